@@ -0,0 +1,124 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "common/object-pool.h"
+#include "exec/hash-table.inline.h"
+#include "exprs/expr.h"
+#include "runtime/mem-pool.h"
+#include "runtime/tuple-row.h"
+#include "util/benchmark.h"
+#include "util/cpu-info.h"
+
+using namespace impala;
+using namespace std;
+
+// Benchmarks the grouping loop of AggregationNode for
+// "select k, count(*), sum(v) from t group by k" over 1M input rows, with k drawn
+// from 10 up to 1M distinct values: for every input row, look up its group in a
+// HashTable and either update the group's agg tuple or create and insert a new one.
+// The agg tuple is laid out like the one AggregationNode would produce
+// (k, count, sum).
+
+static const int NUM_INPUT_ROWS = 1024 * 1024;
+static const int NUM_GROUPS[] = { 10, 1000, 100 * 1000, 1000 * 1000 };
+
+struct InputTuple {
+  int64_t key;
+  int64_t value;
+};
+
+struct AggTuple {
+  int64_t key;
+  int64_t count;
+  int64_t sum;
+};
+
+struct AggregationData {
+  // over AggTuple
+  vector<Expr*> build_exprs;
+  // over InputTuple
+  vector<Expr*> probe_exprs;
+  vector<TupleRow*> input_rows;
+};
+
+static void InitData(ObjectPool* obj_pool, MemPool* mem_pool, int num_groups,
+    AggregationData* data) {
+  data->build_exprs.push_back(obj_pool->Add(new SlotRef(TYPE_BIGINT, 0)));
+  data->probe_exprs.push_back(obj_pool->Add(new SlotRef(TYPE_BIGINT, 0)));
+  RowDescriptor desc;
+  Expr::Prepare(data->build_exprs, NULL, desc);
+  Expr::Prepare(data->probe_exprs, NULL, desc);
+
+  for (int i = 0; i < NUM_INPUT_ROWS; ++i) {
+    TupleRow* row = reinterpret_cast<TupleRow*>(mem_pool->Allocate(sizeof(Tuple*)));
+    InputTuple* tuple =
+        reinterpret_cast<InputTuple*>(mem_pool->Allocate(sizeof(InputTuple)));
+    tuple->key = rand() % num_groups;
+    tuple->value = rand();
+    row->SetTuple(0, reinterpret_cast<Tuple*>(tuple));
+    data->input_rows.push_back(row);
+  }
+}
+
+static void TestAggregation(int batch_size, void* d) {
+  AggregationData* data = reinterpret_cast<AggregationData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    MemPool agg_pool;
+    HashTable table(data->build_exprs, data->probe_exprs, 1, true);
+    for (int j = 0; j < data->input_rows.size(); ++j) {
+      TupleRow* input_row = data->input_rows[j];
+      const InputTuple* input = reinterpret_cast<InputTuple*>(input_row->GetTuple(0));
+      HashTable::Iterator it = table.Find(input_row);
+      AggTuple* agg;
+      if (it != table.End()) {
+        agg = reinterpret_cast<AggTuple*>(it.GetRow()->GetTuple(0));
+      } else {
+        TupleRow* agg_row =
+            reinterpret_cast<TupleRow*>(agg_pool.Allocate(sizeof(Tuple*)));
+        agg = reinterpret_cast<AggTuple*>(agg_pool.Allocate(sizeof(AggTuple)));
+        agg->key = input->key;
+        agg->count = 0;
+        agg->sum = 0;
+        agg_row->SetTuple(0, reinterpret_cast<Tuple*>(agg));
+        table.Insert(agg_row);
+      }
+      ++agg->count;
+      agg->sum += input->value;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  CpuInfo::Init();
+  srand(0);
+  ObjectPool obj_pool;
+  MemPool mem_pool;
+
+  BenchmarkSuite suite("Aggregation");
+  for (int i = 0; i < sizeof(NUM_GROUPS) / sizeof(NUM_GROUPS[0]); ++i) {
+    AggregationData* data = obj_pool.Add(new AggregationData());
+    InitData(&obj_pool, &mem_pool, NUM_GROUPS[i], data);
+    stringstream name;
+    name << "GroupBy groups=" << NUM_GROUPS[i];
+    suite.AddBenchmark(name.str(), TestAggregation, data, NUM_INPUT_ROWS);
+  }
+
+  cout << suite.Measure() << endl;
+  return 0;
+}
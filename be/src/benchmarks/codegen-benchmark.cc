@@ -0,0 +1,163 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
+#include <llvm/Function.h>
+#include <llvm/Transforms/Utils/Cloning.h>
+
+#include "codegen/llvm-codegen.h"
+#include "common/logging.h"
+#include "util/cpu-info.h"
+#include "util/stat-util.h"
+
+using namespace boost;
+using namespace impala;
+using namespace llvm;
+using namespace std;
+
+// Measures where the time to set up codegen for a fragment goes: loading the impala
+// IR module, building the functions, OptimizeModule() and jit compiling.  For each
+// set of operators, every iteration loads a new module, clones the cross compiled
+// functions of those operators and inlines their calls, as the exec nodes do when
+// they build their functions, and then compiles them with CompileModule().  The
+// report has the mean and median ms of each phase (from the LlvmCodeGen profile
+// counters) and the number of functions and instructions that were compiled.
+// The jit cache is not used, so every iteration compiles everything.
+
+DEFINE_int32(iterations, 10, "Number of times to compile each set of functions.");
+
+struct FunctionSet {
+  const char* name;
+  vector<IRFunction::Type> fns;
+};
+
+static const char* PHASES[] = {
+  "LoadTime", "CodegenTime", "OptimizationTime", "JitTime", "CompileTime"
+};
+static const int NUM_PHASES = sizeof(PHASES) / sizeof(PHASES[0]);
+
+static vector<FunctionSet> GetFunctionSets() {
+  IRFunction::Type scan[] = { IRFunction::HDFS_SCANNER_WRITE_ALIGNED_TUPLES };
+  IRFunction::Type agg[] = {
+    IRFunction::AGG_NODE_PROCESS_ROW_BATCH_WITH_GROUPING,
+    IRFunction::AGG_NODE_PROCESS_ROW_BATCH_NO_GROUPING,
+  };
+  IRFunction::Type join[] = {
+    IRFunction::HASH_JOIN_PROCESS_BUILD_BATCH,
+    IRFunction::HASH_JOIN_HASH_PROBE_BATCH,
+    IRFunction::HASH_JOIN_PROCESS_PROBE_BATCH,
+  };
+  vector<FunctionSet> sets(4);
+  sets[0].name = "scan";
+  sets[0].fns.assign(scan, scan + 1);
+  sets[1].name = "agg";
+  sets[1].fns.assign(agg, agg + 2);
+  sets[2].name = "join";
+  sets[2].fns.assign(join, join + 3);
+  sets[3].name = "scan+agg+join";
+  for (int i = 0; i < 3; ++i) {
+    sets[3].fns.insert(sets[3].fns.end(), sets[i].fns.begin(), sets[i].fns.end());
+  }
+  return sets;
+}
+
+// Compiles 'set' once with a new LlvmCodeGen.  Sets phase_ms[i] to the ms spent in
+// PHASES[i] and returns the number of functions and instructions compiled.
+static Status CompileSet(const FunctionSet& set, double* phase_ms,
+    int64_t* num_functions, int64_t* num_instructions) {
+  scoped_ptr<LlvmCodeGen> codegen;
+  RETURN_IF_ERROR(LlvmCodeGen::LoadImpalaIR(&codegen));
+  codegen->EnableOptimizations(true);
+
+  vector<void*> jitted_fns(set.fns.size());
+  {
+    SCOPED_TIMER(codegen->codegen_timer());
+    for (int i = 0; i < set.fns.size(); ++i) {
+      Function* fn = CloneFunction(codegen->GetFunction(set.fns[i]));
+      codegen->module()->getFunctionList().push_back(fn);
+      codegen->InlineAllCallSites(fn, false);
+      fn = codegen->FinalizeFunction(fn);
+      if (fn == NULL) return Status("Could not build a function of " + string(set.name));
+      codegen->AddFunctionToJit(fn, &jitted_fns[i]);
+    }
+  }
+  RETURN_IF_ERROR(codegen->CompileModule());
+
+  RuntimeProfile* profile = codegen->runtime_profile();
+  for (int i = 0; i < NUM_PHASES; ++i) {
+    phase_ms[i] = profile->GetCounter(PHASES[i])->value() /
+        static_cast<double>(CpuInfo::cycles_per_ms());
+  }
+  *num_functions = profile->GetCounter("NumFunctions")->value();
+  *num_instructions = profile->GetCounter("NumInstructions")->value();
+  return Status::OK;
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CpuInfo::Init();
+  LlvmCodeGen::InitializeLlvm();
+
+  // The first load reads the module from disk and caches it; leave that out.
+  {
+    scoped_ptr<LlvmCodeGen> codegen;
+    Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
+    if (!status.ok()) {
+      cerr << "Could not load the impala IR: " << status.GetErrorMsg() << endl;
+      return 1;
+    }
+  }
+
+  vector<FunctionSet> sets = GetFunctionSets();
+  cout << setw(16) << left << "Set" << right << setw(8) << "Fns" << setw(10) << "Instrs";
+  for (int i = 0; i < NUM_PHASES; ++i) cout << setw(24) << PHASES[i];
+  cout << endl << setw(34) << "";
+  for (int i = 0; i < NUM_PHASES; ++i) cout << setw(24) << "mean/p50 (ms)";
+  cout << endl;
+
+  for (int i = 0; i < sets.size(); ++i) {
+    vector<vector<double> > phase_ms(NUM_PHASES, vector<double>(FLAGS_iterations));
+    int64_t num_functions = 0;
+    int64_t num_instructions = 0;
+    for (int j = 0; j < FLAGS_iterations; ++j) {
+      double ms[NUM_PHASES];
+      Status status = CompileSet(sets[i], ms, &num_functions, &num_instructions);
+      if (!status.ok()) {
+        cerr << status.GetErrorMsg() << endl;
+        return 1;
+      }
+      for (int k = 0; k < NUM_PHASES; ++k) phase_ms[k][j] = ms[k];
+    }
+
+    cout << setw(16) << left << sets[i].name << right << setw(8) << num_functions
+         << setw(10) << num_instructions;
+    for (int k = 0; k < NUM_PHASES; ++k) {
+      double mean, stddev;
+      StatUtil::ComputeMeanStddev(&phase_ms[k][0], FLAGS_iterations, &mean, &stddev);
+      double p50 = StatUtil::ComputePercentile(&phase_ms[k][0], FLAGS_iterations, 50);
+      stringstream ss;
+      ss << fixed << setprecision(2) << mean << "/" << p50;
+      cout << setw(24) << ss.str();
+    }
+    cout << endl;
+  }
+  return 0;
+}
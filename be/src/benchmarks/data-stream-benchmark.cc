@@ -0,0 +1,335 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <boost/thread/thread.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "common/object-pool.h"
+#include "runtime/data-stream-mgr.h"
+#include "runtime/data-stream-recvr.h"
+#include "runtime/data-stream-sender.h"
+#include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
+#include "runtime/row-batch.h"
+#include "runtime/runtime-state.h"
+#include "runtime/string-value.h"
+#include "runtime/tuple-row.h"
+#include "util/cpu-info.h"
+#include "util/debug-util.h"
+#include "util/disk-info.h"
+#include "util/histogram.h"
+#include "util/stopwatch.h"
+#include "util/thrift-server.h"
+#include "gen-cpp/ImpalaInternalService.h"
+#include "gen-cpp/Descriptors_types.h"
+
+using namespace boost;
+using namespace impala;
+using namespace std;
+using namespace apache::thrift;
+
+// Measures the throughput of the exchange: --num_senders senders send --num_rows rows
+// each to --num_receivers receivers, through the TransmitData rpcs of a backend in
+// this process (as in runtime/data-stream-test).  The output is either broadcast or
+// hash partitioned on the first bigint column.  Rows have --num_bigint_cols bigint
+// columns and --num_string_cols strings of --string_len characters.  Compression is
+// controlled by --compress_row_batches.
+// The report has the rows/s and bytes/s over all receivers (bytes are counted once
+// per receiver for broadcasts) and, summed over the senders, the time spent
+// serializing batches, in TransmitData rpcs (with their latency percentiles), the cpu
+// time of the send threads and the time the senders waited for their send windows.
+// Example:
+//   data-stream-benchmark --num_senders=4 --num_receivers=4 --num_string_cols=2
+
+DEFINE_int32(num_senders, 2, "Number of senders.");
+DEFINE_int32(num_receivers, 2, "Number of receivers.");
+DEFINE_int64(num_rows, 1024 * 1024, "Number of rows sent by each sender.");
+DEFINE_int32(benchmark_batch_size, 1024, "Rows per batch.");
+DEFINE_int32(num_bigint_cols, 2, "Number of bigint columns per row.");
+DEFINE_int32(num_string_cols, 1, "Number of string columns per row.");
+DEFINE_int32(string_len, 20, "Length of the strings.");
+DEFINE_bool(broadcast, false, "If true, every row is sent to all receivers, otherwise "
+    "the rows are hash partitioned on the first bigint column.");
+DEFINE_int32(channel_buffer_size, 1024 * 1024, "Per channel buffer size of each "
+    "sender, in bytes.");
+DEFINE_int32(recvr_buffer_size, 10 * 1024 * 1024, "Buffer size of each receiver, in "
+    "bytes.");
+
+DECLARE_int32(port);
+DECLARE_bool(compress_row_batches);
+
+static const PlanNodeId DEST_NODE_ID = 1;
+
+class BenchmarkBackend : public ImpalaInternalServiceIf {
+ public:
+  BenchmarkBackend(DataStreamMgr* stream_mgr): mgr_(stream_mgr) {}
+  virtual ~BenchmarkBackend() {}
+
+  virtual void ExecPlanFragment(
+      TExecPlanFragmentResult& return_val, const TExecPlanFragmentParams& params) {}
+
+  virtual void ReportExecStatus(
+      TReportExecStatusResult& return_val, const TReportExecStatusParams& params) {}
+
+  virtual void CancelPlanFragment(
+      TCancelPlanFragmentResult& return_val, const TCancelPlanFragmentParams& params) {}
+
+  virtual void TransmitData(
+      TTransmitDataResult& return_val, const TTransmitDataParams& params) {
+    if (!params.eos) {
+      bool recvr_closed;
+      mgr_->AddData(params.dest_fragment_instance_id, params.dest_node_id,
+                    params.src_fragment_instance_id, params.row_batch, &recvr_closed)
+          .SetTStatus(&return_val);
+      if (recvr_closed) return_val.__set_recvr_closed(true);
+    } else {
+      mgr_->CloseSender(params.dest_fragment_instance_id, params.dest_node_id,
+                        params.src_fragment_instance_id).SetTStatus(&return_val);
+    }
+  }
+
+ private:
+  DataStreamMgr* mgr_;
+};
+
+// Returns a descriptor for rows with a single tuple of the bigint columns followed by
+// the string columns.
+static const RowDescriptor* CreateRowDesc(ObjectPool* pool, DescriptorTbl** desc_tbl) {
+  TDescriptorTable thrift_desc_tbl;
+  int num_cols = FLAGS_num_bigint_cols + FLAGS_num_string_cols;
+  int offset = 0;
+  for (int i = 0; i < num_cols; ++i) {
+    bool is_string = i >= FLAGS_num_bigint_cols;
+    TSlotDescriptor slot_desc;
+    slot_desc.__set_id(i);
+    slot_desc.__set_parent(0);
+    slot_desc.__set_slotType(is_string ? TPrimitiveType::STRING : TPrimitiveType::BIGINT);
+    slot_desc.__set_columnPos(i);
+    slot_desc.__set_byteOffset(offset);
+    slot_desc.__set_nullIndicatorByte(-1);
+    slot_desc.__set_nullIndicatorBit(-1);
+    slot_desc.__set_slotIdx(i);
+    slot_desc.__set_isMaterialized(true);
+    thrift_desc_tbl.slotDescriptors.push_back(slot_desc);
+    offset += is_string ? sizeof(StringValue) : sizeof(int64_t);
+  }
+  TTupleDescriptor tuple_desc;
+  tuple_desc.__set_id(0);
+  tuple_desc.__set_byteSize(offset);
+  tuple_desc.__set_numNullBytes(0);
+  thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+  Status status = DescriptorTbl::Create(pool, thrift_desc_tbl, desc_tbl);
+  CHECK(status.ok()) << status.GetErrorMsg();
+  vector<TTupleId> row_tids(1, 0);
+  vector<bool> nullable_tuples(1, false);
+  return pool->Add(new RowDescriptor(**desc_tbl, row_tids, nullable_tuples));
+}
+
+// Fills a batch with random rows.  Every sender sends the same batch over and over,
+// which doesn't matter for the exchange.
+static RowBatch* CreateBatch(ObjectPool* pool, const RowDescriptor& row_desc) {
+  int tuple_size = row_desc.tuple_descriptors()[0]->byte_size();
+  RowBatch* batch = pool->Add(new RowBatch(row_desc, FLAGS_benchmark_batch_size));
+  MemPool* data_pool = batch->tuple_data_pool();
+  for (int i = 0; i < FLAGS_benchmark_batch_size; ++i) {
+    uint8_t* tuple = data_pool->Allocate(tuple_size);
+    int64_t* bigints = reinterpret_cast<int64_t*>(tuple);
+    for (int j = 0; j < FLAGS_num_bigint_cols; ++j) {
+      bigints[j] = (static_cast<int64_t>(rand()) << 32) | rand();
+    }
+    StringValue* strings =
+        reinterpret_cast<StringValue*>(bigints + FLAGS_num_bigint_cols);
+    for (int j = 0; j < FLAGS_num_string_cols; ++j) {
+      strings[j].len = FLAGS_string_len;
+      strings[j].ptr = reinterpret_cast<char*>(data_pool->Allocate(FLAGS_string_len));
+      for (int k = 0; k < FLAGS_string_len; ++k) {
+        strings[j].ptr[k] = 'a' + rand() % 26;
+      }
+    }
+    int idx = batch->AddRow();
+    batch->GetRow(idx)->SetTuple(0, reinterpret_cast<Tuple*>(tuple));
+    batch->CommitLastRow();
+  }
+  return batch;
+}
+
+static TDataStreamSink CreateSink() {
+  TDataStreamSink sink;
+  sink.dest_node_id = DEST_NODE_ID;
+  if (FLAGS_broadcast) {
+    sink.output_partition.type = TPartitionType::UNPARTITIONED;
+    return sink;
+  }
+  TExprNode slot_ref;
+  slot_ref.node_type = TExprNodeType::SLOT_REF;
+  slot_ref.type = TPrimitiveType::BIGINT;
+  slot_ref.num_children = 0;
+  slot_ref.__isset.slot_ref = true;
+  slot_ref.slot_ref.slot_id = 0;
+  TExpr expr;
+  expr.nodes.push_back(slot_ref);
+  sink.output_partition.type = TPartitionType::HASH_PARTITIONED;
+  sink.output_partition.__isset.partitioning_exprs = true;
+  sink.output_partition.partitioning_exprs.push_back(expr);
+  return sink;
+}
+
+struct SenderInfo {
+  RuntimeState state;
+  Status status;
+  int64_t num_bytes_sent;
+
+  SenderInfo() : num_bytes_sent(0) {}
+};
+
+static void Sender(const RowDescriptor* row_desc, DescriptorTbl* desc_tbl,
+    RowBatch* batch, const TDataStreamSink* sink,
+    const vector<TPlanFragmentDestination>* dests, int sender_num, SenderInfo* info) {
+  TUniqueId sender_id;
+  sender_id.hi = 1;
+  sender_id.lo = sender_num;
+  info->state.set_desc_tbl(desc_tbl);
+  DataStreamSender sender(*row_desc, sender_id, *sink, *dests,
+      FLAGS_channel_buffer_size);
+  info->status = sender.Init(&info->state);
+  if (!info->status.ok()) return;
+  for (int64_t num_rows = 0; num_rows < FLAGS_num_rows; num_rows += batch->num_rows()) {
+    info->status = sender.Send(&info->state, batch);
+    if (!info->status.ok()) return;
+  }
+  info->status = sender.Close(&info->state);
+  info->num_bytes_sent = sender.GetNumDataBytesSent();
+}
+
+static void Receiver(DataStreamRecvr* recvr, int64_t* num_rows) {
+  bool is_cancelled;
+  RowBatch* batch;
+  while ((batch = recvr->GetBatch(&is_cancelled)) != NULL && !is_cancelled) {
+    *num_rows += batch->num_rows();
+  }
+}
+
+// Returns the sum of the values of the counters 'name' in the senders' profiles.
+static int64_t SumCounters(const vector<SenderInfo*>& senders, const string& name) {
+  int64_t sum = 0;
+  for (int i = 0; i < senders.size(); ++i) {
+    RuntimeProfile::Counter* counter =
+        senders[i]->state.runtime_profile()->GetCounter(name);
+    if (counter != NULL) sum += counter->value();
+  }
+  return sum;
+}
+
+static string PrintTicks(int64_t ticks) {
+  return PrettyPrinter::Print(ticks, TCounterType::CPU_TICKS);
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CpuInfo::Init();
+  DiskInfo::Init();
+  srand(0);
+  if (!FLAGS_broadcast && FLAGS_num_bigint_cols == 0) {
+    cerr << "Hash partitioning needs --num_bigint_cols > 0" << endl;
+    return 1;
+  }
+
+  ObjectPool pool;
+  DescriptorTbl* desc_tbl;
+  const RowDescriptor* row_desc = CreateRowDesc(&pool, &desc_tbl);
+  RowBatch* batch = CreateBatch(&pool, *row_desc);
+  TDataStreamSink sink = CreateSink();
+
+  DataStreamMgr stream_mgr;
+  shared_ptr<BenchmarkBackend> handler(new BenchmarkBackend(&stream_mgr));
+  shared_ptr<TProcessor> processor(new ImpalaInternalServiceProcessor(handler));
+  ThriftServer server("DataStreamBenchmark backend", processor, FLAGS_port);
+  server.Start();
+
+  vector<TPlanFragmentDestination> dests(FLAGS_num_receivers);
+  vector<DataStreamRecvr*> recvrs(FLAGS_num_receivers);
+  vector<int64_t> rows_received(FLAGS_num_receivers);
+  for (int i = 0; i < FLAGS_num_receivers; ++i) {
+    dests[i].fragment_instance_id.hi = 0;
+    dests[i].fragment_instance_id.lo = i;
+    dests[i].server.ipaddress = "127.0.0.1";
+    dests[i].server.port = FLAGS_port;
+    recvrs[i] = stream_mgr.CreateRecvr(*row_desc, dests[i].fragment_instance_id,
+        DEST_NODE_ID, FLAGS_num_senders, FLAGS_recvr_buffer_size);
+  }
+
+  WallClockStopWatch timer;
+  timer.Start();
+  thread_group threads;
+  for (int i = 0; i < FLAGS_num_receivers; ++i) {
+    threads.add_thread(new thread(Receiver, recvrs[i], &rows_received[i]));
+  }
+  vector<SenderInfo*> senders;
+  for (int i = 0; i < FLAGS_num_senders; ++i) {
+    senders.push_back(pool.Add(new SenderInfo()));
+    threads.add_thread(new thread(Sender, row_desc, desc_tbl, batch, &sink, &dests, i,
+        senders.back()));
+  }
+  threads.join_all();
+  timer.Stop();
+  int64_t elapsed_ms = max<int64_t>(timer.ElapsedTime(), 1);
+
+  int64_t total_rows = 0;
+  for (int i = 0; i < FLAGS_num_receivers; ++i) {
+    total_rows += rows_received[i];
+    delete recvrs[i];
+  }
+  int64_t total_bytes = 0;
+  Histogram rpc_times(TCounterType::CPU_TICKS);
+  for (int i = 0; i < senders.size(); ++i) {
+    CHECK(senders[i]->status.ok()) << senders[i]->status.GetErrorMsg();
+    total_bytes += senders[i]->num_bytes_sent;
+    rpc_times.Merge(
+        *senders[i]->state.runtime_profile()->GetHistogram("TransmitDataRpcTime"));
+  }
+
+  cout << "Senders: " << FLAGS_num_senders << " Receivers: " << FLAGS_num_receivers
+       << (FLAGS_broadcast ? " broadcast" : " hash partitioned")
+       << " Row: " << FLAGS_num_bigint_cols << " bigints, " << FLAGS_num_string_cols
+       << " strings of " << FLAGS_string_len
+       << " Batch size: " << FLAGS_benchmark_batch_size
+       << (FLAGS_compress_row_batches ? " compressed" : " uncompressed") << endl;
+  cout << "Received " << total_rows << " rows, "
+       << PrettyPrinter::Print(total_bytes, TCounterType::BYTES) << " in "
+       << PrettyPrinter::Print(elapsed_ms, TCounterType::TIME_MS) << endl;
+  cout << setprecision(4)
+       << "Throughput: " << total_rows * 1000.0 / elapsed_ms << " rows/s, "
+       << total_bytes / 1024.0 / 1024 * 1000 / elapsed_ms << " MB/s" << endl;
+  cout << "Summed over the senders:" << endl
+       << "  Serialization: " << PrintTicks(SumCounters(senders, "SerializeBatchTime"))
+       << endl
+       << "  TransmitData rpcs: " << rpc_times.count() << " taking "
+       << PrintTicks(rpc_times.sum()) << " (p50="
+       << PrintTicks(rpc_times.GetPercentile(50)) << " p99="
+       << PrintTicks(rpc_times.GetPercentile(99)) << ")" << endl
+       << "  Send thread cpu: "
+       << PrintTicks(SumCounters(senders, "SendThreadsUserTime") +
+              SumCounters(senders, "SendThreadsSysTime")) << endl
+       << "  Waiting for send windows: "
+       << PrintTicks(SumCounters(senders, "SenderWaitTime")) << endl;
+
+  server.StopForTesting();
+  return 0;
+}
@@ -0,0 +1,221 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/thread.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "runtime/disk-io-mgr.h"
+#include "runtime/hdfs-fs-cache.h"
+#include "util/cpu-info.h"
+#include "util/debug-util.h"
+#include "util/disk-info.h"
+#include "util/metrics.h"
+#include "util/non-primitive-metrics.h"
+#include "util/stopwatch.h"
+
+using namespace boost;
+using namespace impala;
+using namespace std;
+
+// Measures the read throughput of the io mgr, to tune --num_disks,
+// --num_threads_per_disk and --read_size for a machine.  Unlike
+// runtime/disk-io-mgr-stress-test, which reads small generated files to check the
+// results, this reads existing files, which should be large (>= 1GB) and, for local
+// files, not in the os page cache (e.g. drop it with
+// "echo 3 > /proc/sys/vm/drop_caches" first).
+// Each reader reads whole files, one after the other, until --duration_sec is over.
+// The report has the MB/s over all readers, the cpu time of the process per GB read
+// and, for every disk queue that was used, the read latency percentiles.
+// Example:
+//   disk-io-mgr-benchmark --files=/data/1/f,/data/2/f --num_readers=4 \
+//       --num_threads_per_disk=2 --read_size=1048576
+
+DEFINE_string(files, "", "Comma separated list of the files to read. With --use_hdfs "
+    "these are paths in the default hdfs file system, otherwise local paths.");
+DEFINE_bool(use_hdfs, false, "If true, the files are read through hdfs.");
+DEFINE_int32(num_readers, 4, "Number of concurrent readers.");
+DEFINE_int32(buffers_per_disk, 3, "Number of io buffers per disk for each reader.");
+DEFINE_int32(duration_sec, 10, "Time to read for.");
+
+DECLARE_int32(num_disks);
+DECLARE_int32(num_threads_per_disk);
+DECLARE_int32(read_size);
+
+struct BenchmarkFile {
+  string path;
+  int64_t len;
+  int disk_id;
+};
+
+class DiskIoMgrBenchmark {
+ public:
+  DiskIoMgrBenchmark(DiskIoMgr* io_mgr, hdfsFS hdfs, const vector<BenchmarkFile>& files)
+    : io_mgr_(io_mgr), hdfs_(hdfs), files_(files), next_file_idx_(0),
+      bytes_read_(0), done_(false) {
+  }
+
+  // Runs the readers for 'sec' seconds and returns the elapsed wall clock time in ms.
+  int64_t Run(int num_readers, int sec) {
+    WallClockStopWatch timer;
+    timer.Start();
+    thread_group readers;
+    for (int i = 0; i < num_readers; ++i) {
+      readers.add_thread(new thread(&DiskIoMgrBenchmark::ReaderThread, this));
+    }
+    sleep(sec);
+    done_ = true;
+    readers.join_all();
+    timer.Stop();
+    return timer.ElapsedTime();
+  }
+
+  int64_t bytes_read() const { return bytes_read_; }
+
+ private:
+  DiskIoMgr* io_mgr_;
+  hdfsFS hdfs_;
+  const vector<BenchmarkFile>& files_;
+  int next_file_idx_;
+  int64_t bytes_read_;
+  volatile bool done_;
+
+  // Reads the next file with a reader of its own until all files have been read
+  // once by some reader, then starts over.
+  void ReaderThread() {
+    while (!done_) {
+      const BenchmarkFile& file =
+          files_[__sync_fetch_and_add(&next_file_idx_, 1) % files_.size()];
+      DiskIoMgr::ReaderContext* reader;
+      Status status = io_mgr_->RegisterReader(hdfs_, FLAGS_buffers_per_disk, &reader);
+      CHECK(status.ok()) << status.GetErrorMsg();
+      DiskIoMgr::ScanRange range;
+      range.Reset(file.path.c_str(), file.len, 0, file.disk_id);
+      vector<DiskIoMgr::ScanRange*> ranges(1, &range);
+      status = io_mgr_->AddScanRanges(reader, ranges);
+      CHECK(status.ok()) << status.GetErrorMsg();
+
+      bool eos = false;
+      while (!eos && !done_) {
+        DiskIoMgr::BufferDescriptor* buffer;
+        status = io_mgr_->GetNext(reader, &buffer, &eos);
+        CHECK(status.ok()) << file.path << ": " << status.GetErrorMsg();
+        if (buffer == NULL) continue;
+        __sync_fetch_and_add(&bytes_read_, buffer->len());
+        buffer->Return();
+      }
+      io_mgr_->UnregisterReader(reader);
+    }
+  }
+};
+
+// Returns the user + system cpu time of the process in ms.
+static int64_t ProcessCpuMillis() {
+  rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000L +
+      (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000L;
+}
+
+// Looks up the length of each file in --files and the disk it is on.  Hdfs files
+// aren't on a known local disk; they are spread over the disk queues round robin,
+// as HdfsScanNode does.
+static vector<BenchmarkFile> GetFiles(hdfsFS hdfs, int num_disks) {
+  vector<string> paths;
+  split(paths, FLAGS_files, is_any_of(","), token_compress_on);
+  vector<BenchmarkFile> files;
+  for (int i = 0; i < paths.size(); ++i) {
+    BenchmarkFile file;
+    file.path = paths[i];
+    if (hdfs != NULL) {
+      hdfsFileInfo* info = hdfsGetPathInfo(hdfs, file.path.c_str());
+      CHECK(info != NULL) << "Could not stat " << file.path;
+      file.len = info->mSize;
+      hdfsFreeFileInfo(info, 1);
+      file.disk_id = i % num_disks;
+    } else {
+      struct stat info;
+      CHECK_EQ(stat(file.path.c_str(), &info), 0) << "Could not stat " << file.path;
+      file.len = info.st_size;
+      file.disk_id = DiskInfo::disk_id(file.path.c_str()) % num_disks;
+    }
+    if (file.len > 0) files.push_back(file);
+  }
+  return files;
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  google::InitGoogleLogging(argv[0]);
+  CpuInfo::Init();
+  DiskInfo::Init();
+  if (FLAGS_files.empty()) {
+    cerr << "--files is required" << endl;
+    return 1;
+  }
+
+  HdfsFsCache fs_cache;
+  hdfsFS hdfs = FLAGS_use_hdfs ? fs_cache.GetDefaultConnection() : NULL;
+  Metrics metrics;
+  DiskIoMgr io_mgr(FLAGS_num_disks, FLAGS_num_threads_per_disk, FLAGS_read_size);
+  Status status = io_mgr.Init(NULL, &metrics);
+  CHECK(status.ok()) << status.GetErrorMsg();
+
+  vector<BenchmarkFile> files = GetFiles(hdfs, io_mgr.num_disks());
+  if (files.empty()) {
+    cerr << "No non-empty files in --files" << endl;
+    return 1;
+  }
+
+  DiskIoMgrBenchmark benchmark(&io_mgr, hdfs, files);
+  int64_t start_cpu_ms = ProcessCpuMillis();
+  int64_t elapsed_ms = benchmark.Run(FLAGS_num_readers, FLAGS_duration_sec);
+  int64_t cpu_ms = ProcessCpuMillis() - start_cpu_ms;
+  double gb_read = benchmark.bytes_read() / (1024.0 * 1024 * 1024);
+
+  cout << "Disks: " << io_mgr.num_disks()
+       << " Threads per disk: " << FLAGS_num_threads_per_disk
+       << " Read size: " << PrettyPrinter::Print(FLAGS_read_size, TCounterType::BYTES)
+       << " Readers: " << FLAGS_num_readers
+       << " Buffers per disk: " << FLAGS_buffers_per_disk << endl;
+  cout << "Read " << PrettyPrinter::Print(benchmark.bytes_read(), TCounterType::BYTES)
+       << " in " << PrettyPrinter::Print(elapsed_ms, TCounterType::TIME_MS) << endl;
+  cout << setprecision(4)
+       << "Throughput: " << benchmark.bytes_read() / 1024.0 / 1024 / elapsed_ms * 1000
+       << " MB/s" << endl;
+  if (gb_read > 0) cout << "Cpu per GB: " << cpu_ms / gb_read << " ms" << endl;
+
+  cout << "Read latency per disk (us):" << endl;
+  for (int i = 0; i < io_mgr.num_disks(); ++i) {
+    stringstream key;
+    key << "disk-io-mgr.disk-" << i << ".read-latency-us";
+    HistogramMetric* metric = metrics.GetMetric<HistogramMetric>(key.str());
+    if (metric == NULL) continue;
+    Histogram latency = metric->value();
+    if (latency.count() == 0) continue;
+    cout << "  disk " << i << ": reads=" << latency.count()
+         << " p50=" << latency.GetPercentile(50)
+         << " p95=" << latency.GetPercentile(95)
+         << " p99=" << latency.GetPercentile(99)
+         << " max=" << latency.max_value() << endl;
+  }
+  return 0;
+}
@@ -0,0 +1,134 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#include "common/object-pool.h"
+#include "exec/hash-table.inline.h"
+#include "exprs/expr.h"
+#include "runtime/mem-pool.h"
+#include "runtime/tuple-row.h"
+#include "util/benchmark.h"
+#include "util/cpu-info.h"
+
+using namespace impala;
+using namespace std;
+
+// Benchmarks HashTable::Insert() (building a table from scratch) and
+// HashTable::Find() (half of the probes hit) for keys of 1, 2 and 4 bigint columns and
+// tables of 1K (fits in L1/L2), 64K (L3) and 1M rows (main memory).
+// Rows have a single tuple with all key columns.
+
+struct HashTableData {
+  vector<Expr*> build_exprs;
+  vector<Expr*> probe_exprs;
+  vector<TupleRow*> build_rows;
+  vector<TupleRow*> probe_rows;
+  // for the probe benchmark, contains build_rows
+  HashTable* table;
+};
+
+static const int TABLE_SIZES[] = { 1024, 64 * 1024, 1024 * 1024 };
+static const int KEY_WIDTHS[] = { 1, 2, 4 };
+
+// Creates a row with 'num_cols' bigint columns; column i is key + i.
+static TupleRow* CreateRow(MemPool* pool, int num_cols, int64_t key) {
+  TupleRow* row = reinterpret_cast<TupleRow*>(pool->Allocate(sizeof(Tuple*)));
+  int64_t* tuple = reinterpret_cast<int64_t*>(pool->Allocate(num_cols * sizeof(int64_t)));
+  for (int i = 0; i < num_cols; ++i) {
+    tuple[i] = key + i;
+  }
+  row->SetTuple(0, reinterpret_cast<Tuple*>(tuple));
+  return row;
+}
+
+static void InitData(ObjectPool* obj_pool, MemPool* mem_pool, int num_cols,
+    int num_rows, HashTableData* data) {
+  for (int i = 0; i < num_cols; ++i) {
+    int offset = i * sizeof(int64_t);
+    data->build_exprs.push_back(obj_pool->Add(new SlotRef(TYPE_BIGINT, offset)));
+    data->probe_exprs.push_back(obj_pool->Add(new SlotRef(TYPE_BIGINT, offset)));
+  }
+  RowDescriptor desc;
+  Expr::Prepare(data->build_exprs, NULL, desc);
+  Expr::Prepare(data->probe_exprs, NULL, desc);
+
+  // distinct build keys in random order; probe keys are from twice the range
+  for (int i = 0; i < num_rows; ++i) {
+    int64_t key = (static_cast<int64_t>(rand()) * num_rows + i) * 2;
+    data->build_rows.push_back(CreateRow(mem_pool, num_cols, key));
+  }
+  for (int i = 0; i < num_rows; ++i) {
+    int64_t key = *reinterpret_cast<int64_t*>(
+        data->build_rows[rand() % num_rows]->GetTuple(0));
+    data->probe_rows.push_back(CreateRow(mem_pool, num_cols, key + rand() % 2));
+  }
+
+  data->table = obj_pool->Add(
+      new HashTable(data->build_exprs, data->probe_exprs, 1, false));
+  for (int i = 0; i < num_rows; ++i) {
+    data->table->Insert(data->build_rows[i]);
+  }
+}
+
+static void TestInsert(int batch_size, void* d) {
+  HashTableData* data = reinterpret_cast<HashTableData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    HashTable table(data->build_exprs, data->probe_exprs, 1, false);
+    for (int j = 0; j < data->build_rows.size(); ++j) {
+      table.Insert(data->build_rows[j]);
+    }
+  }
+}
+
+static int64_t num_matches = 0;
+
+static void TestProbe(int batch_size, void* d) {
+  HashTableData* data = reinterpret_cast<HashTableData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    for (int j = 0; j < data->probe_rows.size(); ++j) {
+      HashTable::Iterator it = data->table->Find(data->probe_rows[j]);
+      // make sure the probe isn't optimized away
+      if (it != data->table->End()) ++num_matches;
+    }
+  }
+}
+
+int main(int argc, char** argv) {
+  CpuInfo::Init();
+  srand(0);
+  ObjectPool obj_pool;
+  MemPool mem_pool;
+
+  BenchmarkSuite suite("HashTable");
+  int num_sizes = sizeof(TABLE_SIZES) / sizeof(TABLE_SIZES[0]);
+  int num_widths = sizeof(KEY_WIDTHS) / sizeof(KEY_WIDTHS[0]);
+  vector<HashTableData*> all_data;
+  for (int i = 0; i < num_widths; ++i) {
+    for (int j = 0; j < num_sizes; ++j) {
+      HashTableData* data = obj_pool.Add(new HashTableData());
+      InitData(&obj_pool, &mem_pool, KEY_WIDTHS[i], TABLE_SIZES[j], data);
+      stringstream suffix;
+      suffix << " keys=" << KEY_WIDTHS[i] << "xbigint rows=" << TABLE_SIZES[j];
+      suite.AddBenchmark("Insert" + suffix.str(), TestInsert, data, TABLE_SIZES[j]);
+      suite.AddBenchmark("Probe" + suffix.str(), TestProbe, data, TABLE_SIZES[j]);
+    }
+  }
+
+  cout << suite.Measure() << endl;
+  return 0;
+}
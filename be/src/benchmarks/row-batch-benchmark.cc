@@ -0,0 +1,145 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iostream>
+#include <string>
+#include <gflags/gflags.h>
+
+#include "common/object-pool.h"
+#include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
+#include "runtime/row-batch.h"
+#include "runtime/string-value.h"
+#include "runtime/tuple-row.h"
+#include "util/benchmark.h"
+#include "util/cpu-info.h"
+
+#include "gen-cpp/Data_types.h"
+#include "gen-cpp/Descriptors_types.h"
+
+DECLARE_bool(compress_row_batches);
+
+using namespace impala;
+using namespace std;
+
+// Benchmarks RowBatch::Serialize() and deserialization (the RowBatch c'tor from a
+// TRowBatch), with and without compression, for a batch of 1024 rows of
+// (bigint, int, string), where the strings are 10 to 30 characters from a small
+// alphabet.  This is what each exchange does per row batch.
+
+static const int NUM_ROWS = 1024;
+
+struct RowBatchData {
+  const RowDescriptor* row_desc;
+  RowBatch* batch;
+  bool compress;
+  TRowBatch serialized_batch;
+};
+
+static void AddSlot(int id, TPrimitiveType::type type, int offset,
+    TDescriptorTable* desc_tbl) {
+  TSlotDescriptor slot_desc;
+  slot_desc.__set_id(id);
+  slot_desc.__set_parent(0);
+  slot_desc.__set_slotType(type);
+  slot_desc.__set_columnPos(id);
+  slot_desc.__set_byteOffset(offset);
+  slot_desc.__set_nullIndicatorByte(-1);
+  slot_desc.__set_nullIndicatorBit(-1);
+  slot_desc.__set_slotIdx(id);
+  slot_desc.__set_isMaterialized(true);
+  desc_tbl->slotDescriptors.push_back(slot_desc);
+}
+
+// Returns a descriptor for rows with one (bigint, int, string) tuple.
+static const RowDescriptor* CreateRowDesc(ObjectPool* pool) {
+  TDescriptorTable thrift_desc_tbl;
+  TTupleDescriptor tuple_desc;
+  tuple_desc.__set_id(0);
+  tuple_desc.__set_byteSize(16 + sizeof(StringValue));
+  tuple_desc.__set_numNullBytes(0);
+  thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+  AddSlot(0, TPrimitiveType::BIGINT, 0, &thrift_desc_tbl);
+  AddSlot(1, TPrimitiveType::INT, 8, &thrift_desc_tbl);
+  AddSlot(2, TPrimitiveType::STRING, 16, &thrift_desc_tbl);
+  DescriptorTbl* desc_tbl;
+  Status status = DescriptorTbl::Create(pool, thrift_desc_tbl, &desc_tbl);
+  DCHECK(status.ok());
+  vector<TTupleId> row_tids(1, 0);
+  vector<bool> nullable_tuples(1, false);
+  return pool->Add(new RowDescriptor(*desc_tbl, row_tids, nullable_tuples));
+}
+
+static RowBatch* CreateBatch(ObjectPool* pool, const RowDescriptor& row_desc) {
+  RowBatch* batch = pool->Add(new RowBatch(row_desc, NUM_ROWS));
+  MemPool* data_pool = batch->tuple_data_pool();
+  for (int i = 0; i < NUM_ROWS; ++i) {
+    uint8_t* tuple = data_pool->Allocate(16 + sizeof(StringValue));
+    *reinterpret_cast<int64_t*>(tuple) = rand();
+    *reinterpret_cast<int32_t*>(tuple + 8) = rand() % 1000;
+    StringValue* str = reinterpret_cast<StringValue*>(tuple + 16);
+    str->len = 10 + rand() % 21;
+    str->ptr = reinterpret_cast<char*>(data_pool->Allocate(str->len));
+    for (int j = 0; j < str->len; ++j) {
+      str->ptr[j] = 'a' + rand() % 8;
+    }
+    int idx = batch->AddRow();
+    batch->GetRow(idx)->SetTuple(0, reinterpret_cast<Tuple*>(tuple));
+    batch->CommitLastRow();
+  }
+  return batch;
+}
+
+static void TestSerialize(int batch_size, void* d) {
+  RowBatchData* data = reinterpret_cast<RowBatchData*>(d);
+  FLAGS_compress_row_batches = data->compress;
+  for (int i = 0; i < batch_size; ++i) {
+    TRowBatch output_batch;
+    data->batch->Serialize(&output_batch);
+  }
+}
+
+static void TestDeserialize(int batch_size, void* d) {
+  RowBatchData* data = reinterpret_cast<RowBatchData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    RowBatch batch(*data->row_desc, data->serialized_batch);
+  }
+}
+
+int main(int argc, char** argv) {
+  google::ParseCommandLineFlags(&argc, &argv, true);
+  CpuInfo::Init();
+  srand(0);
+  ObjectPool pool;
+
+  const RowDescriptor* row_desc = CreateRowDesc(&pool);
+  RowBatch* batch = CreateBatch(&pool, *row_desc);
+
+  BenchmarkSuite suite("RowBatch");
+  for (int compress = 0; compress <= 1; ++compress) {
+    RowBatchData* data = pool.Add(new RowBatchData());
+    data->row_desc = row_desc;
+    data->batch = batch;
+    data->compress = compress;
+    FLAGS_compress_row_batches = compress;
+    batch->Serialize(&data->serialized_batch);
+    string suffix = compress ? " (compressed)" : " (uncompressed)";
+    suite.AddBenchmark("Serialize" + suffix, TestSerialize, data, NUM_ROWS);
+    suite.AddBenchmark("Deserialize" + suffix, TestDeserialize, data, NUM_ROWS);
+  }
+
+  cout << suite.Measure() << endl;
+  return 0;
+}
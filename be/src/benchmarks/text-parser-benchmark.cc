@@ -0,0 +1,231 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "common/object-pool.h"
+#include "exec/delimited-text-parser.inline.h"
+#include "exec/text-converter.inline.h"
+#include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
+#include "runtime/string-value.h"
+#include "runtime/tuple.h"
+#include "util/benchmark.h"
+#include "util/cpu-info.h"
+
+#include "gen-cpp/Descriptors_types.h"
+
+using namespace impala;
+using namespace std;
+
+// Benchmarks the two steps of the text scanner on generated data:
+//  - DelimitedTextParser::ParseFieldLocations() over a buffer of '|' delimited rows,
+//    with 4, 16 or 64 short columns, long strings, or escaped delimiters.  Each case
+//    runs with AVX2 (if the cpu has it), with only SSE4.2 and with neither, by
+//    turning the cpu features off with CpuInfo::EnableFeature().
+//  - TextConverter::WriteSlot() for int and string fields.
+// Every iteration processes one buffer and the rows per iteration are the bytes in
+// the buffer, so "Rows/sec" in the tables is bytes/sec and the per row counters are
+// per byte.
+
+static const int BUFFER_LEN = 256 * 1024;
+static const int MAX_TUPLES = 1024;
+static const char TUPLE_DELIM = '\n';
+static const char FIELD_DELIM = '|';
+static const char ESCAPE_CHAR = '\\';
+
+struct ParserData {
+  DelimitedTextParser* parser;
+  string buffer;
+  // CpuInfo features to run with.
+  int64_t cpu_flags;
+  vector<FieldLocation> field_locations;
+  vector<char*> row_end_locations;
+};
+
+struct ConverterData {
+  TextConverter* converter;
+  const SlotDescriptor* slot_desc;
+  Tuple* tuple;
+  MemPool* pool;
+  string buffer;
+  vector<FieldLocation> fields;
+};
+
+// Returns rows of 'num_cols' fields of min_len to max_len random characters, up to
+// BUFFER_LEN bytes.  If 'escape_pct' > 0, that percentage of the fields contain an
+// escaped field delimiter.
+static string GenerateText(int num_cols, int min_len, int max_len, int escape_pct) {
+  stringstream ss;
+  while (ss.tellp() < BUFFER_LEN) {
+    for (int i = 0; i < num_cols; ++i) {
+      if (i > 0) ss << FIELD_DELIM;
+      int len = min_len + rand() % (max_len - min_len + 1);
+      for (int j = 0; j < len; ++j) {
+        ss << static_cast<char>('a' + rand() % 26);
+      }
+      if (rand() % 100 < escape_pct) ss << ESCAPE_CHAR << FIELD_DELIM;
+    }
+    ss << TUPLE_DELIM;
+  }
+  return ss.str();
+}
+
+static void SetCpuFeatures(int64_t flags) {
+  CpuInfo::EnableFeature(CpuInfo::AVX2, (flags & CpuInfo::AVX2) != 0);
+  CpuInfo::EnableFeature(CpuInfo::SSE4_2, (flags & CpuInfo::SSE4_2) != 0);
+}
+
+static void TestParse(int batch_size, void* d) {
+  ParserData* data = reinterpret_cast<ParserData*>(d);
+  SetCpuFeatures(data->cpu_flags);
+  for (int i = 0; i < batch_size; ++i) {
+    data->parser->ParserReset();
+    char* buffer = &data->buffer[0];
+    char* buffer_end = buffer + data->buffer.size();
+    while (buffer < buffer_end) {
+      int num_tuples = 0;
+      int num_fields = 0;
+      char* col_start;
+      Status status = data->parser->ParseFieldLocations(MAX_TUPLES,
+          buffer_end - buffer, &buffer, &data->row_end_locations[0],
+          &data->field_locations[0], &num_tuples, &num_fields, &col_start);
+      DCHECK(status.ok());
+    }
+  }
+}
+
+static void TestWriteSlot(int batch_size, void* d) {
+  ConverterData* data = reinterpret_cast<ConverterData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    for (int j = 0; j < data->fields.size(); ++j) {
+      data->converter->WriteSlot(data->slot_desc, data->tuple,
+          data->fields[j].start, data->fields[j].len, false, false, data->pool);
+    }
+  }
+}
+
+static void AddParserBenchmarks(ObjectPool* pool, const string& name, int num_cols,
+    int min_len, int max_len, int escape_pct) {
+  string buffer = GenerateText(num_cols, min_len, max_len, escape_pct);
+  char escape_char = escape_pct > 0 ? ESCAPE_CHAR : '\0';
+  vector<bool> is_materialized_col(num_cols, true);
+  int64_t hardware_flags = CpuInfo::hardware_flags();
+
+  const int64_t variants[] = { CpuInfo::AVX2 | CpuInfo::SSE4_2, CpuInfo::SSE4_2, 0 };
+  const char* variant_names[] = { "AVX2", "SSE4.2", "No SSE" };
+  BenchmarkSuite suite("Parse " + name);
+  for (int i = 0; i < 3; ++i) {
+    if ((hardware_flags & variants[i]) != variants[i]) continue;
+    ParserData* data = pool->Add(new ParserData());
+    data->parser = pool->Add(new DelimitedTextParser(num_cols, 0, is_materialized_col,
+        TUPLE_DELIM, FIELD_DELIM, '\0', escape_char));
+    data->buffer = buffer;
+    data->cpu_flags = variants[i];
+    data->field_locations.resize(MAX_TUPLES * num_cols);
+    data->row_end_locations.resize(MAX_TUPLES);
+    suite.AddBenchmark(variant_names[i], TestParse, data, buffer.size());
+  }
+  cout << suite.Measure() << endl;
+  SetCpuFeatures(hardware_flags);
+}
+
+// Returns a tuple descriptor for a tuple with one slot of 'type'.
+static const TupleDescriptor* CreateTupleDesc(ObjectPool* pool,
+    TPrimitiveType::type type) {
+  TDescriptorTable thrift_desc_tbl;
+  TTupleDescriptor tuple_desc;
+  tuple_desc.__set_id(0);
+  tuple_desc.__set_byteSize(8 + sizeof(StringValue));
+  tuple_desc.__set_numNullBytes(1);
+  thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+  TSlotDescriptor slot_desc;
+  slot_desc.__set_id(0);
+  slot_desc.__set_parent(0);
+  slot_desc.__set_slotType(type);
+  slot_desc.__set_columnPos(0);
+  slot_desc.__set_byteOffset(8);
+  slot_desc.__set_nullIndicatorByte(0);
+  slot_desc.__set_nullIndicatorBit(0);
+  slot_desc.__set_slotIdx(0);
+  slot_desc.__set_isMaterialized(true);
+  thrift_desc_tbl.slotDescriptors.push_back(slot_desc);
+  DescriptorTbl* desc_tbl;
+  Status status = DescriptorTbl::Create(pool, thrift_desc_tbl, &desc_tbl);
+  DCHECK(status.ok());
+  return desc_tbl->GetTupleDescriptor(0);
+}
+
+// Adds a benchmark that converts the fields of a buffer of values from 'gen'.
+static void AddConverterBenchmark(ObjectPool* pool, MemPool* mem_pool,
+    BenchmarkSuite* suite, const string& name, TPrimitiveType::type type,
+    string (*gen)()) {
+  ConverterData* data = pool->Add(new ConverterData());
+  data->converter = pool->Add(new TextConverter('\0'));
+  const TupleDescriptor* tuple_desc = CreateTupleDesc(pool, type);
+  data->slot_desc = tuple_desc->slots()[0];
+  data->tuple = Tuple::Create(tuple_desc->byte_size(), mem_pool);
+  data->pool = mem_pool;
+  while (data->buffer.size() < BUFFER_LEN) {
+    data->buffer += gen();
+    data->buffer += FIELD_DELIM;
+  }
+  // Field boundaries are taken after the buffer is complete so they can't be
+  // invalidated by a reallocation.
+  char* start = &data->buffer[0];
+  for (int i = 0; i < data->buffer.size(); ++i) {
+    if (data->buffer[i] != FIELD_DELIM) continue;
+    FieldLocation field;
+    field.start = start;
+    field.len = &data->buffer[i] - start;
+    data->fields.push_back(field);
+    start = &data->buffer[i + 1];
+  }
+  suite->AddBenchmark(name, TestWriteSlot, data, data->buffer.size());
+}
+
+static string GenerateInt() {
+  stringstream ss;
+  ss << rand() % 1000000;
+  return ss.str();
+}
+
+static string GenerateString() {
+  return string(1 + rand() % 20, 'a' + rand() % 26);
+}
+
+int main(int argc, char** argv) {
+  CpuInfo::Init();
+  srand(0);
+  ObjectPool pool;
+
+  AddParserBenchmarks(&pool, "4 cols", 4, 1, 10, 0);
+  AddParserBenchmarks(&pool, "16 cols", 16, 1, 10, 0);
+  AddParserBenchmarks(&pool, "64 cols", 64, 1, 10, 0);
+  AddParserBenchmarks(&pool, "long strings", 4, 100, 500, 0);
+  AddParserBenchmarks(&pool, "escapes", 16, 1, 10, 10);
+
+  MemPool mem_pool;
+  BenchmarkSuite suite("TextConverter");
+  AddConverterBenchmark(&pool, &mem_pool, &suite, "WriteSlot int", TPrimitiveType::INT,
+      GenerateInt);
+  AddConverterBenchmark(&pool, &mem_pool, &suite, "WriteSlot string",
+      TPrimitiveType::STRING, GenerateString);
+  cout << suite.Measure() << endl;
+  return 0;
+}
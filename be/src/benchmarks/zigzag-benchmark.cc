@@ -0,0 +1,86 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <iostream>
+#include <vector>
+
+#include "common/object-pool.h"
+#include "exec/read-write-util.h"
+#include "util/benchmark.h"
+#include "util/cpu-info.h"
+
+using namespace impala;
+using namespace std;
+
+// Benchmarks decoding (ReadWriteUtil::GetZLong()) and skipping
+// (ReadWriteUtil::SkipZLongs()) 64K zigzag longs, as in a plain Trevni int or long
+// column.  The values are either all small (one byte each, like most lengths) or
+// of random sizes.
+
+static const int NUM_VALUES = 64 * 1024;
+
+struct ZigzagData {
+  vector<uint8_t> buf;
+  // Sum of the decoded values, so the decoding isn't optimized away.
+  int64_t sum;
+};
+
+static void InitData(bool small_values, ZigzagData* data) {
+  uint8_t zlong[ReadWriteUtil::MAX_ZLONG_LEN];
+  for (int i = 0; i < NUM_VALUES; ++i) {
+    int64_t value = (static_cast<int64_t>(rand()) << 32) | rand();
+    value = small_values ? value % 64 : value >> (rand() % 64);
+    int len = ReadWriteUtil::PutZLong(value, zlong);
+    data->buf.insert(data->buf.end(), zlong, zlong + len);
+  }
+  data->sum = 0;
+}
+
+static void TestGetZLong(int batch_size, void* d) {
+  ZigzagData* data = reinterpret_cast<ZigzagData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    uint8_t* bp = &data->buf[0];
+    for (int j = 0; j < NUM_VALUES; ++j) {
+      int64_t value;
+      bp += ReadWriteUtil::GetZLong(bp, &value);
+      data->sum += value;
+    }
+  }
+}
+
+static void TestSkipZLongs(int batch_size, void* d) {
+  ZigzagData* data = reinterpret_cast<ZigzagData*>(d);
+  for (int i = 0; i < batch_size; ++i) {
+    data->sum += ReadWriteUtil::SkipZLongs(&data->buf[0], data->buf.size(), NUM_VALUES);
+  }
+}
+
+int main(int argc, char** argv) {
+  CpuInfo::Init();
+  srand(0);
+  ObjectPool pool;
+
+  BenchmarkSuite suite("Zigzag");
+  for (int small_values = 1; small_values >= 0; --small_values) {
+    ZigzagData* data = pool.Add(new ZigzagData());
+    InitData(small_values, data);
+    string suffix = small_values ? " (small values)" : " (random sizes)";
+    suite.AddBenchmark("GetZLong" + suffix, TestGetZLong, data, NUM_VALUES);
+    suite.AddBenchmark("SkipZLongs" + suffix, TestSkipZLongs, data, NUM_VALUES);
+  }
+
+  cout << suite.Measure() << endl;
+  return 0;
+}
@@ -30,9 +30,12 @@ import os
 ir_functions = [
   ["AGG_NODE_PROCESS_ROW_BATCH_WITH_GROUPING", "ProcessRowBatchWithGrouping"],
   ["AGG_NODE_PROCESS_ROW_BATCH_NO_GROUPING", "ProcessRowBatchNoGrouping"],
+  ["AGG_NODE_PROCESS_ROW_BATCH_DIRECT", "ProcessRowBatchDirect"],
+  ["DATA_STREAM_SENDER_COMPUTE_CHANNEL_IDXS", "ComputeChannelIdxs"],
   ["HASH_CRC", "IrCrcHash"],
   ["HASH_FVN", "IrFvnHash"],
   ["HASH_JOIN_PROCESS_BUILD_BATCH", "ProcessBuildBatch"],
+  ["HASH_JOIN_HASH_PROBE_BATCH", "HashProbeBatch"],
   ["HASH_JOIN_PROCESS_PROBE_BATCH", "ProcessProbeBatch"],
   ["HDFS_SCANNER_WRITE_ALIGNED_TUPLES", "WriteAlignedTuples"],
   ["STRING_VALUE_EQ", "StringValueEQ"],
@@ -41,6 +44,7 @@ ir_functions = [
   ["STRING_VALUE_GT", "StringValueGT"],
   ["STRING_VALUE_LT", "StringValueLT"],
   ["STRING_VALUE_LE", "StringValueLE"],
+  ["STRING_VALUE_FIND", "StringValueFind"],
   ["STRING_TO_BOOL", "IrStringToBool"],
   ["STRING_TO_INT8", "IrStringToInt8"],
   ["STRING_TO_INT16", "IrStringToInt16"],
@@ -21,6 +21,7 @@
 #include "exec/aggregation-node-ir.cc"
 #include "exec/hash-join-node-ir.cc"
 #include "exec/hdfs-scanner-ir.cc"
+#include "runtime/data-stream-sender-ir.cc"
 #include "runtime/string-value-ir.cc"
 #include "util/hash-util-ir.cc"
 #else
@@ -0,0 +1,76 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "codegen/jit-cache.h"
+
+#include <vector>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "codegen/llvm-codegen.h"
+
+using namespace boost;
+using namespace std;
+
+// Each entry keeps the module of the LlvmCodeGen that compiled it alive, so this
+// limits the number of such modules as well.
+DEFINE_int32(codegen_cache_entries, 64, "Maximum number of jit compiled functions "
+    "that are shared between fragments. 0 disables sharing.");
+
+namespace impala {
+
+JitCache* JitCache::instance() {
+  // Never deleted: the cached LlvmCodeGen objects must not be destroyed after llvm
+  // has been shut down at process exit.
+  static JitCache* cache = new JitCache();
+  return cache;
+}
+
+bool JitCache::Lookup(const string& key, Entry* entry) {
+  lock_guard<mutex> l(lock_);
+  map<string, CachedEntry>::iterator it = entries_.find(key);
+  if (it == entries_.end()) return false;
+  lru_list_.splice(lru_list_.end(), lru_list_, it->second.lru_pos);
+  *entry = it->second.entry;
+  return true;
+}
+
+void JitCache::Insert(const string& key, const Entry& entry) {
+  if (FLAGS_codegen_cache_entries <= 0) return;
+  // Destroy the evicted objects after releasing the lock.
+  vector<shared_ptr<LlvmCodeGen> > evicted;
+  {
+    lock_guard<mutex> l(lock_);
+    pair<map<string, CachedEntry>::iterator, bool> inserted =
+        entries_.insert(make_pair(key, CachedEntry()));
+    CachedEntry* cached = &inserted.first->second;
+    if (inserted.second) {
+      cached->lru_pos = lru_list_.insert(lru_list_.end(), &inserted.first->first);
+    } else {
+      evicted.push_back(cached->entry.owner);
+      lru_list_.splice(lru_list_.end(), lru_list_, cached->lru_pos);
+    }
+    cached->entry = entry;
+
+    while (entries_.size() > static_cast<size_t>(FLAGS_codegen_cache_entries)) {
+      map<string, CachedEntry>::iterator lru = entries_.find(*lru_list_.front());
+      DCHECK(lru != entries_.end());
+      evicted.push_back(lru->second.entry.owner);
+      lru_list_.pop_front();
+      entries_.erase(lru);
+    }
+  }
+}
+
+}
@@ -0,0 +1,83 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_CODEGEN_JIT_CACHE_H
+#define IMPALA_CODEGEN_JIT_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace impala {
+
+class LlvmCodeGen;
+
+// Process wide cache of jit compiled functions, shared by all LlvmCodeGen objects.
+// Entries are keyed by the IR of the function (see LlvmCodeGen::GetJitCacheKey()), so
+// fragments that generate identical code (e.g. the same query run again) can reuse
+// the machine code instead of compiling it again.
+// The machine code belongs to the execution engine of the LlvmCodeGen that compiled
+// it, so each entry keeps that object alive.  The cache holds at most
+// --codegen_cache_entries entries and evicts the least recently used one.
+// This class is thread safe.
+class JitCache {
+ public:
+  struct Entry {
+    // Jit compiled function and its scratch size, as returned by
+    // LlvmCodeGen::JitFunction()
+    void* fn;
+    int scratch_size;
+
+    // Object containing the machine code for 'fn'
+    boost::shared_ptr<LlvmCodeGen> owner;
+
+    Entry() : fn(NULL), scratch_size(0) {}
+  };
+
+  // Cache is a singleton
+  static JitCache* instance();
+
+  // Returns true and sets 'entry' if 'key' is in the cache.
+  bool Lookup(const std::string& key, Entry* entry);
+
+  // Adds 'entry' under 'key', replacing any existing entry.  This is a no-op if the
+  // cache is disabled.
+  void Insert(const std::string& key, const Entry& entry);
+
+ private:
+  JitCache() {}
+
+  // Keys of the cached entries, ordered from the least to the most recently used.
+  // The strings are the keys of entries_.
+  typedef std::list<const std::string*> LruList;
+
+  struct CachedEntry {
+    Entry entry;
+    // Position of the entry in lru_list_
+    LruList::iterator lru_pos;
+  };
+
+  // Lock protecting all fields below
+  boost::mutex lock_;
+
+  std::map<std::string, CachedEntry> entries_;
+  LruList lru_list_;
+};
+
+}
+
+#endif
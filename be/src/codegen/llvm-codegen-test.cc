@@ -32,12 +32,11 @@ namespace impala {
 class LlvmCodeGenTest : public testing:: Test {
  protected:
   static void LifetimeTest() {
-    ObjectPool pool;
     Status status;
     for (int i = 0; i < 10; ++i) {
-      LlvmCodeGen object1(&pool, "Test");
-      LlvmCodeGen object2(&pool, "Test");
-      LlvmCodeGen object3(&pool, "Test");
+      LlvmCodeGen object1("Test");
+      LlvmCodeGen object2("Test");
+      LlvmCodeGen object3("Test");
       
       status = object1.Init();
       ASSERT_TRUE(status.ok());
@@ -51,13 +50,13 @@ class LlvmCodeGenTest : public testing:: Test {
   }
 
   // Wrapper to call private test-only methods on LlvmCodeGen object
-  static Status LoadFromFile(ObjectPool* pool, const string& filename, 
+  static Status LoadFromFile(const string& filename,
       scoped_ptr<LlvmCodeGen>* codegen) {
-    return LlvmCodeGen::LoadFromFile(pool, filename, codegen);
+    return LlvmCodeGen::LoadFromFile(filename, codegen);
   }
 
   static LlvmCodeGen* CreateCodegen(ObjectPool* pool) {
-    LlvmCodeGen* codegen = pool->Add(new LlvmCodeGen(pool, "Test"));
+    LlvmCodeGen* codegen = pool->Add(new LlvmCodeGen("Test"));
     if (codegen != NULL) {
       Status status = codegen->Init();
       if (!status.ok()) return NULL;
@@ -88,10 +87,9 @@ TEST_F(LlvmCodeGenTest, MultithreadedLifetime) {
 
 // Test loading a non-existent file
 TEST_F(LlvmCodeGenTest, BadIRFile) {
-  ObjectPool pool;
   string module_file = "NonExistentFile.ir";
   scoped_ptr<LlvmCodeGen> codegen;
-  Status status = LlvmCodeGenTest::LoadFromFile(&pool, module_file.c_str(), &codegen);
+  Status status = LlvmCodeGenTest::LoadFromFile(module_file.c_str(), &codegen);
   EXPECT_TRUE(!status.ok());
 }
 
@@ -140,7 +138,6 @@ Function* CodegenInnerLoop(LlvmCodeGen* codegen, int64_t* jitted_counter, int de
 //   5. Updated the jitted loop in place with another jitted inner loop function
 //   6. Run the loop and make sure the updated is called.
 TEST_F(LlvmCodeGenTest, ReplaceFnCall) {
-  ObjectPool pool;
   const char* loop_call_name = "DefaultImplementation";
   const char* loop_name = "TestLoop";
   typedef void (*TestLoopFn)(int);
@@ -150,7 +147,7 @@ TEST_F(LlvmCodeGenTest, ReplaceFnCall) {
 
   // Part 1: Load the module and make sure everything is loaded correctly.
   scoped_ptr<LlvmCodeGen> codegen;
-  Status status = LlvmCodeGenTest::LoadFromFile(&pool, module_file.c_str(), &codegen);
+  Status status = LlvmCodeGenTest::LoadFromFile(module_file.c_str(), &codegen);
   EXPECT_TRUE(codegen.get() != NULL);
   EXPECT_TRUE(status.ok());
 
@@ -273,10 +270,8 @@ Function* CodegenStringTest(LlvmCodeGen* codegen) {
 // struct.  Just create a simple StringValue struct and make sure the IR can read it
 // and modify it.
 TEST_F(LlvmCodeGenTest, StringValue) {
-  ObjectPool pool;
-  
   scoped_ptr<LlvmCodeGen> codegen;
-  Status status = LlvmCodeGen::LoadImpalaIR(&pool, &codegen);
+  Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
   EXPECT_TRUE(status.ok());
   EXPECT_TRUE(codegen.get() != NULL);
 
@@ -315,10 +310,8 @@ TEST_F(LlvmCodeGenTest, StringValue) {
 
 // Test calling memcpy intrinsic
 TEST_F(LlvmCodeGenTest, MemcpyTest) {
-  ObjectPool pool;
-  
   scoped_ptr<LlvmCodeGen> codegen;
-  Status status = LlvmCodeGen::LoadImpalaIR(&pool, &codegen);
+  Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
   ASSERT_TRUE(status.ok());
   ASSERT_TRUE(codegen.get() != NULL);
 
@@ -353,14 +346,12 @@ TEST_F(LlvmCodeGenTest, MemcpyTest) {
 
 // Test codegen for hash
 TEST_F(LlvmCodeGenTest, HashTest) {
-  ObjectPool pool;
-
   // Values to compute hash on
   const char* data1 = "test string";
   const char* data2 = "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ";
 
   scoped_ptr<LlvmCodeGen> codegen;
-  Status status = LlvmCodeGen::LoadImpalaIR(&pool, &codegen);
+  Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
   ASSERT_TRUE(status.ok());
   ASSERT_TRUE(codegen.get() != NULL);
   
@@ -430,6 +421,69 @@ TEST_F(LlvmCodeGenTest, HashTest) {
   CpuInfo::EnableFeature(CpuInfo::SSE4_2, restore_sse_support);
 }
 
+// Codegens a function returning 'val'
+static Function* CodegenConstantFn(LlvmCodeGen* codegen, int val) {
+  LlvmCodeGen::FnPrototype prototype(codegen, "ConstantTest", codegen->GetType(TYPE_INT));
+  LlvmCodeGen::LlvmBuilder builder(codegen->context());
+  Function* fn = prototype.GeneratePrototype(&builder, NULL);
+  builder.CreateRet(codegen->GetIntConstant(TYPE_INT, val));
+  return codegen->FinalizeFunction(fn);
+}
+
+// Test that identical functions from different objects share the jitted code
+// through the JitCache and that the code outlives the object that compiled it.
+TEST_F(LlvmCodeGenTest, JitCache) {
+  typedef int (*TestConstantFn)();
+  shared_ptr<LlvmCodeGen> codegens[3];
+  void* jitted_fns[3];
+  for (int i = 0; i < 3; ++i) {
+    scoped_ptr<LlvmCodeGen> codegen;
+    Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
+    ASSERT_TRUE(status.ok());
+    codegens[i].reset(codegen.release());
+    codegens[i]->EnableJitCache(codegens[i]);
+
+    // The last function is different from the others.
+    Function* fn = CodegenConstantFn(codegens[i].get(), i < 2 ? 10 : 20);
+    ASSERT_TRUE(fn != NULL);
+    jitted_fns[i] = codegens[i]->JitFunction(fn);
+    ASSERT_TRUE(jitted_fns[i] != NULL);
+  }
+  EXPECT_EQ(jitted_fns[0], jitted_fns[1]);
+  EXPECT_NE(jitted_fns[0], jitted_fns[2]);
+
+  codegens[0].reset();
+  EXPECT_EQ(reinterpret_cast<TestConstantFn>(jitted_fns[1])(), 10);
+  EXPECT_EQ(reinterpret_cast<TestConstantFn>(jitted_fns[2])(), 20);
+}
+
+// Test that functions added with AddFunctionToJit() are compiled on the compile thread
+// and that nothing is set after the compile is cancelled.
+TEST_F(LlvmCodeGenTest, AsyncCompile) {
+  typedef int (*TestConstantFn)();
+  for (int cancel = 0; cancel < 2; ++cancel) {
+    scoped_ptr<LlvmCodeGen> codegen;
+    Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
+    ASSERT_TRUE(status.ok());
+    Function* fn = CodegenConstantFn(codegen.get(), 30);
+    ASSERT_TRUE(fn != NULL);
+    void* jitted_fn = NULL;
+    codegen->AddFunctionToJit(fn, &jitted_fn);
+    if (cancel) {
+      // Cancelling before the compile starts skips all functions.
+      EXPECT_TRUE(codegen->WaitForCompile(true).ok());
+    }
+    codegen->CompileModuleAsync();
+    EXPECT_TRUE(codegen->WaitForCompile(false).ok());
+    if (cancel) {
+      EXPECT_TRUE(jitted_fn == NULL);
+    } else {
+      ASSERT_TRUE(jitted_fn != NULL);
+      EXPECT_EQ(reinterpret_cast<TestConstantFn>(jitted_fn)(), 30);
+    }
+  }
+}
+
 }
 
 int main(int argc, char **argv) {
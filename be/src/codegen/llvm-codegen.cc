@@ -16,15 +16,20 @@
 
 #include <fstream>
 #include <iostream>
+#include <set>
 #include <sstream>
+#include <unistd.h>
 #include <boost/thread/mutex.hpp>
 
 #include <llvm/Analysis/Passes.h>
 #include <llvm/Analysis/InstructionSimplify.h>
+#include <llvm/Bitcode/ReaderWriter.h>
 #include <llvm/ExecutionEngine/ExecutionEngine.h>
 #include <llvm/ExecutionEngine/JIT.h>
+#include <llvm/ExecutionEngine/JITEventListener.h>
 #include <llvm/PassManager.h>
 #include <llvm/Support/DynamicLibrary.h>
+#include <llvm/Support/InstIterator.h>
 #include <llvm/Support/IRReader.h>
 #include <llvm/Support/MemoryBuffer.h>
 #include <llvm/Support/NoFolder.h>
@@ -38,9 +43,11 @@
 #include <llvm/Transforms/Utils/Cloning.h>
 
 #include "common/logging.h"
+#include "codegen/jit-cache.h"
 #include "codegen/subexpr-elimination.h"
 #include "impala-ir/impala-ir-names.h"
 #include "util/cpu-info.h"
+#include "util/hash-util.h"
 #include "util/path-builder.h"
 
 using namespace boost;
@@ -49,12 +56,106 @@ using namespace std;
 
 DEFINE_bool(dump_ir, false, "if true, output IR after optimization passes");
 DEFINE_string(module_output, "", "if set, saves the generated IR to the output file.");
+DEFINE_bool(perf_map, false, "if true, writes the address range and name of every jit "
+    "compiled function to /tmp/perf-<pid>.map, where perf looks up the symbols of jit "
+    "compiled code");
 
 namespace impala {
 
 static mutex llvm_initialization_lock;
 static bool llvm_initialized = false;
 
+// Id of the next LlvmCodeGen object.  Only modified with atomic instructions.
+static int64_t next_codegen_id = 0;
+
+// Appends a "<start> <size> <name>" line (addresses in hex) to the process' perf map
+// for every function the jit emits.  There is a single listener per process, which is
+// registered with every ExecutionEngine if --perf_map is set.  perf maps can't remove
+// entries, so those of freed functions stay in the file; their addresses may be
+// reused by later functions, which then have two entries.
+class PerfMapListener : public JITEventListener {
+ public:
+  PerfMapListener() {
+    stringstream path;
+    path << "/tmp/perf-" << getpid() << ".map";
+    file_.open(path.str().c_str(), fstream::out | fstream::app);
+    if (file_.fail()) LOG(ERROR) << "Could not open perf map " << path.str();
+  }
+
+  virtual void NotifyFunctionEmitted(const Function& fn, void* code, size_t size,
+      const EmittedFunctionDetails& details) {
+    lock_guard<mutex> l(lock_);
+    if (!file_.is_open()) return;
+    file_ << hex << reinterpret_cast<uintptr_t>(code) << " " << size << dec << " "
+          << fn.getName().str() << endl;
+  }
+
+ private:
+  mutex lock_;  // protects file_, since functions are compiled by many threads
+  ofstream file_;
+};
+
+// Created by InitializeLlvm() if --perf_map is set; never freed, since the execution
+// engines keep pointers to it.
+static PerfMapListener* perf_map_listener = NULL;
+
+// Bitcode of the impala IR module after the function passes, built by the first
+// LoadImpalaIR() call.  Protected by impala_ir_lock.
+static mutex impala_ir_lock;
+static string* impala_ir_bitcode = NULL;
+
+// Populates 'pass_builder' with the passes of OptimizeModule().
+static void InitPassBuilder(PassManagerBuilder* pass_builder) {
+  // This pass manager will construct optimizations passes that are "typical" for
+  // c/c++ programs.  We're relying on llvm to pick the best passes for us.
+  // TODO: we can likely muck with this to get better compile speeds or write
+  // our own passes.  Our subexpression elimination optimization can be rolled into
+  // a pass.
+  pass_builder->OptLevel = 2;          // 2 maps to -O2
+  pass_builder->Inliner = createFunctionInliningPass();
+}
+
+// Sets *bitcode to the cached impala IR bitcode, reading 'file' and running the
+// function passes over its functions if this is the first call.  The module is
+// parsed into a context of its own, which is dropped once the bitcode is written.
+static Status GetImpalaIRBitcode(const string& file, const string** bitcode) {
+  lock_guard<mutex> l(impala_ir_lock);
+  if (impala_ir_bitcode == NULL) {
+    OwningPtr<MemoryBuffer> file_buffer;
+    llvm::error_code err = MemoryBuffer::getFile(file, file_buffer);
+    if (err.value() != 0) {
+      stringstream ss;
+      ss << "Could not load module " << file << ": " << err.message();
+      return Status(ss.str());
+    }
+    LLVMContext context;
+    string error;
+    scoped_ptr<Module> module(ParseBitcodeFile(file_buffer.get(), context, &error));
+    if (module.get() == NULL) {
+      stringstream ss;
+      ss << "Could not parse module " << file << ": " << error;
+      return Status(ss.str());
+    }
+
+    PassManagerBuilder pass_builder;
+    InitPassBuilder(&pass_builder);
+    FunctionPassManager function_pass(module.get());
+    pass_builder.populateFunctionPassManager(function_pass);
+    for (Module::iterator it = module->begin(), end = module->end(); it != end; ++it) {
+      if (!it->isDeclaration()) function_pass.run(*it);
+    }
+    function_pass.doFinalization();
+
+    string* result = new string();
+    raw_string_ostream stream(*result);
+    WriteBitcodeToFile(module.get(), stream);
+    stream.flush();
+    impala_ir_bitcode = result;
+  }
+  *bitcode = impala_ir_bitcode;
+  return Status::OK;
+}
+
 void LlvmCodeGen::InitializeLlvm(bool load_backend) {
   mutex::scoped_lock initialization_lock(llvm_initialization_lock);
   if (llvm_initialized) return;
@@ -66,6 +167,7 @@ void LlvmCodeGen::InitializeLlvm(bool load_backend) {
   // dynamically linking jitted code.
   llvm::InitializeNativeTarget();
   llvm_initialized = true;
+  if (FLAGS_perf_map) perf_map_listener = new PerfMapListener();
 
   if (load_backend) {
     string path;
@@ -76,9 +178,9 @@ void LlvmCodeGen::InitializeLlvm(bool load_backend) {
   }
 }
 
-LlvmCodeGen::LlvmCodeGen(ObjectPool* pool, const string& name) :
+LlvmCodeGen::LlvmCodeGen(const string& name) :
   name_(name),
-  profile_(pool, "CodeGen"),
+  profile_(&pool_, "CodeGen"),
   optimizations_enabled_(false),
   is_corrupt_(false),
   is_compiled_(false),
@@ -86,6 +188,8 @@ LlvmCodeGen::LlvmCodeGen(ObjectPool* pool, const string& name) :
   module_(NULL),
   execution_engine_(NULL),
   scratch_buffer_offset_(0),
+  id_(__sync_fetch_and_add(&next_codegen_id, 1)),
+  compile_cancelled_(false),
   debug_trace_fn_(NULL) {
 
   DCHECK(llvm_initialized) << "Must call LlvmCodeGen::InitializeLlvm first.";
@@ -94,15 +198,18 @@ LlvmCodeGen::LlvmCodeGen(ObjectPool* pool, const string& name) :
   module_file_size_ = ADD_COUNTER(&profile_, "ModuleFileSize", TCounterType::BYTES);
   compile_timer_ = ADD_COUNTER(&profile_, "CompileTime", TCounterType::CPU_TICKS);
   codegen_timer_ = ADD_COUNTER(&profile_, "CodegenTime", TCounterType::CPU_TICKS);
+  optimization_timer_ =
+      ADD_COUNTER(&profile_, "OptimizationTime", TCounterType::CPU_TICKS);
+  jit_timer_ = ADD_COUNTER(&profile_, "JitTime", TCounterType::CPU_TICKS);
+  num_functions_ = ADD_COUNTER(&profile_, "NumFunctions", TCounterType::UNIT);
+  num_instructions_ = ADD_COUNTER(&profile_, "NumInstructions", TCounterType::UNIT);
+  jit_cache_hits_ = ADD_COUNTER(&profile_, "JitCacheHits", TCounterType::UNIT);
 
   loaded_functions_.resize(IRFunction::FN_END);
 }
 
-Status LlvmCodeGen::LoadFromFile(ObjectPool* pool,
-    const string& file, scoped_ptr<LlvmCodeGen>* codegen) {
-  codegen->reset(new LlvmCodeGen(pool, ""));
-
-  SCOPED_TIMER((*codegen)->load_module_timer_);
+Status LlvmCodeGen::LoadFromFile(const string& file,
+    scoped_ptr<LlvmCodeGen>* codegen) {
   OwningPtr<MemoryBuffer> file_buffer;
   llvm::error_code err = MemoryBuffer::getFile(file, file_buffer);
   if (err.value() != 0) {
@@ -110,15 +217,22 @@ Status LlvmCodeGen::LoadFromFile(ObjectPool* pool,
     ss << "Could not load module " << file << ": " << err.message();
     return Status(ss.str());
   }
+  return LoadFromMemory(file_buffer.get(), file, codegen);
+}
 
-  COUNTER_UPDATE((*codegen)->module_file_size_, file_buffer->getBufferSize());
+Status LlvmCodeGen::LoadFromMemory(MemoryBuffer* buffer, const string& name,
+    scoped_ptr<LlvmCodeGen>* codegen) {
+  codegen->reset(new LlvmCodeGen(""));
+
+  SCOPED_TIMER((*codegen)->load_module_timer_);
+  COUNTER_UPDATE((*codegen)->module_file_size_, buffer->getBufferSize());
   string error;
-  Module* loaded_module = ParseBitcodeFile(file_buffer.get(),
+  Module* loaded_module = ParseBitcodeFile(buffer,
       (*codegen)->context(), &error);
 
   if (loaded_module == NULL) {
     stringstream ss;
-    ss << "Could not parse module " << file << ": " << error;
+    ss << "Could not parse module " << name << ": " << error;
     return Status(ss.str());
   }
   (*codegen)->module_ = loaded_module;
@@ -126,7 +240,7 @@ Status LlvmCodeGen::LoadFromFile(ObjectPool* pool,
   return (*codegen)->Init();
 }
 
-Status LlvmCodeGen::LoadImpalaIR(ObjectPool* pool, scoped_ptr<LlvmCodeGen>* codegen_ret) {
+Status LlvmCodeGen::LoadImpalaIR(scoped_ptr<LlvmCodeGen>* codegen_ret) {
   // Load the statically cross compiled file.  We cannot load an ll file with sse
   // instructions on a machine without sse support (the load fails, doesn't matter
   // if those instructions end up getting run or not).
@@ -136,7 +250,12 @@ Status LlvmCodeGen::LoadImpalaIR(ObjectPool* pool, scoped_ptr<LlvmCodeGen>* code
   } else {
     PathBuilder::GetFullPath("llvm-ir/impala-no-sse.ll", &module_file);
   }
-  RETURN_IF_ERROR(LoadFromFile(pool, module_file, codegen_ret));
+  const string* bitcode;
+  RETURN_IF_ERROR(GetImpalaIRBitcode(module_file, &bitcode));
+  // The buffer only references the cached bitcode, which is never freed.
+  OwningPtr<MemoryBuffer> buffer(MemoryBuffer::getMemBuffer(
+      StringRef(bitcode->data(), bitcode->size()), module_file, false));
+  RETURN_IF_ERROR(LoadFromMemory(buffer.get(), module_file, codegen_ret));
   LlvmCodeGen* codegen = codegen_ret->get();
 
   // Parse module for cross compiled functions and types
@@ -159,6 +278,7 @@ Status LlvmCodeGen::LoadImpalaIR(ObjectPool* pool, scoped_ptr<LlvmCodeGen>* code
   // Parse functions from module
   vector<Function*> functions;
   codegen->GetFunctions(&functions);
+  codegen->optimized_functions_.insert(functions.begin(), functions.end());
   int parsed_functions = 0;
   for (int i = 0; i < functions.size(); ++i) {
     string fn_name = functions[i]->getName();
@@ -214,6 +334,9 @@ Status LlvmCodeGen::Init() {
     ss << "Could not create ExecutionEngine: " << error_string_;
     return Status(ss.str());
   }
+  if (perf_map_listener != NULL) {
+    execution_engine_->RegisterJITEventListener(perf_map_listener);
+  }
 
   void_type_ = Type::getVoidTy(context());
   ptr_type_ = PointerType::get(GetType(TYPE_TINYINT), 0);
@@ -226,6 +349,7 @@ Status LlvmCodeGen::Init() {
 }
 
 LlvmCodeGen::~LlvmCodeGen() {
+  WaitForCompile(true);
   if (FLAGS_module_output.size() != 0) {
     fstream f(FLAGS_module_output.c_str(), fstream::out | fstream::trunc);
     if (f.fail()) {
@@ -245,6 +369,11 @@ void LlvmCodeGen::EnableOptimizations(bool enable) {
   optimizations_enabled_ = enable;
 }
 
+void LlvmCodeGen::EnableJitCache(const shared_ptr<LlvmCodeGen>& codegen) {
+  DCHECK_EQ(codegen.get(), this);
+  self_ = codegen;
+}
+
 string LlvmCodeGen::GetIR(bool full_module) const {
   string str;
   raw_string_ostream stream(str);
@@ -413,9 +542,11 @@ Function* LlvmCodeGen::ReplaceCallSites(Function* caller, bool update_in_place,
     caller = new_caller;
   } else if (jitted_functions_.find(caller) != jitted_functions_.end()) {
     // This function is already dynamically linked, unlink it.
+    DCHECK(self_.expired()) << "Functions in the JitCache cannot be modified.";
     execution_engine_->freeMachineCodeForFunction(caller);
     jitted_functions_.erase(caller);
   }
+  if (update_in_place) optimized_functions_.erase(caller);
 
   *replaced = 0;
   // loop over all blocks
@@ -447,6 +578,7 @@ Function* LlvmCodeGen::ReplaceCallSites(Function* caller, bool update_in_place,
 // probably need to make this more complicated and somewhat cost based or write
 // our own optimization passes.
 int LlvmCodeGen::InlineAllCallSites(Function* fn, bool skip_registered_fns) {
+  optimized_functions_.erase(fn);
   int functions_inlined = 0;
   // Collect all call sites
   vector<CallInst*> call_sites;
@@ -500,22 +632,27 @@ Status LlvmCodeGen::OptimizeModule() {
   is_compiled_ = true;
 
   if (is_corrupt_) return Status("Module is corrupt.");
-  SCOPED_TIMER(compile_timer_);
+  SCOPED_TIMER(optimization_timer_);
+  for (Module::iterator it = module_->begin(), end = module_->end(); it != end ; ++ it) {
+    if (it->isDeclaration()) continue;
+    if (optimized_functions_.find(it) != optimized_functions_.end()) continue;
+    COUNTER_UPDATE(num_functions_, 1);
+    for (Function::iterator block = it->begin(); block != it->end(); ++block) {
+      COUNTER_UPDATE(num_instructions_, block->size());
+    }
+  }
   if (!optimizations_enabled_) return Status::OK;
   
-  // This pass manager will construct optimizations passes that are "typical" for
-  // c/c++ programs.  We're relying on llvm to pick the best passes for us.
-  // TODO: we can likely muck with this to get better compile speeds or write
-  // our own passes.  Our subexpression elimination optimization can be rolled into
-  // a pass.
-  PassManagerBuilder pass_builder ;
-  pass_builder.OptLevel = 2;          // 2 maps to -O2
-  pass_builder.Inliner = createFunctionInliningPass() ;
+  PassManagerBuilder pass_builder;
+  InitPassBuilder(&pass_builder);
 
+  // The precompiled functions were optimized when the module was cached.
   scoped_ptr<FunctionPassManager> function_pass(new FunctionPassManager(module_));
   pass_builder.populateFunctionPassManager(*function_pass);
   for (Module::iterator it = module_->begin(), end = module_->end(); it != end ; ++ it) {
-    if (!it->isDeclaration()) function_pass->run(*it);
+    if (it->isDeclaration()) continue;
+    if (optimized_functions_.find(it) != optimized_functions_.end()) continue;
+    function_pass->run(*it);
   }
   function_pass->doFinalization() ;
 
@@ -534,15 +671,127 @@ void* LlvmCodeGen::JitFunction(Function* function, int* scratch_size) {
   } else {
     *scratch_size = scratch_buffer_offset_;
   }
+
+  shared_ptr<LlvmCodeGen> self = self_.lock();
+  string cache_key;
+  if (self.get() != NULL) {
+    GetJitCacheKey(function, &cache_key);
+    JitCache::Entry entry;
+    if (JitCache::instance()->Lookup(cache_key, &entry) && entry.owner->id_ <= id_) {
+      if (scratch_size != NULL) *scratch_size = entry.scratch_size;
+      COUNTER_UPDATE(jit_cache_hits_, 1);
+      if (entry.owner != self) {
+        lock_guard<mutex> l(jitted_functions_lock_);
+        cached_code_owners_.push_back(entry.owner);
+      }
+      return entry.fn;
+    }
+  }
+
   // TODO: log a warning if the jitted function is too big (larger than I cache)
-  void* jitted_function = execution_engine_->getPointerToFunction(function);
-  lock_guard<mutex> l(jitted_functions_lock_);
-  if (jitted_function != NULL) {
+  void* jitted_function;
+  {
+    SCOPED_TIMER(jit_timer_);
+    jitted_function = execution_engine_->getPointerToFunction(function);
+  }
+  if (jitted_function == NULL) return NULL;
+  {
+    lock_guard<mutex> l(jitted_functions_lock_);
     jitted_functions_[function] = true;
   }
+  if (self.get() != NULL) {
+    JitCache::Entry entry;
+    entry.fn = jitted_function;
+    entry.scratch_size = scratch_buffer_offset_;
+    entry.owner = self;
+    JitCache::instance()->Insert(cache_key, entry);
+  }
   return jitted_function;
 }
 
+void LlvmCodeGen::AddFunctionToJit(Function* function, void** fn_ptr) {
+  DCHECK(!is_compiled_);
+  DCHECK(fn_ptr != NULL);
+  fns_to_jit_.push_back(make_pair(function, fn_ptr));
+}
+
+Status LlvmCodeGen::CompileModule() {
+  SCOPED_TIMER(compile_timer_);
+  RETURN_IF_ERROR(OptimizeModule());
+  for (int i = 0; i < fns_to_jit_.size(); ++i) {
+    {
+      lock_guard<mutex> l(compile_lock_);
+      if (compile_cancelled_) break;
+    }
+    void* jitted_fn = JitFunction(fns_to_jit_[i].first);
+    if (jitted_fn == NULL) {
+      return Status("Could not jit compile " + fns_to_jit_[i].first->getName().str());
+    }
+    // Taking the lock also orders the writes that produced the machine code before
+    // the write of the pointer that readers use to call it.
+    lock_guard<mutex> l(compile_lock_);
+    if (compile_cancelled_) break;
+    *fns_to_jit_[i].second = jitted_fn;
+  }
+  return Status::OK;
+}
+
+void LlvmCodeGen::CompileModuleAsync() {
+  DCHECK(compile_thread_.get() == NULL);
+  compile_thread_.reset(new thread(&LlvmCodeGen::CompileModuleThread, this));
+}
+
+void LlvmCodeGen::CompileModuleThread() {
+  compile_status_ = CompileModule();
+  if (!compile_status_.ok()) {
+    LOG(ERROR) << "Error with codegen for this query: " << compile_status_.GetErrorMsg();
+  }
+}
+
+Status LlvmCodeGen::WaitForCompile(bool cancel) {
+  if (cancel) {
+    lock_guard<mutex> l(compile_lock_);
+    compile_cancelled_ = true;
+  }
+  if (compile_thread_.get() != NULL) {
+    compile_thread_->join();
+    compile_thread_.reset();
+  }
+  return compile_status_;
+}
+
+void LlvmCodeGen::GetJitCacheKey(Function* function, string* key) {
+  key->clear();
+  raw_string_ostream stream(*key);
+  set<const Value*> visited;
+  vector<const Value*> values(1, function);
+  while (!values.empty()) {
+    const Value* value = values.back();
+    values.pop_back();
+    if (!visited.insert(value).second) continue;
+    if (const Function* fn = dyn_cast<Function>(value)) {
+      // Declared functions are linked to the same symbols in every module.
+      if (fn->isDeclaration()) continue;
+      fn->print(stream, NULL);
+      for (const_inst_iterator it = inst_begin(fn); it != inst_end(fn); ++it) {
+        for (User::const_op_iterator op = it->op_begin(); op != it->op_end(); ++op) {
+          if (isa<Constant>(*op)) values.push_back(*op);
+        }
+      }
+    } else if (const GlobalVariable* var = dyn_cast<GlobalVariable>(value)) {
+      var->print(stream, NULL);
+      if (var->hasInitializer()) values.push_back(var->getInitializer());
+    } else if (const Constant* constant = dyn_cast<Constant>(value)) {
+      // Constant exprs and aggregates can refer to functions and globals.
+      for (User::const_op_iterator op = constant->op_begin();
+          op != constant->op_end(); ++op) {
+        values.push_back(*op);
+      }
+    }
+  }
+  stream.flush();
+}
+
 int LlvmCodeGen::GetScratchBuffer(int byte_size) {
   // TODO: this is not yet implemented/tested
   DCHECK(false);
@@ -795,7 +1044,8 @@ void LlvmCodeGen::ClearHashFns() {
 //   ret i32 %12
 // }
 Function* LlvmCodeGen::GetHashFunction(int num_bytes) {
-  if (CpuInfo::IsSupported(CpuInfo::SSE4_2)) {
+  // Same variant as HashUtil::Hash(), so that interpreted and codegen'd hashes match.
+  if (HashUtil::HASH_KERNEL.level() >= CpuDispatch::SSE4_2) {
     if (num_bytes == -1) {
       // -1 indicates variable length, just return the generic loop based
       // hash fn.
@@ -807,7 +1057,9 @@ Function* LlvmCodeGen::GetHashFunction(int num_bytes) {
       return cached_fn->second;
     }
 
-    // Generate a function to hash these bytes
+    // Generate a function to hash these bytes, with the same crc steps as
+    // HashUtil::CrcHash() so that the hash values match.
+    const int fn_num_bytes = num_bytes;
     stringstream ss;
     ss << "CrcHash" << num_bytes;
     FnPrototype prototype(this, ss.str(), GetType(TYPE_INT));
@@ -875,7 +1127,7 @@ Function* LlvmCodeGen::GetHashFunction(int num_bytes) {
 
     fn = FinalizeFunction(fn);
     if (fn != NULL) {
-      hash_fns_[num_bytes] = fn;
+      hash_fns_[fn_num_bytes] = fn;
     }
     return fn;
   } else {
@@ -19,10 +19,14 @@
 #include "common/status.h"
 
 #include <map>
+#include <set>
 #include <string>
 #include <vector>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/weak_ptr.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include <llvm/DerivedTypes.h>
 #include <llvm/Intrinsics.h>
@@ -45,6 +49,7 @@ namespace llvm {
   class Function;
   class FunctionPassManager;
   class LLVMContext;
+  class MemoryBuffer;
   class Module;
   class NoFolder;
   class PassManager;
@@ -91,11 +96,18 @@ class SubExprElimination;
 // Subsequently, nodes can get at the jit compiled function pointer (typically during the 
 // Open() call).  Getting the jit compiled function (JitFunction()) is the only thread 
 // safe function.
+// Alternatively, nodes register the functions in Prepare() with AddFunctionToJit()
+// and the fragment compiles them with CompileModule(), or in the background with
+// CompileModuleAsync().  In the latter case, nodes start executing with their
+// interpreted code paths and switch to the jitted functions once they are ready.
 //
 // Currently, each query will create and initialize one of these 
 // objects.  This requires loading and parsing the cross compiled modules.
 // TODO: we should be able to do this once per process and let llvm compile
 // functions from across modules.
+// Jit compiled functions can be shared across these objects through the JitCache
+// (see EnableJitCache()), which saves compiling functions that another fragment
+// already compiled the same way.
 //
 // LLVM has a nontrivial memory management scheme and objects will take
 // ownership of others.  The document is pretty good about being explicit with this
@@ -116,7 +128,10 @@ class LlvmCodeGen {
 
   // Loads and parses the precompiled impala IR module
   // codegen will contain the created object on success.  
-  static Status LoadImpalaIR(ObjectPool*, boost::scoped_ptr<LlvmCodeGen>* codegen);
+  // The module is read from disk and run through the function passes of
+  // OptimizeModule() only once per process; the bitcode of the result is cached and
+  // every call parses it into the new object's context.
+  static Status LoadImpalaIR(boost::scoped_ptr<LlvmCodeGen>* codegen);
 
   // Removes all jit compiled dynamically linked functions from the process.
   ~LlvmCodeGen();
@@ -127,6 +142,12 @@ class LlvmCodeGen {
   // Turns on/off optimization passes
   void EnableOptimizations(bool enable);
 
+  // Makes JitFunction() look up functions in the process wide JitCache before
+  // compiling them, and add the ones it compiles to it.  Cached functions can
+  // outlive the caller's use of this object, so 'codegen' must be a shared_ptr that
+  // owns this object.
+  void EnableJitCache(const boost::shared_ptr<LlvmCodeGen>& codegen);
+
   // For debugging. Returns the IR that was generated.  If full_module, the
   // entire module is dumped, including what was loaded from precompiled IR.
   // If false, only output IR for functions which were generated.
@@ -277,9 +298,32 @@ class LlvmCodeGen {
   // scratch_size will be set to the buffer size required to call the function
   // scratch_size is the total size from all LlvmCodeGen::GetScratchBuffer
   // calls (with some additional bytes for alignment)
+  // If the JitCache is enabled and contains a function with the same IR, that
+  // function is returned instead.
   // This function is thread safe.
   void* JitFunction(llvm::Function* function, int* scratch_size = NULL);
 
+  // Registers 'function' to be jit compiled by CompileModule().  *fn_ptr is set to
+  // the jitted function when it has been compiled and is left unchanged if
+  // compilation fails or is cancelled.  With CompileModuleAsync(), *fn_ptr is set
+  // from another thread while the caller is running, so the caller must keep a
+  // working path for *fn_ptr == NULL and read *fn_ptr each time it picks a path.
+  void AddFunctionToJit(llvm::Function* function, void** fn_ptr);
+
+  // Optimizes the module (see OptimizeModule()) and jit compiles the functions added
+  // with AddFunctionToJit().
+  Status CompileModule();
+
+  // Runs CompileModule() on a separate thread.  The module must not be modified
+  // until WaitForCompile() returns.
+  void CompileModuleAsync();
+
+  // Waits for the thread started by CompileModuleAsync(), if any.  If 'cancel', the
+  // functions that were not compiled yet are skipped.  No *fn_ptr is set after this
+  // returns, so the objects containing them can be destroyed.  Returns the status
+  // of CompileModule().
+  Status WaitForCompile(bool cancel);
+
   // Verfies the function if the verfier is enabled.  Returns false if function
   // is invalid.
   bool VerifyFunction(llvm::Function* function);
@@ -375,7 +419,7 @@ class LlvmCodeGen {
   // Top level codegen object.  'module_name' is only used for debugging when
   // outputting the IR.  module's loaded from disk will be named as the file
   // path.  
-  LlvmCodeGen(ObjectPool* pool, const std::string& module_name);
+  LlvmCodeGen(const std::string& module_name);
 
   // Initializes the jitter and execution engine.  
   Status Init();
@@ -383,9 +427,14 @@ class LlvmCodeGen {
   // Load a pre-compiled IR module from 'file'.  This creates a top level
   // codegen object.  This is used by tests to load custom modules.
   // codegen will contain the created object on success.  
-  static Status LoadFromFile(ObjectPool*, const std::string& file, 
+  static Status LoadFromFile(const std::string& file,
       boost::scoped_ptr<LlvmCodeGen>* codegen);
 
+  // Same as LoadFromFile() for the module in 'buffer', which is named 'name' in
+  // error messages.
+  static Status LoadFromMemory(llvm::MemoryBuffer* buffer,
+      const std::string& name, boost::scoped_ptr<LlvmCodeGen>* codegen);
+
   // Load the intrinsics impala needs.  This is a one time initialization.
   // Values are stored in 'llvm_intrinsics_'
   Status LoadIntrinsics();
@@ -393,19 +442,44 @@ class LlvmCodeGen {
   // Clears generated hash fns.  This is only used for testing.
   void ClearHashFns();
 
+  // Sets 'key' to the JitCache key for 'function': the IR of the function, of all
+  // the functions it references that are defined in the module and of the global
+  // variables they use.  The IR contains everything the machine code depends on,
+  // including offsets and pointers that were baked into the code.
+  void GetJitCacheKey(llvm::Function* function, std::string* key);
+
   // Name of the JIT module.  Useful for debugging.
   std::string name_;
 
-  // Codegen counters
+  // Pool for the profile counters.  This object may outlive the fragment that
+  // created it (see EnableJitCache()), so it cannot use the fragment's pool.
+  ObjectPool pool_;
+
+  // Codegen counters, per phase: loading the IR module (load_module_timer_),
+  // building functions (codegen_timer_, timed by the callers), OptimizeModule()
+  // (optimization_timer_) and jit compiling (jit_timer_).  compile_timer_ is the
+  // total of the latter two in CompileModule().  num_functions_ and
+  // num_instructions_ count the functions that OptimizeModule() runs over, i.e. the
+  // ones built for the query, and their instructions before optimization.
   RuntimeProfile profile_;
   RuntimeProfile::Counter* load_module_timer_;
   RuntimeProfile::Counter* module_file_size_;
   RuntimeProfile::Counter* compile_timer_;
   RuntimeProfile::Counter* codegen_timer_;
+  RuntimeProfile::Counter* optimization_timer_;
+  RuntimeProfile::Counter* jit_timer_;
+  RuntimeProfile::Counter* num_functions_;
+  RuntimeProfile::Counter* num_instructions_;
+  RuntimeProfile::Counter* jit_cache_hits_;
 
   // whether or not optimizations are enabled
   bool optimizations_enabled_;
 
+  // Functions of the impala IR module that the function passes of OptimizeModule()
+  // already ran over when the module was cached (see LoadImpalaIR()).  They are skipped
+  // by those passes, unless they were modified in place since.
+  std::set<llvm::Function*> optimized_functions_;
+
   // If true, the module is corrupt and we cannot codegen this query. 
   // TODO: we could consider just removing the offending function and attempting to
   // codegen the rest of the query.  This requires more testing though to make sure
@@ -438,9 +512,39 @@ class LlvmCodeGen {
   // bool is unused.
   std::map<llvm::Function*, bool> jitted_functions_;
   
-  // Lock protecting jitted_functions_
+  // Lock protecting jitted_functions_ and cached_code_owners_
   boost::mutex jitted_functions_lock_;
 
+  // Unique, increasing id of this object.  To avoid reference cycles, JitFunction()
+  // only uses cached functions from objects with a smaller id.
+  int64_t id_;
+
+  // Owner of this object if the JitCache is enabled.
+  boost::weak_ptr<LlvmCodeGen> self_;
+
+  // Objects containing functions JitFunction() returned from the JitCache.  They
+  // must live as long as this object, whose callers use those functions.
+  std::vector<boost::shared_ptr<LlvmCodeGen> > cached_code_owners_;
+
+  // Functions added with AddFunctionToJit() and where to store the jitted function.
+  std::vector<std::pair<llvm::Function*, void**> > fns_to_jit_;
+
+  // Thread running CompileModule(), if CompileModuleAsync() was called.
+  boost::scoped_ptr<boost::thread> compile_thread_;
+
+  // Status of CompileModule() on compile_thread_.
+  Status compile_status_;
+
+  // Lock protecting compile_cancelled_.  Held while setting the fn_ptrs of
+  // fns_to_jit_, so that none is set after cancellation.
+  boost::mutex compile_lock_;
+
+  // Set by WaitForCompile(true)
+  bool compile_cancelled_;
+
+  // Runs CompileModule() and sets compile_status_.
+  void CompileModuleThread();
+
   // Keeps track of the external functions that have been included in this module
   // e.g libc functions or non-jitted impala functions.
   // TODO: this should probably be FnPrototype->Functions mapping
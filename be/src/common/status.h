@@ -102,6 +102,16 @@ class Status {
         && error_detail_->error_code == TStatusCode::CANCELLED;
   }
 
+  bool IsMemLimitExceeded() const {
+    return error_detail_ != NULL
+        && error_detail_->error_code == TStatusCode::MEM_LIMIT_EXCEEDED;
+  }
+
+  bool IsBroadcastBuildLimitExceeded() const {
+    return error_detail_ != NULL
+        && error_detail_->error_code == TStatusCode::BROADCAST_BUILD_LIMIT_EXCEEDED;
+  }
+
   // Add an error message and set the code if no code has been set yet.
   // If a code has already been set, 'code' is ignored.
   void AddErrorMsg(TStatusCode::type code, const std::string& msg);
@@ -32,13 +32,16 @@ void AggregationNode::ProcessRowBatchNoGrouping(RowBatch* batch) {
 }
 
 void AggregationNode::ProcessRowBatchWithGrouping(RowBatch* batch) {
+  hash_tbl_->EvalProbeBatch(batch);
   for (int i = 0; i < batch->num_rows(); ++i) {
     TupleRow* row = batch->GetRow(i);
     AggregationTuple* agg_tuple = NULL; 
-    HashTable::Iterator entry = hash_tbl_->Find(row);
+    HashTable::Iterator entry = hash_tbl_->FindBatchRow(i);
     if (!entry.HasNext()) {
       agg_tuple = ConstructAggTuple();
-      hash_tbl_->Insert(reinterpret_cast<TupleRow*>(&agg_tuple));
+      // The grouping slots of the new tuple are copies of the row's grouping values,
+      // so the row's hash is also the hash of the new tuple.
+      hash_tbl_->InsertBatchRow(i, reinterpret_cast<TupleRow*>(&agg_tuple));
     } else {
       agg_tuple = reinterpret_cast<AggregationTuple*>(entry.GetRow()->GetTuple(0));
     }
@@ -46,3 +49,15 @@ void AggregationNode::ProcessRowBatchWithGrouping(RowBatch* batch) {
   }
 }
 
+void AggregationNode::ProcessRowBatchDirect(RowBatch* batch) {
+  for (int i = 0; i < batch->num_rows(); ++i) {
+    int idx = direct_idxs_[i];
+    AggregationTuple* agg_tuple = direct_tuples_[idx];
+    if (agg_tuple == NULL) {
+      agg_tuple = ConstructDirectAggTuple(idx);
+      direct_tuples_[idx] = agg_tuple;
+    }
+    UpdateAggTuple(agg_tuple, batch->GetRow(i));
+  }
+}
+
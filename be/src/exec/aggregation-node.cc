@@ -15,29 +15,63 @@
 #include "exec/aggregation-node.h"
 
 #include <math.h>
+#include <iomanip>
+#include <limits>
+#include <set>
 #include <sstream>
 #include <boost/functional/hash.hpp>
+#include <gflags/gflags.h>
 
 #include <x86intrin.h>
 
 #include "codegen/llvm-codegen.h"
+#include "exec/distinct-value-set.h"
 #include "exec/hash-table.inline.h"
+#include "exec/hdfs-scan-node.h"
 #include "exprs/agg-expr.h"
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "runtime/descriptors.h"
+#include "runtime/exec-env.h"
 #include "runtime/mem-pool.h"
+#include "runtime/parallel-executor.h"
 #include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
+#include "runtime/spill-stream.h"
+#include "runtime/string-heap.h"
 #include "runtime/string-value.inline.h"
 #include "runtime/tuple.h"
 #include "runtime/tuple-row.h"
+#include "util/cpu-info.h"
 #include "util/debug-util.h"
+#include "util/hash-util.h"
+#include "util/hyper-log-log.h"
 #include "util/runtime-profile.h"
 
 #include "gen-cpp/Exprs_types.h"
 #include "gen-cpp/PlanNodes_types.h"
 
+DEFINE_int64(agg_mem_limit, 1024L * 1024L * 1024L,
+    "maximum memory (in bytes) for the hash table of a grouping aggregation; "
+    "input beyond that is spilled to disk");
+DEFINE_bool(intern_grouping_strings, true,
+    "if true, grouping aggregations store each distinct string grouping value only "
+    "once; they stop deduplicating if the grouping strings have few duplicates");
+DEFINE_bool(streaming_preaggregation, true,
+    "if true, grouping pre-aggregations whose hash table outgrows the L2 cache pass "
+    "input rows through unaggregated when they don't reduce them enough");
+DEFINE_double(streaming_preagg_min_reduction, 2.0,
+    "a streaming pre-aggregation passes rows through once its hash table outgrows the "
+    "L2 cache and a batch has fewer than this many rows per new group");
+DEFINE_bool(direct_aggregation, true,
+    "if true, aggregations grouping by a single integer expr with a small range of "
+    "values keep their groups in an array indexed by the value instead of hashing");
+DEFINE_int32(agg_num_partitions, 1,
+    "number of hash partitions of the input that a grouping aggregation aggregates in "
+    "parallel on the threads of --num_aggregation_threads; 1 aggregates the input on "
+    "the fragment's thread");
+
 using namespace impala;
 using namespace std;
 using namespace boost;
@@ -81,27 +115,88 @@ class AggregationTuple {
 
 const char* AggregationTuple::LLVM_CLASS_NAME = "class.impala::AggregationTuple";
 
-// TODO: pass in maximum size; enforce by setting limit in mempool
+// A batch of rows for a partition node to aggregate in AggregateRound().
+struct PartitionWork {
+  AggregationNode* node;
+  RuntimeState* state;
+  RowBatch* batch;
+};
+
 // TODO: have a Status ExecNode::Init(const TPlanNode&) member function
 // that does initialization outside of c'tor, so we can indicate errors
 AggregationNode::AggregationNode(ObjectPool* pool, const TPlanNode& tnode,
-                                 const DescriptorTbl& descs)
+                                 const DescriptorTbl& descs, bool is_partition)
   : ExecNode(pool, tnode, descs),
     agg_tuple_id_(tnode.agg_node.agg_tuple_id),
     agg_tuple_desc_(NULL),
     singleton_output_tuple_(NULL),
     num_string_slots_(0),
     tuple_pool_(new MemPool()),
-    codegen_process_row_batch_fn_(NULL),
     process_row_batch_fn_(NULL),
-    needs_finalize_(tnode.agg_node.need_finalize) {
+    process_row_batch_direct_fn_(NULL),
+    use_direct_agg_(false),
+    direct_min_(0),
+    num_direct_groups_(0),
+    direct_range_set_(false),
+    needs_finalize_(tnode.agg_node.need_finalize),
+    is_streaming_preagg_(FLAGS_streaming_preaggregation && !is_partition
+        && tnode.agg_node.__isset.is_preaggregation
+        && tnode.agg_node.is_preaggregation),
+    passing_through_(false),
+    sorted_input_(!is_partition && tnode.agg_node.__isset.input_is_sorted
+        && tnode.agg_node.input_is_sorted),
+    sorted_group_(NULL),
+    child_batch_idx_(0),
+    child_eos_(false),
+    num_input_rows_(0),
+    input_row_desc_(NULL),
+    mem_limit_(FLAGS_agg_mem_limit),
+    is_partition_(is_partition),
+    next_cached_state_(0),
+    next_cached_row_(0),
+    use_codegen_(true),
+    output_node_(this),
+    next_output_partition_(0),
+    input_level_(0) {
   // ignore return status for now
   Expr::CreateExprTrees(pool, tnode.agg_node.grouping_exprs, &probe_exprs_);
   Expr::CreateExprTrees(pool, tnode.agg_node.aggregate_exprs, &aggregate_exprs_);
+  vector<vector<Expr*>*> input_exprs;
+  input_exprs.push_back(&probe_exprs_);
+  input_exprs.push_back(&aggregate_exprs_);
+  SharedExpr::EliminateCommonSubExprs(pool, input_exprs);
+
+  // The partition nodes need their own exprs, since exprs keep their results.
+  if (!is_partition && FLAGS_agg_num_partitions > 1 && !probe_exprs_.empty()) {
+    for (int i = 0; i < FLAGS_agg_num_partitions; ++i) {
+      partitions_.push_back(pool->Add(new AggregationNode(pool, tnode, descs, true)));
+    }
+  }
+  if (!is_partition && tnode.agg_node.__isset.partition_cache_keys) {
+    partition_cache_keys_ = tnode.agg_node.partition_cache_keys;
+    thrift_plan_node_.reset(new TPlanNode(tnode));
+  }
+}
+
+AggregationNode::~AggregationNode() {
+  ClearRoundBatches();
+  for (int i = 0; i < partition_batches_.size(); ++i) {
+    delete partition_batches_[i];
+  }
+  for (int i = 0; i < spill_streams_.size(); ++i) {
+    delete spill_streams_[i];
+    delete spill_batches_[i];
+  }
+  for (int i = 0; i < spilled_partitions_.size(); ++i) {
+    delete spilled_partitions_[i].stream;
+  }
 }
 
 Status AggregationNode::Prepare(RuntimeState* state) {
   RETURN_IF_ERROR(ExecNode::Prepare(state));
+  tuple_pool_.reset(new MemPool(mem_tracker()));
+  // a partition node's input row descriptor is set by its parent
+  if (!is_partition_) input_row_desc_ = &child(0)->row_desc();
 
   build_timer_ =
       ADD_COUNTER(runtime_profile(), "BuildTime", TCounterType::CPU_TICKS);
@@ -109,12 +204,28 @@ Status AggregationNode::Prepare(RuntimeState* state) {
       ADD_COUNTER(runtime_profile(), "GetResultsTime", TCounterType::CPU_TICKS);
   hash_table_buckets_counter_ = 
       ADD_COUNTER(runtime_profile(), "BuildBuckets", TCounterType::UNIT);
+  partitions_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "PartitionsSpilled", TCounterType::UNIT);
+  rows_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "RowsSpilled", TCounterType::UNIT);
+  bytes_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "BytesSpilled", TCounterType::BYTES);
+  string_duplicates_counter_ =
+      ADD_COUNTER(runtime_profile(), "GroupingStringDuplicates", TCounterType::UNIT);
+  rows_passed_through_counter_ =
+      ADD_COUNTER(runtime_profile(), "RowsPassedThrough", TCounterType::UNIT);
+  parallel_rounds_counter_ =
+      ADD_COUNTER(runtime_profile(), "ParallelRounds", TCounterType::UNIT);
+  cache_hits_counter_ =
+      ADD_COUNTER(runtime_profile(), "PartitionCacheHits", TCounterType::UNIT);
+  cache_inserts_counter_ =
+      ADD_COUNTER(runtime_profile(), "PartitionCacheInserts", TCounterType::UNIT);
 
   SCOPED_TIMER(runtime_profile_->total_time_counter());
   
   agg_tuple_desc_ = state->desc_tbl().GetTupleDescriptor(agg_tuple_id_);
-  RETURN_IF_ERROR(Expr::Prepare(probe_exprs_, state, child(0)->row_desc()));
-  RETURN_IF_ERROR(Expr::Prepare(aggregate_exprs_, state, child(0)->row_desc()));
+  RETURN_IF_ERROR(Expr::Prepare(probe_exprs_, state, *input_row_desc_));
+  RETURN_IF_ERROR(Expr::Prepare(aggregate_exprs_, state, *input_row_desc_));
 
   // Construct build exprs from agg_tuple_desc_
   for (int i = 0; i < probe_exprs_.size(); ++i) {
@@ -122,11 +233,15 @@ Status AggregationNode::Prepare(RuntimeState* state) {
     Expr* expr = new SlotRef(desc);      
     state->obj_pool()->Add(expr);
     build_exprs_.push_back(expr);
+    if (FLAGS_intern_grouping_strings && desc->type() == TYPE_STRING
+        && string_heap_ == NULL) {
+      string_heap_.reset(new StringHeap(tuple_pool_.get()));
+    }
   }
   RETURN_IF_ERROR(Expr::Prepare(build_exprs_, state, row_desc()));
 
-  // TODO: how many buckets?
-  hash_tbl_.reset(new HashTable(build_exprs_, probe_exprs_, 1, true));
+  hash_tbl_.reset(new HashTable(build_exprs_, probe_exprs_, 1, true,
+      InitialHashTableBuckets(1024), mem_tracker()));
   
   // Determine the number of string slots in the output
   for (vector<Expr*>::const_iterator expr = aggregate_exprs_.begin();
@@ -134,18 +249,104 @@ Status AggregationNode::Prepare(RuntimeState* state) {
     AggregateExpr* agg_expr = static_cast<AggregateExpr*>(*expr);
     if (agg_expr->type() == TYPE_STRING) ++num_string_slots_;
   }
+
+  for (int i = 0; i < aggregate_exprs_.size(); ++i) {
+    AggregateExpr* agg_expr = static_cast<AggregateExpr*>(aggregate_exprs_[i]);
+    if (!agg_expr->is_distinct()) {
+      distinct_sets_.push_back(NULL);
+      continue;
+    }
+    DCHECK(agg_expr->agg_op() == TAggregationOp::COUNT
+        || agg_expr->agg_op() == TAggregationOp::SUM);
+    vector<PrimitiveType> types;
+    for (int j = 0; j < agg_expr->GetNumChildren(); ++j) {
+      types.push_back(agg_expr->GetChild(j)->type());
+    }
+    distinct_sets_.push_back(
+        state->obj_pool()->Add(new DistinctValueSet(types, tuple_pool_.get())));
+    distinct_values_.resize(max<int>(distinct_values_.size(), types.size()));
+    // passed-through rows would lose the values seen by their group
+    is_streaming_preagg_ = false;
+  }
+  if (!partition_cache_keys_.empty()) {
+    // only the groups of a pre-aggregation of the scan's rows can be cached
+    if (state->exec_env()->agg_state_cache() == NULL || probe_exprs_.empty()
+        || needs_finalize_ || !conjuncts_.empty()
+        || dynamic_cast<HdfsScanNode*>(child(0)) == NULL) {
+      partition_cache_keys_.clear();
+    } else {
+      // the partition nodes aggregate the rows of a scanned partition each
+      is_streaming_preagg_ = false;
+      sorted_input_ = false;
+      partitions_.clear();
+    }
+  }
+  if (probe_exprs_.empty()) is_streaming_preagg_ = false;
+  if (probe_exprs_.empty()) sorted_input_ = false;
+  if (sorted_input_) {
+    // the groups are complete as soon as the input moves on to the next one
+    is_streaming_preagg_ = false;
+    partitions_.clear();
+    runtime_profile()->AddInfoString("SortedInput", "true");
+  }
+  if (state->exec_env()->aggregation_pool() == NULL) partitions_.clear();
+  // the partition nodes aggregate all input rows
+  if (!partitions_.empty()) is_streaming_preagg_ = false;
+  DCHECK(!is_streaming_preagg_ || !needs_finalize_);
   
   if (probe_exprs_.empty()) {
     // create single output tuple now; we need to output something
     // even if our input is empty
     singleton_output_tuple_ = ConstructAggTuple();
   }
+  if (!partitions_.empty()) {
+    VLOG_QUERY << "AggregationNode(node_id=" << id() << ") aggregating "
+               << partitions_.size() << " partitions in parallel";
+    stringstream num_partitions;
+    num_partitions << partitions_.size();
+    runtime_profile()->AddInfoString("AggregationPartitions", num_partitions.str());
+    int partition_batch_rows =
+        PARTITION_BATCH_FACTOR * state->batch_size(*input_row_desc_);
+    for (int i = 0; i < partitions_.size(); ++i) {
+      partitions_[i]->input_row_desc_ = input_row_desc_;
+      partitions_[i]->mem_limit_ = mem_limit_ / partitions_.size();
+      RETURN_IF_ERROR(partitions_[i]->Prepare(state));
+      partition_batches_.push_back(new RowBatch(*input_row_desc_, partition_batch_rows));
+    }
+    // this node only routes the input rows
+    return Status::OK;
+  }
+  if (!partition_cache_keys_.empty()) {
+    runtime_profile()->AddInfoString("PartitionCache", "true");
+    // the partition nodes are created in Open(), once the scan ranges are known
+    return Status::OK;
+  }
+  // GetNextSorted() is not codegen'd: with constant memory and no hashing, it is
+  // dominated by UpdateAggTuple() and the child.
+  if (sorted_input_) return Status::OK;
+  InitDirectAgg();
 
-  LlvmCodeGen* codegen = state->llvm_codegen();
+  LlvmCodeGen* codegen = use_codegen_ ? state->llvm_codegen() : NULL;
   if (codegen != NULL) {
     Function* update_tuple_fn = CodegenUpdateAggTuple(codegen);
+    Function* process_row_batch_fn = NULL;
     if (update_tuple_fn != NULL) {
-      codegen_process_row_batch_fn_ = CodegenProcessRowBatch(codegen, update_tuple_fn);
+      process_row_batch_fn = CodegenProcessRowBatch(codegen, update_tuple_fn);
+    }
+    if (update_tuple_fn != NULL && use_direct_agg_) {
+      Function* process_row_batch_direct_fn =
+          CodegenProcessRowBatchDirect(codegen, update_tuple_fn);
+      if (process_row_batch_direct_fn != NULL) {
+        codegen->AddFunctionToJit(process_row_batch_direct_fn,
+            reinterpret_cast<void**>(&process_row_batch_direct_fn_));
+      }
+    }
+    if (process_row_batch_fn != NULL) {
+      // process_row_batch_fn_ is set once the function is jitted.
+      codegen->AddFunctionToJit(process_row_batch_fn,
+          reinterpret_cast<void**>(&process_row_batch_fn_));
+      LOG(INFO) << "AggregationNode(node_id=" << id()
+                << ") using llvm codegend functions.";
     }
   }
   return Status::OK;
@@ -154,101 +355,688 @@ Status AggregationNode::Prepare(RuntimeState* state) {
 Status AggregationNode::Open(RuntimeState* state) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
 
-  // Update to using codegen'd process row batch.
-  if (codegen_process_row_batch_fn_ != NULL) {
-    void* jitted_process_row_batch = 
-        state->llvm_codegen()->JitFunction(codegen_process_row_batch_fn_);
-    process_row_batch_fn_ = 
-        reinterpret_cast<ProcessRowBatchFn>(jitted_process_row_batch);
-    LOG(INFO) << "AggregationNode(node_id=" << id() 
-              << ") using llvm codegend functions.";
-  }
-
+  // the scan must not start reading the cached partitions
+  if (!partition_cache_keys_.empty()) return OpenCachedPartitions(state);
   RETURN_IF_ERROR(children_[0]->Open(state));
+  if (!partitions_.empty()) return OpenPartitions(state);
 
-  RowBatch batch(children_[0]->row_desc(), state->batch_size());
-  int64_t num_input_rows = 0;
+  child_batch_.reset(new RowBatch(
+      children_[0]->row_desc(), state->batch_size(children_[0]->row_desc())));
+  // the sorted input is aggregated in GetNext()
+  if (sorted_input_) return Status::OK;
+  RowBatch* batch = child_batch_.get();
   int64_t num_agg_rows = 0;
   while (true) {
-    bool eos;
-    RETURN_IF_CANCELLED(state);
-    RETURN_IF_ERROR(children_[0]->GetNext(state, &batch, &eos));
+    RETURN_IF_ERROR(state->CheckQueryState());
+    RETURN_IF_ERROR(children_[0]->GetNext(state, batch, &child_eos_));
     SCOPED_TIMER(build_timer_);
 
     if (VLOG_ROW_IS_ON) {
-      for (int i = 0; i < batch.num_rows(); ++i) {
-        TupleRow* row = batch.GetRow(i);
+      for (int i = 0; i < batch->num_rows(); ++i) {
+        TupleRow* row = batch->GetRow(i);
         VLOG_ROW << "input row: " << PrintRow(row, children_[0]->row_desc());
       }
     }
     int64_t agg_rows_before = hash_tbl_->size();
-    if (process_row_batch_fn_ != NULL) {
-      process_row_batch_fn_(this, &batch);
-    } else if (singleton_output_tuple_ != NULL) {
-      ProcessRowBatchNoGrouping(&batch);
-    } else {
-      ProcessRowBatchWithGrouping(&batch);
+    RETURN_IF_ERROR(ProcessBatch(state, batch));
+    int64_t new_groups = hash_tbl_->size() - agg_rows_before;
+    num_agg_rows += new_groups;
+    num_input_rows_ += batch->num_rows();
+
+    int batch_rows = batch->num_rows();
+    batch->Reset();
+    if (child_eos_) break;
+    if (is_streaming_preagg_ && ShouldPassThrough(batch_rows, new_groups)) {
+      VLOG_QUERY << "AggregationNode(node_id=" << id() << ") aggregated "
+                 << num_input_rows_ << " input rows into " << hash_tbl_->size()
+                 << " groups; passing the remaining input through";
+      passing_through_ = true;
+      break;
     }
-    COUNTER_SET(hash_table_buckets_counter_, hash_tbl_->num_buckets());
-    COUNTER_SET(memory_used_counter(), 
-        tuple_pool_->peak_allocated_bytes() + hash_tbl_->byte_size());
-    num_agg_rows += (hash_tbl_->size() - agg_rows_before);
-    num_input_rows += batch.num_rows();
-
-    batch.Reset();
-    if (eos) break;
+  }
+  // the output is returned from the hash table
+  if (use_direct_agg_) SwitchToHashAgg();
+  RETURN_IF_ERROR(FinishSpilling(state));
+  if (string_heap_ != NULL) {
+    COUNTER_SET(string_duplicates_counter_, string_heap_->num_duplicates());
   }
   
   if (singleton_output_tuple_ != NULL) {
     hash_tbl_->Insert(reinterpret_cast<TupleRow*>(&singleton_output_tuple_));
     ++num_agg_rows;
   }
-  VLOG_FILE << "aggregated " << num_input_rows << " input rows into "
+  VLOG_FILE << "aggregated " << num_input_rows_ << " input rows into "
             << num_agg_rows << " output rows";
   output_iterator_ = hash_tbl_->Begin();
   return Status::OK;
 }
 
+Status AggregationNode::OpenPartitions(RuntimeState* state) {
+  int max_batch_rows = state->batch_size(*input_row_desc_);
+  bool eos = false;
+  while (!eos) {
+    RETURN_IF_ERROR(state->CheckQueryState());
+    // The partition batches reference the rows of all batches of the round.
+    RowBatch* batch = new RowBatch(*input_row_desc_, max_batch_rows);
+    round_batches_.push_back(batch);
+    RETURN_IF_ERROR(children_[0]->GetNext(state, batch, &eos));
+    SCOPED_TIMER(build_timer_);
+    num_input_rows_ += batch->num_rows();
+    if (PartitionBatch(batch, max_batch_rows) || eos) {
+      RETURN_IF_ERROR(AggregateRound(state));
+    }
+  }
+
+  int64_t num_agg_rows = 0;
+  for (int i = 0; i < partitions_.size(); ++i) {
+    AggregationNode* partition = partitions_[i];
+    if (partition->use_direct_agg_) partition->SwitchToHashAgg();
+    RETURN_IF_ERROR(partition->FinishSpilling(state));
+    num_agg_rows += partition->hash_tbl_->size();
+  }
+  VLOG_FILE << "aggregated " << num_input_rows_ << " input rows into "
+            << num_agg_rows << " output rows in " << partitions_.size()
+            << " partitions";
+  // the groups are returned one partition after the other
+  output_node_ = partitions_[0];
+  next_output_partition_ = 1;
+  output_iterator_ = output_node_->hash_tbl_->Begin();
+  return Status::OK;
+}
+
+Status AggregationNode::OpenCachedPartitions(RuntimeState* state) {
+  JoinBuildCache* cache = state->exec_env()->agg_state_cache();
+  HdfsScanNode* scan = static_cast<HdfsScanNode*>(children_[0]);
+  // The instance may only read some of a partition's files; the groups are cached for
+  // the ranges it reads.
+  map<int64_t, string> ranges;
+  scan->GetPartitionRanges(&ranges);
+  set<int64_t> cached_partitions;
+  vector<pair<int64_t, string> > uncached_partitions;
+  for (map<int64_t, string>::iterator it = ranges.begin(); it != ranges.end(); ++it) {
+    map<int64_t, string>::iterator key = partition_cache_keys_.find(it->first);
+    if (key == partition_cache_keys_.end()) {
+      // not known to the planner, aggregated without caching
+      uncached_partitions.push_back(make_pair(it->first, string()));
+      continue;
+    }
+    string state_key = key->second + it->second;
+    JoinBuildCache::EntryPtr entry = cache->Lookup(state_key);
+    if (entry == NULL) {
+      uncached_partitions.push_back(make_pair(it->first, state_key));
+    } else {
+      cached_states_.push_back(entry);
+      cached_partitions.insert(it->first);
+    }
+  }
+  scan->SkipPartitions(cached_partitions);
+  COUNTER_SET(cache_hits_counter_, static_cast<int64_t>(cached_states_.size()));
+
+  // The partition nodes run without codegen: the fragment's functions have been
+  // compiled by now.
+  map<int64_t, AggregationNode*> partition_nodes;
+  for (int i = 0; i < uncached_partitions.size(); ++i) {
+    AggregationNode* partition = state->obj_pool()->Add(new AggregationNode(
+        state->obj_pool(), *thrift_plan_node_, state->desc_tbl(), true));
+    partition->input_row_desc_ = input_row_desc_;
+    partition->mem_limit_ = mem_limit_ / uncached_partitions.size();
+    partition->use_codegen_ = false;
+    partitions_.push_back(partition);
+    partition_state_keys_.push_back(uncached_partitions[i].second);
+    RETURN_IF_ERROR(partition->Prepare(state));
+    partition_nodes[uncached_partitions[i].first] = partition;
+  }
+
+  RETURN_IF_ERROR(children_[0]->Open(state));
+  child_batch_.reset(new RowBatch(
+      children_[0]->row_desc(), state->batch_size(children_[0]->row_desc())));
+  RowBatch* batch = child_batch_.get();
+  while (!child_eos_) {
+    RETURN_IF_ERROR(state->CheckQueryState());
+    RETURN_IF_ERROR(children_[0]->GetNext(state, batch, &child_eos_));
+    SCOPED_TIMER(build_timer_);
+    if (batch->num_rows() > 0) {
+      // all rows of a scan batch are from the same partition
+      map<int64_t, AggregationNode*>::iterator partition =
+          partition_nodes.find(scan->batch_partition_id());
+      DCHECK(partition != partition_nodes.end());
+      RETURN_IF_ERROR(partition->second->ProcessBatch(state, batch));
+      partition->second->num_input_rows_ += batch->num_rows();
+      num_input_rows_ += batch->num_rows();
+    }
+    batch->Reset();
+  }
+
+  int64_t num_agg_rows = 0;
+  for (int i = 0; i < partitions_.size(); ++i) {
+    AggregationNode* partition = partitions_[i];
+    if (partition->use_direct_agg_) partition->SwitchToHashAgg();
+    RETURN_IF_ERROR(partition->FinishSpilling(state));
+    num_agg_rows += partition->hash_tbl_->size();
+    // the groups of spilled rows are only aggregated while they are returned
+    if (partition_state_keys_[i].empty() || !partition->spilled_partitions_.empty()) {
+      continue;
+    }
+    vector<Tuple*> tuples;
+    tuples.reserve(partition->hash_tbl_->size());
+    for (HashTable::Iterator it = partition->hash_tbl_->Begin(); it.HasNext();
+         it.Next<false>()) {
+      tuples.push_back(it.GetRow()->GetTuple(0));
+    }
+    JoinBuildCache::EntryPtr entry = cache->Insert(
+        partition_state_keys_[i], 1, &tuples, partition->tuple_pool_.get());
+    if (entry == NULL) continue;
+    COUNTER_UPDATE(cache_inserts_counter_, 1);
+    // The groups are now in the entry; they are returned from there.
+    partition->hash_tbl_->Clear();
+    cached_states_.push_back(entry);
+  }
+  VLOG_FILE << "aggregated " << num_input_rows_ << " input rows into "
+            << num_agg_rows << " output rows in " << partitions_.size()
+            << " partitions, " << cached_partitions.size() << " partitions cached";
+  if (!partitions_.empty()) {
+    output_node_ = partitions_[0];
+    next_output_partition_ = 1;
+  }
+  output_iterator_ = output_node_->hash_tbl_->Begin();
+  return Status::OK;
+}
+
+void AggregationNode::OutputCachedStates(RowBatch* row_batch) {
+  while (next_cached_state_ < cached_states_.size()) {
+    const JoinBuildCache::Entry& entry = *cached_states_[next_cached_state_];
+    while (next_cached_row_ < entry.num_rows() && !row_batch->IsFull()
+        && !ReachedLimit()) {
+      int row_idx = row_batch->AddRow();
+      TupleRow* row = row_batch->GetRow(row_idx);
+      // The entries are immutable; the rows stay valid until Close().
+      row->SetTuple(0, entry.GetRow(next_cached_row_++)->GetTuple(0));
+      VLOG_ROW << "output row: " << PrintRow(row, row_desc());
+      row_batch->CommitLastRow();
+      ++num_rows_returned_;
+    }
+    if (next_cached_row_ < entry.num_rows()) break;
+    ++next_cached_state_;
+    next_cached_row_ = 0;
+  }
+}
+
+bool AggregationNode::PartitionBatch(RowBatch* batch, int max_batch_rows) {
+  // The rows of batch are distinct but the batch memory is reused.
+  SharedExpr::InvalidateCachedValues();
+  int num_tuples = input_row_desc_->tuple_descriptors().size();
+  int num_partitions = partitions_.size();
+  bool round_full = false;
+  for (int i = 0; i < batch->num_rows(); ++i) {
+    TupleRow* row = batch->GetRow(i);
+    uint32_t hash = 0;
+    for (int j = 0; j < probe_exprs_.size(); ++j) {
+      hash = RawValue::GetHashValue(
+          probe_exprs_[j]->GetValue(row), probe_exprs_[j]->type(), hash);
+    }
+    // The partitions' hash tables and spill partitions are computed from the same
+    // values; rehash with a seed of its own so that the partitions are independent.
+    hash = HashUtil::FvnHash(
+        &hash, sizeof(hash), HashUtil::FVN_SEED + MAX_PARTITION_DEPTH + 1);
+    RowBatch* partition_batch = partition_batches_[hash % num_partitions];
+    int row_idx = partition_batch->AddRow();
+    TupleRow* partition_row = partition_batch->GetRow(row_idx);
+    for (int j = 0; j < num_tuples; ++j) {
+      partition_row->SetTuple(j, row->GetTuple(j));
+    }
+    partition_batch->CommitLastRow();
+    if (partition_batch->num_rows() + max_batch_rows > partition_batch->capacity()) {
+      round_full = true;
+    }
+  }
+  return round_full;
+}
+
+Status AggregationNode::AggregateRound(RuntimeState* state) {
+  vector<PartitionWork> work(partitions_.size());
+  vector<void*> args;
+  for (int i = 0; i < partitions_.size(); ++i) {
+    if (partition_batches_[i]->num_rows() == 0) continue;
+    work[i].node = partitions_[i];
+    work[i].state = state;
+    work[i].batch = partition_batches_[i];
+    args.push_back(&work[i]);
+  }
+  Status status;
+  if (!args.empty()) {
+    status = ParallelExecutor::Exec(state->exec_env()->aggregation_pool(),
+        &AggregationNode::AggregatePartitionBatch, &args[0], args.size());
+    COUNTER_UPDATE(parallel_rounds_counter_, 1);
+  }
+  ClearRoundBatches();
+  return status;
+}
+
+Status AggregationNode::AggregatePartitionBatch(void* arg) {
+  PartitionWork* work = reinterpret_cast<PartitionWork*>(arg);
+  // the partition's exprs may have been evaluated on another thread of the pool
+  SharedExpr::StartThreadScopes();
+  SCOPED_TIMER(work->node->build_timer_);
+  Status status = work->node->ProcessBatch(work->state, work->batch);
+  work->node->num_input_rows_ += work->batch->num_rows();
+  work->batch->Reset();
+  return status;
+}
+
+void AggregationNode::ClearRoundBatches() {
+  for (int i = 0; i < partition_batches_.size(); ++i) {
+    partition_batches_[i]->Reset();
+  }
+  for (int i = 0; i < round_batches_.size(); ++i) {
+    delete round_batches_[i];
+  }
+  round_batches_.clear();
+}
+
 Status AggregationNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
   SCOPED_TIMER(get_results_timer_);
 
   if (ReachedLimit()) {
     *eos = true;
     return Status::OK;
   }
+  if (sorted_input_) {
+    RETURN_IF_ERROR(GetNextSorted(state, row_batch));
+    *eos = (child_eos_ && child_batch_idx_ == child_batch_->num_rows())
+        || ReachedLimit();
+    COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+    return Status::OK;
+  }
   Expr** conjuncts = &conjuncts_[0];
   int num_conjuncts = conjuncts_.size();
 
-  while (output_iterator_.HasNext() && !row_batch->IsFull()) {
-    int row_idx = row_batch->AddRow();
-    TupleRow* row = row_batch->GetRow(row_idx);
-    Tuple* agg_tuple = output_iterator_.GetRow()->GetTuple(0);
-    if (needs_finalize_) {
-      FinalizeAggTuple(reinterpret_cast<AggregationTuple*>(agg_tuple));
+  while (true) {
+    while (output_iterator_.HasNext() && !row_batch->IsFull()) {
+      int row_idx = row_batch->AddRow();
+      TupleRow* row = row_batch->GetRow(row_idx);
+      Tuple* agg_tuple = output_iterator_.GetRow()->GetTuple(0);
+      if (needs_finalize_) {
+        output_node_->FinalizeAggTuple(reinterpret_cast<AggregationTuple*>(agg_tuple));
+      }
+      row->SetTuple(0, agg_tuple);
+      if (ExecNode::EvalConjuncts(conjuncts, num_conjuncts, row)) {
+        VLOG_ROW << "output row: " << PrintRow(row, row_desc());
+        row_batch->CommitLastRow();
+        ++num_rows_returned_;
+        if (ReachedLimit()) break;
+      }
+      output_iterator_.Next<false>();
     }
-    row->SetTuple(0, agg_tuple);
-    if (ExecNode::EvalConjuncts(conjuncts, num_conjuncts, row)) {
-      VLOG_ROW << "output row: " << PrintRow(row, row_desc());
-      row_batch->CommitLastRow();
-      ++num_rows_returned_;
-      if (ReachedLimit()) break;
+    if (output_iterator_.HasNext() || row_batch->IsFull() || ReachedLimit()) break;
+    if (passing_through_) {
+      // all groups have been returned; stream the rest of the input
+      RETURN_IF_ERROR(PassThroughRows(state, row_batch));
+      break;
+    }
+    if (!output_node_->spilled_partitions_.empty()) {
+      // all groups in memory have been returned; move on to the next spilled partition
+      RETURN_IF_CANCELLED(state);
+      RETURN_IF_ERROR(output_node_->AggregateSpilledPartition(state, row_batch));
+      output_iterator_ = output_node_->output_iterator_;
+      continue;
     }
-    output_iterator_.Next<false>();
+    if (next_output_partition_ == partitions_.size()) {
+      // all groups that were aggregated have been returned
+      if (next_cached_state_ < cached_states_.size()) OutputCachedStates(row_batch);
+      break;
+    }
+    // The groups of the partition node stay in its pool until Close().
+    output_node_ = partitions_[next_output_partition_++];
+    output_iterator_ = output_node_->hash_tbl_->Begin();
   }
-  *eos = !output_iterator_.HasNext() || ReachedLimit();
+  *eos = (!output_iterator_.HasNext() && output_node_->spilled_partitions_.empty()
+      && next_output_partition_ == partitions_.size() && !passing_through_
+      && next_cached_state_ == cached_states_.size())
+      || ReachedLimit();
   COUNTER_SET(rows_returned_counter_, num_rows_returned_);
   return Status::OK;
 }
 
 Status AggregationNode::Close(RuntimeState* state) {
   COUNTER_SET(memory_used_counter(), 
-      tuple_pool_->peak_allocated_bytes() + hash_tbl_->byte_size());
+      max(memory_used_counter()->value(),
+          tuple_pool_->peak_allocated_bytes() + hash_tbl_->byte_size()));
   COUNTER_SET(hash_table_buckets_counter_, hash_tbl_->num_buckets());
+  for (int i = 0; i < spill_streams_.size(); ++i) {
+    delete spill_streams_[i];
+    delete spill_batches_[i];
+  }
+  spill_streams_.clear();
+  spill_batches_.clear();
+  for (int i = 0; i < spilled_partitions_.size(); ++i) {
+    delete spilled_partitions_[i].stream;
+  }
+  spilled_partitions_.clear();
+  ClearRoundBatches();
+  for (int i = 0; i < partitions_.size(); ++i) {
+    AggregationNode* partition = partitions_[i];
+    // not prepared if Prepare() failed before
+    if (partition->hash_tbl_ == NULL) continue;
+    partition->Close(state);
+    COUNTER_UPDATE(memory_used_counter(), partition->memory_used_counter()->value());
+    COUNTER_UPDATE(partitions_spilled_counter_,
+        partition->partitions_spilled_counter_->value());
+    COUNTER_UPDATE(rows_spilled_counter_, partition->rows_spilled_counter_->value());
+    COUNTER_UPDATE(bytes_spilled_counter_, partition->bytes_spilled_counter_->value());
+    if (partition->string_heap_ != NULL) {
+      COUNTER_UPDATE(string_duplicates_counter_,
+          partition->string_heap_->num_duplicates());
+    }
+  }
+  if (is_streaming_preagg_ && num_rows_returned_ > 0) {
+    // how well the pre-aggregation reduced its input
+    stringstream reduction;
+    reduction << setprecision(3)
+              << static_cast<double>(num_input_rows_) / num_rows_returned_;
+    runtime_profile_->AddInfoString("ReductionFactor", reduction.str());
+  }
   return ExecNode::Close(state);
 }
 
+int64_t AggregationNode::MemUsage() const {
+  int64_t bytes = tuple_pool_->total_allocated_bytes() + hash_tbl_->byte_size();
+  if (string_heap_ != NULL) bytes += string_heap_->byte_size();
+  for (int i = 0; i < distinct_sets_.size(); ++i) {
+    if (distinct_sets_[i] != NULL) bytes += distinct_sets_[i]->byte_size();
+  }
+  bytes += direct_tuples_.size() * sizeof(AggregationTuple*);
+  return bytes;
+}
+
+Status AggregationNode::ProcessBatch(RuntimeState* state, RowBatch* batch) {
+  // The rows of batch are distinct but the batch memory is reused.
+  SharedExpr::InvalidateCachedValues();
+  if (!spill_streams_.empty()) return ProcessRowBatchSpilling(state, batch);
+  if (use_direct_agg_ && !EvalDirectIdxs(batch)) SwitchToHashAgg();
+
+  if (use_direct_agg_) {
+    if (process_row_batch_direct_fn_ != NULL) {
+      process_row_batch_direct_fn_(this, batch);
+    } else {
+      ProcessRowBatchDirect(batch);
+    }
+  } else if (process_row_batch_fn_ != NULL) {
+    process_row_batch_fn_(this, batch);
+  } else if (singleton_output_tuple_ != NULL) {
+    ProcessRowBatchNoGrouping(batch);
+  } else {
+    ProcessRowBatchWithGrouping(batch);
+  }
+  COUNTER_SET(hash_table_buckets_counter_, hash_tbl_->num_buckets());
+  COUNTER_SET(memory_used_counter(),
+      max(memory_used_counter()->value(),
+          tuple_pool_->peak_allocated_bytes() + hash_tbl_->byte_size()));
+
+  // without grouping there is only a single output tuple, and direct aggregation has
+  // a bounded number of groups; nothing to spill
+  if (singleton_output_tuple_ == NULL && !use_direct_agg_
+      && MemUsage() > mem_limit_) {
+    RETURN_IF_ERROR(StartSpilling(state));
+  }
+  return Status::OK;
+}
+
+bool AggregationNode::ShouldPassThrough(int batch_rows, int64_t new_groups) {
+  // Once the memory limit is reached, rows of new groups are spilled instead.
+  // Direct aggregation doesn't hash.
+  if (!spill_streams_.empty() || use_direct_agg_) return false;
+  // A hash table that fits in the cache is cheap to probe, whatever the reduction.
+  int64_t cache_size = CpuInfo::CacheSize(CpuInfo::L2_CACHE);
+  if (cache_size <= 0) cache_size = 256 * 1024;
+  if (MemUsage() <= cache_size) return false;
+  return batch_rows < FLAGS_streaming_preagg_min_reduction * new_groups;
+}
+
+Status AggregationNode::PassThroughRows(RuntimeState* state, RowBatch* row_batch) {
+  DCHECK(passing_through_);
+  DCHECK(!output_iterator_.HasNext());
+  // The groups in the hash table have all been returned; their memory is transferred
+  // to 'row_batch' along with that of the passed-through rows.
+  if (hash_tbl_->size() > 0) hash_tbl_->Clear();
+  Expr** conjuncts = &conjuncts_[0];
+  int num_conjuncts = conjuncts_.size();
+  while (!row_batch->IsFull() && !ReachedLimit()) {
+    if (child_batch_idx_ == child_batch_->num_rows()) {
+      child_batch_->Reset();
+      child_batch_idx_ = 0;
+      if (child_eos_) {
+        passing_through_ = false;
+        break;
+      }
+      RETURN_IF_ERROR(state->CheckQueryState());
+      RETURN_IF_ERROR(children_[0]->GetNext(state, child_batch_.get(), &child_eos_));
+      num_input_rows_ += child_batch_->num_rows();
+      SharedExpr::InvalidateCachedValues();
+      hash_tbl_->EvalProbeBatch(child_batch_.get());
+      continue;
+    }
+    // The hash table is empty; this only loads the row's grouping values for
+    // ConstructAggTuple().
+    HashTable::Iterator entry = hash_tbl_->FindBatchRow(child_batch_idx_);
+    DCHECK(!entry.HasNext());
+    AggregationTuple* agg_tuple = ConstructAggTuple();
+    UpdateAggTuple(agg_tuple, child_batch_->GetRow(child_batch_idx_));
+    ++child_batch_idx_;
+    COUNTER_UPDATE(rows_passed_through_counter_, 1);
+
+    int row_idx = row_batch->AddRow();
+    TupleRow* row = row_batch->GetRow(row_idx);
+    row->SetTuple(0, agg_tuple->tuple());
+    if (ExecNode::EvalConjuncts(conjuncts, num_conjuncts, row)) {
+      VLOG_ROW << "output row: " << PrintRow(row, row_desc());
+      row_batch->CommitLastRow();
+      ++num_rows_returned_;
+    }
+  }
+  row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), false);
+  string_buffer_free_list_.Reset();
+  if (string_heap_ != NULL) string_heap_->Reset(tuple_pool_.get());
+  return Status::OK;
+}
+
+Status AggregationNode::GetNextSorted(RuntimeState* state, RowBatch* row_batch) {
+  DCHECK(sorted_group_ == NULL);
+  // The hash table stays empty; it only evaluates the grouping exprs over the input.
+  while (!row_batch->IsFull() && !ReachedLimit()) {
+    if (child_batch_idx_ == child_batch_->num_rows()) {
+      if (child_eos_) {
+        if (sorted_group_ != NULL) OutputSortedGroup(row_batch);
+        break;
+      }
+      // The rows of sorted_group_ have been aggregated, the batch can go.
+      child_batch_->Reset();
+      child_batch_idx_ = 0;
+      RETURN_IF_ERROR(state->CheckQueryState());
+      RETURN_IF_ERROR(children_[0]->GetNext(state, child_batch_.get(), &child_eos_));
+      num_input_rows_ += child_batch_->num_rows();
+      SharedExpr::InvalidateCachedValues();
+      hash_tbl_->EvalProbeBatch(child_batch_.get());
+      continue;
+    }
+    HashTable::Iterator entry = hash_tbl_->FindBatchRow(child_batch_idx_);
+    DCHECK(!entry.HasNext());
+    if (sorted_group_ != NULL && !IsSortedGroupRow()) {
+      // The row starts the next group, which is constructed in the next iteration
+      // unless 'row_batch' is now full.
+      OutputSortedGroup(row_batch);
+      continue;
+    }
+    if (sorted_group_ == NULL) sorted_group_ = ConstructAggTuple();
+    UpdateAggTuple(sorted_group_, child_batch_->GetRow(child_batch_idx_));
+    ++child_batch_idx_;
+  }
+  // Every group constructed so far has been returned.
+  DCHECK(sorted_group_ == NULL);
+  row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), false);
+  string_buffer_free_list_.Reset();
+  if (string_heap_ != NULL) string_heap_->Reset(tuple_pool_.get());
+  for (int i = 0; i < distinct_sets_.size(); ++i) {
+    if (distinct_sets_[i] != NULL) distinct_sets_[i]->Reset(tuple_pool_.get());
+  }
+  return Status::OK;
+}
+
+bool AggregationNode::IsSortedGroupRow() {
+  Tuple* group = sorted_group_->tuple();
+  for (int i = 0; i < probe_exprs_.size(); ++i) {
+    SlotDescriptor* slot_desc = agg_tuple_desc_->slots()[i];
+    bool group_null = group->IsNull(slot_desc->null_indicator_offset());
+    if (hash_tbl_->last_expr_value_null(i)) {
+      if (!group_null) return false;
+    } else if (group_null || !RawValue::Eq(hash_tbl_->last_expr_value(i),
+        group->GetSlot(slot_desc->tuple_offset()), slot_desc->type())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void AggregationNode::OutputSortedGroup(RowBatch* row_batch) {
+  DCHECK(sorted_group_ != NULL);
+  if (needs_finalize_) FinalizeAggTuple(sorted_group_);
+  int row_idx = row_batch->AddRow();
+  TupleRow* row = row_batch->GetRow(row_idx);
+  row->SetTuple(0, sorted_group_->tuple());
+  if (ExecNode::EvalConjuncts(&conjuncts_[0], conjuncts_.size(), row)) {
+    VLOG_ROW << "output row: " << PrintRow(row, row_desc());
+    row_batch->CommitLastRow();
+    ++num_rows_returned_;
+  }
+  sorted_group_ = NULL;
+}
+
+Status AggregationNode::StartSpilling(RuntimeState* state) {
+  DCHECK(spill_streams_.empty());
+  if (input_level_ >= MAX_PARTITION_DEPTH) {
+    stringstream ss;
+    ss << "Aggregation exceeded its memory limit of " << mem_limit_
+       << " bytes (--agg_mem_limit=" << FLAGS_agg_mem_limit << ") after repartitioning its input "
+       << MAX_PARTITION_DEPTH << " times";
+    return Status(ss.str());
+  }
+  VLOG_QUERY << "AggregationNode(node_id=" << id() << ") reached memory limit with "
+             << hash_tbl_->size() << " groups; spilling partitions of level "
+             << input_level_ + 1;
+  for (int i = 0; i < NUM_SPILL_PARTITIONS; ++i) {
+    spill_streams_.push_back(new SpillStream(state, *input_row_desc_));
+    spill_batches_.push_back(new RowBatch(*input_row_desc_, state->batch_size()));
+    spill_batches_.back()->set_is_self_contained(true);
+    RETURN_IF_ERROR(spill_streams_.back()->Init());
+  }
+  return Status::OK;
+}
+
+Status AggregationNode::ProcessRowBatchSpilling(RuntimeState* state, RowBatch* batch) {
+  const vector<TupleDescriptor*>& tuple_descs = input_row_desc_->tuple_descriptors();
+  hash_tbl_->EvalProbeBatch(batch);
+  for (int i = 0; i < batch->num_rows(); ++i) {
+    TupleRow* row = batch->GetRow(i);
+    HashTable::Iterator entry = hash_tbl_->FindBatchRow(i);
+    if (entry.HasNext()) {
+      UpdateAggTuple(
+          reinterpret_cast<AggregationTuple*>(entry.GetRow()->GetTuple(0)), row);
+      continue;
+    }
+
+    int partition = GetSpillPartition();
+    RowBatch* spill_batch = spill_batches_[partition];
+    int row_idx = spill_batch->AddRow();
+    TupleRow* spill_row = spill_batch->GetRow(row_idx);
+    for (int j = 0; j < tuple_descs.size(); ++j) {
+      Tuple* tuple = row->GetTuple(j);
+      spill_row->SetTuple(j, tuple == NULL ? NULL :
+          tuple->DeepCopy(*tuple_descs[j], spill_batch->tuple_data_pool()));
+    }
+    spill_batch->CommitLastRow();
+    if (spill_batch->IsFull()) {
+      // Serialize() resets the (self-contained) batch
+      RETURN_IF_ERROR(spill_streams_[partition]->AddBatch(spill_batch));
+    }
+    COUNTER_UPDATE(rows_spilled_counter_, 1);
+  }
+  return Status::OK;
+}
+
+int AggregationNode::GetSpillPartition() {
+  uint32_t hash = 0;
+  for (int i = 0; i < probe_exprs_.size(); ++i) {
+    void* value =
+        hash_tbl_->last_expr_value_null(i) ? NULL : hash_tbl_->last_expr_value(i);
+    hash = RawValue::GetHashValue(value, probe_exprs_[i]->type(), hash);
+  }
+  // The hash table buckets are computed from (crc) hashes of the same values, and
+  // all rows of a spilled partition share the hash of the levels above; rehash with
+  // a level-specific seed so that the partitions at each level are independent.
+  hash = HashUtil::FvnHash(&hash, sizeof(hash), HashUtil::FVN_SEED + input_level_);
+  return hash % NUM_SPILL_PARTITIONS;
+}
+
+Status AggregationNode::FinishSpilling(RuntimeState* state) {
+  for (int i = 0; i < spill_streams_.size(); ++i) {
+    RETURN_IF_ERROR(spill_streams_[i]->AddBatch(spill_batches_[i]));
+    delete spill_batches_[i];
+    spill_batches_[i] = NULL;
+    SpilledPartition partition;
+    partition.stream = spill_streams_[i];
+    partition.level = input_level_ + 1;
+    if (partition.stream->num_rows() == 0) {
+      delete partition.stream;
+    } else {
+      COUNTER_UPDATE(partitions_spilled_counter_, 1);
+      COUNTER_UPDATE(bytes_spilled_counter_, partition.stream->bytes_written());
+      spilled_partitions_.push_back(partition);
+    }
+    spill_streams_[i] = NULL;
+  }
+  spill_streams_.clear();
+  spill_batches_.clear();
+  return Status::OK;
+}
+
+Status AggregationNode::AggregateSpilledPartition(
+    RuntimeState* state, RowBatch* row_batch) {
+  DCHECK(!spilled_partitions_.empty());
+  DCHECK(singleton_output_tuple_ == NULL);
+  SpilledPartition partition = spilled_partitions_.back();
+  spilled_partitions_.pop_back();
+  scoped_ptr<SpillStream> stream(partition.stream);
+  input_level_ = partition.level;
+
+  // Start over with an empty hash table.  Returned rows may still reference the
+  // groups of the previous partition.
+  row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), false);
+  string_buffer_free_list_.Reset();
+  if (string_heap_ != NULL) string_heap_->Reset(tuple_pool_.get());
+  for (int i = 0; i < distinct_sets_.size(); ++i) {
+    if (distinct_sets_[i] != NULL) distinct_sets_[i]->Reset(tuple_pool_.get());
+  }
+  hash_tbl_->Clear();
+
+  SCOPED_TIMER(build_timer_);
+  RETURN_IF_ERROR(stream->PrepareForRead());
+  scoped_ptr<RowBatch> batch;
+  while (true) {
+    RETURN_IF_ERROR(state->CheckQueryState());
+    bool eos;
+    RETURN_IF_ERROR(stream->GetNext(&batch, &eos));
+    if (eos) break;
+    RETURN_IF_ERROR(ProcessBatch(state, batch.get()));
+  }
+  RETURN_IF_ERROR(FinishSpilling(state));
+  VLOG_FILE << "aggregated " << stream->num_rows() << " spilled rows of level "
+            << partition.level << " into " << hash_tbl_->size() << " output rows";
+  output_iterator_ = hash_tbl_->Begin();
+  return Status::OK;
+}
+
 AggregationTuple* AggregationNode::ConstructAggTuple() {
   AggregationTuple* agg_out_tuple = 
       AggregationTuple::Create(agg_tuple_desc_->byte_size(), 
@@ -263,10 +1051,57 @@ AggregationTuple* AggregationNode::ConstructAggTuple() {
     } else {
       void* src = hash_tbl_->last_expr_value(i);
       void* dst = agg_tuple->GetSlot((*slot_desc)->tuple_offset());
-      RawValue::Write(src, dst, (*slot_desc)->type(), tuple_pool_.get());
+      if (string_heap_ != NULL && (*slot_desc)->type() == TYPE_STRING) {
+        *reinterpret_cast<StringValue*>(dst) =
+            string_heap_->Intern(*reinterpret_cast<StringValue*>(src));
+      } else {
+        RawValue::Write(src, dst, (*slot_desc)->type(), tuple_pool_.get());
+      }
+    }
+  }
+  InitAggSlots(agg_out_tuple);
+  return agg_out_tuple;
+}
+
+AggregationTuple* AggregationNode::ConstructDirectAggTuple(int idx) {
+  AggregationTuple* agg_out_tuple =
+      AggregationTuple::Create(agg_tuple_desc_->byte_size(),
+          num_string_slots_, tuple_pool_.get());
+  Tuple* agg_tuple = agg_out_tuple->tuple();
+  SlotDescriptor* slot_desc = agg_tuple_desc_->slots()[0];
+  if (idx == num_direct_groups_) {
+    agg_tuple->SetNull(slot_desc->null_indicator_offset());
+  } else {
+    int64_t value = direct_min_ + idx;
+    void* slot = agg_tuple->GetSlot(slot_desc->tuple_offset());
+    switch (slot_desc->type()) {
+      case TYPE_BOOLEAN:
+        *reinterpret_cast<bool*>(slot) = value;
+        break;
+      case TYPE_TINYINT:
+        *reinterpret_cast<int8_t*>(slot) = value;
+        break;
+      case TYPE_SMALLINT:
+        *reinterpret_cast<int16_t*>(slot) = value;
+        break;
+      case TYPE_INT:
+        *reinterpret_cast<int32_t*>(slot) = value;
+        break;
+      case TYPE_BIGINT:
+        *reinterpret_cast<int64_t*>(slot) = value;
+        break;
+      default:
+        DCHECK(false) << "invalid type: " << TypeToString(slot_desc->type());
     }
   }
+  InitAggSlots(agg_out_tuple);
+  return agg_out_tuple;
+}
 
+void AggregationNode::InitAggSlots(AggregationTuple* agg_out_tuple) {
+  Tuple* agg_tuple = agg_out_tuple->tuple();
+  vector<SlotDescriptor*>::const_iterator slot_desc =
+      agg_tuple_desc_->slots().begin() + probe_exprs_.size();
   int string_slot_idx = -1;
 
   ExprValue default_value;
@@ -315,10 +1150,103 @@ AggregationTuple* AggregationNode::ConstructAggTuple() {
         agg_expr->agg_op() == TAggregationOp::MERGE_PCSA) {
       ConstructDistinctEstimateSlot(agg_out_tuple,
           (*slot_desc)->null_indicator_offset(), string_slot_idx, slot);
+    } else if (agg_expr->agg_op() == TAggregationOp::DISTINCT_HLL ||
+        agg_expr->agg_op() == TAggregationOp::MERGE_HLL) {
+      ConstructHllSlot(agg_out_tuple, (*slot_desc)->null_indicator_offset(),
+          string_slot_idx, slot);
     }
   }
+}
 
-  return agg_out_tuple;
+void AggregationNode::InitDirectAgg() {
+  if (!FLAGS_direct_aggregation || probe_exprs_.size() != 1) return;
+  switch (probe_exprs_[0]->type()) {
+    case TYPE_BOOLEAN:
+      direct_min_ = 0;
+      num_direct_groups_ = 2;
+      direct_range_set_ = true;
+      break;
+    case TYPE_TINYINT:
+      direct_min_ = numeric_limits<int8_t>::min();
+      num_direct_groups_ = 1 << 8;
+      direct_range_set_ = true;
+      break;
+    case TYPE_SMALLINT:
+      direct_min_ = numeric_limits<int16_t>::min();
+      num_direct_groups_ = 1 << 16;
+      direct_range_set_ = true;
+      break;
+    case TYPE_INT:
+    case TYPE_BIGINT:
+      num_direct_groups_ = MAX_DIRECT_GROUPS;
+      direct_range_set_ = false;
+      break;
+    default:
+      return;
+  }
+  DCHECK_LE(num_direct_groups_, MAX_DIRECT_GROUPS);
+  use_direct_agg_ = true;
+  direct_tuples_.resize(num_direct_groups_ + 1, NULL);
+}
+
+// Returns the integer value of the grouping value 'value' of type 'type'.
+static inline int64_t GetDirectValue(const void* value, PrimitiveType type) {
+  switch (type) {
+    case TYPE_BOOLEAN:
+      return *reinterpret_cast<const bool*>(value);
+    case TYPE_TINYINT:
+      return *reinterpret_cast<const int8_t*>(value);
+    case TYPE_SMALLINT:
+      return *reinterpret_cast<const int16_t*>(value);
+    case TYPE_INT:
+      return *reinterpret_cast<const int32_t*>(value);
+    case TYPE_BIGINT:
+      return *reinterpret_cast<const int64_t*>(value);
+    default:
+      DCHECK(false) << "invalid type: " << TypeToString(type);
+      return 0;
+  }
+}
+
+bool AggregationNode::EvalDirectIdxs(RowBatch* batch) {
+  Expr* expr = probe_exprs_[0];
+  PrimitiveType type = expr->type();
+  int num_rows = batch->num_rows();
+  if (!direct_range_set_) {
+    // The range starts at the smallest value of the first batch with non-NULL values.
+    for (int i = 0; i < num_rows; ++i) {
+      void* value = expr->GetValue(batch->GetRow(i));
+      if (value == NULL) continue;
+      int64_t v = GetDirectValue(value, type);
+      if (!direct_range_set_ || v < direct_min_) direct_min_ = v;
+      direct_range_set_ = true;
+    }
+  }
+  direct_idxs_.resize(num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    void* value = expr->GetValue(batch->GetRow(i));
+    if (value == NULL) {
+      direct_idxs_[i] = num_direct_groups_;
+      continue;
+    }
+    // Values below direct_min_ wrap around to large indexes.
+    uint64_t idx = static_cast<uint64_t>(GetDirectValue(value, type))
+        - static_cast<uint64_t>(direct_min_);
+    if (idx >= static_cast<uint64_t>(num_direct_groups_)) return false;
+    direct_idxs_[i] = idx;
+  }
+  return true;
+}
+
+void AggregationNode::SwitchToHashAgg() {
+  DCHECK(use_direct_agg_);
+  for (int i = 0; i < direct_tuples_.size(); ++i) {
+    if (direct_tuples_[i] == NULL) continue;
+    hash_tbl_->Insert(reinterpret_cast<TupleRow*>(&direct_tuples_[i]));
+  }
+  vector<AggregationTuple*>().swap(direct_tuples_);
+  vector<int>().swap(direct_idxs_);
+  use_direct_agg_ = false;
 }
 
 char* AggregationNode::AllocateStringBuffer(int new_size, int* allocated_size) {
@@ -415,6 +1343,16 @@ void UpdateSumSlot(Tuple* tuple, const NullIndicatorOffset& null_indicator_offse
   }
 }
 
+bool AggregationNode::IsNewDistinctValue(int agg_idx, AggregationTuple* tuple,
+    TupleRow* row) {
+  Expr* agg_expr = aggregate_exprs_[agg_idx];
+  for (int i = 0; i < agg_expr->GetNumChildren(); ++i) {
+    distinct_values_[i] = agg_expr->GetChild(i)->GetValue(row);
+    if (distinct_values_[i] == NULL) return false;
+  }
+  return distinct_sets_[agg_idx]->Insert(tuple, &distinct_values_[0]);
+}
+
 void AggregationNode::UpdateAggTuple(AggregationTuple* agg_out_tuple, TupleRow* row) {
   DCHECK(agg_out_tuple != NULL);
   Tuple* tuple = agg_out_tuple->tuple();
@@ -430,6 +1368,12 @@ void AggregationNode::UpdateAggTuple(AggregationTuple* agg_out_tuple, TupleRow*
     // current slot in the array of string buffer lengths
     if (agg_expr->type() == TYPE_STRING) ++string_slot_idx;
 
+    // DISTINCT aggregates only see each of their group's values once
+    if (agg_expr->is_distinct()
+        && !IsNewDistinctValue(expr - aggregate_exprs_.begin(), agg_out_tuple, row)) {
+      continue;
+    }
+
     // deal with COUNT(*) separately (no need to check the actual child expr value)
     if (agg_expr->is_star()) {
       DCHECK_EQ(agg_expr->agg_op(), TAggregationOp::COUNT);
@@ -566,6 +1510,16 @@ void AggregationNode::UpdateAggTuple(AggregationTuple* agg_out_tuple, TupleRow*
         UpdateMergeEstimateSlot(agg_out_tuple, string_slot_idx, slot, value);
         break;
 
+      case TAggregationOp::DISTINCT_HLL:
+        UpdateHllSlot(agg_out_tuple, string_slot_idx, slot, value,
+            agg_expr->GetChild(0)->type());
+        break;
+
+      case TAggregationOp::MERGE_HLL:
+        DCHECK_EQ(agg_expr->GetChild(0)->type(), TYPE_STRING);
+        MergeHllSlot(agg_out_tuple, string_slot_idx, slot, value);
+        break;
+
       default:
         DCHECK(false) << "bad aggregate operator: " << agg_expr->agg_op();
     }
@@ -596,6 +1550,10 @@ void AggregationNode::FinalizeAggTuple(AggregationTuple* agg_out_tuple) {
         // Convert the bit vector into a number
         FinalizeEstimateSlot(string_slot_idx, slot, agg_expr->agg_op());
         break;
+      case TAggregationOp::DISTINCT_HLL:
+      case TAggregationOp::MERGE_HLL:
+        FinalizeHllSlot(agg_out_tuple, string_slot_idx, slot);
+        break;
         // For all other aggregate, do nothing.
       default:
         break;
@@ -764,6 +1722,11 @@ Function* AggregationNode::CodegenUpdateAggTuple(LlvmCodeGen* codegen) {
 
   for (int i = 0; i < aggregate_exprs_.size(); ++i) {
     AggregateExpr* agg_expr = static_cast<AggregateExpr*>(aggregate_exprs_[i]);
+    if (agg_expr->is_distinct()) {
+      VLOG_QUERY << "Could not codegen UpdateAggTuple because "
+                 << "DISTINCT aggregation is not yet supported.";
+      return NULL;
+    }
     // If the agg_expr can't be generated, bail generating this function
     if (!agg_expr->is_star() && agg_expr->codegen_fn() == NULL) {
       VLOG_QUERY << "Could not codegen UpdateAggTuple because the "
@@ -774,7 +1737,9 @@ Function* AggregationNode::CodegenUpdateAggTuple(LlvmCodeGen* codegen) {
     if (agg_expr->agg_op() == TAggregationOp::DISTINCT_PC
         || agg_expr->agg_op() == TAggregationOp::DISTINCT_PCSA
         || agg_expr->agg_op() == TAggregationOp::MERGE_PCSA
-        || agg_expr->agg_op() == TAggregationOp::MERGE_PC) {
+        || agg_expr->agg_op() == TAggregationOp::MERGE_PC
+        || agg_expr->agg_op() == TAggregationOp::DISTINCT_HLL
+        || agg_expr->agg_op() == TAggregationOp::MERGE_HLL) {
       return NULL;
     }
   }
@@ -871,26 +1836,18 @@ Function* AggregationNode::CodegenProcessRowBatch(
     Function* equals_fn = hash_tbl_->CodegenEquals(codegen);
     if (equals_fn == NULL) return NULL;
     
-    // Codegen for evaluating build rows
-    Function* eval_build_row_fn = hash_tbl_->CodegenEvalTupleRow(codegen, true);
-    if (eval_build_row_fn == NULL) return NULL;
-
     // Codegen for evaluating probe rows
     Function* eval_probe_row_fn = hash_tbl_->CodegenEvalTupleRow(codegen, false);
     if (eval_probe_row_fn == NULL) return NULL;
 
     // Replace call sites
-    process_batch_fn = codegen->ReplaceCallSites(process_batch_fn, false,
-        eval_build_row_fn, "EvalBuildRow", &replaced);
-    DCHECK_EQ(replaced, 1);
-    
     process_batch_fn = codegen->ReplaceCallSites(process_batch_fn, false,
         eval_probe_row_fn, "EvalProbeRow", &replaced);
     DCHECK_EQ(replaced, 1);
 
     process_batch_fn = codegen->ReplaceCallSites(process_batch_fn, false,
         hash_fn, "HashCurrentRow", &replaced);
-    DCHECK_EQ(replaced, 2);
+    DCHECK_EQ(replaced, 1);
 
     process_batch_fn = codegen->ReplaceCallSites(process_batch_fn, false,
         equals_fn, "Equals", &replaced);
@@ -905,6 +1862,24 @@ Function* AggregationNode::CodegenProcessRowBatch(
   return codegen->OptimizeFunctionWithExprs(process_batch_fn);
 }
 
+Function* AggregationNode::CodegenProcessRowBatchDirect(
+    LlvmCodeGen* codegen, Function* update_tuple_fn) {
+  SCOPED_TIMER(codegen->codegen_timer());
+  DCHECK(update_tuple_fn != NULL);
+  Function* process_batch_fn =
+      codegen->GetFunction(IRFunction::AGG_NODE_PROCESS_ROW_BATCH_DIRECT);
+  if (process_batch_fn == NULL) {
+    LOG(ERROR) << "Could not find AggregationNode::ProcessRowBatchDirect in module.";
+    return NULL;
+  }
+  int replaced = 0;
+  process_batch_fn = codegen->ReplaceCallSites(process_batch_fn, false,
+      update_tuple_fn, "UpdateAggTuple", &replaced);
+  DCHECK_EQ(replaced, 1) << "One call site should be replaced.";
+  DCHECK(process_batch_fn != NULL);
+  return codegen->OptimizeFunctionWithExprs(process_batch_fn);
+}
+
 void AggregationNode::ConstructDistinctEstimateSlot(AggregationTuple* agg_tuple,
     const NullIndicatorOffset& null_indicator_offset, int string_slot_idx,
     void* slot) {
@@ -1095,5 +2070,79 @@ string AggregationNode::DistinctEstimateBitMapToString(char* v) {
   return debugstr.str();
 }
 
+void AggregationNode::ReserveStringSlot(AggregationTuple* tuple, int string_slot_idx,
+    StringValue* dst, int len) {
+  int32_t* string_buffer_lengths = tuple->BufferLengths(agg_tuple_desc_->byte_size());
+  int curr_size = string_buffer_lengths[string_slot_idx];
+  if (curr_size >= len) return;
+  char* buffer = AllocateStringBuffer(len, &(string_buffer_lengths[string_slot_idx]));
+  memcpy(buffer, dst->ptr, dst->len);
+  string_buffer_free_list_.Add(reinterpret_cast<uint8_t*>(dst->ptr), curr_size);
+  dst->ptr = buffer;
+}
+
+void AggregationNode::ConstructHllSlot(AggregationTuple* agg_tuple,
+    const NullIndicatorOffset& null_indicator_offset, int string_slot_idx,
+    void* slot) {
+  StringValue* state = static_cast<StringValue*>(slot);
+  int32_t* string_buffer_lengths = agg_tuple->BufferLengths(
+      agg_tuple_desc_->byte_size());
+  DCHECK_EQ(string_buffer_lengths[string_slot_idx], 0);
+  state->ptr = AllocateStringBuffer(HyperLogLog::EMPTY_LEN,
+      &(string_buffer_lengths[string_slot_idx]));
+  HyperLogLog::Init(state);
+  agg_tuple->tuple()->SetNotNull(null_indicator_offset);
+}
+
+// Returns the buffer size to grow a HyperLogLog state with a buffer of 'curr_size'
+// bytes to so that it holds 'len' bytes.  Sparse states grow geometrically so that
+// they don't reallocate for every new register.
+static inline int HllBufferSize(int curr_size, int len) {
+  return min(max(len, 2 * curr_size), HyperLogLog::DENSE_LEN);
+}
+
+inline void AggregationNode::UpdateHllSlot(AggregationTuple* agg_tuple,
+    int string_slot_idx, void* slot, void* value, PrimitiveType type) {
+  DCHECK(value != NULL);
+  StringValue* state = static_cast<StringValue*>(slot);
+  uint32_t hash_value = RawValue::GetHashValue(value, type, 0);
+  if (state->ptr[0] == HyperLogLog::SPARSE) {
+    int len = HyperLogLog::UpdateLen(*state, hash_value);
+    int32_t* string_buffer_lengths =
+        agg_tuple->BufferLengths(agg_tuple_desc_->byte_size());
+    int curr_size = string_buffer_lengths[string_slot_idx];
+    if (len > curr_size) {
+      ReserveStringSlot(agg_tuple, string_slot_idx, state,
+          HllBufferSize(curr_size, len));
+    }
+  }
+  HyperLogLog::Update(hash_value, state);
 }
 
+inline void AggregationNode::MergeHllSlot(AggregationTuple* agg_tuple,
+    int string_slot_idx, void* slot, void* value) {
+  DCHECK(value != NULL);
+  StringValue* state = static_cast<StringValue*>(slot);
+  StringValue* src_state = static_cast<StringValue*>(value);
+  int len = HyperLogLog::MergeLen(*state, *src_state);
+  int32_t* string_buffer_lengths =
+      agg_tuple->BufferLengths(agg_tuple_desc_->byte_size());
+  int curr_size = string_buffer_lengths[string_slot_idx];
+  if (len > curr_size) {
+    ReserveStringSlot(agg_tuple, string_slot_idx, state, HllBufferSize(curr_size, len));
+  }
+  HyperLogLog::Merge(*src_state, state);
+}
+
+void AggregationNode::FinalizeHllSlot(AggregationTuple* agg_tuple, int string_slot_idx,
+    void* slot) {
+  StringValue* state = static_cast<StringValue*>(slot);
+  // We're overwriting the state with the result in the same string buffer.
+  stringstream out;
+  out << HyperLogLog::Estimate(*state);
+  ReserveStringSlot(agg_tuple, string_slot_idx, state, out.str().length());
+  memcpy(state->ptr, out.str().c_str(), out.str().length());
+  state->len = out.str().length();
+}
+
+}
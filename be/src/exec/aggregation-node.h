@@ -16,13 +16,17 @@
 #ifndef IMPALA_EXEC_AGGREGATION_NODE_H
 #define IMPALA_EXEC_AGGREGATION_NODE_H
 
+#include <deque>
 #include <functional>
+#include <map>
+#include <string>
 #include <boost/scoped_ptr.hpp>
 
 #include "exec/exec-node.h"
 #include "exec/hash-table.h"
 #include "runtime/descriptors.h"  // for TupleId
 #include "runtime/free-list.h"
+#include "runtime/join-build-cache.h"
 #include "runtime/mem-pool.h"
 
 namespace llvm {
@@ -33,9 +37,12 @@ namespace impala {
 
 class AggregateExpr;
 class AggregationTuple;
+class DistinctValueSet;
 class LlvmCodeGen;
 class RowBatch;
 struct RuntimeState;
+class SpillStream;
+class StringHeap;
 struct StringValue;
 class Tuple;
 class TupleDescriptor;
@@ -51,9 +58,69 @@ class TupleDescriptor;
 // will be appended to the end of the normal tuple data that stores the size of buffer 
 // for that string slot.  This also results in the correct alignment because StringValue 
 // slots are 8-byte aligned and form the tail end of the tuple.
+//
+// If the hash table and tuple pool grow beyond --agg_mem_limit, the node stops
+// creating new groups: input rows that belong to groups already in the hash table
+// are still aggregated in memory, while all other rows are hash-partitioned on the
+// grouping exprs and spilled to disk.  The groups in memory are complete once the
+// input is consumed and are returned first.  Each spilled partition is then
+// aggregated on its own, from scratch.  A partition that again exceeds the limit
+// is spilled and repartitioned with a different hash function, up to
+// MAX_PARTITION_DEPTH levels.
+//
+// DISTINCT aggregate functions (COUNT and SUM) are computed with a DistinctValueSet
+// per function, which records the parameter values each group has seen; a row only
+// updates the function's slot if its values are new to the group.  The sets are
+// part of the memory that counts against --agg_mem_limit, and spilled partitions
+// rebuild them along with their groups.  A DISTINCT aggregation without grouping
+// can't spill.
+//
+// A grouping pre-aggregation (whose output is merged by an aggregation in another
+// fragment) streams: if its hash table outgrows the L2 cache while a batch of input
+// rows barely reduces to fewer groups (see --streaming_preagg_min_reduction), the
+// node returns the groups it has and then passes the remaining input rows through,
+// each as an aggregation tuple of its own, instead of aggregating them.  The merge
+// aggregation computes the same result either way.
+//
+// An aggregation with a single integer grouping expr whose values fall into a range of
+// at most MAX_DIRECT_GROUPS values (the whole domain of BOOLEAN, TINYINT and SMALLINT,
+// or, for INT and BIGINT, a range starting at the smallest value of the first input
+// batch) keeps its groups in an array indexed by the grouping value, so that rows are
+// aggregated without hashing or comparing keys.  Once an INT or BIGINT value falls
+// outside of the range, the groups move to the hash table and aggregation continues
+// there; at the end of the input they are moved there in any case, for the output.
+//
+// With --agg_num_partitions > 1, a grouping aggregation splits its input by a hash of
+// the grouping values among that many partition nodes: AggregationNodes without
+// children that the node creates from its own plan node.  The node collects rounds of
+// input batches, routes each row to its partition, and then has the partitions
+// aggregate their rows in parallel on the threads of ExecEnv::aggregation_pool().
+// Since every group belongs to exactly one partition, the partitions' groups don't
+// need to be merged; they are returned one partition after the other.  Each partition
+// spills on its own, with an equal share of --agg_mem_limit.
+//
+// If the planner knows that the input is sorted on the grouping exprs (see
+// TAggregationNode.input_is_sorted), the rows of each group are adjacent and the node
+// doesn't build a hash table: GetNext() aggregates the input one group at a time and
+// returns each group once a row of the next one arrives.  Memory use is bounded by
+// that of the groups of a single output batch, and the first rows are returned
+// without waiting for the whole input.
+//
+// The groups of a grouping pre-aggregation that reads a table scan directly are kept
+// across queries in ExecEnv::agg_state_cache(), one entry per scanned partition (see
+// TAggregationNode.partition_cache_keys).  The key of an entry also covers the scan
+// ranges of the partition that the instance reads.  Before the scan starts, the node
+// looks up the partitions and has the scan skip those that are cached; the others are
+// aggregated with a partition node each, to which the scan's batches are routed by
+// their partition.  Their groups are then cached and returned along with the cached
+// ones.  The merge aggregation finds the same groups as if all partitions had been
+// aggregated together.
 class AggregationNode : public ExecNode {
  public:
-  AggregationNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
+  // 'is_partition' is only set for the partition nodes that an AggregationNode creates.
+  AggregationNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs,
+                  bool is_partition = false);
+  virtual ~AggregationNode();
 
   virtual Status Prepare(RuntimeState* state);
   virtual Status Open(RuntimeState* state);
@@ -83,12 +150,43 @@ class AggregationNode : public ExecNode {
 
   boost::scoped_ptr<MemPool> tuple_pool_;
 
-  // IR for process row batch.  NULL if codegen is disabled.
-  llvm::Function* codegen_process_row_batch_fn_;
+  // If set, the string grouping values of new groups are interned in tuple_pool_
+  // instead of being copied, so groups share the data of equal strings.  NULL if there
+  // are no string grouping exprs or --intern_grouping_strings is off.
+  boost::scoped_ptr<StringHeap> string_heap_;
+
+  // The set of distinct values of each DISTINCT aggregate expr, and NULL for the other
+  // aggregate exprs; indexed like aggregate_exprs_.  Owned by the runtime state's
+  // object pool.
+  std::vector<DistinctValueSet*> distinct_sets_;
+
+  // Parameter values of the DISTINCT aggregate expr that UpdateAggTuple() evaluates.
+  std::vector<void*> distinct_values_;
 
   typedef void (*ProcessRowBatchFn)(AggregationNode*, RowBatch*);
-  // Jitted ProcessRowBatch function pointer.  Null if codegen is disabled.
+  // Jitted ProcessRowBatch function pointer.  Null if codegen is disabled or until
+  // the function has been compiled, which can happen while the node is running.
   ProcessRowBatchFn process_row_batch_fn_;
+  // Jitted ProcessRowBatchDirect, likewise.
+  ProcessRowBatchFn process_row_batch_direct_fn_;
+
+  // Maximum number of groups (not counting the NULL group) of direct aggregation.
+  static const int MAX_DIRECT_GROUPS = 65536;
+
+  // True while the groups are kept in direct_tuples_ rather than hash_tbl_.
+  bool use_direct_agg_;
+
+  // Group of each grouping value v in [direct_min_, direct_min_ + num_direct_groups_),
+  // at index v - direct_min_, followed by the group of NULL; NULL for groups that have
+  // no rows yet.  For INT and BIGINT grouping exprs, direct_min_ is only set (and
+  // direct_range_set_ true) once the first non-NULL value has been seen.
+  std::vector<AggregationTuple*> direct_tuples_;
+  int64_t direct_min_;
+  int num_direct_groups_;
+  bool direct_range_set_;
+
+  // Index into direct_tuples_ of each row of the batch being aggregated.
+  std::vector<int> direct_idxs_;
 
   // Certain aggregates require a finalize step, which is the final step of the
   // aggregate after consuming all input rows. The finalize step converts the aggregate
@@ -96,18 +194,227 @@ class AggregationNode : public ExecNode {
   // a finalize step.
   bool needs_finalize_;
 
+  // True if this is a grouping pre-aggregation that may pass rows through, and
+  // --streaming_preaggregation is on.
+  bool is_streaming_preagg_;
+
+  // True once the node passes input rows through; the rest of the child's output is
+  // read in GetNext().  Reset when the child's output is exhausted.
+  bool passing_through_;
+
+  // True if the input is sorted on the grouping exprs, so that the groups are
+  // aggregated one at a time by GetNextSorted().
+  bool sorted_input_;
+
+  // The group of the rows GetNextSorted() is aggregating; NULL between groups.
+  AggregationTuple* sorted_group_;
+
+  // Batch of child rows; child_batch_idx_ is the next row to pass through (or, with
+  // sorted_input_, to aggregate) and child_eos_ is set once the child has returned
+  // its last batch.
+  boost::scoped_ptr<RowBatch> child_batch_;
+  int child_batch_idx_;
+  bool child_eos_;
+
+  // Number of rows read from the child
+  int64_t num_input_rows_;
+
+  // Row descriptor of the input rows: the child's, or that of the parent's child for
+  // a partition node.
+  const RowDescriptor* input_row_desc_;
+
+  // Memory limit of the hash table and tuple pool; --agg_mem_limit, divided among the
+  // partition nodes if there are any.
+  int64_t mem_limit_;
+
+  // True for a partition node of another AggregationNode.
+  bool is_partition_;
+
+  // The partition nodes that aggregate the input in parallel, or those that aggregate
+  // the scanned partitions that aren't cached; empty if the node aggregates its input
+  // itself.  Owned by the object pool.
+  std::vector<AggregationNode*> partitions_;
+
+  // Cache key of the groups of each scanned partition, by partition id (see
+  // TAggregationNode.partition_cache_keys); empty if the groups aren't cached.
+  std::map<int64_t, std::string> partition_cache_keys_;
+
+  // The plan node, to create the partition nodes in Open().  Only set with
+  // partition_cache_keys_.
+  boost::scoped_ptr<TPlanNode> thrift_plan_node_;
+
+  // The key in ExecEnv::agg_state_cache() of the groups of each partition node,
+  // indexed like partitions_; empty if they can't be cached.
+  std::vector<std::string> partition_state_keys_;
+
+  // The cached groups of the partitions, returned after those of the partition nodes
+  // (that weren't cached), and the next of their rows to return.
+  std::vector<JoinBuildCache::EntryPtr> cached_states_;
+  int next_cached_state_;
+  int next_cached_row_;
+
+  // False for the partition nodes that are created in Open(), once the fragment's
+  // functions have been compiled.
+  bool use_codegen_;
+
+  // Capacity of the batches of partition_batches_, in input batches.
+  static const int PARTITION_BATCH_FACTOR = 2;
+
+  // The rows routed to each partition in the current round.  The batches only hold
+  // pointers to the tuples of round_batches_.
+  std::vector<RowBatch*> partition_batches_;
+
+  // The child's batches of the current round.
+  std::vector<RowBatch*> round_batches_;
+
+  // The node whose groups are being returned: this node, or the partition node at
+  // next_output_partition_ - 1.
+  AggregationNode* output_node_;
+  int next_output_partition_;
+
   // Time spent processing the child rows
   RuntimeProfile::Counter* build_timer_;
   // Time spent returning the aggregated rows
   RuntimeProfile::Counter* get_results_timer_;
   // Num buckets in hash table
   RuntimeProfile::Counter* hash_table_buckets_counter_;   
+  // Number of partitions that were spilled to disk
+  RuntimeProfile::Counter* partitions_spilled_counter_;
+  // Number of input rows that were spilled to disk
+  RuntimeProfile::Counter* rows_spilled_counter_;
+  // Bytes written to spill files
+  RuntimeProfile::Counter* bytes_spilled_counter_;
+  // Number of grouping strings that were deduplicated by string_heap_
+  RuntimeProfile::Counter* string_duplicates_counter_;
+  // Number of input rows that were passed through without aggregation
+  RuntimeProfile::Counter* rows_passed_through_counter_;
+  // Number of rounds of input batches that the partition nodes aggregated in parallel
+  RuntimeProfile::Counter* parallel_rounds_counter_;
+  // Number of scanned partitions whose groups were found in / added to the cache
+  RuntimeProfile::Counter* cache_hits_counter_;
+  RuntimeProfile::Counter* cache_inserts_counter_;
+
+  // Number of partitions the input is split into when the node spills.
+  static const int NUM_SPILL_PARTITIONS = 16;
+
+  // Maximum number of times the input of a group can be repartitioned.
+  static const int MAX_PARTITION_DEPTH = 4;
+
+  // A partition of input rows that was spilled to disk and still needs to be
+  // aggregated.  'level' is the number of times the rows have been partitioned.
+  struct SpilledPartition {
+    SpillStream* stream;
+    int level;
+  };
+
+  // Partitioning level of the input that is currently being aggregated
+  // (0 for the child's output).
+  int input_level_;
+
+  // If not empty, the memory limit has been reached and the rows of new groups are
+  // spilled to these partitions (of level input_level_ + 1) rather than aggregated.
+  // spill_batches_ buffers the rows for each partition (in the batches' own pools).
+  std::vector<SpillStream*> spill_streams_;
+  std::vector<RowBatch*> spill_batches_;
+
+  // Fully written partitions that have not been aggregated yet.  Processed as a
+  // stack so that repartitioned data is aggregated before its siblings.
+  std::deque<SpilledPartition> spilled_partitions_;
+
+  // Returns the memory used by the hash table and the aggregation tuples.
+  int64_t MemUsage() const;
+
+  // Aggregates 'batch'.  Switches to spilling once the memory limit is reached.
+  Status ProcessBatch(RuntimeState* state, RowBatch* batch);
+
+  // Reads the child's output and aggregates it with the partition nodes.
+  Status OpenPartitions(RuntimeState* state);
+
+  // Looks up the groups of the scanned partitions in the cache and opens the scan
+  // without the cached partitions.  Aggregates the others with a partition node each
+  // and caches their groups.
+  Status OpenCachedPartitions(RuntimeState* state);
+
+  // Fills 'row_batch' with the rows of cached_states_.
+  void OutputCachedStates(RowBatch* row_batch);
+
+  // Routes the rows of 'batch' to partition_batches_ by the hash of their grouping
+  // values.  Returns true if a partition batch doesn't have room for another batch
+  // of 'max_batch_rows' rows.
+  bool PartitionBatch(RowBatch* batch, int max_batch_rows);
+
+  // Has the partition nodes aggregate partition_batches_ in parallel and frees the
+  // batches of the round.
+  Status AggregateRound(RuntimeState* state);
+
+  // Deletes round_batches_.
+  void ClearRoundBatches();
+
+  // Work item of AggregateRound(): aggregates the batch of a partition node.
+  // 'arg' is a PartitionWork.
+  static Status AggregatePartitionBatch(void* arg);
+
+  // Returns true if a streaming pre-aggregation should pass the rest of its input
+  // through, given that the last input batch of 'batch_rows' rows added 'new_groups'
+  // groups.
+  bool ShouldPassThrough(int batch_rows, int64_t new_groups);
+
+  // Fills 'row_batch' with the child's rows, each converted into an aggregation tuple
+  // of its own.  The memory of the tuples (and of previously returned groups) is
+  // transferred to 'row_batch'.
+  Status PassThroughRows(RuntimeState* state, RowBatch* row_batch);
+
+  // Fills 'row_batch' with the groups of the sorted input.  A group is complete, and
+  // added to 'row_batch', once the first row of the next group or the end of the
+  // input is reached.  The memory of the groups is transferred to 'row_batch'.
+  Status GetNextSorted(RuntimeState* state, RowBatch* row_batch);
+
+  // Returns true if the grouping values of the last row passed to
+  // hash_tbl_->FindBatchRow() are those of sorted_group_.
+  bool IsSortedGroupRow();
+
+  // Finalizes sorted_group_, adds it to 'row_batch' if it passes the conjuncts and
+  // clears sorted_group_.
+  void OutputSortedGroup(RowBatch* row_batch);
+
+  // Creates the spill partitions for input_level_ + 1.  Returns an error if the
+  // input has already been repartitioned MAX_PARTITION_DEPTH times.
+  Status StartSpilling(RuntimeState* state);
+
+  // Aggregates rows of existing groups in 'batch' and spills the rest.
+  Status ProcessRowBatchSpilling(RuntimeState* state, RowBatch* batch);
+
+  // Flushes the spill buffers and queues the spill partitions for aggregation.
+  Status FinishSpilling(RuntimeState* state);
+
+  // Computes the spill partition of the last row passed to hash_tbl_->FindBatchRow().
+  int GetSpillPartition();
+
+  // Resets the hash table and aggregates the next spilled partition into it.
+  // The memory referenced by previously returned rows is transferred to 'row_batch'.
+  Status AggregateSpilledPartition(RuntimeState* state, RowBatch* row_batch);
 
   // Constructs a new aggregation output tuple (allocated from tuple_pool_),
   // initialized to grouping values computed over 'current_row_'.
   // Aggregation expr slots are set to their initial values.
   AggregationTuple* ConstructAggTuple();
 
+  // Constructs the aggregation output tuple of direct_tuples_[idx].
+  AggregationTuple* ConstructDirectAggTuple(int idx);
+
+  // Sets the aggregation expr slots of 'agg_tuple' to their initial values.
+  void InitAggSlots(AggregationTuple* agg_tuple);
+
+  // Sets up direct aggregation if the grouping expr allows it.
+  void InitDirectAgg();
+
+  // Computes direct_idxs_ for 'batch'.  Returns false if a grouping value falls outside
+  // the range of direct_tuples_.
+  bool EvalDirectIdxs(RowBatch* batch);
+
+  // Inserts the groups of direct_tuples_ into hash_tbl_ and stops direct aggregation.
+  void SwitchToHashAgg();
+
   // Allocates a string buffer that is at least the new_size.  The actual size of 
   // the allocated buffer is returned in allocated_size.  
   // The function first tries to allocate from the free list.  If there is nothing
@@ -134,6 +441,11 @@ class AggregationNode : public ExecNode {
   // computed over 'row'.
   void UpdateAggTuple(AggregationTuple* tuple, TupleRow* row);
 
+  // Returns true if the parameter values of the DISTINCT aggregate expr
+  // aggregate_exprs_[agg_idx] over 'row' are all non-NULL and new to the group
+  // 'tuple'.
+  bool IsNewDistinctValue(int agg_idx, AggregationTuple* tuple, TupleRow* row);
+
   // Called when all rows have been aggregated for the aggregation tuple to compute final
   // aggregate values
   void FinalizeAggTuple(AggregationTuple* tuple);
@@ -141,6 +453,8 @@ class AggregationNode : public ExecNode {
   // Do the aggregation for all tuple rows in the batch
   void ProcessRowBatchNoGrouping(RowBatch* batch);
   void ProcessRowBatchWithGrouping(RowBatch* batch);
+  // Aggregates the rows into direct_tuples_[direct_idxs_[i]].
+  void ProcessRowBatchDirect(RowBatch* batch);
 
   // Codegen the process row batch loop.  The loop has already been compiled to
   // IR and loaded into the codegen object.  UpdateAggTuple has also been 
@@ -149,6 +463,10 @@ class AggregationNode : public ExecNode {
   llvm::Function* CodegenProcessRowBatch(
       LlvmCodeGen* codegen, llvm::Function* update_tuple_fn);
 
+  // Same for ProcessRowBatchDirect.
+  llvm::Function* CodegenProcessRowBatchDirect(
+      LlvmCodeGen* codegen, llvm::Function* update_tuple_fn);
+
   // Codegen for updating aggregate_exprs at slot_idx. Returns NULL if unsuccessful.
   // slot_idx is the idx into aggregate_exprs_ (does not include grouping exprs).
   llvm::Function* CodegenUpdateSlot(LlvmCodeGen* codegen, int slot_idx);
@@ -191,6 +509,20 @@ class AggregationNode : public ExecNode {
 
   // Helper function to print aggregation tuple's distinct estimate bitmap
   static std::string DistinctEstimateBitMapToString(char* v);
+
+  // Compute distincthll with HyperLogLog (see util/hyper-log-log.h). The phases are the
+  // same as for distinctpc, but the state in the string slot starts out sparse and only
+  // grows to the dense registers for groups with many distinct values.
+  void ConstructHllSlot(AggregationTuple*, const NullIndicatorOffset&, int slot_id,
+                        void* slot);
+  void UpdateHllSlot(AggregationTuple*, int slot_id, void* slot, void* value,
+                     PrimitiveType type);
+  void MergeHllSlot(AggregationTuple*, int slot_id, void* slot, void* value);
+  void FinalizeHllSlot(AggregationTuple*, int slot_id, void* slot);
+
+  // Makes room for 'len' bytes in the string buffer of 'dst', keeping its contents.
+  void ReserveStringSlot(AggregationTuple*, int string_slot_idx, StringValue* dst,
+                         int len);
 };
 
 }
@@ -0,0 +1,159 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "common/object-pool.h"
+#include "exec/batch-conjunct-evaluator.h"
+#include "exprs/expr.h"
+#include "runtime/descriptors.h"
+#include "runtime/row-batch.h"
+#include "runtime/tuple-row.h"
+#include "util/runtime-profile.h"
+#include "gen-cpp/Descriptors_types.h"
+
+using namespace std;
+
+namespace impala {
+
+// Rows have a single tuple with NUM_SLOTS bool slots.  The conjuncts are slot refs
+// on those slots.
+class BatchConjunctEvaluatorTest : public testing::Test {
+ protected:
+  static const int NUM_SLOTS = 3;
+
+  ObjectPool pool_;
+  DescriptorTbl* desc_tbl_;
+  const RowDescriptor* row_desc_;
+  vector<Expr*> conjuncts_;
+
+  // Tuple memory of the last batch returned by CreateBatch().
+  bool* tuple_mem_;
+
+  virtual void SetUp() {
+    TTupleDescriptor tuple_desc;
+    tuple_desc.__set_id(0);
+    tuple_desc.__set_byteSize(NUM_SLOTS);
+    tuple_desc.__set_numNullBytes(0);
+    TDescriptorTable thrift_desc_tbl;
+    thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+    EXPECT_TRUE(DescriptorTbl::Create(&pool_, thrift_desc_tbl, &desc_tbl_).ok());
+    vector<TTupleId> row_tids(1, 0);
+    vector<bool> nullable_tuples(1, false);
+    row_desc_ = pool_.Add(new RowDescriptor(*desc_tbl_, row_tids, nullable_tuples));
+
+    for (int i = 0; i < NUM_SLOTS; ++i) {
+      conjuncts_.push_back(pool_.Add(new SlotRef(TYPE_BOOLEAN, i)));
+    }
+    EXPECT_TRUE(Expr::Prepare(conjuncts_, NULL, *row_desc_).ok());
+  }
+
+  // Adds rows [0, num_rows) to a new batch; row i gets slot values
+  // (i % 2 == 0, i % 3 == 0, true).
+  RowBatch* CreateBatch(int num_rows) {
+    RowBatch* batch = pool_.Add(new RowBatch(*row_desc_, num_rows));
+    tuple_mem_ = reinterpret_cast<bool*>(
+        batch->tuple_data_pool()->Allocate(num_rows * NUM_SLOTS));
+    for (int i = 0; i < num_rows; ++i) {
+      bool* tuple = tuple_mem_ + i * NUM_SLOTS;
+      tuple[0] = i % 2 == 0;
+      tuple[1] = i % 3 == 0;
+      tuple[2] = true;
+      int idx = batch->AddRow();
+      batch->GetRow(idx)->SetTuple(0, reinterpret_cast<Tuple*>(tuple));
+      batch->CommitLastRow();
+    }
+    return batch;
+  }
+
+  // Returns the row number that CreateBatch() gave the idx-th row of 'batch', which
+  // must be the last batch it returned.
+  int RowNumber(RowBatch* batch, int idx) {
+    return (reinterpret_cast<bool*>(batch->GetRow(idx)->GetTuple(0)) - tuple_mem_)
+        / NUM_SLOTS;
+  }
+};
+
+TEST_F(BatchConjunctEvaluatorTest, Filter) {
+  RuntimeProfile profile(&pool_, "test");
+  BatchConjunctEvaluator evaluator(conjuncts_, &profile);
+  RowBatch* batch = CreateBatch(100);
+  evaluator.EvalConjuncts(batch);
+  // multiples of 6, in order
+  ASSERT_EQ(batch->num_rows(), 17);
+  for (int i = 0; i < batch->num_rows(); ++i) {
+    EXPECT_EQ(RowNumber(batch, i), i * 6);
+  }
+
+  EXPECT_EQ(profile.GetCounter("Conjunct0RowsIn")->value(), 100);
+  EXPECT_EQ(profile.GetCounter("Conjunct0RowsPassed")->value(), 50);
+  EXPECT_EQ(profile.GetCounter("Conjunct0Selectivity")->value(), 50);
+  EXPECT_EQ(profile.GetCounter("Conjunct1RowsIn")->value(), 50);
+  EXPECT_EQ(profile.GetCounter("Conjunct1RowsPassed")->value(), 17);
+  EXPECT_EQ(profile.GetCounter("Conjunct2RowsIn")->value(), 17);
+  EXPECT_EQ(profile.GetCounter("Conjunct2Selectivity")->value(), 100);
+}
+
+TEST_F(BatchConjunctEvaluatorTest, StartRow) {
+  RuntimeProfile profile(&pool_, "test");
+  BatchConjunctEvaluator evaluator(conjuncts_, &profile);
+  RowBatch* batch = CreateBatch(20);
+  // rows before start_row are kept even if they don't pass
+  evaluator.EvalConjuncts(batch, 5);
+  ASSERT_EQ(batch->num_rows(), 5 + 3);
+  for (int i = 0; i < 5; ++i) {
+    EXPECT_EQ(RowNumber(batch, i), i);
+  }
+  EXPECT_EQ(RowNumber(batch, 5), 6);
+  EXPECT_EQ(RowNumber(batch, 6), 12);
+  EXPECT_EQ(RowNumber(batch, 7), 18);
+
+  evaluator.EvalConjuncts(batch, batch->num_rows());
+  EXPECT_EQ(batch->num_rows(), 8);
+}
+
+TEST_F(BatchConjunctEvaluatorTest, Reorder) {
+  // (true, i % 2 == 0, i % 3 == 0): the conjunct that rejects nothing should end up
+  // last.
+  vector<Expr*> conjuncts;
+  conjuncts.push_back(conjuncts_[2]);
+  conjuncts.push_back(conjuncts_[0]);
+  conjuncts.push_back(conjuncts_[1]);
+  RuntimeProfile profile(&pool_, "test");
+  BatchConjunctEvaluator evaluator(conjuncts, &profile);
+  for (int i = 0; i < BatchConjunctEvaluator::REORDER_INTERVAL; ++i) {
+    RowBatch* batch = CreateBatch(1024);
+    evaluator.EvalConjuncts(batch);
+    EXPECT_EQ(batch->num_rows(), 171);
+  }
+  vector<Expr*> order = evaluator.conjuncts();
+  ASSERT_EQ(order.size(), 3);
+  EXPECT_EQ(order[2], conjuncts_[2]);
+
+  // the result doesn't depend on the order
+  RowBatch* batch = CreateBatch(1024);
+  evaluator.EvalConjuncts(batch);
+  ASSERT_EQ(batch->num_rows(), 171);
+  for (int i = 0; i < batch->num_rows(); ++i) {
+    EXPECT_EQ(RowNumber(batch, i), i * 6);
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
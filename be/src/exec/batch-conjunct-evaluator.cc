@@ -0,0 +1,157 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/batch-conjunct-evaluator.h"
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+#include <boost/bind.hpp>
+
+#include "common/logging.h"
+#include "exec/dictionary-filter.h"
+#include "exprs/shared-expr.h"
+#include "runtime/row-batch.h"
+#include "util/stopwatch.h"
+
+using namespace boost;
+using namespace impala;
+using namespace std;
+
+// Percentage of the rows counted by 'rows_in' that were counted by 'rows_passed'.
+static int64_t PassedPercentage(const RuntimeProfile::Counter* rows_passed,
+    const RuntimeProfile::Counter* rows_in) {
+  if (rows_in->value() == 0) return 0;
+  return rows_passed->value() * 100 / rows_in->value();
+}
+
+BatchConjunctEvaluator::BatchConjunctEvaluator(const vector<Expr*>& conjuncts,
+    RuntimeProfile* profile)
+  : sel_capacity_(0),
+    num_batches_(0) {
+  for (int i = 0; i < conjuncts.size(); ++i) {
+    DCHECK_EQ(conjuncts[i]->type(), TYPE_BOOLEAN);
+    ConjunctState state;
+    state.conjunct = conjuncts[i];
+    state.idx = i;
+    state.dictionary_filter = NULL;
+    state.rows_in = 0;
+    state.rows_passed = 0;
+    state.ticks = 0;
+    state.rank = 0;
+
+    stringstream prefix;
+    prefix << "Conjunct" << i;
+    state.rows_in_counter =
+        ADD_COUNTER(profile, prefix.str() + "RowsIn", TCounterType::UNIT);
+    state.rows_passed_counter =
+        ADD_COUNTER(profile, prefix.str() + "RowsPassed", TCounterType::UNIT);
+    // Returns NULL if another evaluator over the same profile already added it.
+    profile->AddDerivedCounter(prefix.str() + "Selectivity", TCounterType::UNIT,
+        bind<int64_t>(&PassedPercentage, state.rows_passed_counter,
+          state.rows_in_counter));
+    conjuncts_.push_back(state);
+  }
+}
+
+vector<Expr*> BatchConjunctEvaluator::conjuncts() const {
+  vector<Expr*> result;
+  for (int i = 0; i < conjuncts_.size(); ++i) {
+    result.push_back(conjuncts_[i].conjunct);
+  }
+  return result;
+}
+
+void BatchConjunctEvaluator::SetDictionaryFilter(int conjunct_idx,
+    DictionaryFilter* filter) {
+  for (int i = 0; i < conjuncts_.size(); ++i) {
+    if (conjuncts_[i].idx == conjunct_idx) conjuncts_[i].dictionary_filter = filter;
+  }
+}
+
+void BatchConjunctEvaluator::EvalConjuncts(RowBatch* batch, int start_row) {
+  DCHECK_LE(start_row, batch->num_rows());
+  int num_sel = batch->num_rows() - start_row;
+  if (num_sel == 0 || conjuncts_.empty()) return;
+  SharedExpr::InvalidateCachedValues();
+
+  if (sel_capacity_ < num_sel) {
+    sel_.reset(new int[num_sel]);
+    sel_capacity_ = num_sel;
+  }
+  int* sel = sel_.get();
+  for (int i = 0; i < num_sel; ++i) {
+    sel[i] = start_row + i;
+  }
+
+  for (int i = 0; i < conjuncts_.size() && num_sel > 0; ++i) {
+    ConjunctState* state = &conjuncts_[i];
+    uint64_t start = StopWatch::Rdtsc();
+    int num_passed = 0;
+    if (state->dictionary_filter != NULL && state->dictionary_filter->enabled()) {
+      DictionaryFilter* filter = state->dictionary_filter;
+      for (int k = 0; k < num_sel; ++k) {
+        sel[num_passed] = sel[k];
+        num_passed += filter->Eval(batch->GetRow(sel[k]));
+      }
+    } else {
+      state->conjunct->GetValues(batch, sel, num_sel, &result_);
+      // Keep the rows that are true and not NULL.  Branch-free: the selectivity of a
+      // conjunct is arbitrary, so a branch per row would often be mispredicted.
+      const uint8_t* values = result_.values<uint8_t>();
+      const uint8_t* is_null = result_.is_null();
+      for (int k = 0; k < num_sel; ++k) {
+        sel[num_passed] = sel[k];
+        num_passed += (values[k] != 0) & (is_null[k] == 0);
+      }
+    }
+    state->ticks += StopWatch::Rdtsc() - start;
+    state->rows_in += num_sel;
+    state->rows_passed += num_passed;
+    COUNTER_UPDATE(state->rows_in_counter, num_sel);
+    COUNTER_UPDATE(state->rows_passed_counter, num_passed);
+    num_sel = num_passed;
+  }
+
+  // Move the surviving rows down; sel is ascending so nothing is overwritten before it
+  // is copied.
+  int row_byte_size = batch->row_byte_size();
+  for (int i = 0; i < num_sel; ++i) {
+    if (sel[i] == start_row + i) continue;
+    memcpy(batch->GetRow(start_row + i), batch->GetRow(sel[i]), row_byte_size);
+  }
+  batch->set_num_rows(start_row + num_sel);
+
+  if (++num_batches_ % REORDER_INTERVAL == 0) Reorder();
+}
+
+void BatchConjunctEvaluator::Reorder() {
+  for (int i = 0; i < conjuncts_.size(); ++i) {
+    ConjunctState* state = &conjuncts_[i];
+    if (state->rows_in == 0) {
+      // Not evaluated yet (all rows were filtered by earlier conjuncts): move it to
+      // the front once so we learn what it costs.
+      state->rank = 0;
+      continue;
+    }
+    double cost_per_row = state->ticks / state->rows_in;
+    double rejected = 1 - state->rows_passed / state->rows_in;
+    state->rank = rejected > 0 ?
+        cost_per_row / rejected : numeric_limits<double>::max();
+    state->rows_in /= 2;
+    state->rows_passed /= 2;
+    state->ticks /= 2;
+  }
+  stable_sort(conjuncts_.begin(), conjuncts_.end(), RankLess());
+}
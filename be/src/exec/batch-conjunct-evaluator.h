@@ -0,0 +1,111 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_BATCH_CONJUNCT_EVALUATOR_H
+#define IMPALA_EXEC_BATCH_CONJUNCT_EVALUATOR_H
+
+#include <vector>
+#include <boost/scoped_array.hpp>
+
+#include "exprs/expr.h"
+#include "util/runtime-profile.h"
+
+namespace impala {
+
+class DictionaryFilter;
+class RowBatch;
+
+// Evaluates a list of conjuncts over a whole row batch at a time, as an alternative to
+// ExecNode::EvalConjuncts(), which evaluates all conjuncts for one row before moving to
+// the next.  The rows that are still candidates are kept in a selection vector;
+// conjunct i is evaluated (via Expr::GetValues()) only over the rows that survived
+// conjuncts 0..i-1, and the selection vector is then shrunk to the rows it passed.
+// At the end the surviving rows are compacted to the front of the batch.
+// The evaluator tracks how many rows each conjunct sees and passes and how long it
+// takes, and periodically reorders the conjuncts so that cheap, selective ones run
+// first (ascending cost per row / fraction of rows rejected).  The per-conjunct row
+// counts are exported to 'profile' as Conjunct<i>RowsIn, Conjunct<i>RowsPassed and
+// Conjunct<i>Selectivity (percentage of rows passed), where i is the conjunct's
+// position in the original list.
+// The conjuncts must already be prepared.  This class is not thread safe (neither are
+// the conjuncts); each thread needs its own evaluator (and conjunct copies).  The
+// profile counters can be shared between evaluators for copies of the same conjuncts.
+class BatchConjunctEvaluator {
+ public:
+  BatchConjunctEvaluator(const std::vector<Expr*>& conjuncts, RuntimeProfile* profile);
+
+  // Removes all rows at index >= start_row from 'batch' that don't pass all conjuncts,
+  // keeping the order of the remaining rows.
+  void EvalConjuncts(RowBatch* batch, int start_row = 0);
+
+  // The conjuncts in their current evaluation order.
+  std::vector<Expr*> conjuncts() const;
+
+  // Evaluates the conjunct at position 'conjunct_idx' of the original list with
+  // 'filter' (which must be over that conjunct) while the filter is enabled.  The
+  // caller keeps ownership of 'filter'.
+  void SetDictionaryFilter(int conjunct_idx, DictionaryFilter* filter);
+
+  // Number of batches between reorderings of the conjuncts.
+  static const int REORDER_INTERVAL = 16;
+
+ private:
+  struct ConjunctState {
+    Expr* conjunct;
+
+    // position in the original list
+    int idx;
+
+    // NULL if the conjunct is evaluated with GetValues()
+    DictionaryFilter* dictionary_filter;
+
+    // Observed rows in/passed and cpu ticks spent.  Halved at every reordering so
+    // that recent batches count more.
+    double rows_in;
+    double rows_passed;
+    double ticks;
+
+    // Sort key for the evaluation order, computed from the stats above.
+    double rank;
+
+    RuntimeProfile::Counter* rows_in_counter;
+    RuntimeProfile::Counter* rows_passed_counter;
+  };
+
+  // Orders conjuncts_ by ascending rank.
+  struct RankLess {
+    bool operator()(const ConjunctState& a, const ConjunctState& b) const {
+      return a.rank < b.rank;
+    }
+  };
+
+  // Recomputes the ranks from the stats and reorders conjuncts_.
+  void Reorder();
+
+  std::vector<ConjunctState> conjuncts_;
+
+  // Result of the conjunct that is currently evaluated.
+  ExprColumn result_;
+
+  // Row indices that passed all conjuncts evaluated so far.
+  boost::scoped_array<int> sel_;
+  int sel_capacity_;
+
+  int num_batches_;
+};
+
+}
+
+#endif
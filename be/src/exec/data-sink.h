@@ -43,6 +43,10 @@ class DataSink {
   // Send a row batch into this sink.
   virtual Status Send(RuntimeState* state, RowBatch* batch) = 0;
 
+  // Returns false once the sink doesn't need any more rows (e.g., all receivers of a
+  // data stream have what they need), in which case the fragment stops early.
+  virtual bool NeedsMoreRows() { return true; }
+
   // Releases all resources that were allocated in Init()/Send().
   // Further Send() calls are illegal after calling Close().
   virtual Status Close(RuntimeState* state) = 0;
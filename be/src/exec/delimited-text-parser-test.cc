@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <stdlib.h>
 #include <string>
 #include <gtest/gtest.h>
 
@@ -64,6 +65,46 @@ TEST(DelimitedTextParser, Escapes) {
   ValidateTupleStart(&escape_parser, "@|no_delims", 2, TUPLE_DELIM);
 }
 
+// Test ProcessEscapeMask32 against escaping the characters one at a time, over
+// consecutive blocks so that escapes carry over.
+TEST(DelimitedTextParser, EscapeMask32) {
+  srand(0);
+  for (int i = 0; i < 10000; ++i) {
+    bool last_char_is_escape = false;
+    bool expected_last_char_is_escape = false;
+    for (int block = 0; block < 4; ++block) {
+      // Dense blocks have long runs of escape characters.
+      int density = rand() % 4;
+      uint32_t escape_mask = 0;
+      for (int j = 0; j < 32; ++j) {
+        if (rand() % 4 < density) escape_mask |= 1u << j;
+      }
+      // Any character that isn't an escape could be a delimiter.
+      uint32_t delim_mask = ~escape_mask;
+      uint32_t expected_delim_mask = delim_mask;
+      for (int j = 0; j < 32; ++j) {
+        if (expected_last_char_is_escape) {
+          expected_delim_mask &= ~(1u << j);
+          expected_last_char_is_escape = false;
+        } else {
+          expected_last_char_is_escape = (escape_mask & (1u << j)) != 0;
+        }
+      }
+      ProcessEscapeMask32(escape_mask, &last_char_is_escape, &delim_mask);
+      ASSERT_EQ(delim_mask, expected_delim_mask) << "escape_mask: " << escape_mask;
+      ASSERT_EQ(last_char_is_escape, expected_last_char_is_escape);
+    }
+  }
+
+  // A full block of escapes, starting with an escaped one.
+  bool last_char_is_escape = true;
+  uint32_t delim_mask = 0;
+  ProcessEscapeMask32(0xffffffff, &last_char_is_escape, &delim_mask);
+  EXPECT_TRUE(last_char_is_escape);
+  ProcessEscapeMask32(0xffffffff, &last_char_is_escape, &delim_mask);
+  EXPECT_TRUE(last_char_is_escape);
+}
+
 // TODO: expand test for other delimited text parser functions/cases.
 // Not all of them work without creating a HdfsScanNode but we can expand
 // these tests quite a bit more.
@@ -14,6 +14,8 @@
 
 #include "exec/delimited-text-parser.inline.h"
 
+#include <immintrin.h>
+
 #include "exec/byte-stream.h"
 #include "exec/hdfs-scanner.h"
 #include "util/cpu-info.h"
@@ -21,6 +23,9 @@
 using namespace impala;
 using namespace std;
 
+CpuDispatch::Kernel DelimitedTextParser::PARSE_KERNEL(
+    "DelimitedTextParser::ParseFieldLocations", CpuDispatch::AVX2);
+
 DelimitedTextParser::DelimitedTextParser(HdfsScanNode* scan_node,
                                          char tuple_delim,
                                          char field_delim,
@@ -34,9 +39,52 @@ DelimitedTextParser::DelimitedTextParser(HdfsScanNode* scan_node,
       current_column_has_escape_(false),
       last_char_is_escape_(false),
       last_row_delim_offset_(-1),
+      num_cols_(0),
+      num_partition_keys_(0),
       is_materialized_col_(NULL),
       column_idx_(0) {
+  InitSearch();
+
+  // scan_node_ can be NULL in test setups
+  if (scan_node_ == NULL) return;
+
+  num_cols_ = scan_node_->num_cols();
+  num_partition_keys_ = scan_node_->num_partition_keys();
+  is_materialized_col_ = new bool[num_cols_];
+  for (int i = 0; i < num_cols_; ++i) {
+    is_materialized_col_[i] = 
+        scan_node_->GetMaterializedSlotIdx(i) != HdfsScanNode::SKIP_COLUMN;
+  }
+  ParserReset();
+}
+
+DelimitedTextParser::DelimitedTextParser(int num_cols, int num_partition_keys,
+                                         const vector<bool>& is_materialized_col,
+                                         char tuple_delim,
+                                         char field_delim,
+                                         char collection_item_delim,
+                                         char escape_char)
+    : scan_node_(NULL),
+      field_delim_(field_delim),
+      escape_char_(escape_char),
+      collection_item_delim_(collection_item_delim),
+      tuple_delim_(tuple_delim),
+      current_column_has_escape_(false),
+      last_char_is_escape_(false),
+      last_row_delim_offset_(-1),
+      num_cols_(num_cols),
+      num_partition_keys_(num_partition_keys),
+      is_materialized_col_(new bool[num_cols]),
+      column_idx_(0) {
+  DCHECK_EQ(is_materialized_col.size(), num_cols);
+  InitSearch();
+  for (int i = 0; i < num_cols_; ++i) {
+    is_materialized_col_[i] = is_materialized_col[i];
+  }
+  ParserReset();
+}
 
+void DelimitedTextParser::InitSearch() {
   // Initialize the sse search registers.
   char search_chars[SSEUtil::CHARS_PER_128_BIT_REGISTER];
   memset(search_chars, 0, sizeof(search_chars));
@@ -62,7 +110,7 @@ DelimitedTextParser::DelimitedTextParser(HdfsScanNode* scan_node,
   }
 
   int num_delims = 0;
-  if (tuple_delim != '\0') {
+  if (tuple_delim_ != '\0') {
     search_chars[num_delims++] = tuple_delim_;
     // Hive will treats \r (^M) as an alternate tuple delimiter, but \r\n is a
     // single tuple delimiter.
@@ -70,7 +118,7 @@ DelimitedTextParser::DelimitedTextParser(HdfsScanNode* scan_node,
     xmm_tuple_search_ = _mm_loadu_si128(reinterpret_cast<__m128i*>(search_chars));
   }
 
-  if (field_delim != '\0' || collection_item_delim != '\0') {
+  if (field_delim_ != '\0' || collection_item_delim_ != '\0') {
     search_chars[num_delims++] = field_delim_;
     search_chars[num_delims++] = collection_item_delim_;
   }
@@ -78,16 +126,14 @@ DelimitedTextParser::DelimitedTextParser(HdfsScanNode* scan_node,
   DCHECK_GT(num_delims, 0);
   xmm_delim_search_ = _mm_loadu_si128(reinterpret_cast<__m128i*>(search_chars));
 
-  // scan_node_ can be NULL in test setups
-  if (scan_node_ == NULL) return;
-  
-  ParserReset();
-
-  num_cols_ = scan_node_->num_cols();
-  is_materialized_col_ = new bool[num_cols_];
-  for (int i = 0; i < num_cols_; ++i) {
-    is_materialized_col_[i] = 
-        scan_node_->GetMaterializedSlotIdx(i) != HdfsScanNode::SKIP_COLUMN;
+  // Unlike _mm_cmpistrm, the AVX2 compares don't stop at a '\0' so leave those out.
+  int num_avx2_delims = 0;
+  for (int i = 0; i < num_delims; ++i) {
+    if (search_chars[i] != '\0') avx2_delim_search_[num_avx2_delims++] = search_chars[i];
+  }
+  DCHECK_GT(num_avx2_delims, 0);
+  for (int i = num_avx2_delims; i < sizeof(avx2_delim_search_); ++i) {
+    avx2_delim_search_[i] = avx2_delim_search_[0];
   }
 }
 
@@ -99,7 +145,7 @@ void DelimitedTextParser::ParserReset() {
   current_column_has_escape_ = false;
   last_char_is_escape_ = false;
   last_row_delim_offset_ = -1;
-  column_idx_ = scan_node_->num_partition_keys();
+  column_idx_ = num_partition_keys_;
 }
 
 // Parsing raw csv data into FieldLocation descriptors.
@@ -117,7 +163,19 @@ Status DelimitedTextParser::ParseFieldLocations(int max_tuples, int64_t remainin
     last_row_delim_offset_ = -1;
   }
 
-  if (CpuInfo::IsSupported(CpuInfo::SSE4_2)) {
+  if (PARSE_KERNEL.level() >= CpuDispatch::AVX2) {
+    if (escape_char_ == '\0') {
+      ParseAvx2<false>(max_tuples, &remaining_len, byte_buffer_ptr, row_end_locations,
+          field_locations, num_tuples, num_fields, next_column_start);
+    } else {
+      ParseAvx2<true>(max_tuples, &remaining_len, byte_buffer_ptr, row_end_locations,
+          field_locations, num_tuples, num_fields, next_column_start);
+    }
+    if (*num_tuples == max_tuples) return Status::OK;
+  }
+
+  // With AVX2, this handles a remaining block of 16 characters.
+  if (PARSE_KERNEL.level() >= CpuDispatch::SSE4_2) {
     if (escape_char_ == '\0') {
       ParseSse<false>(max_tuples, &remaining_len, byte_buffer_ptr, row_end_locations,
           field_locations, num_tuples, num_fields, next_column_start);
@@ -160,7 +218,7 @@ Status DelimitedTextParser::ParseFieldLocations(int max_tuples, int64_t remainin
         AddColumn<true>(*byte_buffer_ptr - *next_column_start,
             next_column_start, num_fields, field_locations);
         FillColumns<false>(0, NULL, num_fields, field_locations);
-        column_idx_ = scan_node_->num_partition_keys();
+        column_idx_ = num_partition_keys_;
         row_end_locations[*num_tuples] = *byte_buffer_ptr;
         ++(*num_tuples);
       }
@@ -187,12 +245,115 @@ Status DelimitedTextParser::ParseFieldLocations(int max_tuples, int64_t remainin
     AddColumn<true>(*byte_buffer_ptr - *next_column_start,
         next_column_start, num_fields, field_locations);
     FillColumns<false>(0, NULL, num_fields, field_locations);
-    column_idx_ = scan_node_->num_partition_keys();
+    column_idx_ = num_partition_keys_;
     ++(*num_tuples);
   }
   return Status::OK;
 }
 
+// AVX2 version of ParseSse.  AVX2 has no equivalent of _mm_cmpistrm for 32 bytes, so
+// instead the 32 characters are compared against each delimiter with
+// _mm256_cmpeq_epi8 and the results are or'ed and turned into a 32-bit mask with
+// _mm256_movemask_epi8, and the same for the escape character.  Escaped delimiters
+// are removed from the mask with ProcessEscapeMask32.  Apart from the block size,
+// the processing of the mask is the same as in ParseSse.
+// The target attribute lets this function use AVX2 even though the rest of the file
+// is compiled for SSE4.2.  Inlined callees get compiled for AVX2 as part of it; their
+// out of line copies don't.
+template <bool process_escapes>
+__attribute__((target("avx2")))
+void DelimitedTextParser::ParseAvx2(int max_tuples,
+    int64_t* remaining_len, char** byte_buffer_ptr,
+    char** row_end_locations,
+    FieldLocation* field_locations,
+    int* num_tuples, int* num_fields, char** next_column_start) {
+  DCHECK(CpuInfo::IsSupported(CpuInfo::AVX2));
+  static const int CHARS_PER_256_BIT_REGISTER = 32;
+
+  const __m256i ymm_delim0 = _mm256_set1_epi8(avx2_delim_search_[0]);
+  const __m256i ymm_delim1 = _mm256_set1_epi8(avx2_delim_search_[1]);
+  const __m256i ymm_delim2 = _mm256_set1_epi8(avx2_delim_search_[2]);
+  const __m256i ymm_delim3 = _mm256_set1_epi8(avx2_delim_search_[3]);
+  const __m256i ymm_escape = _mm256_set1_epi8(escape_char_);
+
+  while (LIKELY(*remaining_len >= CHARS_PER_256_BIT_REGISTER)) {
+    __m256i ymm_buffer =
+        _mm256_loadu_si256(reinterpret_cast<const __m256i*>(*byte_buffer_ptr));
+    __m256i ymm_delim_mask = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi8(ymm_buffer, ymm_delim0),
+                        _mm256_cmpeq_epi8(ymm_buffer, ymm_delim1)),
+        _mm256_or_si256(_mm256_cmpeq_epi8(ymm_buffer, ymm_delim2),
+                        _mm256_cmpeq_epi8(ymm_buffer, ymm_delim3)));
+    uint32_t delim_mask = _mm256_movemask_epi8(ymm_delim_mask);
+
+    // Escape characters in the block that have not been accounted to a column yet.
+    uint32_t escape_mask = 0;
+    if (process_escapes) {
+      DCHECK(escape_char_ != '\0');
+      escape_mask = _mm256_movemask_epi8(_mm256_cmpeq_epi8(ymm_buffer, ymm_escape));
+      ProcessEscapeMask32(escape_mask, &last_char_is_escape_, &delim_mask);
+    }
+
+    // Process all non-zero bits in the delim_mask from lsb->msb.  If a bit
+    // is set, the character in that spot is either a field or tuple delimiter.
+    while (delim_mask != 0) {
+      int n = __builtin_ctz(delim_mask);
+      DCHECK_LT(n, CHARS_PER_256_BIT_REGISTER);
+      // clear current bit
+      delim_mask &= delim_mask - 1;
+
+      if (process_escapes) {
+        // Was there an escape character in [last delimiter, n]?  Then clear the
+        // escapes up to and including n.
+        uint32_t below_n = (1u << n) - 1;
+        current_column_has_escape_ |= (escape_mask & below_n) != 0;
+        escape_mask &= ~(below_n | (1u << n));
+      }
+
+      char* delim_ptr = *byte_buffer_ptr + n;
+
+      if (*delim_ptr == field_delim_ || *delim_ptr == collection_item_delim_) {
+        AddColumn<process_escapes>(delim_ptr - *next_column_start,
+            next_column_start, num_fields, field_locations);
+        continue;
+      }
+
+      if (*delim_ptr == tuple_delim_ || (tuple_delim_ == '\n' && *delim_ptr == '\r')) {
+        if (UNLIKELY(
+                last_row_delim_offset_ == *remaining_len - n && *delim_ptr == '\n')) {
+          // If the row ended in \r\n then move the next start past the \n
+          ++*next_column_start;
+          last_row_delim_offset_ = -1;
+          continue;
+        }
+        AddColumn<process_escapes>(delim_ptr - *next_column_start,
+            next_column_start, num_fields, field_locations);
+        FillColumns<false>(0, NULL, num_fields, field_locations);
+        column_idx_ = num_partition_keys_;
+        row_end_locations[*num_tuples] = delim_ptr;
+        ++(*num_tuples);
+        // Remember where we saw the last \r.
+        last_row_delim_offset_ = *delim_ptr == '\r' ? *remaining_len - n - 1 : -1;
+        if (UNLIKELY(*num_tuples == max_tuples)) {
+          (*byte_buffer_ptr) += (n + 1);
+          if (process_escapes) last_char_is_escape_ = false;
+          *remaining_len -= (n + 1);
+          // If the last character we processed was \r then set the offset to 0
+          // so that we will use it at the beginning of the next batch.
+          if (last_row_delim_offset_ == *remaining_len) last_row_delim_offset_ = 0;
+          return;
+        }
+      }
+    }
+
+    // Escape characters after the last delimiter belong to the current column.
+    if (process_escapes) current_column_has_escape_ |= escape_mask != 0;
+
+    *remaining_len -= CHARS_PER_256_BIT_REGISTER;
+    *byte_buffer_ptr += CHARS_PER_256_BIT_REGISTER;
+  }
+}
+
 // Find the first instance of the tuple delimiter.  This will
 // find the start of the first full tuple in buffer by looking for the end of
 // the previous tuple.
@@ -208,7 +369,7 @@ int DelimitedTextParser::FindFirstInstance(const char* buffer, int len) {
     return 0;
   }
 restart:
-  if (CpuInfo::IsSupported(CpuInfo::SSE4_2)) {
+  if (PARSE_KERNEL.level() >= CpuDispatch::SSE4_2) {
     __m128i xmm_buffer, xmm_tuple_mask;
     while (tuple_start < len) {
       // TODO: can we parallelize this as well?  Are there multiple sse execution units?
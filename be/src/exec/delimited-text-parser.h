@@ -16,14 +16,20 @@
 #ifndef IMPALA_EXEC_DELIMITED_TEXT_PARSER_H
 #define IMPALA_EXEC_DELIMITED_TEXT_PARSER_H
 
+#include <vector>
+
 #include "exec/hdfs-scanner.h"
 #include "exec/hdfs-scan-node.h"
+#include "util/cpu-dispatch.h"
 #include "util/sse-util.h"
 
 namespace impala {
 
 class DelimitedTextParser {
  public:
+  // Selects the AVX2, SSE4.2 or character by character parsing of
+  // ParseFieldLocations(), ParseSingleTuple() and FindFirstInstance().
+  static CpuDispatch::Kernel PARSE_KERNEL;
 
   // The Delimited Text Parser parses text rows that are delimited by specific
   // characters:
@@ -44,21 +50,30 @@ class DelimitedTextParser {
                       char tuple_delim, char field_delim_ = '\0',
                       char collection_item_delim = '\0', char escape_char = '\0');
 
+  // Same as above without a scan node, e.g. for benchmarks: rows have 'num_cols'
+  // columns, the first 'num_partition_keys' of which are not in the data, and column
+  // i is materialized if is_materialized_col[i] is true.
+  DelimitedTextParser(int num_cols, int num_partition_keys,
+                      const std::vector<bool>& is_materialized_col,
+                      char tuple_delim, char field_delim_ = '\0',
+                      char collection_item_delim = '\0', char escape_char = '\0');
+
   ~DelimitedTextParser();
 
   // Called to initialize parser at beginning of scan range.
   void ParserReset();
 
   // Check if we are at the start of a tuple.
-  bool AtTupleStart() { return column_idx_ == scan_node_->num_partition_keys(); }
+  bool AtTupleStart() { return column_idx_ == num_partition_keys_; }
 
   char escape_char() const { return escape_char_; }
 
   // Parses a byte buffer for the field and tuple breaks.
   // This function will write the field start & len to field_locations
   // which can then be written out to tuples.
-  // This function uses SSE ("Intel x86 instruction set extension
-  // 'Streaming Simd Extension') if the hardware supports SSE4.2
+  // This function uses AVX2 if PARSE_KERNEL selects it, which compares 32
+  // characters at a time, and otherwise SSE ("Intel x86 instruction set extension
+  // 'Streaming Simd Extension') if PARSE_KERNEL selects SSE4.2
   // instructions.  SSE4.2 added string processing instructions that
   // allow for processing 16 characters at a time.  Otherwise, this
   // function walks the file_buffer_ character by character.
@@ -130,8 +145,9 @@ class DelimitedTextParser {
                    int* num_fields, impala::FieldLocation* field_locations);
 
  private:
-  // Initialize the parser state.
-  void ParserInit(HdfsScanNode* scan_node);
+  // Initializes the search registers and escape masks for the delimiters.  Called by
+  // the c'tors.
+  void InitSearch();
 
   // Helper routine to add a column to the field_locations vector.
   // Template parameter:
@@ -159,6 +175,16 @@ class DelimitedTextParser {
       FieldLocation* field_locations,
       int* num_tuples, int* num_fields, char** next_column_start);
 
+  // Same as ParseSse but processes 32 characters at a time with AVX2 byte compares
+  // and resolves escapes with ProcessEscapeMask32.  Only called if PARSE_KERNEL selects
+  // AVX2; it is compiled for AVX2 regardless of the global compiler flags.
+  template <bool process_escapes>
+  __attribute__((target("avx2")))
+  void ParseAvx2(int max_tuples, int64_t* remaining_len,
+      char** byte_buffer_ptr, char** row_end_locations_,
+      FieldLocation* field_locations,
+      int* num_tuples, int* num_fields, char** next_column_start);
+
   // ScanNode reference to map columns in the data to slots in the tuples.
   HdfsScanNode* scan_node_;
 
@@ -171,6 +197,13 @@ class DelimitedTextParser {
   // SSE(xmm) register containing the escape search character.
   __m128i xmm_escape_search_;
 
+  // The characters ParseAvx2 searches for: the tuple delimiter (and \r if that is
+  // \n), field and collection item delimiters, excluding '\0'.  Unused entries
+  // repeat the first one so all of them can be compared unconditionally.  These are
+  // broadcast into ymm registers on each call rather than stored as __m256i, which
+  // would need 32-byte alignment of this object.
+  char avx2_delim_search_[4];
+
   // Character delimiting fields (to become slots).
   char field_delim_;
 
@@ -207,6 +240,10 @@ class DelimitedTextParser {
   // performance reasons.
   int num_cols_;
 
+  // Number of partition keys, which come first among the columns but are not in the
+  // data.  Replicated from ScanNode for performance reasons.
+  int num_partition_keys_;
+
   // For each col index [0, num_cols), true if the column should be materialized.
   // Replicated from the ScanNode for performance reasons.  Memory owned by this
   // object.
@@ -48,6 +48,36 @@ inline void ProcessEscapeMask(uint16_t escape_mask, bool* last_char_is_escape,
   *delim_mask &= ~escape_mask;
 }
 
+// 32 character version of ProcessEscapeMask for ParseAvx2 that finds the escaped
+// characters with carries instead of a loop over the bits.  A character is escaped
+// if it follows an odd length run of escape characters, counting the run from the
+// previous block if *last_char_is_escape.  Adding the first bit of each run
+// (start_edges) to the escape mask carries it past the end of the run, so the
+// parity of the position the carry lands on, relative to where the run started,
+// tells whether the run had odd length.  Runs are split by the parity of their
+// start so that each sum only has to be checked against a fixed parity.
+inline void ProcessEscapeMask32(uint32_t escape_mask, bool* last_char_is_escape,
+                                uint32_t* delim_mask) {
+  static const uint32_t EVEN_BITS = 0x55555555;
+  uint32_t prev_escape = *last_char_is_escape ? 1 : 0;
+  uint32_t start_edges = escape_mask & ~(escape_mask << 1);
+  // A run continuing from the previous block counts as starting one bit earlier.
+  uint32_t even_start_mask = EVEN_BITS ^ prev_escape;
+  uint32_t even_starts = start_edges & even_start_mask;
+  uint32_t odd_starts = start_edges & ~even_start_mask;
+
+  uint32_t even_carries = escape_mask + even_starts;
+  uint64_t odd_sum = static_cast<uint64_t>(escape_mask) + odd_starts;
+  // The carry out of the last bit is an odd run ending the block.  (An even start
+  // can only reach the end with an even length.)
+  *last_char_is_escape = (odd_sum >> 32) != 0;
+  uint32_t odd_carries = static_cast<uint32_t>(odd_sum) | prev_escape;
+
+  uint32_t even_start_odd_end = even_carries & ~escape_mask & ~EVEN_BITS;
+  uint32_t odd_start_even_end = odd_carries & ~escape_mask & EVEN_BITS;
+  *delim_mask &= ~(even_start_odd_end | odd_start_even_end);
+}
+
 template <bool process_escapes>
 inline void DelimitedTextParser::AddColumn(int len, char** next_column_start, 
     int* num_fields, FieldLocation* field_locations) {
@@ -72,7 +102,7 @@ void inline DelimitedTextParser:: FillColumns(int len, char** last_column,
   // Fill in any columns missing from the end of the tuple.
   char* dummy = NULL;
   if (last_column == NULL) last_column = &dummy;
-  while (column_idx_ < scan_node_->num_cols()) {
+  while (column_idx_ < num_cols_) {
     AddColumn<process_escapes>(len, last_column, num_fields, field_locations);
     // The rest of the columns will be null.
     len = 0;
@@ -181,7 +211,7 @@ inline void DelimitedTextParser::ParseSse(int max_tuples,
         AddColumn<process_escapes>(delim_ptr - *next_column_start,
             next_column_start, num_fields, field_locations);
         FillColumns<false>(0, NULL, num_fields, field_locations);
-        column_idx_ = scan_node_->num_partition_keys();
+        column_idx_ = num_partition_keys_;
         row_end_locations[*num_tuples] = delim_ptr;
         ++(*num_tuples);
         // Remember where we saw the last \r.
@@ -216,10 +246,10 @@ inline void DelimitedTextParser::ParseSingleTuple(int64_t remaining_len, char* b
   char* next_column_start = buffer;
   __m128i xmm_buffer, xmm_delim_mask, xmm_escape_mask;
 
-  column_idx_ = scan_node_->num_partition_keys();
+  column_idx_ = num_partition_keys_;
   current_column_has_escape_ = false;
 
-  if (LIKELY(CpuInfo::IsSupported(CpuInfo::SSE4_2))) {
+  if (LIKELY(PARSE_KERNEL.level() >= CpuDispatch::SSE4_2)) {
     while (LIKELY(remaining_len >= SSEUtil::CHARS_PER_128_BIT_REGISTER)) {
       // Load the next 16 bytes into the xmm register
       xmm_buffer = _mm_loadu_si128(reinterpret_cast<__m128i*>(buffer));
@@ -0,0 +1,126 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "exec/dictionary-filter.h"
+#include "exprs/expr.h"
+#include "runtime/tuple.h"
+#include "runtime/tuple-row.h"
+#include "util/cpu-info.h"
+
+using namespace std;
+
+namespace impala {
+
+// Tuples have a null byte followed by a string slot.
+static const int SLOT_OFFSET = 8;
+static const NullIndicatorOffset NULL_OFFSET(0, 0);
+
+// Conjunct on the string slot that is true if the string starts with 'a' and NULL if
+// the slot is NULL.  Counts its evaluations.
+class StartsWithA : public Expr {
+ public:
+  StartsWithA() : Expr(TYPE_BOOLEAN), num_evals(0) {
+    compute_fn_ = ComputeFn;
+  }
+
+  int num_evals;
+
+ private:
+  static void* ComputeFn(Expr* e, TupleRow* row) {
+    StartsWithA* expr = static_cast<StartsWithA*>(e);
+    ++expr->num_evals;
+    Tuple* tuple = row->GetTuple(0);
+    if (tuple->IsNull(NULL_OFFSET)) return NULL;
+    StringValue* value = tuple->GetStringSlot(SLOT_OFFSET);
+    expr->result_.bool_val = value->len > 0 && value->ptr[0] == 'a';
+    return &expr->result_.bool_val;
+  }
+};
+
+class DictionaryFilterTest : public testing::Test {
+ protected:
+  DictionaryFilterTest() : filter_(&conjunct_, 0, SLOT_OFFSET, NULL_OFFSET) {
+    tuple_ = reinterpret_cast<Tuple*>(tuple_mem_);
+    row_ = reinterpret_cast<TupleRow*>(&tuple_);
+  }
+
+  // Evaluates the filter for a row with the value 'value', or a NULL value.
+  bool Eval(const string& value, bool is_null = false) {
+    memset(tuple_mem_, 0, sizeof(tuple_mem_));
+    // The filter must not depend on the row memory after Eval(), so each value is
+    // passed in a new copy.
+    value_ = value;
+    if (is_null) {
+      tuple_->SetNull(NULL_OFFSET);
+    } else {
+      StringValue* slot = tuple_->GetStringSlot(SLOT_OFFSET);
+      slot->ptr = const_cast<char*>(value_.data());
+      slot->len = value_.size();
+    }
+    return filter_.Eval(row_);
+  }
+
+  StartsWithA conjunct_;
+  DictionaryFilter filter_;
+  uint8_t tuple_mem_[SLOT_OFFSET + sizeof(StringValue)];
+  Tuple* tuple_;
+  TupleRow* row_;
+  string value_;
+};
+
+TEST_F(DictionaryFilterTest, Basic) {
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_TRUE(Eval("abc"));
+    EXPECT_FALSE(Eval("xyz"));
+    EXPECT_FALSE(Eval(""));
+    EXPECT_FALSE(Eval("", true));
+    EXPECT_TRUE(Eval("a"));
+  }
+  // The conjunct was evaluated once per distinct value, including NULL.
+  EXPECT_EQ(conjunct_.num_evals, 5);
+  EXPECT_EQ(filter_.num_values(), 4);
+  EXPECT_EQ(filter_.num_hits(), 45);
+  EXPECT_TRUE(filter_.enabled());
+}
+
+TEST_F(DictionaryFilterTest, HighCardinality) {
+  for (int i = 0; i < DictionaryFilter::MAX_VALUES; ++i) {
+    stringstream value;
+    value << (i % 2 == 0 ? "a" : "b") << i;
+    EXPECT_EQ(Eval(value.str()), i % 2 == 0);
+  }
+  EXPECT_TRUE(filter_.enabled());
+  EXPECT_TRUE(Eval("a0"));
+  EXPECT_EQ(conjunct_.num_evals, DictionaryFilter::MAX_VALUES);
+
+  // One more distinct value disables the filter; the conjunct is then evaluated for
+  // every row.
+  EXPECT_FALSE(Eval("new value"));
+  EXPECT_FALSE(filter_.enabled());
+  EXPECT_TRUE(Eval("a0"));
+  EXPECT_FALSE(Eval("b1"));
+  EXPECT_EQ(conjunct_.num_evals, DictionaryFilter::MAX_VALUES + 3);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
+  return RUN_ALL_TESTS();
+}
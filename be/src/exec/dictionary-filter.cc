@@ -0,0 +1,110 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/dictionary-filter.h"
+
+#include "common/logging.h"
+#include "exec/exec-node.h"
+#include "exprs/expr.h"
+#include "runtime/mem-pool.h"
+#include "runtime/string-value.inline.h"
+#include "runtime/tuple.h"
+#include "runtime/tuple-row.h"
+#include "util/hash-util.h"
+
+using namespace impala;
+using namespace std;
+
+const int DictionaryFilter::MAX_VALUES;
+
+const SlotDescriptor* DictionaryFilter::GetSlot(Expr* conjunct,
+    const DescriptorTbl& desc_tbl) {
+  vector<SlotId> slot_ids;
+  int num_slots = conjunct->GetSlotIds(&slot_ids);
+  if (num_slots == 0 || !conjunct->IsDeterministic()) return NULL;
+  for (int i = 1; i < num_slots; ++i) {
+    if (slot_ids[i] != slot_ids[0]) return NULL;
+  }
+  const SlotDescriptor* slot_desc = desc_tbl.GetSlotDescriptor(slot_ids[0]);
+  if (slot_desc == NULL || slot_desc->type() != TYPE_STRING) return NULL;
+  return slot_desc;
+}
+
+DictionaryFilter::DictionaryFilter(Expr* conjunct, int tuple_idx, int slot_offset,
+    const NullIndicatorOffset& null_offset)
+  : conjunct_(conjunct),
+    tuple_idx_(tuple_idx),
+    slot_offset_(slot_offset),
+    null_offset_(null_offset),
+    enabled_(true),
+    null_result_(-1),
+    buckets_(NUM_BUCKETS, -1),
+    pool_(new MemPool()),
+    num_hits_(0) {
+  DCHECK_EQ(conjunct->type(), TYPE_BOOLEAN);
+  entries_.reserve(MAX_VALUES);
+}
+
+DictionaryFilter::~DictionaryFilter() {
+}
+
+bool DictionaryFilter::Eval(TupleRow* row) {
+  if (!enabled_) return ExecNode::EvalConjuncts(&conjunct_, 1, row);
+
+  Tuple* tuple = row->GetTuple(tuple_idx_);
+  if (tuple == NULL || tuple->IsNull(null_offset_)) {
+    if (null_result_ != -1) {
+      ++num_hits_;
+      return null_result_;
+    }
+    null_result_ = ExecNode::EvalConjuncts(&conjunct_, 1, row);
+    return null_result_;
+  }
+
+  const StringValue* value = tuple->GetStringSlot(slot_offset_);
+  uint32_t hash = HashUtil::Hash(value->ptr, value->len, 0);
+  int bucket = hash & (NUM_BUCKETS - 1);
+  while (buckets_[bucket] != -1) {
+    const Entry& entry = entries_[buckets_[bucket]];
+    if (entry.hash == hash && entry.value.Eq(*value)) {
+      ++num_hits_;
+      return entry.passed;
+    }
+    bucket = (bucket + 1) & (NUM_BUCKETS - 1);
+  }
+
+  bool passed = ExecNode::EvalConjuncts(&conjunct_, 1, row);
+  if (entries_.size() == MAX_VALUES) {
+    Disable();
+    return passed;
+  }
+  Entry entry;
+  entry.value.len = value->len;
+  entry.value.ptr = reinterpret_cast<char*>(pool_->Allocate(value->len));
+  memcpy(entry.value.ptr, value->ptr, value->len);
+  entry.hash = hash;
+  entry.passed = passed;
+  buckets_[bucket] = entries_.size();
+  entries_.push_back(entry);
+  return passed;
+}
+
+void DictionaryFilter::Disable() {
+  VLOG(2) << "Disabling dictionary filter with more than " << MAX_VALUES
+          << " values: " << conjunct_->DebugString();
+  enabled_ = false;
+  vector<Entry>().swap(entries_);
+  vector<int>().swap(buckets_);
+  pool_.reset();
+}
@@ -0,0 +1,104 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_DICTIONARY_FILTER_H
+#define IMPALA_EXEC_DICTIONARY_FILTER_H
+
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "runtime/descriptors.h"
+#include "runtime/string-value.h"
+
+namespace impala {
+
+class Expr;
+class MemPool;
+class TupleRow;
+
+// Evaluates a conjunct that only depends on one string slot (e.g. s = 'abc' or
+// s LIKE '%abc%') once per distinct value of the slot.  The filter builds a dictionary
+// of the values it sees, with the result of the conjunct for each of them, and
+// answers rows with a known value from the dictionary.  This is what the trevni
+// scanner does with the dictionaries of its columns, for formats without them.
+// Low-cardinality columns are the common case, so the filter starts enabled; once the
+// slot has more than MAX_VALUES distinct values, it frees the dictionary and evaluates
+// the conjunct for every row.
+// The dictionary holds copies of the values, so rows may be freed or reused after
+// they were evaluated.  This class is not thread safe (neither is the conjunct).
+class DictionaryFilter {
+ public:
+  // Maximum number of distinct values in the dictionary
+  static const int MAX_VALUES = 1024;
+
+  // Returns the slot that 'conjunct' depends on if it is a string slot, 'conjunct'
+  // references no other slot and it is deterministic.  Returns NULL otherwise.
+  static const SlotDescriptor* GetSlot(Expr* conjunct, const DescriptorTbl& desc_tbl);
+
+  // 'conjunct' must be prepared and only depend on the string slot at 'slot_offset'
+  // of the tuple at 'tuple_idx' of the rows, whose null indicator is 'null_offset'.
+  DictionaryFilter(Expr* conjunct, int tuple_idx, int slot_offset,
+      const NullIndicatorOffset& null_offset);
+
+  ~DictionaryFilter();
+
+  // Returns true if 'row' passes the conjunct, like ExecNode::EvalConjuncts().
+  bool Eval(TupleRow* row);
+
+  // False once the slot had too many distinct values.
+  bool enabled() const { return enabled_; }
+
+  int num_values() const { return entries_.size(); }
+
+  // Number of rows that were answered from the dictionary
+  int64_t num_hits() const { return num_hits_; }
+
+ private:
+  // power of two, so that the dictionary is at most half full
+  static const int NUM_BUCKETS = 2 * MAX_VALUES;
+
+  struct Entry {
+    // points into pool_
+    StringValue value;
+    uint32_t hash;
+    bool passed;
+  };
+
+  // Frees the dictionary and evaluates the conjunct for every row from then on.
+  void Disable();
+
+  Expr* conjunct_;
+  const int tuple_idx_;
+  const int slot_offset_;
+  const NullIndicatorOffset null_offset_;
+  bool enabled_;
+
+  // -1 until a row with a NULL slot was evaluated, then whether it passed
+  int null_result_;
+
+  std::vector<Entry> entries_;
+
+  // Open addressing hash table of indexes into entries_; the bucket of an entry is
+  // the first empty one at or after its hash.  -1 for empty buckets.
+  std::vector<int> buckets_;
+
+  boost::scoped_ptr<MemPool> pool_;
+  int64_t num_hits_;
+};
+
+}
+
+#endif
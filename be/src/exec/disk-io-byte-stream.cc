@@ -0,0 +1,175 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/disk-io-byte-stream.h"
+
+#include <algorithm>
+#include <vector>
+
+#include "common/status.h"
+#include "exec/hdfs-scan-node.h"
+#include "runtime/runtime-state.h"
+
+using namespace impala;
+using namespace std;
+
+DiskIoByteStream::DiskIoByteStream(DiskIoMgr* io_mgr, HdfsScanNode* scan_node,
+    int disk_id, int64_t offset, int64_t len, int max_buffers)
+  : ByteStream(),
+    io_mgr_(io_mgr),
+    scan_node_(scan_node),
+    disk_id_(disk_id),
+    range_end_(offset + len),
+    max_buffers_(max_buffers),
+    position_(offset),
+    reader_(NULL),
+    buffer_(NULL),
+    buffer_start_(offset),
+    buffer_end_(offset) {
+  DCHECK_GT(max_buffers, 0);
+}
+
+DiskIoByteStream::~DiskIoByteStream() {
+  CancelRange();
+}
+
+Status DiskIoByteStream::Open(const string& location) {
+  DCHECK(reader_ == NULL);
+  location_ = location;
+  return IssueRange(position_);
+}
+
+Status DiskIoByteStream::Close() {
+  CancelRange();
+  return Status::OK;
+}
+
+Status DiskIoByteStream::IssueRange(int64_t offset) {
+  DCHECK(reader_ == NULL);
+  DCHECK(buffer_ == NULL);
+  position_ = offset;
+  buffer_start_ = buffer_end_ = offset;
+  if (offset >= range_end_) return Status::OK;
+
+  DiskIoMgr::ReaderContext* reader;
+  RETURN_IF_ERROR(io_mgr_->RegisterReader(
+      scan_node_->hdfs_connection(), max_buffers_, &reader));
+  reader_ = reader;
+  io_mgr_->set_bytes_read_counter(reader_, scan_node_->bytes_read_counter());
+  io_mgr_->set_read_timer(reader_, scan_node_->read_timer());
+  io_mgr_->set_weight(reader_, scan_node_->runtime_state()->io_weight());
+
+  scan_range_.Reset(location_.c_str(), range_end_ - offset, offset, disk_id_);
+  vector<DiskIoMgr::ScanRange*> ranges(1, &scan_range_);
+  return io_mgr_->AddScanRanges(reader_, ranges);
+}
+
+void DiskIoByteStream::CancelRange() {
+  // The buffer must be returned before the reader is unregistered.
+  if (buffer_ != NULL) {
+    buffer_->Return();
+    buffer_ = NULL;
+  }
+  if (reader_ != NULL) {
+    io_mgr_->UnregisterReader(reader_);
+    reader_ = NULL;
+  }
+}
+
+Status DiskIoByteStream::GetNextBuffer() {
+  DCHECK(reader_ != NULL);
+  if (buffer_ != NULL) {
+    buffer_->Return();
+    buffer_ = NULL;
+  }
+  bool eos;
+  Status status = io_mgr_->GetNext(reader_, &buffer_, &eos);
+  if (!status.ok()) {
+    if (buffer_ != NULL) {
+      buffer_->Return();
+      buffer_ = NULL;
+    }
+    return status;
+  }
+  if (buffer_ == NULL) {
+    return Status("Unexpected end of scan range reading " + location_);
+  }
+  buffer_start_ = buffer_->scan_range()->offset() + buffer_->scan_range_offset();
+  buffer_end_ = buffer_start_ + buffer_->len();
+  DCHECK_LE(buffer_end_, range_end_);
+  return Status::OK;
+}
+
+Status DiskIoByteStream::Read(uint8_t* buf, int64_t req_length, int64_t* actual_length) {
+  DCHECK(buf != NULL);
+  DCHECK_GE(req_length, 0);
+  *actual_length = 0;
+  while (*actual_length < req_length && position_ < range_end_) {
+    if (position_ >= buffer_end_) {
+      RETURN_IF_ERROR(GetNextBuffer());
+      // The file is shorter than the range.
+      if (buffer_end_ == buffer_start_) break;
+    }
+    DCHECK_GE(position_, buffer_start_);
+    int64_t num_bytes = min(req_length - *actual_length, buffer_end_ - position_);
+    memcpy(buf + *actual_length, buffer_->buffer() + (position_ - buffer_start_),
+        num_bytes);
+    *actual_length += num_bytes;
+    position_ += num_bytes;
+  }
+  total_bytes_read_ += *actual_length;
+  return Status::OK;
+}
+
+Status DiskIoByteStream::Seek(int64_t offset) {
+  if (offset >= buffer_start_ && offset <= buffer_end_) {
+    position_ = offset;
+    return Status::OK;
+  }
+
+  if (offset >= range_end_) {
+    CancelRange();
+    position_ = buffer_start_ = buffer_end_ = offset;
+    return Status::OK;
+  }
+
+  // Skip over the read ahead buffers if the offset is in them.
+  int64_t read_ahead = static_cast<int64_t>(max_buffers_) * io_mgr_->read_buffer_size();
+  if (reader_ != NULL && offset > buffer_end_ && offset - buffer_end_ <= read_ahead) {
+    while (offset > buffer_end_) {
+      position_ = buffer_end_;
+      RETURN_IF_ERROR(GetNextBuffer());
+      if (buffer_end_ == buffer_start_) break;
+    }
+    position_ = offset;
+    return Status::OK;
+  }
+
+  CancelRange();
+  return IssueRange(offset);
+}
+
+Status DiskIoByteStream::SeekRelative(int64_t offset) {
+  return Seek(position_ + offset);
+}
+
+Status DiskIoByteStream::GetPosition(int64_t* position) {
+  *position = position_;
+  return Status::OK;
+}
+
+Status DiskIoByteStream::Eof(bool* eof) {
+  *eof = position_ >= range_end_;
+  return Status::OK;
+}
@@ -0,0 +1,106 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_DISK_IO_BYTE_STREAM_H_
+#define IMPALA_EXEC_DISK_IO_BYTE_STREAM_H_
+
+#include <string>
+
+#include "exec/byte-stream.h"
+#include "runtime/disk-io-mgr.h"
+
+namespace impala {
+
+class HdfsScanNode;
+class Status;
+
+// A ByteStream that reads one byte range of a file through the DiskIoMgr.  The range
+// is issued to the io mgr as a scan range, so it is queued with the other reads on
+// its disk and read asynchronously: the io mgr reads up to max_buffers buffers ahead
+// of the caller and Read() only blocks if the caller gets ahead of the disk.
+// Each stream registers its own reader with the io mgr.  The reader's buffer limit
+// bounds the read ahead of the stream, and since the stream never waits on buffers
+// for other ranges, a thread can consume several streams in lock step (e.g. the
+// columns of a columnar file) without them starving each other.
+// The io mgr requires that a reader is registered, read and unregistered from the
+// same thread, so Open(), Read(), Seek() and Close() must all be called from one
+// thread.
+class DiskIoByteStream : public ByteStream {
+ public:
+  // io_mgr: io mgr to read with.
+  // scan_node: scan node reading the stream, for its hdfs connection and counters.
+  // disk_id: disk queue the reads are issued to.
+  // offset, len: the byte range of the file this stream reads.  Offsets passed to
+  //   Seek() and returned by GetPosition() are file offsets and the stream is at eof
+  //   at offset + len.
+  // max_buffers: number of io buffers read ahead.
+  DiskIoByteStream(DiskIoMgr* io_mgr, HdfsScanNode* scan_node, int disk_id,
+      int64_t offset, int64_t len, int max_buffers);
+
+  virtual ~DiskIoByteStream();
+
+  // Issue the range starting at offset to the io mgr.  location is the file name.
+  virtual Status Open(const std::string& location);
+  virtual Status Close();
+  virtual Status Read(uint8_t* buf, int64_t req_length, int64_t* actual_length);
+
+  // Seeks within the current buffer, or past bytes that are (being) read ahead, are
+  // done by skipping.  Other seeks cancel the read ahead and issue a new range
+  // from offset, so data that is seeked over is not read.
+  virtual Status Seek(int64_t offset);
+  virtual Status SeekRelative(int64_t offset);
+  virtual Status GetPosition(int64_t* position);
+  virtual Status Eof(bool* eof);
+
+ private:
+  DiskIoMgr* io_mgr_;
+  HdfsScanNode* scan_node_;
+  int disk_id_;
+
+  // End of the byte range of this stream.
+  int64_t range_end_;
+
+  int max_buffers_;
+
+  // File offset of the next byte returned by Read().
+  int64_t position_;
+
+  // Reader and scan range for the reads from the last issued offset.  NULL if there
+  // is no range in flight.
+  DiskIoMgr::ReaderContext* reader_;
+  DiskIoMgr::ScanRange scan_range_;
+
+  // Buffer position_ is in, NULL if none has been read since the last range was
+  // issued.
+  DiskIoMgr::BufferDescriptor* buffer_;
+
+  // File offsets of the start and end of the data in buffer_.
+  int64_t buffer_start_;
+  int64_t buffer_end_;
+
+  // Issues the range [offset, range_end_). Any previous range must have been
+  // cancelled by CancelRange().
+  Status IssueRange(int64_t offset);
+
+  // Returns buffer_ and unregisters reader_, cancelling any reads in flight.
+  void CancelRange();
+
+  // Gets the next buffer from the io mgr into buffer_, returning the previous one.
+  Status GetNextBuffer();
+};
+
+}
+
+#endif
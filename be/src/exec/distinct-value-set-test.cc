@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "exec/distinct-value-set.h"
+#include "runtime/mem-pool.h"
+#include "runtime/string-value.inline.h"
+
+using namespace std;
+
+namespace impala {
+
+TEST(DistinctValueSetTest, Groups) {
+  MemPool pool;
+  vector<PrimitiveType> types(1, TYPE_INT);
+  DistinctValueSet set(types, &pool);
+  int group1, group2;
+  for (int i = 0; i < 10000; ++i) {
+    int32_t value = i % 100;
+    void* values[] = { &value };
+    EXPECT_EQ(set.Insert(&group1, values), i < 100);
+    EXPECT_EQ(set.Insert(&group2, values), i < 100);
+  }
+  EXPECT_EQ(set.size(), 200);
+  EXPECT_GT(set.byte_size(), 0);
+
+  MemPool pool2;
+  set.Reset(&pool2);
+  EXPECT_EQ(set.size(), 0);
+  int32_t value = 0;
+  void* values[] = { &value };
+  EXPECT_TRUE(set.Insert(&group1, values));
+  EXPECT_GT(pool2.total_allocated_bytes(), 0);
+}
+
+TEST(DistinctValueSetTest, MultipleValues) {
+  MemPool pool;
+  vector<PrimitiveType> types;
+  types.push_back(TYPE_BIGINT);
+  types.push_back(TYPE_STRING);
+  DistinctValueSet set(types, &pool);
+  int group;
+  string strings[] = { "a", "b", "a" };
+  int64_t ints[] = { 1, 1, 2 };
+  for (int i = 0; i < 3; ++i) {
+    // copies of the strings, to check that the set keeps its own data
+    string str = strings[i];
+    StringValue str_value(const_cast<char*>(str.data()), str.size());
+    void* values[] = { &ints[i], &str_value };
+    EXPECT_TRUE(set.Insert(&group, values));
+    str[0] = 'x';
+  }
+  for (int i = 0; i < 3; ++i) {
+    StringValue str_value(const_cast<char*>(strings[i].data()), strings[i].size());
+    void* values[] = { &ints[i], &str_value };
+    EXPECT_FALSE(set.Insert(&group, values));
+  }
+  EXPECT_EQ(set.size(), 3);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,97 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/distinct-value-set.h"
+
+#include "runtime/mem-pool.h"
+#include "runtime/raw-value.h"
+#include "runtime/string-value.inline.h"
+#include "util/hash-util.h"
+
+using namespace std;
+
+namespace impala {
+
+const int DistinctValueSet::MIN_BUCKETS;
+
+DistinctValueSet::DistinctValueSet(const vector<PrimitiveType>& types, MemPool* pool)
+  : types_(types),
+    pool_(pool),
+    num_entries_(0) {
+  DCHECK(pool != NULL);
+  DCHECK(!types.empty());
+  buckets_.resize(MIN_BUCKETS, NULL);
+}
+
+inline bool DistinctValueSet::Eq(const Entry* entry, const void* group,
+    void* const* values) const {
+  if (entry->group != group) return false;
+  for (int i = 0; i < types_.size(); ++i) {
+    if (!RawValue::Eq(entry->values[i], values[i], types_[i])) return false;
+  }
+  return true;
+}
+
+bool DistinctValueSet::Insert(const void* group, void* const* values) {
+  uint32_t hash = HashUtil::Hash(&group, sizeof(group), 0);
+  for (int i = 0; i < types_.size(); ++i) {
+    DCHECK(values[i] != NULL);
+    hash = RawValue::GetHashValue(values[i], types_[i], hash);
+  }
+  int mask = buckets_.size() - 1;
+  int bucket_idx = hash & mask;
+  while (buckets_[bucket_idx] != NULL) {
+    Entry* entry = buckets_[bucket_idx];
+    if (entry->hash == hash && Eq(entry, group, values)) return false;
+    bucket_idx = (bucket_idx + 1) & mask;
+  }
+
+  Entry* entry = reinterpret_cast<Entry*>(pool_->Allocate(sizeof(Entry)));
+  entry->group = group;
+  entry->hash = hash;
+  entry->values =
+      reinterpret_cast<void**>(pool_->Allocate(types_.size() * sizeof(void*)));
+  for (int i = 0; i < types_.size(); ++i) {
+    int size = types_[i] == TYPE_STRING ? sizeof(StringValue) : GetByteSize(types_[i]);
+    entry->values[i] = pool_->Allocate(size);
+    RawValue::Write(values[i], entry->values[i], types_[i], pool_);
+  }
+  buckets_[bucket_idx] = entry;
+  ++num_entries_;
+  // keep the table at most half full
+  if (num_entries_ * 2 > buckets_.size()) ResizeBuckets(buckets_.size() * 2);
+  return true;
+}
+
+void DistinctValueSet::Reset(MemPool* pool) {
+  DCHECK(pool != NULL);
+  pool_ = pool;
+  num_entries_ = 0;
+  vector<Entry*>(MIN_BUCKETS, NULL).swap(buckets_);
+}
+
+void DistinctValueSet::ResizeBuckets(int num_buckets) {
+  DCHECK_EQ(num_buckets & (num_buckets - 1), 0);
+  vector<Entry*> old_buckets(num_buckets, NULL);
+  old_buckets.swap(buckets_);
+  int mask = num_buckets - 1;
+  for (int i = 0; i < old_buckets.size(); ++i) {
+    if (old_buckets[i] == NULL) continue;
+    int bucket_idx = old_buckets[i]->hash & mask;
+    while (buckets_[bucket_idx] != NULL) bucket_idx = (bucket_idx + 1) & mask;
+    buckets_[bucket_idx] = old_buckets[i];
+  }
+}
+
+}
@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_DISTINCT_VALUE_SET_H
+#define IMPALA_EXEC_DISTINCT_VALUE_SET_H
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "common/logging.h"
+#include "runtime/primitive-type.h"
+
+namespace impala {
+
+class MemPool;
+
+// The distinct values that a DISTINCT aggregate function (e.g. COUNT(DISTINCT a, b))
+// has seen in each group of an aggregation.  A group is identified by a pointer (its
+// aggregation tuple), so that the values of all groups share one open addressing hash
+// table of (group, values) entries.  Entries and values, including string data, are
+// copied into a MemPool, which must outlive the set.
+class DistinctValueSet {
+ public:
+  // 'types' are the types of the values of each entry.
+  DistinctValueSet(const std::vector<PrimitiveType>& types, MemPool* pool);
+
+  // Adds the values 'values' (one non-NULL value per type) to the values of 'group'.
+  // Returns true if 'group' had not seen them before.
+  bool Insert(const void* group, void* const* values);
+
+  // Drops all entries and allocates future ones from 'pool'.  This must be called when
+  // the data of the previous pool was freed or transferred.
+  void Reset(MemPool* pool);
+
+  // Number of (group, values) entries.
+  int64_t size() const { return num_entries_; }
+
+  // Returns the number of bytes allocated for the buckets, not including the entries
+  // in the pool.
+  int64_t byte_size() const { return buckets_.size() * sizeof(Entry*); }
+
+ private:
+  static const int MIN_BUCKETS = 1024;
+
+  struct Entry {
+    const void* group;
+    uint32_t hash;
+    // one value per type
+    void** values;
+  };
+
+  bool Eq(const Entry* entry, const void* group, void* const* values) const;
+
+  // Rebuilds buckets_ with 'num_buckets' buckets, which must be a power of two.
+  void ResizeBuckets(int num_buckets);
+
+  const std::vector<PrimitiveType> types_;
+  MemPool* pool_;
+
+  // NULL for empty buckets; the bucket of an entry is the first empty one at or after
+  // its hash modulo the number of buckets.
+  std::vector<Entry*> buckets_;
+  int64_t num_entries_;
+};
+
+}
+
+#endif
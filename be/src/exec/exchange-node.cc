@@ -14,15 +14,23 @@
 
 #include "exec/exchange-node.h"
 
+#include <algorithm>
 #include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
 
+#include "exprs/expr.h"
 #include "runtime/data-stream-mgr.h"
 #include "runtime/runtime-state.h"
 #include "runtime/row-batch.h"
+#include "runtime/tuple-row.h"
 #include "util/debug-util.h"
 #include "util/runtime-profile.h"
 #include "gen-cpp/PlanNodes_types.h"
 
+DEFINE_int32(exchg_node_buffer_size_bytes, 10 * 1024 * 1024,
+    "(Advanced) maximum number of bytes of row batches an exchange node buffers; "
+    "senders block once it is reached");
+
 using namespace impala;
 using namespace std;
 using namespace boost;
@@ -31,29 +39,152 @@ ExchangeNode::ExchangeNode(
     ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs)
   : ExecNode(pool, tnode, descs),
     num_senders_(0),
-    stream_recvr_(NULL) {
+    has_shared_stream_id_(false),
+    stream_recvr_(NULL),
+    is_merging_(false) {
+  // TODO: log errors in runtime state
+  Status status = Init(pool, tnode);
+  DCHECK(status.ok()) << "ExchangeNode c'tor:Init failed: \n" << status.GetErrorMsg();
+}
+
+Status ExchangeNode::Init(ObjectPool* pool, const TPlanNode& tnode) {
+  if (!tnode.__isset.exchange_node
+      || tnode.exchange_node.ordering_exprs.empty()) {
+    return Status::OK;
+  }
+  is_merging_ = true;
+  RETURN_IF_ERROR(Expr::CreateExprTrees(
+      pool, tnode.exchange_node.ordering_exprs, &lhs_ordering_exprs_));
+  RETURN_IF_ERROR(Expr::CreateExprTrees(
+      pool, tnode.exchange_node.ordering_exprs, &rhs_ordering_exprs_));
+  is_asc_order_.insert(
+      is_asc_order_.begin(), tnode.exchange_node.is_asc_order.begin(),
+      tnode.exchange_node.is_asc_order.end());
+  DCHECK_EQ(is_asc_order_.size(), lhs_ordering_exprs_.size());
+  return Status::OK;
 }
 
 Status ExchangeNode::Prepare(RuntimeState* state) {
   RETURN_IF_ERROR(ExecNode::Prepare(state));
   
-  // TODO: figure out appropriate buffer size
+  bytes_received_counter_ =
+      ADD_COUNTER(runtime_profile(), "BytesReceived", TCounterType::BYTES);
+  peak_buffered_bytes_counter_ =
+      ADD_COUNTER(runtime_profile(), "PeakBufferedBytes", TCounterType::BYTES);
+  blocked_senders_counter_ =
+      ADD_COUNTER(runtime_profile(), "SendersBlocked", TCounterType::UNIT);
+  sender_blocked_timer_ =
+      ADD_COUNTER(runtime_profile(), "SendersBlockedTime", TCounterType::TIME_MS);
+  data_arrival_timer_ =
+      ADD_COUNTER(runtime_profile(), "DataArrivalWaitTime", TCounterType::CPU_TICKS);
+
+  if (is_merging_) {
+    Expr::Prepare(lhs_ordering_exprs_, state, row_descriptor_);
+    Expr::Prepare(rhs_ordering_exprs_, state, row_descriptor_);
+    comparator_.reset(new TupleRowComparator(
+        lhs_ordering_exprs_, rhs_ordering_exprs_, is_asc_order_));
+  }
+
   // row descriptor of this node and the incoming stream should be the same.
   DCHECK_GT(num_senders_, 0);
   stream_recvr_.reset(state->stream_mgr()->CreateRecvr(
-    row_descriptor_, state->fragment_instance_id(), id_, num_senders_, 1024 * 1024));
+    row_descriptor_, state->fragment_instance_id(), id_, num_senders_,
+    FLAGS_exchg_node_buffer_size_bytes, is_merging_,
+    has_shared_stream_id_ ? &shared_stream_id_ : NULL));
+
+  if (!relay_destinations_.empty()) {
+    TDataStreamSink sink;
+    sink.dest_node_id = id_;
+    sink.output_partition.type = TPartitionType::UNPARTITIONED;
+    relay_.reset(new DataStreamSender(row_descriptor_, state->fragment_instance_id(),
+        sink, relay_destinations_, 16 * 1024));
+    RETURN_IF_ERROR(relay_->Init(state));
+    stream_recvr_->SetRelay(relay_.get());
+  }
   return Status::OK;
 }
 
 Status ExchangeNode::Open(RuntimeState* state) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  if (!is_merging_) return Status::OK;
+  // the merge can't start before every sender has delivered its first rows
+  DCHECK(inputs_.empty());
+  for (int i = 0; i < num_senders_; ++i) {
+    Input* input = pool_->Add(new Input());
+    input->sender_idx = i;
+    input->row_idx = 0;
+    inputs_.push_back(input);
+    bool input_eos;
+    RETURN_IF_ERROR(GetNextInputBatch(input, &input_eos));
+    if (!input_eos) heap_.push_back(input);
+  }
+  make_heap(heap_.begin(), heap_.end(), InputGreaterThan(this));
+  return Status::OK;
+}
+
+TupleRow* ExchangeNode::Input::current_row() {
+  return batch->GetRow(row_idx);
+}
+
+Status ExchangeNode::GetNextInputBatch(Input* input, bool* eos) {
+  bool is_cancelled;
+  do {
+    {
+      SCOPED_TIMER(data_arrival_timer_);
+      input->batch.reset(stream_recvr_->GetBatch(input->sender_idx, &is_cancelled));
+    }
+    UpdateStreamCounters();
+    if (is_cancelled) return Status(TStatusCode::CANCELLED);
+  } while (input->batch.get() != NULL && input->batch->num_rows() == 0);
+  input->row_idx = 0;
+  *eos = input->batch.get() == NULL;
+  return Status::OK;
+}
+
+Status ExchangeNode::GetNextMerging(
+    RuntimeState* state, RowBatch* output_batch, bool* eos) {
+  output_batch->Reset();
+  InputGreaterThan greater_than(this);
+  while (!output_batch->IsFull() && !heap_.empty() && !ReachedLimit()) {
+    pop_heap(heap_.begin(), heap_.end(), greater_than);
+    Input* input = heap_.back();
+    int row_idx = output_batch->AddRow();
+    output_batch->CopyRow(input->current_row(), output_batch->GetRow(row_idx));
+    output_batch->CommitLastRow();
+    ++num_rows_returned_;
+
+    if (++input->row_idx < input->batch->num_rows()) {
+      push_heap(heap_.begin(), heap_.end(), greater_than);
+      continue;
+    }
+    // the output now holds the last reference to this batch's data
+    input->batch->TransferResourceOwnership(output_batch);
+    bool input_eos;
+    RETURN_IF_ERROR(GetNextInputBatch(input, &input_eos));
+    if (input_eos) {
+      heap_.pop_back();
+    } else {
+      push_heap(heap_.begin(), heap_.end(), greater_than);
+    }
+  }
+  COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+  *eos = heap_.empty() || ReachedLimit();
+  // let the senders stop
+  if (ReachedLimit()) stream_recvr_->Close();
   return Status::OK;
 }
 
 Status ExchangeNode::GetNext(RuntimeState* state, RowBatch* output_batch, bool* eos) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
+  if (is_merging_) return GetNextMerging(state, output_batch, eos);
   bool is_cancelled;
-  scoped_ptr<RowBatch> input_batch(stream_recvr_->GetBatch(&is_cancelled));
+  scoped_ptr<RowBatch> input_batch;
+  {
+    SCOPED_TIMER(data_arrival_timer_);
+    input_batch.reset(stream_recvr_->GetBatch(&is_cancelled));
+  }
+  UpdateStreamCounters();
   VLOG_FILE << "exch: has batch=" << (input_batch.get() == NULL ? "false" : "true")
             << " #rows=" << (input_batch.get() != NULL ? input_batch->num_rows() : 0)
             << " is_cancelled=" << (is_cancelled ? "true" : "false")
@@ -69,30 +200,66 @@ Status ExchangeNode::GetNext(RuntimeState* state, RowBatch* output_batch, bool*
 
   // copy all rows (up to limit) and attach all mempools from the input batch
   DCHECK(input_batch->row_desc().IsPrefixOf(output_batch->row_desc()));
-  int i = 0;
-  for (; i < input_batch->num_rows(); ++i) {
-    if (ReachedLimit()) {
-      *eos = true;
-      break;
+  int num_rows = input_batch->num_rows();
+  if (limit_ != -1) {
+    num_rows = max<int64_t>(0, min<int64_t>(num_rows, limit_ - num_rows_returned_));
+  }
+  if (num_rows > 0 && input_batch->row_byte_size() == output_batch->row_byte_size()) {
+    // the rows have the same layout, so all tuple pointers can be copied at once
+    int dest_idx = output_batch->AddRows(num_rows);
+    DCHECK_EQ(dest_idx, 0);
+    memcpy(output_batch->GetRow(dest_idx), input_batch->GetRow(0),
+        num_rows * input_batch->row_byte_size());
+    output_batch->CommitRows(num_rows);
+  } else {
+    for (int i = 0; i < num_rows; ++i) {
+      TupleRow* src = input_batch->GetRow(i);
+      int j = output_batch->AddRow();
+      DCHECK_EQ(i, j);
+      TupleRow* dest = output_batch->GetRow(i);
+      // this works as expected if rows from input_batch form a prefix of
+      // rows in output_batch
+      input_batch->CopyRow(src, dest);
+      output_batch->CommitLastRow();
     }
-    TupleRow* src = input_batch->GetRow(i);
-    int j = output_batch->AddRow();
-    DCHECK_EQ(i, j);
-    TupleRow* dest = output_batch->GetRow(i);
-    // this works as expected if rows from input_batch form a prefix of
-    // rows in output_batch
-    input_batch->CopyRow(src, dest);
-    output_batch->CommitLastRow();
   }
-  num_rows_returned_ += i;
+  num_rows_returned_ += num_rows;
+  if (ReachedLimit()) {
+    *eos = true;
+    // let the senders stop
+    stream_recvr_->Close();
+  }
   COUNTER_SET(rows_returned_counter_, num_rows_returned_);
   input_batch->TransferResourceOwnership(output_batch);
   return Status::OK;
 }
 
+Status ExchangeNode::Close(RuntimeState* state) {
+  Status status;
+  // our receivers only get the rest of the stream through the relay
+  if (relay_.get() != NULL) status = stream_recvr_->WaitForRelay();
+  Status close_status = ExecNode::Close(state);
+  return status.ok() ? close_status : status;
+}
+
+void ExchangeNode::UpdateStreamCounters() {
+  COUNTER_SET(bytes_received_counter_, stream_recvr_->num_bytes_received());
+  COUNTER_SET(peak_buffered_bytes_counter_, stream_recvr_->peak_buffered_bytes());
+  COUNTER_SET(blocked_senders_counter_, stream_recvr_->num_blocked_adds());
+  COUNTER_SET(sender_blocked_timer_, stream_recvr_->sender_blocked_time_ms());
+}
+
 void ExchangeNode::DebugString(int indentation_level, std::stringstream* out) const {
   *out << string(indentation_level * 2, ' ');
   *out << "ExchangeNode(#senders=" << num_senders_;
+  if (is_merging_) {
+    *out << " ordering_exprs=" << Expr::DebugString(lhs_ordering_exprs_)
+         << " sort_order=[";
+    for (int i = 0; i < is_asc_order_.size(); ++i) {
+      *out << (i > 0 ? " " : "") << (is_asc_order_[i] ? "asc" : "desc");
+    }
+    *out << "]";
+  }
   ExecNode::DebugString(indentation_level, out);
   *out << ")";
 }
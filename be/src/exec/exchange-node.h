@@ -16,15 +16,25 @@
 #ifndef IMPALA_EXEC_EXCHANGE_NODE_H
 #define IMPALA_EXEC_EXCHANGE_NODE_H
 
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 #include "exec/exec-node.h"
+#include "exec/tuple-row-comparator.h"
 #include "runtime/data-stream-recvr.h"
+#include "runtime/data-stream-sender.h"
+#include "util/runtime-profile.h"
+#include "gen-cpp/ImpalaInternalService_types.h"  // for TPlanFragmentDestination
 
 namespace impala {
 
 // Receiver node for data streams. This simply feeds row batches received from the
 // data stream into the execution tree.
-// The data stream is created in Prepare() and closed in the d'tor.
+// The data stream is created in Prepare() and closed in the d'tor. It buffers at most
+// --exchg_node_buffer_size_bytes (plus one batch); senders are blocked beyond that.
+// If the plan node specifies ordering exprs, each sender's stream is expected to be
+// sorted on them and the node returns their merge, which is then sorted as well
+// (a merging exchange). The merge deep-copies nothing: output rows point into the
+// input batches, whose memory is moved to the output batch once they're exhausted.
 class ExchangeNode : public ExecNode {
  public:
   ExchangeNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
@@ -33,16 +43,121 @@ class ExchangeNode : public ExecNode {
   virtual Status Open(RuntimeState* state);
   virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
 
+  // Waits for the relay, if any, to forward the whole stream.
+  virtual Status Close(RuntimeState* state);
+
   // the number of senders needs to be set after the c'tor, because it's not
   // recorded in TPlanNode, and before calling Prepare()
   void set_num_senders(int num_senders) { num_senders_ = num_senders; }
 
+  // Makes the node receive the broadcast stream that is sent to the fragment instance
+  // 'stream_id' on this backend (see DataStreamMgr::CreateRecvr()); must be called
+  // before Prepare().
+  void set_shared_stream_id(const TUniqueId& stream_id) {
+    has_shared_stream_id_ = true;
+    shared_stream_id_ = stream_id;
+  }
+
+  // Makes the node forward its (broadcast) stream to 'destinations' while receiving
+  // it, as part of a relay tree (see DataStreamRecvr::SetRelay()); must be called
+  // before Prepare().
+  void set_relay_destinations(const std::vector<TPlanFragmentDestination>& destinations) {
+    relay_destinations_ = destinations;
+  }
+
+  // Tells the senders that no (more) rows are needed, e.g. because the parent
+  // already has them.  Can be called after Prepare() without opening the node.
+  void CloseStream() { stream_recvr_->Close(); }
+
  protected:
   virtual void DebugString(int indentation_level, std::stringstream* out) const;
 
  private:
+  Status Init(ObjectPool* pool, const TPlanNode& tnode);
+
+  // Strict less-than on the ordering exprs; NULLs go last regardless of asc/desc.
+  class TupleRowLessThan {
+   public:
+    TupleRowLessThan(ExchangeNode* node) : node_(node) {}
+    bool operator()(TupleRow* const& lhs, TupleRow* const& rhs) const {
+      return node_->comparator_->Less(lhs, rhs);
+    }
+
+   private:
+    ExchangeNode* node_;
+  };
+
+  // The current batch of one sender's stream.
+  struct Input {
+    int sender_idx;
+    boost::scoped_ptr<RowBatch> batch;
+    int row_idx;
+
+    TupleRow* current_row();
+  };
+
+  // Orders inputs by their current row, so that a max-heap under this comparator
+  // has the smallest row on top.
+  class InputGreaterThan {
+   public:
+    InputGreaterThan(ExchangeNode* node) : less_than_(node) {}
+    bool operator()(Input* const& lhs, Input* const& rhs) const {
+      return less_than_(rhs->current_row(), lhs->current_row());
+    }
+
+   private:
+    TupleRowLessThan less_than_;
+  };
+
+  // Replaces input->batch with the next non-empty batch of its sender, or with NULL
+  // if the sender's stream is exhausted (*eos is set accordingly).
+  Status GetNextInputBatch(Input* input, bool* eos);
+
+  // GetNext() for merging exchanges.
+  Status GetNextMerging(RuntimeState* state, RowBatch* output_batch, bool* eos);
+
   int num_senders_;  // needed for stream_recvr_ construction
+
+  // set if the node shares its stream with the other instances on this backend
+  bool has_shared_stream_id_;
+  TUniqueId shared_stream_id_;
+
+  // Forwards the stream to relay_destinations_, if there are any; created in
+  // Prepare().  Declared before stream_recvr_, which refers to it until it is
+  // destroyed.
+  std::vector<TPlanFragmentDestination> relay_destinations_;
+  boost::scoped_ptr<DataStreamSender> relay_;
+
   boost::scoped_ptr<DataStreamRecvr> stream_recvr_;
+
+  // flow control statistics of stream_recvr_
+  RuntimeProfile::Counter* bytes_received_counter_;
+  RuntimeProfile::Counter* peak_buffered_bytes_counter_;
+  RuntimeProfile::Counter* blocked_senders_counter_;
+  RuntimeProfile::Counter* sender_blocked_timer_;
+
+  // time spent waiting in stream_recvr_->GetBatch() for batches to arrive
+  RuntimeProfile::Counter* data_arrival_timer_;
+
+  // Copies stream_recvr_'s flow control statistics into the counters above.
+  void UpdateStreamCounters();
+
+  // true if this node merges sorted streams
+  bool is_merging_;
+  std::vector<bool> is_asc_order_;
+
+  // Two copies of the ordering exprs, one for each side of a comparison
+  // (see TopNNode).
+  std::vector<Expr*> lhs_ordering_exprs_;
+  std::vector<Expr*> rhs_ordering_exprs_;
+
+  // Compares rows by the ordering exprs above; created in Prepare().
+  boost::scoped_ptr<TupleRowComparator> comparator_;
+
+  // For merging exchanges, one input per sender, and a heap (under InputGreaterThan)
+  // of those that aren't exhausted yet. Inputs are owned by pool_.
+  std::vector<Input*> inputs_;
+  std::vector<Input*> heap_;
 };
 
 };
@@ -14,26 +14,36 @@
 
 #include "exec/exec-node.h"
 
+#include <iomanip>
 #include <sstream>
+#include <gflags/gflags.h>
 
 #include "codegen/llvm-codegen.h"
 #include "common/object-pool.h"
 #include "common/status.h"
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "exec/aggregation-node.h"
 #include "exec/hash-join-node.h"
 #include "exec/hdfs-scan-node.h"
 #include "exec/hbase-scan-node.h"
 #include "exec/exchange-node.h"
 #include "exec/merge-node.h"
+#include "exec/nested-loop-join-node.h"
+#include "exec/sort-node.h"
 #include "exec/topn-node.h"
 #include "runtime/descriptors.h"
 #include "runtime/mem-pool.h"
+#include "runtime/mem-tracker.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
 #include "util/debug-util.h"
 #include "util/runtime-profile.h"
 
+DEFINE_bool(exec_node_hw_counters, false, "if true, exec nodes count the hardware "
+    "events (cycles, instructions, cache and branch misses) of their GetNext() calls "
+    "in their profiles");
+
 using namespace llvm;
 using namespace std;
 using namespace boost;
@@ -41,6 +51,8 @@ using namespace boost;
 namespace impala {
 
 const string ExecNode::ROW_THROUGHPUT_COUNTER = "RowsReturnedRate";
+const string ExecNode::ROWS_RETURNED_COUNTER = "RowsReturned";
+const string ExecNode::PEAK_MEMORY_USAGE_COUNTER = "PeakMemoryUsage";
 
 int ExecNode::GetNodeIdFromProfile(RuntimeProfile* p) {
   return p->metadata();
@@ -52,25 +64,43 @@ ExecNode::ExecNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl
     pool_(pool),
     row_descriptor_(descs, tnode.row_tuples, tnode.nullable_tuples),
     limit_(tnode.limit),
-    num_rows_returned_(0) {
+    num_rows_returned_(0),
+    prev_hash_table_buckets_(
+        tnode.__isset.exec_stats ? tnode.exec_stats.num_hash_table_buckets : 0),
+    hw_counters_enabled_(false) {
   Status status = Expr::CreateExprTrees(pool, tnode.conjuncts, &conjuncts_);
   DCHECK(status.ok())
       << "ExecNode c'tor: deserialization of conjuncts failed:\n"
       << status.GetErrorMsg();
+  SharedExpr::EliminateCommonSubExprs(pool, &conjuncts_);
   InitRuntimeProfile(PrintPlanNodeType(tnode.node_type));
 }
 
+ExecNode::~ExecNode() {
+}
+
 Status ExecNode::Prepare(RuntimeState* state) {
   DCHECK(runtime_profile_.get() != NULL);
+  mem_tracker_.reset(
+      new MemTracker(-1, runtime_profile_->name(), state->instance_mem_tracker()));
   rows_returned_counter_ =
-      ADD_COUNTER(runtime_profile_, "RowsReturned", TCounterType::UNIT);
+      ADD_COUNTER(runtime_profile_, ROWS_RETURNED_COUNTER, TCounterType::UNIT);
   memory_used_counter_ =
       ADD_COUNTER(runtime_profile_, "MemoryUsed", TCounterType::BYTES);
+  runtime_profile_->AddDerivedCounter(PEAK_MEMORY_USAGE_COUNTER, TCounterType::BYTES,
+      bind<int64_t>(&MemTracker::peak_consumption, mem_tracker_.get()));
   rows_returned_rate_ = runtime_profile()->AddDerivedCounter(
       ROW_THROUGHPUT_COUNTER, TCounterType::UNIT_PER_SECOND,
       bind<int64_t>(&RuntimeProfile::UnitsPerSecond, rows_returned_counter_, 
         runtime_profile()->total_time_counter()));
-
+  hw_counters_enabled_ =
+      FLAGS_exec_node_hw_counters && ThreadPerfCounters::GetForThread() != NULL;
+  if (hw_counters_enabled_) {
+    for (int i = 0; i < ThreadPerfCounters::NUM_COUNTERS; ++i) {
+      hw_counters_[i] = ADD_COUNTER(runtime_profile_, ThreadPerfCounters::GetCounterName(
+          static_cast<ThreadPerfCounters::Counter>(i)), TCounterType::UNIT);
+    }
+  }
 
   RETURN_IF_ERROR(PrepareConjuncts(state));
   for (int i = 0; i < children_.size(); ++i) {
@@ -81,6 +111,14 @@ Status ExecNode::Prepare(RuntimeState* state) {
 
 Status ExecNode::Close(RuntimeState* state) {
   COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+  if (hw_counters_enabled_ && hw_counters_[ThreadPerfCounters::CYCLES]->value() > 0) {
+    // IPC, which tells compute bound (high) from memory bound (low) nodes
+    stringstream ipc;
+    ipc << setprecision(3)
+        << static_cast<double>(hw_counters_[ThreadPerfCounters::INSTRUCTIONS]->value())
+           / hw_counters_[ThreadPerfCounters::CYCLES]->value();
+    runtime_profile_->AddInfoString("InstructionsPerCycle", ipc.str());
+  }
   Status result;
   for (int i = 0; i < children_.size(); ++i) {
     result.AddError(children_[i]->Close(state));
@@ -171,15 +209,15 @@ Status ExecNode::CreateNode(ObjectPool* pool, const TPlanNode& tnode,
       if (tnode.sort_node.use_top_n) {
         *node = pool->Add(new TopNNode(pool, tnode, descs));
       } else {
-      // TODO: Need Sort Node
-      //  *node = pool->Add(new SortNode(pool, tnode, descs));
-        error_msg << "ORDER BY with no LIMIT not implemented";
-        return Status(error_msg.str());
+        *node = pool->Add(new SortNode(pool, tnode, descs));
       }
       return Status::OK;
     case TPlanNodeType::MERGE_NODE:
       *node = pool->Add(new MergeNode(pool, tnode, descs));
       return Status::OK;
+    case TPlanNodeType::NESTED_LOOP_JOIN_NODE:
+      *node = pool->Add(new NestedLoopJoinNode(pool, tnode, descs));
+      return Status::OK;
     default:
       map<int, const char*>::const_iterator i =
           _TPlanNodeType_VALUES_TO_NAMES.find(tnode.node_type);
@@ -199,6 +237,12 @@ string ExecNode::DebugString() const {
   return out.str();
 }
 
+void ExecNode::Cancel(RuntimeState* state) {
+  for (int i = 0; i < children_.size(); ++i) {
+    children_[i]->Cancel(state);
+  }
+}
+
 void ExecNode::DebugString(int indentation_level, stringstream* out) const {
   *out << " conjuncts=" << Expr::DebugString(conjuncts_);
   for (int i = 0; i < children_.size(); ++i) {
@@ -215,6 +259,8 @@ Status ExecNode::PrepareConjuncts(RuntimeState* state) {
 }
 
 bool ExecNode::EvalConjuncts(Expr* const* exprs, int num_exprs, TupleRow* row) {
+  // Callers may reuse row for the next row (scanners do if it doesn't pass).
+  SharedExpr::InvalidateCachedValues();
   for (int i = 0; i < num_exprs; ++i) {
     void* value = exprs[i]->GetValue(row);
     if (value == NULL || *reinterpret_cast<bool*>(value) == false) return false;
@@ -16,17 +16,28 @@
 #ifndef IMPALA_EXEC_EXEC_NODE_H
 #define IMPALA_EXEC_EXEC_NODE_H
 
+#include <algorithm>
 #include <vector>
 #include <sstream>
+#include <boost/scoped_ptr.hpp>
 
 #include "common/status.h"
 #include "runtime/descriptors.h"  // for RowDescriptor
+#include "util/perf-counters.h"
 #include "util/runtime-profile.h"
 #include "gen-cpp/PlanNodes_types.h"
 
+// Counts the hardware events of the enclosing scope, typically all of GetNext(), in
+// the node's profile if --exec_node_hw_counters is set.  Like the node's total time,
+// the counts include the time spent in the children's GetNext() calls.  Work done on
+// other threads (e.g. by the scanner threads of a scan node) is not counted.
+#define SCOPED_HW_COUNTERS() \
+    ScopedHwCounters MACRO_CONCAT(SCOPED_HW_COUNTERS, __COUNTER__)(this)
+
 namespace impala {
 
 class Expr;
+class MemTracker;
 class ObjectPool;
 class Counters;
 class RowBatch;
@@ -44,6 +55,8 @@ class ExecNode {
   // Init conjuncts.
   ExecNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
 
+  virtual ~ExecNode();
+
   // Sets up internal structures, etc., without doing any actual work.
   // Must be called prior to Open(). Will only be called once in this
   // node's lifetime.
@@ -78,6 +91,13 @@ class ExecNode {
   // each implementation should start out by calling the default implementation.
   virtual Status Close(RuntimeState* state);
 
+  // Called from another thread when the fragment gets cancelled, after
+  // RuntimeState::is_cancelled() has been set: wakes up the threads of this subtree
+  // that are blocked on I/O or on other threads, so that they notice right away
+  // instead of at their next check.  Must be thread-safe and may be called before
+  // Open() or after Close().  The default implementation cancels the children.
+  virtual void Cancel(RuntimeState* state);
+
   // Creates exec node tree from list of nodes contained in plan via depth-first
   // traversal. All nodes are placed in pool.
   // Returns error if 'plan' is corrupted, otherwise success.
@@ -127,11 +147,17 @@ class ExecNode {
   RuntimeProfile* runtime_profile() { return runtime_profile_.get(); }
   RuntimeProfile::Counter* memory_used_counter() const { return memory_used_counter_; }
 
+  // Tracks the memory allocated by this node; a child of the fragment instance's
+  // tracker.  NULL until Prepare() is called.
+  MemTracker* mem_tracker() { return mem_tracker_.get(); }
+
   // Extract node id from p->name().
   static int GetNodeIdFromProfile(RuntimeProfile* p);
 
   // Names of counters shared by all exec nodes
   static const std::string ROW_THROUGHPUT_COUNTER;
+  static const std::string ROWS_RETURNED_COUNTER;
+  static const std::string PEAK_MEMORY_USAGE_COUNTER;
 
  protected:
   int id_;  // unique w/in single plan tree
@@ -144,14 +170,59 @@ class ExecNode {
   int64_t limit_;  // -1: no limit
   int64_t num_rows_returned_;
 
+  // Number of buckets the node's hash table ended up with in an earlier run of the
+  // plan fragment (see TPlanNode.exec_stats); 0 if not known.
+  int64_t prev_hash_table_buckets_;
+
   boost::scoped_ptr<RuntimeProfile> runtime_profile_;
   RuntimeProfile::Counter* rows_returned_counter_;
   RuntimeProfile::Counter* rows_returned_rate_;
   // Account for peak memory used by this node
   RuntimeProfile::Counter* memory_used_counter_;
 
+  // Hardware counters accumulated by SCOPED_HW_COUNTERS(), indexed by
+  // ThreadPerfCounters::Counter.  Only created if --exec_node_hw_counters is set.
+  RuntimeProfile::Counter* hw_counters_[ThreadPerfCounters::NUM_COUNTERS];
+  bool hw_counters_enabled_;
+
+  // Adds the hardware counters of the calling thread between its construction and
+  // destruction to the node's hw_counters_, if they are enabled and available.
+  class ScopedHwCounters {
+   public:
+    explicit ScopedHwCounters(ExecNode* node) : node_(node), counters_(NULL) {
+      if (!node->hw_counters_enabled_) return;
+      counters_ = ThreadPerfCounters::GetForThread();
+      if (counters_ != NULL && !counters_->Read(start_values_)) counters_ = NULL;
+    }
+
+    ~ScopedHwCounters() {
+      if (counters_ == NULL) return;
+      int64_t values[ThreadPerfCounters::NUM_COUNTERS];
+      if (!counters_->Read(values)) return;
+      for (int i = 0; i < ThreadPerfCounters::NUM_COUNTERS; ++i) {
+        node_->hw_counters_[i]->Update(values[i] - start_values_[i]);
+      }
+    }
+
+   private:
+    ExecNode* node_;
+    ThreadPerfCounters* counters_;  // NULL if nothing is counted
+    int64_t start_values_[ThreadPerfCounters::NUM_COUNTERS];
+  };
+
+  // Created in Prepare(); declared in the base class so that it outlives the
+  // subclasses' pools and hash tables that charge against it.
+  boost::scoped_ptr<MemTracker> mem_tracker_;
+
   ExecNode* child(int i) { return children_[i]; }
 
+  // Returns the number of buckets to create the node's hash table with: as many as it
+  // had at the end of the previous run, so that it doesn't grow to that size again,
+  // but at least 'default_buckets'.
+  int64_t InitialHashTableBuckets(int64_t default_buckets) const {
+    return std::max(prev_hash_table_buckets_, default_buckets);
+  }
+
   // Create a single exec node derived from thrift node; place exec node in 'pool'.
   static Status CreateNode(ObjectPool* pool, const TPlanNode& tnode,
                            const DescriptorTbl& descs, ExecNode** node);
@@ -101,7 +101,7 @@ int HashJoinNode::ProcessProbeBatch(RowBatch* out_batch, RowBatch* probe_batch,
       // Advance to the next probe row
       if (UNLIKELY(probe_batch_pos_ == probe_rows)) goto end;
       current_probe_row_ = probe_batch->GetRow(probe_batch_pos_++);
-      hash_tbl_iterator_ = hash_tbl_->Find(current_probe_row_);
+      hash_tbl_iterator_ = hash_tbl_->FindBatchRow(probe_batch_pos_ - 1);
       matched_probe_ = false;
     }
   }
@@ -114,8 +114,9 @@ end:
 
 void HashJoinNode::ProcessBuildBatch(RowBatch* build_batch) {
   // insert build row into our hash table
-  for (int i = 0; i < build_batch->num_rows(); ++i) {
-    hash_tbl_->Insert(build_batch->GetRow(i));
-  }
+  hash_tbl_->InsertBatch(build_batch);
 }
 
+void HashJoinNode::HashProbeBatch(RowBatch* probe_batch) {
+  hash_tbl_->EvalProbeBatch(probe_batch);
+}
@@ -15,17 +15,61 @@
 #include "exec/hash-join-node.h"
 
 #include <sstream>
+#include <gflags/gflags.h>
 
 #include "codegen/llvm-codegen.h"
+#include "exec/exchange-node.h"
 #include "exec/hash-table.inline.h"
+#include "exec/hdfs-scan-node.h"
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
+#include "runtime/exec-env.h"
+#include "runtime/mem-pool.h"
+#include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
+#include "runtime/spill-stream.h"
+#include "runtime/string-heap.h"
+#include "runtime/tuple-row.h"
+#include "util/bloom-filter.h"
+#include "util/cpu-info.h"
 #include "util/debug-util.h"
+#include "util/hash-util.h"
 #include "util/runtime-profile.h"
 
 #include "gen-cpp/PlanNodes_types.h"
 
+DEFINE_int64(join_mem_limit, 1024L * 1024L * 1024L,
+    "maximum memory (in bytes) for the build side of a hash join; build input "
+    "beyond that is partitioned and spilled to disk");
+DEFINE_bool(enable_join_in_place, true,
+    "If true, joins that return at most one row per probe row join the probe batches "
+    "in place instead of copying their rows into the output batch.");
+DEFINE_bool(intern_build_strings, true,
+    "if true, hash joins store each distinct string of their build rows only once; "
+    "they stop deduplicating if the build strings have few duplicates");
+DEFINE_bool(prefetch_probe_batches, true,
+    "if true, hash joins prefetch the hash table entries for each probe batch before "
+    "probing it, if the hash table doesn't fit in the L2 cache");
+DEFINE_double(build_compaction_threshold, 0.5,
+    "hash joins copy the rows of a build batch into their own pool, instead of keeping "
+    "all of the batch's tuple data, if the rows use less than this fraction of it; "
+    "0 disables the copying");
+DEFINE_bool(dedup_semi_join_build, true,
+    "if true, left semi joins without non-equi join predicates only keep one build row "
+    "per distinct build key");
+DEFINE_bool(enable_runtime_filters, true,
+    "if true, hash joins build bloom filters over their build keys and push them into "
+    "the probe side hdfs scans in the same plan fragment");
+DEFINE_int64(runtime_filter_max_build_rows, 1024L * 1024L,
+    "hash joins with more build rows than this don't produce runtime filters");
+DEFINE_bool(async_join_build, true,
+    "if true, hash joins build their hash table in a separate thread while their probe "
+    "child is opened, unless they push runtime filters into the probe side");
+DEFINE_bool(join_probe_readahead, true,
+    "if true, hash joins whose probe child isn't a scan fetch the next probe batch in a "
+    "separate thread while they join the current one");
+
 using namespace boost;
 using namespace impala;
 using namespace llvm;
@@ -38,10 +82,19 @@ HashJoinNode::HashJoinNode(
   : ExecNode(pool, tnode, descs),
     join_op_(tnode.hash_join_node.join_op),
     build_pool_(new MemPool()),
-    codegen_process_build_batch_fn_(NULL),
     process_build_batch_fn_(NULL),
-    codegen_process_probe_batch_fn_(NULL),
-    process_probe_batch_fn_(NULL) {
+    hash_probe_batch_fn_(NULL),
+    process_probe_batch_fn_(NULL),
+    build_keys_unique_(false),
+    dedup_build_(false),
+    drop_build_strings_(false),
+    limit_broadcast_build_(false),
+    probe_readahead_(false),
+    readahead_ready_(false),
+    readahead_eos_(false),
+    readahead_done_(false),
+    level_(0),
+    num_resident_partitions_(NUM_SPILL_PARTITIONS) {
   // TODO: log errors in runtime state
   Status status = Init(pool, tnode);
   DCHECK(status.ok())
@@ -69,16 +122,26 @@ Status HashJoinNode::Init(ObjectPool* pool, const TPlanNode& tnode) {
   RETURN_IF_ERROR(
       Expr::CreateExprTrees(pool, tnode.hash_join_node.other_join_conjuncts,
                             &other_join_conjuncts_));
+  if (tnode.hash_join_node.__isset.build_cache_key) {
+    build_cache_key_ = tnode.hash_join_node.build_cache_key;
+  }
+  limit_broadcast_build_ = tnode.hash_join_node.__isset.limit_broadcast_build
+      && tnode.hash_join_node.limit_broadcast_build;
+  unused_build_slots_.insert(tnode.hash_join_node.unused_build_slots.begin(),
+      tnode.hash_join_node.unused_build_slots.end());
   return Status::OK;
 }
 
 HashJoinNode::~HashJoinNode() {
   // probe_batch_ must be cleaned up in Close() to ensure proper resource freeing.
   DCHECK(probe_batch_ == NULL);
+  DCHECK(readahead_thread_ == NULL);
+  ReleaseSpillState();
 }
 
 Status HashJoinNode::Prepare(RuntimeState* state) {
   RETURN_IF_ERROR(ExecNode::Prepare(state));
+  build_pool_.reset(new MemPool(mem_tracker()));
 
   build_timer_ = 
       ADD_COUNTER(runtime_profile(), "BuildTime", TCounterType::CPU_TICKS);
@@ -90,6 +153,31 @@ Status HashJoinNode::Prepare(RuntimeState* state) {
       ADD_COUNTER(runtime_profile(), "BuildBuckets", TCounterType::UNIT);
   probe_row_counter_ =
       ADD_COUNTER(runtime_profile(), "ProbeRows", TCounterType::UNIT);
+  partitions_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "PartitionsSpilled", TCounterType::UNIT);
+  bytes_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "BytesSpilled", TCounterType::BYTES);
+  runtime_filters_counter_ =
+      ADD_COUNTER(runtime_profile(), "RuntimeFiltersPublished", TCounterType::UNIT);
+  string_duplicates_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildStringDuplicates", TCounterType::UNIT);
+  readahead_wait_timer_ =
+      ADD_COUNTER(runtime_profile(), "ProbeReadaheadWaitTime", TCounterType::CPU_TICKS);
+  build_cache_hits_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildCacheHits", TCounterType::UNIT);
+  build_duplicates_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildDuplicatesDropped", TCounterType::UNIT);
+  build_batches_compacted_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildBatchesCompacted", TCounterType::UNIT);
+
+  dedup_build_ =
+      FLAGS_dedup_semi_join_build && match_one_build_ && other_join_conjuncts_.empty();
+
+  // The rows of other build inputs depend on the instance of the join.
+  if (state->exec_env()->join_build_cache() == NULL
+      || dynamic_cast<ExchangeNode*>(child(1)) == NULL) {
+    build_cache_key_.clear();
+  }
 
   // build and probe exprs are evaluated in the context of the rows produced by our
   // right and left children, respectively
@@ -101,18 +189,42 @@ Status HashJoinNode::Prepare(RuntimeState* state) {
 
   result_tuple_row_size_ = row_descriptor_.tuple_descriptors().size() * sizeof(Tuple*);
 
+  if (FLAGS_enable_runtime_filters) FindRuntimeFilterTargets(state);
+
   // pre-compute the tuple index of build tuples in the output row
   build_tuple_size_ = child(1)->row_desc().tuple_descriptors().size();
   build_tuple_idx_.reserve(build_tuple_size_);
+  build_string_slots_.resize(build_tuple_size_);
+  dropped_string_slots_.resize(build_tuple_size_);
   for (int i = 0; i < build_tuple_size_; ++i) {
     TupleDescriptor* build_tuple_desc = child(1)->row_desc().tuple_descriptors()[i];
     build_tuple_idx_.push_back(row_descriptor_.GetTupleIdx(build_tuple_desc->id()));
+    const vector<SlotDescriptor*>& string_slots = build_tuple_desc->string_slots();
+    for (int j = 0; j < string_slots.size(); ++j) {
+      if (unused_build_slots_.find(string_slots[j]->id()) == unused_build_slots_.end()) {
+        build_string_slots_[i].push_back(string_slots[j]);
+      } else {
+        dropped_string_slots_[i].push_back(string_slots[j]);
+        drop_build_strings_ = true;
+      }
+    }
+    if (FLAGS_intern_build_strings && !build_string_slots_[i].empty()
+        && string_heap_ == NULL) {
+      string_heap_.reset(new StringHeap(build_pool_.get()));
+    }
   }
 
-  // TODO: default buckets
-  hash_tbl_.reset(new HashTable(build_exprs_, probe_exprs_, build_tuple_size_, false));
+  hash_tbl_.reset(new HashTable(build_exprs_, probe_exprs_, build_tuple_size_, false,
+      InitialHashTableBuckets(1024), mem_tracker()));
   
-  probe_batch_.reset(new RowBatch(row_descriptor_, state->batch_size()));
+  probe_batch_.reset(new RowBatch(row_descriptor_, state->batch_size(row_descriptor_)));
+  // Scans already produce their batches in threads of their own.
+  probe_readahead_ =
+      FLAGS_join_probe_readahead && dynamic_cast<ScanNode*>(child(0)) == NULL;
+  if (probe_readahead_) {
+    readahead_batch_.reset(
+        new RowBatch(row_descriptor_, state->batch_size(row_descriptor_)));
+  }
   
   LlvmCodeGen* codegen = state->llvm_codegen();
   if (codegen != NULL) {
@@ -121,19 +233,47 @@ Status HashJoinNode::Prepare(RuntimeState* state) {
     if (hash_fn == NULL) return Status::OK;
 
     // Codegen for build path
-    codegen_process_build_batch_fn_ = CodegenProcessBuildBatch(codegen, hash_fn);
+    Function* process_build_batch_fn = CodegenProcessBuildBatch(codegen, hash_fn);
+    if (process_build_batch_fn != NULL) {
+      codegen->AddFunctionToJit(process_build_batch_fn,
+          reinterpret_cast<void**>(&process_build_batch_fn_));
+      LOG(INFO) << "HashJoinNode(node_id=" << id()
+                << ") using llvm codegend function for building hash table.";
+    } else {
+      LOG(WARNING) << "Codegen for HashJoinNode (node_id=" << id()
+                   << ") was not supported for this query.";
+    }
+
+    // Codegen for hashing probe batches
+    Function* hash_probe_batch_fn = CodegenHashProbeBatch(codegen, hash_fn);
+    if (hash_probe_batch_fn != NULL) {
+      codegen->AddFunctionToJit(hash_probe_batch_fn,
+          reinterpret_cast<void**>(&hash_probe_batch_fn_));
+    }
 
     // Codegen for probe path (only for left joins)
-    if (!match_all_build_) {
-      codegen_process_probe_batch_fn_ = CodegenProcessProbeBatch(codegen, hash_fn);
+    Function* process_probe_batch_fn = NULL;
+    if (!match_all_build_) process_probe_batch_fn = CodegenProcessProbeBatch(codegen);
+    if (process_probe_batch_fn != NULL) {
+      codegen->AddFunctionToJit(process_probe_batch_fn,
+          reinterpret_cast<void**>(&process_probe_batch_fn_));
+      LOG(INFO) << "HashJoinNode(node_id=" << id()
+                << ") using llvm codegend function for probing hash table.";
+    } else {
+      LOG(WARNING) << "Codegen for HashJoinNode (node_id=" << id()
+                   << ") was not supported for this query.";
     }
   }
   return Status::OK;
 }
 
 Status HashJoinNode::Close(RuntimeState* state) {
+  // the thread may still be in child(0)->GetNext()
+  StopProbeReadahead();
   // Must reset probe_batch_ in Close() to release resources
   probe_batch_.reset(NULL);
+  readahead_batch_.reset(NULL);
+  ReleaseSpillState();
   COUNTER_UPDATE(memory_used_counter_, build_pool_->peak_allocated_bytes());
   COUNTER_UPDATE(memory_used_counter_, hash_tbl_->byte_size());
   return ExecNode::Close(state);
@@ -143,66 +283,246 @@ Status HashJoinNode::Open(RuntimeState* state) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
   RETURN_IF_CANCELLED(state);
       
-  if (codegen_process_build_batch_fn_ == NULL) {
-    LOG(WARNING) << "Codegen for HashJoinNode (node_id=" << id()
-                 << ") was not supported for this query.";
-  } else {
-    void* jitted_process_build_batch = 
-        state->llvm_codegen()->JitFunction(codegen_process_build_batch_fn_);
-    DCHECK(jitted_process_build_batch != NULL);
-    process_build_batch_fn_ = 
-        reinterpret_cast<ProcessBuildBatchFn>(jitted_process_build_batch);
-    LOG(INFO) << "HashJoinNode(node_id=" << id() 
-              << ") using llvm codegend function for building hash table.";
-  }
-
-  if (codegen_process_probe_batch_fn_ == NULL) {
-    LOG(WARNING) << "Codegen for HashJoinNode (node_id=" << id()
-                << ") was not supported for this query.";
+  eos_ = false;
+  StopProbeReadahead();
+
+  if (FLAGS_async_join_build && runtime_filter_targets_.empty()) {
+    // Opening child(0) can take as long as the build (e.g. the build of a join or an
+    // aggregation below it); do both at the same time.
+    Status build_status;
+    thread build_thread(
+        bind(&HashJoinNode::BuildSideThread, this, state, &build_status));
+    Status open_status = child(0)->Open(state);
+    build_thread.join();
+    RETURN_IF_ERROR(build_status);
+    RETURN_IF_ERROR(open_status);
   } else {
-    void* jitted_process_probe_batch = 
-        state->llvm_codegen()->JitFunction(codegen_process_probe_batch_fn_);
-    DCHECK(jitted_process_probe_batch != NULL);
-    process_probe_batch_fn_ = 
-        reinterpret_cast<ProcessProbeBatchFn>(jitted_process_probe_batch);
-    LOG(INFO) << "HashJoinNode(node_id=" << id() 
-              << ") using llvm codegend function for probing hash table.";
+    RETURN_IF_ERROR(ConstructBuildSide(state));
+    // the scans only start reading in Open(), so they'll apply the filters to all rows
+    PublishRuntimeFilters(state);
+    RETURN_IF_ERROR(child(0)->Open(state));
+  }
+  probe_eos_ = false;
+  if (probe_readahead_) {
+    readahead_ready_ = false;
+    readahead_eos_ = false;
+    readahead_done_ = false;
+    readahead_status_ = Status::OK;
+    readahead_thread_.reset(
+        new thread(bind(&HashJoinNode::ProbeReadaheadThread, this, state)));
   }
+  return InitProbe(state);
+}
 
-  eos_ = false;
+void HashJoinNode::BuildSideThread(RuntimeState* state, Status* status) {
+  // child(1)'s exprs may have been evaluated by other threads before
+  SharedExpr::StartThreadScopes();
+  *status = ConstructBuildSide(state);
+}
 
+Status HashJoinNode::ConstructBuildSide(RuntimeState* state) {
   // Do a full scan of child(1) and store everything in hash_tbl_
   // The hash join node needs to keep in memory all build tuples, including the tuple
   // row ptrs.  The row ptrs are copied into the hash table's internal structure so they
   // don't need to be stored in the build_pool_.
-  RowBatch build_batch(child(1)->row_desc(), state->batch_size());
+  if (!build_cache_key_.empty()) {
+    cached_build_ = state->exec_env()->join_build_cache()->Lookup(build_cache_key_);
+    if (cached_build_ != NULL) return ConstructCachedBuildSide(state);
+    // other joins over the same scan need all of its rows
+    if (dedup_build_) build_cache_key_.clear();
+  }
+  RowBatch build_batch(child(1)->row_desc(), state->batch_size(child(1)->row_desc()));
   RETURN_IF_ERROR(child(1)->Open(state));
   while (true) {
-    RETURN_IF_CANCELLED(state);
+    RETURN_IF_ERROR(state->CheckQueryState());
     bool eos;
     RETURN_IF_ERROR(child(1)->GetNext(state, &build_batch, &eos));
     SCOPED_TIMER(build_timer_);
-    // take ownership of tuple data of build_batch
-    build_pool_->AcquireData(build_batch.tuple_data_pool(), false);
-
-    // Call codegen version if possible
-    if (process_build_batch_fn_ == NULL) {
-      ProcessBuildBatch(&build_batch);
-    } else {
-      process_build_batch_fn_(this, &build_batch);
-    }
+    COUNTER_UPDATE(build_row_counter_, build_batch.num_rows());
+    if (!runtime_filter_targets_.empty()) AddRuntimeFilterValues(&build_batch);
+    RETURN_IF_ERROR(ProcessBuildInput(state, &build_batch));
     VLOG_ROW << hash_tbl_->DebugString(true, &child(1)->row_desc());
+    if (limit_broadcast_build_ && state->max_broadcast_build_bytes() > 0
+        && MemUsage() > state->max_broadcast_build_bytes()) {
+      // fail before the probe starts; the whole query is restarted as partitioned
+      stringstream ss;
+      ss << "Broadcast build of HashJoinNode (id=" << id() << ") exceeds "
+         << "max_broadcast_build_bytes=" << state->max_broadcast_build_bytes()
+         << " after " << build_row_counter_->value() << " rows";
+      return Status(TStatusCode::BROADCAST_BUILD_LIMIT_EXCEEDED, ss.str());
+    }
 
     build_batch.Reset();
     if (eos) break;
   }
-  COUNTER_UPDATE(build_row_counter_, hash_tbl_->size());
+  RETURN_IF_ERROR(FinishBuildSpilling(state));
+  if (!build_cache_key_.empty()) {
+    // All tuple data of the build rows is in build_pool_.
+    cached_build_ = state->exec_env()->join_build_cache()->Insert(
+        build_cache_key_, build_tuple_size_, &build_cache_tuples_, build_pool_.get());
+    vector<Tuple*>().swap(build_cache_tuples_);
+  }
   COUNTER_UPDATE(build_buckets_counter_, hash_tbl_->num_buckets());
+  if (string_heap_ != NULL) {
+    COUNTER_SET(string_duplicates_counter_, string_heap_->num_duplicates());
+  }
 
   VLOG_ROW << hash_tbl_->DebugString(true, &child(1)->row_desc());
+  return Status::OK;
+}
+
+Status HashJoinNode::ConstructCachedBuildSide(RuntimeState* state) {
+  // child(1) isn't opened; let its senders stop
+  static_cast<ExchangeNode*>(child(1))->CloseStream();
+  SCOPED_TIMER(build_timer_);
+  COUNTER_UPDATE(build_cache_hits_counter_, 1);
+  COUNTER_UPDATE(build_row_counter_, cached_build_->num_rows());
+  for (int i = 0; i < cached_build_->num_rows(); ++i) {
+    TupleRow* row = cached_build_->GetRow(i);
+    if (!runtime_filter_targets_.empty()) AddRuntimeFilterValues(row);
+    if (dedup_build_) {
+      uint32_t hash;
+      if (hash_tbl_->FindBuildRow(row, &hash)) {
+        COUNTER_UPDATE(build_duplicates_counter_, 1);
+      } else {
+        hash_tbl_->InsertHashed(row, hash);
+      }
+    } else {
+      hash_tbl_->Insert(row);
+    }
+  }
+  if (!runtime_filter_targets_.empty()) CheckRuntimeFilterBuildRows();
+  COUNTER_UPDATE(build_buckets_counter_, hash_tbl_->num_buckets());
+  VLOG_QUERY << "HashJoinNode(node_id=" << id() << ") built its hash table from "
+             << cached_build_->num_rows() << " cached rows";
+  return Status::OK;
+}
+
+void HashJoinNode::ProbeReadaheadThread(RuntimeState* state) {
+  // child(0)'s exprs were evaluated by the fragment's thread in Open()
+  SharedExpr::StartThreadScopes();
+  while (true) {
+    {
+      unique_lock<mutex> l(readahead_lock_);
+      while (readahead_ready_ && !readahead_done_) readahead_taken_cv_.wait(l);
+      if (readahead_done_) return;
+    }
+    // The rows of the batch are those of the previous probe batch, whose resources
+    // have been passed on.
+    readahead_batch_->Reset();
+    readahead_batch_->ClearBatch();
+    bool eos = false;
+    Status status = child(0)->GetNext(state, readahead_batch_.get(), &eos);
+    unique_lock<mutex> l(readahead_lock_);
+    readahead_status_ = status;
+    readahead_eos_ = eos;
+    readahead_ready_ = true;
+    readahead_ready_cv_.notify_one();
+    if (!status.ok() || eos) return;
+  }
+}
+
+Status HashJoinNode::GetReadaheadBatch() {
+  SCOPED_TIMER(readahead_wait_timer_);
+  unique_lock<mutex> l(readahead_lock_);
+  while (!readahead_ready_) readahead_ready_cv_.wait(l);
+  RETURN_IF_ERROR(readahead_status_);
+  probe_batch_->Swap(readahead_batch_.get());
+  probe_eos_ = readahead_eos_;
+  readahead_ready_ = false;
+  readahead_taken_cv_.notify_one();
+  return Status::OK;
+}
+
+void HashJoinNode::StopProbeReadahead() {
+  if (readahead_thread_ == NULL) return;
+  {
+    unique_lock<mutex> l(readahead_lock_);
+    readahead_done_ = true;
+    readahead_taken_cv_.notify_one();
+  }
+  readahead_thread_->join();
+  readahead_thread_.reset(NULL);
+}
+
+void HashJoinNode::FindRuntimeFilterTargets(RuntimeState* state) {
+  if (match_all_probe_) return;
+  for (int i = 0; i < probe_exprs_.size(); ++i) {
+    SlotRef* slot_ref = dynamic_cast<SlotRef*>(probe_exprs_[i]);
+    if (slot_ref == NULL || slot_ref->slot_id() == -1) continue;
+    const SlotDescriptor* slot_desc =
+        state->desc_tbl().GetSlotDescriptor(slot_ref->slot_id());
+    if (slot_desc == NULL || slot_desc->type() != build_exprs_[i]->type()) continue;
+
+    ExecNode* node = child(0);
+    while (node->limit() == -1) {
+      HdfsScanNode* scan_node = dynamic_cast<HdfsScanNode*>(node);
+      if (scan_node != NULL) {
+        if (scan_node->tuple_desc()->id() == slot_desc->parent()) {
+          RuntimeFilterTarget target;
+          target.expr_idx = i;
+          target.scan_node = scan_node;
+          target.slot_desc = slot_desc;
+          runtime_filter_targets_.push_back(target);
+        }
+        break;
+      }
+      HashJoinNode* join_node = dynamic_cast<HashJoinNode*>(node);
+      if (join_node == NULL) break;
+      // Whatever the lower join's type, its output rows with a slot value that
+      // doesn't match our build side (including NULL-extended ones) are dropped here.
+      node = join_node->child(0);
+    }
+  }
+}
+
+void HashJoinNode::AddRuntimeFilterValues(RowBatch* build_batch) {
+  for (int i = 0; i < build_batch->num_rows(); ++i) {
+    AddRuntimeFilterValues(build_batch->GetRow(i));
+  }
+  CheckRuntimeFilterBuildRows();
+}
 
-  RETURN_IF_ERROR(child(0)->Open(state));
+void HashJoinNode::AddRuntimeFilterValues(TupleRow* build_row) {
+  for (int i = 0; i < runtime_filter_targets_.size(); ++i) {
+    RuntimeFilterTarget* target = &runtime_filter_targets_[i];
+    Expr* expr = build_exprs_[target->expr_idx];
+    void* value = expr->GetValue(build_row);
+    // NULLs never match (the hash table doesn't store them)
+    if (value == NULL) continue;
+    target->build_hashes.push_back(RawValue::GetHashValue(value, expr->type()));
+  }
+}
 
+void HashJoinNode::CheckRuntimeFilterBuildRows() {
+  if (build_row_counter_->value() > FLAGS_runtime_filter_max_build_rows) {
+    // the filter would be big and not very selective
+    VLOG_QUERY << "HashJoinNode(node_id=" << id() << ") has too many build rows for "
+               << "runtime filters";
+    runtime_filter_targets_.clear();
+  }
+}
+
+void HashJoinNode::PublishRuntimeFilters(RuntimeState* state) {
+  for (int i = 0; i < runtime_filter_targets_.size(); ++i) {
+    RuntimeFilterTarget* target = &runtime_filter_targets_[i];
+    BloomFilter* filter =
+        state->obj_pool()->Add(new BloomFilter(target->build_hashes.size()));
+    for (int j = 0; j < target->build_hashes.size(); ++j) {
+      filter->Insert(target->build_hashes[j]);
+    }
+    target->scan_node->AddRuntimeFilter(target->slot_desc, filter);
+    COUNTER_UPDATE(runtime_filters_counter_, 1);
+    VLOG_QUERY << "HashJoinNode(node_id=" << id() << ") published a runtime filter on "
+               << "slot " << target->slot_desc->id() << " to HdfsScanNode(node_id="
+               << target->scan_node->id() << "), " << target->build_hashes.size()
+               << " build values, " << filter->byte_size() << " bytes";
+    vector<uint32_t>().swap(target->build_hashes);
+  }
+  runtime_filter_targets_.clear();
+}
+
+Status HashJoinNode::InitProbe(RuntimeState* state) {
   // seed probe batch and current_probe_row_, etc.
   // The child node will only assign tuples to the tuple row for the tuples it
   // computes.  The other tuple ptrs must be set to NULL.
@@ -210,14 +530,19 @@ Status HashJoinNode::Open(RuntimeState* state) {
   // operation we do only touches the tuples that have been assigned.  Doesn't
   // show up as a perf hit.
   probe_batch_->ClearBatch();
+
+  build_keys_unique_ = FLAGS_enable_join_in_place && !match_all_build_ &&
+      !match_one_build_ && !hash_tbl_->HasDuplicateKeys();
   
   while (true) {
-    RETURN_IF_ERROR(child(0)->GetNext(state, probe_batch_.get(), &probe_eos_));
+    RETURN_IF_ERROR(GetNextProbeBatch(state));
     COUNTER_UPDATE(probe_row_counter_, probe_batch_->num_rows());
     probe_batch_pos_ = 0;
     if (probe_batch_->num_rows() == 0) {
       if (probe_eos_) {
         eos_ = true;
+        // there is nothing to probe; all build rows are unmatched
+        if (match_all_build_) hash_tbl_iterator_ = hash_tbl_->Begin();
         break;
       }
       probe_batch_->Reset();
@@ -226,7 +551,7 @@ Status HashJoinNode::Open(RuntimeState* state) {
       current_probe_row_ = probe_batch_->GetRow(probe_batch_pos_++);
       VLOG_ROW << "probe row: " << PrintRow(current_probe_row_, child(0)->row_desc());
       matched_probe_ = false;
-      hash_tbl_iterator_ = hash_tbl_->Find(current_probe_row_);
+      hash_tbl_iterator_ = hash_tbl_->FindBatchRow(probe_batch_pos_ - 1);
       break;
     }
   }
@@ -237,6 +562,22 @@ Status HashJoinNode::Open(RuntimeState* state) {
 Status HashJoinNode::GetNext(RuntimeState* state, RowBatch* out_batch, bool* eos) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
+  while (true) {
+    RETURN_IF_ERROR(GetNextInternal(state, out_batch, eos));
+    if (!*eos || ReachedLimit() || spilled_partitions_.empty()) return Status::OK;
+    // the in-memory partitions are done; continue with the next spilled one
+    RETURN_IF_CANCELLED(state);
+    RETURN_IF_ERROR(PrepareNextPartition(state, out_batch));
+    if (out_batch->IsFull()) {
+      *eos = false;
+      return Status::OK;
+    }
+  }
+}
+
+Status HashJoinNode::GetNextInternal(
+    RuntimeState* state, RowBatch* out_batch, bool* eos) {
   if (ReachedLimit()) {
     *eos = true;
     return Status::OK;
@@ -323,7 +664,7 @@ Status HashJoinNode::GetNext(RuntimeState* state, RowBatch* out_batch, bool* eos
         probe_batch_->ClearBatch();
         while (true) {
           probe_timer.Stop();
-          RETURN_IF_ERROR(child(0)->GetNext(state, probe_batch_.get(), &probe_eos_));
+          RETURN_IF_ERROR(GetNextProbeBatch(state));
           probe_timer.Start();
           if (probe_batch_->num_rows() == 0) {
             if (probe_eos_) {
@@ -352,7 +693,7 @@ Status HashJoinNode::GetNext(RuntimeState* state, RowBatch* out_batch, bool* eos
     current_probe_row_ = probe_batch_->GetRow(probe_batch_pos_++);
     VLOG_ROW << "probe row: " << PrintRow(current_probe_row_, child(0)->row_desc());
     matched_probe_ = false;
-    hash_tbl_iterator_ = hash_tbl_->Find(current_probe_row_);
+    hash_tbl_iterator_ = hash_tbl_->FindBatchRow(probe_batch_pos_ - 1);
   }
 
   *eos = true;
@@ -395,8 +736,17 @@ Status HashJoinNode::LeftJoinGetNext(RuntimeState* state,
     int64_t max_added_rows = out_batch->capacity() - out_batch->num_rows();
     if (limit() != -1) max_added_rows = min(max_added_rows, limit() - rows_returned());
     
-    // Continue processing this row batch
-    if (process_probe_batch_fn_ == NULL) {
+    bool joined_in_place = CanJoinInPlace(out_batch);
+    if (joined_in_place) {
+      num_rows_returned_ += JoinProbeBatchInPlace(max_added_rows);
+      COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+      out_batch->Swap(probe_batch_.get());
+      // probe_batch_ is now out_batch's old, empty batch.
+      probe_batch_pos_ = 0;
+      hash_tbl_iterator_ = hash_tbl_->End();
+      matched_probe_ = true;
+    } else if (process_probe_batch_fn_ == NULL) {
+      // Continue processing this row batch
       num_rows_returned_ += 
           ProcessProbeBatch(out_batch, probe_batch_.get(), max_added_rows);
       COUNTER_SET(rows_returned_counter_, num_rows_returned_);
@@ -423,16 +773,468 @@ Status HashJoinNode::LeftJoinGetNext(RuntimeState* state,
       } else {
         probe_batch_->ClearBatch();
         probe_timer.Stop();
-        RETURN_IF_ERROR(child(0)->GetNext(state, probe_batch_.get(), &probe_eos_));
+        RETURN_IF_ERROR(GetNextProbeBatch(state));
         probe_timer.Start();
         COUNTER_UPDATE(probe_row_counter_, probe_batch_->num_rows());
       }
     }
+    // Rather than copying more rows into it, return the batch so that the next probe
+    // batch can be joined in place as well.
+    if (joined_in_place && out_batch->num_rows() > 0) break;
+  }
+
+  return Status::OK;
+}
+
+bool HashJoinNode::CanJoinInPlace(RowBatch* out_batch) {
+  if (!FLAGS_enable_join_in_place) return false;
+  if (!match_one_build_ && !build_keys_unique_) return false;
+  // The jitted probe loop evaluates the conjuncts faster than we would.
+  if (process_probe_batch_fn_ != NULL &&
+      (!other_join_conjuncts_.empty() || !conjuncts_.empty())) {
+    return false;
+  }
+  // Swap() needs an out_batch without rows or resources.  It also swaps the
+  // capacities, which our parent may rely on.
+  if (out_batch->num_rows() != 0 || out_batch->num_io_buffers() != 0 ||
+      out_batch->tuple_data_pool()->GetTotalChunkSizes() != 0 ||
+      out_batch->is_self_contained() ||
+      out_batch->capacity() != probe_batch_->capacity()) {
+    return false;
+  }
+  // InitProbe() leaves the first probe row started, but not joined.
+  return probe_batch_pos_ == 0 || (probe_batch_pos_ == 1 && !matched_probe_);
+}
+
+int HashJoinNode::JoinProbeBatchInPlace(int64_t max_rows) {
+  Expr* const* other_conjuncts = &other_join_conjuncts_[0];
+  int num_other_conjuncts = other_join_conjuncts_.size();
+  Expr* const* conjuncts = &conjuncts_[0];
+  int num_conjuncts = conjuncts_.size();
+
+  int num_rows = 0;
+  for (int i = 0; i < probe_batch_->num_rows() && num_rows < max_rows; ++i) {
+    TupleRow* row = probe_batch_->GetRow(i);
+    bool matched = false;
+    HashTable::Iterator it = hash_tbl_->FindBatchRow(i);
+    for (; it.HasNext(); it.Next<true>()) {
+      TupleRow* build_row = it.GetRow();
+      for (int j = 0; j < build_tuple_size_; ++j) {
+        row->SetTuple(build_tuple_idx_[j], build_row->GetTuple(j));
+      }
+      if (EvalConjuncts(other_conjuncts, num_other_conjuncts, row)) {
+        matched = true;
+        break;
+      }
+    }
+    if (!matched) {
+      if (!match_all_probe_) continue;
+      for (int j = 0; j < build_tuple_size_; ++j) {
+        row->SetTuple(build_tuple_idx_[j], NULL);
+      }
+    }
+    if (!EvalConjuncts(conjuncts, num_conjuncts, row)) continue;
+    if (num_rows != i) probe_batch_->CopyRow(row, probe_batch_->GetRow(num_rows));
+    ++num_rows;
+  }
+  probe_batch_->set_num_rows(num_rows);
+  return num_rows;
+}
+
+Status HashJoinNode::GetNextProbeBatch(RuntimeState* state) {
+  if (probe_stream_.get() == NULL) {
+    if (readahead_thread_ != NULL) {
+      RETURN_IF_ERROR(GetReadaheadBatch());
+    } else {
+      RETURN_IF_ERROR(child(0)->GetNext(state, probe_batch_.get(), &probe_eos_));
+    }
+  } else {
+    // Spilled probe rows only contain child(0)'s tuples; widen them to our row layout.
+    scoped_ptr<RowBatch> spilled_batch;
+    RETURN_IF_ERROR(probe_stream_->GetNext(&spilled_batch, &probe_eos_));
+    if (!probe_eos_) {
+      int num_probe_tuples = child(0)->row_desc().tuple_descriptors().size();
+      for (int i = 0; i < spilled_batch->num_rows(); ++i) {
+        TupleRow* row = probe_batch_->GetRow(probe_batch_->AddRow());
+        memset(row, 0, result_tuple_row_size_);
+        memcpy(row, spilled_batch->GetRow(i), num_probe_tuples * sizeof(Tuple*));
+        probe_batch_->CommitLastRow();
+      }
+      spilled_batch->TransferResourceOwnership(probe_batch_.get());
+    }
+  }
+  if (spill_partitions_.empty()) {
+    PrepareProbeBatch();
+    return Status::OK;
+  }
+
+  // Remove the rows of spilled partitions from the batch.
+  const vector<TupleDescriptor*>& probe_descs = child(0)->row_desc().tuple_descriptors();
+  int num_rows = 0;
+  for (int i = 0; i < probe_batch_->num_rows(); ++i) {
+    TupleRow* row = probe_batch_->GetRow(i);
+    int partition = GetPartition(row, probe_exprs_);
+    if (partition >= num_resident_partitions_) {
+      RETURN_IF_ERROR(AddSpillRow(partition, row, probe_descs,
+          spill_partitions_[partition].probe_stream));
+    } else {
+      if (num_rows != i) probe_batch_->CopyRow(row, probe_batch_->GetRow(num_rows));
+      ++num_rows;
+    }
+  }
+  probe_batch_->set_num_rows(num_rows);
+  if (probe_eos_) RETURN_IF_ERROR(FinishProbeSpilling(state));
+  PrepareProbeBatch();
+  return Status::OK;
+}
+
+void HashJoinNode::PrepareProbeBatch() {
+  if (hash_probe_batch_fn_ == NULL) {
+    HashProbeBatch(probe_batch_.get());
+  } else {
+    hash_probe_batch_fn_(this, probe_batch_.get());
+  }
+  if (!FLAGS_prefetch_probe_batches) return;
+  if (hash_tbl_->byte_size() <= CpuInfo::CacheSize(CpuInfo::L2_CACHE)) return;
+  hash_tbl_->PrefetchProbeBatch();
+}
+
+int64_t HashJoinNode::MemUsage() const {
+  int64_t bytes = build_pool_->total_allocated_bytes() + hash_tbl_->byte_size();
+  if (string_heap_ != NULL) bytes += string_heap_->byte_size();
+  return bytes;
+}
+
+TupleRow* HashJoinNode::CopyBuildRow(TupleRow* row, MemPool* pool) {
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  bool intern_strings = string_heap_ != NULL && string_heap_->dedup_enabled();
+  if (!intern_strings && !drop_build_strings_) return row->DeepCopy(build_descs, pool);
+  TupleRow* result =
+      reinterpret_cast<TupleRow*>(pool->Allocate(build_descs.size() * sizeof(Tuple*)));
+  for (int i = 0; i < build_descs.size(); ++i) {
+    Tuple* tuple = row->GetTuple(i);
+    if (tuple == NULL) {
+      result->SetTuple(i, NULL);
+      continue;
+    }
+    const TupleDescriptor& desc = *build_descs[i];
+    Tuple* copy = reinterpret_cast<Tuple*>(pool->Allocate(desc.byte_size()));
+    memcpy(copy, tuple, desc.byte_size());
+    const vector<SlotDescriptor*>& string_slots = build_string_slots_[i];
+    for (vector<SlotDescriptor*>::const_iterator slot = string_slots.begin();
+         slot != string_slots.end(); ++slot) {
+      if (copy->IsNull((*slot)->null_indicator_offset())) continue;
+      StringValue* str = copy->GetStringSlot((*slot)->tuple_offset());
+      if (intern_strings) {
+        *str = string_heap_->Intern(*str);
+      } else if (str->len > 0) {
+        char* data = reinterpret_cast<char*>(pool->Allocate(str->len));
+        memcpy(data, str->ptr, str->len);
+        str->ptr = data;
+      }
+    }
+    const vector<SlotDescriptor*>& dropped_slots = dropped_string_slots_[i];
+    for (vector<SlotDescriptor*>::const_iterator slot = dropped_slots.begin();
+         slot != dropped_slots.end(); ++slot) {
+      StringValue* str = copy->GetStringSlot((*slot)->tuple_offset());
+      str->ptr = NULL;
+      str->len = 0;
+    }
+    result->SetTuple(i, copy);
+  }
+  return result;
+}
+
+Status HashJoinNode::ProcessBuildInput(RuntimeState* state, RowBatch* build_batch) {
+  bool intern_strings = string_heap_ != NULL && string_heap_->dedup_enabled();
+  if (dedup_build_) {
+    RETURN_IF_ERROR(ProcessDistinctBuildInput(build_batch));
+  } else if (spill_partitions_.empty() && !intern_strings && !drop_build_strings_ &&
+      !IsSparseBuildBatch(build_batch)) {
+    // take ownership of tuple data of build_batch
+    build_pool_->AcquireData(build_batch->tuple_data_pool(), false);
+  } else {
+    // Spill the rows of spilled partitions.  Only take copies of the other rows, so
+    // that we don't hold on to the memory of the spilled ones (or of duplicate
+    // strings, or of the rows that the build child filtered out).
+    const vector<TupleDescriptor*>& build_descs =
+        child(1)->row_desc().tuple_descriptors();
+    int num_rows = 0;
+    for (int i = 0; i < build_batch->num_rows(); ++i) {
+      TupleRow* row = build_batch->GetRow(i);
+      if (!spill_partitions_.empty()) {
+        int partition = GetPartition(row, build_exprs_);
+        if (partition >= num_resident_partitions_) {
+          RETURN_IF_ERROR(AddSpillRow(partition, row, build_descs,
+              spill_partitions_[partition].build_stream));
+          continue;
+        }
+      }
+      build_batch->CopyRow(CopyBuildRow(row, build_pool_.get()),
+          build_batch->GetRow(num_rows++));
+    }
+    build_batch->set_num_rows(num_rows);
+  }
+  if (!build_cache_key_.empty()) {
+    for (int i = 0; i < build_batch->num_rows(); ++i) {
+      TupleRow* row = build_batch->GetRow(i);
+      for (int j = 0; j < build_tuple_size_; ++j) {
+        build_cache_tuples_.push_back(row->GetTuple(j));
+      }
+    }
+  }
+
+  // Call codegen version if possible
+  if (dedup_build_) {
+    // the rows have already been inserted
+  } else if (process_build_batch_fn_ == NULL) {
+    ProcessBuildBatch(build_batch);
+  } else {
+    process_build_batch_fn_(this, build_batch);
+  }
+
+  if (MemUsage() > FLAGS_join_mem_limit
+      && (spill_partitions_.empty() || num_resident_partitions_ > 0)) {
+    // too large to be cached anyway
+    build_cache_key_.clear();
+    vector<Tuple*>().swap(build_cache_tuples_);
+    RETURN_IF_ERROR(SpillBuildPartitions(state));
+  }
+  return Status::OK;
+}
+
+bool HashJoinNode::IsSparseBuildBatch(RowBatch* build_batch) {
+  int64_t pool_bytes = build_batch->tuple_data_pool()->total_allocated_bytes();
+  if (FLAGS_build_compaction_threshold <= 0 || pool_bytes == 0) return false;
+  int64_t max_row_bytes = FLAGS_build_compaction_threshold * pool_bytes;
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  int64_t row_bytes = 0;
+  for (int i = 0; i < build_batch->num_rows(); ++i) {
+    TupleRow* row = build_batch->GetRow(i);
+    for (int j = 0; j < build_descs.size(); ++j) {
+      Tuple* tuple = row->GetTuple(j);
+      if (tuple == NULL) continue;
+      row_bytes += build_descs[j]->byte_size();
+      const vector<SlotDescriptor*>& string_slots = build_descs[j]->string_slots();
+      for (int k = 0; k < string_slots.size(); ++k) {
+        if (tuple->IsNull(string_slots[k]->null_indicator_offset())) continue;
+        row_bytes += tuple->GetStringSlot(string_slots[k]->tuple_offset())->len;
+      }
+    }
+    // dense enough; no need to look at the other rows
+    if (row_bytes >= max_row_bytes) return false;
+  }
+  COUNTER_UPDATE(build_batches_compacted_counter_, 1);
+  return true;
+}
+
+Status HashJoinNode::ProcessDistinctBuildInput(RowBatch* build_batch) {
+  DCHECK(build_cache_key_.empty());
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  int num_duplicates = 0;
+  for (int i = 0; i < build_batch->num_rows(); ++i) {
+    TupleRow* row = build_batch->GetRow(i);
+    if (!spill_partitions_.empty()) {
+      // duplicates of spilled rows are dropped when their partition is joined
+      int partition = GetPartition(row, build_exprs_);
+      if (partition >= num_resident_partitions_) {
+        RETURN_IF_ERROR(AddSpillRow(partition, row, build_descs,
+            spill_partitions_[partition].build_stream));
+        continue;
+      }
+    }
+    uint32_t hash;
+    if (hash_tbl_->FindBuildRow(row, &hash)) {
+      ++num_duplicates;
+      continue;
+    }
+    hash_tbl_->InsertHashed(CopyBuildRow(row, build_pool_.get()), hash);
+  }
+  COUNTER_UPDATE(build_duplicates_counter_, num_duplicates);
+  return Status::OK;
+}
+
+int HashJoinNode::GetPartition(TupleRow* row, const vector<Expr*>& exprs) {
+  uint32_t hash = 0;
+  for (int i = 0; i < exprs.size(); ++i) {
+    hash = RawValue::GetHashValue(exprs[i]->GetValue(row), exprs[i]->type(), hash);
+  }
+  // The hash table buckets are computed from (crc) hashes of the same values, and
+  // all rows of a spilled partition share the hash of the levels above; rehash with
+  // a level-specific seed so that the partitions at each level are independent.
+  hash = HashUtil::FvnHash(&hash, sizeof(hash), HashUtil::FVN_SEED + level_);
+  return hash % NUM_SPILL_PARTITIONS;
+}
+
+Status HashJoinNode::AddSpillRow(int partition, TupleRow* row,
+    const vector<TupleDescriptor*>& descs, SpillStream* stream) {
+  RowBatch* batch = spill_batches_[partition];
+  TupleRow* spill_row = batch->GetRow(batch->AddRow());
+  for (int i = 0; i < descs.size(); ++i) {
+    Tuple* tuple = row->GetTuple(i);
+    spill_row->SetTuple(i, tuple == NULL ? NULL :
+        tuple->DeepCopy(*descs[i], batch->tuple_data_pool()));
+  }
+  batch->CommitLastRow();
+  // Serialize() resets the (self-contained) batch
+  if (batch->IsFull()) RETURN_IF_ERROR(stream->AddBatch(batch));
+  return Status::OK;
+}
+
+Status HashJoinNode::SpillBuildPartitions(RuntimeState* state) {
+  if (spill_partitions_.empty()) {
+    if (level_ >= MAX_PARTITION_DEPTH) {
+      stringstream ss;
+      ss << "Hash join exceeded its memory limit (--join_mem_limit="
+         << FLAGS_join_mem_limit << ") after repartitioning its build input "
+         << MAX_PARTITION_DEPTH << " times";
+      return Status(ss.str());
+    }
+    for (int i = 0; i < NUM_SPILL_PARTITIONS; ++i) {
+      SpilledPartition partition;
+      partition.build_stream = new SpillStream(state, child(1)->row_desc());
+      partition.probe_stream = NULL;
+      partition.level = level_ + 1;
+      spill_partitions_.push_back(partition);
+      spill_batches_.push_back(new RowBatch(child(1)->row_desc(), state->batch_size()));
+      spill_batches_.back()->set_is_self_contained(true);
+      RETURN_IF_ERROR(partition.build_stream->Init());
+    }
+    num_resident_partitions_ = NUM_SPILL_PARTITIONS;
   }
 
+  int num_resident_partitions = num_resident_partitions_ / 2;
+  VLOG_QUERY << "HashJoinNode(node_id=" << id() << ") reached memory limit with "
+             << hash_tbl_->size() << " build rows; spilling partitions "
+             << num_resident_partitions << "-" << num_resident_partitions_ - 1
+             << " of level " << level_ + 1;
+
+  // Copy the rows of the partitions that stay in memory into a new pool and spill
+  // the others, then rebuild the hash table from the copies.
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  scoped_ptr<MemPool> resident_pool(new MemPool(mem_tracker()));
+  if (string_heap_ != NULL) string_heap_->Reset(resident_pool.get());
+  vector<TupleRow*> resident_rows;
+  for (HashTable::Iterator it = hash_tbl_->Begin(); it.HasNext(); it.Next<false>()) {
+    TupleRow* row = it.GetRow();
+    int partition = GetPartition(row, build_exprs_);
+    if (partition < num_resident_partitions) {
+      resident_rows.push_back(CopyBuildRow(row, resident_pool.get()));
+    } else {
+      RETURN_IF_ERROR(AddSpillRow(partition, row, build_descs,
+          spill_partitions_[partition].build_stream));
+    }
+  }
+  hash_tbl_->Clear();
+  for (int i = 0; i < resident_rows.size(); ++i) {
+    hash_tbl_->Insert(resident_rows[i]);
+  }
+  COUNTER_UPDATE(memory_used_counter_, build_pool_->peak_allocated_bytes());
+  build_pool_.swap(resident_pool);
+  num_resident_partitions_ = num_resident_partitions;
   return Status::OK;
 }
 
+Status HashJoinNode::FinishBuildSpilling(RuntimeState* state) {
+  for (int i = 0; i < spill_partitions_.size(); ++i) {
+    SpilledPartition* partition = &spill_partitions_[i];
+    if (i < num_resident_partitions_) {
+      // the rows of this partition are in the hash table
+      DCHECK_EQ(partition->build_stream->num_rows(), 0);
+      delete partition->build_stream;
+      partition->build_stream = NULL;
+      delete spill_batches_[i];
+      spill_batches_[i] = NULL;
+      continue;
+    }
+    RETURN_IF_ERROR(partition->build_stream->AddBatch(spill_batches_[i]));
+    COUNTER_UPDATE(partitions_spilled_counter_, 1);
+    COUNTER_UPDATE(bytes_spilled_counter_, partition->build_stream->bytes_written());
+
+    // From now on, buffer the probe rows of this partition.
+    delete spill_batches_[i];
+    spill_batches_[i] = new RowBatch(child(0)->row_desc(), state->batch_size());
+    spill_batches_[i]->set_is_self_contained(true);
+    partition->probe_stream = new SpillStream(state, child(0)->row_desc());
+    RETURN_IF_ERROR(partition->probe_stream->Init());
+  }
+  return Status::OK;
+}
+
+Status HashJoinNode::FinishProbeSpilling(RuntimeState* state) {
+  for (int i = num_resident_partitions_; i < spill_partitions_.size(); ++i) {
+    SpilledPartition* partition = &spill_partitions_[i];
+    RETURN_IF_ERROR(partition->probe_stream->AddBatch(spill_batches_[i]));
+    COUNTER_UPDATE(bytes_spilled_counter_, partition->probe_stream->bytes_written());
+    delete spill_batches_[i];
+    spill_batches_[i] = NULL;
+    spilled_partitions_.push_back(*partition);
+    partition->build_stream = NULL;
+    partition->probe_stream = NULL;
+  }
+  spill_partitions_.clear();
+  spill_batches_.clear();
+  return Status::OK;
+}
+
+Status HashJoinNode::PrepareNextPartition(RuntimeState* state, RowBatch* out_batch) {
+  DCHECK(spill_partitions_.empty());
+  DCHECK(!spilled_partitions_.empty());
+  SpilledPartition partition = spilled_partitions_.back();
+  spilled_partitions_.pop_back();
+  scoped_ptr<SpillStream> build_stream(partition.build_stream);
+  probe_stream_.reset(partition.probe_stream);
+  level_ = partition.level;
+
+  // Rows in out_batch may reference the build and probe rows of the last pass.
+  out_batch->tuple_data_pool()->AcquireData(build_pool_.get(), false);
+  if (string_heap_ != NULL) string_heap_->Reset(build_pool_.get());
+  probe_batch_->TransferResourceOwnership(out_batch);
+  probe_batch_pos_ = 0;
+  hash_tbl_->Clear();
+  joined_build_rows_.clear();
+
+  {
+    SCOPED_TIMER(build_timer_);
+    RETURN_IF_ERROR(build_stream->PrepareForRead());
+    scoped_ptr<RowBatch> build_batch;
+    while (true) {
+      RETURN_IF_ERROR(state->CheckQueryState());
+      bool eos;
+      RETURN_IF_ERROR(build_stream->GetNext(&build_batch, &eos));
+      if (eos) break;
+      RETURN_IF_ERROR(ProcessBuildInput(state, build_batch.get()));
+    }
+    RETURN_IF_ERROR(FinishBuildSpilling(state));
+  }
+  VLOG_FILE << "HashJoinNode(node_id=" << id() << ") joining spilled partition of level "
+            << level_ << " with " << build_stream->num_rows() << " build rows and "
+            << probe_stream_->num_rows() << " probe rows";
+
+  RETURN_IF_ERROR(probe_stream_->PrepareForRead());
+  probe_eos_ = false;
+  eos_ = false;
+  return InitProbe(state);
+}
+
+void HashJoinNode::ReleaseSpillState() {
+  for (int i = 0; i < spill_partitions_.size(); ++i) {
+    delete spill_partitions_[i].build_stream;
+    delete spill_partitions_[i].probe_stream;
+  }
+  spill_partitions_.clear();
+  for (int i = 0; i < spill_batches_.size(); ++i) {
+    delete spill_batches_[i];
+  }
+  spill_batches_.clear();
+  for (int i = 0; i < spilled_partitions_.size(); ++i) {
+    delete spilled_partitions_[i].build_stream;
+    delete spilled_partitions_[i].probe_stream;
+  }
+  spilled_partitions_.clear();
+  probe_stream_.reset();
+}
+
 void HashJoinNode::DebugString(int indentation_level, stringstream* out) const {
   *out << string(indentation_level * 2, ' ');
   *out << "HashJoin(eos=" << (eos_ ? "true" : "false")
@@ -585,8 +1387,30 @@ Function* HashJoinNode::CodegenProcessBuildBatch(LlvmCodeGen* codegen,
   return codegen->OptimizeFunctionWithExprs(process_build_batch_fn);
 }
 
-Function* HashJoinNode::CodegenProcessProbeBatch(LlvmCodeGen* codegen,
-    Function* hash_fn) {
+Function* HashJoinNode::CodegenHashProbeBatch(LlvmCodeGen* codegen, Function* hash_fn) {
+  // Get cross compiled function
+  Function* hash_probe_batch_fn = codegen->GetFunction(
+      IRFunction::HASH_JOIN_HASH_PROBE_BATCH);
+  DCHECK(hash_probe_batch_fn != NULL);
+
+  // Codegen for evaluating probe rows
+  Function* eval_row_fn = hash_tbl_->CodegenEvalTupleRow(codegen, false);
+  if (eval_row_fn == NULL) return NULL;
+
+  int replaced = 0;
+  // Replace call sites
+  hash_probe_batch_fn = codegen->ReplaceCallSites(hash_probe_batch_fn, false,
+      eval_row_fn, "EvalProbeRow", &replaced);
+  DCHECK_EQ(replaced, 1);
+
+  hash_probe_batch_fn = codegen->ReplaceCallSites(hash_probe_batch_fn, false,
+      hash_fn, "HashCurrentRow", &replaced);
+  DCHECK_EQ(replaced, 1);
+
+  return codegen->OptimizeFunctionWithExprs(hash_probe_batch_fn);
+}
+
+Function* HashJoinNode::CodegenProcessProbeBatch(LlvmCodeGen* codegen) {
   // Get cross compiled function
   Function* process_probe_batch_fn = codegen->GetFunction(
       IRFunction::HASH_JOIN_PROCESS_PROBE_BATCH);
@@ -596,10 +1420,6 @@ Function* HashJoinNode::CodegenProcessProbeBatch(LlvmCodeGen* codegen,
   Function* equals_fn = hash_tbl_->CodegenEquals(codegen);
   if (equals_fn == NULL) return NULL;
 
-  // Codegen for evaluating build rows
-  Function* eval_row_fn = hash_tbl_->CodegenEvalTupleRow(codegen, false);
-  if (eval_row_fn == NULL) return NULL;
-
   // Codegen CreateOutputRow
   Function* create_output_row_fn = CodegenCreateOutputRow(codegen);
   if (create_output_row_fn == NULL) return NULL;
@@ -614,14 +1434,6 @@ Function* HashJoinNode::CodegenProcessProbeBatch(LlvmCodeGen* codegen,
 
   // Replace all call sites with codegen version
   int replaced = 0;
-  process_probe_batch_fn = codegen->ReplaceCallSites(process_probe_batch_fn, false,
-      hash_fn, "HashCurrentRow", &replaced);
-  DCHECK_EQ(replaced, 1);
-  
-  process_probe_batch_fn = codegen->ReplaceCallSites(process_probe_batch_fn, false,
-      eval_row_fn, "EvalProbeRow", &replaced);
-  DCHECK_EQ(replaced, 1);
-
   process_probe_batch_fn = codegen->ReplaceCallSites(process_probe_batch_fn, false,
       create_output_row_fn, "CreateOutputRow", &replaced);
   DCHECK_EQ(replaced, 2);
@@ -16,18 +16,28 @@
 #ifndef IMPALA_EXEC_HASH_JOIN_NODE_H
 #define IMPALA_EXEC_HASH_JOIN_NODE_H
 
+#include <deque>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/unordered_set.hpp>
 
 #include "exec/exec-node.h"
 #include "exec/hash-table.h"
+#include "runtime/join-build-cache.h"
 
 #include "gen-cpp/PlanNodes_types.h"  // for TJoinOp
 
 namespace impala {
 
+class HdfsScanNode;
 class MemPool;
 class RowBatch;
+class SlotDescriptor;
+class SpillStream;
+class StringHeap;
+class Tuple;
 class TupleRow;
 
 // Node for in-memory hash joins:
@@ -36,12 +46,38 @@ class TupleRow;
 // - for each row from our left input, probes the hash table to retrieve
 //   matching entries; the probe exprs are the lhs exprs of our equi-join predicates
 //
+// If the build side exceeds --join_mem_limit, the join switches to a hybrid hash
+// join: build rows are hash-partitioned on the build exprs into NUM_SPILL_PARTITIONS
+// partitions, of which a prefix stays in memory and the rest is spilled to disk;
+// every time the limit is exceeded again, half of the remaining in-memory
+// partitions are spilled.  Probe rows of in-memory partitions are joined right away,
+// probe rows of spilled partitions are written to disk as well.  Once the probe input
+// is exhausted, each spilled partition is joined in turn: its build rows are loaded
+// into the (cleared) hash table, partitioning them again with a different hash if
+// they still don't fit, and its spilled probe rows are used as the probe input.
+//
 // Row batches:
 // - In general, we are not able to pass our output row batch on to our left child (when
 //   we're fetching the probe rows): if we have a 1xn join, our output will contain
 //   multiple rows per left input row
-// - TODO: fix this, so in the case of 1x1/nx1 joins (for instance, fact to dimension tbl)
-//   we don't do these extra copies
+// - If every probe row joins with at most one build row (semi joins, or inner and left
+//   outer joins whose build keys are unique, e.g. fact to dimension tbl joins), the
+//   build tuples are written into the rows of the probe batch itself, whose rows have
+//   the output layout, and the batch is swapped into the output batch.  Only the rows
+//   that are dropped cost a copy: the rows after them are moved up.
+//
+// Threads (see --async_join_build and --join_probe_readahead):
+// - Unless the join pushes runtime filters into the probe side, which need the
+//   complete build input before child(0) is opened, the hash table is built in a
+//   separate thread while child(0) is opened.  In a tree of joins all builds then run
+//   at the same time.
+// - Unless child(0) is a scan, whose batches are produced by threads of its own
+//   anyway, a read-ahead thread fetches the next batch of probe rows from child(0)
+//   while the current one is joined.
+//
+// Build rows that the planner gave a cache key (broadcast scans of a table) are kept
+// in ExecEnv::join_build_cache(); later joins with the same key build their hash
+// table from the cached rows and don't read child(1).
 class HashJoinNode : public ExecNode {
  public:
   HashJoinNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
@@ -82,9 +118,41 @@ class HashJoinNode : public ExecNode {
   bool match_all_build_;  // output all rows coming from the build input
 
   bool matched_probe_;  // if true, we have matched the current probe row
+  bool build_keys_unique_;  // if true, no two build rows have equal keys
+
+  // If true (for left semi joins without other_join_conjuncts_, see
+  // --dedup_semi_join_build), a build row is only copied and inserted into the hash
+  // table if no row with the same keys is in it yet: each probe row returns at most
+  // one match, and any build row with its keys will do.  The build memory is then
+  // bounded by the distinct keys rather than the build rows, and the bucket chains
+  // that probes walk hold no duplicates.
+  bool dedup_build_;
   bool eos_;  // if true, nothing left to return in GetNext()
   boost::scoped_ptr<MemPool> build_pool_;  // holds everything referenced in hash_tbl_
 
+  // If set, build rows are copied into build_pool_ with their strings interned, so
+  // that each distinct build string is stored only once.  NULL if the build rows have
+  // no string slots or --intern_build_strings is off.
+  boost::scoped_ptr<StringHeap> string_heap_;
+
+  // The planner's key for the rows of child(1), if they can be looked up in and added
+  // to the join build cache: child(1) is an exchange that receives a broadcast table
+  // scan.  Cleared if the cache is disabled or the build input spills.
+  std::string build_cache_key_;
+
+  // If true, child(1) is broadcast but the join could be partitioned; the build fails
+  // with BROADCAST_BUILD_LIMIT_EXCEEDED as soon as MemUsage() exceeds the query option
+  // max_broadcast_build_bytes, so that the query can be re-planned.
+  bool limit_broadcast_build_;
+
+  // While building with a build_cache_key_: the tuple ptrs of all build rows,
+  // build_tuple_size_ per row, including those that the hash table doesn't store.
+  std::vector<Tuple*> build_cache_tuples_;
+
+  // The cached rows that the hash table was built from, or that the build rows were
+  // moved into; held until the node is destroyed.
+  JoinBuildCache::EntryPtr cached_build_;
+
   // probe_batch_ must be cleared before calling GetNext().  The child node
   // does not initialize all tuple ptrs in the row, only the ones that it
   // is responsible for.
@@ -93,28 +161,60 @@ class HashJoinNode : public ExecNode {
   bool probe_eos_;  // if true, probe child has no more rows to process
   TupleRow* current_probe_row_;
 
+  // If true, child(0)'s batches are fetched by readahead_thread_ into
+  // readahead_batch_, which GetReadaheadBatch() swaps with probe_batch_.  The thread
+  // runs from Open() until child(0)'s eos; it is only used for the child's output,
+  // not for spilled probe rows.
+  bool probe_readahead_;
+  boost::scoped_ptr<boost::thread> readahead_thread_;
+  boost::scoped_ptr<RowBatch> readahead_batch_;
+
+  // Protects the members below.
+  boost::mutex readahead_lock_;
+  // signalled when readahead_batch_ has been filled, and when it has been taken
+  boost::condition_variable readahead_ready_cv_;
+  boost::condition_variable readahead_taken_cv_;
+  bool readahead_ready_;  // readahead_batch_ holds the next probe batch
+  bool readahead_eos_;  // child(0)'s eos with readahead_batch_
+  bool readahead_done_;  // set to stop the thread
+  Status readahead_status_;
+
   // build_tuple_idx_[i] is the tuple index of child(1)'s tuple[i] in the output row
   std::vector<int> build_tuple_idx_;
   int build_tuple_size_;
 
+  // The planner's unused build slots: slots of child(1)'s tuples that nothing at or
+  // above this node references.
+  boost::unordered_set<SlotId> unused_build_slots_;
+
+  // build_string_slots_[i] are the string slots of child(1)'s tuple[i] whose data
+  // CopyBuildRow() copies, dropped_string_slots_[i] the unused ones, which it leaves
+  // empty.  If drop_build_strings_, some string slots are unused; the build rows are
+  // then always copied instead of holding on to the memory of the build batches.
+  std::vector<std::vector<SlotDescriptor*> > build_string_slots_;
+  std::vector<std::vector<SlotDescriptor*> > dropped_string_slots_;
+  bool drop_build_strings_;
+
   // byte size of result tuple row (sum of the tuple ptrs, not the tuple data).  
   // This should be the same size as the probe tuple row.
   int result_tuple_row_size_;
   
-  // llvm function for build batch
-  llvm::Function* codegen_process_build_batch_fn_;
+  // The jitted function pointers below are NULL if codegen is disabled or until the
+  // functions have been compiled, which can happen while the node is running.
 
   // Function declaration for codegen'd function.  Signature must match
   // HashJoinNode::ProcessBuildBatch
   typedef void (*ProcessBuildBatchFn)(HashJoinNode*, RowBatch*);
   ProcessBuildBatchFn process_build_batch_fn_;
-  
-  // llvm function object for probe batch
-  llvm::Function* codegen_process_probe_batch_fn_;
 
+  // Function declaration for codegen'd function.  Signature must match
+  // HashJoinNode::HashProbeBatch
+  typedef void (*HashProbeBatchFn)(HashJoinNode*, RowBatch*);
+  HashProbeBatchFn hash_probe_batch_fn_;
+  
   // HashJoinNode::ProcessProbeBatch() exactly
   typedef int (*ProcessProbeBatchFn)(HashJoinNode*, RowBatch*, RowBatch*, int);
-  // Jitted ProcessProbeBatch function pointer.  Null if codegen is disabled.
+  // Jitted ProcessProbeBatch function pointer.
   ProcessProbeBatchFn process_probe_batch_fn_;
   
   RuntimeProfile::Counter* build_timer_;   // time to build hash table
@@ -122,10 +222,169 @@ class HashJoinNode : public ExecNode {
   RuntimeProfile::Counter* build_row_counter_;   // num build rows
   RuntimeProfile::Counter* probe_row_counter_;   // num probe rows
   RuntimeProfile::Counter* build_buckets_counter_;   // num buckets in hash table
+  RuntimeProfile::Counter* partitions_spilled_counter_;   // num partitions on disk
+  RuntimeProfile::Counter* bytes_spilled_counter_;   // bytes written to spill files
+  RuntimeProfile::Counter* runtime_filters_counter_;   // num runtime filters published
+  RuntimeProfile::Counter* string_duplicates_counter_;   // num deduped build strings
+  RuntimeProfile::Counter* readahead_wait_timer_;   // time waiting for probe batches
+  RuntimeProfile::Counter* build_cache_hits_counter_;   // num builds from cached rows
+  RuntimeProfile::Counter* build_duplicates_counter_;   // num build rows dropped
+  RuntimeProfile::Counter* build_batches_compacted_counter_;   // see IsSparseBuildBatch()
+
+  // Number of partitions the build and probe inputs are split into when spilling.
+  static const int NUM_SPILL_PARTITIONS = 16;
+
+  // Maximum number of times the build input can be repartitioned.
+  static const int MAX_PARTITION_DEPTH = 4;
+
+  // The build and probe rows of one hash partition.  'level' is the number of times
+  // the rows have been partitioned.
+  struct SpilledPartition {
+    SpillStream* build_stream;
+    SpillStream* probe_stream;
+    int level;
+  };
+
+  // Partitioning level of the current build/probe input (0 for the child's output).
+  int level_;
+
+  // Empty as long as the build input fits in memory.  Otherwise contains
+  // NUM_SPILL_PARTITIONS partitions of level level_ + 1, of which the first
+  // num_resident_partitions_ are kept in the hash table and the others are spilled.
+  // spill_batches_ buffers the rows for each spilled partition; during the build
+  // phase these are build rows, during the probe phase probe rows.
+  std::vector<SpilledPartition> spill_partitions_;
+  std::vector<RowBatch*> spill_batches_;
+  int num_resident_partitions_;
+
+  // Spilled partitions whose build and probe input are complete and that still need
+  // to be joined; processed as a stack.
+  std::deque<SpilledPartition> spilled_partitions_;
+
+  // If set, the probe input of the current pass is read from here instead of child(0).
+  boost::scoped_ptr<SpillStream> probe_stream_;
+
+  // A runtime filter over the build values of build_exprs_[expr_idx], pushed into
+  // 'scan_node' as a filter on 'slot_desc', the slot probe_exprs_[expr_idx] refers to.
+  struct RuntimeFilterTarget {
+    int expr_idx;
+    HdfsScanNode* scan_node;
+    const SlotDescriptor* slot_desc;
+    // hashes of the non-NULL build values, collected while building
+    std::vector<uint32_t> build_hashes;
+  };
+  std::vector<RuntimeFilterTarget> runtime_filter_targets_;
 
   // set up build_- and probe_exprs_
   Status Init(ObjectPool* pool, const TPlanNode& tnode);
 
+  // Populates runtime_filter_targets_.  Probe rows that don't match any build row can
+  // be dropped by the scan that produces them unless the join outputs all probe rows.
+  // The scan must be in this fragment (so that the filter can be handed over before
+  // it is opened) and must be reached from child(0) through the probe sides of joins
+  // only.  Probe exprs that are slot refs on a scan's tuple get a filter; the scan
+  // can't have a limit, since filtering would change the rows that make the limit.
+  void FindRuntimeFilterTargets(RuntimeState* state);
+
+  // Adds the hashes of the build values of 'build_batch' to runtime_filter_targets_;
+  // gives up on the runtime filters when the build input is too large.
+  void AddRuntimeFilterValues(RowBatch* build_batch);
+
+  // Adds the hashes of the build values of 'build_row' to runtime_filter_targets_.
+  void AddRuntimeFilterValues(TupleRow* build_row);
+
+  // Gives up on the runtime filters if there are too many build rows.
+  void CheckRuntimeFilterBuildRows();
+
+  // Creates the runtime filters from the collected build values and hands them to
+  // their scan nodes.
+  void PublishRuntimeFilters(RuntimeState* state);
+
+  // Opens child(1) and adds all of its rows to the hash table (or the spilled
+  // partitions).
+  Status ConstructBuildSide(RuntimeState* state);
+
+  // Builds the hash table from cached_build_ instead of child(1).
+  Status ConstructCachedBuildSide(RuntimeState* state);
+
+  // Thread function of the asynchronous build: ConstructBuildSide() into *status.
+  void BuildSideThread(RuntimeState* state, Status* status);
+
+  // Thread function of readahead_thread_.
+  void ProbeReadaheadThread(RuntimeState* state);
+
+  // Waits for the read-ahead thread's next batch and swaps it into probe_batch_,
+  // whose resources must have been passed on.
+  Status GetReadaheadBatch();
+
+  // Stops readahead_thread_, if running, and waits for it.
+  void StopProbeReadahead();
+
+  // Produces the output of the partition(s) that are currently in memory; returns
+  // *eos once they are done.
+  Status GetNextInternal(RuntimeState* state, RowBatch* row_batch, bool* eos);
+
+  // Fetches the first probe row of the current pass and starts probing for it.
+  Status InitProbe(RuntimeState* state);
+
+  // Fetches the next probe batch into probe_batch_, from child(0) or probe_stream_.
+  // Rows of spilled partitions are removed from the batch and written to disk.
+  Status GetNextProbeBatch(RuntimeState* state);
+
+  // Evaluates and hashes the probe keys of all of probe_batch_'s rows, and prefetches
+  // the hash table entries they will probe unless the hash table is small enough to
+  // stay in the cache anyway.  Must only be called once all matches of the previous
+  // probe row have been returned.
+  void PrepareProbeBatch();
+
+  // Adds the rows of 'build_batch' to the hash table (or the spilled partitions).
+  Status ProcessBuildInput(RuntimeState* state, RowBatch* build_batch);
+
+  // ProcessBuildInput() if dedup_build_: spills the rows of spilled partitions and
+  // adds copies of the other rows to the hash table, unless their keys are in it.
+  Status ProcessDistinctBuildInput(RowBatch* build_batch);
+
+  // Returns true if the rows of 'build_batch' use less than
+  // --build_compaction_threshold of its tuple data, e.g. because the build child
+  // filtered out most of the rows it materialized.  The build then copies the rows
+  // instead of keeping all of the batch's data for the lifetime of the hash table.
+  bool IsSparseBuildBatch(RowBatch* build_batch);
+
+  // Returns a copy of build row 'row' in 'pool'.  The strings are interned in
+  // string_heap_ while it deduplicates, otherwise they are copied into 'pool' too.
+  // The strings of unused slots are left empty.
+  TupleRow* CopyBuildRow(TupleRow* row, MemPool* pool);
+
+  // Returns the memory used by the build side.
+  int64_t MemUsage() const;
+
+  // Returns the partition of 'row', with 'exprs' being the build or probe exprs.
+  int GetPartition(TupleRow* row, const std::vector<Expr*>& exprs);
+
+  // Copies 'row' into the spill buffer of 'partition', writing the buffer to 'stream'
+  // when it is full.  'descs' describes the tuples of the spilled row.
+  Status AddSpillRow(int partition, TupleRow* row,
+      const std::vector<TupleDescriptor*>& descs, SpillStream* stream);
+
+  // Spills half of the in-memory build partitions, creating the partitions first if
+  // the hash table wasn't partitioned yet.  Rebuilds the hash table from the rows
+  // that remain in memory.
+  Status SpillBuildPartitions(RuntimeState* state);
+
+  // Called at the end of the build input: finishes the spilled build partitions and
+  // prepares for spilling their probe rows.
+  Status FinishBuildSpilling(RuntimeState* state);
+
+  // Called at the end of the probe input: queues the spilled partitions.
+  Status FinishProbeSpilling(RuntimeState* state);
+
+  // Loads the next spilled partition.  Output rows may still reference memory of the
+  // previous pass, which is transferred to 'out_batch'.
+  Status PrepareNextPartition(RuntimeState* state, RowBatch* out_batch);
+
+  // Deletes all spill streams and buffers.
+  void ReleaseSpillState();
+
   // GetNext helper function for the common join cases: Inner join, left semi and left 
   // outer
   Status LeftJoinGetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
@@ -138,9 +397,22 @@ class HashJoinNode : public ExecNode {
   // return the number of rows added to out_batch
   int ProcessProbeBatch(RowBatch* out_batch, RowBatch* probe_batch, int max_added_rows); 
 
+  // Returns true if the rest of probe_batch_ can be joined in place and handed to
+  // 'out_batch' with JoinProbeBatchInPlace(): each probe row joins with at most one
+  // build row, the probe batch hasn't returned any rows yet and out_batch is empty.
+  bool CanJoinInPlace(RowBatch* out_batch);
+
+  // Joins the rows of probe_batch_ in place, keeping the first max_rows rows that
+  // pass the conjuncts.  Returns the number of rows kept.
+  int JoinProbeBatchInPlace(int64_t max_rows);
+
   // Construct the build hash table, adding all the rows in 'build_batch'
   void ProcessBuildBatch(RowBatch* build_batch);
 
+  // Evaluates and hashes the probe exprs over all rows of 'probe_batch', for
+  // probing with HashTable::FindBatchRow().
+  void HashProbeBatch(RowBatch* probe_batch);
+
   // Write combined row, consisting of probe_row and build_row, to out_row.
   // This is replaced by codegen.
   void CreateOutputRow(TupleRow* out_row, TupleRow* probe_row, TupleRow* build_row);
@@ -153,12 +425,16 @@ class HashJoinNode : public ExecNode {
   // hash table.
   // Returns NULL if codegen was not possible.
   llvm::Function* CodegenProcessBuildBatch(LlvmCodeGen*, llvm::Function* hash_fn);
-  
-  // Codegen processing probe batches.  Identical signature to ProcessProbeBatch.
+
+  // Codegen hashing probe batches.  Identical signature to HashProbeBatch.
   // hash_fn is the codegen'd function for computing hashes over tuple rows in the
   // hash table.
   // Returns NULL if codegen was not possible.
-  llvm::Function* CodegenProcessProbeBatch(LlvmCodeGen*, llvm::Function* hash_fn);
+  llvm::Function* CodegenHashProbeBatch(LlvmCodeGen*, llvm::Function* hash_fn);
+  
+  // Codegen processing probe batches.  Identical signature to ProcessProbeBatch.
+  // Returns NULL if codegen was not possible.
+  llvm::Function* CodegenProcessProbeBatch(LlvmCodeGen*);
 };
 
 }
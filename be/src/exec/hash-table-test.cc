@@ -70,6 +70,10 @@ class HashTableTest : public testing::Test {
     table->ResizeBuckets(new_size);
   }
 
+  bool PackedKeys(HashTable* table) {
+    return table->packed_keys_;
+  }
+
   // Do a full table scan on table.  All values should be between [min,max).  If
   // all_unique, then each key(int value) should only appear once.  Results are
   // stored in results, indexed by the key.  Results must have been preallocated to
@@ -276,6 +280,98 @@ TEST_F(HashTableTest, GrowTableTest) {
   }
 }
 
+// Clear() should remove all rows and shrink the table, leaving it usable for new
+// inserts.
+TEST_F(HashTableTest, ClearTest) {
+  int initial_buckets = 16;
+  HashTable hash_table(build_expr_, probe_expr_, 1, false, initial_buckets);
+  for (int i = 0; i < 10000; ++i) {
+    hash_table.Insert(CreateTupleRow(i));
+  }
+  EXPECT_EQ(hash_table.size(), 10000);
+  EXPECT_GT(hash_table.num_buckets(), initial_buckets);
+  int64_t full_byte_size = hash_table.byte_size();
+
+  hash_table.Clear();
+  EXPECT_EQ(hash_table.size(), 0);
+  EXPECT_EQ(hash_table.num_buckets(), initial_buckets);
+  EXPECT_LT(hash_table.byte_size(), full_byte_size);
+  EXPECT_TRUE(hash_table.Begin() == hash_table.End());
+  EXPECT_TRUE(hash_table.Find(CreateTupleRow(1)) == hash_table.End());
+
+  for (int i = 10000; i < 10100; ++i) {
+    hash_table.Insert(CreateTupleRow(i));
+  }
+  EXPECT_EQ(hash_table.size(), 100);
+  for (int i = 9990; i < 10110; ++i) {
+    TupleRow* probe_row = CreateTupleRow(i);
+    HashTable::Iterator iter = hash_table.Find(probe_row);
+    if (i >= 10000 && i < 10100) {
+      EXPECT_TRUE(iter != hash_table.End());
+      ValidateMatch(probe_row, iter.GetRow());
+    } else {
+      EXPECT_TRUE(iter == hash_table.End());
+    }
+  }
+}
+
+TEST_F(HashTableTest, DuplicateKeysTest) {
+  HashTable hash_table(build_expr_, probe_expr_, 1, false, 16);
+  EXPECT_FALSE(hash_table.HasDuplicateKeys());
+  for (int i = 0; i < 1000; ++i) {
+    hash_table.Insert(CreateTupleRow(i));
+  }
+  EXPECT_FALSE(hash_table.HasDuplicateKeys());
+  hash_table.Insert(CreateTupleRow(500));
+  EXPECT_TRUE(hash_table.HasDuplicateKeys());
+}
+
+// Inserting only the rows that FindBuildRow() doesn't find keeps one row per key.
+TEST_F(HashTableTest, DistinctInsertTest) {
+  HashTable hash_table(build_expr_, probe_expr_, 1, false, 16);
+  vector<TupleRow*> first_rows;
+  for (int i = 0; i < 300; ++i) {
+    TupleRow* row = CreateTupleRow(i % 100);
+    uint32_t hash;
+    if (hash_table.FindBuildRow(row, &hash)) {
+      EXPECT_GE(i, 100);
+      continue;
+    }
+    EXPECT_LT(i, 100);
+    hash_table.InsertHashed(row, hash);
+    first_rows.push_back(row);
+  }
+  EXPECT_EQ(hash_table.size(), 100);
+  EXPECT_FALSE(hash_table.HasDuplicateKeys());
+  for (int i = 0; i < 100; ++i) {
+    HashTable::Iterator iter = hash_table.Find(CreateTupleRow(i));
+    ASSERT_TRUE(iter != hash_table.End());
+    EXPECT_EQ(iter.GetRow()->GetTuple(0), first_rows[i]->GetTuple(0));
+  }
+}
+
+// An int key (and its null bit) is packed into the nodes: matches no longer depend on
+// the build rows once they are inserted.
+TEST_F(HashTableTest, PackedKeysTest) {
+  HashTable hash_table(build_expr_, probe_expr_, 1, true, 16);
+  EXPECT_TRUE(PackedKeys(&hash_table));
+  vector<TupleRow*> build_rows;
+  for (int i = 0; i < 100; ++i) {
+    build_rows.push_back(CreateTupleRow(i));
+    hash_table.Insert(build_rows.back());
+  }
+  for (int i = 0; i < 100; ++i) {
+    *reinterpret_cast<int32_t*>(build_rows[i]->GetTuple(0)) = -1;
+  }
+  for (int i = 0; i < 100; ++i) {
+    HashTable::Iterator iter = hash_table.Find(CreateTupleRow(i));
+    ASSERT_TRUE(iter != hash_table.End());
+    EXPECT_EQ(iter.GetRow()->GetTuple(0), build_rows[i]->GetTuple(0));
+  }
+  EXPECT_TRUE(hash_table.Find(CreateTupleRow(-1)) == hash_table.End());
+  EXPECT_FALSE(hash_table.HasDuplicateKeys());
+}
+
 }
 
 int main(int argc, char** argv) {
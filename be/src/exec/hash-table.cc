@@ -13,9 +13,12 @@
 // limitations under the License.
 
 #include "codegen/llvm-codegen.h"
+#include "common/compiler-util.h"
 #include "exec/hash-table.inline.h"
 #include "exprs/expr.h"
+#include "runtime/mem-tracker.h"
 #include "runtime/raw-value.h"
+#include "runtime/row-batch.h"
 #include "runtime/string-value.inline.h"
 #include "util/debug-util.h"
 
@@ -28,7 +31,8 @@ const char* HashTable::LLVM_CLASS_NAME = "class.impala::HashTable";
 const float HashTable::MAX_BUCKET_OCCUPANCY_FRACTION = 0.75f;
 
 HashTable::HashTable(const vector<Expr*>& build_exprs, const vector<Expr*>& probe_exprs,
-    int num_build_tuples, bool stores_nulls, int64_t num_buckets) :
+    int num_build_tuples, bool stores_nulls, int64_t num_buckets,
+    MemTracker* mem_tracker) :
     build_exprs_(build_exprs),
     probe_exprs_(probe_exprs),
     num_build_tuples_(num_build_tuples),
@@ -36,7 +40,10 @@ HashTable::HashTable(const vector<Expr*>& build_exprs, const vector<Expr*>& prob
     node_byte_size_(sizeof(Node) + sizeof(Tuple*) * num_build_tuples_),
     num_filled_buckets_(0),
     nodes_(NULL),
-    num_nodes_(0) {
+    num_nodes_(0),
+    initial_num_buckets_(num_buckets),
+    mem_tracker_(mem_tracker),
+    batch_num_rows_(0) {
   DCHECK_EQ(build_exprs_.size(), probe_exprs_.size());
   buckets_.resize(num_buckets);
   num_buckets_ = num_buckets;
@@ -48,9 +55,41 @@ HashTable::HashTable(const vector<Expr*>& build_exprs, const vector<Expr*>& prob
   expr_values_buffer_= new uint8_t[results_buffer_size_];
   memset(expr_values_buffer_, 0, sizeof(uint8_t) * results_buffer_size_);
   expr_value_null_bits_ = new uint8_t[build_exprs_.size()];
+  batch_values_row_size_ = results_buffer_size_ + build_exprs_.size();
 
-  nodes_capacity_ = 1024;
-  nodes_ = reinterpret_cast<uint8_t*>(malloc(node_byte_size_ * nodes_capacity_));
+  // Integer and boolean values are equal iff their bits are, so if the keys fit in a
+  // uint64_t they can be compared as one.  Padding in the results layout is zero.
+  packed_keys_ = var_result_begin_ == -1;
+  for (int i = 0; i < build_exprs_.size(); ++i) {
+    switch (build_exprs_[i]->type()) {
+      case TYPE_BOOLEAN:
+      case TYPE_TINYINT:
+      case TYPE_SMALLINT:
+      case TYPE_INT:
+      case TYPE_BIGINT:
+        break;
+      default:
+        packed_keys_ = false;
+    }
+  }
+  key_bytes_ = results_buffer_size_ + (stores_nulls_ ? build_exprs_.size() : 0);
+  if (key_bytes_ > static_cast<int>(sizeof(uint64_t))) packed_keys_ = false;
+  key_offset_ = node_byte_size_;
+  if (packed_keys_) node_byte_size_ += sizeof(uint64_t);
+  current_key_ = 0;
+
+  nodes_capacity_ = INITIAL_NODES_CAPACITY;
+  nodes_ = reinterpret_cast<uint8_t*>(
+      HugePageAllocator::Allocate(node_byte_size_ * nodes_capacity_));
+  UpdateMemTracker(0);
+}
+
+HashTable::~HashTable() {
+  // TODO: use tr1::array?
+  delete[] expr_values_buffer_;
+  delete[] expr_value_null_bits_;
+  HugePageAllocator::Free(nodes_, node_byte_size_ * nodes_capacity_);
+  if (mem_tracker_ != NULL) mem_tracker_->Release(byte_size());
 }
 
 bool HashTable::EvalRow(TupleRow* row, const vector<Expr*>& exprs) {
@@ -556,8 +595,31 @@ Function* HashTable::CodegenEquals(LlvmCodeGen* codegen) {
   return codegen->FinalizeFunction(fn);
 }
 
+void HashTable::ReserveBatchBuffers(int num_rows) {
+  batch_num_rows_ = num_rows;
+  if (batch_hashes_.size() >= num_rows) return;
+  batch_hashes_.resize(num_rows);
+  batch_has_null_.resize(num_rows);
+  batch_values_.resize(num_rows * batch_values_row_size_);
+}
+
+void HashTable::PrefetchProbeBatch() {
+  // Prefetch all buckets first; the node of a bucket can't be prefetched until the
+  // bucket itself has been loaded.
+  for (int i = 0; i < batch_num_rows_; ++i) {
+    if (!stores_nulls_ && batch_has_null_[i]) continue;
+    PREFETCH(&buckets_[batch_hashes_[i] % num_buckets_]);
+  }
+  for (int i = 0; i < batch_num_rows_; ++i) {
+    if (!stores_nulls_ && batch_has_null_[i]) continue;
+    int64_t node_idx = buckets_[batch_hashes_[i] % num_buckets_].node_idx_;
+    if (node_idx != -1) PREFETCH(GetNode(node_idx));
+  }
+}
+
 void HashTable::ResizeBuckets(int64_t num_buckets) {
-  vector<Bucket> new_buckets;
+  int64_t old_byte_size = byte_size();
+  Buckets new_buckets;
 
   new_buckets.resize(num_buckets);
   num_filled_buckets_ = 0;
@@ -579,12 +641,69 @@ void HashTable::ResizeBuckets(int64_t num_buckets) {
   buckets_.swap(new_buckets);
   num_buckets_ = buckets_.size();
   num_buckets_till_resize_ = MAX_BUCKET_OCCUPANCY_FRACTION * num_buckets_;
+  UpdateMemTracker(old_byte_size);
 }
   
 void HashTable::GrowNodeArray() {
+  int64_t old_byte_size = byte_size();
+  int64_t old_size = nodes_capacity_ * node_byte_size_;
   nodes_capacity_ = nodes_capacity_ + nodes_capacity_ / 2;
   int64_t new_size = nodes_capacity_ * node_byte_size_;
-  nodes_ = reinterpret_cast<uint8_t*>(realloc(nodes_, new_size));
+  nodes_ = reinterpret_cast<uint8_t*>(
+      HugePageAllocator::Reallocate(nodes_, old_size, new_size));
+  UpdateMemTracker(old_byte_size);
+}
+
+void HashTable::UpdateMemTracker(int64_t old_byte_size) {
+  if (mem_tracker_ == NULL) return;
+  int64_t new_byte_size = byte_size();
+  if (new_byte_size > old_byte_size) {
+    mem_tracker_->Consume(new_byte_size - old_byte_size);
+  } else {
+    mem_tracker_->Release(old_byte_size - new_byte_size);
+  }
+}
+
+void HashTable::Clear() {
+  int64_t old_byte_size = byte_size();
+  Buckets new_buckets(initial_num_buckets_);
+  buckets_.swap(new_buckets);
+  num_buckets_ = buckets_.size();
+  num_buckets_till_resize_ = MAX_BUCKET_OCCUPANCY_FRACTION * num_buckets_;
+  num_filled_buckets_ = 0;
+  num_nodes_ = 0;
+  if (nodes_capacity_ > INITIAL_NODES_CAPACITY) {
+    int64_t old_size = nodes_capacity_ * node_byte_size_;
+    nodes_capacity_ = INITIAL_NODES_CAPACITY;
+    nodes_ = reinterpret_cast<uint8_t*>(HugePageAllocator::Reallocate(
+        nodes_, old_size, nodes_capacity_ * node_byte_size_));
+  }
+  UpdateMemTracker(old_byte_size);
+}
+
+bool HashTable::HasDuplicateKeys() {
+  for (int64_t i = 0; i < num_buckets_; ++i) {
+    for (int64_t node_idx = buckets_[i].node_idx_; node_idx != -1;
+         node_idx = GetNode(node_idx)->next_idx_) {
+      Node* node = GetNode(node_idx);
+      bool evaluated = false;
+      for (int64_t other_idx = node->next_idx_; other_idx != -1;
+           other_idx = GetNode(other_idx)->next_idx_) {
+        Node* other = GetNode(other_idx);
+        if (other->hash_ != node->hash_) continue;
+        if (packed_keys_) {
+          if (*NodeKey(other) == *NodeKey(node)) return true;
+          continue;
+        }
+        if (!evaluated) {
+          EvalBuildRow(node->data());
+          evaluated = true;
+        }
+        if (Equals(other->data())) return true;
+      }
+    }
+  }
+  return false;
 }
 
 string HashTable::DebugString(bool skip_empty, const RowDescriptor* desc) {
@@ -20,6 +20,7 @@
 #include <boost/cstdint.hpp>
 #include "codegen/impala-ir.h"
 #include "common/logging.h"
+#include "runtime/huge-page-allocator.h"
 #include "util/hash-util.h"
 
 namespace llvm {
@@ -30,6 +31,8 @@ namespace impala {
 
 class Expr;
 class LlvmCodeGen;
+class MemTracker;
+class RowBatch;
 class RowDescriptor;
 class Tuple;
 class TupleRow;
@@ -48,6 +51,11 @@ class TupleRow;
 // computation for hashing.  The implementation is also designed to allow codegen 
 // for some paths.
 //
+// If the keys are integers or booleans that, with their null bits if nulls are stored,
+// take at most 8 bytes in the results layout, they are packed into a uint64_t that
+// each node stores after its tuple pointers.  Matching a node is then a single
+// compare against the packed key of the current row and doesn't touch the build row.
+//
 // The hash table does not support removes. The hash table is not thread safe.
 //
 // The implementation is based on the boost multiset.  The hashtable is implemented by
@@ -74,15 +82,13 @@ class HashTable {
   //  - num_build_tuples: number of Tuples in the build tuple row
   //  - stores_nulls: if false, TupleRows with nulls are ignored during Insert
   //  - num_buckets: number of buckets that the hash table should be initialized to
+  //  - mem_tracker: if non-NULL, the bucket and node arrays (see byte_size()) are
+  //    charged against it
   HashTable(const std::vector<Expr*>& build_exprs, const std::vector<Expr*>& probe_exprs,
-      int num_build_tuples, bool stores_nulls, int64_t num_buckets = 1024);
+      int num_build_tuples, bool stores_nulls, int64_t num_buckets = 1024,
+      MemTracker* mem_tracker = NULL);
 
-  ~HashTable() {
-    // TODO: use tr1::array?
-    delete[] expr_values_buffer_;
-    delete[] expr_value_null_bits_;
-    free(nodes_);
-  }
+  ~HashTable();
 
   // Insert row into the hash table.  Row will be evaluated over build_exprs_
   // This will grow the hash table if necessary
@@ -94,6 +100,16 @@ class HashTable {
     InsertImpl(row);
   }
   
+  // Removes all rows from the hash table and shrinks the buckets and node array
+  // back to their initial size.  The expr result buffers are not reallocated, so
+  // functions codegen'd against this hash table stay valid.
+  void Clear();
+
+  // Returns true if two rows in the table have equal build_exprs_ values.  Only rows
+  // with the same hash are compared.  This overwrites the values cached by the last
+  // Find(), so it must not be called while iterating over the matches of a row.
+  bool HasDuplicateKeys();
+
   // Returns the start iterator for all rows that match 'probe_row'.  'probe_row' is
   // evaluated with probe_exprs_.  The iterator can be iterated until HashTable::End() 
   // to find all the matching rows.
@@ -104,6 +120,62 @@ class HashTable {
   // rows are evaluated lazily (i.e. computed as the Iterator is moved).   
   // Returns HashTable::End() if there is no match.
   Iterator Find(TupleRow* probe_row);
+
+  // Batch interface: the keys of a whole batch are evaluated and hashed in one loop
+  // before any row is probed, which keeps the expr evaluation loop tight and allows
+  // the bucket loads of all rows to be started (PrefetchProbeBatch()) before they are
+  // needed.
+  //
+  // Evaluates probe_exprs_ over all rows of 'batch' and caches the results and the
+  // hash of every row.  The cached values are invalidated by the next
+  // EvalProbeBatch() or InsertBatch() call and reference the data of 'batch', so
+  // 'batch' must not be reset while they are in use.
+  void IR_ALWAYS_INLINE EvalProbeBatch(RowBatch* batch);
+
+  // Returns the start iterator for all rows that match row 'batch_idx' of the batch
+  // passed to the last EvalProbeBatch().  This is equivalent to Find() on that row
+  // but doesn't evaluate or hash the row again.  Like Find(), this sets the values
+  // returned by last_expr_value() and the same restrictions on iterating apply.
+  Iterator IR_ALWAYS_INLINE FindBatchRow(int batch_idx);
+
+  // Inserts 'row' with the hash computed for row 'batch_idx' of the last
+  // EvalProbeBatch() batch, without evaluating build_exprs_ over 'row'.  This is only
+  // correct if build_exprs_ over 'row' evaluate to the same values as probe_exprs_
+  // over that probe row, e.g. for aggregation, since the grouping slots of a new
+  // agg tuple are initialized from the probe values.
+  void IR_ALWAYS_INLINE InsertBatchRow(int batch_idx, TupleRow* row) {
+    if (num_filled_buckets_ > num_buckets_till_resize_) {
+      ResizeBuckets(num_buckets_ * 2);
+    }
+    InsertImpl(row, batch_hashes_[batch_idx], packed_keys_ ? BatchRowKey(batch_idx) : 0);
+  }
+
+  // Returns true if the table already contains a row whose build_exprs_ values equal
+  // those of build row 'row', or if the table doesn't store nulls and 'row' has a NULL
+  // value.  Otherwise returns false and sets *hash to the hash of 'row', so that 'row'
+  // (or a copy of it) can be added with InsertHashed().  This invalidates the values
+  // cached by the last Find().
+  bool IR_ALWAYS_INLINE FindBuildRow(TupleRow* row, uint32_t* hash);
+
+  // Inserts 'row' with the hash that FindBuildRow() returned for it.
+  void IR_ALWAYS_INLINE InsertHashed(TupleRow* row, uint32_t hash) {
+    if (num_filled_buckets_ > num_buckets_till_resize_) {
+      ResizeBuckets(num_buckets_ * 2);
+    }
+    InsertImpl(row, hash);
+  }
+
+  // Inserts all rows of 'batch', evaluating and hashing all of them before inserting
+  // any.  Equivalent to calling Insert() on each row.  This invalidates the values
+  // cached by EvalProbeBatch().
+  void IR_ALWAYS_INLINE InsertBatch(RowBatch* batch);
+
+  // Prefetches the buckets that the rows of the last EvalProbeBatch() batch hash to,
+  // and then the first node of each of those buckets, so that the FindBatchRow()
+  // calls for the batch hit the cpu cache.  Without this, probing a table that is
+  // much larger than the cache costs two dependent cache misses per row (bucket, then
+  // node); prefetching a whole batch lets the misses for different rows overlap.
+  void PrefetchProbeBatch();
   
   // Returns number of elements in the hash table
   int64_t size() { return num_nodes_; }
@@ -256,6 +328,22 @@ class HashTable {
   // Insert row into the hash table
   void IR_ALWAYS_INLINE InsertImpl(TupleRow* row);
 
+  // Insert row, whose build exprs hash to 'hash', into the hash table
+  void IR_ALWAYS_INLINE InsertImpl(TupleRow* row, uint32_t hash) {
+    InsertImpl(row, hash, packed_keys_ ? CurrentKey() : 0);
+  }
+
+  // Insert row, whose build exprs hash to 'hash' and pack to 'key' (if packed_keys_),
+  // into the hash table
+  void IR_ALWAYS_INLINE InsertImpl(TupleRow* row, uint32_t hash, uint64_t key);
+
+  // Returns the start iterator for all rows matching the values in
+  // 'expr_values_buffer_', which hash to 'hash'.
+  Iterator IR_ALWAYS_INLINE FindImpl(uint32_t hash);
+
+  // Makes sure the batch_* buffers can hold 'num_rows' rows.
+  void ReserveBatchBuffers(int num_rows);
+
   // Chains the node at 'node_idx' to 'bucket'.  Nodes in a bucket are chained
   // as a linked list; this places the new node at the beginning of the list.
   void AddToBucket(Bucket* bucket, int64_t node_idx, Node* node);
@@ -302,13 +390,52 @@ class HashTable {
   // This will be replaced by codegen.
   bool Equals(TupleRow* build_row);
 
+  // Returns the packed key stored in 'node'.  Only valid if packed_keys_.
+  uint64_t* NodeKey(Node* node) {
+    return reinterpret_cast<uint64_t*>(reinterpret_cast<uint8_t*>(node) + key_offset_);
+  }
+
+  // Returns the values in expr_values_buffer_ (and expr_value_null_bits_ if
+  // stores_nulls_) packed into a key.  Only valid if packed_keys_.
+  uint64_t CurrentKey() const {
+    uint64_t key = 0;
+    memcpy(&key, expr_values_buffer_, results_buffer_size_);
+    if (stores_nulls_) {
+      memcpy(reinterpret_cast<uint8_t*>(&key) + results_buffer_size_,
+          expr_value_null_bits_, build_exprs_.size());
+    }
+    return key;
+  }
+
+  // Returns the packed key of row 'batch_idx' of the last batch whose values were
+  // stored in batch_values_.  Only valid if packed_keys_.
+  uint64_t BatchRowKey(int batch_idx) const {
+    uint64_t key = 0;
+    memcpy(&key, &batch_values_[batch_idx * batch_values_row_size_], key_bytes_);
+    return key;
+  }
+
+  // Returns true if the row of 'node', whose hash matches, equals the current row:
+  // compares the packed keys if possible, otherwise calls Equals().  'current_key_'
+  // must have been set by FindImpl().
+  bool IR_ALWAYS_INLINE NodeEquals(Node* node) {
+    if (packed_keys_) return *NodeKey(node) == current_key_;
+    return Equals(node->data());
+  }
+
   // Grow the node array.
   void GrowNodeArray();
 
+  // Charges the change in byte_size() since it was 'old_byte_size' to mem_tracker_.
+  void UpdateMemTracker(int64_t old_byte_size);
+
   // Load factor that will trigger growing the hash table on insert.  This is 
   // defined as the number of non-empty buckets / total_buckets
   static const float MAX_BUCKET_OCCUPANCY_FRACTION;
 
+  // Number of nodes that 'nodes_' is initially allocated for.
+  static const int64_t INITIAL_NODES_CAPACITY = 1024;
+
   const std::vector<Expr*>& build_exprs_;
   const std::vector<Expr*>& probe_exprs_;
 
@@ -316,25 +443,61 @@ class HashTable {
   const int num_build_tuples_;
   const bool stores_nulls_;
 
-  // Size of hash table nodes.  This includes a fixed size header and the Tuple*'s that
-  // follow.
-  const int node_byte_size_;
+  // Size of hash table nodes.  This includes a fixed size header, the Tuple*'s that
+  // follow and, if packed_keys_, the packed key.
+  int node_byte_size_;
+
+  // If true, the keys are packed (see class comment): key_bytes_ bytes of
+  // expr_values_buffer_ followed by expr_value_null_bits_ (if stores_nulls_), the
+  // same layout as a row of batch_values_.  The packed key of a node is stored at
+  // byte key_offset_ of the node.
+  bool packed_keys_;
+  int key_bytes_;
+  int key_offset_;
+
+  // Packed key of the row passed to the last FindImpl(), for Iterator::Next()
+  uint64_t current_key_;
 
   // Number of non-empty buckets.  Used to determine when to grow and rehash
   int64_t num_filled_buckets_;
   // Memory to store node data.  This is not allocated from a pool to take advantage
-  // of realloc.
-  // TODO: integrate with mem pools
+  // of realloc.  It comes from HugePageAllocator, as do the buckets, so that large
+  // tables can be backed by huge pages.
   uint8_t* nodes_;
   // number of nodes stored (i.e. size of hash table)
   int64_t num_nodes_;
   // max number of nodes that can be stored in 'nodes_' before realloc
   int64_t nodes_capacity_;
 
-  std::vector<Bucket> buckets_;
+  typedef std::vector<Bucket, HugePageStlAllocator<Bucket> > Buckets;
+  Buckets buckets_;
   
   // equal to buckets_.size() but more efficient than the size function
   int64_t num_buckets_;
+
+  // number of buckets the hash table was created with
+  const int64_t initial_num_buckets_;
+
+  // if non-NULL, byte_size() is charged against this tracker
+  MemTracker* mem_tracker_;
+
+  // Number of rows of the last batch passed to EvalProbeBatch() or InsertBatch()
+  int batch_num_rows_;
+
+  // Hash of each row of that batch.  Undefined for rows with NULL keys if
+  // stores_nulls_ is false.
+  std::vector<uint32_t> batch_hashes_;
+
+  // Whether any key of each row of that batch evaluated to NULL
+  std::vector<uint8_t> batch_has_null_;
+
+  // Evaluated probe keys of each row of the last EvalProbeBatch() batch.  The keys of
+  // a row are a copy of 'expr_values_buffer_' followed by a copy of
+  // 'expr_value_null_bits_', so they can be restored with two memcpys.
+  std::vector<uint8_t> batch_values_;
+
+  // Size of the keys of a single row in batch_values_.
+  int batch_values_row_size_;
   
   // The number of filled buckets to trigger a resize.  This is cached for efficiency
   int64_t num_buckets_till_resize_;
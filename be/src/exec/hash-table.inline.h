@@ -16,21 +16,27 @@
 #ifndef IMPALA_EXEC_HASH_TABLE_INLINE_H
 #define IMPALA_EXEC_HASH_TABLE_INLINE_H
 
+#include "common/compiler-util.h"
 #include "exec/hash-table.h"
+#include "runtime/row-batch.h"
 
 namespace impala {
 
 inline HashTable::Iterator HashTable::Find(TupleRow* probe_row) {
   bool has_nulls = EvalProbeRow(probe_row);
   if (!stores_nulls_ && has_nulls) return End();
-  uint32_t hash = HashCurrentRow();
+  return FindImpl(HashCurrentRow());
+}
+
+inline HashTable::Iterator HashTable::FindImpl(uint32_t hash) {
   int64_t bucket_idx = hash % num_buckets_;
 
   Bucket* bucket = &buckets_[bucket_idx];
   int64_t node_idx = bucket->node_idx_;
+  if (packed_keys_) current_key_ = CurrentKey();
   while (node_idx != -1) {
     Node* node = GetNode(node_idx);
-    if (node->hash_ == hash && Equals(node->data())) {
+    if (node->hash_ == hash && NodeEquals(node)) {
       return Iterator(this, bucket_idx, node_idx, hash);
     }
     node_idx = node->next_idx_;
@@ -38,6 +44,61 @@ inline HashTable::Iterator HashTable::Find(TupleRow* probe_row) {
 
   return End();
 }
+
+inline void HashTable::EvalProbeBatch(RowBatch* batch) {
+  int num_rows = batch->num_rows();
+  ReserveBatchBuffers(num_rows);
+  int num_exprs = probe_exprs_.size();
+  for (int i = 0; i < num_rows; ++i) {
+    bool has_null = EvalProbeRow(batch->GetRow(i));
+    batch_has_null_[i] = has_null;
+    if (!stores_nulls_ && has_null) continue;
+    batch_hashes_[i] = HashCurrentRow();
+    uint8_t* values = &batch_values_[i * batch_values_row_size_];
+    memcpy(values, expr_values_buffer_, results_buffer_size_);
+    memcpy(values + results_buffer_size_, expr_value_null_bits_, num_exprs);
+  }
+}
+
+inline HashTable::Iterator HashTable::FindBatchRow(int batch_idx) {
+  DCHECK_LT(batch_idx, batch_num_rows_);
+  if (!stores_nulls_ && batch_has_null_[batch_idx]) return End();
+  // Restore the row's values for Equals() and last_expr_value()
+  const uint8_t* values = &batch_values_[batch_idx * batch_values_row_size_];
+  memcpy(expr_values_buffer_, values, results_buffer_size_);
+  memcpy(expr_value_null_bits_, values + results_buffer_size_, probe_exprs_.size());
+  return FindImpl(batch_hashes_[batch_idx]);
+}
+
+inline bool HashTable::FindBuildRow(TupleRow* row, uint32_t* hash) {
+  bool has_null = EvalBuildRow(row);
+  if (!stores_nulls_ && has_null) return true;
+  *hash = HashCurrentRow();
+  return FindImpl(*hash) != End();
+}
+
+inline void HashTable::InsertBatch(RowBatch* batch) {
+  int num_rows = batch->num_rows();
+  ReserveBatchBuffers(num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    bool has_null = EvalBuildRow(batch->GetRow(i));
+    batch_has_null_[i] = has_null;
+    if (!stores_nulls_ && has_null) continue;
+    batch_hashes_[i] = HashCurrentRow();
+    if (packed_keys_) {
+      uint8_t* values = &batch_values_[i * batch_values_row_size_];
+      memcpy(values, expr_values_buffer_, results_buffer_size_);
+      memcpy(values + results_buffer_size_, expr_value_null_bits_, build_exprs_.size());
+    }
+  }
+  for (int i = 0; i < num_rows; ++i) {
+    if (!stores_nulls_ && batch_has_null_[i]) continue;
+    if (num_filled_buckets_ > num_buckets_till_resize_) {
+      ResizeBuckets(num_buckets_ * 2);
+    }
+    InsertImpl(batch->GetRow(i), batch_hashes_[i], packed_keys_ ? BatchRowKey(i) : 0);
+  }
+}
   
 inline HashTable::Iterator HashTable::Begin() {
   int64_t bucket_idx = -1;
@@ -60,14 +121,17 @@ inline HashTable::Bucket* HashTable::NextBucket(int64_t* bucket_idx) {
 inline void HashTable::InsertImpl(TupleRow* row) {
   bool has_null = EvalBuildRow(row);
   if (!stores_nulls_ && has_null) return;
+  InsertImpl(row, HashCurrentRow());
+}
 
-  uint32_t hash = HashCurrentRow();
+inline void HashTable::InsertImpl(TupleRow* row, uint32_t hash, uint64_t key) {
   int64_t bucket_idx = hash % num_buckets_;
   if (num_nodes_ == nodes_capacity_) GrowNodeArray();
   Node* node = GetNode(num_nodes_);
   TupleRow* data = node->data();
   node->hash_ = hash;
   memcpy(data, row, sizeof(Tuple*) * num_build_tuples_);
+  if (packed_keys_) *NodeKey(node) = key;
   AddToBucket(&buckets_[bucket_idx], num_nodes_, node);
   ++num_nodes_;
 }
@@ -88,11 +152,12 @@ inline void HashTable::Iterator::Next() {
   // bucket needs to be scanned. 'expr_values_buffer_' contains the results
   // for the current probe row.
   if (check_match) {
-    // TODO: this should prefetch the next node
     int64_t next_idx = node->next_idx_;
     while (next_idx != -1) {
       node = table_->GetNode(next_idx);
-      if (node->hash_ == scan_hash_ && table_->Equals(node->data())) {
+      // Start loading the node after this one while comparing this one.
+      if (node->next_idx_ != -1) PREFETCH(table_->GetNode(node->next_idx_));
+      if (node->hash_ == scan_hash_ && table_->NodeEquals(node)) {
         node_idx_ = next_idx;
         return;
       } 
@@ -15,8 +15,12 @@
 #include "hbase-scan-node.h"
 
 #include <algorithm>
+#include <boost/bind.hpp>
 #include <boost/foreach.hpp>
+#include <gflags/gflags.h>
 
+#include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "runtime/runtime-state.h"
 #include "runtime/row-batch.h"
 #include "runtime/string-value.h"
@@ -30,6 +34,12 @@ using namespace std;
 using namespace boost;
 using namespace impala;
 
+DEFINE_int32(hbase_scanner_threads, 8, "Maximum number of key ranges an hbase scan "
+    "node scans concurrently, each on its own thread.  If <= 1, the ranges are scanned "
+    "one after another.");
+DEFINE_int32(hbase_scans_per_region_server, 2, "Maximum number of concurrent scans "
+    "of an hbase scan node to the same region server.");
+
 HBaseScanNode::HBaseScanNode(ObjectPool* pool, const TPlanNode& tnode,
                              const DescriptorTbl& descs)
     : ScanNode(pool, tnode, descs),
@@ -38,11 +48,16 @@ HBaseScanNode::HBaseScanNode(ObjectPool* pool, const TPlanNode& tnode,
       tuple_desc_(NULL),
       tuple_idx_(0),
       filters_(tnode.hbase_scan_node.filters),
+      thrift_conjuncts_(tnode.conjuncts),
       num_errors_(0),
       tuple_pool_(new MemPool()),
       hbase_scanner_(NULL),
       row_key_slot_(NULL),
-      text_converter_(new TextConverter('\\')) {
+      text_converter_(new TextConverter('\\')),
+      num_scanner_threads_(0),
+      max_queued_row_batches_(0),
+      num_active_scanners_(0),
+      done_(false) {
 }
 
 HBaseScanNode::~HBaseScanNode() {
@@ -62,7 +77,7 @@ Status HBaseScanNode::Prepare(RuntimeState* state) {
     // TODO: make sure we print all available diagnostic output to our error log
     return Status("Failed to get tuple descriptor.");
   }
-  // The data retrieved from HBase via result_.raw() is sorted by family/qualifier.
+  // The keyvalues retrieved from HBase are sorted by family/qualifier.
   // The corresponding HBase columns in the Impala metadata are also sorted by
   // family/qualifier.
   // Here, we re-order the slots from the query by family/qualifier, exploiting the
@@ -99,17 +114,32 @@ Status HBaseScanNode::Prepare(RuntimeState* state) {
 Status HBaseScanNode::Open(RuntimeState* state) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
-  JNIEnv* env = getJNIEnv();
-  return hbase_scanner_->StartScan(env, tuple_desc_, scan_range_vector_, filters_);
+  num_scanner_threads_ =
+      min(FLAGS_hbase_scanner_threads, static_cast<int>(scan_range_vector_.size()));
+  if (num_scanner_threads_ <= 1) {
+    num_scanner_threads_ = 0;
+    JNIEnv* env = getJNIEnv();
+    return hbase_scanner_->StartScan(env, tuple_desc_, scan_range_vector_, filters_);
+  }
+
+  for (int i = 0; i < scan_range_vector_.size(); ++i) {
+    unscanned_ranges_.push_back(i);
+  }
+  max_queued_row_batches_ = num_scanner_threads_ * MAX_QUEUED_ROW_BATCHES_PER_THREAD;
+  num_active_scanners_ = num_scanner_threads_;
+  for (int i = 0; i < num_scanner_threads_; ++i) {
+    scanner_threads_.add_thread(
+        new thread(bind(&HBaseScanNode::ScannerThread, this, state)));
+  }
+  return Status::OK;
 }
 
 void HBaseScanNode::WriteTextSlot(
     const string& family, const string& qualifier,
     void* value, int value_length, SlotDescriptor* slot,
-    RuntimeState* state, bool* error_in_row) {
-  SCOPED_TIMER(materialize_tuple_timer());
-  if (!text_converter_->WriteSlot(slot, tuple_,
-      reinterpret_cast<char*>(value), value_length, true, false, tuple_pool_.get())) {
+    RuntimeState* state, Tuple* tuple, MemPool* tuple_pool, bool* error_in_row) {
+  if (!text_converter_->WriteSlot(slot, tuple,
+      reinterpret_cast<char*>(value), value_length, true, false, tuple_pool)) {
     *error_in_row = true;
     if (state->LogHasSpace()) {
       stringstream ss;
@@ -122,65 +152,44 @@ void HBaseScanNode::WriteTextSlot(
   }
 }
 
-Status HBaseScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
-  RETURN_IF_CANCELLED(state);
-  // For GetNext, most of the time is spent in HBaseTableScanner::ResultScanner_next,
-  // but there's still some considerable time inside here.
-  // TODO: need to understand how the time is spent inside this function.
-  SCOPED_TIMER(runtime_profile_->total_time_counter());
-  SCOPED_TIMER(materialize_tuple_timer());
-  if (ReachedLimit()) {
-    *eos = true;
-    return Status::OK;
-  }
-
+Status HBaseScanNode::FillRowBatch(RuntimeState* state, JNIEnv* env,
+    HBaseTableScanner* scanner, const vector<Expr*>& conjuncts, MemPool* tuple_pool,
+    int64_t max_rows, RowBatch* row_batch, int* num_errors, bool* scanner_eos) {
   // create new tuple buffer for row_batch
-  tuple_buffer_size_ = row_batch->capacity() * tuple_desc_->byte_size();
-  tuple_buffer_ = tuple_pool_->Allocate(tuple_buffer_size_);
-  bzero(tuple_buffer_, tuple_buffer_size_);
-  tuple_ = reinterpret_cast<Tuple*>(tuple_buffer_);
+  int tuple_buffer_size = row_batch->capacity() * tuple_desc_->byte_size();
+  void* tuple_buffer = tuple_pool->Allocate(tuple_buffer_size);
+  bzero(tuple_buffer, tuple_buffer_size);
+  Tuple* tuple = reinterpret_cast<Tuple*>(tuple_buffer);
 
   // Indicates whether the current row has conversion errors. Used for error reporting.
   bool error_in_row = false;
 
-  // Indicates whether there are more rows to process. Set in hbase_scanner_.Next().
-  JNIEnv* env = getJNIEnv();
-  bool has_next = false;
-  while (true) {
+  *scanner_eos = false;
+  int64_t num_rows_added = 0;
+  while (!row_batch->IsFull() && num_rows_added != max_rows) {
     RETURN_IF_CANCELLED(state);
-    if (ReachedLimit() || row_batch->IsFull()) {
-      // hang on to last allocated chunk in pool, we'll keep writing into it in the
-      // next GetNext() call
-      row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), !ReachedLimit());
-      *eos = ReachedLimit();
-      return Status::OK;
-    }
-    RETURN_IF_ERROR(hbase_scanner_->Next(env, &has_next));
+    // Indicates whether there are more rows to process. Set in scanner->Next().
+    bool has_next = false;
+    RETURN_IF_ERROR(scanner->Next(env, &has_next));
     if (!has_next) {
-      if (num_errors_ > 0) {
-        const HBaseTableDescriptor* hbase_table =
-            static_cast<const HBaseTableDescriptor*> (tuple_desc_->table_desc());
-        state->ReportFileErrors(hbase_table->table_name(), num_errors_);
-      }
-      row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), false);
-      *eos = true;
+      *scanner_eos = true;
       return Status::OK;
     }
 
     int row_idx = row_batch->AddRow();
     TupleRow* row = row_batch->GetRow(row_idx);
-    row->SetTuple(tuple_idx_, tuple_);
+    row->SetTuple(tuple_idx_, tuple);
 
     // Write row key slot.
     if (row_key_slot_ != NULL) {
       void* key;
       int key_length;
-      hbase_scanner_->GetRowKey(env, &key, &key_length);
+      scanner->GetRowKey(env, &key, &key_length);
       if (key == NULL) {
-        tuple_->SetNull(row_key_slot_->null_indicator_offset());
+        tuple->SetNull(row_key_slot_->null_indicator_offset());
       } else {
-        WriteTextSlot("key", "",
-            key, key_length, row_key_slot_, state, &error_in_row);
+        WriteTextSlot("key", "", key, key_length, row_key_slot_, state, tuple,
+            tuple_pool, &error_in_row);
       }
     }
 
@@ -188,26 +197,27 @@ Status HBaseScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eo
     for (int i = 0; i < sorted_non_key_slots_.size(); ++i) {
       void* value;
       int value_length;
-      hbase_scanner_->GetValue(env, sorted_cols_[i]->first, sorted_cols_[i]->second,
+      scanner->GetValue(env, sorted_cols_[i]->first, sorted_cols_[i]->second,
           &value, &value_length);
       if (value == NULL) {
-        tuple_->SetNull(sorted_non_key_slots_[i]->null_indicator_offset());
+        tuple->SetNull(sorted_non_key_slots_[i]->null_indicator_offset());
       } else {
         WriteTextSlot(sorted_cols_[i]->first, sorted_cols_[i]->second,
-            value, value_length, sorted_non_key_slots_[i], state, &error_in_row);
+            value, value_length, sorted_non_key_slots_[i], state, tuple, tuple_pool,
+            &error_in_row);
       }
     }
 
     // Error logging: Flush error stream and add name of HBase table and current row key.
     if (error_in_row) {
       error_in_row = false;
-      ++num_errors_;
+      ++*num_errors;
       if (state->LogHasSpace()) {
         stringstream ss;
         ss << "hbase table: " << table_name_ << endl;
         void* key;
         int key_length;
-        hbase_scanner_->GetRowKey(env, &key, &key_length);
+        scanner->GetRowKey(env, &key, &key_length);
         ss << "row key: " << string(reinterpret_cast<const char*>(key), key_length);
         state->LogError(ss.str());
       }
@@ -217,27 +227,243 @@ Status HBaseScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eo
       }
     }
 
-    if (EvalConjuncts(&conjuncts_[0], conjuncts_.size(), row)) {
+    if (EvalConjuncts(conjuncts.empty() ? NULL : &conjuncts[0], conjuncts.size(), row)) {
       row_batch->CommitLastRow();
-      ++num_rows_returned_;
-      COUNTER_SET(rows_returned_counter_, num_rows_returned_);
-      char* new_tuple = reinterpret_cast<char*>(tuple_);
+      ++num_rows_added;
+      char* new_tuple = reinterpret_cast<char*>(tuple);
       new_tuple += tuple_desc_->byte_size();
-      tuple_ = reinterpret_cast<Tuple*>(new_tuple);
+      tuple = reinterpret_cast<Tuple*>(new_tuple);
     } else {
       // make sure to reset null indicators since we're overwriting
       // the tuple assembled for the previous row
-      tuple_->Init(tuple_desc_->byte_size());
+      tuple->Init(tuple_desc_->byte_size());
     }
   }
+  return Status::OK;
+}
+
+Status HBaseScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
+  RETURN_IF_CANCELLED(state);
+  if (num_scanner_threads_ > 0) {
+    return GetNextMaterializedRowBatch(state, row_batch, eos);
+  }
+  // For GetNext, most of the time is spent in HBaseTableScanner::ResultScanner_next,
+  // but there's still some considerable time inside here.
+  // TODO: need to understand how the time is spent inside this function.
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
+  SCOPED_TIMER(materialize_tuple_timer());
+  if (ReachedLimit()) {
+    *eos = true;
+    return Status::OK;
+  }
+
+  JNIEnv* env = getJNIEnv();
+  int64_t max_rows = limit_ == -1 ? -1 : limit_ - num_rows_returned_;
+  int num_rows_before = row_batch->num_rows();
+  bool scanner_eos = false;
+  RETURN_IF_ERROR(FillRowBatch(state, env, hbase_scanner_.get(), conjuncts_,
+      tuple_pool_.get(), max_rows, row_batch, &num_errors_, &scanner_eos));
+  num_rows_returned_ += row_batch->num_rows() - num_rows_before;
+  COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+
+  if (scanner_eos) {
+    if (num_errors_ > 0) {
+      const HBaseTableDescriptor* hbase_table =
+          static_cast<const HBaseTableDescriptor*> (tuple_desc_->table_desc());
+      state->ReportFileErrors(hbase_table->table_name(), num_errors_);
+    }
+    row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), false);
+    *eos = true;
+    return Status::OK;
+  }
+  // hang on to last allocated chunk in pool, we'll keep writing into it in the
+  // next GetNext() call
+  row_batch->tuple_data_pool()->AcquireData(tuple_pool_.get(), !ReachedLimit());
+  *eos = ReachedLimit();
+  return Status::OK;
+}
+
+void HBaseScanNode::ScannerThread(RuntimeState* state) {
+  // getJNIEnv() attaches this thread to the JVM, with its own JNIEnv.
+  JNIEnv* env = getJNIEnv();
+  Status status;
+  vector<Expr*> conjuncts;
+  if (env == NULL) {
+    status = Status("Failed to get/create JVM");
+  } else {
+    status = Expr::CreateExprTrees(state->obj_pool(), thrift_conjuncts_, &conjuncts);
+    if (status.ok()) SharedExpr::EliminateCommonSubExprs(state->obj_pool(), &conjuncts);
+    if (status.ok()) status = Expr::Prepare(conjuncts, state, row_desc(), true);
+  }
+
+  HBaseTableScanner scanner(this, state->htable_cache());
+  scanner.set_num_requested_keyvalues(sorted_non_key_slots_.size());
+  while (status.ok()) {
+    int range_idx = -1;
+    {
+      unique_lock<mutex> l(lock_);
+      // Find the first unscanned range of a region server that is below its limit
+      // of concurrent scans, or wait for a scan to complete.
+      while (!done_ && !unscanned_ranges_.empty()) {
+        list<int>::iterator it = unscanned_ranges_.begin();
+        for (; it != unscanned_ranges_.end(); ++it) {
+          const string& server = scan_range_vector_[*it].region_server();
+          if (region_server_scans_[server] < FLAGS_hbase_scans_per_region_server) break;
+        }
+        if (it != unscanned_ranges_.end()) {
+          range_idx = *it;
+          unscanned_ranges_.erase(it);
+          ++region_server_scans_[scan_range_vector_[range_idx].region_server()];
+          break;
+        }
+        range_done_cv_.wait(l);
+      }
+    }
+    if (range_idx == -1) break;
+
+    status = ScanRange(state, env, &scanner, conjuncts, range_idx);
+    {
+      lock_guard<mutex> l(lock_);
+      --region_server_scans_[scan_range_vector_[range_idx].region_server()];
+    }
+    range_done_cv_.notify_all();
+  }
+  if (env != NULL) scanner.Close(env);
+
+  {
+    lock_guard<mutex> l(lock_);
+    if (!status.ok() && status_.ok()) {
+      status_ = status;
+      done_ = true;
+    }
+    --num_active_scanners_;
+  }
+  range_done_cv_.notify_all();
+  row_batch_added_cv_.notify_all();
+  row_batch_consumed_cv_.notify_all();
+}
+
+Status HBaseScanNode::ScanRange(RuntimeState* state, JNIEnv* env,
+    HBaseTableScanner* scanner, const vector<Expr*>& conjuncts, int range_idx) {
+  HBaseTableScanner::ScanRangeVector ranges(1, scan_range_vector_[range_idx]);
+  Status status = scanner->StartScan(env, tuple_desc_, ranges, filters_);
+
+  // The tuples of each batch are allocated from tuple_pool and all of its memory is
+  // passed to the batch, so the pool can go away with the thread.
+  MemPool tuple_pool;
+  int num_errors = 0;
+  bool scanner_eos = false;
+  while (status.ok() && !scanner_eos) {
+    RowBatch* row_batch = new RowBatch(row_desc(), state->batch_size(row_desc()));
+    {
+      SCOPED_TIMER(materialize_tuple_timer());
+      status = FillRowBatch(state, env, scanner, conjuncts, &tuple_pool, -1,
+          row_batch, &num_errors, &scanner_eos);
+    }
+    row_batch->tuple_data_pool()->AcquireData(&tuple_pool, false);
+    if (!status.ok() || row_batch->num_rows() == 0) {
+      delete row_batch;
+      continue;
+    }
+    if (!AddMaterializedRowBatch(row_batch)) break;
+  }
+  scanner->CloseScan(env);
+
+  lock_guard<mutex> l(lock_);
+  num_errors_ += num_errors;
+  return status;
+}
+
+bool HBaseScanNode::AddMaterializedRowBatch(RowBatch* row_batch) {
+  {
+    unique_lock<mutex> l(lock_);
+    while (!done_ && materialized_row_batches_.size() >= max_queued_row_batches_) {
+      row_batch_consumed_cv_.wait(l);
+    }
+    if (done_) {
+      delete row_batch;
+      return false;
+    }
+    materialized_row_batches_.push_back(row_batch);
+  }
+  row_batch_added_cv_.notify_one();
+  return true;
+}
+
+Status HBaseScanNode::GetNextMaterializedRowBatch(RuntimeState* state,
+    RowBatch* row_batch, bool* eos) {
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  RowBatch* materialized_batch = NULL;
+  {
+    unique_lock<mutex> l(lock_);
+    if (ReachedLimit() || done_) {
+      *eos = true;
+      return status_;
+    }
+    while (materialized_row_batches_.empty() && num_active_scanners_ > 0 &&
+           status_.ok()) {
+      row_batch_added_cv_.wait(l);
+    }
+    // Return any errors
+    if (!status_.ok()) return status_;
+
+    if (materialized_row_batches_.empty()) {
+      // All ranges are scanned.
+      DCHECK_EQ(num_active_scanners_, 0);
+      if (num_errors_ > 0) state->ReportFileErrors(table_name_, num_errors_);
+      *eos = true;
+      return Status::OK;
+    }
+    materialized_batch = materialized_row_batches_.front();
+    materialized_row_batches_.pop_front();
+  }
+  row_batch_consumed_cv_.notify_one();
+
+  row_batch->Swap(materialized_batch);
+  delete materialized_batch;
+  num_rows_returned_ += row_batch->num_rows();
+  *eos = false;
+  if (ReachedLimit()) {
+    int num_rows_over = num_rows_returned_ - limit_;
+    row_batch->set_num_rows(row_batch->num_rows() - num_rows_over);
+    num_rows_returned_ -= num_rows_over;
+    *eos = true;
+    // Stop the scanner threads.
+    {
+      lock_guard<mutex> l(lock_);
+      done_ = true;
+    }
+    range_done_cv_.notify_all();
+    row_batch_consumed_cv_.notify_all();
+  }
+  COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+  return Status::OK;
 }
 
 Status HBaseScanNode::Close(RuntimeState* state) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
   COUNTER_UPDATE(memory_used_counter(), tuple_pool_->peak_allocated_bytes());
 
-  JNIEnv* env = getJNIEnv();
-  hbase_scanner_->Close(env);
+  if (num_scanner_threads_ > 0) {
+    {
+      lock_guard<mutex> l(lock_);
+      done_ = true;
+    }
+    range_done_cv_.notify_all();
+    row_batch_consumed_cv_.notify_all();
+    scanner_threads_.join_all();
+    // There are materialized batches that have not been returned to the parent node.
+    // Clean those up now.
+    for (list<RowBatch*>::iterator it = materialized_row_batches_.begin();
+         it != materialized_row_batches_.end(); ++it) {
+      delete *it;
+    }
+    materialized_row_batches_.clear();
+  } else {
+    JNIEnv* env = getJNIEnv();
+    hbase_scanner_->Close(env);
+  }
   // Report total number of errors.
   if (num_errors_ > 0) {
     state->ReportFileErrors(table_name_, num_errors_);
@@ -245,6 +471,20 @@ Status HBaseScanNode::Close(RuntimeState* state) {
   return ExecNode::Close(state);
 }
 
+void HBaseScanNode::Cancel(RuntimeState* state) {
+  // Scanner threads in a JNI call only notice once it returns, but they don't get
+  // to queue another batch.
+  {
+    lock_guard<mutex> l(lock_);
+    if (status_.ok()) status_ = Status::CANCELLED;
+    done_ = true;
+  }
+  range_done_cv_.notify_all();
+  row_batch_added_cv_.notify_all();
+  row_batch_consumed_cv_.notify_all();
+  ExecNode::Cancel(state);
+}
+
 void HBaseScanNode::DebugString(int indentation_level, stringstream* out) const {
   *out << string(indentation_level * 2, ' ');
   *out << "HBaseScanNode(tupleid=" << tuple_id_ << " table=" << table_name_;
@@ -271,6 +511,12 @@ Status HBaseScanNode::SetScanRanges(const vector<TScanRangeParams>& scan_ranges)
     if (key_range.__isset.stopKey) {
       sr.set_stop_key(key_range.stopKey);
     }
+    if (key_range.__isset.regionServer) {
+      sr.set_region_server(key_range.regionServer);
+    }
+    if (key_range.__isset.rowKeys) {
+      sr.set_row_keys(key_range.rowKeys);
+    }
   }
   return Status::OK;
 }
@@ -16,16 +16,28 @@
 #ifndef IMPALA_EXEC_HBASE_SCAN_NODE_H_
 #define IMPALA_EXEC_HBASE_SCAN_NODE_H_
 
+#include <list>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+#include <boost/unordered_map.hpp>
 #include "runtime/descriptors.h"
 #include "exec/hbase-table-scanner.h"
 #include "exec/scan-node.h"
 
 namespace impala {
 
+class RowBatch;
 class TextConverter;
 class Tuple;
 
+// Scan node for an HBase table.  If the node has several key ranges, the ranges are
+// scanned concurrently by up to FLAGS_hbase_scanner_threads threads, with at most
+// FLAGS_hbase_scans_per_region_server of them scanning ranges of the same region
+// server.  Each thread has its own HBaseTableScanner, JNIEnv and copy of the conjuncts,
+// and queues the row batches it materializes for GetNext().  With a single range or
+// thread, the range is scanned by the thread calling GetNext().
 class HBaseScanNode : public ScanNode {
  public:
   HBaseScanNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
@@ -36,15 +48,17 @@ class HBaseScanNode : public ScanNode {
   // initialize hbase_scanner_, and create text_converter_.
   virtual Status Prepare(RuntimeState* state);
 
-  // Start HBase scan using hbase_scanner_.
+  // Start HBase scan using hbase_scanner_, or start the scanner threads.
   virtual Status Open(RuntimeState* state);
 
   // Fill the next row batch by calling Next() on the hbase_scanner_,
-  // converting text data in HBase cells to binary data.
+  // converting text data in HBase cells to binary data, or return the next row batch
+  // materialized by the scanner threads.
   virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
 
-  // Close the hbase_scanner_, and report errors.
+  // Close the hbase_scanner_ or stop the scanner threads, and report errors.
   virtual Status Close(RuntimeState* state);
+  virtual void Cancel(RuntimeState* state);
 
   virtual Status SetScanRanges(const std::vector<TScanRangeParams>& scan_ranges);
 
@@ -57,6 +71,9 @@ class HBaseScanNode : public ScanNode {
   // Column 0 in the Impala metadata refers to the HBasw row key.
   const static int ROW_KEY = 0;
 
+  // Maximum number of row batches queued per scanner thread.
+  const static int MAX_QUEUED_ROW_BATCHES_PER_THREAD = 2;
+
   // Compare two slots based on their column position, to sort them ascending.
   static bool CmpColPos(const SlotDescriptor* a, const SlotDescriptor* b);
 
@@ -78,6 +95,10 @@ class HBaseScanNode : public ScanNode {
   // HBase Filters to be set in HBaseTableScanner.
   std::vector<THBaseFilter> filters_;
 
+  // The conjuncts, from which each scanner thread creates its own copy since exprs
+  // are not thread safe.
+  std::vector<TExpr> thrift_conjuncts_;
+
   // Counts the total number of conversion errors for this table.
   int num_errors_;
 
@@ -99,25 +120,76 @@ class HBaseScanNode : public ScanNode {
   // NULL if row key is not requested.
   SlotDescriptor* row_key_slot_;
 
-  // Size of tuple buffer determined by size of tuples and capacity of row batches.
-  int tuple_buffer_size_;
+  // Helper class for converting text to other types;
+  boost::scoped_ptr<TextConverter> text_converter_;
 
-  // Buffer into which fixed-length portion of tuple data is written in current
-  // GetNext() call.
-  void* tuple_buffer_;
+  // Number of scanner threads, 0 if the ranges are scanned by hbase_scanner_ in
+  // GetNext().  Set in Open().
+  int num_scanner_threads_;
+  boost::thread_group scanner_threads_;
 
-  // Current tuple.
-  Tuple* tuple_;
+  // Protects all members below.
+  boost::mutex lock_;
 
-  // Helper class for converting text to other types;
-  boost::scoped_ptr<TextConverter> text_converter_;
+  // Indices in scan_range_vector_ of the ranges no scanner thread has started on.
+  std::list<int> unscanned_ranges_;
+
+  // Number of ranges of each region server being scanned.
+  typedef boost::unordered_map<std::string, int> RegionServerScans;
+  RegionServerScans region_server_scans_;
+
+  // Signalled when a range scan completes, so a thread waiting for a region server
+  // to be below its scan limit can start on the next range.
+  boost::condition_variable range_done_cv_;
+
+  // Row batches materialized by the scanner threads that have not been returned by
+  // GetNext() yet.  The threads block while max_queued_row_batches_ are queued.
+  std::list<RowBatch*> materialized_row_batches_;
+  int max_queued_row_batches_;
+  boost::condition_variable row_batch_added_cv_;
+  boost::condition_variable row_batch_consumed_cv_;
+
+  // Number of scanner threads that have not exited.
+  int num_active_scanners_;
+
+  // Set if the scan is complete (limit reached, error or Close()), which stops the
+  // scanner threads.
+  bool done_;
+
+  // The first error of a scanner thread.
+  Status status_;
 
-  // Writes a slot in tuple_ from an HBase value containing text data.
+  // Writes a slot in tuple from an HBase value containing text data.
   // The HBase value is converted into the appropriate target type.
   void WriteTextSlot(
       const std::string& family, const std::string& qualifier,
       void* value, int value_length, SlotDescriptor* slot,
-      RuntimeState* state, bool* error_in_row);
+      RuntimeState* state, Tuple* tuple, MemPool* tuple_pool, bool* error_in_row);
+
+  // Materializes the rows returned by scanner into row_batch, evaluating conjuncts,
+  // until row_batch is full, max_rows rows were added (if max_rows != -1) or the
+  // scanner is done, which sets *scanner_eos.  Tuples and strings are allocated from
+  // tuple_pool.  Conversion errors are added to *num_errors.
+  Status FillRowBatch(RuntimeState* state, JNIEnv* env, HBaseTableScanner* scanner,
+      const std::vector<Expr*>& conjuncts, MemPool* tuple_pool, int64_t max_rows,
+      RowBatch* row_batch, int* num_errors, bool* scanner_eos);
+
+  // Main function of the scanner threads: scans ranges from unscanned_ranges_ until
+  // there are none left or the scan is done.
+  void ScannerThread(RuntimeState* state);
+
+  // Scans scan_range_vector_[range_idx] with 'scanner', queueing the materialized row
+  // batches.  The scanner's HTable and Scan are reused for the thread's next range.
+  Status ScanRange(RuntimeState* state, JNIEnv* env, HBaseTableScanner* scanner,
+      const std::vector<Expr*>& conjuncts, int range_idx);
+
+  // Queues row_batch for GetNext(), waiting while the queue is full.  Returns false
+  // and deletes row_batch if the scan is done.
+  bool AddMaterializedRowBatch(RowBatch* row_batch);
+
+  // GetNext() for the scan by the scanner threads.
+  Status GetNextMaterializedRowBatch(RuntimeState* state, RowBatch* row_batch,
+      bool* eos);
 };
 
 }
@@ -13,7 +13,9 @@
 // limitations under the License.
 
 #include "hbase-table-scanner.h"
+#include <algorithm>
 #include <cstring>
+#include <gflags/gflags.h>
 #include "util/jni-util.h"
 #include "runtime/descriptors.h"
 #include "runtime/runtime-state.h"
@@ -22,46 +24,55 @@
 using namespace std;
 using namespace impala;
 
+DEFINE_int32(hbase_caching, 1024, "Number of rows the hbase scanner fetches per RPC to "
+    "the region server (Scan.setCaching()), and per JNI call.");
+DEFINE_bool(hbase_cache_blocks, false, "If true, the blocks read by hbase scans are "
+    "added to the region servers' block cache (Scan.setCacheBlocks()).");
+
 jclass HBaseTableScanner::htable_cl_ = NULL;
 jclass HBaseTableScanner::scan_cl_ = NULL;
 jclass HBaseTableScanner::resultscanner_cl_ = NULL;
 jclass HBaseTableScanner::result_cl_ = NULL;
 jclass HBaseTableScanner::immutable_bytes_writable_cl_ = NULL;
-jclass HBaseTableScanner::keyvalue_cl_ = NULL;
 jclass HBaseTableScanner::hconstants_cl_ = NULL;
 jclass HBaseTableScanner::filter_list_cl_ = NULL;
 jclass HBaseTableScanner::filter_list_op_cl_ = NULL;
 jclass HBaseTableScanner::single_column_value_filter_cl_ = NULL;
 jclass HBaseTableScanner::compare_op_cl_ = NULL;
+jclass HBaseTableScanner::first_key_only_filter_cl_ = NULL;
+jclass HBaseTableScanner::key_only_filter_cl_ = NULL;
+jclass HBaseTableScanner::get_cl_ = NULL;
+jclass HBaseTableScanner::array_list_cl_ = NULL;
 jmethodID HBaseTableScanner::htable_ctor_ = NULL;
 jmethodID HBaseTableScanner::htable_get_scanner_id_ = NULL;
 jmethodID HBaseTableScanner::htable_close_id_ = NULL;
+jmethodID HBaseTableScanner::htable_get_id_ = NULL;
 jmethodID HBaseTableScanner::scan_ctor_ = NULL;
 jmethodID HBaseTableScanner::scan_set_max_versions_id_ = NULL;
 jmethodID HBaseTableScanner::scan_set_caching_id_ = NULL;
+jmethodID HBaseTableScanner::scan_set_cache_blocks_id_ = NULL;
 jmethodID HBaseTableScanner::scan_add_column_id_ = NULL;
 jmethodID HBaseTableScanner::scan_set_filter_id_ = NULL;
 jmethodID HBaseTableScanner::scan_set_start_row_id_ = NULL;
 jmethodID HBaseTableScanner::scan_set_stop_row_id_ = NULL;
-jmethodID HBaseTableScanner::resultscanner_next_id_ = NULL;
+jmethodID HBaseTableScanner::resultscanner_next_rows_id_ = NULL;
 jmethodID HBaseTableScanner::resultscanner_close_id_ = NULL;
 jmethodID HBaseTableScanner::result_get_bytes_id_ = NULL;
-jmethodID HBaseTableScanner::result_raw_id_ = NULL;
+jmethodID HBaseTableScanner::result_is_empty_id_ = NULL;
 jmethodID HBaseTableScanner::immutable_bytes_writable_get_id_ = NULL;
 jmethodID HBaseTableScanner::immutable_bytes_writable_get_length_id_ = NULL;
 jmethodID HBaseTableScanner::immutable_bytes_writable_get_offset_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_buffer_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_family_offset_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_family_length_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_qualifier_offset_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_qualifier_length_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_row_offset_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_row_length_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_value_offset_id_ = NULL;
-jmethodID HBaseTableScanner::keyvalue_get_value_length_id_ = NULL;
 jmethodID HBaseTableScanner::filter_list_ctor_ = NULL;
 jmethodID HBaseTableScanner::filter_list_add_filter_id_ = NULL;
 jmethodID HBaseTableScanner::single_column_value_filter_ctor_ = NULL;
+jmethodID HBaseTableScanner::first_key_only_filter_ctor_ = NULL;
+jmethodID HBaseTableScanner::key_only_filter_ctor_ = NULL;
+jmethodID HBaseTableScanner::get_ctor_ = NULL;
+jmethodID HBaseTableScanner::get_add_column_id_ = NULL;
+jmethodID HBaseTableScanner::get_set_filter_id_ = NULL;
+jmethodID HBaseTableScanner::get_set_cache_blocks_id_ = NULL;
+jmethodID HBaseTableScanner::array_list_ctor_ = NULL;
+jmethodID HBaseTableScanner::array_list_add_id_ = NULL;
 jobject HBaseTableScanner::empty_row_ = NULL;
 jobject HBaseTableScanner::must_pass_all_op_ = NULL;
 jobjectArray HBaseTableScanner::compare_ops_ = NULL;
@@ -75,6 +86,12 @@ void HBaseTableScanner::ScanRange::DebugString(int indentation_level,
   if (!stop_key_.empty()) {
     *out << " stop_key=" << stop_key_;
   }
+  if (!region_server_.empty()) {
+    *out << " region_server=" << region_server_;
+  }
+  if (!row_keys_.empty()) {
+    *out << " row_keys=" << row_keys_.size();
+  }
 }
 
 HBaseTableScanner::HBaseTableScanner(ScanNode* scan_node, HBaseTableCache* htable_cache)
@@ -83,20 +100,22 @@ HBaseTableScanner::HBaseTableScanner(ScanNode* scan_node, HBaseTableCache* htabl
     htable_(NULL),
     scan_(NULL),
     resultscanner_(NULL),
-    result_(NULL),
-    keyvalues_(NULL),
-    keyvalue_(NULL),
-    byte_array_(NULL),
+    filter_list_(NULL),
+    results_(NULL),
+    num_results_(0),
+    result_idx_(0),
+    row_frame_pushed_(false),
     buffer_(NULL),
     buffer_length_(0),
+    row_key_offset_(0),
+    row_key_length_(0),
     keyvalue_index_(0),
     num_requested_keyvalues_(0),
     num_addl_requested_cols_(0),
-    num_keyvalues_(0),
     all_keyvalues_present_(false),
     value_pool_(new MemPool()),
     buffer_pool_(new MemPool()),
-    rows_cached_(DEFAULT_ROWS_CACHED),
+    rows_cached_(max(FLAGS_hbase_caching, 1)),
     scan_setup_timer_(ADD_COUNTER(scan_node_->runtime_profile(),
       "HBaseTableScanner.ScanSetup", TCounterType::CPU_TICKS)) {
 }
@@ -109,7 +128,8 @@ Status HBaseTableScanner::Init() {
   }
 
   // Global class references:
-  // HTable, Scan, ResultScanner, Result, ImmutableBytesWritable, KeyValue, HConstants.
+  // HTable, Scan, ResultScanner, Result, ImmutableBytesWritable, HConstants, the
+  // filters, Get and ArrayList.
   RETURN_IF_ERROR(
       JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/client/HTable",
           &htable_cl_));
@@ -124,8 +144,6 @@ Status HBaseTableScanner::Init() {
   RETURN_IF_ERROR(
       JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/io/ImmutableBytesWritable",
           &immutable_bytes_writable_cl_));
-  RETURN_IF_ERROR(
-      JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/KeyValue", &keyvalue_cl_));
   RETURN_IF_ERROR(
       JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/HConstants",
           &hconstants_cl_));
@@ -143,6 +161,16 @@ Status HBaseTableScanner::Init() {
       JniUtil::GetGlobalClassRef(env,
           "org/apache/hadoop/hbase/filter/CompareFilter$CompareOp",
           &compare_op_cl_));
+  RETURN_IF_ERROR(
+      JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/filter/FirstKeyOnlyFilter",
+          &first_key_only_filter_cl_));
+  RETURN_IF_ERROR(
+      JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/filter/KeyOnlyFilter",
+          &key_only_filter_cl_));
+  RETURN_IF_ERROR(
+      JniUtil::GetGlobalClassRef(env, "org/apache/hadoop/hbase/client/Get", &get_cl_));
+  RETURN_IF_ERROR(
+      JniUtil::GetGlobalClassRef(env, "java/util/ArrayList", &array_list_cl_));
 
   // HTable method ids.
   htable_ctor_ = env->GetMethodID(htable_cl_, "<init>",
@@ -154,6 +182,9 @@ Status HBaseTableScanner::Init() {
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   htable_close_id_ = env->GetMethodID(htable_cl_, "close", "()V");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  htable_get_id_ = env->GetMethodID(htable_cl_, "get",
+      "(Ljava/util/List;)[Lorg/apache/hadoop/hbase/client/Result;");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
   // Scan method ids.
   scan_ctor_ = env->GetMethodID(scan_cl_, "<init>", "()V");
@@ -163,6 +194,8 @@ Status HBaseTableScanner::Init() {
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   scan_set_caching_id_ = env->GetMethodID(scan_cl_, "setCaching", "(I)V");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  scan_set_cache_blocks_id_ = env->GetMethodID(scan_cl_, "setCacheBlocks", "(Z)V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   scan_add_column_id_ = env->GetMethodID(scan_cl_, "addColumn",
       "([B[B)Lorg/apache/hadoop/hbase/client/Scan;");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
@@ -177,19 +210,18 @@ Status HBaseTableScanner::Init() {
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
   // ResultScanner method ids.
-  resultscanner_next_id_ = env->GetMethodID(resultscanner_cl_, "next",
-      "()Lorg/apache/hadoop/hbase/client/Result;");
+  resultscanner_next_rows_id_ = env->GetMethodID(resultscanner_cl_, "next",
+      "(I)[Lorg/apache/hadoop/hbase/client/Result;");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   resultscanner_close_id_ = env->GetMethodID(resultscanner_cl_, "close", "()V");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
   // Result method ids.
-  result_raw_id_ = env->GetMethodID(result_cl_, "raw",
-      "()[Lorg/apache/hadoop/hbase/KeyValue;");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   result_get_bytes_id_ = env->GetMethodID(result_cl_, "getBytes",
       "()Lorg/apache/hadoop/hbase/io/ImmutableBytesWritable;");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  result_is_empty_id_ = env->GetMethodID(result_cl_, "isEmpty", "()Z");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
   // ImmutableBytesWritable method ids.
   immutable_bytes_writable_get_id_ =
@@ -202,30 +234,6 @@ Status HBaseTableScanner::Init() {
       env->GetMethodID(immutable_bytes_writable_cl_, "getOffset", "()I");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
-  // KeyValue method ids.
-  keyvalue_get_buffer_id_ = env->GetMethodID(keyvalue_cl_, "getBuffer", "()[B");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_family_offset_id_ =
-      env->GetMethodID(keyvalue_cl_, "getFamilyOffset", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_family_length_id_ =
-      env->GetMethodID(keyvalue_cl_, "getFamilyLength", "()B");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_qualifier_offset_id_ =
-      env->GetMethodID(keyvalue_cl_, "getQualifierOffset", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_qualifier_length_id_ =
-      env->GetMethodID(keyvalue_cl_, "getQualifierLength", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_row_offset_id_ = env->GetMethodID(keyvalue_cl_, "getRowOffset", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_row_length_id_ = env->GetMethodID(keyvalue_cl_, "getRowLength", "()S");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_value_offset_id_ = env->GetMethodID(keyvalue_cl_, "getValueOffset", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-  keyvalue_get_value_length_id_ = env->GetMethodID(keyvalue_cl_, "getValueLength", "()I");
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
-
   // HConstants fields.
   jfieldID empty_start_row_id =
       env->GetStaticFieldID(hconstants_cl_, "EMPTY_START_ROW", "[B");
@@ -254,6 +262,31 @@ Status HBaseTableScanner::Init() {
           "([B[BLorg/apache/hadoop/hbase/filter/CompareFilter$CompareOp;[B)V");
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
+  // FirstKeyOnlyFilter and KeyOnlyFilter method ids.
+  first_key_only_filter_ctor_ =
+      env->GetMethodID(first_key_only_filter_cl_, "<init>", "()V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  key_only_filter_ctor_ = env->GetMethodID(key_only_filter_cl_, "<init>", "()V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+
+  // Get method ids.
+  get_ctor_ = env->GetMethodID(get_cl_, "<init>", "([B)V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  get_add_column_id_ = env->GetMethodID(get_cl_, "addColumn",
+      "([B[B)Lorg/apache/hadoop/hbase/client/Get;");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  get_set_filter_id_ = env->GetMethodID(get_cl_, "setFilter",
+      "(Lorg/apache/hadoop/hbase/filter/Filter;)Lorg/apache/hadoop/hbase/client/Get;");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  get_set_cache_blocks_id_ = env->GetMethodID(get_cl_, "setCacheBlocks", "(Z)V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+
+  // ArrayList method ids.
+  array_list_ctor_ = env->GetMethodID(array_list_cl_, "<init>", "(I)V");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  array_list_add_id_ = env->GetMethodID(array_list_cl_, "add", "(Ljava/lang/Object;)Z");
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+
   // Get op array from CompareFilter.CompareOp.
   jmethodID compare_op_values = env->GetStaticMethodID(compare_op_cl_, "values",
       "()[Lorg/apache/hadoop/hbase/filter/CompareFilter$CompareOp;");
@@ -272,21 +305,32 @@ Status HBaseTableScanner::ScanSetup(JNIEnv* env, const TupleDescriptor* tuple_de
 
   const HBaseTableDescriptor* hbase_table =
       static_cast<const HBaseTableDescriptor*>(tuple_desc->table_desc());
+  requested_cols_.clear();
   // Use global cache of HTables.
-  htable_ = htable_cache_->GetHBaseTable(hbase_table->table_name());
-  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  table_name_ = hbase_table->table_name();
+  if (htable_ == NULL) {
+    RETURN_IF_ERROR(htable_cache_->GetHBaseTable(table_name_, &htable_));
+  }
 
   // Setup an Scan object without the range
-  // scan_ = new Scan();
-  scan_ = env->NewObject(scan_cl_, scan_ctor_);
+  // scan = new Scan();
+  jobject scan = env->NewObject(scan_cl_, scan_ctor_);
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
-  // scan_.setMaxVersions(1);
-  scan_ = env->CallObjectMethod(scan_, scan_set_max_versions_id_, 1);
+  // scan.setMaxVersions(1);
+  scan = env->CallObjectMethod(scan, scan_set_max_versions_id_, 1);
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
-  // scan_.setCaching(rows_cached_);
-  env->CallObjectMethod(scan_, scan_set_caching_id_, rows_cached_);
+  // Don't fetch more rows per RPC than the limit.
+  if (scan_node_->limit() > 0) {
+    rows_cached_ = min(static_cast<int64_t>(rows_cached_), scan_node_->limit());
+  }
+  // scan.setCaching(rows_cached_);
+  env->CallVoidMethod(scan, scan_set_caching_id_, rows_cached_);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+
+  // scan.setCacheBlocks(FLAGS_hbase_cache_blocks);
+  env->CallVoidMethod(scan, scan_set_cache_blocks_id_, FLAGS_hbase_cache_blocks);
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
   const vector<SlotDescriptor*>& slots = tuple_desc->slots();
@@ -301,9 +345,10 @@ Status HBaseTableScanner::ScanSetup(JNIEnv* env, const TupleDescriptor* tuple_de
     RETURN_IF_ERROR(CreateByteArray(env, family, &family_bytes));
     jbyteArray qualifier_bytes;
     RETURN_IF_ERROR(CreateByteArray(env, qualifier, &qualifier_bytes));
-    // scan_.addColumn(family_bytes, qualifier_bytes);
-    env->CallObjectMethod(scan_, scan_add_column_id_, family_bytes, qualifier_bytes);
+    // scan.addColumn(family_bytes, qualifier_bytes);
+    env->CallObjectMethod(scan, scan_add_column_id_, family_bytes, qualifier_bytes);
     RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    requested_cols_.push_back(make_pair(family, qualifier));
   }
 
   // circumvent hbase bug: make sure to select all cols that have filters,
@@ -327,18 +372,36 @@ Status HBaseTableScanner::ScanSetup(JNIEnv* env, const TupleDescriptor* tuple_de
     RETURN_IF_ERROR(CreateByteArray(env, it->family, &family_bytes));
     jbyteArray qualifier_bytes;
     RETURN_IF_ERROR(CreateByteArray(env, it->qualifier, &qualifier_bytes));
-    // scan_.addColumn(family_bytes, qualifier_bytes);
-    env->CallObjectMethod(scan_, scan_add_column_id_, family_bytes, qualifier_bytes);
+    // scan.addColumn(family_bytes, qualifier_bytes);
+    env->CallObjectMethod(scan, scan_add_column_id_, family_bytes, qualifier_bytes);
     RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    requested_cols_.push_back(make_pair(it->family, it->qualifier));
     ++num_addl_requested_cols_;
   }
 
+  // If only the row key is requested, the first keyvalue of each row without its value
+  // is enough.  With filters, all columns the filters need are requested.
+  bool row_key_only = num_requested_keyvalues_ == 0 && filters.empty();
+
   // Add HBase Filters.
-  if (!filters.empty()) {
+  if (!filters.empty() || row_key_only) {
     // filter_list = new FilterList(Operator.MUST_PASS_ALL);
     jobject filter_list =
         env->NewObject(filter_list_cl_, filter_list_ctor_, must_pass_all_op_);
     RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    if (row_key_only) {
+      // filter_list.add(new FirstKeyOnlyFilter());
+      jobject first_key_only_filter =
+          env->NewObject(first_key_only_filter_cl_, first_key_only_filter_ctor_);
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      env->CallVoidMethod(filter_list, filter_list_add_filter_id_, first_key_only_filter);
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      // filter_list.add(new KeyOnlyFilter());
+      jobject key_only_filter = env->NewObject(key_only_filter_cl_, key_only_filter_ctor_);
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      env->CallVoidMethod(filter_list, filter_list_add_filter_id_, key_only_filter);
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    }
     vector<THBaseFilter>::const_iterator it;
     for (it = filters.begin(); it != filters.end(); ++it) {
       // hbase_op = CompareFilter.CompareOp.values()[it->op_ordinal];
@@ -361,26 +424,40 @@ Status HBaseTableScanner::ScanSetup(JNIEnv* env, const TupleDescriptor* tuple_de
       RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
     }
     // scan.setFilter(filter_list);
-    scan_ = env->CallObjectMethod(scan_, scan_set_filter_id_, filter_list);
+    scan = env->CallObjectMethod(scan, scan_set_filter_id_, filter_list);
     RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    filter_list_ = env->NewGlobalRef(filter_list);
+    if (filter_list_ == NULL) {
+      return Status("Failed to create a global reference to a FilterList");
+    }
   }
 
+  // The Scan is reused for the ranges of later StartScan() calls, which may be made
+  // after the local references of this call are gone.
+  scan_ = env->NewGlobalRef(scan);
+  env->DeleteLocalRef(scan);
+  if (scan_ == NULL) return Status("Failed to create a global reference to a Scan");
   return Status::OK;
 }
 
 Status HBaseTableScanner::InitScanRange(JNIEnv* env, const ScanRange& scan_range) {
+  if (!scan_range.row_keys().empty()) return GetRows(env, scan_range);
+
   jbyteArray start_bytes;
   CreateByteArray(env, scan_range.start_key(), &start_bytes);
   jbyteArray end_bytes;
   CreateByteArray(env, scan_range.stop_key(), &end_bytes);
 
-  // scan_ = scan_.setStartRow(start_bytes);
-  scan_ = env->CallObjectMethod(scan_, scan_set_start_row_id_, start_bytes);
+  // scan_.setStartRow(start_bytes);
+  // The returned Scan is scan_ itself, keep the global reference.
+  env->DeleteLocalRef(env->CallObjectMethod(scan_, scan_set_start_row_id_, start_bytes));
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
 
-  // scan_ = scan_.setStopRow(end_bytes);
-  scan_ = env->CallObjectMethod(scan_, scan_set_stop_row_id_, end_bytes);
+  // scan_.setStopRow(end_bytes);
+  env->DeleteLocalRef(env->CallObjectMethod(scan_, scan_set_stop_row_id_, end_bytes));
   RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  if (start_bytes != empty_row_) env->DeleteLocalRef(start_bytes);
+  if (end_bytes != empty_row_) env->DeleteLocalRef(end_bytes);
 
   // resultscanner_ = htable_.getScanner(scan_);
   resultscanner_ = env->CallObjectMethod(htable_, htable_get_scanner_id_, scan_);
@@ -389,10 +466,67 @@ Status HBaseTableScanner::InitScanRange(JNIEnv* env, const ScanRange& scan_range
 
 }
 
+Status HBaseTableScanner::GetRows(JNIEnv* env, const ScanRange& scan_range) {
+  DCHECK(results_ == NULL);
+  const vector<string>& row_keys = scan_range.row_keys();
+  // gets = new ArrayList(row_keys.size());
+  jobject gets = env->NewObject(array_list_cl_, array_list_ctor_,
+      static_cast<jint>(row_keys.size()));
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  for (int i = 0; i < row_keys.size(); ++i) {
+    // The local references of this Get are released once it is in the list.
+    if (env->PushLocalFrame(2 * requested_cols_.size() + 4) < 0) {
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      return Status("Failed to allocate JNI local references for the hbase gets.");
+    }
+    Status status = AddGet(env, row_keys[i], gets);
+    env->PopLocalFrame(NULL);
+    RETURN_IF_ERROR(status);
+  }
+  // results_ = htable_.get(gets);
+  results_ = reinterpret_cast<jobjectArray>(
+      env->CallObjectMethod(htable_, htable_get_id_, gets));
+  env->DeleteLocalRef(gets);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  num_results_ = results_ == NULL ? 0 : env->GetArrayLength(results_);
+  result_idx_ = 0;
+  return Status::OK;
+}
+
+Status HBaseTableScanner::AddGet(JNIEnv* env, const string& row_key, jobject gets) {
+  jbyteArray row_bytes;
+  RETURN_IF_ERROR(CreateByteArray(env, row_key, &row_bytes));
+  // get = new Get(row_bytes);
+  jobject get = env->NewObject(get_cl_, get_ctor_, row_bytes);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  // The Get reads the same columns as scan_, with the same filters.
+  for (int i = 0; i < requested_cols_.size(); ++i) {
+    jbyteArray family_bytes;
+    RETURN_IF_ERROR(CreateByteArray(env, requested_cols_[i].first, &family_bytes));
+    jbyteArray qualifier_bytes;
+    RETURN_IF_ERROR(CreateByteArray(env, requested_cols_[i].second, &qualifier_bytes));
+    // get.addColumn(family_bytes, qualifier_bytes);
+    env->CallObjectMethod(get, get_add_column_id_, family_bytes, qualifier_bytes);
+    RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  }
+  if (filter_list_ != NULL) {
+    // get.setFilter(filter_list_);
+    env->CallObjectMethod(get, get_set_filter_id_, filter_list_);
+    RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  }
+  // get.setCacheBlocks(FLAGS_hbase_cache_blocks);
+  env->CallVoidMethod(get, get_set_cache_blocks_id_, FLAGS_hbase_cache_blocks);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  // gets.add(get);
+  env->CallBooleanMethod(gets, array_list_add_id_, get);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  return Status::OK;
+}
+
 Status HBaseTableScanner::StartScan(JNIEnv* env, const TupleDescriptor* tuple_desc,
     const ScanRangeVector& scan_range_vector, const vector<THBaseFilter>& filters) {
-  // Setup the scan without ranges first
-  RETURN_IF_ERROR(ScanSetup(env, tuple_desc, filters));
+  // Setup the scan without ranges first, unless a previous scan already did.
+  if (scan_ == NULL) RETURN_IF_ERROR(ScanSetup(env, tuple_desc, filters));
 
   // Record the ranges
   scan_range_vector_ = &scan_range_vector;
@@ -417,60 +551,109 @@ Status HBaseTableScanner::CreateByteArray(JNIEnv* env, const std::string& s,
   return Status::OK;
 }
 
-Status HBaseTableScanner::Next(JNIEnv* env, bool* has_next) {
-  {
-    SCOPED_TIMER(scan_node_->read_timer());
-    while(true) {
-      //result_ = resultscanner_.next();
-      result_ = env->CallObjectMethod(resultscanner_, resultscanner_next_id_);
-
-      // jump to the next region when finished with the current region.
-      if (result_ == NULL &&
-          current_scan_range_idx_ + 1 < scan_range_vector_->size()) {
-        ++current_scan_range_idx_;
-        RETURN_IF_ERROR(InitScanRange(env,
-            scan_range_vector_->at(current_scan_range_idx_)));
-        continue;
+Status HBaseTableScanner::FetchResults(JNIEnv* env) {
+  DCHECK(results_ == NULL);
+  while (true) {
+    if (resultscanner_ != NULL) {
+      // results_ = resultscanner_.next(rows_cached_);
+      results_ = reinterpret_cast<jobjectArray>(env->CallObjectMethod(
+          resultscanner_, resultscanner_next_rows_id_, rows_cached_));
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      num_results_ = results_ == NULL ? 0 : env->GetArrayLength(results_);
+      result_idx_ = 0;
+    } else {
+      // All results of the gets of the current range were returned by GetRows().
+      num_results_ = 0;
+    }
+
+    // jump to the next region when finished with the current region.
+    if (num_results_ == 0 &&
+        current_scan_range_idx_ + 1 < scan_range_vector_->size()) {
+      ReleaseResults(env);
+      if (resultscanner_ != NULL) {
+        // resultscanner_.close();
+        env->CallVoidMethod(resultscanner_, resultscanner_close_id_);
+        RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+        env->DeleteLocalRef(resultscanner_);
+        resultscanner_ = NULL;
       }
-      break;
+      ++current_scan_range_idx_;
+      RETURN_IF_ERROR(InitScanRange(env,
+          scan_range_vector_->at(current_scan_range_idx_)));
+      if (num_results_ > 0) return Status::OK;
+      continue;
     }
+    return Status::OK;
   }
+}
 
-  if (result_ == NULL) {
-    *has_next = false;
-    return Status::OK;
+void HBaseTableScanner::ReleaseResults(JNIEnv* env) {
+  if (row_frame_pushed_) {
+    env->PopLocalFrame(NULL);
+    row_frame_pushed_ = false;
+  }
+  if (results_ != NULL) {
+    env->DeleteLocalRef(results_);
+    results_ = NULL;
   }
+  num_results_ = 0;
+  result_idx_ = 0;
+}
 
-  // keyvalues_ = result_.raw();
-  keyvalues_ =
-      reinterpret_cast<jobjectArray>(env->CallObjectMethod(result_, result_raw_id_));
-  num_keyvalues_ = env->GetArrayLength(keyvalues_);
-  // Check that raw() didn't return more keyvalues than expected.
-  // If num_requested_keyvalues_ is 0 then only row key is asked for and this check
-  // should pass.
-  if (num_keyvalues_ > num_requested_keyvalues_ + num_addl_requested_cols_
-      && num_requested_keyvalues_ + num_addl_requested_cols_ != 0) {
-    *has_next = false;
-    return Status("Encountered more keyvalues than expected.");
+Status HBaseTableScanner::Next(JNIEnv* env, bool* has_next) {
+  // Release the JNI objects of the previous row.
+  if (row_frame_pushed_) {
+    env->PopLocalFrame(NULL);
+    row_frame_pushed_ = false;
   }
-  // If all requested columns are present, and we didn't ask for any extra ones to work
-  // around an hbase bug, we avoid family-/qualifier comparisons in NextValue().
-  if (num_keyvalues_ == num_requested_keyvalues_ && num_addl_requested_cols_ == 0) {
-    all_keyvalues_present_ = true;
-  } else {
-    all_keyvalues_present_ = false;
+
+  jobject result;
+  while (true) {
+    if (result_idx_ >= num_results_) {
+      SCOPED_TIMER(scan_node_->read_timer());
+      ReleaseResults(env);
+      RETURN_IF_ERROR(FetchResults(env));
+    }
+
+    if (num_results_ == 0) {
+      *has_next = false;
+      return Status::OK;
+    }
+
+    // The local references created for this row: the Result, its
+    // ImmutableBytesWritable and the backing byte array.
+    if (env->PushLocalFrame(3) < 0) {
+      RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+      return Status("Failed to allocate JNI local references for the hbase scan.");
+    }
+    row_frame_pushed_ = true;
+
+    // result = results_[result_idx_];
+    result = env->GetObjectArrayElement(results_, result_idx_);
+    RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    ++result_idx_;
+
+    // A scan only returns rows that exist, but the get of a missing row returns an
+    // empty Result; skip those.
+    if (resultscanner_ != NULL) break;
+    bool empty = env->CallBooleanMethod(result, result_is_empty_id_);
+    RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+    if (!empty) break;
+    env->PopLocalFrame(NULL);
+    row_frame_pushed_ = false;
   }
-  keyvalue_index_ = 0;
-  // All KeyValues are backed by the same buffer. Place it into the C byffer_.
-  jobject immutable_bytes_writable =
-      env->CallObjectMethod(result_, result_get_bytes_id_);
-  byte_array_ = (jbyteArray)
-      env->CallObjectMethod(immutable_bytes_writable, immutable_bytes_writable_get_id_);
 
+  // All KeyValues are serialized into one buffer. Place it into the C buffer_.
+  jobject immutable_bytes_writable =
+      env->CallObjectMethod(result, result_get_bytes_id_);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  jbyteArray byte_array = reinterpret_cast<jbyteArray>(
+      env->CallObjectMethod(immutable_bytes_writable, immutable_bytes_writable_get_id_));
   int bytes_array_length = env->CallIntMethod(immutable_bytes_writable,
       immutable_bytes_writable_get_length_id_);
-  result_bytes_offset_ = env->CallIntMethod(immutable_bytes_writable,
+  int result_bytes_offset = env->CallIntMethod(immutable_bytes_writable,
       immutable_bytes_writable_get_offset_id_);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
   COUNTER_UPDATE(scan_node_->bytes_read_counter(), bytes_array_length);
 
   // Copy the data from the java byte array to our buffer_.
@@ -480,51 +663,126 @@ Status HBaseTableScanner::Next(JNIEnv* env, bool* has_next) {
     buffer_ = buffer_pool_->Allocate(bytes_array_length);
     buffer_length_ = bytes_array_length;
   }
-  env->GetByteArrayRegion(byte_array_, result_bytes_offset_, bytes_array_length,
+  env->GetByteArrayRegion(byte_array, result_bytes_offset, bytes_array_length,
       reinterpret_cast<jbyte*>(buffer_));
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+
+  RETURN_IF_ERROR(ParseKeyValues(bytes_array_length));
+  int num_keyvalues = keyvalues_.size();
+  // Check that the row doesn't have more keyvalues than expected.
+  // If num_requested_keyvalues_ is 0 then only row key is asked for and this check
+  // should pass.
+  if (num_keyvalues > num_requested_keyvalues_ + num_addl_requested_cols_
+      && num_requested_keyvalues_ + num_addl_requested_cols_ != 0) {
+    *has_next = false;
+    return Status("Encountered more keyvalues than expected.");
+  }
+  // If all requested columns are present, and we didn't ask for any extra ones to work
+  // around an hbase bug, we avoid family-/qualifier comparisons in NextValue().
+  all_keyvalues_present_ =
+      num_keyvalues == num_requested_keyvalues_ && num_addl_requested_cols_ == 0;
+  keyvalue_index_ = 0;
 
   value_pool_->Clear();
   *has_next = true;
   return Status::OK;
 }
 
+// Returns the big endian integer at buf.
+static inline int32_t GetBigEndianInt(const uint8_t* buf) {
+  return (buf[0] << 24) | (buf[1] << 16) | (buf[2] << 8) | buf[3];
+}
+
+// Returns the big endian short at buf.
+static inline int16_t GetBigEndianShort(const uint8_t* buf) {
+  return (buf[0] << 8) | buf[1];
+}
+
+// The keyvalues of a Result are serialized as
+//   <int length><KeyValue> ...
+// and a KeyValue as
+//   <int key length><int value length><key><value>
+// where the key is
+//   <short row length><row><byte family length><family><qualifier>
+//   <long timestamp><byte key type>
+// All integers are big endian.
+Status HBaseTableScanner::ParseKeyValues(int length) {
+  // Sizes of the fixed length parts of a KeyValue.
+  static const int KEYVALUE_LENGTHS_SIZE = 2 * sizeof(int32_t);
+  static const int KEY_INFRASTRUCTURE_SIZE =
+      sizeof(int16_t) + sizeof(uint8_t) + sizeof(int64_t) + sizeof(uint8_t);
+
+  const uint8_t* buffer = reinterpret_cast<const uint8_t*>(buffer_);
+  keyvalues_.clear();
+  int offset = 0;
+  while (offset < length) {
+    if (length - offset < static_cast<int>(sizeof(int32_t))) break;
+    int keyvalue_length = GetBigEndianInt(buffer + offset);
+    offset += sizeof(int32_t);
+    if (keyvalue_length < KEYVALUE_LENGTHS_SIZE + KEY_INFRASTRUCTURE_SIZE ||
+        keyvalue_length > length - offset) {
+      break;
+    }
+    int key_length = GetBigEndianInt(buffer + offset);
+    int value_length = GetBigEndianInt(buffer + offset + sizeof(int32_t));
+    int key_offset = offset + KEYVALUE_LENGTHS_SIZE;
+    int row_length = static_cast<uint16_t>(GetBigEndianShort(buffer + key_offset));
+    if (key_length < KEY_INFRASTRUCTURE_SIZE + row_length ||
+        KEYVALUE_LENGTHS_SIZE + key_length + value_length != keyvalue_length) {
+      break;
+    }
+    int family_length = buffer[key_offset + sizeof(int16_t) + row_length];
+
+    KeyValueLocation keyvalue;
+    keyvalue.family_offset = key_offset + sizeof(int16_t) + row_length + sizeof(uint8_t);
+    keyvalue.family_length = family_length;
+    keyvalue.qualifier_offset = keyvalue.family_offset + family_length;
+    keyvalue.qualifier_length =
+        key_length - KEY_INFRASTRUCTURE_SIZE - row_length - family_length;
+    keyvalue.value_offset = key_offset + key_length;
+    keyvalue.value_length = value_length;
+    if (keyvalue.qualifier_length < 0) break;
+
+    if (keyvalues_.empty()) {
+      row_key_offset_ = key_offset + sizeof(int16_t);
+      row_key_length_ = row_length;
+    }
+    keyvalues_.push_back(keyvalue);
+    offset += keyvalue_length;
+  }
+  if (offset != length || keyvalues_.empty()) {
+    return Status("Invalid serialized HBase result.");
+  }
+  return Status::OK;
+}
+
 void HBaseTableScanner::GetRowKey(JNIEnv* env, void** key, int* key_length) {
-  keyvalue_ = env->GetObjectArrayElement(keyvalues_, 0);
-  *key_length = env->CallShortMethod(keyvalue_, keyvalue_get_row_length_id_);
-  int key_offset =
-      env->CallIntMethod(keyvalue_, keyvalue_get_row_offset_id_) - result_bytes_offset_;
+  *key_length = row_key_length_;
   // Allocate one extra byte for null-terminator.
   *key = value_pool_->Allocate(*key_length + 1);
-  memcpy(*key, reinterpret_cast<char*>(buffer_) + key_offset, *key_length);
+  memcpy(*key, reinterpret_cast<char*>(buffer_) + row_key_offset_, *key_length);
   reinterpret_cast<char*>(*key)[*key_length] = '\0';
 }
 
 void HBaseTableScanner::GetValue(JNIEnv* env, const string& family,
     const string& qualifier, void** value, int* value_length) {
   // Current row doesn't have any more keyvalues. All remaining values are NULL.
-  if (keyvalue_index_ >= num_keyvalues_) {
+  if (keyvalue_index_ >= static_cast<int>(keyvalues_.size())) {
     *value = NULL;
     *value_length = 0;
     return;
   }
-  keyvalue_ = env->GetObjectArrayElement(keyvalues_, keyvalue_index_);
+  const KeyValueLocation& keyvalue = keyvalues_[keyvalue_index_];
   if (!all_keyvalues_present_) {
     // Check family. If it doesn't match, we have a NULL value.
-    int family_offset = env->CallIntMethod(keyvalue_, keyvalue_get_family_offset_id_) -
-        result_bytes_offset_;
-    int family_length = env->CallByteMethod(keyvalue_, keyvalue_get_family_length_id_);
-    if (CompareStrings(family, family_offset, family_length) != 0) {
+    if (CompareStrings(family, keyvalue.family_offset, keyvalue.family_length) != 0) {
       *value = NULL;
       *value_length = 0;
       return;
     }
     // Check qualifier. If it doesn't match, we have a NULL value.
-    int qualifier_offset =
-        env->CallIntMethod(keyvalue_, keyvalue_get_qualifier_offset_id_) -
-        result_bytes_offset_;
-    int qualifier_length =
-        env->CallIntMethod(keyvalue_, keyvalue_get_qualifier_length_id_);
-    if (CompareStrings(qualifier, qualifier_offset, qualifier_length) != 0) {
+    if (CompareStrings(
+          qualifier, keyvalue.qualifier_offset, keyvalue.qualifier_length) != 0) {
       *value = NULL;
       *value_length = 0;
       return;
@@ -532,12 +790,11 @@ void HBaseTableScanner::GetValue(JNIEnv* env, const string& family,
   }
   // The requested family/qualifier matches the keyvalue at keyvalue_index_.
   // Copy the cell.
-  *value_length = env->CallIntMethod(keyvalue_, keyvalue_get_value_length_id_);
-  int value_offset = env->CallIntMethod(keyvalue_, keyvalue_get_value_offset_id_) -
-                     result_bytes_offset_;
+  *value_length = keyvalue.value_length;
   // Allocate one extra byte for null-terminator.
   *value = value_pool_->Allocate(*value_length + 1);
-  memcpy(*value, reinterpret_cast<char*>(buffer_) + value_offset, *value_length);
+  memcpy(*value, reinterpret_cast<char*>(buffer_) + keyvalue.value_offset,
+      *value_length);
   reinterpret_cast<char*>(*value)[*value_length] = '\0';
   ++keyvalue_index_;
 }
@@ -556,9 +813,29 @@ int HBaseTableScanner::CompareStrings(const string& s, int offset, int length) {
   }
 }
 
-void HBaseTableScanner::Close(JNIEnv* env) {
+void HBaseTableScanner::CloseScan(JNIEnv* env) {
+  ReleaseResults(env);
   if (resultscanner_ != NULL) {
     // resultscanner_.close();
-    env->CallObjectMethod(resultscanner_, resultscanner_close_id_);
+    env->CallVoidMethod(resultscanner_, resultscanner_close_id_);
+    if (env->ExceptionOccurred()) env->ExceptionClear();
+    env->DeleteLocalRef(resultscanner_);
+    resultscanner_ = NULL;
+  }
+}
+
+void HBaseTableScanner::Close(JNIEnv* env) {
+  CloseScan(env);
+  if (scan_ != NULL) {
+    env->DeleteGlobalRef(scan_);
+    scan_ = NULL;
+  }
+  if (filter_list_ != NULL) {
+    env->DeleteGlobalRef(filter_list_);
+    filter_list_ = NULL;
+  }
+  if (htable_ != NULL) {
+    htable_cache_->ReleaseHBaseTable(table_name_, htable_);
+    htable_ = NULL;
   }
 }
@@ -19,6 +19,7 @@
 #include <jni.h>
 #include <string>
 #include <sstream>
+#include <vector>
 #include <boost/scoped_ptr.hpp>
 #include "gen-cpp/PlanNodes_types.h"
 #include "exec/scan-node.h"
@@ -32,13 +33,14 @@ class MemPool;
 class Status;
 
 // JNI wrapper class implementing minimal functionality for scanning an HBase table.
+// Only the materialized families/qualifiers are requested from HBase and the
+// THBaseFilters are pushed into the Scan as SingleColumnValueFilters.  If only the row
+// key is requested, only the first key of each row is returned, without its value.
+// Rows are fetched from the ResultScanner in arrays of up to rows_cached_ Results per
+// JNI call.  The keyvalues of a row are parsed from the serialized Result, so the
+// only JNI calls per row are the ones that copy the Result's bytes.
 // Note: When none of the requested family/qualifiers exist in a particular row,
 // HBase will not return the row at all, leading to "missing" NULL values.
-// TODO: Related to filtering, there is a special filter that allows only selecting the
-//       keyvalues.
-//       Currently, if only the row key is requested
-//       all keyvalues are fetched from HBase (since there is no family/qualifier
-//       restriction).
 // TODO: Enable time travel.
 class HBaseTableScanner {
  public:
@@ -52,7 +54,8 @@ class HBaseTableScanner {
   // and find method ids.
   static Status Init();
 
-  // HBase scan range; "" means unbounded
+  // HBase scan range; "" means unbounded.  If row_keys is not empty, the range is the
+  // rows with these keys, which are read with one batch of gets rather than a scan.
   class ScanRange {
    public:
     ScanRange()
@@ -62,8 +65,12 @@ class HBaseTableScanner {
 
     const std::string& start_key() const { return start_key_; }
     const std::string& stop_key() const {return stop_key_; }
+    const std::string& region_server() const { return region_server_; }
+    const std::vector<std::string>& row_keys() const { return row_keys_; }
     void set_start_key(const std::string& key) { start_key_ = key; }
     void set_stop_key(const std::string& key) { stop_key_ = key; }
+    void set_region_server(const std::string& server) { region_server_ = server; }
+    void set_row_keys(const std::vector<std::string>& keys) { row_keys_ = keys; }
 
     // Write debug string of this ScanRange into out.
     void DebugString(int indentation_level, std::stringstream* out);
@@ -71,6 +78,10 @@ class HBaseTableScanner {
    private:
     std::string start_key_;
     std::string stop_key_;
+    // host:port of the region server serving the range; "" if unknown.
+    std::string region_server_;
+    // Sorted keys of the rows to get; empty for a scan of the whole range.
+    std::vector<std::string> row_keys_;
   };
 
   typedef std::vector<ScanRange> ScanRangeVector;
@@ -78,6 +89,8 @@ class HBaseTableScanner {
   // Perform a table scan, retrieving the families/qualifiers referenced in tuple_desc.
   // If start_/stop_key is not empty, is used for the corresponding role in the scan.
   // Note: scan_range_vector cannot be modified for the duration of the scan.
+  // After CloseScan(), this can be called again with other ranges, and the same
+  // tuple_desc and filters, which reuses the HTable and the Scan of the first call.
   Status StartScan(JNIEnv* env, const TupleDescriptor* tuple_desc,
                    const ScanRangeVector& scan_range_vector,
                    const std::vector<THBaseFilter>& filters);
@@ -96,7 +109,11 @@ class HBaseTableScanner {
   void GetValue(JNIEnv* env, const std::string& family, const std::string& qualifier,
       void** value, int* value_length);
 
-  // Close HTable and ResultScanner.
+  // Close the ResultScanner of the current scan and release the JNI references to the
+  // current results, but keep the HTable and the Scan for the next StartScan().
+  void CloseScan(JNIEnv* env);
+
+  // CloseScan() and return the HTable to the cache.
   void Close(JNIEnv* env);
 
   void set_num_requested_keyvalues(int num_requested_keyvalues) {
@@ -104,8 +121,6 @@ class HBaseTableScanner {
   }
 
  private:
-  static const int DEFAULT_ROWS_CACHED = 1024;
-
   // The enclosing ScanNode; it is used to update performance counters.
   ScanNode* scan_node_;
 
@@ -115,42 +130,46 @@ class HBaseTableScanner {
   static jclass resultscanner_cl_;
   static jclass result_cl_;
   static jclass immutable_bytes_writable_cl_;
-  static jclass keyvalue_cl_;
   static jclass hconstants_cl_;
   static jclass filter_list_cl_;
   static jclass filter_list_op_cl_;
   static jclass single_column_value_filter_cl_;
   static jclass compare_op_cl_;
+  static jclass first_key_only_filter_cl_;
+  static jclass key_only_filter_cl_;
+  static jclass get_cl_;
+  static jclass array_list_cl_;
 
   static jmethodID htable_ctor_;
   static jmethodID htable_get_scanner_id_;
   static jmethodID htable_close_id_;
+  static jmethodID htable_get_id_;
   static jmethodID scan_ctor_;
   static jmethodID scan_set_max_versions_id_;
   static jmethodID scan_set_caching_id_;
+  static jmethodID scan_set_cache_blocks_id_;
   static jmethodID scan_add_column_id_;
   static jmethodID scan_set_filter_id_;
   static jmethodID scan_set_start_row_id_;
   static jmethodID scan_set_stop_row_id_;
-  static jmethodID resultscanner_next_id_;
+  static jmethodID resultscanner_next_rows_id_;
   static jmethodID resultscanner_close_id_;
   static jmethodID result_get_bytes_id_;
-  static jmethodID result_raw_id_;
+  static jmethodID result_is_empty_id_;
   static jmethodID immutable_bytes_writable_get_id_;
   static jmethodID immutable_bytes_writable_get_length_id_;
   static jmethodID immutable_bytes_writable_get_offset_id_;
-  static jmethodID keyvalue_get_buffer_id_;
-  static jmethodID keyvalue_get_family_offset_id_;
-  static jmethodID keyvalue_get_family_length_id_;
-  static jmethodID keyvalue_get_qualifier_offset_id_;
-  static jmethodID keyvalue_get_qualifier_length_id_;
-  static jmethodID keyvalue_get_row_offset_id_;
-  static jmethodID keyvalue_get_row_length_id_;
-  static jmethodID keyvalue_get_value_offset_id_;
-  static jmethodID keyvalue_get_value_length_id_;
   static jmethodID filter_list_ctor_;
   static jmethodID filter_list_add_filter_id_;
   static jmethodID single_column_value_filter_ctor_;
+  static jmethodID first_key_only_filter_ctor_;
+  static jmethodID key_only_filter_ctor_;
+  static jmethodID get_ctor_;
+  static jmethodID get_add_column_id_;
+  static jmethodID get_set_filter_id_;
+  static jmethodID get_set_cache_blocks_id_;
+  static jmethodID array_list_ctor_;
+  static jmethodID array_list_add_id_;
 
   static jobject empty_row_;
   static jobject must_pass_all_op_;
@@ -164,22 +183,48 @@ class HBaseTableScanner {
   int current_scan_range_idx_; // the index of the current scan range
 
   // Instances related to scanning a table. Set in StartScan().
-  jobject htable_;        // Java type HTable
-  jobject scan_;          // Java type Scan
-  jobject resultscanner_; // Java type ResultScanner
-
-  // Helper members for retrieving results from a scan. Updated in Next(), and
-  // NextValue() methods.
-  jobject result_;  // Java type Result
-  jobjectArray keyvalues_;  // Java type KeyValue[]. Result of result_.raw();
-  jobject keyvalue_; // Java type KeyValue
-  // Byte array backing the KeyValues[] created in one call to Next().
-  jbyteArray byte_array_;
-  void* buffer_;  // C version of byte_array_.
+  std::string table_name_;
+  jobject htable_;        // Java type HTable, checked out of htable_cache_
+  jobject scan_;          // Java type Scan, a global reference kept until Close()
+  jobject resultscanner_; // Java type ResultScanner; NULL while reading gets
+
+  // The families/qualifiers and the FilterList (a global reference, NULL if there are
+  // no filters) of scan_, which the Gets of ranges with row keys get as well.
+  std::vector<std::pair<std::string, std::string> > requested_cols_;
+  jobject filter_list_;
+
+  // Results returned by the last resultscanner_.next(rows_cached_), Java type
+  // Result[].  NULL if no rows have been fetched from the current scan range yet.
+  jobjectArray results_;
+  int num_results_;
+  // Index in results_ of the current row.
+  int result_idx_;
+
+  // True if a local reference frame was pushed for the JNI objects of the current
+  // row.  The frame is popped in the following Next(), which releases them.
+  bool row_frame_pushed_;
+
+  // Serialized keyvalues of the current row, copied from its Result.getBytes().
+  // Each keyvalue is stored as a big endian int length followed by the KeyValue.
+  void* buffer_;
   int buffer_length_; // size of buffer
 
-  // The offset of the ImmutableByteWritable (returned by result_.getBytes()).
-  int result_bytes_offset_;
+  // Location of a keyvalue's family, qualifier and value in buffer_.
+  struct KeyValueLocation {
+    int family_offset;
+    int family_length;
+    int qualifier_offset;
+    int qualifier_length;
+    int value_offset;
+    int value_length;
+  };
+
+  // Keyvalues of the current row.  Set in Next().
+  std::vector<KeyValueLocation> keyvalues_;
+
+  // Location of the current row's key in buffer_.
+  int row_key_offset_;
+  int row_key_length_;
 
   // Current position in keyvalues_. Incremented in NextValue(). Reset in Next().
   int keyvalue_index_;
@@ -192,9 +237,6 @@ class HBaseTableScanner {
   // hbase bug
   int num_addl_requested_cols_;
 
-  // Number of keyvalues returned from last result_.raw().
-  int num_keyvalues_;
-
   // Indicates whether all requested keyvalues are present in the current keyvalues_.
   // If set to true, all family/qualifier comparisons are avoided in NextValue().
   bool all_keyvalues_present_;
@@ -209,7 +251,8 @@ class HBaseTableScanner {
   boost::scoped_ptr<MemPool> buffer_pool_;
 
   // Number of rows for caching that will be passed to scanners.
-  // Set in the HBase call Scan.setCaching();
+  // Set in the HBase call Scan.setCaching().  This is also the number of rows
+  // fetched per JNI call.
   int rows_cached_;
 
   // HBase specific counters
@@ -230,6 +273,26 @@ class HBaseTableScanner {
 
   // Initialize the scan to the given range
   Status InitScanRange(JNIEnv* env, const ScanRange& scan_range);
+
+  // Gets the rows of scan_range.row_keys() in one HTable.get(List<Get>) call and sets
+  // results_ to them.
+  Status GetRows(JNIEnv* env, const ScanRange& scan_range);
+
+  // Adds a Get of the row with 'row_key' and the columns and filters of scan_ to the
+  // java List 'gets'.
+  Status AddGet(JNIEnv* env, const std::string& row_key, jobject gets);
+
+  // Fetch the next array of up to rows_cached_ rows of the scan into results_, moving
+  // to the next scan range when the current one is done.  Sets num_results_ to 0 at
+  // the end of the scan.
+  Status FetchResults(JNIEnv* env);
+
+  // Parse the first length bytes of serialized keyvalues in buffer_ into keyvalues_
+  // and the row key location.
+  Status ParseKeyValues(int length);
+
+  // Release the local references of the current row and of results_.
+  void ReleaseResults(JNIEnv* env);
 };
 
 }
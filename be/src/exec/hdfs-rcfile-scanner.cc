@@ -14,6 +14,7 @@
 
 #include <boost/algorithm/string.hpp>
 #include "text-converter.h"
+#include "codegen/llvm-codegen.h"
 #include "exprs/expr.h"
 #include "runtime/descriptors.h"
 #include "runtime/runtime-state.h"
@@ -27,16 +28,17 @@
 #include "util/runtime-profile.h"
 #include "common/object-pool.h"
 #include "gen-cpp/PlanNodes_types.h"
-#include "exec/buffered-byte-stream.h"
 #include "exec/hdfs-rcfile-scanner.h"
 #include "exec/hdfs-sequence-scanner.h"
 #include "exec/hdfs-scan-node.h"
+#include "exec/scan-range-context.h"
 #include "exec/serde-utils.inline.h"
 #include "exec/text-converter.inline.h"
 
 using namespace std;
 using namespace boost;
 using namespace impala;
+using namespace llvm;
 
 const char* const HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME =
   "org.apache.hadoop.hive.ql.io.RCFile$KeyBuffer";
@@ -49,18 +51,18 @@ const char* const HdfsRCFileScanner::RCFILE_METADATA_KEY_NUM_COLS =
 
 const uint8_t HdfsRCFileScanner::RCFILE_VERSION_HEADER[4] = {'R', 'C', 'F', 1};
 
-static const uint8_t RC_FILE_RECORD_DELIMITER = 0xff;
+const int HdfsRCFileScanner::HEADER_SIZE = 1024;
 
-HdfsRCFileScanner::HdfsRCFileScanner(HdfsScanNode* scan_node, RuntimeState* state,
-    MemPool* mem_pool)
-    : HdfsScanner(scan_node, state, mem_pool),
-      scan_range_fully_buffered_(false),
+#define RETURN_IF_FALSE(x) if (UNLIKELY(!(x))) return parse_status_
+
+HdfsRCFileScanner::HdfsRCFileScanner(HdfsScanNode* scan_node, RuntimeState* state)
+    : HdfsScanner(scan_node, state),
+      only_parsing_header_(false),
+      header_(NULL),
+      have_sync_(false),
       key_buffer_pool_(new MemPool()),
       key_buffer_length_(0),
-      compressed_data_buffer_length_(0),
       column_buffer_pool_(new MemPool()) {
-  // Initialize the parser to find bytes that are 0xff.
-  find_first_parser_.reset(new DelimitedTextParser(scan_node, RC_FILE_RECORD_DELIMITER));
 }
 
 HdfsRCFileScanner::~HdfsRCFileScanner() {
@@ -71,10 +73,39 @@ HdfsRCFileScanner::~HdfsRCFileScanner() {
       key_buffer_pool_->peak_allocated_bytes());
 }
 
+void HdfsRCFileScanner::IssueInitialRanges(HdfsScanNode* scan_node,
+    const vector<HdfsFileDesc*>& files) {
+  // Issue just the header range for each file.  When the header is complete,
+  // we'll issue the ranges for that file.
+  for (int i = 0; i < files.size(); ++i) {
+    int64_t partition_id = reinterpret_cast<int64_t>(files[i]->ranges[0]->meta_data());
+    DiskIoMgr::ScanRange* header_range = scan_node->AllocateScanRange(
+        files[i]->filename.c_str(), HEADER_SIZE, 0, partition_id, -1, files[i]->mtime);
+    scan_node->AddDiskIoRange(header_range);
+  }
+}
+
+void HdfsRCFileScanner::IssueFileRanges(const char* filename) {
+  HdfsFileDesc* file_desc = scan_node_->GetFileDesc(filename);
+  scan_node_->AddDiskIoRange(file_desc);
+}
+
+// Codegen for materializing parsed data into tuples.  The rows are written from
+// field locations like the text scanner's, so this is the same function.
+Function* HdfsRCFileScanner::Codegen(HdfsScanNode* node) {
+  LlvmCodeGen* codegen = node->runtime_state()->llvm_codegen();
+  if (codegen == NULL) return NULL;
+  Function* write_complete_tuple_fn = CodegenWriteCompleteTuple(node, codegen);
+  if (write_complete_tuple_fn == NULL) return NULL;
+  return CodegenWriteAlignedTuples(node, codegen, write_complete_tuple_fn);
+}
+
 Status HdfsRCFileScanner::Prepare() {
   RETURN_IF_ERROR(HdfsScanner::Prepare());
 
   text_converter_.reset(new TextConverter(0));
+  field_locations_.resize(
+      scan_node_->row_batch_capacity() * scan_node_->materialized_slots().size());
 
   // Allocate the buffers for the key information that is used to read and decode
   // the column data from its run length encoding.
@@ -112,143 +143,169 @@ Status HdfsRCFileScanner::Prepare() {
 }
 
 Status HdfsRCFileScanner::Close() {
+  context_->AcquirePool(column_buffer_pool_.get());
+  if (!only_parsing_header_) scan_node_->RangeComplete();
+  context_->Complete();
   return Status::OK;
 }
 
-Status HdfsRCFileScanner::InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition, 
-    DiskIoMgr::ScanRange* scan_range, Tuple* template_tuple, 
-    ByteStream* current_byte_stream_) {
-  RETURN_IF_ERROR(HdfsScanner::InitCurrentScanRange(hdfs_partition, scan_range, 
-      template_tuple, current_byte_stream_));
-  end_of_scan_range_ = scan_range->len() + scan_range->offset();
-
-  // Check the Location (file name) to see if we have changed files.
-  // If this a new file then we need to read and process the header.
-  if (previous_location_ != current_byte_stream_->GetLocation()) {
-    RETURN_IF_ERROR(current_byte_stream_->Seek(0));
-    RETURN_IF_ERROR(ReadFileHeader());
-    // Save the current file name if we get the same file we can avoid
-    // rereading the header information.
-    previous_location_ = current_byte_stream_->GetLocation();
-    // Save the seek offset of the end of the header information.  If we
-    // get a scan range that starts at the beginning of the file we can avoid
-    // reading the header but we must seek past it to get to the beginning of the data.
-    current_byte_stream_->GetPosition(&header_end_);
-  } else if (scan_range->offset() == 0) {
-    // If are at the beginning of the file and we previously read the file header
-    // we do not have to read it again but we need to seek past the file header.
-    // We saved the offset above when we previously read and processed the header.
-    RETURN_IF_ERROR(current_byte_stream_->Seek(header_end_));
-  }
+Status HdfsRCFileScanner::InitNewRange() {
+  DCHECK(header_ != NULL);
+  only_parsing_header_ = false;
+
+  template_tuple_ = context_->template_tuple();
 
-  // Offset may not point to row group boundary so we need to search for the next
-  // sync block.
-  if (scan_range->offset() != 0) {
-    RETURN_IF_ERROR(current_byte_stream_->Seek(scan_range->offset()));
-    RETURN_IF_ERROR(find_first_parser_->FindSyncBlock(end_of_scan_range_,
-          SYNC_HASH_SIZE, &(sync_hash_[0]), current_byte_stream_));
+  if (header_->is_compressed) {
+    RETURN_IF_ERROR(Codec::CreateDecompressor(state_,
+        column_buffer_pool_.get(), !has_noncompact_strings_, header_->codec,
+        &decompressor_));
   }
-  int64_t position;
-  RETURN_IF_ERROR(current_byte_stream_->GetPosition(&position));
 
   ResetRowGroup();
-
-  scan_range_fully_buffered_ = false;
   previous_total_length_ = 0;
-  tuple_ = NULL;
+  have_sync_ = false;
 
+  RETURN_IF_ERROR(InitializeCodegenFn(context_->partition_descriptor(),
+      THdfsFileFormat::RC_FILE, "HdfsRCFileScanner"));
   return Status::OK;
 }
 
+Status HdfsRCFileScanner::ProcessScanRange(ScanRangeContext* context) {
+  context_ = context;
+
+  header_ = reinterpret_cast<FileHeader*>(
+      scan_node_->GetFileMetadata(context_->filename()));
+  if (header_ == NULL) {
+    // This is the initial scan range just to parse the header
+    only_parsing_header_ = true;
+    header_ = state_->obj_pool()->Add(new FileHeader());
+    RETURN_IF_ERROR(ReadFileHeader());
+
+    // Header is parsed, set the metadata in the scan node and issue more ranges
+    scan_node_->SetFileMetadata(context_->filename(), header_);
+    IssueFileRanges(context_->filename());
+    return Status::OK;
+  }
+
+  // Initialize state for new scan range
+  RETURN_IF_ERROR(InitNewRange());
+
+  // Find the first row group.  A range that starts at the beginning of the file
+  // skips the header, any other range starts at the first sync in it.
+  if (context_->scan_range()->offset() == 0) {
+    RETURN_IF_FALSE(
+        SerDeUtils::SkipBytes(context_, header_->header_size, &parse_status_));
+  } else {
+    RETURN_IF_ERROR(SkipToSync(header_->sync, SYNC_HASH_SIZE, &have_sync_));
+    if (context_->eosr()) return Status::OK;
+  }
+
+  // TODO: We should be able to skip over badly formated data and move to the
+  //       next sync block to restart the scan.
+  Status status = ProcessRange();
+  if (!status.ok() && state_->LogHasSpace()) {
+    stringstream ss;
+    ss << "Error while processing: " << context_->filename()
+       << " at offset: " << context_->file_offset();
+    state_->LogError(ss.str());
+  }
+  return status;
+}
+
 Status HdfsRCFileScanner::ReadFileHeader() {
-  vector<uint8_t> head;
-  RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-      sizeof(RCFILE_VERSION_HEADER), &head));
-  if (!memcmp(&head[0], HdfsSequenceScanner::SEQFILE_VERSION_HEADER, 
+  uint8_t* head;
+  RETURN_IF_FALSE(SerDeUtils::ReadBytes(context_,
+      sizeof(RCFILE_VERSION_HEADER), &head, &parse_status_));
+  if (!memcmp(head, HdfsSequenceScanner::SEQFILE_VERSION_HEADER,
       sizeof(HdfsSequenceScanner::SEQFILE_VERSION_HEADER))) {
-    version_ = SEQ6;
-  } else if (!memcmp(&head[0], RCFILE_VERSION_HEADER, sizeof(RCFILE_VERSION_HEADER))) {
-    version_ = RCF1;
+    header_->version = SEQ6;
+  } else if (!memcmp(head, RCFILE_VERSION_HEADER, sizeof(RCFILE_VERSION_HEADER))) {
+    header_->version = RCF1;
   } else {
     stringstream ss;
     ss << "Invalid RCFILE_VERSION_HEADER: '"
-       << SerDeUtils::HexDump(&head[0], sizeof(RCFILE_VERSION_HEADER)) << "'";
+       << SerDeUtils::HexDump(head, sizeof(RCFILE_VERSION_HEADER)) << "'";
     return Status(ss.str());
   }
-  
-  if (version_ == SEQ6) {
-    vector<char> buf;
-    RETURN_IF_ERROR(SerDeUtils::ReadText(current_byte_stream_, &buf));
-    if (strncmp(&buf[0], HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME,
-        strlen(HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME))) {
+
+  if (header_->version == SEQ6) {
+    uint8_t* class_name;
+    int len;
+    RETURN_IF_FALSE(SerDeUtils::ReadText(context_, &class_name, &len, &parse_status_));
+    if (len != strlen(HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME) ||
+        memcmp(class_name, HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME, len)) {
       stringstream ss;
       ss << "Invalid RCFILE_KEY_CLASS_NAME: '"
-         << string(&buf[0], strlen(HdfsRCFileScanner::RCFILE_KEY_CLASS_NAME))
-         << "'";
+         << string(reinterpret_cast<char*>(class_name), len) << "'";
       return Status(ss.str());
     }
 
-    RETURN_IF_ERROR(SerDeUtils::ReadText(current_byte_stream_, &buf));
-    if (strncmp(&buf[0], HdfsRCFileScanner::RCFILE_VALUE_CLASS_NAME,
-        strlen(HdfsRCFileScanner::RCFILE_VALUE_CLASS_NAME))) {
+    RETURN_IF_FALSE(SerDeUtils::ReadText(context_, &class_name, &len, &parse_status_));
+    if (len != strlen(HdfsRCFileScanner::RCFILE_VALUE_CLASS_NAME) ||
+        memcmp(class_name, HdfsRCFileScanner::RCFILE_VALUE_CLASS_NAME, len)) {
       stringstream ss;
       ss << "Invalid RCFILE_VALUE_CLASS_NAME: '"
-         << string(&buf[0], strlen(HdfsRCFileScanner::RCFILE_VALUE_CLASS_NAME))
-         << "'";
+         << string(reinterpret_cast<char*>(class_name), len) << "'";
       return Status(ss.str());
     }
   }
 
-  RETURN_IF_ERROR(SerDeUtils::ReadBoolean(current_byte_stream_, &is_compressed_));
+  RETURN_IF_FALSE(
+      SerDeUtils::ReadBoolean(context_, &header_->is_compressed, &parse_status_));
 
-  if (version_ == SEQ6) {
+  if (header_->version == SEQ6) {
     // Read the is_blk_compressed header field. This field should *always*
     // be FALSE, and is the result of a defect in the original RCFile
     // implementation contained in Hive.
     bool is_blk_compressed;
-    RETURN_IF_ERROR(SerDeUtils::ReadBoolean(current_byte_stream_, &is_blk_compressed));
+    RETURN_IF_FALSE(
+        SerDeUtils::ReadBoolean(context_, &is_blk_compressed, &parse_status_));
     if (is_blk_compressed) {
       stringstream ss;
       ss << "RC files do no support block compression, set in: '"
-         << current_byte_stream_->GetLocation() << "'";
+         << context_->filename() << "'";
       return Status(ss.str());
     }
   }
 
-  vector<char> codec;
-  if (is_compressed_) {
-    // Read the codec and get the right decompressor class.
-    RETURN_IF_ERROR(SerDeUtils::ReadText(current_byte_stream_, &codec));
-    string codec_str(&codec[0], codec.size());
-    RETURN_IF_ERROR(Codec::CreateDecompressor(state_,
-        column_buffer_pool_.get(), !has_noncompact_strings_, codec_str, &decompressor_));
+  if (header_->is_compressed) {
+    // Read the codec, the decompressor is created for each scan range.
+    uint8_t* codec_ptr;
+    int len;
+    RETURN_IF_FALSE(SerDeUtils::ReadText(context_, &codec_ptr, &len, &parse_status_));
+    header_->codec = string(reinterpret_cast<char*>(codec_ptr), len);
   }
 
-  VLOG_FILE << current_byte_stream_->GetLocation() << ": "
-            << (is_compressed_ ?  "block compressed" : "not compressed");
-  if (is_compressed_) VLOG_FILE << string(&codec[0], codec.size());
+  VLOG_FILE << context_->filename() << ": "
+            << (header_->is_compressed ?  "block compressed" : "not compressed");
+  if (header_->is_compressed) VLOG_FILE << header_->codec;
 
   RETURN_IF_ERROR(ReadFileHeaderMetadata());
 
-  RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-      HdfsRCFileScanner::SYNC_HASH_SIZE, &sync_hash_[0]));
+  uint8_t* sync;
+  RETURN_IF_FALSE(SerDeUtils::ReadBytes(context_, SYNC_HASH_SIZE, &sync, &parse_status_));
+  memcpy(header_->sync, sync, SYNC_HASH_SIZE);
+
+  header_->header_size = context_->total_bytes_returned();
   return Status::OK;
 }
 
 Status HdfsRCFileScanner::ReadFileHeaderMetadata() {
   int map_size = 0;
-  vector<char> key;
-  vector<char> value;
-
-  RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &map_size));
+  RETURN_IF_FALSE(SerDeUtils::ReadInt(context_, &map_size, &parse_status_));
 
   for (int i = 0; i < map_size; ++i) {
-    RETURN_IF_ERROR(SerDeUtils::ReadText(current_byte_stream_, &key));
-    RETURN_IF_ERROR(SerDeUtils::ReadText(current_byte_stream_, &value));
-
-    if (!strncmp(&key[0], HdfsRCFileScanner::RCFILE_METADATA_KEY_NUM_COLS,
-        strlen(HdfsRCFileScanner::RCFILE_METADATA_KEY_NUM_COLS))) {
-      string tmp(&value[0], value.size());
+    uint8_t* key;
+    int key_len;
+    RETURN_IF_FALSE(SerDeUtils::ReadText(context_, &key, &key_len, &parse_status_));
+    bool is_num_cols = key_len == strlen(HdfsRCFileScanner::RCFILE_METADATA_KEY_NUM_COLS)
+        && !memcmp(key, HdfsRCFileScanner::RCFILE_METADATA_KEY_NUM_COLS, key_len);
+
+    uint8_t* value;
+    int value_len;
+    RETURN_IF_FALSE(SerDeUtils::ReadText(context_, &value, &value_len, &parse_status_));
+    if (is_num_cols) {
+      string tmp(reinterpret_cast<char*>(value), value_len);
       int file_num_cols = atoi(tmp.c_str());
       if (file_num_cols != num_cols_) {
         return Status("Unexpected hive.io.rcfile.column.number value!");
@@ -259,19 +316,18 @@ Status HdfsRCFileScanner::ReadFileHeaderMetadata() {
 }
 
 Status HdfsRCFileScanner::ReadSync() {
-  uint8_t hash[HdfsRCFileScanner::SYNC_HASH_SIZE];
-  RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-      HdfsRCFileScanner::SYNC_HASH_SIZE, &hash[0]));
-  if (memcmp(&hash[0], &sync_hash_[0], HdfsRCFileScanner::SYNC_HASH_SIZE)) {
+  uint8_t* hash;
+  RETURN_IF_FALSE(SerDeUtils::ReadBytes(context_, SYNC_HASH_SIZE, &hash, &parse_status_));
+  if (memcmp(hash, header_->sync, SYNC_HASH_SIZE)) {
     if (state_->LogHasSpace()) {
       stringstream ss;
       ss  << "Bad sync hash in current HdfsRCFileScanner: "
-          << current_byte_stream_->GetLocation() << "." << endl
+          << context_->filename() << "." << endl
           << "Expected: '"
-          << SerDeUtils::HexDump(sync_hash_, HdfsRCFileScanner::SYNC_HASH_SIZE)
+          << SerDeUtils::HexDump(header_->sync, SYNC_HASH_SIZE)
           << "'" << endl
           << "Actual:   '"
-          << SerDeUtils::HexDump(hash, HdfsRCFileScanner::SYNC_HASH_SIZE)
+          << SerDeUtils::HexDump(hash, SYNC_HASH_SIZE)
           << "'" << endl;
       state_->LogError(ss.str());
     }
@@ -297,79 +353,43 @@ void HdfsRCFileScanner::ResetRowGroup() {
   memset(col_buf_pos_, 0, num_cols_ * sizeof(int32_t));
 }
 
-Status HdfsRCFileScanner::ReadRowGroup() {
+Status HdfsRCFileScanner::ReadRowGroup(int32_t record_length) {
   ResetRowGroup();
-  int64_t position;
-  bool eof;
-
-  while (num_rows_ == 0) {
-    RETURN_IF_ERROR(ReadHeader());
-    RETURN_IF_ERROR(ReadKeyBuffers());
-    if (has_noncompact_strings_ || previous_total_length_ < total_col_length_) {
-      column_buffer_ = column_buffer_pool_->Allocate(total_col_length_);
-      previous_total_length_ = total_col_length_;
-    }
-    RETURN_IF_ERROR(ReadColumnBuffers());
-    RETURN_IF_ERROR(current_byte_stream_->GetPosition(&position));
-    if (position >= end_of_scan_range_) {
-      RETURN_IF_ERROR(current_byte_stream_->Eof(&eof));
-      if (eof) {
-        scan_range_fully_buffered_ = true;
-        break;
-      }
-
-      // We must read up to the next sync marker.
-      int32_t record_length;
-      RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &record_length));
-      if (record_length == HdfsRCFileScanner::SYNC_MARKER) {
-        // If the marker is there, it's an error not to have a Sync block following the
-        // Marker.
-        RETURN_IF_ERROR(ReadSync());
-        scan_range_fully_buffered_ = true;
-        break;
-      } else {
-        RETURN_IF_ERROR(current_byte_stream_->Seek(position));
-      }
-    }
+  RETURN_IF_ERROR(ReadHeader(record_length));
+  RETURN_IF_ERROR(ReadKeyBuffers());
+  if (has_noncompact_strings_ || previous_total_length_ < total_col_length_) {
+    // The rows of the previous row groups point into the column buffers if the
+    // strings are not copied, so pass them on with the current batch.
+    if (has_noncompact_strings_) context_->AcquirePool(column_buffer_pool_.get());
+    column_buffer_ = column_buffer_pool_->Allocate(total_col_length_);
+    previous_total_length_ = total_col_length_;
   }
+  RETURN_IF_ERROR(ReadColumnBuffers());
   return Status::OK;
 }
 
-Status HdfsRCFileScanner::ReadHeader() {
-  int32_t record_length;
-  RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &record_length));
-  // The sync block is marked with a record_length of -1.
-  if (record_length == HdfsRCFileScanner::SYNC_MARKER) {
-    RETURN_IF_ERROR(ReadSync());
-    RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &record_length));
-  }
+Status HdfsRCFileScanner::ReadHeader(int32_t record_length) {
   if (record_length < 0) {
     stringstream ss;
-    int64_t position;
-    current_byte_stream_->GetPosition(&position);
-    position -= sizeof(int32_t);
+    int64_t position = context_->file_offset() - sizeof(int32_t);
     ss << "Bad record length: " << record_length << " in file: "
-        << current_byte_stream_->GetLocation() << " at offset: " << position;
+        << context_->filename() << " at offset: " << position;
     return Status(ss.str());
   }
-  RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &key_length_));
+  RETURN_IF_FALSE(SerDeUtils::ReadInt(context_, &key_length_, &parse_status_));
   if (key_length_ < 0) {
     stringstream ss;
-    int64_t position;
-    current_byte_stream_->GetPosition(&position);
-    position -= sizeof(int32_t);
+    int64_t position = context_->file_offset() - sizeof(int32_t);
     ss << "Bad key length: " << key_length_ << " in file: "
-        << current_byte_stream_->GetLocation() << " at offset: " << position;
+        << context_->filename() << " at offset: " << position;
     return Status(ss.str());
   }
-  RETURN_IF_ERROR(SerDeUtils::ReadInt(current_byte_stream_, &compressed_key_length_));
+  RETURN_IF_FALSE(SerDeUtils::ReadInt(context_, &compressed_key_length_, &parse_status_));
   if (compressed_key_length_ < 0) {
     stringstream ss;
-    int64_t position;
-    current_byte_stream_->GetPosition(&position);
-    position -= sizeof(int32_t);
+    int64_t position = context_->file_offset() - sizeof(int32_t);
     ss << "Bad compressed key length: " << compressed_key_length_ << " in file: "
-        << current_byte_stream_->GetLocation() << " at offset: " << position;
+        << context_->filename() << " at offset: " << position;
     return Status(ss.str());
   }
   return Status::OK;
@@ -380,18 +400,19 @@ Status HdfsRCFileScanner::ReadKeyBuffers() {
     key_buffer_ = key_buffer_pool_->Allocate(key_length_);
     key_buffer_length_ = key_length_;
   }
-  if (is_compressed_) {
-    if (compressed_data_buffer_length_ < compressed_key_length_) {
-      compressed_data_buffer_ = key_buffer_pool_->Allocate(compressed_key_length_);
-      compressed_data_buffer_length_ = compressed_key_length_;
-    }
-    RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-        compressed_key_length_, compressed_data_buffer_));
+  // The bytes returned by the context are only valid until the next read, and the
+  // column keys are used until the end of the row group, so they are copied (or
+  // decompressed) into key_buffer_.
+  uint8_t* key_data;
+  if (header_->is_compressed) {
+    RETURN_IF_FALSE(SerDeUtils::ReadBytes(context_,
+        compressed_key_length_, &key_data, &parse_status_));
     RETURN_IF_ERROR(decompressor_->ProcessBlock(compressed_key_length_,
-        compressed_data_buffer_, &key_length_, &key_buffer_));
+        key_data, &key_length_, &key_buffer_));
   } else {
-    RETURN_IF_ERROR(
-        SerDeUtils::ReadBytes(current_byte_stream_, key_length_, key_buffer_));
+    RETURN_IF_FALSE(
+        SerDeUtils::ReadBytes(context_, key_length_, &key_data, &parse_status_));
+    memcpy(key_buffer_, key_data, key_length_);
   }
 
   total_col_length_ = 0;
@@ -443,11 +464,9 @@ inline Status HdfsRCFileScanner::NextField(int col_idx) {
     uint8_t* col_key_buf = &col_key_bufs_[col_idx][0];
     int bytes_read = SerDeUtils::GetVLong(col_key_buf, key_buf_pos_[col_idx], &length);
     if (bytes_read == -1) {
-        int64_t position;
-        current_byte_stream_->GetPosition(&position);
         stringstream ss;
         ss << "Invalid column length in file: "
-           << current_byte_stream_->GetLocation() << " at offset: " << position;
+           << context_->filename() << " at offset: " << context_->file_offset();
         if (state_->LogHasSpace()) state_->LogError(ss.str());
         return Status(ss.str());
     }
@@ -481,161 +500,157 @@ inline Status HdfsRCFileScanner::NextRow(bool* eorg) {
   return Status::OK;
 }
 
+// Only the column buffers of materialized slots are read.  The buffers of the
+// columns in between are skipped together, without being copied.
 Status HdfsRCFileScanner::ReadColumnBuffers() {
+  int64_t skip_length = 0;
   for (int col_idx = 0; col_idx < num_cols_; ++col_idx) {
     if (!ReadColumn(col_idx)) {
-      RETURN_IF_ERROR(SerDeUtils::SkipBytes(current_byte_stream_, col_buf_len_[col_idx]));
+      skip_length += col_buf_len_[col_idx];
     } else {
+      if (skip_length > 0) {
+        RETURN_IF_FALSE(context_->SkipBytes(skip_length, &parse_status_));
+        skip_length = 0;
+      }
       // TODO: Stream through these column buffers instead of reading everything
       // in at once.
       DCHECK_LE(
           col_buf_uncompressed_len_[col_idx] + col_bufs_off_[col_idx], total_col_length_);
-      if (is_compressed_) {
-        if (compressed_data_buffer_length_ < col_buf_len_[col_idx]) {
-          compressed_data_buffer_ = key_buffer_pool_->Allocate(col_buf_len_[col_idx]);
-          compressed_data_buffer_length_ = col_buf_len_[col_idx];
-        }
-        RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-            col_buf_len_[col_idx], compressed_data_buffer_));
+      uint8_t* col_data;
+      RETURN_IF_FALSE(SerDeUtils::ReadBytes(context_,
+          col_buf_len_[col_idx], &col_data, &parse_status_));
+      if (header_->is_compressed) {
         uint8_t* compressed_output = column_buffer_ + col_bufs_off_[col_idx];
         RETURN_IF_ERROR(decompressor_->ProcessBlock(col_buf_len_[col_idx],
-            compressed_data_buffer_, &col_buf_uncompressed_len_[col_idx],
-            &compressed_output));
+            col_data, &col_buf_uncompressed_len_[col_idx], &compressed_output));
       } else {
-        RETURN_IF_ERROR(SerDeUtils::ReadBytes(current_byte_stream_,
-            col_buf_len_[col_idx], column_buffer_ + col_bufs_off_[col_idx]));
+        memcpy(column_buffer_ + col_bufs_off_[col_idx], col_data, col_buf_len_[col_idx]);
       }
     }
   }
+  if (skip_length > 0) {
+    RETURN_IF_FALSE(context_->SkipBytes(skip_length, &parse_status_));
+  }
   return Status::OK;
 }
 
-// TODO: We should be able to skip over badly fomrated data and move to the
-//       next sync block to restart the scan.
-Status HdfsRCFileScanner::GetNext(RowBatch* row_batch, bool* eosr) {
-  AllocateTupleBuffer(row_batch);
-  // Indicates whether the current row has errors.
-  bool error_in_row = false;
+// Reads the row groups until the first sync past the end of the scan range.  The
+// row groups after that sync are read by the scanner of the next range.
+Status HdfsRCFileScanner::ProcessRange() {
+  while (!scan_node_->ReachedLimit()) {
+    if (context_->cancelled()) return Status::CANCELLED;
+
+    bool past_end = context_->eosr();
+    int32_t record_length;
+    if (have_sync_) {
+      // SkipToSync() already read past the sync of the first row group.
+      have_sync_ = false;
+      RETURN_IF_FALSE(SerDeUtils::ReadInt(context_, &record_length, &parse_status_));
+    } else {
+      // The file may only end before the record length of a row group.
+      uint8_t* buffer;
+      int len;
+      bool eos;
+      RETURN_IF_FALSE(
+          context_->GetBytes(&buffer, sizeof(int32_t), &len, &eos, &parse_status_));
+      if (len == 0) break;
+      if (len != sizeof(int32_t)) {
+        stringstream ss;
+        ss << "Truncated row group header in file: " << context_->filename();
+        return Status(ss.str());
+      }
+      record_length = SerDeUtils::GetInt(buffer);
 
-  if (scan_node_->ReachedLimit()) {
-    tuple_ = NULL;
-    *eosr = true;
-    return Status::OK;
+      // The sync block is marked with a record_length of -1.
+      if (record_length == HdfsRCFileScanner::SYNC_MARKER) {
+        if (past_end) break;
+        RETURN_IF_ERROR(ReadSync());
+        RETURN_IF_FALSE(SerDeUtils::ReadInt(context_, &record_length, &parse_status_));
+      }
+    }
+
+    RETURN_IF_ERROR(ReadRowGroup(record_length));
+    RETURN_IF_ERROR(ProcessRowGroup());
   }
+  return Status::OK;
+}
 
+// The field locations of the materialized columns of a batch of rows are collected
+// first and the rows are then written with the (codegen'd) WriteAlignedTuples().
+Status HdfsRCFileScanner::ProcessRowGroup() {
+  const vector<SlotDescriptor*>& materialized_slots = scan_node_->materialized_slots();
+  int num_slots = materialized_slots.size();
 
-  // HdfsRCFileScanner effectively does buffered IO, in that it reads the
-  // rcfile into a column buffer, and sets an eof marker at that
-  // point, before the buffer is drained.
-  // In the following loop, eosr tracks the end of stream flag that
-  // tells the scan node to move onto the next scan range.
-  // scan_range_fully_buffered_ is set once the RC file has been fully
-  // read into RCRowGroups.
-  while (!scan_node_->ReachedLimit() && !row_batch->IsFull() && !(*eosr)) {
-    if (num_rows_ == row_pos_) {
-      // scan_range_fully_buffered_ is set iff the scan range has been
-      // exhausted due to a previous read.
-      if (scan_range_fully_buffered_) {
-        *eosr = true;
-        break;
-      }
-      RETURN_IF_ERROR(ReadRowGroup());
+  while (row_pos_ < num_rows_ && !scan_node_->ReachedLimit()) {
+    if (context_->cancelled()) return Status::CANCELLED;
 
-      if (num_rows_ == 0) break;
+    TupleRow* current_row;
+    int max_tuples = context_->GetMemory(&tuple_pool_, &tuple_, &current_row);
+    int num_rows = min(max_tuples, num_rows_ - row_pos_);
+
+    if (materialized_slots.empty()) {
+      // Handle case where there are no slots to materialize (e.g. count(*))
+      row_pos_ += num_rows;
+      context_->CommitRows(WriteEmptyTuples(context_, current_row, num_rows));
+      continue;
     }
 
     SCOPED_TIMER(scan_node_->materialize_tuple_timer());
-    // Copy rows out of the current row group into the row_batch
-    while (!scan_node_->ReachedLimit() && !row_batch->IsFull()) {
+    DCHECK_LE(num_rows * num_slots, field_locations_.size());
+    FieldLocation* fields = &field_locations_[0];
+    for (int i = 0; i < num_rows; ++i) {
       bool eorg = false;
       RETURN_IF_ERROR(NextRow(&eorg));
-      if (eorg) break;
-
-      // Index into current row in row_batch.
-      int row_idx = row_batch->AddRow();
-      DCHECK(row_idx != RowBatch::INVALID_ROW_INDEX);
-      TupleRow* current_row = row_batch->GetRow(row_idx);
-      current_row->SetTuple(scan_node_->tuple_idx(), tuple_);
-      // Initialize tuple_ from the partition key template tuple before writing the
-      // slots
-      InitTuple(template_tuple_, tuple_);
-
-      const vector<SlotDescriptor*>& materialized_slots = 
-          scan_node_->materialized_slots();
-      vector<SlotDescriptor*>::const_iterator it;
-
-      for (it = materialized_slots.begin(); it != materialized_slots.end(); ++it) {
-        const SlotDescriptor* slot_desc = *it;
-        int rc_column_idx = slot_desc->col_pos() - scan_node_->num_partition_keys();
-
-        const char* col_start = reinterpret_cast<const char*>(&((column_buffer_ +
-            col_bufs_off_[rc_column_idx])[col_buf_pos_[rc_column_idx]]));
-        int field_len = cur_field_length_[rc_column_idx];
-        DCHECK_LE(col_start + field_len,
-            reinterpret_cast<const char*>(column_buffer_ + total_col_length_));
-
-        if (!text_converter_->WriteSlot(slot_desc, tuple_, 
-              col_start, field_len, !has_noncompact_strings_, false, tuple_pool_)) {
-          ReportColumnParseError(slot_desc, col_start, field_len);
-          error_in_row = true;
-        }
+      DCHECK(!eorg);
+
+      for (int j = 0; j < num_slots; ++j) {
+        int rc_column_idx =
+            materialized_slots[j]->col_pos() - scan_node_->num_partition_keys();
+        fields->start = reinterpret_cast<char*>(column_buffer_ +
+            col_bufs_off_[rc_column_idx] + col_buf_pos_[rc_column_idx]);
+        fields->len = cur_field_length_[rc_column_idx];
+        DCHECK_LE(fields->start + fields->len,
+            reinterpret_cast<char*>(column_buffer_ + total_col_length_));
+        ++fields;
       }
+    }
 
-      if (error_in_row) {
-        error_in_row = false;
-        if (state_->LogHasSpace()) {
-          stringstream ss;
-          ss << "file: " << current_byte_stream_->GetLocation();
-          state_->LogError(ss.str());
-        }
-        if (state_->abort_on_error()) {
-          state_->ReportFileErrors(current_byte_stream_->GetLocation(), 1);
-          return Status(state_->ErrorLog());
-        }
-      }
+    int max_added_tuples = (scan_node_->limit() == -1) ?
+          num_rows : scan_node_->limit() - scan_node_->rows_returned();
 
-      // Evaluate the conjuncts and add the row to the batch
-      if (ExecNode::EvalConjuncts(conjuncts_, num_conjuncts_, current_row)) {
-        row_batch->CommitLastRow();
-        if (scan_node_->ReachedLimit() || row_batch->IsFull()) {
-          tuple_ = NULL;
-          return Status::OK;
-        }
-        char* new_tuple = reinterpret_cast<char*>(tuple_);
-        new_tuple += tuple_byte_size_;
-        tuple_ = reinterpret_cast<Tuple*>(new_tuple);
-      }
+    // Call jitted function if possible
+    int tuples_returned;
+    if (write_tuples_fn_ != NULL) {
+      tuples_returned = write_tuples_fn_(this, tuple_pool_, current_row,
+          context_->row_byte_size(), &field_locations_[0], num_rows,
+          max_added_tuples, num_slots, 0);
+    } else {
+      tuples_returned = WriteAlignedTuples(tuple_pool_, current_row,
+          context_->row_byte_size(), &field_locations_[0], num_rows,
+          max_added_tuples, num_slots, 0);
     }
-  }
 
-  // Note that number of rows remaining == 0 -> scan_range_fully_buffered_
-  // at this point, hence we don't need to explicitly check that
-  // scan_range_fully_buffered_ == true.
-  if (scan_node_->ReachedLimit() || num_rows_ == 0 || num_rows_ == row_pos_) {
-    // We reached the limit, drained the row group or hit the end of the table.
-    // No more work to be done. Clean up all pools with the last row batch.
-    *eosr = true;
-  } else {
-    DCHECK(row_batch->IsFull());
-    // The current row_batch is full, but we haven't yet reached our limit.
-    // Hang on to the last chunks. We'll continue from there in the next
-    // call to GetNext().
-    *eosr = false;
-  }
-  // Maintian ownership of last memory chunk if not at the end of the scan range.
-  if (has_noncompact_strings_) {
-    row_batch->tuple_data_pool()->AcquireData(column_buffer_pool_.get(), !*eosr);
+    if (tuples_returned == -1) return parse_status_;
+    context_->CommitRows(tuples_returned);
   }
-  row_batch->tuple_data_pool()->AcquireData(tuple_pool_, !*eosr);
-
   return Status::OK;
 }
 
+void HdfsRCFileScanner::LogRowParseError(stringstream* ss, int row_idx) {
+  DCHECK(state_->LogHasSpace());
+  int num_slots = scan_node_->materialized_slots().size();
+  const FieldLocation* fields = &field_locations_[row_idx * num_slots];
+  for (int i = 0; i < num_slots; ++i) {
+    if (i > 0) *ss << ",";
+    *ss << string(fields[i].start, fields[i].len);
+  }
+}
+
 void HdfsRCFileScanner::DebugString(int indentation_level, stringstream* out) const {
   // TODO: Add more details of internal state.
   *out << string(indentation_level * 2, ' ');
   *out << "HdfsRCFileScanner(tupleid=" << scan_node_->tuple_idx() <<
-    " file=" << current_byte_stream_->GetLocation();
+    " file=" << context_->filename();
   // TODO: Scanner::DebugString
   //  ExecNode::DebugString(indentation_level, out);
   *out << "])" << endl;
@@ -18,7 +18,6 @@
 
 #include "util/codec.h"
 #include "exec/hdfs-scanner.h"
-#include "exec/delimited-text-parser.h"
 
 // org.apache.hadoop.hive.ql.io.RCFile is the original RCFile implementation
 // and should be viewed as the canonical definition of this format. If
@@ -221,6 +220,14 @@
 // is not used by the query is skipped and not read from the file.  The key data
 // and the column data my be compressed.  The key data is compressed in a single
 // block while the column data is compressed separately by column.
+//
+// Like sequence files, the file header range is issued first and parsed by its own
+// scanner, which then issues the scan ranges of the file.  A scan range starts at the
+// first sync in it and includes all row groups up to the first sync after its end.
+// The row groups of a range are read sequentially from its ScanRangeContext, so the
+// io mgr reads ahead while the scanner decodes the current row group.  The column
+// data is interleaved within each row group, so the chunks of the columns that are
+// not read are skipped over in the context rather than issued as separate reads.
 
 namespace impala {
 
@@ -231,14 +238,18 @@ class Tuple;
 // A scanner for reading RCFiles into tuples. 
 class HdfsRCFileScanner : public HdfsScanner {
  public:
-  HdfsRCFileScanner(HdfsScanNode* scan_node, RuntimeState* state, MemPool* tuple_pool);
+  HdfsRCFileScanner(HdfsScanNode* scan_node, RuntimeState* state);
   virtual ~HdfsRCFileScanner();
-  virtual Status GetNext(RowBatch* row_batch, bool* eos);
   virtual Status Prepare();
-  virtual Status InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition, 
-      DiskIoMgr::ScanRange* scan_range, Tuple* template_tuple, ByteStream* byte_stream);
+  virtual Status ProcessScanRange(ScanRangeContext* context);
   virtual Status Close();
 
+  // Issue the initial scan ranges for all rc files.
+  static void IssueInitialRanges(HdfsScanNode*, const std::vector<HdfsFileDesc*>&);
+
+  // Codegen writing tuples and evaluating predicates
+  static llvm::Function* Codegen(HdfsScanNode*);
+
   void DebugString(int indentation_level, std::stringstream* out) const;
 
  private:
@@ -264,16 +275,47 @@ class HdfsRCFileScanner : public HdfsScanner {
   // of the file {'R', 'C', 'F' 1} 
   static const uint8_t RCFILE_VERSION_HEADER[4];
 
-  // read the current RCFile header
+  // Estimate of header size in bytes.  If this is not big enough, the scanner will
+  // read more as necessary.
+  static const int HEADER_SIZE;
+
+  enum Version {
+    SEQ6,     // The version pre hive-0.9 which uses the seq header
+    RCF1      // The version post hive-0.9 which uses a new header
+  };
+
+  // Data that is fixed across headers.  This struct is shared between scan ranges.
+  struct FileHeader {
+    Version version;
+
+    // true if the RCFile is compressed
+    bool is_compressed;
+
+    // Codec name if it is compressed.
+    std::string codec;
+
+    // The sync hash read in from the file header.
+    uint8_t sync[SYNC_HASH_SIZE];
+
+    // End of the header block so we don't have to reparse it.
+    int64_t header_size;
+  };
+
+  // Issue the scan ranges of the file, once its header is parsed.
+  void IssueFileRanges(const char* filename);
+
+  // Initialize the state for a new scan range.
+  Status InitNewRange();
+
+  // Process the row groups of the range.
+  Status ProcessRange();
+
+  // read the current RCFile header into header_
   // Verifies:
   //   version
   //   key class
   //   value class
   //   number of columns
-  // Sets:
-  //   is_compressed_
-  //   decompressor_
-  //   sync_hash_
   Status ReadFileHeader();
 
   // read the RCFile Header Metadata section in the current file
@@ -282,14 +324,11 @@ class HdfsRCFileScanner : public HdfsScanner {
   //   hive.io.rcfile.column.number
   Status ReadFileHeaderMetadata();
 
-  // Read the rowgroup header
-  // Verifies:
-  //   sync hash if pressent.
+  // Read the rest of the rowgroup header, after the record_length.
   // Sets:
   //   key_length_
   //   compressed_key_length_
-  //   num_rows_
-  Status ReadHeader();
+  Status ReadHeader(int32_t record_length);
 
   // Read and validate the rowgroup sync field
   Status ReadSync();
@@ -334,7 +373,10 @@ class HdfsRCFileScanner : public HdfsScanner {
   //   ReadHeader
   //   ReadKeyBuffers
   //   ReadColumnBuffers
-  Status ReadRowGroup();
+  Status ReadRowGroup(int32_t record_length);
+
+  // Materialize the rows of the current row group and commit them to the context.
+  Status ProcessRowGroup();
 
   // Move to next row. Return false if we were at the last row.
   // Calls NexField on each column that we are reading.
@@ -346,45 +388,24 @@ class HdfsRCFileScanner : public HdfsScanner {
   // Reset the Row Group information.
   void ResetRowGroup();
 
+  // Logs the materialized fields of row row_idx of the last rows written from
+  // field_locations_.
+  virtual void LogRowParseError(std::stringstream*, int row_idx);
+
   // Returns whether or not column at col_idx should be read
   bool ReadColumn(int col_idx) {
     col_idx += scan_node_->num_partition_keys();
     return scan_node_->GetMaterializedSlotIdx(col_idx) != HdfsScanNode::SKIP_COLUMN;
   }
 
-  // Helper class for converting text to other types;
-  boost::scoped_ptr<TextConverter> text_converter_;
-
-  // Parser to find the first record block.
-  boost::scoped_ptr<DelimitedTextParser> find_first_parser_;
-
-  // Location (file name) of previous scan range.
-  std::string previous_location_;
-
-  enum Version {
-    SEQ6,     // The version pre hive-0.9 which uses the seq header
-    RCF1      // The version post hive-0.9 which uses a new header
-  };
-
-  Version version_;
-
-  // Offset to end of file header.
-  int64_t header_end_;
-
-  // End of the scan range.
-  int end_of_scan_range_;
+  // If true, this scanner is only processing the header bytes.
+  bool only_parsing_header_;
 
-  // Guard variable to prevent reading again from RCFileReader when
-  // the file is exhausted but not all rows have been materialised
-  // from the row group. Reset to false with every
-  // InitCurrentScanRange.
-  bool scan_range_fully_buffered_;
+  // Header for this scan range.  Memory is owned by the parent scan node.
+  FileHeader* header_;
 
-  // true if the current RCFile is compressed
-  bool is_compressed_;
-
-  // The sync_hash_ from the file header.
-  uint8_t sync_hash_[SYNC_HASH_SIZE];
+  // If true, SkipToSync() also read the sync of the first row group.
+  bool have_sync_;
 
   // number of columns in this rowgroup object
   int num_cols_;
@@ -427,12 +448,6 @@ class HdfsRCFileScanner : public HdfsScanner {
   // Length of key_buffer_.
   int key_buffer_length_;
 
-  // Temporary buffer for compressed data. Allocated from key_buffer_pool_.
-  uint8_t* compressed_data_buffer_;
-
-  // Length of the compressed data buffer.
-  int compressed_data_buffer_length_;
-
   // Current position in the key buffer, by column
   int32_t* key_buf_pos_;
 
@@ -459,6 +474,11 @@ class HdfsRCFileScanner : public HdfsScanner {
 
   // Column buffer byte offset, by column.
   int32_t* col_buf_pos_;
+
+  // Locations of the materialized fields of the rows being written, in the order of
+  // the materialized slots.  The rows are materialized from these with
+  // WriteAlignedTuples(), like the delimited text formats.
+  std::vector<FieldLocation> field_locations_;
 };
 
 }
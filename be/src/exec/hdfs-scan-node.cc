@@ -17,30 +17,45 @@
 #include "exec/hdfs-sequence-scanner.h"
 #include "exec/hdfs-rcfile-scanner.h"
 #include "exec/hdfs-trevni-scanner.h"
-#include "exec/hdfs-byte-stream.h"
 
+#include <algorithm>
 #include <sstream>
 #include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
 
 #include "codegen/llvm-codegen.h"
 #include "common/logging.h"
 #include "common/object-pool.h"
+#include "exec/batch-conjunct-evaluator.h"
 #include "exec/scan-range-context.h"
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "runtime/descriptors.h"
+#include "runtime/exec-env.h"
 #include "runtime/hdfs-fs-cache.h"
 #include "runtime/runtime-state.h"
 #include "runtime/mem-pool.h"
 #include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
+#include "util/bloom-filter.h"
+#include "util/cgroup-util.h"
+#include "util/cpu-info.h"
 #include "util/debug-util.h"
+#include "util/hash-util.h"
 #include "util/runtime-profile.h"
+#include "util/thread-tokens.h"
 
 #include "gen-cpp/PlanNodes_types.h"
 
 // TODO: temp change to validate we don't have an incast problem for joins with big tables
 DEFINE_bool(randomize_scan_ranges, false, 
     "if true, randomizes the order of scan ranges");
+// Bounds for the adjustment of scanner threads and io buffers (see
+// AdjustScannerThreads()).
+DEFINE_int32(max_queued_row_batches, 10, "Number of row batches a scan node queues "
+    "for its consumer before it lowers the number of scanner threads.");
+DEFINE_int32(max_io_buffers_per_disk, 10, "Maximum number of io buffers per disk a "
+    "scan node raises its reader to when its scanners wait for io.");
 
 using namespace boost;
 using namespace impala;
@@ -53,21 +68,41 @@ HdfsScanNode::HdfsScanNode(ObjectPool* pool, const TPlanNode& tnode,
       thrift_plan_node_(new TPlanNode(tnode)),
       tuple_id_(tnode.hdfs_scan_node.tuple_id),
       compact_data_(tnode.compact_data),
+      row_batch_capacity_(0),
       reader_context_(NULL),
       tuple_desc_(NULL),
       unknown_disk_id_warned_(false),
-      tuple_pool_(new MemPool()),
+      sample_percent_(100),
+      sample_seed_(0),
       num_unqueued_files_(0),
       scanner_pool_(new ObjectPool()),
-      current_scanner_(NULL),
-      current_byte_stream_(NULL),
       num_partition_keys_(0),
+      thread_pool_(NULL),
+      adaptive_scanner_threads_(false),
+      scanner_threads_target_(0),
+      io_buffers_per_disk_(0),
+      last_adjustment_time_(0),
+      last_io_wait_time_(0),
+      scanner_io_wait_timer_(NULL),
+      scanner_threads_target_counter_(NULL),
+      io_buffers_per_disk_counter_(NULL),
+      batch_partition_id_(-1),
       done_(false),
       partition_key_pool_(new MemPool()),
       next_range_to_issue_idx_(0),
       all_ranges_in_queue_(false),
       ranges_in_flight_(0),
-      all_ranges_issued_(false) {
+      thread_tokens_(NULL),
+      num_thread_tokens_(0),
+      all_ranges_issued_(false),
+      runtime_filter_rows_rejected_counter_(NULL),
+      files_pruned_counter_(NULL),
+      scan_range_time_(NULL),
+      scanner_thread_counters_(NULL) {
+  if (tnode.hdfs_scan_node.__isset.sample_percent) {
+    sample_percent_ = tnode.hdfs_scan_node.sample_percent;
+    sample_seed_ = tnode.hdfs_scan_node.sample_seed;
+  }
 }
 
 HdfsScanNode::~HdfsScanNode() {
@@ -76,6 +111,7 @@ HdfsScanNode::~HdfsScanNode() {
 Status HdfsScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
 
   {
     unique_lock<recursive_mutex> l(lock_);
@@ -98,6 +134,8 @@ Status HdfsScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos
     if (!materialized_row_batches_.empty()) {
       RowBatch* materialized_batch = materialized_row_batches_.front();
       materialized_row_batches_.pop_front();
+      batch_partition_id_ = materialized_batch_partitions_.front();
+      materialized_batch_partitions_.pop_front();
 
       row_batch->Swap(materialized_batch);
       // Update the number of materialized rows instead of when they are materialized.
@@ -126,37 +164,8 @@ Status HdfsScanNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos
     }
   } 
 
-  // TODO: remove when all scanners are updated to use io mgr.
-  if (current_scanner_ == NULL) {
-    RETURN_IF_ERROR(InitNextScanRange(state, eos));
-    if (*eos) return Status::OK;
-  }
-
-  // Loops until all the scan ranges are complete or batch is full
-  *eos = false;
-  do {
-    bool eosr = false;
-    RETURN_IF_ERROR(current_scanner_->GetNext(row_batch, &eosr));
-    RETURN_IF_CANCELLED(state);
-
-    num_rows_returned_ += row_batch->num_rows();
-    COUNTER_SET(rows_returned_counter_, num_rows_returned_);
-
-    if (ReachedLimit()) {
-      *eos = true;
-      return Status::OK;
-    }
-
-    if (eosr) { // Current scan range is finished
-      ++current_range_idx_;
-
-      // Will update file and current_file_scan_ranges_ so that subsequent check passes
-      RETURN_IF_ERROR(InitNextScanRange(state, eos));
-      // Done with all files
-      if (*eos) break;
-    }
-  } while (!row_batch->IsFull());
-
+  // All scan ranges are complete.
+  *eos = true;
   return Status::OK;
 }
 
@@ -166,6 +175,7 @@ Status HdfsScanNode::CreateConjuncts(vector<Expr*>* expr) {
   // TODO: we really need to stop having to create copies of exprs
   RETURN_IF_ERROR(Expr::CreateExprTrees(runtime_state_->obj_pool(), 
       thrift_plan_node_->conjuncts, expr));
+  SharedExpr::EliminateCommonSubExprs(runtime_state_->obj_pool(), expr);
   for (int i = 0; i < expr->size(); ++i) {
     RETURN_IF_ERROR(Expr::Prepare((*expr)[i], runtime_state_, row_desc(), true));
   }
@@ -173,16 +183,30 @@ Status HdfsScanNode::CreateConjuncts(vector<Expr*>* expr) {
 }
 
 Status HdfsScanNode::SetScanRanges(const vector<TScanRangeParams>& scan_range_params) {
+  int num_sampled_ranges = 0;
+  int64_t sampled_bytes = 0;
+  int64_t total_bytes = 0;
   // Convert the input ranges into per file DiskIO::ScanRange objects
   for (int i = 0; i < scan_range_params.size(); ++i) {
     DCHECK(scan_range_params[i].scan_range.__isset.hdfs_file_split);
     const THdfsFileSplit& split = scan_range_params[i].scan_range.hdfs_file_split;
     const string& path = split.path;
+    total_bytes += split.length;
+    if (sample_percent_ < 100) {
+      // The selection only depends on the range, not on the instance that was assigned
+      // the range; FvnHash() is the same on all backends, unlike the crc hash.
+      uint32_t hash = HashUtil::FvnHash(path.data(), path.size(), sample_seed_);
+      hash = HashUtil::FvnHash(&split.offset, sizeof(split.offset), hash);
+      if (static_cast<int>(hash % 100) >= sample_percent_) continue;
+    }
+    ++num_sampled_ranges;
+    sampled_bytes += split.length;
 
     HdfsFileDesc* desc = NULL;
     ScanRangeMap::iterator desc_it = per_file_scan_ranges_.find(path);
     if (desc_it == per_file_scan_ranges_.end()) {
-      desc = runtime_state_->obj_pool()->Add(new HdfsFileDesc(path));
+      desc = runtime_state_->obj_pool()->Add(
+          new HdfsFileDesc(path, split.__isset.mtime ? split.mtime : 0));
       per_file_scan_ranges_[path] = desc;
     } else {
       desc = desc_it->second;
@@ -195,13 +219,58 @@ Status HdfsScanNode::SetScanRanges(const vector<TScanRangeParams>& scan_range_pa
     }
 
     desc->ranges.push_back(AllocateScanRange(desc->filename.c_str(), 
-       split.length, split.offset, split.partition_id, scan_range_params[i].volume_id));
+       split.length, split.offset, split.partition_id, scan_range_params[i].volume_id,
+       desc->mtime));
+  }
+  if (sample_percent_ < 100) {
+    stringstream ss;
+    ss << sample_percent_ << "% requested, " << num_sampled_ranges << " of "
+       << scan_range_params.size() << " ranges read ("
+       << PrettyPrinter::Print(sampled_bytes, TCounterType::BYTES) << " of "
+       << PrettyPrinter::Print(total_bytes, TCounterType::BYTES) << ")";
+    runtime_profile()->AddInfoString("SamplingRatio", ss.str());
   }
   return Status::OK;
 }
 
+void HdfsScanNode::GetPartitionRanges(map<int64_t, string>* ranges) const {
+  // Ranges with the same path come from the same file desc, in the order of the
+  // assignment; sort them so that the description doesn't depend on it.
+  map<int64_t, vector<string> > partition_ranges;
+  for (ScanRangeMap::const_iterator it = per_file_scan_ranges_.begin();
+       it != per_file_scan_ranges_.end(); ++it) {
+    const vector<DiskIoMgr::ScanRange*>& file_ranges = it->second->ranges;
+    for (int i = 0; i < file_ranges.size(); ++i) {
+      stringstream ss;
+      ss << " " << it->first << ":" << file_ranges[i]->offset() << ":"
+         << file_ranges[i]->len();
+      partition_ranges[reinterpret_cast<int64_t>(file_ranges[i]->meta_data())]
+          .push_back(ss.str());
+    }
+  }
+  ranges->clear();
+  for (map<int64_t, vector<string> >::iterator it = partition_ranges.begin();
+       it != partition_ranges.end(); ++it) {
+    sort(it->second.begin(), it->second.end());
+    string& description = (*ranges)[it->first];
+    for (int i = 0; i < it->second.size(); ++i) description += it->second[i];
+  }
+}
+
+void HdfsScanNode::SkipPartitions(const set<int64_t>& partition_ids) {
+  ScanRangeMap::iterator it = per_file_scan_ranges_.begin();
+  while (it != per_file_scan_ranges_.end()) {
+    int64_t partition_id = reinterpret_cast<int64_t>(it->second->ranges[0]->meta_data());
+    if (partition_ids.find(partition_id) != partition_ids.end()) {
+      per_file_scan_ranges_.erase(it++);
+    } else {
+      ++it;
+    }
+  }
+}
+
 DiskIoMgr::ScanRange* HdfsScanNode::AllocateScanRange(const char* file, int64_t len,
-    int64_t offset, int64_t partition_id, int disk_id) {
+    int64_t offset, int64_t partition_id, int disk_id, int64_t mtime) {
   DCHECK_GE(disk_id, -1);
   if (disk_id == -1) {
     // disk id is unknown, assign it a random one.
@@ -215,68 +284,10 @@ DiskIoMgr::ScanRange* HdfsScanNode::AllocateScanRange(const char* file, int64_t
 
   DiskIoMgr::ScanRange* range = 
       runtime_state_->obj_pool()->Add(new DiskIoMgr::ScanRange());
-  range->Reset(file, len, offset, disk_id, reinterpret_cast<void*>(partition_id));
+  range->Reset(file, len, offset, disk_id, reinterpret_cast<void*>(partition_id), mtime);
   return range;
 }
 
-Status HdfsScanNode::InitNextScanRange(RuntimeState* state, bool* scan_ranges_finished) {
-  *scan_ranges_finished = false;
-  while (true) {
-    if (current_file_scan_ranges_ == per_file_scan_ranges_.end()) {
-      // Defensively return if this gets called after all scan ranges are exhausted.
-      *scan_ranges_finished = true;
-      return Status::OK;
-    } else if (current_range_idx_ == current_file_scan_ranges_->second->ranges.size()) {
-      RETURN_IF_ERROR(current_byte_stream_->Close());
-      current_byte_stream_.reset(NULL);
-      ++current_file_scan_ranges_;
-      current_range_idx_ = 0;
-      if (current_file_scan_ranges_ == per_file_scan_ranges_.end()) {
-        *scan_ranges_finished = true;
-        return Status::OK; // We're done; caller will check for this condition and exit
-      }
-    }
-
-    DiskIoMgr::ScanRange* range = 
-        current_file_scan_ranges_->second->ranges[current_range_idx_];
-    int64_t partition_id = reinterpret_cast<int64_t>(range->meta_data());
-    HdfsPartitionDescriptor* partition = hdfs_table_->GetPartition(partition_id);
-
-    if (partition == NULL) {
-      stringstream ss;
-      ss << "Could not find partition with id: " << partition_id;
-      return Status(ss.str());
-    }
-
-    // TODO: HACK.  Skip this file if it uses the io mgr, it is handled very differently
-    if (partition->file_format() == THdfsFileFormat::TEXT ||
-        partition->file_format() == THdfsFileFormat::SEQUENCE_FILE) {
-      ++current_file_scan_ranges_;
-      continue;
-    }
-
-    Tuple* template_tuple = NULL;
-    // Only allocate template_tuple_ if there are partition keys.  The scanners
-    // use template_tuple == NULL to determine if partition keys are necessary
-    if (!partition_key_slots_.empty()) {
-      DCHECK(!partition->partition_key_values().empty());
-      template_tuple = InitTemplateTuple(state, partition->partition_key_values());
-    } 
-
-    if (current_byte_stream_ == NULL) {
-      current_byte_stream_.reset(new HdfsByteStream(hdfs_connection_, this));
-      RETURN_IF_ERROR(current_byte_stream_->Open(current_file_scan_ranges_->first));
-      current_scanner_ = GetScanner(partition);
-      DCHECK(current_scanner_ != NULL);
-    }
-
-    RETURN_IF_ERROR(current_scanner_->InitCurrentScanRange(partition, range, 
-        template_tuple, current_byte_stream_.get()));
-    return Status::OK;
-  }
-  return Status::OK;
-}
-
 HdfsFileDesc* HdfsScanNode::GetFileDesc(const string& filename) {
   DCHECK(per_file_scan_ranges_.find(filename) != per_file_scan_ranges_.end());
   return per_file_scan_ranges_[filename];
@@ -295,22 +306,12 @@ void* HdfsScanNode::GetFileMetadata(const string& filename) {
   return it->second;
 }
 
-Function* HdfsScanNode::GetCodegenFn(THdfsFileFormat::type type) {
-  CodegendFnMap::iterator it = codegend_fn_map_.find(type);
-  if (it == codegend_fn_map_.end()) return NULL;
+void* HdfsScanNode::GetJittedFn(THdfsFileFormat::type type) {
+  JittedFnMap::iterator it = jitted_fn_map_.find(type);
+  if (it == jitted_fn_map_.end()) return NULL;
   return it->second;
 }
 
-HdfsScanner* HdfsScanNode::GetScanner(HdfsPartitionDescriptor* partition) {
-  ScannerMap::iterator scanner_it = scanner_map_.find(partition->file_format());
-  if (scanner_it != scanner_map_.end()) {
-    return scanner_it->second;
-  }
-  HdfsScanner* scanner = CreateScanner(partition);
-  scanner_map_[partition->file_format()] = scanner;
-  return scanner;
-}
-
 HdfsScanner* HdfsScanNode::CreateScanner(HdfsPartitionDescriptor* partition) {
   HdfsScanner* scanner = NULL;
 
@@ -323,10 +324,10 @@ HdfsScanner* HdfsScanNode::CreateScanner(HdfsPartitionDescriptor* partition) {
       scanner = new HdfsSequenceScanner(this, runtime_state_);
       break;
     case THdfsFileFormat::RC_FILE:
-      scanner = new HdfsRCFileScanner(this, runtime_state_, tuple_pool_.get());
+      scanner = new HdfsRCFileScanner(this, runtime_state_);
       break;
     case THdfsFileFormat::TREVNI:
-      scanner = new HdfsTrevniScanner(this, runtime_state_, tuple_pool_.get());
+      scanner = new HdfsTrevniScanner(this, runtime_state_);
       break;
     default:
       DCHECK(false) << "Unknown Hdfs file format type:" << partition->file_format();
@@ -345,7 +346,22 @@ Status HdfsScanNode::Prepare(RuntimeState* state) {
 
   tuple_desc_ = state->desc_tbl().GetTupleDescriptor(tuple_id_);
   DCHECK(tuple_desc_ != NULL);
-  current_range_idx_ = 0;
+  thread_tokens_ = state->scanner_thread_tokens();
+  thread_pool_ = state->exec_env()->scanner_pool();
+  row_batch_capacity_ = state->batch_size(row_desc(), conjuncts_.empty() ? limit_ : -1);
+  runtime_filter_rows_rejected_counter_ = ADD_SHARDED_COUNTER(
+      runtime_profile(), "RowsRejectedByRuntimeFilters", TCounterType::UNIT);
+  files_pruned_counter_ =
+      ADD_COUNTER(runtime_profile(), "FilesPrunedByPartitionKeys", TCounterType::UNIT);
+  scanner_io_wait_timer_ = ADD_SHARDED_COUNTER(
+      runtime_profile(), "ScannerIoWaitTime", TCounterType::CPU_TICKS);
+  scan_range_time_ =
+      runtime_profile()->AddHistogram("ScanRangeTime", TCounterType::CPU_TICKS);
+  scanner_thread_counters_ = runtime_profile()->AddThreadCounters("ScannerThreads");
+  scanner_threads_target_counter_ =
+      ADD_COUNTER(runtime_profile(), "ScannerThreadsTarget", TCounterType::UNIT);
+  io_buffers_per_disk_counter_ =
+      ADD_COUNTER(runtime_profile(), "IoBuffersPerDisk", TCounterType::UNIT);
 
   // One-time initialisation of state that is constant across scan ranges
   DCHECK(tuple_desc_->table_desc() != NULL);
@@ -388,16 +404,100 @@ Status HdfsScanNode::Prepare(RuntimeState* state) {
   }
 
   // Codegen scanner specific functions
-  if (state->llvm_codegen() != NULL) {
-    Function* text_fn = HdfsTextScanner::Codegen(this);
-    Function* seq_fn = HdfsSequenceScanner::Codegen(this);
-    if (text_fn != NULL) codegend_fn_map_[THdfsFileFormat::TEXT] = text_fn;
-    if (seq_fn != NULL) codegend_fn_map_[THdfsFileFormat::SEQUENCE_FILE] = seq_fn;
+  LlvmCodeGen* codegen = state->llvm_codegen();
+  if (codegen != NULL) {
+    map<THdfsFileFormat::type, Function*> codegend_fns;
+    codegend_fns[THdfsFileFormat::TEXT] = HdfsTextScanner::Codegen(this);
+    codegend_fns[THdfsFileFormat::SEQUENCE_FILE] = HdfsSequenceScanner::Codegen(this);
+    codegend_fns[THdfsFileFormat::RC_FILE] = HdfsRCFileScanner::Codegen(this);
+    for (map<THdfsFileFormat::type, Function*>::iterator it = codegend_fns.begin();
+        it != codegend_fns.end(); ++it) {
+      if (it->second == NULL) continue;
+      // The map entries are not moved by later inserts.
+      void** jitted_fn = &jitted_fn_map_[it->first];
+      *jitted_fn = NULL;
+      codegen->AddFunctionToJit(it->second, jitted_fn);
+    }
   }
 
   return Status::OK;
 }
 
+void HdfsScanNode::AddRuntimeFilter(const SlotDescriptor* slot_desc,
+    const BloomFilter* filter) {
+  DCHECK_EQ(slot_desc->parent(), tuple_desc_->id());
+  RuntimeFilter runtime_filter;
+  runtime_filter.slot_desc = slot_desc;
+  runtime_filter.filter = filter;
+  runtime_filters_.push_back(runtime_filter);
+}
+
+void HdfsScanNode::ApplyRuntimeFilters(RowBatch* batch, int start_row) {
+  if (runtime_filters_.empty()) return;
+  int num_rows = start_row;
+  for (int i = start_row; i < batch->num_rows(); ++i) {
+    TupleRow* row = batch->GetRow(i);
+    Tuple* tuple = row->GetTuple(tuple_idx());
+    bool passed = true;
+    for (int j = 0; j < runtime_filters_.size() && passed; ++j) {
+      const SlotDescriptor* slot_desc = runtime_filters_[j].slot_desc;
+      if (tuple->IsNull(slot_desc->null_indicator_offset())) {
+        passed = false;
+      } else {
+        uint32_t hash = RawValue::GetHashValue(
+            tuple->GetSlot(slot_desc->tuple_offset()), slot_desc->type());
+        passed = runtime_filters_[j].filter->Find(hash);
+      }
+    }
+    if (!passed) continue;
+    if (num_rows != i) batch->CopyRow(row, batch->GetRow(num_rows));
+    ++num_rows;
+  }
+  COUNTER_UPDATE(runtime_filter_rows_rejected_counter_, batch->num_rows() - num_rows);
+  batch->set_num_rows(num_rows);
+}
+
+void HdfsScanNode::GetPartitionConjuncts(vector<Expr*>* conjuncts) {
+  if (partition_key_slots_.empty()) return;
+  for (int i = 0; i < conjuncts_.size(); ++i) {
+    if (!conjuncts_[i]->IsDeterministic()) continue;
+    vector<SlotId> slot_ids;
+    conjuncts_[i]->GetSlotIds(&slot_ids);
+    bool partition_keys_only = true;
+    for (int j = 0; j < slot_ids.size() && partition_keys_only; ++j) {
+      partition_keys_only = false;
+      for (int k = 0; k < partition_key_slots_.size(); ++k) {
+        if (partition_key_slots_[k]->id() == slot_ids[j]) {
+          partition_keys_only = true;
+          break;
+        }
+      }
+    }
+    if (partition_keys_only) conjuncts->push_back(conjuncts_[i]);
+  }
+}
+
+bool HdfsScanNode::PartitionPasses(HdfsPartitionDescriptor* partition,
+    const vector<Expr*>& partition_conjuncts) {
+  Tuple* template_tuple = InitTemplateTuple(runtime_state_,
+      partition->partition_key_values());
+  vector<Tuple*> row(row_desc().tuple_descriptors().size(), NULL);
+  row[tuple_idx()] = template_tuple;
+  if (!partition_conjuncts.empty() && !EvalConjuncts(&partition_conjuncts[0],
+      partition_conjuncts.size(), reinterpret_cast<TupleRow*>(&row[0]))) {
+    return false;
+  }
+  for (int i = 0; i < runtime_filters_.size(); ++i) {
+    const SlotDescriptor* slot_desc = runtime_filters_[i].slot_desc;
+    if (!hdfs_table_->IsClusteringCol(slot_desc)) continue;
+    if (template_tuple->IsNull(slot_desc->null_indicator_offset())) return false;
+    uint32_t hash = RawValue::GetHashValue(
+        template_tuple->GetSlot(slot_desc->tuple_offset()), slot_desc->type());
+    if (!runtime_filters_[i].filter->Find(hash)) return false;
+  }
+  return true;
+}
+
 Tuple* HdfsScanNode::InitTemplateTuple(RuntimeState* state,
     const vector<Expr*>& expr_values) {
   if (partition_key_slots_.empty()) return NULL;
@@ -437,12 +537,22 @@ Status HdfsScanNode::Open(RuntimeState* state) {
     return Status(ss.str());
   } 
 
+  io_buffers_per_disk_ = state->max_io_buffers();
+  COUNTER_SET(io_buffers_per_disk_counter_, io_buffers_per_disk_);
   RETURN_IF_ERROR(runtime_state_->io_mgr()->RegisterReader(
-      hdfs_connection_, state->max_io_buffers(), &reader_context_));
+      hdfs_connection_, io_buffers_per_disk_, &reader_context_));
   runtime_state_->io_mgr()->set_bytes_read_counter(reader_context_, bytes_read_counter());
   runtime_state_->io_mgr()->set_read_timer(reader_context_, read_timer());
+  runtime_state_->io_mgr()->set_weight(reader_context_, state->io_weight());
 
-  current_file_scan_ranges_ = per_file_scan_ranges_.begin();
+  // Conjuncts on partition keys that the planner couldn't use to prune partitions,
+  // and runtime filters on partition keys, are evaluated once per partition here;
+  // the files of partitions that fail them aren't read at all.
+  vector<Expr*> partition_conjuncts;
+  GetPartitionConjuncts(&partition_conjuncts);
+  bool prune_partitions = !partition_key_slots_.empty()
+      && (!partition_conjuncts.empty() || !runtime_filters_.empty());
+  map<int64_t, bool> partition_passes;
 
   int total_scan_ranges = 0;
   // Walk all the files on this node and coalesce all the files with the same
@@ -462,14 +572,27 @@ Status HdfsScanNode::Open(RuntimeState* state) {
       return Status(ss.str());
     }
 
-    // TODO: remove when all scanners are updated
-    if (partition->file_format() == THdfsFileFormat::TEXT ||
-        partition->file_format() == THdfsFileFormat::SEQUENCE_FILE) {
-      ++num_unqueued_files_;
+    RETURN_IF_ERROR(partition->PrepareExprs(state));
+    if (prune_partitions) {
+      map<int64_t, bool>::iterator passes = partition_passes.find(partition_id);
+      if (passes == partition_passes.end()) {
+        passes = partition_passes.insert(make_pair(
+            partition_id, PartitionPasses(partition, partition_conjuncts))).first;
+      }
+      if (!passes->second) {
+        COUNTER_UPDATE(files_pruned_counter_, 1);
+        continue;
+      }
+    }
+
+    ++num_unqueued_files_;
+    if (partition->file_format() == THdfsFileFormat::TREVNI) {
+      // Trevni files are read by one scanner, which reads all their columns.
+      total_scan_ranges += 1;
+    } else {
       total_scan_ranges += ranges.size();
-    } 
+    }
 
-    RETURN_IF_ERROR(partition->PrepareExprs(state));
     per_type_files[partition->file_format()].push_back(it->second);
   }
 
@@ -478,18 +601,32 @@ Status HdfsScanNode::Open(RuntimeState* state) {
     return Status::OK;
   }
 
+  // Split large text ranges if there are too few ranges to keep the scanner threads
+  // busy.  This must be done before the ranges are counted below.
+  total_scan_ranges += HdfsTextScanner::SplitRanges(this,
+      per_type_files[THdfsFileFormat::TEXT], total_scan_ranges);
+
   stringstream ss;
   ss << "Scan ranges complete (node=" << id() << "):";
   progress_ = ProgressUpdater(ss.str(), total_scan_ranges);
 
   max_scanner_threads_ = state->num_scanner_threads();
   if (max_scanner_threads_ == 0) {
+    // Start with a thread per core and let AdjustScannerThreads() find the number of
+    // threads that keeps up with the disks and the consumer.
     max_scanner_threads_ = total_scan_ranges;
+    adaptive_scanner_threads_ = true;
+    scanner_threads_target_ = min(max_scanner_threads_, CpuInfo::num_cores());
   } else {
     max_scanner_threads_ = min(state->num_scanner_threads(), total_scan_ranges);
+    scanner_threads_target_ = max_scanner_threads_;
   }
-  VLOG_FILE << "Using " << max_scanner_threads_ << " simultaneous scanner threads.";
+  VLOG_FILE << "Using " << scanner_threads_target_ << " simultaneous scanner threads"
+            << (adaptive_scanner_threads_ ? " initially." : ".");
   DCHECK_GT(max_scanner_threads_, 0);
+  DCHECK_GT(scanner_threads_target_, 0);
+  COUNTER_SET(scanner_threads_target_counter_, scanner_threads_target_);
+  adjustment_timer_.Start();
 
   if (FLAGS_randomize_scan_ranges) {
     unsigned int seed = time(NULL);
@@ -509,18 +646,14 @@ Status HdfsScanNode::Open(RuntimeState* state) {
   HdfsTextScanner::IssueInitialRanges(this, per_type_files[THdfsFileFormat::TEXT]);
   HdfsSequenceScanner::IssueInitialRanges(this, 
       per_type_files[THdfsFileFormat::SEQUENCE_FILE]);
+  HdfsRCFileScanner::IssueInitialRanges(this, per_type_files[THdfsFileFormat::RC_FILE]);
+  HdfsTrevniScanner::IssueInitialRanges(this, per_type_files[THdfsFileFormat::TREVNI]);
   
   // scanners have added their initial ranges, issue the first batch to the io mgr.
   IssueMoreRanges();
-
-  if (ranges_in_flight_ == 0) {
-    // This is a temporary hack for scanners not using the io mgr.
-    done_ = true;
-    return Status::OK;
-  }
   
   // Start up disk thread which in turn drives the scanner threads.
-  disk_read_thread_.reset(new thread(&HdfsScanNode::DiskThread, this));
+  disk_thread_.Offer(thread_pool_, bind(&HdfsScanNode::DiskThread, this));
   
   return Status::OK;
 }
@@ -531,7 +664,7 @@ Status HdfsScanNode::Close(RuntimeState* state) {
     runtime_state_->io_mgr()->CancelReader(reader_context_);
   }
 
-  if (disk_read_thread_ != NULL) disk_read_thread_->join();
+  disk_thread_.Wait();
 
   // There are materialized batches that have not been returned to the parent node.
   // Clean those up now.
@@ -540,17 +673,42 @@ Status HdfsScanNode::Close(RuntimeState* state) {
     delete *it;
   }
   materialized_row_batches_.clear();
+  materialized_batch_partitions_.clear();
   
-  if (reader_context_ != NULL) {
-    runtime_state_->io_mgr()->UnregisterReader(reader_context_);
+  {
+    // Cancel() might be looking at reader_context_
+    unique_lock<recursive_mutex> l(lock_);
+    if (reader_context_ != NULL) {
+      runtime_state_->io_mgr()->UnregisterReader(reader_context_);
+      reader_context_ = NULL;
+    }
   }
 
   scanner_pool_.reset(NULL);
+  // ranges that failed or were cancelled still hold theirs
+  if (thread_tokens_ != NULL) thread_tokens_->Release(num_thread_tokens_);
+  num_thread_tokens_ = 0;
 
-  COUNTER_UPDATE(memory_used_counter_, tuple_pool_->peak_allocated_bytes());
   return ExecNode::Close(state);
 }
 
+void HdfsScanNode::Cancel(RuntimeState* state) {
+  {
+    unique_lock<recursive_mutex> l(lock_);
+    if (status_.ok()) status_ = Status::CANCELLED;
+    done_ = true;
+    // unblocks the disk thread, which then cancels the scanners' contexts, waking up
+    // scanner threads that wait for bytes
+    if (reader_context_ != NULL) runtime_state_->io_mgr()->CancelReader(reader_context_);
+  }
+  {
+    // GetNext() checks done_ under row_batches_lock_
+    unique_lock<mutex> l(row_batches_lock_);
+  }
+  row_batch_added_cv_.notify_one();
+  ExecNode::Cancel(state);
+}
+
 void HdfsScanNode::AddDiskIoRange(DiskIoMgr::ScanRange* range) {
   unique_lock<recursive_mutex> lock(lock_);
   all_ranges_.push_back(range);
@@ -598,8 +756,16 @@ Status HdfsScanNode::IssueMoreRanges() {
   unique_lock<recursive_mutex> lock(lock_);
 
   int num_remaining = all_ranges_.size() - next_range_to_issue_idx_;
-  int threads_remaining = max_scanner_threads_ - ranges_in_flight_;
+  int threads_remaining = scanner_threads_target_ - ranges_in_flight_;
   int ranges_to_issue = min(threads_remaining, num_remaining);
+  if (thread_tokens_ != NULL && ranges_to_issue > 0) {
+    // The scans of concurrent queries share the tokens; without any, this scan makes
+    // do with a single thread.
+    int free_ranges = ranges_in_flight_ == 0 ? 1 : 0;
+    int acquired = thread_tokens_->TryAcquire(ranges_to_issue - free_ranges);
+    num_thread_tokens_ += acquired;
+    ranges_to_issue = free_ranges + acquired;
+  }
 
   vector<DiskIoMgr::ScanRange*> ranges;
   if (ranges_to_issue > 0) {
@@ -632,8 +798,8 @@ void HdfsScanNode::StartNewScannerThread(DiskIoMgr::BufferDescriptor* buffer) {
   contexts_[range] = context;
   HdfsScanner* scanner = CreateScanner(partition);
 
-  scanner_threads_.add_thread(new thread(&HdfsScanNode::ScannerThread, this,
-        scanner, context)); 
+  scanner_threads_.Offer(thread_pool_,
+      bind(&HdfsScanNode::ScannerThread, this, scanner, context));
 }
 
 // The disk thread continuously reads from the io mgr queuing buffers to the 
@@ -644,6 +810,7 @@ void HdfsScanNode::StartNewScannerThread(DiskIoMgr::BufferDescriptor* buffer) {
 // first buffer for this scan range), a new context object is created as well as a
 // new scanner thread to process it.
 void HdfsScanNode::DiskThread() {
+  ScopedCgroupAssignment cgroup(runtime_state_->cpu_cgroup());
   while (true) {
     bool eos = false;
     DiskIoMgr::BufferDescriptor* buffer_desc = NULL;
@@ -695,7 +862,7 @@ void HdfsScanNode::DiskThread() {
     it->second->Cancel();
   }
 
-  scanner_threads_.join_all();
+  scanner_threads_.Wait();
   contexts_.clear();
   
   // Wake up thread in GetNext
@@ -706,19 +873,29 @@ void HdfsScanNode::DiskThread() {
   row_batch_added_cv_.notify_one();
 }
 
-void HdfsScanNode::AddMaterializedRowBatch(RowBatch* row_batch) {
+void HdfsScanNode::AddMaterializedRowBatch(RowBatch* row_batch, int64_t partition_id) {
   {
     unique_lock<mutex> l(row_batches_lock_);
     materialized_row_batches_.push_back(row_batch);
+    materialized_batch_partitions_.push_back(partition_id);
   }
   row_batch_added_cv_.notify_one();
 }
 
 void HdfsScanNode::ScannerThread(HdfsScanner* scanner, ScanRangeContext* context) {
+  // the pool's thread may have evaluated other exprs before
+  SharedExpr::StartThreadScopes();
+  ScopedCgroupAssignment cgroup(runtime_state_->cpu_cgroup());
   // Call into the scanner to process the range.  From the scanner's perspective,
   // everything is single threaded.
+  context->set_conjunct_evaluator(scanner->conjunct_evaluator());
+  StopWatch range_watch;
+  range_watch.Start();
+  ThreadCounterMeasurement thread_measurement(scanner_thread_counters_);
   Status status = scanner->ProcessScanRange(context);
   scanner->Close();
+  thread_measurement.Stop();
+  scan_range_time_->Add(range_watch.ElapsedTime());
 
   // Scanner thread completed. Take a look and update the status 
   unique_lock<recursive_mutex> l(lock_);
@@ -754,7 +931,14 @@ void HdfsScanNode::ScannerThread(HdfsScanner* scanner, ScanRangeContext* context
     row_batch_added_cv_.notify_one();
   }
 
+  if (adaptive_scanner_threads_) AdjustScannerThreads();
   --ranges_in_flight_;
+  if (thread_tokens_ != NULL && num_thread_tokens_ > max(0, ranges_in_flight_ - 1)) {
+    // give the token of this thread back before IssueMoreRanges() asks for one, so
+    // that the scans of other queries get their turn
+    thread_tokens_->Release(1);
+    --num_thread_tokens_;
+  }
   if (progress_.done()) {
     // All ranges are finished.  Indicate we are done.
     {
@@ -767,6 +951,37 @@ void HdfsScanNode::ScannerThread(HdfsScanner* scanner, ScanRangeContext* context
   }
 }
 
+void HdfsScanNode::AdjustScannerThreads() {
+  int64_t now = adjustment_timer_.ElapsedTime();
+  int64_t io_wait_time = scanner_io_wait_timer_->value();
+  int64_t interval = now - last_adjustment_time_;
+  int64_t waited = io_wait_time - last_io_wait_time_;
+  last_adjustment_time_ = now;
+  last_io_wait_time_ = io_wait_time;
+
+  int num_queued_batches;
+  {
+    unique_lock<mutex> l(row_batches_lock_);
+    num_queued_batches = materialized_row_batches_.size();
+  }
+
+  if (num_queued_batches >= FLAGS_max_queued_row_batches) {
+    // The consumer does not keep up, the scanner threads only add memory.  The ranges
+    // in flight finish, but fewer new ones are issued.
+    if (scanner_threads_target_ > 1) --scanner_threads_target_;
+  } else if (waited * 2 > interval * ranges_in_flight_) {
+    // The scanners waited for io more than half of the time.  Read more ranges in
+    // parallel, and further ahead in each.
+    if (scanner_threads_target_ < max_scanner_threads_) ++scanner_threads_target_;
+    if (io_buffers_per_disk_ < FLAGS_max_io_buffers_per_disk) {
+      runtime_state_->io_mgr()->IncreaseBuffers(reader_context_, 1);
+      ++io_buffers_per_disk_;
+    }
+  }
+  COUNTER_SET(scanner_threads_target_counter_, scanner_threads_target_);
+  COUNTER_SET(io_buffers_per_disk_counter_, io_buffers_per_disk_);
+}
+
 void HdfsScanNode::RangeComplete() {
   scan_ranges_complete_counter()->Update(1);
   progress_.Update(1);
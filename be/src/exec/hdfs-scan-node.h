@@ -16,6 +16,9 @@
 #ifndef IMPALA_EXEC_HDFS_SCAN_NODE_H_
 #define IMPALA_EXEC_HDFS_SCAN_NODE_H_
 
+#include <map>
+#include <set>
+#include <string>
 #include <vector>
 #include <memory>
 #include <stdint.h>
@@ -33,12 +36,14 @@
 #include "runtime/disk-io-mgr.h"
 #include "runtime/string-buffer.h"
 #include "util/progress-updater.h"
+#include "util/stopwatch.h"
+#include "util/thread-pool.h"
 
 #include "gen-cpp/PlanNodes_types.h"
 
 namespace impala {
 
-class ByteStream;
+class BloomFilter;
 class DescriptorTbl;
 class HdfsScanner;
 class RowBatch;
@@ -47,6 +52,7 @@ class ScanRangeContext;
 class Tuple;
 class TPlanNode;
 class TScanRange;
+class ThreadTokens;
 
 // Maintains per file information for files assigned to this scan node.  This includes 
 // all the scan ranges for the file as well as a lock which can be used when updating 
@@ -54,8 +60,11 @@ class TScanRange;
 struct HdfsFileDesc {
   boost::mutex lock;
   std::string filename;
+  // Last modification time of the file, 0 if unknown (see DiskIoMgr::ScanRange).
+  int64_t mtime;
   std::vector<DiskIoMgr::ScanRange*> ranges;
-  HdfsFileDesc(const std::string& filename) : filename(filename) {}
+  HdfsFileDesc(const std::string& filename, int64_t mtime)
+    : filename(filename), mtime(mtime) {}
 };
 
 // A ScanNode implementation that is used for all tables read directly from 
@@ -73,13 +82,13 @@ struct HdfsFileDesc {
 // 4. The scanner processes the buffers, issuing more byte ranges if necessary.
 // 5. The scanner finishes the scan range and informs the scan node so it can track
 //    end of stream.
+// The number of ranges in flight (and so scanner threads) and the number of io buffers
+// of the node's reader are adjusted while the scan runs, see AdjustScannerThreads().
 // TODO: this class currently throttles ranges sent to the io mgr.  This should be
 // updated to not have to do this once we can restrict the number of scanner threads
 // a better way.
 // TODO: this needs to be moved into the io mgr.  RegisterReader needs to take
 // another argument for max parallel ranges or something like that.
-// TODO: this class supports two types of scanners, TEXT and SEQUENCE which use
-// the io mgr and RCFILE and TREVNI which don't.  Remove the non io mgr path.
 class HdfsScanNode : public ScanNode {
  public:
   HdfsScanNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
@@ -90,11 +99,11 @@ class HdfsScanNode : public ScanNode {
   virtual Status Prepare(RuntimeState* state);
   virtual Status Open(RuntimeState* state);
 
-  // Checks for cancellation at the very beginning and then again after
-  // each call to HdfsScanner::GetNext().
+  // Returns the next row batch materialized by the scanner threads.
   virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
 
   virtual Status Close(RuntimeState* state);
+  virtual void Cancel(RuntimeState* state);
 
   // ScanNode methods
   virtual Status SetScanRanges(const std::vector<TScanRangeParams>& scan_ranges);
@@ -105,6 +114,9 @@ class HdfsScanNode : public ScanNode {
   int limit() const { return limit_; }
 
   bool compact_data() const { return compact_data_; }
+
+  // Capacity of the row batches that the scanners fill, set in Prepare().
+  int row_batch_capacity() const { return row_batch_capacity_; }
   
   const std::vector<SlotDescriptor*>& materialized_slots()
       const { return materialized_slots_; }
@@ -123,6 +135,8 @@ class HdfsScanNode : public ScanNode {
   
   const TupleDescriptor* tuple_desc() { return tuple_desc_; }
 
+  const HdfsTableDescriptor* hdfs_table() { return hdfs_table_; }
+
   hdfsFS hdfs_connection() { return hdfs_connection_; }
 
   RuntimeState* runtime_state() { return runtime_state_; }
@@ -135,17 +149,30 @@ class HdfsScanNode : public ScanNode {
     return column_idx_to_materialized_slot_idx_[col_idx];
   }
 
-  // Returns the per format codegen'd function.  Returns NULL if codegen is not
-  // possible.
-  llvm::Function* GetCodegenFn(THdfsFileFormat::type);
+  // Returns the per format jitted function.  Returns NULL if codegen is not
+  // possible or the function has not been compiled yet.
+  void* GetJittedFn(THdfsFileFormat::type);
 
   // Adds a materialized row batch for the scan node.  This is called from scanner
-  // threads.
-  void AddMaterializedRowBatch(RowBatch* row_batch);
+  // threads.  All rows of the batch are from the partition 'partition_id'.
+  void AddMaterializedRowBatch(RowBatch* row_batch, int64_t partition_id);
+
+  // Returns the partition of the rows of the batch that the last GetNext() returned.
+  int64_t batch_partition_id() const { return batch_partition_id_; }
+
+  // Returns a description of the scan ranges that the node reads from each partition,
+  // by partition id: the path, offset and length of each range.  Can be called once
+  // the scan ranges are set.
+  void GetPartitionRanges(std::map<int64_t, std::string>* ranges) const;
+
+  // Drops the scan ranges of the partitions in 'partition_ids', whose rows are then
+  // not returned.  Must be called before Open().
+  void SkipPartitions(const std::set<int64_t>& partition_ids);
 
   // Allocate a new scan range object.  This is thread safe.
+  // mtime is the last modification time of the file, 0 if unknown.
   DiskIoMgr::ScanRange* AllocateScanRange(const char* file, int64_t len, int64_t offset,
-      int64_t partition_id, int disk_id);
+      int64_t partition_id, int disk_id, int64_t mtime);
 
   // Adds a scan range to the disk io mgr queue.
   void AddDiskIoRange(DiskIoMgr::ScanRange* range);
@@ -183,6 +210,21 @@ class HdfsScanNode : public ScanNode {
   // evaluating conjuncts[1].  Slots that are not referenced by any conjuncts will have
   // order set to conjuncts.size()
   void ComputeSlotMaterializationOrder(std::vector<int>* order) const;
+
+  // Adds a runtime filter (published by a hash join over this node's output): rows
+  // whose value of 'slot_desc' is NULL or isn't in 'filter' are dropped from the
+  // output.  The filter holds RawValue::GetHashValue() hashes of the values.  Must be
+  // called before Open(); the filter must stay valid until Close().
+  void AddRuntimeFilter(const SlotDescriptor* slot_desc, const BloomFilter* filter);
+
+  // Removes the rows at index >= start_row of 'batch' that don't pass the runtime
+  // filters.  This is thread safe.
+  void ApplyRuntimeFilters(RowBatch* batch, int start_row);
+
+  // Time the scanner threads spent waiting for io buffers.
+  RuntimeProfile::ShardedCounter* scanner_io_wait_timer() {
+    return scanner_io_wait_timer_;
+  }
   
   const static int SKIP_COLUMN = -1;
 
@@ -201,6 +243,10 @@ class HdfsScanNode : public ScanNode {
   // stream to another node that will release the memory.
   bool compact_data_;
 
+  // See RuntimeState::batch_size().  Without conjuncts every row the scanners write
+  // is returned, so the batches needn't be larger than the limit.
+  int row_batch_capacity_;
+
   // ReaderContext object to use with the disk-io-mgr
   DiskIoMgr::ReaderContext* reader_context_;
 
@@ -215,49 +261,32 @@ class HdfsScanNode : public ScanNode {
   // this once per scan node since it can be noisy.
   bool unknown_disk_id_warned_;
 
-  // Mem pool for tuple buffer data. Used by scanners for allocation,
-  // but owned here.
-  boost::scoped_ptr<MemPool> tuple_pool_;
+  // Percentage of the scan ranges to read (100 unless the scan is sampled) and the
+  // seed of the hash that selects them (see THdfsScanNode.sample_percent)
+  int sample_percent_;
+  uint32_t sample_seed_;
 
   // Files and their scan ranges
   typedef std::map<std::string, HdfsFileDesc*> ScanRangeMap;
   ScanRangeMap per_file_scan_ranges_;
   
-  // Points at the (file, [scan ranges]) pair currently being processed
-  ScanRangeMap::iterator current_file_scan_ranges_;
-
-  // The index of the current scan range in the current file's scan range list
-  int current_range_idx_;
-
   // Number of files that have not been issued from the scanners.
   int num_unqueued_files_;
 
   // Connection to hdfs, established in Open() and closed in Close().
   hdfsFS hdfs_connection_;
 
-  // Map of HdfsScanner objects to file types.  Only one scanner object will be
-  // created for each file type.  Objects stored in scanner_pool_.
-  typedef std::map<THdfsFileFormat::type, HdfsScanner*> ScannerMap;
-  ScannerMap scanner_map_;
-
-  // Per scanner type codegen'd fn.  This is written to by the main thread and only
-  // read from scanner threads so does not need locks.
-  typedef std::map<THdfsFileFormat::type, llvm::Function*> CodegendFnMap;
-  CodegendFnMap codegend_fn_map_;
+  // Per scanner type jitted fn.  The map is populated in Prepare() and the
+  // functions are filled in by the codegen compile, possibly while scanner threads
+  // are reading them, so scanners pick them up for the ranges started after that.
+  typedef std::map<THdfsFileFormat::type, void*> JittedFnMap;
+  JittedFnMap jitted_fn_map_;
 
   // Pool for storing allocated scanner objects.  We don't want to use the 
   // runtime pool to ensure that the scanner objects are deleted before this
   // object is.
   boost::scoped_ptr<ObjectPool> scanner_pool_;
 
-  // The scanner in use for the current file / scan-range
-  // combination.
-  HdfsScanner* current_scanner_;
-
-  // The source of byte data for consumption by the scanner for the
-  // current file / scan-range combination.
-  boost::scoped_ptr<ByteStream> current_byte_stream_;
-
   // Total number of partition slot descriptors, including non-materialized ones.
   int num_partition_keys_;
 
@@ -274,9 +303,13 @@ class HdfsScanNode : public ScanNode {
   // These descriptors are sorted in order of increasing col_pos
   std::vector<SlotDescriptor*> partition_key_slots_;
 
-  // Thread that constantly reads from the disk io mgr and queues the work on the
-  // context for that scan range.
-  boost::scoped_ptr<boost::thread> disk_read_thread_;
+  // Process-wide threads that run the disk thread and the scanner threads (NULL if
+  // each of them is a thread of its own).
+  ThreadPool* thread_pool_;
+
+  // The disk thread, which constantly reads from the disk io mgr and queues the work
+  // on the context for that scan range.
+  WorkItemGroup disk_thread_;
  
   // Maximum number of simultaneous scanner threads to use.  The actual number of 
   // simultaneous scanner threads might be much less.  We have one scanner thread 
@@ -288,6 +321,32 @@ class HdfsScanNode : public ScanNode {
   // share resources better before we use c-groups).
   int max_scanner_threads_;
 
+  // If true, the scanner threads and io buffers are adjusted by
+  // AdjustScannerThreads().  This is the case unless the number of scanner threads
+  // is set by the query.
+  bool adaptive_scanner_threads_;
+
+  // Current limit of ranges in flight (i.e. scanner threads), at most
+  // max_scanner_threads_.
+  int scanner_threads_target_;
+
+  // Current number of io buffers per disk of reader_context_.
+  int io_buffers_per_disk_;
+
+  // Runs from Open() and times the intervals between adjustments.
+  StopWatch adjustment_timer_;
+
+  // adjustment_timer_ and scanner_io_wait_timer_ at the last adjustment.
+  int64_t last_adjustment_time_;
+  int64_t last_io_wait_time_;
+
+  RuntimeProfile::ShardedCounter* scanner_io_wait_timer_;
+
+  // The values of scanner_threads_target_ and io_buffers_per_disk_.  At the end of
+  // the scan, these are the settings the adjustments settled on.
+  RuntimeProfile::Counter* scanner_threads_target_counter_;
+  RuntimeProfile::Counter* io_buffers_per_disk_counter_;
+
   // Keeps track of total scan ranges and the number finished.
   ProgressUpdater progress_;
 
@@ -295,8 +354,8 @@ class HdfsScanNode : public ScanNode {
   boost::mutex metadata_lock_;
   std::map<std::string, void*> per_file_metadata_;
 
-  // Thread group for all scanner worker threads
-  boost::thread_group scanner_threads_;
+  // All scanner threads, run on thread_pool_
+  WorkItemGroup scanner_threads_;
 
   // Lock and condition variable protecting materialized_row_batches_.  Row batches
   // are produced by the scanner threads and consumed by the main thread in GetNext
@@ -305,6 +364,11 @@ class HdfsScanNode : public ScanNode {
   boost::condition_variable row_batch_added_cv_;
   std::list<RowBatch*> materialized_row_batches_;
 
+  // The partition of the rows of each batch of materialized_row_batches_, and of
+  // the batch that GetNext() returned last.
+  std::list<int64_t> materialized_batch_partitions_;
+  int64_t batch_partition_id_;
+
   // Flag signaling that all scanner threads are done.  This could be because they
   // are finished, an error/cancellation occurred, or the limit was reached.
   // Setting this to true triggers the scanner threads to clean up.
@@ -335,6 +399,13 @@ class HdfsScanNode : public ScanNode {
   // The number of ranges in flight in the io mgr.
   int ranges_in_flight_;
 
+  // Tokens for scanner threads: the query's quota of the process-wide tokens, or
+  // those (NULL if unlimited).  Every range in flight has a scanner thread: the first
+  // one is free, each other one takes a token, so that
+  // num_thread_tokens_ == max(0, ranges_in_flight_ - 1).
+  ThreadTokens* thread_tokens_;
+  int num_thread_tokens_;
+
   // If true, all ranges have been sent to the io mgr.
   bool all_ranges_issued_;
 
@@ -342,6 +413,37 @@ class HdfsScanNode : public ScanNode {
   typedef std::map<const DiskIoMgr::ScanRange*, ScanRangeContext*> ContextMap;
   ContextMap contexts_;
 
+  // Runtime filters on the output rows, see AddRuntimeFilter().
+  struct RuntimeFilter {
+    const SlotDescriptor* slot_desc;
+    const BloomFilter* filter;
+  };
+  std::vector<RuntimeFilter> runtime_filters_;
+
+  // Number of rows dropped by the runtime filters.
+  RuntimeProfile::ShardedCounter* runtime_filter_rows_rejected_counter_;
+
+  // Number of files not read because their partition's key values don't pass the
+  // conjuncts or runtime filters.
+  RuntimeProfile::Counter* files_pruned_counter_;
+
+  // Returns the conjuncts that only reference partition key slots (and are
+  // deterministic), whose value is the same for all rows of a partition.
+  void GetPartitionConjuncts(std::vector<Expr*>* conjuncts);
+
+  // Returns false if no row of 'partition' can pass 'partition_conjuncts' or the
+  // runtime filters on partition key slots.  Evaluates them over the partition's
+  // template tuple.
+  bool PartitionPasses(HdfsPartitionDescriptor* partition,
+      const std::vector<Expr*>& partition_conjuncts);
+
+  // Distribution of the times the scanner threads spent on a scan range.
+  Histogram* scan_range_time_;
+
+  // cpu time and context switches of the scanner threads.  Together with
+  // scanner_io_wait_timer_ this shows whether the scanners are cpu or io bound.
+  RuntimeProfile::ThreadCounters* scanner_thread_counters_;
+
   // Status of failed operations.  This is set asynchronously in DiskThread and
   // ScannerThread.  Returned in GetNext() if an error occurred.  An non-ok
   // status triggers cleanup of the disk and scanner threads.
@@ -350,16 +452,15 @@ class HdfsScanNode : public ScanNode {
   // Issue the next set of queued ranges to the io mgr.  This is used to throttle
   // the number of scan ranges being parsed to the number of scanner threads.
   Status IssueMoreRanges();
-  
-  // Called once per scan-range to initialise (potentially) a new byte
-  // stream and to call the same method on the current scanner.
-  Status InitNextScanRange(RuntimeState* state, bool* scan_ranges_finished);
-
-  // Gets a scanner for the file type for this partition, creating one if none
-  // exists.
-  // TODO: remove when all scanners are updated.
-  HdfsScanner* GetScanner(HdfsPartitionDescriptor*);
 
+  // Feedback control of scanner_threads_target_ and io_buffers_per_disk_, called
+  // when a range finishes.  If the consumer is slow (too many row batches queued),
+  // the target number of scanner threads is lowered.  Otherwise, if the scanners
+  // spent most of the time since the last adjustment waiting for io buffers, more
+  // ranges are put in flight and the reader gets more io buffers.  lock_ must be
+  // taken.
+  void AdjustScannerThreads();
+  
   // Create a new scanner for this partition type and initialize it.
   HdfsScanner* CreateScanner(HdfsPartitionDescriptor*);
 
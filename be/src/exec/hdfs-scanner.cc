@@ -20,10 +20,12 @@
 #include "codegen/llvm-codegen.h"
 #include "common/logging.h"
 #include "common/object-pool.h"
+#include "exec/batch-conjunct-evaluator.h"
+#include "exec/dictionary-filter.h"
 #include "exec/text-converter.h"
-#include "exec/hdfs-byte-stream.h"
 #include "exec/hdfs-scan-node.h"
 #include "exec/scan-range-context.h"
+#include "exec/serde-utils.inline.h"
 #include "exec/text-converter.inline.h"
 #include "exprs/expr.h"
 #include "runtime/descriptors.h"
@@ -32,6 +34,7 @@
 #include "runtime/mem-pool.h"
 #include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
+#include "runtime/string-search.h"
 #include "runtime/tuple-row.h"
 #include "runtime/tuple.h"
 #include "runtime/string-value.h"
@@ -46,26 +49,33 @@ using namespace impala;
 using namespace llvm;
 using namespace std;
 
+DEFINE_bool(enable_batch_conjunct_eval, true, "if true, scanners whose conjuncts "
+    "can't be codegen'd evaluate them a row batch at a time, with adaptive conjunct "
+    "ordering, instead of per tuple");
+DEFINE_bool(enable_lazy_materialization, true, "if true, scanners that evaluate "
+    "conjuncts per tuple only write the slots the next conjunct needs before "
+    "evaluating it, so slots that are only projected are not parsed for rows that "
+    "don't pass");
+DEFINE_bool(enable_dictionary_filters, true, "if true, scanners evaluate conjuncts "
+    "that only depend on one string slot once per distinct value of the slot in each "
+    "scan range, until it has more than a thousand of them");
+
 const char* FieldLocation::LLVM_CLASS_NAME = "struct.impala::FieldLocation";
 const char* HdfsScanner::LLVM_CLASS_NAME = "class.impala::HdfsScanner";
 
-HdfsScanner::HdfsScanner(HdfsScanNode* scan_node, RuntimeState* state, 
-                         MemPool* tuple_pool)
+HdfsScanner::HdfsScanner(HdfsScanNode* scan_node, RuntimeState* state)
     : scan_node_(scan_node),
       state_(state),
       context_(NULL),
       conjuncts_(NULL),
       num_conjuncts_(0),
-      tuple_buffer_(NULL),
       tuple_byte_size_(scan_node->tuple_desc()->byte_size()),
-      tuple_pool_(tuple_pool),
+      tuple_pool_(NULL),
       tuple_(NULL),
       num_errors_in_file_(0),
-      current_byte_stream_(NULL),
       template_tuple_(NULL),
       has_noncompact_strings_(!scan_node->compact_data() &&
                               !scan_node->tuple_desc()->string_slots().empty()),
-      current_scan_range_(NULL),
       num_null_bytes_(scan_node->tuple_desc()->num_null_bytes()),
       write_tuples_fn_(NULL) {
 }
@@ -75,6 +85,58 @@ HdfsScanner::~HdfsScanner() {
 
 Status HdfsScanner::Prepare() {
   RETURN_IF_ERROR(CreateConjunctsCopy());
+  CreateDictionaryFilters();
+
+  // Codegen'd scanners evaluate the conjuncts inline as they write the tuples, which
+  // beats the interpreted batch evaluation.  The per-tuple limit handling in the
+  // scanners assumes that every tuple they write is returned, so scans with a limit
+  // also filter per tuple.
+  bool conjuncts_codegend = state_->llvm_codegen() != NULL;
+  const vector<Expr*>& conjuncts = scan_node_->conjuncts();
+  for (int i = 0; i < conjuncts.size(); ++i) {
+    if (conjuncts[i]->codegen_fn() == NULL) conjuncts_codegend = false;
+  }
+
+  // Lazy materialization only helps if some slot is not needed by the first
+  // conjunct.  In that case it is preferred over batch evaluation, which needs all
+  // slots written first.
+  vector<int> materialize_order;
+  scan_node_->ComputeSlotMaterializationOrder(&materialize_order);
+  bool skips_slots = false;
+  for (int i = 0; i < materialize_order.size(); ++i) {
+    if (materialize_order[i] > 0) skips_slots = true;
+  }
+  bool lazy_materialization = FLAGS_enable_lazy_materialization && skips_slots;
+
+  if (FLAGS_enable_batch_conjunct_eval && num_conjuncts_ > 0 && !conjuncts_codegend &&
+      !lazy_materialization && scan_node_->limit() == -1) {
+    conjunct_evaluator_.reset(
+        new BatchConjunctEvaluator(conjuncts_mem_, scan_node_->runtime_profile()));
+    for (int i = 0; i < dictionary_filters_.size(); ++i) {
+      if (dictionary_filters_[i] != NULL) {
+        conjunct_evaluator_->SetDictionaryFilter(i, dictionary_filters_[i].get());
+      }
+    }
+    num_conjuncts_ = 0;
+  }
+
+  // Without lazy materialization (or conjuncts) all slots are written before the
+  // first conjunct.
+  int num_lazy_conjuncts = lazy_materialization ? num_conjuncts_ : 0;
+  num_slots_before_conjunct_.clear();
+  slot_materialization_order_.clear();
+  for (int conjunct_idx = 0; conjunct_idx < num_lazy_conjuncts; ++conjunct_idx) {
+    for (int i = 0; i < materialize_order.size(); ++i) {
+      if (materialize_order[i] == conjunct_idx) slot_materialization_order_.push_back(i);
+    }
+    num_slots_before_conjunct_.push_back(slot_materialization_order_.size());
+  }
+  for (int i = 0; i < materialize_order.size(); ++i) {
+    if (materialize_order[i] >= num_lazy_conjuncts) {
+      slot_materialization_order_.push_back(i);
+    }
+  }
+  num_slots_before_conjunct_.resize(num_conjuncts_, materialize_order.size());
   return Status::OK;
 }
 
@@ -88,11 +150,26 @@ Status HdfsScanner::CreateConjunctsCopy() {
   return Status::OK;
 }
 
+void HdfsScanner::CreateDictionaryFilters() {
+  dictionary_filters_.clear();
+  dictionary_filters_.resize(conjuncts_mem_.size());
+  if (!FLAGS_enable_dictionary_filters) return;
+  const TupleDescriptor* tuple_desc = scan_node_->tuple_desc();
+  for (int i = 0; i < conjuncts_mem_.size(); ++i) {
+    const SlotDescriptor* slot_desc =
+        DictionaryFilter::GetSlot(conjuncts_mem_[i], state_->desc_tbl());
+    if (slot_desc == NULL || slot_desc->parent() != tuple_desc->id()) continue;
+    dictionary_filters_[i].reset(new DictionaryFilter(conjuncts_mem_[i],
+        scan_node_->tuple_idx(), slot_desc->tuple_offset(),
+        slot_desc->null_indicator_offset()));
+  }
+}
+
 Status HdfsScanner::InitializeCodegenFn(HdfsPartitionDescriptor* partition,
     THdfsFileFormat::type type, const string& scanner_name) {
-  Function* codegen_fn = scan_node_->GetCodegenFn(type);
-  
-  if (codegen_fn == NULL) return Status::OK;
+  void* jitted_fn = scan_node_->GetJittedFn(type);
+
+  if (jitted_fn == NULL) return Status::OK;
   if (!scan_node_->tuple_desc()->string_slots().empty() && 
         ((partition->escape_char() != '\0') || context_->compact_data())) {
     // Cannot use codegen if there are strings slots and we need to 
@@ -100,89 +177,12 @@ Status HdfsScanner::InitializeCodegenFn(HdfsPartitionDescriptor* partition,
     return Status::OK;
   }
 
-  write_tuples_fn_ = reinterpret_cast<WriteTuplesFn>(
-      state_->llvm_codegen()->JitFunction(codegen_fn));
+  write_tuples_fn_ = reinterpret_cast<WriteTuplesFn>(jitted_fn);
   VLOG(2) << scanner_name << "(node_id=" << scan_node_->id() 
           << ") using llvm codegend functions.";
   return Status::OK;
 }
 
-void HdfsScanner::AllocateTupleBuffer(RowBatch* row_batch) {
-  if (tuple_byte_size_ == 0) {
-    tuple_byte_size_ = 0;
-  } else if (tuple_ == NULL) {
-    // create new tuple buffer for row_batch
-    tuple_buffer_size_ = row_batch->capacity() * tuple_byte_size_;
-    tuple_buffer_ = tuple_pool_->Allocate(tuple_buffer_size_);
-    tuple_ = reinterpret_cast<Tuple*>(tuple_buffer_);
-  }
-}
-
-Status HdfsScanner::InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition, 
-    DiskIoMgr::ScanRange* range, Tuple* template_tuple, ByteStream* byte_stream) {
-  // There is only one case where the scanner would get a new template_tuple
-  // memory location.  Most of the time, the template_tuple is copied into
-  // the tuple being materialized so the template tuple memory can be reused.  
-  // However, if there are no materialized slots (partition key only), then the 
-  // template tuple address is directly put into the tuplerows.  In this case we need
-  // a new memory location for the template tuple.  The memory savings is
-  // not important but the address of template_tuple is baked into the codegen
-  // functions.  In the case with no materialized slots, there is no codegen
-  // function so it is not a problem.
-  DCHECK(byte_stream != NULL);
-  current_scan_range_ = range;
-  template_tuple_ = template_tuple;
-  current_byte_stream_ = byte_stream;
-  has_noncompact_strings_ = (!scan_node_->compact_data() &&
-                             !scan_node_->tuple_desc()->string_slots().empty());
-  return Status::OK;
-}
-
-// In this code path, no slots were materialized from the input files.  The only
-// slots are from partition keys.  This lets us simplify writing out the batches.
-//   1. template_tuple_ is the complete tuple.
-//   2. Eval conjuncts against the tuple.
-//   3. If it passes, stamp out 'num_tuples' copies of it into the row_batch.
-int HdfsScanner::WriteEmptyTuples(RowBatch* row_batch, int num_tuples) {
-  // Cap the number of result tuples up at the limit
-  if (scan_node_->limit() != -1) {
-    num_tuples = min(num_tuples,
-        static_cast<int>(scan_node_->limit() - scan_node_->rows_returned()));
-  }
-  DCHECK_GT(num_tuples, 0);
-
-  if (template_tuple_ == NULL) {
-    // No slots from partitions keys or slots.  This is count(*).  Just add the
-    // number of rows to the batch.
-    row_batch->AddRows(num_tuples);
-    row_batch->CommitRows(num_tuples);
-  } else {
-    // Make a row and evaluate the row
-    int row_idx = row_batch->AddRow();
-    
-    TupleRow* current_row = row_batch->GetRow(row_idx);
-    current_row->SetTuple(scan_node_->tuple_idx(), template_tuple_);
-    if (!ExecNode::EvalConjuncts(conjuncts_, num_conjuncts_, current_row)) {
-      return 0;
-    }
-    // Add first tuple
-    row_batch->CommitLastRow();
-    --num_tuples;
-
-    DCHECK_LE(num_tuples, row_batch->capacity() - row_batch->num_rows());
-
-    for (int n = 0; n < num_tuples; ++n) {
-      DCHECK(!row_batch->IsFull());
-      row_idx = row_batch->AddRow();
-      DCHECK(row_idx != RowBatch::INVALID_ROW_INDEX);
-      TupleRow* current_row = row_batch->GetRow(row_idx);
-      current_row->SetTuple(scan_node_->tuple_idx(), template_tuple_);
-      row_batch->CommitLastRow();
-    }
-  } 
-  return num_tuples;
-}
-
 // In this code path, no slots were materialized from the input files.  The only
 // slots are from partition keys.  This lets us simplify writing out the batches.
 //   1. template_tuple_ is the complete tuple.
@@ -212,30 +212,134 @@ int HdfsScanner::WriteEmptyTuples(ScanRangeContext* context,
   return num_tuples;
 }
 
+// Returns the offset of the sync block (the -1 marker followed by sync) in buffer, or
+// buffer_len if there is none.
+// The marker and sync together don't fit in an sse register, so this searches for the
+// sync alone (with sse4.2 when it's at most 16 bytes) and then checks the marker
+// before each match.
+static int FindSyncBlock(const uint8_t* buffer, int buffer_len,
+    const uint8_t* sync, int sync_len) {
+  const int marker_len = sizeof(int32_t);
+  StringValue needle(const_cast<char*>(reinterpret_cast<const char*>(sync)), sync_len);
+  StringSearch search(&needle);
+
+  int start = marker_len;
+  while (start + sync_len <= buffer_len) {
+    StringValue haystack(const_cast<char*>(
+        reinterpret_cast<const char*>(buffer + start)), buffer_len - start);
+    int offset = search.Search(&haystack);
+    if (offset == -1) break;
+    offset += start;
+    const uint8_t* marker = buffer + offset - marker_len;
+    if ((marker[0] & marker[1] & marker[2] & marker[3]) == 0xff) {
+      return offset - marker_len;
+    }
+    start = offset + 1;
+  }
+  return buffer_len;
+}
+
+Status HdfsScanner::SkipToSync(const uint8_t* sync, int sync_size, bool* past_sync) {
+  bool eosr = false;
+  int offset = sync_size;
+  int buffer_len;
+  do {
+    uint8_t* buffer;
+  
+    RETURN_IF_ERROR(context_->GetRawBytes(&buffer, &buffer_len, &eosr));
+    offset = FindSyncBlock(buffer, buffer_len, sync, sync_size);
+    DCHECK_LE(offset, buffer_len);
+
+    // We need to check for a sync that spans buffers.
+    if (offset == buffer_len) {
+      // The marker (-1) and the sync can start anywhere in the
+      // last sync_size + 3 bytes of the buffer.
+      const int tail_size = sync_size + sizeof(int32_t) - 1;
+      uint8_t* bp = buffer + buffer_len - tail_size;
+      uint8_t save[2 * tail_size];
+
+      // Save the tail of the buffer.
+      memcpy(save, bp, tail_size);
+
+      // Read the next buffer.
+      if (!SerDeUtils::SkipBytes(context_, offset, &parse_status_)) return parse_status_;
+      RETURN_IF_ERROR(context_->GetRawBytes(&buffer, &buffer_len, &eosr));
+      offset = buffer_len;
+      if (buffer_len >= tail_size) {
+        memcpy(save + tail_size, buffer, tail_size);
+        offset = FindSyncBlock(save, 2 * tail_size, sync, sync_size);
+
+        // The sync mark does not span the buffers search the whole new buffer.
+        if (offset == 2 * tail_size) {
+          offset = buffer_len;
+          continue;
+        }
+
+        *past_sync = true;
+        // Adjust the offset to be relative to the start of the new buffer
+        offset -= tail_size;
+        // Adjust offset to be past the sync since it spans buffers.
+        offset += sync_size + sizeof(int32_t);
+      }
+    }
+
+    // Advance to the offset.  If *past_sync is set then this is past the sync block.
+    if (offset != 0) {
+      if (!SerDeUtils::SkipBytes(context_, offset, &parse_status_)) return parse_status_;
+    }
+  } while (offset >= buffer_len && !eosr);
+
+  if (!eosr) {
+    VLOG_FILE << "Found sync for: " << context_->filename()
+              << " at " << context_->file_offset() - (*past_sync ? offset : 0);
+  }
+
+  return Status::OK;
+}
+
 bool HdfsScanner::WriteCompleteTuple(MemPool* pool, FieldLocation* fields, 
     Tuple* tuple, TupleRow* tuple_row, Tuple* template_tuple,
     uint8_t* error_fields, uint8_t* error_in_row) {
   *error_in_row = false;
   // Initialize tuple before materializing slots
   InitTuple(template_tuple, tuple);
+  tuple_row->SetTuple(scan_node_->tuple_idx(), tuple);
 
-  for (int i = 0; i < scan_node_->materialized_slots().size(); ++i) {
-    int need_escape = false;
-    int len = fields[i].len;
-    if (UNLIKELY(len < 0)) {
-      len = -len;
-      need_escape = true;
+  // Write the slots in slot_materialization_order_, evaluating each conjunct as soon
+  // as the slots it needs are written, like the codegen'd version of this function.
+  int num_slots = slot_materialization_order_.size();
+  int order_idx = 0;
+  for (int conjunct_idx = 0; conjunct_idx <= num_conjuncts_; ++conjunct_idx) {
+    int end = conjunct_idx < num_conjuncts_ ?
+        num_slots_before_conjunct_[conjunct_idx] : num_slots;
+    for (; order_idx < end; ++order_idx) {
+      int i = slot_materialization_order_[order_idx];
+      int need_escape = false;
+      int len = fields[i].len;
+      if (UNLIKELY(len < 0)) {
+        len = -len;
+        need_escape = true;
+      }
+
+      SlotDescriptor* desc = scan_node_->materialized_slots()[i];
+      bool error = !text_converter_->WriteSlot(desc, tuple,
+          fields[i].start, len, context_->compact_data(), need_escape, pool);
+      error_fields[i] = error;
+      *error_in_row |= error;
+    }
+    if (conjunct_idx == num_conjuncts_) break;
+    DictionaryFilter* filter = dictionary_filters_[conjunct_idx].get();
+    bool passed = filter != NULL ? filter->Eval(tuple_row) :
+        ExecNode::EvalConjuncts(&conjuncts_[conjunct_idx], 1, tuple_row);
+    if (!passed) {
+      // The slots that were not written have no errors.
+      for (; order_idx < num_slots; ++order_idx) {
+        error_fields[slot_materialization_order_[order_idx]] = false;
+      }
+      return false;
     }
-
-    SlotDescriptor* desc = scan_node_->materialized_slots()[i];
-    bool error = !text_converter_->WriteSlot(desc, tuple,
-        fields[i].start, len, context_->compact_data(), need_escape, pool);
-    error_fields[i] = error;
-    *error_in_row |= error;
   }
-
-  tuple_row->SetTuple(scan_node_->tuple_idx(), tuple);
-  return ExecNode::EvalConjuncts(&conjuncts_mem_[0], num_conjuncts_, tuple_row);
+  return true;
 }
 
 // Codegen for WriteTuple(above).  The signature matches WriteTuple (except for the
@@ -533,7 +637,7 @@ bool HdfsScanner::ReportTupleParseError(FieldLocation* fields, uint8_t* errors,
 }
 
 void HdfsScanner::LogRowParseError(stringstream* ss, int row_idx) {
-  // This is only called for text and seq files which should override this function.
+  // This is only called for text, seq and rc files which should override this function.
   DCHECK(false);
 }
 
@@ -21,15 +21,17 @@
 #include <stdint.h>
 #include <boost/regex.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 
 #include "exec/scan-node.h"
 #include "runtime/disk-io-mgr.h"
 
 namespace impala {
 
-class ByteStream;
+class BatchConjunctEvaluator;
 class Compression;
 class DescriptorTbl;
+class DictionaryFilter;
 class Expr;
 class HdfsPartitionDescriptor;
 class HdfsScanNode;
@@ -58,25 +60,19 @@ struct FieldLocation {
   static const char* LLVM_CLASS_NAME;
 };
 
-// TODO: Remove this comment when all scanners are updated to use IO mgr.  See
-// ScanRangeContext comments for how the io mgr based scanners work.
 // HdfsScanners are instantiated by an HdfsScanNode to parse file data in a particular
 // format into Impala's Tuple structures. They are an abstract class; the actual mechanism
 // for parsing bytes into tuples is format specific and supplied by subclasses.  This
-// class provides methods to allocate tuple buffer data to write tuples to, and access to
-// the parent scan node to retrieve information that is constant across scan range
-// boundaries. The scan node provides a ByteStream* for reading bytes from (usually) an
-// HdfsByteStream. Management of any buffer space to stage those bytes is the
-// responsibility of the subclass.  The scan node also provides a template tuple
-// containing pre-materialised slots to initialise each tuple.
-// Subclasses must implement GetNext. They must also call 
-// scan_node_->IncrNumRowsReturned() for every row they write.
+// class provides access to the parent scan node to retrieve information that is
+// constant across scan range boundaries.  Each scanner object processes a single scan
+// range, reading its bytes from a ScanRangeContext which the io mgr fills
+// asynchronously; see the ScanRangeContext comments for how this works.  The context
+// also provides the template tuple containing pre-materialised slots to initialise
+// each tuple and the memory the tuples are written to.
 // The typical lifecycle is:
 //   1. Prepare
-//   2. InitCurrentScanRange
-//   3. GetNext
-//   4. Repeat 3 until scan range is exhausted
-//   5. Repeat from 2., if there are more scan ranges in the current file.
+//   2. ProcessScanRange
+//   3. Close
 // For codegen, the functionality is split into two parts.  
 //   1. During the Prepare() phase, the scanner subclass's Codegen() function will be
 //      called to perform codegen for that scanner type for the specific tuple desc.
@@ -92,24 +88,11 @@ class HdfsScanner {
   const static int FILE_BLOCK_SIZE = 4096;
 
   // scan_node - parent scan node
-  // filling materialized slots
-  // tuple_pool - mem pool owned by parent scan node for allocation
-  // of tuple buffer data
-  HdfsScanner(HdfsScanNode* scan_node, RuntimeState* state, MemPool* tuple_pool);
+  HdfsScanner(HdfsScanNode* scan_node, RuntimeState* state);
 
   virtual ~HdfsScanner();
 
-  // Writes parsed tuples into tuple buffer,
-  // and sets pointers in row_batch to point to them.
-  // row_batch may be non-full when all scan ranges have been read
-  virtual Status GetNext(RowBatch* row_batch, bool* eos) { 
-    // TODO: remove when all scanners are updated
-    DCHECK(false);
-    return Status::OK;
-  }
-
   // One-time initialisation of state that is constant across scan ranges.
-  // TODO: update comment when all scanners are using the io mgr.
   virtual Status Prepare();
 
   // Scanner subclasses must implement these static functions as well.  Unfortunately,
@@ -123,23 +106,20 @@ class HdfsScanner {
   // codegen the functions for each scanner object.
   // llvm::Function* Codegen(HdfsScanNode*);
 
-  // One-time initialisation of per-scan-range state.  The scanner objects are
-  // reused for different scan ranges so this function must reset all state.
-  virtual Status InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition, 
-      DiskIoMgr::ScanRange* scan_range, Tuple* template_tuple, ByteStream* byte_stream);
-
   // Process an entire scan range reading bytes from context.  Context is initialized
   // with the scan range meta data (e.g. template tuple, partition descriptor, etc).
   // This function should only return on error or end of scan range.
-  virtual Status ProcessScanRange(ScanRangeContext* context) {
-    // TODO: make this pure virtual when all scanners are updated.
-    return Status::OK;
-  }
+  virtual Status ProcessScanRange(ScanRangeContext* context) = 0;
 
   // Release all resources the scanner has allocated.  This is the last chance for
   // the scanner to attach any resources to the ScanRangeContext object.
   virtual Status Close() = 0;
 
+  // If not NULL, the scanner does not evaluate its conjuncts per tuple (num_conjuncts_
+  // is 0) and the caller must filter the materialized row batches with this evaluator
+  // instead.  Set in Prepare().
+  BatchConjunctEvaluator* conjunct_evaluator() { return conjunct_evaluator_.get(); }
+
   static const char* LLVM_CLASS_NAME;
   
  protected:
@@ -162,22 +142,32 @@ class HdfsScanner {
   // Cache of conjuncts_mem_.size()
   int num_conjuncts_;
 
-  // Contiguous block of memory into which tuples are written, allocated
-  // from tuple_pool_. We don't allocate individual tuples from tuple_pool_ directly,
-  // because MemPool::Allocate() always rounds up to the next 8 bytes
-  // (ie, would be wasteful if we had 2-byte tuples).
-  uint8_t* tuple_buffer_;
+  // Evaluates conjuncts_mem_ a row batch at a time, see conjunct_evaluator().
+  boost::scoped_ptr<BatchConjunctEvaluator> conjunct_evaluator_;
+
+  // For each conjunct that only depends on one string slot, the filter that evaluates
+  // it once per distinct value of the slot in this scan range; NULL for the other
+  // conjuncts.  Set in Prepare() if --enable_dictionary_filters is true.
+  std::vector<boost::shared_ptr<DictionaryFilter> > dictionary_filters_;
 
-  // Size of tuple_buffer_.
-  int tuple_buffer_size_;
+  // The order in which WriteCompleteTuple() writes the materialized slots (indexes
+  // into materialized_slots()).  With lazy materialization, the slots needed by
+  // each conjunct come before those only needed by later conjuncts.  Set in
+  // Prepare().
+  std::vector<int> slot_materialization_order_;
+
+  // For each of the num_conjuncts_ conjuncts, the number of slots at the start of
+  // slot_materialization_order_ that WriteCompleteTuple() writes before evaluating
+  // it.  Without lazy materialization, this is all slots.
+  std::vector<int> num_slots_before_conjunct_;
 
   // Fixed size of each tuple, in bytes
   int tuple_byte_size_;
 
-  // Contains all memory for tuple data, including string data which
-  // we can't reference in the file buffers (because it needs to be
-  // unescaped or straddles two file buffers). Owned by the parent
-  // scan node, since the data in it may need to outlive this scanner.
+  // Pool for tuple data, including string data which we can't reference in the
+  // file buffers (because it needs to be unescaped or straddles two file buffers).
+  // This is the pool returned by the last ScanRangeContext::GetMemory() call, so the
+  // data is owned by the row batch being written.
   MemPool* tuple_pool_;
 
   // Current tuple.
@@ -186,10 +176,6 @@ class HdfsScanner {
   // number of errors in current file
   int num_errors_in_file_;
 
-  // The current provider of bytes to parse. Usually only changes
-  // between files, so is active for the lifetime of a scanner.
-  ByteStream* current_byte_stream_;
- 
   // Helper class for converting text to other types;
   boost::scoped_ptr<TextConverter> text_converter_;
 
@@ -207,9 +193,6 @@ class HdfsScanner {
   // how to treat buffer memory that contains slot data.
   bool has_noncompact_strings_;
   
-  // The scan range currently being read
-  DiskIoMgr::ScanRange* current_scan_range_;
-  
   // Number of null bytes in the tuple.
   int32_t num_null_bytes_;
 
@@ -232,27 +215,32 @@ class HdfsScanner {
   // TODO: fix exprs
   Status CreateConjunctsCopy();
 
-  // Initializes write_tuples_fn_ to the jitted function if codegen is possible.
+  // Sets up dictionary_filters_ for the conjunct copies.
+  void CreateDictionaryFilters();
+
+  // Initializes write_tuples_fn_ to the jitted function if codegen is possible and
+  // the function has been compiled.  Called for each scan range, so scanners switch
+  // to the jitted function at the first range after it is compiled.
   // - partition - partition descriptor for this scanner/scan range
   // - type - type for this scanner
   // - scanner_name - debug string name for this scanner (e.g. HdfsTextScanner)
   Status InitializeCodegenFn(HdfsPartitionDescriptor* partition, 
       THdfsFileFormat::type type, const std::string& scanner_name);
 
-  // Allocates a buffer from tuple_pool_ large enough to hold one
-  // tuple for every remaining row in row_batch.  The tuple memory
-  // is uninitialized.
-  void AllocateTupleBuffer(RowBatch* row_batch);
-
   // Utility method to write out tuples when there are no materialized
-  // fields (e.g. select count(*) or only partition keys).
+  // fields (e.g. select count(*) or only partition keys).  The tuples are written
+  // to the rows starting at tuple_row; the caller must commit them to the context.
   //   num_tuples - Total number of tuples to write out.
-  // Returns the number of tuples added to the row batch.
-  int WriteEmptyTuples(RowBatch* row_batch, int num_tuples);
-
-  // Write empty tuples and commit them to the context object
+  // Returns the number of tuples written.
   int WriteEmptyTuples(ScanRangeContext* context, TupleRow* tuple_row, int num_tuples);
 
+  // Skips ahead in context_ to the start of the next sync block: the int -1 followed
+  // by the 'sync_size' byte 'sync' hash, which is how the sequence and rc file formats
+  // mark the record/row group boundaries a scan range can start at.  Skips to the
+  // end of the scan range if there is none.  If the sync block spans two io buffers it
+  // is skipped as well and *past_sync is set to true.
+  Status SkipToSync(const uint8_t* sync, int sync_size, bool* past_sync);
+
   // Processes batches of fields and writes them out to tuple_row_mem.
   // - 'pool' mempool to allocate from for auxiliary tuple memory
   // - 'tuple_row_mem' preallocated tuple_row memory this function must use.
@@ -285,7 +273,9 @@ class HdfsScanner {
 
   // Writes out all slots for 'tuple' from 'fields'. 'fields' must be aligned
   // to the start of the tuple (e.g. fields[0] maps to slots[0]).
-  // After writing the tuple, it will be evaluated against the conjuncts.
+  // The tuple is evaluated against the conjuncts as the slots are written; slots
+  // are written in slot_materialization_order_ and those after the slots of a
+  // failing conjunct are not written at all.
   //  - error_fields is an out array.  error_fields[i] will be set to true if the ith
   //    field had a parse error
   //  - error_in_row is an out bool.  It is set to true if any field had parse errors
@@ -14,6 +14,8 @@
 
 #include "exec/hdfs-sequence-scanner.h"
 
+#include <boost/bind.hpp>
+
 #include "codegen/llvm-codegen.h"
 #include "exec/delimited-text-parser.inline.h"
 #include "exec/hdfs-scan-node.h"
@@ -21,10 +23,11 @@
 #include "exec/serde-utils.inline.h"
 #include "exec/text-converter.inline.h"
 #include "runtime/descriptors.h"
+#include "runtime/exec-env.h"
 #include "runtime/runtime-state.h"
-#include "runtime/string-search.h"
 #include "runtime/tuple.h"
 #include "runtime/tuple-row.h"
+#include "util/thread-pool.h"
 
 using namespace boost;
 using namespace impala;
@@ -43,18 +46,31 @@ static const uint8_t SEQUENCE_FILE_RECORD_DELIMITER = 0xff;
 #define RETURN_IF_FALSE(x) if (UNLIKELY(!(x))) return parse_status_
 
 HdfsSequenceScanner::HdfsSequenceScanner(HdfsScanNode* scan_node, RuntimeState* state) 
-    : HdfsScanner(scan_node, state, NULL),
+    : HdfsScanner(scan_node, state),
       header_(NULL),
       unparsed_data_buffer_pool_(new MemPool()),
       unparsed_data_buffer_(NULL),
       num_buffered_records_in_compressed_block_(0),
       have_sync_(false),
-      block_start_(0) {
+      block_start_(0),
+      decompression_pool_(NULL),
+      next_block_(0) {
+  if (state->exec_env() != NULL) {
+    decompression_pool_ = state->exec_env()->decompression_pool();
+  }
+  for (int i = 0; i < 2; ++i) {
+    compressed_blocks_[i].pool.reset(new MemPool());
+  }
 }
 
 HdfsSequenceScanner::~HdfsSequenceScanner() {
+  WaitForDecompression();
   COUNTER_UPDATE(scan_node_->memory_used_counter(),
       unparsed_data_buffer_pool_->peak_allocated_bytes());
+  for (int i = 0; i < 2; ++i) {
+    COUNTER_UPDATE(scan_node_->memory_used_counter(),
+        compressed_blocks_[i].pool->peak_allocated_bytes());
+  }
 }
 
 void HdfsSequenceScanner::IssueInitialRanges(HdfsScanNode* scan_node, 
@@ -66,7 +82,7 @@ void HdfsSequenceScanner::IssueInitialRanges(HdfsScanNode* scan_node,
     // TODO: add remote disk id and plumb that through to the io mgr.  It should have
     // 1 queue for each NIC as well?
     DiskIoMgr::ScanRange* header_range = scan_node->AllocateScanRange(
-        files[i]->filename.c_str(), HEADER_SIZE, 0, partition_id, -1);
+        files[i]->filename.c_str(), HEADER_SIZE, 0, partition_id, -1, files[i]->mtime);
     scan_node->AddDiskIoRange(header_range);
   }
 }
@@ -76,10 +92,8 @@ void HdfsSequenceScanner::IssueFileRanges(const char* filename) {
   scan_node_->AddDiskIoRange(file_desc);
 }
 
-// Codegen for materialized parsed data into tuples.  
-// TODO: sequence file scanner needs to be split into a cross compiled ir file,
-// probably just for the block compressed path.  WriteCompleteTuple should be 
-// injected into that function.
+// Codegen for materialized parsed data into tuples.  Both the block compressed and
+// the record path write their tuples with the codegen'd WriteAlignedTuples().
 Function* HdfsSequenceScanner::Codegen(HdfsScanNode* node) {
   LlvmCodeGen* codegen = node->runtime_state()->llvm_codegen();
   if (codegen == NULL) return NULL;
@@ -147,14 +161,15 @@ Status HdfsSequenceScanner::ProcessScanRange(ScanRangeContext* context) {
     if (!context_->eosr()) {
       parse_status_ = Status::OK;
       ++num_errors;
-      status = SkipToSync();
-      if (context_->eosr()) break;
+      status = SkipToSync(header_->sync, SYNC_HASH_SIZE, &have_sync_);
+      // A block that was read ahead before the error still belongs to this range.
+      if (context_->eosr() && !compressed_blocks_[next_block_].issued) break;
 
       // If block compressed, reset the number of records.
       // We will be at the beginning of a block.
       num_buffered_records_in_compressed_block_ = 0;
     }
-  } while (!context_->eosr());
+  } while (!context_->eosr() || compressed_blocks_[next_block_].issued);
 
   if (num_errors != 0 || !status.ok()) {
     if (state_->LogHasSpace()) {
@@ -172,7 +187,11 @@ Status HdfsSequenceScanner::ProcessScanRange(ScanRangeContext* context) {
 }
 
 Status HdfsSequenceScanner::Close() {
+  WaitForDecompression();
   context_->AcquirePool(unparsed_data_buffer_pool_.get());
+  for (int i = 0; i < 2; ++i) {
+    context_->AcquirePool(compressed_blocks_[i].pool.get());
+  }
   if (!only_parsing_header_) scan_node_->RangeComplete();
   context_->Complete();
   return Status::OK;
@@ -191,6 +210,7 @@ Status HdfsSequenceScanner::InitNewRange() {
       hdfs_partition->escape_char()));
   
   num_buffered_records_in_compressed_block_ = 0;
+  next_block_ = 0;
 
   template_tuple_ = context_->template_tuple();
 
@@ -198,9 +218,19 @@ Status HdfsSequenceScanner::InitNewRange() {
     // For record-compressed data we always want to copy since they tend to be
     // small and occupy a bigger mempool chunk.
     if (!header_->is_blk_compressed) context_->set_compact_data(true);
-    RETURN_IF_ERROR(Codec::CreateDecompressor(state_,
-        unparsed_data_buffer_pool_.get(), context_->compact_data(),
-        header_->codec, &decompressor_));
+    if (header_->is_blk_compressed) {
+      for (int i = 0; i < 2; ++i) {
+        CompressedBlock* block = &compressed_blocks_[i];
+        DCHECK(!block->in_flight);
+        block->issued = false;
+        RETURN_IF_ERROR(Codec::CreateDecompressor(state_, block->pool.get(),
+            context_->compact_data(), header_->codec, &block->decompressor));
+      }
+    } else {
+      RETURN_IF_ERROR(Codec::CreateDecompressor(state_,
+          unparsed_data_buffer_pool_.get(), context_->compact_data(),
+          header_->codec, &decompressor_));
+    }
   }
   
   // Initialize codegen fn
@@ -215,8 +245,9 @@ Status HdfsSequenceScanner::Prepare() {
   // Allocate the scratch space for two pass parsing.  The most fields we can go
   // through in one parse pass is the batch size (tuples) * the number of fields per tuple
   // TODO: This should probably be based on L2/L3 cache sizes (as should the batch size)
-  record_locations_.resize(state_->batch_size());
-  field_locations_.resize(state_->batch_size() * scan_node_->materialized_slots().size());
+  record_locations_.resize(scan_node_->row_batch_capacity());
+  field_locations_.resize(
+      scan_node_->row_batch_capacity() * scan_node_->materialized_slots().size());
   
   decompress_timer_ = ADD_COUNTER(
       scan_node_->runtime_profile(), "DecompressionTime", TCounterType::CPU_TICKS);
@@ -224,23 +255,6 @@ Status HdfsSequenceScanner::Prepare() {
   return Status::OK;
 }
 
-int FindSyncBlock(const uint8_t* buffer, int buffer_len, 
-    const uint8_t* sync, int sync_len) {
-  char marker_and_sync[4 + sync_len];
-  marker_and_sync[0] = marker_and_sync[1] = 
-      marker_and_sync[2] = marker_and_sync[3] = 0xff;
-  memcpy(marker_and_sync + 4, sync, sync_len);
-
-  StringValue needle(marker_and_sync, 4 + sync_len);
-  StringValue haystack(
-      const_cast<char*>(reinterpret_cast<const char*>(buffer)), buffer_len);
-
-  StringSearch search(&needle);
-  int offset = search.Search(&haystack);
-  if (offset == -1) return buffer_len;
-  return offset;
-}
-
 Status HdfsSequenceScanner::FindFirstRecord(bool* found) {
   Status status;
   if (context_->scan_range()->offset() == 0) {
@@ -251,7 +265,7 @@ Status HdfsSequenceScanner::FindFirstRecord(bool* found) {
     return Status::OK;
   }
 
-  RETURN_IF_ERROR(SkipToSync());
+  RETURN_IF_ERROR(SkipToSync(header_->sync, SYNC_HASH_SIZE, &have_sync_));
   *found = !context_->eosr();
   return Status::OK;
 }
@@ -328,7 +342,8 @@ inline Status HdfsSequenceScanner::GetRecord(uint8_t** record_ptr,
 // Process block compressed sequence files.  This is the most used sequence file
 // format.  The general strategy is to process the data in large chunks to minimize
 // function calls.  The process is:
-// 1. Decompress an entire block
+// 1. Decompress an entire block.  If there is a decompression pool, the next block
+//    is read and decompressed on the pool while this one is parsed.
 // 2. In row batch sizes:
 //   a. Collect the start of records and their lengths
 //   b. Parse cols locations to field_locations_
@@ -338,11 +353,14 @@ inline Status HdfsSequenceScanner::GetRecord(uint8_t** record_ptr,
 Status HdfsSequenceScanner::ProcessBlockCompressedScanRange() {
   DCHECK(header_->is_blk_compressed);
 
-  while (!context_->eosr() || num_buffered_records_in_compressed_block_ > 0) {
+  while (!context_->eosr() || num_buffered_records_in_compressed_block_ > 0 ||
+      compressed_blocks_[next_block_].issued) {
     if (num_buffered_records_in_compressed_block_ == 0) {
-      if (context_->eosr()) return Status::OK;
-      // No more decompressed data, decompress the next block
-      RETURN_IF_ERROR(ReadCompressedBlock());
+      if (context_->eosr() && !compressed_blocks_[next_block_].issued) {
+        return Status::OK;
+      }
+      // No more decompressed data, get the next block
+      RETURN_IF_ERROR(GetCompressedBlock());
       if (num_buffered_records_in_compressed_block_ < 0) return parse_status_;
     }
     
@@ -454,40 +472,27 @@ Status HdfsSequenceScanner::ProcessRange() {
       int num_tuples = 0;
       int num_fields = 0;
       char* row_end_loc;
-      uint8_t error_in_row = false;
 
       RETURN_IF_ERROR(delimited_text_parser_->ParseFieldLocations(
           1, record_len, reinterpret_cast<char**>(&record), &row_end_loc,
           &field_locations_[0], &num_tuples, &num_fields, &col_start));
       DCHECK(num_tuples == 1);
       
-      uint8_t errors[num_fields];
-      memset(errors, 0, sizeof(errors));
-
-      add_row = WriteCompleteTuple(pool, &field_locations_[0], tuple_, tuple_row_mem,
-          template_tuple_, &errors[0], &error_in_row);
-
-      if (UNLIKELY(error_in_row)) {
-        for (int i = 0; i < scan_node_->materialized_slots().size(); ++i) {
-          if (errors[i]) {
-            const SlotDescriptor* desc = scan_node_->materialized_slots()[i];
-            ReportColumnParseError(
-                desc, field_locations_[i].start, field_locations_[i].len);
-          }
-        }
-        // Report all the fields that have errors.
-        ++num_errors_in_file_;
-        if (state_->LogHasSpace()) {
-          stringstream ss;
-          ss << "file: " << context_->filename() << endl
-             << "record: " << string(reinterpret_cast<char*>(record_start), record_len);
-          state_->LogError(ss.str());
-        }
-        if (state_->abort_on_error()) {
-          state_->ReportFileErrors(context_->filename(), 1);
-          return Status(state_->ErrorLog());
-        }
+      // LogRowParseError() reports the record from record_locations_.
+      record_locations_[0].record = record_start;
+      record_locations_[0].len = record_len;
+
+      // Call jitted function if possible
+      int tuples_returned;
+      if (write_tuples_fn_ != NULL) {
+        tuples_returned = write_tuples_fn_(this, pool, tuple_row_mem,
+            context_->row_byte_size(), &field_locations_[0], 1, 1, num_fields, 0);
+      } else {
+        tuples_returned = WriteAlignedTuples(pool, tuple_row_mem,
+            context_->row_byte_size(), &field_locations_[0], 1, 1, num_fields, 0);
       }
+      if (tuples_returned == -1) return parse_status_;
+      add_row = tuples_returned == 1;
     } else {
       add_row = WriteEmptyTuples(context_, tuple_row_mem, 1);
     }
@@ -617,72 +622,15 @@ Status HdfsSequenceScanner::CheckSync() {
   return Status::OK;
 }
 
-Status HdfsSequenceScanner::SkipToSync() {
-  bool eosr = false;
-  int offset = SYNC_HASH_SIZE;
-  int buffer_len;
-  do {
-    uint8_t* buffer;
-  
-    RETURN_IF_ERROR(context_->GetRawBytes(&buffer, &buffer_len, &eosr));
-    offset = FindSyncBlock(buffer, buffer_len, header_->sync, SYNC_HASH_SIZE);
-    DCHECK_LE(offset, buffer_len);
-
-    // We need to check for a sync that spans buffers.
-    if (offset == buffer_len) {
-      // The marker (-1) and the sync can start anywhere in the
-      // last 19 bytes of the buffer.  
-      static const int tail_size = SYNC_HASH_SIZE + sizeof(int32_t) - 1;
-      uint8_t* bp = buffer + buffer_len - tail_size;
-      uint8_t save[2 * tail_size];
-
-      // Save the tail of the buffer.
-      memcpy(save, bp, tail_size);
-
-      // Read the next buffer.
-      RETURN_IF_FALSE(SerDeUtils::SkipBytes(context_, offset, &parse_status_));
-      RETURN_IF_ERROR(context_->GetRawBytes(&buffer, &buffer_len, &eosr));
-      offset = buffer_len;
-      if (buffer_len >= tail_size) {
-        memcpy(save + tail_size, buffer, tail_size);
-        offset = FindSyncBlock(save, 2 * tail_size, header_->sync, SYNC_HASH_SIZE);
-
-        // The sync mark does not span the buffers search the whole new buffer.
-        if (offset == 2 * tail_size) {
-          offset = buffer_len;
-          continue;
-        }
-
-        have_sync_ = true;
-        // Adjust the offset to be relative to the start of the new buffer
-        offset -= tail_size;
-        // Adjust offset to be past the sync since it spans buffers.
-        offset += SYNC_HASH_SIZE + sizeof(int32_t);
-      }
-    }
-
-    // Advance to the offset.  If have_sync_ is set then this is past the sync block.
-    if (offset != 0) {
-      RETURN_IF_FALSE(SerDeUtils::SkipBytes(context_, offset, &parse_status_));
-    }
-  } while (offset >= buffer_len && !eosr);
-
-  if (!eosr) {
-    VLOG_FILE << "Found sync for: " << context_->filename()
-              << " at " << context_->file_offset() - (have_sync_ ? offset : 0);
-  }
-
-  return Status::OK;
-}
-
-Status HdfsSequenceScanner::ReadCompressedBlock() {
-  // We are reading a new compressed block.  Pass the previous buffer pool 
-  // bytes to the batch.  We don't need them anymore.
+Status HdfsSequenceScanner::ReadCompressedBlock(CompressedBlock* block) {
+  // We are reading a new compressed block into the block that was parsed before
+  // the current one.  Pass its buffer pool bytes to the batch.  We don't need them
+  // anymore.
   if (!context_->compact_data()) {
-    context_->AcquirePool(unparsed_data_buffer_pool_.get());
+    context_->AcquirePool(block->pool.get());
   }
 
-  block_start_ = context_->file_offset();
+  block->block_start = context_->file_offset();
   if (have_sync_) {
     // We skipped ahead on an error and read the sync block.
     have_sync_ = false;
@@ -704,12 +652,11 @@ Status HdfsSequenceScanner::ReadCompressedBlock() {
   }
 
   RETURN_IF_FALSE(SerDeUtils::ReadVLong(context_, 
-      &num_buffered_records_in_compressed_block_, &parse_status_));
-  if (num_buffered_records_in_compressed_block_ < 0) {
+      &block->num_records, &parse_status_));
+  if (block->num_records < 0) {
     if (state_->LogHasSpace()) {
       stringstream ss;
-      ss << "Bad compressed block record count: "
-         << num_buffered_records_in_compressed_block_;
+      ss << "Bad compressed block record count: " << block->num_records;
       state_->LogError(ss.str());
     }
     return Status("bad record count");
@@ -734,18 +681,72 @@ Status HdfsSequenceScanner::ReadCompressedBlock() {
     return Status(ss.str());
   }
   
-  uint8_t* compressed_data = NULL;
-  RETURN_IF_FALSE(
-      SerDeUtils::ReadBytes(context_, block_size, &compressed_data, &parse_status_));
+  block->compressed_len = block_size;
+  RETURN_IF_FALSE(SerDeUtils::ReadBytes(
+      context_, block_size, &block->compressed_data, &parse_status_));
+  return Status::OK;
+}
+
+void HdfsSequenceScanner::DecompressBlock(CompressedBlock* block) {
+  {
+    SCOPED_TIMER(decompress_timer_);
+    int len = 0;
+    block->status = block->decompressor->ProcessBlock(block->compressed_len,
+        block->compressed_data, &len, &block->data);
+  }
+  lock_guard<mutex> l(decompression_lock_);
+  block->in_flight = false;
+  decompression_done_cv_.notify_all();
+}
+
+void HdfsSequenceScanner::IssueCompressedBlock() {
+  DCHECK(decompression_pool_ != NULL);
+  CompressedBlock* block = &compressed_blocks_[next_block_];
+  DCHECK(!block->issued);
+  block->issued = true;
+  block->status = ReadCompressedBlock(block);
+  if (!block->status.ok()) return;
+
+  block->compressed_buffer.resize(block->compressed_len + 1);
+  memcpy(&block->compressed_buffer[0], block->compressed_data, block->compressed_len);
+  block->compressed_data = &block->compressed_buffer[0];
+  {
+    lock_guard<mutex> l(decompression_lock_);
+    block->in_flight = true;
+  }
+  decompression_pool_->Offer(bind(&HdfsSequenceScanner::DecompressBlock, this, block));
+}
+
+Status HdfsSequenceScanner::GetCompressedBlock() {
+  CompressedBlock* block = &compressed_blocks_[next_block_];
+  if (block->issued) {
+    unique_lock<mutex> l(decompression_lock_);
+    while (block->in_flight) decompression_done_cv_.wait(l);
+  } else {
+    // Nothing was read ahead, e.g. for the first block of the range.
+    block->status = ReadCompressedBlock(block);
+    if (block->status.ok()) DecompressBlock(block);
+  }
+  block->issued = false;
+  next_block_ = 1 - next_block_;
+  block_start_ = block->block_start;
+  RETURN_IF_ERROR(block->status);
+
+  num_buffered_records_in_compressed_block_ = block->num_records;
+  next_record_in_compressed_block_ = block->data;
 
-  int len = 0;
-  SCOPED_TIMER(decompress_timer_);
-  RETURN_IF_ERROR(decompressor_->ProcessBlock(block_size, compressed_data,
-      &len, &unparsed_data_buffer_));
-  next_record_in_compressed_block_ = unparsed_data_buffer_;
+  // Decompress the next block while the records of this one are parsed.
+  if (decompression_pool_ != NULL && !context_->eosr()) IssueCompressedBlock();
   return Status::OK;
 }
 
+void HdfsSequenceScanner::WaitForDecompression() {
+  unique_lock<mutex> l(decompression_lock_);
+  while (compressed_blocks_[0].in_flight || compressed_blocks_[1].in_flight) {
+    decompression_done_cv_.wait(l);
+  }
+}
+
 void HdfsSequenceScanner::LogRowParseError(stringstream* ss, int row_idx) {
   DCHECK(state_->LogHasSpace());
   DCHECK_LT(row_idx, record_locations_.size());
@@ -16,12 +16,17 @@
 #ifndef IMPALA_EXEC_HDFS_SEQUENCE_SCANNER_H
 #define IMPALA_EXEC_HDFS_SEQUENCE_SCANNER_H
 
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
 #include "util/codec.h"
 #include "exec/hdfs-scanner.h"
 #include "exec/delimited-text-parser.h"
 
 namespace impala {
 
+class ThreadPool;
+
 // This scanner parses Sequence file located in HDFS, and writes the
 // content as tuples in the Impala in-memory representation of data, e.g.
 // (tuples, rows, row batches).
@@ -233,9 +238,62 @@ class HdfsSequenceScanner : public HdfsScanner {
   // more common and can be parsed more efficiently in larger pieces.
   Status ProcessBlockCompressedScanRange();
 
-  // Read a compressed block.
-  // Decompress to unparsed_data_buffer_ allocated from unparsed_data_buffer_pool_.
-  Status ReadCompressedBlock();
+  // A block compressed block that is read by the scanner thread and decompressed,
+  // possibly on the decompression pool while the scanner parses the previous block.
+  // Each block has its own pool and decompressor so that decompressing one block
+  // does not touch the memory of the block being parsed.
+  struct CompressedBlock {
+    // Pool for the decompressed data.
+    boost::scoped_ptr<MemPool> pool;
+    boost::scoped_ptr<Codec> decompressor;
+
+    // File offset of the start of the block, for error messages.
+    int block_start;
+
+    // The compressed data.  If the block is decompressed on the decompression pool
+    // this points to compressed_buffer, since the bytes returned by the context are
+    // only valid until the next read.
+    uint8_t* compressed_data;
+    int compressed_len;
+    std::vector<uint8_t> compressed_buffer;
+
+    // Number of records in the block and the decompressed data.
+    int64_t num_records;
+    uint8_t* data;
+
+    // Error reading or decompressing the block.
+    Status status;
+
+    // True if the block is read but not yet returned by GetCompressedBlock().
+    bool issued;
+
+    // True while the block is being decompressed on the decompression pool.
+    // Protected by decompression_lock_.
+    bool in_flight;
+
+    CompressedBlock() : issued(false), in_flight(false) { }
+  };
+
+  // Read the header and the compressed data of the next block into 'block'.
+  Status ReadCompressedBlock(CompressedBlock* block);
+
+  // Decompress 'block', setting block->data and block->status.  Runs on the
+  // decompression pool if there is one.
+  void DecompressBlock(CompressedBlock* block);
+
+  // Read the next block into compressed_blocks_[next_block_] and decompress it,
+  // on the decompression pool if there is one.  Errors are returned with the block
+  // by GetCompressedBlock() so that the records of the current block are still
+  // returned.
+  void IssueCompressedBlock();
+
+  // Set next_record_in_compressed_block_ and num_buffered_records_in_compressed_block_
+  // to the next block, waiting for it to be decompressed.  The block is read and
+  // decompressed here if it has not been issued.
+  Status GetCompressedBlock();
+
+  // Wait for any block in flight on the decompression pool.
+  void WaitForDecompression();
 
   // Read compressed or uncompressed records from the byte stream into memory
   // in unparsed_data_buffer_pool_.  Not used for block compressed files.
@@ -248,10 +306,6 @@ class HdfsSequenceScanner : public HdfsScanner {
   // read and verify a sync block.
   Status CheckSync();
 
-  // Find the next sync block to start a scan range or recover from error.
-  // IF the sync block spanned a buffer then set have_sync_ = true.
-  Status SkipToSync();
-
   // Appends the current file and line to the RuntimeState's error log.
   // row_idx is 0-based (in current batch) where the parse error occured.
   virtual void LogRowParseError(std::stringstream*, int row_idx);
@@ -326,6 +380,18 @@ class HdfsSequenceScanner : public HdfsScanner {
   
   // Time spent decompressing bytes
   RuntimeProfile::Counter* decompress_timer_;
+
+  // Shared decompression threads, NULL if the scanner thread decompresses the blocks.
+  ThreadPool* decompression_pool_;
+
+  // The block compressed blocks are double buffered: while the records of one are
+  // parsed, the next is decompressed.  next_block_ is the one read next.
+  CompressedBlock compressed_blocks_[2];
+  int next_block_;
+
+  // Protects CompressedBlock::in_flight.
+  boost::mutex decompression_lock_;
+  boost::condition_variable decompression_done_cv_;
 };
 
 } // namespace impala
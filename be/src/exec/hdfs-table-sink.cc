@@ -16,27 +16,39 @@
 #include "exec/hdfs-text-table-writer.h"
 #include "exec/hdfs-trevni-table-writer.h"
 #include "exec/exec-node.h"
+#include "exec/insert-stats.h"
 #include "gen-cpp/JavaConstants_constants.h"
 #include "util/hdfs-util.h"
 #include "exprs/expr.h"
+#include "runtime/exec-env.h"
 #include "runtime/hdfs-fs-cache.h"
 #include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
 #include "runtime/string-value.inline.h"
+#include "util/thread-pool.h"
 
 #include <vector>
 #include <sstream>
 #include <hdfs.h>
+#include <boost/bind.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/date_time/posix_time/posix_time.hpp>
+#include <gflags/gflags.h>
 #include <stdlib.h>
 
 #include "gen-cpp/Data_types.h"
 
 using namespace std;
+using namespace boost;
 using namespace boost::posix_time;
 
+DEFINE_bool(insert_column_stats, false, "If true, INSERTs gather the row count and, "
+    "for every column, the number of NULLs, the smallest and largest value and the "
+    "number of distinct values of the rows they write to each partition while writing "
+    "them, and pass them to the metastore update.");
+
 namespace impala {
 
 HdfsTableSink::HdfsTableSink(const RowDescriptor& row_desc,
@@ -46,7 +58,13 @@ HdfsTableSink::HdfsTableSink(const RowDescriptor& row_desc,
        table_id_(tsink.table_sink.target_table_id),
        select_list_texprs_(select_list_texprs),
        partition_key_texprs_(tsink.table_sink.hdfs_table_sink.partition_key_exprs),
-       overwrite_(tsink.table_sink.hdfs_table_sink.overwrite) {
+       overwrite_(tsink.table_sink.hdfs_table_sink.overwrite),
+       input_is_clustered_(tsink.table_sink.hdfs_table_sink.__isset.input_is_clustered &&
+           tsink.table_sink.hdfs_table_sink.input_is_clustered),
+       num_partition_keys_(0),
+       last_partition_(NULL),
+       writer_pool_(NULL),
+       num_pending_writes_(0) {
   DCHECK(tsink.__isset.table_sink);
   stringstream unique_id_ss;
   unique_id_ss << unique_id.hi << "-" << unique_id.lo;
@@ -97,6 +115,13 @@ Status HdfsTableSink::Init(RuntimeState* state) {
   }
 
   PrepareExprs(state);
+  if (!dynamic_partition_key_exprs_.empty()) {
+    // At most one partition of clustered input has rows in a batch.
+    if (!input_is_clustered_) writer_pool_ = state->exec_env()->table_writer_pool();
+    partition_table_.resize(16, NULL);
+    key_values_pool_.reset(new MemPool());
+    row_key_values_.resize(dynamic_partition_key_exprs_.size());
+  }
 
   // Get file format for default partition in table descriptor, and
   // build a map from partition key values to partition descriptor for
@@ -238,7 +263,10 @@ Status HdfsTableSink::CreateNewTmpFile(RuntimeState* state,
   // Save the ultimate destination for this file (it will be moved by the coordinator)
   stringstream dest;
   dest << output_partition->hdfs_file_name_template << "." << output_partition->num_files;
-  (*state->hdfs_files_to_move())[output_partition->current_file_name] = dest.str();
+  {
+    lock_guard<mutex> l(lock_);
+    (*state->hdfs_files_to_move())[output_partition->current_file_name] = dest.str();
+  }
 
   ++output_partition->num_files;
   output_partition->num_rows = 0;
@@ -249,18 +277,26 @@ Status HdfsTableSink::InitOutputPartition(RuntimeState* state,
     const HdfsPartitionDescriptor& partition_descriptor,
     OutputPartition* output_partition) {
   output_partition->hdfs_connection = hdfs_connection_;
+  if (writer_pool_ != NULL) {
+    RETURN_IF_ERROR(Expr::CreateExprTrees(state->obj_pool(), select_list_texprs_,
+        &output_partition->output_exprs));
+    RETURN_IF_ERROR(
+        Expr::Prepare(output_partition->output_exprs, state, row_desc_, true));
+  } else {
+    output_partition->output_exprs = output_exprs_;
+  }
 
   switch (partition_descriptor.file_format()) {
     case THdfsFileFormat::TEXT: {
       output_partition->writer.reset(
-          new HdfsTextTableWriter(state, output_partition,
-                                  &partition_descriptor, table_desc_, output_exprs_));
+          new HdfsTextTableWriter(state, output_partition, &partition_descriptor,
+                                  table_desc_, output_partition->output_exprs));
       break;
     }
     case THdfsFileFormat::TREVNI: {
       output_partition->writer.reset(
-          new HdfsTrevniTableWriter(state, output_partition,
-                                    &partition_descriptor, table_desc_, output_exprs_));
+          new HdfsTrevniTableWriter(state, output_partition, &partition_descriptor,
+                                    table_desc_, output_partition->output_exprs));
       break;
     }
     default:
@@ -276,6 +312,15 @@ Status HdfsTableSink::InitOutputPartition(RuntimeState* state,
   }
   RETURN_IF_ERROR(output_partition->writer->Init());
   output_partition->partition_descriptor = &partition_descriptor;
+  if (FLAGS_insert_column_stats && output_partition->stats == NULL) {
+    int num_non_partition_cols =
+        table_desc_->num_cols() - table_desc_->num_clustering_cols();
+    vector<PrimitiveType> types;
+    for (int i = 0; i < num_non_partition_cols; ++i) {
+      types.push_back(output_partition->output_exprs[i]->type());
+    }
+    output_partition->stats.reset(new InsertStats(types));
+  }
   return CreateNewTmpFile(state, output_partition);
 }
 
@@ -284,7 +329,7 @@ void HdfsTableSink::GetHashTblKey(const vector<Expr*>& exprs, string* key) {
   TColumnValue col_val;
   for (int i = 0; i < dynamic_partition_key_exprs_.size(); ++i) {
     RawValue::PrintValueAsBytes(exprs[i]->GetValue(current_row_),
-                                exprs[0]->type(), &hash_table_key);
+                                exprs[i]->type(), &hash_table_key);
     // Additionally append "/" to avoid accidental key collisions.
     hash_table_key << "/";
   }
@@ -328,50 +373,198 @@ inline Status HdfsTableSink::GetOutputPartition(
   return Status::OK;
 }
 
+uint32_t HdfsTableSink::HashKeyValues(void* const* values) const {
+  uint32_t hash = 0;
+  for (int i = 0; i < dynamic_partition_key_exprs_.size(); ++i) {
+    hash = RawValue::GetHashValue(values[i], dynamic_partition_key_exprs_[i]->type(),
+        hash);
+  }
+  return hash;
+}
+
+bool HdfsTableSink::KeyValuesEq(void* const* v1, void* const* v2) const {
+  for (int i = 0; i < dynamic_partition_key_exprs_.size(); ++i) {
+    if (v1[i] == NULL || v2[i] == NULL) {
+      if (v1[i] != v2[i]) return false;
+      continue;
+    }
+    if (!RawValue::Eq(v1[i], v2[i], dynamic_partition_key_exprs_[i]->type())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HdfsTableSink::PartitionKey* HdfsTableSink::AddPartitionKey(uint32_t hash,
+    PartitionPair* partition_pair) {
+  PartitionKey* partition_key = reinterpret_cast<PartitionKey*>(
+      key_values_pool_->Allocate(sizeof(PartitionKey)));
+  partition_key->hash = hash;
+  partition_key->partition = partition_pair;
+  int num_keys = dynamic_partition_key_exprs_.size();
+  partition_key->key_values = reinterpret_cast<void**>(
+      key_values_pool_->Allocate(num_keys * sizeof(void*)));
+  for (int i = 0; i < num_keys; ++i) {
+    if (row_key_values_[i] == NULL) {
+      partition_key->key_values[i] = NULL;
+      continue;
+    }
+    PrimitiveType type = dynamic_partition_key_exprs_[i]->type();
+    int size = type == TYPE_STRING ? sizeof(StringValue) : GetByteSize(type);
+    partition_key->key_values[i] = key_values_pool_->Allocate(size);
+    RawValue::Write(row_key_values_[i], partition_key->key_values[i], type,
+        key_values_pool_.get());
+  }
+
+  if (2 * (num_partition_keys_ + 1) > partition_table_.size()) {
+    vector<PartitionKey*> old_table(2 * partition_table_.size(), NULL);
+    old_table.swap(partition_table_);
+    for (int i = 0; i < old_table.size(); ++i) {
+      if (old_table[i] == NULL) continue;
+      int bucket = old_table[i]->hash & (partition_table_.size() - 1);
+      while (partition_table_[bucket] != NULL) {
+        bucket = (bucket + 1) & (partition_table_.size() - 1);
+      }
+      partition_table_[bucket] = old_table[i];
+    }
+  }
+  int bucket = hash & (partition_table_.size() - 1);
+  while (partition_table_[bucket] != NULL) {
+    bucket = (bucket + 1) & (partition_table_.size() - 1);
+  }
+  partition_table_[bucket] = partition_key;
+  ++num_partition_keys_;
+  return partition_key;
+}
+
+inline Status HdfsTableSink::GetRowPartition(RuntimeState* state, RowBatch* batch,
+    PartitionPair** partition_pair) {
+  for (int i = 0; i < dynamic_partition_key_exprs_.size(); ++i) {
+    row_key_values_[i] = dynamic_partition_key_exprs_[i]->GetValue(current_row_);
+  }
+  if (last_partition_ != NULL &&
+      KeyValuesEq(&row_key_values_[0], last_partition_->key_values)) {
+    *partition_pair = last_partition_->partition;
+    return Status::OK;
+  }
+  if (input_is_clustered_ && last_partition_ != NULL) {
+    RETURN_IF_ERROR(CloseClusteredPartition(state, batch, last_partition_->partition));
+  }
+
+  uint32_t hash = HashKeyValues(&row_key_values_[0]);
+  int bucket = hash & (partition_table_.size() - 1);
+  while (partition_table_[bucket] != NULL) {
+    PartitionKey* partition_key = partition_table_[bucket];
+    if (partition_key->hash == hash &&
+        KeyValuesEq(&row_key_values_[0], partition_key->key_values)) {
+      last_partition_ = partition_key;
+      *partition_pair = partition_key->partition;
+      OutputPartition* output_partition = (*partition_pair)->first;
+      if (output_partition->writer == NULL) {
+        // A closed partition of clustered input; continue in a new file.
+        RETURN_IF_ERROR(InitOutputPartition(state,
+            *output_partition->partition_descriptor, output_partition));
+      }
+      return Status::OK;
+    }
+    bucket = (bucket + 1) & (partition_table_.size() - 1);
+  }
+
+  // First row of this partition.
+  string key;
+  GetHashTblKey(dynamic_partition_key_exprs_, &key);
+  RETURN_IF_ERROR(GetOutputPartition(state, key, partition_pair));
+  last_partition_ = AddPartitionKey(hash, *partition_pair);
+  return Status::OK;
+}
+
+Status HdfsTableSink::WritePartition(RuntimeState* state, RowBatch* batch,
+    PartitionPair* partition_pair) {
+  // Pass the row batch to the writer. If new_file is returned true then the current
+  // file is finalized and a new file is opened.
+  // The writer tracks where it is in the batch when it returns with new_file set.
+  OutputPartition* output_partition = partition_pair->first;
+  bool new_file;
+  do {
+    RETURN_IF_ERROR(output_partition->writer->AppendRowBatch(
+            batch, partition_pair->second, &new_file));
+    if (new_file) {
+      RETURN_IF_ERROR(FinalizePartitionFile(state, output_partition));
+      RETURN_IF_ERROR(CreateNewTmpFile(state, output_partition));
+    }
+  } while (new_file);
+  partition_pair->second.clear();
+  return Status::OK;
+}
+
+Status HdfsTableSink::CloseClusteredPartition(RuntimeState* state, RowBatch* batch,
+    PartitionPair* partition_pair) {
+  DCHECK(input_is_clustered_);
+  OutputPartition* output_partition = partition_pair->first;
+  if (output_partition->writer == NULL) return Status::OK;
+  RETURN_IF_ERROR(WritePartition(state, batch, partition_pair));
+  RETURN_IF_ERROR(FinalizePartitionFile(state, output_partition));
+  output_partition->writer.reset();
+  return Status::OK;
+}
+
+void HdfsTableSink::WritePartitionInPool(RuntimeState* state, RowBatch* batch,
+    PartitionPair* partition_pair) {
+  Status status = WritePartition(state, batch, partition_pair);
+  lock_guard<mutex> l(lock_);
+  if (write_status_.ok() && !status.ok()) write_status_ = status;
+  if (--num_pending_writes_ == 0) writes_done_cv_.notify_one();
+}
+
 Status HdfsTableSink::Send(RuntimeState* state, RowBatch* batch) {
   // If there are no partition keys then just pass the whole batch to one partition.
   if (dynamic_partition_key_exprs_.empty()) {
     // If there are no dynamic keys just use an empty key.
     PartitionPair* partition_pair;
     RETURN_IF_ERROR(GetOutputPartition(state, "", &partition_pair));
-    // Pass the row batch to the writer. If new_file is returned true then the current
-    // file is finalized and a new file is opened.
-    // The writer tracks where it is in the batch when it returns with new_file set.
-    OutputPartition* output_partition = partition_pair->first;
-    bool new_file;
-    do {
-      RETURN_IF_ERROR(output_partition->writer->AppendRowBatch(
-              batch, partition_pair->second, &new_file));
-      if (new_file) {
-        RETURN_IF_ERROR(FinalizePartitionFile(state, output_partition));
-        RETURN_IF_ERROR(CreateNewTmpFile(state, output_partition));
-      }
-    } while (new_file);
+    RETURN_IF_ERROR(WritePartition(state, batch, partition_pair));
+  } else if (input_is_clustered_) {
+    // GetRowPartition() writes and closes each partition that ends in this batch; the
+    // last one stays open for the next batch.
+    for (int i = 0; i < batch->num_rows(); ++i) {
+      current_row_ = batch->GetRow(i);
+      PartitionPair* partition_pair = NULL;
+      RETURN_IF_ERROR(GetRowPartition(state, batch, &partition_pair));
+      partition_pair->second.push_back(i);
+    }
+    if (last_partition_ != NULL) {
+      RETURN_IF_ERROR(WritePartition(state, batch, last_partition_->partition));
+    }
   } else {
     for (int i = 0; i < batch->num_rows(); ++i) {
       current_row_ = batch->GetRow(i);
-
-      string key;
-      GetHashTblKey(dynamic_partition_key_exprs_, &key);
       PartitionPair* partition_pair = NULL;
-      RETURN_IF_ERROR(GetOutputPartition(state, key, &partition_pair));
+      RETURN_IF_ERROR(GetRowPartition(state, batch, &partition_pair));
       partition_pair->second.push_back(i);
     }
+    vector<PartitionPair*> partitions;
     for (PartitionMap::iterator partition = partition_keys_to_output_partitions_.begin();
          partition != partition_keys_to_output_partitions_.end(); ++partition) {
-      OutputPartition* output_partition = partition->second.first;
-      if (partition->second.second.empty()) continue;
-
-      bool new_file;
-      do {
-        RETURN_IF_ERROR(output_partition->writer->AppendRowBatch(
-                batch, partition->second.second, &new_file));
-        if (new_file) {
-          RETURN_IF_ERROR(FinalizePartitionFile(state, output_partition));
-          RETURN_IF_ERROR(CreateNewTmpFile(state, output_partition));
-        }
-      } while (new_file);
-      partition->second.second.clear();
+      if (!partition->second.second.empty()) partitions.push_back(&partition->second);
+    }
+    if (writer_pool_ == NULL || partitions.size() == 1) {
+      for (int i = 0; i < partitions.size(); ++i) {
+        RETURN_IF_ERROR(WritePartition(state, batch, partitions[i]));
+      }
+    } else {
+      // The writers use their own exprs and files; wait for them since the batch
+      // is only valid until Send() returns.
+      {
+        lock_guard<mutex> l(lock_);
+        num_pending_writes_ = partitions.size();
+      }
+      for (int i = 0; i < partitions.size(); ++i) {
+        writer_pool_->Offer(bind(&HdfsTableSink::WritePartitionInPool, this, state,
+            batch, partitions[i]));
+      }
+      unique_lock<mutex> l(lock_);
+      while (num_pending_writes_ > 0) writes_done_cv_.wait(l);
+      RETURN_IF_ERROR(write_status_);
     }
   }
   return Status::OK;
@@ -379,11 +572,14 @@ Status HdfsTableSink::Send(RuntimeState* state, RowBatch* batch) {
 
 Status HdfsTableSink::FinalizePartitionFile(RuntimeState* state,
                                             OutputPartition* partition) {
-  partition->writer->Finalize();
+  RETURN_IF_ERROR(partition->writer->Finalize());
 
   // Track total number of appended rows per partition in runtime
   // state. partition->num_rows counts number of rows appended is per-file.
-  (*state->num_appended_rows())[partition->partition_name] += partition->num_rows;
+  {
+    lock_guard<mutex> l(lock_);
+    (*state->num_appended_rows())[partition->partition_name] += partition->num_rows;
+  }
 
   // Close file.
   int hdfs_ret = hdfsCloseFile(hdfs_connection_, partition->tmp_hdfs_file);
@@ -401,7 +597,14 @@ Status HdfsTableSink::Close(RuntimeState* state) {
            partition_keys_to_output_partitions_.begin();
        cur_partition != partition_keys_to_output_partitions_.end();
        ++cur_partition) {
-    RETURN_IF_ERROR(FinalizePartitionFile(state, cur_partition->second.first));
+    OutputPartition* partition = cur_partition->second.first;
+    if (partition->stats != NULL) {
+      partition->stats->AddTo(
+          &(*state->insert_partition_stats())[partition->partition_name]);
+    }
+    // Closed partitions of clustered input have no writer or open file.
+    if (partition->writer == NULL) continue;
+    RETURN_IF_ERROR(FinalizePartitionFile(state, partition));
   }
   return Status::OK;
 }
@@ -19,10 +19,13 @@
 #include <hdfs.h>
 #include <boost/unordered_map.hpp>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
 
 // needed for scoped_ptr to work on ObjectPool
 #include "common/object-pool.h"
 #include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
 #include "exec/data-sink.h"
 
 namespace impala {
@@ -32,6 +35,8 @@ class TupleDescriptor;
 class TupleRow;
 class RuntimeState;
 class HdfsTableWriter;
+class InsertStats;
+class ThreadPool;
 
 // Records the temporary and final Hdfs file name,
 // the opened temporary Hdfs file, and the number of appended rows
@@ -76,6 +81,15 @@ struct OutputPartition {
   // Table format specific writer functions.
   boost::scoped_ptr<HdfsTableWriter> writer;
 
+  // Statistics of all rows written to this partition, over all its files; NULL
+  // unless --insert_column_stats is set.
+  boost::scoped_ptr<InsertStats> stats;
+
+  // Exprs that materialize the output values for writer.  Exprs evaluate into their
+  // own buffers, so partitions that are written in parallel each have their own copy
+  // of the sink's output exprs.
+  std::vector<Expr*> output_exprs;
+
   // The descriptor for this partition.
   const HdfsPartitionDescriptor* partition_descriptor;
 };
@@ -111,6 +125,21 @@ struct OutputPartition {
 // The temporary directory is <table base dir>/<unique_id.hi>-<unique_id.lo>_data
 // such that an external tool can easily clean up incomplete inserts.
 // This is consistent with Hive's behavior.
+//
+// Parallel writes:
+// Send() routes the rows of a batch to their partitions on the calling thread. If
+// more than one partition received rows, the partitions' writers format, compress
+// and write them to Hdfs in parallel on the ExecEnv's table writer pool. Send()
+// returns once all of them are done with the batch, so at most one batch per sink
+// is buffered.
+//
+// Clustered input:
+// If the planner sorted the input by the partition keys (input_is_clustered), the
+// rows of each partition are consecutive. The sink then writes a partition's rows
+// as soon as the next partition starts, closes its file and frees its writer, so
+// only one partition file and writer buffer are open at a time no matter how many
+// partitions the insert writes. Should the rows of a closed partition show up again,
+// the partition gets a new file.
 class HdfsTableSink : public DataSink {
  public:
   HdfsTableSink(const RowDescriptor& row_desc, const TUniqueId& unique_id,
@@ -164,6 +193,38 @@ class HdfsTableSink : public DataSink {
   Status GetOutputPartition(RuntimeState* state, const std::string& key,
                             PartitionPair** partition_pair);
 
+  // Returns the output partition of current_row_ by looking up its evaluated dynamic
+  // partition keys in partition_table_.  The string key of GetHashTblKey() is only
+  // built the first time a partition is seen.
+  // If the input is clustered and current_row_ starts a new partition, the rows of
+  // 'batch' routed to the previous partition are written and the previous partition
+  // is closed first.
+  Status GetRowPartition(RuntimeState* state, RowBatch* batch,
+                         PartitionPair** partition_pair);
+
+  // Writes the rows of 'batch' routed to 'partition_pair', finalizes its current file
+  // and frees its writer.
+  Status CloseClusteredPartition(RuntimeState* state, RowBatch* batch,
+                                 PartitionPair* partition_pair);
+
+  // An output partition and the values of its dynamic partition keys (NULL for NULL
+  // keys).  Allocated from key_values_pool_, like the values.
+  struct PartitionKey {
+    uint32_t hash;
+    PartitionPair* partition;
+    void** key_values;
+  };
+
+  // Returns the hash of the dynamic partition key values 'values'.
+  uint32_t HashKeyValues(void* const* values) const;
+
+  // Returns true if the dynamic partition key values 'v1' and 'v2' are equal.
+  bool KeyValuesEq(void* const* v1, void* const* v2) const;
+
+  // Adds a PartitionKey for 'partition_pair' and row_key_values_ with 'hash' to
+  // partition_table_, and returns it.
+  PartitionKey* AddPartitionKey(uint32_t hash, PartitionPair* partition_pair);
+
   // Initialise and prepare select and partition key expressions
   Status PrepareExprs(RuntimeState* state);
 
@@ -177,6 +238,16 @@ class HdfsTableSink : public DataSink {
   // the partition.
   Status FinalizePartitionFile(RuntimeState* state, OutputPartition* partition);
 
+  // Appends the rows of 'batch' that were routed to 'partition_pair' to its current
+  // file, opening new files as the writer asks for them, and clears the list of rows.
+  Status WritePartition(RuntimeState* state, RowBatch* batch,
+                        PartitionPair* partition_pair);
+
+  // Work item for writer_pool_: calls WritePartition(), records a failure in
+  // write_status_ and signals writes_done_cv_.
+  void WritePartitionInPool(RuntimeState* state, RowBatch* batch,
+                            PartitionPair* partition_pair);
+
   // Descriptor of target table. Set in Init().
   const HdfsTableDescriptor* table_desc_;
 
@@ -212,6 +283,9 @@ class HdfsTableSink : public DataSink {
   // Indicates whether the existing partitions should be overwritten.
   bool overwrite_;
 
+  // If true, the rows of each partition arrive consecutively; see the class comment.
+  bool input_is_clustered_;
+
   // string representation of c'tors unique_id. Used for per-partition Hdfs file names,
   // and for tmp Hdfs directories. Set in Prepare();
   std::string unique_id_str_;
@@ -237,6 +311,35 @@ class HdfsTableSink : public DataSink {
   typedef boost::unordered_map<std::string, HdfsPartitionDescriptor*>
       PartitionDescriptorMap;
   PartitionDescriptorMap partition_descriptor_map_;
+
+  // Open addressing hash table of the PartitionKeys of the output partitions.  NULL
+  // for empty buckets; the number of buckets is a power of two that is at least twice
+  // the number of partitions.
+  std::vector<PartitionKey*> partition_table_;
+  int num_partition_keys_;
+  boost::scoped_ptr<MemPool> key_values_pool_;
+
+  // Partition of the previous row routed by GetRowPartition().  Rows of sorted or
+  // clustered input usually go to the same partition as their predecessors.
+  PartitionKey* last_partition_;
+
+  // Dynamic partition key values of current_row_.
+  std::vector<void*> row_key_values_;
+
+  // Threads that write partitions in parallel, shared with the other sinks.  NULL if
+  // partitions are written by the calling thread.  Set in Init().
+  ThreadPool* writer_pool_;
+
+  // Protects the state below, as well as the runtime state's maps of appended rows
+  // and files to move while writes are in flight.
+  boost::mutex lock_;
+
+  // Number of WritePartitionInPool() calls of the current batch that haven't finished.
+  int num_pending_writes_;
+  boost::condition_variable writes_done_cv_;
+
+  // First error of a WritePartitionInPool() call.
+  Status write_status_;
 };
 }
 #endif
@@ -25,7 +25,8 @@ HdfsTableWriter::HdfsTableWriter(RuntimeState* state, OutputPartition* output,
   : state_(state),
     output_(output),
     table_desc_(table_desc),
-    output_exprs_(output_exprs) {
+    output_exprs_(output_exprs),
+    row_values_(table_desc->num_cols() - table_desc->num_clustering_cols()) {
 }
 
 Status HdfsTableWriter::Write(const uint8_t* data, int32_t len) {
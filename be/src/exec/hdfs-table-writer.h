@@ -22,6 +22,7 @@
 
 #include "runtime/descriptors.h"
 #include "exec/hdfs-table-sink.h"
+#include "exec/insert-stats.h"
 #include "util/hdfs-util.h"
 
 namespace impala {
@@ -71,6 +72,12 @@ class HdfsTableWriter {
   }
   Status Write(const uint8_t* data, int32_t len);
 
+  // Adds the row that was just appended, whose values the writer stored in
+  // row_values_, to the partition's statistics if they are gathered.
+  void AddRowToStats() {
+    if (output_->stats != NULL) output_->stats->AddRow(&row_values_[0]);
+  }
+
   // Runtime state.
   RuntimeState* state_;
 
@@ -82,6 +89,10 @@ class HdfsTableWriter {
 
   // Expressions that materialize output values.
   std::vector<Expr*> output_exprs_;
+
+  // Values of the non-partition columns of the row being appended (see
+  // AddRowToStats()).
+  std::vector<void*> row_values_;
 };
 }
 #endif
@@ -23,6 +23,7 @@
 #include "exec/text-converter.inline.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
+#include "util/codec.h"
 #include "util/cpu-info.h"
 #include "util/debug-util.h"
 
@@ -31,10 +32,14 @@ using namespace impala;
 using namespace llvm;
 using namespace std;
 
+DEFINE_int64(text_scan_range_min_split_size, 32 * 1024 * 1024,
+    "Text scan ranges are split into smaller ranges, of at least this many bytes, "
+    "when a scan has fewer ranges than scanner threads.  0 disables splitting.");
+
 const char* HdfsTextScanner::LLVM_CLASS_NAME = "class.impala::HdfsTextScanner";
 
 HdfsTextScanner::HdfsTextScanner(HdfsScanNode* scan_node, RuntimeState* state) 
-    : HdfsScanner(scan_node, state, NULL),
+    : HdfsScanner(scan_node, state),
       boundary_mem_pool_(new MemPool()),
       boundary_row_(boundary_mem_pool_.get()),
       boundary_column_(boundary_mem_pool_.get()),
@@ -42,12 +47,19 @@ HdfsTextScanner::HdfsTextScanner(HdfsScanNode* scan_node, RuntimeState* state)
       byte_buffer_ptr_(NULL),
       byte_buffer_end_(NULL),
       byte_buffer_read_size_(0),
-      error_in_row_(false) {
+      error_in_row_(false),
+      decompressed_data_pool_(new MemPool()),
+      compressed_data_(NULL),
+      compressed_data_len_(0),
+      stream_end_(false),
+      decompression_done_(false) {
 }
 
 HdfsTextScanner::~HdfsTextScanner() {
   COUNTER_UPDATE(scan_node_->memory_used_counter(),
       boundary_mem_pool_->peak_allocated_bytes());
+  COUNTER_UPDATE(scan_node_->memory_used_counter(),
+      decompressed_data_pool_->peak_allocated_bytes());
 }
 
 void HdfsTextScanner::IssueInitialRanges(HdfsScanNode* scan_node, 
@@ -58,9 +70,63 @@ void HdfsTextScanner::IssueInitialRanges(HdfsScanNode* scan_node,
   }
 }
 
+int HdfsTextScanner::SplitRanges(HdfsScanNode* scan_node,
+    const vector<HdfsFileDesc*>& files, int num_ranges) {
+  if (FLAGS_text_scan_range_min_split_size <= 0 || num_ranges == 0) return 0;
+  int num_threads = scan_node->runtime_state()->num_scanner_threads();
+  if (num_threads == 0) num_threads = CpuInfo::num_cores();
+  if (num_ranges >= num_threads) return 0;
+  int64_t max_pieces = (num_threads + num_ranges - 1) / num_ranges;
+
+  int num_added = 0;
+  for (int i = 0; i < files.size(); ++i) {
+    vector<DiskIoMgr::ScanRange*>& ranges = files[i]->ranges;
+    if (ranges.empty()) continue;
+    int64_t partition_id = reinterpret_cast<int64_t>(ranges[0]->meta_data());
+    HdfsPartitionDescriptor* partition =
+        scan_node->hdfs_table()->GetPartition(partition_id);
+    // Compressed files can only be read from the start.
+    if (partition == NULL || partition->compression() != THdfsCompression::NONE) {
+      continue;
+    }
+
+    vector<DiskIoMgr::ScanRange*> split_ranges;
+    for (int j = 0; j < ranges.size(); ++j) {
+      DiskIoMgr::ScanRange* range = ranges[j];
+      int64_t num_pieces =
+          min(max_pieces, range->len() / FLAGS_text_scan_range_min_split_size);
+      if (num_pieces <= 1) {
+        split_ranges.push_back(range);
+        continue;
+      }
+      int64_t piece_len = range->len() / num_pieces;
+      int64_t offset = range->offset();
+      int64_t end = range->offset() + range->len();
+      for (int k = 0; k < num_pieces; ++k) {
+        int64_t len = (k == num_pieces - 1) ? end - offset : piece_len;
+        split_ranges.push_back(scan_node->AllocateScanRange(range->file(), len, offset,
+            partition_id, range->disk_id(), range->mtime()));
+        offset += len;
+      }
+      num_added += num_pieces - 1;
+    }
+    ranges.swap(split_ranges);
+  }
+  if (num_added > 0) {
+    VLOG_FILE << "Split text scan ranges into " << num_ranges + num_added
+              << " ranges for " << num_threads << " scanner threads.";
+  }
+  return num_added;
+}
+
 Status HdfsTextScanner::ProcessScanRange(ScanRangeContext* context) {
   // Reset state for new scan range
-  InitNewRange(context);
+  RETURN_IF_ERROR(InitNewRange(context));
+
+  // Compressed files are read entirely by the range at the start of the file.
+  if (decompressor_.get() != NULL && context_->scan_range()->offset() != 0) {
+    return Status::OK;
+  }
 
   // Find the first tuple.  If eosr is true, it means we went through the entire
   // scan range without finding a single tuple.  The bytes will be picked up
@@ -83,12 +149,13 @@ Status HdfsTextScanner::ProcessScanRange(ScanRangeContext* context) {
 
 Status HdfsTextScanner::Close() {
   context_->AcquirePool(boundary_mem_pool_.get());
+  context_->AcquirePool(decompressed_data_pool_.get());
   scan_node_->RangeComplete();
   context_->Complete();
   return Status::OK;
 }
 
-void HdfsTextScanner::InitNewRange(ScanRangeContext* context) {
+Status HdfsTextScanner::InitNewRange(ScanRangeContext* context) {
   context->set_read_past_buffer_size(NEXT_BLOCK_READ_SIZE);
   context_ = context;
   HdfsPartitionDescriptor* hdfs_partition = context_->partition_descriptor();
@@ -124,8 +191,23 @@ void HdfsTextScanner::InitNewRange(ScanRangeContext* context) {
   partial_tuple_ = reinterpret_cast<Tuple*>(
       boundary_mem_pool_->Allocate(scan_node_->tuple_desc()->byte_size()));
 
+  compressed_data_ = NULL;
+  compressed_data_len_ = 0;
+  stream_end_ = false;
+  decompression_done_ = false;
+  Codec* decompressor;
+  RETURN_IF_ERROR(Codec::CreateDecompressor(state_, decompressed_data_pool_.get(),
+      context_->compact_data(), hdfs_partition->compression(), &decompressor));
+  decompressor_.reset(decompressor);
+  if (decompressor_.get() != NULL) {
+    // The rest of the file is read past the end of the range in io buffer sized
+    // pieces.
+    context->set_read_past_buffer_size(state_->io_mgr()->read_buffer_size());
+  }
+
   // Initialize codegen fn
   InitializeCodegenFn(hdfs_partition, THdfsFileFormat::TEXT, "HdfsTextScanner");
+  return Status::OK;
 }
 
 Status HdfsTextScanner::FinishScanRange() {
@@ -263,6 +345,7 @@ Status HdfsTextScanner::ProcessRange(int* num_tuples, bool past_scan_range) {
 
 Status HdfsTextScanner::FillByteBuffer(bool* eosr, int num_bytes) {
   *eosr = false;
+  if (decompressor_.get() != NULL) return FillCompressedByteBuffer(eosr);
   Status status;
   context_->GetBytes(
       reinterpret_cast<uint8_t**>(&byte_buffer_ptr_), num_bytes, 
@@ -271,6 +354,51 @@ Status HdfsTextScanner::FillByteBuffer(bool* eosr, int num_bytes) {
   return status;
 }
 
+Status HdfsTextScanner::FillCompressedByteBuffer(bool* eosr) {
+  // The previous decompressed buffers are only needed by the rows that were
+  // already committed.
+  if (!context_->compact_data()) {
+    context_->AcquirePool(decompressed_data_pool_.get());
+  }
+
+  byte_buffer_read_size_ = 0;
+  while (byte_buffer_read_size_ == 0 && !decompression_done_) {
+    if (compressed_data_len_ == 0) {
+      // Within the scan range, get the next io buffer.  Past it, read the rest of
+      // the file one io buffer at a time.
+      bool past_scan_range = context_->eosr();
+      int read_size = past_scan_range ? state_->io_mgr()->read_buffer_size() : 0;
+      bool eos;
+      Status status;
+      if (!context_->GetBytes(&compressed_data_, read_size, &compressed_data_len_,
+          &eos, &status)) {
+        return status;
+      }
+      if (compressed_data_len_ == 0 && past_scan_range) {
+        if (!stream_end_) {
+          stringstream ss;
+          ss << "Compressed file is truncated: " << context_->filename();
+          return Status(ss.str());
+        }
+        decompression_done_ = true;
+        break;
+      }
+    }
+
+    int bytes_read;
+    uint8_t* output;
+    SCOPED_TIMER(decompress_timer_);
+    RETURN_IF_ERROR(decompressor_->ProcessBlockStreaming(compressed_data_len_,
+        compressed_data_, &bytes_read, &byte_buffer_read_size_, &output, &stream_end_));
+    compressed_data_ += bytes_read;
+    compressed_data_len_ -= bytes_read;
+    byte_buffer_ptr_ = reinterpret_cast<char*>(output);
+  }
+  byte_buffer_end_ = byte_buffer_ptr_ + byte_buffer_read_size_;
+  *eosr = decompression_done_;
+  return Status::OK;
+}
+
 Status HdfsTextScanner::FindFirstTuple(bool* tuple_found) {
   *tuple_found = true;
   if (context_->file_offset() != 0) {
@@ -316,12 +444,15 @@ Status HdfsTextScanner::Prepare() {
   
   parse_delimiter_timer_ = ADD_COUNTER(
       scan_node_->runtime_profile(), "DelimiterParseTime", TCounterType::CPU_TICKS);
+  decompress_timer_ = ADD_COUNTER(
+      scan_node_->runtime_profile(), "DecompressionTime", TCounterType::CPU_TICKS);
 
   // Allocate the scratch space for two pass parsing.  The most fields we can go
   // through in one parse pass is the batch size (tuples) * the number of fields per tuple
   // TODO: This should probably be based on L2/L3 cache sizes (as should the batch size)
-  field_locations_.resize(state_->batch_size() * scan_node_->materialized_slots().size());
-  row_end_locations_.resize(state_->batch_size());
+  field_locations_.resize(
+      scan_node_->row_batch_capacity() * scan_node_->materialized_slots().size());
+  row_end_locations_.resize(scan_node_->row_batch_capacity());
 
   return Status::OK;
 }
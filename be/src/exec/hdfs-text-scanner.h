@@ -21,12 +21,18 @@
 
 namespace impala {
 
+class Codec;
 class DelimitedTextParser;
 class ScanRangeContext;
 class HdfsFileDesc;
 
 // HdfsScanner implementation that understands text-formatted
 // records. Uses SSE instructions, if available, for performance.
+// Compressed (gzip or deflate) files are not splittable: the scanner for the range
+// at the start of the file decompresses the whole file, reading past the end of its
+// range, and the scanners for the other ranges of the file return no rows.  The
+// file is decompressed incrementally into fixed size buffers, so the memory used
+// does not depend on the size of the file.
 class HdfsTextScanner : public HdfsScanner {
  public:
   HdfsTextScanner(HdfsScanNode* scan_node, RuntimeState* state);
@@ -41,6 +47,16 @@ class HdfsTextScanner : public HdfsScanner {
   // Issue io manager byte ranges for 'files'
   static void IssueInitialRanges(HdfsScanNode*, const std::vector<HdfsFileDesc*>& files);
 
+  // Splits the uncompressed ranges in 'files' into smaller ranges if the scan node
+  // has fewer than one range ('num_ranges' in total, across all formats) per scanner
+  // thread, so that a few large files are parsed in parallel.  Each piece is a
+  // normal scan range: its scanner skips to the first tuple start and reads past its
+  // end to finish the last tuple, as it does for ranges split at hdfs blocks.
+  // Ranges are not split into pieces smaller than
+  // FLAGS_text_scan_range_min_split_size.  Returns the number of ranges added.
+  static int SplitRanges(HdfsScanNode*, const std::vector<HdfsFileDesc*>& files,
+      int num_ranges);
+
   // Codegen writing tuples and evaluating predicates
   static llvm::Function* Codegen(HdfsScanNode*);
 
@@ -51,7 +67,7 @@ class HdfsTextScanner : public HdfsScanner {
 
   // Initializes this scanner for this context.  The context maps to a single
   // scan range.
-  void InitNewRange(ScanRangeContext* context);
+  Status InitNewRange(ScanRangeContext* context);
 
   // Finds the start of the first tuple in this scan range and initializes 
   // byte_buffer_ptr to be the next character (the start of the first tuple).  If 
@@ -77,6 +93,10 @@ class HdfsTextScanner : public HdfsScanner {
   // otherwise it will just read num_bytes.
   Status FillByteBuffer(bool* eosr, int num_bytes = 0);
 
+  // FillByteBuffer() for compressed files: decompresses the next buffer of the
+  // file.  *eosr is set once the whole file is decompressed.
+  Status FillCompressedByteBuffer(bool* eosr);
+
   // Prepends field data that was from the previous file buffer (This field straddled two
   // file buffers).  'data' already contains the pointer/len from the current file buffer,
   // boundary_column_ contains the beginning of the data from the previous file
@@ -157,6 +177,25 @@ class HdfsTextScanner : public HdfsScanner {
 
   // Time parsing text files
   RuntimeProfile::Counter* parse_delimiter_timer_;
+
+  // Decompressor for compressed files, NULL if the file is not compressed.
+  boost::scoped_ptr<Codec> decompressor_;
+
+  // Pool for the decompressed buffers.
+  boost::scoped_ptr<MemPool> decompressed_data_pool_;
+
+  // Compressed bytes returned by the context that are not decompressed yet.
+  uint8_t* compressed_data_;
+  int compressed_data_len_;
+
+  // True if the last decompressed byte ended a compressed stream.
+  bool stream_end_;
+
+  // True once the whole file is decompressed.
+  bool decompression_done_;
+
+  // Time spent decompressing bytes
+  RuntimeProfile::Counter* decompress_timer_;
 };
 
 }
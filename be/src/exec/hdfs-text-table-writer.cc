@@ -20,6 +20,8 @@
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
 #include "runtime/hdfs-fs-cache.h"
+#include "runtime/mem-pool.h"
+#include "util/codec.h"
 
 #include <vector>
 #include <sstream>
@@ -40,6 +42,44 @@ HdfsTextTableWriter::HdfsTextTableWriter(RuntimeState* state, OutputPartition* o
   tuple_delim_ = partition->line_delim();
   field_delim_ = partition->field_delim();
   escape_char_ = partition->escape_char();
+  compression_ = partition->compression();
+}
+
+HdfsTextTableWriter::~HdfsTextTableWriter() {
+}
+
+Status HdfsTextTableWriter::Init() {
+  if (compression_ == THdfsCompression::NONE) return Status::OK;
+  if (compression_ != THdfsCompression::GZIP &&
+      compression_ != THdfsCompression::DEFAULT) {
+    stringstream ss;
+    ss << "Writing text files with " << Codec::GetCodecName(compression_)
+       << " compression is not supported, only gzip and deflate are.";
+    return Status(ss.str());
+  }
+  compressor_pool_.reset(new MemPool());
+  Codec* compressor;
+  RETURN_IF_ERROR(Codec::CreateCompressor(
+      state_, compressor_pool_.get(), true, compression_, &compressor));
+  compressor_.reset(compressor);
+  text_buffer_.reserve(COMPRESSED_BLOCK_SIZE);
+  return Status::OK;
+}
+
+Status HdfsTextTableWriter::Finalize() {
+  if (compressor_.get() != NULL) RETURN_IF_ERROR(FlushCompressedBlock());
+  return Status::OK;
+}
+
+Status HdfsTextTableWriter::FlushCompressedBlock() {
+  if (text_buffer_.empty()) return Status::OK;
+  int compressed_len = 0;
+  uint8_t* compressed_data;
+  RETURN_IF_ERROR(compressor_->ProcessBlock(text_buffer_.size(),
+      reinterpret_cast<uint8_t*>(&text_buffer_[0]), &compressed_len, &compressed_data));
+  RETURN_IF_ERROR(Write(compressed_data, compressed_len));
+  text_buffer_.clear();
+  return Status::OK;
 }
 
 Status HdfsTextTableWriter::AppendRowBatch(RowBatch* batch,
@@ -55,10 +95,12 @@ Status HdfsTextTableWriter::AppendRowBatch(RowBatch* batch,
   bool all_rows = row_group_indices.empty();
   int num_non_partition_cols =
       table_desc_->num_cols() - table_desc_->num_clustering_cols();
+  // The text of the rows is appended to text_buffer_ without going through a
+  // stringstream.  Uncompressed text is written once per batch rather than once per
+  // row, compressed text once it's a full block.
   for (int row_idx = 0; row_idx < limit; ++row_idx) {
     TupleRow* current_row = all_rows ?
         batch->GetRow(row_idx) : batch->GetRow(row_group_indices[row_idx]);
-    stringstream row_stringstream;
     // There might be a select expr for partition cols as well, but we shouldn't be
     // writing their values to the row. Since there must be at least
     // num_non_partition_cols select exprs, and we assume that by convention any
@@ -66,27 +108,32 @@ Status HdfsTextTableWriter::AppendRowBatch(RowBatch* batch,
     // the first num_non_partition_cols values.
     for (int j = 0; j < num_non_partition_cols; ++j) {
       void* value = output_exprs_[j]->GetValue(current_row);
+      row_values_[j] = value;
       if (value != NULL) {
-        output_exprs_[j]->PrintValue(value, &row_stringstream);
+        RawValue::AppendValue(value, output_exprs_[j]->type(), TEXT_PRECISION,
+            &text_buffer_);
       } else {
         // NULL values in hive are encoded as '\N'
-        row_stringstream << "\\N";
+        text_buffer_.append("\\N");
       }
       // Append field delimiter.
       if (j + 1 < num_non_partition_cols) {
-        row_stringstream << field_delim_;
+        text_buffer_.push_back(field_delim_);
       }
     }
     // Append tuple delimiter.
-    row_stringstream << tuple_delim_;
-    // Write line to Hdfs file.
-    // HDFS does some buffering to fill a packet which is ~64kb in size.
-    // TODO: Determine if there's any throughput benefit in batching larger
-    // writes together.
-    string row_string = row_stringstream.str();
-    RETURN_IF_ERROR(Write(row_string.data(), row_string.size()));
+    text_buffer_.push_back(tuple_delim_);
+    AddRowToStats();
+    if (compressor_.get() != NULL && text_buffer_.size() >= COMPRESSED_BLOCK_SIZE) {
+      RETURN_IF_ERROR(FlushCompressedBlock());
+    }
     ++output_->num_rows;
   }
+  if (compressor_.get() == NULL && !text_buffer_.empty()) {
+    // HDFS does some buffering to fill a packet which is ~64kb in size.
+    RETURN_IF_ERROR(Write(text_buffer_.data(), text_buffer_.size()));
+    text_buffer_.clear();
+  }
   *new_file = false;
   return Status::OK;
 }
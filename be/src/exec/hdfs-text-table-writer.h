@@ -17,6 +17,8 @@
 #define IMPALA_EXEC_HDFS_TEXT_TABLE_WRITER_H
 
 #include <hdfs.h>
+#include <string>
+#include <boost/scoped_ptr.hpp>
 
 #include "runtime/descriptors.h"
 #include "exec/hdfs-table-sink.h"
@@ -24,7 +26,9 @@
 
 namespace impala {
 
+class Codec;
 class Expr;
+class MemPool;
 class TupleDescriptor;
 class TupleRow;
 class RuntimeState;
@@ -32,6 +36,10 @@ class OutputPartition;
 
 // The writer consumes all rows passed to it and writes the evaluated output_exprs_
 // as delimited text into Hdfs files.
+// If the partition is compressed, the text is buffered and compressed in blocks of
+// COMPRESSED_BLOCK_SIZE bytes.  Each block is a complete gzip (or zlib) stream, and
+// files of concatenated streams are read like a single stream by the text scanner and
+// by Hadoop.  Other codecs can't be read as a stream and are rejected by Init().
 class HdfsTextTableWriter : public HdfsTableWriter {
  public:
   HdfsTextTableWriter(RuntimeState* state, OutputPartition* output,
@@ -39,11 +47,13 @@ class HdfsTextTableWriter : public HdfsTableWriter {
                       const HdfsTableDescriptor* table_desc,
                       const std::vector<Expr*>& output_exprs);
 
-  ~HdfsTextTableWriter() { }
+  ~HdfsTextTableWriter();
 
-  // There is nothing to do for text.
-  virtual Status Init() { return Status::OK; }
-  virtual Status Finalize() { return Status::OK; }
+  // Creates the compressor of compressed partitions.
+  virtual Status Init();
+
+  // Compresses and writes the buffered text.
+  virtual Status Finalize();
 
   // Appends delimited string representation of the rows in the batch to output partition.
   Status AppendRowBatch(RowBatch* current_row,
@@ -58,6 +68,28 @@ class HdfsTextTableWriter : public HdfsTableWriter {
 
   // Escape character. TODO: Escape output.
   char escape_char_;
+
+  // Compresses text_buffer_ and writes it to the file.
+  Status FlushCompressedBlock();
+
+  // Amount of text that is buffered before it is compressed.
+  static const int COMPRESSED_BLOCK_SIZE = 1024 * 1024;
+
+  // Compression of the partition.
+  THdfsCompression::type compression_;
+
+  // Compressor and the pool of its output buffer; NULL if the partition isn't
+  // compressed.
+  boost::scoped_ptr<MemPool> compressor_pool_;
+  boost::scoped_ptr<Codec> compressor_;
+
+  // Digits of the doubles and floats written, the default precision of a
+  // stringstream, which this used to write with.
+  static const int TEXT_PRECISION = 6;
+
+  // Text of the rows that weren't written yet.  Uncompressed text is written at the
+  // end of each batch, compressed text in blocks of COMPRESSED_BLOCK_SIZE.
+  std::string text_buffer_;
 };
 
 }
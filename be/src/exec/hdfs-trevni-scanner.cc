@@ -14,6 +14,7 @@
 
 #include "text-converter.h"
 #include "exprs/expr.h"
+#include "runtime/column-batch.h"
 #include "runtime/descriptors.h"
 #include "runtime/runtime-state.h"
 #include "runtime/mem-pool.h"
@@ -28,9 +29,11 @@
 #include "common/object-pool.h"
 #include "gen-cpp/PlanNodes_types.h"
 #include "exec/hdfs-trevni-scanner.h"
+#include "exec/disk-io-byte-stream.h"
 #include "exec/hdfs-scan-node.h"
 #include "exec/read-write-util.h"
-#include "exec/serde-utils.h"
+#include "exec/scan-range-context.h"
+#include "exec/serde-utils.inline.h"
 #include "exec/text-converter.inline.h"
 #include "gen-cpp/Descriptors_types.h"
 #include "gen-cpp/JavaConstants_constants.h"
@@ -39,78 +42,205 @@ using namespace std;
 using namespace boost;
 using namespace impala;
 
-HdfsTrevniScanner::HdfsTrevniScanner(HdfsScanNode* scan_node, RuntimeState* state,
-                                     MemPool* mem_pool)
-    : HdfsScanner(scan_node, state, mem_pool),
+DEFINE_int32(trevni_column_read_ahead_buffers, 2, "Number of io buffers each column "
+    "of a Trevni file is read ahead by.");
+DEFINE_bool(enable_trevni_column_batches, true, "If true, Trevni scans without "
+    "per-row conjuncts decode their rows a column at a time.");
+
+const int HdfsTrevniScanner::HEADER_SIZE = 1024;
+
+HdfsTrevniScanner::HdfsTrevniScanner(HdfsScanNode* scan_node, RuntimeState* state)
+    : HdfsScanner(scan_node, state),
       decompressor_(NULL),
       compressed_data_pool_(new MemPool()),
       file_checksum_(false),
       compressed_buffer_size_(0),
-      object_pool_(new ObjectPool) {
+      object_pool_(new ObjectPool),
+      file_length_(0) {
 }
 
 HdfsTrevniScanner::~HdfsTrevniScanner() {
   COUNTER_UPDATE(scan_node_->memory_used_counter(),
       compressed_data_pool_->peak_allocated_bytes());
   for (int i = 0; i < column_info_.size(); ++i) {
+    if (column_info_[i].mem_pool == NULL) continue;
     COUNTER_UPDATE(scan_node_->memory_used_counter(),
         column_info_[i].mem_pool->peak_allocated_bytes());
   }
 }
 
+void HdfsTrevniScanner::IssueInitialRanges(HdfsScanNode* scan_node,
+    const vector<HdfsFileDesc*>& files) {
+  // Issue just the header range for each file.  The scanner for the header reads
+  // the columns of the file itself.
+  for (int i = 0; i < files.size(); ++i) {
+    const DiskIoMgr::ScanRange* range = files[i]->ranges[0];
+    int64_t partition_id = reinterpret_cast<int64_t>(range->meta_data());
+    DiskIoMgr::ScanRange* header_range = scan_node->AllocateScanRange(
+        files[i]->filename.c_str(), min<int64_t>(HEADER_SIZE, range->len()), 0,
+        partition_id, range->disk_id(), files[i]->mtime);
+    scan_node->AddDiskIoRange(header_range);
+    // The file issues no other ranges to the scan node.
+    scan_node->FileQueued(files[i]->filename.c_str());
+  }
+}
+
 Status HdfsTrevniScanner::Prepare() {
   RETURN_IF_ERROR(HdfsScanner::Prepare());
   tuple_ = NULL;
+  blocks_skipped_counter_ = ADD_COUNTER(
+      scan_node_->runtime_profile(), "TrevniBlocksSkipped", TCounterType::UNIT);
+  InitStatsPredicates();
+
+  if (FLAGS_enable_trevni_column_batches && num_conjuncts_ == 0 &&
+      !scan_node_->materialized_slots().empty()) {
+    column_batch_.reset(new ColumnBatch(
+        scan_node_->materialized_slots(), scan_node_->row_batch_capacity()));
+  }
+
+  const DescriptorTbl& desc_tbl = state_->desc_tbl();
+  dict_conjunct_slot_.assign(num_conjuncts_, -1);
+  for (int i = 0; i < num_conjuncts_; ++i) {
+    vector<SlotId> slot_ids;
+    int num_slots = conjuncts_[i]->GetSlotIds(&slot_ids);
+    if (num_slots == 0) continue;
+    bool single_slot = true;
+    for (int j = 1; j < num_slots; ++j) {
+      if (slot_ids[j] != slot_ids[0]) single_slot = false;
+    }
+    const SlotDescriptor* slot_desc = desc_tbl.GetSlotDescriptor(slot_ids[0]);
+    if (!single_slot || slot_desc->type() != TYPE_STRING) continue;
+    dict_conjunct_slot_[i] = scan_node_->GetMaterializedSlotIdx(slot_desc->col_pos());
+  }
   return Status::OK;
 }
 
+void HdfsTrevniScanner::InitStatsPredicates() {
+  stats_predicates_.clear();
+  const DescriptorTbl& desc_tbl = state_->desc_tbl();
+  for (int i = 0; i < conjuncts_mem_.size(); ++i) {
+    BinaryPredicate* pred = dynamic_cast<BinaryPredicate*>(conjuncts_mem_[i]);
+    if (pred == NULL) continue;
+    StatsPredicate stats_pred;
+    stats_pred.op = pred->compare_op();
+    if (stats_pred.op == BinaryPredicate::NE ||
+        stats_pred.op == BinaryPredicate::INVALID_OP) {
+      continue;
+    }
+    SlotRef* slot_ref = dynamic_cast<SlotRef*>(pred->GetChild(0));
+    Expr* constant = pred->GetChild(1);
+    if (slot_ref == NULL) {
+      // <constant> <op> <slot> is <slot> <reversed op> <constant>.
+      slot_ref = dynamic_cast<SlotRef*>(pred->GetChild(1));
+      constant = pred->GetChild(0);
+      switch (stats_pred.op) {
+        case BinaryPredicate::LT:
+          stats_pred.op = BinaryPredicate::GT;
+          break;
+        case BinaryPredicate::LE:
+          stats_pred.op = BinaryPredicate::GE;
+          break;
+        case BinaryPredicate::GT:
+          stats_pred.op = BinaryPredicate::LT;
+          break;
+        case BinaryPredicate::GE:
+          stats_pred.op = BinaryPredicate::LE;
+          break;
+        default:
+          break;
+      }
+    }
+    if (slot_ref == NULL || !constant->IsConstant()) continue;
+
+    // Only types that are kept in the block statistics as they are in the slot.
+    stats_pred.type = slot_ref->type();
+    map<PrimitiveType, TrevniType>::const_iterator tm =
+        type_map_trevni.find(stats_pred.type);
+    if (tm == type_map_trevni.end() ||
+        GetTrevniStatsType(tm->second) != stats_pred.type) {
+      continue;
+    }
+
+    const SlotDescriptor* slot_desc = desc_tbl.GetSlotDescriptor(slot_ref->slot_id());
+    stats_pred.slot_idx = scan_node_->GetMaterializedSlotIdx(slot_desc->col_pos());
+    // Partition key slots.
+    if (stats_pred.slot_idx == HdfsScanNode::SKIP_COLUMN) continue;
+
+    void* value = constant->GetValue(NULL);
+    if (value == NULL) continue;
+    memcpy(&stats_pred.value, value, GetByteSize(stats_pred.type));
+    stats_predicates_.push_back(stats_pred);
+  }
+}
+
 Status HdfsTrevniScanner::Close() {
+  for (int i = 0; i < column_info_.size(); ++i) {
+    TrevniColumnInfo* column = &column_info_[i];
+    if (column->stream != NULL) column->stream->Close();
+    // The last block of string columns is referenced by the last row batch.
+    if (column->has_noncompact_strings && column->mem_pool != NULL) {
+      context_->AcquirePool(column->mem_pool);
+    }
+  }
+  scan_node_->RangeComplete();
+  context_->Complete();
   return Status::OK;
 }
 
-Status HdfsTrevniScanner::InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition,
-    DiskIoMgr::ScanRange* scan_range, Tuple* template_tuple, 
-    ByteStream* current_byte_stream) {
-  RETURN_IF_ERROR(HdfsScanner::InitCurrentScanRange(hdfs_partition,
-      scan_range, template_tuple, current_byte_stream));
+Status HdfsTrevniScanner::ProcessScanRange(ScanRangeContext* context) {
+  context_ = context;
+  template_tuple_ = context_->template_tuple();
 
   // Trevni files are required to be in a single Hdfs block.
-  if (scan_range->offset() != 0) {
-    return FileReadError(
-        "Bad scan range, offset != 0, Trevni files must be in a single block.");
+  HdfsFileDesc* file_desc = scan_node_->GetFileDesc(context_->filename());
+  const DiskIoMgr::ScanRange* file_range = file_desc->ranges[0];
+  if (file_desc->ranges.size() != 1 || file_range->offset() != 0) {
+    return FileReadError("Bad scan range, Trevni files must be in a single block.");
   }
+  file_length_ = file_range->len();
 
-  // Clear the information from the previous file.
   file_checksum_ = false;
+  current_row_ = 0;
+  next_stats_check_row_ = 0;
   column_info_.clear();
   RETURN_IF_ERROR(ReadFileHeader());
+  RETURN_IF_ERROR(OpenColumnStreams(file_range));
 
   // Read the column information for the columns we are interested in.
   for (int i = 0; i < column_info_.size(); ++i) {
     RETURN_IF_ERROR(ReadColumnInfo(&column_info_[i]));
   }
 
+  return ProcessRows();
+}
+
+Status HdfsTrevniScanner::OpenColumnStreams(const DiskIoMgr::ScanRange* file_range) {
+  for (int i = 0; i < column_info_.size(); ++i) {
+    TrevniColumnInfo* column = &column_info_[i];
+    column->stream = object_pool_->Add(new DiskIoByteStream(state_->io_mgr(),
+        scan_node_, file_range->disk_id(), column->current_offset,
+        column->end_offset - column->current_offset,
+        FLAGS_trevni_column_read_ahead_buffers));
+    RETURN_IF_ERROR(column->stream->Open(context_->filename()));
+  }
   return Status::OK;
 }
 
 Status HdfsTrevniScanner::ReadFileHeader() {
-  vector<uint8_t> head;
-  int64_t bytes_read;
-  head.resize(sizeof(TREVNI_VERSION_HEADER));
-  RETURN_IF_ERROR(
-      current_byte_stream_->Read(&head[0], sizeof(TREVNI_VERSION_HEADER), &bytes_read));
-  if (bytes_read != sizeof(TREVNI_VERSION_HEADER)) {
+  uint8_t* head;
+  Status status;
+  if (!SerDeUtils::ReadBytes(context_, sizeof(TREVNI_VERSION_HEADER), &head, &status)) {
     return FileReadError("Short read of file header");
   }
-  if (memcmp(&head[0], TREVNI_VERSION_HEADER, sizeof(TREVNI_VERSION_HEADER))) {
+  if (memcmp(head, TREVNI_VERSION_HEADER, sizeof(TREVNI_VERSION_HEADER))) {
     stringstream ss;
     ss << "Invalid TREVNI_VERSION_HEADER: '"
-       << SerDeUtils::HexDump(&head[0], sizeof(TREVNI_VERSION_HEADER)) << "'";
+       << SerDeUtils::HexDump(head, sizeof(TREVNI_VERSION_HEADER)) << "'";
     return Status(ss.str());
   }
 
-  RETURN_IF_ERROR(ReadWriteUtil::ReadInt<int64_t>(current_byte_stream_, &row_count_));
-  RETURN_IF_ERROR(ReadWriteUtil::ReadInt<int32_t>(current_byte_stream_, &column_count_));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadInt(context_, &row_count_));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadInt(context_, &column_count_));
 
   RETURN_IF_ERROR(ReadFileHeaderMetadata());
 
@@ -128,36 +258,45 @@ Status HdfsTrevniScanner::ReadFileHeader() {
   }
 
   // Read the column start locations.
-  vector<uint64_t> buf;
-  buf.resize(column_count_);
-  RETURN_IF_ERROR(current_byte_stream_->Read(
-      reinterpret_cast<uint8_t*>(&buf[0]), sizeof(int64_t) * column_count_, &bytes_read));
-  if (bytes_read != sizeof(int64_t) * column_count_) {
+  uint8_t* starts;
+  if (!SerDeUtils::ReadBytes(context_, sizeof(int64_t) * column_count_, &starts,
+          &status)) {
     return FileReadError("Short read of column start locations");
   }
+  vector<int64_t> buf(column_count_);
+  if (column_count_ > 0) memcpy(&buf[0], starts, sizeof(int64_t) * column_count_);
   for (int i = 0; i < column_count_; ++i) {
     int slot_idx =
         scan_node_->GetMaterializedSlotIdx(i + scan_node_->num_partition_keys());
 
     if (slot_idx == HdfsScanNode::SKIP_COLUMN) continue;
 
-    column_info_[slot_idx].current_offset = buf[i];
+    TrevniColumnInfo* column = &column_info_[slot_idx];
+    column->current_offset = buf[i];
+    // The column runs up to the start of the next column or the end of the file.
+    column->end_offset = file_length_;
+    for (int j = 0; j < column_count_; ++j) {
+      if (buf[j] > buf[i] && buf[j] < column->end_offset) column->end_offset = buf[j];
+    }
+    if (column->current_offset < 0 || column->current_offset > file_length_) {
+      return FileReadError("Bad column start location");
+    }
     // Each column needs its own memory pool since we must hold on to each
     // columns block buffer when passing memory to our caller.
-    column_info_[slot_idx].mem_pool = object_pool_->Add(new MemPool());
+    column->mem_pool = object_pool_->Add(new MemPool());
   }
   return Status::OK;
 }
 
 Status HdfsTrevniScanner::ReadFileHeaderMetadata() {
   int32_t map_size;
-  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(current_byte_stream_, &map_size));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(context_, &map_size));
 
   for (int i = 0; i < map_size; ++i) {
     string key;
-    RETURN_IF_ERROR(ReadWriteUtil::ReadString(current_byte_stream_, &key));
+    RETURN_IF_ERROR(ReadWriteUtil::ReadString(context_, &key));
     vector<uint8_t> value;
-    RETURN_IF_ERROR(ReadWriteUtil::ReadBytes(current_byte_stream_, &value));
+    RETURN_IF_ERROR(ReadWriteUtil::ReadBytes(context_, &value));
 
     map<const string, FileMeta>::const_iterator meta = file_meta_map.find(key);
 
@@ -190,11 +329,11 @@ Status HdfsTrevniScanner::ReadFileHeaderMetadata() {
 
 Status HdfsTrevniScanner::SkipColumnMetadata() {
   int32_t map_size;
-  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(current_byte_stream_, &map_size));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(context_, &map_size));
 
   for (int i = 0; i < map_size; ++i) {
-    RETURN_IF_ERROR(ReadWriteUtil::SkipBytes(current_byte_stream_));
-    RETURN_IF_ERROR(ReadWriteUtil::SkipBytes(current_byte_stream_));
+    RETURN_IF_ERROR(ReadWriteUtil::SkipBytes(context_));
+    RETURN_IF_ERROR(ReadWriteUtil::SkipBytes(context_));
   }
   return Status::OK;
 }
@@ -203,13 +342,14 @@ Status HdfsTrevniScanner::ReadColumnMetadata(int column_idx) {
   struct TrevniColumnInfo* col_info = &column_info_[column_idx];
   col_info->decompressor = decompressor_;
   int32_t map_size;
-  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(current_byte_stream_, &map_size));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadZInt(context_, &map_size));
+  bool has_stats = false;
 
   for (int i = 0; i < map_size; ++i) {
     string key;
-    RETURN_IF_ERROR(ReadWriteUtil::ReadString(current_byte_stream_, &key));
+    RETURN_IF_ERROR(ReadWriteUtil::ReadString(context_, &key));
     vector<uint8_t> value;
-    RETURN_IF_ERROR(ReadWriteUtil::ReadBytes(current_byte_stream_, &value));
+    RETURN_IF_ERROR(ReadWriteUtil::ReadBytes(context_, &value));
 
     map<const string, ColumnMeta>::const_iterator meta = column_meta_map.find(key);
 
@@ -257,6 +397,12 @@ Status HdfsTrevniScanner::ReadColumnMetadata(int column_idx) {
           return FileReadError("Bad definition level specification: " + strval);
         }
         break;
+      case COL_STATS:
+        has_stats = true;
+        break;
+      case COL_ENCODING:
+        col_info->has_encoding = true;
+        break;
     }
   }
 
@@ -271,6 +417,7 @@ Status HdfsTrevniScanner::ReadColumnMetadata(int column_idx) {
     col_info->has_noncompact_strings = has_noncompact_strings_;
   }
   col_info->length = GetTrevniTypeLength(col_info->type);
+  if (has_stats) col_info->stats_type = GetTrevniStatsType(col_info->type);
   return Status::OK;
 }
 
@@ -294,16 +441,16 @@ Status HdfsTrevniScanner::CreateDecompressor(const vector<uint8_t>& value,
 }
 
 Status HdfsTrevniScanner::ReadColumnInfo(TrevniColumnInfo* column) {
-  RETURN_IF_ERROR(current_byte_stream_->Seek(column->current_offset));
+  RETURN_IF_ERROR(column->stream->Seek(column->current_offset));
   int32_t block_count = 0;
   RETURN_IF_ERROR(
-      ReadWriteUtil::ReadInt<int32_t>(current_byte_stream_, &block_count));
+      ReadWriteUtil::ReadInt<int32_t>(column->stream, &block_count));
   column->block_desc.resize(block_count);
 
   for (int i = 0; i < block_count; ++i) {
     RETURN_IF_ERROR(ReadBlockDescriptor(*column, &column->block_desc[i]));
   }
-  RETURN_IF_ERROR(current_byte_stream_->GetPosition(&column->current_offset));
+  RETURN_IF_ERROR(column->stream->GetPosition(&column->current_offset));
 
   return Status::OK;
 }
@@ -311,16 +458,58 @@ Status HdfsTrevniScanner::ReadColumnInfo(TrevniColumnInfo* column) {
 Status HdfsTrevniScanner::ReadBlockDescriptor(const TrevniColumnInfo& column,
                                               TrevniBlockInfo* block) {
   RETURN_IF_ERROR(
-      ReadWriteUtil::ReadInt<int32_t>(current_byte_stream_, &block->row_count));
-  RETURN_IF_ERROR(ReadWriteUtil::ReadInt<int32_t>(current_byte_stream_, &block->size));
+      ReadWriteUtil::ReadInt<int32_t>(column.stream, &block->row_count));
+  RETURN_IF_ERROR(ReadWriteUtil::ReadInt<int32_t>(column.stream, &block->size));
   RETURN_IF_ERROR(
-      ReadWriteUtil::ReadInt<int32_t>(current_byte_stream_, &block->compressed_size));
+      ReadWriteUtil::ReadInt<int32_t>(column.stream, &block->compressed_size));
   if (column.has_values) {
     RETURN_IF_ERROR(ReadValue(column, &block->first_value));
   }
+  if (column.stats_type != INVALID_TYPE) {
+    RETURN_IF_ERROR(ReadBlockStats(column, block));
+  }
+  if (column.has_encoding) {
+    int32_t encoding;
+    RETURN_IF_ERROR(ReadWriteUtil::ReadInt<int32_t>(column.stream, &encoding));
+    block->encoding = static_cast<TrevniEncoding>(encoding);
+  }
   return Status::OK;
 }
 
+Status HdfsTrevniScanner::ReadBlockStats(const TrevniColumnInfo& column,
+                                         TrevniBlockInfo* block) {
+  TrevniBlockStats* stats = &block->stats;
+  RETURN_IF_ERROR(
+      ReadWriteUtil::ReadInt<int32_t>(column.stream, &stats->null_count));
+  stats->has_min_max = stats->null_count < block->row_count;
+  if (stats->has_min_max) {
+    RETURN_IF_ERROR(ReadStatsValue(column, &stats->min_value));
+    RETURN_IF_ERROR(ReadStatsValue(column, &stats->max_value));
+  }
+  return Status::OK;
+}
+
+Status HdfsTrevniScanner::ReadStatsValue(const TrevniColumnInfo& column,
+                                         TrevniBlockStats::Value* value) {
+  switch (column.type) {
+    case TREVNI_INT:
+      return ReadWriteUtil::ReadZInt(column.stream, &value->int_val);
+    case TREVNI_LONG:
+      return ReadWriteUtil::ReadZLong(column.stream, &value->bigint_val);
+    default: {
+      // Fixed length types are stored as in the column data.
+      DCHECK_GT(column.length, 0);
+      int64_t bytes_read;
+      RETURN_IF_ERROR(column.stream->Read(
+          reinterpret_cast<uint8_t*>(value), column.length, &bytes_read));
+      if (bytes_read != column.length) {
+        return FileReadError("Short read of block statistics");
+      }
+      return Status::OK;
+    }
+  }
+}
+
 // TODO: Implement reading the initial value for a data block (if has_values is set).
 Status HdfsTrevniScanner::ReadValue(const TrevniColumnInfo& column, void** value) {
   DCHECK(false);
@@ -330,16 +519,18 @@ Status HdfsTrevniScanner::ReadValue(const TrevniColumnInfo& column, void** value
 Status HdfsTrevniScanner::ReadCurrentBlock(TrevniColumnInfo* column) {
   DCHECK_EQ(column->current_row_count, 0);
   DCHECK_LT(column->current_block, column->block_desc.size());
-  RETURN_IF_ERROR(current_byte_stream_->Seek(column->current_offset));
+  RETURN_IF_ERROR(column->stream->Seek(column->current_offset));
   TrevniBlockInfo* block = &column->block_desc[column->current_block];
   if (column->has_noncompact_strings || column->current_buffer_size < block->size) {
+    // The strings of the previous block are referenced by the rows written so far.
+    if (column->has_noncompact_strings) context_->AcquirePool(column->mem_pool);
     column->current_buffer_size = block->size;
     column->buffer = column->mem_pool->Allocate(column->current_buffer_size);
   }
 
   int64_t bytes_read;
   if (column->decompressor == NULL) {
-    RETURN_IF_ERROR(current_byte_stream_->Read(column->buffer, block->size, &bytes_read));
+    RETURN_IF_ERROR(column->stream->Read(column->buffer, block->size, &bytes_read));
     if (bytes_read != block->size) {
       return FileReadError("Short read of data buffer");
     }
@@ -348,7 +539,7 @@ Status HdfsTrevniScanner::ReadCurrentBlock(TrevniColumnInfo* column) {
       compressed_buffer_size_ = block->compressed_size;
       compressed_buffer_ = compressed_data_pool_->Allocate(compressed_buffer_size_);
     }
-    RETURN_IF_ERROR(current_byte_stream_->Read(
+    RETURN_IF_ERROR(column->stream->Read(
         compressed_buffer_, block->compressed_size, &bytes_read));
     if (bytes_read != block->compressed_size) {
       return FileReadError("Short read of compressed data");
@@ -362,8 +553,8 @@ Status HdfsTrevniScanner::ReadCurrentBlock(TrevniColumnInfo* column) {
   }
   
   // The definition and repetition arrays are after the data.
+  uint8_t* bp = &column->buffer[block->size];
   if (column->max_def_level > 0) {
-    uint8_t* bp = &column->buffer[block->size];
     if (column->max_rep_level > 0) {
       int size = IntegerArray::IntegerSize(column->max_rep_level);
       int array_size = IntegerArray::ArraySize(size, block->row_count);
@@ -381,22 +572,118 @@ Status HdfsTrevniScanner::ReadCurrentBlock(TrevniColumnInfo* column) {
     memcpy(array, bp, array_size);
     column->def_level = IntegerArray(size, block->row_count, array);
   }
+  column->encoding = block->encoding;
+  if (column->encoding != TREVNI_PLAIN) {
+    RETURN_IF_ERROR(InitEncodedBlock(column, block, bp));
+  }
   column->current_value = column->buffer;
+  column->values_end = bp;
   column->current_row_count = block->row_count;
   ++column->current_block;
-  RETURN_IF_ERROR(current_byte_stream_->GetPosition(&column->current_offset));
+  RETURN_IF_ERROR(column->stream->GetPosition(&column->current_offset));
+  return Status::OK;
+}
+
+Status HdfsTrevniScanner::InitEncodedBlock(TrevniColumnInfo* column,
+                                           TrevniBlockInfo* block, uint8_t* values_end) {
+  uint8_t* bp = column->buffer;
+  switch (column->encoding) {
+    case TREVNI_DICTIONARY: {
+      if (column->type != TREVNI_STRING) {
+        return FileReadError("Dictionary encoding of a non-string column");
+      }
+      int32_t count;
+      bp += ReadWriteUtil::GetZInt(bp, &count);
+      column->dictionary.resize(count);
+      for (int i = 0; i < count; ++i) {
+        int64_t len;
+        bp += ReadWriteUtil::GetZLong(bp, &len);
+        if (bp + len > values_end) return FileReadError("Bad dictionary");
+        column->dictionary[i] = StringValue(reinterpret_cast<char*>(bp), len);
+        bp += len;
+      }
+      // The result of a conjunct on the column is only known per code for this block.
+      if (num_conjuncts_ > 0) {
+        column->dict_conjunct_results.assign(count * num_conjuncts_, -1);
+      }
+      break;
+    }
+    case TREVNI_BIT_PACKED:
+      if (column->type != TREVNI_INT && column->type != TREVNI_LONG) {
+        return FileReadError("Bit packed encoding of a non-integer column");
+      }
+      bp += ReadWriteUtil::GetZLong(bp, &column->packed_base);
+      break;
+    default:
+      return FileReadError("Unknown block encoding");
+  }
+
+  int bit_size = *bp++;
+  if (bp > values_end || bit_size == 0 || bit_size >= 32) {
+    return FileReadError("Bad encoded block");
+  }
+  // Copy the array out for alignment.  The array is read a word at a time, so leave
+  // room for the last partial word.
+  int array_size = values_end - bp;
+  uint8_t* array = compressed_data_pool_->Allocate(array_size + sizeof(uint32_t));
+  memcpy(array, bp, array_size);
+  column->codes = IntegerArray(bit_size, block->row_count, array);
   return Status::OK;
 }
 
 Status HdfsTrevniScanner::FileReadError(const string& msg) {
   if (state_->LogHasSpace()) {
     stringstream ss;
-    ss << "file: " << current_byte_stream_->GetLocation() << ": " << msg;
+    ss << "file: " << context_->filename() << ": " << msg;
     state_->LogError(ss.str());
   }
   return Status(msg);
 }
 
+bool HdfsTrevniScanner::BlockMayMatch(const StatsPredicate& pred,
+                                      const TrevniBlockStats& stats) {
+  // A comparison with null is never true.
+  if (!stats.has_min_max) return false;
+  switch (pred.op) {
+    case BinaryPredicate::EQ:
+      return RawValue::Compare(&stats.min_value, &pred.value, pred.type) <= 0 &&
+          RawValue::Compare(&stats.max_value, &pred.value, pred.type) >= 0;
+    case BinaryPredicate::LT:
+      return RawValue::Compare(&stats.min_value, &pred.value, pred.type) < 0;
+    case BinaryPredicate::LE:
+      return RawValue::Compare(&stats.min_value, &pred.value, pred.type) <= 0;
+    case BinaryPredicate::GT:
+      return RawValue::Compare(&stats.max_value, &pred.value, pred.type) > 0;
+    case BinaryPredicate::GE:
+      return RawValue::Compare(&stats.max_value, &pred.value, pred.type) >= 0;
+    default:
+      return true;
+  }
+}
+
+int64_t HdfsTrevniScanner::RowsToSkip() {
+  int64_t skip_to_row = current_row_;
+  next_stats_check_row_ = current_row_ + row_count_;
+  for (int i = 0; i < stats_predicates_.size(); ++i) {
+    const StatsPredicate& pred = stats_predicates_[i];
+    TrevniColumnInfo* column = &column_info_[pred.slot_idx];
+    if (column->stats_type != pred.type) continue;
+    // Find the block containing the current row.
+    while (column->stats_block_end_row <= current_row_ &&
+           column->stats_block < column->block_desc.size()) {
+      column->stats_block_end_row += column->block_desc[column->stats_block].row_count;
+      ++column->stats_block;
+    }
+    if (column->stats_block_end_row <= current_row_) continue;
+    const TrevniBlockInfo& block = column->block_desc[column->stats_block - 1];
+    if (!BlockMayMatch(pred, block.stats)) {
+      skip_to_row = max(skip_to_row, column->stats_block_end_row);
+    }
+    next_stats_check_row_ = min(next_stats_check_row_, column->stats_block_end_row);
+  }
+  return skip_to_row - current_row_;
+}
+
 // Store a value into a slot, return true if there is overflow.
 template <typename T>
 bool WriteSlot(void* slot, int64_t value) {
@@ -405,189 +692,388 @@ bool WriteSlot(void* slot, int64_t value) {
   return val != value;
 }
 
-Status HdfsTrevniScanner::GetNext(RowBatch* row_batch, bool* eosr) {
-  AllocateTupleBuffer(row_batch);
-  // Indicates whether the current row has errors.
-  bool error_in_row = false;
-  string error_str;
-
-  if (scan_node_->ReachedLimit()) {
-    tuple_ = NULL;
-    *eosr = true;
-    return Status::OK;
-  }
-
-  SCOPED_TIMER(scan_node_->materialize_tuple_timer());
-  // Index into current row in row_batch.
-  int row_idx = RowBatch::INVALID_ROW_INDEX;
-
-  while (!scan_node_->ReachedLimit() && !row_batch->IsFull() && row_count_ > 0) {
-    const vector<SlotDescriptor*>& materialized_slots = scan_node_->materialized_slots();
-    vector<SlotDescriptor*>::const_iterator it;
-
-    InitTuple(template_tuple_, tuple_);
-    TrevniColumnInfo* column = &column_info_[0];
-    for (it = materialized_slots.begin();
-         it != materialized_slots.end(); ++it, ++column) {
-      const SlotDescriptor* slot_desc = *it;
-
-      if (UNLIKELY(column->current_row_count == 0)) {
-        RETURN_IF_ERROR(ReadCurrentBlock(column));
-      }
-
-      if (column->ValueIsNull()) {
-        tuple_->SetNull(slot_desc->null_indicator_offset());
-        --column->current_row_count;
-        continue;
+Status HdfsTrevniScanner::SkipValues(TrevniColumnInfo* column, int64_t num_values) {
+  while (num_values > 0) {
+    if (column->current_row_count == 0) {
+      // Skip whole blocks without reading them.
+      while (column->current_block < column->block_desc.size()) {
+        const TrevniBlockInfo& block = column->block_desc[column->current_block];
+        if (num_values < block.row_count) break;
+        column->current_offset +=
+            column->decompressor == NULL ? block.size : block.compressed_size;
+        ++column->current_block;
+        num_values -= block.row_count;
+        COUNTER_UPDATE(blocks_skipped_counter_, 1);
       }
+      if (num_values == 0) break;
+      RETURN_IF_ERROR(ReadCurrentBlock(column));
+    }
 
-      void* slot = tuple_->GetSlot(slot_desc->tuple_offset());
+    int64_t num_in_block = min<int64_t>(num_values, column->current_row_count);
+    if (column->max_def_level == 0 && column->encoding == TREVNI_PLAIN &&
+        (column->type == TREVNI_INT || column->type == TREVNI_LONG)) {
+      // Every value is a zigzag integer that can be skipped without decoding it.
+      int64_t len = ReadWriteUtil::SkipZLongs(column->current_value,
+          column->values_end - column->current_value, num_in_block);
+      if (len == -1) return FileReadError("Bad integer format");
+      column->current_value += len;
+      column->current_row_count -= num_in_block;
+      num_values -= num_in_block;
+      continue;
+    }
+    for (int64_t i = 0; i < num_in_block; ++i) {
+      if (column->ValueIsNull()) continue;
       if (column->type == TREVNI_BOOL) {
-        *reinterpret_cast<bool*>(slot) = column->bool_column.GetNextValue();
+        column->bool_column.GetNextValue();
+      } else if (column->encoding != TREVNI_PLAIN) {
+        column->codes.GetNextValue();
       } else if (column->length == 0) {
-        // Handle variable length values.
         int64_t value;
-        int len = ReadWriteUtil::GetZLong(column->current_value, &value);
-        column->current_value += len;
-        switch (column->type) {
-          case TREVNI_INT:
-          case TREVNI_LONG: {
-            switch (slot_desc->type()) {
-              case TYPE_TINYINT:
-                error_in_row = WriteSlot<int8_t>(slot, value);
-                break;
-              case TYPE_SMALLINT:
-                 error_in_row = WriteSlot<int16_t>(slot, value);
-                 break;
-              case TYPE_INT:
-                error_in_row = WriteSlot<int32_t>(slot, value);
-                break;
-              case TYPE_BIGINT:
-                *reinterpret_cast<int64_t*>(slot) = value;
-                break;
-              default:
-                DCHECK(false);
-                return Status("Bad type");
-            }
-            break;
-          }
-
-          // TODO: Does TREVNI_BYTES map to a data type?
-          case TREVNI_BYTES:
-          case TREVNI_STRING: {
-            StringValue* str_slot = reinterpret_cast<StringValue*>(slot);
-            str_slot->len = value;
-            if (!has_noncompact_strings_) {
-              char* slot_data = reinterpret_cast<char*>(tuple_pool_->Allocate(value));
-              memcpy(slot_data, column->current_value, str_slot->len);
-              str_slot->ptr = slot_data;
-            } else {
-              str_slot->ptr = reinterpret_cast<char*>(column->current_value);
-            }
-            column->current_value += value;
-            break;
-          }
-          default:
-            DCHECK(0);
-            return Status("Bad Trevni type");
+        column->current_value += ReadWriteUtil::GetZLong(column->current_value, &value);
+        if (column->type == TREVNI_BYTES || column->type == TREVNI_STRING) {
+          column->current_value += value;
         }
       } else {
-        // Fixed length types: They are read into an aligned buffer.
-        switch (slot_desc->type()) {
+        column->current_value += column->length;
+      }
+    }
+    column->current_row_count -= num_in_block;
+    num_values -= num_in_block;
+  }
+  return Status::OK;
+}
+
+Status HdfsTrevniScanner::MaterializeSlot(const SlotDescriptor* slot_desc,
+    TrevniColumnInfo* column, bool* error_in_row) {
+  if (UNLIKELY(column->num_skipped_values > 0)) {
+    RETURN_IF_ERROR(SkipValues(column, column->num_skipped_values));
+    column->num_skipped_values = 0;
+  }
+  if (UNLIKELY(column->current_row_count == 0)) {
+    RETURN_IF_ERROR(ReadCurrentBlock(column));
+  }
+
+  column->last_code = -1;
+  if (column->ValueIsNull()) {
+    tuple_->SetNull(slot_desc->null_indicator_offset());
+  } else {
+    RETURN_IF_ERROR(DecodeValue(slot_desc->type(), column,
+        tuple_->GetSlot(slot_desc->tuple_offset()), error_in_row));
+  }
+  --column->current_row_count;
+  return Status::OK;
+}
+
+Status HdfsTrevniScanner::DecodeValue(PrimitiveType slot_type, TrevniColumnInfo* column,
+    void* slot, bool* error_in_row) {
+  if (column->type == TREVNI_BOOL) {
+    *reinterpret_cast<bool*>(slot) = column->bool_column.GetNextValue();
+  } else if (column->length == 0) {
+    // Handle variable length values.  For strings, value is the length.
+    int64_t value;
+    uint8_t* str_data = NULL;
+    switch (column->encoding) {
+      case TREVNI_PLAIN:
+        column->current_value += ReadWriteUtil::GetZLong(column->current_value, &value);
+        str_data = column->current_value;
+        break;
+      case TREVNI_DICTIONARY: {
+        uint32_t code = column->codes.GetNextValue();
+        if (UNLIKELY(code >= column->dictionary.size())) {
+          return FileReadError("Bad dictionary code");
+        }
+        column->last_code = code;
+        value = column->dictionary[code].len;
+        str_data = reinterpret_cast<uint8_t*>(column->dictionary[code].ptr);
+        break;
+      }
+      case TREVNI_BIT_PACKED:
+        value = column->packed_base + column->codes.GetNextValue();
+        break;
+    }
+    switch (column->type) {
+      case TREVNI_INT:
+      case TREVNI_LONG: {
+        switch (slot_type) {
           case TYPE_TINYINT:
-            *reinterpret_cast<int8_t*>(slot) =
-                *reinterpret_cast<int8_t*>(column->current_value);
+            *error_in_row |= WriteSlot<int8_t>(slot, value);
             break;
           case TYPE_SMALLINT:
-            *reinterpret_cast<int16_t*>(slot) =
-                *reinterpret_cast<int16_t*>(column->current_value);
+            *error_in_row |= WriteSlot<int16_t>(slot, value);
             break;
           case TYPE_INT:
-            *reinterpret_cast<int32_t*>(slot) =
-                *reinterpret_cast<int32_t*>(column->current_value);
+            *error_in_row |= WriteSlot<int32_t>(slot, value);
             break;
           case TYPE_BIGINT:
-            *reinterpret_cast<int64_t*>(slot) =
-                *reinterpret_cast<int64_t*>(column->current_value);
-            break;
-          case TYPE_FLOAT:
-            *reinterpret_cast<float*>(slot) =
-                *reinterpret_cast<float*>(column->current_value);
-            break;
-          case TYPE_DOUBLE:
-            *reinterpret_cast<double*>(slot) =
-                *reinterpret_cast<double*>(column->current_value);
+            *reinterpret_cast<int64_t*>(slot) = value;
             break;
-          case TYPE_TIMESTAMP: {
-            // This may not be aligned.
-            memcpy(slot, column->current_value, column->length);
-            break;
-          }
           default:
-            DCHECK(0);
+            DCHECK(false);
             return Status("Bad type");
         }
-        column->current_value += column->length;
+        break;
+      }
+
+      // TODO: Does TREVNI_BYTES map to a data type?
+      case TREVNI_BYTES:
+      case TREVNI_STRING: {
+        StringValue* str_slot = reinterpret_cast<StringValue*>(slot);
+        str_slot->len = value;
+        if (!has_noncompact_strings_) {
+          char* slot_data = reinterpret_cast<char*>(tuple_pool_->Allocate(value));
+          memcpy(slot_data, str_data, str_slot->len);
+          str_slot->ptr = slot_data;
+        } else {
+          str_slot->ptr = reinterpret_cast<char*>(str_data);
+        }
+        if (column->encoding == TREVNI_PLAIN) column->current_value += value;
+        break;
       }
-      --column->current_row_count;
+      default:
+        DCHECK(0);
+        return Status("Bad Trevni type");
     }
-    
-    if (error_in_row) {
-      error_in_row = false;
-      if (state_->LogHasSpace()) {
-        stringstream ss;
-        ss << "file " << current_byte_stream_->GetLocation() << error_str <<endl;
-        state_->LogError(ss.str());
+  } else {
+    // Fixed length types: They are read into an aligned buffer.
+    switch (slot_type) {
+      case TYPE_TINYINT:
+        *reinterpret_cast<int8_t*>(slot) =
+            *reinterpret_cast<int8_t*>(column->current_value);
+        break;
+      case TYPE_SMALLINT:
+        *reinterpret_cast<int16_t*>(slot) =
+            *reinterpret_cast<int16_t*>(column->current_value);
+        break;
+      case TYPE_INT:
+        *reinterpret_cast<int32_t*>(slot) =
+            *reinterpret_cast<int32_t*>(column->current_value);
+        break;
+      case TYPE_BIGINT:
+        *reinterpret_cast<int64_t*>(slot) =
+            *reinterpret_cast<int64_t*>(column->current_value);
+        break;
+      case TYPE_FLOAT:
+        *reinterpret_cast<float*>(slot) =
+            *reinterpret_cast<float*>(column->current_value);
+        break;
+      case TYPE_DOUBLE:
+        *reinterpret_cast<double*>(slot) =
+            *reinterpret_cast<double*>(column->current_value);
+        break;
+      case TYPE_TIMESTAMP: {
+        // This may not be aligned.
+        memcpy(slot, column->current_value, column->length);
+        break;
       }
-      if (state_->abort_on_error()) {
-        state_->ReportFileErrors(current_byte_stream_->GetLocation(), 1);
-        return Status(state_->ErrorLog());
+      default:
+        DCHECK(0);
+        return Status("Bad type");
+    }
+    column->current_value += column->length;
+  }
+  return Status::OK;
+}
+
+Status HdfsTrevniScanner::ReadColumnValues(int col_idx, TrevniColumnInfo* column,
+    int num_rows, bool* error_in_row) {
+  if (UNLIKELY(column->num_skipped_values > 0)) {
+    RETURN_IF_ERROR(SkipValues(column, column->num_skipped_values));
+    column->num_skipped_values = 0;
+  }
+  PrimitiveType slot_type = column_batch_->slot_desc(col_idx)->type();
+  int slot_size = ColumnBatch::GetSlotSize(slot_type);
+  uint8_t* values = column_batch_->GetValues<uint8_t>(col_idx);
+  int row_idx = 0;
+  while (row_idx < num_rows) {
+    if (UNLIKELY(column->current_row_count == 0)) {
+      RETURN_IF_ERROR(ReadCurrentBlock(column));
+    }
+    int num_values = min(num_rows - row_idx, column->current_row_count);
+    if (column->max_def_level == 0 && column->type != TREVNI_BOOL &&
+        column->encoding == TREVNI_PLAIN && column->length == slot_size) {
+      // Fixed length values without nulls are stored just like in the column batch.
+      memcpy(values + row_idx * slot_size, column->current_value,
+          num_values * slot_size);
+      column->current_value += num_values * slot_size;
+    } else {
+      for (int i = row_idx; i < row_idx + num_values; ++i) {
+        if (column->ValueIsNull()) {
+          column_batch_->SetNull(col_idx, i);
+        } else {
+          RETURN_IF_ERROR(
+              DecodeValue(slot_type, column, values + i * slot_size, error_in_row));
+        }
       }
     }
-    --row_count_;
+    column->current_row_count -= num_values;
+    row_idx += num_values;
+  }
+  return Status::OK;
+}
+
+inline bool HdfsTrevniScanner::EvalConjunct(int conjunct_idx, TupleRow* row) {
+  int slot_idx = dict_conjunct_slot_[conjunct_idx];
+  if (slot_idx != -1 && column_info_[slot_idx].last_code != -1) {
+    TrevniColumnInfo* column = &column_info_[slot_idx];
+    int8_t* result = &column->dict_conjunct_results[
+        column->last_code * num_conjuncts_ + conjunct_idx];
+    if (*result == -1) {
+      *result = ExecNode::EvalConjuncts(&conjuncts_[conjunct_idx], 1, row);
+    }
+    return *result;
+  }
+  return ExecNode::EvalConjuncts(&conjuncts_[conjunct_idx], 1, row);
+}
+
+// Columns are read in slot_materialization_order_ and each conjunct is evaluated as
+// soon as its columns are read.  If a row fails a conjunct, the columns after it in
+// that order are not decoded for the row; their values are skipped when the column
+// is next read, so blocks in which no row passes are not read at all.
+// Before that, runs of rows whose block statistics show that they fail one of
+// stats_predicates_ are skipped in all columns.
+Status HdfsTrevniScanner::ProcessRows() {
+  if (column_batch_.get() != NULL) return ProcessColumnBatches();
+
+  // Indicates whether the current row has errors.
+  bool error_in_row = false;
+
+  const vector<SlotDescriptor*>& materialized_slots = scan_node_->materialized_slots();
+  int num_slots = slot_materialization_order_.size();
+
+  while (row_count_ > 0 && !scan_node_->ReachedLimit()) {
+    if (context_->cancelled()) return Status::CANCELLED;
 
-    // TODO: The code from here down is more or less common to all scanners. Move it.
-    // We now have a complete row, with everything materialized
-    DCHECK(!row_batch->IsFull());
-    if (row_idx == RowBatch::INVALID_ROW_INDEX) {
-      row_idx = row_batch->AddRow();
+    TupleRow* current_row;
+    int max_tuples = context_->GetMemory(&tuple_pool_, &tuple_, &current_row);
+
+    if (materialized_slots.empty()) {
+      // Handle case where there are no slots to materialize (e.g. count(*))
+      int num_rows = min<int64_t>(max_tuples, row_count_);
+      row_count_ -= num_rows;
+      current_row_ += num_rows;
+      context_->CommitRows(WriteEmptyTuples(context_, current_row, num_rows));
+      continue;
     }
-    TupleRow* current_row = row_batch->GetRow(row_idx);
-    current_row->SetTuple(scan_node_->tuple_idx(), tuple_);
 
-    // Evaluate the conjuncts and add the row to the batch
-    if (ExecNode::EvalConjuncts(conjuncts_, num_conjuncts_, current_row)) {
-      row_batch->CommitLastRow();
-      row_idx = RowBatch::INVALID_ROW_INDEX;
-      if (scan_node_->ReachedLimit() || row_batch->IsFull()) {
-        tuple_ = NULL;
-        break;
+    SCOPED_TIMER(scan_node_->materialize_tuple_timer());
+    int num_to_commit = 0;
+    while (num_to_commit < max_tuples && row_count_ > 0) {
+      if (current_row_ >= next_stats_check_row_) {
+        int64_t num_rows;
+        while ((num_rows = RowsToSkip()) > 0) {
+          for (int i = 0; i < column_info_.size(); ++i) {
+            column_info_[i].num_skipped_values += num_rows;
+          }
+          current_row_ += num_rows;
+          row_count_ -= num_rows;
+        }
+        if (row_count_ == 0) break;
+      }
+
+      InitTuple(template_tuple_, tuple_);
+      current_row->SetTuple(scan_node_->tuple_idx(), tuple_);
+
+      bool passed = true;
+      int order_idx = 0;
+      for (int conjunct_idx = 0; conjunct_idx <= num_conjuncts_; ++conjunct_idx) {
+        int end = conjunct_idx < num_conjuncts_ ?
+            num_slots_before_conjunct_[conjunct_idx] : num_slots;
+        for (; order_idx < end; ++order_idx) {
+          int slot_idx = slot_materialization_order_[order_idx];
+          RETURN_IF_ERROR(MaterializeSlot(materialized_slots[slot_idx],
+              &column_info_[slot_idx], &error_in_row));
+        }
+        if (conjunct_idx < num_conjuncts_ && !EvalConjunct(conjunct_idx, current_row)) {
+          passed = false;
+          break;
+        }
+      }
+      // The remaining columns skip this row's value.
+      for (; order_idx < num_slots; ++order_idx) {
+        ++column_info_[slot_materialization_order_[order_idx]].num_skipped_values;
+      }
+
+      if (error_in_row) {
+        error_in_row = false;
+        RETURN_IF_ERROR(ReportRowError());
+      }
+      --row_count_;
+      ++current_row_;
+
+      if (passed) {
+        ++num_to_commit;
+        tuple_ = context_->next_tuple(tuple_);
+        current_row = context_->next_row(current_row);
       }
-      uint8_t* new_tuple = reinterpret_cast<uint8_t*>(tuple_);
-      new_tuple += tuple_byte_size_;
-      tuple_ = reinterpret_cast<Tuple*>(new_tuple);
     }
+    context_->CommitRows(num_to_commit);
   }
 
-  if (scan_node_->ReachedLimit() || row_count_ == 0) {
-    // We reached the limit, drained the row group or hit the end of the table.
-    // No more work to be done. Clean up all pools with the last row batch.
-    *eosr = true;
-  } else {
-    DCHECK(row_batch->IsFull());
-    // The current row_batch is full, but we haven't yet reached our limit.
-    *eosr = false;
-  }
+  return Status::OK;
+}
+
+// Each batch of rows stops at the next row at which a column with statistics starts
+// a new block, so that runs of rows that fail stats_predicates_ are still skipped.
+Status HdfsTrevniScanner::ProcessColumnBatches() {
+  bool error_in_row = false;
+  while (row_count_ > 0 && !scan_node_->ReachedLimit()) {
+    if (context_->cancelled()) return Status::CANCELLED;
 
-  // Maintain ownership of last memory chunk if not at the end of the scan range.
-  if (has_noncompact_strings_) {
-    for (int i = 0; i < column_info_.size(); ++i) {
-      if (column_info_[i].has_noncompact_strings) {
-        row_batch->tuple_data_pool()->AcquireData(column_info_[i].mem_pool, !*eosr);
+    if (current_row_ >= next_stats_check_row_) {
+      int64_t num_rows;
+      while ((num_rows = RowsToSkip()) > 0) {
+        for (int i = 0; i < column_info_.size(); ++i) {
+          column_info_[i].num_skipped_values += num_rows;
+        }
+        current_row_ += num_rows;
+        row_count_ -= num_rows;
       }
+      if (row_count_ == 0) break;
+    }
+
+    TupleRow* current_row;
+    int max_tuples = context_->GetMemory(&tuple_pool_, &tuple_, &current_row);
+    int64_t num_rows = min<int64_t>(next_stats_check_row_ - current_row_,
+        min(max_tuples, column_batch_->capacity()));
+
+    SCOPED_TIMER(scan_node_->materialize_tuple_timer());
+    column_batch_->Reset();
+    for (int i = 0; i < column_batch_->num_columns(); ++i) {
+      RETURN_IF_ERROR(ReadColumnValues(i, &column_info_[i], num_rows, &error_in_row));
+    }
+    column_batch_->set_num_rows(num_rows);
+
+    Tuple* tuple = tuple_;
+    for (int i = 0; i < num_rows; ++i) {
+      InitTuple(template_tuple_, tuple);
+      current_row->SetTuple(scan_node_->tuple_idx(), tuple);
+      tuple = context_->next_tuple(tuple);
+      current_row = context_->next_row(current_row);
     }
+    column_batch_->MaterializeTuples(
+        reinterpret_cast<uint8_t*>(tuple_), tuple_byte_size_);
+
+    // Values that don't fit their slots are only reported once per batch.
+    if (error_in_row) {
+      error_in_row = false;
+      RETURN_IF_ERROR(ReportRowError());
+    }
+    row_count_ -= num_rows;
+    current_row_ += num_rows;
+    context_->CommitRows(num_rows);
   }
-  row_batch->tuple_data_pool()->AcquireData(tuple_pool_, !*eosr);
+  return Status::OK;
+}
 
+Status HdfsTrevniScanner::ReportRowError() {
+  if (state_->LogHasSpace()) {
+    stringstream ss;
+    ss << "file " << context_->filename() << endl;
+    state_->LogError(ss.str());
+  }
+  if (state_->abort_on_error()) {
+    state_->ReportFileErrors(context_->filename(), 1);
+    return Status(state_->ErrorLog());
+  }
   return Status::OK;
 }
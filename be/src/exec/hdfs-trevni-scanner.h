@@ -19,30 +19,50 @@
 #include "exec/hdfs-scanner.h"
 #include "exec/delimited-text-parser.h"
 #include "exec/trevni-def.h"
+#include "exprs/binary-predicate.h"
+#include "runtime/string-value.h"
 #include "util/integer-array.h"
 
 namespace impala {
 
+class ColumnBatch;
+class DiskIoByteStream;
+
 // This scanner parses Trevni file located in HDFS, and writes the
 // content as tuples in the Impala in-memory representation of data, e.g.
 // (tuples, rows, row batches).
+// Trevni files are in a single block and are processed by one scanner.  The scan
+// range issued for a file only covers the file header.  The scanner then reads each
+// of the columns it needs through its own DiskIoByteStream, so the io mgr reads
+// ahead in all of them while the scanner decodes the current blocks.  Columns that
+// are not materialized and blocks that are skipped are not read.
+// If no conjuncts are evaluated per row, the rows are decoded a column at a time
+// into a ColumnBatch, which is then converted into tuples.
 class HdfsTrevniScanner : public HdfsScanner {
  public:
-  HdfsTrevniScanner(HdfsScanNode* scan_node, RuntimeState* state, MemPool* tuple_pool);
+  HdfsTrevniScanner(HdfsScanNode* scan_node, RuntimeState* state);
 
   virtual ~HdfsTrevniScanner();
   virtual Status Prepare();
-  virtual Status GetNext(RowBatch* row_batch, bool* eosr);
+  virtual Status ProcessScanRange(ScanRangeContext* context);
   virtual Status Close();
 
+  // Issue the header range for each of 'files'.
+  static void IssueInitialRanges(HdfsScanNode*, const std::vector<HdfsFileDesc*>& files);
+
  private:
+  // Estimate of header size in bytes.  If this is not big enough, the scanner will
+  // read more as necessary.
+  static const int HEADER_SIZE;
+
   // Per-block Information.
   struct TrevniBlockInfo {
     TrevniBlockInfo()
         : row_count(),
           size(0),
           compressed_size(0),
-          first_value(NULL) {
+          first_value(NULL),
+          encoding(TREVNI_PLAIN) {
     }
     // Number of rows in this block;
     int32_t row_count; 
@@ -56,6 +76,12 @@ class HdfsTrevniScanner : public HdfsScanner {
     // first value in block.
     // TODO: implement optional storing of first value.
     void* first_value; 
+
+    // Null count and min/max of the block, if the column has block statistics.
+    TrevniBlockStats stats;
+
+    // Encoding of the values in the block.
+    TrevniEncoding encoding;
   };
 
   // Per-column Information.
@@ -70,8 +96,21 @@ class HdfsTrevniScanner : public HdfsScanner {
           max_rep_level(0),
           max_def_level(0),
           decompressor(NULL),
+          mem_pool(NULL),
           current_buffer_size(0),
-          buffer(NULL) {
+          buffer(NULL),
+          values_end(NULL),
+          has_noncompact_strings(false),
+          num_skipped_values(0),
+          stats_type(INVALID_TYPE),
+          stats_block(0),
+          stats_block_end_row(0),
+          has_encoding(false),
+          encoding(TREVNI_PLAIN),
+          packed_base(0),
+          last_code(-1),
+          end_offset(0),
+          stream(NULL) {
     }
 
     // Return if the current value in the column is null.
@@ -138,6 +177,10 @@ class HdfsTrevniScanner : public HdfsScanner {
     // Pointer into buffer containing the current row value
     uint8_t* current_value;
 
+    // End of the values in buffer, i.e. the start of the definition and repetition
+    // arrays, if any.
+    uint8_t* values_end;
+
     // If we are not compacting strings and this column has strings, note it here.
     bool has_noncompact_strings;
 
@@ -150,12 +193,91 @@ class HdfsTrevniScanner : public HdfsScanner {
     // We store TREVNI_BOOL values as a bit array, this field is used to
     // read the array.
     IntegerArray bool_column;
+
+    // Number of values that were not read because their rows failed a conjunct
+    // evaluated before this column was needed.  They are skipped before the next
+    // value is read.
+    int64_t num_skipped_values;
+
+    // Type of the block min/max values, INVALID_TYPE if the file has no block
+    // statistics for this column.
+    PrimitiveType stats_type;
+
+    // Index of the first block after the one containing the current row, and the
+    // row number just past that block.  Used by RowsToSkip().
+    int32_t stats_block;
+    int64_t stats_block_end_row;
+
+    // True if the block descriptors have the block encoding.
+    bool has_encoding;
+
+    // Encoding of the current block.  For TREVNI_DICTIONARY and TREVNI_BIT_PACKED
+    // the values are read from codes instead of current_value.
+    TrevniEncoding encoding;
+
+    // For TREVNI_DICTIONARY, the strings in the current block, pointing into buffer.
+    std::vector<StringValue> dictionary;
+
+    // For TREVNI_BIT_PACKED, the value that the codes are relative to.
+    int64_t packed_base;
+
+    // Code of each non-null value of the current block.
+    IntegerArray codes;
+
+    // Dictionary code of the last value read for this column, -1 if it was null or
+    // the block is not dictionary encoded.
+    int last_code;
+
+    // For dictionary encoded blocks, the result of each conjunct in
+    // dict_conjunct_slot_ for each code: dict_conjunct_results[code * num_conjuncts_ +
+    // conjunct_idx] is 1 if the conjunct passed, 0 if it failed and -1 if it has not
+    // been evaluated yet for that code.
+    std::vector<int8_t> dict_conjunct_results;
+
+    // Offset just past the column's data: the start of the next column or the end
+    // of the file.
+    int64_t end_offset;
+
+    // Stream reading the column's data, owned by object_pool_.
+    DiskIoByteStream* stream;
+  };
+
+  // A conjunct of the form <slot> <op> <constant>, which can be evaluated against
+  // the min/max statistics of the blocks of the slot's column.
+  struct StatsPredicate {
+    // Index of the slot in materialized_slots() and column_info_.
+    int slot_idx;
+
+    // Comparison done by the conjunct, with the slot on the left hand side.
+    BinaryPredicate::CompareOp op;
+
+    // Type of the slot and constant.
+    PrimitiveType type;
+
+    // Value of the constant.
+    TrevniBlockStats::Value value;
   };
 
-  // Initialises any state required at the beginning of a new scan range.
-  virtual Status InitCurrentScanRange(HdfsPartitionDescriptor* hdfs_partition,
-                                      DiskIoMgr::ScanRange* scan_range, 
-                                      Tuple* template_tuple, ByteStream* byte_stream);
+  // Open a DiskIoByteStream over [current_offset, end_offset) for each column,
+  // issuing the reads to the disk of file_range.
+  Status OpenColumnStreams(const DiskIoMgr::ScanRange* file_range);
+
+  // Materialize and return the rows of the file.  Returns when all rows are done,
+  // the limit is reached or the scan is cancelled.
+  Status ProcessRows();
+
+  // Same as ProcessRows(), but decodes the rows through column_batch_.
+  Status ProcessColumnBatches();
+
+  // Reads the next num_rows values of column into column col_idx of column_batch_,
+  // after skipping the column's num_skipped_values.  Sets *error_in_row if a value
+  // does not fit its slot.
+  Status ReadColumnValues(int col_idx, TrevniColumnInfo* column, int num_rows,
+      bool* error_in_row);
+
+  // Logs an error for the current file after a row that had errors.  Returns an
+  // error if the query aborts on errors.
+  Status ReportRowError();
 
   // Read the current Trevni file header from the beginning of the file.
   // Verifies:
@@ -163,7 +285,7 @@ class HdfsTrevniScanner : public HdfsScanner {
   // Sets:
   //   row_count_
   //   column_count_
-  //   column_start_
+  //   current_offset and end_offset of the columns read
   // Calls ReadFileHeaderMetadata
   // Calls ReadColumnMetadata
   Status ReadFileHeader();
@@ -196,6 +318,17 @@ class HdfsTrevniScanner : public HdfsScanner {
   // Read a column data block.  Decompress if necessary. Set up levels arrays.
   Status ReadBlock(const TrevniBlockInfo& column, TrevniBlockInfo* block);
 
+  // Read the statistics of a block in a column that has them.
+  Status ReadBlockStats(const TrevniColumnInfo& column, TrevniBlockInfo* block);
+
+  // Read a single value of the column's Trevni type into a value of its stats type.
+  Status ReadStatsValue(const TrevniColumnInfo& column, TrevniBlockStats::Value* value);
+
+  // Set up a column for reading the dictionary encoded or bit packed values of the
+  // block just read.  values_end is where the level arrays start in buffer.
+  Status InitEncodedBlock(TrevniColumnInfo* column, TrevniBlockInfo* block,
+                          uint8_t* values_end);
+
   // Read the starting value of a block. Not implemented yet.
   Status ReadValue(const TrevniColumnInfo& column, void** value);
 
@@ -214,12 +347,59 @@ class HdfsTrevniScanner : public HdfsScanner {
   // Read the current block for column.
   Status ReadCurrentBlock(TrevniColumnInfo* column);
 
+  // Skips the next num_values values of column.  Blocks that only contain skipped
+  // values are not read.
+  Status SkipValues(TrevniColumnInfo* column, int64_t num_values);
+
+  // Reads the next value of column into the slot for slot_desc in tuple_, after
+  // skipping the column's num_skipped_values.  Sets *error_in_row if the value does
+  // not fit the slot.
+  Status MaterializeSlot(const SlotDescriptor* slot_desc, TrevniColumnInfo* column,
+      bool* error_in_row);
+
+  // Decodes the next value of column, which is not null, into 'slot', which is of
+  // type slot_type.  Does not update the column's current_row_count.
+  Status DecodeValue(PrimitiveType slot_type, TrevniColumnInfo* column, void* slot,
+      bool* error_in_row);
+
+  // Collect the conjuncts that can be evaluated against block statistics in
+  // stats_predicates_.
+  void InitStatsPredicates();
+
+  // Returns false if the block statistics show that no value in the block
+  // satisfies the predicate.
+  static bool BlockMayMatch(const StatsPredicate& pred, const TrevniBlockStats& stats);
+
+  // Returns the number of rows, starting at current_row_, that are in a block whose
+  // statistics show that the rows fail one of stats_predicates_.  Sets
+  // next_stats_check_row_ to the next row at which a predicate column starts a
+  // new block.
+  int64_t RowsToSkip();
+
+  // Evaluate conjuncts_[conjunct_idx] for the current row.  For conjuncts on a
+  // single string slot, whose column is dictionary encoded, this is done once per
+  // dictionary code.
+  bool EvalConjunct(int conjunct_idx, TupleRow* row);
+
   // The default decompressor class to use.
   Codec* decompressor_;
 
   // Number of rows in file.
   int64_t row_count_;
 
+  // Number of rows of the file that have been returned or skipped.
+  int64_t current_row_;
+
+  // RowsToSkip() is not called again until current_row_ reaches this row.
+  int64_t next_stats_check_row_;
+
+  // Conjuncts that are evaluated against the block statistics.
+  std::vector<StatsPredicate> stats_predicates_;
+
+  // For each of the num_conjuncts_ conjuncts, the index of the string slot that is
+  // the only slot referenced by it, or -1.
+  std::vector<int> dict_conjunct_slot_;
+
   // Number of columns in file.
   int32_t column_count_;
 
@@ -242,6 +422,16 @@ class HdfsTrevniScanner : public HdfsScanner {
 
   // Object pool for holding decompressors.
   boost::scoped_ptr<ObjectPool> object_pool_;
+
+  // Length of the current file.
+  int64_t file_length_;
+
+  // Number of column blocks that were skipped without reading them.
+  RuntimeProfile::Counter* blocks_skipped_counter_;
+
+  // Values of the materialized slots of the current batch of rows, if the rows are
+  // decoded a column at a time.  NULL otherwise.
+  boost::scoped_ptr<ColumnBatch> column_batch_;
 };
 
 } // namespace impala
@@ -22,12 +22,17 @@
 #include "runtime/runtime-state.h"
 #include "runtime/hdfs-fs-cache.h"
 #include "runtime/primitive-type.h"
+#include "runtime/string-value.h"
+#include "util/hash-util.h"
+#include "util/integer-array.h"
 
+#include <algorithm>
 #include <vector>
 #include <sstream>
 #include <hdfs.h>
 #include <boost/scoped_ptr.hpp>
 #include <boost/assign/list_of.hpp>
+#include <boost/unordered_map.hpp>
 #include <stdlib.h>
 
 #include "gen-cpp/ImpalaService_types.h"
@@ -37,6 +42,14 @@ using namespace boost;
 using namespace boost::assign;
 
 namespace impala {
+
+// Hash for the dictionary of a block.
+struct StringValueHash {
+  size_t operator()(const StringValue& value) const {
+    return HashUtil::Hash(value.ptr, value.len, 0);
+  }
+};
+
 HdfsTrevniTableWriter::HdfsTrevniTableWriter(RuntimeState* state, OutputPartition* output,
                                              const HdfsPartitionDescriptor* part_desc,
                                              const HdfsTableDescriptor* table_desc,
@@ -67,6 +80,9 @@ Status HdfsTrevniTableWriter::Init() {
     DCHECK(tm != type_map_trevni.end());
     columns_[j].type = tm->second;
     columns_[j].type_length = GetTrevniTypeLength(columns_[j].type);
+    columns_[j].stats_type = GetTrevniStatsType(columns_[j].type);
+    columns_[j].has_encoding = columns_[j].type == TREVNI_STRING ||
+        columns_[j].type == TREVNI_INT || columns_[j].type == TREVNI_LONG;
     // Make up a name for the column.
     char buf[16];
     snprintf(buf, 16, "col_%d", j + 1);
@@ -120,6 +136,14 @@ void HdfsTrevniTableWriter::SetHeaderFileSize() {
     bytes_added_ += sizeof(int32_t);
     // Just use the biggest type name.
     bytes_added_ += sizeof("timestamp") + 1;
+    if (columns_[i].stats_type != INVALID_TYPE) {
+      bytes_added_ += sizeof(TREVNI_STATS) + 1;
+      bytes_added_ += sizeof("true") + 1;
+    }
+    if (columns_[i].has_encoding) {
+      bytes_added_ += sizeof(TREVNI_ENCODING) + 1;
+      bytes_added_ += sizeof("true") + 1;
+    }
     if (columns_[i].max_def_level > 0) {
       bytes_added_ += sizeof(TREVNI_DEFINITION) + 1;
       // assume the definition level is not more than 2 digits.
@@ -137,10 +161,12 @@ Status HdfsTrevniTableWriter::CreateNewBlock(TrevniColumnInfo* column,
                                              TrevniBlockInfo** blockp) {
   *blockp = NULL;
   uint8_t* buffer = NULL;
-  if (column->compressor != NULL && !column->block_desc.empty()) {
+  if (!column->block_desc.empty()) {
     TrevniBlockInfo* previous_block = &column->block_desc.back();
-    buffer = previous_block->data;
-    RETURN_IF_ERROR(CompressBlock(column, previous_block));
+    // Compressed blocks are written from the compressor's buffer, so the plain
+    // data buffer can be reused.
+    if (column->compressor != NULL) buffer = previous_block->data;
+    RETURN_IF_ERROR(FinishBlock(column, previous_block));
   }
   column->block_desc.resize(column->block_desc.size() + 1);
   TrevniBlockInfo* block = &column->block_desc.back();
@@ -148,6 +174,12 @@ Status HdfsTrevniTableWriter::CreateNewBlock(TrevniColumnInfo* column,
   // If we are over the limit just return.
   bytes_added_ += sizeof(block->row_count) +
       sizeof(block->size) + sizeof(block->compressed_size);
+  if (column->stats_type != INVALID_TYPE) {
+    // The null count and the largest possible min and max values.
+    bytes_added_ += sizeof(int32_t) +
+        2 * max<int>(ReadWriteUtil::MAX_ZLONG_LEN, column->type_length);
+  }
+  if (column->has_encoding) bytes_added_ += sizeof(int32_t);
   if (bytes_added_ > file_limit_ && file_limit_ != 0)  return Status::OK;
 
   // The limit is the amount of the block that is not taken up by the arrays.
@@ -170,7 +202,7 @@ Status HdfsTrevniTableWriter::CreateNewBlock(TrevniColumnInfo* column,
         // Use the average length of the previous block.
         TrevniBlockInfo* previous_block =
             &column->block_desc[column->block_desc.size() - 2];
-        length = previous_block->size / previous_block->row_count;
+        length = previous_block->plain_size / previous_block->row_count;
       } else {
         // Guess small so we are not likely to run out.
         switch (column->type) {
@@ -212,6 +244,135 @@ Status HdfsTrevniTableWriter::CreateNewBlock(TrevniColumnInfo* column,
   return Status::OK;
 }
 
+Status HdfsTrevniTableWriter::FinishBlock(TrevniColumnInfo* column,
+                                          TrevniBlockInfo* block) {
+  block->plain_size = block->size;
+  if (column->has_encoding) RETURN_IF_ERROR(EncodeBlock(column, block));
+  if (column->compressor != NULL) RETURN_IF_ERROR(CompressBlock(column, block));
+  return Status::OK;
+}
+
+Status HdfsTrevniTableWriter::EncodeBlock(TrevniColumnInfo* column,
+                                          TrevniBlockInfo* block) {
+  if (block->size == 0) return Status::OK;
+  switch (column->type) {
+    case TREVNI_STRING:
+      return DictionaryEncodeBlock(column, block);
+    case TREVNI_INT:
+    case TREVNI_LONG:
+      return BitPackBlock(column, block);
+    default:
+      DCHECK(false) << "Unexpected type in EncodeBlock";
+      return Status::OK;
+  }
+}
+
+uint8_t* HdfsTrevniTableWriter::AllocateEncodedBuffer(const TrevniColumnInfo& column,
+                                                      TrevniBlockInfo* block,
+                                                      int size) {
+  if (column.max_def_level > 0) {
+    size += block->def_level.CurrentByteCount();
+    if (column.max_rep_level > 0) size += block->rep_level.CurrentByteCount();
+  }
+  return col_mem_pool_->Allocate(size);
+}
+
+Status HdfsTrevniTableWriter::DictionaryEncodeBlock(TrevniColumnInfo* column,
+                                                    TrevniBlockInfo* block) {
+  typedef boost::unordered_map<StringValue, uint32_t, StringValueHash> DictionaryMap;
+  DictionaryMap dictionary;
+  vector<StringValue> entries;
+  vector<uint32_t> codes;
+  uint8_t int_buf[ReadWriteUtil::MAX_ZINT_LEN];
+  int entries_size = 0;
+
+  // The strings in the block are <ZInt length> <bytes>.
+  uint8_t* value = block->data;
+  uint8_t* end = block->data + block->size;
+  while (value < end) {
+    int64_t len;
+    value += ReadWriteUtil::GetZLong(value, &len);
+    StringValue str(reinterpret_cast<char*>(value), len);
+    value += len;
+    DictionaryMap::iterator entry = dictionary.find(str);
+    if (entry == dictionary.end()) {
+      if (entries.size() == MAX_DICTIONARY_SIZE) return Status::OK;
+      entry = dictionary.insert(make_pair(str, entries.size())).first;
+      entries.push_back(str);
+      entries_size += ReadWriteUtil::PutZInt(len, int_buf) + len;
+    }
+    codes.push_back(entry->second);
+  }
+
+  int bit_size = max(1, IntegerArray::IntegerSize(entries.size() - 1));
+  int codes_size = IntegerArray::ArraySize(bit_size, codes.size());
+  int size = ReadWriteUtil::PutZInt(entries.size(), int_buf) + entries_size + 1 +
+      codes_size;
+  if (size >= block->size) return Status::OK;
+
+  uint8_t* buffer = AllocateEncodedBuffer(*column, block, size);
+  uint8_t* bp = buffer;
+  bp += ReadWriteUtil::PutZInt(entries.size(), bp);
+  for (int i = 0; i < entries.size(); ++i) {
+    bp += ReadWriteUtil::PutZInt(entries[i].len, bp);
+    memcpy(bp, entries[i].ptr, entries[i].len);
+    bp += entries[i].len;
+  }
+  *bp++ = bit_size;
+  IntegerArrayBuilder builder(bit_size, codes.size(), col_mem_pool_.get());
+  for (int i = 0; i < codes.size(); ++i) {
+    builder.Put(codes[i]);
+  }
+  memcpy(bp, builder.array(), codes_size);
+  DCHECK_EQ(bp + codes_size - buffer, size);
+
+  bytes_added_ -= block->size - size;
+  block->data = buffer;
+  block->size = size;
+  block->encoding = TREVNI_DICTIONARY;
+  return Status::OK;
+}
+
+Status HdfsTrevniTableWriter::BitPackBlock(TrevniColumnInfo* column,
+                                           TrevniBlockInfo* block) {
+  // Both ints and longs are zig-zag encoded.
+  vector<int64_t> values;
+  uint8_t* value = block->data;
+  uint8_t* end = block->data + block->size;
+  while (value < end) {
+    int64_t v;
+    value += ReadWriteUtil::GetZLong(value, &v);
+    values.push_back(v);
+  }
+  int64_t min_value = *min_element(values.begin(), values.end());
+  int64_t max_value = *max_element(values.begin(), values.end());
+  uint64_t range = static_cast<uint64_t>(max_value) - static_cast<uint64_t>(min_value);
+  if (range >= (1ULL << MAX_PACKED_BIT_SIZE)) return Status::OK;
+
+  int bit_size = max(1, IntegerArray::IntegerSize(static_cast<int>(range)));
+  int codes_size = IntegerArray::ArraySize(bit_size, values.size());
+  uint8_t long_buf[ReadWriteUtil::MAX_ZLONG_LEN];
+  int size = ReadWriteUtil::PutZLong(min_value, long_buf) + 1 + codes_size;
+  if (size >= block->size) return Status::OK;
+
+  uint8_t* buffer = AllocateEncodedBuffer(*column, block, size);
+  uint8_t* bp = buffer;
+  bp += ReadWriteUtil::PutZLong(min_value, bp);
+  *bp++ = bit_size;
+  IntegerArrayBuilder builder(bit_size, values.size(), col_mem_pool_.get());
+  for (int i = 0; i < values.size(); ++i) {
+    builder.Put(values[i] - min_value);
+  }
+  memcpy(bp, builder.array(), codes_size);
+  DCHECK_EQ(bp + codes_size - buffer, size);
+
+  bytes_added_ -= block->size - size;
+  block->data = buffer;
+  block->size = size;
+  block->encoding = TREVNI_BIT_PACKED;
+  return Status::OK;
+}
+
 Status HdfsTrevniTableWriter::CompressBlock(TrevniColumnInfo* column,
                                             TrevniBlockInfo* block) {
   // Copy the levels array to the end of the block.
@@ -379,6 +540,7 @@ Status HdfsTrevniTableWriter::AppendRowBatch(RowBatch* batch,
       TrevniBlockInfo* block = &column->block_desc.back();
       block->previous_size = block->size;
       void* value = output_exprs_[j]->GetValue(current_row);
+      row_values_[j] = value;
 
       // Check for null value.
       if (value == NULL) {
@@ -407,10 +569,18 @@ Status HdfsTrevniTableWriter::AppendRowBatch(RowBatch* batch,
         *new_file = true;
         return Status::OK;
       }
+      if (column->stats_type != INVALID_TYPE) {
+        if (value == NULL) {
+          ++block->stats.null_count;
+        } else {
+          block->stats.Update(value, column->stats_type);
+        }
+      }
       ++block->row_count;
     }
     ++row_count_;
     ++output_->num_rows;
+    AddRowToStats();
   }
 
   // Reset the row_idx_ when we exhaust the batch.  We can exit before exhausting 
@@ -450,9 +620,9 @@ Status HdfsTrevniTableWriter::WriteFileHeader() {
     RETURN_IF_ERROR(WriteLong(start));
 
     TrevniColumnInfo* column = &columns_[i];
-    // Compress the last block if needed.
-    if (column->compressor != NULL && !column->block_desc.empty()) {
-      RETURN_IF_ERROR(CompressBlock(column, &column->block_desc.back()));
+    // Encode and compress the last block if needed.
+    if (!column->block_desc.empty()) {
+      RETURN_IF_ERROR(FinishBlock(column, &column->block_desc.back()));
     }
     start += sizeof(int32_t);
 
@@ -467,6 +637,10 @@ Status HdfsTrevniTableWriter::WriteFileHeader() {
         // TODO: Account for size of the value
         DCHECK(false);
       }
+      if (column->stats_type != INVALID_TYPE) {
+        start += BlockStatsSize(*column, block);
+      }
+      if (column->has_encoding) start += sizeof(int32_t);
       if (column->compressor == NULL) {
         if (column->max_def_level > 0) {
           start += block.def_level.CurrentByteCount();
@@ -484,9 +658,9 @@ Status HdfsTrevniTableWriter::WriteFileHeader() {
   // Write out the value for the last column.
   RETURN_IF_ERROR(WriteLong(start));
   TrevniColumnInfo* column = &columns_[columns_.size() - 1];
-  // Compress the last block if needed.
-  if (column->compressor != NULL && !column->block_desc.empty()) {
-    RETURN_IF_ERROR(CompressBlock(column, &column->block_desc.back()));
+  // Encode and compress the last block if needed.
+  if (!column->block_desc.empty()) {
+    RETURN_IF_ERROR(FinishBlock(column, &column->block_desc.back()));
   }
   return Status::OK;
 }
@@ -506,6 +680,8 @@ Status HdfsTrevniTableWriter::WriteFileMetadata() {
 Status HdfsTrevniTableWriter::WriteColumnMetadata(TrevniColumnInfo* column) {
   // Every column has a name and type in the metadata.
   int count = 2;
+  if (column->stats_type != INVALID_TYPE) ++count;
+  if (column->has_encoding) ++count;
   if (column->max_def_level > 0) ++count;
   if (column->max_rep_level > 0) ++count;
   // TODO: include column specific codec
@@ -519,6 +695,14 @@ Status HdfsTrevniTableWriter::WriteColumnMetadata(TrevniColumnInfo* column) {
   map<TrevniType, const string>::const_iterator type = type_map_string.find(column->type);
   DCHECK(type != type_map_string.end());
   RETURN_IF_ERROR(WriteString(type->second));
+  if (column->stats_type != INVALID_TYPE) {
+    RETURN_IF_ERROR(WriteString("trevni.stats"));
+    RETURN_IF_ERROR(WriteString("true"));
+  }
+  if (column->has_encoding) {
+    RETURN_IF_ERROR(WriteString("trevni.encoding"));
+    RETURN_IF_ERROR(WriteString("true"));
+  }
   if (column->max_def_level > 0) {
     RETURN_IF_ERROR(WriteString("trevni.definition"));
     stringstream ds;
@@ -570,9 +754,46 @@ Status HdfsTrevniTableWriter::WriteBlockDescriptor(TrevniColumnInfo* column,
     DCHECK(false);
   }
 
+  if (column->stats_type != INVALID_TYPE) {
+    RETURN_IF_ERROR(WriteInt(block->stats.null_count));
+    if (block->stats.has_min_max) {
+      uint8_t buf[ReadWriteUtil::MAX_ZLONG_LEN + sizeof(TimestampValue)];
+      int len = EncodeStatsValue(*column, &block->stats.min_value, buf);
+      RETURN_IF_ERROR(Write(buf, len));
+      len = EncodeStatsValue(*column, &block->stats.max_value, buf);
+      RETURN_IF_ERROR(Write(buf, len));
+    }
+  }
+  if (column->has_encoding) RETURN_IF_ERROR(WriteInt(block->encoding));
   return Status::OK;
 }
 
+int HdfsTrevniTableWriter::EncodeStatsValue(const TrevniColumnInfo& column,
+                                            const void* value, uint8_t* buf) {
+  switch (column.type) {
+    case TREVNI_INT:
+      return ReadWriteUtil::PutZInt(*reinterpret_cast<const int32_t*>(value), buf);
+    case TREVNI_LONG:
+      return ReadWriteUtil::PutZLong(*reinterpret_cast<const int64_t*>(value), buf);
+    default:
+      // Fixed length types are stored as in the column data.
+      DCHECK_GT(column.type_length, 0);
+      memcpy(buf, value, column.type_length);
+      return column.type_length;
+  }
+}
+
+int HdfsTrevniTableWriter::BlockStatsSize(const TrevniColumnInfo& column,
+                                          const TrevniBlockInfo& block) {
+  int size = sizeof(block.stats.null_count);
+  if (block.stats.has_min_max) {
+    uint8_t buf[ReadWriteUtil::MAX_ZLONG_LEN + sizeof(TimestampValue)];
+    size += EncodeStatsValue(column, &block.stats.min_value, buf);
+    size += EncodeStatsValue(column, &block.stats.max_value, buf);
+  }
+  return size;
+}
+
 Status HdfsTrevniTableWriter::WriteBlock(TrevniColumnInfo* column,
                                          TrevniBlockInfo* block) {
   if (column->compressor != NULL) {
@@ -60,6 +60,13 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
  private:
   static const int BLOCK_SIZE = 64 * 1024;
 
+  // Blocks with more distinct strings than this are not dictionary encoded.
+  static const int MAX_DICTIONARY_SIZE = 64 * 1024;
+
+  // Integer blocks are not bit packed if the difference between the smallest and
+  // largest value needs more bits than this.
+  static const int MAX_PACKED_BIT_SIZE = 24;
+
   // Per-block information.
   struct TrevniBlockInfo {
     TrevniBlockInfo()
@@ -69,7 +76,9 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
           compressed_size(0),
           first_value(NULL),
           data(NULL),
-          compressed_data(NULL) {
+          compressed_data(NULL),
+          encoding(TREVNI_PLAIN),
+          plain_size(0) {
     }
 
     // Number of rows in this block;
@@ -107,6 +116,15 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
 
     // Compressed data.
     uint8_t* compressed_data;
+
+    // Null count and min/max of the values, if the column has block statistics.
+    TrevniBlockStats stats;
+
+    // Encoding of data.  Blocks are written plain and encoded when they are full.
+    TrevniEncoding encoding;
+
+    // Size of the plain values, set by FinishBlock().
+    int32_t plain_size;
   };
 
   // Per-column Information.
@@ -119,6 +137,8 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
           max_def_level(0),
           max_rep_level(0),
           has_crc(false),
+          stats_type(INVALID_TYPE),
+          has_encoding(false),
           compressor(NULL),
           current_value(NULL) {
       }
@@ -153,6 +173,13 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
     // True if column has CRC;
     bool has_crc;
 
+    // Type of the block min/max values, INVALID_TYPE if the column has no
+    // block statistics.
+    PrimitiveType stats_type;
+
+    // True if the blocks of this column may be dictionary encoded or bit packed.
+    bool has_encoding;
+
     // Per-column compressor, if any.
     Codec* compressor;
 
@@ -176,6 +203,22 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
   // Updates bytes_added_.
   Status  CreateNewBlock(TrevniColumnInfo* column, TrevniBlockInfo** blockp);
 
+  // Called when no more values will be added to the block: encodes and then
+  // compresses it as needed.
+  Status FinishBlock(TrevniColumnInfo* column, TrevniBlockInfo* block);
+
+  // Replace the plain values of a full block with the dictionary encoding (string
+  // columns) or the bit packed encoding (int and long columns), if that makes the
+  // block smaller.  bytes_added_ is updated with the space saved.
+  Status EncodeBlock(TrevniColumnInfo* column, TrevniBlockInfo* block);
+  Status DictionaryEncodeBlock(TrevniColumnInfo* column, TrevniBlockInfo* block);
+  Status BitPackBlock(TrevniColumnInfo* column, TrevniBlockInfo* block);
+
+  // Allocate a buffer for the encoded data of a block, with room for the level
+  // arrays that CompressBlock() appends.
+  uint8_t* AllocateEncodedBuffer(const TrevniColumnInfo& column,
+                                 TrevniBlockInfo* block, int size);
+
   // Write the file header information to the output file.
   Status WriteFileHeader();
 
@@ -198,6 +241,14 @@ class HdfsTrevniTableWriter : public HdfsTableWriter {
   // Write descriptor for a block to the output file.
   Status WriteBlockDescriptor(TrevniColumnInfo* column, TrevniBlockInfo* block);
 
+  // Encode a value of the column's stats type in the Trevni type of the column.
+  // Returns the number of bytes put in buf, which must have room for
+  // ReadWriteUtil::MAX_ZLONG_LEN bytes or the type length, whichever is larger.
+  int EncodeStatsValue(const TrevniColumnInfo& column, const void* value, uint8_t* buf);
+
+  // Return the size of the block statistics written in the block descriptor.
+  int BlockStatsSize(const TrevniColumnInfo& column, const TrevniBlockInfo& block);
+
   // Write level and definition arrays and data for a block to the output file.
   Status WriteBlock(TrevniColumnInfo* column, TrevniBlockInfo* block);
 
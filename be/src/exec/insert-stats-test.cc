@@ -0,0 +1,110 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <gtest/gtest.h>
+
+#include "exec/insert-stats.h"
+#include "runtime/string-value.h"
+
+using namespace std;
+
+namespace impala {
+
+// Returns stats of an int and a string column, with rows (i, "s<i % 10>") for i in
+// [begin, end) and a NULL int in every 4th row.
+static InsertStats* MakeStats(int begin, int end) {
+  vector<PrimitiveType> types;
+  types.push_back(TYPE_INT);
+  types.push_back(TYPE_STRING);
+  InsertStats* stats = new InsertStats(types);
+  for (int i = begin; i < end; ++i) {
+    int32_t int_value = i;
+    string str = "s" + string(1, '0' + i % 10);
+    StringValue string_value(const_cast<char*>(str.data()), str.size());
+    void* values[] = { i % 4 == 0 ? NULL : &int_value, &string_value };
+    stats->AddRow(values);
+  }
+  return stats;
+}
+
+TEST(InsertStatsTest, Basic) {
+  boost::scoped_ptr<InsertStats> stats(MakeStats(1, 1001));
+  EXPECT_EQ(stats->num_rows(), 1000);
+  TInsertPartitionStats result;
+  stats->AddTo(&result);
+  InsertStats::SetNumDistinctValues(&result);
+  EXPECT_EQ(result.num_rows, 1000);
+  ASSERT_EQ(result.column_stats.size(), 2);
+
+  const TInsertColumnStats& ints = result.column_stats[0];
+  EXPECT_EQ(ints.num_nulls, 250);
+  EXPECT_EQ(ints.min_value.intVal, 1);
+  EXPECT_EQ(ints.max_value.intVal, 999);
+  EXPECT_NEAR(ints.num_distinct_values, 750, 750 * 0.1);
+
+  const TInsertColumnStats& strings = result.column_stats[1];
+  EXPECT_EQ(strings.num_nulls, 0);
+  EXPECT_EQ(strings.min_value.stringVal, "s0");
+  EXPECT_EQ(strings.max_value.stringVal, "s9");
+  EXPECT_EQ(strings.num_distinct_values, 10);
+}
+
+TEST(InsertStatsTest, AllNulls) {
+  vector<PrimitiveType> types(1, TYPE_BIGINT);
+  InsertStats stats(types);
+  void* values[] = { NULL };
+  stats.AddRow(values);
+  TInsertPartitionStats result;
+  stats.AddTo(&result);
+  InsertStats::SetNumDistinctValues(&result);
+  EXPECT_EQ(result.column_stats[0].num_nulls, 1);
+  EXPECT_FALSE(result.column_stats[0].__isset.min_value);
+  EXPECT_FALSE(result.column_stats[0].__isset.max_value);
+  EXPECT_EQ(result.column_stats[0].num_distinct_values, 0);
+}
+
+TEST(InsertStatsTest, Merge) {
+  // Two instances that wrote overlapping ranges of values to the same partition.
+  boost::scoped_ptr<InsertStats> stats1(MakeStats(500, 2000));
+  boost::scoped_ptr<InsertStats> stats2(MakeStats(1, 1001));
+  TInsertPartitionStats result;
+  stats1->AddTo(&result);
+  TInsertPartitionStats other;
+  stats2->AddTo(&other);
+  InsertStats::Merge(other, &result);
+  InsertStats::SetNumDistinctValues(&result);
+
+  EXPECT_EQ(result.num_rows, 2500);
+  const TInsertColumnStats& ints = result.column_stats[0];
+  EXPECT_EQ(ints.num_nulls, 375 + 250);
+  EXPECT_EQ(ints.min_value.intVal, 1);
+  EXPECT_EQ(ints.max_value.intVal, 1999);
+  EXPECT_NEAR(ints.num_distinct_values, 1500, 1500 * 0.1);
+  EXPECT_EQ(result.column_stats[1].num_distinct_values, 10);
+
+  // AddTo() merges into existing stats as well.
+  stats2->AddTo(&result);
+  EXPECT_EQ(result.num_rows, 3500);
+  EXPECT_EQ(result.column_stats[0].max_value.intVal, 1999);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
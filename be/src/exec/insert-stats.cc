@@ -0,0 +1,201 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/insert-stats.h"
+
+#include <string.h>
+
+#include "common/logging.h"
+#include "runtime/raw-value.h"
+#include "runtime/string-value.h"
+#include "util/hyper-log-log.h"
+
+using namespace std;
+
+namespace impala {
+
+// Compares 'value' with the value of type 'type' whose bytes (or characters) are 'bytes'.
+static int Compare(const void* value, const string& bytes, PrimitiveType type) {
+  if (type == TYPE_STRING) {
+    StringValue string_value(const_cast<char*>(bytes.data()), bytes.size());
+    return RawValue::Compare(value, &string_value, type);
+  }
+  return RawValue::Compare(value, bytes.data(), type);
+}
+
+// Sets 'bytes' to the bytes of 'value' of type 'type', or its characters for strings.
+static void AssignValue(const void* value, PrimitiveType type, string* bytes) {
+  if (type == TYPE_STRING) {
+    const StringValue* string_value = reinterpret_cast<const StringValue*>(value);
+    bytes->assign(string_value->ptr, string_value->len);
+  } else {
+    bytes->assign(reinterpret_cast<const char*>(value), GetByteSize(type));
+  }
+}
+
+// Returns true if 'v1' is smaller than 'v2'; both have the same field set.
+static bool Less(const TColumnValue& v1, const TColumnValue& v2) {
+  if (v1.__isset.boolVal) return v1.boolVal < v2.boolVal;
+  if (v1.__isset.intVal) return v1.intVal < v2.intVal;
+  if (v1.__isset.longVal) return v1.longVal < v2.longVal;
+  if (v1.__isset.doubleVal) return v1.doubleVal < v2.doubleVal;
+  return v1.stringVal < v2.stringVal;
+}
+
+InsertStats::Column::Column(PrimitiveType type)
+  : type(type),
+    num_nulls(0),
+    has_value(false),
+    ndv_buffer(HyperLogLog::DENSE_LEN, '\0') {
+  StringValue state(&ndv_buffer[0], 0);
+  HyperLogLog::Init(&state);
+  ndv_len = state.len;
+}
+
+void InsertStats::Column::AddValue(const void* value) {
+  if (!has_value) {
+    AssignValue(value, type, &min);
+    AssignValue(value, type, &max);
+    has_value = true;
+  } else if (Compare(value, min, type) < 0) {
+    AssignValue(value, type, &min);
+  } else if (Compare(value, max, type) > 0) {
+    AssignValue(value, type, &max);
+  }
+  // the buffer always has room for the dense state
+  StringValue state(&ndv_buffer[0], ndv_len);
+  HyperLogLog::Update(RawValue::GetHashValue(value, type, 0), &state);
+  ndv_len = state.len;
+}
+
+InsertStats::InsertStats(const vector<PrimitiveType>& types)
+  : num_rows_(0) {
+  for (int i = 0; i < types.size(); ++i) {
+    columns_.push_back(Column(types[i]));
+  }
+}
+
+void InsertStats::ToColumnValue(const string& bytes, PrimitiveType type,
+    TColumnValue* value) {
+  const char* data = bytes.data();
+  switch (type) {
+    case TYPE_BOOLEAN:
+      value->__set_boolVal(*data != 0);
+      break;
+    case TYPE_TINYINT:
+      value->__set_intVal(*reinterpret_cast<const int8_t*>(data));
+      break;
+    case TYPE_SMALLINT: {
+      int16_t v;
+      memcpy(&v, data, sizeof(v));
+      value->__set_intVal(v);
+      break;
+    }
+    case TYPE_INT: {
+      int32_t v;
+      memcpy(&v, data, sizeof(v));
+      value->__set_intVal(v);
+      break;
+    }
+    case TYPE_BIGINT: {
+      int64_t v;
+      memcpy(&v, data, sizeof(v));
+      value->__set_longVal(v);
+      break;
+    }
+    case TYPE_FLOAT: {
+      float v;
+      memcpy(&v, data, sizeof(v));
+      value->__set_doubleVal(v);
+      break;
+    }
+    case TYPE_DOUBLE: {
+      double v;
+      memcpy(&v, data, sizeof(v));
+      value->__set_doubleVal(v);
+      break;
+    }
+    case TYPE_TIMESTAMP:
+      RawValue::PrintValue(data, type, &value->stringVal);
+      value->__isset.stringVal = true;
+      break;
+    case TYPE_STRING:
+      value->__set_stringVal(bytes);
+      break;
+    default:
+      DCHECK(false) << "bad column type: " << TypeToString(type);
+  }
+}
+
+void InsertStats::AddTo(TInsertPartitionStats* stats) const {
+  TInsertPartitionStats own_stats;
+  own_stats.num_rows = num_rows_;
+  own_stats.column_stats.resize(columns_.size());
+  for (int i = 0; i < columns_.size(); ++i) {
+    const Column& column = columns_[i];
+    TInsertColumnStats* column_stats = &own_stats.column_stats[i];
+    column_stats->num_nulls = column.num_nulls;
+    if (column.has_value) {
+      ToColumnValue(column.min, column.type, &column_stats->min_value);
+      column_stats->__isset.min_value = true;
+      ToColumnValue(column.max, column.type, &column_stats->max_value);
+      column_stats->__isset.max_value = true;
+    }
+    column_stats->ndv_state.assign(column.ndv_buffer.data(), column.ndv_len);
+  }
+  if (stats->column_stats.empty()) {
+    DCHECK_EQ(stats->num_rows, 0);
+    *stats = own_stats;
+  } else {
+    Merge(own_stats, stats);
+  }
+}
+
+void InsertStats::Merge(const TInsertPartitionStats& src, TInsertPartitionStats* dst) {
+  DCHECK_EQ(src.column_stats.size(), dst->column_stats.size());
+  dst->num_rows += src.num_rows;
+  for (int i = 0; i < src.column_stats.size(); ++i) {
+    const TInsertColumnStats& src_column = src.column_stats[i];
+    TInsertColumnStats* dst_column = &dst->column_stats[i];
+    dst_column->num_nulls += src_column.num_nulls;
+    if (src_column.__isset.min_value && (!dst_column->__isset.min_value
+        || Less(src_column.min_value, dst_column->min_value))) {
+      dst_column->__set_min_value(src_column.min_value);
+    }
+    if (src_column.__isset.max_value && (!dst_column->__isset.max_value
+        || Less(dst_column->max_value, src_column.max_value))) {
+      dst_column->__set_max_value(src_column.max_value);
+    }
+
+    string buffer(dst_column->ndv_state);
+    buffer.resize(HyperLogLog::DENSE_LEN);
+    StringValue dst_state(&buffer[0], dst_column->ndv_state.size());
+    StringValue src_state(
+        const_cast<char*>(src_column.ndv_state.data()), src_column.ndv_state.size());
+    HyperLogLog::Merge(src_state, &dst_state);
+    buffer.resize(dst_state.len);
+    dst_column->ndv_state.swap(buffer);
+  }
+}
+
+void InsertStats::SetNumDistinctValues(TInsertPartitionStats* stats) {
+  for (int i = 0; i < stats->column_stats.size(); ++i) {
+    TInsertColumnStats* column_stats = &stats->column_stats[i];
+    const string& ndv_state = column_stats->ndv_state;
+    StringValue state(const_cast<char*>(ndv_state.data()), ndv_state.size());
+    column_stats->__set_num_distinct_values(HyperLogLog::Estimate(state));
+  }
+}
+
+}
@@ -0,0 +1,94 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_INSERT_STATS_H
+#define IMPALA_EXEC_INSERT_STATS_H
+
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "runtime/primitive-type.h"
+#include "gen-cpp/ImpalaInternalService_types.h"
+
+namespace impala {
+
+// Gathers the statistics of the rows that an INSERT writes to a partition (see
+// TInsertPartitionStats): the number of rows and, for each column, the number of
+// NULLs, the smallest and largest value and a HyperLogLog state for the number of
+// distinct values.  The table writers add every row they append, with the values they
+// already evaluated, so the statistics come without another pass over the data.
+// The statistics of the instances that wrote to the same partition are combined with
+// Merge().
+class InsertStats {
+ public:
+  // 'types' are the types of the columns, in table order.
+  explicit InsertStats(const std::vector<PrimitiveType>& types);
+
+  // Adds a row with the column values 'values' (NULL for NULLs), one per column.
+  void AddRow(void* const* values) {
+    ++num_rows_;
+    for (int i = 0; i < columns_.size(); ++i) {
+      if (values[i] == NULL) {
+        ++columns_[i].num_nulls;
+      } else {
+        columns_[i].AddValue(values[i]);
+      }
+    }
+  }
+
+  int64_t num_rows() const { return num_rows_; }
+
+  // Adds the statistics gathered so far to 'stats', which holds the statistics of the
+  // same partition from other instances or is empty.
+  void AddTo(TInsertPartitionStats* stats) const;
+
+  // Adds the statistics 'src' of a partition to those of the same partition in 'dst'.
+  static void Merge(const TInsertPartitionStats& src, TInsertPartitionStats* dst);
+
+  // Sets num_distinct_values in all columns of 'stats' from their ndv_state.
+  static void SetNumDistinctValues(TInsertPartitionStats* stats);
+
+ private:
+  struct Column {
+    PrimitiveType type;
+    int64_t num_nulls;
+
+    // The smallest and largest value, if has_value.  These hold the bytes of the
+    // value, or the characters of strings.
+    bool has_value;
+    std::string min;
+    std::string max;
+
+    // The HyperLogLog state, whose buffer has room for the dense state.
+    std::string ndv_buffer;
+    int ndv_len;
+
+    explicit Column(PrimitiveType type);
+
+    void AddValue(const void* value);
+  };
+
+  // Sets 'value' to the value of type 'type' whose bytes (or characters) are 'bytes'.
+  static void ToColumnValue(const std::string& bytes, PrimitiveType type,
+      TColumnValue* value);
+
+  int64_t num_rows_;
+  std::vector<Column> columns_;
+};
+
+}
+
+#endif
@@ -13,16 +13,32 @@
 // limitations under the License.
 
 #include "exec/merge-node.h"
+
+#include <boost/bind.hpp>
+#include <gflags/gflags.h>
+
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
 #include "runtime/raw-value.h"
+#include "util/cpu-info.h"
 #include "gen-cpp/PlanNodes_types.h"
 
+DEFINE_bool(union_concurrent_children, true,
+    "if true, merge nodes with several children open and drain them concurrently, on up "
+    "to one thread per core");
+DEFINE_bool(union_preserve_child_order, false,
+    "if true, merge nodes that drain their children concurrently still return the rows "
+    "of each child before those of the next one");
+
+using namespace boost;
 using namespace std;
 
 namespace impala {
 
+const int MergeNode::MAX_QUEUED_BATCHES;
+
 MergeNode::MergeNode(ObjectPool* pool, const TPlanNode& tnode,
                      const DescriptorTbl& descs)
     : ExecNode(pool, tnode, descs),
@@ -30,7 +46,11 @@ MergeNode::MergeNode(ObjectPool* pool, const TPlanNode& tnode,
       child_idx_(INVALID_CHILD_IDX),
       child_row_batch_(NULL),
       child_eos_(false),
-      child_row_idx_(0) {
+      child_row_idx_(0),
+      concurrent_(false),
+      next_child_to_start_(0),
+      first_active_child_(0),
+      done_(false) {
   DCHECK_EQ(1, tnode.row_tuples.size());
   tuple_id_ = tnode.row_tuples[0];
   // TODO: log errors in runtime state
@@ -80,9 +100,114 @@ Status MergeNode::Prepare(RuntimeState* state) {
   return Status::OK;
 }
 
+Status MergeNode::Open(RuntimeState* state) {
+  StopChildThreads();
+  concurrent_ = FLAGS_union_concurrent_children && children_.size() > 1;
+  if (!concurrent_) return Status::OK;
+
+  child_batches_.clear();
+  child_batches_.resize(children_.size());
+  child_done_.assign(children_.size(), false);
+  next_child_to_start_ = 0;
+  first_active_child_ = 0;
+  done_ = false;
+  status_ = Status::OK;
+  int num_threads = min(static_cast<int>(children_.size()), CpuInfo::num_cores());
+  for (int i = 0; i < num_threads; ++i) {
+    child_threads_.add_thread(new thread(bind(&MergeNode::ChildThread, this, state)));
+  }
+  return Status::OK;
+}
+
+void MergeNode::ChildThread(RuntimeState* state) {
+  // the children's exprs may have been evaluated by other threads before
+  SharedExpr::StartThreadScopes();
+  while (true) {
+    int child_idx;
+    {
+      lock_guard<mutex> l(lock_);
+      if (done_ || next_child_to_start_ == children_.size()) return;
+      child_idx = next_child_to_start_++;
+    }
+    Status status = DrainChild(state, child_idx);
+    lock_guard<mutex> l(lock_);
+    child_done_[child_idx] = true;
+    if (!status.ok() && status_.ok()) status_ = status;
+    batch_added_cv_.notify_one();
+    if (!status.ok()) return;
+  }
+}
+
+Status MergeNode::DrainChild(RuntimeState* state, int child_idx) {
+  RETURN_IF_ERROR(child(child_idx)->Open(state));
+  const RowDescriptor& child_row_desc = child(child_idx)->row_desc();
+  while (true) {
+    RETURN_IF_CANCELLED(state);
+    scoped_ptr<RowBatch> batch(
+        new RowBatch(child_row_desc, state->batch_size(child_row_desc)));
+    bool eos;
+    RETURN_IF_ERROR(child(child_idx)->GetNext(state, batch.get(), &eos));
+    unique_lock<mutex> l(lock_);
+    while (child_batches_[child_idx].size() >= MAX_QUEUED_BATCHES && !done_) {
+      batch_consumed_cv_.wait(l);
+    }
+    if (done_) return Status::OK;
+    if (batch->num_rows() > 0) {
+      child_batches_[child_idx].push_back(batch.release());
+      batch_added_cv_.notify_one();
+    }
+    if (eos) return Status::OK;
+  }
+}
+
+Status MergeNode::TakeChildBatch() {
+  unique_lock<mutex> l(lock_);
+  while (true) {
+    RETURN_IF_ERROR(status_);
+    while (first_active_child_ < children_.size()
+        && child_done_[first_active_child_]
+        && child_batches_[first_active_child_].empty()) {
+      ++first_active_child_;
+    }
+    if (first_active_child_ == children_.size()) {
+      child_idx_ = INVALID_CHILD_IDX;
+      return Status::OK;
+    }
+    int last_child =
+        FLAGS_union_preserve_child_order ? first_active_child_ + 1 : children_.size();
+    for (int i = first_active_child_; i < last_child; ++i) {
+      if (child_batches_[i].empty()) continue;
+      child_idx_ = i;
+      child_row_batch_.reset(child_batches_[i].front());
+      child_batches_[i].pop_front();
+      child_row_idx_ = 0;
+      batch_consumed_cv_.notify_all();
+      return Status::OK;
+    }
+    batch_added_cv_.wait(l);
+  }
+}
+
+void MergeNode::StopChildThreads() {
+  {
+    lock_guard<mutex> l(lock_);
+    done_ = true;
+    batch_consumed_cv_.notify_all();
+  }
+  child_threads_.join_all();
+  for (int i = 0; i < child_batches_.size(); ++i) {
+    for (list<RowBatch*>::iterator it = child_batches_[i].begin();
+        it != child_batches_[i].end(); ++it) {
+      delete *it;
+    }
+    child_batches_[i].clear();
+  }
+}
+
 Status MergeNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
   // Create new tuple buffer for row_batch.
   int tuple_buffer_size = row_batch->capacity() * tuple_desc_->byte_size();
   void* tuple_buffer = row_batch->tuple_data_pool()->Allocate(tuple_buffer_size);
@@ -98,6 +223,27 @@ Status MergeNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
     *eos = ReachedLimit();
     if (*eos || row_batch->IsFull()) return Status::OK;
   }
+
+  if (concurrent_) {
+    // Materialize the batches the child threads queued, whichever child they are from.
+    while (true) {
+      if (child_row_batch_.get() == NULL
+          || child_row_idx_ >= child_row_batch_->num_rows()) {
+        RETURN_IF_CANCELLED(state);
+        child_row_batch_.reset(NULL);
+        RETURN_IF_ERROR(TakeChildBatch());
+        if (child_idx_ == INVALID_CHILD_IDX) break;
+      }
+      if (EvalAndMaterializeExprs(result_expr_lists_[child_idx_], false, &tuple,
+          row_batch)) {
+        *eos = ReachedLimit();
+        return Status::OK;
+      }
+    }
+    *eos = true;
+    return Status::OK;
+  }
+
   if (child_idx_ == INVALID_CHILD_IDX) {
     child_idx_ = 0;
   }
@@ -107,8 +253,9 @@ Status MergeNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
     // Row batch was either never set or we're moving on to a different child.
     if (child_row_batch_.get() == NULL) {
       RETURN_IF_CANCELLED(state);
+      const RowDescriptor& child_row_desc = child(child_idx_)->row_desc();
       child_row_batch_.reset(
-          new RowBatch(child(child_idx_)->row_desc(), state->batch_size()));
+          new RowBatch(child_row_desc, state->batch_size(child_row_desc)));
       // Open child and fetch the first row batch.
       RETURN_IF_ERROR(child(child_idx_)->Open(state));
       RETURN_IF_ERROR(child(child_idx_)->GetNext(state, child_row_batch_.get(),
@@ -149,6 +296,8 @@ Status MergeNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
 
 Status MergeNode::Close(RuntimeState* state) {
   // don't call ExecNode::Close(), it always closes all children
+  // the child threads may still be in a child's GetNext()
+  StopChildThreads();
   child_row_batch_.reset(NULL);
   return ExecNode::Close(state);
 }
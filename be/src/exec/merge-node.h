@@ -16,11 +16,14 @@
 #ifndef IMPALA_EXEC_MERGE_NODE_H_
 #define IMPALA_EXEC_MERGE_NODE_H_
 
+#include <list>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "exec/exec-node.h"
 #include "runtime/mem-pool.h"
-#include <boost/scoped_ptr.hpp>
 
 namespace impala {
 
@@ -31,12 +34,17 @@ class TupleRow;
 // evaluated expressions into row batches. The MergeNode pulls row batches sequentially
 // from its children sequentially, i.e., it exhausts one child completely before moving
 // on to the next one.
+// With --union_concurrent_children and more than one child, the children are opened and
+// drained at the same time by up to one thread per core instead, each child into a
+// queue of at most MAX_QUEUED_BATCHES batches.  GetNext() materializes the queued
+// batches in the order they arrive, or, with --union_preserve_child_order, in the
+// order of the children.
 class MergeNode : public ExecNode {
  public:
   MergeNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
 
   virtual Status Prepare(RuntimeState* state);
-  virtual Status Open(RuntimeState* state) { return Status::OK; }
+  virtual Status Open(RuntimeState* state);
   virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
   virtual Status Close(RuntimeState* state);
 
@@ -71,9 +79,54 @@ class MergeNode : public ExecNode {
   // Index of current row in child_row_batch_.
   int child_row_idx_;
 
+  // Maximum number of batches queued for each child in concurrent mode.
+  static const int MAX_QUEUED_BATCHES = 2;
+
+  // True if the children are drained by child_threads_.
+  bool concurrent_;
+  boost::thread_group child_threads_;
+
+  // Protects the members below.
+  boost::mutex lock_;
+  // signalled when a batch was queued or a child is done, and when a batch was taken
+  boost::condition_variable batch_added_cv_;
+  boost::condition_variable batch_consumed_cv_;
+
+  // The batches of each child that have not been taken by GetNext() yet.
+  std::vector<std::list<RowBatch*> > child_batches_;
+
+  // True for the children whose last batch has been queued.
+  std::vector<bool> child_done_;
+
+  // The next child for a thread to drain.
+  int next_child_to_start_;
+
+  // The first child that has batches to come.
+  int first_active_child_;
+
+  // Set to stop the threads.
+  bool done_;
+
+  // The first error of a child.
+  Status status_;
+
   // Create const exprs, child exprs and conjuncts from corresponding thrift exprs.
   Status Init(ObjectPool* pool, const TPlanNode& tnode);
 
+  // Thread function of child_threads_: drains children until there are none left.
+  void ChildThread(RuntimeState* state);
+
+  // Opens child 'child_idx' and queues all of its batches.
+  Status DrainChild(RuntimeState* state, int child_idx);
+
+  // Waits for the next queued batch and makes it child_row_batch_, with child_idx_ the
+  // index of its child.  Sets child_idx_ to INVALID_CHILD_IDX when all children are
+  // done.
+  Status TakeChildBatch();
+
+  // Stops and joins child_threads_, and deletes the queued batches.
+  void StopChildThreads();
+
   // Evaluates exprs on all rows in child_row_batch_ starting from child_row_idx_,
   // and materializes their results into *tuple.
   // Adds *tuple into row_batch, and increments *tuple.
@@ -0,0 +1,322 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/nested-loop-join-node.h"
+
+#include <algorithm>
+#include <sstream>
+
+#include "codegen/llvm-codegen.h"
+#include "exprs/expr.h"
+#include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
+#include "runtime/row-batch.h"
+#include "runtime/runtime-state.h"
+#include "runtime/tuple-row.h"
+#include "util/cpu-info.h"
+#include "util/debug-util.h"
+#include "util/runtime-profile.h"
+
+#include "gen-cpp/PlanNodes_types.h"
+
+using namespace impala;
+using namespace llvm;
+using namespace std;
+
+NestedLoopJoinNode::NestedLoopJoinNode(
+    ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs)
+  : ExecNode(pool, tnode, descs),
+    join_op_(tnode.nested_loop_join_node.join_op),
+    build_pool_(new MemPool()),
+    block_rows_(1),
+    probe_eos_(false),
+    block_start_(0),
+    probe_idx_(0),
+    build_idx_(0),
+    unmatched_idx_(0),
+    eval_join_conjuncts_fn_(NULL),
+    eval_conjuncts_fn_(NULL) {
+  // TODO: log errors in runtime state
+  Status status = Expr::CreateExprTrees(
+      pool, tnode.nested_loop_join_node.join_conjuncts, &join_conjuncts_);
+  DCHECK(status.ok())
+      << "NestedLoopJoinNode c'tor: CreateExprTrees() failed:\n"
+      << status.GetErrorMsg();
+
+  // the planner only creates nested-loop joins that don't output unmatched build rows
+  DCHECK(join_op_ == TJoinOp::INNER_JOIN || join_op_ == TJoinOp::LEFT_OUTER_JOIN
+      || join_op_ == TJoinOp::LEFT_SEMI_JOIN);
+  match_all_probe_ = (join_op_ == TJoinOp::LEFT_OUTER_JOIN);
+  match_one_build_ = (join_op_ == TJoinOp::LEFT_SEMI_JOIN);
+}
+
+NestedLoopJoinNode::~NestedLoopJoinNode() {
+  // probe_batch_ must be cleaned up in Close() to ensure proper resource freeing.
+  DCHECK(probe_batch_ == NULL);
+}
+
+Status NestedLoopJoinNode::Prepare(RuntimeState* state) {
+  RETURN_IF_ERROR(ExecNode::Prepare(state));
+  build_pool_.reset(new MemPool(mem_tracker()));
+
+  build_timer_ =
+      ADD_COUNTER(runtime_profile(), "BuildTime", TCounterType::CPU_TICKS);
+  probe_timer_ =
+      ADD_COUNTER(runtime_profile(), "ProbeTime", TCounterType::CPU_TICKS);
+  build_row_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildRows", TCounterType::UNIT);
+  probe_row_counter_ =
+      ADD_COUNTER(runtime_profile(), "ProbeRows", TCounterType::UNIT);
+  build_blocks_counter_ =
+      ADD_COUNTER(runtime_profile(), "BuildBlocks", TCounterType::UNIT);
+
+  // join_conjuncts_ are evaluated in the context of the rows produced by this node
+  Expr::Prepare(join_conjuncts_, state, row_descriptor_);
+
+  const vector<TupleDescriptor*>& probe_descs = child(0)->row_desc().tuple_descriptors();
+  for (int i = 0; i < probe_descs.size(); ++i) {
+    probe_tuple_idx_.push_back(row_descriptor_.GetTupleIdx(probe_descs[i]->id()));
+  }
+  // Size the blocks so that the build tuples of a block (and their tuple ptrs) take up
+  // about half of the L2 cache; the other half is left to the probe batch.
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  int build_row_bytes = build_descs.size() * sizeof(Tuple*);
+  for (int i = 0; i < build_descs.size(); ++i) {
+    build_tuple_idx_.push_back(row_descriptor_.GetTupleIdx(build_descs[i]->id()));
+    build_row_bytes += build_descs[i]->byte_size();
+  }
+  long cache_size = CpuInfo::CacheSize(CpuInfo::L2_CACHE);
+  if (cache_size <= 0) cache_size = 256 * 1024;
+  block_rows_ = max(1L, cache_size / 2 / max(build_row_bytes, 1));
+
+  probe_batch_.reset(
+      new RowBatch(child(0)->row_desc(), state->batch_size(child(0)->row_desc())));
+  probe_matched_.reset(new bool[probe_batch_->capacity()]);
+
+  LlvmCodeGen* codegen = state->llvm_codegen();
+  if (codegen != NULL) {
+    Function* eval_join_conjuncts_fn = NULL;
+    if (!join_conjuncts_.empty()) {
+      eval_join_conjuncts_fn = CodegenEvalConjuncts(codegen, join_conjuncts_);
+      if (eval_join_conjuncts_fn != NULL) {
+        codegen->AddFunctionToJit(eval_join_conjuncts_fn,
+            reinterpret_cast<void**>(&eval_join_conjuncts_fn_));
+      }
+    }
+    Function* eval_conjuncts_fn = NULL;
+    if (!conjuncts_.empty()) {
+      eval_conjuncts_fn = CodegenEvalConjuncts(codegen, conjuncts_);
+      if (eval_conjuncts_fn != NULL) {
+        codegen->AddFunctionToJit(eval_conjuncts_fn,
+            reinterpret_cast<void**>(&eval_conjuncts_fn_));
+      }
+    }
+    if ((join_conjuncts_.empty() || eval_join_conjuncts_fn != NULL)
+        && (conjuncts_.empty() || eval_conjuncts_fn != NULL)) {
+      LOG(INFO) << "NestedLoopJoinNode(node_id=" << id()
+                << ") using llvm codegend functions for evaluating conjuncts.";
+    } else {
+      LOG(WARNING) << "Codegen for NestedLoopJoinNode (node_id=" << id()
+                   << ") was not supported for this query.";
+    }
+  }
+  return Status::OK;
+}
+
+Status NestedLoopJoinNode::Close(RuntimeState* state) {
+  // Must reset probe_batch_ in Close() to release resources
+  probe_batch_.reset(NULL);
+  COUNTER_UPDATE(memory_used_counter_, build_pool_->peak_allocated_bytes());
+  return ExecNode::Close(state);
+}
+
+Status NestedLoopJoinNode::Open(RuntimeState* state) {
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  RETURN_IF_CANCELLED(state);
+  RETURN_IF_ERROR(ConstructBuildSide(state));
+  RETURN_IF_ERROR(child(0)->Open(state));
+
+  // start with an empty probe batch; GetNext() fetches the first one
+  probe_eos_ = false;
+  probe_batch_->Reset();
+  block_start_ = build_rows_.size();
+  unmatched_idx_ = 0;
+  return Status::OK;
+}
+
+Status NestedLoopJoinNode::ConstructBuildSide(RuntimeState* state) {
+  build_rows_.clear();
+  build_pool_->Clear();
+  const vector<TupleDescriptor*>& build_descs = child(1)->row_desc().tuple_descriptors();
+  RowBatch build_batch(child(1)->row_desc(), state->batch_size(child(1)->row_desc()));
+  RETURN_IF_ERROR(child(1)->Open(state));
+  while (true) {
+    RETURN_IF_ERROR(state->CheckQueryState());
+    bool eos;
+    RETURN_IF_ERROR(child(1)->GetNext(state, &build_batch, &eos));
+    SCOPED_TIMER(build_timer_);
+    COUNTER_UPDATE(build_row_counter_, build_batch.num_rows());
+    // Copy the rows rather than holding on to the batches: the copies are packed in
+    // build order, which is what makes a block of rows a contiguous range of memory,
+    // and the input's io buffers can be recycled.
+    for (int i = 0; i < build_batch.num_rows(); ++i) {
+      build_rows_.push_back(build_batch.GetRow(i)->DeepCopy(build_descs,
+          build_pool_.get()));
+    }
+    build_batch.Reset();
+    if (eos) break;
+  }
+  COUNTER_SET(build_blocks_counter_,
+      static_cast<int64_t>((build_rows_.size() + block_rows_ - 1) / block_rows_));
+  return Status::OK;
+}
+
+Status NestedLoopJoinNode::GetNext(RuntimeState* state, RowBatch* out_batch, bool* eos) {
+  RETURN_IF_CANCELLED(state);
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
+  if (ReachedLimit()) {
+    *eos = true;
+    return Status::OK;
+  }
+  *eos = false;
+
+  // Explicitly manage the timer counter to avoid measuring time in the child
+  // GetNext call.
+  ScopedTimer<StopWatch> probe_timer(probe_timer_);
+  while (!out_batch->IsFull()) {
+    if (block_start_ < build_rows_.size()) {
+      JoinTile(out_batch);
+    } else if (match_all_probe_ && unmatched_idx_ < probe_batch_->num_rows()) {
+      OutputUnmatchedProbeRows(out_batch);
+    } else {
+      // pass on resources, out_batch might still need them
+      probe_batch_->TransferResourceOwnership(out_batch);
+      if (probe_eos_) {
+        *eos = true;
+        return Status::OK;
+      }
+      if (out_batch->IsFull()) break;
+      probe_timer.Stop();
+      RETURN_IF_ERROR(GetNextProbeBatch(state));
+      probe_timer.Start();
+      continue;
+    }
+    COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+    if (ReachedLimit()) {
+      *eos = true;
+      return Status::OK;
+    }
+  }
+  return Status::OK;
+}
+
+Status NestedLoopJoinNode::GetNextProbeBatch(RuntimeState* state) {
+  RETURN_IF_ERROR(child(0)->GetNext(state, probe_batch_.get(), &probe_eos_));
+  COUNTER_UPDATE(probe_row_counter_, probe_batch_->num_rows());
+  memset(probe_matched_.get(), 0, probe_batch_->num_rows() * sizeof(bool));
+  block_start_ = probe_batch_->num_rows() > 0 ? 0 : build_rows_.size();
+  probe_idx_ = 0;
+  build_idx_ = 0;
+  unmatched_idx_ = 0;
+  return Status::OK;
+}
+
+void NestedLoopJoinNode::JoinTile(RowBatch* out_batch) {
+  int block_end = min<int>(block_start_ + block_rows_, build_rows_.size());
+  Expr* const* join_conjuncts = join_conjuncts_.empty() ? NULL : &join_conjuncts_[0];
+  int num_join_conjuncts = join_conjuncts_.size();
+  Expr* const* conjuncts = conjuncts_.empty() ? NULL : &conjuncts_[0];
+  int num_conjuncts = conjuncts_.size();
+  // the jitted functions may become available while we're running
+  EvalConjunctsFn eval_join_conjuncts =
+      eval_join_conjuncts_fn_ != NULL ? eval_join_conjuncts_fn_ : &EvalConjuncts;
+  EvalConjunctsFn eval_conjuncts =
+      eval_conjuncts_fn_ != NULL ? eval_conjuncts_fn_ : &EvalConjuncts;
+
+  int num_probe_rows = probe_batch_->num_rows();
+  for (; probe_idx_ < num_probe_rows; ++probe_idx_, build_idx_ = block_start_) {
+    // a semi join returns each probe row once
+    if (match_one_build_ && probe_matched_[probe_idx_]) continue;
+    TupleRow* probe_row = probe_batch_->GetRow(probe_idx_);
+    while (build_idx_ < block_end) {
+      int row_idx = out_batch->AddRow();
+      DCHECK(row_idx != RowBatch::INVALID_ROW_INDEX);
+      TupleRow* out_row = out_batch->GetRow(row_idx);
+      CreateOutputRow(out_row, probe_row, build_rows_[build_idx_++]);
+      if (!eval_join_conjuncts(join_conjuncts, num_join_conjuncts, out_row)) continue;
+      probe_matched_[probe_idx_] = true;
+      bool added = eval_conjuncts(conjuncts, num_conjuncts, out_row);
+      if (added) {
+        out_batch->CommitLastRow();
+        VLOG_ROW << "match row: " << PrintRow(out_row, row_desc());
+        ++num_rows_returned_;
+      }
+      if (match_one_build_) break;
+      // resume with the next build row of this probe row
+      if (added && (out_batch->IsFull() || ReachedLimit())) return;
+    }
+    if (out_batch->IsFull() || ReachedLimit()) {
+      // resume with the next probe row
+      ++probe_idx_;
+      build_idx_ = block_start_;
+      return;
+    }
+  }
+  // the whole probe batch has been joined with this block
+  block_start_ = block_end;
+  probe_idx_ = 0;
+  build_idx_ = block_start_;
+}
+
+void NestedLoopJoinNode::OutputUnmatchedProbeRows(RowBatch* out_batch) {
+  Expr* const* conjuncts = conjuncts_.empty() ? NULL : &conjuncts_[0];
+  int num_conjuncts = conjuncts_.size();
+  for (; unmatched_idx_ < probe_batch_->num_rows(); ++unmatched_idx_) {
+    if (probe_matched_[unmatched_idx_]) continue;
+    int row_idx = out_batch->AddRow();
+    DCHECK(row_idx != RowBatch::INVALID_ROW_INDEX);
+    TupleRow* out_row = out_batch->GetRow(row_idx);
+    CreateOutputRow(out_row, probe_batch_->GetRow(unmatched_idx_), NULL);
+    if (EvalConjuncts(conjuncts, num_conjuncts, out_row)) {
+      out_batch->CommitLastRow();
+      VLOG_ROW << "match row: " << PrintRow(out_row, row_desc());
+      ++num_rows_returned_;
+      if (out_batch->IsFull() || ReachedLimit()) {
+        ++unmatched_idx_;
+        return;
+      }
+    }
+  }
+}
+
+void NestedLoopJoinNode::CreateOutputRow(
+    TupleRow* out, TupleRow* probe, TupleRow* build) {
+  for (int i = 0; i < probe_tuple_idx_.size(); ++i) {
+    out->SetTuple(probe_tuple_idx_[i], probe->GetTuple(i));
+  }
+  for (int i = 0; i < build_tuple_idx_.size(); ++i) {
+    out->SetTuple(build_tuple_idx_[i], build == NULL ? NULL : build->GetTuple(i));
+  }
+}
+
+void NestedLoopJoinNode::DebugString(int indentation_level, stringstream* out) const {
+  *out << string(indentation_level * 2, ' ');
+  *out << "NestedLoopJoin(probe_eos=" << (probe_eos_ ? "true" : "false")
+       << " build_rows=" << build_rows_.size()
+       << " block_rows=" << block_rows_
+       << " join_conjuncts=" << Expr::DebugString(join_conjuncts_);
+  ExecNode::DebugString(indentation_level, out);
+  *out << ")";
+}
@@ -0,0 +1,135 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_NESTED_LOOP_JOIN_NODE_H
+#define IMPALA_EXEC_NESTED_LOOP_JOIN_NODE_H
+
+#include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
+
+#include "exec/exec-node.h"
+
+#include "gen-cpp/PlanNodes_types.h"  // for TJoinOp
+
+namespace impala {
+
+class MemPool;
+class RowBatch;
+class TupleRow;
+
+// Node for joins without equi-join predicates (cross joins, inequality and band
+// joins), supporting inner, left outer and left semi joins:
+// - copies all rows of our right input (child(1)) into build_pool_, back to back in
+//   the order they arrive, so that consecutive build rows are adjacent in memory
+// - joins each batch of rows from our left input with the build rows one block at a
+//   time: a block is a range of build rows whose tuples fit in about half of the L2
+//   cache, and all probe rows of the batch are compared with the block before moving
+//   on to the next one.  Each build row is thus loaded into the cache once per probe
+//   batch rather than once per probe row.
+// The join conjuncts are evaluated over every (probe row, build row) pair of a tile,
+// with a codegen'd EvalConjuncts() if possible.  For left outer and left semi joins,
+// the node remembers which rows of the probe batch matched; unmatched probe rows are
+// returned (with NULL build tuples) once the batch has been joined with all blocks.
+// The output rows of a probe batch come in block order, not in probe order.
+class NestedLoopJoinNode : public ExecNode {
+ public:
+  NestedLoopJoinNode(ObjectPool* pool, const TPlanNode& tnode,
+      const DescriptorTbl& descs);
+
+  ~NestedLoopJoinNode();
+
+  virtual Status Prepare(RuntimeState* state);
+  virtual Status Open(RuntimeState* state);
+  virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
+  virtual Status Close(RuntimeState* state);
+
+ protected:
+  void DebugString(int indentation_level, std::stringstream* out) const;
+
+ private:
+  TJoinOp::type join_op_;
+
+  // conjuncts from the JOIN clause
+  std::vector<Expr*> join_conjuncts_;
+
+  // derived from join_op_
+  bool match_all_probe_;  // output all rows coming from the probe input
+  bool match_one_build_;  // match at most one build row to each probe row
+
+  // holds the build rows; build_rows_ points into it
+  boost::scoped_ptr<MemPool> build_pool_;
+  std::vector<TupleRow*> build_rows_;
+
+  // Number of build rows in a block; derived from the byte size of the build tuples.
+  int block_rows_;
+
+  // The current probe batch, and which of its rows matched a build row (for left
+  // outer and left semi joins).
+  boost::scoped_ptr<RowBatch> probe_batch_;
+  boost::scoped_array<bool> probe_matched_;
+  bool probe_eos_;  // if true, probe child has no more rows to process
+
+  // Position of the tile loop: probe_batch_ is joined with the block of build rows
+  // starting at block_start_; the next pair to compare is probe row probe_idx_ with
+  // build row build_idx_.  block_start_ == build_rows_.size() once all blocks are done.
+  int block_start_;
+  int probe_idx_;
+  int build_idx_;
+
+  // Next row of probe_batch_ to check for unmatched rows, once all blocks are done.
+  int unmatched_idx_;
+
+  // probe_tuple_idx_[i] and build_tuple_idx_[i] are the tuple indices of child(0)'s
+  // and child(1)'s tuple[i] in the output row
+  std::vector<int> probe_tuple_idx_;
+  std::vector<int> build_tuple_idx_;
+
+  // Jitted ExecNode::EvalConjuncts() over join_conjuncts_ and conjuncts_; NULL if
+  // codegen is disabled or until the functions have been compiled.
+  typedef bool (*EvalConjunctsFn)(Expr* const*, int, TupleRow*);
+  EvalConjunctsFn eval_join_conjuncts_fn_;
+  EvalConjunctsFn eval_conjuncts_fn_;
+
+  RuntimeProfile::Counter* build_timer_;   // time to copy the build rows
+  RuntimeProfile::Counter* probe_timer_;   // time to join
+  RuntimeProfile::Counter* build_row_counter_;   // num build rows
+  RuntimeProfile::Counter* probe_row_counter_;   // num probe rows
+  RuntimeProfile::Counter* build_blocks_counter_;   // num blocks of build rows
+
+  // Opens child(1) and copies all of its rows into build_pool_.
+  Status ConstructBuildSide(RuntimeState* state);
+
+  // Fetches the next probe batch from child(0) and starts joining it with the
+  // first block.
+  Status GetNextProbeBatch(RuntimeState* state);
+
+  // Joins probe_batch_ with the current block, from the current position of the tile
+  // loop, until out_batch is full, the limit is reached or the tile is done; in the
+  // latter case advances to the next block.
+  void JoinTile(RowBatch* out_batch);
+
+  // Adds the rows of probe_batch_ that didn't match any build row to out_batch,
+  // until it is full or the limit is reached.
+  void OutputUnmatchedProbeRows(RowBatch* out_batch);
+
+  // Write combined row, consisting of probe_row and build_row, to out_row.  build_row
+  // may be NULL.
+  void CreateOutputRow(TupleRow* out_row, TupleRow* probe_row, TupleRow* build_row);
+};
+
+}
+
+#endif
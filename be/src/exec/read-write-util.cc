@@ -13,7 +13,12 @@
 // limitations under the License.
 
 #include "exec/read-write-util.h"
+
+#include <limits>
+
 #include "exec/byte-stream.h"
+#include "exec/scan-range-context.h"
+#include "exec/serde-utils.inline.h"
 
 using namespace std;
 using namespace impala;
@@ -34,6 +39,27 @@ Status ReadWriteUtil::ReadZLong(ByteStream* byte_stream, int64_t* value) {
   return Status::OK;
 }
 
+int64_t ReadWriteUtil::SkipZLongs(const uint8_t* buf, int64_t buf_len,
+    int64_t num_values) {
+  const uint64_t CONTINUATION_BITS = 0x8080808080808080ULL;
+  const uint8_t* bp = buf;
+  const uint8_t* end = buf + buf_len;
+  // Each byte without the continuation bit ends a value.  Whole words are skipped as
+  // long as the last value to skip doesn't end in them.
+  while (bp + sizeof(uint64_t) <= end) {
+    uint64_t word;
+    memcpy(&word, bp, sizeof(word));
+    int num_ends = __builtin_popcountll(~word & CONTINUATION_BITS);
+    if (num_ends >= num_values) break;
+    num_values -= num_ends;
+    bp += sizeof(word);
+  }
+  while (num_values > 0 && bp < end) {
+    if ((*bp++ & 0x80) == 0) --num_values;
+  }
+  return num_values == 0 ? bp - buf : -1;
+}
+
 Status ReadWriteUtil::ReadZInt(ByteStream* byte_stream, int32_t* integer) {
   uint8_t buf[MAX_ZINT_LEN];
   int64_t nread;
@@ -83,6 +109,77 @@ Status ReadWriteUtil::SkipBytes(ByteStream* byte_stream) {
   return byte_stream->SeekRelative(len);
 }
 
+Status ReadWriteUtil::ReadZLong(ScanRangeContext* context, int64_t* value) {
+  // The context can't be seeked back, so read the value a byte at a time until the
+  // last byte, which doesn't have the continuation bit.
+  uint8_t buf[MAX_ZLONG_LEN];
+  Status status;
+  for (int i = 0; i < MAX_ZLONG_LEN; ++i) {
+    uint8_t* byte;
+    if (!SerDeUtils::ReadBytes(context, 1, &byte, &status)) return status;
+    buf[i] = *byte;
+    if ((*byte & 0x80) == 0) {
+      GetZLong(buf, value);
+      return Status::OK;
+    }
+  }
+  return Status("Bad integer format");
+}
+
+Status ReadWriteUtil::ReadZInt(ScanRangeContext* context, int32_t* integer) {
+  int64_t value;
+  RETURN_IF_ERROR(ReadZLong(context, &value));
+  if (value < numeric_limits<int32_t>::min() || value > numeric_limits<int32_t>::max()) {
+    return Status("Bad integer format");
+  }
+  *integer = value;
+  return Status::OK;
+}
+
+Status ReadWriteUtil::ReadInt(ScanRangeContext* context, int32_t* integer) {
+  uint8_t* buf;
+  Status status;
+  if (!SerDeUtils::ReadBytes(context, sizeof(int32_t), &buf, &status)) return status;
+  *integer = GetInt(buf);
+  return Status::OK;
+}
+
+Status ReadWriteUtil::ReadInt(ScanRangeContext* context, int64_t* longint) {
+  uint8_t* buf;
+  Status status;
+  if (!SerDeUtils::ReadBytes(context, sizeof(int64_t), &buf, &status)) return status;
+  *longint = GetLong(buf);
+  return Status::OK;
+}
+
+Status ReadWriteUtil::ReadString(ScanRangeContext* context, string* str) {
+  int64_t len;
+  RETURN_IF_ERROR(ReadZLong(context, &len));
+  uint8_t* buf;
+  Status status;
+  if (!SerDeUtils::ReadBytes(context, len, &buf, &status)) return status;
+  str->assign(reinterpret_cast<char*>(buf), len);
+  return Status::OK;
+}
+
+Status ReadWriteUtil::ReadBytes(ScanRangeContext* context, vector<uint8_t>* buf) {
+  int64_t len;
+  RETURN_IF_ERROR(ReadZLong(context, &len));
+  uint8_t* bytes;
+  Status status;
+  if (!SerDeUtils::ReadBytes(context, len, &bytes, &status)) return status;
+  buf->assign(bytes, bytes + len);
+  return Status::OK;
+}
+
+Status ReadWriteUtil::SkipBytes(ScanRangeContext* context) {
+  int64_t len;
+  RETURN_IF_ERROR(ReadZLong(context, &len));
+  Status status;
+  if (!SerDeUtils::SkipBytes(context, len, &status)) return status;
+  return Status::OK;
+}
+
 int ReadWriteUtil::PutZInt(int32_t integer, uint8_t* buf) {
   // Move the sign bit to the first bit.
   uint32_t uinteger = (integer << 1) ^ (integer >> 31);
@@ -16,13 +16,18 @@
 #ifndef IMPALA_EXEC_READ_WRITE_UTIL_H
 #define IMPALA_EXEC_READ_WRITE_UTIL_H
 
+#include "common/compiler-util.h"
 #include "exec/hdfs-byte-stream.h"
 
 class ByteStream;
 
 namespace impala {
 
+class ScanRangeContext;
+
 // Class for reading and writing various data types supported by Trevni and Avro.
+// The read functions come in two versions: one reading from a ByteStream and one
+// reading from a ScanRangeContext, which blocks until the io mgr has read the bytes.
 class ReadWriteUtil {
  public:
   // Maximum lengths for Zigzag encodings.
@@ -38,6 +43,10 @@ class ReadWriteUtil {
   // Read the length of the byte or string value and skip over it.
   static Status SkipBytes(ByteStream* byte_stream);
 
+  static Status ReadString(ScanRangeContext* context, std::string* str);
+  static Status ReadBytes(ScanRangeContext* context, std::vector<uint8_t>* buf);
+  static Status SkipBytes(ScanRangeContext* context);
+
   // Return an integer from a buffer, stored little endian.
   static int32_t GetInt(uint8_t* buf) {
     return buf[0] | (buf[1] << 8) | (buf[2] << 16) | (buf[3] << 24);
@@ -74,6 +83,11 @@ class ReadWriteUtil {
   // This is the integer encoding defined by google.com protocol-buffers:
   // https://developers.google.com/protocol-buffers/docs/encoding
   static int GetZLong(uint8_t* buf, int64_t* value) {
+    // Small values take a single byte.
+    if (LIKELY((*buf & 0x80) == 0)) {
+      *value = (*buf >> 1) ^ -(*buf & 1);
+      return 1;
+    }
     uint64_t zlong = 0;
     int shift = 0;
     uint8_t* bp = buf;
@@ -90,6 +104,10 @@ class ReadWriteUtil {
 
   // Get a zigzag encoded integer from a buffer and return its length.
   static int GetZInt(uint8_t* buf, int32_t* integer) {
+    if (LIKELY((*buf & 0x80) == 0)) {
+      *integer = (*buf >> 1) ^ -(*buf & 1);
+      return 1;
+    }
     uint32_t zint = 0;
     int shift = 0;
     uint8_t* bp = buf;
@@ -104,12 +122,25 @@ class ReadWriteUtil {
     return bp - buf;
   }
 
+  // Skip over num_values zigzag encoded integers or longs in the buf_len bytes at buf
+  // and return the number of bytes skipped, or -1 if buf holds fewer values.  The
+  // values are not decoded: this counts the bytes without the continuation bit,
+  // 8 bytes at a time.
+  static int64_t SkipZLongs(const uint8_t* buf, int64_t buf_len, int64_t num_values);
+
   // Read a zigzag encoded integer from the current byte stream.
   static Status ReadZInt(ByteStream* byte_stream, int32_t* integer);
 
   // Read a zigzag encoded long integer from the current byte stream.
   static Status ReadZLong(ByteStream* byte_stream, int64_t* longint);
 
+  static Status ReadZInt(ScanRangeContext* context, int32_t* integer);
+  static Status ReadZLong(ScanRangeContext* context, int64_t* longint);
+
+  // Read a little endian integer or long from context.
+  static Status ReadInt(ScanRangeContext* context, int32_t* integer);
+  static Status ReadInt(ScanRangeContext* context, int64_t* longint);
+
   // Put a zigzag encoded integer into a buffer and return its length.
   static int PutZInt(int32_t integer, uint8_t* buf);
 
@@ -32,13 +32,13 @@ Status ScanNode::Prepare(RuntimeState* state) {
   RETURN_IF_ERROR(ExecNode::Prepare(state));
   
   bytes_read_counter_ =
-      ADD_COUNTER(runtime_profile(), BYTES_READ_COUNTER, TCounterType::BYTES);
+      ADD_SHARDED_COUNTER(runtime_profile(), BYTES_READ_COUNTER, TCounterType::BYTES);
   read_timer_ =
-      ADD_COUNTER(runtime_profile(), READ_TIMER, TCounterType::CPU_TICKS);
+      ADD_SHARDED_COUNTER(runtime_profile(), READ_TIMER, TCounterType::CPU_TICKS);
   total_throughput_counter_ = runtime_profile()->AddRateCounter(
       TOTAL_THROUGHPUT_COUNTER, bytes_read_counter_);
-  materialize_tuple_timer_ =
-      ADD_COUNTER(runtime_profile(), MATERIALIZE_TUPLE_TIMER, TCounterType::CPU_TICKS);
+  materialize_tuple_timer_ = ADD_SHARDED_COUNTER(
+      runtime_profile(), MATERIALIZE_TUPLE_TIMER, TCounterType::CPU_TICKS);
   per_thread_throughput_counter_ = runtime_profile()->AddDerivedCounter(
        PER_THREAD_THROUGHPUT_COUNTER, TCounterType::BYTES_PER_SECOND,
        bind<int64_t>(&RuntimeProfile::UnitsPerSecond, bytes_read_counter_, read_timer_));
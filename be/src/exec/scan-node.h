@@ -41,15 +41,17 @@ class ScanNode : public ExecNode {
 
   virtual bool IsScanNode() const { return true; }
 
-  RuntimeProfile::Counter* bytes_read_counter() const { return bytes_read_counter_; }
-  RuntimeProfile::Counter* read_timer() const { return read_timer_; }
+  RuntimeProfile::ShardedCounter* bytes_read_counter() const {
+    return bytes_read_counter_;
+  }
+  RuntimeProfile::ShardedCounter* read_timer() const { return read_timer_; }
   RuntimeProfile::Counter* total_throughput_counter() const { 
     return total_throughput_counter_; 
   }
   RuntimeProfile::Counter* per_thread_throughput_counter() const {
     return per_thread_throughput_counter_;
   }
-  RuntimeProfile::Counter* materialize_tuple_timer() const { 
+  RuntimeProfile::ShardedCounter* materialize_tuple_timer() const { 
     return materialize_tuple_timer_; 
   }
   RuntimeProfile::Counter* scan_ranges_complete_counter() const {
@@ -65,13 +67,14 @@ class ScanNode : public ExecNode {
   static const std::string SCAN_RANGES_COMPLETE_COUNTER;
 
  private:
-  RuntimeProfile::Counter* bytes_read_counter_; // # bytes read from the scanner
-  RuntimeProfile::Counter* read_timer_; // total read time 
+  // The counters that all scanner threads update are sharded.
+  RuntimeProfile::ShardedCounter* bytes_read_counter_; // # bytes read from the scanner
+  RuntimeProfile::ShardedCounter* read_timer_; // total read time 
   // Wall based aggregate read throughput [bytes/sec]
   RuntimeProfile::Counter* total_throughput_counter_;
   // Per thread read throughput [bytes/sec]
   RuntimeProfile::Counter* per_thread_throughput_counter_;
-  RuntimeProfile::Counter* materialize_tuple_timer_;  // time writing tuple slots
+  RuntimeProfile::ShardedCounter* materialize_tuple_timer_;  // time writing tuple slots
   RuntimeProfile::Counter* scan_ranges_complete_counter_;
 };
 
@@ -14,6 +14,7 @@
 
 #include "exec/scan-range-context.h"
 
+#include "exec/batch-conjunct-evaluator.h"
 #include "exec/hdfs-scan-node.h"
 #include "runtime/row-batch.h"
 #include "runtime/mem-pool.h"
@@ -36,10 +37,12 @@ ScanRangeContext::ScanRangeContext(RuntimeState* state, HdfsScanNode* scan_node,
     current_buffer_pos_(NULL),
     total_bytes_returned_(0),
     read_past_buffer_size_(DEFAULT_READ_PAST_SIZE),
+    conjunct_evaluator_(NULL),
     boundary_pool_(new MemPool()),
     boundary_buffer_(new StringBuffer(boundary_pool_.get())),
     cancelled_(false),
     read_eosr_(false),
+    read_ahead_used_(false),
     current_buffer_(NULL) {
 
   compact_data_ = scan_node->compact_data() || 
@@ -60,9 +63,10 @@ ScanRangeContext::~ScanRangeContext() {
 }
 
 void ScanRangeContext::NewRowBatch() {
-  current_row_batch_ = new RowBatch(scan_node_->row_desc(), state_->batch_size());
+  current_row_batch_ =
+      new RowBatch(scan_node_->row_desc(), scan_node_->row_batch_capacity());
   tuple_mem_ = current_row_batch_->tuple_data_pool()->Allocate(
-      state_->batch_size() * tuple_byte_size_);
+      current_row_batch_->capacity() * tuple_byte_size_);
 }
 
 void ScanRangeContext::AttachCompletedResources(bool done) {
@@ -84,12 +88,19 @@ void ScanRangeContext::AttachCompletedResources(bool done) {
 
   // If there are any rows or any io buffers, pass this batch to the scan node.
   if (current_row_batch_->num_io_buffers() > 0 || current_row_batch_->num_rows() > 0) {
-    scan_node_->AddMaterializedRowBatch(current_row_batch_);
+    EnqueueRowBatch();
     current_row_batch_ = NULL;
     if (!done) NewRowBatch();
   }
 }
 
+void ScanRangeContext::EnqueueRowBatch() {
+  scan_node_->ApplyRuntimeFilters(current_row_batch_, 0);
+  if (conjunct_evaluator_ != NULL) conjunct_evaluator_->EvalConjuncts(current_row_batch_);
+  scan_node_->AddMaterializedRowBatch(current_row_batch_,
+      reinterpret_cast<int64_t>(scan_range_->meta_data()));
+}
+
 void ScanRangeContext::RemoveFirstBuffer() {
   DCHECK(current_buffer_ != NULL);
   DCHECK(!buffers_.empty());
@@ -108,12 +119,25 @@ void ScanRangeContext::RemoveFirstBuffer() {
   }
 }
 
+bool ScanRangeContext::UseReadAhead() {
+  if (read_ahead_used_ || current_buffer_ == NULL || !current_buffer_->eosr() ||
+      current_buffer_->read_ahead_len() == 0) {
+    return false;
+  }
+  read_ahead_used_ = true;
+  current_buffer_bytes_left_ += current_buffer_->read_ahead_len();
+  return true;
+}
+
 Status ScanRangeContext::GetRawBytes(uint8_t** out_buffer, int* len, bool* eos) {
   // Wait for first buffer
   {
     unique_lock<mutex> l(lock_);
-    while (!cancelled_ && buffers_.empty()) {
-      read_ready_cv_.wait(l);
+    if (!cancelled_ && buffers_.empty()) {
+      SCOPED_TIMER(scan_node_->scanner_io_wait_timer());
+      while (!cancelled_ && buffers_.empty()) {
+        read_ready_cv_.wait(l);
+      }
     }
 
     if (cancelled_) {
@@ -136,6 +160,40 @@ Status ScanRangeContext::GetRawBytes(uint8_t** out_buffer, int* len, bool* eos)
 return Status::OK;
 }
 
+bool ScanRangeContext::SkipBytes(int64_t length, Status* status) {
+  uint8_t* buffer = NULL;
+  int len;
+  bool eos;
+  while (length > 0) {
+    if (current_buffer_bytes_left_ == 0) {
+      if (eosr()) {
+        // Past the end of the scan range, the bytes are read (synchronously) in
+        // small chunks so just let GetBytes() handle it.
+        if (!GetBytes(&buffer, length, &len, &eos, status)) return false;
+        if (len != length) {
+          *status = Status("incomplete read");
+          return false;
+        }
+        return true;
+      }
+      // Wait for the next buffer.
+      *status = GetRawBytes(&buffer, &len, &eos);
+      if (!status->ok()) return false;
+      if (len == 0) {
+        *status = Status("incomplete read");
+        return false;
+      }
+      continue;
+    }
+    // Consume the rest (or part) of the current buffer.  This never stitches.
+    int num_bytes = min<int64_t>(length, current_buffer_bytes_left_);
+    if (!GetBytes(&buffer, num_bytes, &len, &eos, status)) return false;
+    DCHECK_EQ(len, num_bytes);
+    length -= num_bytes;
+  }
+  return true;
+}
+
 Status ScanRangeContext::GetBytesInternal(uint8_t** out_buffer, int requested_len, 
     bool peek, int* out_len, bool* eos) {
   *out_len = 0;
@@ -148,7 +206,8 @@ Status ScanRangeContext::GetBytesInternal(uint8_t** out_buffer, int requested_le
   // scanner. Attach the boundary pool and io buffers to the current row batch.
   {
     unique_lock<mutex> l(lock_);
-    if (current_buffer_bytes_left_ == 0 && current_buffer_ != NULL) {
+    if (current_buffer_bytes_left_ == 0 && current_buffer_ != NULL &&
+        !UseReadAhead()) {
       RemoveFirstBuffer();
     }
     AttachCompletedResources(false);
@@ -161,8 +220,11 @@ Status ScanRangeContext::GetBytesInternal(uint8_t** out_buffer, int requested_le
   while (true) {
     unique_lock<mutex> l(lock_);
    
-    while (!cancelled_ && buffers_.empty() && !eosr()) {
-      read_ready_cv_.wait(l);
+    if (!cancelled_ && buffers_.empty() && !eosr()) {
+      SCOPED_TIMER(scan_node_->scanner_io_wait_timer());
+      while (!cancelled_ && buffers_.empty() && !eosr()) {
+        read_ready_cv_.wait(l);
+      }
     }
 
     if (cancelled_) return Status::CANCELLED;
@@ -175,6 +237,8 @@ Status ScanRangeContext::GetBytesInternal(uint8_t** out_buffer, int requested_le
 
     // Not enough bytes, copy the end of this buffer and combine it wit the next one
     if (requested_len > current_buffer_bytes_left_) {
+      // The request goes past the range, which the read ahead bytes may cover.
+      if (UseReadAhead()) continue;
       if (current_buffer_ != NULL) {
         read_eosr_ = current_buffer_->eosr();
         boundary_buffer_->Append(current_buffer_pos_, current_buffer_bytes_left_);
@@ -261,7 +325,7 @@ void ScanRangeContext::CommitRows(int num_rows) {
   tuple_mem_ += scan_node_->tuple_desc()->byte_size() * num_rows;
 
   if (current_row_batch_->IsFull()) {
-    scan_node_->AddMaterializedRowBatch(current_row_batch_);
+    EnqueueRowBatch();
     NewRowBatch();
   }
 }
@@ -305,7 +369,7 @@ void ScanRangeContext::Complete() {
     // resources attached to it that can't be cleaned up until all previous row
     // batches have been consumed.
     if (current_row_batch_ != NULL) {
-      scan_node_->AddMaterializedRowBatch(current_row_batch_);
+      EnqueueRowBatch();
     }
 
     // Set variables to NULL to make sure this object is not being used after Complete()
@@ -29,6 +29,7 @@
 
 namespace impala {
 
+class BatchConjunctEvaluator;
 class HdfsPartitionDescriptor;
 class HdfsScanNode;
 class MemPool;
@@ -86,6 +87,12 @@ class ScanRangeContext {
   // Reading past the end of the scan range is likely a remote read.  We want
   // to minimize the number of io requests as well as the data volume.
   void set_read_past_buffer_size(int size) { read_past_buffer_size_ = size; }
+
+  // Sets the evaluator that filters each row batch before it is enqueued with the
+  // scan node.  NULL (the default) enqueues all committed rows.
+  void set_conjunct_evaluator(BatchConjunctEvaluator* evaluator) {
+    conjunct_evaluator_ = evaluator;
+  }
   
   // Returns the next *len bytes or an error.  This can block if bytes are not
   // available.  
@@ -108,6 +115,14 @@ class ScanRangeContext {
   // range location (e.g. repeated calls to this function will return the same thing).
   Status GetRawBytes(uint8_t** buffer, int* out_len, bool* eos);
 
+  // Advances the scan range location by length bytes.  Unlike GetBytes(), the
+  // skipped bytes are not stitched together across io buffers, so skipping a large
+  // number of bytes (e.g. the columns of an rc file row group that are not read)
+  // does not copy them.  Returns false and sets *status on error, or if the file
+  // ends before length bytes.
+  // This should only be called from the scanner thread.
+  bool SkipBytes(int64_t length, Status* status);
+
   // Gets memory for outputting tuples.   
   //  *pool is the mem pool that should be used for memory allocated for those tuples.
   //  *tuple_mem should be the location to output tuples, and 
@@ -226,6 +241,9 @@ class ScanRangeContext {
   // Current row batch that tuples are being written to.
   RowBatch* current_row_batch_;
 
+  // If not NULL, used to filter current_row_batch_ before it is enqueued.
+  BatchConjunctEvaluator* conjunct_evaluator_;
+
   // Tuple memory for current row batch.
   uint8_t* tuple_mem_;
 
@@ -246,6 +264,9 @@ class ScanRangeContext {
   // Set to true when a buffer returns the end of the scan range.
   bool read_eosr_;
 
+  // Set once the read ahead bytes of the last buffer have been made available.
+  bool read_ahead_used_;
+
   // Buffers that are ready for the reader
   std::list<DiskIoMgr::BufferDescriptor*> buffers_;
 
@@ -262,11 +283,21 @@ class ScanRangeContext {
   // Removes the first buffer from the queue, adding it to the row batch if necessary.
   void RemoveFirstBuffer();
 
+  // If the current buffer is the last one of the range and holds bytes past the
+  // range's end (DiskIoMgr::BufferDescriptor::read_ahead_len()), adds those to the
+  // bytes left in it, so that reading past the range needs no io.  Returns true if
+  // there were any.  lock_ must be taken.
+  bool UseReadAhead();
+
   // Create a new row batch and tuple buffer.
   void NewRowBatch();
 
   // Attach all completed io buffers to the current row batch
   void AttachCompletedResources(bool done);
+
+  // Filters current_row_batch_ with the scan node's runtime filters and
+  // conjunct_evaluator_ (if set) and passes it to the scan node.
+  void EnqueueRowBatch();
   
   // GetBytes helper to handle the slow path 
   // If peek is set then return the data but do not move the current offset.
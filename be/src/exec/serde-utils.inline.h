@@ -53,15 +53,7 @@ inline bool SerDeUtils::ReadBytes(ScanRangeContext* context, int length,
 }
 
 inline bool SerDeUtils::SkipBytes(ScanRangeContext* context, int length, Status* status) {
-  uint8_t* dummy_buf;
-  int bytes_read;
-  bool dummy_eos;
-  RETURN_IF_FALSE(context->GetBytes(&dummy_buf, length, &bytes_read, &dummy_eos, status));
-  if (UNLIKELY(length != bytes_read)) {
-    *status = Status("incomplete read");
-    return false;
-  }
-  return true;
+  return context->SkipBytes(length, status);
 }
 
 inline bool SerDeUtils::SkipText(ScanRangeContext* context, Status* status) {
@@ -0,0 +1,309 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exec/sort-node.h"
+
+#include <algorithm>
+#include <sstream>
+#include <gflags/gflags.h>
+
+#include "exprs/expr.h"
+#include "runtime/descriptors.h"
+#include "runtime/mem-pool.h"
+#include "runtime/row-batch.h"
+#include "runtime/runtime-state.h"
+#include "runtime/spill-stream.h"
+#include "runtime/tuple.h"
+#include "runtime/tuple-row.h"
+#include "util/debug-util.h"
+#include "util/runtime-profile.h"
+
+#include "gen-cpp/Exprs_types.h"
+#include "gen-cpp/PlanNodes_types.h"
+
+DEFINE_int64(sort_run_bytes, 256 * 1024 * 1024,
+    "size (in bytes) of the in-memory runs of the sort node; input that exceeds this "
+    "is sorted in runs of this size that are spilled to disk and merged");
+DEFINE_int32(sort_merge_fan_in, 16, "maximum number of runs merged at a time by the "
+    "sort node");
+
+using namespace impala;
+using namespace std;
+
+SortNode::SortNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs)
+  : ExecNode(pool, tnode, descs),
+    tuple_row_less_than_(this),
+    run_pool_(new MemPool),
+    next_row_idx_(0),
+    sort_timer_(NULL),
+    merge_timer_(NULL),
+    runs_spilled_counter_(NULL),
+    bytes_spilled_counter_(NULL),
+    merge_passes_counter_(NULL) {
+  // TODO: log errors in runtime state
+  Status status = Init(pool, tnode);
+  DCHECK(status.ok()) << "SortNode c'tor:Init failed: \n" << status.GetErrorMsg();
+}
+
+SortNode::~SortNode() {
+  for (int i = 0; i < spilled_runs_.size(); ++i) {
+    delete spilled_runs_[i];
+  }
+}
+
+Status SortNode::Init(ObjectPool* pool, const TPlanNode& tnode) {
+  RETURN_IF_ERROR(
+      Expr::CreateExprTrees(pool, tnode.sort_node.ordering_exprs, &lhs_ordering_exprs_));
+  RETURN_IF_ERROR(
+      Expr::CreateExprTrees(pool, tnode.sort_node.ordering_exprs, &rhs_ordering_exprs_));
+  is_asc_order_.insert(
+      is_asc_order_.begin(), tnode.sort_node.is_asc_order.begin(),
+      tnode.sort_node.is_asc_order.end());
+  DCHECK_EQ(conjuncts_.size(), 0) << "SortNode should never have predicates to evaluate.";
+  return Status::OK;
+}
+
+Status SortNode::Prepare(RuntimeState* state) {
+  RETURN_IF_ERROR(ExecNode::Prepare(state));
+  run_pool_.reset(new MemPool(mem_tracker()));
+
+  tuple_descs_ = child(0)->row_desc().tuple_descriptors();
+  Expr::Prepare(lhs_ordering_exprs_, state, child(0)->row_desc());
+  Expr::Prepare(rhs_ordering_exprs_, state, child(0)->row_desc());
+  comparator_.reset(new TupleRowComparator(
+      lhs_ordering_exprs_, rhs_ordering_exprs_, is_asc_order_));
+
+  sort_timer_ = ADD_COUNTER(runtime_profile(), "SortTime", TCounterType::CPU_TICKS);
+  merge_timer_ = ADD_COUNTER(runtime_profile(), "MergeTime", TCounterType::CPU_TICKS);
+  runs_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "RunsSpilled", TCounterType::UNIT);
+  bytes_spilled_counter_ =
+      ADD_COUNTER(runtime_profile(), "BytesSpilled", TCounterType::BYTES);
+  merge_passes_counter_ =
+      ADD_COUNTER(runtime_profile(), "IntermediateMergePasses", TCounterType::UNIT);
+  return Status::OK;
+}
+
+Status SortNode::Open(RuntimeState* state) {
+  RETURN_IF_CANCELLED(state);
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  RETURN_IF_ERROR(child(0)->Open(state));
+
+  RowBatch batch(child(0)->row_desc(), state->batch_size(child(0)->row_desc()));
+  bool eos;
+  do {
+    RETURN_IF_ERROR(state->CheckQueryState());
+    batch.Reset();
+    RETURN_IF_ERROR(child(0)->GetNext(state, &batch, &eos));
+    for (int i = 0; i < batch.num_rows(); ++i) {
+      run_rows_.push_back(batch.GetRow(i)->DeepCopy(tuple_descs_, run_pool_.get()));
+    }
+    int64_t run_bytes =
+        run_pool_->total_allocated_bytes() + run_rows_.size() * sizeof(TupleRow*);
+    if (run_bytes >= FLAGS_sort_run_bytes) RETURN_IF_ERROR(SpillRun(state));
+  } while (!eos);
+
+  if (spilled_runs_.empty()) {
+    // Everything fit in memory.
+    SortRun();
+    next_row_idx_ = 0;
+    return Status::OK;
+  }
+  if (!run_rows_.empty()) RETURN_IF_ERROR(SpillRun(state));
+  return MergeRuns(state);
+}
+
+Status SortNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
+  RETURN_IF_CANCELLED(state);
+  SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
+  if (ReachedLimit()) {
+    *eos = true;
+    return Status::OK;
+  }
+
+  if (merger_.get() != NULL) {
+    SCOPED_TIMER(merge_timer_);
+    int num_rows_before = row_batch->num_rows();
+    RETURN_IF_ERROR(merger_->GetNext(row_batch, eos));
+    num_rows_returned_ += row_batch->num_rows() - num_rows_before;
+    if (ReachedLimit()) {
+      row_batch->set_num_rows(row_batch->num_rows() - (num_rows_returned_ - limit_));
+      num_rows_returned_ = limit_;
+      *eos = true;
+    }
+    COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+    return Status::OK;
+  }
+
+  while (!row_batch->IsFull() && next_row_idx_ < run_rows_.size() && !ReachedLimit()) {
+    int row_idx = row_batch->AddRow();
+    TupleRow* dst_row = row_batch->GetRow(row_idx);
+    row_batch->CopyRow(run_rows_[next_row_idx_], dst_row);
+    ++next_row_idx_;
+    row_batch->CommitLastRow();
+    ++num_rows_returned_;
+  }
+  COUNTER_SET(rows_returned_counter_, num_rows_returned_);
+  *eos = next_row_idx_ == run_rows_.size() || ReachedLimit();
+  return Status::OK;
+}
+
+Status SortNode::Close(RuntimeState* state) {
+  COUNTER_UPDATE(memory_used_counter(), run_pool_->peak_allocated_bytes());
+  merger_.reset();
+  for (int i = 0; i < spilled_runs_.size(); ++i) {
+    delete spilled_runs_[i];
+  }
+  spilled_runs_.clear();
+  return ExecNode::Close(state);
+}
+
+void SortNode::SortRun() {
+  SCOPED_TIMER(sort_timer_);
+  sort(run_rows_.begin(), run_rows_.end(), tuple_row_less_than_);
+}
+
+Status SortNode::SpillRun(RuntimeState* state) {
+  SortRun();
+  auto_ptr<SpillStream> run(new SpillStream(state, child(0)->row_desc()));
+  RETURN_IF_ERROR(run->Init());
+
+  RowBatch batch(child(0)->row_desc(), state->batch_size(child(0)->row_desc()));
+  for (int i = 0; i < run_rows_.size(); ++i) {
+    int row_idx = batch.AddRow();
+    batch.CopyRow(run_rows_[i], batch.GetRow(row_idx));
+    batch.CommitLastRow();
+    if (batch.IsFull()) {
+      RETURN_IF_ERROR(run->AddBatch(&batch));
+      batch.Reset();
+    }
+  }
+  RETURN_IF_ERROR(run->AddBatch(&batch));
+
+  COUNTER_UPDATE(runs_spilled_counter_, 1);
+  COUNTER_UPDATE(bytes_spilled_counter_, run->bytes_written());
+  spilled_runs_.push_back(run.release());
+
+  // Keep track of the largest run before releasing its memory.
+  COUNTER_UPDATE(memory_used_counter(), run_pool_->peak_allocated_bytes());
+  run_rows_.clear();
+  run_pool_.reset(new MemPool(mem_tracker()));
+  return Status::OK;
+}
+
+Status SortNode::MergeRuns(RuntimeState* state) {
+  SCOPED_TIMER(merge_timer_);
+  int fan_in = max(FLAGS_sort_merge_fan_in, 2);
+  while (spilled_runs_.size() > fan_in) {
+    RETURN_IF_CANCELLED(state);
+    vector<SpillStream*> inputs(spilled_runs_.begin(), spilled_runs_.begin() + fan_in);
+    spilled_runs_.erase(spilled_runs_.begin(), spilled_runs_.begin() + fan_in);
+    RunMerger merger(this);
+    RETURN_IF_ERROR(merger.Init(inputs));
+
+    auto_ptr<SpillStream> output(new SpillStream(state, child(0)->row_desc()));
+    RETURN_IF_ERROR(output->Init());
+    RowBatch batch(child(0)->row_desc(), state->batch_size(child(0)->row_desc()));
+    bool eos = false;
+    while (!eos) {
+      RETURN_IF_CANCELLED(state);
+      RETURN_IF_ERROR(merger.GetNext(&batch, &eos));
+      RETURN_IF_ERROR(output->AddBatch(&batch));
+      batch.Reset();
+    }
+    COUNTER_UPDATE(merge_passes_counter_, 1);
+    COUNTER_UPDATE(bytes_spilled_counter_, output->bytes_written());
+    spilled_runs_.push_back(output.release());
+  }
+
+  vector<SpillStream*> inputs(spilled_runs_.begin(), spilled_runs_.end());
+  spilled_runs_.clear();
+  merger_.reset(new RunMerger(this));
+  return merger_->Init(inputs);
+}
+
+TupleRow* SortNode::RunMerger::Input::current_row() {
+  return batch->GetRow(row_idx);
+}
+
+SortNode::RunMerger::~RunMerger() {
+  for (int i = 0; i < inputs_.size(); ++i) {
+    delete inputs_[i]->run;
+    delete inputs_[i];
+  }
+}
+
+Status SortNode::RunMerger::Init(const vector<SpillStream*>& runs) {
+  DCHECK(inputs_.empty());
+  for (int i = 0; i < runs.size(); ++i) {
+    Input* input = new Input();
+    input->run = runs[i];
+    input->row_idx = 0;
+    inputs_.push_back(input);
+  }
+  for (int i = 0; i < inputs_.size(); ++i) {
+    RETURN_IF_ERROR(inputs_[i]->run->PrepareForRead());
+  }
+  for (int i = 0; i < inputs_.size(); ++i) {
+    bool eos;
+    RETURN_IF_ERROR(inputs_[i]->run->GetNext(&inputs_[i]->batch, &eos));
+    if (!eos) heap_.push_back(inputs_[i]);
+  }
+  make_heap(heap_.begin(), heap_.end(), InputGreaterThan(node_));
+  return Status::OK;
+}
+
+Status SortNode::RunMerger::Advance(Input* input, RowBatch* output, bool* eos) {
+  *eos = false;
+  if (++input->row_idx < input->batch->num_rows()) return Status::OK;
+  input->batch->TransferResourceOwnership(output);
+  input->row_idx = 0;
+  // The batch is released by the next GetNext(); its tuple data now lives in 'output'.
+  return input->run->GetNext(&input->batch, eos);
+}
+
+Status SortNode::RunMerger::GetNext(RowBatch* batch, bool* eos) {
+  InputGreaterThan greater_than(node_);
+  while (!batch->IsFull() && !heap_.empty()) {
+    pop_heap(heap_.begin(), heap_.end(), greater_than);
+    Input* input = heap_.back();
+    int row_idx = batch->AddRow();
+    batch->CopyRow(input->current_row(), batch->GetRow(row_idx));
+    batch->CommitLastRow();
+
+    bool input_eos;
+    RETURN_IF_ERROR(Advance(input, batch, &input_eos));
+    if (input_eos) {
+      heap_.pop_back();
+    } else {
+      push_heap(heap_.begin(), heap_.end(), greater_than);
+    }
+  }
+  *eos = heap_.empty();
+  return Status::OK;
+}
+
+void SortNode::DebugString(int indentation_level, stringstream* out) const {
+  *out << string(indentation_level * 2, ' ');
+  *out << "SortNode("
+       << " ordering_exprs=" << Expr::DebugString(lhs_ordering_exprs_)
+       << " sort_order=[";
+  for (int i = 0; i < is_asc_order_.size(); ++i) {
+    *out << (i > 0 ? " " : "") << (is_asc_order_[i] ? "asc" : "desc");
+  }
+  *out << "]";
+  ExecNode::DebugString(indentation_level, out);
+  *out << ")";
+}
@@ -0,0 +1,168 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_SORT_NODE_H
+#define IMPALA_EXEC_SORT_NODE_H
+
+#include <deque>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+
+#include "exec/exec-node.h"
+#include "exec/tuple-row-comparator.h"
+#include "runtime/descriptors.h"  // for TupleId
+
+namespace impala {
+
+class MemPool;
+class RuntimeState;
+class SpillStream;
+class Tuple;
+
+// Node for ORDER BY without a LIMIT.
+// Input rows are deep-copied into an in-memory run until the run reaches
+// --sort_run_bytes.  A full run is sorted and spilled to a SpillStream.  If the
+// whole input fits into a single run it is sorted and returned from memory.
+// Otherwise the remaining rows are spilled as the last run and the runs are merged:
+// while there are more than --sort_merge_fan_in runs, intermediate passes merge
+// groups of runs into new, longer runs; the final pass merges the remaining runs
+// while producing output in GetNext().
+// NULLs sort after all other values, regardless of asc/desc (same as TopNNode).
+class SortNode : public ExecNode {
+ public:
+  SortNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
+  virtual ~SortNode();
+
+  virtual Status Prepare(RuntimeState* state);
+  virtual Status Open(RuntimeState* state);
+  virtual Status GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos);
+  virtual Status Close(RuntimeState* state);
+
+ protected:
+  virtual void DebugString(int indentation_level, std::stringstream* out) const;
+
+ private:
+  Status Init(ObjectPool* pool, const TPlanNode& tnode);
+
+  // Strict weak ordering on TupleRows according to the ordering exprs.
+  class TupleRowLessThan {
+   public:
+    TupleRowLessThan(SortNode* node) : node_(node) {}
+    bool operator()(TupleRow* const& lhs, TupleRow* const& rhs) const {
+      return node_->comparator_->Less(lhs, rhs);
+    }
+
+   private:
+    SortNode* node_;
+  };
+
+  // Merges a set of sorted spilled runs into a single sorted sequence of rows.
+  class RunMerger {
+   public:
+    RunMerger(SortNode* node) : node_(node) {}
+
+    // Deletes the input runs.
+    ~RunMerger();
+
+    // Takes ownership of 'runs', prepares them for reading and reads the first
+    // batch of each.
+    Status Init(const std::vector<SpillStream*>& runs);
+
+    // Adds merged rows to 'batch' until it is full or all runs are exhausted, in
+    // which case *eos is set.  The memory backing input batches is transferred to
+    // 'batch' once they are exhausted, so the rows in 'batch' stay valid until it is
+    // reset.
+    Status GetNext(RowBatch* batch, bool* eos);
+
+   private:
+    struct Input {
+      SpillStream* run;
+      boost::scoped_ptr<RowBatch> batch;
+      int row_idx;
+
+      TupleRow* current_row();
+    };
+
+    // Orders the heap so that the input with the smallest current row is on top.
+    class InputGreaterThan {
+     public:
+      InputGreaterThan(SortNode* node) : less_than_(node) {}
+      bool operator()(Input* const& lhs, Input* const& rhs) const {
+        return less_than_(rhs->current_row(), lhs->current_row());
+      }
+
+     private:
+      TupleRowLessThan less_than_;
+    };
+
+    // Moves 'input' to its next row, fetching the next batch from the run if the
+    // current one is exhausted.  The exhausted batch's resources are transferred to
+    // 'output'.  Sets *eos if the run has no more rows.
+    Status Advance(Input* input, RowBatch* output, bool* eos);
+
+    SortNode* node_;
+    std::vector<Input*> inputs_;
+
+    // Min-heap (under InputGreaterThan) of inputs that are not exhausted.
+    std::vector<Input*> heap_;
+  };
+
+  // Sorts the rows in the current in-memory run.
+  void SortRun();
+
+  // Sorts the current run, writes it to a new SpillStream and resets the run.
+  Status SpillRun(RuntimeState* state);
+
+  // Merges spilled runs until at most --sort_merge_fan_in remain, then initializes
+  // merger_ over the remaining runs.
+  Status MergeRuns(RuntimeState* state);
+
+  std::vector<TupleDescriptor*> tuple_descs_;
+  std::vector<bool> is_asc_order_;
+
+  // Create two copies of the exprs for evaluating over the TupleRows.
+  // The result of the evaluation is stored in the Expr, so it's not efficient to use
+  // one set of Expr to compare TupleRows.
+  std::vector<Expr*> lhs_ordering_exprs_;
+  std::vector<Expr*> rhs_ordering_exprs_;
+
+  // Compares rows by the ordering exprs above; created in Prepare().
+  boost::scoped_ptr<TupleRowComparator> comparator_;
+
+  TupleRowLessThan tuple_row_less_than_;
+
+  // Rows of the current in-memory run and the pool that backs them.
+  std::vector<TupleRow*> run_rows_;
+  boost::scoped_ptr<MemPool> run_pool_;
+
+  // Index of the next row in run_rows_ to return if the input fit in memory.
+  int next_row_idx_;
+
+  // Spilled runs that haven't been merged yet.
+  std::deque<SpillStream*> spilled_runs_;
+
+  // Produces the output if the input did not fit in memory.
+  boost::scoped_ptr<RunMerger> merger_;
+
+  RuntimeProfile::Counter* sort_timer_;
+  RuntimeProfile::Counter* merge_timer_;
+  RuntimeProfile::Counter* runs_spilled_counter_;
+  RuntimeProfile::Counter* bytes_spilled_counter_;
+  RuntimeProfile::Counter* merge_passes_counter_;
+};
+
+}
+
+#endif
@@ -14,6 +14,7 @@
 
 #include "exec/topn-node.h"
 
+#include <algorithm>
 #include <sstream>
 
 #include "exprs/expr.h"
@@ -21,6 +22,7 @@
 #include "runtime/mem-pool.h"
 #include "runtime/raw-value.h"
 #include "runtime/row-batch.h"
+#include "runtime/string-value.h"
 #include "runtime/runtime-state.h"
 #include "runtime/tuple.h"
 #include "runtime/tuple-row.h"
@@ -33,11 +35,19 @@
 using namespace impala;
 using namespace std;
 
+// Rounds 'value' up to the next multiple of 'factor'.
+static inline int RoundUp(int value, int factor) {
+  return (value + factor - 1) / factor * factor;
+}
+
 TopNNode::TopNNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs) 
   : ExecNode(pool, tnode, descs),
-    tuple_row_less_than_(this),
-    priority_queue_(tuple_row_less_than_),
-    tuple_pool_(new MemPool) {
+    key_size_(0),
+    input_key_(NULL),
+    entry_less_than_(this),
+    priority_queue_(entry_less_than_),
+    tuple_pool_(new MemPool),
+    rows_evicted_counter_(NULL) {
   // TODO: log errors in runtime state
   Status status = Init(pool, tnode);
   DCHECK(status.ok()) << "TopNNode c'tor:Init failed: \n" << status.GetErrorMsg();
@@ -45,9 +55,7 @@ TopNNode::TopNNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl
 
 Status TopNNode::Init(ObjectPool* pool, const TPlanNode& tnode) {
   RETURN_IF_ERROR(
-      Expr::CreateExprTrees(pool, tnode.sort_node.ordering_exprs, &lhs_ordering_exprs_));
-  RETURN_IF_ERROR(
-      Expr::CreateExprTrees(pool, tnode.sort_node.ordering_exprs, &rhs_ordering_exprs_));
+      Expr::CreateExprTrees(pool, tnode.sort_node.ordering_exprs, &ordering_exprs_));
   is_asc_order_.insert(
       is_asc_order_.begin(), tnode.sort_node.is_asc_order.begin(),
       tnode.sort_node.is_asc_order.end());
@@ -56,44 +64,139 @@ Status TopNNode::Init(ObjectPool* pool, const TPlanNode& tnode) {
 }
 
 // The stl::priority_queue is a MAX heap.
-bool TopNNode::TupleRowLessThan::operator()(TupleRow* const& lhs, TupleRow* const& rhs)
-    const {
-  DCHECK(node_ != NULL);
-
-  vector<Expr*>::const_iterator lhs_expr_iter = node_->lhs_ordering_exprs_.begin();
-  vector<Expr*>::const_iterator rhs_expr_iter = node_->rhs_ordering_exprs_.begin();
-  vector<bool>::const_iterator is_asc_iter = node_->is_asc_order_.begin();
-
-  for (;lhs_expr_iter != node_->lhs_ordering_exprs_.end(); 
-      ++lhs_expr_iter,++rhs_expr_iter,++is_asc_iter) {
-    Expr* lhs_expr = *lhs_expr_iter;
-    Expr* rhs_expr = *rhs_expr_iter;
-    void *lhs_value = lhs_expr->GetValue(lhs);
-    void *rhs_value = rhs_expr->GetValue(rhs);
-    bool less_than = *is_asc_iter;
-
-    // NULL's always go at the end regardless of asc/desc
-    if (lhs_value == NULL && rhs_value == NULL) continue;
-    if (lhs_value == NULL && rhs_value != NULL) return false;
-    if (lhs_value != NULL && rhs_value == NULL) return true;
-
-    int result = RawValue::Compare(lhs_value, rhs_value, lhs_expr->type());
-    if (!less_than) {
-      result = -result;
+bool TopNNode::KeyLessThan(const uint8_t* lhs, const uint8_t* rhs) const {
+  int result = normalizer_.Compare(lhs, rhs);
+  if (result != 0 || normalizer_.is_exact()) return result < 0;
+  // The normalized keys only hold string prefixes and are otherwise exact, so the
+  // first difference between the rows, if any, is in one of the string values.
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    if (string_value_offsets_[i] == -1) continue;
+    const StringValue* lhs_value =
+        reinterpret_cast<const StringValue*>(lhs + string_value_offsets_[i]);
+    const StringValue* rhs_value =
+        reinterpret_cast<const StringValue*>(rhs + string_value_offsets_[i]);
+    result = lhs_value->Compare(*rhs_value);
+    if (!is_asc_order_[i]) result = -result;
+    if (result != 0) return result < 0;
+  }
+  // Equal keys: the priority queue requires a strict ordering.
+  return false;
+}
+
+void TopNNode::EvalKey(TupleRow* row, uint8_t* key) {
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    void* value = ordering_exprs_[i]->GetValue(row);
+    normalizer_.NormalizeValue(i, value, key);
+    if (string_value_offsets_[i] == -1) continue;
+    // NULLs are told apart by the normalized key
+    *reinterpret_cast<StringValue*>(key + string_value_offsets_[i]) =
+        value == NULL ? StringValue() : *reinterpret_cast<StringValue*>(value);
+  }
+}
+
+int TopNNode::GetVarLenSize(TupleRow* row, const uint8_t* key) {
+  int result = 0;
+  for (int i = 0; i < tuple_descs_.size(); ++i) {
+    Tuple* tuple = row->GetTuple(i);
+    if (tuple == NULL) continue;
+    const vector<SlotDescriptor*>& string_slots = tuple_descs_[i]->string_slots();
+    for (int j = 0; j < string_slots.size(); ++j) {
+      if (tuple->IsNull(string_slots[j]->null_indicator_offset())) continue;
+      result += tuple->GetStringSlot(string_slots[j]->tuple_offset())->len;
     }
-    if (result > 0) return false;
-    if (result < 0) return true;
-    // Otherwise, try the next Expr
   }
-  return true;
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    if (string_value_offsets_[i] == -1) continue;
+    result += reinterpret_cast<const StringValue*>(key + string_value_offsets_[i])->len;
+  }
+  return result;
+}
+
+void TopNNode::CopyToEntry(TupleRow* row, const uint8_t* key, Entry* entry) {
+  int var_len_size = GetVarLenSize(row, key);
+  if (var_len_size > entry->var_len_capacity) {
+    // Grow geometrically, so that the abandoned buffers of an entry never add up to
+    // more than its current one.
+    entry->var_len_capacity = max(var_len_size, 2 * entry->var_len_capacity);
+    entry->var_len_data =
+        reinterpret_cast<char*>(tuple_pool_->Allocate(entry->var_len_capacity));
+  }
+  char* var_len_data = entry->var_len_data;
+
+  for (int i = 0; i < tuple_descs_.size(); ++i) {
+    Tuple* src = row->GetTuple(i);
+    if (src == NULL) {
+      entry->row->SetTuple(i, NULL);
+      continue;
+    }
+    Tuple* dst = entry->tuples[i];
+    memcpy(dst, src, tuple_descs_[i]->byte_size());
+    const vector<SlotDescriptor*>& string_slots = tuple_descs_[i]->string_slots();
+    for (int j = 0; j < string_slots.size(); ++j) {
+      if (dst->IsNull(string_slots[j]->null_indicator_offset())) continue;
+      StringValue* value = dst->GetStringSlot(string_slots[j]->tuple_offset());
+      memcpy(var_len_data, value->ptr, value->len);
+      value->ptr = var_len_data;
+      var_len_data += value->len;
+    }
+    entry->row->SetTuple(i, dst);
+  }
+
+  memcpy(entry->key, key, key_size_);
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    if (string_value_offsets_[i] == -1) continue;
+    StringValue* value =
+        reinterpret_cast<StringValue*>(entry->key + string_value_offsets_[i]);
+    if (value->len == 0) continue;
+    memcpy(var_len_data, value->ptr, value->len);
+    value->ptr = var_len_data;
+    var_len_data += value->len;
+  }
+  DCHECK_LE(var_len_data - entry->var_len_data, entry->var_len_capacity);
+}
+
+TopNNode::Entry* TopNNode::AllocateEntry() {
+  int row_size = tuple_descs_.size() * sizeof(Tuple*);
+  Entry* entry = reinterpret_cast<Entry*>(tuple_pool_->Allocate(sizeof(Entry)));
+  entry->row = reinterpret_cast<TupleRow*>(tuple_pool_->Allocate(row_size));
+  entry->tuples = reinterpret_cast<Tuple**>(tuple_pool_->Allocate(row_size));
+  for (int i = 0; i < tuple_descs_.size(); ++i) {
+    entry->tuples[i] =
+        reinterpret_cast<Tuple*>(tuple_pool_->Allocate(tuple_descs_[i]->byte_size()));
+  }
+  entry->key = tuple_pool_->Allocate(key_size_);
+  entry->var_len_data = NULL;
+  entry->var_len_capacity = 0;
+  return entry;
 }
 
 Status TopNNode::Prepare(RuntimeState* state) {
   RETURN_IF_ERROR(ExecNode::Prepare(state));
+  tuple_pool_.reset(new MemPool(mem_tracker()));
+  rows_evicted_counter_ =
+      ADD_COUNTER(runtime_profile(), "RowsEvicted", TCounterType::UNIT);
   
   tuple_descs_ = child(0)->row_desc().tuple_descriptors();
-  Expr::Prepare(lhs_ordering_exprs_, state, child(0)->row_desc());
-  Expr::Prepare(rhs_ordering_exprs_, state, child(0)->row_desc());
+  Expr::Prepare(ordering_exprs_, state, child(0)->row_desc());
+
+  // NULLs go last regardless of asc/desc
+  vector<PrimitiveType> types;
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    types.push_back(ordering_exprs_[i]->type());
+  }
+  normalizer_.Init(types, is_asc_order_, false);
+  // the normalized key, followed by the string values, 8-byte aligned
+  int offset = RoundUp(normalizer_.key_size(), 8);
+  for (int i = 0; i < ordering_exprs_.size(); ++i) {
+    if (types[i] == TYPE_STRING) {
+      string_value_offsets_.push_back(offset);
+      offset += sizeof(StringValue);
+    } else {
+      string_value_offsets_.push_back(-1);
+    }
+  }
+  key_size_ = offset;
+  input_key_ = tuple_pool_->Allocate(key_size_);
   return Status::OK;
 }
 
@@ -102,10 +205,10 @@ Status TopNNode::Open(RuntimeState* state) {
   SCOPED_TIMER(runtime_profile_->total_time_counter());
   RETURN_IF_ERROR(child(0)->Open(state));
 
-  RowBatch batch(child(0)->row_desc(), state->batch_size());
+  RowBatch batch(child(0)->row_desc(), state->batch_size(child(0)->row_desc()));
   bool eos;
   do {
-    RETURN_IF_CANCELLED(state);
+    RETURN_IF_ERROR(state->CheckQueryState());
     batch.Reset();
     RETURN_IF_ERROR(child(0)->GetNext(state, &batch, &eos));
     for (int i = 0; i < batch.num_rows(); ++i) {
@@ -121,6 +224,7 @@ Status TopNNode::Open(RuntimeState* state) {
 Status TopNNode::GetNext(RuntimeState* state, RowBatch* row_batch, bool* eos) {
   RETURN_IF_CANCELLED(state);
   SCOPED_TIMER(runtime_profile_->total_time_counter());
+  SCOPED_HW_COUNTERS();
   while (!row_batch->IsFull() && (get_next_iter_ != sorted_top_n_.end())) {
     int row_idx = row_batch->AddRow();
     TupleRow* dst_row = row_batch->GetRow(row_idx);
@@ -142,28 +246,21 @@ Status TopNNode::Close(RuntimeState* state) {
 
 // Insert if either not at the limit or it's a new TopN tuple_row
 void TopNNode::InsertTupleRow(TupleRow* input_row) {
-  TupleRow* insert_tuple_row = NULL;
-  
+  if (limit_ == 0) return;
+  EvalKey(input_row, input_key_);
+  Entry* entry = NULL;
   if (priority_queue_.size() < limit_) {
-    insert_tuple_row = input_row->DeepCopy(tuple_descs_, tuple_pool_.get());
+    entry = AllocateEntry();
   } else {
-    TupleRow* top_tuple_row = priority_queue_.top();
-    if (tuple_row_less_than_(input_row, top_tuple_row)) {
-      for (int i = 0; i < tuple_descs_.size(); ++i) {
-        Tuple* dst_tuple = top_tuple_row->GetTuple(i);
-        Tuple* src_tuple = input_row->GetTuple(i);
-        // TODO: DeepCopy will allocate new buffers for the string data.  This needs
-        // to be fixed to use a freelist
-        src_tuple->DeepCopy(dst_tuple, *(tuple_descs_[i]), tuple_pool_.get());
-      }
-      insert_tuple_row = top_tuple_row;
-      priority_queue_.pop();
-    }
-  }
-
-  if (insert_tuple_row != NULL) {
-    priority_queue_.push(insert_tuple_row);
+    Entry* top_entry = priority_queue_.top();
+    if (!KeyLessThan(input_key_, top_entry->key)) return;
+    // reuse the evicted entry's memory for the new row
+    priority_queue_.pop();
+    COUNTER_UPDATE(rows_evicted_counter_, 1);
+    entry = top_entry;
   }
+  CopyToEntry(input_row, input_key_, entry);
+  priority_queue_.push(entry);
 }
 
 // Reverse the order of the tuples in the priority queue
@@ -172,9 +269,9 @@ void TopNNode::PrepareForOutput() {
   int index = sorted_top_n_.size() - 1;
 
   while (priority_queue_.size() > 0) {
-    TupleRow* tuple_row = priority_queue_.top();
+    Entry* entry = priority_queue_.top();
     priority_queue_.pop();
-    sorted_top_n_[index] = tuple_row;
+    sorted_top_n_[index] = entry->row;
     --index;
   }
 
@@ -184,7 +281,7 @@ void TopNNode::PrepareForOutput() {
 void TopNNode::DebugString(int indentation_level, stringstream* out) const {
   *out << string(indentation_level * 2, ' ');
   *out << "TopNNode("
-       << " ordering_exprs=" << Expr::DebugString(lhs_ordering_exprs_)
+       << " ordering_exprs=" << Expr::DebugString(ordering_exprs_)
        << " sort_order=[";
   for (int i = 0; i < is_asc_order_.size(); ++i) {
     *out << (i > 0 ? " " : "") << (is_asc_order_[i] ? "asc" : "desc");
@@ -21,6 +21,8 @@
 
 #include "exec/exec-node.h"
 #include "runtime/descriptors.h"  // for TupleId
+#include "runtime/sort-key-normalizer.h"
+#include "util/runtime-profile.h"
 
 namespace impala {
 
@@ -31,7 +33,14 @@ class Tuple;
 // Node for in-memory TopN (ORDER BY ... LIMIT)
 // This handles the case where the result fits in memory.  This node will do a deep
 // copy of the tuples that are necessary for the output.
-// This is implemented by storing rows in a priority queue.  
+// This is implemented by storing rows in a priority queue of at most 'limit' entries.
+// Each entry is allocated once and reused in place when its row gets evicted, and
+// it caches the row's sort key, normalized by a SortKeyNormalizer, so that the
+// ordering exprs are evaluated once per input row rather than once per comparison
+// and most comparisons are a single memcmp().  String
+// data of an entry lives in a buffer owned by the entry that only grows when a new
+// row doesn't fit into it, so the memory footprint is bounded by 'limit' times the
+// largest row (plus slack), independently of the number of input rows.
 class TopNNode : public ExecNode {
  public:
   TopNNode(ObjectPool* pool, const TPlanNode& tnode, const DescriptorTbl& descs);
@@ -47,20 +56,49 @@ class TopNNode : public ExecNode {
  private:
   Status Init(ObjectPool* pool, const TPlanNode& tnode);
 
-  class TupleRowLessThan {
+  // A priority queue entry.  'row' points to tuples of this entry (or NULL tuples),
+  // 'key' holds the sort key: the normalized key, followed by the (complete) string
+  // values of string ordering exprs, at string_value_offsets_.
+  struct Entry {
+    TupleRow* row;
+    Tuple** tuples;  // this entry's tuple storage, by tuple idx
+    uint8_t* key;
+    char* var_len_data;  // string data of 'row' and 'key'
+    int var_len_capacity;
+  };
+
+  // Orders entries by their sort key: strict less-than according to the ORDER BY
+  // clause, with NULLs last regardless of asc/desc.
+  class EntryLessThan {
    public:
-    TupleRowLessThan() : node_(NULL) {}
-    TupleRowLessThan(TopNNode* node) : node_(node) {}
-    bool operator()(TupleRow* const& lhs, TupleRow* const& rhs) const;
+    EntryLessThan() : node_(NULL) {}
+    EntryLessThan(TopNNode* node) : node_(node) {}
+    bool operator()(Entry* const& lhs, Entry* const& rhs) const {
+      return node_->KeyLessThan(lhs->key, rhs->key);
+    }
 
    private:
     TopNNode* node_;
   };
-    
-  friend class TupleLessThan;
 
-  // Inserts a tuple row into the priority queue if it's in the TopN.  Creates a deep 
-  // copy of tuple_row, which it stores in tuple_pool_.
+  // Returns true if sort key 'lhs' orders before sort key 'rhs'.
+  bool KeyLessThan(const uint8_t* lhs, const uint8_t* rhs) const;
+
+  // Evaluates the ordering exprs over 'row' into sort key 'key'. String values in
+  // 'key' point to the exprs' results.
+  void EvalKey(TupleRow* row, uint8_t* key);
+
+  // Returns the number of bytes of string data in 'row' and 'key'.
+  int GetVarLenSize(TupleRow* row, const uint8_t* key);
+
+  // Replaces the contents of 'entry' with a deep copy of 'row' and of its sort
+  // key 'key'.
+  void CopyToEntry(TupleRow* row, const uint8_t* key, Entry* entry);
+
+  // Allocates a new, empty entry from tuple_pool_.
+  Entry* AllocateEntry();
+
+  // Inserts a tuple row into the priority queue if it's in the TopN.
   void InsertTupleRow(TupleRow* tuple_row);
 
   // Flatten and reverse the priority queue.
@@ -68,27 +106,34 @@ class TopNNode : public ExecNode {
 
   std::vector<TupleDescriptor*> tuple_descs_;
   std::vector<bool> is_asc_order_;
+  std::vector<Expr*> ordering_exprs_;
+
+  SortKeyNormalizer normalizer_;
 
-  // Create two copies of the exprs for evaluating over the TupleRows.
-  // The result of the evaluation is stored in the Expr, so it's not efficient to use
-  // one set of Expr to compare TupleRows.
-  std::vector<Expr*> lhs_ordering_exprs_;
-  std::vector<Expr*> rhs_ordering_exprs_;
+  // layout of sort keys: for each ordering expr, the offset of its StringValue (-1
+  // for non-string exprs), and the total size
+  std::vector<int> string_value_offsets_;
+  int key_size_;
 
-  TupleRowLessThan tuple_row_less_than_;
+  // sort key of the input row that's being inserted
+  uint8_t* input_key_;
+
+  EntryLessThan entry_less_than_;
 
   // The priority queue will never have more elements in it than the LIMIT.  The stl 
   // priority queue doesn't support a max size, so to get that functionality, the order
   // of the queue is the opposite of what the ORDER BY clause specifies, such that the top 
   // of the queue is the last sorted element.
-  std::priority_queue<TupleRow*, std::vector<TupleRow*>, TupleRowLessThan> priority_queue_;
+  std::priority_queue<Entry*, std::vector<Entry*>, EntryLessThan> priority_queue_;
 
   // After computing the TopN in the priority_queue, pop them and put them in this vector
   std::vector<TupleRow*> sorted_top_n_;
   std::vector<TupleRow*>::iterator get_next_iter_;
     
-  // Stores everything referenced in priority_queue_
+  // Stores the entries and everything they reference
   boost::scoped_ptr<MemPool> tuple_pool_;
+
+  RuntimeProfile::Counter* rows_evicted_counter_;
 };
 
 };
@@ -20,6 +20,10 @@
 #include <boost/assign/list_of.hpp>
 #include <boost/unordered_map.hpp>
 
+#include "runtime/primitive-type.h"
+#include "runtime/raw-value.h"
+#include "runtime/timestamp-value.h"
+
 // This file contains common elements between the Trenvi Writer and Scanner.
 // Trevni defines the following data types used in the file format:
 //   Null, requires zero Bytes. Sometimes used in array columns.
@@ -72,6 +76,8 @@
 //   <block-uncompressed-size>
 //   <block-compressed-size>
 //   [ <first-value> ]
+//   [ <block-stats> ]
+//   [ <block-encoding> ]
 //
 // block-row-count ::= Fixed32
 // block-uncompressed-size ::= Fixed32
@@ -79,6 +85,19 @@
 //
 // first-value := -- First value in column in type of column
 //
+// -- Impala: present if the column metadata has trevni.stats.  The min and max
+// -- values are omitted if all values in the block are null.
+// block-stats ::=
+//   <block-null-count>
+//   [ <block-min-value> <block-max-value> ]
+//
+// block-null-count ::= Fixed32
+// block-min-value ::= -- Smallest non-null value in block in type of column
+// block-max-value ::= -- Largest non-null value in block in type of column
+//
+// -- Impala: present if the column metadata has trevni.encoding, see TrevniEncoding.
+// block-encoding ::= Fixed32
+//
 // block ::=
 //   <column-values>*
 //   [<definition-array>
@@ -89,6 +108,27 @@
 // repetition-array ::= IntegerArray
 // column-values ::= -- Serialized column values
 //
+// -- Impala: the column values of a block with block-encoding TREVNI_DICTIONARY
+// -- (string columns) or TREVNI_BIT_PACKED (int and long columns) are replaced by:
+// dictionary-values ::=
+//   <dictionary-count>
+//   <dictionary-entry>*
+//   <code-bit-size>
+//   <codes>
+//
+// bit-packed-values ::=
+//   <base-value>
+//   <code-bit-size>
+//   <codes>
+//
+// dictionary-count ::= Int
+// dictionary-entry ::= String
+// base-value ::= Long -- Smallest value in block
+// code-bit-size ::= Byte
+// -- For each non-null value, its index in the dictionary or the value minus
+// -- base-value.
+// codes ::= IntegerArray
+//
 // -- A collection of key-value pairs defining metadata values for the file.
 // -- Text key and value pairs.
 // metadata ::=
@@ -116,6 +156,8 @@ static const std::string TREVNI_ARRAY = "trevni.array";
 static const std::string TREVNI_PARENT = "trevni.parent";
 static const std::string TREVNI_REPETITION = "trevni.repetition";
 static const std::string TREVNI_DEFINITION = "trevni.definition";
+static const std::string TREVNI_STATS = "trevni.stats";
+static const std::string TREVNI_ENCODING = "trevni.encoding";
 
 // Types defined by Trevni.
 enum TrevniType {
@@ -183,7 +225,9 @@ enum ColumnMeta {
   COL_ARRAY,        // Trevni: is array
   COL_PARENT,       // Trevni: name of parent column, if any
   COL_REPETITION,     // Impala: Max repetition level, 0 if absent
-  COL_DEFINITION    // Impala: Max definition level, 0 if absent. > 0 implies nullable.
+  COL_DEFINITION,   // Impala: Max definition level, 0 if absent. > 0 implies nullable.
+  COL_STATS,        // Impala: Block descriptors have null count and min/max values.
+  COL_ENCODING      // Impala: Block descriptors have the block's TrevniEncoding.
 };
 
 static const std::map<const std::string, ColumnMeta> column_meta_map = boost::assign::map_list_of
@@ -194,7 +238,16 @@ static const std::map<const std::string, ColumnMeta> column_meta_map = boost::as
   (TREVNI_ARRAY, COL_ARRAY)
   (TREVNI_PARENT, COL_PARENT)
   (TREVNI_REPETITION, COL_REPETITION)
-  (TREVNI_DEFINITION, COL_DEFINITION);
+  (TREVNI_DEFINITION, COL_DEFINITION)
+  (TREVNI_STATS, COL_STATS)
+  (TREVNI_ENCODING, COL_ENCODING);
+
+// Encodings of the column values in a block, see block-encoding.
+enum TrevniEncoding {
+  TREVNI_PLAIN = 0,
+  TREVNI_DICTIONARY,
+  TREVNI_BIT_PACKED
+};
 
 // Map of recognized checksum names
 enum Checksum {
@@ -248,5 +301,65 @@ static const std::map<TrevniType, const std::string> type_map_string = boost::as
   (TREVNI_STRING, "string")
   (TREVNI_BYTES, "bytes");
 
+// Return the type in which block min/max values of a column of the given Trevni type
+// are held in memory, with the same representation as a slot of that type.
+// Returns INVALID_TYPE if no block statistics are kept for the type.
+// Floating point columns have none since NaN values have no order.
+inline PrimitiveType GetTrevniStatsType(TrevniType type) {
+  switch (type) {
+    case TREVNI_FIXED8:
+      return TYPE_TINYINT;
+    case TREVNI_FIXED16:
+      return TYPE_SMALLINT;
+    case TREVNI_INT:
+      return TYPE_INT;
+    case TREVNI_LONG:
+      return TYPE_BIGINT;
+    case TREVNI_TIMESTAMP:
+      return TYPE_TIMESTAMP;
+    default:
+      return INVALID_TYPE;
+  }
+}
+
+// Per-block value statistics, see block-stats above.
+struct TrevniBlockStats {
+  // A value of the column's stats type.
+  union Value {
+    int8_t tinyint_val;
+    int16_t smallint_val;
+    int32_t int_val;
+    int64_t bigint_val;
+    uint8_t timestamp_val[sizeof(TimestampValue)];
+  };
+
+  TrevniBlockStats() : null_count(0), has_min_max(false) {
+    memset(&min_value, 0, sizeof(min_value));
+    memset(&max_value, 0, sizeof(max_value));
+  }
+
+  // Add a non-null value of 'type' to the min and max.
+  void Update(const void* value, PrimitiveType type) {
+    if (!has_min_max) {
+      memcpy(&min_value, value, GetByteSize(type));
+      memcpy(&max_value, value, GetByteSize(type));
+      has_min_max = true;
+    } else if (RawValue::Compare(value, &min_value, type) < 0) {
+      memcpy(&min_value, value, GetByteSize(type));
+    } else if (RawValue::Compare(value, &max_value, type) > 0) {
+      memcpy(&max_value, value, GetByteSize(type));
+    }
+  }
+
+  // Number of null values in the block.
+  int32_t null_count;
+
+  // False if the block only has null values, min_value and max_value are not set.
+  bool has_min_max;
+
+  Value min_value;
+  Value max_value;
+};
+
 }
 #endif
@@ -0,0 +1,84 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "exec/tuple-row-comparator.h"
+
+#include "common/logging.h"
+#include "runtime/string-value.h"
+#include "runtime/timestamp-value.h"
+
+using namespace std;
+
+namespace impala {
+
+template <typename T>
+static int CompareValues(const void* v1, const void* v2) {
+  const T& t1 = *reinterpret_cast<const T*>(v1);
+  const T& t2 = *reinterpret_cast<const T*>(v2);
+  return t1 > t2 ? 1 : (t1 < t2 ? -1 : 0);
+}
+
+template <>
+int CompareValues<StringValue>(const void* v1, const void* v2) {
+  return reinterpret_cast<const StringValue*>(v1)->Compare(
+      *reinterpret_cast<const StringValue*>(v2));
+}
+
+TupleRowComparator::TupleRowComparator(const vector<Expr*>& lhs_exprs,
+    const vector<Expr*>& rhs_exprs, const vector<bool>& is_asc_order) {
+  DCHECK_EQ(lhs_exprs.size(), rhs_exprs.size());
+  DCHECK_EQ(lhs_exprs.size(), is_asc_order.size());
+  for (int i = 0; i < lhs_exprs.size(); ++i) {
+    Column col;
+    col.lhs_expr = lhs_exprs[i];
+    col.rhs_expr = rhs_exprs[i];
+    col.is_asc = is_asc_order[i];
+    switch (lhs_exprs[i]->type()) {
+      case TYPE_BOOLEAN:
+        col.compare_fn = CompareValues<bool>;
+        break;
+      case TYPE_TINYINT:
+        col.compare_fn = CompareValues<int8_t>;
+        break;
+      case TYPE_SMALLINT:
+        col.compare_fn = CompareValues<int16_t>;
+        break;
+      case TYPE_INT:
+        col.compare_fn = CompareValues<int32_t>;
+        break;
+      case TYPE_BIGINT:
+        col.compare_fn = CompareValues<int64_t>;
+        break;
+      case TYPE_FLOAT:
+        col.compare_fn = CompareValues<float>;
+        break;
+      case TYPE_DOUBLE:
+        col.compare_fn = CompareValues<double>;
+        break;
+      case TYPE_STRING:
+        col.compare_fn = CompareValues<StringValue>;
+        break;
+      case TYPE_TIMESTAMP:
+        col.compare_fn = CompareValues<TimestampValue>;
+        break;
+      default:
+        DCHECK(false) << "invalid type: " << TypeToString(lhs_exprs[i]->type());
+        col.compare_fn = CompareValues<bool>;
+    }
+    columns_.push_back(col);
+  }
+}
+
+}
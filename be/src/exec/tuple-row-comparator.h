@@ -0,0 +1,74 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXEC_TUPLE_ROW_COMPARATOR_H
+#define IMPALA_EXEC_TUPLE_ROW_COMPARATOR_H
+
+#include <vector>
+
+#include "exprs/expr.h"
+
+namespace impala {
+
+class TupleRow;
+
+// Strict weak ordering on TupleRows according to a list of ordering exprs and sort
+// directions, for the nodes that sort or merge rows.  NULLs go last regardless of
+// asc/desc.  The comparison function of each expr is picked by its type when the
+// comparator is created, so comparing two rows doesn't go through a switch on the
+// type of every value.
+// The exprs are evaluated twice per comparison, so the comparator takes two copies
+// of them, one for each side: the result of an evaluation is stored in the Expr.
+class TupleRowComparator {
+ public:
+  // 'lhs_exprs' and 'rhs_exprs' must be prepared; they must outlive the comparator.
+  TupleRowComparator(const std::vector<Expr*>& lhs_exprs,
+      const std::vector<Expr*>& rhs_exprs, const std::vector<bool>& is_asc_order);
+
+  // Returns true if 'lhs' orders before 'rhs'.
+  bool Less(TupleRow* lhs, TupleRow* rhs) const {
+    for (int i = 0; i < columns_.size(); ++i) {
+      const Column& col = columns_[i];
+      void* lhs_value = col.lhs_expr->GetValue(lhs);
+      void* rhs_value = col.rhs_expr->GetValue(rhs);
+      if (lhs_value == NULL || rhs_value == NULL) {
+        if (lhs_value == rhs_value) continue;
+        return rhs_value == NULL;
+      }
+      int result = col.compare_fn(lhs_value, rhs_value);
+      if (result != 0) return col.is_asc ? result < 0 : result > 0;
+    }
+    // Equal rows: sorting requires a strict ordering.
+    return false;
+  }
+
+ private:
+  // Returns <0, 0 or >0 if the first value is less than, equal to or greater than the
+  // second one.
+  typedef int (*CompareFn)(const void*, const void*);
+
+  struct Column {
+    Expr* lhs_expr;
+    Expr* rhs_expr;
+    CompareFn compare_fn;
+    bool is_asc;
+  };
+
+  std::vector<Column> columns_;
+};
+
+}
+
+#endif
@@ -16,6 +16,7 @@
 #include <stdio.h>
 #include <iostream>
 #include <limits.h>
+#include <vector>
 #include <gtest/gtest.h>
 #include "exec/read-write-util.h"
 #include "util/cpu-info.h"
@@ -73,6 +74,34 @@ TEST(ZigzagTest, Basic) {
   }
 
 }
+
+// Test skipping runs of zigzag longs of mixed lengths.
+TEST(ZigzagTest, SkipZLongs) {
+  vector<uint8_t> buf;
+  vector<int> ends;
+  int64_t value = 0x5a5a5a5a;
+  for (int i = 0; i < 1000; ++i) {
+    value = HashUtil::CrcHash(&value, sizeof(value), i);
+    // Mostly small values, as for lengths, with some of every other size.
+    int64_t v = (i % 4 == 0) ? value >> (value & 63) : value % 64;
+    uint8_t zlong[ReadWriteUtil::MAX_ZLONG_LEN];
+    int len = ReadWriteUtil::PutZLong(v, zlong);
+    buf.insert(buf.end(), zlong, zlong + len);
+    ends.push_back(buf.size());
+  }
+  for (int start = 0; start < 10; ++start) {
+    int start_byte = start == 0 ? 0 : ends[start - 1];
+    for (int n = 0; n + start <= ends.size(); n += 7) {
+      int expected = (n == 0 ? start_byte : ends[start + n - 1]) - start_byte;
+      EXPECT_EQ(expected, ReadWriteUtil::SkipZLongs(
+          &buf[start_byte], buf.size() - start_byte, n));
+    }
+    // Asking for more values than there are fails.
+    EXPECT_EQ(-1, ReadWriteUtil::SkipZLongs(
+        &buf[start_byte], buf.size() - start_byte, ends.size() - start + 1));
+  }
+}
+
 }
 
 int main(int argc, char **argv) {
@@ -16,6 +16,7 @@
 
 #include "codegen/llvm-codegen.h"
 #include "exprs/arithmetic-expr.h"
+#include "runtime/row-batch.h"
 #include "util/debug-util.h"
 #include "gen-cpp/Exprs_types.h"
 
@@ -39,6 +40,198 @@ string ArithmeticExpr::DebugString() const {
   return out.str();
 }
 
+// The arithmetic operators, for values of type T.  Results are truncated to T, as
+// they are in the generated row-at-a-time compute functions.
+struct AddOp {
+  template <typename T> static T Apply(T a, T b) { return a + b; }
+};
+struct SubtractOp {
+  template <typename T> static T Apply(T a, T b) { return a - b; }
+};
+struct MultiplyOp {
+  template <typename T> static T Apply(T a, T b) { return a * b; }
+};
+struct DivideOp {
+  template <typename T> static T Apply(T a, T b) { return a / b; }
+};
+struct ModOp {
+  template <typename T> static T Apply(T a, T b) { return a % b; }
+};
+struct BitAndOp {
+  template <typename T> static T Apply(T a, T b) { return a & b; }
+};
+struct BitOrOp {
+  template <typename T> static T Apply(T a, T b) { return a | b; }
+};
+struct BitXorOp {
+  template <typename T> static T Apply(T a, T b) { return a ^ b; }
+};
+struct BitNotOp {
+  template <typename T> static T Apply(T a, T) { return ~a; }
+};
+
+// The loops below compute the operator for every position, NULL or not, so that they
+// don't branch; null indicators are combined in a separate pass.
+template <typename T, typename OP>
+struct BinaryLoop {
+  static void Run(int n, ExprColumn* lhs, ExprColumn* rhs, ExprColumn* result) {
+    const T* a = lhs->values<T>();
+    const T* b = rhs->values<T>();
+    T* out = result->values<T>();
+    for (int i = 0; i < n; ++i) {
+      out[i] = OP::Apply(a[i], b[i]);
+    }
+    const uint8_t* a_null = lhs->is_null();
+    const uint8_t* b_null = rhs->is_null();
+    uint8_t* out_null = result->is_null();
+    for (int i = 0; i < n; ++i) {
+      out_null[i] = a_null[i] | b_null[i];
+    }
+  }
+};
+
+// Integer division by 0 traps, which must not happen for positions that are NULL;
+// those divide by 1 instead.  Non-NULL divisions by 0 return NULL.
+template <typename T, typename OP>
+struct CheckedDivideLoop {
+  static void Run(int n, ExprColumn* lhs, ExprColumn* rhs, ExprColumn* result) {
+    const T* a = lhs->values<T>();
+    const T* b = rhs->values<T>();
+    T* out = result->values<T>();
+    const uint8_t* a_null = lhs->is_null();
+    const uint8_t* b_null = rhs->is_null();
+    uint8_t* out_null = result->is_null();
+    for (int i = 0; i < n; ++i) {
+      uint8_t div_by_zero = b[i] == 0;
+      out[i] = OP::Apply(a[i], div_by_zero ? static_cast<T>(1) : b[i]);
+      out_null[i] = a_null[i] | b_null[i] | div_by_zero;
+    }
+  }
+};
+
+template <typename T, typename OP>
+struct UnaryLoop {
+  static void Run(int n, ExprColumn* child, ExprColumn*, ExprColumn* result) {
+    const T* a = child->values<T>();
+    T* out = result->values<T>();
+    for (int i = 0; i < n; ++i) {
+      out[i] = OP::Apply(a[i], a[i]);
+    }
+    memcpy(result->is_null(), child->is_null(), n);
+  }
+};
+
+// Runs LOOP<T, OP> for the C++ type T of 'type'.
+template <template <typename, typename> class LOOP, typename OP>
+static void DispatchIntegral(PrimitiveType type, int n, ExprColumn* lhs,
+    ExprColumn* rhs, ExprColumn* result) {
+  switch (type) {
+    case TYPE_TINYINT:
+      LOOP<int8_t, OP>::Run(n, lhs, rhs, result);
+      break;
+    case TYPE_SMALLINT:
+      LOOP<int16_t, OP>::Run(n, lhs, rhs, result);
+      break;
+    case TYPE_INT:
+      LOOP<int32_t, OP>::Run(n, lhs, rhs, result);
+      break;
+    case TYPE_BIGINT:
+      LOOP<int64_t, OP>::Run(n, lhs, rhs, result);
+      break;
+    default:
+      DCHECK(false) << "bad integer type: " << TypeToString(type);
+  }
+}
+
+template <template <typename, typename> class LOOP, typename OP>
+static void DispatchNumeric(PrimitiveType type, int n, ExprColumn* lhs,
+    ExprColumn* rhs, ExprColumn* result) {
+  switch (type) {
+    case TYPE_FLOAT:
+      LOOP<float, OP>::Run(n, lhs, rhs, result);
+      break;
+    case TYPE_DOUBLE:
+      LOOP<double, OP>::Run(n, lhs, rhs, result);
+      break;
+    default:
+      DispatchIntegral<LOOP, OP>(type, n, lhs, rhs, result);
+  }
+}
+
+void ArithmeticExpr::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  // the operands are of the result type
+  for (int i = 0; i < GetNumChildren(); ++i) {
+    DCHECK_EQ(children_[i]->type(), type_);
+  }
+  GetChildValues(batch, sel, num_rows);
+  ExprColumn* lhs = &child_results_[0];
+  ExprColumn* rhs = GetNumChildren() == 2 ? &child_results_[1] : NULL;
+  switch (op()) {
+    case TExprOpcode::ADD_LONG_LONG:
+    case TExprOpcode::ADD_DOUBLE_DOUBLE:
+      DispatchNumeric<BinaryLoop, AddOp>(type_, num_rows, lhs, rhs, result);
+      break;
+    case TExprOpcode::SUBTRACT_LONG_LONG:
+    case TExprOpcode::SUBTRACT_DOUBLE_DOUBLE:
+      DispatchNumeric<BinaryLoop, SubtractOp>(type_, num_rows, lhs, rhs, result);
+      break;
+    case TExprOpcode::MULTIPLY_LONG_LONG:
+    case TExprOpcode::MULTIPLY_DOUBLE_DOUBLE:
+      DispatchNumeric<BinaryLoop, MultiplyOp>(type_, num_rows, lhs, rhs, result);
+      break;
+    case TExprOpcode::DIVIDE:
+      DispatchNumeric<BinaryLoop, DivideOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::INT_DIVIDE_CHAR_CHAR:
+    case TExprOpcode::INT_DIVIDE_SHORT_SHORT:
+    case TExprOpcode::INT_DIVIDE_INT_INT:
+    case TExprOpcode::INT_DIVIDE_LONG_LONG:
+      DispatchIntegral<CheckedDivideLoop, DivideOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::MOD_CHAR_CHAR:
+    case TExprOpcode::MOD_SHORT_SHORT:
+    case TExprOpcode::MOD_INT_INT:
+    case TExprOpcode::MOD_LONG_LONG:
+      DispatchIntegral<CheckedDivideLoop, ModOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::BITAND_CHAR_CHAR:
+    case TExprOpcode::BITAND_SHORT_SHORT:
+    case TExprOpcode::BITAND_INT_INT:
+    case TExprOpcode::BITAND_LONG_LONG:
+      DispatchIntegral<BinaryLoop, BitAndOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::BITOR_CHAR_CHAR:
+    case TExprOpcode::BITOR_SHORT_SHORT:
+    case TExprOpcode::BITOR_INT_INT:
+    case TExprOpcode::BITOR_LONG_LONG:
+      DispatchIntegral<BinaryLoop, BitOrOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::BITXOR_CHAR_CHAR:
+    case TExprOpcode::BITXOR_SHORT_SHORT:
+    case TExprOpcode::BITXOR_INT_INT:
+    case TExprOpcode::BITXOR_LONG_LONG:
+      DispatchIntegral<BinaryLoop, BitXorOp>(type_, num_rows, lhs, rhs, result);
+      break;
+
+    case TExprOpcode::BITNOT_CHAR:
+    case TExprOpcode::BITNOT_SHORT:
+    case TExprOpcode::BITNOT_INT:
+    case TExprOpcode::BITNOT_LONG:
+      DispatchIntegral<UnaryLoop, BitNotOp>(type_, num_rows, lhs, NULL, result);
+      break;
+
+    default:
+      // evaluates the children again, one row at a time
+      Expr::EvalBatch(batch, sel, num_rows, result);
+  }
+}
+
 // IR generator for ArithmeticExpr.  For ADD_LONG_LONG, the IR looks like:
 //
 // define i64 @ArithmeticExpr(i8** %row, i8* %state_data, i1* %is_null) {
@@ -35,6 +35,9 @@ class ArithmeticExpr: public Expr {
   ArithmeticExpr(const TExprNode& node);
 
   virtual std::string DebugString() const;
+
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
 };
 
 }
@@ -16,6 +16,7 @@
 
 #include "codegen/llvm-codegen.h"
 #include "exprs/binary-predicate.h"
+#include "runtime/row-batch.h"
 #include "util/debug-util.h"
 #include "gen-cpp/Exprs_types.h"
 
@@ -39,6 +40,187 @@ string BinaryPredicate::DebugString() const {
   return out.str();
 }
 
+// The comparison operators, for values of type T.  StringValue only has named
+// comparison functions.
+struct EqOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a == b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Eq(b); }
+};
+struct NeOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a != b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Ne(b); }
+};
+struct LtOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a < b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Lt(b); }
+};
+struct LeOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a <= b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Le(b); }
+};
+struct GtOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a > b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Gt(b); }
+};
+struct GeOp {
+  template <typename T> static bool Apply(const T& a, const T& b) { return a >= b; }
+  static bool Apply(const StringValue& a, const StringValue& b) { return a.Ge(b); }
+};
+
+// Compares all positions, NULL or not (NULL values are initialized), and combines
+// the null indicators in a separate pass.
+template <typename T, typename OP>
+static void CompareLoop(int n, ExprColumn* lhs, ExprColumn* rhs, ExprColumn* result) {
+  const T* a = lhs->values<T>();
+  const T* b = rhs->values<T>();
+  bool* out = result->values<bool>();
+  for (int i = 0; i < n; ++i) {
+    out[i] = OP::Apply(a[i], b[i]);
+  }
+  const uint8_t* a_null = lhs->is_null();
+  const uint8_t* b_null = rhs->is_null();
+  uint8_t* out_null = result->is_null();
+  for (int i = 0; i < n; ++i) {
+    out_null[i] = a_null[i] | b_null[i];
+  }
+}
+
+// Runs CompareLoop<T, OP> for the C++ type T of 'type'.
+template <typename OP>
+static void DispatchCompare(PrimitiveType type, int n, ExprColumn* lhs,
+    ExprColumn* rhs, ExprColumn* result) {
+  switch (type) {
+    case TYPE_BOOLEAN:
+      CompareLoop<bool, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_TINYINT:
+      CompareLoop<int8_t, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_SMALLINT:
+      CompareLoop<int16_t, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_INT:
+      CompareLoop<int32_t, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_BIGINT:
+      CompareLoop<int64_t, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_FLOAT:
+      CompareLoop<float, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_DOUBLE:
+      CompareLoop<double, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_STRING:
+      CompareLoop<StringValue, OP>(n, lhs, rhs, result);
+      break;
+    case TYPE_TIMESTAMP:
+      CompareLoop<TimestampValue, OP>(n, lhs, rhs, result);
+      break;
+    default:
+      DCHECK(false) << "bad comparison type: " << TypeToString(type);
+  }
+}
+
+void BinaryPredicate::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  DCHECK_EQ(children_[0]->type(), children_[1]->type());
+  GetChildValues(batch, sel, num_rows);
+  ExprColumn* lhs = &child_results_[0];
+  ExprColumn* rhs = &child_results_[1];
+  PrimitiveType type = children_[0]->type();
+  switch (compare_op()) {
+    case EQ:
+      DispatchCompare<EqOp>(type, num_rows, lhs, rhs, result);
+      break;
+    case NE:
+      DispatchCompare<NeOp>(type, num_rows, lhs, rhs, result);
+      break;
+    case LT:
+      DispatchCompare<LtOp>(type, num_rows, lhs, rhs, result);
+      break;
+    case LE:
+      DispatchCompare<LeOp>(type, num_rows, lhs, rhs, result);
+      break;
+    case GT:
+      DispatchCompare<GtOp>(type, num_rows, lhs, rhs, result);
+      break;
+    case GE:
+      DispatchCompare<GeOp>(type, num_rows, lhs, rhs, result);
+      break;
+    default:
+      // evaluates the children again, one row at a time
+      Expr::EvalBatch(batch, sel, num_rows, result);
+  }
+}
+
+BinaryPredicate::CompareOp BinaryPredicate::compare_op() const {
+  switch (op()) {
+    case TExprOpcode::EQ_BOOL_BOOL:
+    case TExprOpcode::EQ_CHAR_CHAR:
+    case TExprOpcode::EQ_SHORT_SHORT:
+    case TExprOpcode::EQ_INT_INT:
+    case TExprOpcode::EQ_LONG_LONG:
+    case TExprOpcode::EQ_FLOAT_FLOAT:
+    case TExprOpcode::EQ_DOUBLE_DOUBLE:
+    case TExprOpcode::EQ_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::EQ_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return EQ;
+    case TExprOpcode::NE_BOOL_BOOL:
+    case TExprOpcode::NE_CHAR_CHAR:
+    case TExprOpcode::NE_SHORT_SHORT:
+    case TExprOpcode::NE_INT_INT:
+    case TExprOpcode::NE_LONG_LONG:
+    case TExprOpcode::NE_FLOAT_FLOAT:
+    case TExprOpcode::NE_DOUBLE_DOUBLE:
+    case TExprOpcode::NE_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::NE_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return NE;
+    case TExprOpcode::LT_BOOL_BOOL:
+    case TExprOpcode::LT_CHAR_CHAR:
+    case TExprOpcode::LT_SHORT_SHORT:
+    case TExprOpcode::LT_INT_INT:
+    case TExprOpcode::LT_LONG_LONG:
+    case TExprOpcode::LT_FLOAT_FLOAT:
+    case TExprOpcode::LT_DOUBLE_DOUBLE:
+    case TExprOpcode::LT_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::LT_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return LT;
+    case TExprOpcode::LE_BOOL_BOOL:
+    case TExprOpcode::LE_CHAR_CHAR:
+    case TExprOpcode::LE_SHORT_SHORT:
+    case TExprOpcode::LE_INT_INT:
+    case TExprOpcode::LE_LONG_LONG:
+    case TExprOpcode::LE_FLOAT_FLOAT:
+    case TExprOpcode::LE_DOUBLE_DOUBLE:
+    case TExprOpcode::LE_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::LE_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return LE;
+    case TExprOpcode::GT_BOOL_BOOL:
+    case TExprOpcode::GT_CHAR_CHAR:
+    case TExprOpcode::GT_SHORT_SHORT:
+    case TExprOpcode::GT_INT_INT:
+    case TExprOpcode::GT_LONG_LONG:
+    case TExprOpcode::GT_FLOAT_FLOAT:
+    case TExprOpcode::GT_DOUBLE_DOUBLE:
+    case TExprOpcode::GT_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::GT_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return GT;
+    case TExprOpcode::GE_BOOL_BOOL:
+    case TExprOpcode::GE_CHAR_CHAR:
+    case TExprOpcode::GE_SHORT_SHORT:
+    case TExprOpcode::GE_INT_INT:
+    case TExprOpcode::GE_LONG_LONG:
+    case TExprOpcode::GE_FLOAT_FLOAT:
+    case TExprOpcode::GE_DOUBLE_DOUBLE:
+    case TExprOpcode::GE_STRINGVALUE_STRINGVALUE:
+    case TExprOpcode::GE_TIMESTAMPVALUE_TIMESTAMPVALUE:
+      return GE;
+    default:
+      return INVALID_OP;
+  }
+}
+
 // IR codegen for binary predicates.  For integer less than, the IR looks like:
 //
 // define i1 @BinaryPredicate(i8** %row, i8* %state_data, i1* %is_null) {
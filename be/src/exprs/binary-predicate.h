@@ -25,7 +25,13 @@ namespace impala {
 
 class BinaryPredicate : public Predicate {
  public:
+  // The comparison done by a binary predicate, independent of the operand type.
+  enum CompareOp { EQ, NE, LT, LE, GT, GE, INVALID_OP };
+
   virtual llvm::Function* Codegen(LlvmCodeGen* code_gen);
+
+  // Returns the comparison done by op(), or INVALID_OP if op() is not a comparison.
+  CompareOp compare_op() const;
  
  protected:
   friend class Expr;
@@ -34,6 +40,9 @@ class BinaryPredicate : public Predicate {
 
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& desc);
   virtual std::string DebugString() const;
+
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
 };
 
 }
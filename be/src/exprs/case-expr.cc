@@ -12,19 +12,58 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <limits>
+#include <sstream>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
+
 #include "exprs/case-expr.h"
+#include "codegen/llvm-codegen.h"
 #include "exprs/conditional-functions.h"
+#include "runtime/raw-value.h"
+#include "runtime/string-value.inline.h"
 
 #include "gen-cpp/Exprs_types.h"
 
+using namespace llvm;
 using namespace std;
 
 namespace impala {
 
+static bool IsIntType(PrimitiveType type) {
+  return type == TYPE_TINYINT || type == TYPE_SMALLINT || type == TYPE_INT
+      || type == TYPE_BIGINT;
+}
+
+// Returns 'value' of integer type 'type'.
+static int64_t GetIntValue(const void* value, PrimitiveType type) {
+  switch (type) {
+    case TYPE_TINYINT:
+      return *reinterpret_cast<const int8_t*>(value);
+    case TYPE_SMALLINT:
+      return *reinterpret_cast<const int16_t*>(value);
+    case TYPE_INT:
+      return *reinterpret_cast<const int32_t*>(value);
+    case TYPE_BIGINT:
+      return *reinterpret_cast<const int64_t*>(value);
+    default:
+      DCHECK(false) << "not an integer type: " << TypeToString(type);
+      return 0;
+  }
+}
+
+size_t CaseExpr::ValueHash::operator()(const void* value) const {
+  return RawValue::GetHashValue(value, type);
+}
+
+bool CaseExpr::ValueEq::operator()(const void* v1, const void* v2) const {
+  return RawValue::Eq(v1, v2, type);
+}
+
 CaseExpr::CaseExpr(const TExprNode& node)
   : Expr(node),
     has_case_expr_(node.case_expr.has_case_expr),
-    has_else_expr_(node.case_expr.has_else_expr) {
+    has_else_expr_(node.case_expr.has_else_expr),
+    then_table_min_(0) {
 }
 
 Status CaseExpr::Prepare(RuntimeState* state, const RowDescriptor& row_desc) {
@@ -33,10 +72,327 @@ Status CaseExpr::Prepare(RuntimeState* state, const RowDescriptor& row_desc) {
   // Otherwise keep the one provided by the OpCodeRegistry set in the parent's c'tor.
   if (!has_case_expr_) {
     compute_fn_ = ConditionalFunctions::NoCaseComputeFn;
+    return Status::OK;
+  }
+
+  int loop_end = has_else_expr_ ? GetNumChildren() - 1 : GetNumChildren();
+  int num_values = (loop_end - 1) / 2;
+  if (num_values < MIN_LOOKUP_SIZE) return Status::OK;
+  for (int i = 1; i < loop_end; i += 2) {
+    if (!GetChild(i)->IsConstant()) return Status::OK;
   }
+  PrimitiveType type = GetChild(0)->type();
+  then_map_.reset(new ThenMap(num_values, ValueHash(type), ValueEq(type)));
+  bool is_int = IsIntType(type);
+  int64_t min_value = numeric_limits<int64_t>::max();
+  int64_t max_value = numeric_limits<int64_t>::min();
+  for (int i = 1; i < loop_end; i += 2) {
+    DCHECK_EQ(type, GetChild(i)->type());
+    void* value = GetChild(i)->GetValue(NULL);
+    // A null when value doesn't match anything.
+    if (value == NULL) continue;
+    // Only the first when clause of a value can be taken; insert() keeps it.
+    then_map_->insert(make_pair(value, i + 1));
+    if (!is_int) continue;
+    min_value = min(min_value, GetIntValue(value, type));
+    max_value = max(max_value, GetIntValue(value, type));
+  }
+  if (is_int && !then_map_->empty()) {
+    // The difference of the values may overflow an int64_t, not a uint64_t.
+    uint64_t span = static_cast<uint64_t>(max_value) - static_cast<uint64_t>(min_value);
+    if (span < MAX_TABLE_DENSITY * then_map_->size()) {
+      then_table_.assign(span + 1, -1);
+      then_table_min_ = min_value;
+      for (ThenMap::iterator it = then_map_->begin(); it != then_map_->end(); ++it) {
+        uint64_t offset = static_cast<uint64_t>(GetIntValue(it->first, type))
+            - static_cast<uint64_t>(min_value);
+        then_table_[offset] = it->second;
+      }
+    }
+  }
+  compute_fn_ = LookupComputeFn;
   return Status::OK;
 }
 
+void* CaseExpr::LookupComputeFn(Expr* e, TupleRow* row) {
+  CaseExpr* expr = static_cast<CaseExpr*>(e);
+  void* case_val = e->children()[0]->GetValue(row);
+  // A null case value doesn't match any when value.
+  int then_idx = case_val == NULL ? -1 : FindThenExpr(expr, case_val);
+  if (then_idx >= 0) return e->children()[then_idx]->GetValue(row);
+  if (expr->has_else_expr_) return e->children()[e->GetNumChildren() - 1]->GetValue(row);
+  return NULL;
+}
+
+int CaseExpr::FindThenExpr(const CaseExpr* e, const void* value) {
+  DCHECK(e->then_map_.get() != NULL);
+  if (!e->then_table_.empty()) {
+    int64_t int_value = GetIntValue(value, e->children()[0]->type());
+    uint64_t offset =
+        static_cast<uint64_t>(int_value) - static_cast<uint64_t>(e->then_table_min_);
+    return offset < e->then_table_.size() ? e->then_table_[offset] : -1;
+  }
+  ThenMap::const_iterator it = e->then_map_->find(value);
+  return it != e->then_map_->end() ? it->second : -1;
+}
+
+// IR generation for case exprs.  Each when expr is evaluated in its own block and
+// branches to its then block or to the next when block.  The result of the taken
+// then (or else) expr is returned as is, it has already set is_null.
+// For "case when a > 1 then 10 else 20 end", the IR looks like:
+//
+// define i32 @CaseExpr(i8** %row, i8* %state_data, i1* %is_null) {
+// entry:
+//   br label %when0
+//
+// when0:                                            ; preds = %entry
+//   %child_result = call i1 @BinaryPredicate(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_null = load i1* %is_null
+//   br i1 %child_null, label %else, label %when_not_null0
+//
+// when_not_null0:                                   ; preds = %when0
+//   br i1 %child_result, label %then0, label %else
+//
+// then0:                                            ; preds = %when_not_null0
+//   %then_val = call i32 @IntLiteral(i8** %row, i8* %state_data, i1* %is_null)
+//   br label %ret_block
+//
+// else:                                             ; preds = %when_not_null0, %when0
+//   %else_val = call i32 @IntLiteral1(i8** %row, i8* %state_data, i1* %is_null)
+//   br label %ret_block
+//
+// ret_block:                                        ; preds = %else, %then0
+//   %tmp_phi = phi i32 [ %then_val, %then0 ], [ %else_val, %else ]
+//   ret i32 %tmp_phi
+// }
+Function* CaseExpr::Codegen(LlvmCodeGen* codegen) {
+  if (then_map_.get() != NULL) return CodegenLookup(codegen);
+  int num_children = GetNumChildren();
+  for (int i = 0; i < num_children; ++i) {
+    if (children()[i]->Codegen(codegen) == NULL) return NULL;
+  }
+  int first_when = has_case_expr_ ? 1 : 0;
+  int loop_end = has_else_expr_ ? num_children - 1 : num_children;
+  DCHECK_GE(loop_end - first_when, 2);
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Type* return_type = GetLlvmReturnType(codegen);
+  Function* function = CreateComputeFnPrototype(codegen, "CaseExpr");
+  Function::arg_iterator fn_args = function->arg_begin();
+  Value* args[3] = { fn_args++, fn_args++, fn_args };
+
+  BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  BasicBlock* else_block = BasicBlock::Create(context, "else", function);
+  BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
+  PHINode* phi_node =
+      PHINode::Create(return_type, loop_end / 2 + 1, "tmp_phi", ret_block);
+
+  // Evaluate the case expr.  If it is null, no when expr can match.
+  BasicBlock* when_block = BasicBlock::Create(context, "when0", function, else_block);
+  Value* case_val = NULL;
+  if (has_case_expr_) {
+    case_val = children()[0]->CodegenGetValue(codegen, entry_block,
+        else_block, when_block);
+  } else {
+    builder.SetInsertPoint(entry_block);
+    builder.CreateBr(when_block);
+  }
+
+  for (int i = first_when; i < loop_end; i += 2) {
+    stringstream suffix;
+    suffix << (i - first_when) / 2;
+    BasicBlock* when_not_null_block = BasicBlock::Create(context,
+        "when_not_null" + suffix.str(), function, else_block);
+    BasicBlock* then_block = BasicBlock::Create(context, "then" + suffix.str(),
+        function, else_block);
+    BasicBlock* next_block = else_block;
+    if (i + 2 < loop_end) {
+      stringstream next_suffix;
+      next_suffix << (i - first_when) / 2 + 1;
+      next_block = BasicBlock::Create(context, "when" + next_suffix.str(),
+          function, else_block);
+    }
+
+    // A null when value does not match.
+    Value* when_val = children()[i]->CodegenGetValue(codegen, when_block,
+        next_block, when_not_null_block);
+    builder.SetInsertPoint(when_not_null_block);
+    Value* matched = when_val;
+    if (has_case_expr_) {
+      matched = codegen->CodegenEquals(&builder, case_val, when_val,
+          children()[0]->type());
+    }
+    builder.CreateCondBr(matched, then_block, next_block);
+
+    builder.SetInsertPoint(then_block);
+    Value* then_val = builder.CreateCall3(children()[i + 1]->codegen_fn(),
+        args[0], args[1], args[2], "then_val");
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(then_val, then_block);
+
+    when_block = next_block;
+  }
+
+  builder.SetInsertPoint(else_block);
+  if (has_else_expr_) {
+    Value* else_val = builder.CreateCall3(children()[num_children - 1]->codegen_fn(),
+        args[0], args[1], args[2], "else_val");
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(else_val, else_block);
+  } else {
+    CodegenSetIsNullArg(codegen, else_block, true);
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(GetNullReturnValue(codegen), else_block);
+  }
+
+  builder.SetInsertPoint(ret_block);
+  builder.CreateRet(phi_node);
+
+  return codegen->FinalizeFunction(function);
+}
+
+// IR generation for case exprs that look up then_map_.  Integer case values are the
+// condition of a switch with a case for each when value, which llvm lowers to a jump
+// table or a binary search.  Other values are passed to FindThenExpr() by pointer and
+// its result, the index of the then expr, is switched on.
+// For "case a when 1 then 10 when 2 then 20 ... else 0 end", the IR looks like:
+//
+// define i32 @CaseExpr(i8** %row, i8* %state_data, i1* %is_null) {
+// entry:
+//   %child_result = call i32 @SlotRef(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_null = load i1* %is_null
+//   br i1 %child_null, label %else, label %lookup
+//
+// lookup:                                           ; preds = %entry
+//   switch i32 %child_result, label %else [
+//     i32 1, label %then0
+//     i32 2, label %then1
+//     ...
+//   ]
+//
+// then0:                                            ; preds = %lookup
+//   %then_val = call i32 @IntLiteral(i8** %row, i8* %state_data, i1* %is_null)
+//   br label %ret_block
+// ...
+//
+// else:                                             ; preds = %lookup, %entry
+//   %else_val = call i32 @IntLiteral8(i8** %row, i8* %state_data, i1* %is_null)
+//   br label %ret_block
+//
+// ret_block:                                        ; preds = %else, %then1, %then0
+//   %tmp_phi = phi i32 [ %then_val, %then0 ], [ %then_val1, %then1 ], ...
+//   ret i32 %tmp_phi
+// }
+Function* CaseExpr::CodegenLookup(LlvmCodeGen* codegen) {
+  int num_children = GetNumChildren();
+  int loop_end = has_else_expr_ ? num_children - 1 : num_children;
+  // The when exprs aren't evaluated.
+  if (children()[0]->Codegen(codegen) == NULL) return NULL;
+  for (int i = 2; i < num_children; i += 2) {
+    if (children()[i]->Codegen(codegen) == NULL) return NULL;
+  }
+  if (has_else_expr_ && children()[num_children - 1]->Codegen(codegen) == NULL) {
+    return NULL;
+  }
+  PrimitiveType type = children()[0]->type();
+  bool is_int = IsIntType(type);
+
+  Function* find_fn = NULL;
+  if (!is_int) {
+    // Declare FindThenExpr() in the module and map it to the native function.
+    const char* find_fn_name = "CaseExprFindThenExpr";
+    find_fn = codegen->module()->getFunction(find_fn_name);
+    if (find_fn == NULL) {
+      vector<Type*> arg_types;
+      arg_types.push_back(codegen->ptr_type());
+      arg_types.push_back(codegen->ptr_type());
+      FunctionType* fn_type =
+          FunctionType::get(codegen->GetType(TYPE_INT), arg_types, false);
+      find_fn = Function::Create(fn_type, GlobalValue::ExternalLinkage,
+          find_fn_name, codegen->module());
+      codegen->execution_engine()->addGlobalMapping(find_fn,
+          reinterpret_cast<void*>(&FindThenExpr));
+    }
+  }
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Type* return_type = GetLlvmReturnType(codegen);
+  Function* function = CreateComputeFnPrototype(codegen, "CaseExpr");
+  Function::arg_iterator fn_args = function->arg_begin();
+  Value* args[3] = { fn_args++, fn_args++, fn_args };
+
+  BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  BasicBlock* lookup_block = BasicBlock::Create(context, "lookup", function);
+  BasicBlock* else_block = BasicBlock::Create(context, "else", function);
+  BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
+  PHINode* phi_node =
+      PHINode::Create(return_type, then_map_->size() + 1, "tmp_phi", ret_block);
+
+  // A null case value doesn't match any when value.
+  Value* case_val = children()[0]->CodegenGetValue(codegen, entry_block,
+      else_block, lookup_block);
+
+  builder.SetInsertPoint(lookup_block);
+  Value* switch_val = case_val;
+  if (!is_int) {
+    // String values are already returned by pointer.
+    Value* value_ptr = case_val;
+    if (type != TYPE_STRING) {
+      Value* value = codegen->CreateEntryBlockAlloca(function,
+          LlvmCodeGen::NamedVariable("value", codegen->GetType(type)));
+      builder.CreateStore(case_val, value);
+      value_ptr = value;
+    }
+    value_ptr = builder.CreateBitCast(value_ptr, codegen->ptr_type(), "value_ptr");
+    Value* expr_ptr = codegen->CastPtrToLlvmPtr(codegen->ptr_type(), this);
+    switch_val = builder.CreateCall2(find_fn, expr_ptr, value_ptr, "then_idx");
+  }
+  SwitchInst* switch_inst =
+      builder.CreateSwitch(switch_val, else_block, then_map_->size());
+  IntegerType* switch_type = cast<IntegerType>(switch_val->getType());
+
+  for (int i = 1; i < loop_end; i += 2) {
+    void* when_val = children()[i]->GetValue(NULL);
+    // Only the first when clause of a value is taken (and has a case).
+    if (when_val == NULL || FindThenExpr(this, when_val) != i + 1) continue;
+    stringstream name;
+    name << "then" << (i - 1) / 2;
+    BasicBlock* then_block = BasicBlock::Create(context, name.str(), function,
+        else_block);
+    builder.SetInsertPoint(then_block);
+    Value* then_val = builder.CreateCall3(children()[i + 1]->codegen_fn(),
+        args[0], args[1], args[2], "then_val");
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(then_val, then_block);
+
+    if (is_int) {
+      switch_inst->addCase(
+          ConstantInt::get(switch_type, GetIntValue(when_val, type), true), then_block);
+    } else {
+      switch_inst->addCase(ConstantInt::get(switch_type, i + 1, true), then_block);
+    }
+  }
+
+  builder.SetInsertPoint(else_block);
+  if (has_else_expr_) {
+    Value* else_val = builder.CreateCall3(children()[num_children - 1]->codegen_fn(),
+        args[0], args[1], args[2], "else_val");
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(else_val, else_block);
+  } else {
+    CodegenSetIsNullArg(codegen, else_block, true);
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(GetNullReturnValue(codegen), else_block);
+  }
+
+  builder.SetInsertPoint(ret_block);
+  builder.CreateRet(phi_node);
+
+  return codegen->FinalizeFunction(function);
+}
+
 string CaseExpr::DebugString() const {
   stringstream out;
   out << "CaseExpr(has_case_expr=" << has_case_expr_
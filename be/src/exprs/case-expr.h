@@ -17,6 +17,9 @@
 #define IMPALA_EXPRS_CASE_EXPR_H_
 
 #include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_map.hpp>
 #include "expr.h"
 
 namespace impala {
@@ -24,6 +27,9 @@ namespace impala {
 class TExprNode;
 
 class CaseExpr: public Expr {
+ public:
+  virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
+
  protected:
   friend class Expr;
   friend class ComputeFunctions;
@@ -38,8 +44,53 @@ class CaseExpr: public Expr {
   bool has_else_expr() { return has_else_expr_; }
 
  private:
+  // Case exprs with at least this many constant when values look up the then expr of
+  // the case value instead of comparing it with each when value.
+  static const int MIN_LOOKUP_SIZE = 8;
+
+  // Integer case exprs whose when values span at most this many times as many values
+  // as there are when values look them up in then_table_.
+  static const int MAX_TABLE_DENSITY = 4;
+
+  // Hash and equality functions for values of 'type'.
+  struct ValueHash {
+    PrimitiveType type;
+    ValueHash(PrimitiveType type) : type(type) { }
+    size_t operator()(const void* value) const;
+  };
+  struct ValueEq {
+    PrimitiveType type;
+    ValueEq(PrimitiveType type) : type(type) { }
+    bool operator()(const void* v1, const void* v2) const;
+  };
+  typedef boost::unordered_map<const void*, int, ValueHash, ValueEq> ThenMap;
+
   const bool has_case_expr_;
   const bool has_else_expr_;
+
+  // If the when values are constant and there are at least MIN_LOOKUP_SIZE of them,
+  // the index of the child that is the then expr of each non-null when value (of its
+  // first when clause).  The keys point into the results of the when exprs, which are
+  // not evaluated again.  NULL otherwise.
+  boost::scoped_ptr<ThenMap> then_map_;
+
+  // For integer when values that are dense enough, the same as then_map_ in an array
+  // indexed by the value minus then_table_min_: the index of the then expr, or -1 if
+  // no when value is equal.  Empty otherwise.
+  std::vector<int> then_table_;
+  int64_t then_table_min_;
+
+  // Compute function if then_map_ is set.
+  static void* LookupComputeFn(Expr* e, TupleRow* row);
+
+  // Returns the index of the then expr that 'value' (of the case expr's type) selects,
+  // or -1 if it doesn't match any when value.  Requires then_map_.  Also called by the
+  // codegen'd function.
+  static int FindThenExpr(const CaseExpr* e, const void* value);
+
+  // Codegen for then_map_: a switch on the case value for integers, and otherwise a
+  // call to FindThenExpr() and a switch on the result.
+  llvm::Function* CodegenLookup(LlvmCodeGen* codegen);
 };
 
 }
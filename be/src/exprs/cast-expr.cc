@@ -16,6 +16,7 @@
 
 #include "codegen/llvm-codegen.h"
 #include "exprs/cast-expr.h"
+#include "runtime/row-batch.h"
 #include "gen-cpp/Exprs_types.h"
 
 using namespace llvm;
@@ -46,6 +47,99 @@ bool CastExpr::IsJittable(LlvmCodeGen* codegen) const {
   return Expr::IsJittable(codegen);
 }
 
+// Converts like the generated compute functions do, with an implicit conversion.
+template <typename FROM, typename TO>
+static void CastLoop(int n, ExprColumn* child, ExprColumn* result) {
+  const FROM* in = child->values<FROM>();
+  TO* out = result->values<TO>();
+  for (int i = 0; i < n; ++i) {
+    out[i] = in[i];
+  }
+  memcpy(result->is_null(), child->is_null(), n);
+}
+
+// Runs CastLoop<FROM, TO> for the C++ type TO of 'to_type'.
+template <typename FROM>
+static void CastFrom(PrimitiveType to_type, int n, ExprColumn* child,
+    ExprColumn* result) {
+  switch (to_type) {
+    case TYPE_BOOLEAN:
+      CastLoop<FROM, bool>(n, child, result);
+      break;
+    case TYPE_TINYINT:
+      CastLoop<FROM, int8_t>(n, child, result);
+      break;
+    case TYPE_SMALLINT:
+      CastLoop<FROM, int16_t>(n, child, result);
+      break;
+    case TYPE_INT:
+      CastLoop<FROM, int32_t>(n, child, result);
+      break;
+    case TYPE_BIGINT:
+      CastLoop<FROM, int64_t>(n, child, result);
+      break;
+    case TYPE_FLOAT:
+      CastLoop<FROM, float>(n, child, result);
+      break;
+    case TYPE_DOUBLE:
+      CastLoop<FROM, double>(n, child, result);
+      break;
+    default:
+      DCHECK(false) << "bad cast type: " << TypeToString(to_type);
+  }
+}
+
+static bool IsNativeType(PrimitiveType type) {
+  switch (type) {
+    case TYPE_BOOLEAN:
+    case TYPE_TINYINT:
+    case TYPE_SMALLINT:
+    case TYPE_INT:
+    case TYPE_BIGINT:
+    case TYPE_FLOAT:
+    case TYPE_DOUBLE:
+      return true;
+    default:
+      return false;
+  }
+}
+
+void CastExpr::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  PrimitiveType from_type = children_[0]->type();
+  if (!IsNativeType(from_type) || !IsNativeType(type_)) {
+    Expr::EvalBatch(batch, sel, num_rows, result);
+    return;
+  }
+  GetChildValues(batch, sel, num_rows);
+  ExprColumn* child = &child_results_[0];
+  switch (from_type) {
+    case TYPE_BOOLEAN:
+      CastFrom<bool>(type_, num_rows, child, result);
+      break;
+    case TYPE_TINYINT:
+      CastFrom<int8_t>(type_, num_rows, child, result);
+      break;
+    case TYPE_SMALLINT:
+      CastFrom<int16_t>(type_, num_rows, child, result);
+      break;
+    case TYPE_INT:
+      CastFrom<int32_t>(type_, num_rows, child, result);
+      break;
+    case TYPE_BIGINT:
+      CastFrom<int64_t>(type_, num_rows, child, result);
+      break;
+    case TYPE_FLOAT:
+      CastFrom<float>(type_, num_rows, child, result);
+      break;
+    case TYPE_DOUBLE:
+      CastFrom<double>(type_, num_rows, child, result);
+      break;
+    default:
+      DCHECK(false) << "bad cast type: " << TypeToString(from_type);
+  }
+}
+
 // IR Generation for Cast Exprs.  For a cast from long to double, the IR
 // looks like:
 //
@@ -35,6 +35,11 @@ class CastExpr: public Expr {
  protected:
   friend class Expr;
   CastExpr(const TExprNode& node);
+
+  // Casts between BOOLEAN and the numeric types are computed in a typed loop; others
+  // (from and to strings and timestamps) are evaluated one row at a time.
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
 };
 
 }
@@ -13,10 +13,12 @@
 // limitations under the License.
 
 #include <sstream>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 
 #include "codegen/llvm-codegen.h"
 #include "exprs/compound-predicate.h"
 #include "util/debug-util.h"
+#include "util/stopwatch.h"
 
 using namespace std;
 using namespace llvm;
@@ -24,7 +26,9 @@ using namespace llvm;
 namespace impala {
 
 CompoundPredicate::CompoundPredicate(const TExprNode& node)
-  : Predicate(node) {
+  : Predicate(node),
+    first_child_(0),
+    rows_until_sample_(1) {
 }
 
 Status CompoundPredicate::Prepare(RuntimeState* state, const RowDescriptor& desc) {
@@ -32,46 +36,76 @@ Status CompoundPredicate::Prepare(RuntimeState* state, const RowDescriptor& desc
   return Expr::Prepare(state, desc);
 }
 
+void* CompoundPredicate::Combine(bool* val1, bool* val2, bool decisive) {
+  // <> && false is false, <> || true is true
+  if ((val1 != NULL && *val1 == decisive) || (val2 != NULL && *val2 == decisive)) {
+    result_.bool_val = decisive;
+    return &result_.bool_val;
+  }
+  // true && NULL is NULL, false || NULL is NULL
+  if (val1 == NULL || val2 == NULL) return NULL;
+  result_.bool_val = !decisive;
+  return &result_.bool_val;
+}
+
+inline void* CompoundPredicate::Evaluate(TupleRow* row, bool decisive) {
+  DCHECK_EQ(children_.size(), 2);
+  if (--rows_until_sample_ == 0) return EvaluateSampled(row, decisive);
+  bool* val1 = reinterpret_cast<bool*>(children_[first_child_]->GetValue(row));
+  if (val1 != NULL && *val1 == decisive) {
+    result_.bool_val = decisive;
+    return &result_.bool_val;
+  }
+  bool* val2 = reinterpret_cast<bool*>(children_[1 - first_child_]->GetValue(row));
+  return Combine(val1, val2, decisive);
+}
+
+void* CompoundPredicate::EvaluateSampled(TupleRow* row, bool decisive) {
+  rows_until_sample_ = SAMPLE_INTERVAL;
+  bool* vals[2];
+  for (int i = 0; i < 2; ++i) {
+    ChildStats* stats = &child_stats_[i];
+    if (stats->num_samples == MAX_SAMPLES) {
+      stats->cycles /= 2;
+      stats->num_samples /= 2;
+      stats->num_decided /= 2;
+    }
+    uint64_t start = StopWatch::Rdtsc();
+    vals[i] = reinterpret_cast<bool*>(children_[i]->GetValue(row));
+    stats->cycles += StopWatch::Rdtsc() - start;
+    ++stats->num_samples;
+    if (vals[i] != NULL && *vals[i] == decisive) ++stats->num_decided;
+  }
+
+  // Evaluating child i first costs cycles_i + (1 - decided_i) * cycles_j per row,
+  // which is less than the other order iff cycles_i / decided_i < cycles_j / decided_j.
+  // Both children have the same number of samples.
+  const ChildStats& stats0 = child_stats_[0];
+  const ChildStats& stats1 = child_stats_[1];
+  double cost0 = static_cast<double>(stats0.cycles) * stats1.num_decided;
+  double cost1 = static_cast<double>(stats1.cycles) * stats0.num_decided;
+  if (cost0 != cost1) first_child_ = cost0 < cost1 ? 0 : 1;
+  return Combine(vals[0], vals[1], decisive);
+}
+
+bool CompoundPredicate::EvaluateSampledIr(CompoundPredicate* p, TupleRow* row,
+    bool* is_null) {
+  bool decisive = p->opcode_ == TExprOpcode::COMPOUND_OR;
+  bool* result = reinterpret_cast<bool*>(p->EvaluateSampled(row, decisive));
+  *is_null = result == NULL;
+  return result != NULL && *result;
+}
+
 void* CompoundPredicate::AndComputeFn(Expr* e, TupleRow* row) {
   CompoundPredicate* p = static_cast<CompoundPredicate*>(e);
-  DCHECK_EQ(p->children_.size(), 2);
   DCHECK_EQ(p->opcode_, TExprOpcode::COMPOUND_AND);
-  Expr* op1 = e->children()[0];
-  bool* val1 = reinterpret_cast<bool*>(op1->GetValue(row));
-  Expr* op2 = e->children()[1];
-  bool* val2 = reinterpret_cast<bool*>(op2->GetValue(row));
-  // <> && false is false
-  if ((val1 != NULL && !*val1) || (val2 != NULL && !*val2)) {
-    p->result_.bool_val = false;
-    return &p->result_.bool_val;
-  }
-  // true && NULL is NULL
-  if (val1 == NULL || val2 == NULL) {
-    return NULL;
-  }
-  p->result_.bool_val = true;
-  return &p->result_.bool_val;
+  return p->Evaluate(row, false);
 }
 
 void* CompoundPredicate::OrComputeFn(Expr* e, TupleRow* row) {
   CompoundPredicate* p = static_cast<CompoundPredicate*>(e);
-  DCHECK_EQ(p->children_.size(), 2);
   DCHECK_EQ(p->opcode_, TExprOpcode::COMPOUND_OR);
-  Expr* op1 = e->children()[0];
-  bool* val1 = reinterpret_cast<bool*>(op1->GetValue(row));
-  Expr* op2 = e->children()[1];
-  bool* val2 = reinterpret_cast<bool*>(op2->GetValue(row));
-  // <> || true is true
-  if ((val1 != NULL && *val1) || (val2 != NULL && *val2)) {
-    p->result_.bool_val = true;
-    return &p->result_.bool_val;
-  }
-  // false || NULL is NULL
-  if (val1 == NULL || val2 == NULL) {
-    return NULL;
-  }
-  p->result_.bool_val = false;
-  return &p->result_.bool_val;
+  return p->Evaluate(row, true);
 }
 
 void* CompoundPredicate::NotComputeFn(Expr* e, TupleRow* row) {
@@ -145,47 +179,55 @@ Function* CompoundPredicate::CodegenNot(LlvmCodeGen* codegen) {
   return function;
 }
 
-// IR codegen for compound and/or predicates.  Compound predicate has non trivial 
-// null handling as well as many branches so this is pretty complicated.  The IR 
-// for x && y is:
+// IR codegen for compound and/or predicates.  The function contains the short-circuit
+// evaluation of both orders of the children, picks one with first_child_ and leaves
+// the sampled rows to EvaluateSampled().  The IR for x && y is:
 //
 // define i1 @CompoundPredicate(i8** %row, i8* %state_data, i1* %is_null) {
 // entry:
-//   %rhs_null = alloca i1
-//   %lhs_null = alloca i1
-//   %lhs_call = call i1 @LiteralPredicate(i8** %row, i8* %state_data, i1* %lhs_null)
-//   %rhs_call = call i1 @LiteralPredicate1(i8** %row, i8* %state_data, i1* %rhs_null)
-//   %lhs_null2 = load i1* %lhs_null
-//   %rhs_null3 = load i1* %rhs_null
-//   %tmp_and = and i1 %lhs_call, %rhs_call
-//   br i1 %lhs_null2, label %lhs_null1, label %lhs_not_null
-// 
-// lhs_null1:                                        ; preds = %entry
-//   br i1 %rhs_null3, label %null_block, label %lhs_null_rhs_not_null
-// 
-// lhs_not_null:                                     ; preds = %entry
-//   br i1 %rhs_null3, label %lhs_not_null_rhs_null, label %not_null_block
-// 
-// lhs_null_rhs_not_null:                            ; preds = %lhs_null1
-//   br i1 %rhs_call, label %null_block, label %not_null_block
-// 
-// lhs_not_null_rhs_null:                            ; preds = %lhs_not_null
-//   br i1 %lhs_call, label %null_block, label %not_null_block
-// 
-// null_block:                                       
-//   store i1 true, i1* %is_null
-//   br label %ret
-// 
-// not_null_block:                                   
-//   %0 = phi i1 [ false, %lhs_null_rhs_not_null ], 
-//               [ false, %lhs_not_null_rhs_null ], 
-//               [ %tmp_and, %lhs_not_null ]
+//   %first_null_ptr = alloca i1
+//   %second_null_ptr = alloca i1
+//   %rows_until_sample = load i32* inttoptr (i64 58267056 to i32*)
+//   %rows_left = sub i32 %rows_until_sample, 1
+//   store i32 %rows_left, i32* inttoptr (i64 58267056 to i32*)
+//   %is_sampled = icmp eq i32 %rows_left, 0
+//   br i1 %is_sampled, label %sampled, label %dispatch
+//
+// sampled:                                          ; preds = %entry
+//   %sampled_result = call i1 @CompoundPredicateEvaluateSampled(
+//       i8* inttoptr (i64 58266944 to i8*), i8** %row, i1* %is_null)
+//   ret i1 %sampled_result
+//
+// dispatch:                                         ; preds = %entry
+//   %first_child = load i32* inttoptr (i64 58267052 to i32*)
+//   %lhs_is_first = icmp eq i32 %first_child, 0
+//   br i1 %lhs_is_first, label %lhs_first, label %rhs_first
+//
+// decided:                         ; preds = %rhs_first_second, %rhs_first, ...
 //   store i1 false, i1* %is_null
-//   br label %ret
-// 
-// ret:                                           ; preds = %not_null_block, %null_block
-//   %tmp_phi = phi i1 [ false, %null_block ], [ %0, %not_null_block ]
-//   ret i1 %tmp_phi
+//   ret i1 false
+//
+// lhs_first:                                        ; preds = %dispatch
+//   %first_val = call i1 @LiteralPredicate(i8** %row, i8* %state_data,
+//       i1* %first_null_ptr)
+//   %first_null = load i1* %first_null_ptr
+//   %first_not_decided = or i1 %first_null, %first_val
+//   br i1 %first_not_decided, label %lhs_first_second, label %decided
+//
+// lhs_first_second:                                 ; preds = %lhs_first
+//   %second_val = call i1 @LiteralPredicate1(i8** %row, i8* %state_data,
+//       i1* %second_null_ptr)
+//   %second_null = load i1* %second_null_ptr
+//   %second_not_decided = or i1 %second_null, %second_val
+//   br i1 %second_not_decided, label %lhs_first_not_decided, label %decided
+//
+// lhs_first_not_decided:                            ; preds = %lhs_first_second
+//   %any_null = or i1 %first_null, %second_null
+//   store i1 %any_null, i1* %is_null
+//   ret i1 true
+//
+// rhs_first:                                        ; preds = %dispatch
+//   ... the same as lhs_first, with the calls swapped
 // }
 Function* CompoundPredicate::CodegenBinary(LlvmCodeGen* codegen) {
   DCHECK_EQ(GetNumChildren(), 2);
@@ -194,115 +236,121 @@ Function* CompoundPredicate::CodegenBinary(LlvmCodeGen* codegen) {
   if (lhs_function == NULL) return NULL;
   Function* rhs_function = children()[1]->Codegen(codegen);
   if (rhs_function == NULL) return NULL;
-  
+
+  // Declare EvaluateSampledIr() in the module and map it to the native function.
+  const char* sampled_fn_name = "CompoundPredicateEvaluateSampled";
+  Function* sampled_fn = codegen->module()->getFunction(sampled_fn_name);
+  if (sampled_fn == NULL) {
+    vector<Type*> arg_types;
+    arg_types.push_back(codegen->ptr_type());
+    arg_types.push_back(PointerType::get(codegen->ptr_type(), 0));
+    arg_types.push_back(PointerType::get(codegen->boolean_type(), 0));
+    FunctionType* fn_type = FunctionType::get(codegen->boolean_type(), arg_types, false);
+    sampled_fn = Function::Create(fn_type, GlobalValue::ExternalLinkage,
+        sampled_fn_name, codegen->module());
+    codegen->execution_engine()->addGlobalMapping(sampled_fn,
+        reinterpret_cast<void*>(&EvaluateSampledIr));
+  }
+
   LLVMContext& context = codegen->context();
   LlvmCodeGen::LlvmBuilder builder(context);
-  Type* return_type = codegen->GetType(type());
   Function* function = CreateComputeFnPrototype(codegen, "CompoundPredicate");
+  Function::arg_iterator func_args = function->arg_begin();
+  Value* row_ptr = func_args++;
+  ++func_args;
+  Value* is_null_ptr = func_args;
 
   BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  BasicBlock* sampled_block = BasicBlock::Create(context, "sampled", function);
+  BasicBlock* dispatch_block = BasicBlock::Create(context, "dispatch", function);
+  BasicBlock* decided_block = BasicBlock::Create(context, "decided", function);
+  BasicBlock* lhs_first_block = BasicBlock::Create(context, "lhs_first", function);
+  BasicBlock* rhs_first_block = BasicBlock::Create(context, "rhs_first", function);
+
+  // Count down to the next sampled row.
   builder.SetInsertPoint(entry_block);
+  LlvmCodeGen::NamedVariable first_null_var("first_null_ptr", codegen->boolean_type());
+  LlvmCodeGen::NamedVariable second_null_var("second_null_ptr",
+      codegen->boolean_type());
+  Value* first_is_null = codegen->CreateEntryBlockAlloca(function, first_null_var);
+  Value* second_is_null = codegen->CreateEntryBlockAlloca(function, second_null_var);
+  Value* rows_until_sample_ptr =
+      codegen->CastPtrToLlvmPtr(codegen->GetPtrType(TYPE_INT), &rows_until_sample_);
+  Value* rows_until_sample = builder.CreateLoad(rows_until_sample_ptr,
+      "rows_until_sample");
+  Value* rows_left = builder.CreateSub(rows_until_sample,
+      codegen->GetIntConstant(TYPE_INT, 1), "rows_left");
+  builder.CreateStore(rows_left, rows_until_sample_ptr);
+  Value* is_sampled = builder.CreateICmpEQ(rows_left,
+      codegen->GetIntConstant(TYPE_INT, 0), "is_sampled");
+  builder.CreateCondBr(is_sampled, sampled_block, dispatch_block);
+
+  builder.SetInsertPoint(sampled_block);
+  Value* this_ptr = codegen->CastPtrToLlvmPtr(codegen->ptr_type(), this);
+  Value* sampled_result = builder.CreateCall3(sampled_fn, this_ptr, row_ptr,
+      is_null_ptr, "sampled_result");
+  builder.CreateRet(sampled_result);
+
+  builder.SetInsertPoint(dispatch_block);
+  Value* first_child = builder.CreateLoad(
+      codegen->CastPtrToLlvmPtr(codegen->GetPtrType(TYPE_INT), &first_child_),
+      "first_child");
+  Value* lhs_is_first = builder.CreateICmpEQ(first_child,
+      codegen->GetIntConstant(TYPE_INT, 0), "lhs_is_first");
+  builder.CreateCondBr(lhs_is_first, lhs_first_block, rhs_first_block);
+
+  // The result is 'decisive' if either child is.
+  bool decisive = op() == TExprOpcode::COMPOUND_OR;
+  builder.SetInsertPoint(decided_block);
+  builder.CreateStore(codegen->false_value(), is_null_ptr);
+  builder.CreateRet(decisive ? codegen->true_value() : codegen->false_value());
 
-  LlvmCodeGen::NamedVariable lhs_null_var("lhs_null_ptr", codegen->boolean_type());
-  LlvmCodeGen::NamedVariable rhs_null_var("rhs_null_ptr", codegen->boolean_type());
-  
-  // Create stack variables for lhs is_null result and rhs is_null result
-  Value* lhs_is_null = codegen->CreateEntryBlockAlloca(function, lhs_null_var);
-  Value* rhs_is_null = codegen->CreateEntryBlockAlloca(function, rhs_null_var);
-
-  // Control blocks for aggregating results
-  BasicBlock* lhs_null_block = BasicBlock::Create(context, "lhs_null", function);
-  BasicBlock* lhs_not_null_block = 
-      BasicBlock::Create(context, "lhs_not_null", function);
-  BasicBlock* lhs_null_rhs_not_null_block = 
-      BasicBlock::Create(context, "lhs_null_rhs_not_null", function);
-  BasicBlock* lhs_not_null_rhs_null_block = 
-      BasicBlock::Create(context, "lhs_not_null_rhs_null", function);
-  BasicBlock* null_block = BasicBlock::Create(context, "null_block", function);
-  BasicBlock* not_null_block = BasicBlock::Create(context, "not_null_block", function);
-  BasicBlock* ret_block = BasicBlock::Create(context, "ret", function);
+  CodegenOrder(codegen, function, lhs_first_block, lhs_function, rhs_function,
+      first_is_null, second_is_null, decided_block);
+  CodegenOrder(codegen, function, rhs_first_block, rhs_function, lhs_function,
+      first_is_null, second_is_null, decided_block);
+  return function;
+}
+
+void CompoundPredicate::CodegenOrder(LlvmCodeGen* codegen, Function* function,
+    BasicBlock* block, Function* first_fn, Function* second_fn, Value* first_is_null,
+    Value* second_is_null, BasicBlock* decided_block) {
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  bool decisive = op() == TExprOpcode::COMPOUND_OR;
+  string name = block->getName();
+  BasicBlock* second_block = BasicBlock::Create(context, name + "_second", function);
+  BasicBlock* not_decided_block =
+      BasicBlock::Create(context, name + "_not_decided", function);
 
-  // Initialize the function arguments to the child functions
   Function::arg_iterator func_args = function->arg_begin();
   Value* row_ptr = func_args++;
   Value* state_data_ptr = func_args++;
   Value* is_null_ptr = func_args;
-  Value* args[3] = { row_ptr, state_data_ptr, lhs_is_null };
-
-  // Call lhs
-  Value* lhs_value = builder.CreateCall(lhs_function, args, "lhs_call");
-  // Call rhs
-  args[2] = rhs_is_null;
-  Value* rhs_value = builder.CreateCall(rhs_function, args, "rhs_call");
-  
-  Value* lhs_is_null_val = builder.CreateLoad(lhs_is_null, "lhs_null");
-  Value* rhs_is_null_val = builder.CreateLoad(rhs_is_null, "rhs_null");
-  Value* compare = NULL;
-  if (op() == TExprOpcode::COMPOUND_AND) {
-    compare = builder.CreateAnd(lhs_value, rhs_value, "tmp_and");
-  } else {
-    compare = builder.CreateOr(lhs_value, rhs_value, "tmp_or");
-  }
-
-  // Branch if lhs is null
-  builder.CreateCondBr(lhs_is_null_val, lhs_null_block, lhs_not_null_block);
-
-  // lhs_is_null block
-  builder.SetInsertPoint(lhs_null_block);
-  builder.CreateCondBr(rhs_is_null_val, null_block, lhs_null_rhs_not_null_block);
-
-  // lhs_is_not_null block
-  builder.SetInsertPoint(lhs_not_null_block);
-  builder.CreateCondBr(rhs_is_null_val, lhs_not_null_rhs_null_block, not_null_block);
-
-  // lhs_not_null rhs_null block
-  builder.SetInsertPoint(lhs_not_null_rhs_null_block);
-  if (op() == TExprOpcode::COMPOUND_AND) {
-    // false && null -> false; true && null -> null
-    builder.CreateCondBr(lhs_value, null_block, not_null_block);
-  } else {
-    // true || null -> true; false || null -> null
-    builder.CreateCondBr(lhs_value, not_null_block, null_block);
-  }
-
-  // lhs_null rhs_not_null block
-  builder.SetInsertPoint(lhs_null_rhs_not_null_block);
-  if (op() == TExprOpcode::COMPOUND_AND) {
-    // null && false -> false; null && true -> null
-    builder.CreateCondBr(rhs_value, null_block, not_null_block);
-  } else {
-    // null || true -> true; null || false -> null
-    builder.CreateCondBr(rhs_value, not_null_block, null_block);
-  }
-
-  // NULL block
-  builder.SetInsertPoint(null_block);
-  builder.CreateStore(codegen->true_value(), is_null_ptr);
-  builder.CreateBr(ret_block);
-
-  // not-NULL block
-  builder.SetInsertPoint(not_null_block);
-  PHINode* not_null_phi = builder.CreatePHI(codegen->boolean_type(), 3);
-  if (op() == TExprOpcode::COMPOUND_AND) {
-    not_null_phi->addIncoming(codegen->false_value(), lhs_null_rhs_not_null_block);
-    not_null_phi->addIncoming(codegen->false_value(), lhs_not_null_rhs_null_block);
-    not_null_phi->addIncoming(compare, lhs_not_null_block);
-  } else {
-    not_null_phi->addIncoming(codegen->true_value(), lhs_null_rhs_not_null_block);
-    not_null_phi->addIncoming(codegen->true_value(), lhs_not_null_rhs_null_block);
-    not_null_phi->addIncoming(compare, lhs_not_null_block);
-  }
-  builder.CreateStore(codegen->false_value(), is_null_ptr);
-  builder.CreateBr(ret_block);
-
-  // Ret/merge block
-  builder.SetInsertPoint(ret_block);
-  PHINode* phi_node = builder.CreatePHI(return_type, 2, "tmp_phi");
-  phi_node->addIncoming(codegen->false_value(), null_block);
-  phi_node->addIncoming(not_null_phi, not_null_block);
-  builder.CreateRet(phi_node);
-
-  return function;
+  Value* args[3] = { row_ptr, state_data_ptr, first_is_null };
+
+  // A child decides the result if it isn't null and its value is 'decisive'.
+  builder.SetInsertPoint(block);
+  Value* first_val = builder.CreateCall(first_fn, args, "first_val");
+  Value* first_null = builder.CreateLoad(first_is_null, "first_null");
+  if (decisive) first_val = builder.CreateNot(first_val);
+  Value* first_not_decided = builder.CreateOr(first_null, first_val, "first_not_decided");
+  builder.CreateCondBr(first_not_decided, second_block, decided_block);
+
+  builder.SetInsertPoint(second_block);
+  args[2] = second_is_null;
+  Value* second_val = builder.CreateCall(second_fn, args, "second_val");
+  Value* second_null = builder.CreateLoad(second_is_null, "second_null");
+  if (decisive) second_val = builder.CreateNot(second_val);
+  Value* second_not_decided =
+      builder.CreateOr(second_null, second_val, "second_not_decided");
+  builder.CreateCondBr(second_not_decided, not_decided_block, decided_block);
+
+  // true && NULL is NULL, false || NULL is NULL
+  builder.SetInsertPoint(not_decided_block);
+  builder.CreateStore(builder.CreateOr(first_null, second_null, "any_null"),
+      is_null_ptr);
+  builder.CreateRet(decisive ? codegen->false_value() : codegen->true_value());
 }
 
 Function* CompoundPredicate::Codegen(LlvmCodeGen* codegen) {  
@@ -22,6 +22,14 @@
 
 namespace impala {
 
+// AND and OR short-circuit: the second child is only evaluated if the first one
+// doesn't decide the result.  The order of the children adapts to their cost and
+// selectivity.  Every SAMPLE_INTERVAL-th row, both children are evaluated and timed,
+// and the child with the lower cost per row that it decides on its own is evaluated
+// first from then on, so for example cheap_col = 5 runs before expensive_fn(x) in
+// "expensive_fn(x) AND cheap_col = 5" if it filters rows at all.
+// The codegen'd function contains both orders and picks one with first_child_, which
+// the sampled rows update.
 class CompoundPredicate: public Predicate {
  public:
   virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
@@ -40,9 +48,55 @@ class CompoundPredicate: public Predicate {
   llvm::Function* CodegenNot(LlvmCodeGen* codegen);
   llvm::Function* CodegenBinary(LlvmCodeGen* codegen);
 
+  // Emits the short-circuit evaluation of 'first_fn' and 'second_fn' into 'block' of
+  // 'function'.  The children's is_null results are stored in 'first_is_null' and
+  // 'second_is_null'; a child that decides the result branches to 'decided_block'.
+  void CodegenOrder(LlvmCodeGen* codegen, llvm::Function* function,
+      llvm::BasicBlock* block, llvm::Function* first_fn, llvm::Function* second_fn,
+      llvm::Value* first_is_null, llvm::Value* second_is_null,
+      llvm::BasicBlock* decided_block);
+
   static void* AndComputeFn(Expr* e, TupleRow* row);
   static void* OrComputeFn(Expr* e, TupleRow* row);
   static void* NotComputeFn(Expr* e, TupleRow* row);
+
+  static const int SAMPLE_INTERVAL = 64;
+
+  // The statistics are halved after this many samples, so the order follows changes
+  // of the data.
+  static const int MAX_SAMPLES = 1024;
+
+  // Statistics of a child from the sampled rows.
+  struct ChildStats {
+    int64_t cycles;
+    int64_t num_samples;
+    // number of sampled rows for which this child decided the result on its own
+    int64_t num_decided;
+
+    ChildStats() : cycles(0), num_samples(0), num_decided(0) {}
+  };
+  ChildStats child_stats_[2];
+
+  // index of the child that is evaluated first
+  int32_t first_child_;
+
+  // number of rows until the next sampled row, including it
+  int32_t rows_until_sample_;
+
+  // Evaluates AND (if 'decisive' is false) or OR: a child that is 'decisive' decides
+  // the result.  Returns the result like a compute function.
+  void* Evaluate(TupleRow* row, bool decisive);
+
+  // Evaluates both children of a sampled row, updates child_stats_ and first_child_
+  // and returns the result like Evaluate().
+  void* EvaluateSampled(TupleRow* row, bool decisive);
+
+  // EvaluateSampled() for the codegen'd function, which calls it through a pointer to
+  // this predicate.
+  static bool EvaluateSampledIr(CompoundPredicate* p, TupleRow* row, bool* is_null);
+
+  // Returns the result for the children's values 'val1' and 'val2' (in either order).
+  void* Combine(bool* val1, bool* val2, bool decisive);
 };
 
 }
@@ -14,8 +14,12 @@
 
 #include "date-literal.h"
 
+#include <sstream>
+
 #include "gen-cpp/Exprs_types.h"
 
+using namespace std;
+
 namespace impala {
 
 DateLiteral::DateLiteral(const TExprNode& node)
@@ -23,4 +27,10 @@ DateLiteral::DateLiteral(const TExprNode& node)
   result_.bigint_val = node.date_literal.value;
 }
 
+string DateLiteral::DebugString() const {
+  stringstream out;
+  out << "DateLiteral(value=" << result_.bigint_val << ")";
+  return out.str();
+}
+
 }
@@ -28,6 +28,8 @@ class DateLiteral: public Expr {
   friend class Expr;
 
   DateLiteral(const TExprNode& node);
+
+  virtual std::string DebugString() const;
 };
 
 }
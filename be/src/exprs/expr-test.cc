@@ -23,6 +23,7 @@
 #include "common/object-pool.h"
 #include "runtime/raw-value.h"
 #include "runtime/primitive-type.h"
+#include "runtime/row-batch.h"
 #include "runtime/string-value.h"
 #include "testutil/in-process-query-executor.h"
 #include "gen-cpp/Exprs_types.h"
@@ -145,7 +146,7 @@ class ExprTest : public testing::Test {
 
   void* GetCodegenValue(Expr* root) {
     scoped_ptr<LlvmCodeGen> codegen;
-    Status status = LlvmCodeGen::LoadImpalaIR(&pool_, &codegen);
+    Status status = LlvmCodeGen::LoadImpalaIR(&codegen);
     EXPECT_TRUE(status.ok());
     int scratch_size = 0;
   
@@ -254,6 +255,37 @@ class ExprTest : public testing::Test {
     }
   }
 
+  // Checks that evaluating 'expr' with Expr::GetValues() over a selection of rows
+  // returns the row-at-a-time result for every selected row.
+  void TestBatchValue(const string& expr) {
+    string stmt = "select " + expr;
+    vector<PrimitiveType> result_types;
+    Status status = executor_->Exec(stmt, &result_types);
+    ASSERT_TRUE(status.ok()) << "stmt: " << stmt << "\nerror: " << status.GetErrorMsg();
+    vector<void*> result_row;
+    ASSERT_TRUE(executor_->FetchResult(&result_row).ok());
+    ASSERT_EQ(1, result_row.size());
+    Expr* root = executor_->select_list_exprs()[0];
+
+    RowDescriptor row_desc;
+    RowBatch batch(row_desc, 8);
+    batch.AddRows(8);
+    batch.CommitRows(8);
+    int sel[] = { 1, 4, 7 };
+    ExprColumn column;
+    root->GetValues(&batch, sel, 3, &column);
+    EXPECT_EQ(column.num_values(), 3);
+    for (int i = 0; i < 3; ++i) {
+      void* value = column.GetValue(i);
+      if (result_row[0] == NULL) {
+        EXPECT_TRUE(value == NULL) << expr;
+      } else {
+        ASSERT_TRUE(value != NULL) << expr;
+        EXPECT_EQ(RawValue::Compare(result_row[0], value, root->type()), 0) << expr;
+      }
+    }
+  }
+
   void TestNonOkStatus(const string& expr) {
     string stmt = "select " + expr;
     vector<PrimitiveType> result_types;
@@ -763,6 +795,51 @@ TEST_F(ExprTest, BinaryPredicates) {
   TestStringComparisons();
 }
 
+TEST_F(ExprTest, BatchEvaluation) {
+  // arithmetic
+  TestBatchValue("1 + 2");
+  TestBatchValue("5 - 10");
+  TestBatchValue("3 * 4.5");
+  TestBatchValue("10 / 4");
+  TestBatchValue("10 DIV 3");
+  TestBatchValue("-10 % 3");
+  TestBatchValue("7 & 3");
+  TestBatchValue("7 | 8");
+  TestBatchValue("7 ^ 2");
+  TestBatchValue("~7");
+  TestBatchValue("(1 + 2) * (3 - 4) DIV 2");
+
+  // binary predicates
+  TestBatchValue("1 < 2");
+  TestBatchValue("2.5 >= 2.5");
+  TestBatchValue("false = true");
+  TestBatchValue("'abc' = 'abc'");
+  TestBatchValue("'abc' > 'abd'");
+  TestBatchValue("1 + 1 != 2");
+
+  // casts, including ones that are evaluated a row at a time
+  TestBatchValue("cast(3.7 as int)");
+  TestBatchValue("cast(5 as tinyint) + cast(1 as tinyint)");
+  TestBatchValue("cast(1 + 2 as double) * 2");
+  TestBatchValue("cast('5' as int) + 1");
+  TestBatchValue("cast(5 as string)");
+
+  // compound predicates, which short-circuit after the first (sampled) row
+  TestBatchValue("1 < 2 AND 2 < 3");
+  TestBatchValue("1 > 2 AND 2 < 3");
+  TestBatchValue("1 < 2 AND 2 > 3");
+  TestBatchValue("1 < 2 AND NULL");
+  TestBatchValue("NULL AND 1 > 2");
+  TestBatchValue("1 > 2 OR 2 > 3");
+  TestBatchValue("1 > 2 OR 2 < 3");
+  TestBatchValue("NULL OR 1 < 2");
+  TestBatchValue("1 > 2 OR NULL");
+
+  // exprs without a batch implementation
+  TestBatchValue("concat('a', 'b')");
+  TestBatchValue("length(concat('a', 'b')) = 2");
+}
+
 // Test casting from all types to all other types
 TEST_F(ExprTest, CastExprs) {
   // From tinyint
@@ -804,6 +881,15 @@ TEST_F(ExprTest, CastExprs) {
   TestCast("'0'", "0");
   TestCast("'5'", "5");
   TestCast("'-5'", "-5");
+  // Strings with runs of 8 digits
+  TestValue("cast('123456789' as int)", TYPE_INT, 123456789);
+  TestValue("cast('+1234567890123456789' as bigint)", TYPE_BIGINT,
+      1234567890123456789LL);
+  TestValue("cast('-12345678901234567' as bigint)", TYPE_BIGINT, -12345678901234567LL);
+  TestValue("cast('00000000000000000012' as bigint)", TYPE_BIGINT, 12);
+  TestIsNull("cast('1234567a9' as int)", TYPE_INT);
+  TestIsNull("cast('12345678901' as int)", TYPE_INT);
+  TestIsNull("cast('99999999999999999999' as bigint)", TYPE_BIGINT);
 
 #if 0
   // Test overflow.  TODO: Hive casting rules are very weird here also.  It seems for
@@ -866,17 +952,17 @@ TEST_F(ExprTest, IsNullPredicate) {
 }
 
 TEST_F(ExprTest, LikePredicate) {
-  TestValue("'a' LIKE '%a%'", TYPE_BOOLEAN, true);
-  TestValue("'a' LIKE '%abcde'", TYPE_BOOLEAN, false);
-  TestValue("'a' LIKE 'abcde%'", TYPE_BOOLEAN, false);
-  TestValue("'abcde' LIKE 'abcde%'", TYPE_BOOLEAN, true);
-  TestValue("'abcde' LIKE '%abcde'", TYPE_BOOLEAN, true);
-  TestValue("'abcde' LIKE '%abcde%'", TYPE_BOOLEAN, true);
+  TestValue("'a' LIKE '%a%'", TYPE_BOOLEAN, true, true);
+  TestValue("'a' LIKE '%abcde'", TYPE_BOOLEAN, false, true);
+  TestValue("'a' LIKE 'abcde%'", TYPE_BOOLEAN, false, true);
+  TestValue("'abcde' LIKE 'abcde%'", TYPE_BOOLEAN, true, true);
+  TestValue("'abcde' LIKE '%abcde'", TYPE_BOOLEAN, true, true);
+  TestValue("'abcde' LIKE '%abcde%'", TYPE_BOOLEAN, true, true);
   // IMP-117
-  TestValue("'ab' LIKE '%a'", TYPE_BOOLEAN, false);
+  TestValue("'ab' LIKE '%a'", TYPE_BOOLEAN, false, true);
   TestValue("'ab' NOT LIKE '%a'", TYPE_BOOLEAN, true);
   // IMP-117
-  TestValue("'ba' LIKE 'a%'", TYPE_BOOLEAN, false);
+  TestValue("'ba' LIKE 'a%'", TYPE_BOOLEAN, false, true);
   TestValue("'a' LIKE '_'", TYPE_BOOLEAN, true);
   TestValue("'a' NOT LIKE '_'", TYPE_BOOLEAN, false);
   TestValue("'a' LIKE 'a'", TYPE_BOOLEAN, true);
@@ -884,13 +970,40 @@ TEST_F(ExprTest, LikePredicate) {
   TestValue("'a' NOT LIKE 'a'", TYPE_BOOLEAN, false);
   TestValue("'a' NOT LIKE 'b'", TYPE_BOOLEAN, true);
   // IMP-117 -- initial part of pattern appears earlier in string.
-  TestValue("'LARGE BRUSHED BRASS' LIKE '%BRASS'", TYPE_BOOLEAN, true);
-  TestValue("'BRASS LARGE BRUSHED' LIKE '%BRASS'", TYPE_BOOLEAN, false);
-  TestValue("'BRASS LARGE BRUSHED' LIKE 'BRUSHED%'", TYPE_BOOLEAN, false);
-  TestValue("'BRASS LARGE BRUSHED' LIKE 'BRASS%'", TYPE_BOOLEAN, true);
-  TestValue("'prefix1234' LIKE 'prefix%'", TYPE_BOOLEAN, true);
-  TestValue("'1234suffix' LIKE '%suffix'", TYPE_BOOLEAN, true);
+  TestValue("'LARGE BRUSHED BRASS' LIKE '%BRASS'", TYPE_BOOLEAN, true, true);
+  TestValue("'BRASS LARGE BRUSHED' LIKE '%BRASS'", TYPE_BOOLEAN, false, true);
+  TestValue("'BRASS LARGE BRUSHED' LIKE 'BRUSHED%'", TYPE_BOOLEAN, false, true);
+  TestValue("'BRASS LARGE BRUSHED' LIKE 'BRASS%'", TYPE_BOOLEAN, true, true);
+  TestValue("'prefix1234' LIKE 'prefix%'", TYPE_BOOLEAN, true, true);
+  TestValue("'1234suffix' LIKE '%suffix'", TYPE_BOOLEAN, true, true);
   TestValue("'1234substr5678' LIKE '%substr%'", TYPE_BOOLEAN, true);
+  TestValue("'abc' LIKE 'abc'", TYPE_BOOLEAN, true, true);
+  TestValue("'abc' LIKE 'ab'", TYPE_BOOLEAN, false, true);
+  TestValue("'abc' LIKE '%'", TYPE_BOOLEAN, true, true);
+  TestValue("'' LIKE '%%'", TYPE_BOOLEAN, true, true);
+  TestValue("'abc' LIKE '%%b%%'", TYPE_BOOLEAN, true, true);
+  // Patterns with several segments
+  TestValue("'abc' LIKE 'a%c'", TYPE_BOOLEAN, true);
+  TestValue("'ac' LIKE 'a%c'", TYPE_BOOLEAN, true);
+  TestValue("'ababc' LIKE 'ab%bc'", TYPE_BOOLEAN, true);
+  TestValue("'abc' LIKE 'ab%bc'", TYPE_BOOLEAN, false);
+  TestValue("'xaybz' LIKE '%a%b%'", TYPE_BOOLEAN, true);
+  TestValue("'xbyaz' LIKE '%a%b%'", TYPE_BOOLEAN, false);
+  TestValue("'abab' LIKE '%ab%ab%'", TYPE_BOOLEAN, true);
+  TestValue("'aba' LIKE '%ab%ab%'", TYPE_BOOLEAN, false);
+  TestValue("'a1b2c3' LIKE 'a%b%c%3'", TYPE_BOOLEAN, true);
+  // Strings longer than an sse register, with the match at register boundaries
+  TestValue("'the quick brown fox jumps over the lazy dog' LIKE '%lazy%'",
+      TYPE_BOOLEAN, true, true);
+  TestValue("'the quick brown fox jumps over the lazy dog' LIKE '%lazy cat%'",
+      TYPE_BOOLEAN, false, true);
+  TestValue("'0123456789abcdexyz' LIKE '%exyz%'", TYPE_BOOLEAN, true, true);
+  TestValue("'0123456789abcdefxy' LIKE '%fxy%'", TYPE_BOOLEAN, true, true);
+  TestValue("'0123456789abcdefxy' LIKE '%fxyz%'", TYPE_BOOLEAN, false, true);
+  TestValue("'0123456789abcdefghijklmnop' LIKE '%0123456789abcdefg%'",
+      TYPE_BOOLEAN, true, true);
+  TestValue("instr('0123456789abcdef0123456789abcdef', 'cdef0')", TYPE_INT, 13, true);
+  TestValue("instr('0123456789abcdef0123456789abcdef', 'cdefg')", TYPE_INT, 0, true);
   TestValue("'a%a' LIKE 'a\\%a'", TYPE_BOOLEAN, true);
   TestValue("'a123a' LIKE 'a\\%a'", TYPE_BOOLEAN, false);
   TestValue("'a_a' LIKE 'a\\_a'", TYPE_BOOLEAN, true);
@@ -964,10 +1077,10 @@ TEST_F(ExprTest, InPredicate) {
   for(int_iter = min_int_values_.begin(); int_iter != min_int_values_.end();
       ++int_iter) {
     string& val = default_type_strs_[int_iter->first];
-    TestValue(val + " in (2, 3, " + val + ")", TYPE_BOOLEAN, true);
-    TestValue(val + " in (2, 3, 4)", TYPE_BOOLEAN, false);
-    TestValue(val + " not in (2, 3, " + val + ")", TYPE_BOOLEAN, false);
-    TestValue(val + " not in (2, 3, 4)", TYPE_BOOLEAN, true);
+    TestValue(val + " in (2, 3, " + val + ")", TYPE_BOOLEAN, true, true);
+    TestValue(val + " in (2, 3, 4)", TYPE_BOOLEAN, false, true);
+    TestValue(val + " not in (2, 3, " + val + ")", TYPE_BOOLEAN, false, true);
+    TestValue(val + " not in (2, 3, 4)", TYPE_BOOLEAN, true, true);
   }
 
   // Test floats.
@@ -975,23 +1088,23 @@ TEST_F(ExprTest, InPredicate) {
   for(float_iter = min_float_values_.begin(); float_iter != min_float_values_.end();
       ++float_iter) {
     string& val = default_type_strs_[float_iter->first];
-    TestValue(val + " in (2, 3, " + val + ")", TYPE_BOOLEAN, true);
-    TestValue(val + " in (2, 3, 4)", TYPE_BOOLEAN, false);
-    TestValue(val + " not in (2, 3, " + val + ")", TYPE_BOOLEAN, false);
-    TestValue(val + " not in (2, 3, 4)", TYPE_BOOLEAN, true);
+    TestValue(val + " in (2, 3, " + val + ")", TYPE_BOOLEAN, true, true);
+    TestValue(val + " in (2, 3, 4)", TYPE_BOOLEAN, false, true);
+    TestValue(val + " not in (2, 3, " + val + ")", TYPE_BOOLEAN, false, true);
+    TestValue(val + " not in (2, 3, 4)", TYPE_BOOLEAN, true, true);
   }
 
   // Test bools.
-  TestValue("true in (true, false, false)", TYPE_BOOLEAN, true);
-  TestValue("true in (false, false, false)", TYPE_BOOLEAN, false);
-  TestValue("true not in (true, false, false)", TYPE_BOOLEAN, false);
-  TestValue("true not in (false, false, false)", TYPE_BOOLEAN, true);
+  TestValue("true in (true, false, false)", TYPE_BOOLEAN, true, true);
+  TestValue("true in (false, false, false)", TYPE_BOOLEAN, false, true);
+  TestValue("true not in (true, false, false)", TYPE_BOOLEAN, false, true);
+  TestValue("true not in (false, false, false)", TYPE_BOOLEAN, true, true);
 
   // Test strings.
-  TestValue("'ab' in ('ab', 'cd', 'efg')", TYPE_BOOLEAN, true);
-  TestValue("'ab' in ('cd', 'efg', 'h')", TYPE_BOOLEAN, false);
-  TestValue("'ab' not in ('ab', 'cd', 'efg')", TYPE_BOOLEAN, false);
-  TestValue("'ab' not in ('cd', 'efg', 'h')", TYPE_BOOLEAN, true);
+  TestValue("'ab' in ('ab', 'cd', 'efg')", TYPE_BOOLEAN, true, true);
+  TestValue("'ab' in ('cd', 'efg', 'h')", TYPE_BOOLEAN, false, true);
+  TestValue("'ab' not in ('ab', 'cd', 'efg')", TYPE_BOOLEAN, false, true);
+  TestValue("'ab' not in ('cd', 'efg', 'h')", TYPE_BOOLEAN, true, true);
 
   // Test timestamps.
   TestValue(default_timestamp_str_ + " "
@@ -1011,6 +1124,21 @@ TEST_F(ExprTest, InPredicate) {
       "cast('2011-11-23 09:11:12' as timestamp), "
       "cast('2011-11-24 09:12:13' as timestamp))", TYPE_BOOLEAN, true);
 
+  // Test large constant lists, which are looked up in a hash set.
+  string int_list = "1, 2, 3, 4, 5, 6, 7, 8, 9, 10";
+  TestValue("5 in (" + int_list + ")", TYPE_BOOLEAN, true, true);
+  TestValue("11 in (" + int_list + ")", TYPE_BOOLEAN, false, true);
+  TestValue("5 not in (" + int_list + ")", TYPE_BOOLEAN, false, true);
+  TestValue("11 not in (" + int_list + ")", TYPE_BOOLEAN, true, true);
+  TestValue("5 in (" + int_list + ", NULL)", TYPE_BOOLEAN, true, true);
+  TestIsNull("11 in (" + int_list + ", NULL)", TYPE_BOOLEAN, true);
+  TestIsNull("11 not in (" + int_list + ", NULL)", TYPE_BOOLEAN, true);
+  TestIsNull("NULL in (" + int_list + ")", TYPE_BOOLEAN);
+  string str_list = "'a', 'b', 'c', 'd', 'e', 'f', 'g', 'abc'";
+  TestValue("'abc' in (" + str_list + ")", TYPE_BOOLEAN, true, true);
+  TestValue("'ab' in (" + str_list + ")", TYPE_BOOLEAN, false, true);
+  TestValue("2.5 in (1.5, 2.5, 3.5, 4.5, 5.5, 6.5, 7.5, 8.5)", TYPE_BOOLEAN, true, true);
+
   // Test operator precedence.
   TestValue("5+1 in (3, 6, 10)", TYPE_BOOLEAN, true);
   TestValue("5+1 not in (3, 6, 10)", TYPE_BOOLEAN, false);
@@ -1032,16 +1160,21 @@ TEST_F(ExprTest, StringFunctions) {
   TestStringValue("lower('Hello')", "hello");
   TestStringValue("lower('hello!')", "hello!");
   TestStringValue("lcase('HELLO')", "hello");
+  // More than 16 characters, with the characters around the letters.
+  TestStringValue("lower('@AZ[`az{ 0123 HELLO WORLD @AZ[`az{')",
+      "@az[`az{ 0123 hello world @az[`az{");
 
   TestStringValue("upper('')", "");
   TestStringValue("upper('HELLO')", "HELLO");
   TestStringValue("upper('Hello')", "HELLO");
   TestStringValue("upper('hello!')", "HELLO!");
   TestStringValue("ucase('hello')", "HELLO");
+  TestStringValue("upper('@AZ[`az{ 0123 hello world @AZ[`az{')",
+      "@AZ[`AZ{ 0123 HELLO WORLD @AZ[`AZ{");
 
-  TestValue("length('')", TYPE_INT, 0);
-  TestValue("length('a')", TYPE_INT, 1);
-  TestValue("length('abcdefg')", TYPE_INT, 7);
+  TestValue("length('')", TYPE_INT, 0, true);
+  TestValue("length('a')", TYPE_INT, 1, true);
+  TestValue("length('abcdefg')", TYPE_INT, 7, true);
 
   TestStringValue("reverse('abcdefg')", "gfedcba");
   TestStringValue("reverse('')", "");
@@ -1068,6 +1201,13 @@ TEST_F(ExprTest, StringFunctions) {
   TestStringValue("rtrim('abcdefg   ')", "abcdefg");
   TestStringValue("rtrim('   abcdefg')", "   abcdefg");
   TestStringValue("rtrim('abc  defg')", "abc  defg");
+  // Runs of more than 16 spaces.
+  string spaces(40, ' ');
+  TestStringValue("trim('" + spaces + "')", "");
+  TestStringValue("trim('" + spaces + "a b" + spaces + "')", "a b");
+  TestStringValue("ltrim('" + spaces + "a b" + spaces + "')", "a b" + spaces);
+  TestStringValue("rtrim('" + spaces + "a b" + spaces + "')", spaces + "a b");
+  TestStringValue("rtrim('abcdefghijklmnopq ')", "abcdefghijklmnopq");
 
   TestStringValue("space(0)", "");
   TestStringValue("space(-1)", "");
@@ -1104,18 +1244,18 @@ TEST_F(ExprTest, StringFunctions) {
 
   // Note that Hive returns positions starting from 1.
   // Hive returns 0 if substr was not found in str (or on other error coditions).
-  TestValue("instr('', '')", TYPE_INT, 0);
-  TestValue("instr('', 'abc')", TYPE_INT, 0);
-  TestValue("instr('abc', '')", TYPE_INT, 0);
-  TestValue("instr('abc', 'abc')", TYPE_INT, 1);
-  TestValue("instr('xyzabc', 'abc')", TYPE_INT, 4);
-  TestValue("instr('xyzabcxyz', 'bcx')", TYPE_INT, 5);
-  TestValue("locate('', '')", TYPE_INT, 0);
-  TestValue("locate('abc', '')", TYPE_INT, 0);
-  TestValue("locate('', 'abc')", TYPE_INT, 0);
-  TestValue("locate('abc', 'abc')", TYPE_INT, 1);
-  TestValue("locate('abc', 'xyzabc')", TYPE_INT, 4);
-  TestValue("locate('bcx', 'xyzabcxyz')", TYPE_INT, 5);
+  TestValue("instr('', '')", TYPE_INT, 0, true);
+  TestValue("instr('', 'abc')", TYPE_INT, 0, true);
+  TestValue("instr('abc', '')", TYPE_INT, 0, true);
+  TestValue("instr('abc', 'abc')", TYPE_INT, 1, true);
+  TestValue("instr('xyzabc', 'abc')", TYPE_INT, 4, true);
+  TestValue("instr('xyzabcxyz', 'bcx')", TYPE_INT, 5, true);
+  TestValue("locate('', '')", TYPE_INT, 0, true);
+  TestValue("locate('abc', '')", TYPE_INT, 0, true);
+  TestValue("locate('', 'abc')", TYPE_INT, 0, true);
+  TestValue("locate('abc', 'abc')", TYPE_INT, 1, true);
+  TestValue("locate('abc', 'xyzabc')", TYPE_INT, 4, true);
+  TestValue("locate('bcx', 'xyzabcxyz')", TYPE_INT, 5, true);
   // Test locate with starting pos param.
   // Note that Hive expects positions starting from 1 as input.
   TestValue("locate('', '', 0)", TYPE_INT, 0);
@@ -1684,6 +1824,13 @@ TEST_F(ExprTest, MathRoundingFunctions) {
 }
 
 TEST_F(ExprTest, TimestampFunctions) {
+  // Timestamps in and out of the "YYYY-MM-DD HH:MM:SS" format
+  TestStringValue("cast(cast('2012-02-29 23:59:58.123' as timestamp) as string)",
+      "2012-02-29 23:59:58.123000000");
+  TestStringValue("cast(cast(' 2012-02-29 23:59:58 ' as timestamp) as string)",
+      "2012-02-29 23:59:58");
+  TestStringValue("cast(cast('2012-02-29' as timestamp) as string)",
+      "2012-02-29 00:00:00");
   TestStringValue("cast(cast('2012-01-01 09:10:11.123456789' as timestamp) as string)",
       "2012-01-01 09:10:11.123456789");
   // Add/sub years.
@@ -1875,6 +2022,22 @@ TEST_F(ExprTest, TimestampFunctions) {
   TestStringValue("cast(from_utc_timestamp(cast(1.3041352164485E9 as timestamp), 'PST') "
       "as string)", "2011-04-29 20:46:56.448499917");
 
+  // Around the DST changes of 2011.
+  TestStringValue("cast(from_utc_timestamp(cast('2011-03-13 09:59:59' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-03-13 01:59:59");
+  TestStringValue("cast(from_utc_timestamp(cast('2011-03-13 10:00:00' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-03-13 03:00:00");
+  TestStringValue("cast(from_utc_timestamp(cast('2011-11-06 08:59:59' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-11-06 01:59:59");
+  TestStringValue("cast(from_utc_timestamp(cast('2011-11-06 09:00:00' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-11-06 01:00:00");
+  TestStringValue("cast(to_utc_timestamp(cast('2011-03-13 03:00:00' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-03-13 10:00:00");
+  TestStringValue("cast(to_utc_timestamp(cast('2011-07-01 12:00:00' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-07-01 19:00:00");
+  TestStringValue("cast(to_utc_timestamp(cast('2011-11-06 02:00:00' as timestamp), "
+      "'America/Los_Angeles') as string)", "2011-11-06 10:00:00");
+
   // Hive silently ignores bad timezones.  We log a problem.
   TestStringValue(
       "cast(from_utc_timestamp("
@@ -1975,34 +2138,61 @@ TEST_F(ExprTest, ConditionalFunctions) {
 
   // Test logic of case expr using int types.
   // The different types and casting are tested below.
-  TestValue("case when true then 1 end", TYPE_TINYINT, 1);
-  TestValue("case when false then 1 when true then 2 end", TYPE_TINYINT, 2);
+  TestValue("case when true then 1 end", TYPE_TINYINT, 1, true);
+  TestValue("case when false then 1 when true then 2 end", TYPE_TINYINT, 2, true);
   TestValue("case when false then 1 when false then 2 when true then 3 end",
       TYPE_TINYINT, 3);
   // Test else expr.
-  TestValue("case when false then 1 else 10 end", TYPE_TINYINT, 10);
-  TestValue("case when false then 1 when false then 2 else 10 end", TYPE_TINYINT, 10);
+  TestValue("case when false then 1 else 10 end", TYPE_TINYINT, 10, true);
+  TestValue("case when false then 1 when false then 2 else 10 end",
+      TYPE_TINYINT, 10, true);
   TestValue("case when false then 1 when false then 2 when false then 3 else 10 end",
       TYPE_TINYINT, 10);
   TestIsNull("case when false then 1 end", TYPE_TINYINT);
   // Test with case expr.
-  TestValue("case 21 when 21 then 1 end", TYPE_TINYINT, 1);
-  TestValue("case 21 when 20 then 1 when 21 then 2 end", TYPE_TINYINT, 2);
-  TestValue("case 21 when 20 then 1 when 19 then 2 when 21 then 3 end", TYPE_TINYINT, 3);
+  TestValue("case 21 when 21 then 1 end", TYPE_TINYINT, 1, true);
+  TestValue("case 21 when 20 then 1 when 21 then 2 end", TYPE_TINYINT, 2, true);
+  TestValue("case 21 when 20 then 1 when 19 then 2 when 21 then 3 end",
+      TYPE_TINYINT, 3, true);
+  // Enough constant when-exprs to look up the then-expr (see CaseExpr::Prepare()):
+  // dense ints, sparse ints, duplicates (the first when-expr wins), NULL when-exprs
+  // and strings.
+  string when_list = "when 1 then 11 when 2 then 12 when 3 then 13 when 4 then 14 "
+      "when 5 then 15 when 6 then 16 when 7 then 17 when 8 then 18";
+  TestValue("case 5 " + when_list + " end", TYPE_TINYINT, 15, true);
+  TestValue("case 1 " + when_list + " end", TYPE_TINYINT, 11, true);
+  TestValue("case 8 " + when_list + " end", TYPE_TINYINT, 18, true);
+  TestIsNull("case 9 " + when_list + " end", TYPE_TINYINT);
+  TestValue("case 0 " + when_list + " else 10 end", TYPE_TINYINT, 10, true);
+  TestValue("case NULL " + when_list + " else 10 end", TYPE_TINYINT, 10);
+  string sparse_list = "when 1 then 11 when 1000000 then 12 when -5 then 13 "
+      "when 70 then 14 when 1000000 then 15 when NULL then 16 when 7 then 17 "
+      "when 123456 then 18 when 9 then 19";
+  TestValue("case 1000000 " + sparse_list + " end", TYPE_TINYINT, 12, true);
+  TestValue("case -5 " + sparse_list + " end", TYPE_TINYINT, 13, true);
+  TestValue("case 9 " + sparse_list + " end", TYPE_TINYINT, 19, true);
+  TestValue("case 2 " + sparse_list + " else 10 end", TYPE_TINYINT, 10, true);
+  string str_when_list = "when 'a' then 1 when 'b' then 2 when 'c' then 3 "
+      "when 'abc' then 4 when 'e' then 5 when 'f' then 6 when 'a' then 7 "
+      "when 'h' then 8";
+  TestValue("case 'abc' " + str_when_list + " end", TYPE_TINYINT, 4, true);
+  TestValue("case 'a' " + str_when_list + " end", TYPE_TINYINT, 1, true);
+  TestValue("case 'ab' " + str_when_list + " else 10 end", TYPE_TINYINT, 10, true);
+  TestIsNull("case 'x' " + str_when_list + " end", TYPE_TINYINT);
   // Should skip when-exprs that are NULL
 #if 0
   TestIsNull("case when NULL then 1 end", TYPE_TINYINT);
   TestIsNull("case when NULL then 1 end else NULL end", TYPE_TINYINT);
-  TestValue("case when NULL then 1 else 2 end", TYPE_TINYINT, 2);
-  TestValue("case when NULL then 1 when true then 2 else 3 end", TYPE_TINYINT, 2);
+  TestValue("case when NULL then 1 else 2 end", TYPE_TINYINT, 2, true);
+  TestValue("case when NULL then 1 when true then 2 else 3 end", TYPE_TINYINT, 2, true);
 #endif
   // Should return else expr, if case-expr is NULL.
 #if 0
   TestIsNull("case NULL when 1 then 1 end", TYPE_TINYINT);
   TestIsNull("case NULL when 1 then 1 else NULL end", TYPE_TINYINT);
-  TestValue("case NULL when 1 then 1 else 2 end", TYPE_TINYINT, 2);
-  TestValue("case 10 when NULL then 1 else 2 end", TYPE_TINYINT, 2);
-  TestValue("case 10 when NULL then 1 when 10 then 2 else 3 end", TYPE_TINYINT, 2);
+  TestValue("case NULL when 1 then 1 else 2 end", TYPE_TINYINT, 2, true);
+  TestValue("case 10 when NULL then 1 else 2 end", TYPE_TINYINT, 2, true);
+  TestValue("case 10 when NULL then 1 when 10 then 2 else 3 end", TYPE_TINYINT, 2, true);
 #endif
 
   // Test all types in case/when exprs, without casts.
@@ -2095,6 +2285,16 @@ void ValidateLayout(const vector<Expr*>& exprs, int expected_byte_size,
   }
 }
 
+TEST_F(ExprTest, ConstantFolding) {
+  // Constant children are replaced by literals when the root is prepared, so the
+  // root can be codegen'd even if the child can't.
+  TestValue("length(concat('a', 'bc'))", TYPE_INT, 3, true);
+  EXPECT_EQ(executor_->select_list_exprs()[0]->GetChild(0)->GetNumChildren(), 0);
+  TestIsNull("length(regexp_extract('abxcy1234a', '(/.', 0))", TYPE_INT, true);
+  TestValue("year(cast('2011-12-22' as timestamp))", TYPE_INT, 2011);
+  EXPECT_EQ(executor_->select_list_exprs()[0]->GetChild(0)->GetNumChildren(), 0);
+}
+
 TEST_F(ExprTest, ResultsLayoutTest) {
   ObjectPool pool;
 
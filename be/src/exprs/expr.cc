@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <sstream>
+#include <gflags/gflags.h>
 
 #include "codegen/llvm-codegen.h"
 #include "common/object-pool.h"
@@ -39,8 +40,10 @@
 #include "exprs/timestamp-literal.h"
 #include "gen-cpp/Exprs_types.h"
 #include "gen-cpp/Data_types.h"
-#include "runtime/runtime-state.h"
+#include "runtime/mem-pool.h"
 #include "runtime/raw-value.h"
+#include "runtime/row-batch.h"
+#include "runtime/runtime-state.h"
 
 #include "gen-cpp/Exprs_types.h"
 #include "gen-cpp/ImpalaService_types.h"
@@ -49,6 +52,9 @@ using namespace std;
 using namespace impala;
 using namespace llvm;
 
+DEFINE_bool(fold_constant_exprs, true, "if true, constant subexpressions are "
+    "evaluated once when the exprs are prepared and replaced by literals");
+
 const char* Expr::LLVM_CLASS_NAME = "class.impala::Expr";
 
 template<class T>
@@ -90,6 +96,58 @@ void* ExprValue::TryParse(const string& str, PrimitiveType type) {
   return NULL;
 }
 
+ExprColumn::ExprColumn()
+  : type_(INVALID_TYPE),
+    byte_size_(0),
+    num_values_(0),
+    data_capacity_(0),
+    null_capacity_(0) {
+}
+
+ExprColumn::~ExprColumn() {
+}
+
+void ExprColumn::Reset(PrimitiveType type, int num_values) {
+  type_ = type;
+  byte_size_ = type == TYPE_STRING ? sizeof(StringValue) : GetByteSize(type);
+  num_values_ = num_values;
+  int num_bytes = num_values * byte_size_;
+  if (num_bytes > data_capacity_) {
+    data_.reset(new uint8_t[num_bytes]);
+    data_capacity_ = num_bytes;
+  }
+  if (num_values > null_capacity_) {
+    is_null_.reset(new uint8_t[num_values]);
+    null_capacity_ = num_values;
+  }
+  if (string_pool_.get() != NULL) string_pool_->Clear();
+}
+
+void ExprColumn::SetValue(int i, const void* value) {
+  DCHECK_LT(i, num_values_);
+  uint8_t* dst = data_.get() + i * byte_size_;
+  if (value == NULL) {
+    is_null_[i] = 1;
+    memset(dst, 0, byte_size_);
+    return;
+  }
+  is_null_[i] = 0;
+  if (type_ == TYPE_STRING) {
+    const StringValue* src = reinterpret_cast<const StringValue*>(value);
+    StringValue* str = reinterpret_cast<StringValue*>(dst);
+    str->ptr = reinterpret_cast<char*>(string_pool()->Allocate(src->len));
+    str->len = src->len;
+    memcpy(str->ptr, src->ptr, src->len);
+  } else {
+    memcpy(dst, value, byte_size_);
+  }
+}
+
+MemPool* ExprColumn::string_pool() {
+  if (string_pool_.get() == NULL) string_pool_.reset(new MemPool());
+  return string_pool_.get();
+}
+
 Expr::Expr(PrimitiveType type, bool is_slotref)
     : opcode_(TExprOpcode::INVALID_OPCODE),
       is_slotref_(is_slotref),
@@ -145,6 +203,9 @@ Expr* Expr::CreateLiteral(ObjectPool* pool, PrimitiveType type, void* data) {
     case TYPE_STRING:
       result = new StringLiteral(*reinterpret_cast<StringValue*>(data));
       break;
+    case TYPE_TIMESTAMP:
+      result = new TimestampLiteral(*reinterpret_cast<TimestampValue*>(data));
+      break;
     default:
       DCHECK(false) << "Invalid type.";
   }
@@ -472,6 +533,45 @@ void Expr::GetValue(TupleRow* row, bool as_ascii, TColumnValue* col_val) {
   }
 }
 
+void Expr::GetValues(RowBatch* batch, const int* sel, int num_rows, ExprColumn* result) {
+  DCHECK(type_ != INVALID_TYPE);
+  result->Reset(type_, num_rows);
+  if (num_rows == 0) return;
+  EvalBatch(batch, sel, num_rows, result);
+}
+
+void Expr::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  for (int i = 0; i < num_rows; ++i) {
+    TupleRow* row = batch->GetRow(sel == NULL ? i : sel[i]);
+    result->SetValue(i, GetValue(row));
+  }
+}
+
+void Expr::EvalConstantBatch(int num_rows, ExprColumn* result) {
+  result->SetValue(0, GetValue(NULL));
+  // the string data (if any) was copied once, the StringValue can be shared
+  uint8_t* value = reinterpret_cast<uint8_t*>(result->GetValue(0));
+  int byte_size = type_ == TYPE_STRING ? sizeof(StringValue) : GetByteSize(type_);
+  for (int i = 1; i < num_rows; ++i) {
+    if (value == NULL) {
+      result->SetValue(i, NULL);
+    } else {
+      result->is_null()[i] = 0;
+      memcpy(value + i * byte_size, value, byte_size);
+    }
+  }
+}
+
+void Expr::GetChildValues(RowBatch* batch, const int* sel, int num_rows) {
+  if (child_results_.get() == NULL) {
+    child_results_.reset(new ExprColumn[children_.size()]);
+  }
+  for (int i = 0; i < children_.size(); ++i) {
+    children_[i]->GetValues(batch, sel, num_rows, &child_results_[i]);
+  }
+}
+
 void Expr::PrintValue(TupleRow* row, string* str) {
   RawValue::PrintValue(GetValue(row), type(), str);
 }
@@ -492,10 +592,56 @@ Status Expr::PrepareChildren(RuntimeState* state, const RowDescriptor& row_desc)
   DCHECK(type_ != INVALID_TYPE);
   for (int i = 0; i < children_.size(); ++i) {
     RETURN_IF_ERROR(children_[i]->Prepare(state, row_desc));
+    // state is only NULL in tests, which don't need the folding.
+    if (FLAGS_fold_constant_exprs && state != NULL && children_[i]->IsFoldable()) {
+      RETURN_IF_ERROR(children_[i]->FoldConstant(state, row_desc, &children_[i]));
+    }
   }
   return Status::OK;
 }
 
+bool Expr::IsFoldable() const {
+  // Literals are already folded.
+  if (children_.empty()) return false;
+  switch (type_) {
+    case TYPE_BOOLEAN:
+    case TYPE_TINYINT:
+    case TYPE_SMALLINT:
+    case TYPE_INT:
+    case TYPE_BIGINT:
+    case TYPE_FLOAT:
+    case TYPE_DOUBLE:
+    case TYPE_STRING:
+    case TYPE_TIMESTAMP:
+      break;
+    default:
+      return false;
+  }
+  return IsConstant() && IsDeterministic();
+}
+
+Status Expr::FoldConstant(RuntimeState* state, const RowDescriptor& row_desc,
+    Expr** literal) {
+  // The literal copies the value, which may be in this expr's result_.
+  void* value = GetValue(NULL);
+  if (value == NULL) {
+    *literal = state->obj_pool()->Add(new NullLiteral(type_));
+  } else {
+    *literal = CreateLiteral(state->obj_pool(), type_, value);
+  }
+  return (*literal)->Prepare(state, row_desc);
+}
+
+bool Expr::IsDeterministic() const {
+  if (opcode_ == TExprOpcode::MATH_RAND || opcode_ == TExprOpcode::MATH_RAND_INT) {
+    return false;
+  }
+  for (int i = 0; i < children_.size(); ++i) {
+    if (!children_[i]->IsDeterministic()) return false;
+  }
+  return true;
+}
+
 Status Expr::Prepare(Expr* root, RuntimeState* state, const RowDescriptor& row_desc,
     bool disable_codegen) {
   RETURN_IF_ERROR(root->Prepare(state, row_desc));
@@ -18,6 +18,8 @@
 
 #include <string>
 #include <vector>
+#include <boost/scoped_array.hpp>
+#include <boost/scoped_ptr.hpp>
 
 #include "common/status.h"
 #include "gen-cpp/Opcodes_types.h"
@@ -38,7 +40,9 @@ namespace impala {
 
 class Expr;
 class LlvmCodeGen;
+class MemPool;
 class ObjectPool;
+class RowBatch;
 class RowDescriptor;
 class RuntimeState;
 class TColumnValue;
@@ -204,6 +208,61 @@ struct ExprValue {
   }
 };
 
+// The results of evaluating an expr over a selection of rows of a RowBatch with
+// Expr::GetValues(): the i-th value belongs to the i-th selected row.
+// Values are stored densely by type (ie, values<int32_t>() for TYPE_INT, values<bool>()
+// for TYPE_BOOLEAN, etc.) next to an array of null indicators, so callers can iterate
+// over them with simple typed loops.  Null values hold an unspecified (but
+// initialized) value, so loops may compute every position without branching.
+// String values either point into the evaluated batch or into string_pool(); they
+// stay valid until the column is reset.
+class ExprColumn {
+ public:
+  ExprColumn();
+  ~ExprColumn();
+
+  // Makes room for 'num_values' values of 'type'.  Previous values, including the
+  // string data in string_pool(), are discarded; storage is reused when possible.
+  void Reset(PrimitiveType type, int num_values);
+
+  // Sets the i-th value to a copy of 'value', which is NULL for a SQL NULL.
+  // String data is copied into string_pool().
+  void SetValue(int i, const void* value);
+
+  // Returns a pointer to the i-th value, or NULL if it is NULL, like Expr::GetValue().
+  void* GetValue(int i) {
+    DCHECK_LT(i, num_values_);
+    return is_null_[i] ? NULL : data_.get() + i * byte_size_;
+  }
+
+  template <typename T> T* values() {
+    DCHECK_EQ(sizeof(T), byte_size_);
+    return reinterpret_cast<T*>(data_.get());
+  }
+
+  // Non-zero for NULL values.
+  uint8_t* is_null() { return is_null_.get(); }
+
+  PrimitiveType type() const { return type_; }
+  int num_values() const { return num_values_; }
+
+  MemPool* string_pool();
+
+ private:
+  PrimitiveType type_;
+  int byte_size_;
+  int num_values_;
+  int data_capacity_;  // in bytes
+  int null_capacity_;
+  boost::scoped_array<uint8_t> data_;
+  boost::scoped_array<uint8_t> is_null_;
+  boost::scoped_ptr<MemPool> string_pool_;
+
+  // not copyable; exprs own their scratch columns
+  ExprColumn(const ExprColumn&);
+  ExprColumn& operator=(const ExprColumn&);
+};
+
 // This is the superclass of all expr evaluation nodes.
 class Expr {
  public:
@@ -229,6 +288,16 @@ class Expr {
   // TYPE_STRING: stringVal
   void GetValue(TupleRow* row, bool as_ascii, TColumnValue* col_val);
 
+  // Evaluates the expr over 'num_rows' rows of 'batch' at once and writes the result
+  // for the i-th of them into position i of 'result'.  The rows are given by their
+  // indexes in 'sel' (a selection vector), or are the first 'num_rows' rows of the
+  // batch if 'sel' is NULL.
+  // This is the interpreted alternative to calling GetValue() for every row: arithmetic
+  // exprs, binary predicates, casts between numeric types and slot refs evaluate their
+  // children into scratch columns and then compute all results in one typed loop.
+  // Other exprs fall back to one GetValue() call per row.
+  void GetValues(RowBatch* batch, const int* sel, int num_rows, ExprColumn* result);
+
   // Convenience functions: print value into 'str' or 'stream'.
   // NULL turns into "NULL".
   void PrintValue(TupleRow* row, std::string* str);
@@ -250,6 +319,10 @@ class Expr {
   // the children are constant.
   virtual bool IsConstant() const;
 
+  // Returns false if this expr or one below it returns a different value every time
+  // it is evaluated (rand()).
+  bool IsDeterministic() const;
+
   // Returns the slots that are referenced by this expr tree in 'slot_ids'.
   // Returns the number of slots added to the vector 
   virtual int GetSlotIds(std::vector<SlotId>* slot_ids) const;
@@ -355,6 +428,7 @@ class Expr {
   friend class CaseExpr;
   friend class InPredicate;
   friend class FunctionCall;
+  friend class SharedExpr;
 
   Expr(PrimitiveType type, bool is_slotref = false);
   Expr(const TExprNode& node, bool is_slotref = false);
@@ -365,9 +439,33 @@ class Expr {
 
   // Helper function that just calls prepare on all the children
   // Does not do anything on the this expr.
+  // Children that are constant (see IsFoldable()) are evaluated once and replaced
+  // by a literal of their value, so they are not evaluated again for every row and
+  // this expr's Prepare() and Codegen() see the literal.
   // Return OK if successful, otherwise return error status.
   Status PrepareChildren(RuntimeState* state, const RowDescriptor& row_desc);
 
+  // Returns true if this expr is not a literal, is constant and deterministic, and
+  // has a type that there are literals for.
+  bool IsFoldable() const;
+
+  // Evaluates this prepared expr and returns a prepared literal of its value, which is
+  // allocated from state's pool, in 'literal'.
+  Status FoldConstant(RuntimeState* state, const RowDescriptor& row_desc,
+      Expr** literal);
+
+  // Computes GetValues() into 'result', which has already been reset to type_ and
+  // 'num_rows' values.  The default implementation calls GetValue() for every row.
+  // Subclasses that override this typically call GetChildValues() first.
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
+
+  // EvalBatch() for literals: computes GetValue(NULL) once and repeats it.
+  void EvalConstantBatch(int num_rows, ExprColumn* result);
+
+  // Evaluates all children with GetValues() into child_results_.
+  void GetChildValues(RowBatch* batch, const int* sel, int num_rows);
+
   // function to evaluate expr; typically set in Prepare()
   ComputeFn compute_fn_;
 
@@ -381,6 +479,10 @@ class Expr {
   std::vector<Expr*> children_;
   ExprValue result_;
 
+  // Scratch columns for the results of children_, one per child; allocated by the
+  // first GetChildValues() call.
+  boost::scoped_array<ExprColumn> child_results_;
+
   // Codegened IR function.  Will be NULL if this expr was not codegen'd.
   llvm::Function* codegen_fn_;
 
@@ -475,7 +577,18 @@ class SlotRef : public Expr {
 
   virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
 
+  // -1 for slot refs created with the test c'tor.
+  SlotId slot_id() const { return slot_id_; }
+
  protected:
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
+
+  // Copies the slot values of the selected rows into 'values'.
+  template <typename T>
+  void GatherValues(RowBatch* batch, const int* sel, int num_rows, T* values,
+      uint8_t* is_null);
+
   int tuple_idx_;  // within row
   int slot_offset_;  // within tuple
   NullIndicatorOffset null_indicator_offset_;  // within tuple
@@ -14,6 +14,8 @@
 
 #include "float-literal.h"
 
+#include <iomanip>
+#include <limits>
 #include <sstream>
 
 #include "codegen/llvm-codegen.h"
@@ -82,11 +84,12 @@ string FloatLiteral::DebugString() const {
   stringstream out;
   out << "FloatLiteral(value=";
   switch (type_) {
+    // Print enough digits to tell any two values apart.
     case TYPE_FLOAT:
-      out << result_.float_val;
+      out << setprecision(numeric_limits<float>::digits10 + 2) << result_.float_val;
       break;
     case TYPE_DOUBLE:
-      out << result_.double_val;
+      out << setprecision(numeric_limits<double>::digits10 + 2) << result_.double_val;
       break;
     default:
       DCHECK(false) << "FloatLiteral::Prepare(): bad type: " << TypeToString(type_);
@@ -12,11 +12,14 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <algorithm>
+#include <cstring>
 #include <sstream>
 #include <string>
 
 #include "codegen/llvm-codegen.h"
 #include "exprs/function-call.h"
+#include "exprs/timestamp-functions.h"
 #include "runtime/runtime-state.h"
 
 using namespace llvm;
@@ -27,7 +30,7 @@ using namespace boost;
 namespace impala {
 
 FunctionCall::FunctionCall(const TExprNode& node)
-  : Expr(node), regex_(NULL) {
+  : Expr(node), timezone_table_(NULL), timezone_hint_(0) {
 }
 
 Status FunctionCall::Prepare(RuntimeState* state, const RowDescriptor& row_desc) {
@@ -38,6 +41,29 @@ Status FunctionCall::Prepare(RuntimeState* state, const RowDescriptor& row_desc)
     DCHECK(!state->now()->NotADateTime());
     result_.timestamp_val = *(state->now());
   }
+  // Look up a constant timezone once instead of for every row.
+  if ((opcode_ == TExprOpcode::FROM_UTC_TIMESTAMP ||
+       opcode_ == TExprOpcode::TO_UTC_TIMESTAMP) && children_[1]->IsConstant()) {
+    StringValue* tz = reinterpret_cast<StringValue*>(children_[1]->GetValue(NULL));
+    if (tz != NULL) timezone_table_ = TimezoneDatabase::FindTable(tz->DebugString());
+  }
+  // Likewise, precompute the search for a constant substring.
+  int substr_idx = -1;
+  if (opcode_ == TExprOpcode::STRING_INSTR) {
+    substr_idx = 1;
+  } else if (opcode_ == TExprOpcode::STRING_LOCATE_STRINGVALUE_STRINGVALUE ||
+      opcode_ == TExprOpcode::STRING_LOCATE_STRINGVALUE_STRINGVALUE_INT) {
+    substr_idx = 0;
+  }
+  if (substr_idx >= 0 && children_[substr_idx]->IsConstant()) {
+    StringValue* substr =
+        reinterpret_cast<StringValue*>(children_[substr_idx]->GetValue(NULL));
+    if (substr != NULL) {
+      substr_data_.assign(substr->ptr, substr->len);
+      substr_ = StringValue(const_cast<char*>(substr_data_.data()), substr_data_.size());
+      substr_search_.reset(new StringSearch(&substr_));
+    }
+  }
   return Status::OK;
 }
 
@@ -47,47 +73,67 @@ string FunctionCall::DebugString() const {
   return out.str();
 }
 
-bool FunctionCall::SetRegex(const string& pattern) {
+const regex* FunctionCall::GetRegex(const StringValue& pattern) {
+  for (RegexCache::iterator it = regex_cache_.begin(); it != regex_cache_.end(); ++it) {
+    const string& cached = it->first;
+    if (cached.size() == pattern.len &&
+        memcmp(cached.data(), pattern.ptr, pattern.len) == 0) {
+      if (it != regex_cache_.begin()) {
+        regex_cache_.splice(regex_cache_.begin(), regex_cache_, it);
+      }
+      return it->second.get();
+    }
+  }
+
+  string pattern_str(pattern.ptr, pattern.len);
+  shared_ptr<regex> re;
   try {
-    regex_.reset(new regex(pattern, regex_constants::extended));
+    re.reset(new regex(pattern_str, regex_constants::extended));
   } catch(bad_expression& e) {
-    return false;
+    // cached as NULL
   }
-  return true;
+  if (regex_cache_.size() >= REGEX_CACHE_SIZE) regex_cache_.pop_back();
+  regex_cache_.push_front(make_pair(pattern_str, re));
+  return re.get();
 }
 
 void FunctionCall::SetReplaceStr(const StringValue* str_val) {
   replace_str_.reset(new string(str_val->ptr, str_val->len));
 }
 
-// IR generation for generic function calls.
-// for sqrt, the IR looks like:
+// IR generation for function calls.  Only functions that don't need to allocate
+// their result are supported: the string functions returning an int and sqrt.
+// The children are evaluated in order and a null child makes the result null.
+// For length(a), the IR looks like:
 //
-// define double @FunctionCall(i8** %row, i8* %state_data, i1* %is_null) {
+// define i32 @FunctionCall(i8** %row, i8* %state_data, i1* %is_null) {
 // entry:
-//   %child_result = call double @FloatLiteral(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_result = call %"struct.impala::StringValue"* @SlotRef(i8** %row,
+//       i8* %state_data, i1* %is_null)
 //   %child_null = load i1* %is_null
 //   br i1 %child_null, label %ret_block, label %not_null_block
-// 
+//
 // not_null_block:                                   ; preds = %entry
-//   %tmp_sqrt = call double @sqrt(double %child_result)
+//   %len_ptr = getelementptr inbounds %"struct.impala::StringValue"* %child_result,
+//       i32 0, i32 1
+//   %tmp_length = load i32* %len_ptr
 //   br label %ret_block
-// 
+//
 // ret_block:                                        ; preds = %not_null_block, %entry
-//   %tmp_phi = phi double [ 0.000000e+00, %entry ], [ %tmp_sqrt, %not_null_block ]
-//   ret double %tmp_phi
+//   %tmp_phi = phi i32 [ 0, %entry ], [ %tmp_length, %not_null_block ]
+//   ret i32 %tmp_phi
 // }
-//
-// TODO: this is still prototypey and needs to be made more generic to handle
-// other functions with different signatures.
 Function* FunctionCall::Codegen(LlvmCodeGen* codegen) {
-  return NULL;
-#if 0
-// TODO: This is currently written to bail out halfway through if the function
-// is not supported (only sqrt is).  This leaves zombie functions in the module
-// and llvm does not like that.
-  LLVMContext& context = codegen->context();
-  LlvmCodeGen::LlvmBuilder builder(context);
+  switch (op()) {
+    case TExprOpcode::MATH_SQRT:
+    case TExprOpcode::STRING_LENGTH:
+    case TExprOpcode::STRING_INSTR:
+    case TExprOpcode::STRING_LOCATE_STRINGVALUE_STRINGVALUE:
+      break;
+    default:
+      // Not supported.  Bail out before creating any function for this expr.
+      return NULL;
+  }
 
   // Generate child functions
   for (int i = 0; i < GetNumChildren(); ++i) {
@@ -95,51 +141,69 @@ Function* FunctionCall::Codegen(LlvmCodeGen* codegen) {
     if (child == NULL) return NULL;
   }
 
-  Type* return_type = codegen->GetType(type());
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Type* return_type = GetLlvmReturnType(codegen);
   Function* function = CreateComputeFnPrototype(codegen, "FunctionCall");
   BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
-
-  BasicBlock* not_null_block = BasicBlock::Create(context, "not_null_block", function);
   BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
 
-  builder.SetInsertPoint(entry_block);
-  scoped_ptr<LlvmCodeGen::FnPrototype> prototype;
-  Type* ret_type = NULL;
+  builder.SetInsertPoint(ret_block);
+  PHINode* phi_node =
+      builder.CreatePHI(return_type, GetNumChildren() + 1, "tmp_phi");
+
+  // Call the child functions, each one in the not null block of the previous one.
+  vector<Value*> args;
+  BasicBlock* child_block = entry_block;
+  for (int i = 0; i < GetNumChildren(); ++i) {
+    BasicBlock* not_null_block = BasicBlock::Create(context, "not_null_block",
+        function, ret_block);
+    args.push_back(children()[i]->CodegenGetValue(
+        codegen, child_block, ret_block, not_null_block));
+    phi_node->addIncoming(GetNullReturnValue(codegen), child_block);
+    child_block = not_null_block;
+  }
+
+  builder.SetInsertPoint(child_block);
   Value* result = NULL;
   switch (op()) {
     case TExprOpcode::MATH_SQRT: {
-      ret_type = codegen->double_type();
-      prototype.reset(new LlvmCodeGen::FnPrototype(codegen, "sqrt", ret_type));
-      prototype->AddArgument(LlvmCodeGen::NamedVariable("x", codegen->double_type()));
+      LlvmCodeGen::FnPrototype prototype(codegen, "sqrt", codegen->double_type());
+      prototype.AddArgument(LlvmCodeGen::NamedVariable("x", codegen->double_type()));
+      Function* sqrt_fn = codegen->GetLibCFunction(&prototype);
+      result = builder.CreateCall(sqrt_fn, args[0], "tmp_sqrt");
+      break;
+    }
+    case TExprOpcode::STRING_LENGTH:
+      result = builder.CreateLoad(
+          builder.CreateStructGEP(args[0], 1, "len_ptr"), "tmp_length");
+      break;
+    case TExprOpcode::STRING_INSTR:
+    case TExprOpcode::STRING_LOCATE_STRINGVALUE_STRINGVALUE: {
+      // instr(str, substr) and locate(substr, str).  Hive returns positions starting
+      // from 1 and 0 if there is no match.
+      Value* str = args[0];
+      Value* substr = args[1];
+      if (op() == TExprOpcode::STRING_LOCATE_STRINGVALUE_STRINGVALUE) {
+        swap(str, substr);
+      }
+      Function* find_fn = codegen->GetFunction(IRFunction::STRING_VALUE_FIND);
+      Value* offset = builder.CreateCall2(find_fn, str, substr, "offset");
+      result = builder.CreateAdd(offset, codegen->GetIntConstant(TYPE_INT, 1),
+          "tmp_position");
       break;
     }
     default:
+      DCHECK(false) << "Unknown op: " << op();
       return NULL;
   }
-
-  Function* external_function = codegen->GetLibCFunction(prototype.get());
-
-  // Call child functions.  TODO: this needs to be an IR loop over all children
-  DCHECK_EQ(GetNumChildren(), 1);
-  vector<Value*> args;
-  args.resize(GetNumChildren());
-  for (int i = 0; i < GetNumChildren(); ++i) {
-    args[i] = children()[i]->CodegenGetValue(
-        codegen, entry_block, ret_block, not_null_block);
-  }
-
-  builder.SetInsertPoint(not_null_block);
-  result = builder.CreateCall(external_function, args, "tmp_" + prototype->name());
   builder.CreateBr(ret_block);
+  phi_node->addIncoming(result, child_block);
 
   builder.SetInsertPoint(ret_block);
-  PHINode* phi_node = builder.CreatePHI(return_type, 2, "tmp_phi");
-  phi_node->addIncoming(GetNullReturnValue(codegen), entry_block);
-  phi_node->addIncoming(result, not_null_block);
   builder.CreateRet(phi_node);
 
   return codegen->FinalizeFunction(function);
-#endif
 }
 
 }
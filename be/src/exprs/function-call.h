@@ -16,16 +16,21 @@
 #ifndef IMPALA_EXPRS_FUNCTION_CALL_H_
 #define IMPALA_EXPRS_FUNCTION_CALL_H_
 
+#include <list>
 #include <string>
+#include <utility>
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/regex.hpp>
 
 #include "exprs/expr.h"
+#include "runtime/string-search.h"
 
 namespace impala {
 
 class TExprNode;
 class RuntimeState;
+class TimezoneTable;
 
 class FunctionCall: public Expr {
  public:
@@ -34,24 +39,47 @@ class FunctionCall: public Expr {
  protected:
   friend class Expr;
   friend class StringFunctions;
+  friend class TimestampFunctions;
 
   FunctionCall(const TExprNode& node);
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
   virtual std::string DebugString() const;
 
-  // Returns false if the pattern is invalid, true otherwise.
-  bool SetRegex(const std::string& pattern);
-  const boost::regex* GetRegex() const { return regex_.get(); }
+  // Returns the compiled regex for 'pattern', or NULL if the pattern is invalid.
+  // The REGEX_CACHE_SIZE most recently used patterns stay compiled, so that patterns
+  // that aren't constant (e.g. come from a column or a CASE) are only recompiled if
+  // they don't repeat within a few rows.
+  const boost::regex* GetRegex(const StringValue& pattern);
 
   void SetReplaceStr(const StringValue* str_val);
   const std::string* GetReplaceStr() const { return replace_str_.get(); }
 
+  // The search for the substring of instr() and locate(), or NULL if the substring
+  // isn't constant.
+  const StringSearch* substr_search() const { return substr_search_.get(); }
+
  private:
-  // Used in regexp string functions to avoid re-compiling
-  // a constant regexp for every function invocation.
-  boost::scoped_ptr<boost::regex> regex_;
+  static const int REGEX_CACHE_SIZE = 16;
+
+  // Used in regexp string functions to avoid re-compiling the regexps for every
+  // function invocation: the compiled patterns, most recently used first.  Invalid
+  // patterns are kept with a NULL regex.
+  typedef std::list<std::pair<std::string, boost::shared_ptr<boost::regex> > >
+      RegexCache;
+  RegexCache regex_cache_;
   // To avoid copying constant replace strings in regexp_replace.
   boost::scoped_ptr<std::string> replace_str_;
+
+  // Used in instr() and locate() to set up the search for a constant substring once
+  // in Prepare().  substr_ points to substr_data_, the copy of the substring.
+  std::string substr_data_;
+  StringValue substr_;
+  boost::scoped_ptr<StringSearch> substr_search_;
+
+  // Used in from/to_utc_timestamp(): the table of a constant timezone, which is looked
+  // up in Prepare(), and the interval of the last conversion (see TimezoneTable).
+  const TimezoneTable* timezone_table_;
+  int timezone_hint_;
 };
 
 }
@@ -13,24 +13,54 @@
 // limitations under the License.
 
 #include <sstream>
+#include <llvm/ExecutionEngine/ExecutionEngine.h>
 
+#include "codegen/llvm-codegen.h"
 #include "exprs/in-predicate.h"
 #include "runtime/raw-value.h"
 #include "runtime/string-value.inline.h"
 
+using namespace llvm;
 using namespace std;
 
 namespace impala {
 
+size_t InPredicate::ValueHash::operator()(const void* value) const {
+  return RawValue::GetHashValue(value, type);
+}
+
+bool InPredicate::ValueEq::operator()(const void* v1, const void* v2) const {
+  return RawValue::Eq(v1, v2, type);
+}
+
 InPredicate::InPredicate(const TExprNode& node)
   : Predicate(node),
-    is_not_in_(node.in_predicate.is_not_in) {
+    is_not_in_(node.in_predicate.is_not_in),
+    value_set_has_null_(false) {
 }
 
 Status InPredicate::Prepare(RuntimeState* state, const RowDescriptor& desc) {
   DCHECK_GE(children_.size(), 2);
-  Expr::PrepareChildren(state, desc);
+  RETURN_IF_ERROR(Expr::PrepareChildren(state, desc));
   compute_fn_ = ComputeFn;
+
+  int num_values = GetNumChildren() - 1;
+  if (num_values < MIN_VALUE_SET_SIZE) return Status::OK;
+  for (int i = 1; i < GetNumChildren(); ++i) {
+    if (!GetChild(i)->IsConstant()) return Status::OK;
+  }
+  PrimitiveType type = GetChild(0)->type();
+  value_set_.reset(new ValueSet(num_values, ValueHash(type), ValueEq(type)));
+  for (int i = 1; i < GetNumChildren(); ++i) {
+    DCHECK_EQ(type, GetChild(i)->type());
+    void* value = GetChild(i)->GetValue(NULL);
+    if (value == NULL) {
+      value_set_has_null_ = true;
+    } else {
+      value_set_->insert(value);
+    }
+  }
+  compute_fn_ = SetComputeFn;
   return Status::OK;
 }
 
@@ -69,4 +99,221 @@ void* InPredicate::ComputeFn(Expr* e, TupleRow* row) {
   return &e->result_.bool_val;
 }
 
+void* InPredicate::SetComputeFn(Expr* e, TupleRow* row) {
+  void* cmp_val = e->children()[0]->GetValue(row);
+  if (cmp_val == NULL) return NULL;
+  InPredicate* in_pred = static_cast<InPredicate*>(e);
+  if (SetContains(in_pred, cmp_val)) {
+    e->result_.bool_val = !in_pred->is_not_in_;
+    return &e->result_.bool_val;
+  }
+  if (in_pred->value_set_has_null_) return NULL;
+  e->result_.bool_val = in_pred->is_not_in_;
+  return &e->result_.bool_val;
+}
+
+bool InPredicate::SetContains(const InPredicate* pred, const void* value) {
+  return pred->value_set_->find(value) != pred->value_set_->end();
+}
+
+// IR generation for in predicates.  The list values are compared one after the
+// other, tracking in a phi node whether a null list value was seen.  If there is no
+// match, the result is null if a list value was null.
+// For "a in (1, 2)", the IR looks like:
+//
+// define i1 @InPredicate(i8** %row, i8* %state_data, i1* %is_null) {
+// entry:
+//   %child_result = call i32 @SlotRef(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_null = load i1* %is_null
+//   br i1 %child_null, label %ret_block, label %in_list1
+//
+// in_list1:                                         ; preds = %entry
+//   %found_null = phi i1 [ false, %entry ]
+//   %child_result1 = call i32 @IntLiteral(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_null2 = load i1* %is_null
+//   br i1 %child_null2, label %in_list2, label %compare1
+//
+// compare1:                                         ; preds = %in_list1
+//   %tmp_eq = icmp eq i32 %child_result, %child_result1
+//   br i1 %tmp_eq, label %found, label %in_list2
+//
+// in_list2:                                         ; preds = %compare1, %in_list1
+//   %found_null3 = phi i1 [ true, %in_list1 ], [ %found_null, %compare1 ]
+//   ...
+//
+// found:                                            ; preds = %compare2, %compare1
+//   store i1 false, i1* %is_null
+//   br label %ret_block
+//
+// not_found:                                        ; preds = %compare2, %in_list2
+//   %found_null6 = phi i1 [ true, %in_list2 ], [ %found_null3, %compare2 ]
+//   store i1 %found_null6, i1* %is_null
+//   br label %ret_block
+//
+// ret_block:                                        ; preds = %not_found, %found, %entry
+//   %tmp_phi = phi i1 [ false, %entry ], [ true, %found ], [ false, %not_found ]
+//   ret i1 %tmp_phi
+// }
+Function* InPredicate::Codegen(LlvmCodeGen* codegen) {
+  if (value_set_.get() != NULL) return CodegenSetLookup(codegen);
+  int num_children = GetNumChildren();
+  DCHECK_GE(num_children, 2);
+  for (int i = 0; i < num_children; ++i) {
+    if (children()[i]->Codegen(codegen) == NULL) return NULL;
+  }
+  PrimitiveType type = children()[0]->type();
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Function* function = CreateComputeFnPrototype(codegen, "InPredicate");
+  Function::arg_iterator fn_args = function->arg_begin();
+  ++fn_args;
+  ++fn_args;
+  Value* is_null_ptr = fn_args;
+
+  BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  // in_list_blocks[i] evaluates child i.  The last block is reached if no value matches.
+  vector<BasicBlock*> in_list_blocks(num_children + 1);
+  vector<PHINode*> found_null_phis(num_children + 1);
+  for (int i = 1; i <= num_children; ++i) {
+    stringstream name;
+    if (i < num_children) {
+      name << "in_list" << i;
+    } else {
+      name << "not_found";
+    }
+    in_list_blocks[i] = BasicBlock::Create(context, name.str(), function);
+    found_null_phis[i] = PHINode::Create(codegen->GetType(TYPE_BOOLEAN), 2,
+        "found_null", in_list_blocks[i]);
+  }
+  BasicBlock* found_block = BasicBlock::Create(context, "found", function);
+  BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
+
+  // A null value is not in any list
+  Value* cmp_val = children()[0]->CodegenGetValue(codegen, entry_block,
+      ret_block, in_list_blocks[1]);
+  found_null_phis[1]->addIncoming(codegen->false_value(), entry_block);
+
+  for (int i = 1; i < num_children; ++i) {
+    DCHECK_EQ(type, children()[i]->type());
+    stringstream name;
+    name << "compare" << i;
+    BasicBlock* compare_block =
+        BasicBlock::Create(context, name.str(), function, in_list_blocks[i + 1]);
+    Value* in_list_val = children()[i]->CodegenGetValue(codegen, in_list_blocks[i],
+        in_list_blocks[i + 1], compare_block);
+    found_null_phis[i + 1]->addIncoming(codegen->true_value(), in_list_blocks[i]);
+
+    builder.SetInsertPoint(compare_block);
+    Value* eq = codegen->CodegenEquals(&builder, cmp_val, in_list_val, type);
+    builder.CreateCondBr(eq, found_block, in_list_blocks[i + 1]);
+    found_null_phis[i + 1]->addIncoming(found_null_phis[i], compare_block);
+  }
+
+  // The children may have set is_null, the result of the compares is not null.
+  builder.SetInsertPoint(found_block);
+  builder.CreateStore(codegen->false_value(), is_null_ptr);
+  builder.CreateBr(ret_block);
+
+  BasicBlock* not_found_block = in_list_blocks[num_children];
+  builder.SetInsertPoint(not_found_block);
+  builder.CreateStore(found_null_phis[num_children], is_null_ptr);
+  builder.CreateBr(ret_block);
+
+  Value* found_val = is_not_in_ ? codegen->false_value() : codegen->true_value();
+  Value* not_found_val = is_not_in_ ? codegen->true_value() : codegen->false_value();
+  builder.SetInsertPoint(ret_block);
+  PHINode* phi_node = builder.CreatePHI(codegen->GetType(TYPE_BOOLEAN), 3, "tmp_phi");
+  phi_node->addIncoming(GetNullReturnValue(codegen), entry_block);
+  phi_node->addIncoming(found_val, found_block);
+  phi_node->addIncoming(not_found_val, not_found_block);
+  builder.CreateRet(phi_node);
+
+  return codegen->FinalizeFunction(function);
+}
+
+// IR generation for in predicates that look up value_set_.  The value is passed to
+// SetContains() by pointer.  For "a in (1, 2, ..., 10)", the IR looks like:
+//
+// define i1 @InPredicate(i8** %row, i8* %state_data, i1* %is_null) {
+// entry:
+//   %value = alloca i32
+//   %child_result = call i32 @SlotRef(i8** %row, i8* %state_data, i1* %is_null)
+//   %child_null = load i1* %is_null
+//   br i1 %child_null, label %ret_block, label %lookup
+//
+// lookup:                                           ; preds = %entry
+//   store i32 %child_result, i32* %value
+//   %value_ptr = bitcast i32* %value to i8*
+//   %found = call i1 @InPredicateSetContains(i8* inttoptr (i64 51107824 to i8*),
+//       i8* %value_ptr)
+//   store i1 false, i1* %is_null
+//   br label %ret_block
+//
+// ret_block:                                        ; preds = %lookup, %entry
+//   %tmp_phi = phi i1 [ false, %entry ], [ %found, %lookup ]
+//   ret i1 %tmp_phi
+// }
+Function* InPredicate::CodegenSetLookup(LlvmCodeGen* codegen) {
+  if (children()[0]->Codegen(codegen) == NULL) return NULL;
+  PrimitiveType type = children()[0]->type();
+
+  // Declare SetContains() in the module and map it to the native function.
+  const char* contains_fn_name = "InPredicateSetContains";
+  Function* contains_fn = codegen->module()->getFunction(contains_fn_name);
+  if (contains_fn == NULL) {
+    vector<Type*> arg_types;
+    arg_types.push_back(codegen->ptr_type());
+    arg_types.push_back(codegen->ptr_type());
+    FunctionType* fn_type =
+        FunctionType::get(codegen->GetType(TYPE_BOOLEAN), arg_types, false);
+    contains_fn = Function::Create(fn_type, GlobalValue::ExternalLinkage,
+        contains_fn_name, codegen->module());
+    codegen->execution_engine()->addGlobalMapping(contains_fn,
+        reinterpret_cast<void*>(&SetContains));
+  }
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Function* function = CreateComputeFnPrototype(codegen, "InPredicate");
+  Function::arg_iterator fn_args = function->arg_begin();
+  ++fn_args;
+  ++fn_args;
+  Value* is_null_ptr = fn_args;
+
+  BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  BasicBlock* lookup_block = BasicBlock::Create(context, "lookup", function);
+  BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
+
+  Value* cmp_val = children()[0]->CodegenGetValue(codegen, entry_block,
+      ret_block, lookup_block);
+
+  builder.SetInsertPoint(lookup_block);
+  // String values are already returned by pointer.
+  Value* value_ptr = cmp_val;
+  if (type != TYPE_STRING) {
+    Value* value = codegen->CreateEntryBlockAlloca(function,
+        LlvmCodeGen::NamedVariable("value", codegen->GetType(type)));
+    builder.CreateStore(cmp_val, value);
+    value_ptr = value;
+  }
+  value_ptr = builder.CreateBitCast(value_ptr, codegen->ptr_type(), "value_ptr");
+  Value* pred_ptr = codegen->CastPtrToLlvmPtr(codegen->ptr_type(), this);
+  Value* found = builder.CreateCall2(contains_fn, pred_ptr, value_ptr, "found");
+  // If the value is not found, the result is null if the list contains a null.
+  Value* result = is_not_in_ ? builder.CreateNot(found, "not_found") : found;
+  Value* is_null = value_set_has_null_ ?
+      builder.CreateNot(found, "null_result") : codegen->false_value();
+  builder.CreateStore(is_null, is_null_ptr);
+  builder.CreateBr(ret_block);
+
+  builder.SetInsertPoint(ret_block);
+  PHINode* phi_node = builder.CreatePHI(codegen->GetType(TYPE_BOOLEAN), 2, "tmp_phi");
+  phi_node->addIncoming(GetNullReturnValue(codegen), entry_block);
+  phi_node->addIncoming(result, lookup_block);
+  builder.CreateRet(phi_node);
+
+  return codegen->FinalizeFunction(function);
+}
+
 }
@@ -17,11 +17,16 @@
 #define IMPALA_EXPRS_IN_PREDICATE_H_
 
 #include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/unordered_set.hpp>
 #include "exprs/predicate.h"
 
 namespace impala {
 
 class InPredicate : public Predicate {
+ public:
+  virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
+
  protected:
   friend class Expr;
 
@@ -31,8 +36,44 @@ class InPredicate : public Predicate {
   virtual std::string DebugString() const;
 
  private:
-   const bool is_not_in_;
-   static void* ComputeFn(Expr* e, TupleRow* row);
+  // Constant in lists with at least this many values are looked up in value_set_
+  // instead of being compared with each value.
+  static const int MIN_VALUE_SET_SIZE = 8;
+
+  // Hash and equality functions for values of 'type'.
+  struct ValueHash {
+    PrimitiveType type;
+    ValueHash(PrimitiveType type) : type(type) { }
+    size_t operator()(const void* value) const;
+  };
+  struct ValueEq {
+    PrimitiveType type;
+    ValueEq(PrimitiveType type) : type(type) { }
+    bool operator()(const void* v1, const void* v2) const;
+  };
+  typedef boost::unordered_set<const void*, ValueHash, ValueEq> ValueSet;
+
+  const bool is_not_in_;
+
+  // The non-null values of the in list, if it is constant and has at least
+  // MIN_VALUE_SET_SIZE values.  NULL otherwise.  The values point into the results of
+  // the children, which are not evaluated again.
+  boost::scoped_ptr<ValueSet> value_set_;
+
+  // True if the in list of value_set_ contains a null.
+  bool value_set_has_null_;
+
+  static void* ComputeFn(Expr* e, TupleRow* row);
+
+  // Compute function if value_set_ is set.
+  static void* SetComputeFn(Expr* e, TupleRow* row);
+
+  // Returns whether 'value' is in the value_set_ of 'pred'.  Called by the codegen'd
+  // function.
+  static bool SetContains(const InPredicate* pred, const void* value);
+
+  // Codegen for value_set_: a call to SetContains().
+  llvm::Function* CodegenSetLookup(LlvmCodeGen* codegen);
 };
 
 }
@@ -38,6 +38,11 @@ class IntLiteral: public Expr {
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
   virtual std::string DebugString() const;
 
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result) {
+    EvalConstantBatch(num_rows, result);
+  }
+
  private:
   static void* ReturnTinyintValue(Expr* e, TupleRow* row);
   static void* ReturnSmallintValue(Expr* e, TupleRow* row);
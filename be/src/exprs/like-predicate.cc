@@ -18,9 +18,11 @@
 #include <boost/regex.hpp>
 #include <string.h>
 
+#include "codegen/llvm-codegen.h"
 #include "runtime/string-value.inline.h"
 
 using namespace boost;
+using namespace llvm;
 using namespace std;
 
 namespace impala {
@@ -71,6 +73,42 @@ void* LikePredicate::ConstantEndsWithFn(Expr* e, TupleRow* row) {
   return &p->result_.bool_val;
 }
 
+void* LikePredicate::ConstantEqualsFn(Expr* e, TupleRow* row) {
+  LikePredicate* p = static_cast<LikePredicate*>(e);
+  DCHECK_EQ(p->GetNumChildren(), 2);
+  StringValue* val = static_cast<StringValue*>(e->GetChild(0)->GetValue(row));
+  if (val == NULL) return NULL;
+  p->result_.bool_val = p->search_string_sv_.Eq(*val);
+  return &p->result_.bool_val;
+}
+
+void* LikePredicate::ConstantSegmentsFn(Expr* e, TupleRow* row) {
+  LikePredicate* p = static_cast<LikePredicate*>(e);
+  DCHECK_EQ(p->GetNumChildren(), 2);
+  DCHECK_GE(p->segment_svs_.size(), 2);
+  StringValue* val = static_cast<StringValue*>(e->GetChild(0)->GetValue(row));
+  if (val == NULL) return NULL;
+  p->result_.bool_val = false;
+  const StringValue& first = p->segment_svs_.front();
+  const StringValue& last = p->segment_svs_.back();
+  if (val->len < first.len + last.len) return &p->result_.bool_val;
+  if (!first.Eq(StringValue(val->ptr, first.len))) return &p->result_.bool_val;
+  if (!last.Eq(StringValue(val->ptr + val->len - last.len, last.len))) {
+    return &p->result_.bool_val;
+  }
+  // Find the middle segments in order, between the first and the last one.
+  StringValue rest(val->ptr + first.len, val->len - first.len - last.len);
+  for (int i = 1; i < p->segment_patterns_.size() - 1; ++i) {
+    int offset = p->segment_patterns_[i].Search(&rest);
+    if (offset == -1) return &p->result_.bool_val;
+    int matched_len = offset + p->segment_svs_[i].len;
+    rest.ptr += matched_len;
+    rest.len -= matched_len;
+  }
+  p->result_.bool_val = true;
+  return &p->result_.bool_val;
+}
+
 void* LikePredicate::ConstantRegexFn(Expr* e, TupleRow* row) {
   LikePredicate* p = static_cast<LikePredicate*>(e);
   DCHECK_EQ(p->GetNumChildren(), 2);
@@ -120,38 +158,12 @@ Status LikePredicate::Prepare(RuntimeState* state, const RowDescriptor& row_desc
     // determine pattern and decide on eval fn
     StringValue* pattern = static_cast<StringValue*>(GetChild(1)->GetValue(NULL));
     string pattern_str(pattern->ptr, pattern->len);
-    // Generate a regex search to look for simple patterns: 
-    // - "%anything%": This maps to a fast substring search implementation. 
-    // - anything%: This maps to a strncmp implementation
-    // - %anything: This maps to a strncmp implementation
-    // Regex marks the "anything" so it can be extracted for the pattern.
-    regex substring_re("(%+)([^%_]*)(%+)", regex::extended);
-    regex ends_with_re("(%+)([^%_]*)", regex::extended);
-    regex starts_with_re("([^%_]*)(%+)", regex::extended);
-    smatch match_res;
-    if (opcode_ == TExprOpcode::LIKE) {
-      if (regex_match(pattern_str, match_res, substring_re)) {
-        // match_res.str(0) is the whole string, match_res.str(1) the first group, etc.
-        search_string_ = match_res.str(2);
-        search_string_sv_ =
-            StringValue(const_cast<char*>(search_string_.c_str()), search_string_.size());
-        substring_pattern_ = StringSearch(&search_string_sv_);
-        compute_fn_ = ConstantSubstringFn;
-        return Status::OK;
-      } else if (regex_match(pattern_str, match_res, starts_with_re)) {
-        search_string_ = match_res.str(1);
-        search_string_sv_ =
-            StringValue(const_cast<char*>(search_string_.c_str()), search_string_.size());
-        compute_fn_ = ConstantStartsWithFn;
-        return Status::OK;
-      } else if (regex_match(pattern_str, match_res, ends_with_re)) {
-        search_string_ = match_res.str(2);
-        search_string_sv_ =
-            StringValue(const_cast<char*>(search_string_.c_str()), search_string_.size());
-        compute_fn_ = ConstantEndsWithFn;
-        return Status::OK;
-      } 
-    } 
+    // LIKE patterns without a _ are matched without a regex.
+    vector<string> segments;
+    if (opcode_ == TExprOpcode::LIKE && SplitLikePattern(pattern, &segments)) {
+      InitPatternMatch(segments);
+      return Status::OK;
+    }
     string re_pattern;
     if (opcode_ == TExprOpcode::LIKE) {
       ConvertLikePattern(pattern, &re_pattern);
@@ -181,6 +193,182 @@ Status LikePredicate::Prepare(RuntimeState* state, const RowDescriptor& row_desc
   return Status::OK;
 }
 
+// IR generation for like predicates with a constant pattern.  The exact, prefix and
+// suffix matches compare the string or its start or end with the search string, the
+// substring match calls the cross compiled StringValueFind().
+// For "a like 'abc%'", the IR looks like:
+//
+// define i1 @LikePredicate(i8** %row, i8* %state_data, i1* %is_null) {
+// entry:
+//   %substring = alloca %"struct.impala::StringValue"
+//   %child_result = call %"struct.impala::StringValue"* @SlotRef(i8** %row,
+//       i8* %state_data, i1* %is_null)
+//   %child_null = load i1* %is_null
+//   br i1 %child_null, label %ret_block, label %not_null
+//
+// not_null:                                         ; preds = %entry
+//   %val_ptr = getelementptr inbounds %"struct.impala::StringValue"* %child_result,
+//       i32 0, i32 0
+//   %ptr = load i8** %val_ptr
+//   %val_len = getelementptr inbounds %"struct.impala::StringValue"* %child_result,
+//       i32 0, i32 1
+//   %len = load i32* %val_len
+//   %long_enough = icmp sge i32 %len, 3
+//   br i1 %long_enough, label %compare, label %ret_block
+//
+// compare:                                          ; preds = %not_null
+//   %substring_ptr = getelementptr inbounds %"struct.impala::StringValue"* %substring,
+//       i32 0, i32 0
+//   store i8* %ptr, i8** %substring_ptr
+//   %substring_len = getelementptr inbounds %"struct.impala::StringValue"* %substring,
+//       i32 0, i32 1
+//   store i32 3, i32* %substring_len
+//   %tmp_eq = call i1 @StringValueEQ(%"struct.impala::StringValue"* %substring,
+//       %"struct.impala::StringValue"* inttoptr (i64 54112352 to
+//       %"struct.impala::StringValue"*))
+//   br label %ret_block
+//
+// ret_block:                                        ; preds = %compare, %not_null, %entry
+//   %tmp_phi = phi i1 [ false, %entry ], [ false, %not_null ], [ %tmp_eq, %compare ]
+//   ret i1 %tmp_phi
+// }
+Function* LikePredicate::Codegen(LlvmCodeGen* codegen) {
+  // Patterns that need a regex or have several segments are not codegen'd.
+  bool is_starts_with = compute_fn_ == ConstantStartsWithFn;
+  bool is_ends_with = compute_fn_ == ConstantEndsWithFn;
+  bool is_substring = compute_fn_ == ConstantSubstringFn;
+  bool is_equals = compute_fn_ == ConstantEqualsFn;
+  if (!is_starts_with && !is_ends_with && !is_substring && !is_equals) return NULL;
+
+  DCHECK_EQ(GetNumChildren(), 2);
+  // The pattern (child 1) is constant and has already been evaluated in Prepare().
+  if (children()[0]->Codegen(codegen) == NULL) return NULL;
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Function* function = CreateComputeFnPrototype(codegen, "LikePredicate");
+
+  BasicBlock* entry_block = BasicBlock::Create(context, "entry", function);
+  BasicBlock* not_null_block = BasicBlock::Create(context, "not_null", function);
+  BasicBlock* ret_block = BasicBlock::Create(context, "ret_block", function);
+
+  Type* str_ptr_type = codegen->GetPtrType(TYPE_STRING);
+  Value* search_string =
+      codegen->CastPtrToLlvmPtr(str_ptr_type, &search_string_sv_);
+  Value* val = children()[0]->CodegenGetValue(codegen, entry_block,
+      ret_block, not_null_block);
+
+  builder.SetInsertPoint(ret_block);
+  PHINode* phi_node = builder.CreatePHI(codegen->GetType(TYPE_BOOLEAN), 3, "tmp_phi");
+  phi_node->addIncoming(GetNullReturnValue(codegen), entry_block);
+
+  builder.SetInsertPoint(not_null_block);
+  if (is_equals) {
+    Value* result = codegen->CodegenEquals(&builder, val, search_string, TYPE_STRING);
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(result, not_null_block);
+  } else if (is_substring) {
+    Function* find_fn = codegen->GetFunction(IRFunction::STRING_VALUE_FIND);
+    Value* offset = builder.CreateCall2(find_fn, val, search_string, "offset");
+    Value* result = builder.CreateICmpNE(offset,
+        codegen->GetIntConstant(TYPE_INT, -1), "tmp_found");
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(result, not_null_block);
+  } else {
+    // Compare the search string with the prefix/suffix of the same length.  Strings
+    // shorter than the search string don't match.
+    BasicBlock* compare_block = BasicBlock::Create(context, "compare", function,
+        ret_block);
+    Value* search_len = codegen->GetIntConstant(TYPE_INT, search_string_sv_.len);
+    Value* ptr = builder.CreateLoad(builder.CreateStructGEP(val, 0, "val_ptr"), "ptr");
+    Value* len = builder.CreateLoad(builder.CreateStructGEP(val, 1, "val_len"), "len");
+    Value* long_enough = builder.CreateICmpSGE(len, search_len, "long_enough");
+    builder.CreateCondBr(long_enough, compare_block, ret_block);
+    phi_node->addIncoming(codegen->false_value(), not_null_block);
+
+    builder.SetInsertPoint(compare_block);
+    if (is_ends_with) {
+      ptr = builder.CreateGEP(ptr, builder.CreateSub(len, search_len), "suffix");
+    }
+    Value* substring = codegen->CreateEntryBlockAlloca(function,
+        LlvmCodeGen::NamedVariable("substring", codegen->GetType(TYPE_STRING)));
+    builder.CreateStore(ptr, builder.CreateStructGEP(substring, 0, "substring_ptr"));
+    builder.CreateStore(search_len,
+        builder.CreateStructGEP(substring, 1, "substring_len"));
+    Value* result = codegen->CodegenEquals(&builder, substring, search_string,
+        TYPE_STRING);
+    builder.CreateBr(ret_block);
+    phi_node->addIncoming(result, compare_block);
+  }
+
+  builder.SetInsertPoint(ret_block);
+  builder.CreateRet(phi_node);
+
+  return codegen->FinalizeFunction(function);
+}
+
+bool LikePredicate::SplitLikePattern(const StringValue* pattern,
+    vector<string>* segments) const {
+  segments->clear();
+  string segment;
+  bool is_escaped = false;
+  for (int i = 0; i < pattern->len; ++i) {
+    char c = pattern->ptr[i];
+    if (!is_escaped && c == '%') {
+      if (!segment.empty() || segments->empty()) segments->push_back(segment);
+      segment.clear();
+    } else if (!is_escaped && c == '_') {
+      return false;
+    } else if (!is_escaped && c == escape_char_) {
+      is_escaped = true;
+    } else {
+      segment.append(1, c);
+      is_escaped = false;
+    }
+  }
+  segments->push_back(segment);
+  return true;
+}
+
+void LikePredicate::InitPatternMatch(const vector<string>& segments) {
+  DCHECK(!segments.empty());
+  if (segments.size() == 1) {
+    // No %: 'anything'
+    search_string_ = segments[0];
+    compute_fn_ = ConstantEqualsFn;
+  } else if (segments.size() == 2 && segments[1].empty()) {
+    // 'anything%', this includes '%', which matches all strings.
+    search_string_ = segments[0];
+    compute_fn_ = ConstantStartsWithFn;
+  } else if (segments.size() == 2 && segments[0].empty()) {
+    // '%anything'
+    search_string_ = segments[1];
+    compute_fn_ = ConstantEndsWithFn;
+  } else if (segments.size() == 3 && segments[0].empty() && segments[2].empty()) {
+    // '%anything%'
+    search_string_ = segments[1];
+    compute_fn_ = ConstantSubstringFn;
+  } else {
+    // 'a%b', '%a%b%' etc.
+    segments_ = segments;
+    segment_svs_.clear();
+    segment_patterns_.clear();
+    for (int i = 0; i < segments_.size(); ++i) {
+      segment_svs_.push_back(
+          StringValue(const_cast<char*>(segments_[i].c_str()), segments_[i].size()));
+    }
+    // segment_svs_ doesn't change anymore.
+    for (int i = 0; i < segment_svs_.size(); ++i) {
+      segment_patterns_.push_back(StringSearch(&segment_svs_[i]));
+    }
+    compute_fn_ = ConstantSegmentsFn;
+    return;
+  }
+  search_string_sv_ =
+      StringValue(const_cast<char*>(search_string_.c_str()), search_string_.size());
+  substring_pattern_ = StringSearch(&search_string_sv_);
+}
+
 void LikePredicate::ConvertLikePattern(
     const StringValue* pattern, string* re_pattern) const {
   re_pattern->clear();
@@ -17,6 +17,7 @@
 #define IMPALA_EXPRS_LIKE_PREDICATE_H_
 
 #include <string>
+#include <vector>
 #include <boost/scoped_ptr.hpp> 
 #include <boost/regex.hpp> 
 
@@ -27,6 +28,11 @@
 namespace impala {
 
 class LikePredicate: public Predicate {
+ public:
+  // Only constant patterns that are an exact, prefix, suffix or substring match are
+  // codegen'd.
+  virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
+
  protected:
   friend class Expr;
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
@@ -41,10 +47,32 @@ class LikePredicate: public Predicate {
   StringSearch substring_pattern_;
   boost::scoped_ptr<boost::regex> regex_;
 
+  // For patterns with several segments (e.g. 'a%b%c'): the unescaped segments between
+  // the %s, and searches for the ones in the middle.  The first and last segment are
+  // matched against the start and end of the string.
+  std::vector<std::string> segments_;
+  std::vector<StringValue> segment_svs_;
+  std::vector<StringSearch> segment_patterns_;
+
   // Convert a LIKE pattern (with embedded % and _) into the corresponding
   // regular expression pattern. Escaped chars are copied verbatim.
   void ConvertLikePattern(const StringValue* pattern, std::string* re_pattern) const;
 
+  // Splits a LIKE pattern into the unescaped strings between its %s.  Consecutive
+  // %s don't produce empty segments, but a leading or trailing % does.  Returns false
+  // if the pattern contains a _, which needs a regex.
+  bool SplitLikePattern(const StringValue* pattern,
+      std::vector<std::string>* segments) const;
+
+  // Sets up the compute function and search strings for 'segments'.
+  void InitPatternMatch(const std::vector<std::string>& segments);
+
+  // Handling of like predicates that can be implemented using string compare
+  static void* ConstantEqualsFn(Expr* e, TupleRow* row);
+
+  // Handling of like predicates of the form 'a%b%...%c', using the segments_
+  static void* ConstantSegmentsFn(Expr* e, TupleRow* row);
+
   // Handling of like predicates that map to strstr
   static void* ConstantSubstringFn(Expr* e, TupleRow* row);
 
@@ -34,6 +34,11 @@ class NullLiteral: public Expr {
 
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
 
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result) {
+    EvalConstantBatch(num_rows, result);
+  }
+
  private:
   static void* ReturnValue(Expr* e, TupleRow* row);
 };
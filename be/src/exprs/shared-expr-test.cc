@@ -0,0 +1,209 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "common/object-pool.h"
+#include "exprs/expr.h"
+#include "exprs/shared-expr.h"
+#include "runtime/descriptors.h"
+#include "runtime/tuple-row.h"
+#include "gen-cpp/Descriptors_types.h"
+#include "gen-cpp/Exprs_types.h"
+
+using namespace std;
+
+namespace impala {
+
+// Rows have a single tuple with NUM_SLOTS bool slots.
+class SharedExprTest : public testing::Test {
+ protected:
+  static const int NUM_SLOTS = 3;
+
+  ObjectPool pool_;
+  DescriptorTbl* desc_tbl_;
+  const RowDescriptor* row_desc_;
+
+  bool tuple_[NUM_SLOTS];
+  Tuple* row_mem_[1];
+  TupleRow* row_;
+
+  virtual void SetUp() {
+    TTupleDescriptor tuple_desc;
+    tuple_desc.__set_id(0);
+    tuple_desc.__set_byteSize(NUM_SLOTS);
+    tuple_desc.__set_numNullBytes(0);
+    TDescriptorTable thrift_desc_tbl;
+    thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+    EXPECT_TRUE(DescriptorTbl::Create(&pool_, thrift_desc_tbl, &desc_tbl_).ok());
+    vector<TTupleId> row_tids(1, 0);
+    vector<bool> nullable_tuples(1, false);
+    row_desc_ = pool_.Add(new RowDescriptor(*desc_tbl_, row_tids, nullable_tuples));
+
+    for (int i = 0; i < NUM_SLOTS; ++i) {
+      tuple_[i] = false;
+    }
+    row_ = reinterpret_cast<TupleRow*>(row_mem_);
+    row_->SetTuple(0, reinterpret_cast<Tuple*>(tuple_));
+  }
+
+  Expr* CreateSlotRef(int slot) {
+    return pool_.Add(new SlotRef(TYPE_BOOLEAN, slot));
+  }
+
+  // Returns an expr 'opcode' of 'children'.  'type' is its return type.
+  Expr* CreateExpr(TExprNodeType::type node_type, TExprOpcode::type opcode,
+      TPrimitiveType::type type, Expr* child0, Expr* child1 = NULL) {
+    TExprNode node;
+    node.node_type = node_type;
+    node.type = type;
+    node.__set_opcode(opcode);
+    node.num_children = 0;
+    TExpr texpr;
+    texpr.nodes.push_back(node);
+    Expr* expr;
+    EXPECT_TRUE(Expr::CreateExprTree(&pool_, texpr, &expr).ok());
+    expr->AddChild(child0);
+    if (child1 != NULL) expr->AddChild(child1);
+    return expr;
+  }
+
+  Expr* CreateNot(Expr* child) {
+    return CreateExpr(TExprNodeType::COMPOUND_PRED, TExprOpcode::COMPOUND_NOT,
+        TPrimitiveType::BOOLEAN, child);
+  }
+
+  Expr* CreateAnd(Expr* lhs, Expr* rhs) {
+    return CreateExpr(TExprNodeType::COMPOUND_PRED, TExprOpcode::COMPOUND_AND,
+        TPrimitiveType::BOOLEAN, lhs, rhs);
+  }
+
+  Expr* CreateOr(Expr* lhs, Expr* rhs) {
+    return CreateExpr(TExprNodeType::COMPOUND_PRED, TExprOpcode::COMPOUND_OR,
+        TPrimitiveType::BOOLEAN, lhs, rhs);
+  }
+
+  bool Eval(Expr* expr) {
+    void* value = expr->GetValue(row_);
+    EXPECT_TRUE(value != NULL);
+    return *reinterpret_cast<bool*>(value);
+  }
+};
+
+TEST_F(SharedExprTest, Roots) {
+  vector<Expr*> exprs;
+  exprs.push_back(CreateNot(CreateSlotRef(0)));
+  exprs.push_back(CreateNot(CreateSlotRef(0)));
+  exprs.push_back(CreateNot(CreateSlotRef(1)));
+  SharedExpr::EliminateCommonSubExprs(&pool_, &exprs);
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(exprs[0]) != NULL);
+  EXPECT_EQ(exprs[0], exprs[1]);
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(exprs[2]) == NULL);
+  ASSERT_TRUE(Expr::Prepare(exprs, NULL, *row_desc_).ok());
+
+  SharedExpr::InvalidateCachedValues();
+  EXPECT_TRUE(Eval(exprs[0]));
+  EXPECT_TRUE(Eval(exprs[2]));
+}
+
+TEST_F(SharedExprTest, SubExprs) {
+  // not(slot0) and slot1, not(slot0) or slot2
+  vector<Expr*> conjuncts;
+  conjuncts.push_back(CreateAnd(CreateNot(CreateSlotRef(0)), CreateSlotRef(1)));
+  vector<Expr*> exprs;
+  exprs.push_back(CreateOr(CreateNot(CreateSlotRef(0)), CreateSlotRef(2)));
+  vector<vector<Expr*>*> expr_lists;
+  expr_lists.push_back(&conjuncts);
+  expr_lists.push_back(&exprs);
+  SharedExpr::EliminateCommonSubExprs(&pool_, expr_lists);
+  // slot refs aren't shared
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(conjuncts[0]->GetChild(0)) != NULL);
+  EXPECT_EQ(conjuncts[0]->GetChild(0), exprs[0]->GetChild(0));
+  EXPECT_NE(conjuncts[0]->GetChild(1), exprs[0]->GetChild(1));
+  ASSERT_TRUE(Expr::Prepare(conjuncts, NULL, *row_desc_).ok());
+  ASSERT_TRUE(Expr::Prepare(exprs, NULL, *row_desc_).ok());
+
+  tuple_[1] = true;
+  SharedExpr::InvalidateCachedValues();
+  EXPECT_TRUE(Eval(conjuncts[0]));
+  EXPECT_TRUE(Eval(exprs[0]));
+
+  // The row changes in place: the cached value is used until the next scope.
+  tuple_[0] = true;
+  EXPECT_TRUE(Eval(conjuncts[0]));
+  SharedExpr::InvalidateCachedValues();
+  EXPECT_FALSE(Eval(conjuncts[0]));
+  EXPECT_FALSE(Eval(exprs[0]));
+}
+
+TEST_F(SharedExprTest, ThreadScopes) {
+  vector<Expr*> exprs;
+  exprs.push_back(CreateNot(CreateSlotRef(0)));
+  exprs.push_back(CreateNot(CreateSlotRef(0)));
+  SharedExpr::EliminateCommonSubExprs(&pool_, &exprs);
+  ASSERT_TRUE(dynamic_cast<SharedExpr*>(exprs[0]) != NULL);
+  ASSERT_TRUE(Expr::Prepare(exprs, NULL, *row_desc_).ok());
+
+  tuple_[0] = false;
+  SharedExpr::InvalidateCachedValues();
+  EXPECT_TRUE(Eval(exprs[0]));
+  // A thread taking over the exprs starts with scopes of its own, which never match
+  // the scope of the cached value.
+  tuple_[0] = true;
+  SharedExpr::StartThreadScopes();
+  EXPECT_FALSE(Eval(exprs[0]));
+}
+
+TEST_F(SharedExprTest, NestedSubExprs) {
+  // not(not(slot0)) occurs twice, not(slot0) once more on its own: after sharing
+  // the outer expr, not(slot0) is still evaluated twice.
+  vector<Expr*> exprs;
+  exprs.push_back(CreateNot(CreateNot(CreateSlotRef(0))));
+  exprs.push_back(CreateNot(CreateNot(CreateSlotRef(0))));
+  exprs.push_back(CreateAnd(CreateNot(CreateSlotRef(0)), CreateSlotRef(1)));
+  SharedExpr::EliminateCommonSubExprs(&pool_, &exprs);
+  EXPECT_EQ(exprs[0], exprs[1]);
+  ASSERT_TRUE(dynamic_cast<SharedExpr*>(exprs[0]) != NULL);
+  Expr* inner = exprs[0]->GetChild(0)->GetChild(0);
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(inner) != NULL);
+  EXPECT_EQ(inner, exprs[2]->GetChild(0));
+
+  // An expr that only occurs inside a repeated one is not shared.
+  exprs.clear();
+  exprs.push_back(CreateNot(CreateNot(CreateSlotRef(0))));
+  exprs.push_back(CreateNot(CreateNot(CreateSlotRef(0))));
+  SharedExpr::EliminateCommonSubExprs(&pool_, &exprs);
+  EXPECT_EQ(exprs[0], exprs[1]);
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(exprs[0]->GetChild(0)->GetChild(0)) == NULL);
+}
+
+TEST_F(SharedExprTest, Rand) {
+  vector<Expr*> exprs;
+  for (int i = 0; i < 2; ++i) {
+    int seed = 1;
+    exprs.push_back(CreateExpr(TExprNodeType::FUNCTION_CALL, TExprOpcode::MATH_RAND_INT,
+        TPrimitiveType::DOUBLE, Expr::CreateLiteral(&pool_, TYPE_INT, &seed)));
+  }
+  SharedExpr::EliminateCommonSubExprs(&pool_, &exprs);
+  EXPECT_NE(exprs[0], exprs[1]);
+  EXPECT_TRUE(dynamic_cast<SharedExpr*>(exprs[0]) == NULL);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
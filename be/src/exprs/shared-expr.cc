@@ -0,0 +1,206 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "exprs/shared-expr.h"
+
+#include <map>
+#include <sstream>
+#include <gflags/gflags.h>
+
+#include "common/object-pool.h"
+#include "exprs/agg-expr.h"
+
+using namespace llvm;
+using namespace std;
+
+DEFINE_bool(eliminate_common_subexprs, true, "if true, subexpressions that occur more "
+    "than once in the exprs of a plan node are evaluated once per row by the "
+    "interpreted (non-codegen'd) exprs");
+
+namespace impala {
+
+__thread int64_t SharedExpr::scope_ = 0;
+int64_t SharedExpr::next_scopes_ = 0;
+
+typedef map<string, int> SubExprCounts;
+
+// Returns true if 'expr' may be replaced by a SharedExpr.
+static bool IsShareable(const Expr* expr) {
+  // Leaves are cheaper than a SharedExpr.
+  if (expr->GetNumChildren() == 0) return false;
+  // The aggregation node updates each of its aggregate exprs separately.
+  if (dynamic_cast<const AggregateExpr*>(expr) != NULL) return false;
+  return expr->IsDeterministic();
+}
+
+// Returns a string that is equal for two subtrees iff they compute the same values.
+// The DebugString() of an expr describes the expr and its children, but the
+// children's descriptions are not delimited (e.g. for string literals), so the
+// description of every node is prefixed with its length.
+static void AppendSignature(const Expr* expr, string* signature) {
+  stringstream out;
+  string debug_string = expr->DebugString();
+  out << debug_string.size() << ":" << debug_string << "(";
+  signature->append(out.str());
+  for (int i = 0; i < expr->GetNumChildren(); ++i) {
+    AppendSignature(expr->GetChild(i), signature);
+  }
+  signature->append(")");
+}
+
+static string GetSignature(const Expr* expr) {
+  string signature;
+  AppendSignature(expr, &signature);
+  return signature;
+}
+
+// Counts all shareable subtrees of 'expr' in 'counts'.
+static void CountSubExprs(const Expr* expr, SubExprCounts* counts) {
+  if (IsShareable(expr)) ++(*counts)[GetSignature(expr)];
+  for (int i = 0; i < expr->GetNumChildren(); ++i) {
+    CountSubExprs(expr->GetChild(i), counts);
+  }
+}
+
+// Counts the evaluations of the subtrees of 'expr' after the subtrees in
+// 'all_counts' that occur more than once are shared: the children of a shared
+// subtree are only evaluated by its first occurrence.
+static void CountEvaluations(const Expr* expr, const SubExprCounts& all_counts,
+    SubExprCounts* counts) {
+  if (IsShareable(expr)) {
+    string signature = GetSignature(expr);
+    SubExprCounts::const_iterator it = all_counts.find(signature);
+    DCHECK(it != all_counts.end());
+    if (it->second > 1 && ++(*counts)[signature] > 1) return;
+  }
+  for (int i = 0; i < expr->GetNumChildren(); ++i) {
+    CountEvaluations(expr->GetChild(i), all_counts, counts);
+  }
+}
+
+SharedExpr::SharedExpr(Expr* child)
+  : Expr(child->type()),
+    prepared_(false),
+    codegen_done_(false),
+    cached_row_(NULL),
+    cached_scope_(-1),
+    cached_value_(NULL) {
+  AddChild(child);
+}
+
+void SharedExpr::EliminateCommonSubExprs(ObjectPool* pool,
+    const vector<vector<Expr*>*>& expr_lists) {
+  if (!FLAGS_eliminate_common_subexprs) return;
+  SubExprCounts all_counts;
+  for (int i = 0; i < expr_lists.size(); ++i) {
+    for (int j = 0; j < expr_lists[i]->size(); ++j) {
+      CountSubExprs((*expr_lists[i])[j], &all_counts);
+    }
+  }
+  SubExprCounts counts;
+  for (int i = 0; i < expr_lists.size(); ++i) {
+    for (int j = 0; j < expr_lists[i]->size(); ++j) {
+      CountEvaluations((*expr_lists[i])[j], all_counts, &counts);
+    }
+  }
+  SharedExprMap shared_exprs;
+  for (int i = 0; i < expr_lists.size(); ++i) {
+    for (int j = 0; j < expr_lists[i]->size(); ++j) {
+      ReplaceSubExprs(pool, counts, &shared_exprs, &(*expr_lists[i])[j]);
+    }
+  }
+  if (!shared_exprs.empty()) {
+    VLOG_FILE << "Sharing " << shared_exprs.size() << " common subexprs";
+  }
+}
+
+void SharedExpr::EliminateCommonSubExprs(ObjectPool* pool, vector<Expr*>* exprs) {
+  EliminateCommonSubExprs(pool, vector<vector<Expr*>*>(1, exprs));
+}
+
+void SharedExpr::ReplaceSubExprs(ObjectPool* pool, const SubExprCounts& counts,
+    SharedExprMap* shared_exprs, Expr** expr) {
+  vector<Expr*>& children = (*expr)->children_;
+  if (IsShareable(*expr)) {
+    string signature = GetSignature(*expr);
+    SubExprCounts::const_iterator it = counts.find(signature);
+    if (it != counts.end() && it->second > 1) {
+      SharedExprMap::iterator shared = shared_exprs->find(signature);
+      if (shared != shared_exprs->end()) {
+        *expr = shared->second;
+        return;
+      }
+      // The shared subtree may itself contain shared subtrees.
+      for (int i = 0; i < children.size(); ++i) {
+        ReplaceSubExprs(pool, counts, shared_exprs, &children[i]);
+      }
+      SharedExpr* shared_expr = pool->Add(new SharedExpr(*expr));
+      (*shared_exprs)[signature] = shared_expr;
+      *expr = shared_expr;
+      return;
+    }
+  }
+  for (int i = 0; i < children.size(); ++i) {
+    ReplaceSubExprs(pool, counts, shared_exprs, &children[i]);
+  }
+}
+
+void SharedExpr::StartThreadScopes() {
+  // a thread would need 2^32 scopes to reach the next thread's
+  int64_t scopes = __sync_add_and_fetch(&next_scopes_, 1);
+  scope_ = scopes << 32;
+}
+
+Status SharedExpr::Prepare(RuntimeState* state, const RowDescriptor& row_desc) {
+  if (prepared_) return Status::OK;
+  prepared_ = true;
+  RETURN_IF_ERROR(Expr::PrepareChildren(state, row_desc));
+  compute_fn_ = ComputeFn;
+  return Status::OK;
+}
+
+void* SharedExpr::ComputeFn(Expr* e, TupleRow* row) {
+  SharedExpr* expr = static_cast<SharedExpr*>(e);
+  if (expr->cached_scope_ != scope_ || expr->cached_row_ != row) {
+    // The result points to the child's result_ or into the row, which don't change
+    // until the child is evaluated again.
+    expr->cached_value_ = expr->children_[0]->GetValue(row);
+    expr->cached_row_ = row;
+    expr->cached_scope_ = scope_;
+  }
+  return expr->cached_value_;
+}
+
+void SharedExpr::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  // Batches are evaluated one expr at a time, so there is nothing to reuse.
+  children_[0]->GetValues(batch, sel, num_rows, result);
+}
+
+Function* SharedExpr::Codegen(LlvmCodeGen* codegen) {
+  if (!codegen_done_) {
+    codegen_done_ = true;
+    codegen_fn_ = children_[0]->Codegen(codegen);
+    scratch_buffer_size_ = children_[0]->scratch_buffer_size();
+  }
+  return codegen_fn_;
+}
+
+string SharedExpr::DebugString() const {
+  stringstream out;
+  out << "SharedExpr(" << Expr::DebugString() << ")";
+  return out.str();
+}
+
+}
@@ -0,0 +1,109 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_EXPRS_SHARED_EXPR_H_
+#define IMPALA_EXPRS_SHARED_EXPR_H_
+
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "exprs/expr.h"
+
+namespace impala {
+
+class ObjectPool;
+
+// A subexpression that occurs more than once in the exprs of an exec node (e.g. the
+// same substring() call in two conjuncts) and is evaluated once per row in the
+// interpreted path.  The SharedExpr replaces every occurrence of the subtree and has
+// it as its only child.  GetValue() evaluates the child for the first row it is
+// called with and returns the cached result while it is called with the same row.
+// Row memory is reused, so a TupleRow* can have different contents over time: the
+// cache is only valid within a scope, and the code that evaluates the exprs row at a
+// time (e.g. ExecNode::EvalConjuncts()) must call InvalidateCachedValues() whenever
+// the rows it passes may have changed.  Scopes are per thread; a SharedExpr must
+// only be evaluated by one thread at a time, like any other expr with a result_, and
+// code that hands exprs to another thread must have it call StartThreadScopes().
+// Codegen'd exprs call the child's function directly: the llvm passes do their own
+// subexpression elimination (see SubExprElimination).
+class SharedExpr : public Expr {
+ public:
+  // Replaces the subtrees that occur more than once in the expr trees of
+  // 'expr_lists' by a SharedExpr allocated from 'pool'.  Subtrees are compared by
+  // their DebugString(), so this must be called before the exprs are prepared.  Only
+  // subtrees that are worth caching are shared: not slot refs or literals, not
+  // aggregate exprs and not subtrees that return a different value on every call
+  // (rand()).  All exprs must be evaluated over rows with the same layout, and by
+  // code that calls InvalidateCachedValues().
+  // Does nothing if --eliminate_common_subexprs is false.
+  static void EliminateCommonSubExprs(ObjectPool* pool,
+      const std::vector<std::vector<Expr*>*>& expr_lists);
+  static void EliminateCommonSubExprs(ObjectPool* pool, std::vector<Expr*>* exprs);
+
+  // Starts a new scope on this thread: the next GetValue() of each SharedExpr
+  // evaluated by this thread evaluates its child again.
+  static void InvalidateCachedValues() { ++scope_; }
+
+  // Moves this thread on to scopes that no thread has used yet, so that it doesn't
+  // see the values cached by another thread that evaluated the same exprs before.
+  static void StartThreadScopes();
+
+  virtual llvm::Function* Codegen(LlvmCodeGen* codegen);
+  virtual std::string DebugString() const;
+
+ protected:
+  virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result);
+
+ private:
+  // Signatures of the shareable subtrees of a set of expr trees (see
+  // GetSignature() in the .cc), with the number of times each of them is evaluated.
+  typedef std::map<std::string, int> SubExprCounts;
+  typedef std::map<std::string, SharedExpr*> SharedExprMap;
+
+  SharedExpr(Expr* child);
+
+  // Replaces *expr, or the subtrees below it, by the SharedExpr for their signature
+  // if they are evaluated more than once according to 'counts'.  The SharedExpr is
+  // created on the first occurrence and added to 'shared_exprs'.
+  static void ReplaceSubExprs(ObjectPool* pool, const SubExprCounts& counts,
+      SharedExprMap* shared_exprs, Expr** expr);
+
+  static void* ComputeFn(Expr* e, TupleRow* row);
+
+  // Current scope of this thread
+  static __thread int64_t scope_;
+
+  // Number of calls to StartThreadScopes(), which starts at next_scopes_ << 32.
+  static int64_t next_scopes_;
+
+  // Prepare() and Codegen() are called once per parent; only the first call does
+  // anything.
+  bool prepared_;
+  bool codegen_done_;
+
+  // Row and scope the child was last evaluated with, and its result.  cached_row_
+  // is only valid if cached_scope_ == scope_.
+  TupleRow* cached_row_;
+  int64_t cached_scope_;
+  void* cached_value_;
+};
+
+}
+
+#endif
@@ -18,6 +18,7 @@
 
 #include "codegen/llvm-codegen.h"
 #include "gen-cpp/Exprs_types.h"
+#include "runtime/row-batch.h"
 #include "runtime/runtime-state.h"
 
 using namespace std;
@@ -79,6 +80,58 @@ int SlotRef::GetSlotIds(vector<SlotId>* slot_ids) const {
   return 1;
 }
 
+template <typename T>
+void SlotRef::GatherValues(RowBatch* batch, const int* sel, int num_rows, T* values,
+    uint8_t* is_null) {
+  for (int i = 0; i < num_rows; ++i) {
+    Tuple* t = batch->GetRow(sel == NULL ? i : sel[i])->GetTuple(tuple_idx_);
+    if (t == NULL || t->IsNull(null_indicator_offset_)) {
+      is_null[i] = 1;
+      memset(&values[i], 0, sizeof(T));
+    } else {
+      is_null[i] = 0;
+      values[i] = *reinterpret_cast<T*>(t->GetSlot(slot_offset_));
+    }
+  }
+}
+
+void SlotRef::EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+    ExprColumn* result) {
+  uint8_t* is_null = result->is_null();
+  switch (type_) {
+    case TYPE_BOOLEAN:
+      GatherValues(batch, sel, num_rows, result->values<bool>(), is_null);
+      break;
+    case TYPE_TINYINT:
+      GatherValues(batch, sel, num_rows, result->values<int8_t>(), is_null);
+      break;
+    case TYPE_SMALLINT:
+      GatherValues(batch, sel, num_rows, result->values<int16_t>(), is_null);
+      break;
+    case TYPE_INT:
+      GatherValues(batch, sel, num_rows, result->values<int32_t>(), is_null);
+      break;
+    case TYPE_BIGINT:
+      GatherValues(batch, sel, num_rows, result->values<int64_t>(), is_null);
+      break;
+    case TYPE_FLOAT:
+      GatherValues(batch, sel, num_rows, result->values<float>(), is_null);
+      break;
+    case TYPE_DOUBLE:
+      GatherValues(batch, sel, num_rows, result->values<double>(), is_null);
+      break;
+    case TYPE_STRING:
+      // the string data stays in the batch
+      GatherValues(batch, sel, num_rows, result->values<StringValue>(), is_null);
+      break;
+    case TYPE_TIMESTAMP:
+      GatherValues(batch, sel, num_rows, result->values<TimestampValue>(), is_null);
+      break;
+    default:
+      Expr::EvalBatch(batch, sel, num_rows, result);
+  }
+}
+
 string SlotRef::DebugString() const {
   stringstream out;
   out << "SlotRef(slot_id=" << slot_id_
@@ -15,6 +15,9 @@
 #include "exprs/string-functions.h"
 
 #include <boost/regex.hpp>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #include "exprs/expr.h"
 #include "exprs/function-call.h"
@@ -100,29 +103,47 @@ void* StringFunctions::Length(Expr* e, TupleRow* row) {
   return &e->result_.int_val;
 }
 
+// Copies [src, src + len) to dst, mapping the ASCII letters from 'first' to 'last' to
+// the other case.  This is what ::tolower()/::toupper() do in the "C" locale.  16 bytes
+// are converted at a time by comparing them against the range of letters; bytes
+// >= 0x80 are negative as signed chars and are never in the range.
+static inline void ConvertCase(const char* src, int len, char first, char last,
+    char* dst) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i below = _mm_set1_epi8(first - 1);
+  const __m128i above = _mm_set1_epi8(last + 1);
+  const __m128i case_bit = _mm_set1_epi8(0x20);
+  for (; i + 16 <= len; i += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+    __m128i in_range =
+        _mm_and_si128(_mm_cmpgt_epi8(chars, below), _mm_cmplt_epi8(chars, above));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i),
+        _mm_xor_si128(chars, _mm_and_si128(in_range, case_bit)));
+  }
+#endif
+  for (; i < len; ++i) {
+    char c = src[i];
+    dst[i] = (c >= first && c <= last) ? c ^ 0x20 : c;
+  }
+}
+
 // Implementation of LOWER
 //   string lower(string input)
 // Returns a string identical to the input, but with all characters
 // mapped to their lower-case equivalents. If input == NULL, returns
 // NULL per MySQL.
-// Both this function, and Upper, have opportunities for SIMD-based
-// optimization (since the current implementation operates on one
-// character at a time).
 void* StringFunctions::Lower(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 1);
   Expr* op = e->children()[0];
   StringValue* str = reinterpret_cast<StringValue*>(op->GetValue(row));
   if (str == NULL) return NULL;
 
+  // The result buffer of the expr is reused from row to row, so it is only
+  // reallocated when the result grows.
   e->result_.string_data.resize(str->len);
   e->result_.SyncStringVal();
-
-  // Writing to string_val.ptr rather than string_data.begin() ensures
-  // that we bypass any range checks on the output iterator (since we
-  // know for sure that we're writing str->len bytes)
-  std::transform(str->ptr, str->ptr + str->len,
-                 e->result_.string_val.ptr, ::tolower);
-
+  ConvertCase(str->ptr, str->len, 'A', 'Z', e->result_.string_val.ptr);
   return &e->result_.string_val;
 }
 
@@ -139,13 +160,7 @@ void* StringFunctions::Upper(Expr* e, TupleRow* row) {
 
   e->result_.string_data.resize(str->len);
   e->result_.SyncStringVal();
-
-  // Writing to string_val.ptr rather than string_data.begin() ensures
-  // that we bypass any range checks on the output iterator (since we
-  // know for sure that we're writing str->len bytes)
-  std::transform(str->ptr, str->ptr + str->len,
-                 e->result_.string_val.ptr, ::toupper);
-
+  ConvertCase(str->ptr, str->len, 'a', 'z', e->result_.string_val.ptr);
   return &e->result_.string_val;
 }
 
@@ -168,22 +183,48 @@ void* StringFunctions::Reverse(Expr* e, TupleRow* row) {
   return (&e->result_.string_val);
 }
 
+// Returns the number of spaces [ptr, ptr + len) starts with.  16 bytes are compared
+// at a time; the first one that isn't a space is the lowest bit of the inverted mask.
+static inline int CountLeadingSpaces(const char* ptr, int len) {
+  int i = 0;
+#ifdef __SSE2__
+  const __m128i spaces = _mm_set1_epi8(' ');
+  for (; i + 16 <= len; i += 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + i));
+    int not_space = ~_mm_movemask_epi8(_mm_cmpeq_epi8(chars, spaces)) & 0xffff;
+    if (not_space != 0) return i + __builtin_ctz(not_space);
+  }
+#endif
+  while (i < len && ptr[i] == ' ') ++i;
+  return i;
+}
+
+// Returns the number of spaces [ptr, ptr + len) ends with, scanning backwards.
+static inline int CountTrailingSpaces(const char* ptr, int len) {
+  // [ptr + end, ptr + len) are spaces
+  int end = len;
+#ifdef __SSE2__
+  const __m128i spaces = _mm_set1_epi8(' ');
+  for (; end >= 16; end -= 16) {
+    __m128i chars = _mm_loadu_si128(reinterpret_cast<const __m128i*>(ptr + end - 16));
+    int not_space = ~_mm_movemask_epi8(_mm_cmpeq_epi8(chars, spaces)) & 0xffff;
+    if (not_space != 0) return 15 - (31 - __builtin_clz(not_space)) + len - end;
+  }
+#endif
+  while (end > 0 && ptr[end - 1] == ' ') --end;
+  return len - end;
+}
+
+// The trim functions return a part of their input, without copying it.
 void* StringFunctions::Trim(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 1);
   StringValue* str = reinterpret_cast<StringValue*>(e->children()[0]->GetValue(row));
   if (str == NULL) return NULL;
-  // Find new starting position.
-  int32_t begin = 0;
-  while (begin < str->len && str->ptr[begin] == ' ') {
-    ++begin;
-  }
-  // Find new ending position.
-  int32_t end = str->len - 1;
-  while (end > begin && str->ptr[end] == ' ') {
-    --end;
-  }
+  int begin = CountLeadingSpaces(str->ptr, str->len);
+  int len = str->len - begin;
+  len -= CountTrailingSpaces(str->ptr + begin, len);
   e->result_.string_val.ptr = str->ptr + begin;
-  e->result_.string_val.len = end - begin + 1;
+  e->result_.string_val.len = len;
   return &e->result_.string_val;
 }
 
@@ -191,11 +232,7 @@ void* StringFunctions::Ltrim(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 1);
   StringValue* str = reinterpret_cast<StringValue*>(e->children()[0]->GetValue(row));
   if (str == NULL) return NULL;
-  // Find new starting position.
-  int32_t begin = 0;
-  while (begin < str->len && str->ptr[begin] == ' ') {
-    ++begin;
-  }
+  int begin = CountLeadingSpaces(str->ptr, str->len);
   e->result_.string_val.ptr = str->ptr + begin;
   e->result_.string_val.len = str->len - begin;
   return &e->result_.string_val;
@@ -205,13 +242,8 @@ void* StringFunctions::Rtrim(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 1);
   StringValue* str = reinterpret_cast<StringValue*>(e->children()[0]->GetValue(row));
   if (str == NULL) return NULL;
-  // Find new ending position.
-  int32_t end = str->len - 1;
-  while (end > 0 && str->ptr[end] == ' ') {
-    --end;
-  }
   e->result_.string_val.ptr = str->ptr;
-  e->result_.string_val.len = (str->ptr[end] == ' ') ? end : end + 1;
+  e->result_.string_val.len = str->len - CountTrailingSpaces(str->ptr, str->len);
   return &e->result_.string_val;
 }
 
@@ -312,14 +344,23 @@ void* StringFunctions::Rpad(Expr* e, TupleRow* row) {
   return &e->result_.string_val;
 }
 
+const StringSearch* StringFunctions::GetSearch(Expr* e, StringValue* substr,
+    StringSearch* row_search) {
+  const StringSearch* search = static_cast<FunctionCall*>(e)->substr_search();
+  if (search != NULL) return search;
+  *row_search = StringSearch(substr);
+  return row_search;
+}
+
 void* StringFunctions::Instr(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 2);
   StringValue* str = reinterpret_cast<StringValue*>(e->children()[0]->GetValue(row));
   StringValue* substr = reinterpret_cast<StringValue*>(e->children()[1]->GetValue(row));
   if (str == NULL || substr == NULL) return NULL;
-  StringSearch search(substr);
+  StringSearch row_search;
+  const StringSearch* search = GetSearch(e, substr, &row_search);
   // Hive returns positions starting from 1.
-  e->result_.int_val = search.Search(str) + 1;
+  e->result_.int_val = search->Search(str) + 1;
   return &e->result_.int_val;
 }
 
@@ -328,9 +369,10 @@ void* StringFunctions::Locate(Expr* e, TupleRow* row) {
   StringValue* substr = reinterpret_cast<StringValue*>(e->children()[0]->GetValue(row));
   StringValue* str = reinterpret_cast<StringValue*>(e->children()[1]->GetValue(row));
   if (str == NULL || substr == NULL) return NULL;
-  StringSearch search(substr);
+  StringSearch row_search;
+  const StringSearch* search = GetSearch(e, substr, &row_search);
   // Hive returns positions starting from 1.
-  e->result_.int_val = search.Search(str) + 1;
+  e->result_.int_val = search->Search(str) + 1;
   return &e->result_.int_val;
 }
 
@@ -347,10 +389,11 @@ void* StringFunctions::LocatePos(Expr* e, TupleRow* row) {
     e->result_.int_val = 0;
     return &e->result_.int_val;
   }
-  StringSearch search(substr);
+  StringSearch row_search;
+  const StringSearch* search = GetSearch(e, substr, &row_search);
   // Input start_pos starts from 1.
   StringValue adjusted_str(str->ptr + *start_pos - 1, str->len - *start_pos + 1);
-  int32_t match_pos = search.Search(&adjusted_str);
+  int32_t match_pos = search->Search(&adjusted_str);
   if (match_pos >= 0) {
     // Hive returns the position in the original string starting from 1.
     e->result_.int_val = *start_pos + match_pos;
@@ -367,23 +410,14 @@ void* StringFunctions::RegexpExtract(Expr* e, TupleRow* row) {
   int32_t* index = reinterpret_cast<int32_t*>(e->children()[2]->GetValue(row));
   if (str == NULL || pattern == NULL || index == NULL) return NULL;
   FunctionCall* func_expr = static_cast<FunctionCall*>(e);
-  // Compile the regex if pattern is not constant,
-  // or if pattern is constant and this is the first function invocation.
-  if ((!e->children()[1]->IsConstant()) ||
-      (e->children()[1]->IsConstant() && func_expr->GetRegex() == NULL)) {
-    string pattern_str(pattern->ptr, pattern->len);
-    bool valid_pattern = func_expr->SetRegex(pattern_str);
-    // Hive throws an exception for invalid patterns.
-    if (!valid_pattern) {
-      return NULL;
-    }
-  }
-  DCHECK(func_expr->GetRegex() != NULL);
+  const regex* re = func_expr->GetRegex(*pattern);
+  // Hive throws an exception for invalid patterns.
+  if (re == NULL) return NULL;
   cmatch matches;
   // cast's are necessary to make boost understand which function we want.
   bool success = regex_search(const_cast<const char*>(str->ptr),
       const_cast<const char*>(str->ptr) + str->len,
-      matches, *func_expr->GetRegex(), regex_constants::match_any);
+      matches, *re, regex_constants::match_any);
   if (!success) {
     e->result_.SetStringVal("");
     return &e->result_.string_val;
@@ -400,18 +434,9 @@ void* StringFunctions::RegexpReplace(Expr* e, TupleRow* row) {
   StringValue* replace = reinterpret_cast<StringValue*>(e->children()[2]->GetValue(row));
   if (str == NULL || pattern == NULL || replace == NULL) return NULL;
   FunctionCall* func_expr = static_cast<FunctionCall*>(e);
-  // Compile the regex if pattern is not constant,
-  // or if pattern is constant and this is the first function invocation.
-  if ((!e->children()[1]->IsConstant()) ||
-      (e->children()[1]->IsConstant() && func_expr->GetRegex() == NULL)) {
-    string pattern_str(pattern->ptr, pattern->len);
-    bool valid_pattern = func_expr->SetRegex(pattern_str);
-    // Hive throws an exception for invalid patterns.
-    if (!valid_pattern) {
-      return NULL;
-    }
-  }
-  DCHECK(func_expr->GetRegex() != NULL);
+  const regex* re = func_expr->GetRegex(*pattern);
+  // Hive throws an exception for invalid patterns.
+  if (re == NULL) return NULL;
   // Only copy replace if it is not constant, or if it constant
   // and this is the first invocation.
   if ((!e->children()[2]->IsConstant()) ||
@@ -424,7 +449,7 @@ void* StringFunctions::RegexpReplace(Expr* e, TupleRow* row) {
   re_detail::string_out_iterator<basic_string<char> >
       out_iter(e->result_.string_data);
   regex_replace(out_iter, const_cast<const char*>(str->ptr),
-      const_cast<const char*>(str->ptr) + str->len, *func_expr->GetRegex(),
+      const_cast<const char*>(str->ptr) + str->len, *re,
       *func_expr->GetReplaceStr());
   e->result_.SyncStringVal();
   return &e->result_.string_val;
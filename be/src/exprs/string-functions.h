@@ -54,6 +54,12 @@ class StringFunctions {
   static void* FindInSet(Expr* e, TupleRow* row);
   static void* ParseUrl(Expr* e, TupleRow* row);
   static void* ParseUrlKey(Expr* e, TupleRow* row);
+
+ private:
+  // Returns the search for 'substr' in instr() and locate(): the one FunctionCall
+  // precomputed for a constant substring, or 'row_search' set up for this row.
+  static const StringSearch* GetSearch(Expr* e, StringValue* substr,
+      StringSearch* row_search);
 };
 
 }
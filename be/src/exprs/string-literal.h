@@ -39,6 +39,11 @@ class StringLiteral: public Expr {
   virtual Status Prepare(RuntimeState* state, const RowDescriptor& row_desc);
   virtual std::string DebugString() const;
 
+  virtual void EvalBatch(RowBatch* batch, const int* sel, int num_rows,
+      ExprColumn* result) {
+    EvalConstantBatch(num_rows, result);
+  }
+
  private:
   static void* ComputeFn(Expr* e, TupleRow* row);
 };
@@ -16,9 +16,13 @@
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <boost/date_time/time_zone_base.hpp>
 #include <boost/date_time/local_time/local_time.hpp>
+#include <boost/thread/locks.hpp>
+#include <algorithm>
+#include <limits>
 
 #include "exprs/timestamp-functions.h"
 #include "exprs/expr.h"
+#include "exprs/function-call.h"
 #include "runtime/tuple-row.h"
 #include "runtime/timestamp-value.h"
 #include "util/path-builder.h"
@@ -36,6 +40,8 @@ namespace impala {
 
 local_time::tz_database TimezoneDatabase::tz_database_;
 vector<string> TimezoneDatabase::tz_region_list_;
+mutex TimezoneDatabase::tables_lock_;
+TimezoneDatabase::TableMap TimezoneDatabase::tables_;
 
 void* TimestampFunctions::FromUnix(Expr* e, TupleRow* row) {
   DCHECK_LE(e->GetNumChildren(), 2);
@@ -138,8 +144,9 @@ void* TimestampFunctions::Year(Expr* e, TupleRow* row) {
 
   // If the value has been set to not_a_date_time then it will be marked special
   // therefore there is no valid date component and this function returns NULL.
-  if (tv->date().is_special()) return NULL;
-  e->result_.int_val = tv->date().year();
+  int year, month, day;
+  if (!tv->GetCivilDate(&year, &month, &day)) return NULL;
+  e->result_.int_val = year;
   return &e->result_.int_val;
 }
 
@@ -149,8 +156,9 @@ void* TimestampFunctions::Month(Expr* e, TupleRow* row) {
   TimestampValue* tv = reinterpret_cast<TimestampValue*>(op->GetValue(row));
   if (tv == NULL) return NULL;
 
-  if (tv->date().is_special()) return NULL;
-  e->result_.int_val = tv->date().month();
+  int year, month, day;
+  if (!tv->GetCivilDate(&year, &month, &day)) return NULL;
+  e->result_.int_val = month;
   return &e->result_.int_val;
 }
 
@@ -160,8 +168,10 @@ void* TimestampFunctions::Day(Expr* e, TupleRow* row) {
   TimestampValue* tv = reinterpret_cast<TimestampValue*>(op->GetValue(row));
   if (tv == NULL) return NULL;
 
-  if (tv->date().is_special()) return NULL;
-  e->result_.int_val = tv->date().day_of_year();
+  int year, month, day;
+  if (!tv->GetCivilDate(&year, &month, &day)) return NULL;
+  e->result_.int_val = tv->date().day_number() -
+      TimestampValue::DayNumberFromCivil(year, 1, 1) + 1;
   return &e->result_.int_val;
 }
 
@@ -171,8 +181,9 @@ void* TimestampFunctions::DayOfMonth(Expr* e, TupleRow* row) {
   TimestampValue* tv = reinterpret_cast<TimestampValue*>(op->GetValue(row));
   if (tv == NULL) return NULL;
 
-  if (tv->date().is_special()) return NULL;
-  e->result_.int_val = tv->date().day();
+  int year, month, day;
+  if (!tv->GetCivilDate(&year, &month, &day)) return NULL;
+  e->result_.int_val = day;
   return &e->result_.int_val;
 }
 
@@ -183,7 +194,16 @@ void* TimestampFunctions::WeekOfYear(Expr* e, TupleRow* row) {
   if (tv == NULL) return NULL;
 
   if (tv->date().is_special()) return NULL;
-  e->result_.int_val = tv->date().week_number();
+  // The ISO 8601 week number (like date::week_number()): weeks start on Monday and
+  // belong to the year of their Thursday.
+  int64_t day_number = tv->date().day_number();
+  // 0 is Monday
+  int64_t day_of_week = day_number % 7;
+  int64_t thursday = day_number - day_of_week + 3;
+  int year, month, day;
+  TimestampValue::CivilFromDayNumber(thursday, &year, &month, &day);
+  e->result_.int_val =
+      (thursday - TimestampValue::DayNumberFromCivil(year, 1, 1)) / 7 + 1;
   return &e->result_.int_val;
 }
 
@@ -235,8 +255,14 @@ void* TimestampFunctions::ToDate(Expr* e, TupleRow* row) {
   TimestampValue* tv = reinterpret_cast<TimestampValue*>(op->GetValue(row));
   if (tv == NULL) return NULL;
 
-  string result = to_iso_extended_string(tv->date());
-  e->result_.SetStringVal(result);
+  char buf[TimestampValue::MAX_STRING_LEN];
+  int len = tv->ToString(buf);
+  if (len >= 10) {
+    // just the date part
+    e->result_.SetStringVal(string(buf, 10));
+  } else {
+    e->result_.SetStringVal(to_iso_extended_string(tv->date()));
+  }
   return &e->result_.string_val;
 }
 
@@ -369,10 +395,22 @@ void* TimestampFunctions::DateDiff(Expr* e, TupleRow* row) {
   if (tv1->date().is_special()) return NULL;
   if (tv2->date().is_special()) return NULL;
 
-  e->result_.int_val = (tv2->date() - tv1->date()).days();
+  e->result_.int_val = static_cast<int64_t>(tv2->date().day_number()) -
+      tv1->date().day_number();
   return &e->result_.int_val;
 }
 
+// Returns the table of the timezone of from/to_utc_timestamp(), or NULL if it is
+// unknown.  The table of a constant timezone is looked up in FunctionCall::Prepare().
+static const TimezoneTable* GetTimezoneTable(Expr* e, const StringValue* tz) {
+  FunctionCall* func_expr = static_cast<FunctionCall*>(e);
+  if (func_expr->timezone_table_ != NULL) return func_expr->timezone_table_;
+  const TimezoneTable* table = TimezoneDatabase::FindTable(tz->DebugString());
+  // This should raise some sort of error or at least null. Hive just ignores it.
+  if (table == NULL) LOG(ERROR) << "Unknown timezone '" << *tz << "'" << endl;
+  return table;
+}
+
 void* TimestampFunctions::FromUtc(Expr* e, TupleRow* row) {
   DCHECK_EQ(e->GetNumChildren(), 2);
   Expr* op1 = e->children()[0];
@@ -383,17 +421,13 @@ void* TimestampFunctions::FromUtc(Expr* e, TupleRow* row) {
 
   if (tv->NotADateTime()) return NULL;
 
-  time_zone_ptr timezone = TimezoneDatabase::FindTimezone(tz->DebugString());
-  // This should raise some sort of error or at least null. Hive just ignores it.
-  if (timezone == NULL) {
-    LOG(ERROR) << "Unknown timezone '" << *tz << "'" << endl;
+  const TimezoneTable* table = GetTimezoneTable(e, tz);
+  if (table == NULL) {
     e->result_.timestamp_val = *tv;
     return &e->result_.timestamp_val;
   }
-  ptime temp;
-  tv->ToPtime(&temp);
-  local_date_time lt(temp, timezone);
-  e->result_.timestamp_val = lt.local_time();
+  e->result_.timestamp_val =
+      table->FromUtc(*tv, &static_cast<FunctionCall*>(e)->timezone_hint_);
   return &e->result_.timestamp_val;
 }
 
@@ -407,19 +441,116 @@ void* TimestampFunctions::ToUtc(Expr* e, TupleRow* row) {
 
   if (tv->NotADateTime()) return NULL;
 
-  time_zone_ptr timezone = TimezoneDatabase::FindTimezone(tz->DebugString());
-  // This should raise some sort of error or at least null. Hive just ignores it.
-  if (timezone == NULL) {
-    LOG(ERROR) << "Unknown timezone '" << *tz << "'" << endl;
+  const TimezoneTable* table = GetTimezoneTable(e, tz);
+  if (table == NULL) {
     e->result_.timestamp_val = *tv;
     return &e->result_.timestamp_val;
   }
-  local_date_time lt(tv->date(), tv->time_of_day(),
-                     timezone, local_date_time::NOT_DATE_TIME_ON_ERROR);
-  e->result_.timestamp_val = TimestampValue(lt.utc_time());
+  e->result_.timestamp_val =
+      table->ToUtc(*tv, &static_cast<FunctionCall*>(e)->timezone_hint_);
   return &e->result_.timestamp_val;
 }
 
+static const date EPOCH(1970, 1, 1);
+
+static int64_t ToSeconds(const ptime& t) {
+  return (t.date() - EPOCH).days() * 24 * 60 * 60LL + t.time_of_day().total_seconds();
+}
+
+// Returns false if 't' isn't covered by the intervals of TimezoneTable.
+static bool ToTableSeconds(const ptime& t, int64_t* seconds) {
+  if (t.is_special()) return false;
+  // the first and last year are left out, so that a change of the UTC offset at
+  // the turn of the year doesn't matter
+  int year = t.date().year();
+  if (year <= TimezoneTable::MIN_YEAR || year >= TimezoneTable::MAX_YEAR) return false;
+  *seconds = ToSeconds(t);
+  return true;
+}
+
+TimezoneTable::TimezoneTable(const time_zone_ptr& zone)
+  : zone_(zone) {
+  int32_t std_offset = zone->base_utc_offset().total_seconds();
+  vector<Interval> utc_changes;
+  vector<Interval> local_changes;
+  if (zone->has_dst()) {
+    // These follow boost's local_date_time: DST starts at the (standard) local time
+    // dst_local_start_time() and ends at the (DST) local time dst_local_end_time(); the
+    // local times in the first 'dst_length' seconds after the start are skipped and
+    // those in the last 'dst_length' seconds before the end are repeated.  Boost only
+    // looks at the time of day on the days of the start and end, so these periods
+    // don't reach into the next and previous day.
+    int32_t dst_length = zone->dst_offset().total_seconds();
+    int32_t dst_offset = std_offset + dst_length;
+    for (int year = MIN_YEAR; year <= MAX_YEAR; ++year) {
+      ptime start_time = zone->dst_local_start_time(year);
+      ptime end_time = zone->dst_local_end_time(year);
+      int64_t start = ToSeconds(start_time);
+      int64_t end = ToSeconds(end_time);
+      int64_t skipped_end = min(start + dst_length,
+          ToSeconds(ptime(start_time.date() + days(1))));
+      int64_t repeated_start = max(end - dst_length, ToSeconds(ptime(end_time.date())));
+      utc_changes.push_back(Interval(start - std_offset, dst_offset));
+      utc_changes.push_back(Interval(repeated_start - std_offset, std_offset));
+      local_changes.push_back(Interval(start, INVALID_OFFSET));
+      local_changes.push_back(Interval(skipped_end, dst_offset));
+      local_changes.push_back(Interval(repeated_start, INVALID_OFFSET));
+      local_changes.push_back(Interval(end, std_offset));
+    }
+  }
+  // The first interval is before MIN_YEAR and only used if there is no DST.
+  InitIntervals(&utc_changes, std_offset, &utc_intervals_);
+  InitIntervals(&local_changes, std_offset, &local_intervals_);
+}
+
+void TimezoneTable::InitIntervals(vector<Interval>* changes, int32_t offset,
+    vector<Interval>* intervals) {
+  stable_sort(changes->begin(), changes->end(), StartsBefore);
+  intervals->reserve(changes->size() + 1);
+  intervals->push_back(Interval(numeric_limits<int64_t>::min(), offset));
+  intervals->insert(intervals->end(), changes->begin(), changes->end());
+}
+
+int32_t TimezoneTable::FindOffset(const vector<Interval>& intervals, int64_t t,
+    int* hint) {
+  int i = *hint;
+  if (i < 0 || i >= intervals.size() || t < intervals[i].start ||
+      (i + 1 < intervals.size() && t >= intervals[i + 1].start)) {
+    // the last interval that starts at or before t
+    i = upper_bound(intervals.begin(), intervals.end(), t, StartsAfter)
+        - intervals.begin() - 1;
+    DCHECK_GE(i, 0);
+    *hint = i;
+  }
+  return intervals[i].offset;
+}
+
+TimestampValue TimezoneTable::FromUtc(const TimestampValue& tv, int* hint) const {
+  ptime temp;
+  tv.ToPtime(&temp);
+  int64_t seconds;
+  if (!ToTableSeconds(temp, &seconds)) {
+    local_date_time lt(temp, zone_);
+    return TimestampValue(lt.local_time());
+  }
+  return TimestampValue(
+      temp + posix_time::seconds(FindOffset(utc_intervals_, seconds, hint)));
+}
+
+TimestampValue TimezoneTable::ToUtc(const TimestampValue& tv, int* hint) const {
+  ptime temp;
+  tv.ToPtime(&temp);
+  int64_t seconds;
+  if (!ToTableSeconds(temp, &seconds)) {
+    local_date_time lt(temp.date(), temp.time_of_day(),
+                       zone_, local_date_time::NOT_DATE_TIME_ON_ERROR);
+    return TimestampValue(lt.utc_time());
+  }
+  int32_t offset = FindOffset(local_intervals_, seconds, hint);
+  if (offset == INVALID_OFFSET) return TimestampValue(ptime(not_a_date_time));
+  return TimestampValue(temp - posix_time::seconds(offset));
+}
+
 TimezoneDatabase::TimezoneDatabase() {
   // Create a temporary file and write the timezone information.  The boost
   // interface only loads this format from a file.  We don't want to raise
@@ -454,6 +585,18 @@ TimezoneDatabase::TimezoneDatabase() {
 
 TimezoneDatabase::~TimezoneDatabase() { }
 
+const TimezoneTable* TimezoneDatabase::FindTable(const string& tz) {
+  lock_guard<mutex> l(tables_lock_);
+  TableMap::iterator it = tables_.find(tz);
+  if (it != tables_.end()) return it->second.get();
+  // Unknown names aren't cached, the map would grow with every bad value.
+  time_zone_ptr zone = FindTimezone(tz);
+  if (zone == NULL) return NULL;
+  shared_ptr<TimezoneTable> table(new TimezoneTable(zone));
+  tables_[tz] = table;
+  return table.get();
+}
+
 time_zone_ptr TimezoneDatabase::FindTimezone(const string& tz) {
   // See if they specified a zone id
   if (tz.find_first_of('/') != string::npos)
@@ -16,17 +16,22 @@
 #ifndef IMPALA_EXPRS_TIMESTAMP_FUNCTIONS_H
 #define IMPALA_EXPRS_TIMESTAMP_FUNCTIONS_H
 
+#include <map>
+#include <vector>
 #include <boost/date_time/posix_time/posix_time.hpp>
 #include <boost/date_time/gregorian/gregorian.hpp>
 #include <boost/date_time/time_zone_base.hpp>
 #include <boost/date_time/local_time/local_time.hpp>
+#include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <boost/shared_ptr.hpp>
 #include "runtime/string-value.h"
 
 namespace impala {
 
 class Expr;
 class OpcodeRegistry;
+class TimestampValue;
 class TupleRow;
 
 class TimestampFunctions {
@@ -97,6 +102,65 @@ class TimestampFunctions {
 
 };
 
+// Precomputed UTC offsets of a timezone, which convert timestamps between UTC and the
+// zone's local time much faster than boost's local_date_time.  The DST transitions of
+// the years MIN_YEAR to MAX_YEAR are computed from the zone's rules once, splitting the
+// time line into intervals with a fixed UTC offset; a conversion looks up its interval
+// with a binary search, which is skipped if the timestamp falls into the interval of
+// the caller's previous conversion ('hint').  Timestamps outside of these years are
+// converted by boost.  Tables are immutable and can be shared by multiple threads.
+class TimezoneTable {
+ public:
+  static const int MIN_YEAR = 1900;
+  static const int MAX_YEAR = 2100;
+
+  TimezoneTable(const boost::local_time::time_zone_ptr& zone);
+
+  // Converts the UTC timestamp 'tv' to the zone's local time.  '*hint' is the index of
+  // the interval of the caller's last conversion, initially 0, and is updated.
+  TimestampValue FromUtc(const TimestampValue& tv, int* hint) const;
+
+  // Converts the zone's local time 'tv' to UTC.  Like boost, local times that are
+  // skipped or repeated by a DST change are converted to not-a-date-time.
+  TimestampValue ToUtc(const TimestampValue& tv, int* hint) const;
+
+ private:
+  // Offset of the local times that don't exist or aren't unique.
+  static const int32_t INVALID_OFFSET = -0x7fffffff;
+
+  struct Interval {
+    // in seconds since the epoch
+    int64_t start;
+    // the local time minus the UTC time, in seconds, or INVALID_OFFSET
+    int32_t offset;
+
+    Interval(int64_t start, int32_t offset) : start(start), offset(offset) { }
+  };
+
+  boost::local_time::time_zone_ptr zone_;
+
+  // Sorted by start; the first interval starts at the minimum int64_t.
+  // The intervals of the UTC time line, and of the local time line.
+  std::vector<Interval> utc_intervals_;
+  std::vector<Interval> local_intervals_;
+
+  // Sorts 'changes' and sets 'intervals' to them, preceded by a first interval with
+  // 'offset'.
+  static void InitIntervals(std::vector<Interval>* changes, int32_t offset,
+      std::vector<Interval>* intervals);
+
+  // Returns the offset of the interval that contains 't'; see FromUtc() for 'hint'.
+  static int32_t FindOffset(const std::vector<Interval>& intervals, int64_t t,
+      int* hint);
+
+  static bool StartsBefore(const Interval& a, const Interval& b) {
+    return a.start < b.start;
+  }
+  static bool StartsAfter(int64_t t, const Interval& interval) {
+    return t < interval.start;
+  }
+};
+
 // Functions to load and access the timestamp database.
 class TimezoneDatabase {
  public:
@@ -105,10 +169,21 @@ class TimezoneDatabase {
 
   static boost::local_time::time_zone_ptr FindTimezone(const std::string& tz);
 
+  // Returns the conversion table of the timezone 'tz' (see FindTimezone()), or NULL if
+  // there is no such timezone.  Tables are built on first use and never freed.
+  static const TimezoneTable* FindTable(const std::string& tz);
+
  private:
   static const char* TIMEZONE_DATABASE_STR;
   static boost::local_time::tz_database tz_database_;
   static std::vector<std::string> tz_region_list_;
+
+  // Protects tables_.
+  static boost::mutex tables_lock_;
+
+  // The tables of the timezones that have been looked up, by name.
+  typedef std::map<std::string, boost::shared_ptr<TimezoneTable> > TableMap;
+  static TableMap tables_;
 };
 
 }
@@ -27,6 +27,11 @@ TimestampLiteral::TimestampLiteral(double val)
   result_.timestamp_val = TimestampValue(val);
 }
 
+TimestampLiteral::TimestampLiteral(const TimestampValue& val)
+  : Expr(TYPE_TIMESTAMP) {
+  result_.timestamp_val = val;
+}
+
 void* TimestampLiteral::ComputeFn(Expr* e, TupleRow* row) {
   TimestampLiteral* l = static_cast<TimestampLiteral*>(e);
   return &l->result_.timestamp_val;
@@ -40,7 +45,7 @@ Status TimestampLiteral::Prepare(RuntimeState* state, const RowDescriptor& row_d
 
 string TimestampLiteral::DebugString() const {
   stringstream out;
-  out << "TimestampLiteral(value=" << result_.string_data << ")";
+  out << "TimestampLiteral(value=" << result_.timestamp_val << ")";
   return out.str();
 }
 
@@ -0,0 +1,181 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "runtime/block-cache.h"
+
+using namespace std;
+
+namespace impala {
+
+static const int BUFFER_SIZE = 1024;
+
+class BlockCacheTest : public testing::Test {
+ protected:
+  virtual void TearDown() {
+    for (int i = 0; i < buffers_.size(); ++i) {
+      delete[] buffers_[i];
+    }
+  }
+
+  char* NewBuffer() {
+    buffers_.push_back(new char[BUFFER_SIZE]);
+    return buffers_.back();
+  }
+
+  static BlockCache::Key BlockKey(const string& file, int64_t offset) {
+    return BlockCache::Key(file, 1, offset, BUFFER_SIZE);
+  }
+
+  // Inserts the block at 'offset' of 'file' and releases it.  Returns false if it was
+  // not cached.
+  bool InsertBlock(BlockCache* cache, const string& file, int64_t offset) {
+    vector<char*> freed;
+    BlockCache::Block* block =
+        cache->Insert(BlockKey(file, offset), NewBuffer(), BUFFER_SIZE, false, &freed);
+    if (block == NULL) return false;
+    EXPECT_TRUE(cache->Release(block) == NULL);
+    return true;
+  }
+
+  // Returns true if the block at 'offset' of 'file' is cached.
+  static bool IsCached(BlockCache* cache, const string& file, int64_t offset) {
+    BlockCache::Block* block = cache->Lookup(BlockKey(file, offset));
+    if (block == NULL) return false;
+    EXPECT_TRUE(cache->Release(block) == NULL);
+    return true;
+  }
+
+  static void Clear(BlockCache* cache) {
+    vector<char*> freed;
+    cache->Clear(&freed);
+  }
+
+  // Buffers handed to the caches, freed at the end of the test.
+  vector<char*> buffers_;
+};
+
+TEST_F(BlockCacheTest, Basic) {
+  BlockCache cache(4 * BUFFER_SIZE, BUFFER_SIZE);
+  char* data = NewBuffer();
+  vector<char*> freed;
+  BlockCache::Key key("/file", 1, 0, BUFFER_SIZE);
+  BlockCache::Block* block = cache.Insert(key, data, 10, true, &freed);
+  ASSERT_TRUE(block != NULL);
+  EXPECT_TRUE(freed.empty());
+  EXPECT_EQ(cache.cached_bytes(), BUFFER_SIZE);
+
+  // The same block can't be inserted twice.
+  EXPECT_TRUE(cache.Insert(key, NewBuffer(), 10, true, &freed) == NULL);
+
+  BlockCache::Block* hit = cache.Lookup(key);
+  ASSERT_TRUE(hit == block);
+  EXPECT_EQ(hit->data(), data);
+  EXPECT_EQ(hit->len(), 10);
+  EXPECT_TRUE(hit->eof());
+  EXPECT_TRUE(cache.Release(hit) == NULL);
+  EXPECT_TRUE(cache.Release(block) == NULL);
+
+  // A different mtime, offset or length is a different block.
+  EXPECT_TRUE(cache.Lookup(BlockCache::Key("/file", 2, 0, BUFFER_SIZE)) == NULL);
+  EXPECT_TRUE(cache.Lookup(BlockCache::Key("/file", 1, 1, BUFFER_SIZE)) == NULL);
+  EXPECT_TRUE(cache.Lookup(BlockCache::Key("/file", 1, 0, 10)) == NULL);
+  EXPECT_EQ(cache.num_hits(), 1);
+  EXPECT_EQ(cache.num_misses(), 3);
+
+  cache.Clear(&freed);
+  ASSERT_EQ(freed.size(), 1);
+  EXPECT_EQ(freed[0], data);
+  EXPECT_EQ(cache.cached_bytes(), 0);
+}
+
+// A block that is evicted while it is referenced is freed by its last Release().
+TEST_F(BlockCacheTest, EvictReferenced) {
+  BlockCache cache(1 * BUFFER_SIZE, BUFFER_SIZE);
+  vector<char*> freed;
+  char* data = NewBuffer();
+  BlockCache::Block* block =
+      cache.Insert(BlockKey("/file", 0), data, BUFFER_SIZE, false, &freed);
+  ASSERT_TRUE(block != NULL);
+  BlockCache::Block* hit = cache.Lookup(BlockKey("/file", 0));
+  ASSERT_TRUE(hit != NULL);
+
+  ASSERT_TRUE(InsertBlock(&cache, "/file", BUFFER_SIZE));
+  EXPECT_FALSE(IsCached(&cache, "/file", 0));
+  EXPECT_EQ(block->data(), data);
+  EXPECT_TRUE(cache.Release(block) == NULL);
+  EXPECT_EQ(cache.Release(hit), data);
+  Clear(&cache);
+}
+
+// Blocks that are read repeatedly survive a scan of many blocks that are read once.
+TEST_F(BlockCacheTest, ScanResistance) {
+  BlockCache cache(8 * BUFFER_SIZE, BUFFER_SIZE);
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(InsertBlock(&cache, "/hot", i * BUFFER_SIZE));
+    EXPECT_TRUE(IsCached(&cache, "/hot", i * BUFFER_SIZE));
+  }
+  for (int i = 0; i < 100; ++i) {
+    ASSERT_TRUE(InsertBlock(&cache, "/scan", i * BUFFER_SIZE));
+  }
+  for (int i = 0; i < 4; ++i) {
+    EXPECT_TRUE(IsCached(&cache, "/hot", i * BUFFER_SIZE)) << i;
+  }
+  EXPECT_LE(cache.cached_bytes(), 8 * BUFFER_SIZE);
+
+  // A block that is read again shortly after it was evicted from the FIFO queue goes
+  // to the LRU queue.
+  EXPECT_FALSE(IsCached(&cache, "/scan", 95 * BUFFER_SIZE));
+  ASSERT_TRUE(InsertBlock(&cache, "/scan", 95 * BUFFER_SIZE));
+  for (int i = 100; i < 200; ++i) {
+    ASSERT_TRUE(InsertBlock(&cache, "/scan", i * BUFFER_SIZE));
+  }
+  EXPECT_TRUE(IsCached(&cache, "/scan", 95 * BUFFER_SIZE));
+  Clear(&cache);
+}
+
+TEST_F(BlockCacheTest, Pinning) {
+  BlockCache cache(4 * BUFFER_SIZE, BUFFER_SIZE);
+  ASSERT_TRUE(InsertBlock(&cache, "/warehouse/dim/file", 0));
+  cache.PinPath("/warehouse/dim/");
+  ASSERT_TRUE(InsertBlock(&cache, "/warehouse/dim/file", BUFFER_SIZE));
+  for (int i = 0; i < 20; ++i) {
+    ASSERT_TRUE(InsertBlock(&cache, "/warehouse/fact/file", i * BUFFER_SIZE));
+    EXPECT_TRUE(IsCached(&cache, "/warehouse/fact/file", i * BUFFER_SIZE));
+  }
+  EXPECT_TRUE(IsCached(&cache, "/warehouse/dim/file", 0));
+  EXPECT_TRUE(IsCached(&cache, "/warehouse/dim/file", BUFFER_SIZE));
+
+  // Pinned blocks are not evicted to make room for other pinned blocks either.
+  ASSERT_TRUE(InsertBlock(&cache, "/warehouse/dim/file", 2 * BUFFER_SIZE));
+  ASSERT_TRUE(InsertBlock(&cache, "/warehouse/dim/file", 3 * BUFFER_SIZE));
+  EXPECT_FALSE(InsertBlock(&cache, "/warehouse/dim/file", 4 * BUFFER_SIZE));
+  EXPECT_FALSE(InsertBlock(&cache, "/warehouse/fact/file", 0));
+
+  // The blocks are evictable again once the path is unpinned.
+  cache.UnpinPath("/warehouse/dim/");
+  ASSERT_TRUE(InsertBlock(&cache, "/warehouse/fact/file", 0));
+  EXPECT_LE(cache.cached_bytes(), 4 * BUFFER_SIZE);
+  Clear(&cache);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
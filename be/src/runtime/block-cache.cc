@@ -0,0 +1,224 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/block-cache.h"
+
+#include <algorithm>
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+bool BlockCache::Key::operator<(const Key& other) const {
+  if (offset != other.offset) return offset < other.offset;
+  if (len != other.len) return len < other.len;
+  if (mtime != other.mtime) return mtime < other.mtime;
+  return file < other.file;
+}
+
+BlockCache::BlockCache(int64_t capacity, int buffer_size)
+  : capacity_(capacity),
+    buffer_size_(buffer_size),
+    max_blocks_(capacity / buffer_size),
+    max_a1in_blocks_(max<int64_t>(1, max_blocks_ / 4)),
+    max_a1out_keys_(max<int64_t>(1, max_blocks_ / 2)),
+    num_a1in_blocks_(0),
+    num_hits_(0),
+    num_misses_(0) {
+  DCHECK_GT(buffer_size, 0);
+}
+
+BlockCache::~BlockCache() {
+  DCHECK(blocks_.empty());
+}
+
+bool BlockCache::IsPinned(const string& file) const {
+  for (int i = 0; i < pinned_prefixes_.size(); ++i) {
+    if (file.compare(0, pinned_prefixes_[i].size(), pinned_prefixes_[i]) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void BlockCache::PinPath(const string& prefix) {
+  lock_guard<mutex> l(lock_);
+  pinned_prefixes_.push_back(prefix);
+  for (BlockMap::iterator it = blocks_.begin(); it != blocks_.end(); ++it) {
+    if (it->second->queue_ != Block::PINNED && IsPinned(it->first.file)) {
+      MoveToQueue(it->second, Block::PINNED);
+    }
+  }
+}
+
+void BlockCache::UnpinPath(const string& prefix) {
+  lock_guard<mutex> l(lock_);
+  vector<string>::iterator prefix_it =
+      find(pinned_prefixes_.begin(), pinned_prefixes_.end(), prefix);
+  if (prefix_it == pinned_prefixes_.end()) return;
+  pinned_prefixes_.erase(prefix_it);
+  // The blocks that are no longer pinned were used often enough to be pinned.
+  BlockList::iterator it = pinned_.begin();
+  while (it != pinned_.end()) {
+    Block* block = *it++;
+    if (!IsPinned(block->key_.file)) MoveToQueue(block, Block::AM);
+  }
+}
+
+BlockCache::Block* BlockCache::Lookup(const Key& key) {
+  lock_guard<mutex> l(lock_);
+  BlockMap::iterator it = blocks_.find(key);
+  if (it == blocks_.end()) {
+    ++num_misses_;
+    return NULL;
+  }
+  ++num_hits_;
+  Block* block = it->second;
+  if (block->queue_ != Block::PINNED) MoveToQueue(block, Block::AM);
+  ++block->num_refs_;
+  return block;
+}
+
+BlockCache::Block* BlockCache::Insert(const Key& key, char* data, int64_t len,
+    bool eof, vector<char*>* freed) {
+  DCHECK(data != NULL);
+  DCHECK_LE(len, buffer_size_);
+  lock_guard<mutex> l(lock_);
+  // Another reader may have read the same block at the same time.
+  if (blocks_.find(key) != blocks_.end()) return NULL;
+  if (!MakeRoom(freed)) return NULL;
+
+  Block* block = new Block(key, data, len, eof);
+  blocks_[key] = block;
+  Block::Queue queue = Block::A1IN;
+  if (IsPinned(key.file)) {
+    queue = Block::PINNED;
+  } else {
+    map<Key, KeyList::iterator>::iterator a1out_it = a1out_index_.find(key);
+    if (a1out_it != a1out_index_.end()) {
+      // The block was evicted from a1in recently: it is read repeatedly.
+      a1out_.erase(a1out_it->second);
+      a1out_index_.erase(a1out_it);
+      queue = Block::AM;
+    }
+  }
+  MoveToQueue(block, queue);
+  ++block->num_refs_;
+  return block;
+}
+
+char* BlockCache::Release(Block* block) {
+  lock_guard<mutex> l(lock_);
+  DCHECK_GT(block->num_refs_, 0);
+  if (--block->num_refs_ > 0 || block->queue_ != Block::NONE) return NULL;
+  char* data = block->data_;
+  delete block;
+  return data;
+}
+
+void BlockCache::Clear(vector<char*>* freed) {
+  lock_guard<mutex> l(lock_);
+  while (!blocks_.empty()) {
+    Evict(blocks_.begin()->second, freed);
+  }
+  a1out_.clear();
+  a1out_index_.clear();
+}
+
+int64_t BlockCache::cached_bytes() {
+  lock_guard<mutex> l(lock_);
+  return blocks_.size() * buffer_size_;
+}
+
+int64_t BlockCache::num_hits() {
+  lock_guard<mutex> l(lock_);
+  return num_hits_;
+}
+
+int64_t BlockCache::num_misses() {
+  lock_guard<mutex> l(lock_);
+  return num_misses_;
+}
+
+void BlockCache::MoveToQueue(Block* block, Block::Queue queue) {
+  switch (block->queue_) {
+    case Block::A1IN:
+      a1in_.erase(block->queue_it_);
+      --num_a1in_blocks_;
+      break;
+    case Block::AM:
+      am_.erase(block->queue_it_);
+      break;
+    case Block::PINNED:
+      pinned_.erase(block->queue_it_);
+      break;
+    case Block::NONE:
+      break;
+  }
+  block->queue_ = queue;
+  switch (queue) {
+    case Block::A1IN:
+      a1in_.push_front(block);
+      block->queue_it_ = a1in_.begin();
+      ++num_a1in_blocks_;
+      break;
+    case Block::AM:
+      am_.push_front(block);
+      block->queue_it_ = am_.begin();
+      break;
+    case Block::PINNED:
+      pinned_.push_front(block);
+      block->queue_it_ = pinned_.begin();
+      break;
+    case Block::NONE:
+      break;
+  }
+}
+
+void BlockCache::Evict(Block* block, vector<char*>* freed) {
+  MoveToQueue(block, Block::NONE);
+  blocks_.erase(block->key_);
+  if (block->num_refs_ == 0) {
+    freed->push_back(block->data_);
+    delete block;
+  }
+}
+
+bool BlockCache::MakeRoom(vector<char*>* freed) {
+  while (blocks_.size() >= max_blocks_) {
+    Block* victim;
+    if (!a1in_.empty() && (num_a1in_blocks_ >= max_a1in_blocks_ || am_.empty())) {
+      victim = a1in_.back();
+      a1out_.push_front(victim->key_);
+      a1out_index_[victim->key_] = a1out_.begin();
+      if (a1out_index_.size() > max_a1out_keys_) {
+        a1out_index_.erase(a1out_.back());
+        a1out_.pop_back();
+      }
+    } else if (!am_.empty()) {
+      victim = am_.back();
+    } else {
+      // Only pinned blocks are left.
+      return false;
+    }
+    Evict(victim, freed);
+  }
+  return true;
+}
+
+}
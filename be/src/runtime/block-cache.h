@@ -0,0 +1,176 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_BLOCK_CACHE_H
+#define IMPALA_RUNTIME_BLOCK_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+namespace impala {
+
+// Cache of the io buffers the DiskIoMgr read from files, so that files that are read
+// over and over (e.g. dimension tables) are served from memory.  The cache holds at
+// most 'capacity' bytes of buffers (each block is charged the full buffer size).
+// Blocks are handed out by reference, without copying: Lookup() and Insert() return a
+// block with a reference that the caller gives up with Release().  A block that is
+// evicted while referenced stays valid until its last reference is released.
+// The buffers of cached blocks are shared by all readers and must not be modified.
+//
+// Eviction follows 2Q (Johnson and Shasha), which keeps a sequential scan of a large
+// file from flushing the blocks that are read repeatedly:
+//  - blocks enter a FIFO queue (a1in), which holds at most a quarter of the capacity,
+//  - blocks that are hit again move to an LRU queue (am),
+//  - the keys of blocks evicted from a1in are remembered (a1out), and a block whose
+//    key is remembered enters am directly when it is read again.
+// Blocks of files under a pinned path prefix (PinPath()) are never evicted.
+// All functions are thread safe.
+class BlockCache {
+ public:
+  // Identifies a block: the read of 'len' bytes at 'offset' of 'file', as of the
+  // file's modification time 'mtime'.
+  struct Key {
+    std::string file;
+    int64_t mtime;
+    int64_t offset;
+    int64_t len;
+
+    Key(const std::string& file, int64_t mtime, int64_t offset, int64_t len)
+      : file(file), mtime(mtime), offset(offset), len(len) {
+    }
+
+    bool operator<(const Key& other) const;
+  };
+
+  class Block {
+   public:
+    // The bytes read for the key.  'len' is less than the key's len if the read
+    // reached the end of the file, 'eof' is then true.
+    char* data() const { return data_; }
+    int64_t len() const { return len_; }
+    bool eof() const { return eof_; }
+
+   private:
+    friend class BlockCache;
+    enum Queue { NONE, A1IN, AM, PINNED };
+
+    Block(const Key& key, char* data, int64_t len, bool eof)
+      : key_(key), data_(data), len_(len), eof_(eof), num_refs_(0), queue_(NONE) {
+    }
+
+    Key key_;
+    char* data_;
+    int64_t len_;
+    bool eof_;
+
+    // Number of Lookup()/Insert() references not yet released.
+    int num_refs_;
+
+    // Queue the block is on (and position in it), NONE once evicted.
+    Queue queue_;
+    std::list<Block*>::iterator queue_it_;
+  };
+
+  // 'buffer_size' is the allocated size of each buffer.
+  BlockCache(int64_t capacity, int buffer_size);
+
+  // Clear() must have been called and all blocks must have been released.
+  ~BlockCache();
+
+  // Keeps the blocks of files whose path starts with 'prefix' (e.g. a table
+  // directory) in the cache until UnpinPath(prefix) is called.  Pinned blocks count
+  // against the capacity.
+  void PinPath(const std::string& prefix);
+  void UnpinPath(const std::string& prefix);
+
+  // Returns the block for 'key', with a reference, or NULL if it is not cached.
+  Block* Lookup(const Key& key);
+
+  // Adds the 'len' bytes read for 'key' in the buffer 'data' to the cache.  On success,
+  // the cache owns 'data' and the block is returned with a reference.  Returns NULL if
+  // the block is not cached, e.g. because the cache is full of pinned or referenced
+  // blocks; the caller keeps 'data' then.  The buffers of blocks evicted to make room
+  // are appended to 'freed', for the caller to free.
+  Block* Insert(const Key& key, char* data, int64_t len, bool eof,
+      std::vector<char*>* freed);
+
+  // Gives up a reference to 'block'.  Returns the block's buffer if the caller needs
+  // to free it (the block was evicted and this was the last reference), else NULL.
+  char* Release(Block* block);
+
+  // Removes all cached blocks and appends the buffers of the unreferenced ones to
+  // 'freed'.
+  void Clear(std::vector<char*>* freed);
+
+  int64_t capacity() const { return capacity_; }
+  int64_t cached_bytes();
+  int64_t num_hits();
+  int64_t num_misses();
+
+ private:
+  typedef std::list<Block*> BlockList;
+  typedef std::map<Key, Block*> BlockMap;
+
+  const int64_t capacity_;
+  const int buffer_size_;
+
+  // Maximum number of blocks in the cache, in a1in_ and of keys in a1out_.
+  const int64_t max_blocks_;
+  const int64_t max_a1in_blocks_;
+  const int64_t max_a1out_keys_;
+
+  // Protects all members below.
+  boost::mutex lock_;
+
+  // All cached blocks, by key.
+  BlockMap blocks_;
+
+  // The queues of the cached blocks.  New blocks are added at the front.
+  BlockList a1in_;
+  BlockList am_;
+  BlockList pinned_;
+  int64_t num_a1in_blocks_;
+
+  // Keys of the blocks last evicted from a1in_, most recent first, and their index.
+  typedef std::list<Key> KeyList;
+  KeyList a1out_;
+  std::map<Key, KeyList::iterator> a1out_index_;
+
+  std::vector<std::string> pinned_prefixes_;
+
+  int64_t num_hits_;
+  int64_t num_misses_;
+
+  bool IsPinned(const std::string& file) const;
+
+  // Removes 'block' from its queue and adds it to the front of 'queue'.
+  void MoveToQueue(Block* block, Block::Queue queue);
+
+  // Removes 'block' from its queue and the map.  Deletes it and appends its buffer to
+  // 'freed' if it is not referenced.
+  void Evict(Block* block, std::vector<char*>* freed);
+
+  // Evicts blocks until there is room for one more.  Returns false if there are not
+  // enough evictable blocks.
+  bool MakeRoom(std::vector<char*>* freed);
+};
+
+}
+
+#endif
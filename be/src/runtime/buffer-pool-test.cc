@@ -0,0 +1,189 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <gtest/gtest.h>
+
+#include "runtime/buffer-pool.h"
+#include "runtime/disk-io-mgr.h"
+#include "runtime/scratch-mgr.h"
+#include "util/cpu-info.h"
+#include "util/disk-info.h"
+
+using namespace std;
+using boost::scoped_ptr;
+
+DECLARE_string(scratch_dirs);
+
+namespace impala {
+
+static const int PAGE_SIZE = 1024;
+
+class BufferPoolTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/buffer-pool-test-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    FLAGS_scratch_dirs = dir_;
+    io_mgr_.reset(new DiskIoMgr(1, 2, PAGE_SIZE));
+    ASSERT_TRUE(io_mgr_->Init().ok());
+    scratch_mgr_.reset(new ScratchMgr(io_mgr_.get()));
+    ASSERT_TRUE(scratch_mgr_->Init().ok());
+  }
+
+  virtual void TearDown() {
+    scratch_mgr_.reset();
+    io_mgr_.reset();
+    rmdir(dir_.c_str());
+  }
+
+  static void Fill(BufferPool::Page* page, int seed) {
+    for (int i = 0; i < PAGE_SIZE; ++i) page->data()[i] = i * 7 + seed;
+  }
+
+  static bool Check(BufferPool::Page* page, int seed) {
+    for (int i = 0; i < PAGE_SIZE; ++i) {
+      if (page->data()[i] != static_cast<uint8_t>(i * 7 + seed)) return false;
+    }
+    return true;
+  }
+
+  // Cycles 'num_pages' pages of its own through pin, write, unpin, pin and check.
+  static void Worker(BufferPool* pool, int num_pages, int seed, int* num_errors) {
+    vector<BufferPool::Page*> pages(num_pages);
+    for (int i = 0; i < num_pages; ++i) {
+      if (!pool->NewPage(&pages[i]).ok()) {
+        ++*num_errors;
+        pages.resize(i);
+        break;
+      }
+      Fill(pages[i], seed + i);
+      pool->Unpin(pages[i]);
+    }
+    for (int round = 0; round < 10; ++round) {
+      for (int i = 0; i < pages.size(); ++i) {
+        if (!pool->Pin(pages[i]).ok() || !Check(pages[i], seed + i)) ++*num_errors;
+        pool->Unpin(pages[i]);
+      }
+    }
+    for (int i = 0; i < pages.size(); ++i) pool->FreePage(pages[i]);
+  }
+
+  string dir_;
+  scoped_ptr<DiskIoMgr> io_mgr_;
+  scoped_ptr<ScratchMgr> scratch_mgr_;
+};
+
+TEST_F(BufferPoolTest, NoLimit) {
+  MemTracker parent;
+  BufferPool pool(io_mgr_.get(), scratch_mgr_.get(), -1, &parent);
+  EXPECT_EQ(pool.page_size(), PAGE_SIZE);
+  vector<BufferPool::Page*> pages(10);
+  for (int i = 0; i < pages.size(); ++i) {
+    ASSERT_TRUE(pool.NewPage(&pages[i]).ok());
+    Fill(pages[i], i);
+    if (i % 2 == 0) pool.Unpin(pages[i]);
+  }
+  EXPECT_EQ(pool.bytes_allocated(), 10 * PAGE_SIZE);
+  EXPECT_EQ(parent.consumption(), 10 * PAGE_SIZE);
+  for (int i = 0; i < pages.size(); ++i) {
+    ASSERT_TRUE(pool.Pin(pages[i]).ok());
+    EXPECT_TRUE(Check(pages[i], i));
+    pool.FreePage(pages[i]);
+  }
+  EXPECT_EQ(pool.num_evictions(), 0);
+
+  // Freed memory is reused.
+  BufferPool::Page* page;
+  ASSERT_TRUE(pool.NewPage(&page).ok());
+  EXPECT_EQ(pool.bytes_allocated(), 10 * PAGE_SIZE);
+  pool.FreePage(page);
+}
+
+TEST_F(BufferPoolTest, Eviction) {
+  BufferPool pool(io_mgr_.get(), scratch_mgr_.get(), 4 * PAGE_SIZE);
+  vector<BufferPool::Page*> pages(10);
+  for (int i = 0; i < pages.size(); ++i) {
+    ASSERT_TRUE(pool.NewPage(&pages[i]).ok());
+    Fill(pages[i], i);
+    pool.Unpin(pages[i]);
+  }
+  EXPECT_EQ(pool.bytes_allocated(), 4 * PAGE_SIZE);
+  EXPECT_EQ(pool.num_evictions(), 6);
+
+  // Pinning the evicted pages evicts the others.
+  for (int i = 0; i < pages.size(); ++i) {
+    ASSERT_TRUE(pool.Pin(pages[i]).ok());
+    EXPECT_TRUE(Check(pages[i], i)) << i;
+    pool.Unpin(pages[i]);
+  }
+  EXPECT_EQ(pool.bytes_allocated(), 4 * PAGE_SIZE);
+
+  // With all memory pinned, allocations fail.
+  for (int i = 0; i < 4; ++i) ASSERT_TRUE(pool.Pin(pages[i]).ok());
+  BufferPool::Page* page;
+  EXPECT_FALSE(pool.NewPage(&page).ok());
+  EXPECT_FALSE(pool.Pin(pages[4]).ok());
+  EXPECT_FALSE(pages[4]->is_pinned());
+
+  for (int i = 0; i < pages.size(); ++i) pool.FreePage(pages[i]);
+  ASSERT_TRUE(pool.NewPage(&page).ok());
+  pool.FreePage(page);
+}
+
+TEST_F(BufferPoolTest, NoScratch) {
+  BufferPool pool(io_mgr_.get(), NULL, 2 * PAGE_SIZE);
+  BufferPool::Page* pages[3];
+  ASSERT_TRUE(pool.NewPage(&pages[0]).ok());
+  ASSERT_TRUE(pool.NewPage(&pages[1]).ok());
+  pool.Unpin(pages[0]);
+  EXPECT_FALSE(pool.NewPage(&pages[2]).ok());
+  ASSERT_TRUE(pool.Pin(pages[0]).ok());
+  pool.FreePage(pages[0]);
+  pool.FreePage(pages[1]);
+}
+
+// Threads pin and unpin their pages concurrently.  Even the pages of a single thread
+// don't fit, but the pages they pin at a time do.
+TEST_F(BufferPoolTest, Concurrency) {
+  const int NUM_THREADS = 4;
+  const int PAGES_PER_THREAD = 8;
+  BufferPool pool(io_mgr_.get(), scratch_mgr_.get(), (NUM_THREADS + 2) * PAGE_SIZE);
+  boost::thread_group threads;
+  int num_errors[NUM_THREADS];
+  for (int i = 0; i < NUM_THREADS; ++i) {
+    num_errors[i] = 0;
+    threads.add_thread(new boost::thread(&BufferPoolTest::Worker, &pool,
+        PAGES_PER_THREAD, i * 100, &num_errors[i]));
+  }
+  threads.join_all();
+  for (int i = 0; i < NUM_THREADS; ++i) EXPECT_EQ(num_errors[i], 0);
+  EXPECT_GT(pool.num_evictions(), 0);
+  EXPECT_LE(pool.bytes_allocated(), pool.limit());
+}
+
+}
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
+  impala::DiskInfo::Init();
+  return RUN_ALL_TESTS();
+}
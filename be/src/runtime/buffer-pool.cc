@@ -0,0 +1,225 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/buffer-pool.h"
+
+#include <string.h>
+#include <unistd.h>
+#include <sstream>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+
+#include "runtime/disk-io-mgr.h"
+#include "runtime/huge-page-allocator.h"
+#include "runtime/scratch-mgr.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+// Waits for the completion of a write range.
+struct WriteWaiter {
+  mutex lock;
+  condition_variable done_cv;
+  bool done;
+  Status status;
+
+  WriteWaiter() : done(false) {}
+
+  // Notifies with the lock held, since the waiter is destroyed once Wait() returns.
+  void Done(const Status& write_status) {
+    lock_guard<mutex> l(lock);
+    status = write_status;
+    done = true;
+    done_cv.notify_one();
+  }
+
+  Status Wait() {
+    unique_lock<mutex> l(lock);
+    while (!done) done_cv.wait(l);
+    return status;
+  }
+};
+
+BufferPool::BufferPool(DiskIoMgr* io_mgr, ScratchMgr* scratch_mgr, int64_t limit,
+    MemTracker* parent_tracker)
+  : io_mgr_(io_mgr),
+    scratch_mgr_(scratch_mgr),
+    page_size_(io_mgr->read_buffer_size()),
+    tracker_(limit, "Buffer pool", parent_tracker),
+    disk_id_(-1),
+    file_len_(0),
+    num_pages_(0),
+    num_evictions_(0) {
+}
+
+BufferPool::~BufferPool() {
+  DCHECK_EQ(num_pages_, 0);
+  for (int i = 0; i < free_buffers_.size(); ++i) {
+    HugePageAllocator::Free(free_buffers_[i], page_size_);
+  }
+  tracker_.Release(free_buffers_.size() * page_size_);
+  if (!path_.empty()) unlink(path_.c_str());
+}
+
+Status BufferPool::NewPage(Page** page) {
+  uint8_t* buffer;
+  RETURN_IF_ERROR(AllocateBuffer(&buffer));
+  *page = new Page(buffer);
+  lock_guard<mutex> l(lock_);
+  ++num_pages_;
+  return Status::OK;
+}
+
+void BufferPool::Unpin(Page* page) {
+  lock_guard<mutex> l(lock_);
+  DCHECK_EQ(page->state_, Page::PINNED);
+  page->state_ = Page::UNPINNED;
+  page->unpinned_it_ = unpinned_pages_.insert(unpinned_pages_.end(), page);
+}
+
+Status BufferPool::Pin(Page* page) {
+  {
+    unique_lock<mutex> l(lock_);
+    while (page->state_ == Page::EVICTING) evicted_cv_.wait(l);
+    if (page->state_ == Page::PINNED) return Status::OK;
+    if (page->state_ == Page::UNPINNED) {
+      unpinned_pages_.erase(page->unpinned_it_);
+      page->state_ = Page::PINNED;
+      return Status::OK;
+    }
+  }
+  // The page is evicted and not on unpinned_pages_, so only this thread uses it.
+  DCHECK_EQ(page->state_, Page::EVICTED);
+  uint8_t* buffer;
+  RETURN_IF_ERROR(AllocateBuffer(&buffer));
+  Status status = ReadPage(page, buffer);
+  lock_guard<mutex> l(lock_);
+  if (!status.ok()) {
+    free_buffers_.push_back(buffer);
+    return status;
+  }
+  page->data_ = buffer;
+  page->state_ = Page::PINNED;
+  return Status::OK;
+}
+
+void BufferPool::FreePage(Page* page) {
+  {
+    unique_lock<mutex> l(lock_);
+    while (page->state_ == Page::EVICTING) evicted_cv_.wait(l);
+    if (page->state_ == Page::UNPINNED) unpinned_pages_.erase(page->unpinned_it_);
+    if (page->data_ != NULL) free_buffers_.push_back(page->data_);
+    if (page->file_offset_ >= 0) free_slots_.push_back(page->file_offset_);
+    DCHECK_GT(num_pages_, 0);
+    --num_pages_;
+  }
+  delete page;
+}
+
+Status BufferPool::AllocateBuffer(uint8_t** buffer) {
+  Page* victim;
+  {
+    lock_guard<mutex> l(lock_);
+    if (!free_buffers_.empty()) {
+      *buffer = free_buffers_.back();
+      free_buffers_.pop_back();
+      return Status::OK;
+    }
+    if (!tracker_.has_limit() || tracker_.consumption() + page_size_ <= limit()) {
+      tracker_.Consume(page_size_);
+      victim = NULL;
+    } else if (unpinned_pages_.empty() || scratch_mgr_ == NULL) {
+      stringstream ss;
+      ss << "Buffer pool limit of " << limit() << " bytes exceeded: "
+         << unpinned_pages_.size() << " of " << num_pages_ << " pages are unpinned"
+         << (scratch_mgr_ == NULL ? " and there is no scratch space to evict to" : "");
+      return Status(ss.str());
+    } else {
+      victim = unpinned_pages_.front();
+      unpinned_pages_.pop_front();
+      victim->state_ = Page::EVICTING;
+    }
+  }
+  if (victim == NULL) {
+    *buffer = reinterpret_cast<uint8_t*>(HugePageAllocator::Allocate(page_size_));
+    return Status::OK;
+  }
+
+  // Write the victim out without holding the lock; its owner waits in Pin() or
+  // FreePage() if it needs the page meanwhile.
+  Status status = WritePage(victim);
+  lock_guard<mutex> l(lock_);
+  if (status.ok()) {
+    *buffer = victim->data_;
+    victim->data_ = NULL;
+    victim->state_ = Page::EVICTED;
+    ++num_evictions_;
+  } else {
+    // The page keeps its memory and its place as the next victim.
+    victim->state_ = Page::UNPINNED;
+    victim->unpinned_it_ = unpinned_pages_.insert(unpinned_pages_.begin(), victim);
+  }
+  evicted_cv_.notify_all();
+  return status;
+}
+
+Status BufferPool::WritePage(Page* page) {
+  {
+    lock_guard<mutex> l(lock_);
+    if (path_.empty()) {
+      string path;
+      int disk_id;
+      RETURN_IF_ERROR(scratch_mgr_->CreateFile("buffer-pool", &path, &disk_id));
+      path_ = path;
+      disk_id_ = disk_id;
+    }
+    if (page->file_offset_ < 0) {
+      if (free_slots_.empty()) {
+        page->file_offset_ = file_len_;
+        file_len_ += page_size_;
+      } else {
+        page->file_offset_ = free_slots_.back();
+        free_slots_.pop_back();
+      }
+    }
+  }
+  WriteWaiter waiter;
+  DiskIoMgr::WriteRange range;
+  range.Reset(path_.c_str(), page->file_offset_, disk_id_,
+      reinterpret_cast<const char*>(page->data_), page_size_,
+      bind(&WriteWaiter::Done, &waiter, _1));
+  RETURN_IF_ERROR(io_mgr_->AddWriteRange(&range));
+  return waiter.Wait();
+}
+
+Status BufferPool::ReadPage(Page* page, uint8_t* buffer) {
+  DCHECK_GE(page->file_offset_, 0);
+  DiskIoMgr::ScanRange range;
+  range.Reset(path_.c_str(), page_size_, page->file_offset_, disk_id_);
+  DiskIoMgr::BufferDescriptor* io_buffer = NULL;
+  Status status = io_mgr_->Read(NULL, &range, &io_buffer);
+  if (status.ok() && io_buffer->len() != page_size_) {
+    stringstream ss;
+    ss << "Short read of evicted page from " << path_ << " at offset "
+       << page->file_offset_ << ": " << io_buffer->len() << " bytes";
+    status = Status(ss.str());
+  }
+  if (status.ok()) memcpy(buffer, io_buffer->buffer(), page_size_);
+  if (io_buffer != NULL) io_buffer->Return();
+  return status;
+}
+
+}
@@ -0,0 +1,160 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_BUFFER_POOL_H
+#define IMPALA_RUNTIME_BUFFER_POOL_H
+
+#include <list>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "common/logging.h"
+#include "common/status.h"
+#include "runtime/mem-tracker.h"
+
+namespace impala {
+
+class DiskIoMgr;
+class ScratchMgr;
+
+// Process-wide pool of fixed-size pages for the large buffers of operators (hash
+// tables, sort runs, spilled partitions), so that their memory is bounded as a
+// whole and reused across queries rather than allocated separately by each.
+// The pages are as large as the io mgr's buffers (DiskIoMgr::read_buffer_size()).
+// A page is either pinned, when its memory can be used, or unpinned, when the client
+// does not need it for now.  To stay below its limit the pool evicts unpinned pages,
+// least recently unpinned first: their contents are written to a scratch file
+// (ScratchMgr::CreateFile()) through the io mgr, and their memory is given to the
+// page being allocated.  Pinning an evicted page reads it back.  With no scratch mgr,
+// or with all pages pinned, allocations beyond the limit fail.
+// Memory of freed pages is kept in the pool for the next allocation; all of the
+// pool's memory is charged to its MemTracker.
+// All functions of the pool are thread-safe; a page must only be used by one thread
+// at a time.
+class BufferPool {
+ public:
+  class Page;
+
+  // 'io_mgr' and 'scratch_mgr' must outlive the pool; 'scratch_mgr' may be NULL, in
+  // which case pages are never evicted.  'limit' is in bytes, < 0 for no limit.
+  // The pool's memory is also charged to 'parent_tracker', if non-NULL.
+  BufferPool(DiskIoMgr* io_mgr, ScratchMgr* scratch_mgr, int64_t limit,
+      MemTracker* parent_tracker = NULL);
+
+  // All pages must have been freed.
+  ~BufferPool();
+
+  // Allocates a new, pinned page.  Its contents are undefined.  Evicts an unpinned
+  // page if the pool is at its limit, and returns an error if that is not possible.
+  Status NewPage(Page** page);
+
+  // Unpins 'page', which must be pinned: its contents are kept, but may be evicted.
+  void Unpin(Page* page);
+
+  // Pins 'page', reading its contents back if it was evicted.  data() can be used
+  // again after this.  No-op if the page is pinned.
+  Status Pin(Page* page);
+
+  // Frees 'page', pinned or not.  'page' is invalid after this.
+  void FreePage(Page* page);
+
+  int64_t page_size() const { return page_size_; }
+  int64_t limit() const { return tracker_.limit(); }
+
+  // Bytes of memory held by the pool, including the memory of freed pages.
+  int64_t bytes_allocated() const { return tracker_.consumption(); }
+
+  int64_t num_evictions() const { return num_evictions_; }
+
+ private:
+  // Returns the memory for a page in *buffer: the memory of a freed page, new memory
+  // if the pool is below its limit, or the memory of an evicted page.
+  Status AllocateBuffer(uint8_t** buffer);
+
+  // Writes the contents of 'page' to its slot of the scratch file, creating the
+  // file or assigning the slot first if needed.  Waits for the write.
+  Status WritePage(Page* page);
+
+  // Reads the contents of 'page', which was evicted, into 'buffer'.
+  Status ReadPage(Page* page, uint8_t* buffer);
+
+  DiskIoMgr* io_mgr_;
+  ScratchMgr* scratch_mgr_;
+  const int64_t page_size_;
+
+  // Charged with page_size_ for every buffer the pool allocated.
+  MemTracker tracker_;
+
+  // Protects all members below and the state of the pages.
+  boost::mutex lock_;
+
+  // Signalled when the eviction of a page finishes.
+  boost::condition_variable evicted_cv_;
+
+  // Memory of freed pages.
+  std::vector<uint8_t*> free_buffers_;
+
+  // Unpinned pages that have memory, least recently unpinned first.
+  std::list<Page*> unpinned_pages_;
+
+  // Scratch file of the evicted pages; created on the first eviction.  Each page that
+  // has been evicted keeps its slot of page_size_ bytes until it is freed.
+  std::string path_;
+  int disk_id_;
+  int64_t file_len_;
+  std::vector<int64_t> free_slots_;
+
+  int64_t num_pages_;
+  int64_t num_evictions_;
+};
+
+class BufferPool::Page {
+ public:
+  // The page's memory, page_size() bytes.  Only valid while the page is pinned.
+  uint8_t* data() const {
+    DCHECK_EQ(state_, PINNED);
+    return data_;
+  }
+
+  bool is_pinned() const { return state_ == PINNED; }
+
+ private:
+  friend class BufferPool;
+
+  enum State {
+    PINNED,
+    UNPINNED,   // on unpinned_pages_, still has its memory
+    EVICTING,   // being written out, waited for by Pin() and FreePage()
+    EVICTED     // only in the scratch file
+  };
+
+  Page(uint8_t* data) : data_(data), state_(PINNED), file_offset_(-1) {}
+
+  uint8_t* data_;
+  State state_;
+
+  // Offset of the page's slot in the scratch file, -1 if it has none yet.
+  int64_t file_offset_;
+
+  // Position in unpinned_pages_ while UNPINNED.
+  std::list<Page*>::iterator unpinned_it_;
+};
+
+}
+
+#endif
@@ -0,0 +1,106 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <vector>
+#include <boost/thread/thread.hpp>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "runtime/chunk-allocator.h"
+#include "runtime/mem-pool.h"
+
+DECLARE_int64(mem_pool_chunk_cache_bytes);
+
+using namespace std;
+
+namespace impala {
+
+TEST(ChunkAllocatorTest, Recycle) {
+  ChunkAllocator::FlushThreadCache();
+  ChunkAllocator::ReleaseCache();
+  // Chunks are reused by the same thread first.
+  uint8_t* chunk = ChunkAllocator::Allocate(8 * 1024);
+  ChunkAllocator::Free(chunk, 8 * 1024);
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 0);
+  EXPECT_EQ(ChunkAllocator::Allocate(8 * 1024), chunk);
+  ChunkAllocator::Free(chunk, 8 * 1024);
+
+  // Flushing moves them to the shared cache.
+  ChunkAllocator::FlushThreadCache();
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 8 * 1024);
+  EXPECT_EQ(ChunkAllocator::Allocate(8 * 1024), chunk);
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 0);
+  ChunkAllocator::Free(chunk, 8 * 1024);
+
+  // Sizes that aren't size classes aren't cached.
+  uint8_t* odd_chunk = ChunkAllocator::Allocate(5000);
+  ChunkAllocator::Free(odd_chunk, 5000);
+  ChunkAllocator::Free(ChunkAllocator::Allocate(1024 * 1024), 1024 * 1024);
+  ChunkAllocator::FlushThreadCache();
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 8 * 1024);
+
+  ChunkAllocator::ReleaseCache();
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 0);
+}
+
+static void AllocateAndFree(int num_chunks) {
+  vector<uint8_t*> chunks;
+  for (int i = 0; i < num_chunks; ++i) {
+    chunks.push_back(ChunkAllocator::Allocate(64 * 1024));
+  }
+  for (int i = 0; i < num_chunks; ++i) {
+    ChunkAllocator::Free(chunks[i], 64 * 1024);
+  }
+}
+
+TEST(ChunkAllocatorTest, RetainedBytesLimit) {
+  ChunkAllocator::ReleaseCache();
+  int64_t old_limit = FLAGS_mem_pool_chunk_cache_bytes;
+  FLAGS_mem_pool_chunk_cache_bytes = 1024 * 1024;
+  // The thread cache takes 1MB, the shared cache takes the 1MB limit, the rest is
+  // freed.  Thread caches are returned to the shared cache when the thread exits.
+  boost::thread t(AllocateAndFree, 64);
+  t.join();
+  EXPECT_EQ(ChunkAllocator::retained_bytes(), 1024 * 1024);
+  ChunkAllocator::ReleaseCache();
+  FLAGS_mem_pool_chunk_cache_bytes = old_limit;
+}
+
+TEST(ChunkAllocatorTest, MemPool) {
+  ChunkAllocator::FlushThreadCache();
+  ChunkAllocator::ReleaseCache();
+  vector<pair<uint8_t*, int> > chunks;
+  {
+    MemPool pool;
+    pool.Allocate(4 * 1024);
+    pool.Allocate(8 * 1024);
+    pool.GetChunkInfo(&chunks);
+  }
+  // A new pool gets the same chunks back.
+  MemPool pool;
+  vector<pair<uint8_t*, int> > new_chunks;
+  pool.Allocate(4 * 1024);
+  pool.Allocate(8 * 1024);
+  pool.GetChunkInfo(&new_chunks);
+  ASSERT_EQ(new_chunks.size(), 2);
+  EXPECT_EQ(new_chunks[0].first, chunks[0].first);
+  EXPECT_EQ(new_chunks[1].first, chunks[1].first);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,175 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/chunk-allocator.h"
+
+#include <stdlib.h>
+#include <vector>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/tss.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+
+DEFINE_int64(mem_pool_chunk_cache_bytes, 256L * 1024 * 1024, "Maximum number of bytes "
+    "of freed mem pool chunks that are kept for reuse.  0 disables recycling.");
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+const int ChunkAllocator::MIN_CACHED_SIZE;
+const int ChunkAllocator::MAX_CACHED_SIZE;
+
+// Number of size classes: MIN_CACHED_SIZE, 2 * MIN_CACHED_SIZE, .., MAX_CACHED_SIZE
+static const int NUM_SIZE_CLASSES = 8;
+
+// Maximum number of bytes in a thread's cache.
+static const int64_t THREAD_CACHE_MAX_BYTES = 1024 * 1024;
+
+// Returns the size class of 'size', or -1 if chunks of that size aren't cached.
+static int GetSizeClass(int size) {
+  if (size < ChunkAllocator::MIN_CACHED_SIZE || size > ChunkAllocator::MAX_CACHED_SIZE) {
+    return -1;
+  }
+  if ((size & (size - 1)) != 0) return -1;
+  int size_class = 0;
+  for (int s = ChunkAllocator::MIN_CACHED_SIZE; s < size; s *= 2) ++size_class;
+  DCHECK_LT(size_class, NUM_SIZE_CLASSES);
+  return size_class;
+}
+
+namespace {
+
+// The chunks of one size class in the shared cache.
+struct SizeClassCache {
+  mutex lock;
+  vector<uint8_t*> chunks;
+};
+
+// Chunks freed by one thread.
+struct ThreadCache {
+  vector<uint8_t*> chunks[NUM_SIZE_CLASSES];
+  int64_t num_bytes;
+
+  ThreadCache() : num_bytes(0) {}
+  ~ThreadCache();
+};
+
+// Never deleted, so that the caches of threads that exit during process shutdown
+// don't refer to destroyed state.
+SizeClassCache* shared_cache = new SizeClassCache[NUM_SIZE_CLASSES];
+int64_t shared_cache_bytes = 0;
+thread_specific_ptr<ThreadCache>* thread_cache = new thread_specific_ptr<ThreadCache>();
+
+int ClassSize(int size_class) {
+  return ChunkAllocator::MIN_CACHED_SIZE << size_class;
+}
+
+// Adds 'chunk' of 'size_class' to the shared cache, or frees it if the cache is full.
+void FreeToSharedCache(uint8_t* chunk, int size_class) {
+  int size = ClassSize(size_class);
+  if (__sync_add_and_fetch(&shared_cache_bytes, size) >
+      FLAGS_mem_pool_chunk_cache_bytes) {
+    __sync_fetch_and_add(&shared_cache_bytes, -size);
+    free(chunk);
+    return;
+  }
+  SizeClassCache& cache = shared_cache[size_class];
+  lock_guard<mutex> l(cache.lock);
+  cache.chunks.push_back(chunk);
+}
+
+ThreadCache::~ThreadCache() {
+  for (int i = 0; i < NUM_SIZE_CLASSES; ++i) {
+    for (int j = 0; j < chunks[i].size(); ++j) {
+      FreeToSharedCache(chunks[i][j], i);
+    }
+  }
+}
+
+}
+
+uint8_t* ChunkAllocator::Allocate(int size) {
+  DCHECK_GT(size, 0);
+  int size_class = FLAGS_mem_pool_chunk_cache_bytes > 0 ? GetSizeClass(size) : -1;
+  if (size_class != -1) {
+    ThreadCache* local_cache = thread_cache->get();
+    if (local_cache != NULL && !local_cache->chunks[size_class].empty()) {
+      uint8_t* chunk = local_cache->chunks[size_class].back();
+      local_cache->chunks[size_class].pop_back();
+      local_cache->num_bytes -= size;
+      return chunk;
+    }
+    SizeClassCache& cache = shared_cache[size_class];
+    lock_guard<mutex> l(cache.lock);
+    if (!cache.chunks.empty()) {
+      uint8_t* chunk = cache.chunks.back();
+      cache.chunks.pop_back();
+      __sync_fetch_and_add(&shared_cache_bytes, -size);
+      return chunk;
+    }
+  }
+  uint8_t* chunk = reinterpret_cast<uint8_t*>(malloc(size));
+  if (chunk == NULL) LOG(FATAL) << "Failed to allocate " << size << " bytes";
+  return chunk;
+}
+
+void ChunkAllocator::Free(uint8_t* chunk, int size) {
+  if (chunk == NULL) return;
+  int size_class = FLAGS_mem_pool_chunk_cache_bytes > 0 ? GetSizeClass(size) : -1;
+  if (size_class == -1) {
+    free(chunk);
+    return;
+  }
+  ThreadCache* local_cache = thread_cache->get();
+  if (local_cache == NULL) {
+    local_cache = new ThreadCache();
+    thread_cache->reset(local_cache);
+  }
+  if (local_cache->num_bytes + size <= THREAD_CACHE_MAX_BYTES) {
+    local_cache->chunks[size_class].push_back(chunk);
+    local_cache->num_bytes += size;
+    return;
+  }
+  FreeToSharedCache(chunk, size_class);
+}
+
+int64_t ChunkAllocator::retained_bytes() {
+  return __sync_fetch_and_add(&shared_cache_bytes, 0);
+}
+
+void ChunkAllocator::FlushThreadCache() {
+  // The cache returns its chunks when it is deleted.
+  thread_cache->reset();
+}
+
+void ChunkAllocator::ReleaseCache() {
+  for (int i = 0; i < NUM_SIZE_CLASSES; ++i) {
+    vector<uint8_t*> chunks;
+    {
+      lock_guard<mutex> l(shared_cache[i].lock);
+      chunks.swap(shared_cache[i].chunks);
+    }
+    __sync_fetch_and_add(&shared_cache_bytes,
+        -static_cast<int64_t>(chunks.size()) * ClassSize(i));
+    for (int j = 0; j < chunks.size(); ++j) {
+      free(chunks[j]);
+    }
+  }
+}
+
+}
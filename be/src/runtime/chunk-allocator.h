@@ -0,0 +1,59 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_CHUNK_ALLOCATOR_H
+#define IMPALA_RUNTIME_CHUNK_ALLOCATOR_H
+
+#include <boost/cstdint.hpp>
+
+namespace impala {
+
+// Process-wide allocator for MemPool chunks that recycles freed chunks instead of
+// returning them to the system allocator, so that the pools of consecutive row
+// batches and queries reuse memory that is already mapped and faulted in.
+// Chunks whose size is a power of two between MIN_CACHED_SIZE and MAX_CACHED_SIZE
+// (which covers the doubling chunk sizes of MemPool) are cached per size class; all
+// other sizes go straight to malloc()/free().
+// Freed chunks first go to a small cache of the freeing thread, which it allocates
+// from again before touching the shared cache, so that a thread tends to get back
+// memory that it touched recently.  The shared cache retains at most
+// --mem_pool_chunk_cache_bytes; chunks beyond that are freed.  Thread caches are
+// returned to the shared cache when their thread exits.
+// Retained chunks are not charged against any MemTracker.
+// All functions are thread-safe.
+class ChunkAllocator {
+ public:
+  static const int MIN_CACHED_SIZE = 4 * 1024;
+  static const int MAX_CACHED_SIZE = 512 * 1024;
+
+  // Returns a chunk of 'size' bytes.  The contents are undefined.
+  static uint8_t* Allocate(int size);
+
+  // Returns a chunk that was returned by Allocate(size).
+  static void Free(uint8_t* chunk, int size);
+
+  // Number of bytes held by the shared cache (excluding thread caches).
+  static int64_t retained_bytes();
+
+  // Returns the chunks held by the calling thread's cache to the shared cache.
+  static void FlushThreadCache();
+
+  // Frees all chunks in the shared cache.
+  static void ReleaseCache();
+};
+
+}
+
+#endif
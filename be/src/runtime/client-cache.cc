@@ -19,9 +19,10 @@
 #include <protocol/TBinaryProtocol.h>
 #include <transport/TSocket.h>
 #include <transport/TTransportUtils.h>
-#include <memory>
 
 #include <boost/foreach.hpp>
+#include <boost/thread/locks.hpp>
+#include <gflags/gflags.h>
 
 #include "common/logging.h"
 #include "util/thrift-util.h"
@@ -34,56 +35,166 @@ using namespace apache::thrift::server;
 using namespace apache::thrift::transport;
 using namespace apache::thrift::protocol;
 
+DEFINE_int32(backend_client_wait_timeout_ms, 60000, "Maximum time to wait for a "
+    "connection to a backend when all allowed connections to it are in use.");
+DEFINE_int32(backend_client_idle_timeout_ms, 60000, "Connections to backends that have "
+    "not been used for this long are reopened before they are used again.  "
+    "0 disables this.");
+
 namespace impala {
 
-BackendClientCache::BackendClientCache(int max_clients, int max_clients_per_backend)
+BackendClientCache::BackendClientCache(int max_clients, int max_clients_per_backend,
+    const string& name)
   : max_clients_(max_clients),
-    max_clients_per_backend_(max_clients_per_backend) {
+    max_clients_per_backend_(max_clients_per_backend),
+    name_(name),
+    next_ticket_(0),
+    num_clients_(0) {
+}
+
+BackendClientCache::~BackendClientCache() {
+  // Clients that are still in use are leaked rather than deleted under their users.
+  BOOST_FOREACH(ClientCache::value_type& entry, client_cache_) {
+    BOOST_FOREACH(const IdleClient& idle, entry.second.idle_clients) {
+      delete idle.client;
+    }
+  }
 }
 
 Status BackendClientCache::GetClient(
     const pair<string, int>& hostport, ImpalaInternalServiceClient** client) {
   VLOG_RPC << "GetClient("
            << hostport.first << ":" << hostport.second << ")";
-  lock_guard<mutex> l(lock_);
-  ClientCache::iterator cache_entry = client_cache_.find(hostport);
-  if (cache_entry == client_cache_.end()) {
-    cache_entry =
-        client_cache_.insert(make_pair(hostport, list<BackendClient*>())).first;
-    DCHECK(cache_entry != client_cache_.end());
+  IdleClient idle;
+  idle.client = NULL;
+  {
+    unique_lock<mutex> l(lock_);
+    BackendClients& clients = client_cache_[hostport];
+    if (!clients.waiters.empty() || !CanGetClient(hostport, &clients)) {
+      int64_t ticket = next_ticket_++;
+      clients.waiters.push_back(ticket);
+      system_time deadline = get_system_time() +
+          posix_time::milliseconds(FLAGS_backend_client_wait_timeout_ms);
+      bool timed_out = false;
+      while (clients.waiters.front() != ticket || !CanGetClient(hostport, &clients)) {
+        if (!client_released_cv_.timed_wait(l, deadline)) {
+          timed_out = true;
+          break;
+        }
+      }
+      clients.waiters.remove(ticket);
+      // The next waiter may be able to take a client now.
+      client_released_cv_.notify_all();
+      if (timed_out) {
+        stringstream msg;
+        msg << "Timed out waiting for a" << (name_.empty() ? "" : " ") << name_
+            << " client for " << hostport.first << ":" << hostport.second
+            << " after " << FLAGS_backend_client_wait_timeout_ms << "ms ("
+            << clients.num_clients << " clients in use)";
+        return Status(msg.str());
+      }
+    }
+
+    if (!clients.idle_clients.empty()) {
+      idle = clients.idle_clients.front();
+      clients.idle_clients.pop_front();
+      VLOG_RPC << "GetClient(): adding client for "
+               << idle.client->ipaddress() << ":" << idle.client->port();
+    } else {
+      // Reserve the slot; the client is created below.
+      ++clients.num_clients;
+      ++num_clients_;
+    }
   }
 
-  list<BackendClient*>& info_list = cache_entry->second;
-  if (!info_list.empty()) {
-    *client = info_list.front()->iface();
-    VLOG_RPC << "GetClient(): adding client for "
-             << info_list.front()->ipaddress()
-             << ":" << info_list.front()->port();
-    info_list.pop_front();
+  // Connections are opened without holding lock_, so that connecting to an
+  // unresponsive backend doesn't hold up the callers that use other backends.
+  Status status;
+  if (idle.client != NULL) {
+    status = CheckIdleClient(idle);
   } else {
-    auto_ptr<BackendClient> info(
-        new BackendClient(cache_entry->first.first, cache_entry->first.second));
-    RETURN_IF_ERROR(info->Open());
-    client_map_[info->iface()] = info.get();
-    VLOG_CONNECTION << "GetClient(): creating client for "
-                    << info->ipaddress() << ":" << info->port();
-    *client = info.release()->iface();
+    idle.client = new BackendClient(hostport.first, hostport.second);
+    status = idle.client->Open();
+    if (status.ok()) {
+      VLOG_CONNECTION << "GetClient(): creating " << name_ << " client for "
+                      << idle.client->ipaddress() << ":" << idle.client->port();
+    }
   }
 
+  lock_guard<mutex> l(lock_);
+  if (!status.ok()) {
+    client_map_.erase(idle.client->iface());
+    delete idle.client;
+    --client_cache_[hostport].num_clients;
+    --num_clients_;
+    client_released_cv_.notify_all();
+    return status;
+  }
+  client_map_[idle.client->iface()] = idle.client;
+  *client = idle.client->iface();
   return Status::OK;
 }
 
+bool BackendClientCache::CanGetClient(const pair<string, int>& hostport,
+    BackendClients* clients) {
+  if (!clients->idle_clients.empty()) return true;
+  if (max_clients_per_backend_ > 0 && clients->num_clients >= max_clients_per_backend_) {
+    return false;
+  }
+  if (max_clients_ > 0 && num_clients_ >= max_clients_) {
+    return EvictIdleClient(hostport);
+  }
+  return true;
+}
+
+bool BackendClientCache::EvictIdleClient(const pair<string, int>& hostport) {
+  ClientCache::iterator oldest = client_cache_.end();
+  for (ClientCache::iterator i = client_cache_.begin(); i != client_cache_.end(); ++i) {
+    if (i->first == hostport || i->second.idle_clients.empty()) continue;
+    if (oldest == client_cache_.end() || i->second.idle_clients.back().release_time <
+        oldest->second.idle_clients.back().release_time) {
+      oldest = i;
+    }
+  }
+  if (oldest == client_cache_.end()) return false;
+  BackendClient* client = oldest->second.idle_clients.back().client;
+  VLOG_CONNECTION << "Closing idle client for " << client->ipaddress() << ":"
+                  << client->port() << " to make room for " << hostport.first << ":"
+                  << hostport.second;
+  oldest->second.idle_clients.pop_back();
+  --oldest->second.num_clients;
+  --num_clients_;
+  client_map_.erase(client->iface());
+  delete client;
+  return true;
+}
+
+Status BackendClientCache::CheckIdleClient(const IdleClient& idle) {
+  bool expired = FLAGS_backend_client_idle_timeout_ms > 0 && get_system_time() >
+      idle.release_time + posix_time::milliseconds(FLAGS_backend_client_idle_timeout_ms);
+  if (!expired && idle.client->IsHealthy()) return Status::OK;
+  VLOG_CONNECTION << "Reopening " << (expired ? "expired" : "unhealthy") << " client for "
+                  << idle.client->ipaddress() << ":" << idle.client->port();
+  RETURN_IF_ERROR(idle.client->Close());
+  return idle.client->Open();
+}
+
 Status BackendClientCache::ReopenClient(ImpalaInternalServiceClient* client) {
-  lock_guard<mutex> l(lock_);
-  ClientMap::iterator i = client_map_.find(client);
-  DCHECK(i != client_map_.end());
-  BackendClient* info = i->second;
+  BackendClient* info;
+  {
+    lock_guard<mutex> l(lock_);
+    ClientMap::iterator i = client_map_.find(client);
+    DCHECK(i != client_map_.end());
+    info = i->second;
+  }
+  // The caller owns the client until it releases it.
   RETURN_IF_ERROR(info->Close());
   RETURN_IF_ERROR(info->Open());
   return Status::OK;
 }
 
-void BackendClientCache::ReleaseClient(ImpalaInternalServiceClient* client) {
+void BackendClientCache::ReleaseClient(ImpalaInternalServiceClient* client,
+    bool close) {
   lock_guard<mutex> l(lock_);
   ClientMap::iterator i = client_map_.find(client);
   DCHECK(i != client_map_.end());
@@ -93,28 +204,34 @@ void BackendClientCache::ReleaseClient(ImpalaInternalServiceClient* client) {
   ClientCache::iterator j =
       client_cache_.find(make_pair(info->ipaddress(), info->port()));
   DCHECK(j != client_cache_.end());
-  j->second.push_back(info);
+  if (close) info->Close();
+  IdleClient idle;
+  idle.client = info;
+  idle.release_time = get_system_time();
+  j->second.idle_clients.push_front(idle);
+  client_released_cv_.notify_all();
 }
 
 void BackendClientCache::CloseConnections(const pair<string, int>& hostport) {
   lock_guard<mutex> l(lock_);
   ClientCache::iterator cache_entry = client_cache_.find(hostport);
   if (cache_entry == client_cache_.end()) return;
-  VLOG_RPC << "Invalidating all " << cache_entry->second.size() << " clients for: " 
-           << hostport.first << ":" << hostport.second;
-  BOOST_FOREACH(BackendClient* client, cache_entry->second) {
-    client->Close();
+  VLOG_RPC << "Invalidating all " << cache_entry->second.idle_clients.size()
+           << " idle clients for: " << hostport.first << ":" << hostport.second;
+  BOOST_FOREACH(const IdleClient& idle, cache_entry->second.idle_clients) {
+    idle.client->Close();
   }
 }
 
 string BackendClientCache::DebugString() {
   lock_guard<mutex> l(lock_);
   stringstream out;
-  out << "BackendClientCache(#hosts=" << client_cache_.size()
-      << " [";
+  out << "BackendClientCache(" << (name_.empty() ? "" : name_ + " ")
+      << "#hosts=" << client_cache_.size() << " #clients=" << num_clients_ << " [";
   for (ClientCache::iterator i = client_cache_.begin(); i != client_cache_.end(); ++i) {
     if (i != client_cache_.begin()) out << " ";
-    out << i->first.first << ":" << i->first.second << ":" << i->second.size();
+    out << i->first.first << ":" << i->first.second << ":"
+        << i->second.idle_clients.size() << "/" << i->second.num_clients;
   }
   out << "])";
   return out.str();
@@ -20,42 +20,61 @@
 #include <list>
 #include <string>
 #include <boost/unordered_map.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread_time.hpp>
 
 #include "util/thrift-client.h"
 
 #include "common/status.h"
+#include "gen-cpp/Types_types.h"
 
 namespace impala {
 
 class ImpalaInternalServiceClient;
 
 // Cache of Thrift clients for ImpalaInternalServices.
+// Each backend (host/port) has a pool of connections.  A client is used by one caller
+// at a time: GetClient() hands out an idle client, or opens a new one if the limits
+// allow it, and otherwise waits up to --backend_client_wait_timeout_ms for another
+// caller to release one.  Waiters are served in the order they arrived.
+// Idle clients are checked before they're handed out: a client whose connection was
+// closed (by CloseConnections() or by the remote end) or that was idle for longer
+// than --backend_client_idle_timeout_ms is reopened first.
+// ExecEnv keeps separate caches for control rpcs and for data stream rpcs, so that
+// starting, cancelling and reporting on fragments never waits for a connection that
+// is busy with TransmitData.
 // This class is thread-safe.
 // TODO: shut down clients in the background if they don't get used for a period of time
 // TODO: in order to reduce locking overhead when getting/releasing clients,
 // add call to hand back pointer to list stored in ClientCache and add separate lock
 // to list (or change to lock-free list)
-// TODO: More graceful handling of clients that have failed (maybe better
-// handled by a wrapper of ImpalaInternalServiceClient).
 class BackendClientCache {
  public:
-  // Create cache with given upper limits for the total number of cached
-  // clients and the total number of clients per single host/port.
-  // 0 means no limit.
-  // Limits are ignored for now.
-  BackendClientCache(int max_clients, int max_clients_per_backend);
+  // Create cache with given upper limits for the total number of clients and the
+  // number of clients per single host/port, including the ones that are in use.
+  // 0 means no limit.  'name' identifies the cache in log messages.
+  BackendClientCache(int max_clients, int max_clients_per_backend,
+      const std::string& name = "");
 
-  // Return client for specific host/port in 'client'.
+  ~BackendClientCache();
+
+  // Return client for specific host/port in 'client'.  Blocks while the limits are
+  // reached, and returns an error if no client became available in time.
   Status GetClient(
       const std::pair<std::string, int>& hostport,
       ImpalaInternalServiceClient** client);
 
+  Status GetClient(const THostPort& hostport, ImpalaInternalServiceClient** client) {
+    return GetClient(std::make_pair(hostport.ipaddress, hostport.port), client);
+  }
+
   // Reopens the underlying transport in case of error.
   Status ReopenClient(ImpalaInternalServiceClient* client);
 
-  // Hand client back.
-  void ReleaseClient(ImpalaInternalServiceClient* client);
+  // Hand client back.  If 'close' is true, e.g. because an rpc on the client failed,
+  // its connection is closed and it is reopened on its next use.
+  void ReleaseClient(ImpalaInternalServiceClient* client, bool close = false);
 
   // Close all connections to a host (e.g., in case of failure) so that on their
   // next use they will have to be Reopen'ed.
@@ -64,19 +83,67 @@ class BackendClientCache {
   std::string DebugString();
 
  private:
-  int max_clients_;
-  int max_clients_per_backend_;
+  typedef ThriftClient<ImpalaInternalServiceClient> BackendClient;
+
+  struct IdleClient {
+    BackendClient* client;
+
+    // when the client was released
+    boost::system_time release_time;
+  };
+
+  // The clients of a single host/port.
+  struct BackendClients {
+    // Clients that are not in use, most recently released first.
+    std::list<IdleClient> idle_clients;
+
+    // Number of clients, including the ones that are in use.
+    int num_clients;
+
+    // Tickets of the callers of GetClient() that are waiting for a client, in the
+    // order they arrived.  Only the first one may take a client, so that none of
+    // them starves.
+    std::list<int64_t> waiters;
+
+    BackendClients() : num_clients(0) {}
+  };
+
+  // Returns true if a client for 'clients' can be handed out right away, evicting an
+  // idle client of another backend if that is needed to stay within max_clients_.
+  // lock_ must be taken.
+  bool CanGetClient(const std::pair<std::string, int>& hostport,
+                    BackendClients* clients);
+
+  // Reopens idle client 'idle' if it is closed, unhealthy or has been idle for
+  // too long.  Called without holding lock_.
+  Status CheckIdleClient(const IdleClient& idle);
+
+  // Removes and deletes the least recently used idle client of any host/port other
+  // than 'hostport'.  Returns false if there is none.  lock_ must be taken.
+  bool EvictIdleClient(const std::pair<std::string, int>& hostport);
+
+  const int max_clients_;
+  const int max_clients_per_backend_;
+  const std::string name_;
 
   // protects all fields below
   // TODO: have more fine-grained locks or use lock-free data structures,
   // this isn't going to scale for a high request rate
   boost::mutex lock_;
 
-  typedef ThriftClient<ImpalaInternalServiceClient> BackendClient;
+  // signalled when a client is released or deleted
+  boost::condition_variable client_released_cv_;
+
+  // Ticket of the next caller of GetClient() that has to wait (see
+  // BackendClients::waiters).
+  int64_t next_ticket_;
+
+  // Total number of clients, including the ones that are in use.
+  int num_clients_;
 
-  // map from (host, port) to list of clients;
+  // map from (host, port) to its clients;
   // we own BackendClient*
-  typedef boost::unordered_map<std::pair<std::string, int>, std::list<BackendClient*> >
+  typedef boost::unordered_map<std::pair<std::string, int>, BackendClients>
       ClientCache;
   ClientCache client_cache_;
 
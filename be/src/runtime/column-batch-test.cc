@@ -0,0 +1,142 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "common/object-pool.h"
+#include "runtime/column-batch.h"
+#include "runtime/descriptors.h"
+#include "runtime/string-value.h"
+#include "runtime/tuple.h"
+#include "gen-cpp/Descriptors_types.h"
+
+using namespace std;
+
+namespace impala {
+
+// Tuples have a nullable int slot at offset 4, a non-nullable bigint slot at offset 8
+// and a nullable string slot at offset 16.
+class ColumnBatchTest : public testing::Test {
+ protected:
+  static const int TUPLE_SIZE = 32;
+
+  ObjectPool pool_;
+  DescriptorTbl* desc_tbl_;
+  vector<SlotDescriptor*> slots_;
+
+  static TSlotDescriptor MakeSlot(int id, TPrimitiveType::type type, int offset,
+      int null_bit) {
+    TSlotDescriptor slot_desc;
+    slot_desc.__set_id(id);
+    slot_desc.__set_parent(0);
+    slot_desc.__set_slotType(type);
+    slot_desc.__set_columnPos(id);
+    slot_desc.__set_byteOffset(offset);
+    slot_desc.__set_nullIndicatorByte(0);
+    slot_desc.__set_nullIndicatorBit(null_bit);
+    slot_desc.__set_slotIdx(id);
+    slot_desc.__set_isMaterialized(true);
+    return slot_desc;
+  }
+
+  virtual void SetUp() {
+    TTupleDescriptor tuple_desc;
+    tuple_desc.__set_id(0);
+    tuple_desc.__set_byteSize(TUPLE_SIZE);
+    tuple_desc.__set_numNullBytes(1);
+    TDescriptorTable thrift_desc_tbl;
+    thrift_desc_tbl.tupleDescriptors.push_back(tuple_desc);
+    thrift_desc_tbl.slotDescriptors.push_back(MakeSlot(0, TPrimitiveType::INT, 4, 0));
+    thrift_desc_tbl.slotDescriptors.push_back(
+        MakeSlot(1, TPrimitiveType::BIGINT, 8, -1));
+    thrift_desc_tbl.slotDescriptors.push_back(
+        MakeSlot(2, TPrimitiveType::STRING, 16, 1));
+    EXPECT_TRUE(DescriptorTbl::Create(&pool_, thrift_desc_tbl, &desc_tbl_).ok());
+    for (int i = 0; i < 3; ++i) {
+      slots_.push_back(desc_tbl_->GetSlotDescriptor(i));
+    }
+  }
+};
+
+TEST_F(ColumnBatchTest, MaterializeTuples) {
+  const int num_rows = 100;
+  const string str = "0123456789";
+  ColumnBatch batch(slots_, num_rows);
+  int32_t* ints = batch.GetValues<int32_t>(0);
+  int64_t* bigints = batch.GetValues<int64_t>(1);
+  StringValue* strings = batch.GetValues<StringValue>(2);
+  for (int i = 0; i < num_rows; ++i) {
+    if (i % 3 == 0) {
+      batch.SetNull(0, i);
+    } else {
+      ints[i] = i;
+    }
+    bigints[i] = i * 10LL;
+    if (i % 5 == 0) {
+      batch.SetNull(2, i);
+    } else {
+      strings[i] = StringValue(const_cast<char*>(str.data()), i % 10);
+    }
+  }
+  batch.set_num_rows(num_rows);
+  EXPECT_TRUE(batch.HasNulls(0));
+  EXPECT_FALSE(batch.HasNulls(1));
+  EXPECT_TRUE(batch.IsNull(2, 95));
+  EXPECT_FALSE(batch.IsNull(2, 96));
+
+  vector<uint8_t> tuple_mem(num_rows * TUPLE_SIZE);
+  batch.MaterializeTuples(&tuple_mem[0], TUPLE_SIZE);
+  for (int i = 0; i < num_rows; ++i) {
+    Tuple* tuple = reinterpret_cast<Tuple*>(&tuple_mem[i * TUPLE_SIZE]);
+    EXPECT_EQ(tuple->IsNull(slots_[0]->null_indicator_offset()), i % 3 == 0);
+    if (i % 3 != 0) EXPECT_EQ(*reinterpret_cast<int32_t*>(tuple->GetSlot(4)), i);
+    EXPECT_EQ(*reinterpret_cast<int64_t*>(tuple->GetSlot(8)), i * 10LL);
+    EXPECT_EQ(tuple->IsNull(slots_[2]->null_indicator_offset()), i % 5 == 0);
+    if (i % 5 != 0) {
+      StringValue* value = reinterpret_cast<StringValue*>(tuple->GetSlot(16));
+      EXPECT_EQ(value->ptr, str.data());
+      EXPECT_EQ(value->len, i % 10);
+    }
+  }
+}
+
+TEST_F(ColumnBatchTest, Reset) {
+  ColumnBatch batch(slots_, 10);
+  batch.SetNull(0, 3);
+  batch.set_num_rows(10);
+  batch.Reset();
+  EXPECT_EQ(batch.num_rows(), 0);
+  EXPECT_FALSE(batch.HasNulls(0));
+  EXPECT_FALSE(batch.IsNull(0, 3));
+
+  // Only the first num_rows() tuples are written.
+  batch.GetValues<int32_t>(0)[0] = 7;
+  batch.GetValues<int64_t>(1)[0] = 8;
+  batch.GetValues<StringValue>(2)[0] = StringValue();
+  batch.set_num_rows(1);
+  vector<uint8_t> tuple_mem(2 * TUPLE_SIZE);
+  batch.MaterializeTuples(&tuple_mem[0], TUPLE_SIZE);
+  EXPECT_EQ(*reinterpret_cast<int32_t*>(&tuple_mem[4]), 7);
+  EXPECT_EQ(*reinterpret_cast<int64_t*>(&tuple_mem[8]), 8);
+  EXPECT_EQ(*reinterpret_cast<int64_t*>(&tuple_mem[TUPLE_SIZE + 8]), 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,118 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/column-batch.h"
+
+#include "runtime/string-value.h"
+#include "runtime/timestamp-value.h"
+#include "runtime/tuple.h"
+
+using namespace std;
+
+namespace impala {
+
+ColumnBatch::ColumnBatch(const vector<SlotDescriptor*>& slots, int capacity)
+  : capacity_(capacity),
+    num_rows_(0) {
+  DCHECK_GT(capacity, 0);
+  columns_.resize(slots.size());
+  for (int i = 0; i < slots.size(); ++i) {
+    Column* column = &columns_[i];
+    column->slot_desc = slots[i];
+    column->slot_size = GetSlotSize(slots[i]->type());
+    column->values = new uint8_t[capacity * column->slot_size];
+    column->nulls.resize((capacity + 63) / 64);
+    column->has_nulls = false;
+  }
+}
+
+ColumnBatch::~ColumnBatch() {
+  for (int i = 0; i < columns_.size(); ++i) {
+    delete[] columns_[i].values;
+  }
+}
+
+int ColumnBatch::GetSlotSize(PrimitiveType type) {
+  return type == TYPE_STRING ? sizeof(StringValue) : GetByteSize(type);
+}
+
+void ColumnBatch::Reset() {
+  for (int i = 0; i < columns_.size(); ++i) {
+    Column* column = &columns_[i];
+    if (!column->has_nulls) continue;
+    column->nulls.assign(column->nulls.size(), 0);
+    column->has_nulls = false;
+  }
+  num_rows_ = 0;
+}
+
+void ColumnBatch::MaterializeTuples(uint8_t* tuple_mem, int tuple_byte_size) const {
+  for (int i = 0; i < columns_.size(); ++i) {
+    const Column& column = columns_[i];
+    switch (column.slot_desc->type()) {
+      case TYPE_BOOLEAN:
+        MaterializeColumn<bool>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_TINYINT:
+        MaterializeColumn<int8_t>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_SMALLINT:
+        MaterializeColumn<int16_t>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_INT:
+        MaterializeColumn<int32_t>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_BIGINT:
+        MaterializeColumn<int64_t>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_FLOAT:
+        MaterializeColumn<float>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_DOUBLE:
+        MaterializeColumn<double>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_TIMESTAMP:
+        MaterializeColumn<TimestampValue>(column, tuple_mem, tuple_byte_size);
+        break;
+      case TYPE_STRING:
+        MaterializeColumn<StringValue>(column, tuple_mem, tuple_byte_size);
+        break;
+      default:
+        DCHECK(false) << "Unsupported type: " << column.slot_desc->type();
+    }
+  }
+}
+
+template <typename T>
+void ColumnBatch::MaterializeColumn(const Column& column, uint8_t* tuple_mem,
+    int tuple_byte_size) const {
+  const T* values = reinterpret_cast<const T*>(column.values);
+  uint8_t* slot = tuple_mem + column.slot_desc->tuple_offset();
+  if (!column.has_nulls) {
+    for (int i = 0; i < num_rows_; ++i, slot += tuple_byte_size) {
+      *reinterpret_cast<T*>(slot) = values[i];
+    }
+    return;
+  }
+  const NullIndicatorOffset& null_offset = column.slot_desc->null_indicator_offset();
+  for (int i = 0; i < num_rows_; ++i, slot += tuple_byte_size) {
+    if ((column.nulls[i / 64] >> (i % 64)) & 1) {
+      reinterpret_cast<Tuple*>(tuple_mem + i * tuple_byte_size)->SetNull(null_offset);
+    } else {
+      *reinterpret_cast<T*>(slot) = values[i];
+    }
+  }
+}
+
+}
@@ -0,0 +1,119 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_COLUMN_BATCH_H
+#define IMPALA_RUNTIME_COLUMN_BATCH_H
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "common/logging.h"
+#include "runtime/descriptors.h"
+
+namespace impala {
+
+class Tuple;
+
+// A ColumnBatch holds a batch of values of a set of slots column by column: for
+// each slot an array of 'capacity' values of the slot's type (bool, int8_t, ...,
+// double, TimestampValue or StringValue) and a bitmap of the values that are null.
+// Scanners of columnar formats decode a run of values of one column at a time into
+// it, with a single loop per column instead of a switch on the type per value, and
+// convert the batch into tuples with MaterializeTuples() for the exec nodes, which
+// consume RowBatches.
+// The batch doesn't own the data that its StringValues point to.
+class ColumnBatch {
+ public:
+  // Creates a batch with a column for each of 'slots', in that order.
+  ColumnBatch(const std::vector<SlotDescriptor*>& slots, int capacity);
+
+  ~ColumnBatch();
+
+  // Returns the array of values of column 'col_idx'.  T must be the type of the
+  // column's slot.
+  template <typename T>
+  T* GetValues(int col_idx) {
+    DCHECK_GE(col_idx, 0);
+    DCHECK_LT(col_idx, columns_.size());
+    return reinterpret_cast<T*>(columns_[col_idx].values);
+  }
+
+  // Marks value 'row_idx' of column 'col_idx' as null.  The value itself is ignored.
+  void SetNull(int col_idx, int row_idx) {
+    DCHECK_LT(row_idx, capacity_);
+    Column* column = &columns_[col_idx];
+    column->nulls[row_idx / 64] |= 1LL << (row_idx % 64);
+    column->has_nulls = true;
+  }
+
+  bool IsNull(int col_idx, int row_idx) const {
+    DCHECK_LT(row_idx, capacity_);
+    const Column& column = columns_[col_idx];
+    return (column.nulls[row_idx / 64] >> (row_idx % 64)) & 1;
+  }
+
+  // Returns false if no value of column 'col_idx' is null.
+  bool HasNulls(int col_idx) const { return columns_[col_idx].has_nulls; }
+
+  // Clears the null bitmaps and sets the number of rows to 0.
+  void Reset();
+
+  // Copies the first num_rows() rows into as many tuples at 'tuple_mem',
+  // which are 'tuple_byte_size' bytes apart.  Only the slots of the batch are written;
+  // the tuples must have been initialized, with their null indicators cleared.
+  // String data is not copied.
+  void MaterializeTuples(uint8_t* tuple_mem, int tuple_byte_size) const;
+
+  int num_rows() const { return num_rows_; }
+  void set_num_rows(int num_rows) {
+    DCHECK_LE(num_rows, capacity_);
+    num_rows_ = num_rows;
+  }
+
+  int capacity() const { return capacity_; }
+  int num_columns() const { return columns_.size(); }
+  const SlotDescriptor* slot_desc(int col_idx) const {
+    return columns_[col_idx].slot_desc;
+  }
+
+  // Returns the size of a value of 'type' in a column (and in a tuple).
+  static int GetSlotSize(PrimitiveType type);
+
+ private:
+  struct Column {
+    const SlotDescriptor* slot_desc;
+    int slot_size;
+
+    // capacity_ * slot_size bytes
+    uint8_t* values;
+
+    // bit i is set if value i is null
+    std::vector<uint64_t> nulls;
+    bool has_nulls;
+  };
+
+  // Copies the non-null values of 'column' into their slots.
+  template <typename T>
+  void MaterializeColumn(const Column& column, uint8_t* tuple_mem,
+      int tuple_byte_size) const;
+
+  const int capacity_;
+  int num_rows_;
+  std::vector<Column> columns_;
+};
+
+}
+
+#endif
@@ -14,6 +14,7 @@
 
 #include "runtime/coordinator.h"
 
+#include <algorithm>
 #include <limits>
 #include <map>
 #include <protocol/TBinaryProtocol.h>
@@ -37,17 +38,23 @@
 #include "runtime/data-stream-sender.h"
 #include "runtime/data-stream-mgr.h"
 #include "runtime/exec-env.h"
+#include "runtime/exec-stats-store.h"
 #include "runtime/hdfs-fs-cache.h"
 #include "runtime/plan-fragment-executor.h"
 #include "runtime/row-batch.h"
 #include "runtime/parallel-executor.h"
 #include "sparrow/scheduler.h"
 #include "exec/exec-stats.h"
+#include "exec/insert-stats.h"
 #include "exec/data-sink.h"
 #include "exec/scan-node.h"
 #include "util/debug-util.h"
+#include "util/hash-util.h"
 #include "util/hdfs-util.h"
+#include "util/histogram.h"
 #include "util/container-util.h"
+#include "util/cpu-info.h"
+#include "util/thrift-util.h"
 #include "gen-cpp/ImpalaInternalService.h"
 #include "gen-cpp/ImpalaInternalService_types.h"
 #include "gen-cpp/Frontend_types.h"
@@ -61,6 +68,16 @@ using namespace boost::accumulators;
 using namespace apache::thrift::transport;
 using namespace apache::thrift;
 
+DEFINE_double(straggler_progress_ratio, 0.5, "Once half of the instances of a fragment "
+    "have finished, an instance that has completed less than this fraction of its scan "
+    "ranges is reported as a straggler in the query profile. 0 disables reporting.");
+DEFINE_int32(fragment_instances_per_host, 1, "Default number of instances of each "
+    "partitioned plan fragment that run on a backend, if the NUM_INSTANCES_PER_HOST "
+    "query option isn't set. 0 means one per core of the coordinator's host.");
+DEFINE_int32(broadcast_relay_fanout, 0, "If > 0, a broadcast stream with more "
+    "destination backends than this is relayed along a tree: its senders only send it "
+    "to this many backends, each of which forwards it to this many more, and so on. "
+    "0 disables relaying.");
 DECLARE_int32(be_port);
 DECLARE_string(ipaddress);
 DECLARE_string(hostname);
@@ -77,12 +94,19 @@ class Coordinator::BackendExecState {
   WallClockStopWatch stopwatch;  // wall clock timer for this fragment
   const THostPort hostport;  // of ImpalaInternalService
   int64_t total_split_size;  // summed up across all splits; in bytes
+  int64_t num_scan_ranges;  // summed up across all scan nodes
 
-  // assembled in c'tor
-  TExecPlanFragmentParams rpc_params;
+  // Rpc params shared by all instances of the fragment (see ExecRemoteFragment());
+  // owned by the coordinator's obj_pool()
+  const TExecPlanFragmentParams* fragment_rpc_params;
+  int backend_num;
 
   // Fragment idx for this ExecState
   int fragment_idx;
+  int instance_idx;
+
+  // Scan ranges of this instance
+  const PerNodeScanRanges* scan_ranges;
 
   // protects fields below
   // lock ordering: Coordinator::lock_ can only get obtained *prior*
@@ -103,28 +127,36 @@ class Coordinator::BackendExecState {
   // Total scan ranges complete across all scan nodes
   int64_t total_ranges_complete;
 
+  // true after this instance was reported as a straggler
+  bool is_straggler;
+
   FragmentInstanceCounters aggregate_counters;
   
-  BackendExecState(Coordinator* coord, const THostPort& coord_hostport,
-      int backend_num, const TPlanFragment& fragment, int fragment_idx,
-      const FragmentExecParams& params, int instance_idx, ObjectPool* obj_pool) 
+  BackendExecState(Coordinator* coord,
+      const TExecPlanFragmentParams* fragment_rpc_params, int backend_num,
+      int fragment_idx, const FragmentExecParams& params, int instance_idx,
+      ObjectPool* obj_pool)
     : fragment_instance_id(params.instance_ids[instance_idx]),
       hostport(params.hosts[instance_idx]),
       total_split_size(0),
+      num_scan_ranges(0),
+      fragment_rpc_params(fragment_rpc_params),
+      backend_num(backend_num),
       fragment_idx(fragment_idx),
+      instance_idx(instance_idx),
+      scan_ranges(&params.per_instance_scan_ranges[instance_idx]),
       initiated(false),
       done(false),
       profile_created(false),
-      total_ranges_complete(0) {
+      total_ranges_complete(0),
+      is_straggler(false) {
     profile = obj_pool->Add(
         new RuntimeProfile(obj_pool, "Instance " + PrintId(fragment_instance_id)));
-    coord->SetExecPlanFragmentParams(backend_num, fragment, fragment_idx, params,
-        instance_idx, coord_hostport, &rpc_params);
     ComputeTotalSplitSize();
   }
 
-  // Computes sum of split sizes of leftmost scan. Call only after setting
-  // exec_params.
+  // Computes sum of split sizes of leftmost scan and num_scan_ranges. Call only after
+  // setting scan_ranges.
   void ComputeTotalSplitSize();
 
   // Return value of throughput counter for given plan_node_id, or 0 if that node
@@ -144,9 +176,10 @@ class Coordinator::BackendExecState {
 };
 
 void Coordinator::BackendExecState::ComputeTotalSplitSize() {
-  const PerNodeScanRanges& per_node_scan_ranges = rpc_params.params.per_node_scan_ranges;
   total_split_size = 0;
-  BOOST_FOREACH(const PerNodeScanRanges::value_type& entry, per_node_scan_ranges) {
+  num_scan_ranges = 0;
+  BOOST_FOREACH(const PerNodeScanRanges::value_type& entry, *scan_ranges) {
+    num_scan_ranges += entry.second.size();
     BOOST_FOREACH(const TScanRangeParams& scan_range_params, entry.second) {
       if (!scan_range_params.scan_range.__isset.hdfs_file_split) continue;
       total_split_size += scan_range_params.scan_range.hdfs_file_split.length;
@@ -196,13 +229,17 @@ int64_t Coordinator::BackendExecState::UpdateNumScanRangesCompleted() {
 
 Coordinator::Coordinator(ExecEnv* exec_env, ExecStats* exec_stats)
   : exec_env_(exec_env),
+    exec_stats_generation_(0),
     has_called_wait_(false),
+    fragments_started_(false),
     executor_(NULL), // Set in Prepare()
     exec_stats_(exec_stats),
     num_backends_(0),
     num_remaining_backends_(0),
     num_scan_ranges_(0),
-    obj_pool_(NULL) {
+    obj_pool_(NULL),
+    query_events_(NULL),
+    returned_first_row_(false) {
 }
 
 Coordinator::~Coordinator() {
@@ -210,8 +247,11 @@ Coordinator::~Coordinator() {
 
 Status Coordinator::Exec(
     const TUniqueId& query_id, TQueryExecRequest* request,
-    const TQueryOptions& query_options) {
+    const TQueryOptions& query_options, RuntimeProfile::EventSequence* query_events) {
   DCHECK_GT(request->fragments.size(), 0);
+  DCHECK(query_events != NULL);
+  exec_timer_.Start();
+  query_events_ = query_events;
   needs_finalization_ = request->__isset.finalize_params;
   if (needs_finalization_) {
     finalize_params_ = request->finalize_params;
@@ -228,6 +268,7 @@ Status Coordinator::Exec(
 
   ComputeFragmentExecParams(*request);
   ComputeScanRangeAssignment(*request);
+  SetPlanNodeExecStats(request);
 
   THostPort coord;
   coord.__set_hostname(FLAGS_hostname);
@@ -255,6 +296,7 @@ Status Coordinator::Exec(
     SetExecPlanFragmentParams(
         0, request->fragments[0], 0, fragment_exec_params_[0], 0, coord, &rpc_params);
     RETURN_IF_ERROR(executor_->Prepare(rpc_params));
+    query_events_->MarkEvent("Coordinator fragment prepared");
   } else {
     executor_.reset(NULL);
     obj_pool_.reset(new ObjectPool());
@@ -317,12 +359,14 @@ Status Coordinator::Exec(
     // set up exec states
     int num_hosts = params.hosts.size();
     DCHECK_GT(num_hosts, 0);
+    TExecPlanFragmentParams* fragment_rpc_params =
+        obj_pool()->Add(new TExecPlanFragmentParams());
+    SetFragmentRpcParams(request->fragments[fragment_idx], params, coord,
+        fragment_rpc_params);
     for (int instance_idx = 0; instance_idx < num_hosts; ++instance_idx) {
-      // TODO: pool of pre-formatted BackendExecStates?
       BackendExecState* exec_state =
-          obj_pool()->Add(new BackendExecState(this, coord, backend_num,
-              request->fragments[fragment_idx], fragment_idx,
-              params, instance_idx, obj_pool()));
+          obj_pool()->Add(new BackendExecState(this, fragment_rpc_params, backend_num,
+              fragment_idx, params, instance_idx, obj_pool()));
       backend_exec_states_[backend_num] = exec_state;
       ++backend_num;
       VLOG(2) << "Exec(): starting instance: fragment_idx=" << fragment_idx
@@ -332,7 +376,8 @@ Status Coordinator::Exec(
 
     // Issue all rpcs in parallel
     Status fragments_exec_status = ParallelExecutor::Exec(
-        bind<Status>(mem_fn(&Coordinator::ExecRemoteFragment), this, _1), 
+        exec_env_->coordinator_rpc_pool(),
+        bind<Status>(mem_fn(&Coordinator::ExecRemoteFragment), this, _1),
         reinterpret_cast<void**>(&backend_exec_states_[backend_num - num_hosts]),
         num_hosts);
 
@@ -345,16 +390,161 @@ Status Coordinator::Exec(
     }
   }
 
+  if (num_backends_ > 0) query_events_->MarkEvent("Remote fragments started");
   PrintBackendInfo();
 
   stringstream ss;
   ss << "Query " << query_id_;
   progress_ = ProgressUpdater(ss.str(), num_scan_ranges_);
   progress_.set_logging_level(1);
+  fragments_started_ = true;
 
   return Status::OK;
 }
 
+// Returns the key of 'fragment' in the ExecStatsStore: a fingerprint of its plan and of
+// the descriptors of the tables that the query reads, which change along with the
+// tables' partitions.  The scan ranges aren't included, so that the statistics of
+// fragments that read the same tables from different hosts or with a different split
+// size match.
+static string GetExecStatsKey(const TPlanFragment& fragment,
+    const TDescriptorTable& desc_tbl) {
+  string plan;
+  string tables;
+  Status status = SerializeThriftMsg(&fragment, &plan);
+  if (status.ok()) status = SerializeThriftMsg(&desc_tbl, &tables);
+  if (!status.ok()) {
+    VLOG_QUERY << "no exec stats for fragment: " << status.GetErrorMsg();
+    return "";
+  }
+  plan.append(tables);
+  stringstream key;
+  key << hex << HashUtil::FvnHash64(plan.data(), plan.size(), HashUtil::FVN64_SEED)
+      << ":" << HashUtil::FvnHash64(plan.data(), plan.size(), 0) << ":" << plan.size();
+  return key.str();
+}
+
+void Coordinator::SetPlanNodeExecStats(TQueryExecRequest* request) {
+  ExecStatsStore* store = exec_env_->exec_stats_store();
+  if (store == NULL) return;
+  exec_stats_generation_ = store->generation();
+  exec_stats_keys_.resize(request->fragments.size());
+  for (int i = 0; i < request->fragments.size(); ++i) {
+    TPlanFragment& fragment = request->fragments[i];
+    if (!fragment.__isset.plan) continue;
+    // computed before the stats are set, which would change the key
+    exec_stats_keys_[i] = GetExecStatsKey(fragment, request->desc_tbl);
+    ExecStatsStore::NodeStats stats;
+    if (exec_stats_keys_[i].empty() || !store->Lookup(exec_stats_keys_[i], &stats)) {
+      continue;
+    }
+    BOOST_FOREACH(TPlanNode& node, fragment.plan.nodes) {
+      ExecStatsStore::NodeStats::const_iterator it = stats.find(node.node_id);
+      if (it != stats.end()) node.__set_exec_stats(it->second);
+    }
+  }
+}
+
+static int64_t GetCounterValue(RuntimeProfile* profile, const string& name) {
+  RuntimeProfile::Counter* counter = profile->GetCounter(name);
+  return counter == NULL ? 0 : counter->value();
+}
+
+// Raises the stats of the plan nodes whose profiles are in the tree of 'profile' to
+// the values of the nodes' counters.
+static void AddNodeExecStats(RuntimeProfile* profile, ExecStatsStore::NodeStats* stats) {
+  vector<RuntimeProfile*> children;
+  profile->GetAllChildren(&children);
+  for (int i = 0; i < children.size(); ++i) {
+    PlanNodeId id = ExecNode::GetNodeIdFromProfile(children[i]);
+    if (id == g_JavaConstants_constants.INVALID_PLAN_NODE_ID) continue;
+    TPlanNodeExecStats* node = &(*stats)[id];
+    node->num_rows = max(node->num_rows,
+        GetCounterValue(children[i], ExecNode::ROWS_RETURNED_COUNTER));
+    // the final size of the hash table of joins and aggregations
+    node->num_hash_table_buckets = max(node->num_hash_table_buckets,
+        GetCounterValue(children[i], "BuildBuckets"));
+    node->peak_mem_usage = max(node->peak_mem_usage,
+        GetCounterValue(children[i], ExecNode::PEAK_MEMORY_USAGE_COUNTER));
+  }
+}
+
+void Coordinator::RecordPlanNodeExecStats() {
+  ExecStatsStore* store = exec_env_->exec_stats_store();
+  if (store == NULL) return;
+  vector<ExecStatsStore::NodeStats> stats(exec_stats_keys_.size());
+  if (executor_.get() != NULL) AddNodeExecStats(executor_->profile(), &stats[0]);
+  BOOST_FOREACH(BackendExecState* exec_state, backend_exec_states_) {
+    lock_guard<mutex> l(exec_state->lock);
+    AddNodeExecStats(exec_state->profile, &stats[exec_state->fragment_idx]);
+  }
+  for (int i = 0; i < exec_stats_keys_.size(); ++i) {
+    if (exec_stats_keys_[i].empty() || stats[i].empty()) continue;
+    store->Update(exec_stats_keys_[i], exec_stats_generation_, stats[i]);
+  }
+}
+
+// Adds up the rows returned by the plan nodes whose profiles are in the tree of
+// 'profile'.
+static void AddNodeProgress(RuntimeProfile* profile,
+    map<PlanNodeId, Coordinator::Progress::NodeProgress>* nodes) {
+  vector<RuntimeProfile*> children;
+  profile->GetAllChildren(&children);
+  for (int i = 0; i < children.size(); ++i) {
+    PlanNodeId id = ExecNode::GetNodeIdFromProfile(children[i]);
+    if (id == g_JavaConstants_constants.INVALID_PLAN_NODE_ID) continue;
+    RuntimeProfile::Counter* rows_counter =
+        children[i]->GetCounter(ExecNode::ROWS_RETURNED_COUNTER);
+    if (rows_counter == NULL) continue;
+    Coordinator::Progress::NodeProgress* node = &(*nodes)[id];
+    node->name = children[i]->name();
+    node->rows_returned += rows_counter->value();
+  }
+}
+
+bool Coordinator::GetProgress(Progress* progress) {
+  lock_guard<mutex> l(lock_);
+  if (!fragments_started_) return false;
+  progress->num_scan_ranges = progress_.total();
+  progress->num_scan_ranges_complete = progress_.num_complete();
+  progress->elapsed_ms = exec_timer_.ElapsedTime();
+  progress->mem_usage = 0;
+  progress->nodes.clear();
+
+  // progress_ only counts the scan ranges of the backends' reports
+  if (executor_.get() != NULL) {
+    CounterMap& complete = coordinator_counters_.scan_ranges_complete_counters;
+    for (CounterMap::iterator it = complete.begin(); it != complete.end(); ++it) {
+      progress->num_scan_ranges_complete += it->second->value();
+    }
+    RuntimeProfile::Counter* mem_counter =
+        executor_->profile()->GetCounter(PlanFragmentExecutor::MEMORY_USAGE_COUNTER);
+    if (mem_counter != NULL) progress->mem_usage += mem_counter->value();
+    AddNodeProgress(executor_->profile(), &progress->nodes);
+  }
+  BOOST_FOREACH(BackendExecState* exec_state, backend_exec_states_) {
+    lock_guard<mutex> l2(exec_state->lock);
+    if (!exec_state->done) {
+      RuntimeProfile::Counter* mem_counter =
+          exec_state->profile->GetCounter(PlanFragmentExecutor::MEMORY_USAGE_COUNTER);
+      if (mem_counter != NULL) progress->mem_usage += mem_counter->value();
+    }
+    AddNodeProgress(exec_state->profile, &progress->nodes);
+  }
+
+  int64_t num_remaining =
+      progress->num_scan_ranges - progress->num_scan_ranges_complete;
+  if (num_remaining <= 0) {
+    progress->remaining_ms = 0;
+  } else if (progress->num_scan_ranges_complete == 0) {
+    progress->remaining_ms = -1;
+  } else {
+    progress->remaining_ms = static_cast<double>(progress->elapsed_ms) * num_remaining
+        / progress->num_scan_ranges_complete;
+  }
+  return true;
+}
+
 Status Coordinator::GetStatus() {
   lock_guard<mutex> l(lock_);
   return query_status_;
@@ -382,11 +572,111 @@ Status Coordinator::UpdateStatus(const Status& status, const TUniqueId* id) {
   return query_status_;
 }
 
+// One hdfs operation of INSERT finalization, see FinalizeQuery().
+struct Coordinator::FinalizeOp {
+  hdfsFS hdfs_connection;
+  // Partition directory, file to move or directory to delete
+  string path;
+  // Destination of the file to move
+  string dest;
+  // For partition directories, whether to delete the existing data first
+  bool is_overwrite;
+  // For partition directories, whether this is the table's root directory
+  bool is_root;
+};
+
+Status Coordinator::CreatePartitionDir(void* arg) {
+  FinalizeOp* op = reinterpret_cast<FinalizeOp*>(arg);
+  hdfsFS hdfs_connection = op->hdfs_connection;
+  const string& path = op->path;
+  if (op->is_overwrite) {
+    if (op->is_root) {
+      // We need to be a little more careful, and only delete data files in the root
+      // because the tmp directories the sink(s) wrote are there also. 
+      // So only delete files in the table directory - all files are treated as data 
+      // files by Hive and Impala, but directories are ignored (and may legitimately
+      // be used to store permanent non-table data by other applications). 
+      int num_files = 0;
+      hdfsFileInfo* existing_files = 
+          hdfsListDirectory(hdfs_connection, path.c_str(), &num_files);
+      if (existing_files == NULL) {
+        return AppendHdfsErrorMessage("Could not list directory: ", path);
+      }
+      Status delete_status = Status::OK;
+      for (int i = 0; i < num_files; ++i) {
+        if (existing_files[i].mKind == kObjectKindFile) {
+          VLOG(2) << "Deleting: " << string(existing_files[i].mName);
+          if (hdfsDelete(hdfs_connection, existing_files[i].mName, 1) == -1) {
+            delete_status = Status(AppendHdfsErrorMessage("Failed to delete existing "
+                "HDFS file as part of INSERT OVERWRITE query: ", 
+                string(existing_files[i].mName)));
+            break;
+          }
+        }
+      }
+      hdfsFreeFileInfo(existing_files, num_files);
+      RETURN_IF_ERROR(delete_status);
+    } else {
+      // This is a partition directory, not the root directory; we can delete
+      // recursively with abandon, after checking it was ever created. 
+      if (hdfsExists(hdfs_connection, path.c_str()) != -1) {
+        // TODO: There's a potential race here between checking for the directory
+        // and a third-party deleting it. 
+        if (hdfsDelete(hdfs_connection, path.c_str(), 1) == -1) {
+          return Status(AppendHdfsErrorMessage("Failed to delete partition directory "
+                  "as part of INSERT OVERWRITE query: ", path));
+        }
+      }
+    }
+  }
+  // Ignore error if directory already exists
+  hdfsCreateDirectory(hdfs_connection, path.c_str());
+  return Status::OK;
+}
+
+Status Coordinator::MoveFile(void* arg) {
+  FinalizeOp* op = reinterpret_cast<FinalizeOp*>(arg);
+  VLOG_ROW << "Moving tmp file: " << op->path << " to " << op->dest;
+  if (hdfsRename(op->hdfs_connection, op->path.c_str(), op->dest.c_str()) == -1) {
+    stringstream ss;
+    ss << "Could not move HDFS file: " << op->path << " to desintation: " << op->dest;
+    return AppendHdfsErrorMessage(ss.str());
+  }
+  return Status::OK;
+}
+
+Status Coordinator::DeleteTmpDir(void* arg) {
+  FinalizeOp* op = reinterpret_cast<FinalizeOp*>(arg);
+  if (hdfsDelete(op->hdfs_connection, op->path.c_str(), 1) == -1) {
+    return Status(AppendHdfsErrorMessage("Failed to delete temporary directory: ", 
+        op->path));
+  }
+  return Status::OK;
+}
+
+Status Coordinator::ExecFinalizeOps(
+    ParallelExecutor::Function function, vector<FinalizeOp>* ops) {
+  if (ops->empty()) return Status::OK;
+  vector<void*> args(ops->size());
+  for (int i = 0; i < ops->size(); ++i) {
+    args[i] = &(*ops)[i];
+  }
+  ThreadPool* pool = exec_env_->insert_finalize_pool();
+  if (pool == NULL) {
+    for (int i = 0; i < args.size(); ++i) {
+      RETURN_IF_ERROR(function(args[i]));
+    }
+    return Status::OK;
+  }
+  return ParallelExecutor::Exec(pool, function, &args[0], args.size());
+}
+
 Status Coordinator::FinalizeQuery() {
   // All backends must have reported their final statuses before finalization,
   // which is a post-condition of Wait.
   DCHECK(has_called_wait_);
   DCHECK(needs_finalization_);
+  SCOPED_TIMER(ADD_COUNTER(query_profile_, "FinalizationTime", TCounterType::CPU_TICKS));
 
   hdfsFS hdfs_connection = exec_env_->fs_cache()->GetDefaultConnection();
 
@@ -394,88 +684,47 @@ Status Coordinator::FinalizeQuery() {
   // undefined. We should do better cleanup: there's probably enough information
   // here to roll back to the table's previous state.
 
-  // INSERT finalization happens in the four following steps
+  // INSERT finalization happens in the four following steps.  The hdfs operations of
+  // each step are independent, so they run in parallel on the insert finalize pool;
+  // with thousands of partitions, the namenode round trips would otherwise dominate.
   // 1. If OVERWRITE, remove all the files in the target directory
   // 2. Create all the necessary partition directories.
+  vector<FinalizeOp> partition_ops;
   BOOST_FOREACH(const PartitionRowCount::value_type& partition, 
       partition_row_counts_) {
-    stringstream ss;
+    FinalizeOp op;
+    op.hdfs_connection = hdfs_connection;
     // Fully-qualified partition path
-    ss << finalize_params_.hdfs_base_dir << "/" << partition.first;
-    if (finalize_params_.is_overwrite) {   
-      if (partition.first.empty()) {
-        // If the root directory is written to, then the table must not be partitioned
-        DCHECK(partition_row_counts_.size() == 1);
-        // We need to be a little more careful, and only delete data files in the root
-        // because the tmp directories the sink(s) wrote are there also. 
-        // So only delete files in the table directory - all files are treated as data 
-        // files by Hive and Impala, but directories are ignored (and may legitimately
-        // be used to store permanent non-table data by other applications). 
-        int num_files = 0;
-        hdfsFileInfo* existing_files = 
-            hdfsListDirectory(hdfs_connection, ss.str().c_str(), &num_files);
-        if (existing_files == NULL) {
-          return AppendHdfsErrorMessage("Could not list directory: ", ss.str());
-        }
-        Status delete_status = Status::OK;
-        for (int i = 0; i < num_files; ++i) {
-          if (existing_files[i].mKind == kObjectKindFile) {
-            VLOG(2) << "Deleting: " << string(existing_files[i].mName);
-            if (hdfsDelete(hdfs_connection, existing_files[i].mName, 1) == -1) {
-              delete_status = Status(AppendHdfsErrorMessage("Failed to delete existing "
-                  "HDFS file as part of INSERT OVERWRITE query: ", 
-                  string(existing_files[i].mName)));
-              break;
-            }
-          }
-        }
-        hdfsFreeFileInfo(existing_files, num_files);
-        RETURN_IF_ERROR(delete_status);
-      } else {
-        // This is a partition directory, not the root directory; we can delete
-        // recursively with abandon, after checking it was ever created. 
-        if (hdfsExists(hdfs_connection, ss.str().c_str()) != -1) {
-          // TODO: There's a potential race here between checking for the directory
-          // and a third-party deleting it. 
-          if (hdfsDelete(hdfs_connection, ss.str().c_str(), 1) == -1) {
-            return Status(AppendHdfsErrorMessage("Failed to delete partition directory "
-                    "as part of INSERT OVERWRITE query: ", ss.str()));
-          }
-        }
-      }
-    }
-    // Ignore error if directory already exists
-    hdfsCreateDirectory(hdfs_connection, ss.str().c_str());
+    op.path = finalize_params_.hdfs_base_dir + "/" + partition.first;
+    op.is_overwrite = finalize_params_.is_overwrite;
+    op.is_root = partition.first.empty();
+    // If the root directory is written to, then the table must not be partitioned
+    DCHECK(!op.is_root || partition_row_counts_.size() == 1);
+    partition_ops.push_back(op);
   }
+  RETURN_IF_ERROR(ExecFinalizeOps(&Coordinator::CreatePartitionDir, &partition_ops));
 
   // 3. Move all tmp files
-  set<string> tmp_dirs_to_delete;
+  vector<FinalizeOp> move_ops;
+  vector<FinalizeOp> delete_ops;
   BOOST_FOREACH(FileMoveMap::value_type& move, files_to_move_) {
+    FinalizeOp op;
+    op.hdfs_connection = hdfs_connection;
+    op.path = move.first;
+    op.dest = move.second;
     // Empty destination means delete (which we do in a separate
     // pass because we may not have processed the contents of this
     // dir yet)
     if (move.second.empty()) {
-      tmp_dirs_to_delete.insert(move.first);
+      delete_ops.push_back(op);
     } else {
-      VLOG_ROW << "Moving tmp file: " << move.first << " to " << move.second;
-      if (hdfsRename(hdfs_connection, move.first.c_str(), move.second.c_str()) == -1) {
-        stringstream ss;
-        ss << "Could not move HDFS file: " << move.first << " to desintation: " 
-           << move.second;
-        return AppendHdfsErrorMessage(ss.str());
-      }          
+      move_ops.push_back(op);
     }
   }
+  RETURN_IF_ERROR(ExecFinalizeOps(&Coordinator::MoveFile, &move_ops));
 
   // 4. Delete temp directories
-  BOOST_FOREACH(const string& tmp_path, tmp_dirs_to_delete) {
-    if (hdfsDelete(hdfs_connection, tmp_path.c_str(), 1) == -1) {
-      return Status(AppendHdfsErrorMessage("Failed to delete temporary directory: ", 
-          tmp_path));
-    }
-  }
-
-  return Status::OK;
+  return ExecFinalizeOps(&Coordinator::DeleteTmpDir, &delete_ops);
 }
 
 Status Coordinator::WaitForAllBackends() {
@@ -497,6 +746,7 @@ Status Coordinator::Wait() {
   if (executor_.get() != NULL) {
     // Open() may block
     RETURN_IF_ERROR(UpdateStatus(executor_->Open(), NULL));
+    query_events_->MarkEvent("Coordinator fragment opened");
 
     // If the coordinator fragment has a sink, it will have finished executing at this
     // point.  It's safe therefore to copy the set of files to move and updated partitions
@@ -508,10 +758,12 @@ Status Coordinator::Wait() {
     // fragment.  (Backends have a sink only if the coordinator does not)
     DCHECK_EQ(files_to_move_.size(), 0);
     DCHECK_EQ(partition_row_counts_.size(), 0);
+    DCHECK_EQ(partition_stats_.size(), 0);
 
     // Because there are no other updates, safe to copy the maps rather than merge them.
     files_to_move_ = *state->hdfs_files_to_move();
     partition_row_counts_ = *state->num_appended_rows();
+    partition_stats_ = *state->insert_partition_stats();
   } else {
     // Query finalization can only happen when all backends have reported
     // relevant state. They only have relevant state to report in the parallel
@@ -560,9 +812,14 @@ Status Coordinator::GetNext(RowBatch** batch, RuntimeState* state) {
     if (query_status_.ok()) {
       // If the query completed successfully, report aggregate query profiles.
       ReportQuerySummary();
+      RecordPlanNodeExecStats();
     }
   } else {
     exec_stats_->num_rows_ += (*batch)->num_rows();
+    if (!returned_first_row_ && (*batch)->num_rows() > 0) {
+      returned_first_row_ = true;
+      query_events_->MarkEvent("First row fetched");
+    }
   }
   return Status::OK;
 }
@@ -690,16 +947,20 @@ Status Coordinator::ExecRemoteFragment(void* exec_state_arg) {
 
   // this client needs to have been released when this function finishes
   ImpalaInternalServiceClient* backend_client;
-  // TODO: Fix the THostPort mess, make the client cache use the same type.
-  pair<string, int> hostport = make_pair(exec_state->hostport.ipaddress, 
-                                         exec_state->hostport.port);
-  RETURN_IF_ERROR(exec_env_->client_cache()->GetClient(hostport, &backend_client));
+  RETURN_IF_ERROR(
+      exec_env_->client_cache()->GetClient(exec_state->hostport, &backend_client));
   DCHECK(backend_client != NULL);
 
+  // The instances of a fragment only differ in a few params, so they are filled in
+  // here instead of keeping a copy of the fragment for every instance.
+  TExecPlanFragmentParams rpc_params(*exec_state->fragment_rpc_params);
+  SetInstanceRpcParams(exec_state->backend_num, exec_state->fragment_idx,
+      exec_state->instance_idx, *exec_state->scan_ranges, &rpc_params);
+
   TExecPlanFragmentResult thrift_result;
   try {
     try {
-      backend_client->ExecPlanFragment(thrift_result, exec_state->rpc_params);
+      backend_client->ExecPlanFragment(thrift_result, rpc_params);
     } catch (TTransportException& e) {
       // If a backend has stopped and restarted (without the failure detector
       // picking it up) an existing backend client may still think it is
@@ -712,7 +973,7 @@ Status Coordinator::ExecRemoteFragment(void* exec_state_arg) {
         exec_env_->client_cache()->ReleaseClient(backend_client);
         return status;
       }
-      backend_client->ExecPlanFragment(thrift_result, exec_state->rpc_params);
+      backend_client->ExecPlanFragment(thrift_result, rpc_params);
     }
   } catch (TTransportException& e) {
     stringstream msg;
@@ -772,10 +1033,8 @@ void Coordinator::CancelInternal() {
     // if we get an error while trying to get a connection to the backend,
     // keep going
     ImpalaInternalServiceClient* backend_client;
-    pair<string, int> hostport = make_pair(exec_state->hostport.ipaddress, 
-                                           exec_state->hostport.port);
     Status status =
-        exec_env_->client_cache()->GetClient(hostport, &backend_client);
+        exec_env_->client_cache()->GetClient(exec_state->hostport, &backend_client);
     if (!status.ok()) {
       continue;
     }
@@ -834,7 +1093,6 @@ Status Coordinator::UpdateFragmentExecStatus(const TReportExecStatusParams& para
   }
   BackendExecState* exec_state = backend_exec_states_[params.backend_num];
 
-  const TRuntimeProfileTree& cumulative_profile = params.profile;
   Status status(params.status);
   {
     lock_guard<mutex> l(exec_state->lock);
@@ -846,10 +1104,9 @@ Status Coordinator::UpdateFragmentExecStatus(const TReportExecStatusParams& para
         << " status=" << exec_state->status.GetErrorMsg();
     exec_state->status = status;
     exec_state->done = params.done;
-    RuntimeProfile* p = RuntimeProfile::CreateFromThrift(obj_pool(), cumulative_profile);
-    stringstream str;
-    p->PrettyPrint(&str);
-    exec_state->profile->Update(cumulative_profile);
+    // Intermediate reports only contain the counters that changed (see
+    // RuntimeProfile::ToThriftDelta()), so this is proportional to the changes.
+    exec_state->profile->Update(params.profile);
     if (!exec_state->profile_created) {
       CollectScanNodeCounters(exec_state->profile, &exec_state->aggregate_counters);
     }
@@ -876,6 +1133,15 @@ Status Coordinator::UpdateFragmentExecStatus(const TReportExecStatusParams& para
     files_to_move_.insert(
         params.insert_exec_status.files_to_move.begin(),
         params.insert_exec_status.files_to_move.end());
+    BOOST_FOREACH(const PartitionStatsMap::value_type& partition,
+        params.insert_exec_status.partition_stats) {
+      PartitionStatsMap::iterator it = partition_stats_.find(partition.first);
+      if (it == partition_stats_.end()) {
+        partition_stats_.insert(partition);
+      } else {
+        InsertStats::Merge(partition.second, &it->second);
+      }
+    }
   }
 
   if (VLOG_FILE_IS_ON) {
@@ -921,13 +1187,53 @@ Status Coordinator::UpdateFragmentExecStatus(const TReportExecStatusParams& para
       }
     }
     if (--num_remaining_backends_ == 0) {
+      query_events_->MarkEvent("Last remote fragment finished");
       backend_completion_cv_.notify_all();
     }
   }
 
+  CheckForStragglers(exec_state->fragment_idx);
   return Status::OK;
 }
 
+void Coordinator::CheckForStragglers(int fragment_idx) {
+  if (FLAGS_straggler_progress_ratio <= 0) return;
+  lock_guard<mutex> l(lock_);
+  // Instances of the fragment that scan something, and how many of them are done
+  vector<BackendExecState*> instances;
+  int num_done = 0;
+  BOOST_FOREACH(BackendExecState* exec_state, backend_exec_states_) {
+    if (exec_state->fragment_idx != fragment_idx) continue;
+    if (exec_state->num_scan_ranges == 0) continue;
+    instances.push_back(exec_state);
+    lock_guard<mutex> l2(exec_state->lock);
+    if (exec_state->done) ++num_done;
+  }
+  if (instances.size() < 2 || num_done * 2 < instances.size()) return;
+
+  BOOST_FOREACH(BackendExecState* exec_state, instances) {
+    double progress;
+    {
+      lock_guard<mutex> l2(exec_state->lock);
+      if (exec_state->done || exec_state->is_straggler) continue;
+      progress = static_cast<double>(exec_state->total_ranges_complete)
+          / exec_state->num_scan_ranges;
+      if (progress >= FLAGS_straggler_progress_ratio) continue;
+      exec_state->is_straggler = true;
+    }
+    stringstream host;
+    host << exec_state->hostport.ipaddress << ":" << exec_state->hostport.port;
+    VLOG_QUERY << "query_id=" << query_id_ << ": instance "
+               << exec_state->fragment_instance_id << " on " << host.str()
+               << " is a straggler: " << num_done << " of " << instances.size()
+               << " instances are done, it completed "
+               << exec_state->total_ranges_complete << " of "
+               << exec_state->num_scan_ranges << " scan ranges";
+    stragglers_.push_back(host.str());
+    query_profile_->AddInfoString("Stragglers", join(stragglers_, ", "));
+  }
+}
+
 const RowDescriptor& Coordinator::row_desc() const {
   DCHECK(executor_.get() != NULL);
   return executor_->row_desc();
@@ -950,16 +1256,24 @@ bool Coordinator::PrepareCatalogUpdate(TCatalogUpdate* catalog_update) {
       partition_row_counts_) {
     catalog_update->created_partitions.insert(partition.first);
   }
+  if (!partition_stats_.empty()) {
+    catalog_update->__set_partition_stats(partition_stats_);
+    BOOST_FOREACH(PartitionStatsMap::value_type& partition,
+        catalog_update->partition_stats) {
+      InsertStats::SetNumDistinctValues(&partition.second);
+    }
+  }
 
   return catalog_update->created_partitions.size() != 0;
 }
 
 // This function appends summary information to the query_profile_ before
 // outputting it to VLOG.  It adds:
-//   1. Averaged remote fragment profiles (TODO: add outliers)
-//   2. Summary of remote fragment durations (min, max, mean, stddev)
-//   3. Summary of remote fragment rates (min, max, mean, stddev)
-// TODO: add histogram/percentile
+//   1. Averaged remote fragment profiles; their histograms are the merged histograms
+//      of all instances
+//   2. Summary of remote fragment durations (min, max, mean, stddev, percentiles)
+//   3. Instances that took more than twice the median duration
+//   4. Summary of remote fragment rates (min, max, mean, stddev)
 void Coordinator::ReportQuerySummary() {
   // In this case, the query did not even get to start on all the remote nodes,
   // some of the state that is used below might be uninitialized.  In this case,
@@ -994,6 +1308,13 @@ void Coordinator::ReportQuerySummary() {
 
       SummaryStats& completion_times = fragment_profiles_[i].completion_times;
       SummaryStats& rates = fragment_profiles_[i].rates;
+
+      Histogram completion_time_histogram(TCounterType::TIME_MS);
+      for (int j = 0; j < backend_exec_states_.size(); ++j) {
+        if (backend_exec_states_[j]->fragment_idx != i) continue;
+        completion_time_histogram.Add(backend_exec_states_[j]->stopwatch.ElapsedTime());
+      }
+      int64_t median_time = completion_time_histogram.GetPercentile(50);
       
       stringstream times_label;
       times_label 
@@ -1004,7 +1325,22 @@ void Coordinator::ReportQuerySummary() {
         << "  mean: " << PrettyPrinter::Print(
             accumulators::mean(completion_times), TCounterType::TIME_MS)
         << "  stddev:" << PrettyPrinter::Print(
-            sqrt(accumulators::variance(completion_times)), TCounterType::TIME_MS);
+            sqrt(accumulators::variance(completion_times)), TCounterType::TIME_MS)
+        << "  p50:" << PrettyPrinter::Print(median_time, TCounterType::TIME_MS)
+        << "  p95:" << PrettyPrinter::Print(
+            completion_time_histogram.GetPercentile(95), TCounterType::TIME_MS)
+        << "  p99:" << PrettyPrinter::Print(
+            completion_time_histogram.GetPercentile(99), TCounterType::TIME_MS);
+
+      stringstream outliers_label;
+      for (int j = 0; j < backend_exec_states_.size(); ++j) {
+        if (backend_exec_states_[j]->fragment_idx != i) continue;
+        int64_t completion_time = backend_exec_states_[j]->stopwatch.ElapsedTime();
+        if (completion_time <= 2 * median_time) continue;
+        if (outliers_label.tellp() > 0) outliers_label << "  ";
+        outliers_label << backend_exec_states_[j]->hostport << ":"
+                       << PrettyPrinter::Print(completion_time, TCounterType::TIME_MS);
+      }
 
       stringstream rates_label;
       rates_label 
@@ -1019,6 +1355,10 @@ void Coordinator::ReportQuerySummary() {
 
       fragment_profiles_[i].averaged_profile->AddInfoString(
           "completion times", times_label.str());
+      if (outliers_label.tellp() > 0) {
+        fragment_profiles_[i].averaged_profile->AddInfoString(
+            "outliers", outliers_label.str());
+      }
       fragment_profiles_[i].averaged_profile->AddInfoString(
           "execution rates", rates_label.str());
     }
@@ -1049,6 +1389,26 @@ string Coordinator::GetErrorLog() {
   return ss.str();
 }
 
+// Returns true if the broadcast to exchange node 'exch_id' of fragment 'fragment_idx'
+// can be relayed: a relay tree collapses all senders into one, so the stream must come
+// from a single fragment, and the exchange can't merge its senders' sorted streams.
+static bool CanRelayBroadcast(
+    const TQueryExecRequest& exec_request, int fragment_idx, PlanNodeId exch_id) {
+  BOOST_FOREACH(const TPlanNode& node, exec_request.fragments[fragment_idx].plan.nodes) {
+    if (node.node_id != exch_id) continue;
+    if (node.__isset.exchange_node && !node.exchange_node.ordering_exprs.empty()) {
+      return false;
+    }
+  }
+  int num_inputs = 0;
+  for (int i = 0; i < exec_request.dest_fragment_idx.size(); ++i) {
+    if (exec_request.dest_fragment_idx[i] != fragment_idx) continue;
+    const TDataStreamSink& sink = exec_request.fragments[i + 1].output_sink.stream_sink;
+    if (sink.dest_node_id == exch_id) ++num_inputs;
+  }
+  return num_inputs == 1;
+}
+
 void Coordinator::ComputeFragmentExecParams(const TQueryExecRequest& exec_request) {
   fragment_exec_params_.resize(exec_request.fragments.size());
   ComputeFragmentHosts(exec_request);
@@ -1083,24 +1443,67 @@ void Coordinator::ComputeFragmentExecParams(const TQueryExecRequest& exec_reques
     // set # of senders
     DCHECK(exec_request.fragments[i].output_sink.__isset.stream_sink);
     const TDataStreamSink& sink = exec_request.fragments[i].output_sink.stream_sink;
-    // we can only handle unpartitioned (= broadcast) output at the moment
-    DCHECK(sink.output_partition.type == TPartitionType::UNPARTITIONED);
+    // we can only handle unpartitioned (= broadcast) and hash-partitioned output
+    DCHECK(sink.output_partition.type == TPartitionType::UNPARTITIONED
+        || sink.output_partition.type == TPartitionType::HASH_PARTITIONED);
     PlanNodeId exch_id = sink.dest_node_id;
     // we might have multiple fragments sending to this exchange node 
     // (distributed MERGE), which is why we need to add up the #senders
     dest_params.per_exch_num_senders[exch_id] += params.hosts.size();
 
-    // create one TPlanFragmentDestination per destination host
-    params.destinations.resize(dest_params.hosts.size());
-    for (int j = 0; j < dest_params.hosts.size(); ++j) {
-      TPlanFragmentDestination& dest = params.destinations[j];
+    // create one TPlanFragmentDestination per destination instance; a
+    // hash-partitioned sender routes each row to exactly one of these, a broadcast
+    // stream is only sent to the first instance on each host, which shares it with
+    // the host's other instances
+    int instances_per_dest = 1;
+    if (sink.output_partition.type == TPartitionType::UNPARTITIONED
+        && dest_params.num_instances_per_host > 1) {
+      instances_per_dest = dest_params.num_instances_per_host;
+      dest_params.shared_broadcast_exch_ids.insert(exch_id);
+    }
+    params.destinations.clear();
+    for (int j = 0; j < dest_params.hosts.size(); j += instances_per_dest) {
+      TPlanFragmentDestination dest;
       dest.fragment_instance_id = dest_params.instance_ids[j];
       dest.server = THostPort(dest_params.hosts[j]);
       VLOG_RPC  << "dest for fragment " << i << ":"
                 << " instance_id=" << dest.fragment_instance_id 
                 << " server=" << dest.server.ipaddress << ":" << dest.server.port;
+      params.destinations.push_back(dest);
+    }
+    if (sink.output_partition.type == TPartitionType::UNPARTITIONED
+        && FLAGS_broadcast_relay_fanout > 0
+        && params.destinations.size() > FLAGS_broadcast_relay_fanout
+        && CanRelayBroadcast(exec_request, dest_fragment_idx, exch_id)) {
+      ComputeRelayTree(exch_id, instances_per_dest, &params, &dest_params);
+    }
+  }
+}
+
+void Coordinator::ComputeRelayTree(PlanNodeId exch_id, int instances_per_dest,
+    FragmentExecParams* params, FragmentExecParams* dest_params) {
+  int fanout = FLAGS_broadcast_relay_fanout;
+  vector<TPlanFragmentDestination> dests;
+  dests.swap(params->destinations);
+  params->destinations.assign(dests.begin(), dests.begin() + fanout);
+  dest_params->relay_destinations.resize(dest_params->hosts.size());
+  dest_params->relayed_exch_ids.resize(dest_params->hosts.size());
+  // destination j forwards the stream to destinations (j + 1) * fanout up to
+  // (j + 2) * fanout - 1, which gives a tree of depth log_fanout(#destinations)
+  for (int j = 0; j < dests.size(); ++j) {
+    int instance_idx = j * instances_per_dest;
+    DCHECK(dests[j].fragment_instance_id == dest_params->instance_ids[instance_idx]);
+    int end_child = min<int>((j + 2) * fanout, dests.size());
+    for (int child = (j + 1) * fanout; child < end_child; ++child) {
+      dest_params->relay_destinations[instance_idx][exch_id].push_back(dests[child]);
+    }
+    if (j < fanout) continue;
+    for (int k = instance_idx; k < instance_idx + instances_per_dest; ++k) {
+      dest_params->relayed_exch_ids[k].insert(exch_id);
     }
   }
+  VLOG_QUERY << "relaying broadcast to exch " << exch_id << " along a tree: "
+             << dests.size() << " destinations, fanout " << fanout;
 }
 
 Status Coordinator::ComputeFragmentHosts(const TQueryExecRequest& exec_request) {
@@ -1141,9 +1544,9 @@ Status Coordinator::ComputeFragmentHosts(const TQueryExecRequest& exec_request)
         exec_request.per_node_scan_ranges.find(leftmost_scan_id);
     if (entry == exec_request.per_node_scan_ranges.end() || entry->second.empty()) {
       // this scan node doesn't have any scan ranges; run it on the coordinator
-      // TODO: we'll need to revisit this strategy once we can partition joins
-      // (in which case this fragment might be executing a right outer join
-      // with a large build table)
+      // TODO: a partitioned join fragment whose left input is this fragment
+      // inherits its hosts (see above) and would then also only run on the
+      // coordinator, even if its right input is large
       params.hosts.push_back(coord);
       continue;
     }
@@ -1175,9 +1578,35 @@ Status Coordinator::ComputeFragmentHosts(const TQueryExecRequest& exec_request)
     params.hosts.erase(start_duplicates, params.hosts.end());
     unique_hosts_.insert(params.hosts.begin(), params.hosts.end());
   }
+
+  // Replicate the hosts of the partitioned fragments only now, so that fragments
+  // that inherit the hosts of their input don't get the instances multiplied twice.
+  // The instances exchange rows with those on the same backend through the local
+  // stream mgr (see DataStreamSender).
+  int num_instances = NumInstancesPerHost();
+  if (num_instances <= 1) return Status::OK;
+  for (int i = 0; i < exec_request.fragments.size(); ++i) {
+    if (exec_request.fragments[i].partition.type == TPartitionType::UNPARTITIONED) {
+      continue;
+    }
+    FragmentExecParams& params = fragment_exec_params_[i];
+    sparrow::SimpleScheduler::HostList hosts;
+    hosts.swap(params.hosts);
+    BOOST_FOREACH(const THostPort& host, hosts) {
+      params.hosts.insert(params.hosts.end(), num_instances, host);
+    }
+    params.num_instances_per_host = num_instances;
+  }
   return Status::OK;
 }
 
+int Coordinator::NumInstancesPerHost() const {
+  int num_instances = query_options_.num_instances_per_host;
+  if (num_instances <= 0) num_instances = FLAGS_fragment_instances_per_host;
+  if (num_instances <= 0) num_instances = CpuInfo::num_cores();
+  return num_instances;
+}
+
 PlanNodeId Coordinator::FindLeftmostNode(
     const TPlan& plan, const std::vector<TPlanNodeType::type>& types) {
   // the first node with num_children == 0 is the leftmost node
@@ -1233,17 +1662,125 @@ void Coordinator::ComputeScanRangeAssignment(const TQueryExecRequest& exec_reque
   }
 
   scan_range_assignment_.resize(exec_request.fragments.size());
+  // scan nodes of each fragment whose ranges are assigned by bucket
+  vector<vector<PlanNodeId> > bucketed_node_ids(exec_request.fragments.size());
   map<TPlanNodeId, vector<TScanRangeLocations> >::const_iterator  entry;
   for (entry = exec_request.per_node_scan_ranges.begin();
       entry != exec_request.per_node_scan_ranges.end(); ++entry) {
     int fragment_idx = per_node_fragment_idx[entry->first];
+    num_scan_ranges_ += entry->second.size();
+    if (!entry->second.empty() && entry->second[0].__isset.bucket) {
+      bucketed_node_ids[fragment_idx].push_back(entry->first);
+      continue;
+    }
     FragmentScanRangeAssignment* assignment = &scan_range_assignment_[fragment_idx];
     ComputeScanRangeAssignment(
         entry->first, entry->second, fragment_exec_params_[fragment_idx], assignment);
-    num_scan_ranges_ += entry->second.size();
+  }
+  for (int i = 0; i < exec_request.fragments.size(); ++i) {
+    SplitScanRangeAssignment(scan_range_assignment_[i], &fragment_exec_params_[i]);
+    if (!bucketed_node_ids[i].empty()) {
+      // the planner only co-schedules scans that are alone in their fragment
+      DCHECK(scan_range_assignment_[i].empty());
+      ComputeBucketedScanRangeAssignment(
+          exec_request, bucketed_node_ids[i], &fragment_exec_params_[i]);
+    }
   }
 }
 
+void Coordinator::ComputeBucketedScanRangeAssignment(
+    const TQueryExecRequest& exec_request, const vector<PlanNodeId>& node_ids,
+    FragmentExecParams* params) {
+  DCHECK_GT(params->hosts.size(), 0);
+  // the ranges of each bucket, with the id of their node, and the bytes of each bucket
+  map<int, vector<pair<PlanNodeId, const TScanRangeLocations*> > > bucket_ranges;
+  map<int, int64_t> bucket_bytes;
+  BOOST_FOREACH(PlanNodeId node_id, node_ids) {
+    const vector<TScanRangeLocations>& locations =
+        exec_request.per_node_scan_ranges.find(node_id)->second;
+    BOOST_FOREACH(const TScanRangeLocations& scan_range_locations, locations) {
+      DCHECK(scan_range_locations.__isset.bucket);
+      int bucket = scan_range_locations.bucket;
+      bucket_ranges[bucket].push_back(make_pair(node_id, &scan_range_locations));
+      bucket_bytes[bucket] += GetScanRangeLength(scan_range_locations.scan_range);
+    }
+  }
+  vector<pair<int64_t, int> > order;
+  for (map<int, int64_t>::const_iterator it = bucket_bytes.begin();
+       it != bucket_bytes.end(); ++it) {
+    order.push_back(make_pair(it->second, it->first));
+  }
+  sort(order.begin(), order.end(), greater<pair<int64_t, int> >());
+
+  bool single_host = params->hosts.size() == params->num_instances_per_host;
+  // bytes assigned to each instance
+  vector<int64_t> instance_bytes(params->hosts.size(), 0);
+  int64_t local_bytes = 0;
+  int64_t total_bytes = 0;
+  for (int i = 0; i < order.size(); ++i) {
+    int bucket = order[i].second;
+    const vector<pair<PlanNodeId, const TScanRangeLocations*> >& ranges =
+        bucket_ranges[bucket];
+    unordered_set<THostPort> local_hosts;
+    for (int j = 0; j < ranges.size(); ++j) {
+      BOOST_FOREACH(const TScanRangeLocation& location, ranges[j].second->locations) {
+        if (single_host) {
+          local_hosts.insert(params->hosts[0]);
+          continue;
+        }
+        FragmentExecParams::DataServerMap::const_iterator it =
+            params->data_server_map.find(location.server);
+        if (it == params->data_server_map.end()) continue;
+        if (it->second.ipaddress != location.server.ipaddress) continue;
+        local_hosts.insert(it->second);
+      }
+    }
+    int instance_idx = -1;
+    for (int k = 0; k < params->hosts.size(); ++k) {
+      const THostPort& host = params->hosts[k];
+      if (!local_hosts.empty() && local_hosts.find(host) == local_hosts.end()) continue;
+      if (instance_idx == -1 || instance_bytes[k] < instance_bytes[instance_idx]) {
+        instance_idx = k;
+      }
+    }
+    DCHECK_GE(instance_idx, 0);
+    const THostPort& exec_host = params->hosts[instance_idx];
+    instance_bytes[instance_idx] += order[i].first;
+    total_bytes += order[i].first;
+
+    for (int j = 0; j < ranges.size(); ++j) {
+      const TScanRangeLocations& scan_range_locations = *ranges[j].second;
+      int volume_id = -1;
+      if (!scan_range_locations.locations.empty()) {
+        volume_id = scan_range_locations.locations[0].volume_id;
+      }
+      BOOST_FOREACH(const TScanRangeLocation& location, scan_range_locations.locations) {
+        if (location.server.ipaddress != exec_host.ipaddress) continue;
+        volume_id = location.volume_id;
+        local_bytes += GetScanRangeLength(scan_range_locations.scan_range);
+        break;
+      }
+      TScanRangeParams scan_range_params;
+      scan_range_params.scan_range = scan_range_locations.scan_range;
+      scan_range_params.__set_volume_id(volume_id);
+      params->per_instance_scan_ranges[instance_idx][ranges[j].first].push_back(
+          scan_range_params);
+    }
+  }
+
+  stringstream key;
+  key << "Bucketed scan range assignment (nodes";
+  BOOST_FOREACH(PlanNodeId node_id, node_ids) {
+    key << " " << node_id;
+  }
+  key << ")";
+  stringstream ss;
+  ss << order.size() << " buckets over " << params->hosts.size() << " instances, "
+     << PrettyPrinter::Print(total_bytes, TCounterType::BYTES) << " ("
+     << PrettyPrinter::Print(local_bytes, TCounterType::BYTES) << " local)";
+  query_profile_->AddInfoString(key.str(), ss.str());
+}
+
 int64_t GetScanRangeLength(const TScanRange& scan_range) {
   if (scan_range.__isset.hdfs_file_split) {
     return scan_range.hdfs_file_split.length;
@@ -1252,42 +1789,91 @@ int64_t GetScanRangeLength(const TScanRange& scan_range) {
   }
 }
 
+const THostPort* Coordinator::GetExecHost(
+    const FragmentExecParams& params, const THostPort& data_server) {
+  // this is only running on the coordinator anyway
+  if (params.hosts.size() == params.num_instances_per_host) return &params.hosts[0];
+  FragmentExecParams::DataServerMap::const_iterator it =
+      params.data_server_map.find(data_server);
+  DCHECK(it != params.data_server_map.end());
+  return &it->second;
+}
+
+// Orders scan ranges by decreasing length.
+struct ScanRangeLengthGreater {
+  const vector<TScanRangeLocations>* locations;
+  bool operator()(int a, int b) const {
+    return GetScanRangeLength((*locations)[a].scan_range) >
+        GetScanRangeLength((*locations)[b].scan_range);
+  }
+};
+
 void Coordinator::ComputeScanRangeAssignment(
     PlanNodeId node_id, const vector<TScanRangeLocations>& locations,
     const FragmentExecParams& params, FragmentScanRangeAssignment* assignment) {
-  unordered_map<THostPort, int64_t> assigned_bytes_per_host;  // total assigned
+  DCHECK_GT(params.hosts.size(), 0);
+  // The load of a backend is the number of bytes assigned to it per disk of its host.
+  // The state store doesn't publish the disk count of a backend, so it is the number
+  // of distinct volumes of the local replicas of this node's ranges (at least 1).
+  unordered_map<THostPort, HostLoad> loads;
+  BOOST_FOREACH(const THostPort& host, params.hosts) {
+    loads[host];
+  }
   BOOST_FOREACH(const TScanRangeLocations& scan_range_locations, locations) {
-    // assign this scan range to the host w/ the fewest assigned bytes
-    int64_t min_assigned_bytes = numeric_limits<int64_t>::max();
-    const THostPort* data_host = NULL;  // data server; not necessarily backend
+    BOOST_FOREACH(const TScanRangeLocation& location, scan_range_locations.locations) {
+      const THostPort* exec_host = GetExecHost(params, location.server);
+      if (exec_host->ipaddress != location.server.ipaddress) continue;
+      if (location.volume_id >= 0) loads[*exec_host].volumes.insert(location.volume_id);
+    }
+  }
+
+  // Assign the ranges greedily, largest first, to the least loaded backend that has a
+  // local replica of the range, or the least loaded backend if there is none.
+  vector<int> order(locations.size());
+  for (int i = 0; i < order.size(); ++i) {
+    order[i] = i;
+  }
+  ScanRangeLengthGreater length_greater;
+  length_greater.locations = &locations;
+  stable_sort(order.begin(), order.end(), length_greater);
+  BOOST_FOREACH(int range_idx, order) {
+    const TScanRangeLocations& scan_range_locations = locations[range_idx];
+    const THostPort* exec_host = NULL;
+    HostLoad* load = NULL;
     int volume_id = -1;
+    bool is_local = false;
     BOOST_FOREACH(const TScanRangeLocation& location, scan_range_locations.locations) {
-      int64_t* assigned_bytes =
-          FindOrInsert(&assigned_bytes_per_host, location.server, 0L);
-      if (*assigned_bytes < min_assigned_bytes) {
-        min_assigned_bytes = *assigned_bytes;
-        data_host = &location.server;
+      const THostPort* host = GetExecHost(params, location.server);
+      if (host->ipaddress != location.server.ipaddress) continue;
+      HostLoad* host_load = &loads[*host];
+      if (load == NULL || host_load->BytesPerDisk() < load->BytesPerDisk()) {
+        exec_host = host;
+        load = host_load;
         volume_id = location.volume_id;
+        is_local = true;
       }
     }
-    assigned_bytes_per_host[*data_host] +=
-        GetScanRangeLength(scan_range_locations.scan_range);
-
-    // translate data host to backend host
-    DCHECK(data_host != NULL);
-    THostPort exec_hostport;
-    DCHECK_GT(params.hosts.size(), 0);
-    if (params.hosts.size() == 1) {
-      // this is only running on the coordinator anyway
-      exec_hostport = params.hosts[0];
-    } else {
-      FragmentExecParams::DataServerMap::const_iterator it =
-          params.data_server_map.find(*data_host);
-      DCHECK(it != params.data_server_map.end());
-      exec_hostport = it->second;
+    if (!is_local) {
+      BOOST_FOREACH(const THostPort& host, params.hosts) {
+        HostLoad* host_load = &loads[host];
+        if (load == NULL || host_load->BytesPerDisk() < load->BytesPerDisk()) {
+          exec_host = &host;
+          load = host_load;
+        }
+      }
+      // The volume id is only used to spread the reads over the disk queues of the
+      // backend.
+      if (!scan_range_locations.locations.empty()) {
+        volume_id = scan_range_locations.locations[0].volume_id;
+      }
     }
+    DCHECK(exec_host != NULL);
+    load->bytes += GetScanRangeLength(scan_range_locations.scan_range);
+    ++load->num_ranges;
+    if (is_local) ++load->num_local_ranges;
+
     PerNodeScanRanges* scan_ranges =
-        FindOrInsert(assignment, exec_hostport, PerNodeScanRanges());
+        FindOrInsert(assignment, *exec_host, PerNodeScanRanges());
     vector<TScanRangeParams>* scan_range_params_list =
         FindOrInsert(scan_ranges, node_id, vector<TScanRangeParams>());
     // add scan range
@@ -1298,6 +1884,27 @@ void Coordinator::ComputeScanRangeAssignment(
     scan_range_params_list->push_back(scan_range_params);
   }
 
+  // Report the assignment in the profile, ordered by backend.
+  map<string, const HostLoad*> sorted_loads;
+  for (unordered_map<THostPort, HostLoad>::const_iterator it = loads.begin();
+       it != loads.end(); ++it) {
+    stringstream host;
+    host << it->first.ipaddress << ":" << it->first.port;
+    sorted_loads[host.str()] = &it->second;
+  }
+  stringstream ss;
+  for (map<string, const HostLoad*>::const_iterator it = sorted_loads.begin();
+       it != sorted_loads.end(); ++it) {
+    const HostLoad& load = *it->second;
+    ss << (it == sorted_loads.begin() ? "" : ", ") << it->first << ": "
+       << load.num_ranges << " ranges (" << load.num_local_ranges << " local), "
+       << PrettyPrinter::Print(load.bytes, TCounterType::BYTES) << ", "
+       << load.NumDisks() << " disks";
+  }
+  stringstream key;
+  key << "Scan range assignment (node " << node_id << ")";
+  query_profile_->AddInfoString(key.str(), ss.str());
+
   if (VLOG_FILE_IS_ON) {
     BOOST_FOREACH(FragmentScanRangeAssignment::value_type& entry, *assignment) {
       VLOG_FILE << "ScanRangeAssignment: server=" << ThriftDebugString(entry.first);
@@ -1312,25 +1919,87 @@ void Coordinator::ComputeScanRangeAssignment(
   }
 }
 
+void Coordinator::SplitScanRangeAssignment(
+    const FragmentScanRangeAssignment& assignment, FragmentExecParams* params) {
+  params->per_instance_scan_ranges.clear();
+  params->per_instance_scan_ranges.resize(params->hosts.size());
+  // Bytes and number of ranges assigned to each instance; the number of ranges
+  // breaks ties, e.g. between the zero-length ranges of hbase scans.
+  vector<pair<int64_t, int> > loads(params->hosts.size(), pair<int64_t, int>(0, 0));
+  BOOST_FOREACH(const FragmentScanRangeAssignment::value_type& entry, assignment) {
+    // the instances of a host are consecutive
+    sparrow::SimpleScheduler::HostList::const_iterator it =
+        find(params->hosts.begin(), params->hosts.end(), entry.first);
+    DCHECK(it != params->hosts.end());
+    int first_instance = it - params->hosts.begin();
+    int end_instance = min<int>(
+        first_instance + params->num_instances_per_host, params->hosts.size());
+    BOOST_FOREACH(const PerNodeScanRanges::value_type& node_ranges, entry.second) {
+      // the ranges of a node are in the order in which they were assigned to the
+      // host, which is by decreasing length
+      BOOST_FOREACH(const TScanRangeParams& scan_range_params, node_ranges.second) {
+        int instance_idx = first_instance;
+        for (int i = first_instance + 1; i < end_instance; ++i) {
+          if (loads[i] < loads[instance_idx]) instance_idx = i;
+        }
+        loads[instance_idx].first += GetScanRangeLength(scan_range_params.scan_range);
+        ++loads[instance_idx].second;
+        params->per_instance_scan_ranges[instance_idx][node_ranges.first].push_back(
+            scan_range_params);
+      }
+    }
+  }
+}
+
 void Coordinator::SetExecPlanFragmentParams(
     int backend_num, const TPlanFragment& fragment, int fragment_idx,
     const FragmentExecParams& params, int instance_idx, const THostPort& coord,
     TExecPlanFragmentParams* rpc_params) {
+  SetFragmentRpcParams(fragment, params, coord, rpc_params);
+  SetInstanceRpcParams(backend_num, fragment_idx, instance_idx,
+      params.per_instance_scan_ranges[instance_idx], rpc_params);
+}
+
+void Coordinator::SetFragmentRpcParams(const TPlanFragment& fragment,
+    const FragmentExecParams& params, const THostPort& coord,
+    TExecPlanFragmentParams* rpc_params) {
   rpc_params->__set_protocol_version(ImpalaInternalServiceVersion::V1);
   rpc_params->__set_fragment(fragment);
   rpc_params->__set_desc_tbl(desc_tbl_);
   rpc_params->params.__set_query_id(query_id_);
-  rpc_params->params.__set_fragment_instance_id(params.instance_ids[instance_idx]);
-  THostPort exec_host = params.hosts[instance_idx];;
-  PerNodeScanRanges& scan_ranges = scan_range_assignment_[fragment_idx][exec_host];
-  rpc_params->params.__set_per_node_scan_ranges(scan_ranges);
   rpc_params->params.__set_per_exch_num_senders(params.per_exch_num_senders);
   rpc_params->params.__set_destinations(params.destinations);
+  if (!params.shared_broadcast_exch_ids.empty()) {
+    rpc_params->params.__set_shared_broadcast_exch_ids(params.shared_broadcast_exch_ids);
+  }
   rpc_params->__isset.params = true;
   rpc_params->__set_coord(coord);
-  rpc_params->__set_backend_num(backend_num);
   rpc_params->__set_query_globals(query_globals_);
   rpc_params->__set_query_options(query_options_);
 }
 
+void Coordinator::SetInstanceRpcParams(int backend_num, int fragment_idx,
+    int instance_idx, const PerNodeScanRanges& scan_ranges,
+    TExecPlanFragmentParams* rpc_params) {
+  const FragmentExecParams& params = fragment_exec_params_[fragment_idx];
+  rpc_params->params.__set_fragment_instance_id(params.instance_ids[instance_idx]);
+  rpc_params->params.__set_per_node_scan_ranges(scan_ranges);
+  if (!params.shared_broadcast_exch_ids.empty()) {
+    // the first instance on the host receives the shared broadcast streams
+    int first_instance_idx = instance_idx - instance_idx % params.num_instances_per_host;
+    rpc_params->params.__set_broadcast_stream_id(params.instance_ids[first_instance_idx]);
+  }
+  if (!params.relay_destinations.empty()) {
+    if (!params.relay_destinations[instance_idx].empty()) {
+      rpc_params->params.__set_relay_destinations(
+          params.relay_destinations[instance_idx]);
+    }
+    // these streams come from a single relaying instance
+    BOOST_FOREACH(PlanNodeId exch_id, params.relayed_exch_ids[instance_idx]) {
+      rpc_params->params.per_exch_num_senders[exch_id] = 1;
+    }
+  }
+  rpc_params->__set_backend_num(backend_num);
+}
+
 }
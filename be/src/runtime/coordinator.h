@@ -16,6 +16,9 @@
 #ifndef IMPALA_RUNTIME_COORDINATOR_H
 #define IMPALA_RUNTIME_COORDINATOR_H
 
+#include <algorithm>
+#include <map>
+#include <set>
 #include <vector>
 #include <string>
 #include <boost/scoped_ptr.hpp>
@@ -27,6 +30,7 @@
 #include <boost/accumulators/statistics/max.hpp>
 #include <boost/accumulators/statistics/variance.hpp>
 #include <boost/unordered_map.hpp>
+#include <boost/unordered_set.hpp>
 #include <boost/thread/thread.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
@@ -35,6 +39,7 @@
 #include "common/global-types.h"
 #include "util/progress-updater.h"
 #include "util/runtime-profile.h"
+#include "runtime/parallel-executor.h"
 #include "runtime/runtime-state.h"
 #include "sparrow/simple-scheduler.h"
 #include "gen-cpp/Types_types.h"
@@ -96,8 +101,12 @@ class Coordinator {
   // 'Request' must contain at least a coordinator plan fragment (ie, can't
   // be for a query like 'SELECT 1').
   // A call to Exec() must precede all other member function calls.
+  // The milestones of the execution (fragments started, first row fetched, last
+  // fragment finished) are recorded in 'query_events', which must outlive the
+  // coordinator.
   Status Exec(const TUniqueId& query_id, TQueryExecRequest* request,
-              const TQueryOptions& query_options);
+              const TQueryOptions& query_options,
+              RuntimeProfile::EventSequence* query_events);
 
   // Blocks until result rows are ready to be retrieved via GetNext(), or, if the
   // query doesn't return rows, until the query finishes or is cancelled.
@@ -161,6 +170,36 @@ class Coordinator {
   // The set of hosts on which this query will run. Only valid after Exec.
   const boost::unordered_set<THostPort>& unique_hosts() { return unique_hosts_; }
 
+  // Snapshot of the progress of a query, computed from the counters of the fragment
+  // instances as of their last reports.
+  struct Progress {
+    int64_t num_scan_ranges;
+    int64_t num_scan_ranges_complete;
+
+    // Wall clock time since Exec() started; in ms
+    int64_t elapsed_ms;
+
+    // Estimated time until all scan ranges are complete, extrapolated from the rate
+    // at which they completed so far; in ms, -1 if none has completed yet
+    int64_t remaining_ms;
+
+    // Memory currently used by the running fragment instances; in bytes
+    int64_t mem_usage;
+
+    // Name of each plan node (as in the profile) and the rows it returned so far,
+    // summed over its instances
+    struct NodeProgress {
+      std::string name;
+      int64_t rows_returned;
+      NodeProgress() : rows_returned(0) {}
+    };
+    std::map<PlanNodeId, NodeProgress> nodes;
+  };
+
+  // Fills in 'progress' and returns true once Exec() has started all fragments,
+  // returns false before.  Waits for Exec() to finish if it is running.
+  bool GetProgress(Progress* progress);
+
  private:
   class BackendExecState;
     
@@ -182,6 +221,11 @@ class Coordinator {
   TQueryGlobals query_globals_;
   TQueryOptions query_options_;
 
+  // Key of each fragment in the exec env's ExecStatsStore, by fragment idx; empty if
+  // there is no store.  Set in Exec(), along with the store's generation then.
+  std::vector<std::string> exec_stats_keys_;
+  int64_t exec_stats_generation_;
+
   // map from id of a scan node to a specific counter in the node's profile
   typedef std::map<PlanNodeId, RuntimeProfile::Counter*> CounterMap;
 
@@ -194,11 +238,17 @@ class Coordinator {
     CounterMap scan_ranges_complete_counters;
   };
   
+  // map from scan node id to a list of scan ranges
+  typedef std::map<TPlanNodeId, std::vector<TScanRangeParams> > PerNodeScanRanges;
+
   // execution parameters for a single fragment; used to assemble the
   // per-fragment instance TPlanFragmentExecParams;
-  // hosts.size() == instance_ids.size()
+  // hosts.size() == instance_ids.size() == per_instance_scan_ranges.size()
   struct FragmentExecParams {
-    sparrow::SimpleScheduler::HostList hosts; // execution backends
+    // execution backend of each instance; a partitioned fragment has
+    // num_instances_per_host consecutive instances on each of its backends
+    sparrow::SimpleScheduler::HostList hosts;
+    int num_instances_per_host;
 
     // map from scan range server (from TScanRangeLocations) to host in 'hosts'
     typedef boost::unordered_map<THostPort, THostPort> DataServerMap;
@@ -207,12 +257,29 @@ class Coordinator {
     std::vector<TUniqueId> instance_ids;
     std::vector<TPlanFragmentDestination> destinations;
     std::map<PlanNodeId, int> per_exch_num_senders;
+
+    // exchange nodes that receive a broadcast stream once per backend and share it
+    // among the instances on that backend (see TPlanFragmentExecParams)
+    std::set<PlanNodeId> shared_broadcast_exch_ids;
+
+    // For broadcast streams that are relayed along a tree (see ComputeRelayTree()):
+    // per instance, the destinations the instance forwards each stream to, and the
+    // exchange nodes that get their stream from a relaying instance rather than
+    // from the senders.  Empty if no stream to the fragment is relayed.
+    typedef std::map<PlanNodeId, std::vector<TPlanFragmentDestination> >
+        RelayDestinations;
+    std::vector<RelayDestinations> relay_destinations;
+    std::vector<std::set<PlanNodeId> > relayed_exch_ids;
+
+    // scan ranges of each instance, split off its host's entry in
+    // scan_range_assignment_; populated in ComputeScanRangeAssignment()
+    std::vector<PerNodeScanRanges> per_instance_scan_ranges;
+
+    FragmentExecParams() : num_instances_per_host(1) {}
   };
   // populated in ComputeFragmentExecParams()
   std::vector<FragmentExecParams> fragment_exec_params_;
 
-  // map from scan node id to a list of scan ranges
-  typedef std::map<TPlanNodeId, std::vector<TScanRangeParams> > PerNodeScanRanges;
   // map from an impalad host address to the per-node assigned scan ranges;
   // records scan range assignment for a single fragment
   typedef boost::unordered_map<THostPort, PerNodeScanRanges> FragmentScanRangeAssignment;
@@ -237,6 +304,16 @@ class Coordinator {
   // Keeps track of number of completed ranges and total scan ranges.
   ProgressUpdater progress_;
 
+  // Started at the beginning of Exec(); for Progress::elapsed_ms
+  WallClockStopWatch exec_timer_;
+
+  // True once Exec() has started all fragments; protected by lock_
+  bool fragments_started_;
+
+  // Hosts of the instances reported as stragglers by CheckForStragglers();
+  // protected by lock_
+  std::vector<std::string> stragglers_;
+
   // protects all fields below
   boost::mutex lock_;
 
@@ -297,6 +374,10 @@ class Coordinator {
   // entire table.
   PartitionRowCount partition_row_counts_;
 
+  // Statistics of the rows written to each partition, merged over all instances, if
+  // the table sinks gathered them.
+  PartitionStatsMap partition_stats_;
+
   // The set of files to move after an INSERT query has run, in (src, dest) form. An empty
   // string for the destination means that a file is to be deleted.
   FileMoveMap files_to_move_;
@@ -308,6 +389,12 @@ class Coordinator {
   // Aggregate counters for the entire query.
   boost::scoped_ptr<RuntimeProfile> query_profile_;
 
+  // Timeline of the query, set in Exec(); not owned.
+  RuntimeProfile::EventSequence* query_events_;
+
+  // True once GetNext() returned the first row; only accessed by GetNext().
+  bool returned_first_row_;
+
   // Profile for aggregate counters; allocated in obj_pool().
   RuntimeProfile* aggregate_profile_;
 
@@ -346,10 +433,24 @@ class Coordinator {
   // Populates fragment_exec_params_.
   void ComputeFragmentExecParams(const TQueryExecRequest& exec_request);
 
+  // Turns the broadcast from the instances of 'params' to exchange node 'exch_id' of
+  // 'dest_params' into a relay tree with --broadcast_relay_fanout children per node:
+  // the senders only send to the first destinations, which forward the stream to
+  // the next ones, and so on.  'instances_per_dest' is the number of instances that
+  // share the stream of each destination.
+  void ComputeRelayTree(PlanNodeId exch_id, int instances_per_dest,
+      FragmentExecParams* params, FragmentExecParams* dest_params);
+
   // For each fragment in exec_request, computes hosts on which to run the instances
-  // and stores result in fragment_exec_params_.hosts.
+  // and stores result in fragment_exec_params_.hosts.  Partitioned fragments get
+  // NumInstancesPerHost() instances on each of their hosts.
   Status ComputeFragmentHosts(const TQueryExecRequest& exec_request);
 
+  // Returns the number of instances of a partitioned fragment per backend: the
+  // NUM_INSTANCES_PER_HOST query option, or --fragment_instances_per_host if that
+  // isn't set, where 0 means one per core.
+  int NumInstancesPerHost() const;
+
   // Returns the id of the leftmost node of any of the gives types in 'plan_root',
   // or INVALID_PLAN_NODE_ID if no such node present.
   PlanNodeId FindLeftmostNode(
@@ -364,19 +465,67 @@ class Coordinator {
   // Populates scan_range_assignment_.
   void ComputeScanRangeAssignment(const TQueryExecRequest& exec_request);
 
+  // Load of a backend during ComputeScanRangeAssignment()
+  struct HostLoad {
+    int64_t bytes;
+    int num_ranges;
+    int num_local_ranges;
+    // volume ids of the local replicas
+    boost::unordered_set<int> volumes;
+
+    HostLoad() : bytes(0), num_ranges(0), num_local_ranges(0) {}
+    int NumDisks() const { return std::max<int>(volumes.size(), 1); }
+    double BytesPerDisk() const { return static_cast<double>(bytes) / NumDisks(); }
+  };
+
   // Does a scan range assignment (returned in 'assignment') based on a list of scan
-  // range locations for a particular node.
+  // range locations for a particular node, and adds it to query_profile_.
+  // The ranges are assigned greedily by bytes, largest first: each range goes to the
+  // least loaded backend with a local replica, or to the least loaded backend of the
+  // fragment if no replica is local.  A backend's load is its assigned bytes per disk.
   void ComputeScanRangeAssignment(PlanNodeId node_id,
       const std::vector<TScanRangeLocations>& locations,
       const FragmentExecParams& params, FragmentScanRangeAssignment* assignment);
 
+  // Assigns the scan ranges of 'node_ids', the scan nodes of a fragment that executes a
+  // join per bucket (see TScanRangeLocations.bucket), directly to the instances of the
+  // fragment: all ranges of a bucket go to the same instance, so that it joins the
+  // bucket's rows of both scans.  The buckets are assigned greedily by bytes, largest
+  // first, each to the instance with the fewest bytes among those on a backend with a
+  // local replica of one of the bucket's ranges, or among all instances if there is
+  // none.  Stores the ranges in params->per_instance_scan_ranges.
+  void ComputeBucketedScanRangeAssignment(const TQueryExecRequest& exec_request,
+      const std::vector<PlanNodeId>& node_ids, FragmentExecParams* params);
+
+  // Splits the ranges that 'assignment' gives to each host among the instances of
+  // the fragment on that host and stores them in params->per_instance_scan_ranges.
+  // Like ComputeScanRangeAssignment(), it assigns the ranges greedily, each to the
+  // instance with the fewest bytes so far.
+  void SplitScanRangeAssignment(const FragmentScanRangeAssignment& assignment,
+      FragmentExecParams* params);
+
+  // Returns the backend in params.hosts for a data server of one of the fragment's
+  // scan ranges.
+  const THostPort* GetExecHost(const FragmentExecParams& params,
+      const THostPort& data_server);
+
   // Fill in rpc_params based on parameters.
   void SetExecPlanFragmentParams(int backend_num, const TPlanFragment& fragment,
       int fragment_idx, const FragmentExecParams& params, int instance_idx,
       const THostPort& coord, TExecPlanFragmentParams* rpc_params);
 
+  // Fill in the rpc_params that are the same for all instances of a fragment.
+  void SetFragmentRpcParams(const TPlanFragment& fragment,
+      const FragmentExecParams& params, const THostPort& coord,
+      TExecPlanFragmentParams* rpc_params);
+
+  // Fill in the rpc_params that are specific to one instance of a fragment.
+  // 'scan_ranges' are the instance's entry in per_instance_scan_ranges.  Thread-safe.
+  void SetInstanceRpcParams(int backend_num, int fragment_idx, int instance_idx,
+      const PerNodeScanRanges& scan_ranges, TExecPlanFragmentParams* rpc_params);
+
   // Wrapper for ExecPlanFragment() rpc.  This function will be called in parallel
-  // from multiple threads.
+  // from multiple threads of ExecEnv::coordinator_rpc_pool().
   // Obtains exec_state->lock prior to making rpc, so that it serializes
   // correctly with UpdateFragmentExecStatus().
   // exec_state contains all information needed to issue the rpc.
@@ -384,6 +533,12 @@ class Coordinator {
   // always be an instance of BackendExecState.
   Status ExecRemoteFragment(void* exec_state);
 
+  // Reports the instances of fragment 'fragment_idx' that fall far behind their
+  // peers (see --straggler_progress_ratio) in the query profile.  Called whenever an
+  // instance of the fragment reports its status.
+  // Obtains lock_.
+  void CheckForStragglers(int fragment_idx);
+
   // Determine fragment number, given fragment id.
   int GetFragmentNum(const TUniqueId& fragment_id);
 
@@ -409,6 +564,15 @@ class Coordinator {
   // Runs cancel logic. Assumes that lock_ is held.
   void CancelInternal();
 
+  // Sets exec_stats_keys_ and passes the statistics that the exec stats store has for
+  // the fragments of 'request' to their plan nodes (see TPlanNode.exec_stats).
+  void SetPlanNodeExecStats(TQueryExecRequest* request);
+
+  // Records the statistics of the plan nodes of all fragments in the exec stats store.
+  // Only called once the query has finished successfully, when all fragment instances
+  // have sent their final profiles.
+  void RecordPlanNodeExecStats();
+
   // Returns query_status_.
   Status GetStatus();
 
@@ -430,6 +594,21 @@ class Coordinator {
   // backends are returned.
   Status FinalizeQuery();
 
+  // One hdfs operation of FinalizeQuery().
+  struct FinalizeOp;
+
+  // Runs function(&(*ops)[i]) for all ops on the insert finalize pool, or one after
+  // the other if there is none, and returns the first error.
+  Status ExecFinalizeOps(ParallelExecutor::Function function,
+      std::vector<FinalizeOp>* ops);
+
+  // FinalizeOp functions: creates (after deleting the data, if INSERT OVERWRITE) the
+  // partition directory op->path, moves the file op->path to op->dest and deletes the
+  // temporary directory op->path.  They are thread safe.
+  static Status CreatePartitionDir(void* op);
+  static Status MoveFile(void* op);
+  static Status DeleteTmpDir(void* op);
+
   // Outputs aggregate query profile summary.  This is assumed to be called at the
   // end of a succesfully executed query.
   void ReportQuerySummary();
@@ -14,6 +14,7 @@
 
 #include "runtime/data-stream-mgr.h"
 
+#include <algorithm>
 #include <iostream>
 #include <boost/functional/hash.hpp>
 #include <boost/thread/locks.hpp>
@@ -21,8 +22,10 @@
 
 #include "runtime/row-batch.h"
 #include "runtime/data-stream-recvr.h"
+#include "runtime/data-stream-sender.h"
 #include "runtime/raw-value.h"
 #include "util/debug-util.h"
+#include "util/stopwatch.h"
 
 #include "gen-cpp/ImpalaInternalService.h"
 #include "gen-cpp/ImpalaInternalService_types.h"
@@ -35,22 +38,67 @@ using namespace apache::thrift::transport;
 
 namespace impala {
 
+const int DataStreamMgr::MAX_CLOSED_STREAMS;
+
 DataStreamMgr::StreamControlBlock::StreamControlBlock(
     const RowDescriptor& row_desc, const TUniqueId& fragment_id,
-    PlanNodeId dest_node_id, int num_senders, int buffer_size)
+    PlanNodeId dest_node_id, int num_senders, int buffer_size, bool is_merging,
+    const TUniqueId* shared_stream_id)
   : fragment_id_(fragment_id),
     dest_node_id_(dest_node_id),
     row_desc_(row_desc),
+    is_shared_(shared_stream_id != NULL),
+    relay_(NULL),
+    relay_closed_(false),
     is_cancelled_(false),
+    is_closed_(false),
     buffer_limit_(buffer_size),
     num_buffered_bytes_(0),
-    num_remaining_senders_(num_senders) {
+    next_ticket_(0),
+    now_serving_(0),
+    num_remaining_senders_(num_senders),
+    is_merging_(is_merging),
+    num_bytes_received_(0),
+    peak_buffered_bytes_(0),
+    num_blocked_adds_(0),
+    sender_blocked_time_ms_(0) {
+  if (is_shared_) shared_stream_id_ = *shared_stream_id;
+  if (!is_merging_) sender_queues_.resize(1);
+  // GetSenderQueue() hands out pointers into sender_queues_
+  sender_queues_.reserve(num_senders);
+}
+
+DataStreamMgr::StreamControlBlock::SenderQueue*
+DataStreamMgr::StreamControlBlock::GetSenderQueue(const TUniqueId& sender_id) {
+  if (!is_merging_) return &sender_queues_[0];
+  SenderIdxMap::iterator i = sender_idxs_.find(sender_id);
+  if (i != sender_idxs_.end()) return &sender_queues_[i->second];
+  DCHECK_LT(sender_queues_.size(), sender_queues_.capacity());
+  sender_idxs_[sender_id] = sender_queues_.size();
+  sender_queues_.push_back(SenderQueue());
+  // a GetBatch() call might be waiting for this sender to show up
+  data_arrival_.notify_all();
+  return &sender_queues_.back();
+}
+
+RowBatch* DataStreamMgr::StreamControlBlock::DequeueBatch(SenderQueue* queue) {
+  DCHECK(!queue->batch_queue.empty());
+  RowBatch* result = queue->batch_queue.front().second;
+  num_buffered_bytes_ -= queue->batch_queue.front().first;
+  VLOG_ROW << "fetched #rows=" << result->num_rows();
+  queue->batch_queue.pop_front();
+  // only the sender holding the next ticket can make use of the space
+  data_removal_.notify_all();
+  return result;
 }
 
 RowBatch* DataStreamMgr::StreamControlBlock::GetBatch(bool* is_cancelled) {
+  DCHECK(!is_merging_);
   unique_lock<mutex> l(lock_);
+  RowBatchQueue* batch_queue = &sender_queues_[0].batch_queue;
   // wait until something shows up or we know we're done
-  while (!is_cancelled_ && batch_queue_.empty() && num_remaining_senders_ > 0) {
+  while (!is_cancelled_ && !is_closed_ && batch_queue->empty()
+      && num_remaining_senders_ > 0) {
     VLOG_ROW << "wait arrival query=" << fragment_id_ << " node=" << dest_node_id_;
     data_arrival_.wait(l);
   }
@@ -59,48 +107,172 @@ RowBatch* DataStreamMgr::StreamControlBlock::GetBatch(bool* is_cancelled) {
     return NULL;
   }
   *is_cancelled = false;
-  if (batch_queue_.empty()) {
-    DCHECK_EQ(num_remaining_senders_, 0);
+  if (batch_queue->empty()) {
+    DCHECK(is_closed_ || num_remaining_senders_ == 0);
     return NULL;
   }
+  return DequeueBatch(&sender_queues_[0]);
+}
 
-  DCHECK(!batch_queue_.empty());
-  RowBatch* result = batch_queue_.front().second;
-  num_buffered_bytes_ -= batch_queue_.front().first;
-  VLOG_ROW << "fetched #rows=" << result->num_rows();
-  batch_queue_.pop_front();
-  data_removal_.notify_one();
-  return result;
+RowBatch* DataStreamMgr::StreamControlBlock::GetBatch(
+    int sender_idx, bool* is_cancelled) {
+  DCHECK(is_merging_);
+  unique_lock<mutex> l(lock_);
+  // wait until the sender has shown up and either sent something or closed its channel
+  while (!is_cancelled_ && !is_closed_ && (sender_idx >= sender_queues_.size()
+      || (sender_queues_[sender_idx].batch_queue.empty()
+          && !sender_queues_[sender_idx].is_closed))) {
+    VLOG_ROW << "wait arrival query=" << fragment_id_ << " node=" << dest_node_id_
+             << " sender=" << sender_idx;
+    data_arrival_.wait(l);
+  }
+  if (is_cancelled_) {
+    *is_cancelled = true;
+    return NULL;
+  }
+  *is_cancelled = false;
+  if (is_closed_) return NULL;
+  SenderQueue* queue = &sender_queues_[sender_idx];
+  if (queue->batch_queue.empty()) {
+    DCHECK(queue->is_closed);
+    return NULL;
+  }
+  return DequeueBatch(queue);
 }
 
-void DataStreamMgr::StreamControlBlock::AddBatch(const TRowBatch& thrift_batch) {
+bool DataStreamMgr::StreamControlBlock::ReserveBufferSpace(
+    SenderQueue* queue, int batch_size, unique_lock<mutex>* lock) {
+  // Merging streams are drained in the order the merge needs, so they don't hand out
+  // tickets; every sender is admitted once its own queue is empty.
+  int64_t ticket = is_merging_ ? -1 : next_ticket_++;
+  bool blocked = false;
+  WallClockStopWatch blocked_timer;
+  while (!is_cancelled_ && !is_closed_) {
+    bool fits = num_buffered_bytes_ == 0
+        || num_buffered_bytes_ + batch_size <= buffer_limit_;
+    if (is_merging_ ? (fits || queue->batch_queue.empty())
+        : (fits && ticket == now_serving_)) {
+      break;
+    }
+    if (!blocked) {
+      VLOG_ROW << " wait removal: #buffered=" << num_buffered_bytes_
+               << " batch_size=" << batch_size << " ticket=" << ticket
+               << " now_serving=" << now_serving_;
+      blocked = true;
+      ++num_blocked_adds_;
+      blocked_timer.Start();
+    }
+    data_removal_.wait(*lock);
+  }
+  if (blocked) sender_blocked_time_ms_ += blocked_timer.ElapsedTime();
+  if (is_cancelled_ || is_closed_) return false;
+  if (!is_merging_) {
+    ++now_serving_;
+    if (next_ticket_ != now_serving_) data_removal_.notify_all();
+  }
+  num_buffered_bytes_ += batch_size;
+  peak_buffered_bytes_ = max<int64_t>(peak_buffered_bytes_, num_buffered_bytes_);
+  num_bytes_received_ += batch_size;
+  return true;
+}
+
+void DataStreamMgr::StreamControlBlock::AddBatch(
+    const TUniqueId& sender_id, const TRowBatch& thrift_batch) {
   int batch_size = RowBatch::GetBatchSize(thrift_batch);
+  {
+    unique_lock<mutex> l(lock_);
+    DCHECK_GT(num_remaining_senders_, 0);
+    if (!ReserveBufferSpace(GetSenderQueue(sender_id), batch_size, &l)) return;
+  }
+  // deserialize outside of lock_; the space for the batch is already reserved
   RowBatch* batch = new RowBatch(row_desc_, thrift_batch);
+  lock_guard<mutex> l(lock_);
+  if (is_cancelled_ || is_closed_) {
+    num_buffered_bytes_ -= batch_size;
+    delete batch;
+    return;
+  }
+  VLOG_ROW << "added #rows=" << batch->num_rows()
+           << " batch_size=" << batch_size << "\n";
+  GetSenderQueue(sender_id)->batch_queue.push_back(make_pair(batch_size, batch));
+  data_arrival_.notify_one();
+}
+
+void DataStreamMgr::StreamControlBlock::AddBatch(
+    const TUniqueId& sender_id, RowBatch* batch, int batch_size) {
   unique_lock<mutex> l(lock_);
   DCHECK_GT(num_remaining_senders_, 0);
-  // if there's something in the queue and this batch will push us over the
-  // buffer limit we need to wait until the batch gets drained
-  while (!batch_queue_.empty() && num_buffered_bytes_ + batch_size > buffer_limit_) {
-    VLOG_ROW << " wait removal: empty=" << (batch_queue_.empty() ? 1 : 0)
-             << " #buffered=" << num_buffered_bytes_
-             << " batch_size=" << batch_size << "\n";
-    data_removal_.wait(l);
+  SenderQueue* queue = GetSenderQueue(sender_id);
+  if (!ReserveBufferSpace(queue, batch_size, &l)) {
+    delete batch;
+    return;
   }
   VLOG_ROW << "added #rows=" << batch->num_rows()
            << " batch_size=" << batch_size << "\n";
-  batch_queue_.push_back(make_pair(batch_size, batch));
-  num_buffered_bytes_ += batch_size;
+  queue->batch_queue.push_back(make_pair(batch_size, batch));
   data_arrival_.notify_one();
 }
 
-void DataStreamMgr::StreamControlBlock::DecrementSenders() {
+bool DataStreamMgr::StreamControlBlock::DecrementSenders(const TUniqueId& sender_id) {
   lock_guard<mutex> l(lock_);
   DCHECK_GT(num_remaining_senders_, 0);
   num_remaining_senders_ = max(0, num_remaining_senders_ - 1);
   VLOG_FILE << "decremented senders: fragment_id=" << fragment_id_
             << " node_id=" << dest_node_id_
             << " #senders=" << num_remaining_senders_;
-  if (num_remaining_senders_ == 0) data_arrival_.notify_one();
+  if (is_merging_) {
+    GetSenderQueue(sender_id)->is_closed = true;
+    data_arrival_.notify_one();
+  } else if (num_remaining_senders_ == 0) {
+    data_arrival_.notify_one();
+  }
+  return num_remaining_senders_ == 0;
+}
+
+void DataStreamMgr::StreamControlBlock::SetRelay(DataStreamSender* relay) {
+  lock_guard<mutex> l(relay_lock_);
+  relay_ = relay;
+}
+
+bool DataStreamMgr::StreamControlBlock::has_relay() {
+  lock_guard<mutex> l(relay_lock_);
+  return relay_ != NULL;
+}
+
+Status DataStreamMgr::StreamControlBlock::RelayBatch(const TRowBatch& batch) {
+  lock_guard<mutex> l(relay_lock_);
+  if (relay_ == NULL || relay_closed_ || !relay_status_.ok()) return relay_status_;
+  relay_status_ = relay_->SendSerialized(batch);
+  return relay_status_;
+}
+
+void DataStreamMgr::StreamControlBlock::CloseRelay() {
+  lock_guard<mutex> l(relay_lock_);
+  if (relay_ == NULL || relay_closed_) return;
+  VLOG_QUERY << "closing relay: fragment_id=" << fragment_id_
+             << " node_id=" << dest_node_id_;
+  Status status = relay_->Close(NULL);
+  if (relay_status_.ok()) relay_status_ = status;
+  relay_closed_ = true;
+  relay_done_cv_.notify_all();
+}
+
+bool DataStreamMgr::StreamControlBlock::RelayNeedsMoreRows() {
+  lock_guard<mutex> l(relay_lock_);
+  return relay_ != NULL && !relay_closed_ && relay_->NeedsMoreRows();
+}
+
+Status DataStreamMgr::StreamControlBlock::WaitForRelay() {
+  unique_lock<mutex> l(relay_lock_);
+  while (relay_ != NULL && !relay_closed_) {
+    {
+      lock_guard<mutex> cancel_lock(lock_);
+      if (is_cancelled_) return Status::CANCELLED;
+    }
+    // CancelStream() doesn't signal relay_done_cv_, so check again in a while
+    relay_done_cv_.timed_wait(l, posix_time::milliseconds(100));
+  }
+  return relay_status_;
 }
 
 void DataStreamMgr::StreamControlBlock::CancelStream() {
@@ -109,6 +281,32 @@ void DataStreamMgr::StreamControlBlock::CancelStream() {
   VLOG_QUERY << "cancelled stream: fragment_id=" << fragment_id_
              << " node_id=" << dest_node_id_;
   data_arrival_.notify_one();
+  // unblock senders waiting for buffer space
+  data_removal_.notify_all();
+}
+
+void DataStreamMgr::StreamControlBlock::CloseStream() {
+  lock_guard<mutex> l(lock_);
+  if (is_closed_) return;
+  is_closed_ = true;
+  VLOG_QUERY << "closed stream: fragment_id=" << fragment_id_
+             << " node_id=" << dest_node_id_;
+  for (int i = 0; i < sender_queues_.size(); ++i) {
+    RowBatchQueue* batch_queue = &sender_queues_[i].batch_queue;
+    for (RowBatchQueue::iterator it = batch_queue->begin(); it != batch_queue->end();
+        ++it) {
+      num_buffered_bytes_ -= it->first;
+      delete it->second;
+    }
+    batch_queue->clear();
+  }
+  data_arrival_.notify_all();
+  data_removal_.notify_all();
+}
+
+bool DataStreamMgr::StreamControlBlock::is_closed() {
+  lock_guard<mutex> l(lock_);
+  return is_closed_;
 }
 
 inline uint32_t DataStreamMgr::GetHashValue(
@@ -121,16 +319,21 @@ inline uint32_t DataStreamMgr::GetHashValue(
 
 DataStreamRecvr* DataStreamMgr::CreateRecvr(
     const RowDescriptor& row_desc, const TUniqueId& fragment_id, PlanNodeId dest_node_id,
-    int num_senders, int buffer_size) {
+    int num_senders, int buffer_size, bool is_merging,
+    const TUniqueId* shared_stream_id) {
   VLOG_FILE << "creating receiver for fragment="
             << fragment_id << ", node=" << dest_node_id;
   StreamControlBlock* cb = pool_.Add(
       new StreamControlBlock(row_desc, fragment_id, dest_node_id, num_senders,
-                             buffer_size));
+                             buffer_size, is_merging, shared_stream_id));
   size_t hash_value = GetHashValue(fragment_id, dest_node_id);
   lock_guard<mutex> l(lock_);
   fragment_stream_set_.insert(make_pair(fragment_id, dest_node_id));
   stream_map_.insert(make_pair(hash_value, cb));
+  if (shared_stream_id != NULL) {
+    VLOG_FILE << "receiver shares stream=" << *shared_stream_id;
+    shared_streams_[make_pair(*shared_stream_id, dest_node_id)].push_back(cb);
+  }
   return new DataStreamRecvr(this, cb);
 }
 
@@ -153,35 +356,108 @@ DataStreamMgr::StreamMap::iterator DataStreamMgr::FindControlBlock(
   return stream_map_.end();
 }
 
+bool DataStreamMgr::FindControlBlocks(
+    const TUniqueId& fragment_id, PlanNodeId node_id, vector<StreamControlBlock*>* cbs) {
+  {
+    lock_guard<mutex> l(lock_);
+    SharedStreamMap::iterator i = shared_streams_.find(make_pair(fragment_id, node_id));
+    if (i != shared_streams_.end()) {
+      *cbs = i->second;
+      return true;
+    }
+  }
+  StreamMap::iterator i = FindControlBlock(fragment_id, node_id);
+  if (i == stream_map_.end()) return false;
+  cbs->assign(1, i->second);
+  return true;
+}
+
 Status DataStreamMgr::AddData(
-    const TUniqueId& fragment_id, PlanNodeId dest_node_id,
-    const TRowBatch& thrift_batch) {
+    const TUniqueId& fragment_id, PlanNodeId dest_node_id, const TUniqueId& sender_id,
+    const TRowBatch& thrift_batch, bool* recvr_closed) {
   VLOG_ROW << "AddData(): fragment_id=" << fragment_id << " node=" << dest_node_id
           << " size=" << RowBatch::GetBatchSize(thrift_batch);
-  StreamMap::iterator i = FindControlBlock(fragment_id, dest_node_id);
-  if (i == stream_map_.end()) {
+  if (recvr_closed != NULL) *recvr_closed = false;
+  vector<StreamControlBlock*> cbs;
+  if (!FindControlBlocks(fragment_id, dest_node_id, &cbs)) {
+    if (IsClosedStream(fragment_id, dest_node_id)) {
+      if (recvr_closed != NULL) *recvr_closed = true;
+      return Status::OK;
+    }
     stringstream err;
     err << "unknown row batch destination: fragment_id=" << fragment_id
         << " node_id=" << dest_node_id;
     LOG(ERROR) << err.str();
     return Status(err.str());
   }
-  i->second->AddBatch(thrift_batch);
+  // control blocks stay in pool_, so this is safe even if the receivers went away;
+  // the senders only stop once all receivers of a shared stream are closed, and
+  // their relays don't need the batches anymore either
+  bool all_closed = true;
+  for (int j = 0; j < cbs.size(); ++j) {
+    RETURN_IF_ERROR(cbs[j]->RelayBatch(thrift_batch));
+    cbs[j]->AddBatch(sender_id, thrift_batch);
+    all_closed = all_closed && cbs[j]->is_closed() && !cbs[j]->RelayNeedsMoreRows();
+  }
+  if (recvr_closed != NULL) *recvr_closed = all_closed;
   return Status::OK;
 }
 
+Status DataStreamMgr::AddData(
+    const TUniqueId& fragment_id, PlanNodeId dest_node_id, const TUniqueId& sender_id,
+    RowBatch* batch, bool* recvr_closed) {
+  int batch_size = batch->tuple_data_pool()->total_allocated_bytes();
+  VLOG_ROW << "AddData(): fragment_id=" << fragment_id << " node=" << dest_node_id
+          << " size=" << batch_size << " (local)";
+  if (recvr_closed != NULL) *recvr_closed = false;
+  vector<StreamControlBlock*> cbs;
+  if (!FindControlBlocks(fragment_id, dest_node_id, &cbs)) {
+    delete batch;
+    if (IsClosedStream(fragment_id, dest_node_id)) {
+      if (recvr_closed != NULL) *recvr_closed = true;
+      return Status::OK;
+    }
+    stringstream err;
+    err << "unknown row batch destination: fragment_id=" << fragment_id
+        << " node_id=" << dest_node_id;
+    LOG(ERROR) << err.str();
+    return Status(err.str());
+  }
+  DCHECK(batch->is_self_contained());
+  if (cbs.size() > 1 || cbs[0]->has_relay()) {
+    // every receiver of the shared stream needs its own copy of the batch, and a
+    // relay forwards it serialized
+    TRowBatch thrift_batch;
+    Status status = batch->Serialize(&thrift_batch);
+    delete batch;
+    RETURN_IF_ERROR(status);
+    return AddData(fragment_id, dest_node_id, sender_id, thrift_batch, recvr_closed);
+  }
+  cbs[0]->AddBatch(sender_id, batch, batch_size);
+  if (recvr_closed != NULL) *recvr_closed = cbs[0]->is_closed();
+  return Status::OK;
+}
+
+bool DataStreamMgr::HasRecvr(const TUniqueId& fragment_id, PlanNodeId dest_node_id) {
+  vector<StreamControlBlock*> cbs;
+  return FindControlBlocks(fragment_id, dest_node_id, &cbs);
+}
+
 Status DataStreamMgr::CloseSender(
-    const TUniqueId& fragment_id, PlanNodeId dest_node_id) {
+    const TUniqueId& fragment_id, PlanNodeId dest_node_id, const TUniqueId& sender_id) {
   VLOG_FILE << "CloseSender(): fragment_id=" << fragment_id << ", node=" << dest_node_id;
-  StreamMap::iterator i = FindControlBlock(fragment_id, dest_node_id);
-  if (i == stream_map_.end()) {
+  vector<StreamControlBlock*> cbs;
+  if (!FindControlBlocks(fragment_id, dest_node_id, &cbs)) {
+    if (IsClosedStream(fragment_id, dest_node_id)) return Status::OK;
     stringstream err;
     err << "unknown row batch destination: fragment_id=" << fragment_id
         << " node_id=" << dest_node_id;
     LOG(ERROR) << err.str();
     return Status(err.str());
   }
-  i->second->DecrementSenders();
+  for (int j = 0; j < cbs.size(); ++j) {
+    if (cbs[j]->DecrementSenders(sender_id)) cbs[j]->CloseRelay();
+  }
   return Status::OK;
 }
 
@@ -197,11 +473,38 @@ Status DataStreamMgr::DeregisterRecvr(const TUniqueId& fragment_id, PlanNodeId n
   }
   lock_guard<mutex> l(lock_);
   StreamControlBlock* cb = i->second;
-  fragment_stream_set_.erase(make_pair(cb->fragment_id(), cb->dest_node_id()));
+  // nobody is going to drain the stream anymore; drop late batches instead of
+  // blocking their senders forever
+  cb->CancelStream();
+  pair<TUniqueId, PlanNodeId> stream_id =
+      make_pair(cb->fragment_id(), cb->dest_node_id());
+  fragment_stream_set_.erase(stream_id);
   stream_map_.erase(i);
+  if (cb->is_shared()) {
+    SharedStreamMap::iterator shared =
+        shared_streams_.find(make_pair(cb->shared_stream_id(), cb->dest_node_id()));
+    DCHECK(shared != shared_streams_.end());
+    vector<StreamControlBlock*>* cbs = &shared->second;
+    cbs->erase(find(cbs->begin(), cbs->end(), cb));
+    if (cbs->empty()) shared_streams_.erase(shared);
+  }
+  if (cb->is_closed()) {
+    closed_stream_set_.insert(stream_id);
+    closed_streams_.push_back(stream_id);
+    if (closed_streams_.size() > MAX_CLOSED_STREAMS) {
+      closed_stream_set_.erase(closed_streams_.front());
+      closed_streams_.pop_front();
+    }
+  }
   return Status::OK;
 }
 
+bool DataStreamMgr::IsClosedStream(const TUniqueId& fragment_id, PlanNodeId node_id) {
+  lock_guard<mutex> l(lock_);
+  return closed_stream_set_.find(make_pair(fragment_id, node_id))
+      != closed_stream_set_.end();
+}
+
 void DataStreamMgr::Cancel(const TUniqueId& fragment_id) {
   VLOG_QUERY << "cancelling all streams for fragment=" << fragment_id;
   lock_guard<mutex> l(lock_);
@@ -222,4 +525,16 @@ void DataStreamMgr::Cancel(const TUniqueId& fragment_id) {
   }
 }
 
+void DataStreamMgr::CloseRecvrs(const TUniqueId& fragment_id) {
+  VLOG_QUERY << "closing all streams for fragment=" << fragment_id;
+  lock_guard<mutex> l(lock_);
+  FragmentStreamSet::iterator i =
+      fragment_stream_set_.lower_bound(make_pair(fragment_id, 0));
+  while (i != fragment_stream_set_.end() && i->first == fragment_id) {
+    StreamMap::iterator j = FindControlBlock(i->first, i->second, false);
+    if (j != stream_map_.end()) j->second->CloseStream();
+    ++i;
+  }
+}
+
 }
@@ -16,8 +16,11 @@
 #ifndef IMPALA_RUNTIME_DATA_STREAM_MGR_H
 #define IMPALA_RUNTIME_DATA_STREAM_MGR_H
 
+#include <deque>
 #include <list>
+#include <map>
 #include <set>
+#include <vector>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
 #include <boost/unordered_map.hpp>
@@ -25,12 +28,14 @@
 #include "common/status.h"
 #include "common/object-pool.h"
 #include "runtime/descriptors.h"  // for PlanNodeId
+#include "util/uid-util.h"
 #include "gen-cpp/Types_types.h"  // for TUniqueId
 
 namespace impala {
 
 class DescriptorTbl;
 class DataStreamRecvr;
+class DataStreamSender;
 class RowBatch;
 class TRowBatch;
 
@@ -42,47 +47,89 @@ class TRowBatch;
 // - Exchange nodes extract data from an incoming stream via a DataStreamRecvr,
 //   which is created with CreateRecvr().
 //
+// Batches are identified by the fragment instance id of their sender. For a merging
+// stream, which feeds a merging exchange, the receiver keeps each sender's batches in a
+// separate queue so they can be merged; otherwise all batches go into a single queue.
+//
 // DataStreamMgr also allows asynchronous cancellation of streams via Cancel()
 // which unblocks all DataStreamRecvr::GetBatch() calls that are made on behalf
 // of the cancelled fragment id.
+//
+// A receiver that doesn't need any more rows closes its stream (DataStreamRecvr::
+// Close(), CloseRecvrs()): buffered batches are dropped, and AddData() drops incoming
+// ones and tells the sender so, which then stops sending. Closed streams are
+// remembered for a while after their receiver is gone, so that late senders aren't
+// told about an unknown destination.
 class DataStreamMgr {
  public:
   DataStreamMgr() {}
 
   // Create a receiver for a specific fragment_id/node_id destination; desc_tbl
   // is the query's descriptor table and is needed to decode incoming TRowBatches.
+  // If 'is_merging' is true, the batches of each sender are kept apart (see
+  // DataStreamRecvr::GetBatch(int, bool*)).
+  // If 'shared_stream_id' is non-NULL, the receiver also gets all of the batches that
+  // are sent to shared_stream_id/dest_node_id: the receivers of a broadcast stream
+  // on the same backend share it, so that the senders only send it to one of them
+  // (shared_stream_id, which is one of the receivers' own fragment_id). The shared
+  // stream lives as long as any of its receivers.
   // The caller is responsible for deleting the returned DataStreamRecvr.
   // TODO: create receivers in someone's pool
   DataStreamRecvr* CreateRecvr(
       const RowDescriptor& row_desc, const TUniqueId& fragment_id,
-      PlanNodeId dest_node_id, int num_senders, int buffer_size);
+      PlanNodeId dest_node_id, int num_senders, int buffer_size,
+      bool is_merging = false, const TUniqueId* shared_stream_id = NULL);
   
   // Adds a row batch to the stream identified by fragment_id/dest_node_id.
   // The call blocks if this ends up pushing the stream over its buffering limit;
   // it unblocks when the stream consumer removed enough data to make space for
-  // row_batch.
-  // TODO: enforce per-sender quotas (something like 200% of buffer_size/#senders),
-  // so that a single sender can't flood the buffer and stall everybody else.
+  // row_batch. Blocked calls are served in arrival order, so a single sender can't
+  // flood the buffer and stall everybody else. The batch is only deserialized
+  // once it has been granted buffer space.
+  // 'sender_id' is the fragment instance id of the sender.
+  // If the stream is closed, the batch is dropped and '*recvr_closed' (if non-NULL)
+  // is set to true.
   // Returns OK if successful, error status otherwise.
   Status AddData(const TUniqueId& fragment_id, PlanNodeId dest_node_id,
-                 const TRowBatch& thrift_batch);
+                 const TUniqueId& sender_id, const TRowBatch& thrift_batch,
+                 bool* recvr_closed = NULL);
+
+  // In-process counterpart of AddData(TRowBatch) for senders that run in the same
+  // process as the receiver: adds 'batch' itself to the stream, without serializing
+  // it, and takes ownership of it.  'batch' must be self-contained.  Blocks like
+  // AddData(TRowBatch).  'batch' is deleted if there is no such stream.
+  Status AddData(const TUniqueId& fragment_id, PlanNodeId dest_node_id,
+                 const TUniqueId& sender_id, RowBatch* batch,
+                 bool* recvr_closed = NULL);
+
+  // Returns true if a receiver for fragment_id/dest_node_id, or a shared stream with
+  // that id, is registered with this DataStreamMgr, in which case senders in this
+  // process can use AddData(RowBatch*).
+  bool HasRecvr(const TUniqueId& fragment_id, PlanNodeId dest_node_id);
 
   // Decreases the #remaining_senders count for the stream identified by
-  // fragment_id/dest_node_id.
+  // fragment_id/dest_node_id and marks the end of sender_id's stream.
   // Returns OK if successful, error status otherwise.
-  Status CloseSender(const TUniqueId& fragment_id, PlanNodeId dest_node_id);
+  Status CloseSender(const TUniqueId& fragment_id, PlanNodeId dest_node_id,
+                     const TUniqueId& sender_id);
 
   // Closes all streams registered for fragment_id immediately.
   void Cancel(const TUniqueId& fragment_id);
 
+  // Closes all streams registered for fragment_id like DataStreamRecvr::Close();
+  // called once the fragment has produced all of its rows.
+  void CloseRecvrs(const TUniqueId& fragment_id);
+
  private:
   friend class DataStreamRecvr;
 
   class StreamControlBlock {
    public:
+    // 'shared_stream_id' is NULL if the receiver doesn't belong to a shared stream.
     StreamControlBlock(
         const RowDescriptor& row_desc, const TUniqueId& fragment_id,
-        PlanNodeId dest_node_id, int num_senders, int buffer_size);
+        PlanNodeId dest_node_id, int num_senders, int buffer_size, bool is_merging,
+        const TUniqueId* shared_stream_id);
 
     // Returns next available batch or NULL if end-of-stream or stream got
     // cancelled (sets 'is_cancelled' accordingly).
@@ -91,54 +138,172 @@ class DataStreamMgr {
     // The call blocks until another batch arrives or all senders close
     // their channels.
     // The caller owns the batch.
+    // Only valid for non-merging streams.
     RowBatch* GetBatch(bool* is_cancelled);
 
+    // Same as GetBatch(bool*) for the sender_idx-th sender of a merging stream
+    // (senders are numbered in the order in which their first batch or eos arrives).
+    // Returns NULL once that sender has closed its channel and all of its batches
+    // have been returned.
+    RowBatch* GetBatch(int sender_idx, bool* is_cancelled);
+
     // Adds a row batch to this stream's queue; blocks if this will
-    // make the stream exceed its buffer limit.
-    void AddBatch(const TRowBatch& batch);
+    // make the stream exceed its buffer limit. The batch is dropped if the stream
+    // gets cancelled.
+    void AddBatch(const TUniqueId& sender_id, const TRowBatch& batch);
 
-    // Decrement the number of remaining senders and signal eos ("new data")
-    // if the count drops to 0.
-    void DecrementSenders();
+    // Same as AddBatch(TRowBatch), for a batch that doesn't need to be deserialized.
+    // 'batch_size' is the number of bytes it counts against the buffer limit.
+    // Takes ownership of 'batch'.
+    void AddBatch(const TUniqueId& sender_id, RowBatch* batch, int batch_size);
+
+    // Decrement the number of remaining senders, mark the end of sender_id's
+    // stream and signal eos ("new data") if the count drops to 0.
+    // Returns true if it did.
+    bool DecrementSenders(const TUniqueId& sender_id);
+
+    // Sets the sender that the stream is relayed to (see DataStreamRecvr::SetRelay());
+    // NULL stops the relaying.  Waits for a batch that is being relayed.
+    void SetRelay(DataStreamSender* relay);
+    bool has_relay();
+
+    // Sends 'batch' to the relay, if there is one.  Returns the relay's status.
+    Status RelayBatch(const TRowBatch& batch);
+
+    // Closes the relay once all senders have closed their streams.
+    void CloseRelay();
+
+    // Returns true if the relay's receivers still need rows.
+    bool RelayNeedsMoreRows();
+
+    // Waits until CloseRelay() was called or the stream got cancelled, and returns
+    // the relay's status.
+    Status WaitForRelay();
 
     // Set cancellation flag and signal cancellation to receiver.
     void CancelStream();
 
+    // Drops the buffered batches and all batches that arrive from now on, and
+    // unblocks waiting senders.  GetBatch() returns NULL (eos) afterwards.
+    void CloseStream();
+
+    // true if CloseStream() was called
+    bool is_closed();
+
     const TUniqueId& fragment_id() const { return fragment_id_; }
     PlanNodeId dest_node_id() const { return dest_node_id_; }
 
+    // The shared stream the receiver belongs to, if any.
+    bool is_shared() const { return is_shared_; }
+    const TUniqueId& shared_stream_id() const { return shared_stream_id_; }
+
+    // Flow control statistics, see the corresponding members.
+    int64_t num_bytes_received() const { return num_bytes_received_; }
+    int64_t peak_buffered_bytes() const { return peak_buffered_bytes_; }
+    int64_t num_blocked_adds() const { return num_blocked_adds_; }
+    int64_t sender_blocked_time_ms() const { return sender_blocked_time_ms_; }
+
    private:
     TUniqueId fragment_id_;
     PlanNodeId dest_node_id_;
     const RowDescriptor& row_desc_;
 
+    // set if the receiver belongs to a shared stream
+    bool is_shared_;
+    TUniqueId shared_stream_id_;
+
+    // Protects the relay state.  Held while a batch is relayed, which serializes the
+    // calls to relay_ from the senders' threads.  Acquired before lock_, if both are.
+    boost::mutex relay_lock_;
+    boost::condition_variable relay_done_cv_;  // signalled by CloseRelay()
+    DataStreamSender* relay_;  // not owned
+    bool relay_closed_;
+    Status relay_status_;  // status of the first failed relay call
+
     // protects all subsequent data in this block
     boost::mutex lock_;
 
     // if true, the receiver fragment for this stream got cancelled
     bool is_cancelled_;
 
+    // if true, the receiver doesn't need any more rows
+    bool is_closed_;
+
     // soft upper limit on the amount of buffering allowed for this stream;
     // we stop acking incoming data once the amount of buffered data
     // exceeds this value
     int buffer_limit_;
 
-    // total number of bytes held in batch_queue_
+    // total number of bytes held in sender_queues_ or reserved for batches that are
+    // being deserialized
     int num_buffered_bytes_;
 
+    // Senders get buffer space in the order in which they asked for it: each
+    // AddBatch() call draws a ticket and waits until its ticket is served.
+    int64_t next_ticket_;
+    int64_t now_serving_;
+
     // number of senders which haven't closed the channel yet
     // (if it drops to 0, end-of-stream is true)
     int num_remaining_senders_;
 
+    // if true, each sender's batches go into a separate queue
+    bool is_merging_;
+
     // signal arrival of new batch or the eos/cancelled condition
     boost::condition_variable data_arrival_;
 
-    // signal removal of data by stream consumer
+    // signal removal of data by stream consumer, or that the next ticket is served
     boost::condition_variable data_removal_;
 
+    // total bytes of all batches added to the stream
+    int64_t num_bytes_received_;
+
+    // high-water mark of num_buffered_bytes_
+    int64_t peak_buffered_bytes_;
+
+    // number of AddBatch() calls that had to wait for buffer space
+    int64_t num_blocked_adds_;
+
+    // total time AddBatch() calls spent waiting for buffer space, in ms
+    int64_t sender_blocked_time_ms_;
+
     // queue of (batch length, batch) pairs
     typedef std::list<std::pair<int, RowBatch*> > RowBatchQueue;
-    RowBatchQueue batch_queue_;
+
+    struct SenderQueue {
+      RowBatchQueue batch_queue;
+      bool is_closed;  // true once the sender has closed its channel
+
+      SenderQueue() : is_closed(false) {}
+    };
+
+    // For merging streams, one queue per sender, in the order in which the senders
+    // were first heard from; otherwise a single queue shared by all senders.
+    std::vector<SenderQueue> sender_queues_;
+
+    // for merging streams, the index of each sender's queue in sender_queues_
+    typedef boost::unordered_map<TUniqueId, int> SenderIdxMap;
+    SenderIdxMap sender_idxs_;
+
+    // Waits until 'batch_size' bytes of buffer space are available for this sender,
+    // which is the case once all earlier callers have been served and the batch fits
+    // into the buffer (or nothing is buffered), and reserves them.
+    // Merging streams don't serve senders in order; instead, a sender whose queue is
+    // empty is admitted right away: the consumer might be waiting for exactly that
+    // sender's next batch, with the buffer full of other senders' batches.
+    // Returns false without reserving anything if the stream got cancelled or closed.
+    // 'lock' must hold lock_.
+    bool ReserveBufferSpace(SenderQueue* queue, int batch_size,
+        boost::unique_lock<boost::mutex>* lock);
+
+    // Returns the queue for 'sender_id', creating it if necessary.
+    // Must be called with lock_ held.
+    SenderQueue* GetSenderQueue(const TUniqueId& sender_id);
+
+    // Removes the first batch from 'queue' and returns it.
+    // Must be called with lock_ held.
+    RowBatch* DequeueBatch(SenderQueue* queue);
   };
 
   ObjectPool pool_;  // holds control blocks
@@ -173,6 +338,27 @@ class DataStreamMgr {
   typedef std::set<std::pair<TUniqueId, PlanNodeId>, ComparisonOp > FragmentStreamSet;
   FragmentStreamSet fragment_stream_set_;
 
+  // map from shared stream id/node id to the receivers of the shared stream; an entry
+  // is removed when its last receiver is deregistered
+  typedef std::map<std::pair<TUniqueId, PlanNodeId>, std::vector<StreamControlBlock*>,
+      ComparisonOp> SharedStreamMap;
+  SharedStreamMap shared_streams_;
+
+  // Returns the receivers of the shared stream fragment_id/node_id in 'cbs', or
+  // the receiver fragment_id/node_id itself if there is no such shared stream.
+  // Returns false if there is neither.
+  bool FindControlBlocks(const TUniqueId& fragment_id, PlanNodeId node_id,
+      std::vector<StreamControlBlock*>* cbs);
+
+  // the last MAX_CLOSED_STREAMS closed streams whose receivers have been deregistered,
+  // in closed_streams_ in the order of their deregistration
+  static const int MAX_CLOSED_STREAMS = 16 * 1024;
+  FragmentStreamSet closed_stream_set_;
+  std::deque<std::pair<TUniqueId, PlanNodeId> > closed_streams_;
+
+  // Returns true if fragment_id/node_id is in closed_stream_set_.
+  bool IsClosedStream(const TUniqueId& fragment_id, PlanNodeId node_id);
+
   // Return iterator into stream_map_ for given fragment_id/node_id, or stream_map_.end()
   // if not found.
   // If 'acquire_lock' is false, assumes lock_ is already being held and won't try to
@@ -30,10 +30,22 @@ class DataStreamRecvr {
  public:
   // deregister from mgr_
   ~DataStreamRecvr() {
+    cb_->SetRelay(NULL);
     // TODO: log error msg
     mgr_->DeregisterRecvr(cb_->fragment_id(), cb_->dest_node_id());
   }
 
+  // Makes the stream's batches also go to 'relay', which forwards them to further
+  // receivers as they arrive, independently of whether this receiver consumes them,
+  // and is closed once all senders have closed their streams.  'relay' must be a
+  // broadcasting sender, and must stay valid until this receiver is destroyed.
+  // Must be called before the first batch arrives.
+  void SetRelay(DataStreamSender* relay) { cb_->SetRelay(relay); }
+
+  // Waits until the relay has forwarded the whole stream and been closed, or the
+  // stream got cancelled, and returns the relay's status.
+  Status WaitForRelay() { return cb_->WaitForRelay(); }
+
   // Returns next row batch in data stream; blocks if there aren't any.
   // Returns NULL if eos (subsequent calls will not return any more batches).
   // Sets 'is_cancelled' to true if receiver fragment got cancelled, otherwise false.
@@ -43,6 +55,24 @@ class DataStreamRecvr {
     return cb_->GetBatch(is_cancelled);
   }
 
+  // For receivers created with is_merging: returns the next batch of the
+  // sender_idx-th sender (0 <= sender_idx < #senders), or NULL once that sender's
+  // stream is exhausted.  Blocks until either is the case.  Sets 'is_cancelled' like
+  // GetBatch(bool*).
+  RowBatch* GetBatch(int sender_idx, bool* is_cancelled) {
+    return cb_->GetBatch(sender_idx, is_cancelled);
+  }
+
+  // Tells the senders that no more rows are needed and drops the buffered batches;
+  // GetBatch() returns NULL afterwards.
+  void Close() { cb_->CloseStream(); }
+
+  // Flow control statistics of the stream.
+  int64_t num_bytes_received() const { return cb_->num_bytes_received(); }
+  int64_t peak_buffered_bytes() const { return cb_->peak_buffered_bytes(); }
+  int64_t num_blocked_adds() const { return cb_->num_blocked_adds(); }
+  int64_t sender_blocked_time_ms() const { return cb_->sender_blocked_time_ms(); }
+
  private:
   friend class DataStreamMgr;
   DataStreamMgr* mgr_;
@@ -0,0 +1,36 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "runtime/data-stream-sender.h"
+#include "runtime/row-batch.h"
+#include "util/hash-util.h"
+
+using namespace impala;
+
+// Functions in this file are cross compiled to IR with clang.
+
+// HashRow() is replaced by codegen.
+void DataStreamSender::ComputeChannelIdxs(RowBatch* batch, int* channel_idxs) {
+  int num_channels = channels_.size();
+  int num_rows = batch->num_rows();
+  for (int i = 0; i < num_rows; ++i) {
+    uint32_t hash_val = HashRow(batch->GetRow(i));
+    // The receiver's HashTable computes its buckets from (crc) hashes of the same
+    // values; crc is linear, so we rehash with fvn to make sure that the rows
+    // arriving at any one receiver don't all fall into the same subset of its buckets.
+    hash_val = HashUtil::FvnHash(&hash_val, sizeof(hash_val), HashUtil::FVN_SEED);
+    channel_idxs[i] = hash_val % num_channels;
+  }
+}
@@ -14,21 +14,34 @@
 
 #include "runtime/data-stream-sender.h"
 
+#include <algorithm>
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 #include <boost/shared_ptr.hpp>
+#include <boost/thread/locks.hpp>
 #include <boost/thread/thread.hpp>
 #include <protocol/TBinaryProtocol.h>
 #include <protocol/TDebugProtocol.h>
 #include <transport/TSocket.h>
 #include <transport/TTransportUtils.h>
 
+#include "codegen/llvm-codegen.h"
 #include "common/logging.h"
 #include "exprs/expr.h"
+#include "runtime/client-cache.h"
+#include "runtime/data-stream-mgr.h"
+#include "runtime/data-stream-transport.h"
 #include "runtime/descriptors.h"
+#include "runtime/exec-env.h"
+#include "runtime/runtime-state.h"
 #include "runtime/tuple-row.h"
 #include "runtime/row-batch.h"
 #include "runtime/raw-value.h"
 #include "util/debug-util.h"
+#include "util/hash-util.h"
+#include "util/histogram.h"
+#include "util/stopwatch.h"
 #include "util/thrift-client.h"
 
 #include "gen-cpp/Types_types.h"
@@ -40,101 +53,237 @@ using namespace boost;
 using namespace apache::thrift;
 using namespace apache::thrift::protocol;
 using namespace apache::thrift::transport;
+using namespace llvm;
 
 // TODO: move this to backend-main.cc (which we don't have yet)
 DEFINE_int32(port, 20001, "port on which to run Impala backend");
+DEFINE_bool(local_data_streams, true,
+    "if true, data streams between fragments running in the same process hand row "
+    "batches to the receiver directly instead of serializing them and sending rpcs");
+DEFINE_int32(data_stream_sender_window, 4,
+    "maximum number of row batches per data stream channel that are queued or in "
+    "flight; sending blocks while a channel's window is full");
+DEFINE_int32(data_stream_sender_threads, 4,
+    "number of threads per data stream sender that serialize and transmit the "
+    "queued row batches of its channels");
+DEFINE_int32(data_stream_port_offset, 0,
+    "if > 0, backends receive row batches on a dedicated data stream port, this much "
+    "above their backend port, and data stream channels send their batches over a "
+    "connection to that port instead of as TransmitData rpcs (see DataStreamServer)");
 
 namespace impala {
 
+const char* DataStreamSender::LLVM_CLASS_NAME = "class.impala::DataStreamSender";
+
+const int DataStreamSender::CANCEL_CHECK_INTERVAL_MS;
+
 // A channel sends data asynchronously via calls to TransmitData
 // to a single destination ipaddress/node.
 // It has a fixed-capacity buffer and allows the caller either to add rows to
 // that buffer individually (AddRow()), or circumvent the buffer altogether and send
-// TRowBatches directly (SendBatch()). Either way, there can only be one in-flight RPC
-// at any one time (ie, sending will block if the most recent rpc hasn't finished,
-// which allows the receiver node to throttle the sender by withholding acks).
-// *Not* thread-safe.
+// serialized batches directly (SendBatch()). Either way, outgoing batches are queued
+// in the channel and transmitted in order by the sender's send threads
+// (DataStreamSender::SendThread()), one rpc at a time. Up to
+// --data_stream_sender_window batches can be queued or in flight; beyond that,
+// sending blocks until the oldest one has been acked (which allows the receiver node
+// to throttle the sender by withholding acks).
+// If --data_stream_port_offset is set, the batches go over a DataStreamConnection to the
+// receiving backend's DataStreamServer rather than as rpcs, with the same acking.
+// If the receiver runs in the same process, batches are instead added directly to its
+// DataStreamMgr, without serialization or rpcs; that call blocks while the receiver's
+// buffer is full.
+// *Not* thread-safe, except for the members that are shared with the send threads,
+// which are protected by the parent's lock_.
 class DataStreamSender::Channel {
  public:
   // Create channel to send data to particular ipaddress/port/query/node
   // combination. buffer_size is specified in bytes and a soft limit on
   // how much tuple data is getting accumulated before being sent; it only applies
   // when data is added via AddRow() and not sent directly via SendBatch().
-  Channel(const RowDescriptor& row_desc, const THostPort& destination,
-          const TUniqueId& fragment_instance_id, PlanNodeId dest_node_id, int buffer_size)
-    : row_desc_(row_desc),
+  Channel(DataStreamSender* parent, const RowDescriptor& row_desc,
+          const THostPort& destination, const TUniqueId& fragment_instance_id,
+          PlanNodeId dest_node_id, int buffer_size)
+    : parent_(parent),
+      row_desc_(row_desc),
       ipaddress_(destination.ipaddress),
       port_(destination.port),
       fragment_instance_id_(fragment_instance_id),
       dest_node_id_(dest_node_id),
       num_data_bytes_sent_(0),
-      in_flight_batch_(NULL) {
+      client_cache_(NULL),
+      client_(NULL),
+      client_failed_(false),
+      stream_mgr_(NULL),
+      is_local_checked_(false),
+      is_local_(false),
+      is_sending_(false),
+      recvr_closed_(false) {
       // TODO: figure out how to size batch_
-    int capacity = max(1, buffer_size / max(row_desc.GetRowSize(), 1));
-    batch_.reset(new RowBatch(row_desc, capacity));
+    capacity_ = max(1, buffer_size / max(row_desc.GetRowSize(), 1));
+    batch_.reset(new RowBatch(row_desc, capacity_));
   }
 
+  ~Channel();
+
   // Initialize channel.
   // Returns OK if successful, error indication otherwise.
-  Status Init();
+  Status Init(RuntimeState* state);
 
   // Copies a single row into this channel's output buffer and flushes buffer
   // if it reaches capacity.
   // Returns error status if any of the preceding rpcs failed, OK otherwise.
   Status AddRow(TupleRow* row);
 
-  // Asynchronously sends a row batch.
-  // Returns the status of the most recently finished TransmitData
-  // rpc (or OK if there wasn't one that hasn't been reported yet).
-  Status SendBatch(TRowBatch* batch);
+  // Asynchronously sends a serialized row batch, which may be shared with other
+  // channels.  Blocks while the channel's window is full.
+  // Returns the status of the first failed TransmitData rpc, if any.
+  Status SendBatch(const shared_ptr<TRowBatch>& batch);
+
+  // Sends the rows of 'batch' to a local receiver (see IsLocal()).  If 'transfer' is
+  // true, 'batch' must be self-contained; its resources are handed to the receiver
+  // and it is reset.  Otherwise the rows are deep-copied and 'batch' is unchanged.
+  Status SendLocalBatch(RowBatch* batch, bool transfer);
+
+  // Returns true if the receiver is registered with this process' DataStreamMgr.
+  // This is determined on the first call, which must not happen before the first
+  // batch is sent since the receiver might not have been created before that, and
+  // doesn't change afterwards.
+  bool IsLocal();
 
-  // Return status of last TransmitData rpc (initiated by the most recent call
-  // to either SendBatch() or SendCurrentBatch()).
+  // Waits for all queued batches to be transmitted and returns the status of the
+  // first failed TransmitData rpc (or OK if there wasn't one).
   Status GetSendStatus();
 
   // Flush buffered rows and close channel.
   // Returns error status if any of the preceding rpcs failed, OK otherwise.
   Status Close();
 
+  // Transmits the oldest queued batch, serializing it first if necessary.
+  // Only called by the send threads, which serve each channel one batch at a time.
+  void SendNextBatch();
+
   int64_t num_data_bytes_sent() const { return num_data_bytes_sent_; }
 
+  // Returns true once the receiver has closed its stream; batches are dropped from
+  // then on.
+  bool recvr_closed() {
+    lock_guard<mutex> l(parent_->lock_);
+    return recvr_closed_;
+  }
+
  private:
-  typedef ThriftClient<ImpalaInternalServiceClient> BackendThriftClient;
-  scoped_ptr<BackendThriftClient> client_;
+  // A batch waiting to be sent: either a row batch that is owned by the channel
+  // and still needs to be serialized, or an already serialized batch.
+  struct PendingBatch {
+    RowBatch* batch;
+    shared_ptr<TRowBatch> thrift_batch;
+
+    PendingBatch() : batch(NULL) {}
+  };
 
+  DataStreamSender* parent_;
   const RowDescriptor& row_desc_;
   string ipaddress_;
   int port_;
   TUniqueId fragment_instance_id_;
   PlanNodeId dest_node_id_;
 
-  // the number of TRowBatch.data bytes sent successfully
+  // the number of (possibly compressed) TRowBatch.tuple_data bytes sent successfully
   int64_t num_data_bytes_sent_;
 
+  // The client comes from the exec env's data client cache and is held until the
+  // channel is destroyed; without an exec env (e.g., in tests), the channel opens
+  // own_client_ instead and client_cache_ is NULL.
+  typedef ThriftClient<ImpalaInternalServiceClient> BackendThriftClient;
+  BackendClientCache* client_cache_;
+  scoped_ptr<BackendThriftClient> own_client_;
+  ImpalaInternalServiceClient* client_;
+
+  // true if an rpc failed, which leaves the connection in an unknown state
+  bool client_failed_;
+
+  // if non-NULL, batches are sent over this connection instead of with client_, which
+  // is NULL then
+  scoped_ptr<DataStreamConnection> connection_;
+
+  // this process' stream manager; NULL if not known (e.g., in tests)
+  DataStreamMgr* stream_mgr_;
+  bool is_local_checked_;
+  bool is_local_;  // only valid if is_local_checked_
+
   // we're accumulating rows into this batch
   scoped_ptr<RowBatch> batch_;
-  TRowBatch thrift_batch_;
+  int capacity_;  // of batch_
 
-  // accessed by rpc_thread_ and by channel only if there is no in-flight rpc
-  TRowBatch* in_flight_batch_;
-  thread rpc_thread_;  // sender thread
-  Status rpc_status_;  // status of most recently finished TransmitData rpc
+  // The following are protected by parent_->lock_.
+  // Batches that haven't been sent yet, oldest first.
+  deque<PendingBatch> pending_batches_;
+  // true while a send thread is transmitting one of our batches; the channel is in
+  // parent_->ready_channels_ iff it has pending batches and isn't sending
+  bool is_sending_;
+  Status rpc_status_;  // status of the first failed TransmitData rpc
+  bool recvr_closed_;  // see recvr_closed()
+  // Serialized batches that were reset by SendNextBatch(), for SendCurrentBatch() to
+  // reuse instead of allocating a new batch and tuple pointer array for every flush.
+  vector<RowBatch*> free_batches_;
 
-  // Synchronously call client_'s TransmitData() and update rpc_status_
-  // based on return value (or set to error if RPC failed).
-  // Should only run in rpc_thread_.
-  void TransmitData();
+  // Sets recvr_closed_ and drops the pending batches.  Must be called with
+  // parent_->lock_ held.
+  void SetRecvrClosed();
 
-  // Serialize batch_ into thrift_batch_ and send via SendBatch().
-  // Returns SendBatch() status.
+  // Adds 'batch' to pending_batches_, blocking while the window is full.
+  Status EnqueueBatch(const PendingBatch& batch);
+
+  // Synchronously sends 'batch' over connection_ or with client_'s TransmitData(); sets
+  // '*recvr_closed' if the receiver doesn't want the batch.  'data_pool' holds the
+  // tuple data if batch.tuple_data is empty (see RowBatch::Serialize()).
+  // Should only run in a send thread.
+  Status TransmitData(const TRowBatch& batch, MemPool* data_pool, bool* recvr_closed);
+
+  // Queue batch_ for sending and replace it with an empty batch.
   Status SendCurrentBatch();
+
+  // Deep-copies 'row' into a new row of 'dest'.
+  void CopyRow(TupleRow* row, RowBatch* dest);
+
+  // Adds 'batch' to the local receiver's stream and takes ownership of it.
+  Status AddLocalBatch(RowBatch* batch);
 };
 
-Status DataStreamSender::Channel::Init() {
-  client_.reset(new BackendThriftClient(ipaddress_, port_));
+DataStreamSender::Channel::~Channel() {
+  for (int i = 0; i < pending_batches_.size(); ++i) {
+    delete pending_batches_[i].batch;
+  }
+  for (int i = 0; i < free_batches_.size(); ++i) {
+    delete free_batches_[i];
+  }
+  if (client_cache_ != NULL && client_ != NULL) {
+    client_cache_->ReleaseClient(client_, client_failed_);
+  }
+}
+
+Status DataStreamSender::Channel::Init(RuntimeState* state) {
+  if (FLAGS_local_data_streams && state != NULL && state->exec_env() != NULL) {
+    stream_mgr_ = state->stream_mgr();
+  }
+  if (FLAGS_data_stream_port_offset > 0) {
+    connection_.reset(
+        new DataStreamConnection(ipaddress_, port_ + FLAGS_data_stream_port_offset));
+    Status status = connection_->Open();
+    if (status.ok()) return Status::OK;
+    // the receiving backend might not serve the data stream port
+    LOG(WARNING) << status.GetErrorMsg() << "; using TransmitData rpcs instead";
+    connection_.reset();
+  }
+  if (state != NULL && state->exec_env() != NULL) {
+    client_cache_ = state->exec_env()->data_client_cache();
+    return client_cache_->GetClient(make_pair(ipaddress_, port_), &client_);
+  }
+  own_client_.reset(new BackendThriftClient(ipaddress_, port_));
+  client_ = own_client_->iface();
 
   try {
-    client_->Open();
+    own_client_->Open();
   } catch (TTransportException& e) {
     stringstream msg;
     msg << "couldn't create ImpalaInternalService client for " << ipaddress_ << ":"
@@ -145,78 +294,256 @@ Status DataStreamSender::Channel::Init() {
   return Status::OK;
 }
 
-Status DataStreamSender::Channel::SendBatch(TRowBatch* batch) {
+Status DataStreamSender::Channel::SendBatch(const shared_ptr<TRowBatch>& batch) {
   VLOG_ROW << "Channel::SendBatch() instance_id=" << fragment_instance_id_
            << " dest_node=" << dest_node_id_ << " #rows=" << batch->num_rows;
-  // return if the previous batch saw an error
-  RETURN_IF_ERROR(GetSendStatus());
-  DCHECK(in_flight_batch_ == NULL);
-  in_flight_batch_ = batch;
-  rpc_thread_ = thread(&DataStreamSender::Channel::TransmitData, this);
+  PendingBatch pending;
+  pending.thrift_batch = batch;
+  return EnqueueBatch(pending);
+}
+
+Status DataStreamSender::Channel::EnqueueBatch(const PendingBatch& batch) {
+  SCOPED_TIMER(parent_->send_wait_timer_);
+  unique_lock<mutex> l(parent_->lock_);
+  int window = max(FLAGS_data_stream_sender_window, 1);
+  while (rpc_status_.ok() && !recvr_closed_
+      && pending_batches_.size() + (is_sending_ ? 1 : 0) >= window) {
+    if (parent_->IsCancelled()) {
+      delete batch.batch;
+      return Status::CANCELLED;
+    }
+    parent_->batch_sent_cv_.timed_wait(
+        l, posix_time::milliseconds(CANCEL_CHECK_INTERVAL_MS));
+  }
+  if (recvr_closed_) {
+    delete batch.batch;
+    return Status::OK;
+  }
+  if (!rpc_status_.ok()) {
+    // return if a previous batch saw an error
+    delete batch.batch;
+    LOG(ERROR) << "channel send status: " << rpc_status_.GetErrorMsg();
+    return rpc_status_;
+  }
+  pending_batches_.push_back(batch);
+  if (pending_batches_.size() == 1 && !is_sending_) {
+    parent_->ready_channels_.push_back(this);
+    parent_->channel_ready_cv_.notify_one();
+  }
+  return Status::OK;
+}
+
+void DataStreamSender::Channel::SetRecvrClosed() {
+  VLOG_QUERY << "receiver closed: instance_id=" << fragment_instance_id_
+             << " dest_node=" << dest_node_id_;
+  recvr_closed_ = true;
+  for (int i = 0; i < pending_batches_.size(); ++i) {
+    delete pending_batches_[i].batch;
+  }
+  pending_batches_.clear();
+  parent_->batch_sent_cv_.notify_all();
+}
+
+void DataStreamSender::Channel::SendNextBatch() {
+  PendingBatch batch;
+  Status status;
+  bool recvr_closed;
+  {
+    lock_guard<mutex> l(parent_->lock_);
+    DCHECK(!is_sending_);
+    DCHECK(!pending_batches_.empty());
+    batch = pending_batches_.front();
+    pending_batches_.pop_front();
+    is_sending_ = true;
+    // after an error, the remaining batches are dropped
+    status = rpc_status_;
+    if (status.ok() && parent_->IsCancelled()) status = Status::CANCELLED;
+    recvr_closed = recvr_closed_;
+  }
+
+  // a connection sends the tuple data straight from data_pool's chunks
+  MemPool data_pool;
+  RowBatch* free_batch = NULL;
+  if (status.ok() && !recvr_closed && batch.batch != NULL) {
+    batch.thrift_batch.reset(new TRowBatch());
+    SCOPED_TIMER(parent_->serialize_batch_timer_);
+    if (connection_ != NULL) {
+      status = batch.batch->Serialize(batch.thrift_batch.get(), &data_pool);
+    } else {
+      status = batch.batch->Serialize(batch.thrift_batch.get());
+    }
+    batch.batch->Reset();
+    free_batch = batch.batch;
+  } else {
+    delete batch.batch;
+  }
+  if (status.ok() && !recvr_closed) {
+    status = TransmitData(*batch.thrift_batch, &data_pool, &recvr_closed);
+  }
+
+  lock_guard<mutex> l(parent_->lock_);
+  if (rpc_status_.ok()) rpc_status_ = status;
+  if (recvr_closed && !recvr_closed_) SetRecvrClosed();
+  if (free_batch != NULL) free_batches_.push_back(free_batch);
+  is_sending_ = false;
+  if (!pending_batches_.empty()) {
+    parent_->ready_channels_.push_back(this);
+    parent_->channel_ready_cv_.notify_one();
+  }
+  parent_->batch_sent_cv_.notify_all();
+}
+
+bool DataStreamSender::Channel::IsLocal() {
+  if (!is_local_checked_) {
+    is_local_ = stream_mgr_ != NULL &&
+        stream_mgr_->HasRecvr(fragment_instance_id_, dest_node_id_);
+    is_local_checked_ = true;
+    VLOG_FILE << "Channel instance_id=" << fragment_instance_id_
+              << " dest_node=" << dest_node_id_ << " is_local=" << is_local_;
+  }
+  return is_local_;
+}
+
+Status DataStreamSender::Channel::SendLocalBatch(RowBatch* batch, bool transfer) {
+  DCHECK(IsLocal());
+  if (batch->num_rows() == 0 || recvr_closed()) return Status::OK;
+  RowBatch* local_batch = new RowBatch(row_desc_, batch->num_rows());
+  if (transfer) {
+    DCHECK(batch->is_self_contained());
+    for (int i = 0; i < batch->num_rows(); ++i) {
+      int row_idx = local_batch->AddRow();
+      local_batch->CopyRow(batch->GetRow(i), local_batch->GetRow(row_idx));
+      local_batch->CommitLastRow();
+    }
+    batch->TransferResourceOwnership(local_batch);
+  } else {
+    for (int i = 0; i < batch->num_rows(); ++i) {
+      CopyRow(batch->GetRow(i), local_batch);
+    }
+  }
+  return AddLocalBatch(local_batch);
+}
+
+Status DataStreamSender::Channel::AddLocalBatch(RowBatch* batch) {
+  batch->set_is_self_contained(true);
+  int64_t batch_size = batch->tuple_data_pool()->total_allocated_bytes();
+  bool recvr_closed;
+  {
+    // blocks while the receiver's queue is full
+    SCOPED_TIMER(parent_->send_wait_timer_);
+    RETURN_IF_ERROR(stream_mgr_->AddData(fragment_instance_id_, dest_node_id_,
+        parent_->fragment_instance_id_, batch, &recvr_closed));
+  }
+  if (recvr_closed) {
+    lock_guard<mutex> l(parent_->lock_);
+    if (!recvr_closed_) SetRecvrClosed();
+    return Status::OK;
+  }
+  num_data_bytes_sent_ += batch_size;
   return Status::OK;
 }
 
-void DataStreamSender::Channel::TransmitData() {
-  DCHECK(in_flight_batch_ != NULL);
+Status DataStreamSender::Channel::TransmitData(
+    const TRowBatch& batch, MemPool* data_pool, bool* recvr_closed) {
+  if (connection_ != NULL) {
+    VLOG_ROW << "Channel::TransmitData() over connection instance_id="
+             << fragment_instance_id_ << " dest_node=" << dest_node_id_
+             << " #rows=" << batch.num_rows;
+    StopWatch send_watch;
+    send_watch.Start();
+    RETURN_IF_ERROR(connection_->SendBatch(fragment_instance_id_, dest_node_id_,
+        parent_->fragment_instance_id_, batch, data_pool, recvr_closed));
+    parent_->transmit_data_rpc_time_->Add(send_watch.ElapsedTime());
+    if (*recvr_closed) return Status::OK;
+    num_data_bytes_sent_ +=
+        batch.tuple_data.empty() ? batch.uncompressed_size : batch.tuple_data.size();
+    return Status::OK;
+  }
   try {
     VLOG_ROW << "Channel::TransmitData() instance_id=" << fragment_instance_id_
              << " dest_node=" << dest_node_id_
-             << " #rows=" << in_flight_batch_->num_rows;
+             << " #rows=" << batch.num_rows;
     TTransmitDataParams params;
     params.protocol_version = ImpalaInternalServiceVersion::V1;
     params.__set_dest_fragment_instance_id(fragment_instance_id_);
     params.__set_dest_node_id(dest_node_id_);
-    params.__set_row_batch(*in_flight_batch_);  // yet another copy
+    params.__set_src_fragment_instance_id(parent_->fragment_instance_id_);
+    params.__set_row_batch(batch);  // yet another copy
     params.__set_eos(false);
     TTransmitDataResult res;
-    client_->iface()->TransmitData(res, params);
-    if (res.status.status_code != TStatusCode::OK) {
-      rpc_status_ = res.status;
-    } else {
-      num_data_bytes_sent_ += RowBatch::GetBatchSize(*in_flight_batch_);
-      VLOG_ROW << "incremented #data_bytes_sent="
-               << num_data_bytes_sent_;
-    }
+    StopWatch rpc_watch;
+    rpc_watch.Start();
+    client_->TransmitData(res, params);
+    parent_->transmit_data_rpc_time_->Add(rpc_watch.ElapsedTime());
+    if (res.status.status_code != TStatusCode::OK) return Status(res.status);
+    *recvr_closed = res.__isset.recvr_closed && res.recvr_closed;
+    if (*recvr_closed) return Status::OK;
+    num_data_bytes_sent_ += batch.tuple_data.size();
+    VLOG_ROW << "incremented #data_bytes_sent="
+             << num_data_bytes_sent_;
   } catch (TException& e) {
+    client_failed_ = true;
     stringstream msg;
     msg << "TransmitData() to " << ipaddress_ << ":" << port_ << " failed:\n" << e.what();
-    rpc_status_ = Status(msg.str());
-    return;
+    return Status(msg.str());
   }
-  in_flight_batch_ = NULL;
+  return Status::OK;
 }
 
 Status DataStreamSender::Channel::AddRow(TupleRow* row) {
-  int row_num = batch_->AddRow();
-  if (row_num == RowBatch::INVALID_ROW_INDEX) {
-    // batch_ is full, let's send it; but first wait for an ongoing
-    // transmission to finish before modifying thrift_batch_
+  if (batch_->num_rows() == batch_->capacity()) {
+    // batch_ is full, let's send it
     RETURN_IF_ERROR(SendCurrentBatch());
-    row_num = batch_->AddRow();
-    DCHECK_NE(row_num, RowBatch::INVALID_ROW_INDEX);
   }
+  CopyRow(row, batch_.get());
+  return Status::OK;
+}
 
-  TupleRow* dest = batch_->GetRow(row_num);
-  batch_->CopyRow(row, dest);
+void DataStreamSender::Channel::CopyRow(TupleRow* row, RowBatch* dest_batch) {
+  int row_num = dest_batch->AddRow();
+  DCHECK_NE(row_num, RowBatch::INVALID_ROW_INDEX);
+  TupleRow* dest = dest_batch->GetRow(row_num);
   const vector<TupleDescriptor*>& descs = row_desc_.tuple_descriptors();
   for (int i = 0; i < descs.size(); ++i) {
-    dest->SetTuple(i, row->GetTuple(i)->DeepCopy(*descs[i], batch_->tuple_data_pool()));
+    Tuple* tuple = row->GetTuple(i);
+    // tuples can be NULL, eg, for the non-matching side of an outer join
+    if (tuple == NULL) {
+      dest->SetTuple(i, NULL);
+    } else {
+      dest->SetTuple(i, tuple->DeepCopy(*descs[i], dest_batch->tuple_data_pool()));
+    }
   }
-  return Status::OK;
+  dest_batch->CommitLastRow();
 }
 
 Status DataStreamSender::Channel::SendCurrentBatch() {
-  // make sure there's no in-flight TransmitData() call that might still want to
-  // access thrift_batch_
-  rpc_thread_.join();
-  batch_->Serialize(&thrift_batch_);
-  batch_->Reset();
-  RETURN_IF_ERROR(SendBatch(&thrift_batch_));
-  return Status::OK;
+  // batch_ holds deep copies of its rows, so it can be handed over as a whole
+  RowBatch* batch = batch_.release();
+  {
+    lock_guard<mutex> l(parent_->lock_);
+    if (!free_batches_.empty()) {
+      batch_.reset(free_batches_.back());
+      free_batches_.pop_back();
+    }
+  }
+  if (batch_ == NULL) batch_.reset(new RowBatch(row_desc_, capacity_));
+  if (IsLocal()) return AddLocalBatch(batch);
+  // lets Serialize() convert the batch in place rather than copying it again
+  batch->set_is_self_contained(true);
+  PendingBatch pending;
+  pending.batch = batch;
+  return EnqueueBatch(pending);
 }
 
 Status DataStreamSender::Channel::GetSendStatus() {
-  rpc_thread_.join();
+  SCOPED_TIMER(parent_->send_wait_timer_);
+  unique_lock<mutex> l(parent_->lock_);
+  while (!pending_batches_.empty() || is_sending_) {
+    // the send thread drops the remaining batches, but an rpc might be in flight
+    if (parent_->IsCancelled()) return Status::CANCELLED;
+    parent_->batch_sent_cv_.timed_wait(
+        l, posix_time::milliseconds(CANCEL_CHECK_INTERVAL_MS));
+  }
   if (!rpc_status_.ok()) {
     LOG(ERROR) << "channel send status: " << rpc_status_.GetErrorMsg();
   }
@@ -233,17 +560,29 @@ Status DataStreamSender::Channel::Close() {
   }
   // if the last transmitted batch resulted in a error, return that error
   RETURN_IF_ERROR(GetSendStatus());
+  // the receiver doesn't wait for our eos anymore
+  if (recvr_closed()) return Status::OK;
+  if (IsLocal()) {
+    return stream_mgr_->CloseSender(
+        fragment_instance_id_, dest_node_id_, parent_->fragment_instance_id_);
+  }
+  if (connection_ != NULL) {
+    return connection_->SendEos(
+        fragment_instance_id_, dest_node_id_, parent_->fragment_instance_id_);
+  }
   try {
     TTransmitDataParams params;
     params.protocol_version = ImpalaInternalServiceVersion::V1;
     params.__set_dest_fragment_instance_id(fragment_instance_id_);
     params.__set_dest_node_id(dest_node_id_);
+    params.__set_src_fragment_instance_id(parent_->fragment_instance_id_);
     params.__set_eos(true);
     TTransmitDataResult res;
     VLOG_RPC << "calling TransmitData to close channel";
-    client_->iface()->TransmitData(res, params);
+    client_->TransmitData(res, params);
     return Status(res.status);
   } catch (TException& e) {
+    client_failed_ = true;
     stringstream msg;
     msg << "CloseChannel() to "
         << ipaddress_ << ":" << port_ << " failed:\n" << e.what();
@@ -253,17 +592,38 @@ Status DataStreamSender::Channel::Close() {
 }
 
 DataStreamSender::DataStreamSender(
-    const RowDescriptor& row_desc, const TDataStreamSink& sink,
-    const vector<TPlanFragmentDestination>& destinations,
+    const RowDescriptor& row_desc, const TUniqueId& fragment_instance_id,
+    const TDataStreamSink& sink, const vector<TPlanFragmentDestination>& destinations,
     int per_channel_buffer_size)
-  : current_thrift_batch_(&thrift_batch1_) {
+  : row_desc_(row_desc),
+    fragment_instance_id_(fragment_instance_id),
+    state_(NULL),
+    stop_send_threads_(false),
+    transmit_data_rpc_time_(NULL),
+    send_wait_timer_(NULL),
+    serialize_batch_timer_(NULL),
+    send_thread_counters_(NULL),
+    compute_channel_idxs_fn_(NULL),
+    spread_null_keys_(sink.__isset.spread_null_keys && sink.spread_null_keys),
+    num_sampled_rows_(0),
+    rows_until_sample_(0) {
   DCHECK_GT(destinations.size(), 0);
-  DCHECK(sink.output_partition.type == TPartitionType::UNPARTITIONED);
-  broadcast_ = true;
+  DCHECK(sink.output_partition.type == TPartitionType::UNPARTITIONED
+      || sink.output_partition.type == TPartitionType::HASH_PARTITIONED);
+  broadcast_ = sink.output_partition.type == TPartitionType::UNPARTITIONED;
+  if (!broadcast_) {
+    DCHECK(sink.output_partition.__isset.partitioning_exprs);
+    partition_texprs_ = sink.output_partition.partitioning_exprs;
+    channel_num_rows_.resize(destinations.size());
+  }
+  // start at a different channel in each sender, so that senders with few NULLs
+  // don't all send them to the first channel
+  next_null_channel_ =
+      static_cast<uint64_t>(fragment_instance_id.lo) % destinations.size();
   // TODO: use something like google3's linked_ptr here (scoped_ptr isn't copyable)
   for (int i = 0; i < destinations.size(); ++i) {
     channels_.push_back(
-        new Channel(row_desc, destinations[i].server,
+        new Channel(this, row_desc, destinations[i].server,
                     destinations[i].fragment_instance_id,
                     sink.dest_node_id, per_channel_buffer_size));
   }
@@ -272,52 +632,400 @@ DataStreamSender::DataStreamSender(
 DataStreamSender::~DataStreamSender() {
   // TODO: check that sender was either already closed() or there was an error
   // on some channel
+  StopSendThreads();
   for (int i = 0; i < channels_.size(); ++i) {
     delete channels_[i];
   }
 }
 
 Status DataStreamSender::Init(RuntimeState* state) {
+  state_ = state;
+  transmit_data_rpc_time_ = state->runtime_profile()->AddHistogram(
+      "TransmitDataRpcTime", TCounterType::CPU_TICKS);
+  send_wait_timer_ =
+      ADD_COUNTER(state->runtime_profile(), "SenderWaitTime", TCounterType::CPU_TICKS);
+  serialize_batch_timer_ = ADD_COUNTER(
+      state->runtime_profile(), "SerializeBatchTime", TCounterType::CPU_TICKS);
+  send_thread_counters_ = state->runtime_profile()->AddThreadCounters("SendThreads");
+  if (!broadcast_) {
+    RETURN_IF_ERROR(Expr::CreateExprTrees(&pool_, partition_texprs_, &partition_exprs_));
+    RETURN_IF_ERROR(Expr::Prepare(partition_exprs_, state, row_desc_));
+    LlvmCodeGen* codegen = state->llvm_codegen();
+    if (codegen != NULL && !spread_null_keys_) {
+      Function* compute_channel_idxs_fn = CodegenComputeChannelIdxs(codegen);
+      if (compute_channel_idxs_fn != NULL) {
+        codegen->AddFunctionToJit(compute_channel_idxs_fn,
+            reinterpret_cast<void**>(&compute_channel_idxs_fn_));
+        LOG(INFO) << "DataStreamSender using llvm codegend function for partitioning.";
+      }
+    }
+  }
   for (int i = 0; i < channels_.size(); ++i) {
-    RETURN_IF_ERROR(channels_[i]->Init());
+    RETURN_IF_ERROR(channels_[i]->Init(state));
+  }
+  int num_threads = min<int>(max(FLAGS_data_stream_sender_threads, 1), channels_.size());
+  for (int i = 0; i < num_threads; ++i) {
+    send_threads_.add_thread(new thread(&DataStreamSender::SendThread, this));
   }
   return Status::OK;
 }
 
+void DataStreamSender::SendThread() {
+  while (true) {
+    Channel* channel;
+    {
+      unique_lock<mutex> l(lock_);
+      while (!stop_send_threads_ && ready_channels_.empty()) channel_ready_cv_.wait(l);
+      if (stop_send_threads_) return;
+      channel = ready_channels_.front();
+      ready_channels_.pop_front();
+    }
+    SCOPED_THREAD_COUNTER_MEASUREMENT(send_thread_counters_);
+    channel->SendNextBatch();
+  }
+}
+
+void DataStreamSender::StopSendThreads() {
+  {
+    lock_guard<mutex> l(lock_);
+    stop_send_threads_ = true;
+  }
+  channel_ready_cv_.notify_all();
+  send_threads_.join_all();
+}
+
 Status DataStreamSender::Send(RuntimeState* state, RowBatch* batch) {
+  if (!NeedsMoreRows()) return Status::OK;
   if (broadcast_ || channels_.size() == 1) {
-    // current_thrift_batch_ is *not* the one that was written by the last call
-    // to Serialize()
+    // Local channels go first: serializing a self-contained batch resets it.
+    bool has_remote_channels = false;
+    for (int i = 0; i < channels_.size(); ++i) {
+      if (!channels_[i]->IsLocal()) {
+        // no need to serialize the batch for receivers that are done
+        if (!channels_[i]->recvr_closed()) has_remote_channels = true;
+        continue;
+      }
+      // A self-contained batch can be handed over without copying if no other
+      // channel needs it.
+      bool transfer = batch->is_self_contained() && channels_.size() == 1;
+      RETURN_IF_ERROR(channels_[i]->SendLocalBatch(batch, transfer));
+    }
+    if (!has_remote_channels) return Status::OK;
+
+    // 'batch' belongs to the caller, so it is serialized here; the serialized batch
+    // is shared by the channels and freed once the last one has sent it.
+    // SendBatch() will block if a channel's window is full.
     VLOG_ROW << "serializing " << batch->num_rows() << " rows";
-    batch->Serialize(current_thrift_batch_);
-    // SendBatch() will block if there are still in-flight rpcs (and those will
-    // reference the previously written thrift batch)
+    shared_ptr<TRowBatch> thrift_batch(new TRowBatch());
+    {
+      SCOPED_TIMER(serialize_batch_timer_);
+      RETURN_IF_ERROR(batch->Serialize(thrift_batch.get()));
+    }
     for (int i = 0; i < channels_.size(); ++i) {
-      RETURN_IF_ERROR(channels_[i]->SendBatch(current_thrift_batch_));
+      if (channels_[i]->IsLocal()) continue;
+      RETURN_IF_ERROR(channels_[i]->SendBatch(thrift_batch));
     }
-    current_thrift_batch_ =
-        (current_thrift_batch_ == &thrift_batch1_ ? &thrift_batch2_ : &thrift_batch1_);
   } else {
-    // hash-partition batch's rows across channelS
-    int num_channels = channels_.size();
-    for (int i = 0; i < batch->num_rows(); ++i) {
-      TupleRow* row = batch->GetRow(i);
-      void* partition_val = partition_expr_->GetValue(row);
-      size_t hash_val = RawValue::GetHashValue(partition_val, partition_expr_->type());
-      RETURN_IF_ERROR(channels_[hash_val % num_channels]->AddRow(row));
+    // hash-partition batch's rows across channels
+    int num_rows = batch->num_rows();
+    if (num_rows == 0) return Status::OK;
+    channel_idxs_.resize(num_rows);
+    if (spread_null_keys_) {
+      ComputeChannelIdxsSpreadingNulls(batch, &channel_idxs_[0]);
+    } else if (compute_channel_idxs_fn_ != NULL) {
+      compute_channel_idxs_fn_(this, batch, &channel_idxs_[0]);
+    } else {
+      ComputeChannelIdxs(batch, &channel_idxs_[0]);
+    }
+    SampleRows(batch);
+    for (int i = 0; i < num_rows; ++i) {
+      RETURN_IF_ERROR(channels_[channel_idxs_[i]]->AddRow(batch->GetRow(i)));
+    }
+  }
+  return Status::OK;
+}
+
+Status DataStreamSender::SendSerialized(const TRowBatch& batch) {
+  DCHECK(broadcast_ || channels_.size() == 1);
+  if (!NeedsMoreRows()) return Status::OK;
+  // the remote channels share a single copy of the batch
+  shared_ptr<TRowBatch> thrift_batch;
+  for (int i = 0; i < channels_.size(); ++i) {
+    if (channels_[i]->IsLocal()) {
+      RowBatch local_batch(row_desc_, batch);
+      RETURN_IF_ERROR(channels_[i]->SendLocalBatch(&local_batch, true));
+      continue;
     }
+    if (channels_[i]->recvr_closed()) continue;
+    if (thrift_batch.get() == NULL) thrift_batch.reset(new TRowBatch(batch));
+    RETURN_IF_ERROR(channels_[i]->SendBatch(thrift_batch));
   }
   return Status::OK;
 }
 
+uint32_t DataStreamSender::HashRow(TupleRow* row) {
+  // RawValue::GetHashValue() hashes NULLs to a fixed value, so rows with NULL
+  // partitioning values all end up on the same channel, which is what a
+  // subsequent grouping or join on those exprs requires
+  uint32_t hash_val = 0;
+  for (int i = 0; i < partition_exprs_.size(); ++i) {
+    Expr* expr = partition_exprs_[i];
+    hash_val = RawValue::GetHashValue(expr->GetValue(row), expr->type(), hash_val);
+  }
+  return hash_val;
+}
+
+void DataStreamSender::ComputeChannelIdxsSpreadingNulls(RowBatch* batch,
+    int* channel_idxs) {
+  int num_channels = channels_.size();
+  int num_rows = batch->num_rows();
+  for (int i = 0; i < num_rows; ++i) {
+    TupleRow* row = batch->GetRow(i);
+    // same hash as HashRow() for rows without NULLs, so that the rows of all senders
+    // of a join's inputs still meet at the same receiver
+    uint32_t hash_val = 0;
+    bool has_null = false;
+    for (int j = 0; j < partition_exprs_.size(); ++j) {
+      Expr* expr = partition_exprs_[j];
+      void* value = expr->GetValue(row);
+      if (value == NULL) {
+        has_null = true;
+        break;
+      }
+      hash_val = RawValue::GetHashValue(value, expr->type(), hash_val);
+    }
+    if (has_null) {
+      channel_idxs[i] = next_null_channel_;
+      if (++next_null_channel_ == num_channels) next_null_channel_ = 0;
+      continue;
+    }
+    hash_val = HashUtil::FvnHash(&hash_val, sizeof(hash_val), HashUtil::FVN_SEED);
+    channel_idxs[i] = hash_val % num_channels;
+  }
+}
+
+void DataStreamSender::SampleRows(RowBatch* batch) {
+  int num_rows = batch->num_rows();
+  for (int i = 0; i < num_rows; ++i) ++channel_num_rows_[channel_idxs_[i]];
+
+  int i = rows_until_sample_;
+  for (; i < num_rows; i += SAMPLE_INTERVAL) {
+    TupleRow* row = batch->GetRow(i);
+    uint32_t hash = HashRow(row);
+    ++num_sampled_rows_;
+    int min_idx = -1;
+    bool found = false;
+    for (int j = 0; j < heavy_hitters_.size(); ++j) {
+      if (heavy_hitters_[j].hash == hash) {
+        ++heavy_hitters_[j].count;
+        found = true;
+        break;
+      }
+      if (min_idx == -1 || heavy_hitters_[j].count < heavy_hitters_[min_idx].count) {
+        min_idx = j;
+      }
+    }
+    if (found) continue;
+    HeavyHitter* hh;
+    if (heavy_hitters_.size() < NUM_HEAVY_HITTERS) {
+      heavy_hitters_.push_back(HeavyHitter());
+      hh = &heavy_hitters_.back();
+      hh->count = 1;
+    } else {
+      hh = &heavy_hitters_[min_idx];
+      ++hh->count;
+    }
+    hh->hash = hash;
+    stringstream key;
+    for (int j = 0; j < partition_exprs_.size(); ++j) {
+      if (j > 0) key << ", ";
+      Expr* expr = partition_exprs_[j];
+      RawValue::PrintValue(expr->GetValue(row), expr->type(), &key);
+    }
+    hh->key = key.str();
+  }
+  rows_until_sample_ = i - num_rows;
+}
+
+void DataStreamSender::ReportSkew() {
+  if (broadcast_ || state_ == NULL) return;
+  int num_channels = channels_.size();
+  int64_t total_rows = 0;
+  int64_t max_rows = 0;
+  for (int i = 0; i < num_channels; ++i) {
+    total_rows += channel_num_rows_[i];
+    max_rows = max(max_rows, channel_num_rows_[i]);
+  }
+  if (total_rows == 0) return;
+  stringstream skew;
+  skew << "max rows per channel " << max_rows << ", avg "
+       << total_rows / num_channels;
+  state_->runtime_profile()->AddInfoString("PartitionSkew", skew.str());
+
+  // A key is reported if it alone accounts for more rows than the average channel
+  // gets in total; its channel can't be balanced by any hash function.  The sample
+  // counts are upper bounds, and small samples are too noisy for this.
+  if (num_sampled_rows_ < NUM_HEAVY_HITTERS * 4 || num_channels == 1) return;
+  vector<pair<int64_t, string> > hot_keys;
+  for (int i = 0; i < heavy_hitters_.size(); ++i) {
+    if (heavy_hitters_[i].count * num_channels > num_sampled_rows_) {
+      hot_keys.push_back(make_pair(heavy_hitters_[i].count, heavy_hitters_[i].key));
+    }
+  }
+  if (hot_keys.empty()) return;
+  sort(hot_keys.begin(), hot_keys.end(), greater<pair<int64_t, string> >());
+  stringstream ss;
+  for (int i = 0; i < hot_keys.size(); ++i) {
+    if (i > 0) ss << "; ";
+    ss << "(" << hot_keys[i].second << "): ~" << setprecision(3)
+       << 100.0 * hot_keys[i].first / num_sampled_rows_ << "%";
+  }
+  state_->runtime_profile()->AddInfoString("HeavyHitters", ss.str());
+  VLOG_QUERY << "DataStreamSender of instance " << fragment_instance_id_
+             << " has heavy hitters: " << ss.str();
+}
+
+// Codegens hash_combine(seed, value) of RawValue::GetHashValue(), in 'builder''s
+// current block.
+static Value* CodegenHashCombine(LlvmCodeGen* codegen, LlvmCodeGen::LlvmBuilder* builder,
+    Value* seed, Value* value) {
+  Value* shl = builder->CreateShl(seed, codegen->GetIntConstant(TYPE_INT, 6));
+  Value* lshr = builder->CreateLShr(seed, codegen->GetIntConstant(TYPE_INT, 2));
+  Value* sum = builder->CreateAdd(builder->CreateAdd(value, shl), lshr);
+  return builder->CreateXor(seed, sum);
+}
+
+// The generated HashRow() computes the same hash value as the interpreted one.  For
+// each partition expr, it calls the expr's compute function and combines
+// the running hash with the value:
+// - a NULL is combined like RawValue::GetHashValue() does (hash_combine with 0)
+// - a boolean is combined with hash_combine as well
+// - the data of a string is hashed with the generic hash function
+// - any other value is spilled to the stack and its bytes are hashed with the hash
+//   function for its size, which GetHashFunction() unrolls
+// A phi node in the block after each expr picks the null or the not-null result.
+Function* DataStreamSender::CodegenHashRow(LlvmCodeGen* codegen) {
+  if (!Expr::IsCodegenAvailable(partition_exprs_)) {
+    VLOG_QUERY << "Could not codegen HashRow because one of the partition exprs "
+               << "could not be codegen'd.";
+    return NULL;
+  }
+
+  // Get types to generate function prototype
+  Type* this_type = codegen->GetType(DataStreamSender::LLVM_CLASS_NAME);
+  Type* tuple_row_type = codegen->GetType(TupleRow::LLVM_CLASS_NAME);
+  DCHECK(this_type != NULL);
+  DCHECK(tuple_row_type != NULL);
+  LlvmCodeGen::FnPrototype prototype(codegen, "HashRow", codegen->GetType(TYPE_INT));
+  prototype.AddArgument(
+      LlvmCodeGen::NamedVariable("this_ptr", PointerType::get(this_type, 0)));
+  prototype.AddArgument(
+      LlvmCodeGen::NamedVariable("row", PointerType::get(tuple_row_type, 0)));
+
+  LLVMContext& context = codegen->context();
+  LlvmCodeGen::LlvmBuilder builder(context);
+  Value* args[2];
+  Function* fn = prototype.GeneratePrototype(&builder, args);
+
+  // The expr compute functions take the row as an array of tuple pointers.
+  Value* row = builder.CreateBitCast(args[1], PointerType::get(codegen->ptr_type(), 0));
+  LlvmCodeGen::NamedVariable null_var("is_null_ptr", codegen->boolean_type());
+  Value* is_null_ptr = codegen->CreateEntryBlockAlloca(fn, null_var);
+  Value* hash_combine_value = codegen->GetIntConstant(TYPE_INT, 0x9e3779b9);
+
+  Value* hash_result = codegen->GetIntConstant(TYPE_INT, 0);
+  for (int i = 0; i < partition_exprs_.size(); ++i) {
+    Expr* expr = partition_exprs_[i];
+    BasicBlock* null_block = BasicBlock::Create(context, "null", fn);
+    BasicBlock* not_null_block = BasicBlock::Create(context, "not_null", fn);
+    BasicBlock* continue_block = BasicBlock::Create(context, "continue", fn);
+
+    Value* expr_args[] = { row, codegen->null_ptr_value(), is_null_ptr };
+    Value* value = expr->CodegenGetValue(codegen, builder.GetInsertBlock(), expr_args,
+        null_block, not_null_block);
+
+    builder.SetInsertPoint(null_block);
+    Value* null_result =
+        CodegenHashCombine(codegen, &builder, hash_result, hash_combine_value);
+    builder.CreateBr(continue_block);
+
+    builder.SetInsertPoint(not_null_block);
+    Value* not_null_result;
+    switch (expr->type()) {
+      case TYPE_BOOLEAN: {
+        Value* bool_value = builder.CreateZExt(value, codegen->GetType(TYPE_INT));
+        not_null_result = CodegenHashCombine(codegen, &builder, hash_result,
+            builder.CreateAdd(bool_value, hash_combine_value));
+        break;
+      }
+      case TYPE_STRING: {
+        Value* ptr = builder.CreateLoad(builder.CreateStructGEP(value, 0, "ptr"));
+        Value* len = builder.CreateLoad(builder.CreateStructGEP(value, 1, "len"));
+        not_null_result =
+            builder.CreateCall3(codegen->GetHashFunction(), ptr, len, hash_result);
+        break;
+      }
+      default: {
+        int byte_size = GetByteSize(expr->type());
+        LlvmCodeGen::NamedVariable value_var("value", expr->GetLlvmReturnType(codegen));
+        Value* value_ptr = codegen->CreateEntryBlockAlloca(fn, value_var);
+        builder.CreateStore(value, value_ptr);
+        Value* data = builder.CreateBitCast(value_ptr, codegen->ptr_type());
+        not_null_result = builder.CreateCall3(codegen->GetHashFunction(byte_size),
+            data, codegen->GetIntConstant(TYPE_INT, byte_size), hash_result);
+      }
+    }
+    builder.CreateBr(continue_block);
+
+    builder.SetInsertPoint(continue_block);
+    PHINode* phi_node = builder.CreatePHI(codegen->GetType(TYPE_INT), 2);
+    phi_node->addIncoming(null_result, null_block);
+    phi_node->addIncoming(not_null_result, not_null_block);
+    hash_result = phi_node;
+  }
+
+  builder.CreateRet(hash_result);
+  return codegen->FinalizeFunction(fn);
+}
+
+Function* DataStreamSender::CodegenComputeChannelIdxs(LlvmCodeGen* codegen) {
+  SCOPED_TIMER(codegen->codegen_timer());
+  Function* hash_row_fn = CodegenHashRow(codegen);
+  if (hash_row_fn == NULL) return NULL;
+
+  // Get cross compiled function
+  Function* compute_channel_idxs_fn =
+      codegen->GetFunction(IRFunction::DATA_STREAM_SENDER_COMPUTE_CHANNEL_IDXS);
+  DCHECK(compute_channel_idxs_fn != NULL);
+
+  int replaced = 0;
+  compute_channel_idxs_fn = codegen->ReplaceCallSites(compute_channel_idxs_fn, false,
+      hash_row_fn, "HashRow", &replaced);
+  DCHECK_EQ(replaced, 1);
+  return codegen->OptimizeFunctionWithExprs(compute_channel_idxs_fn);
+}
+
 Status DataStreamSender::Close(RuntimeState* state) {
+  ReportSkew();
   // TODO: only close channels that didn't have any errors
   for (int i = 0; i < channels_.size(); ++i) {
     RETURN_IF_ERROR(channels_[i]->Close());
   }
+  StopSendThreads();
   return Status::OK;
 }
 
+bool DataStreamSender::NeedsMoreRows() {
+  for (int i = 0; i < channels_.size(); ++i) {
+    if (!channels_[i]->recvr_closed()) return true;
+  }
+  return false;
+}
+
+bool DataStreamSender::IsCancelled() const {
+  return state_ != NULL && state_->is_cancelled();
+}
+
 int64_t DataStreamSender::GetNumDataBytesSent() const {
   // TODO: do we need synchronization here or are reads & writes to 8-byte ints
   // atomic?
@@ -16,74 +16,214 @@
 #ifndef IMPALA_RUNTIME_DATA_STREAM_SENDER_H
 #define IMPALA_RUNTIME_DATA_STREAM_SENDER_H
 
+#include <deque>
 #include <vector>
 #include <string>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 
 #include "exec/data-sink.h"
 #include "common/object-pool.h"
 #include "common/status.h"
+#include "util/runtime-profile.h"
 #include "gen-cpp/Data_types.h"  // for TRowBatch
+#include "gen-cpp/Exprs_types.h"
+#include "gen-cpp/Types_types.h"  // for TUniqueId
+
+namespace llvm {
+  class Function;
+}
 
 namespace impala {
 
 class Expr;
+class Histogram;
+class LlvmCodeGen;
 class RowBatch;
 class RowDescriptor;
 class TDataStreamSink;
 class THostPort;
 class TPlanFragmentDestination;
+class TupleRow;
 
 // Single sender of an m:n data stream.
 // Row batch data is routed to destinations based on the provided
 // partitioning specification.
+// Outgoing batches are queued per destination channel and serialized (for
+// hash-partitioned output) and transmitted by a small pool of send threads,
+// so that this work overlaps with the production of the next batches.
 // *Not* thread-safe.
 class DataStreamSender : public DataSink {
  public:
   // Construct a sender according to the output specification (sink),
   // sending to the given destinations.
+  // fragment_instance_id is the id of the sending fragment instance; receivers use
+  // it to tell the senders of a stream apart.
   // Per_channel_buffer_size is the buffer size allocated to each channel
   // and is specified in bytes.
-  // NOTE: This can only do broadcasting right now
-  // (sink.output_partition.type == UNPARTITIONED)
+  // The output partition type must be UNPARTITIONED (the stream is broadcast to
+  // all destinations) or HASH_PARTITIONED (each row is sent to exactly one
+  // destination, determined by the hash of its partitioning exprs).
   DataStreamSender(
-    const RowDescriptor& row_desc, const TDataStreamSink& sink,
+    const RowDescriptor& row_desc, const TUniqueId& fragment_instance_id,
+    const TDataStreamSink& sink,
     const std::vector<TPlanFragmentDestination>& destinations,
     int per_channel_buffer_size);
   virtual ~DataStreamSender();
 
   // Setup. Call before Send() or Close().
+  // Creates and prepares the partitioning exprs for hash-partitioned output.
   virtual Status Init(RuntimeState* state);
 
   // Send data in 'batch' to destination nodes according to partitioning
   // specification provided in c'tor.
   // Blocks until all rows in batch are placed in their appropriate outgoing
-  // buffers (ie, blocks if there are still in-flight rpcs from the last
-  // Send() call).
+  // buffers (ie, blocks if a channel already has --data_stream_sender_window
+  // batches queued or in flight).
   // TODO: do we need reuse_batch?
   virtual Status Send(RuntimeState* state, RowBatch* batch);
 
+  // Same as Send() for a batch that is already serialized, e.g. one that a relaying
+  // receiver got (see DataStreamRecvr::SetRelay()).  Only for broadcasting senders.
+  Status SendSerialized(const TRowBatch& batch);
+
   // Flush all buffered data and close all existing channels to destination
   // hosts. Further Send() calls are illegal after calling Close().
   virtual Status Close(RuntimeState* state);
 
+  // Returns false once all receivers have closed their streams (see
+  // DataStreamRecvr::Close()).  Rows for closed receivers are dropped.
+  virtual bool NeedsMoreRows();
+
   // Return total number of bytes sent in TRowBatch.data. If batches are
   // broadcast to multiple receivers, they are counted once per receiver.
   int64_t GetNumDataBytesSent() const;
 
+  // For C++/IR interop, we need to be able to look up types by name.
+  static const char* LLVM_CLASS_NAME;
+
  private:
   class Channel;
 
+  // Returns the hash of the values of partition_exprs_ over 'row', from which its
+  // channel is picked.
+  uint32_t HashRow(TupleRow* row);
+
+  // Sets channel_idxs[i] to the index of the channel that the i-th row of 'batch' is
+  // routed to, based on HashRow().  Cross compiled to IR, where the HashRow() calls
+  // are replaced with a codegen'd version (see CodegenComputeChannelIdxs()).
+  void ComputeChannelIdxs(RowBatch* batch, int* channel_idxs);
+
+  // Same as ComputeChannelIdxs() for spread_null_keys_: rows with a NULL partitioning
+  // value are assigned to the channels round-robin.  Not codegen'd.
+  void ComputeChannelIdxsSpreadingNulls(RowBatch* batch, int* channel_idxs);
+
+  // Skew detection for hash-partitioned output.  Counts the rows of 'batch' per
+  // channel and feeds every SAMPLE_INTERVAL-th row into the heavy hitter sample.
+  void SampleRows(RowBatch* batch);
+
+  // Adds the rows per channel and the partitioning keys that were frequent in the
+  // sample to the profile; called in Close().
+  void ReportSkew();
+
+  // Heavy hitter sample: the NUM_HEAVY_HITTERS most frequent partitioning keys among
+  // the sampled rows, according to the space-saving algorithm (a key that is not
+  // in the sample replaces the least frequent one, and inherits its count, which is
+  // then an upper bound of the key's count).
+  struct HeavyHitter {
+    uint32_t hash;  // HashRow() of the key
+    int64_t count;
+    std::string key;  // printed partitioning values, for the profile
+  };
+  static const int NUM_HEAVY_HITTERS = 16;
+  static const int SAMPLE_INTERVAL = 64;
+
+  // Codegen for HashRow(), for the types of partition_exprs_.  Returns NULL if the
+  // exprs can't be codegen'd.
+  llvm::Function* CodegenHashRow(LlvmCodeGen* codegen);
+
+  // Codegen for ComputeChannelIdxs(), with the codegen'd HashRow().  Returns NULL if
+  // HashRow() can't be codegen'd.
+  llvm::Function* CodegenComputeChannelIdxs(LlvmCodeGen* codegen);
+
+  // Send thread body: repeatedly picks a channel from ready_channels_ and sends its
+  // next batch, until StopSendThreads() is called.
+  void SendThread();
+
+  // Stops and joins the send threads; batches they haven't picked up yet are dropped.
+  void StopSendThreads();
+
+  // Returns true if the fragment got cancelled.  Threads that wait for the send
+  // threads check this every CANCEL_CHECK_INTERVAL_MS.
+  bool IsCancelled() const;
+  static const int CANCEL_CHECK_INTERVAL_MS = 50;
+
+  RuntimeState* state_;  // set in Init()
+
+  const RowDescriptor& row_desc_;
+  TUniqueId fragment_instance_id_;  // of the sending fragment instance
   bool broadcast_;  // if true, send all rows on all channels
 
-  // serialized batches for broadcasting; we need two so we can write
-  // one while the other one is still being sent
-  TRowBatch thrift_batch1_;
-  TRowBatch thrift_batch2_;
-  TRowBatch* current_thrift_batch_;  // the next one to fill in Send()
+  // Protects the state below as well as the channels' queues of pending batches.
+  boost::mutex lock_;
+
+  // Channels with batches to send that no send thread is working on, in the order
+  // in which they became ready.
+  std::deque<Channel*> ready_channels_;
+
+  // signalled when a channel is added to ready_channels_ or the threads are stopped
+  boost::condition_variable channel_ready_cv_;
+
+  // signalled when a channel's send thread has finished with one of its batches
+  boost::condition_variable batch_sent_cv_;
+
+  bool stop_send_threads_;
+
+  // distribution of the times of TransmitData rpcs; set in Init()
+  Histogram* transmit_data_rpc_time_;
+
+  // time the fragment thread spent waiting for a channel's send window, for the
+  // last batches to be sent and for the local receivers to make room; set in Init()
+  RuntimeProfile::Counter* send_wait_timer_;
+
+  // time spent serializing batches, by the fragment thread for broadcast batches and
+  // by the send threads otherwise; set in Init()
+  RuntimeProfile::Counter* serialize_batch_timer_;
+
+  // cpu time and context switches of the send threads while sending; set in Init()
+  RuntimeProfile::ThreadCounters* send_thread_counters_;
+
+  boost::thread_group send_threads_;
 
   ObjectPool pool_;  // TODO: reuse RuntimeState's pool
-  Expr* partition_expr_;  // computes per-row partitioning value
+
+  // compute per-row partitioning values; only set for hash-partitioned output
+  std::vector<TExpr> partition_texprs_;
+  std::vector<Expr*> partition_exprs_;
   std::vector<Channel*> channels_;
+
+  // Jitted ComputeChannelIdxs(), NULL if it wasn't codegen'd; set when the module is
+  // compiled, after Init().
+  typedef void (*ComputeChannelIdxsFn)(DataStreamSender*, RowBatch*, int*);
+  ComputeChannelIdxsFn compute_channel_idxs_fn_;
+
+  // channel index of each row of the batch that is being routed in Send()
+  std::vector<int> channel_idxs_;
+
+  // if true, rows with a NULL partitioning value are spread across the channels (see
+  // TDataStreamSink.spread_null_keys); next_null_channel_ is the next one they go to
+  bool spread_null_keys_;
+  int next_null_channel_;
+
+  // number of rows routed to each channel, for hash-partitioned output
+  std::vector<int64_t> channel_num_rows_;
+
+  std::vector<HeavyHitter> heavy_hitters_;
+  int64_t num_sampled_rows_;
+
+  // number of rows until the next sampled one
+  int rows_until_sample_;
 };
 
 }
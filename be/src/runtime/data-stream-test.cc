@@ -25,7 +25,9 @@
 #include "runtime/data-stream-mgr.h"
 #include "runtime/data-stream-sender.h"
 #include "runtime/data-stream-recvr.h"
+#include "runtime/data-stream-transport.h"
 #include "runtime/descriptors.h"
+#include "runtime/runtime-state.h"
 #include "testutil/test-exec-env.h"
 #include "util/authorization.h"
 #include "util/cpu-info.h"
@@ -46,6 +48,7 @@ using namespace apache::thrift;
 using namespace apache::thrift::protocol;
 
 DECLARE_int32(port);
+DECLARE_int32(data_stream_port_offset);
 DEFINE_string(principal, "", "Kerberos principal");
 DEFINE_string(keytab_file, "", "Kerberos keytab");
 
@@ -68,11 +71,14 @@ class ImpalaTestBackend : public ImpalaInternalServiceIf {
   virtual void TransmitData(
       TTransmitDataResult& return_val, const TTransmitDataParams& params) {
     if (!params.eos) {
+      bool recvr_closed;
       mgr_->AddData(params.dest_fragment_instance_id, params.dest_node_id,
-                    params.row_batch).SetTStatus(&return_val);
-    } else {
-      mgr_->CloseSender(params.dest_fragment_instance_id, params.dest_node_id)
+                    params.src_fragment_instance_id, params.row_batch, &recvr_closed)
           .SetTStatus(&return_val);
+      if (recvr_closed) return_val.__set_recvr_closed(true);
+    } else {
+      mgr_->CloseSender(params.dest_fragment_instance_id, params.dest_node_id,
+                        params.src_fragment_instance_id).SetTStatus(&return_val);
     }
   }
 
@@ -109,6 +115,7 @@ class DataStreamTest : public testing::Test {
   static const int NUM_BATCHES = TOTAL_DATA_SIZE / BATCH_CAPACITY / PER_ROW_DATA;
 
   ObjectPool obj_pool_;
+  RuntimeState runtime_state_;
   DescriptorTbl* desc_tbl_;
   const RowDescriptor* row_desc_;
   TUniqueId next_instance_id_;
@@ -131,8 +138,9 @@ class DataStreamTest : public testing::Test {
     thread* thread_handle;
     Status status;
     int num_bytes_sent;
+    bool recvrs_closed;  // the sender didn't need to send all of its rows
 
-    SenderInfo(): thread_handle(NULL), num_bytes_sent(0) {}
+    SenderInfo(): thread_handle(NULL), num_bytes_sent(0), recvrs_closed(false) {}
   };
   vector<SenderInfo> sender_info_;
 
@@ -141,6 +149,7 @@ class DataStreamTest : public testing::Test {
     DataStreamRecvr* stream_recvr;
     Status status;
     int num_rows_received;
+    multiset<int64_t> data_values;
 
     ReceiverInfo(): thread_handle(NULL), num_rows_received(0) {}
   };
@@ -185,6 +194,22 @@ class DataStreamTest : public testing::Test {
     vector<bool> nullable_tuples;
     nullable_tuples.push_back(false);
     row_desc_ = obj_pool_.Add(new RowDescriptor(*desc_tbl_, row_tids, nullable_tuples));
+    runtime_state_.set_desc_tbl(desc_tbl_);
+  }
+
+  // Set up sink_ to hash-partition its output on the single bigint slot.
+  void SetHashPartitionedSink() {
+    TExprNode slot_ref;
+    slot_ref.node_type = TExprNodeType::SLOT_REF;
+    slot_ref.type = TPrimitiveType::BIGINT;
+    slot_ref.num_children = 0;
+    slot_ref.__isset.slot_ref = true;
+    slot_ref.slot_ref.slot_id = 0;
+    TExpr expr;
+    expr.nodes.push_back(slot_ref);
+    sink_.output_partition.type = TPartitionType::HASH_PARTITIONED;
+    sink_.output_partition.__isset.partitioning_exprs = true;
+    sink_.output_partition.partitioning_exprs.push_back(expr);
   }
 
   // Create batch_, but don't fill it with data yet. Assumes we created row_desc_.
@@ -211,16 +236,25 @@ class DataStreamTest : public testing::Test {
   }
 
   // Start receiver (expecting given number of senders) in separate thread.
-  void StartReceiver(int num_senders, int buffer_size, TUniqueId* out_id = NULL) {
+  // A merging receiver reads its senders' streams one after the other.
+  void StartReceiver(int num_senders, int buffer_size, TUniqueId* out_id = NULL,
+                     bool is_merging = false,
+                     const TUniqueId* shared_stream_id = NULL) {
     TUniqueId instance_id;
     GetNextInstanceId(&instance_id);
     receiver_info_.push_back(ReceiverInfo());
     ReceiverInfo& info = receiver_info_.back();
     info.stream_recvr =
         stream_mgr_->CreateRecvr(
-            *row_desc_, instance_id, DEST_NODE_ID, num_senders, buffer_size);
-    info.thread_handle =
-        new thread(&DataStreamTest::ReadStream, this, num_senders, &info);
+            *row_desc_, instance_id, DEST_NODE_ID, num_senders, buffer_size,
+            is_merging, shared_stream_id);
+    if (is_merging) {
+      info.thread_handle =
+          new thread(&DataStreamTest::ReadMergingStream, this, num_senders, &info);
+    } else {
+      info.thread_handle =
+          new thread(&DataStreamTest::ReadStream, this, num_senders, &info);
+    }
     if (out_id != NULL) *out_id = instance_id;
   }
 
@@ -235,7 +269,7 @@ class DataStreamTest : public testing::Test {
     RowBatch* batch;
     VLOG_QUERY <<  "start reading";
     bool is_cancelled;
-    multiset<int64_t> data_values;
+    multiset<int64_t>& data_values = info->data_values;
     while ((batch = info->stream_recvr->GetBatch(&is_cancelled)) != NULL
         && !is_cancelled) {
       VLOG_QUERY << "read batch #rows=" << (batch != NULL ? batch->num_rows() : 0);
@@ -249,7 +283,11 @@ class DataStreamTest : public testing::Test {
     if (is_cancelled) VLOG_QUERY << "reader is cancelled";
     info->status = (is_cancelled ? Status::CANCELLED : Status::OK);
 
-    if (!is_cancelled) {
+    // with hash-partitioned output, each receiver only sees a subset of the values;
+    // the test itself checks the union of all receivers' values
+    bool is_partitioned =
+        sink_.output_partition.type == TPartitionType::HASH_PARTITIONED;
+    if (!is_cancelled && !is_partitioned) {
       // check contents of batches
       int64_t expected_val;
       EXPECT_EQ(data_values.size(), NUM_BATCHES * BATCH_CAPACITY * num_senders);
@@ -264,6 +302,27 @@ class DataStreamTest : public testing::Test {
     VLOG_QUERY << "done reading";
   }
 
+  // Deplete each sender's stream in turn and check that it arrives in order.
+  void ReadMergingStream(int num_senders, ReceiverInfo* info) {
+    bool is_cancelled = false;
+    for (int i = 0; i < num_senders && !is_cancelled; ++i) {
+      int64_t expected_val = 0;
+      RowBatch* batch;
+      while ((batch = info->stream_recvr->GetBatch(i, &is_cancelled)) != NULL) {
+        info->num_rows_received += batch->num_rows();
+        for (int j = 0; j < batch->num_rows(); ++j) {
+          TupleRow* row = batch->GetRow(j);
+          int64_t val = *static_cast<int64_t*>(row->GetTuple(0)->GetSlot(0));
+          EXPECT_EQ(expected_val++, val);
+          info->data_values.insert(val);
+        }
+        delete batch;
+      }
+      if (!is_cancelled) EXPECT_EQ(expected_val, NUM_BATCHES * BATCH_CAPACITY);
+    }
+    info->status = (is_cancelled ? Status::CANCELLED : Status::OK);
+  }
+
 
   // Start backend in separate thread.
   void StartBackend() {
@@ -278,6 +337,41 @@ class DataStreamTest : public testing::Test {
     delete server_;
   }
 
+  // Sends the rows of two senders to three receivers and checks that each value ends
+  // up at exactly one receiver.
+  void SendHashPartitioned() {
+    StartReceiver(2, 1024);
+    StartReceiver(2, 1024);
+    StartReceiver(2, 1024);
+    StartSender();
+    StartSender();
+    JoinSenders();
+    EXPECT_TRUE(sender_info_[0].status.ok());
+    EXPECT_GT(sender_info_[0].num_bytes_sent, 0);
+    EXPECT_TRUE(sender_info_[1].status.ok());
+    EXPECT_GT(sender_info_[1].num_bytes_sent, 0);
+    JoinReceivers();
+
+    // each value is sent by both senders and needs to end up at exactly one receiver,
+    // and every receiver should get some of the rows
+    multiset<int64_t> all_values;
+    for (int i = 0; i < receiver_info_.size(); ++i) {
+      EXPECT_TRUE(receiver_info_[i].status.ok());
+      EXPECT_GT(receiver_info_[i].num_rows_received, 0);
+      const multiset<int64_t>& values = receiver_info_[i].data_values;
+      for (multiset<int64_t>::const_iterator it = values.begin(); it != values.end();
+           it = values.upper_bound(*it)) {
+        EXPECT_EQ(values.count(*it), 2);
+        for (int j = 0; j < receiver_info_.size(); ++j) {
+          if (j == i) continue;
+          EXPECT_EQ(receiver_info_[j].data_values.count(*it), 0);
+        }
+      }
+      all_values.insert(values.begin(), values.end());
+    }
+    EXPECT_EQ(all_values.size(), 2 * NUM_BATCHES * BATCH_CAPACITY);
+  }
+
   void StartSender(int channel_buffer_size = 1024) {
     int num_senders = sender_info_.size();
     DCHECK_LT(num_senders, MAX_SENDERS);
@@ -295,9 +389,12 @@ class DataStreamTest : public testing::Test {
 
   void Sender(int sender_num, int channel_buffer_size) {
     VLOG_QUERY << "create sender " << sender_num;
+    TUniqueId sender_id;
+    sender_id.hi = 0;
+    sender_id.lo = sender_num;
     DataStreamSender sender(
-        *row_desc_, sink_, dest_, channel_buffer_size);
-    EXPECT_TRUE(sender.Init(NULL).ok());
+        *row_desc_, sender_id, sink_, dest_, channel_buffer_size);
+    EXPECT_TRUE(sender.Init(&runtime_state_).ok());
     scoped_ptr<RowBatch> batch(CreateRowBatch());
     SenderInfo& info = sender_info_[sender_num];
     int next_val = 0;
@@ -310,6 +407,7 @@ class DataStreamTest : public testing::Test {
     VLOG_QUERY << "closing sender" << sender_num;
     info.status = sender.Close(NULL);
     info.num_bytes_sent = sender.GetNumDataBytesSent();
+    info.recvrs_closed = !sender.NeedsMoreRows();
   }
 };
 
@@ -388,10 +486,33 @@ TEST_F(DataStreamTest, MultipleSendersSmallBuffer) {
   JoinReceivers();
   EXPECT_TRUE(receiver_info_[0].status.ok());
   EXPECT_EQ(receiver_info_[0].num_rows_received, 4 * NUM_BATCHES * BATCH_CAPACITY);
+  // the slow receiver makes the senders block, and the buffer limit holds
+  DataStreamRecvr* recvr = receiver_info_[0].stream_recvr;
+  EXPECT_GT(recvr->num_blocked_adds(), 0);
+  EXPECT_LE(recvr->peak_buffered_bytes(), 4 * 1024);
+  EXPECT_GT(recvr->num_bytes_received(), 4 * 1024);
   VLOG_QUERY << "stop backend\n";
   StopBackend();
 }
 
+TEST_F(DataStreamTest, MergingMultipleSendersSmallBuffer) {
+  // the receiver drains one sender at a time, so the buffer fills up with other
+  // senders' batches while it waits for the current sender's next batch
+  StartReceiver(4, 2 * 1024, NULL, true);
+  StartSender();
+  StartSender();
+  StartSender();
+  StartSender();
+  JoinSenders();
+  for (int i = 0; i < sender_info_.size(); ++i) {
+    EXPECT_TRUE(sender_info_[i].status.ok());
+  }
+  JoinReceivers();
+  EXPECT_TRUE(receiver_info_[0].status.ok());
+  EXPECT_EQ(receiver_info_[0].num_rows_received, 4 * NUM_BATCHES * BATCH_CAPACITY);
+  StopBackend();
+}
+
 TEST_F(DataStreamTest, MultipleSendersLargeBuffer) {
   VLOG_QUERY << "start receiver\n";
   StartReceiver(4, 4 * 1024 * 1024);
@@ -451,9 +572,135 @@ TEST_F(DataStreamTest, Cancel) {
   StopBackend();
 }
 
+TEST_F(DataStreamTest, CloseReceiver) {
+  // a receiver that doesn't need any more rows lets its senders finish without
+  // sending everything, and without an error
+  TUniqueId instance_id;
+  GetNextInstanceId(&instance_id);
+  scoped_ptr<DataStreamRecvr> recvr(stream_mgr_->CreateRecvr(
+      *row_desc_, instance_id, DEST_NODE_ID, 2, 1024));
+  recvr->Close();
+  StartSender();
+  JoinSenders();
+  EXPECT_TRUE(sender_info_[0].status.ok());
+  EXPECT_TRUE(sender_info_[0].recvrs_closed);
+  EXPECT_EQ(sender_info_[0].num_bytes_sent, 0);
+  bool is_cancelled;
+  EXPECT_TRUE(recvr->GetBatch(&is_cancelled) == NULL);
+  EXPECT_FALSE(is_cancelled);
+
+  // senders that show up after the receiver is gone are told the same
+  recvr.reset();
+  StartSender();
+  JoinSenders();
+  EXPECT_TRUE(sender_info_[1].status.ok());
+  EXPECT_TRUE(sender_info_[1].recvrs_closed);
+  StopBackend();
+}
+
+TEST_F(DataStreamTest, HashPartitionedMultipleReceivers) {
+  SetHashPartitionedSink();
+  SendHashPartitioned();
+  StopBackend();
+}
+
+// Without NULLs, the rows are partitioned the same way when NULLs would be spread.
+TEST_F(DataStreamTest, HashPartitionedSpreadingNulls) {
+  SetHashPartitionedSink();
+  sink_.__set_spread_null_keys(true);
+  SendHashPartitioned();
+  StopBackend();
+}
+
+// Receivers that share a broadcast stream each get all of the rows, although the
+// senders only send them to the first receiver.
+TEST_F(DataStreamTest, SharedBroadcastStream) {
+  TUniqueId stream_id = next_instance_id_;
+  for (int i = 0; i < 3; ++i) {
+    StartReceiver(2, 1024, NULL, false, &stream_id);
+  }
+  dest_.resize(1);
+  StartSender();
+  StartSender();
+  JoinSenders();
+  EXPECT_TRUE(sender_info_[0].status.ok());
+  EXPECT_TRUE(sender_info_[1].status.ok());
+  EXPECT_GT(sender_info_[0].num_bytes_sent, 0);
+  JoinReceivers();
+  for (int i = 0; i < receiver_info_.size(); ++i) {
+    EXPECT_TRUE(receiver_info_[i].status.ok());
+    EXPECT_EQ(receiver_info_[i].num_rows_received, 2 * NUM_BATCHES * BATCH_CAPACITY);
+  }
+  StopBackend();
+}
+
+// A receiver with a relay forwards the stream, so that the relay's receivers get all
+// of it although the sender only sends it to the first receiver.
+TEST_F(DataStreamTest, RelayedBroadcast) {
+  TUniqueId relay_id;
+  StartReceiver(1, 1024, &relay_id);
+  StartReceiver(1, 1024);
+  StartReceiver(1, 1024);
+  vector<TPlanFragmentDestination> relay_dests(dest_.begin() + 1, dest_.end());
+  dest_.resize(1);
+  DataStreamSender relay(*row_desc_, relay_id, sink_, relay_dests, 1024);
+  ASSERT_TRUE(relay.Init(&runtime_state_).ok());
+  receiver_info_[0].stream_recvr->SetRelay(&relay);
+  StartSender();
+  JoinSenders();
+  EXPECT_TRUE(sender_info_[0].status.ok());
+  EXPECT_TRUE(receiver_info_[0].stream_recvr->WaitForRelay().ok());
+  JoinReceivers();
+  for (int i = 0; i < receiver_info_.size(); ++i) {
+    EXPECT_TRUE(receiver_info_[i].status.ok());
+    EXPECT_EQ(receiver_info_[i].num_rows_received, NUM_BATCHES * BATCH_CAPACITY);
+  }
+  EXPECT_EQ(relay.GetNumDataBytesSent(), 2 * sender_info_[0].num_bytes_sent);
+  receiver_info_[0].stream_recvr->SetRelay(NULL);
+  StopBackend();
+}
+
+// Batches and eos go over the data stream port instead of as rpcs.
+TEST_F(DataStreamTest, DataStreamTransport) {
+  FLAGS_data_stream_port_offset = 1;
+  DataStreamServer server(stream_mgr_, FLAGS_port + FLAGS_data_stream_port_offset);
+  ASSERT_TRUE(server.Start().ok());
+  SetHashPartitionedSink();
+  StartReceiver(2, 1024);
+  StartReceiver(2, 1024);
+  StartSender();
+  StartSender();
+  JoinSenders();
+  for (int i = 0; i < sender_info_.size(); ++i) {
+    EXPECT_TRUE(sender_info_[i].status.ok());
+    EXPECT_GT(sender_info_[i].num_bytes_sent, 0);
+  }
+  JoinReceivers();
+  int num_rows_received = 0;
+  for (int i = 0; i < receiver_info_.size(); ++i) {
+    EXPECT_TRUE(receiver_info_[i].status.ok());
+    num_rows_received += receiver_info_[i].num_rows_received;
+  }
+  EXPECT_EQ(num_rows_received, 2 * NUM_BATCHES * BATCH_CAPACITY);
+
+  // closed receivers are reported like with rpcs
+  TUniqueId instance_id;
+  dest_.clear();
+  GetNextInstanceId(&instance_id);
+  scoped_ptr<DataStreamRecvr> recvr(stream_mgr_->CreateRecvr(
+      *row_desc_, instance_id, DEST_NODE_ID, 1, 1024));
+  recvr->Close();
+  sender_info_.clear();
+  StartSender();
+  JoinSenders();
+  EXPECT_TRUE(sender_info_[0].status.ok());
+  EXPECT_TRUE(sender_info_[0].recvrs_closed);
+  FLAGS_data_stream_port_offset = 0;
+  StopBackend();
+}
+
 // TODO: more tests:
 // - TEST_F(DataStreamTest, SingleSenderMultipleReceivers)
-// - TEST_F(DataStreamTest, MultipleSendersMultipleReceivers)
 // - test case for transmission error in last batch
 // - receivers getting created concurrently
 
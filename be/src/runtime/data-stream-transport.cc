@@ -0,0 +1,375 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/data-stream-transport.h"
+
+#include <errno.h>
+#include <limits.h>
+#include <netdb.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sstream>
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+#include "runtime/data-stream-mgr.h"
+#include "runtime/mem-pool.h"
+#include "gen-cpp/Data_types.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+const uint32_t DataStreamFrame::MAGIC;
+
+// Reads exactly 'len' bytes from 'fd'.  Returns false if the connection was closed
+// (errno is 0 then) or failed first.
+static bool ReadFully(int fd, void* buf, size_t len) {
+  char* pos = reinterpret_cast<char*>(buf);
+  while (len > 0) {
+    ssize_t num_read = recv(fd, pos, len, 0);
+    if (num_read < 0 && errno == EINTR) continue;
+    if (num_read == 0) errno = 0;
+    if (num_read <= 0) return false;
+    pos += num_read;
+    len -= num_read;
+  }
+  return true;
+}
+
+// Writes all buffers of 'iov' to 'fd', at most IOV_MAX per call; 'iov' is consumed
+// in the process.  Returns false if the connection failed.
+static bool WriteFully(int fd, vector<iovec>* iov) {
+  int idx = 0;
+  while (idx < iov->size()) {
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &(*iov)[idx];
+    msg.msg_iovlen = min<int>(iov->size() - idx, IOV_MAX);
+    // a closed connection is reported as an error rather than with SIGPIPE
+    ssize_t num_written = sendmsg(fd, &msg, MSG_NOSIGNAL);
+    if (num_written < 0 && errno == EINTR) continue;
+    if (num_written < 0) return false;
+    // skip the buffers that were written completely and the written part of the next
+    while (idx < iov->size() && num_written >= (*iov)[idx].iov_len) {
+      num_written -= (*iov)[idx].iov_len;
+      ++idx;
+    }
+    if (num_written > 0) {
+      iovec* partial = &(*iov)[idx];
+      partial->iov_base = reinterpret_cast<char*>(partial->iov_base) + num_written;
+      partial->iov_len -= num_written;
+    }
+  }
+  return true;
+}
+
+static void AddBuffer(const void* data, size_t len, vector<iovec>* iov) {
+  if (len == 0) return;
+  iovec buffer;
+  buffer.iov_base = const_cast<void*>(data);
+  buffer.iov_len = len;
+  iov->push_back(buffer);
+}
+
+// Batches are small and acked one by one; don't let Nagle delay them.
+static void SetNoDelay(int fd) {
+  int one = 1;
+  if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) != 0) {
+    VLOG_RPC << "setsockopt(TCP_NODELAY) failed: " << strerror(errno);
+  }
+}
+
+DataStreamServer::DataStreamServer(DataStreamMgr* stream_mgr, int port)
+  : stream_mgr_(stream_mgr),
+    port_(port),
+    listen_fd_(-1),
+    shutdown_(false) {
+}
+
+DataStreamServer::~DataStreamServer() {
+  if (listen_fd_ == -1) return;
+  {
+    lock_guard<mutex> l(lock_);
+    shutdown_ = true;
+    // unblocks accept() and the connection threads' reads
+    shutdown(listen_fd_, SHUT_RDWR);
+    for (set<int>::iterator it = conn_fds_.begin(); it != conn_fds_.end(); ++it) {
+      shutdown(*it, SHUT_RDWR);
+    }
+  }
+  accept_thread_->join();
+  close(listen_fd_);
+  unique_lock<mutex> l(lock_);
+  while (!conn_fds_.empty()) conn_closed_cv_.wait(l);
+}
+
+Status DataStreamServer::Start() {
+  DCHECK_EQ(listen_fd_, -1);
+  int fd = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd < 0) {
+    stringstream ss;
+    ss << "Could not create data stream server socket: " << strerror(errno);
+    return Status(ss.str());
+  }
+  int one = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+  sockaddr_in addr;
+  memset(&addr, 0, sizeof(addr));
+  addr.sin_family = AF_INET;
+  addr.sin_addr.s_addr = htonl(INADDR_ANY);
+  addr.sin_port = htons(port_);
+  if (::bind(fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0
+      || listen(fd, SOMAXCONN) != 0) {
+    stringstream ss;
+    ss << "Could not listen on data stream port " << port_ << ": " << strerror(errno);
+    close(fd);
+    return Status(ss.str());
+  }
+  listen_fd_ = fd;
+  accept_thread_.reset(new thread(&DataStreamServer::AcceptLoop, this));
+  LOG(INFO) << "DataStreamServer listening on " << port_;
+  return Status::OK;
+}
+
+void DataStreamServer::AcceptLoop() {
+  while (true) {
+    int fd = accept(listen_fd_, NULL, NULL);
+    lock_guard<mutex> l(lock_);
+    if (shutdown_) {
+      if (fd >= 0) close(fd);
+      return;
+    }
+    if (fd < 0) {
+      if (errno != EINTR) LOG(WARNING) << "DataStreamServer: accept() failed: "
+                                       << strerror(errno);
+      continue;
+    }
+    SetNoDelay(fd);
+    conn_fds_.insert(fd);
+    // the thread removes itself from conn_fds_ when it is done
+    thread conn_thread(&DataStreamServer::ServeConnection, this, fd);
+    conn_thread.detach();
+  }
+}
+
+void DataStreamServer::ServeConnection(int fd) {
+  DataStreamFrame::FrameHeader header;
+  while (ReadFully(fd, &header, sizeof(header))) {
+    if (header.magic != DataStreamFrame::MAGIC) {
+      LOG(ERROR) << "DataStreamServer: invalid frame, closing connection";
+      break;
+    }
+    if (!ServeFrame(fd, header)) break;
+  }
+  lock_guard<mutex> l(lock_);
+  conn_fds_.erase(fd);
+  close(fd);
+  conn_closed_cv_.notify_all();
+}
+
+bool DataStreamServer::ServeFrame(int fd, const DataStreamFrame::FrameHeader& header) {
+  TUniqueId fragment_id;
+  fragment_id.hi = header.dest_fragment_id_hi;
+  fragment_id.lo = header.dest_fragment_id_lo;
+  TUniqueId sender_id;
+  sender_id.hi = header.sender_id_hi;
+  sender_id.lo = header.sender_id_lo;
+
+  Status status;
+  bool recvr_closed = false;
+  if (header.type == DataStreamFrame::BATCH) {
+    if (header.num_rows < 0 || header.num_row_tuples < 0
+        || header.num_tuple_offsets < 0 || header.tuple_data_len < 0) {
+      LOG(ERROR) << "DataStreamServer: invalid batch frame, closing connection";
+      return false;
+    }
+    // read the batch straight into its TRowBatch
+    TRowBatch batch;
+    batch.num_rows = header.num_rows;
+    batch.row_tuples.resize(header.num_row_tuples);
+    batch.tuple_offsets.resize(header.num_tuple_offsets);
+    batch.tuple_data.resize(header.tuple_data_len);
+    batch.uncompressed_size = header.uncompressed_size;
+    batch.compression_type =
+        static_cast<THdfsCompression::type>(header.compression_type);
+    if (!batch.row_tuples.empty() && !ReadFully(fd, &batch.row_tuples[0],
+        batch.row_tuples.size() * sizeof(TTupleId))) {
+      return false;
+    }
+    if (!batch.tuple_offsets.empty() && !ReadFully(fd, &batch.tuple_offsets[0],
+        batch.tuple_offsets.size() * sizeof(int32_t))) {
+      return false;
+    }
+    if (!batch.tuple_data.empty() && !ReadFully(fd, &batch.tuple_data[0],
+        batch.tuple_data.size())) {
+      return false;
+    }
+    if (batch.num_rows > 0) {
+      status = stream_mgr_->AddData(
+          fragment_id, header.dest_node_id, sender_id, batch, &recvr_closed);
+    }
+  } else if (header.type == DataStreamFrame::EOS) {
+    status = stream_mgr_->CloseSender(fragment_id, header.dest_node_id, sender_id);
+  } else {
+    LOG(ERROR) << "DataStreamServer: unknown frame type " << header.type
+               << ", closing connection";
+    return false;
+  }
+
+  string error_msg;
+  if (!status.ok()) status.GetErrorMsg(&error_msg);
+  DataStreamFrame::ResponseHeader response;
+  response.magic = DataStreamFrame::MAGIC;
+  response.status_code = status.code();
+  response.recvr_closed = recvr_closed;
+  response.error_msg_len = error_msg.size();
+  vector<iovec> iov;
+  AddBuffer(&response, sizeof(response), &iov);
+  AddBuffer(error_msg.data(), error_msg.size(), &iov);
+  return WriteFully(fd, &iov);
+}
+
+DataStreamConnection::DataStreamConnection(const string& ipaddress, int port)
+  : ipaddress_(ipaddress),
+    port_(port),
+    fd_(-1) {
+}
+
+DataStreamConnection::~DataStreamConnection() {
+  if (fd_ != -1) close(fd_);
+}
+
+Status DataStreamConnection::Open() {
+  DCHECK_EQ(fd_, -1);
+  addrinfo hints;
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_INET;
+  hints.ai_socktype = SOCK_STREAM;
+  stringstream port;
+  port << port_;
+  addrinfo* addrs;
+  int result = getaddrinfo(ipaddress_.c_str(), port.str().c_str(), &hints, &addrs);
+  if (result != 0) {
+    stringstream ss;
+    ss << "Could not resolve data stream server " << ipaddress_ << ": "
+       << gai_strerror(result);
+    return Status(ss.str());
+  }
+  fd_ = socket(AF_INET, SOCK_STREAM, 0);
+  if (fd_ < 0 || connect(fd_, addrs->ai_addr, addrs->ai_addrlen) != 0) {
+    freeaddrinfo(addrs);
+    return ConnectionError("connect()");
+  }
+  freeaddrinfo(addrs);
+  SetNoDelay(fd_);
+  return Status::OK;
+}
+
+Status DataStreamConnection::SendBatch(const TUniqueId& fragment_id,
+    PlanNodeId dest_node_id, const TUniqueId& sender_id, const TRowBatch& batch,
+    MemPool* data_pool, bool* recvr_closed) {
+  DataStreamFrame::FrameHeader header;
+  memset(&header, 0, sizeof(header));
+  header.type = DataStreamFrame::BATCH;
+  header.dest_fragment_id_hi = fragment_id.hi;
+  header.dest_fragment_id_lo = fragment_id.lo;
+  header.sender_id_hi = sender_id.hi;
+  header.sender_id_lo = sender_id.lo;
+  header.dest_node_id = dest_node_id;
+  header.num_rows = batch.num_rows;
+  header.num_row_tuples = batch.row_tuples.size();
+  header.num_tuple_offsets = batch.tuple_offsets.size();
+  header.uncompressed_size = batch.uncompressed_size;
+  header.compression_type = batch.compression_type;
+
+  vector<iovec> iov;
+  AddBuffer(&header, sizeof(header), &iov);
+  if (!batch.row_tuples.empty()) {
+    AddBuffer(&batch.row_tuples[0], batch.row_tuples.size() * sizeof(TTupleId), &iov);
+  }
+  if (!batch.tuple_offsets.empty()) {
+    AddBuffer(&batch.tuple_offsets[0], batch.tuple_offsets.size() * sizeof(int32_t),
+        &iov);
+  }
+  if (!batch.tuple_data.empty() || batch.uncompressed_size == 0) {
+    header.tuple_data_len = batch.tuple_data.size();
+    AddBuffer(batch.tuple_data.data(), batch.tuple_data.size(), &iov);
+  } else {
+    DCHECK(data_pool != NULL);
+    DCHECK_EQ(batch.compression_type, THdfsCompression::NONE);
+    vector<pair<uint8_t*, int> > chunk_info;
+    data_pool->GetChunkInfo(&chunk_info);
+    for (int i = 0; i < chunk_info.size(); ++i) {
+      AddBuffer(chunk_info[i].first, chunk_info[i].second, &iov);
+      header.tuple_data_len += chunk_info[i].second;
+    }
+    DCHECK_EQ(header.tuple_data_len, batch.uncompressed_size);
+  }
+  return SendFrame(&header, &iov, recvr_closed);
+}
+
+Status DataStreamConnection::SendEos(const TUniqueId& fragment_id,
+    PlanNodeId dest_node_id, const TUniqueId& sender_id) {
+  DataStreamFrame::FrameHeader header;
+  memset(&header, 0, sizeof(header));
+  header.type = DataStreamFrame::EOS;
+  header.dest_fragment_id_hi = fragment_id.hi;
+  header.dest_fragment_id_lo = fragment_id.lo;
+  header.sender_id_hi = sender_id.hi;
+  header.sender_id_lo = sender_id.lo;
+  header.dest_node_id = dest_node_id;
+  vector<iovec> iov;
+  AddBuffer(&header, sizeof(header), &iov);
+  bool recvr_closed;
+  return SendFrame(&header, &iov, &recvr_closed);
+}
+
+Status DataStreamConnection::SendFrame(DataStreamFrame::FrameHeader* header,
+    vector<iovec>* iov, bool* recvr_closed) {
+  if (fd_ == -1) return Status("Data stream connection is closed");
+  header->magic = DataStreamFrame::MAGIC;
+  if (!WriteFully(fd_, iov)) return ConnectionError("sending a data stream frame");
+
+  DataStreamFrame::ResponseHeader response;
+  if (!ReadFully(fd_, &response, sizeof(response))) {
+    return ConnectionError("receiving a data stream response");
+  }
+  if (response.magic != DataStreamFrame::MAGIC || response.error_msg_len < 0) {
+    errno = 0;
+    return ConnectionError("receiving a data stream response (invalid response)");
+  }
+  string error_msg(response.error_msg_len, '\0');
+  if (!error_msg.empty() && !ReadFully(fd_, &error_msg[0], error_msg.size())) {
+    return ConnectionError("receiving a data stream response");
+  }
+  *recvr_closed = response.recvr_closed != 0;
+  if (response.status_code == TStatusCode::OK) return Status::OK;
+  return Status(static_cast<TStatusCode::type>(response.status_code), error_msg);
+}
+
+Status DataStreamConnection::ConnectionError(const string& what) {
+  stringstream ss;
+  ss << "Data stream connection to " << ipaddress_ << ":" << port_ << " failed in "
+     << what << (errno != 0 ? string(": ") + strerror(errno) : string());
+  if (fd_ != -1) close(fd_);
+  fd_ = -1;
+  return Status(ss.str());
+}
+
+}
@@ -0,0 +1,174 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_DATA_STREAM_TRANSPORT_H
+#define IMPALA_RUNTIME_DATA_STREAM_TRANSPORT_H
+
+#include <set>
+#include <string>
+#include <vector>
+#include <sys/uio.h>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "common/status.h"
+#include "runtime/descriptors.h"  // for PlanNodeId
+#include "gen-cpp/Types_types.h"  // for TUniqueId
+
+namespace impala {
+
+class DataStreamMgr;
+class MemPool;
+class TRowBatch;
+
+// Data plane for the row batches of data streams between backends, used instead of
+// TransmitData rpcs if --data_stream_port_offset is set.  Every backend runs a
+// DataStreamServer on its backend port plus that offset, and each data stream channel
+// keeps a DataStreamConnection to the receiving backend's server for the lifetime of
+// the stream.
+// A batch is sent as a single frame: a FrameHeader, followed by the batch's tuple ids,
+// tuple offsets and tuple data.  The tuple data is written straight from the
+// sender's MemPool chunks (writev()), and the receiver reads it into a TRowBatch
+// without any Thrift (de)serialization.  Each frame is answered with a ResponseHeader
+// (plus error message) once the receiver's DataStreamMgr has taken the batch, which
+// preserves the DataStreamMgr's flow control: a sender blocks while the receiver's
+// buffer is full, just like with TransmitData rpcs.
+// Frames are in host byte order; all backends must run on the same architecture.
+
+// Wire format of the data stream frames.
+struct DataStreamFrame {
+  static const uint32_t MAGIC = 0x49534462;  // "IDSb"
+
+  enum Type { BATCH = 1, EOS = 2 };
+
+  struct FrameHeader {
+    uint32_t magic;
+    int32_t type;
+    int64_t dest_fragment_id_hi;
+    int64_t dest_fragment_id_lo;
+    int64_t sender_id_hi;
+    int64_t sender_id_lo;
+    int32_t dest_node_id;
+    // the following describe the TRowBatch of BATCH frames and are 0 for EOS frames;
+    // the frame continues with num_row_tuples tuple ids, num_tuple_offsets offsets
+    // and tuple_data_len bytes of tuple data
+    int32_t num_rows;
+    int32_t num_row_tuples;
+    int32_t num_tuple_offsets;
+    int32_t tuple_data_len;
+    int32_t uncompressed_size;
+    int32_t compression_type;
+  };
+
+  // followed by error_msg_len bytes of error message
+  struct ResponseHeader {
+    uint32_t magic;
+    int32_t status_code;
+    int32_t recvr_closed;
+    int32_t error_msg_len;
+  };
+};
+
+// Receives data stream frames and hands their batches to a DataStreamMgr.
+// Each connection is served by its own thread.
+class DataStreamServer {
+ public:
+  DataStreamServer(DataStreamMgr* stream_mgr, int port);
+
+  // Stops accepting connections, closes all open ones and waits for their threads.
+  ~DataStreamServer();
+
+  // Starts listening on the port and serving connections in the background.
+  Status Start();
+
+  int port() const { return port_; }
+
+ private:
+  DataStreamMgr* stream_mgr_;
+  const int port_;
+
+  // listening socket; -1 if not started
+  int listen_fd_;
+  boost::scoped_ptr<boost::thread> accept_thread_;
+
+  // protects the members below
+  boost::mutex lock_;
+
+  // sockets of the connections that are being served
+  std::set<int> conn_fds_;
+
+  // signalled when a connection thread exits
+  boost::condition_variable conn_closed_cv_;
+
+  // set by the d'tor; no new connections are served from then on
+  bool shutdown_;
+
+  // Accepts connections and starts a thread for each of them.
+  void AcceptLoop();
+
+  // Serves the frames that arrive on 'fd' until the sender closes the connection or
+  // sends an invalid frame, then closes 'fd'.
+  void ServeConnection(int fd);
+
+  // Reads the rest of the frame with 'header' from 'fd', hands it to stream_mgr_ and
+  // sends the response.  Returns false if the connection failed.
+  bool ServeFrame(int fd, const DataStreamFrame::FrameHeader& header);
+};
+
+// A sender's connection to a DataStreamServer.  Not thread-safe; the frames are sent
+// one at a time, each waiting for its response.  After an error, the connection is
+// unusable.
+class DataStreamConnection {
+ public:
+  DataStreamConnection(const std::string& ipaddress, int port);
+
+  // Closes the connection.
+  ~DataStreamConnection();
+
+  Status Open();
+
+  // Sends 'batch' to the stream fragment_id/dest_node_id on behalf of 'sender_id'
+  // (see DataStreamMgr::AddData()) and waits until the receiver has taken it.
+  // If batch.tuple_data is empty, the tuple data is taken from the chunks of
+  // 'data_pool' (see RowBatch::Serialize(TRowBatch*, MemPool*)), which may be NULL
+  // otherwise.  Sets '*recvr_closed' if the receiver dropped the batch because it
+  // doesn't need any more rows.
+  Status SendBatch(const TUniqueId& fragment_id, PlanNodeId dest_node_id,
+      const TUniqueId& sender_id, const TRowBatch& batch, MemPool* data_pool,
+      bool* recvr_closed);
+
+  // Closes sender_id's end of the stream (see DataStreamMgr::CloseSender()).
+  Status SendEos(const TUniqueId& fragment_id, PlanNodeId dest_node_id,
+      const TUniqueId& sender_id);
+
+ private:
+  const std::string ipaddress_;
+  const int port_;
+  int fd_;  // -1 if not open
+
+  // Sends 'header', followed by 'iov', and waits for the response.
+  Status SendFrame(DataStreamFrame::FrameHeader* header, std::vector<iovec>* iov,
+      bool* recvr_closed);
+
+  // Returns an error mentioning 'what' and errno, and closes the connection.
+  Status ConnectionError(const std::string& what);
+};
+
+}
+
+#endif
@@ -220,12 +220,14 @@ string TupleDescriptor::DebugString() const {
 
 RowDescriptor::RowDescriptor(const DescriptorTbl& desc_tbl,
                              const std::vector<TTupleId>& row_tuples,
-                             const std::vector<bool>& nullable_tuples) {
+                             const std::vector<bool>& nullable_tuples)
+  : has_string_slots_(false) {
   DCHECK(nullable_tuples.size() == row_tuples.size());
   for (int i = 0; i < row_tuples.size(); ++i) {
     tuple_desc_map_.push_back(desc_tbl.GetTupleDescriptor(row_tuples[i]));
     DCHECK(tuple_desc_map_.back() != NULL);
     tuple_idx_nullable_map_.push_back(nullable_tuples[i]);
+    if (!tuple_desc_map_.back()->string_slots().empty()) has_string_slots_ = true;
   }
 
   // find max id
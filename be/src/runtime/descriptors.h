@@ -320,11 +320,12 @@ class RowDescriptor {
   // standard copy c'tor, made explicit here
   RowDescriptor(const RowDescriptor& desc)
     : tuple_desc_map_(desc.tuple_desc_map_),
-      tuple_idx_map_(desc.tuple_idx_map_) {
+      tuple_idx_map_(desc.tuple_idx_map_),
+      has_string_slots_(desc.has_string_slots_) {
   }
 
   // dummy descriptor, needed for the JNI EvalPredicate() function
-  RowDescriptor() {}
+  RowDescriptor() : has_string_slots_(false) {}
 
   // Returns total size in bytes.
   int GetRowSize() const;
@@ -337,6 +338,9 @@ class RowDescriptor {
   // Return true if the Tuple of the given Tuple index is nullable.
   bool TupleIsNullable(int tuple_idx) const;
 
+  // Return true if any tuple of the row has string slots.
+  bool has_string_slots() const { return has_string_slots_; }
+
   // Return descriptors for all tuples in this row, in order of appearance.
   const std::vector<TupleDescriptor*>& tuple_descriptors() const {
     return tuple_desc_map_;
@@ -363,6 +367,8 @@ class RowDescriptor {
 
   // map from TupleId to position of tuple w/in row
   std::vector<int> tuple_idx_map_;
+
+  bool has_string_slots_;
 };
 
 }
@@ -12,6 +12,8 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <unistd.h>
+#include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
 
 #include <gtest/gtest.h>
@@ -19,10 +21,16 @@
 #include "codegen/llvm-codegen.h"
 #include "runtime/disk-io-mgr.h"
 #include "runtime/disk-io-mgr-stress.h"
+#include "util/cpu-info.h"
+#include "util/metrics.h"
 
 using namespace std;
 using namespace boost;
 
+DECLARE_bool(mmap_local_files);
+DECLARE_int64(block_cache_capacity);
+DECLARE_int32(read_ahead_bytes);
+
 const int BUFFER_SIZE = 1024;
 
 namespace impala {
@@ -72,9 +80,9 @@ class DiskIoMgrTest : public testing::Test {
   }
 
   DiskIoMgr::ScanRange* InitRange(const char* file_path, int offset, 
-      int len, int disk_id) {
+      int len, int disk_id, int64_t mtime = 0) {
     DiskIoMgr::ScanRange* range = pool_.Add(new DiskIoMgr::ScanRange());
-    range->Reset(file_path, len, offset, disk_id);
+    range->Reset(file_path, len, offset, disk_id, NULL, mtime);
     return range;
   }
 
@@ -121,6 +129,62 @@ TEST_F(DiskIoMgrTest, SingleReader) {
   }
 }
 
+// Reads ranges that each span multiple buffers with several threads per disk.  The
+// reads are positional, so each buffer must contain the bytes at its own offset.
+// This is run both reading into io buffers and mapping the file.  The buffers are
+// smaller than a page, so the mapped ranges are not page aligned.
+TEST_F(DiskIoMgrTest, MultiBufferRanges) {
+  const char* tmp_file = "/tmp/disk_io_mgr_test_multi_buffer.txt";
+  string data;
+  for (int i = 0; i < 10 * BUFFER_SIZE + 7; ++i) {
+    data.push_back('a' + i % 26);
+  }
+  CreateTempFile(tmp_file, data.c_str());
+
+  for (int use_mmap = 0; use_mmap <= 1; ++use_mmap) {
+    FLAGS_mmap_local_files = use_mmap;
+    for (int num_threads_per_disk = 1; num_threads_per_disk <= 5;
+        ++num_threads_per_disk) {
+      LOG(INFO) << "Starting test with mmap=" << use_mmap
+                << " num_threads_per_disk=" << num_threads_per_disk;
+      DiskIoMgr io_mgr(1, num_threads_per_disk, BUFFER_SIZE);
+      Status status = io_mgr.Init();
+      ASSERT_TRUE(status.ok());
+
+      DiskIoMgr::ReaderContext* reader;
+      status = io_mgr.RegisterReader(NULL, 3, &reader);
+      ASSERT_TRUE(status.ok());
+
+      // Four ranges of unequal lengths, none aligned to the buffer size.
+      vector<DiskIoMgr::ScanRange*> ranges;
+      int range_len = data.size() / 4 + 1;
+      for (int offset = 0; offset < data.size(); offset += range_len) {
+        int len = min<int>(range_len, data.size() - offset);
+        ranges.push_back(InitRange(tmp_file, offset, len, 0));
+      }
+      status = io_mgr.AddScanRanges(reader, ranges);
+      ASSERT_TRUE(status.ok());
+
+      int total_bytes = 0;
+      bool eos = false;
+      while (!eos) {
+        DiskIoMgr::BufferDescriptor* buffer;
+        status = io_mgr.GetNext(reader, &buffer, &eos);
+        ASSERT_TRUE(status.ok());
+        if (buffer == NULL) break;
+        int64_t offset = buffer->scan_range()->offset() + buffer->scan_range_offset();
+        ASSERT_LE(offset + buffer->len(), data.size());
+        EXPECT_EQ(memcmp(buffer->buffer(), data.c_str() + offset, buffer->len()), 0);
+        total_bytes += buffer->len();
+        buffer->Return();
+      }
+      EXPECT_EQ(total_bytes, data.size());
+      io_mgr.UnregisterReader(reader);
+    }
+  }
+  FLAGS_mmap_local_files = false;
+}
+
 // Tests a single reader cancelling half way through scan ranges.  
 TEST_F(DiskIoMgrTest, SingleReaderCancel) {
   for (int num_threads_per_disk = 1; num_threads_per_disk <= 5; ++num_threads_per_disk) {
@@ -371,6 +435,8 @@ TEST_F(DiskIoMgrTest, MultipleReader) {
 
             status = io_mgr.RegisterReader(NULL, num_buffers, &readers[i]);
             ASSERT_TRUE(status.ok());
+            // Readers with different shares of the disk must all finish.
+            io_mgr.set_weight(readers[i], i + 1);
           
             vector<DiskIoMgr::ScanRange*> ranges;
             for (int j = 0; j < DATA_LEN; ++j) {
@@ -397,6 +463,278 @@ TEST_F(DiskIoMgrTest, MultipleReader) {
   }
 }
 
+// Reads the ranges of a file with an mtime with several readers, so that their file
+// handles are cached and reused.  A file that is replaced under the same path (with a
+// new mtime) must not be read through the old file's handles.
+TEST_F(DiskIoMgrTest, CachedFileHandles) {
+  const char* tmp_file = "/tmp/disk_io_mgr_test_cached_handles.txt";
+  const char* datas[] = { "abcdefgh", "ijklmnop" };
+  for (int num_disks = 1; num_disks <= 3; num_disks += 2) {
+    DiskIoMgr io_mgr(num_disks, 2, BUFFER_SIZE);
+    Status status = io_mgr.Init();
+    ASSERT_TRUE(status.ok());
+
+    for (int mtime = 1; mtime <= 2; ++mtime) {
+      // Remove the file first, so the new file is not the one the handles have open.
+      unlink(tmp_file);
+      const char* data = datas[mtime - 1];
+      CreateTempFile(tmp_file, data);
+
+      for (int num_readers = 0; num_readers < 3; ++num_readers) {
+        DiskIoMgr::ReaderContext* reader;
+        status = io_mgr.RegisterReader(NULL, 2, &reader);
+        ASSERT_TRUE(status.ok());
+
+        vector<DiskIoMgr::ScanRange*> ranges;
+        for (int i = 0; i < strlen(data); ++i) {
+          ranges.push_back(InitRange(tmp_file, i, 1, i % num_disks, mtime));
+        }
+        status = io_mgr.AddScanRanges(reader, ranges);
+        ASSERT_TRUE(status.ok());
+
+        ValidateRead(&io_mgr, reader, data);
+        io_mgr.UnregisterReader(reader);
+      }
+    }
+  }
+}
+
+// Reads the ranges of a file repeatedly with the block cache enabled.  The reads after
+// the first are served from the cache, until the file is replaced (with a new mtime).
+TEST_F(DiskIoMgrTest, BlockCache) {
+  const char* tmp_file = "/tmp/disk_io_mgr_test_block_cache.txt";
+  string datas[2];
+  for (int i = 0; i < 3 * BUFFER_SIZE + 10; ++i) {
+    datas[0].push_back('a' + i % 26);
+    datas[1].push_back('A' + i % 26);
+  }
+  int64_t old_capacity = FLAGS_block_cache_capacity;
+  FLAGS_block_cache_capacity = 100 * BUFFER_SIZE;
+  DiskIoMgr io_mgr(2, 2, BUFFER_SIZE);
+  Status status = io_mgr.Init();
+  ASSERT_TRUE(status.ok());
+  FLAGS_block_cache_capacity = old_capacity;
+  ASSERT_TRUE(io_mgr.block_cache() != NULL);
+
+  int64_t expected_hits = 0;
+  for (int mtime = 1; mtime <= 2; ++mtime) {
+    const string& data = datas[mtime - 1];
+    unlink(tmp_file);
+    CreateTempFile(tmp_file, data.c_str());
+
+    for (int num_reads = 0; num_reads < 3; ++num_reads) {
+      DiskIoMgr::ReaderContext* reader;
+      status = io_mgr.RegisterReader(NULL, 3, &reader);
+      ASSERT_TRUE(status.ok());
+
+      // Two ranges per disk, the last one going past the end of the file.
+      vector<DiskIoMgr::ScanRange*> ranges;
+      for (int i = 0; i < 4; ++i) {
+        ranges.push_back(InitRange(tmp_file, i * BUFFER_SIZE, BUFFER_SIZE, i % 2, mtime));
+      }
+      status = io_mgr.AddScanRanges(reader, ranges);
+      ASSERT_TRUE(status.ok());
+
+      string result(data.size(), '\0');
+      int num_ranges_done = 0;
+      while (num_ranges_done < ranges.size()) {
+        DiskIoMgr::BufferDescriptor* buffer;
+        bool eos;
+        status = io_mgr.GetNext(reader, &buffer, &eos);
+        ASSERT_TRUE(status.ok());
+        ASSERT_TRUE(buffer != NULL);
+        EXPECT_TRUE(buffer->eosr());
+        int64_t offset = buffer->scan_range()->offset() + buffer->scan_range_offset();
+        ASSERT_LE(offset + buffer->len(), data.size());
+        memcpy(&result[offset], buffer->buffer(), buffer->len());
+        buffer->Return();
+        ++num_ranges_done;
+      }
+      EXPECT_EQ(result, data);
+      io_mgr.UnregisterReader(reader);
+
+      if (num_reads > 0) expected_hits += ranges.size();
+      EXPECT_EQ(io_mgr.block_cache()->num_hits(), expected_hits);
+    }
+  }
+}
+
+// The last buffer of each range holds up to --read_ahead_bytes past the range's end.
+TEST_F(DiskIoMgrTest, ReadAhead) {
+  const char* tmp_file = "/tmp/disk_io_mgr_test_read_ahead.txt";
+  const char* data = "abcdefghijklmnopqrstuvwxyz";
+  CreateTempFile(tmp_file, data);
+  int old_read_ahead_bytes = FLAGS_read_ahead_bytes;
+  FLAGS_read_ahead_bytes = 8;
+  DiskIoMgr io_mgr(1, 1, 4);
+  Status status = io_mgr.Init();
+  ASSERT_TRUE(status.ok());
+  FLAGS_read_ahead_bytes = old_read_ahead_bytes;
+
+  // Ranges of 6 bytes take two reads, the second of which reads ahead.  The last
+  // range ends 2 bytes before the end of the file.
+  for (int offset = 0; offset <= 18; offset += 6) {
+    DiskIoMgr::ReaderContext* reader;
+    status = io_mgr.RegisterReader(NULL, 1, &reader);
+    ASSERT_TRUE(status.ok());
+    vector<DiskIoMgr::ScanRange*> ranges;
+    ranges.push_back(InitRange(tmp_file, offset, 6, 0));
+    status = io_mgr.AddScanRanges(reader, ranges);
+    ASSERT_TRUE(status.ok());
+
+    for (int i = 0; i < 2; ++i) {
+      DiskIoMgr::BufferDescriptor* buffer;
+      bool eos;
+      status = io_mgr.GetNext(reader, &buffer, &eos);
+      ASSERT_TRUE(status.ok());
+      ASSERT_TRUE(buffer != NULL);
+      EXPECT_EQ(buffer->eosr(), i == 1);
+      int64_t start = offset + buffer->scan_range_offset();
+      int64_t expected_read_ahead =
+          i == 0 ? 0 : min<int64_t>(8, strlen(data) - (start + buffer->len()));
+      ASSERT_EQ(buffer->read_ahead_len(), expected_read_ahead) << offset;
+      EXPECT_EQ(string(buffer->buffer(), buffer->len() + buffer->read_ahead_len()),
+          string(data + start, buffer->len() + expected_read_ahead));
+      buffer->Return();
+    }
+    io_mgr.UnregisterReader(reader);
+  }
+
+  // Sync reads are the reads past a range and don't read further ahead.
+  DiskIoMgr::BufferDescriptor* buffer;
+  status = io_mgr.Read(NULL, InitRange(tmp_file, 2, 3, 0), &buffer);
+  ASSERT_TRUE(status.ok());
+  EXPECT_EQ(buffer->len(), 3);
+  EXPECT_EQ(buffer->read_ahead_len(), 0);
+  buffer->Return();
+}
+
+// Counts the completed writes of the Writes test.
+struct WriteCounter {
+  mutex lock;
+  condition_variable done_cv;
+  int num_done;
+  int num_errors;
+
+  WriteCounter() : num_done(0), num_errors(0) {}
+
+  void WriteDone(const Status& status) {
+    lock_guard<mutex> l(lock);
+    ++num_done;
+    if (!status.ok()) ++num_errors;
+    done_cv.notify_all();
+  }
+
+  void WaitFor(int n) {
+    unique_lock<mutex> l(lock);
+    while (num_done < n) done_cv.wait(l);
+  }
+};
+
+// Writes a file with write ranges in io mgr buffers while a reader reads another file
+// on the same disk.  Neither the writes nor the reads are held up by the other.
+TEST_F(DiskIoMgrTest, Writes) {
+  const char* read_file = "/tmp/disk_io_mgr_test_writes_read.txt";
+  const char* write_file = "/tmp/disk_io_mgr_test_writes_write.txt";
+  const char* data = "abcdefghijklmnopqrstuvwxyz";
+  CreateTempFile(read_file, data);
+  CreateTempFile(write_file, "");
+  const int NUM_WRITES = 20;
+
+  for (int num_threads = 1; num_threads <= 2; ++num_threads) {
+    DiskIoMgr io_mgr(1, num_threads, BUFFER_SIZE);
+    Status status = io_mgr.Init();
+    ASSERT_TRUE(status.ok());
+
+    DiskIoMgr::ReaderContext* reader;
+    status = io_mgr.RegisterReader(NULL, 1, &reader);
+    ASSERT_TRUE(status.ok());
+    vector<DiskIoMgr::ScanRange*> ranges;
+    for (int i = 0; i < strlen(data); ++i) {
+      ranges.push_back(InitRange(read_file, i, 1, 0));
+    }
+    status = io_mgr.AddScanRanges(reader, ranges);
+    ASSERT_TRUE(status.ok());
+
+    WriteCounter counter;
+    vector<char*> buffers;
+    DiskIoMgr::WriteRange write_ranges[NUM_WRITES];
+    for (int i = 0; i < NUM_WRITES; ++i) {
+      buffers.push_back(io_mgr.GetWriteBuffer());
+      memset(buffers.back(), 'A' + i, BUFFER_SIZE);
+      write_ranges[i].Reset(write_file, i * BUFFER_SIZE, 0, buffers.back(), BUFFER_SIZE,
+          bind(&WriteCounter::WriteDone, &counter, _1));
+      status = io_mgr.AddWriteRange(&write_ranges[i]);
+      ASSERT_TRUE(status.ok());
+    }
+
+    ValidateRead(&io_mgr, reader, data);
+    counter.WaitFor(NUM_WRITES);
+    EXPECT_EQ(counter.num_errors, 0);
+    io_mgr.UnregisterReader(reader);
+
+    FILE* file = fopen(write_file, "r");
+    ASSERT_TRUE(file != NULL);
+    for (int i = 0; i < NUM_WRITES; ++i) {
+      vector<char> buffer(BUFFER_SIZE);
+      ASSERT_EQ(fread(&buffer[0], 1, BUFFER_SIZE, file), BUFFER_SIZE);
+      EXPECT_EQ(memcmp(&buffer[0], buffers[i], BUFFER_SIZE), 0) << i;
+    }
+    fclose(file);
+
+    // Returned buffers are handed out again, for reads or writes.
+    for (int i = 0; i < NUM_WRITES; ++i) io_mgr.ReturnWriteBuffer(buffers[i]);
+    int num_allocated_buffers = io_mgr.num_allocated_buffers();
+    for (int i = 0; i < NUM_WRITES; ++i) buffers[i] = io_mgr.GetWriteBuffer();
+    EXPECT_EQ(io_mgr.num_allocated_buffers(), num_allocated_buffers);
+    for (int i = 0; i < NUM_WRITES; ++i) io_mgr.ReturnWriteBuffer(buffers[i]);
+  }
+  unlink(write_file);
+}
+
+// The per disk metrics count the reads and writes of each disk.
+TEST_F(DiskIoMgrTest, Metrics) {
+  const char* tmp_file = "/tmp/disk_io_mgr_test_metrics.txt";
+  const char* data = "abcdefghijklmnopqrstuvwxyz";
+  CreateTempFile(tmp_file, data);
+  Metrics metrics;
+  DiskIoMgr io_mgr(2, 1, BUFFER_SIZE);
+  Status status = io_mgr.Init(NULL, &metrics);
+  ASSERT_TRUE(status.ok());
+
+  DiskIoMgr::ReaderContext* reader;
+  status = io_mgr.RegisterReader(NULL, 1, &reader);
+  ASSERT_TRUE(status.ok());
+  vector<DiskIoMgr::ScanRange*> ranges;
+  for (int i = 0; i < strlen(data); ++i) ranges.push_back(InitRange(tmp_file, i, 1, 1));
+  status = io_mgr.AddScanRanges(reader, ranges);
+  ASSERT_TRUE(status.ok());
+  ValidateRead(&io_mgr, reader, data);
+  io_mgr.UnregisterReader(reader);
+
+  WriteCounter counter;
+  char* buffer = io_mgr.GetWriteBuffer();
+  memset(buffer, 'x', 10);
+  DiskIoMgr::WriteRange write_range;
+  write_range.Reset(tmp_file, 0, 1, buffer, 10,
+      bind(&WriteCounter::WriteDone, &counter, _1));
+  status = io_mgr.AddWriteRange(&write_range);
+  ASSERT_TRUE(status.ok());
+  counter.WaitFor(1);
+  io_mgr.ReturnWriteBuffer(buffer);
+
+  string metrics_str = metrics.DebugString();
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-0.local-bytes-read:0"), string::npos);
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.local-bytes-read:26"), string::npos);
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.hdfs-bytes-read:0"), string::npos);
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.read-latency-us:count=26"),
+      string::npos) << metrics_str;
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.bytes-written:10"), string::npos);
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.active-ios:0"), string::npos);
+  EXPECT_NE(metrics_str.find("disk-io-mgr.disk-1.queue-length:"), string::npos);
+  EXPECT_EQ(metrics_str.find("disk-io-mgr.disk-1.read-throughput:0\n"), string::npos);
+}
+
 // Stress test for multiple clients with cancellation
 // TODO: the stress app should be expanded to include sync reads and adding scan
 // ranges in the middle.
@@ -411,5 +749,6 @@ TEST_F(DiskIoMgrTest, StressTest) {
 int main(int argc, char **argv) {
   google::InitGoogleLogging(argv[0]);
   ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
   return RUN_ALL_TESTS();
 }
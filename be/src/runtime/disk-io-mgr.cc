@@ -14,14 +14,26 @@
 
 #include "runtime/disk-io-mgr.h"
 
+#include <errno.h>
+#include <fcntl.h>
+#include <map>
 #include <queue>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <boost/algorithm/string.hpp>
 #include <boost/functional/hash.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread/locks.hpp>
 
 #include "common/logging.h"
+#include "runtime/huge-page-allocator.h"
+#include "runtime/mem-tracker.h"
+#include "util/cpu-info.h"
 #include "util/disk-info.h"
 #include "util/hdfs-util.h"
+#include "util/non-primitive-metrics.h"
 
 // Control the number of disks on the machine.  If 0, this comes from the system 
 // settings.
@@ -32,8 +44,51 @@ DEFINE_int32(num_disks, 0, "Number of disks on data node.");
 // There is a trade off of latency and throughout, trying to keep disks busy but
 // not introduce seeks.  The literature seems to agree that with 8 MB reads, random
 // io and sequential io perform similarly.
-DEFINE_int32(num_threads_per_disk, 1, "number of threads per disk");
+// Spinning disks only service one read at a time, so more threads just add seeks.
+// Flash devices have no seek penalty and need many outstanding reads to reach their
+// throughput.  If num_threads_per_disk is 0, the number of threads is picked per
+// disk from the disk type reported by DiskInfo.
+DEFINE_int32(num_threads_per_disk, 0, "number of threads per disk. If 0, this is "
+    "num_threads_per_rotational_disk or num_threads_per_flash_disk depending on the "
+    "type of the disk.");
+DEFINE_int32(num_threads_per_rotational_disk, 1,
+    "number of threads per rotational disk, if num_threads_per_disk is 0");
+DEFINE_int32(num_threads_per_flash_disk, 8,
+    "number of threads per flash (ssd/nvme) disk, if num_threads_per_disk is 0");
 DEFINE_int32(read_size, 8 * 1024 * 1024, "Read Size (in bytes)");
+// On a multi-socket machine, io buffers that are read into on one node and scanned on
+// another cost remote memory accesses for every byte.
+DEFINE_bool(numa_aware_io, true, "If true and the machine has several NUMA nodes, the "
+    "io threads of a disk run on the cores of the node of its controller, so that the "
+    "io buffers they read into are allocated there, and freed io buffers are reused on "
+    "the node they were allocated on.");
+// Scanners read past the end of their range to finish the last record, which costs
+// another io (and seek) unless the io mgr already read those bytes.
+DEFINE_int32(read_ahead_bytes, 64 * 1024, "Number of bytes the last read of a scan "
+    "range reads past its end, for the scanner to finish its last record with.  The "
+    "io buffers are that much larger than --read_size.  0 disables read ahead.");
+// Readers of local files can map the files instead of reading them into io buffers.
+// The data then goes to the reader straight from the page cache instead of being
+// copied into (and holding) a read_size io buffer per buffer in flight.
+DEFINE_bool(mmap_local_files, false, "If true, local files are mapped into memory "
+    "instead of being read into io buffers.");
+// Opening an hdfs file costs a NameNode rpc (for the block locations) and setting up
+// the DataNode connection.  Files are typically read as several scan ranges, by the
+// same and by later queries, so the handles of finished ranges are kept open per disk
+// for the next range of the file.
+DEFINE_int32(max_cached_file_handles_per_disk, 128, "Maximum number of open file "
+    "handles of finished scan ranges that each disk keeps for reuse by later ranges of "
+    "the same files. 0 disables the cache.");
+// Tables that are scanned over and over (e.g. dimension tables or the latest
+// partitions) can be served from memory.  The block cache keeps the io buffers read
+// from disk, up to the capacity, and hands them to later reads of the same bytes of
+// the same file (as of the same mtime) without copying.  See BlockCache for the
+// eviction policy.
+DEFINE_int64(block_cache_capacity, 0, "Maximum number of bytes of io buffers the io "
+    "mgr keeps cached for later reads of the same file blocks. 0 disables the cache.");
+DEFINE_string(block_cache_pinned_paths, "", "Comma separated list of path prefixes "
+    "(e.g. table directories) whose cached blocks are never evicted from the block "
+    "cache.");
 
 using namespace boost;
 using namespace impala;
@@ -106,6 +161,14 @@ struct DiskIoMgr::ReaderContext {
   // If true, this is a reader from Read()
   bool sync_reader_;
 
+  // If true, the reader's (local) files are mapped instead of read into io buffers.
+  // Set once when the reader is registered.
+  bool mmap_files_;
+
+  // The reader's share of each disk relative to the other readers on it (see
+  // GetNextScanRange()).  Set before any ranges are added and not changed after.
+  int weight_;
+
   // Struct containing state per disk. See comments in the disk read loop on how 
   // they are used.
   struct PerDiskState {
@@ -137,6 +200,11 @@ struct DiskIoMgr::ReaderContext {
     // The number of empty buffers on this disk
     int num_empty_buffers;
 
+    // Virtual time of the reader on this disk: the bytes it had the disk read,
+    // divided by its weight.  Disk threads serve the reader with the lowest virtual
+    // time.  Protected by the disk queue's lock.
+    int64_t vtime;
+
     PerDiskState() {
       Reset(0);
     }
@@ -147,6 +215,17 @@ struct DiskIoMgr::ReaderContext {
       is_on_queue = false;
       num_threads_in_read = 0;
       num_empty_buffers = per_disk_buffers;
+      vtime = 0;
+    }
+
+    // Returns true if the reader is behind on consuming this disk's buffers: more
+    // of them are read and waiting for (or held by) the reader than are empty.
+    // Such a reader would not use more buffers soon, so other readers are served
+    // first.
+    bool IsBacklogged(int per_disk_buffers) const {
+      int num_unconsumed_buffers =
+          per_disk_buffers - num_empty_buffers - num_threads_in_read;
+      return num_unconsumed_buffers > num_empty_buffers;
     }
   };
 
@@ -180,6 +259,8 @@ struct DiskIoMgr::ReaderContext {
     num_empty_buffers_ = per_disk_buffers * disk_states_.size();
     num_outstanding_buffers_ = 0;
     sync_reader_ = false;
+    mmap_files_ = hdfs_connection == NULL && FLAGS_mmap_local_files;
+    weight_ = 1;
   }
 
   // Validates invariants of reader.  Reader lock should be taken before hand.
@@ -335,28 +416,227 @@ class DiskIoMgr::ReaderCache {
 };
 
 // Per disk state
+// Identifies the file of a cached file handle.
+struct FileHandleKey {
+  // NULL for local files
+  hdfsFS hdfs_connection;
+  string file;
+  int64_t mtime;
+
+  FileHandleKey(hdfsFS hdfs_connection, const char* file, int64_t mtime)
+    : hdfs_connection(hdfs_connection), file(file), mtime(mtime) {
+  }
+
+  bool operator<(const FileHandleKey& other) const {
+    if (hdfs_connection != other.hdfs_connection) {
+      return hdfs_connection < other.hdfs_connection;
+    }
+    if (mtime != other.mtime) return mtime < other.mtime;
+    return file < other.file;
+  }
+};
+
+// Open file handle of a finished scan range, cached by its disk queue.
+struct CachedFileHandle {
+  FileHandleKey key;
+  union {
+    FILE* local_file;
+    hdfsFile hdfs_file;
+  };
+
+  CachedFileHandle(const FileHandleKey& key) : key(key), local_file(NULL) {
+  }
+
+  void Close() {
+    if (key.hdfs_connection != NULL) {
+      hdfsCloseFile(key.hdfs_connection, hdfs_file);
+    } else {
+      fclose(local_file);
+    }
+  }
+};
+
 struct DiskIoMgr::DiskQueue {
   // Disk id (0-based)
   int disk_id;
 
+  // NUMA node the disk threads run on, -1 if they are not pinned.
+  int numa_node;
+
   // Condition variable to signal the disk threads that there is work to do or the
   // thread should shut down.  A disk thread will be woken up when there is a reader
-  // added to the queue.  Readers are only on the queue when they have both work
-  // (scan range added) and an available buffer.
+  // or a write range added to the queue.  Readers are only on the queue when they
+  // have both work (scan range added) and an available buffer.
   condition_variable work_available;
   
-  // Lock that protects access to 'readers'
+  // Lock that protects access to 'readers' and 'write_ranges'
   mutex lock;
 
   // list of all readers that have work queued on this disk and empty buffers to read
   // into.
   list<ReaderContext*> readers;
 
-  // The reader at the head of the queue that will get their io issued next
-  list<ReaderContext*>::iterator next_reader;
+  // Writes queued on this disk, in the order they were added.
+  list<WriteRange*> write_ranges;
+
+  // Virtual time of the disk: the virtual time of the reader (or writes) last served.
+  int64_t vtime;
+
+  // Virtual time of the write queue, which is scheduled against the readers like a
+  // reader of weight 1 that is charged the bytes it writes.
+  int64_t write_vtime;
+
+  // Open file handles of finished scan ranges on this disk, most recently used
+  // first, and their index by file.  A handle is only used by one range at a time:
+  // it is taken out of the cache while a range has it open.
+  typedef list<CachedFileHandle> FileHandleList;
+  typedef multimap<FileHandleKey, FileHandleList::iterator> FileHandleMap;
+  FileHandleList file_handles;
+  FileHandleMap file_handle_index;
+
+  // Protects file_handles and file_handle_index.  This is separate from 'lock' since
+  // it is taken by the disk threads around opening and closing files.
+  mutex file_handles_lock;
+
+  // Metrics of the disk, registered by Init() if the io mgr is given a Metrics object
+  // and NULL otherwise.  The queue length is sampled whenever work is queued or picked
+  // up; active_ios is the number of reads and writes the disk threads are in.
+  // Read latencies are in microseconds and read_throughput is in bytes per second
+  // of read time (read_ticks).
+  Metrics::IntMetric* queue_length_metric;
+  Metrics::IntMetric* active_ios_metric;
+  HistogramMetric* read_latency_metric;
+  Metrics::IntMetric* read_throughput_metric;
+  Metrics::IntMetric* local_bytes_read_metric;
+  Metrics::IntMetric* hdfs_bytes_read_metric;
+  Metrics::IntMetric* bytes_written_metric;
+
+  // Total cpu ticks spent in reads by the disk threads, for read_throughput_metric.
+  int64_t read_ticks;
+
+  DiskQueue(int id) : disk_id(id), numa_node(-1), vtime(0), write_vtime(0),
+      queue_length_metric(NULL), active_ios_metric(NULL), read_latency_metric(NULL),
+      read_throughput_metric(NULL), local_bytes_read_metric(NULL),
+      hdfs_bytes_read_metric(NULL), bytes_written_metric(NULL), read_ticks(0) {
+  }
+
+  ~DiskQueue() {
+    for (FileHandleList::iterator it = file_handles.begin();
+        it != file_handles.end(); ++it) {
+      it->Close();
+    }
+  }
+
+  // Removes a cached handle for 'key' from the cache and returns it in 'handle'.
+  // Returns false if there is none.
+  bool GetFileHandle(const FileHandleKey& key, CachedFileHandle* handle) {
+    lock_guard<mutex> l(file_handles_lock);
+    FileHandleMap::iterator it = file_handle_index.find(key);
+    if (it == file_handle_index.end()) return false;
+    *handle = *it->second;
+    file_handles.erase(it->second);
+    file_handle_index.erase(it);
+    return true;
+  }
+
+  // Adds 'handle' to the cache.  If that makes the cache exceed 'max_handles', the
+  // least recently used handle is removed and returned in 'evicted' for the caller to
+  // close (outside the lock), and true is returned.
+  bool CacheFileHandle(const CachedFileHandle& handle, int max_handles,
+      CachedFileHandle* evicted) {
+    lock_guard<mutex> l(file_handles_lock);
+    file_handles.push_front(handle);
+    file_handle_index.insert(make_pair(handle.key, file_handles.begin()));
+    if (file_handle_index.size() <= max_handles) return false;
+
+    FileHandleList::iterator lru = --file_handles.end();
+    pair<FileHandleMap::iterator, FileHandleMap::iterator> range =
+        file_handle_index.equal_range(lru->key);
+    for (FileHandleMap::iterator it = range.first; it != range.second; ++it) {
+      if (it->second == lru) {
+        file_handle_index.erase(it);
+        break;
+      }
+    }
+    *evicted = *lru;
+    file_handles.erase(lru);
+    return true;
+  }
+
+  // Adds reader to the queue.  The reader's virtual time is moved up to the disk's,
+  // so that a reader that was idle (or is new) gets its share from now on and does
+  // not get the disk to itself until it caught up with the others.
+  // The disk lock must be taken.
+  void AddReader(ReaderContext* reader) {
+    ReaderContext::PerDiskState& state = reader->disk_states_[disk_id];
+    state.vtime = max(state.vtime, vtime);
+    readers.push_back(reader);
+    UpdateQueueLength();
+  }
+
+  // Samples the queue length into queue_length_metric.  The disk lock must be taken.
+  void UpdateQueueLength() {
+    if (queue_length_metric == NULL) return;
+    queue_length_metric->Update(readers.size() + write_ranges.size());
+  }
 
-  DiskQueue(int id) : disk_id(id) {
-    next_reader = readers.end();
+  // Registers the metrics of the disk, with keys "disk-io-mgr.disk-<id>.<name>".
+  void RegisterMetrics(Metrics* metrics) {
+    stringstream prefix;
+    prefix << "disk-io-mgr.disk-" << disk_id << ".";
+    queue_length_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "queue-length", 0L);
+    active_ios_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "active-ios", 0L);
+    read_latency_metric = metrics->RegisterMetric(
+        new HistogramMetric(prefix.str() + "read-latency-us", TCounterType::UNIT));
+    read_throughput_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "read-throughput", 0L);
+    local_bytes_read_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "local-bytes-read", 0L);
+    hdfs_bytes_read_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "hdfs-bytes-read", 0L);
+    bytes_written_metric = metrics->CreateAndRegisterPrimitiveMetric(
+        prefix.str() + "bytes-written", 0L);
+  }
+
+  // Records a read of 'bytes' that took 'ticks' cpu ticks.  'hdfs' is true if the
+  // read went through hdfs rather than the local file system.
+  void RecordRead(int64_t bytes, int64_t ticks, bool hdfs) {
+    if (read_latency_metric == NULL) return;
+    read_latency_metric->Add(ticks * 1000 / CpuInfo::cycles_per_ms());
+    Metrics::IntMetric* bytes_metric =
+        hdfs ? hdfs_bytes_read_metric : local_bytes_read_metric;
+    bytes_metric->Increment(bytes);
+    int64_t total_ticks = __sync_add_and_fetch(&read_ticks, ticks);
+    int64_t total_bytes =
+        local_bytes_read_metric->value() + hdfs_bytes_read_metric->value();
+    if (total_ticks > 0) {
+      read_throughput_metric->Update(static_cast<int64_t>(
+          total_bytes * (CpuInfo::cycles_per_ms() * 1000.0 / total_ticks)));
+    }
+  }
+
+  // Returns the reader that should be served next: the one with the lowest virtual
+  // time, preferring readers that are not backlogged.  Readers with the same virtual
+  // time are served in queue order.  The disk lock must be taken and the queue must
+  // not be empty.
+  list<ReaderContext*>::iterator NextReader() {
+    DCHECK(!readers.empty());
+    list<ReaderContext*>::iterator next = readers.end();
+    bool next_backlogged = false;
+    int64_t next_vtime = 0;
+    for (list<ReaderContext*>::iterator it = readers.begin(); it != readers.end(); ++it) {
+      const ReaderContext::PerDiskState& state = (*it)->disk_states_[disk_id];
+      bool backlogged = state.IsBacklogged((*it)->num_buffers_per_disk_);
+      if (next == readers.end() || (next_backlogged && !backlogged) ||
+          (next_backlogged == backlogged && state.vtime < next_vtime)) {
+        next = it;
+        next_backlogged = backlogged;
+        next_vtime = state.vtime;
+      }
+    }
+    return next;
   }
 };
 
@@ -365,12 +645,13 @@ DiskIoMgr::ScanRange::ScanRange() {
 }
 
 void DiskIoMgr::ScanRange::Reset(const char* file, int64_t len, int64_t offset, 
-    int disk_id, void* meta_data) {
+    int disk_id, void* meta_data, int64_t mtime) {
   file_ = file;
   len_ = len;
   offset_ = offset;
   disk_id_ = disk_id;
   meta_data_ = meta_data;
+  mtime_ = mtime;
 }
     
 void DiskIoMgr::ScanRange::InitInternal(ReaderContext* reader) {
@@ -380,6 +661,20 @@ void DiskIoMgr::ScanRange::InitInternal(ReaderContext* reader) {
   bytes_read_ = 0;
 }
 
+DiskIoMgr::WriteRange::WriteRange() {
+  Reset(NULL, -1, -1, NULL, 0, WriteDoneCallback());
+}
+
+void DiskIoMgr::WriteRange::Reset(const char* file, int64_t offset, int disk_id,
+    const char* data, int64_t len, const WriteDoneCallback& callback) {
+  file_ = file;
+  offset_ = offset;
+  disk_id_ = disk_id;
+  data_ = data;
+  len_ = len;
+  callback_ = callback;
+}
+
 string DiskIoMgr::ScanRange::DebugString() const{
   stringstream ss;
   ss << "file=" << file_ << " disk_id=" << disk_id_ << " offset=" << offset_
@@ -388,7 +683,8 @@ string DiskIoMgr::ScanRange::DebugString() const{
 }
 
 DiskIoMgr::BufferDescriptor::BufferDescriptor(DiskIoMgr* io_mgr) :
-  io_mgr_(io_mgr), reader_(NULL), buffer_(NULL) {
+  io_mgr_(io_mgr), reader_(NULL), buffer_(NULL), mapped_(false), mmap_base_(NULL),
+  mmap_len_(0) {
 }
 
 void DiskIoMgr::BufferDescriptor::Reset(ReaderContext* reader, 
@@ -399,8 +695,13 @@ void DiskIoMgr::BufferDescriptor::Reset(ReaderContext* reader,
   scan_range_ = range;
   buffer_ = buffer;
   len_ = 0;
+  read_ahead_len_ = 0;
   eosr_ = false;
   status_ = Status::OK;
+  mapped_ = false;
+  mmap_base_ = NULL;
+  mmap_len_ = 0;
+  cached_block_ = NULL;
 }
 
 void DiskIoMgr::BufferDescriptor::Return() {
@@ -411,10 +712,15 @@ void DiskIoMgr::BufferDescriptor::Return() {
 DiskIoMgr::DiskIoMgr() :
     num_threads_per_disk_(FLAGS_num_threads_per_disk),
     max_read_size_(FLAGS_read_size),
+    read_ahead_bytes_(max(0, FLAGS_read_ahead_bytes)),
     shut_down_(false),
     total_bytes_read_counter_(TCounterType::BYTES),
     read_timer_(TCounterType::CPU_TICKS),
-    num_allocated_buffers_(0) {
+    total_bytes_written_counter_(TCounterType::BYTES),
+    write_timer_(TCounterType::CPU_TICKS),
+    free_buffers_(1),
+    num_allocated_buffers_(0),
+    mem_tracker_(NULL) {
   int num_disks = FLAGS_num_disks;
   if (num_disks == 0) num_disks = DiskInfo::num_disks();
   disk_queues_.resize(num_disks);
@@ -423,10 +729,15 @@ DiskIoMgr::DiskIoMgr() :
 DiskIoMgr::DiskIoMgr(int num_disks, int threads_per_disk, int max_read_size) :
     num_threads_per_disk_(threads_per_disk),
     max_read_size_(max_read_size),
+    read_ahead_bytes_(max(0, FLAGS_read_ahead_bytes)),
     shut_down_(false),
     total_bytes_read_counter_(TCounterType::BYTES),
     read_timer_(TCounterType::CPU_TICKS),
-    num_allocated_buffers_(0) {
+    total_bytes_written_counter_(TCounterType::BYTES),
+    write_timer_(TCounterType::CPU_TICKS),
+    free_buffers_(1),
+    num_allocated_buffers_(0),
+    mem_tracker_(NULL) {
   if (num_disks == 0) num_disks = DiskInfo::num_disks();
   disk_queues_.resize(num_disks);
 }
@@ -452,15 +763,36 @@ DiskIoMgr::~DiskIoMgr() {
       DCHECK_EQ((*reader)->disk_states_[disk_id].num_threads_in_read, 0);
       DecrementDiskRefCount(*reader);
     }
+    list<WriteRange*>& write_ranges = disk_queues_[i]->write_ranges;
+    for (list<WriteRange*>::iterator it = write_ranges.begin();
+        it != write_ranges.end(); ++it) {
+      (*it)->callback_(Status::CANCELLED);
+    }
+    write_ranges.clear();
   } 
 
   DCHECK(reader_cache_->ValidateAllInactive()) << endl << DebugString();
+
+  if (block_cache_.get() != NULL) {
+    vector<char*> freed;
+    block_cache_->Clear(&freed);
+    for (int i = 0; i < freed.size(); ++i) {
+      ReturnFreeBuffer(freed[i]);
+    }
+  }
   
   // Delete all allocated buffers
-  DCHECK_EQ(num_allocated_buffers_, free_buffers_.size());
-  for (list<char*>::iterator iter = free_buffers_.begin();
-      iter != free_buffers_.end(); ++iter) {
-    delete *iter;
+  int num_free_buffers = 0;
+  for (int i = 0; i < free_buffers_.size(); ++i) {
+    for (list<char*>::iterator iter = free_buffers_[i].begin();
+        iter != free_buffers_[i].end(); ++iter) {
+      HugePageAllocator::Free(*iter, buffer_size());
+      ++num_free_buffers;
+    }
+  }
+  DCHECK_EQ(num_allocated_buffers_, num_free_buffers);
+  if (mem_tracker_ != NULL) {
+    mem_tracker_->Release(static_cast<int64_t>(num_allocated_buffers_) * buffer_size());
   }
 
   for (int i = 0; i < disk_queues_.size(); ++i) {
@@ -468,15 +800,43 @@ DiskIoMgr::~DiskIoMgr() {
   }
 }
 
-Status DiskIoMgr::Init() {
+Status DiskIoMgr::Init(MemTracker* process_mem_tracker, Metrics* metrics) {
+  mem_tracker_ = process_mem_tracker;
+  bool numa_aware = FLAGS_numa_aware_io && CpuInfo::num_numa_nodes() > 1;
+  if (numa_aware) free_buffers_.resize(CpuInfo::num_numa_nodes());
   for (int i = 0; i < disk_queues_.size(); ++i) {
     disk_queues_[i] = new DiskQueue(i);
-    for (int j = 0; j < num_threads_per_disk_; ++j) {
+    if (numa_aware && i < DiskInfo::num_disks()) {
+      int node = DiskInfo::numa_node(i);
+      if (node < CpuInfo::num_numa_nodes()) disk_queues_[i]->numa_node = node;
+    }
+    // Before the disk threads start, so that they see the metrics.
+    if (metrics != NULL) disk_queues_[i]->RegisterMetrics(metrics);
+    int num_threads = num_threads_per_disk_;
+    if (num_threads == 0) {
+      // There can be more disk queues than disks (FLAGS_num_disks), treat the
+      // extra ones as rotational.
+      bool is_rotational = i >= DiskInfo::num_disks() || DiskInfo::is_rotational(i);
+      num_threads = is_rotational ?
+          FLAGS_num_threads_per_rotational_disk : FLAGS_num_threads_per_flash_disk;
+    }
+    DCHECK_GT(num_threads, 0);
+    VLOG_QUERY << "Starting " << num_threads << " io threads for disk " << i;
+    for (int j = 0; j < num_threads; ++j) {
       disk_thread_group_.add_thread(
           new thread(&DiskIoMgr::ReadLoop, this, disk_queues_[i]));
     }
   }
   reader_cache_.reset(new ReaderCache(this));
+  if (FLAGS_block_cache_capacity > 0) {
+    block_cache_.reset(new BlockCache(FLAGS_block_cache_capacity, max_read_size_));
+    vector<string> pinned_paths;
+    split(pinned_paths, FLAGS_block_cache_pinned_paths, is_any_of(","),
+        token_compress_on);
+    for (int i = 0; i < pinned_paths.size(); ++i) {
+      if (!pinned_paths[i].empty()) block_cache_->PinPath(pinned_paths[i]);
+    }
+  }
   return Status::OK;
 }
 
@@ -573,10 +933,77 @@ void DiskIoMgr::set_bytes_read_counter(ReaderContext* r, RuntimeProfile::Counter
   r->bytes_read_counter_ = c;
 }
 
+void DiskIoMgr::IncreaseBuffers(ReaderContext* reader, int num_buffers) {
+  DCHECK_GT(num_buffers, 0);
+  for (int i = 0; i < disk_queues_.size(); ++i) {
+    DiskQueue* disk_queue = disk_queues_[i];
+    {
+      unique_lock<mutex> disk_lock(disk_queue->lock);
+      unique_lock<mutex> reader_lock(reader->lock_);
+      if (reader->state_ != ReaderContext::Active) return;
+      // The limit is raised before any disk gets the buffers, so the buffer counts
+      // stay within it.
+      if (i == 0) reader->num_buffers_per_disk_ += num_buffers;
+      ReaderContext::PerDiskState& state = reader->disk_states_[i];
+      state.num_empty_buffers += num_buffers;
+      reader->num_empty_buffers_ += num_buffers;
+      DCHECK(reader->Validate()) << endl << reader->DebugString();
+      // The reader is not on the queue if it ran out of buffers on this disk.
+      if (state.is_on_queue || state.ranges.empty()) continue;
+      state.is_on_queue = true;
+      disk_queue->AddReader(reader);
+    }
+    disk_queue->work_available.notify_all();
+  }
+}
+
+void DiskIoMgr::set_weight(ReaderContext* r, int weight) {
+  DCHECK_GT(weight, 0);
+  DCHECK_EQ(r->num_remaining_scan_ranges_, 0) << "Set the weight before adding ranges";
+  r->weight_ = weight;
+}
+
 int64_t DiskIoMgr::GetReadThroughput() {
   return RuntimeProfile::UnitsPerSecond(&total_bytes_read_counter_, &read_timer_);
 }
 
+int64_t DiskIoMgr::GetWriteThroughput() {
+  return RuntimeProfile::UnitsPerSecond(&total_bytes_written_counter_, &write_timer_);
+}
+
+int DiskIoMgr::GetQueueLength() {
+  int queue_length = 0;
+  for (int i = 0; i < disk_queues_.size(); ++i) {
+    DiskQueue* queue = disk_queues_[i];
+    lock_guard<mutex> l(queue->lock);
+    queue_length += queue->readers.size() + queue->write_ranges.size();
+  }
+  return queue_length;
+}
+
+Status DiskIoMgr::AddWriteRange(WriteRange* range) {
+  DCHECK(range->file_ != NULL);
+  int disk_id = range->disk_id_;
+  if (disk_id < 0 || disk_id >= disk_queues_.size()) {
+    stringstream ss;
+    ss << "Invalid write range.  Bad disk id: " << disk_id;
+    DCHECK(false) << ss.str();
+    return Status(ss.str());
+  }
+  DiskQueue* disk_queue = disk_queues_[disk_id];
+  {
+    unique_lock<mutex> lock(disk_queue->lock);
+    // As for readers (AddReader()), writes that were idle don't get to catch up.
+    if (disk_queue->write_ranges.empty()) {
+      disk_queue->write_vtime = max(disk_queue->write_vtime, disk_queue->vtime);
+    }
+    disk_queue->write_ranges.push_back(range);
+    disk_queue->UpdateQueueLength();
+  }
+  disk_queue->work_available.notify_one();
+  return Status::OK;
+}
+
 Status DiskIoMgr::AddScanRanges(ReaderContext* reader, const vector<ScanRange*>& ranges) {
   DCHECK(!ranges.empty());
 
@@ -625,7 +1052,7 @@ Status DiskIoMgr::AddScanRanges(ReaderContext* reader, const vector<ScanRange*>&
   for (int i = 0; i < disks_to_add.size(); ++i) {
     {
       unique_lock<mutex> lock(disks_to_add[i]->lock);
-      disks_to_add[i]->readers.push_back(reader);
+      disks_to_add[i]->AddReader(reader);
     }
     disks_to_add[i]->work_available.notify_all();
   }
@@ -717,8 +1144,7 @@ void DiskIoMgr::ReturnBuffer(BufferDescriptor* buffer_desc) {
   // Null buffer meant there was an error or GetNext was called after eos.  Protect
   // against returning those buffers.
   if (buffer_desc->buffer_ != NULL) {
-    ReturnFreeBuffer(buffer_desc->buffer_);
-    buffer_desc->buffer_ = NULL;
+    FreeBufferMemory(buffer_desc);
 
     ReaderContext* reader = buffer_desc->reader_;
     if (reader != NULL) {
@@ -746,7 +1172,7 @@ void DiskIoMgr::ReturnBuffer(BufferDescriptor* buffer_desc) {
           ((reader->state_ == ReaderContext::Cancelled && state.num_threads_in_read == 0) 
           || !state.ranges.empty())) {
         reader->disk_states_[disk_id].is_on_queue = true;
-        disk_queue->readers.push_back(reader);
+        disk_queue->AddReader(reader);
         disk_queue->work_available.notify_one();
       }
     } 
@@ -778,21 +1204,54 @@ DiskIoMgr::BufferDescriptor* DiskIoMgr::GetBufferDesc(
 }
 
 char* DiskIoMgr::GetFreeBuffer() {
+  int num_nodes = free_buffers_.size();
+  int node = num_nodes == 1 ? 0 : CpuInfo::GetCurrentNumaNode();
   unique_lock<mutex> lock(free_buffers_lock_);
-  if (free_buffers_.empty()) {
-    ++num_allocated_buffers_;
-    return new char[max_read_size_];
-  } else {
-    char* buffer = free_buffers_.front();
-    free_buffers_.pop_front();
+  // A buffer of the calling thread's node, or else a remote one rather than more
+  // memory.
+  for (int i = 0; i < num_nodes; ++i) {
+    list<char*>* buffers = &free_buffers_[(node + i) % num_nodes];
+    if (buffers->empty()) continue;
+    char* buffer = buffers->front();
+    buffers->pop_front();
     return buffer;
   }
+  ++num_allocated_buffers_;
+  if (mem_tracker_ != NULL) mem_tracker_->Consume(buffer_size());
+  char* buffer = reinterpret_cast<char*>(HugePageAllocator::Allocate(buffer_size()));
+  // The memory is placed when the caller (usually a disk thread) first writes it.
+  if (num_nodes > 1) buffer_numa_nodes_[buffer] = node;
+  return buffer;
 }
 
 void DiskIoMgr::ReturnFreeBuffer(char* buffer) {
   DCHECK(buffer != NULL);
   unique_lock<mutex> lock(free_buffers_lock_);
-  free_buffers_.push_back(buffer);
+  int node = 0;
+  if (free_buffers_.size() > 1) {
+    map<char*, int>::iterator it = buffer_numa_nodes_.find(buffer);
+    DCHECK(it != buffer_numa_nodes_.end());
+    node = it->second;
+  }
+  free_buffers_[node].push_back(buffer);
+}
+
+void DiskIoMgr::FreeBufferMemory(BufferDescriptor* buffer_desc) {
+  if (buffer_desc->cached_block_ != NULL) {
+    // The buffer belongs to the block cache, unless the block was evicted since.
+    char* buffer = block_cache_->Release(buffer_desc->cached_block_);
+    if (buffer != NULL) ReturnFreeBuffer(buffer);
+    buffer_desc->cached_block_ = NULL;
+  } else if (buffer_desc->mapped_) {
+    if (buffer_desc->mmap_base_ != NULL) {
+      munmap(buffer_desc->mmap_base_, buffer_desc->mmap_len_);
+      buffer_desc->mmap_base_ = NULL;
+      buffer_desc->mmap_len_ = 0;
+    }
+  } else if (buffer_desc->buffer_ != NULL) {
+    ReturnFreeBuffer(buffer_desc->buffer_);
+  }
+  buffer_desc->buffer_ = NULL;
 }
 
 string DiskIoMgr::DebugString() {
@@ -810,6 +1269,9 @@ string DiskIoMgr::DebugString() {
         ss << (void*)*it;
       }
     }
+    if (!disk_queues_[i]->write_ranges.empty()) {
+      ss << " Writes: " << disk_queues_[i]->write_ranges.size();
+    }
     ss << endl;
   }
   return ss.str();
@@ -824,44 +1286,52 @@ void DiskIoMgr::DecrementDiskRefCount(ReaderContext* reader) {
   DCHECK(reader->Validate()) << endl << reader->DebugString();
 }
 
-Status DiskIoMgr::OpenScanRange(hdfsFS hdfs_connection, ScanRange* range) const {
-  if (hdfs_connection != NULL) {
-    if (range->hdfs_file_ != NULL) return Status::OK;
+Status DiskIoMgr::OpenScanRange(DiskQueue* disk_queue, hdfsFS hdfs_connection,
+    ScanRange* range) const {
+  // The union members alias, so this checks for either kind of handle.
+  if (range->local_file_ != NULL) return Status::OK;
 
-    // TODO: is there much overhead opening hdfs files?  Should we try to preserve
-    // the handle across multiple scan ranges of a file?
+  if (range->mtime_ != 0 && FLAGS_max_cached_file_handles_per_disk > 0) {
+    CachedFileHandle handle(FileHandleKey(hdfs_connection, range->file_, range->mtime_));
+    if (disk_queue->GetFileHandle(handle.key, &handle)) {
+      range->local_file_ = handle.local_file;
+      return Status::OK;
+    }
+  }
+
+  if (hdfs_connection != NULL) {
     range->hdfs_file_ = 
         hdfsOpenFile(hdfs_connection, range->file_, O_RDONLY, 0, 0, 0);
     if (range->hdfs_file_ == NULL) {
       return Status(AppendHdfsErrorMessage("Failed to open HDFS file ", range->file_));
     }
-
-    if (hdfsSeek(hdfs_connection, range->hdfs_file_, range->offset_) != 0) {
-      stringstream ss;
-      ss << "Error seeking to " << range->offset_ << " in file: " << range->file_;
-      return Status(AppendHdfsErrorMessage(ss.str()));
-    }
   } else {
-    if (range->local_file_ != NULL) return Status::OK;
-
     range->local_file_ = fopen(range->file_, "r");
     if (range->local_file_ == NULL) {
       stringstream ss;
       ss << "Could not open file: " << range->file_ << ": " << strerror(errno);
       return Status(ss.str());
     }
-    if (fseek(range->local_file_, range->offset_, SEEK_SET) == -1) {
-      stringstream ss;
-      ss << "Could not seek to " << range->offset_ << " for file: " << range->file_
-         << ": " << strerror(errno);
-      return Status(ss.str());
-    }
   } 
   return Status::OK;
 }
 
-void DiskIoMgr::CloseScanRange(hdfsFS hdfs_connection, ScanRange* range) const {
+void DiskIoMgr::CloseScanRange(DiskQueue* disk_queue, hdfsFS hdfs_connection,
+    ScanRange* range, bool cache_handle) const {
   if (range == NULL) return;
+
+  if (cache_handle && range->local_file_ != NULL && range->mtime_ != 0 &&
+      FLAGS_max_cached_file_handles_per_disk > 0) {
+    CachedFileHandle handle(FileHandleKey(hdfs_connection, range->file_, range->mtime_));
+    handle.local_file = range->local_file_;
+    range->local_file_ = NULL;
+    CachedFileHandle evicted(handle.key);
+    if (disk_queue->CacheFileHandle(
+        handle, FLAGS_max_cached_file_handles_per_disk, &evicted)) {
+      evicted.Close();
+    }
+    return;
+  }
  
   if (hdfs_connection != NULL) {
     if (range->hdfs_file_ == NULL) return;
@@ -874,22 +1344,34 @@ void DiskIoMgr::CloseScanRange(hdfsFS hdfs_connection, ScanRange* range) const {
   }
 }
 
+// Reads are positional (pread), so they do not depend on (or move) the position of
+// the file handle.  A handle can then serve reads of several ranges from different
+// threads, and the handle does not need to be seeked when the range is opened.
+// For hdfs, node-local replicas are read by the hdfs client directly from the block
+// files (bypassing the DataNode) when dfs.client.read.shortcircuit is set; the
+// frontend logs a warning at startup if it is not.
 // TODO: how do we best use the disk here.  e.g. is it good to break up a
 // 1MB read into 8 128K reads?
 // TODO: look at linux disk scheduling
 Status DiskIoMgr::ReadFromScanRange(hdfsFS hdfs_connection, ScanRange* range, 
-    char* buffer, int64_t* bytes_read, bool* eosr) {
+    char* buffer, int64_t read_ahead, int64_t* bytes_read, int64_t* read_ahead_len,
+    bool* eosr) {
   *eosr = false;
   *bytes_read = 0;
-  int bytes_to_read = min(static_cast<int64_t>(max_read_size_), 
+  *read_ahead_len = 0;
+  int range_bytes = min(static_cast<int64_t>(max_read_size_), 
       range->len_ - range->bytes_read_);
+  // Only the last read of the range reads ahead, in the same io.
+  int bytes_to_read = range_bytes;
+  if (range->bytes_read_ + range_bytes == range->len_) bytes_to_read += read_ahead;
+  int64_t position = range->offset_ + range->bytes_read_;
 
   if (hdfs_connection != NULL) {
     DCHECK(range->hdfs_file_ != NULL);
     // TODO: why is this loop necessary? Can hdfs reads come up short?
     while (*bytes_read < bytes_to_read) {
-      int last_read = hdfsRead(hdfs_connection, range->hdfs_file_,
-          buffer + *bytes_read, bytes_to_read - *bytes_read);
+      int last_read = hdfsPread(hdfs_connection, range->hdfs_file_,
+          position + *bytes_read, buffer + *bytes_read, bytes_to_read - *bytes_read);
       if (last_read == -1) {
         return Status(
             AppendHdfsErrorMessage("Error reading from HDFS file: ", range->file_));
@@ -902,14 +1384,28 @@ Status DiskIoMgr::ReadFromScanRange(hdfsFS hdfs_connection, ScanRange* range,
     }
   } else {
     DCHECK(range->local_file_ != NULL);
-    *bytes_read = fread(buffer, 1, bytes_to_read, range->local_file_);
-    if (*bytes_read < 0) {
-      stringstream ss;
-      ss << "Could not read from " << range->file_ << " at byte offset: " 
-         << range->bytes_read_ << ": " << strerror(errno);
-      return Status(ss.str());
+    int fd = fileno(range->local_file_);
+    while (*bytes_read < bytes_to_read) {
+      ssize_t last_read = pread(fd, buffer + *bytes_read, bytes_to_read - *bytes_read,
+          position + *bytes_read);
+      if (last_read == -1) {
+        if (errno == EINTR) continue;
+        stringstream ss;
+        ss << "Could not read from " << range->file_ << " at byte offset: " 
+           << position + *bytes_read << ": " << strerror(errno);
+        return Status(ss.str());
+      } else if (last_read == 0) {
+        // No more bytes in the file.  The scan range went past the end
+        *eosr = true;
+        break;
+      }
+      *bytes_read += last_read;
     }
   }
+  if (*bytes_read > range_bytes) {
+    *read_ahead_len = *bytes_read - range_bytes;
+    *bytes_read = range_bytes;
+  }
   range->bytes_read_ += *bytes_read;
   DCHECK_LE(range->bytes_read_, range->len_);
   if (range->bytes_read_ == range->len_) {
@@ -918,13 +1414,104 @@ Status DiskIoMgr::ReadFromScanRange(hdfsFS hdfs_connection, ScanRange* range,
   return Status::OK;
 }
 
+bool DiskIoMgr::ReadFromBlockCache(ScanRange* range, BufferDescriptor* buffer_desc) {
+  if (block_cache_.get() == NULL || range->mtime_ == 0) return false;
+  int64_t bytes_to_read = min(static_cast<int64_t>(max_read_size_),
+      range->len_ - range->bytes_read_);
+  BlockCache::Block* block = block_cache_->Lookup(BlockCache::Key(range->file_,
+      range->mtime_, range->offset_ + range->bytes_read_, bytes_to_read));
+  if (block == NULL) return false;
+
+  // The io buffer picked for the read is not needed.
+  ReturnFreeBuffer(buffer_desc->buffer_);
+  buffer_desc->buffer_ = block->data();
+  buffer_desc->cached_block_ = block;
+  buffer_desc->len_ = block->len();
+  range->bytes_read_ += block->len();
+  DCHECK_LE(range->bytes_read_, range->len_);
+  buffer_desc->eosr_ = block->eof() || range->bytes_read_ == range->len_;
+  buffer_desc->scan_range_offset_ = range->bytes_read_ - buffer_desc->len_;
+  return true;
+}
+
+void DiskIoMgr::AddToBlockCache(ScanRange* range, int64_t bytes_to_read,
+    BufferDescriptor* buffer_desc) {
+  if (block_cache_.get() == NULL || range->mtime_ == 0) return;
+  if (buffer_desc->len_ == 0) return;
+  vector<char*> freed;
+  // A short read means the range went past the end of the file.
+  BlockCache::Block* block = block_cache_->Insert(BlockCache::Key(range->file_,
+      range->mtime_, range->offset_ + range->bytes_read_ - buffer_desc->len_,
+      bytes_to_read), buffer_desc->buffer_, buffer_desc->len_,
+      buffer_desc->len_ < bytes_to_read, &freed);
+  buffer_desc->cached_block_ = block;
+  for (int i = 0; i < freed.size(); ++i) {
+    ReturnFreeBuffer(freed[i]);
+  }
+}
+
+// The mapping is populated (MAP_POPULATE) so that the io happens here in the disk
+// thread and not as page faults in the reader.  It is private and writable since
+// scanners may modify the buffers in place; those pages are copied on write.
+// A buffer maps at most max_read_size_ bytes so that the reader's buffer limit
+// still bounds how far ahead of the reader it is.
+Status DiskIoMgr::MapFromScanRange(ScanRange* range, BufferDescriptor* buffer_desc) {
+  DCHECK(range->local_file_ != NULL);
+  DCHECK(buffer_desc->buffer_ == NULL);
+  buffer_desc->eosr_ = false;
+  buffer_desc->len_ = 0;
+  int fd = fileno(range->local_file_);
+  int64_t position = range->offset_ + range->bytes_read_;
+
+  struct stat file_stat;
+  if (fstat(fd, &file_stat) != 0) {
+    stringstream ss;
+    ss << "Could not stat " << range->file_ << ": " << strerror(errno);
+    return Status(ss.str());
+  }
+  int64_t bytes_to_map = min(static_cast<int64_t>(max_read_size_),
+      range->len_ - range->bytes_read_);
+  bytes_to_map = min(bytes_to_map, max<int64_t>(0, file_stat.st_size - position));
+
+  if (bytes_to_map == 0) {
+    // The scan range went past the end of the file.  There is nothing to map, return
+    // an empty io buffer.
+    buffer_desc->buffer_ = GetFreeBuffer();
+    buffer_desc->eosr_ = true;
+    return Status::OK;
+  }
+
+  static const int64_t page_size = sysconf(_SC_PAGESIZE);
+  int64_t map_offset = position - position % page_size;
+  int64_t map_len = bytes_to_map + (position - map_offset);
+  void* base = mmap(NULL, map_len, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_POPULATE,
+      fd, map_offset);
+  if (base == MAP_FAILED) {
+    stringstream ss;
+    ss << "Could not map " << range->file_ << " at byte offset: " << position
+       << ": " << strerror(errno);
+    return Status(ss.str());
+  }
+  buffer_desc->mapped_ = true;
+  buffer_desc->mmap_base_ = reinterpret_cast<char*>(base);
+  buffer_desc->mmap_len_ = map_len;
+  buffer_desc->buffer_ = buffer_desc->mmap_base_ + (position - map_offset);
+  buffer_desc->len_ = bytes_to_map;
+
+  range->bytes_read_ += bytes_to_map;
+  DCHECK_LE(range->bytes_read_, range->len_);
+  if (range->bytes_read_ == range->len_) {
+    buffer_desc->eosr_ = true;
+  }
+  return Status::OK;
+}
+
 void DiskIoMgr::RemoveReaderFromDiskQueue(DiskQueue* disk_queue, ReaderContext* reader) {
   DCHECK(reader->disk_states_[disk_queue->disk_id].is_on_queue);
   reader->disk_states_[disk_queue->disk_id].is_on_queue = false;
   list<ReaderContext*>::iterator it = disk_queue->readers.begin();
   for (; it != disk_queue->readers.end(); ++it) {
     if (*it == reader) {
-      if (it == disk_queue->next_reader) ++disk_queue->next_reader;
       disk_queue->readers.erase(it);
       return;
     }
@@ -936,32 +1523,47 @@ void DiskIoMgr::RemoveReaderFromDiskQueue(DiskQueue* disk_queue, ReaderContext*
 //  - wait until there is a reader with work and available buffer or the thread should
 //    terminate.  Note: the disk's reader queue only contains readers that have both work
 //    and buffers so this thread does not have to busy spin on readers.
-//  - Remove the scan range, available buffer and cycle to the next reader
+//  - Remove the scan range, available buffer and charge the reader for the read
 // There are a few guarantees this makes which causes some complications.
-//  1) Readers are round-robined. 
+//  1) Readers get the disk in proportion to their weights (weighted fair queuing):
+//     each read is charged to the reader's virtual time as read_size / weight and
+//     the reader with the lowest virtual time is served next.  Readers that are
+//     backlogged (not consuming their buffers) are only served if no other reader
+//     can use the disk, so a reader that is cpu bound does not hold buffers (and
+//     disk time) that a faster reader could use.  With equal weights and no backlog
+//     this is a round robin.
 //  2) Multiple threads (including per disk) can work on the same reader.
 //  3) Scan ranges within a reader are round-robined.
+//  4) The queued writes are one more participant in 1), with weight 1 and charged
+//     the bytes written.
 bool DiskIoMgr::GetNextScanRange(DiskQueue* disk_queue, ScanRange** range, 
-    ReaderContext** reader, char** buffer) {
+    ReaderContext** reader, char** buffer, WriteRange** write_range) {
   // This loops returns either with work to do or when the disk io mgr shuts down.
   while (true) {
     unique_lock<mutex> disk_lock(disk_queue->lock);
 
-    while (!shut_down_ && disk_queue->readers.empty()) {
-      // wait if there are no readers on the queue
+    while (!shut_down_ && disk_queue->readers.empty() &&
+        disk_queue->write_ranges.empty()) {
+      // wait if there are no readers or writes on the queue
       disk_queue->work_available.wait(disk_lock);
     }
     if (shut_down_) break;
-    DCHECK(!disk_queue->readers.empty());
-
-    // Get reader and advance to the next reader
-    if (disk_queue->next_reader == disk_queue->readers.end()) {
-      disk_queue->next_reader = disk_queue->readers.begin();
+    disk_queue->UpdateQueueLength();
+
+    list<ReaderContext*>::iterator reader_it = disk_queue->readers.end();
+    if (!disk_queue->readers.empty()) reader_it = disk_queue->NextReader();
+
+    // Serve a write if the writes are behind the next reader in virtual time.
+    if (!disk_queue->write_ranges.empty() && (reader_it == disk_queue->readers.end() ||
+        disk_queue->write_vtime <=
+            (*reader_it)->disk_states_[disk_queue->disk_id].vtime)) {
+      *write_range = disk_queue->write_ranges.front();
+      disk_queue->write_ranges.pop_front();
+      disk_queue->vtime = disk_queue->write_vtime;
+      disk_queue->write_vtime += (*write_range)->len_;
+      return true;
     }
-    DCHECK(disk_queue->next_reader != disk_queue->readers.end());
-
-    list<ReaderContext*>::iterator reader_it = disk_queue->next_reader;
-    ++disk_queue->next_reader;
+    DCHECK(reader_it != disk_queue->readers.end());
     *reader = *reader_it;
     
     // Grab reader lock, both locks are held now
@@ -972,7 +1574,6 @@ bool DiskIoMgr::GetNextScanRange(DiskQueue* disk_queue, ScanRange** range,
     
     // Check if reader has been cancelled
     if ((*reader)->state_ == ReaderContext::Cancelled) {
-      DCHECK(disk_queue->next_reader != reader_it);
       disk_queue->readers.erase(reader_it);
       state.is_on_queue = false;
       if (state.num_threads_in_read == 0) {
@@ -994,11 +1595,18 @@ bool DiskIoMgr::GetNextScanRange(DiskQueue* disk_queue, ScanRange** range,
     ++state.num_threads_in_read;
     
     // Get a free buffer from the disk io mgr.  It's a global pool for all readers but
-    // they are lazily allocated.  Each reader is guaranteed its share.
-    *buffer = GetFreeBuffer();
+    // they are lazily allocated.  Each reader is guaranteed its share.  Readers that
+    // map their files don't need one, but the buffer counts still limit how many
+    // mappings they have.
+    *buffer = (*reader)->mmap_files_ ? NULL : GetFreeBuffer();
     --(*reader)->num_empty_buffers_;
     --state.num_empty_buffers;
-    DCHECK(*buffer != NULL);
+    DCHECK((*reader)->mmap_files_ || *buffer != NULL);
+
+    // Charge the reader for the read.  The disk's virtual time follows the readers
+    // it serves.
+    disk_queue->vtime = state.vtime;
+    state.vtime += max_read_size_ / (*reader)->weight_;
 
     // Round robin ranges 
     *range = *state.ranges.begin();
@@ -1010,7 +1618,6 @@ bool DiskIoMgr::GetNextScanRange(DiskQueue* disk_queue, ScanRange** range,
       // the reader from the disk queue.  We don't want another disk thread to
       // pick up this reader when it can't do work.  The reader is added back
       // on the queue when the scan range is read or when the buffer is returned.
-      DCHECK(disk_queue->next_reader != reader_it);
       disk_queue->readers.erase(reader_it);
       state.is_on_queue = false;
     }
@@ -1032,7 +1639,7 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
     
     DCHECK(reader->Validate()) << endl << reader->DebugString();
     DCHECK_GT(state.num_threads_in_read, 0);
-    DCHECK(buffer->buffer_ != NULL);
+    DCHECK(buffer->buffer_ != NULL || !buffer->status_.ok());
 
     --state.num_threads_in_read;
 
@@ -1042,11 +1649,10 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
       if (state.is_on_queue) {
         RemoveReaderFromDiskQueue(disk_queue, reader);
       }
-      CloseScanRange(reader->hdfs_connection_, buffer->scan_range_);
+      CloseScanRange(disk_queue, reader->hdfs_connection_, buffer->scan_range_, true);
       ++reader->num_empty_buffers_;
       ++state.num_empty_buffers;
-      ReturnFreeBuffer(buffer->buffer_);
-      buffer->buffer_ = NULL;
+      FreeBufferMemory(buffer);
       ReturnBufferDesc(buffer);
       if (state.num_threads_in_read == 0) {
         state.num_scan_ranges = 0;
@@ -1056,18 +1662,18 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
     }
         
     DCHECK_EQ(reader->state_, ReaderContext::Active);
-    DCHECK(buffer->buffer_ != NULL);
+    DCHECK(buffer->buffer_ != NULL || !buffer->status_.ok());
 
     // Update the reader's scan ranges.  There are a three cases here:
     //  1. Read error
     //  2. End of scan range
     //  3. Middle of scan range
     if (!buffer->status_.ok()) {
-      CloseScanRange(reader->hdfs_connection_, buffer->scan_range_);
+      // Don't keep the handle of a file that failed to read.
+      CloseScanRange(disk_queue, reader->hdfs_connection_, buffer->scan_range_, false);
       ++reader->num_empty_buffers_;
       ++state.num_empty_buffers;
-      ReturnFreeBuffer(buffer->buffer_);
-      buffer->buffer_ = NULL;
+      FreeBufferMemory(buffer);
       buffer->eosr_ = true;
     } else {
       if (!buffer->eosr_) {
@@ -1092,7 +1698,7 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
         }
         state.ranges.insert(it, buffer->scan_range_);
       } else {
-        CloseScanRange(reader->hdfs_connection_, buffer->scan_range_);
+        CloseScanRange(disk_queue, reader->hdfs_connection_, buffer->scan_range_, true);
       }
     }
 
@@ -1112,7 +1718,7 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
         // The reader could have been removed by the thread working on the last 
         // scan range or last buffer.  In that case, we need to add the reader back 
         // on the disk queue since there is still more work to do.
-        disk_queue->readers.push_back(reader);
+        disk_queue->AddReader(reader);
         state.is_on_queue = true;
       }
     }
@@ -1133,41 +1739,122 @@ void DiskIoMgr::HandleReadFinished(DiskQueue* disk_queue, ReaderContext* reader,
 //   3. HandleReadFinished(): Take locks and update the disk and reader with the 
 //      results of the io.
 // Cancellation checking needs to happen in both steps 1 and 3.
+Status DiskIoMgr::Write(WriteRange* range) {
+  SCOPED_TIMER(&write_timer_);
+  int fd = open(range->file_, O_WRONLY);
+  if (fd < 0) {
+    stringstream ss;
+    ss << "Could not open file " << range->file_ << " for writing: " << strerror(errno);
+    return Status(ss.str());
+  }
+  int64_t bytes_written = 0;
+  while (bytes_written < range->len_) {
+    ssize_t ret = pwrite(fd, range->data_ + bytes_written, range->len_ - bytes_written,
+        range->offset_ + bytes_written);
+    if (ret < 0) {
+      if (errno == EINTR) continue;
+      stringstream ss;
+      ss << "Error writing to file " << range->file_ << " at offset "
+         << range->offset_ + bytes_written << ": " << strerror(errno);
+      close(fd);
+      return Status(ss.str());
+    }
+    bytes_written += ret;
+  }
+  COUNTER_UPDATE(&total_bytes_written_counter_, bytes_written);
+  if (close(fd) != 0) {
+    stringstream ss;
+    ss << "Error closing file " << range->file_ << ": " << strerror(errno);
+    return Status(ss.str());
+  }
+  return Status::OK;
+}
+
 void DiskIoMgr::ReadLoop(DiskQueue* disk_queue) {
+  if (disk_queue->numa_node >= 0
+      && !CpuInfo::PinThreadToNumaNode(disk_queue->numa_node)) {
+    LOG(WARNING) << "Could not run the io thread of disk " << disk_queue->disk_id
+                 << " on NUMA node " << disk_queue->numa_node;
+  }
   while (true) {
     char* buffer = NULL;
     ReaderContext* reader = NULL;;
     ScanRange* range = NULL;
+    WriteRange* write_range = NULL;
     
     // Get the next scan range to read
-    if (!GetNextScanRange(disk_queue, &range, &reader, &buffer)) {
+    if (!GetNextScanRange(disk_queue, &range, &reader, &buffer, &write_range)) {
       DCHECK(shut_down_);
       break;
     }
+    if (write_range != NULL) {
+      // The callback can queue the next write or free the range, so the status needs
+      // to be computed first.
+      if (disk_queue->active_ios_metric != NULL) {
+        disk_queue->active_ios_metric->Increment(1);
+      }
+      Status status = Write(write_range);
+      if (disk_queue->active_ios_metric != NULL) {
+        disk_queue->active_ios_metric->Increment(-1);
+        if (status.ok()) disk_queue->bytes_written_metric->Increment(write_range->len_);
+      }
+      write_range->callback_(status);
+      continue;
+    }
     DCHECK(range != NULL);
     DCHECK(reader != NULL);
-    DCHECK(buffer != NULL);
+    DCHECK(reader->mmap_files_ || buffer != NULL);
 
     BufferDescriptor* buffer_desc = GetBufferDesc(reader, range, buffer);
     DCHECK(buffer_desc != NULL);
 
     // No locks in this section.  Only working on local vars.  We don't want to hold a 
     // lock across the read call.
-    buffer_desc->status_ = OpenScanRange(reader->hdfs_connection_, range);
-    if (buffer_desc->status_.ok()) {
-      // Update counters.
-      SCOPED_TIMER(&read_timer_);
-      SCOPED_TIMER(reader->read_timer_);
-      
-      buffer_desc->status_ = ReadFromScanRange(
-          reader->hdfs_connection_, range, buffer, &buffer_desc->len_,
-          &buffer_desc->eosr_);
-      buffer_desc->scan_range_offset_ = range->bytes_read_ - buffer_desc->len_;
-    
+    if (!reader->mmap_files_ && ReadFromBlockCache(range, buffer_desc)) {
+      // Served from memory, this does not count as io.
       if (reader->bytes_read_counter_ != NULL) {
         COUNTER_UPDATE(reader->bytes_read_counter_, buffer_desc->len_);
       }
-      COUNTER_UPDATE(&total_bytes_read_counter_, buffer_desc->len_);
+    } else {
+      buffer_desc->status_ = OpenScanRange(disk_queue, reader->hdfs_connection_, range);
+      if (buffer_desc->status_.ok()) {
+        // Update counters.
+        SCOPED_TIMER(&read_timer_);
+        SCOPED_TIMER(reader->read_timer_);
+        StopWatch read_watch;
+        read_watch.Start();
+        if (disk_queue->active_ios_metric != NULL) {
+          disk_queue->active_ios_metric->Increment(1);
+        }
+
+        if (reader->mmap_files_) {
+          buffer_desc->status_ = MapFromScanRange(range, buffer_desc);
+        } else {
+          int64_t bytes_to_read = min(static_cast<int64_t>(max_read_size_),
+              range->len_ - range->bytes_read_);
+          // Sync reads are the reads past the end of a range themselves.
+          buffer_desc->status_ = ReadFromScanRange(reader->hdfs_connection_, range,
+              buffer, reader->sync_reader_ ? 0 : read_ahead_bytes_, &buffer_desc->len_,
+              &buffer_desc->read_ahead_len_, &buffer_desc->eosr_);
+          if (buffer_desc->status_.ok()) {
+            AddToBlockCache(range, bytes_to_read, buffer_desc);
+          }
+        }
+        buffer_desc->scan_range_offset_ = range->bytes_read_ - buffer_desc->len_;
+        read_watch.Stop();
+        if (disk_queue->active_ios_metric != NULL) {
+          disk_queue->active_ios_metric->Increment(-1);
+          if (buffer_desc->status_.ok()) {
+            disk_queue->RecordRead(buffer_desc->len_, read_watch.ElapsedTime(),
+                reader->hdfs_connection_ != NULL);
+          }
+        }
+
+        if (reader->bytes_read_counter_ != NULL) {
+          COUNTER_UPDATE(reader->bytes_read_counter_, buffer_desc->len_);
+        }
+        COUNTER_UPDATE(&total_bytes_read_counter_, buffer_desc->len_);
+      }
     }
 
     // Finished read, update reader/disk based on the results
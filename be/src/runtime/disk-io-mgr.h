@@ -17,7 +17,9 @@
 #define IMPALA_RUNTIME_DISK_IO_MGR_H
 
 #include <list>
+#include <map>
 #include <vector>
+#include <boost/function.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/condition_variable.hpp>
@@ -27,10 +29,14 @@
 #include "common/hdfs.h"
 #include "common/object-pool.h"
 #include "common/status.h"
+#include "runtime/block-cache.h"
 #include "util/runtime-profile.h"
 
 namespace impala {
 
+class MemTracker;
+class Metrics;
+
 // Manager object that schedules IO for all queries on all disks.  Each query maps
 // to one or more readers, each of which has its own queue of scan ranges.  The
 // API splits up requesting scan ranges (non-blocking) and reading the data (blocking).
@@ -60,6 +66,12 @@ namespace impala {
 // before the reader lock.
 // If multiple reader locks are needed, the locks should be taken in increasing reader
 // context addresses. TODO: we currently never do this.
+// Besides the readers, each disk queue has a queue of write ranges (AddWriteRange()).
+// The queued writes share the disk with the readers like one more reader of weight 1:
+// the disk threads serve whichever of the two has the lower virtual time, so neither
+// a burst of writes nor a busy scan starves the other.  Write buffers come from the
+// same free list as the io buffers (GetWriteBuffer()).  Writes are used for spilling
+// to local scratch files (see ScratchMgr).
 // TODO: IoMgr should be able to request additional scan ranges from the coordinator
 // to help deal with stragglers.
 // TODO: look into reducing the number of locks taken in the disk thread loop
@@ -75,14 +87,16 @@ class DiskIoMgr {
     ScanRange();
 
     // Resets this scan range object with the scan range description.
+    // mtime is the last modification time of the file, or 0 if it is not known.
     void Reset(const char* file, int64_t len, 
-        int64_t offset, int disk_id, void* metadata = NULL);
+        int64_t offset, int disk_id, void* metadata = NULL, int64_t mtime = 0);
    
     const char* file() const { return file_; }
     int64_t len() const { return len_; }
     int64_t offset() const { return offset_; }
     void* meta_data() const { return meta_data_; }
     int disk_id() const { return disk_id_; }
+    int64_t mtime() const { return mtime_; }
 
     void set_len(int64_t len) { len_ = len; }
     void set_offset(int64_t offset) { offset_ = offset; }
@@ -111,6 +125,12 @@ class DiskIoMgr {
     // id of the disk the data is on.  This is 0-indexed
     int disk_id_;    
 
+    // Last modification time of the file, 0 if unknown.  The file handle of a finished
+    // range is kept open by its disk queue for later ranges of the same file with the
+    // same mtime (see FLAGS_max_cached_file_handles_per_disk).  Handles are not reused
+    // for ranges without an mtime, since the file might have been replaced.
+    int64_t mtime_;
+
     // Reader/owner of the scan range
     ReaderContext* reader_;
 
@@ -121,12 +141,49 @@ class DiskIoMgr {
     };
 
     // Number of bytes read so far for this scan range
-    int bytes_read_;
+    int64_t bytes_read_;
   };
   
+  // Description of a write of a buffer to a local file, for AddWriteRange().
+  class WriteRange {
+   public:
+    // Called by the disk thread once the range was written, with the status of the
+    // write.  This must not block, since it holds up the disk.
+    typedef boost::function<void (const Status&)> WriteDoneCallback;
+
+    WriteRange();
+
+    // Resets this write range with the write description.  'data' must remain valid
+    // until the callback was called.
+    void Reset(const char* file, int64_t offset, int disk_id, const char* data,
+        int64_t len, const WriteDoneCallback& callback);
+
+    const char* file() const { return file_; }
+    int64_t offset() const { return offset_; }
+    int disk_id() const { return disk_id_; }
+    int64_t len() const { return len_; }
+
+   private:
+    friend class DiskIoMgr;
+
+    // Path to the file, which must exist
+    const char* file_;
+
+    // byte offset in the file to write at
+    int64_t offset_;
+
+    // id of the disk the file is on.  This is 0-indexed
+    int disk_id_;
+
+    const char* data_;
+    int64_t len_;
+    WriteDoneCallback callback_;
+  };
+
   // Buffer struct that is used by the reader and io mgr to pass read buffers.
   // It is is expected that only one thread has ownership of this object at a 
-  // time.
+  // time.  Buffers served from the block cache are shared with other readers, so
+  // readers must not modify the buffer contents.
   class BufferDescriptor {
    public:
     ScanRange* scan_range() { return scan_range_; }
@@ -134,6 +191,10 @@ class DiskIoMgr {
     int64_t len() { return len_; }
     bool eosr() { return eosr_; }
 
+    // Number of bytes past the end of the scan range that follow the len() bytes in
+    // the buffer (see --read_ahead_bytes).  Only the last buffer of a range has any.
+    int64_t read_ahead_len() { return read_ahead_len_; }
+
     // Returns the offset within the scan range that this buffer starts at
     int64_t scan_range_offset() const { return scan_range_offset_; }
 
@@ -161,6 +222,8 @@ class DiskIoMgr {
     
     // len of read contents
     int64_t len_;
+
+    int64_t read_ahead_len_;
     
     // true if the current scan range is complete
     bool eosr_;
@@ -169,13 +232,25 @@ class DiskIoMgr {
     Status status_;
 
     int64_t scan_range_offset_;
+
+    // If true, buffer_ points into a mapping of the file rather than to an io buffer.
+    // mmap_base_ and mmap_len_ are the (page aligned) mapping, which is unmapped
+    // when the buffer is returned.
+    bool mapped_;
+    char* mmap_base_;
+    int64_t mmap_len_;
+
+    // If non-NULL, buffer_ is the data of this block of the block cache, which the
+    // descriptor holds a reference to.
+    BlockCache::Block* cached_block_;
   };
   
   // Create a DiskIoMgr object.
   //  - num_disks: The number of disks the io mgr should use.  This is used for testing.
   //    Specify 0, to have the disk io mgr query the os for the number of disks.
   //  - threads_per_disk: number of read threads to create per disk.  This is also
-  //    the max queue depth.
+  //    the max queue depth.  Specify 0, to pick it for each disk from whether the
+  //    disk is rotational or flash (see FLAGS_num_threads_per_*_disk).
   //    TODO: make this more complicated?  global/per query buffers limits?
   //  - max_read_size: maximum read size (in bytes)
   DiskIoMgr(int num_disks, int threads_per_disk, int max_read_size);
@@ -188,7 +263,12 @@ class DiskIoMgr {
   ~DiskIoMgr();
 
   // Initialize the IoMgr.  Must be called once before any of the other APIs
-  Status Init();
+  // If 'process_mem_tracker' is non-NULL, the io buffers the io mgr allocates are
+  // charged against it.  The io mgr caches buffers for reuse, so they remain charged
+  // until the io mgr is destroyed.
+  // If 'metrics' is non-NULL, per disk metrics (queue length, active ios, read latency
+  // and throughput, bytes read and written) are registered in it.
+  Status Init(MemTracker* process_mem_tracker = NULL, Metrics* metrics = NULL);
 
   // Allocates tracking structure for this reader. Register a new reader which is
   // returned in *reader.
@@ -247,14 +327,42 @@ class DiskIoMgr {
   // thread safe.  Multiple threads can be calling Read() per reader at a time.
   Status Read(hdfsFS, ScanRange* range, BufferDescriptor** buffer);
 
+  // Queues 'range' on the write queue of its disk.  This call is non-blocking: the
+  // range's callback is called from a disk thread once it was written, or with
+  // CANCELLED if the io mgr is destroyed first.  The caller must not deallocate the
+  // range before that.  Only local files can be written.
+  Status AddWriteRange(WriteRange* range);
+
+  // Returns a buffer of read_buffer_size() bytes for the data of write ranges.  The
+  // buffers are recycled through the io buffer free list, so memory is shared between
+  // reads and writes.  The buffer must be given back with ReturnWriteBuffer().
+  char* GetWriteBuffer() { return GetFreeBuffer(); }
+  void ReturnWriteBuffer(char* buffer) { ReturnFreeBuffer(buffer); }
+
   void set_bytes_read_counter(ReaderContext*, RuntimeProfile::Counter*);
   void set_read_timer(ReaderContext*, RuntimeProfile::Counter*);
 
+  // Sets the reader's share of the disks relative to the other readers.  A disk
+  // with several readers does (roughly) weight times as much io for this reader as
+  // for a reader with weight 1 (the default).  Must be called before AddScanRanges().
+  void set_weight(ReaderContext*, int weight);
+
+  // Raises the reader's limit of io buffers per disk (io_buffers_per_disk in
+  // RegisterReader()) by 'num_buffers'.  This lets a reader whose consumers wait on
+  // io read further ahead.  Can be called at any time from any thread.
+  void IncreaseBuffers(ReaderContext*, int num_buffers);
+
   // Returns the read throughput across all readers.    
   // TODO: should this be a sliding window?  This should report metrics for the
   // last minute, hour and since the beginning.
   int64_t GetReadThroughput();
 
+  // Returns the write throughput of the write ranges.
+  int64_t GetWriteThroughput();
+
+  // Returns the number of readers and writes queued on all disks.
+  int GetQueueLength();
+
   // Returns the read buffer size
   int read_buffer_size() const { return max_read_size_; }
 
@@ -264,6 +372,10 @@ class DiskIoMgr {
   // Returns the number of allocated buffers.
   int num_allocated_buffers() const { return num_allocated_buffers_; }
 
+  // Returns the block cache (see FLAGS_block_cache_capacity), NULL if it is disabled.
+  // Tables can be pinned in the cache with its PinPath().
+  BlockCache* block_cache() { return block_cache_.get(); }
+
   // Dumps the disk io mgr queues (for readers and disks)
   std::string DebugString();
 
@@ -282,12 +394,18 @@ class DiskIoMgr {
   ObjectPool pool_;
 
   // Number of worker(read) threads per disk.  Also the max depth of queued
-  // work to the disk.
+  // work to the disk.  If 0, this depends on the type of each disk.
   int num_threads_per_disk_;
 
-  // Maximum read size.  This is also the size of each allocated buffer.
+  // Maximum read size.  The allocated buffers are read_ahead_bytes_ larger.
   int max_read_size_;
 
+  // Bytes the last read of a range reads past its end.
+  int read_ahead_bytes_;
+
+  // Size of each allocated buffer.
+  int buffer_size() const { return max_read_size_ + read_ahead_bytes_; }
+
   // Thread group containing all the worker threads.
   boost::thread_group disk_thread_group_;
 
@@ -301,17 +419,30 @@ class DiskIoMgr {
   // Total time spent in hdfs reading
   RuntimeProfile::Counter read_timer_;
 
+  // Total bytes written by the io mgr and the time spent writing them.
+  RuntimeProfile::Counter total_bytes_written_counter_;
+  RuntimeProfile::Counter write_timer_;
+
   // Contains all readers that the io mgr is tracking.  This includes readers that are
   // active as well as those in the process of being cancelled.  This is a cache
   // of reader objects that get recycled to minimize object allocations and lock
   // contention.
   boost::scoped_ptr<ReaderCache> reader_cache_;
 
-  // Protects free_buffers_ and free_buffer_descs_
+  // Cache of buffers read from files with an mtime, by file, offset and length.  The
+  // cached buffers are io buffers that are not on the free list.  NULL if disabled.
+  boost::scoped_ptr<BlockCache> block_cache_;
+
+  // Protects free_buffers_, buffer_numa_nodes_ and free_buffer_descs_
   boost::mutex free_buffers_lock_;
   
-  // List of free buffer descs that can be handed out to clients.
-  std::list<char*> free_buffers_;
+  // Free buffers that can be handed out to clients, by the NUMA node they were
+  // allocated on.  A single list unless --numa_aware_io applies.
+  std::vector<std::list<char*> > free_buffers_;
+
+  // The NUMA node of each allocated buffer, if there is more than one list of free
+  // buffers.
+  std::map<char*, int> buffer_numa_nodes_;
 
   // List of free buffer desc objects that can be handed out to clients
   std::list<BufferDescriptor*> free_buffer_descs_;
@@ -319,6 +450,9 @@ class DiskIoMgr {
   // Total number of allocated buffers, used for debugging.
   int num_allocated_buffers_;
 
+  // If non-NULL, allocated io buffers are charged against this tracker.
+  MemTracker* mem_tracker_;
+
   // Per disk queues.  This is static and created once at Init() time.
   // One queue is allocated for each disk on the system and indexed by disk id
   // TODO: try DiskQueue** instead of std::vector?
@@ -336,13 +470,17 @@ class DiskIoMgr {
   void ReturnBuffer(BufferDescriptor* buffer);
 
   // Returns a buffer to read into that is the size of max_read_size_.  If there is a
-  // free buffer in the 'free_buffers_', that is returned, otherwise a new one is 
-  // allocated.
+  // free buffer in the 'free_buffers_', preferably one of the calling thread's NUMA
+  // node, that is returned, otherwise a new one is allocated.
   char* GetFreeBuffer();
 
   // Returns a buffer to the free list.
   void ReturnFreeBuffer(char*);
 
+  // Releases the memory behind buffer_desc: unmaps it if it is mapped, otherwise
+  // returns the io buffer to the free list.  Sets buffer_desc->buffer_ to NULL.
+  void FreeBufferMemory(BufferDescriptor* buffer_desc);
+
   // Removes the reader from the queue.  Both the disk and reader locks should be
   // taken before.
   void RemoveReaderFromDiskQueue(DiskQueue* queue, ReaderContext* reader);
@@ -353,22 +491,45 @@ class DiskIoMgr {
   // There can be multiple threads per disk running this loop.
   void ReadLoop(DiskQueue* queue);
 
-  // Opens the file for 'range'.  This function only modifies memory in local
-  // variables and does not need to be synchronized.
+  // Opens the file for 'range', reusing a handle cached by 'disk_queue' if it has one
+  // for the file.  This function only modifies memory in local variables and the
+  // (separately locked) file handle cache and does not need to be synchronized.
   // if hdfs_connection is NULL, 'range' must be for a local file
-  Status OpenScanRange(hdfsFS hdfs_connection, ScanRange* range) const;
+  Status OpenScanRange(DiskQueue* disk_queue, hdfsFS hdfs_connection,
+      ScanRange* range) const;
 
-  // Closes the file for 'range'.  This function only modifies memory in local
-  // variables and does not need to be synchronized.
+  // Closes the file for 'range'.  If 'cache_handle' is true, the handle is left open
+  // in the file handle cache of 'disk_queue' instead, if the range's file has an mtime.
+  // This function only modifies memory in local variables and the file handle cache
+  // and does not need to be synchronized.
   // if hdfs_connection is NULL, 'range' must be for a local file
-  void CloseScanRange(hdfsFS hdfs_connection, ScanRange* range) const;
+  void CloseScanRange(DiskQueue* disk_queue, hdfsFS hdfs_connection, ScanRange* range,
+      bool cache_handle) const;
 
   // Reads from 'range' into 'buffer'.  Buffer is preallocated.  Returns the number
   // of bytes read.  Updates range to keep track of where in the file we are. 
+  // The last read of the range also reads up to 'read_ahead' bytes past its end,
+  // which are returned in *read_ahead_len and are not counted in *bytes_read.
   // Only modifies local variables and does not need synchronization.
   // if hdfs_connection is NULL, 'range' must be for a local file
   Status ReadFromScanRange(hdfsFS hdfs_connection, ScanRange* range, 
-      char* buffer, int64_t* bytes_read, bool* eosr);
+      char* buffer, int64_t read_ahead, int64_t* bytes_read, int64_t* read_ahead_len,
+      bool* eosr);
+
+  // Serves the next read of 'range' from the block cache if it has it: sets
+  // buffer_desc's buffer, len and eosr and updates the range.  Returns false if the
+  // read is not cached.
+  bool ReadFromBlockCache(ScanRange* range, BufferDescriptor* buffer_desc);
+
+  // Adds the buffer just read from disk by buffer_desc to the block cache, if the
+  // range can be cached.  'bytes_to_read' is the number of bytes that were requested.
+  void AddToBlockCache(ScanRange* range, int64_t bytes_to_read,
+      BufferDescriptor* buffer_desc);
+
+  // Counterpart of ReadFromScanRange() for readers that map local files
+  // (FLAGS_mmap_local_files): maps the next (up to max_read_size_) bytes of the
+  // local file for 'range' and sets buffer_desc's buffer, len and eosr.
+  Status MapFromScanRange(ScanRange* range, BufferDescriptor* buffer_desc);
 
   // Decrements ref count on the reader for this disk.  If the disk ref count for
   // this reader goes to 0, the disk complete condition variable is signaled.
@@ -376,13 +537,19 @@ class DiskIoMgr {
   void DecrementDiskRefCount(ReaderContext* reader);
 
   // This is called from the disk thread to get the next scan to process.  It will
-  // wait until a scan range is available and a buffer is available to do the work.
-  // This functions returns the scan range, the reader and buffer to read into.
+  // wait until a write range is queued, or a scan range is available and a buffer is
+  // available to do the work.
+  // This functions returns either the write range, or the scan range, the reader and
+  // buffer to read into.  *write_range is left NULL for reads.
   // This function cycles through readers and scan ranges in the reader.
   // Only returns false if the disk thread should be shut down.
   // No locks should be taken before this function call and none are left taken after.
   bool GetNextScanRange(DiskQueue*, ScanRange** range, 
-      ReaderContext** reader, char** buffer);
+      ReaderContext** reader, char** buffer, WriteRange** write_range);
+
+  // Writes 'range' to its file.  Only modifies local variables and does not need
+  // synchronization.
+  Status Write(WriteRange* range);
 
   // Updates disk queue and reader state after a read is complete.  The read result
   // is captured in the buffer descriptor.
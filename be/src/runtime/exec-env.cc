@@ -20,14 +20,24 @@
 
 #include "common/logging.h"
 #include "common/service-ids.h"
+#include "runtime/buffer-pool.h"
 #include "runtime/client-cache.h"
 #include "runtime/data-stream-mgr.h"
+#include "runtime/data-stream-transport.h"
 #include "runtime/disk-io-mgr.h"
+#include "runtime/exec-stats-store.h"
 #include "runtime/hbase-table-cache.h"
 #include "runtime/hdfs-fs-cache.h"
+#include "runtime/huge-page-allocator.h"
+#include "runtime/join-build-cache.h"
+#include "runtime/mem-tracker.h"
+#include "runtime/scratch-mgr.h"
 #include "sparrow/simple-scheduler.h"
 #include "sparrow/subscription-manager.h"
+#include "util/cpu-info.h"
 #include "util/metrics.h"
+#include "util/thread-pool.h"
+#include "util/thread-tokens.h"
 #include "util/webserver.h"
 #include "util/default-path-handlers.h"
 #include "gen-cpp/ImpalaInternalService.h"
@@ -41,15 +51,77 @@ using sparrow::SubscriptionManager;
 DEFINE_bool(use_statestore, true,
     "Use an external state-store process to manage cluster membership");
 DEFINE_bool(enable_webserver, true, "If true, debug webserver is enabled");
+DEFINE_int64(mem_limit, -1,
+    "Limit on the total memory (in bytes) used by query execution on this node; "
+    "queries that push usage over the limit fail.  < 0 means no limit.");
+DEFINE_int32(num_decompression_threads, 0,
+    "Number of threads that decompress sequence file blocks ahead of the scanner "
+    "threads.  0 means one per core, < 0 means the scanner threads decompress the "
+    "blocks themselves.");
+DEFINE_int32(num_table_writer_threads, 0,
+    "Number of threads shared by all table sinks for writing the partitions of an "
+    "INSERT in parallel.  0 means one per core, < 0 means each sink writes its "
+    "partitions one after the other.");
+DEFINE_int32(num_aggregation_threads, 0,
+    "Number of threads shared by all aggregation nodes for aggregating hash partitions "
+    "of their input in parallel (see --agg_num_partitions).  0 means one per core, "
+    "< 0 means aggregations use the fragment's thread only.");
+DEFINE_int32(num_scanner_thread_tokens, 0,
+    "Number of scanner threads that the hdfs scans of all queries on this node may run "
+    "in addition to the first thread of each scan.  0 means two per core, < 0 means "
+    "no limit.");
+DEFINE_int32(num_scanner_pool_threads, 0,
+    "Number of threads kept for running the scanner threads of the hdfs scans of all "
+    "queries on this node, so that scan ranges don't start threads of their own.  "
+    "Scans that need more threads at a time start additional ones, which exit when "
+    "they are idle.  0 means two per core, < 0 means a new thread per scan range.");
+DEFINE_int32(num_fragment_exec_threads, 0,
+    "Number of threads kept for executing the plan fragment instances on this node.  "
+    "Instances beyond it start additional threads, which exit when they are idle, "
+    "since instances wait for each other's data.  0 means one per core, < 0 means a "
+    "new thread per instance.");
+DEFINE_int32(coordinator_rpc_threads, 12,
+    "Number of threads shared by all coordinators on this node for issuing the rpcs "
+    "that start fragment instances.  0 means one thread per instance.");
+DEFINE_int32(insert_finalize_threads, 16,
+    "Number of threads shared by all coordinators on this node for the hdfs operations "
+    "that finalize INSERTs (creating partition directories and moving the written "
+    "files into place).  0 means each coordinator does them one at a time.");
+DEFINE_int64(join_build_cache_capacity, 0,
+    "Maximum number of bytes of build rows that broadcast hash joins keep across "
+    "queries, so that joins with the same small table don't need to receive it again.  "
+    "0 disables the cache.");
+DEFINE_int64(agg_state_cache_capacity, 0,
+    "Maximum number of bytes of the groups of pre-aggregations that are kept across "
+    "queries per scanned partition, so that later queries only aggregate the "
+    "partitions whose files have changed.  0 disables the cache.");
+DEFINE_int32(exec_stats_store_max_entries, 1024,
+    "Maximum number of plan fragments whose execution statistics coordinators keep, so "
+    "that later runs of the same fragments can size their hash tables for them.  0 "
+    "disables the store.");
+DEFINE_int64(buffer_pool_limit, -1, "Maximum number of bytes of the pages of the "
+    "buffer pool.  Unpinned pages are evicted to scratch space (--scratch_dirs) to stay "
+    "below it.  < 0 means no limit.");
+DEFINE_int32(backend_client_cache_max_clients, 0, "Maximum number of connections to "
+    "other backends for control rpcs (0 means no limit)");
+DEFINE_int32(backend_client_cache_max_clients_per_backend, 0, "Maximum number of "
+    "connections to a single backend for control rpcs (0 means no limit)");
+DEFINE_int32(data_client_cache_max_clients_per_backend, 0, "Maximum number of "
+    "connections to a single backend for data stream rpcs (0 means no limit).  Each "
+    "data stream holds a connection until it is closed.");
 DECLARE_int32(be_port);
 DECLARE_string(ipaddress);
 
 namespace impala {
 
 ExecEnv::ExecEnv()
-  : stream_mgr_(new DataStreamMgr()),
+  : process_mem_tracker_(new MemTracker(FLAGS_mem_limit, "Process")),
+    stream_mgr_(new DataStreamMgr()),
     subscription_mgr_(new SubscriptionManager()),
-    client_cache_(new BackendClientCache(0, 0)),
+    client_cache_(new BackendClientCache(FLAGS_backend_client_cache_max_clients,
+        FLAGS_backend_client_cache_max_clients_per_backend, "control")),
+    data_client_cache_(new BackendClientCache(0,
+        FLAGS_data_client_cache_max_clients_per_backend, "data")),
     fs_cache_(new HdfsFsCache()),
     htable_cache_(new HBaseTableCache()),
     disk_io_mgr_(new DiskIoMgr()),
@@ -70,14 +142,84 @@ ExecEnv::ExecEnv()
     addresses.push_back(address);
     scheduler_.reset(new SimpleScheduler(addresses, metrics_.get()));
   } 
-  Status status = disk_io_mgr_->Init();
+  Status status = disk_io_mgr_->Init(process_mem_tracker_.get(), metrics_.get());
   CHECK(status.ok());
+  // Without scratch space the node can still run queries that don't spill.
+  scratch_mgr_.reset(new ScratchMgr(disk_io_mgr_.get()));
+  status = scratch_mgr_->Init();
+  if (!status.ok()) {
+    LOG(ERROR) << "Spilling to disk is disabled: " << status.GetErrorMsg();
+  }
+  buffer_pool_.reset(new BufferPool(disk_io_mgr_.get(),
+      status.ok() ? scratch_mgr_.get() : NULL, FLAGS_buffer_pool_limit,
+      process_mem_tracker_.get()));
+  if (FLAGS_num_decompression_threads >= 0) {
+    int num_threads = FLAGS_num_decompression_threads == 0 ?
+        CpuInfo::num_cores() : FLAGS_num_decompression_threads;
+    decompression_pool_.reset(new ThreadPool(num_threads));
+  }
+  if (FLAGS_num_table_writer_threads >= 0) {
+    int num_threads = FLAGS_num_table_writer_threads == 0 ?
+        CpuInfo::num_cores() : FLAGS_num_table_writer_threads;
+    table_writer_pool_.reset(new ThreadPool(num_threads));
+  }
+  if (FLAGS_num_aggregation_threads >= 0) {
+    int num_threads = FLAGS_num_aggregation_threads == 0 ?
+        CpuInfo::num_cores() : FLAGS_num_aggregation_threads;
+    aggregation_pool_.reset(new ThreadPool(num_threads));
+  }
+  if (FLAGS_num_scanner_thread_tokens >= 0) {
+    // scanner threads also wait for io
+    int num_tokens = FLAGS_num_scanner_thread_tokens == 0 ?
+        2 * CpuInfo::num_cores() : FLAGS_num_scanner_thread_tokens;
+    scanner_thread_tokens_.reset(new ThreadTokens(num_tokens));
+  }
+  if (FLAGS_coordinator_rpc_threads > 0) {
+    coordinator_rpc_pool_.reset(new ThreadPool(FLAGS_coordinator_rpc_threads));
+  }
+  if (FLAGS_insert_finalize_threads > 0) {
+    insert_finalize_pool_.reset(new ThreadPool(FLAGS_insert_finalize_threads));
+  }
+  // The scanner threads and fragment instances wait for each other, so these pools
+  // never queue them; the scanner thread tokens bound the threads of the scans.
+  if (FLAGS_num_scanner_pool_threads >= 0) {
+    int num_threads = FLAGS_num_scanner_pool_threads == 0 ?
+        2 * CpuInfo::num_cores() : FLAGS_num_scanner_pool_threads;
+    scanner_pool_.reset(new ThreadPool(num_threads, -1));
+  }
+  if (FLAGS_num_fragment_exec_threads >= 0) {
+    int num_threads = FLAGS_num_fragment_exec_threads == 0 ?
+        CpuInfo::num_cores() : FLAGS_num_fragment_exec_threads;
+    fragment_exec_pool_.reset(new ThreadPool(num_threads, -1));
+  }
+  RegisterPoolMetrics(decompression_pool_.get(), "decompression");
+  RegisterPoolMetrics(table_writer_pool_.get(), "table-writer");
+  RegisterPoolMetrics(aggregation_pool_.get(), "aggregation");
+  RegisterPoolMetrics(coordinator_rpc_pool_.get(), "coordinator-rpc");
+  RegisterPoolMetrics(insert_finalize_pool_.get(), "insert-finalize");
+  RegisterPoolMetrics(scanner_pool_.get(), "scanner");
+  RegisterPoolMetrics(fragment_exec_pool_.get(), "fragment-exec");
+  if (FLAGS_join_build_cache_capacity > 0) {
+    join_build_cache_.reset(new JoinBuildCache(FLAGS_join_build_cache_capacity,
+        process_mem_tracker_.get()));
+  }
+  if (FLAGS_agg_state_cache_capacity > 0) {
+    agg_state_cache_.reset(new JoinBuildCache(FLAGS_agg_state_cache_capacity,
+        process_mem_tracker_.get()));
+  }
+  if (FLAGS_exec_stats_store_max_entries > 0) {
+    exec_stats_store_.reset(new ExecStatsStore(FLAGS_exec_stats_store_max_entries));
+  }
 }
 
 ExecEnv::~ExecEnv() {
   if (scheduler_ != NULL) scheduler_->Close();
 }
 
+void ExecEnv::RegisterPoolMetrics(ThreadPool* pool, const string& name) {
+  if (pool != NULL) pool->RegisterMetrics(metrics_.get(), "thread-pool." + name);
+}
+
 Status ExecEnv::StartServices() {
   LOG(INFO) << "Starting global services";
   // Start services in order to ensure that dependencies between them are met
@@ -89,6 +231,7 @@ Status ExecEnv::StartServices() {
   }
 
   metrics_->Init(enable_webserver_ ? webserver_.get() : NULL);
+  HugePageAllocator::InitMetrics(metrics_.get());
 
   if (FLAGS_use_statestore) RETURN_IF_ERROR(subscription_mgr_->Start());  
 
@@ -97,4 +240,12 @@ Status ExecEnv::StartServices() {
   return Status::OK;
 }
 
+Status ExecEnv::StartDataStreamServer(int port) {
+  DCHECK(data_stream_server_ == NULL);
+  scoped_ptr<DataStreamServer> server(new DataStreamServer(stream_mgr_.get(), port));
+  RETURN_IF_ERROR(server->Start());
+  data_stream_server_.swap(server);
+  return Status::OK;
+}
+
 }
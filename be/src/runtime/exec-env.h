@@ -17,6 +17,7 @@
 #define IMPALA_RUNTIME_EXEC_ENV_H
 
 #include <boost/scoped_ptr.hpp>
+#include <string>
 #include <boost/shared_ptr.hpp>
 #include <boost/thread/thread.hpp>
 
@@ -33,11 +34,19 @@ class SubscriptionManager;
 namespace impala {
 
 class BackendClientCache;
+class BufferPool;
 class DataStreamMgr;
+class DataStreamServer;
 class DiskIoMgr;
+class ExecStatsStore;
 class HBaseTableCache;
 class HdfsFsCache;
+class JoinBuildCache;
+class MemTracker;
+class ScratchMgr;
 class TestExecEnv;
+class ThreadPool;
+class ThreadTokens;
 class Webserver;
 class Metrics;
 
@@ -55,13 +64,73 @@ class ExecEnv {
   }
 
   DataStreamMgr* stream_mgr() { return stream_mgr_.get(); }
+  // Clients for control rpcs: starting, cancelling and reporting on fragments.
   BackendClientCache* client_cache() { return client_cache_.get(); }
+
+  // Clients for data stream rpcs (TransmitData), kept apart from client_cache() so
+  // that control rpcs never wait for a connection that is busy sending data.
+  BackendClientCache* data_client_cache() { return data_client_cache_.get(); }
   HdfsFsCache* fs_cache() { return fs_cache_.get(); }
   HBaseTableCache* htable_cache() { return htable_cache_.get(); }
   DiskIoMgr* disk_io_mgr() { return disk_io_mgr_.get(); }
+
+  // Local scratch space for operators that spill to disk.
+  ScratchMgr* scratch_mgr() { return scratch_mgr_.get(); }
+
+  // Pages for the large buffers of operators, evicted to scratch_mgr() when unpinned.
+  BufferPool* buffer_pool() { return buffer_pool_.get(); }
   Webserver* webserver() { return webserver_.get(); }
   Metrics* metrics() { return metrics_.get(); }
 
+  // Threads shared by all scanners for decompressing blocks ahead of the scanner
+  // threads.  NULL if --num_decompression_threads < 0.
+  ThreadPool* decompression_pool() { return decompression_pool_.get(); }
+
+  // Threads shared by all table sinks for writing partitions in parallel.  NULL if
+  // --num_table_writer_threads < 0.
+  ThreadPool* table_writer_pool() { return table_writer_pool_.get(); }
+
+  // Threads shared by all aggregation nodes for aggregating partitions in parallel.
+  // NULL if --num_aggregation_threads < 0.
+  ThreadPool* aggregation_pool() { return aggregation_pool_.get(); }
+
+  // Tokens for the scanner threads of all hdfs scans beyond the first thread of each
+  // scan.  NULL if --num_scanner_thread_tokens < 0.
+  ThreadTokens* scanner_thread_tokens() { return scanner_thread_tokens_.get(); }
+
+  // Threads shared by all coordinators for starting fragment instances.  NULL if
+  // --coordinator_rpc_threads is 0.
+  ThreadPool* coordinator_rpc_pool() { return coordinator_rpc_pool_.get(); }
+
+  // Threads shared by all coordinators for the hdfs operations of INSERT
+  // finalization.  NULL if --insert_finalize_threads is 0.
+  ThreadPool* insert_finalize_pool() { return insert_finalize_pool_.get(); }
+
+  // Threads shared by all hdfs scans for their scanner threads and disk threads.
+  // NULL if --num_scanner_pool_threads < 0.
+  ThreadPool* scanner_pool() { return scanner_pool_.get(); }
+
+  // Threads for executing plan fragment instances.  NULL if
+  // --num_fragment_exec_threads < 0.
+  ThreadPool* fragment_exec_pool() { return fragment_exec_pool_.get(); }
+
+  // Build rows of broadcast hash joins, reused across queries.  NULL if
+  // --join_build_cache_capacity is 0.
+  JoinBuildCache* join_build_cache() { return join_build_cache_.get(); }
+
+  // Groups of pre-aggregations per scanned partition, reused across queries (see
+  // AggregationNode).  The entries are rows of a single aggregation tuple, kept like
+  // the build rows of joins.  NULL if --agg_state_cache_capacity is 0.
+  JoinBuildCache* agg_state_cache() { return agg_state_cache_.get(); }
+
+  // Execution statistics of recently run plan fragments.  NULL if
+  // --exec_stats_store_max_entries is 0.
+  ExecStatsStore* exec_stats_store() { return exec_stats_store_.get(); }
+
+  // Tracks the memory consumption of the whole process and enforces --mem_limit.
+  // The root of the memory tracker hierarchy.
+  MemTracker* process_mem_tracker() { return process_mem_tracker_.get(); }
+
   void set_enable_webserver(bool enable) { enable_webserver_ = enable; }
 
   sparrow::Scheduler* scheduler() {
@@ -72,22 +141,49 @@ class ExecEnv {
   // Starts any dependent services in their correct order
   virtual Status StartServices();
 
+  // Starts receiving row batches for stream_mgr() on 'port' (see DataStreamServer).
+  // Called along with the backend service if --data_stream_port_offset is set.
+  Status StartDataStreamServer(int port);
+
  protected:
   // Leave protected so that subclasses can override
+  // Declared first so that it outlives everything that charges memory against it.
+  boost::scoped_ptr<MemTracker> process_mem_tracker_;
   boost::scoped_ptr<DataStreamMgr> stream_mgr_;
+  // NULL unless StartDataStreamServer() was called; destroyed before stream_mgr_
+  boost::scoped_ptr<DataStreamServer> data_stream_server_;
   boost::scoped_ptr<sparrow::Scheduler> scheduler_;
   boost::scoped_ptr<sparrow::SubscriptionManager> subscription_mgr_;
   boost::scoped_ptr<BackendClientCache> client_cache_;
+  boost::scoped_ptr<BackendClientCache> data_client_cache_;
   boost::scoped_ptr<HdfsFsCache> fs_cache_;
   boost::scoped_ptr<HBaseTableCache> htable_cache_;
   boost::scoped_ptr<DiskIoMgr> disk_io_mgr_;
+  // Writes through disk_io_mgr_; destroyed before it
+  boost::scoped_ptr<ScratchMgr> scratch_mgr_;
+  // Evicts through scratch_mgr_ and disk_io_mgr_; destroyed before them
+  boost::scoped_ptr<BufferPool> buffer_pool_;
   boost::scoped_ptr<Webserver> webserver_;
   boost::scoped_ptr<Metrics> metrics_;
+  boost::scoped_ptr<ThreadPool> decompression_pool_;
+  boost::scoped_ptr<ThreadPool> table_writer_pool_;
+  boost::scoped_ptr<ThreadPool> aggregation_pool_;
+  boost::scoped_ptr<ThreadTokens> scanner_thread_tokens_;
+  boost::scoped_ptr<ThreadPool> coordinator_rpc_pool_;
+  boost::scoped_ptr<ThreadPool> insert_finalize_pool_;
+  boost::scoped_ptr<ThreadPool> scanner_pool_;
+  boost::scoped_ptr<ThreadPool> fragment_exec_pool_;
+  boost::scoped_ptr<JoinBuildCache> join_build_cache_;
+  boost::scoped_ptr<JoinBuildCache> agg_state_cache_;
+  boost::scoped_ptr<ExecStatsStore> exec_stats_store_;
 
   bool enable_webserver_;
 
  private:
   TimezoneDatabase tz_database_;
+
+  // Registers the metrics of 'pool', if non-NULL, as "thread-pool.<name>.*".
+  void RegisterPoolMetrics(ThreadPool* pool, const std::string& name);
 };
 
 } // namespace impala
@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "runtime/exec-stats-store.h"
+
+using namespace std;
+
+namespace impala {
+
+static ExecStatsStore::NodeStats MakeStats(TPlanNodeId id, int64_t num_rows) {
+  ExecStatsStore::NodeStats stats;
+  stats[id].num_rows = num_rows;
+  stats[id].num_hash_table_buckets = 2 * num_rows;
+  stats[id].peak_mem_usage = 1024;
+  return stats;
+}
+
+TEST(ExecStatsStoreTest, LookupAndEvict) {
+  ExecStatsStore store(2);
+  int64_t generation = store.generation();
+  ExecStatsStore::NodeStats stats;
+  EXPECT_FALSE(store.Lookup("a", &stats));
+
+  store.Update("a", generation, MakeStats(1, 10));
+  store.Update("b", generation, MakeStats(2, 20));
+  EXPECT_TRUE(store.Lookup("a", &stats));
+  EXPECT_EQ(stats.size(), 1);
+  EXPECT_EQ(stats[1].num_rows, 10);
+  EXPECT_EQ(stats[1].num_hash_table_buckets, 20);
+
+  // "b" is the least recently used entry.
+  store.Update("c", generation, MakeStats(3, 30));
+  EXPECT_EQ(store.num_entries(), 2);
+  EXPECT_TRUE(store.Lookup("a", &stats));
+  EXPECT_FALSE(store.Lookup("b", &stats));
+  EXPECT_TRUE(store.Lookup("c", &stats));
+
+  // Updating an entry replaces its stats without evicting another one.
+  store.Update("c", generation, MakeStats(3, 40));
+  EXPECT_EQ(store.num_entries(), 2);
+  EXPECT_TRUE(store.Lookup("c", &stats));
+  EXPECT_EQ(stats[3].num_rows, 40);
+  EXPECT_TRUE(store.Lookup("a", &stats));
+}
+
+TEST(ExecStatsStoreTest, Invalidate) {
+  ExecStatsStore store(10);
+  int64_t generation = store.generation();
+  store.Update("a", generation, MakeStats(1, 10));
+  store.Invalidate();
+  ExecStatsStore::NodeStats stats;
+  EXPECT_FALSE(store.Lookup("a", &stats));
+  EXPECT_EQ(store.num_entries(), 0);
+
+  // Stats of a fragment that started before Invalidate() are dropped.
+  store.Update("a", generation, MakeStats(1, 10));
+  EXPECT_FALSE(store.Lookup("a", &stats));
+  store.Update("a", store.generation(), MakeStats(1, 10));
+  EXPECT_TRUE(store.Lookup("a", &stats));
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,75 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/exec-stats-store.h"
+
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+ExecStatsStore::ExecStatsStore(int max_entries)
+  : max_entries_(max_entries),
+    generation_(0) {
+  DCHECK_GT(max_entries, 0);
+}
+
+bool ExecStatsStore::Lookup(const string& key, NodeStats* stats) {
+  lock_guard<mutex> l(lock_);
+  map<string, EntryList::iterator>::iterator it = entries_.find(key);
+  if (it == entries_.end()) return false;
+  lru_.splice(lru_.begin(), lru_, it->second);
+  *stats = it->second->second;
+  return true;
+}
+
+int64_t ExecStatsStore::generation() {
+  lock_guard<mutex> l(lock_);
+  return generation_;
+}
+
+void ExecStatsStore::Update(const string& key, int64_t generation,
+    const NodeStats& stats) {
+  lock_guard<mutex> l(lock_);
+  if (generation != generation_) return;
+  map<string, EntryList::iterator>::iterator it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.erase(it->second);
+    entries_.erase(it);
+  }
+  if (static_cast<int>(entries_.size()) >= max_entries_) {
+    entries_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  lru_.push_front(make_pair(key, stats));
+  entries_[key] = lru_.begin();
+}
+
+void ExecStatsStore::Invalidate() {
+  lock_guard<mutex> l(lock_);
+  entries_.clear();
+  lru_.clear();
+  ++generation_;
+}
+
+int ExecStatsStore::num_entries() {
+  lock_guard<mutex> l(lock_);
+  return entries_.size();
+}
+
+}
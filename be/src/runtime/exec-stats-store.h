@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_EXEC_STATS_STORE_H
+#define IMPALA_RUNTIME_EXEC_STATS_STORE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "gen-cpp/PlanNodes_types.h"
+
+namespace impala {
+
+// Keeps what the plan nodes of recently finished plan fragments did (see
+// TPlanNodeExecStats), so that the next run of the same fragment can be set up for it,
+// e.g. hash tables start out with the number of buckets they grew to the last time.
+// The coordinator records the statistics of each fragment of a successful query and
+// passes them to the nodes of later runs in TPlanNode.exec_stats.
+// Fragments are keyed by their plan and the descriptors of the tables they read (see
+// Coordinator), and Invalidate() drops all entries when the catalog changes.  At most
+// max_entries fragments are kept, and the least recently used ones are evicted first.
+// This class is thread safe.
+class ExecStatsStore {
+ public:
+  typedef std::map<TPlanNodeId, TPlanNodeExecStats> NodeStats;
+
+  // max_entries must be > 0.
+  explicit ExecStatsStore(int max_entries);
+
+  // Sets 'stats' to the statistics recorded under 'key' and marks them as most
+  // recently used.  Returns false if there are none.
+  bool Lookup(const std::string& key, NodeStats* stats);
+
+  // Returns the current generation, which Invalidate() increments.  It is read before
+  // a fragment starts and passed to Update().
+  int64_t generation();
+
+  // Records 'stats' under 'key', replacing any earlier ones.  Does nothing if
+  // Invalidate() was called after 'generation' was read, since the fragment might have
+  // read tables that changed since.
+  void Update(const std::string& key, int64_t generation, const NodeStats& stats);
+
+  // Removes all entries.
+  void Invalidate();
+
+  int num_entries();
+
+ private:
+  typedef std::list<std::pair<std::string, NodeStats> > EntryList;
+
+  const int max_entries_;
+
+  // protects all fields below
+  boost::mutex lock_;
+
+  // All entries, most recently used first, and an index into it by key
+  EntryList lru_;
+  std::map<std::string, EntryList::iterator> entries_;
+
+  int64_t generation_;
+};
+
+}
+
+#endif
@@ -15,6 +15,7 @@
 #include "runtime/hbase-table-cache.h"
 
 #include <boost/thread/locks.hpp>
+#include <gflags/gflags.h>
 
 #include "common/logging.h"
 #include "util/jni-util.h"
@@ -23,6 +24,9 @@ using namespace std;
 using namespace boost;
 using namespace impala;
 
+DEFINE_int32(hbase_table_pool_size, 16, "Maximum number of idle HTables of each hbase "
+    "table that are kept for later scans.");
+
 jclass HBaseTableCache::htable_cl_ = NULL;
 jmethodID HBaseTableCache::htable_ctor_ = NULL;
 jmethodID HBaseTableCache::htable_close_id_ = NULL;
@@ -74,31 +78,61 @@ Status HBaseTableCache::Init() {
 HBaseTableCache::~HBaseTableCache() {
   JNIEnv* env = getJNIEnv();
   for (HTableMap::iterator i = table_map_.begin(); i != table_map_.end(); ++i) {
-    env->CallObjectMethod(i->second, htable_close_id_);
-    env->DeleteGlobalRef(i->second);
+    for (int j = 0; j < i->second.size(); ++j) {
+      CloseHTable(env, i->second[j]);
+    }
+  }
+}
+
+void HBaseTableCache::CloseHTable(JNIEnv* env, jobject htable) {
+  env->CallVoidMethod(htable, htable_close_id_);
+  if (env->ExceptionOccurred()) {
+    LOG(WARNING) << "Error closing HTable";
+    env->ExceptionClear();
   }
+  env->DeleteGlobalRef(htable);
 }
 
-jobject HBaseTableCache::GetHBaseTable(const string& table_name) {
+Status HBaseTableCache::GetHBaseTable(const string& table_name, jobject* htable) {
+  {
+    lock_guard<mutex> l(lock_);
+    vector<jobject>& idle_htables = table_map_[table_name];
+    if (!idle_htables.empty()) {
+      *htable = idle_htables.back();
+      idle_htables.pop_back();
+      return Status::OK;
+    }
+  }
+
+  // Construct the HTable outside of the lock, it may have to talk to the cluster.
   JNIEnv* env = getJNIEnv();
-  if (env == NULL) return NULL;
-
-  lock_guard<mutex> l(lock_);
-  HTableMap::iterator i = table_map_.find(table_name);
-  if (i == table_map_.end()) {
-    LOG(INFO) << "gethbasetable: name=" << table_name;
-    jstring jtable_name = env->NewStringUTF(table_name.c_str());
-    LOG(INFO) << "env=" << env << " htable_cl=" << htable_cl_
-              << " htable_ctor_=" << htable_ctor_
-              << " hbase_conf=" << hbase_conf_
-              << " jtable=" << jtable_name;
-    jobject htable = env->NewObject(htable_cl_, htable_ctor_, hbase_conf_, jtable_name);
-    jobject global_htable = env->NewGlobalRef(htable);
-    table_map_.insert(make_pair(table_name, global_htable));
-    return global_htable;
-  } else {
-    return i->second;
+  if (env == NULL) return Status("Failed to get/create JVM");
+  VLOG_QUERY << "Creating HTable for " << table_name;
+  // htable = new HTable(hbase_conf_, table_name);
+  jstring jtable_name = env->NewStringUTF(table_name.c_str());
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  jobject local_htable =
+      env->NewObject(htable_cl_, htable_ctor_, hbase_conf_, jtable_name);
+  env->DeleteLocalRef(jtable_name);
+  RETURN_ERROR_IF_EXC(env, JniUtil::throwable_to_string_id());
+  // Not a JniUtil global reference, which would be deleted again in Cleanup().
+  *htable = env->NewGlobalRef(local_htable);
+  env->DeleteLocalRef(local_htable);
+  if (*htable == NULL) return Status("Failed to create a global reference to an HTable");
+  return Status::OK;
+}
+
+void HBaseTableCache::ReleaseHBaseTable(const string& table_name, jobject htable) {
+  {
+    lock_guard<mutex> l(lock_);
+    vector<jobject>& idle_htables = table_map_[table_name];
+    if (idle_htables.size() < FLAGS_hbase_table_pool_size) {
+      idle_htables.push_back(htable);
+      return;
+    }
   }
+  JNIEnv* env = getJNIEnv();
+  if (env != NULL) CloseHTable(env, htable);
 }
 
 }
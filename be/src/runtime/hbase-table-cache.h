@@ -17,14 +17,20 @@
 #define IMPALA_RUNTIME_HBASE_TABLE_CACHE_H
 
 #include <jni.h>
+#include <vector>
 #include "common/status.h"
 #include <boost/unordered_map.hpp>
 #include <boost/thread/mutex.hpp>
 
 namespace impala {
 
-// A (process-wide) cache of HTable java objects.
-// These objects are shared across all threads and kept until the process terminates.
+// A (process-wide) pool of HTable java objects per table.
+// An HTable isn't thread safe, so each is used by one scanner at a time: a scanner
+// checks one out with GetHBaseTable() and returns it with ReleaseHBaseTable().  Up to
+// --hbase_table_pool_size idle HTables of each table are kept for the following scans
+// until the process terminates, so a scan doesn't have to construct one (which looks
+// up the table's regions).  All HTables share the connection to the cluster that
+// HBase keeps for their configuration.
 class HBaseTableCache {
  public:
   ~HBaseTableCache();
@@ -33,15 +39,24 @@ class HBaseTableCache {
   // and find method ids.
   static Status Init();
 
-  // Return the HTable java object for the given table name. If the HTable does not exist
-  // in the cache, it'll be constructed and added to the cache.
-  jobject GetHBaseTable(const std::string& table_name);
+  // Returns an idle HTable java object (a global reference) for the given table name
+  // in 'htable', or constructs a new one if there is none.  The caller has exclusive
+  // use of it until it is passed to ReleaseHBaseTable().
+  Status GetHBaseTable(const std::string& table_name, jobject* htable);
+
+  // Returns 'htable' of GetHBaseTable() to the pool of 'table_name', or closes it if
+  // the pool is full.
+  void ReleaseHBaseTable(const std::string& table_name, jobject htable);
 
  private:
-  boost::mutex lock_;  // protects table_map
-  typedef boost::unordered_map<std::string, jobject> HTableMap;
+  boost::mutex lock_;  // protects table_map_
+  // Idle HTables by table name.
+  typedef boost::unordered_map<std::string, std::vector<jobject> > HTableMap;
   HTableMap table_map_;
 
+  // Closes 'htable' and deletes its global reference.
+  static void CloseHTable(JNIEnv* env, jobject htable);
+
   static jclass htable_cl_;
   static jmethodID htable_ctor_;
   static jmethodID htable_close_id_;
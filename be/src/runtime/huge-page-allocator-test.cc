@@ -0,0 +1,99 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string.h>
+#include <vector>
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "runtime/huge-page-allocator.h"
+
+DECLARE_string(huge_pages);
+
+using namespace std;
+
+namespace impala {
+
+static const int64_t HUGE_PAGE_SIZE = HugePageAllocator::HUGE_PAGE_SIZE;
+
+// Allocates, grows and shrinks a buffer and checks that its contents survive.
+static void TestReallocate() {
+  int64_t size = 1024;
+  uint8_t* buffer = reinterpret_cast<uint8_t*>(HugePageAllocator::Allocate(size));
+  ASSERT_TRUE(buffer != NULL);
+  memset(buffer, 1, size);
+  int64_t new_size = 3 * HUGE_PAGE_SIZE + 100;
+  buffer = reinterpret_cast<uint8_t*>(
+      HugePageAllocator::Reallocate(buffer, size, new_size));
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_EQ(buffer[0], 1);
+  EXPECT_EQ(buffer[size - 1], 1);
+  memset(buffer + size, 2, new_size - size);
+  buffer = reinterpret_cast<uint8_t*>(
+      HugePageAllocator::Reallocate(buffer, new_size, size));
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_EQ(buffer[size - 1], 1);
+  HugePageAllocator::Free(buffer, size);
+}
+
+TEST(HugePageAllocatorTest, None) {
+  FLAGS_huge_pages = "none";
+  TestReallocate();
+}
+
+TEST(HugePageAllocatorTest, Transparent) {
+  FLAGS_huge_pages = "transparent";
+  void* buffer = HugePageAllocator::Allocate(HUGE_PAGE_SIZE + 1);
+  ASSERT_TRUE(buffer != NULL);
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(buffer) % HUGE_PAGE_SIZE, 0);
+  memset(buffer, 0, HUGE_PAGE_SIZE + 1);
+  HugePageAllocator::Free(buffer, HUGE_PAGE_SIZE + 1);
+  TestReallocate();
+  FLAGS_huge_pages = "none";
+}
+
+// Explicit huge pages fall back to transparent ones if none are configured.
+TEST(HugePageAllocatorTest, Explicit) {
+  FLAGS_huge_pages = "explicit";
+  TestReallocate();
+  FLAGS_huge_pages = "none";
+}
+
+// Buffers can be freed after the mode changed.
+TEST(HugePageAllocatorTest, ModeChange) {
+  FLAGS_huge_pages = "transparent";
+  void* mapped = HugePageAllocator::Allocate(HUGE_PAGE_SIZE);
+  FLAGS_huge_pages = "none";
+  void* malloced = HugePageAllocator::Allocate(HUGE_PAGE_SIZE);
+  FLAGS_huge_pages = "transparent";
+  HugePageAllocator::Free(malloced, HUGE_PAGE_SIZE);
+  FLAGS_huge_pages = "none";
+  HugePageAllocator::Free(mapped, HUGE_PAGE_SIZE);
+}
+
+TEST(HugePageAllocatorTest, StlAllocator) {
+  FLAGS_huge_pages = "transparent";
+  vector<int64_t, HugePageStlAllocator<int64_t> > v(HUGE_PAGE_SIZE / sizeof(int64_t));
+  EXPECT_EQ(reinterpret_cast<uintptr_t>(&v[0]) % HUGE_PAGE_SIZE, 0);
+  for (int i = 0; i < 1000; ++i) v.push_back(i);
+  EXPECT_EQ(v.back(), 999);
+  FLAGS_huge_pages = "none";
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,168 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/huge-page-allocator.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+#include <map>
+#include <boost/thread/locks.hpp>
+#include <boost/thread/mutex.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "util/metrics.h"
+
+DEFINE_string(huge_pages, "none", "Whether large hash table and io buffers are backed "
+    "by 2MB huge pages: 'none', 'transparent' (madvise(MADV_HUGEPAGE)) or 'explicit' "
+    "(mmap(MAP_HUGETLB), which needs preallocated huge pages).");
+
+using namespace boost;
+using namespace std;
+
+#ifndef MAP_HUGETLB
+#define MAP_HUGETLB 0x40000
+#endif
+
+namespace impala {
+
+const int64_t HugePageAllocator::HUGE_PAGE_SIZE;
+
+// protects all variables below
+static mutex mapped_buffers_lock;
+
+// Buffers that were mmap()ed, so that Free() knows how a buffer was allocated, and
+// whether they were mapped with MAP_HUGETLB.
+static map<void*, bool> mapped_buffers;
+
+// Total sizes of all mapped buffers, and of the MAP_HUGETLB ones
+static int64_t mapped_bytes = 0;
+static int64_t explicit_bytes = 0;
+
+static Metrics::IntMetric* mapped_bytes_metric = NULL;
+static Metrics::IntMetric* explicit_bytes_metric = NULL;
+
+// Adds 'delta' to the mapped (and, if 'is_explicit', the explicit) bytes.
+// mapped_buffers_lock must be taken.
+static void UpdateMappedBytes(int64_t delta, bool is_explicit) {
+  mapped_bytes += delta;
+  if (is_explicit) explicit_bytes += delta;
+  if (mapped_bytes_metric != NULL) mapped_bytes_metric->Update(mapped_bytes);
+  if (explicit_bytes_metric != NULL) explicit_bytes_metric->Update(explicit_bytes);
+}
+
+// Rounds 'size' up to a multiple of HUGE_PAGE_SIZE.
+static int64_t MappedSize(int64_t size) {
+  const int64_t page = HugePageAllocator::HUGE_PAGE_SIZE;
+  return (size + page - 1) / page * page;
+}
+
+// Maps 'size' bytes (a multiple of HUGE_PAGE_SIZE) that are aligned to
+// HUGE_PAGE_SIZE by mapping an extra huge page and unmapping the unaligned ends.
+static void* MapTransparent(int64_t size) {
+  const int64_t page = HugePageAllocator::HUGE_PAGE_SIZE;
+  void* mapping = mmap(NULL, size + page, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapping == MAP_FAILED) return NULL;
+  uint8_t* start = reinterpret_cast<uint8_t*>(mapping);
+  uint8_t* aligned = reinterpret_cast<uint8_t*>(
+      (reinterpret_cast<uintptr_t>(start) + page - 1) / page * page);
+  if (aligned != start) munmap(start, aligned - start);
+  int64_t tail = (start + size + page) - (aligned + size);
+  if (tail > 0) munmap(aligned + size, tail);
+#ifdef MADV_HUGEPAGE
+  if (madvise(aligned, size, MADV_HUGEPAGE) != 0) {
+    VLOG_FILE << "madvise(MADV_HUGEPAGE) failed: " << strerror(errno);
+  }
+#endif
+  return aligned;
+}
+
+void* HugePageAllocator::Allocate(int64_t size) {
+  bool use_huge_pages = FLAGS_huge_pages != "none" && size >= HUGE_PAGE_SIZE;
+  if (!use_huge_pages) return malloc(size);
+
+  int64_t mapped_size = MappedSize(size);
+  void* buffer = NULL;
+  bool is_explicit = false;
+  if (FLAGS_huge_pages == "explicit") {
+    buffer = mmap(NULL, mapped_size, PROT_READ | PROT_WRITE,
+        MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (buffer == MAP_FAILED) {
+      VLOG_FILE << "mmap(MAP_HUGETLB) of " << mapped_size << " bytes failed: "
+                << strerror(errno);
+      buffer = NULL;
+    } else {
+      is_explicit = true;
+    }
+  } else if (FLAGS_huge_pages != "transparent") {
+    LOG(ERROR) << "Invalid value for --huge_pages: " << FLAGS_huge_pages;
+    return malloc(size);
+  }
+  if (buffer == NULL) buffer = MapTransparent(mapped_size);
+  if (buffer == NULL) return malloc(size);
+
+  lock_guard<mutex> l(mapped_buffers_lock);
+  mapped_buffers[buffer] = is_explicit;
+  UpdateMappedBytes(mapped_size, is_explicit);
+  return buffer;
+}
+
+void* HugePageAllocator::Reallocate(void* buffer, int64_t old_size, int64_t new_size) {
+  if (buffer == NULL) return Allocate(new_size);
+  bool is_mapped;
+  {
+    lock_guard<mutex> l(mapped_buffers_lock);
+    is_mapped = mapped_buffers.find(buffer) != mapped_buffers.end();
+  }
+  bool map_new = FLAGS_huge_pages != "none" && new_size >= HUGE_PAGE_SIZE;
+  if (!is_mapped && !map_new) return realloc(buffer, new_size);
+  if (is_mapped && MappedSize(old_size) == MappedSize(new_size)) return buffer;
+
+  void* new_buffer = Allocate(new_size);
+  if (new_buffer == NULL) return NULL;
+  memcpy(new_buffer, buffer, min(old_size, new_size));
+  Free(buffer, old_size);
+  return new_buffer;
+}
+
+void HugePageAllocator::Free(void* buffer, int64_t size) {
+  if (buffer == NULL) return;
+  int64_t mapped_size = MappedSize(size);
+  {
+    lock_guard<mutex> l(mapped_buffers_lock);
+    map<void*, bool>::iterator it = mapped_buffers.find(buffer);
+    if (it == mapped_buffers.end()) {
+      free(buffer);
+      return;
+    }
+    UpdateMappedBytes(-mapped_size, it->second);
+    mapped_buffers.erase(it);
+  }
+  // Both kinds of mappings are exactly mapped_size bytes long.
+  munmap(buffer, mapped_size);
+}
+
+void HugePageAllocator::InitMetrics(Metrics* metrics) {
+  lock_guard<mutex> l(mapped_buffers_lock);
+  mapped_bytes_metric =
+      metrics->CreateAndRegisterPrimitiveMetric("huge-pages.mapped-bytes", mapped_bytes);
+  explicit_bytes_metric = metrics->CreateAndRegisterPrimitiveMetric(
+      "huge-pages.explicit-bytes", explicit_bytes);
+}
+
+}
@@ -0,0 +1,106 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_HUGE_PAGE_ALLOCATOR_H
+#define IMPALA_RUNTIME_HUGE_PAGE_ALLOCATOR_H
+
+#include <cstddef>
+#include <limits>
+#include <new>
+#include <boost/cstdint.hpp>
+
+namespace impala {
+
+class Metrics;
+
+// Allocator for large, randomly accessed buffers (hash table buckets and nodes, io
+// buffers), which can back them with 2MB huge pages to reduce TLB misses.
+// --huge_pages selects the mode:
+//  - "none": all buffers come from malloc().
+//  - "transparent": buffers of at least HUGE_PAGE_SIZE bytes are mmap()ed, aligned
+//    to HUGE_PAGE_SIZE and madvise()d with MADV_HUGEPAGE, so that the kernel backs
+//    them with transparent huge pages when it can.
+//  - "explicit": like "transparent", but the buffers are mapped with MAP_HUGETLB
+//    from the preallocated huge page pool (vm.nr_hugepages).  If the pool is
+//    exhausted, the buffer is mapped as in "transparent" mode.
+// Smaller buffers always come from malloc().  The mode may be changed while buffers
+// are allocated; each buffer is freed the way it was allocated.
+// All functions are thread-safe.
+class HugePageAllocator {
+ public:
+  static const int64_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+  // Returns a buffer of 'size' bytes, or NULL if the allocation failed.
+  static void* Allocate(int64_t size);
+
+  // Like realloc(): returns a buffer of 'new_size' bytes with the first
+  // min(old_size, new_size) bytes of 'buffer', which came from Allocate(old_size)
+  // and must not be used anymore, unless NULL is returned.
+  static void* Reallocate(void* buffer, int64_t old_size, int64_t new_size);
+
+  // Frees 'buffer', which came from Allocate(size).
+  static void Free(void* buffer, int64_t size);
+
+  // Registers metrics for the number of bytes in huge page mappings.
+  static void InitMetrics(Metrics* metrics);
+};
+
+// STL allocator that allocates from HugePageAllocator, e.g. for
+// std::vector<T, HugePageStlAllocator<T> >.
+template <typename T>
+class HugePageStlAllocator {
+ public:
+  typedef T value_type;
+  typedef T* pointer;
+  typedef const T* const_pointer;
+  typedef T& reference;
+  typedef const T& const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind {
+    typedef HugePageStlAllocator<U> other;
+  };
+
+  HugePageStlAllocator() {}
+  template <typename U>
+  HugePageStlAllocator(const HugePageStlAllocator<U>&) {}
+
+  pointer address(reference x) const { return &x; }
+  const_pointer address(const_reference x) const { return &x; }
+
+  pointer allocate(size_type n, const void* hint = 0) {
+    void* p = HugePageAllocator::Allocate(n * sizeof(T));
+    if (p == NULL) throw std::bad_alloc();
+    return static_cast<pointer>(p);
+  }
+
+  void deallocate(pointer p, size_type n) {
+    HugePageAllocator::Free(p, n * sizeof(T));
+  }
+
+  size_type max_size() const { return std::numeric_limits<size_type>::max() / sizeof(T); }
+
+  void construct(pointer p, const T& value) { new(p) T(value); }
+  void destroy(pointer p) { p->~T(); }
+
+  bool operator==(const HugePageStlAllocator&) const { return true; }
+  bool operator!=(const HugePageStlAllocator&) const { return false; }
+};
+
+}
+
+#endif
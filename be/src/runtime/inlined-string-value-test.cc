@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "runtime/inlined-string-value.h"
+
+using namespace std;
+
+namespace impala {
+
+static InlinedStringValue MakeValue(const string& str) {
+  return InlinedStringValue(str.data(), str.size());
+}
+
+static int Sign(int v) {
+  return v < 0 ? -1 : (v > 0 ? 1 : 0);
+}
+
+TEST(InlinedStringValueTest, Inlining) {
+  string short_str = "abcdefghijkl";
+  string long_str = "abcdefghijklm";
+  InlinedStringValue short_value = MakeValue(short_str);
+  InlinedStringValue long_value = MakeValue(long_str);
+  EXPECT_TRUE(short_value.is_inlined());
+  EXPECT_FALSE(long_value.is_inlined());
+  EXPECT_TRUE(short_value.ptr() != short_str.data());
+  EXPECT_TRUE(long_value.ptr() == long_str.data());
+  EXPECT_EQ(string(short_value.ptr(), short_value.len()), short_str);
+  StringValue str = long_value.ToStringValue();
+  EXPECT_EQ(string(str.ptr, str.len), long_str);
+  EXPECT_EQ(InlinedStringValue().len(), 0);
+}
+
+TEST(InlinedStringValueTest, Compare) {
+  const char* values[] = {
+    "", "a", "ab", "abc", "abcd", "abcde", "abcdefghijkl", "abcdefghijklm",
+    "abcdefghijkln", "abd", "b", "\xff", "zzzzzzzzzzzzzzzzz"
+  };
+  vector<string> strings;
+  for (int i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    strings.push_back(values[i]);
+  }
+  // strings with embedded zero bytes
+  strings.push_back(string("a\0", 2));
+  strings.push_back(string("abcd\0\0\0\0\0\0\0\0\0", 13));
+
+  for (int i = 0; i < strings.size(); ++i) {
+    // copies, so that long values don't share their data
+    string lhs = strings[i];
+    for (int j = 0; j < strings.size(); ++j) {
+      string rhs = strings[j];
+      InlinedStringValue lhs_value = MakeValue(lhs);
+      InlinedStringValue rhs_value = MakeValue(rhs);
+      EXPECT_EQ(lhs_value.Eq(rhs_value), lhs == rhs) << i << " " << j;
+      EXPECT_EQ(Sign(lhs_value.Compare(rhs_value)), Sign(lhs.compare(rhs)))
+          << i << " " << j;
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,128 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_INLINED_STRING_VALUE_H
+#define IMPALA_RUNTIME_INLINED_STRING_VALUE_H
+
+#include <algorithm>
+#include <cstring>
+#include <boost/cstdint.hpp>
+
+#include "common/logging.h"
+#include "runtime/string-value.inline.h"
+
+namespace impala {
+
+// A 16-byte string representation that, unlike StringValue, holds short strings
+// itself and the first bytes of long ones:
+//   len (4 bytes) | prefix (4 bytes) | rest of the string (8 bytes) if len <= 12
+//                                    | pointer to the whole string otherwise
+// Unused bytes of the prefix and of inlined strings are zero.  Strings that differ
+// in their length or their first 4 bytes are told apart without touching their data,
+// and strings of up to MAX_INLINED_LEN bytes are compared without any indirection.
+// Like StringValue, the value doesn't own the data of long strings; an inlined string
+// lives in the value itself, so ptr() is only valid as long as the value is.
+struct InlinedStringValue {
+  static const int PREFIX_LEN = 4;
+  static const int MAX_INLINED_LEN = 12;
+
+  InlinedStringValue() {
+    memset(this, 0, sizeof(InlinedStringValue));
+  }
+
+  explicit InlinedStringValue(const StringValue& str) {
+    Init(str.ptr, str.len);
+  }
+
+  InlinedStringValue(const char* ptr, int len) {
+    Init(ptr, len);
+  }
+
+  int len() const { return len_; }
+  bool is_inlined() const { return len_ <= MAX_INLINED_LEN; }
+
+  // Returns the string data: the value's own bytes for inlined strings.
+  const char* ptr() const { return is_inlined() ? prefix_ : ptr_; }
+
+  // Returns a StringValue that references the same data as ptr().
+  StringValue ToStringValue() const {
+    return StringValue(const_cast<char*>(ptr()), len_);
+  }
+
+  bool Eq(const InlinedStringValue& other) const {
+    // the length and the prefix in one comparison
+    if (Load64(this) != Load64(&other)) return false;
+    if (is_inlined()) return Load64(rest_) == Load64(other.rest_);
+    if (ptr_ == other.ptr_) return true;
+    return memcmp(ptr_ + PREFIX_LEN, other.ptr_ + PREFIX_LEN, len_ - PREFIX_LEN) == 0;
+  }
+
+  bool operator==(const InlinedStringValue& other) const { return Eq(other); }
+  bool operator!=(const InlinedStringValue& other) const { return !Eq(other); }
+
+  // Byte-by-byte comparison of the unsigned bytes: returns < 0, 0 or > 0 if this
+  // string orders before, the same as or after 'other'.  Shorter strings order
+  // before longer strings that they are a prefix of.
+  int Compare(const InlinedStringValue& other) const {
+    uint32_t prefix, other_prefix;
+    memcpy(&prefix, prefix_, PREFIX_LEN);
+    memcpy(&other_prefix, other.prefix_, PREFIX_LEN);
+    if (prefix != other_prefix) {
+      // the big endian interpretations of the prefixes order like their bytes
+      return __builtin_bswap32(prefix) < __builtin_bswap32(other_prefix) ? -1 : 1;
+    }
+    int min_len = std::min(len_, other.len_);
+    if (min_len > PREFIX_LEN) {
+      int result = memcmp(ptr() + PREFIX_LEN, other.ptr() + PREFIX_LEN,
+          min_len - PREFIX_LEN);
+      if (result != 0) return result;
+    }
+    return len_ - other.len_;
+  }
+
+  bool operator<(const InlinedStringValue& other) const { return Compare(other) < 0; }
+
+ private:
+  void Init(const char* ptr, int len) {
+    DCHECK_GE(len, 0);
+    memset(this, 0, sizeof(InlinedStringValue));
+    len_ = len;
+    if (len <= MAX_INLINED_LEN) {
+      // fills prefix_ and then rest_
+      memcpy(prefix_, ptr, len);
+    } else {
+      memcpy(prefix_, ptr, PREFIX_LEN);
+      ptr_ = const_cast<char*>(ptr);
+    }
+  }
+
+  static uint64_t Load64(const void* p) {
+    uint64_t result;
+    memcpy(&result, p, sizeof(result));
+    return result;
+  }
+
+  int32_t len_;
+  char prefix_[PREFIX_LEN];
+  // the rest of an inlined string directly follows prefix_
+  union {
+    char rest_[MAX_INLINED_LEN - PREFIX_LEN];
+    char* ptr_;
+  };
+};
+
+}
+
+#endif
@@ -0,0 +1,111 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "runtime/join-build-cache.h"
+#include "runtime/mem-pool.h"
+#include "runtime/mem-tracker.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+static const int TUPLE_SIZE = 1024;
+
+// Fills 'pool' and 'tuples' with 'num_rows' rows of two tuples each, whose first
+// bytes are 'value'.  Returns the number of bytes allocated.
+static int64_t MakeRows(int num_rows, char value, MemPool* pool, vector<Tuple*>* tuples) {
+  for (int i = 0; i < 2 * num_rows; ++i) {
+    uint8_t* tuple = pool->Allocate(TUPLE_SIZE);
+    tuple[0] = value;
+    tuples->push_back(reinterpret_cast<Tuple*>(tuple));
+  }
+  return pool->GetTotalChunkSizes();
+}
+
+static char FirstByte(TupleRow* row, int tuple_idx) {
+  return *reinterpret_cast<char*>(reinterpret_cast<Tuple**>(row)[tuple_idx]);
+}
+
+TEST(JoinBuildCacheTest, Basic) {
+  MemTracker tracker;
+  JoinBuildCache cache(1024 * 1024, &tracker);
+  EXPECT_TRUE(cache.Lookup("t1") == NULL);
+
+  MemPool pool;
+  vector<Tuple*> tuples;
+  MakeRows(10, 'a', &pool, &tuples);
+  JoinBuildCache::EntryPtr entry = cache.Insert("t1", 2, &tuples, &pool);
+  ASSERT_TRUE(entry != NULL);
+  EXPECT_TRUE(tuples.empty());
+  EXPECT_EQ(pool.GetTotalChunkSizes(), 0);
+  EXPECT_GT(tracker.consumption(), 0);
+  EXPECT_EQ(entry->num_rows(), 10);
+  EXPECT_EQ(FirstByte(entry->GetRow(9), 1), 'a');
+  EXPECT_EQ(cache.cached_bytes(), entry->byte_size());
+
+  // An existing entry isn't replaced.
+  MakeRows(10, 'b', &pool, &tuples);
+  EXPECT_TRUE(cache.Insert("t1", 2, &tuples, &pool) == NULL);
+  EXPECT_EQ(tuples.size(), 20);
+  EXPECT_GT(pool.GetTotalChunkSizes(), 0);
+
+  JoinBuildCache::EntryPtr hit = cache.Lookup("t1");
+  EXPECT_TRUE(hit == entry);
+  EXPECT_TRUE(cache.Lookup("t2") == NULL);
+  EXPECT_EQ(cache.num_hits(), 1);
+  EXPECT_EQ(cache.num_misses(), 2);
+}
+
+// Least recently used entries are evicted, but stay valid while they are held.
+TEST(JoinBuildCacheTest, Eviction) {
+  const int64_t capacity = 1024 * 1024;
+  JoinBuildCache cache(capacity, NULL);
+  {
+    // Rows larger than a quarter of the capacity aren't cached.
+    MemPool pool;
+    vector<Tuple*> tuples;
+    MakeRows(capacity / TUPLE_SIZE / 8 + 1, 'a', &pool, &tuples);
+    EXPECT_TRUE(cache.Insert("big", 2, &tuples, &pool) == NULL);
+  }
+
+  JoinBuildCache::EntryPtr first;
+  for (int i = 0; i < 10; ++i) {
+    MemPool pool;
+    vector<Tuple*> tuples;
+    MakeRows(capacity / TUPLE_SIZE / 32, 'a' + i, &pool, &tuples);
+    string key(1, 'a' + i);
+    JoinBuildCache::EntryPtr entry = cache.Insert(key, 2, &tuples, &pool);
+    ASSERT_TRUE(entry != NULL) << key;
+    if (i == 0) first = entry;
+    // Keep "b" in use.
+    if (i > 1) EXPECT_TRUE(cache.Lookup("b") != NULL);
+    EXPECT_LE(cache.cached_bytes(), capacity);
+  }
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  EXPECT_TRUE(cache.Lookup("b") != NULL);
+  EXPECT_TRUE(cache.Lookup("j") != NULL);
+  EXPECT_EQ(FirstByte(first->GetRow(0), 0), 'a');
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
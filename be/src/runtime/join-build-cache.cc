@@ -0,0 +1,95 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/join-build-cache.h"
+
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+JoinBuildCache::Entry::Entry(MemTracker* mem_tracker, int num_tuples)
+  : pool_(new MemPool(mem_tracker)),
+    num_tuples_(num_tuples),
+    byte_size_(0) {
+  DCHECK_GT(num_tuples, 0);
+}
+
+JoinBuildCache::JoinBuildCache(int64_t capacity, MemTracker* mem_tracker)
+  : capacity_(capacity),
+    mem_tracker_(mem_tracker),
+    cached_bytes_(0),
+    num_hits_(0),
+    num_misses_(0) {
+}
+
+JoinBuildCache::EntryPtr JoinBuildCache::Lookup(const string& key) {
+  lock_guard<mutex> l(lock_);
+  EntryMap::iterator it = entries_.find(key);
+  if (it == entries_.end()) {
+    ++num_misses_;
+    return EntryPtr();
+  }
+  ++num_hits_;
+  lru_.splice(lru_.begin(), lru_, it->second.second);
+  return it->second.first;
+}
+
+JoinBuildCache::EntryPtr JoinBuildCache::Insert(const string& key, int num_tuples,
+    vector<Tuple*>* tuples, MemPool* pool) {
+  DCHECK_EQ(tuples->size() % num_tuples, 0);
+  int64_t byte_size = pool->GetTotalChunkSizes() + tuples->size() * sizeof(Tuple*);
+  if (byte_size > capacity_ / 4) return EntryPtr();
+
+  lock_guard<mutex> l(lock_);
+  // Another join may have built the same rows at the same time.
+  if (entries_.find(key) != entries_.end()) return EntryPtr();
+  while (cached_bytes_ + byte_size > capacity_) {
+    DCHECK(!lru_.empty());
+    EntryMap::iterator victim = entries_.find(lru_.back());
+    cached_bytes_ -= victim->second.first->byte_size();
+    entries_.erase(victim);
+    lru_.pop_back();
+  }
+
+  EntryPtr entry(new Entry(mem_tracker_, num_tuples));
+  entry->tuples_.swap(*tuples);
+  entry->pool_->AcquireData(pool, false);
+  entry->byte_size_ = byte_size;
+  lru_.push_front(key);
+  entries_[key] = make_pair(entry, lru_.begin());
+  cached_bytes_ += byte_size;
+  return entry;
+}
+
+int64_t JoinBuildCache::cached_bytes() {
+  lock_guard<mutex> l(lock_);
+  return cached_bytes_;
+}
+
+int64_t JoinBuildCache::num_hits() {
+  lock_guard<mutex> l(lock_);
+  return num_hits_;
+}
+
+int64_t JoinBuildCache::num_misses() {
+  lock_guard<mutex> l(lock_);
+  return num_misses_;
+}
+
+}
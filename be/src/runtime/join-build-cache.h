@@ -0,0 +1,117 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_JOIN_BUILD_CACHE_H
+#define IMPALA_RUNTIME_JOIN_BUILD_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "runtime/mem-pool.h"
+
+namespace impala {
+
+class MemTracker;
+class Tuple;
+class TupleRow;
+
+// Cache of the build rows of hash joins, so that queries that join with the same
+// small table over and over (e.g. star-schema queries with their dimension tables)
+// don't need to scan and ship it every time.  The key is computed by the planner and
+// identifies the rows and their tuple layout (see HdfsScanNode.getCacheKey()); it
+// changes whenever the table's files do.
+// An entry owns the tuple data of its rows.  Entries are immutable and shared by all
+// joins that use them; an evicted entry stays valid until the last join releases it.
+// The cache holds at most 'capacity' bytes of tuple data, evicting the least recently
+// used entries.  All functions are thread safe.
+// ExecEnv keeps a second instance for the groups of pre-aggregations, whose rows are
+// a single aggregation tuple (see AggregationNode).
+class JoinBuildCache {
+ public:
+  class Entry {
+   public:
+    int num_rows() const { return tuples_.size() / num_tuples_; }
+
+    TupleRow* GetRow(int row_idx) const {
+      return reinterpret_cast<TupleRow*>(
+          const_cast<Tuple**>(&tuples_[row_idx * num_tuples_]));
+    }
+
+    int64_t byte_size() const { return byte_size_; }
+
+   private:
+    friend class JoinBuildCache;
+
+    Entry(MemTracker* mem_tracker, int num_tuples);
+
+    // Holds the tuple data of the rows.
+    boost::scoped_ptr<MemPool> pool_;
+
+    // The tuple ptrs of all rows, num_tuples_ per row.
+    std::vector<Tuple*> tuples_;
+    int num_tuples_;
+
+    int64_t byte_size_;
+  };
+
+  typedef boost::shared_ptr<Entry> EntryPtr;
+
+  // The tuple data of cached entries is charged against 'mem_tracker', if non-NULL.
+  JoinBuildCache(int64_t capacity, MemTracker* mem_tracker);
+
+  // Returns the entry for 'key', or NULL if there is none.
+  EntryPtr Lookup(const std::string& key);
+
+  // Caches the build rows in 'tuples' (the tuple ptrs of all rows, 'num_tuples' per
+  // row), whose tuple data is in 'pool'.  On success, swaps 'tuples' into the entry,
+  // moves all of 'pool''s memory into it and returns the entry; the rows stay valid as
+  // long as the returned entry is held.  Returns NULL, leaving the arguments alone, if
+  // there already is an entry for 'key' or the rows are larger than a quarter of
+  // the capacity.
+  EntryPtr Insert(const std::string& key, int num_tuples, std::vector<Tuple*>* tuples,
+      MemPool* pool);
+
+  int64_t capacity() const { return capacity_; }
+  int64_t cached_bytes();
+  int64_t num_hits();
+  int64_t num_misses();
+
+ private:
+  const int64_t capacity_;
+  MemTracker* mem_tracker_;
+
+  // Protects all members below.
+  boost::mutex lock_;
+
+  // Keys of the cached entries, most recently used first, and the entries by key.
+  typedef std::list<std::string> KeyList;
+  KeyList lru_;
+  typedef std::map<std::string, std::pair<EntryPtr, KeyList::iterator> > EntryMap;
+  EntryMap entries_;
+
+  int64_t cached_bytes_;
+  int64_t num_hits_;
+  int64_t num_misses_;
+};
+
+}
+
+#endif
@@ -140,6 +140,33 @@ TEST(MemPoolTest, Keep) {
   EXPECT_EQ(p2.GetTotalChunkSizes(), 4 * 1024);
 
 }
+
+TEST(MemPoolTest, FreeAllButOneChunk) {
+  MemPool p;
+  p.Allocate(4 * 1024);
+  p.Allocate(8 * 1024);
+  p.Allocate(16 * 1024);
+  // chunks larger than the maximum chunk size aren't kept
+  p.Allocate(600 * 1024);
+  EXPECT_EQ(p.GetTotalChunkSizes(), (4 + 8 + 16 + 600) * 1024);
+
+  // only the 16K chunk is left
+  p.FreeAllButOneChunk();
+  EXPECT_EQ(p.total_allocated_bytes(), 0);
+  EXPECT_EQ(p.GetTotalChunkSizes(), 16 * 1024);
+
+  // and gets reused
+  p.Allocate(10 * 1024);
+  EXPECT_EQ(p.total_allocated_bytes(), 10 * 1024);
+  EXPECT_EQ(p.GetTotalChunkSizes(), 16 * 1024);
+
+  // a pool without chunks stays empty
+  MemPool p2;
+  p2.FreeAllButOneChunk();
+  EXPECT_EQ(p2.GetTotalChunkSizes(), 0);
+  p2.Allocate(1024);
+  EXPECT_EQ(p2.total_allocated_bytes(), 1024);
+}
 }
 
 int main(int argc, char **argv) {
@@ -13,6 +13,8 @@
 // limitations under the License.
 
 #include "runtime/mem-pool.h"
+#include "runtime/chunk-allocator.h"
+#include "runtime/mem-tracker.h"
 
 #include <stdio.h>
 #include <sstream>
@@ -30,7 +32,8 @@ MemPool::MemPool()
     last_offset_conversion_chunk_idx_(-1),
     chunk_size_(0),
     total_allocated_bytes_(0),
-    peak_allocated_bytes_(0) {
+    peak_allocated_bytes_(0),
+    mem_tracker_(NULL) {
 }
 
 MemPool::MemPool(int chunk_size)
@@ -39,37 +42,29 @@ MemPool::MemPool(int chunk_size)
     // round up chunk size to nearest 8 bytes
     chunk_size_(((chunk_size + 7) / 8) * 8),
     total_allocated_bytes_(0),
-    peak_allocated_bytes_(0) {
+    peak_allocated_bytes_(0),
+    mem_tracker_(NULL) {
   DCHECK_GT(chunk_size_, 0);
 }
 
-MemPool::MemPool(const vector<string>& chunks)
+MemPool::MemPool(MemTracker* mem_tracker, int chunk_size)
   : current_chunk_idx_(-1),
     last_offset_conversion_chunk_idx_(-1),
-    chunk_size_(0),
+    chunk_size_(((chunk_size + 7) / 8) * 8),
     total_allocated_bytes_(0),
-    peak_allocated_bytes_(0) {
-  if (chunks.empty()) return;
-  chunks_.reserve(chunks.size());
-  for (int i = 0; i < chunks.size(); ++i) {
-    chunks_.push_back(ChunkInfo());
-    ChunkInfo& chunk = chunks_.back();
-    chunk.owns_data = true;
-    chunk.data = new uint8_t[chunks[i].size()];
-    memcpy(chunk.data, chunks[i].data(), chunks[i].size());
-    chunk.size = chunks[i].size();
-    chunk.allocated_bytes = chunk.size;
-    chunk.cumulative_allocated_bytes = total_allocated_bytes_;
-    total_allocated_bytes_ += chunk.size;
-  }
-  current_chunk_idx_ = chunks_.size() - 1;
+    peak_allocated_bytes_(0),
+    mem_tracker_(mem_tracker) {
+  DCHECK_GE(chunk_size_, 0);
 }
 
 MemPool::~MemPool() {
+  int64_t freed_bytes = 0;
   for (size_t i = 0; i < chunks_.size(); ++i) {
     if (!chunks_[i].owns_data) continue;
-    delete [] chunks_[i].data;
+    freed_bytes += chunks_[i].size;
+    ChunkAllocator::Free(chunks_[i].data, chunks_[i].size);
   }
+  if (mem_tracker_ != NULL) mem_tracker_->Release(freed_bytes);
 }
 
 void MemPool::FindChunk(int min_size) {
@@ -105,13 +100,15 @@ void MemPool::FindChunk(int min_size) {
       }
     }
     chunk_size = ::max(min_size, chunk_size);
+    if (mem_tracker_ != NULL) mem_tracker_->Consume(chunk_size);
     // If there are no free chunks put it at the end, otherwise before the first free.
+    ChunkInfo chunk(ChunkAllocator::Allocate(chunk_size), chunk_size);
     if (first_free_idx == static_cast<int>(chunks_.size())) {
-      chunks_.push_back(ChunkInfo(chunk_size));
+      chunks_.push_back(chunk);
     } else {
       current_chunk_idx_ = first_free_idx;
       vector<ChunkInfo>::iterator insert_chunk = chunks_.begin() + current_chunk_idx_;
-      chunks_.insert(insert_chunk, ChunkInfo(chunk_size));
+      chunks_.insert(insert_chunk, chunk);
     }
   }
 
@@ -140,6 +137,15 @@ void MemPool::AcquireData(MemPool* src, bool keep_current) {
   if (num_acquired_chunks <= 0) return;
 
   vector<ChunkInfo>::iterator end_chunk = src->chunks_.begin() + num_acquired_chunks;
+  if (mem_tracker_ != src->mem_tracker_) {
+    int64_t acquired_bytes = 0;
+    for (vector<ChunkInfo>::iterator chunk = src->chunks_.begin(); chunk != end_chunk;
+         ++chunk) {
+      if (chunk->owns_data) acquired_bytes += chunk->size;
+    }
+    if (src->mem_tracker_ != NULL) src->mem_tracker_->Release(acquired_bytes);
+    if (mem_tracker_ != NULL) mem_tracker_->Consume(acquired_bytes);
+  }
   // insert new chunks after current_chunk_idx_
   vector<ChunkInfo>::iterator insert_chunk = chunks_.begin() + current_chunk_idx_ + 1;
   chunks_.insert(insert_chunk, src->chunks_.begin(), end_chunk);
@@ -173,6 +179,31 @@ void MemPool::AcquireData(MemPool* src, bool keep_current) {
   DCHECK(CheckIntegrity(false));
 }
 
+void MemPool::FreeAllButOneChunk() {
+  int keep_idx = -1;
+  for (int i = 0; i < chunks_.size(); ++i) {
+    if (!chunks_[i].owns_data || chunks_[i].size > MAX_CHUNK_SIZE) continue;
+    if (keep_idx == -1 || chunks_[i].size > chunks_[keep_idx].size) keep_idx = i;
+  }
+  int64_t freed_bytes = 0;
+  for (int i = 0; i < chunks_.size(); ++i) {
+    if (i == keep_idx || !chunks_[i].owns_data) continue;
+    freed_bytes += chunks_[i].size;
+    ChunkAllocator::Free(chunks_[i].data, chunks_[i].size);
+  }
+  if (mem_tracker_ != NULL) mem_tracker_->Release(freed_bytes);
+  if (keep_idx == -1) {
+    chunks_.clear();
+  } else {
+    ChunkInfo chunk(chunks_[keep_idx].data, chunks_[keep_idx].size);
+    chunks_.assign(1, chunk);
+  }
+  current_chunk_idx_ = -1;
+  last_offset_conversion_chunk_idx_ = -1;
+  total_allocated_bytes_ = 0;
+  DCHECK(CheckIntegrity(false));
+}
+
 bool MemPool::Contains(uint8_t* ptr, int size) {
   for (int i = 0; i < chunks_.size(); ++i) {
     const ChunkInfo& info = chunks_[i];
@@ -25,6 +25,8 @@
 
 namespace impala {
 
+class MemTracker;
+
 // A MemPool maintains a list of memory chunks from which it allocates memory in
 // response to Allocate() calls;
 // Chunks stay around for the lifetime of the mempool or until they are passed on to
@@ -64,6 +66,13 @@ namespace impala {
 // remains unchanged. 
 // The one remaining (empty) chunk is released:
 //    delete p;
+//
+// Chunks come from, and are returned to, the process-wide ChunkAllocator, which
+// recycles them across pools.
+//
+// If the pool is given a MemTracker, the sizes of the chunks it owns are charged
+// against the tracker: when a chunk is created in FindChunk(), when chunks move
+// between pools with different trackers in AcquireData(), and when they are freed.
 
 class MemPool {
  public:
@@ -73,11 +82,9 @@ class MemPool {
   // Chunk_size must be > 0.
   MemPool(int chunk_size);
 
-  // Construct a mempool by initializing the chunk data with a copy of the data
-  // backing the strings (each chunk's allocated_bytes == size).
-  // Allocate() must never be called on this pool.
-  // TODO: fix this so we don't need to make a copy
-  MemPool(const std::vector<std::string>& chunks);
+  // Allocates mempool whose chunks are charged against 'mem_tracker'.  If
+  // 'chunk_size' is > 0, all chunks have that size.
+  explicit MemPool(MemTracker* mem_tracker, int chunk_size = 0);
 
   // Frees all chunks of memory.
   ~MemPool();
@@ -117,6 +124,12 @@ class MemPool {
     DCHECK(CheckIntegrity(false));
   }
 
+  // Same as Clear(), but only keeps the largest chunk of at most MAX_CHUNK_SIZE bytes
+  // (if any) and frees the others.  Lets a pool that is emptied after every use
+  // start over without going back to the ChunkAllocator, while not holding on to
+  // more than one chunk.
+  void FreeAllButOneChunk();
+
   // Absorb all chunks that hold data from src. If keep_current is true, let src hold on
   // to its last allocated chunk that contains data.
   // All offsets handed out by calls to GetOffset()/GetCurrentOffset() for 'src'
@@ -134,6 +147,7 @@ class MemPool {
 
   int64_t total_allocated_bytes() const { return total_allocated_bytes_; }
   int64_t peak_allocated_bytes() const { return peak_allocated_bytes_; }
+  MemTracker* mem_tracker() const { return mem_tracker_; }
 
   // Return sum of chunk_sizes_.
   int64_t GetTotalChunkSizes() const;
@@ -178,9 +192,10 @@ class MemPool {
     // bytes allocated via Allocate() in this chunk
     int allocated_bytes;
 
-    explicit ChunkInfo(int size)
+    // 'data' comes from ChunkAllocator::Allocate(size).
+    ChunkInfo(uint8_t* data, int size)
       : owns_data(true),
-        data(new uint8_t[size]),
+        data(data),
         size(size),
         cumulative_allocated_bytes(0),
         allocated_bytes(0) {}
@@ -214,6 +229,9 @@ class MemPool {
 
   std::vector<ChunkInfo> chunks_;
 
+  // if non-NULL, the sizes of owned chunks are charged against this tracker
+  MemTracker* mem_tracker_;
+
   // Find or allocated a chunk with at least min_size spare capacity and update
   // current_chunk_idx_. Also updates chunks_, chunk_sizes_ and allocated_bytes_
   // if a new chunk needs to be created.
@@ -0,0 +1,131 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "runtime/mem-pool.h"
+#include "runtime/mem-tracker.h"
+
+using namespace boost;
+
+namespace impala {
+
+TEST(MemTrackerTest, SingleTracker) {
+  MemTracker t(100);
+  EXPECT_FALSE(t.LimitExceeded());
+  t.Consume(10);
+  EXPECT_EQ(t.consumption(), 10);
+  t.Consume(90);
+  EXPECT_EQ(t.consumption(), 100);
+  EXPECT_FALSE(t.LimitExceeded());
+  t.Consume(1);
+  EXPECT_TRUE(t.LimitExceeded());
+  EXPECT_EQ(t.GetExceededTracker(), &t);
+  t.Release(51);
+  EXPECT_EQ(t.consumption(), 50);
+  EXPECT_EQ(t.peak_consumption(), 101);
+  EXPECT_FALSE(t.LimitExceeded());
+  t.Release(50);
+}
+
+TEST(MemTrackerTest, Hierarchy) {
+  MemTracker root(100, "root");
+  MemTracker child1(80, "child1", &root);
+  MemTracker child2(-1, "child2", &root);
+
+  child1.Consume(50);
+  EXPECT_EQ(child1.consumption(), 50);
+  EXPECT_EQ(root.consumption(), 50);
+  EXPECT_FALSE(child1.LimitExceeded());
+
+  // child2 has no limit of its own, but shares the root's
+  child2.Consume(60);
+  EXPECT_EQ(child2.consumption(), 60);
+  EXPECT_EQ(root.consumption(), 110);
+  EXPECT_TRUE(root.LimitExceeded());
+  EXPECT_TRUE(child1.LimitExceeded());
+  EXPECT_TRUE(child2.LimitExceeded());
+  EXPECT_EQ(child2.GetExceededTracker(), &root);
+
+  child1.Consume(40);
+  EXPECT_EQ(child1.GetExceededTracker(), &child1);
+
+  child1.Release(90);
+  child2.Release(60);
+  EXPECT_EQ(root.consumption(), 0);
+  EXPECT_FALSE(child1.LimitExceeded());
+  EXPECT_EQ(root.peak_consumption(), 150);
+}
+
+TEST(MemTrackerTest, QueryTrackers) {
+  MemTracker process;
+  TUniqueId id;
+  id.hi = 1;
+  id.lo = 2;
+  shared_ptr<MemTracker> t1 = MemTracker::GetQueryMemTracker(id, 100, &process);
+  shared_ptr<MemTracker> t2 = MemTracker::GetQueryMemTracker(id, 100, &process);
+  EXPECT_EQ(t1.get(), t2.get());
+  EXPECT_EQ(t1->parent(), &process);
+
+  id.lo = 3;
+  shared_ptr<MemTracker> t3 = MemTracker::GetQueryMemTracker(id, 100, &process);
+  EXPECT_NE(t1.get(), t3.get());
+
+  t1->Consume(10);
+  t3->Consume(20);
+  EXPECT_EQ(process.consumption(), 30);
+
+  // Once all references are gone the tracker is removed and returns its
+  // consumption to the parent.
+  t3.reset();
+  EXPECT_EQ(process.consumption(), 10);
+  t3 = MemTracker::GetQueryMemTracker(id, 100, &process);
+  EXPECT_EQ(t3->consumption(), 0);
+  t1->Release(10);
+}
+
+TEST(MemTrackerTest, MemPool) {
+  MemTracker tracker1;
+  MemTracker tracker2;
+  {
+    MemPool p1(&tracker1);
+    p1.Allocate(100);
+    EXPECT_EQ(tracker1.consumption(), p1.GetTotalChunkSizes());
+
+    // chunks that move to a pool with a different tracker move their consumption
+    // with them
+    MemPool p2(&tracker2);
+    p2.AcquireData(&p1, false);
+    EXPECT_EQ(tracker1.consumption(), 0);
+    EXPECT_EQ(tracker2.consumption(), p2.GetTotalChunkSizes());
+
+    // untracked pools release the consumption
+    MemPool p3;
+    p3.AcquireData(&p2, false);
+    EXPECT_EQ(tracker2.consumption(), 0);
+
+    p1.Allocate(10 * 1024);
+    EXPECT_EQ(tracker1.consumption(), p1.GetTotalChunkSizes());
+  }
+  EXPECT_EQ(tracker1.consumption(), 0);
+  EXPECT_EQ(tracker2.consumption(), 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
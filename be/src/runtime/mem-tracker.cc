@@ -0,0 +1,90 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/mem-tracker.h"
+
+#include <sstream>
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+#include "util/debug-util.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+mutex MemTracker::query_trackers_lock_;
+MemTracker::QueryTrackerMap MemTracker::query_trackers_;
+
+MemTracker::MemTracker(int64_t byte_limit, const string& label, MemTracker* parent)
+  : limit_(byte_limit),
+    label_(label),
+    parent_(parent),
+    consumption_(0),
+    peak_consumption_(0),
+    is_query_tracker_(false) {
+  for (MemTracker* tracker = this; tracker != NULL; tracker = tracker->parent_) {
+    all_trackers_.push_back(tracker);
+    if (tracker->has_limit()) limit_trackers_.push_back(tracker);
+  }
+}
+
+MemTracker::~MemTracker() {
+  // Whatever is still charged to this tracker is leaving the hierarchy with it.
+  if (parent_ != NULL && consumption_ != 0) parent_->Release(consumption_);
+  if (is_query_tracker_) {
+    lock_guard<mutex> l(query_trackers_lock_);
+    QueryTrackerMap::iterator it = query_trackers_.find(query_id_);
+    // A new tracker for the same query may have been registered after our last
+    // reference went away.
+    if (it != query_trackers_.end() && it->second.expired()) query_trackers_.erase(it);
+  }
+}
+
+shared_ptr<MemTracker> MemTracker::GetQueryMemTracker(
+    const TUniqueId& id, int64_t byte_limit, MemTracker* parent) {
+  lock_guard<mutex> l(query_trackers_lock_);
+  QueryTrackerMap::iterator it = query_trackers_.find(id);
+  if (it != query_trackers_.end()) {
+    shared_ptr<MemTracker> tracker = it->second.lock();
+    if (tracker.get() != NULL) return tracker;
+  }
+  stringstream label;
+  label << "Query " << PrintId(id);
+  shared_ptr<MemTracker> tracker(new MemTracker(byte_limit, label.str(), parent));
+  tracker->is_query_tracker_ = true;
+  tracker->query_id_ = id;
+  query_trackers_[id] = tracker;
+  return tracker;
+}
+
+const MemTracker* MemTracker::GetExceededTracker() const {
+  for (vector<MemTracker*>::const_iterator tracker = limit_trackers_.begin();
+       tracker != limit_trackers_.end(); ++tracker) {
+    if ((*tracker)->consumption() > (*tracker)->limit()) return *tracker;
+  }
+  return NULL;
+}
+
+string MemTracker::DebugString() const {
+  stringstream out;
+  out << "MemTracker(label=" << label_
+      << " limit=" << limit_
+      << " consumption=" << consumption_
+      << " peak=" << peak_consumption_ << ")";
+  return out.str();
+}
+
+}
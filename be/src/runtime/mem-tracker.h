@@ -0,0 +1,141 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_MEM_TRACKER_H
+#define IMPALA_RUNTIME_MEM_TRACKER_H
+
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "util/uid-util.h"
+#include "gen-cpp/Types_types.h"  // for TUniqueId
+
+namespace impala {
+
+// A MemTracker tracks the memory consumption of some part of the system and
+// optionally enforces a byte limit on it.  Trackers form a hierarchy:
+// process -> query -> fragment instance -> exec node.  Consuming memory in a tracker
+// also consumes it in all of its ancestors, so each level sees the total
+// consumption of everything below it.
+// Exceeding a limit doesn't fail the allocation that did it (most allocation sites,
+// e.g. MemPool::Allocate(), can't return an error); instead, exec nodes check
+// LimitExceeded() at well-defined points (RuntimeState::CheckQueryState()) and
+// abort the query with an error status.  Since consumption is only checked
+// periodically, the actual peak can overshoot a limit by roughly one row batch's
+// worth of memory per operator.
+// Consume()/Release() are thread-safe; the tree structure is fixed at construction.
+class MemTracker {
+ public:
+  // byte_limit < 0 means no limit.  'parent' must outlive this tracker.
+  MemTracker(int64_t byte_limit = -1, const std::string& label = std::string(),
+      MemTracker* parent = NULL);
+
+  ~MemTracker();
+
+  // Returns the tracker for the query 'id', creating it (with 'byte_limit' and
+  // 'parent') if it doesn't exist yet.  All fragment instances of a query on this
+  // node share the same query tracker; it is removed once the last reference to it
+  // is released.
+  static boost::shared_ptr<MemTracker> GetQueryMemTracker(
+      const TUniqueId& id, int64_t byte_limit, MemTracker* parent);
+
+  // Increases consumption of this tracker and all of its ancestors by 'bytes'.
+  void Consume(int64_t bytes) {
+    if (bytes == 0) return;
+    for (std::vector<MemTracker*>::iterator tracker = all_trackers_.begin();
+         tracker != all_trackers_.end(); ++tracker) {
+      int64_t consumption = __sync_add_and_fetch(&(*tracker)->consumption_, bytes);
+      (*tracker)->UpdatePeak(consumption);
+    }
+  }
+
+  // Decreases consumption of this tracker and all of its ancestors by 'bytes'.
+  void Release(int64_t bytes) {
+    if (bytes == 0) return;
+    for (std::vector<MemTracker*>::iterator tracker = all_trackers_.begin();
+         tracker != all_trackers_.end(); ++tracker) {
+      __sync_fetch_and_add(&(*tracker)->consumption_, -bytes);
+    }
+  }
+
+  // Returns true if this tracker or any of its ancestors is over its limit.
+  bool LimitExceeded() const {
+    for (std::vector<MemTracker*>::const_iterator tracker = limit_trackers_.begin();
+         tracker != limit_trackers_.end(); ++tracker) {
+      if ((*tracker)->consumption() > (*tracker)->limit()) return true;
+    }
+    return false;
+  }
+
+  // Returns the first tracker, starting from this one, that is over its limit, or
+  // NULL if there is none.
+  const MemTracker* GetExceededTracker() const;
+
+  int64_t limit() const { return limit_; }
+  bool has_limit() const { return limit_ >= 0; }
+  const std::string& label() const { return label_; }
+  MemTracker* parent() const { return parent_; }
+  int64_t consumption() const { return consumption_; }
+  int64_t peak_consumption() const { return peak_consumption_; }
+
+  std::string DebugString() const;
+
+ private:
+  typedef boost::unordered_map<TUniqueId, boost::weak_ptr<MemTracker> > QueryTrackerMap;
+
+  // Raises peak_consumption_ to 'consumption' if it is larger.
+  void UpdatePeak(int64_t consumption) {
+    int64_t peak = peak_consumption_;
+    while (consumption > peak) {
+      int64_t old_peak = __sync_val_compare_and_swap(
+          &peak_consumption_, peak, consumption);
+      if (old_peak == peak) break;
+      peak = old_peak;
+    }
+  }
+
+  int64_t limit_;
+  std::string label_;
+  MemTracker* parent_;
+
+  int64_t consumption_;
+  int64_t peak_consumption_;
+
+  // this tracker plus all of its ancestors
+  std::vector<MemTracker*> all_trackers_;
+
+  // the subset of all_trackers_ that have a limit
+  std::vector<MemTracker*> limit_trackers_;
+
+  // Set for trackers created by GetQueryMemTracker(); used to remove this tracker
+  // from query_trackers_ in the d'tor.
+  bool is_query_tracker_;
+  TUniqueId query_id_;
+
+  // Protects query_trackers_.
+  static boost::mutex query_trackers_lock_;
+
+  // All live query trackers, by query id.
+  static QueryTrackerMap query_trackers_;
+};
+
+}
+
+#endif
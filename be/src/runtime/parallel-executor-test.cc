@@ -17,6 +17,7 @@
 #include <boost/bind.hpp>
 
 #include "runtime/parallel-executor.h"
+#include "util/thread-pool.h"
 
 using namespace boost;
 using namespace std;
@@ -41,6 +42,10 @@ class ParallelExecutorTest {
     return Status::OK;
   }
 
+  static Status Fail(void* value) {
+    return Status("failed");
+  }
+
   ParallelExecutorTest(int num_updates) {
     updates_found_.resize(num_updates);
   }
@@ -72,6 +77,29 @@ TEST(ParallelExecutorTest, Basic) {
   test_caller.Validate();
 }
 
+TEST(ParallelExecutorTest, ThreadPool) {
+  int num_work_items = 100;
+  ParallelExecutorTest test_caller(num_work_items);
+
+  vector<long> args;
+  for (int i = 0; i < num_work_items; ++i) {
+    args.push_back(i);
+  }
+
+  ThreadPool pool(4);
+  Status status = ParallelExecutor::Exec(&pool,
+      bind<Status>(mem_fn(&ParallelExecutorTest::UpdateFunction), &test_caller, _1),
+      reinterpret_cast<void**>(&args[0]), args.size());
+  EXPECT_TRUE(status.ok());
+  test_caller.Validate();
+
+  // The pool can be reused, and returns the status of a failed item.
+  vector<long> failing_args(10, 0);
+  status = ParallelExecutor::Exec(&pool, bind<Status>(&ParallelExecutorTest::Fail, _1),
+      reinterpret_cast<void**>(&failing_args[0]), failing_args.size());
+  EXPECT_FALSE(status.ok());
+}
+
 }
 
 int main(int argc, char **argv) {
@@ -14,8 +14,11 @@
 
 #include "runtime/parallel-executor.h"
 
+#include <boost/bind.hpp>
 #include <boost/thread/thread.hpp>
 
+#include "util/thread-pool.h"
+
 using namespace boost;
 using namespace impala;
 using namespace std;
@@ -34,6 +37,21 @@ Status ParallelExecutor::Exec(Function function, void** args, int num_args) {
   return status;
 }
 
+Status ParallelExecutor::Exec(
+    ThreadPool* pool, Function function, void** args, int num_args) {
+  if (pool == NULL) return Exec(function, args, num_args);
+  PoolState state;
+  state.num_remaining = num_args;
+  for (int i = 0; i < num_args; ++i) {
+    pool->Offer(bind(&ParallelExecutor::PoolWorker, function, args[i], &state));
+  }
+  unique_lock<mutex> l(state.lock);
+  while (state.num_remaining > 0) {
+    state.done_cv.wait(l);
+  }
+  return state.status;
+}
+
 void ParallelExecutor::Worker(Function function, void* arg, mutex* lock, Status* status) {
   Status local_status = function(arg);
   if (!local_status.ok()) {
@@ -42,4 +60,11 @@ void ParallelExecutor::Worker(Function function, void* arg, mutex* lock, Status*
   }
 }
 
-
+void ParallelExecutor::PoolWorker(Function function, void* arg, PoolState* state) {
+  Status local_status = function(arg);
+  unique_lock<mutex> l(state->lock);
+  if (!local_status.ok() && state->status.ok()) state->status = local_status;
+  // 'state' is destroyed as soon as Exec() sees the last item finish, so don't
+  // touch it after releasing the lock.
+  if (--state->num_remaining == 0) state->done_cv.notify_one();
+}
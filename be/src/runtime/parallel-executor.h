@@ -17,11 +17,14 @@
 #define IMPALA_RUNTIME_PARALLEL_EXECUTOR_H
 
 #include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
 #include <boost/thread/mutex.hpp>
 #include "common/status.h"
 
 namespace impala {
 
+class ThreadPool;
+
 // This is a class that executes multiple functions in parallel with different arguments 
 // using a thread pool.  
 // TODO: look into an API for this.  Boost has one that is in review but not yet official.
@@ -43,10 +46,28 @@ class ParallelExecutor {
   // Otherwise, returns Status::OK when all work items have been executed.
   static Status Exec(Function function, void** args, int num_args);
 
+  // Same as above, but runs the work items on the threads of 'pool' instead of
+  // creating a thread per item, so at most pool->num_threads() of them run at a time.
+  // If 'pool' is NULL, this is the same as Exec(function, args, num_args).
+  // The work items must not wait for other items in 'pool'.
+  static Status Exec(ThreadPool* pool, Function function, void** args, int num_args);
+
  private:
+  // Completion state of a call to Exec() with a thread pool.
+  struct PoolState {
+    boost::mutex lock;
+    // signalled when num_remaining drops to 0
+    boost::condition_variable done_cv;
+    int num_remaining;
+    Status status;
+  };
+
   // Worker thread function which calls function(arg).  This function updates
   // *status taking *lock to synchronize results from different threads.
   static void Worker(Function function, void* arg, boost::mutex* lock, Status* status);
+
+  // Work item for the pool: calls function(arg) and updates 'state'.
+  static void PoolWorker(Function function, void* arg, PoolState* state);
 };
 
 }
@@ -18,6 +18,7 @@
 #include <protocol/TBinaryProtocol.h>
 #include <protocol/TDebugProtocol.h>
 #include <transport/TBufferTransports.h>
+#include <boost/bind.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/foreach.hpp>
@@ -33,14 +34,20 @@
 #include "exprs/expr.h"
 #include "runtime/descriptors.h"
 #include "runtime/data-stream-mgr.h"
+#include "runtime/mem-tracker.h"
 #include "runtime/row-batch.h"
 #include "util/cpu-info.h"
 #include "util/debug-util.h"
 #include "util/container-util.h"
+#include "util/stopwatch.h"
 #include "gen-cpp/ImpalaPlanService_types.h"
 
 DEFINE_bool(serialize_batch, false, "serialize and deserialize each returned row batch");
 DEFINE_int32(status_report_interval, 5, "interval between profile reports; in seconds");
+DEFINE_int64(codegen_min_scan_bytes, 64 * 1024, "fragments that only read hdfs scan "
+    "ranges totalling fewer bytes than this run without codegen. 0 always uses codegen.");
+DEFINE_bool(async_codegen, true, "if true, jit compile on a separate thread while the "
+    "fragment starts executing without codegen.");
 
 using namespace std;
 using namespace boost;
@@ -50,13 +57,17 @@ using namespace apache::thrift::transport;
 
 namespace impala {
 
+const string PlanFragmentExecutor::MEMORY_USAGE_COUNTER = "MemoryUsage";
+
 PlanFragmentExecutor::PlanFragmentExecutor(
     ExecEnv* exec_env, const ReportStatusCallback& report_status_cb)
   : exec_env_(exec_env),
     report_status_cb_(report_status_cb),
     report_thread_active_(false),
     done_(false),
-    prepared_(false) {
+    prepared_(false),
+    row_batch_time_(NULL),
+    fragment_thread_counters_(NULL) {
 }
 
 PlanFragmentExecutor::~PlanFragmentExecutor() {
@@ -66,6 +77,10 @@ PlanFragmentExecutor::~PlanFragmentExecutor() {
   row_batch_.reset(NULL);
   // Prepare may not have been called, which sets runtime_state_
   if (runtime_state_.get() != NULL) {
+    // The compile thread sets jitted function pointers in the exec nodes.
+    if (runtime_state_->llvm_codegen() != NULL) {
+      runtime_state_->llvm_codegen()->WaitForCompile(true);
+    }
     plan_->Close(runtime_state_.get());
     if (sink_.get() != NULL) {
       sink_->Close(runtime_state());
@@ -83,9 +98,17 @@ Status PlanFragmentExecutor::Prepare(const TExecPlanFragmentParams& request) {
              << " instance_id=" << PrintId(params.fragment_instance_id);
   VLOG(2) << "params:\n" << ThriftDebugString(params);
 
+  TQueryOptions query_options = request.query_options;
+  string codegen_reason;
+  query_options.disable_codegen = !UseCodegen(request, &codegen_reason);
   runtime_state_.reset(
-      new RuntimeState(params.fragment_instance_id, request.query_options,
+      new RuntimeState(params.fragment_instance_id, query_options,
           request.query_globals.now_string, exec_env_));
+  profile()->AddInfoString("Codegen", codegen_reason);
+  VLOG_QUERY << "Codegen for instance_id=" << PrintId(params.fragment_instance_id)
+             << ": " << codegen_reason;
+  runtime_state_->InitMemTrackers(query_id_);
+  runtime_state_->InitScannerThreadTokens(query_id_);
 
   // set up desc tbl
   DescriptorTbl* desc_tbl = NULL;
@@ -109,21 +132,20 @@ Status PlanFragmentExecutor::Prepare(const TExecPlanFragmentParams& request) {
     int num_senders = FindWithDefault(params.per_exch_num_senders, exch_node->id(), 0);
     DCHECK_GT(num_senders, 0);
     static_cast<ExchangeNode*>(exch_node)->set_num_senders(num_senders);
+    if (params.shared_broadcast_exch_ids.find(exch_node->id())
+        != params.shared_broadcast_exch_ids.end()) {
+      DCHECK(params.__isset.broadcast_stream_id);
+      static_cast<ExchangeNode*>(exch_node)->set_shared_stream_id(
+          params.broadcast_stream_id);
+    }
+    map<PlanNodeId, vector<TPlanFragmentDestination> >::const_iterator relay =
+        params.relay_destinations.find(exch_node->id());
+    if (relay != params.relay_destinations.end()) {
+      static_cast<ExchangeNode*>(exch_node)->set_relay_destinations(relay->second);
+    }
   }
 
   RETURN_IF_ERROR(plan_->Prepare(runtime_state_.get()));
-  
-  if (runtime_state_->llvm_codegen() != NULL) {
-    // After prepare, all functions should have been code-generated.  At this point
-    // we optimize all the functions.
-    Status status = runtime_state_->llvm_codegen()->OptimizeModule();
-    if (!status.ok()) {
-      LOG(ERROR) << "Error with codegen for this query: " << status.GetErrorMsg();
-      // TODO: propagate this to the coordinator and user?  Not really actionable
-      // for them but we'd like them to let us know.
-    }
-    // If codegen failed, we automatically fall back to not using codegen.
-  }
 
   // set scan ranges
   vector<ExecNode*> scan_nodes;
@@ -150,13 +172,75 @@ Status PlanFragmentExecutor::Prepare(const TExecPlanFragmentParams& request) {
 
   // set up profile counters
   rows_produced_counter_ = ADD_COUNTER(profile(), "RowsProduced", TCounterType::UNIT);
+  row_batch_time_ = profile()->AddHistogram("RowBatchTime", TCounterType::CPU_TICKS);
+  fragment_thread_counters_ = profile()->AddThreadCounters("FragmentThreads");
+  profile()->AddDerivedCounter("PeakMemoryUsage", TCounterType::BYTES,
+      bind<int64_t>(&MemTracker::peak_consumption,
+          runtime_state_->instance_mem_tracker()));
+  profile()->AddDerivedCounter(MEMORY_USAGE_COUNTER, TCounterType::BYTES,
+      bind<int64_t>(&MemTracker::consumption, runtime_state_->instance_mem_tracker()));
+
+  // The plan root has evaluated its conjuncts, so every row it returns counts towards
+  // its limit.
+  row_batch_.reset(new RowBatch(plan_->row_desc(),
+      runtime_state_->batch_size(plan_->row_desc(), plan_->limit())));
+
+  LlvmCodeGen* codegen = runtime_state_->llvm_codegen();
+  if (codegen != NULL) {
+    // After prepare, all functions should have been code-generated.  At this point
+    // we optimize and jit compile all the functions.
+    if (FLAGS_async_codegen) {
+      codegen->CompileModuleAsync();
+    } else {
+      Status status = codegen->CompileModule();
+      if (!status.ok()) {
+        LOG(ERROR) << "Error with codegen for this query: " << status.GetErrorMsg();
+        // TODO: propagate this to the coordinator and user?  Not really actionable
+        // for them but we'd like them to let us know.
+      }
+    }
+    // If codegen failed, we automatically fall back to not using codegen.
+  }
 
-  row_batch_.reset(new RowBatch(plan_->row_desc(), runtime_state_->batch_size()));
   VLOG(3) << "plan_root=\n" << plan_->DebugString();
   prepared_ = true;
   return Status::OK;
 }
 
+bool PlanFragmentExecutor::UseCodegen(const TExecPlanFragmentParams& request,
+    string* reason) {
+  if (request.query_options.disable_codegen) {
+    *reason = "Disabled by query option";
+    return false;
+  }
+  *reason = "Enabled";
+  if (FLAGS_codegen_min_scan_bytes <= 0) return true;
+  if (request.fragment.__isset.plan) {
+    BOOST_FOREACH(const TPlanNode& node, request.fragment.plan.nodes) {
+      // The number of rows from other fragments is unknown.
+      if (node.node_type == TPlanNodeType::EXCHANGE_NODE) return true;
+    }
+  }
+  int64_t scan_bytes = 0;
+  BOOST_FOREACH(const PerNodeScanRanges::value_type& entry,
+      request.params.per_node_scan_ranges) {
+    BOOST_FOREACH(const TScanRangeParams& scan_range_params, entry.second) {
+      const TScanRange& scan_range = scan_range_params.scan_range;
+      if (!scan_range.__isset.hdfs_file_split) return true;
+      scan_bytes += scan_range.hdfs_file_split.length;
+    }
+  }
+  if (scan_bytes >= FLAGS_codegen_min_scan_bytes) return true;
+
+  stringstream ss;
+  ss << "Disabled: fragment scans "
+     << PrettyPrinter::Print(scan_bytes, TCounterType::BYTES)
+     << ", less than codegen_min_scan_bytes="
+     << PrettyPrinter::Print(FLAGS_codegen_min_scan_bytes, TCounterType::BYTES);
+  *reason = ss.str();
+  return false;
+}
+
 void PlanFragmentExecutor::PrintVolumeIds(
     const PerNodeScanRanges& per_node_scan_ranges) {
   if (per_node_scan_ranges.empty()) return;
@@ -211,6 +295,7 @@ Status PlanFragmentExecutor::Open() {
 }
 
 Status PlanFragmentExecutor::OpenInternal() {
+  SCOPED_THREAD_COUNTER_MEASUREMENT(fragment_thread_counters_);
   {
     SCOPED_TIMER(profile()->total_time_counter());
     RETURN_IF_ERROR(plan_->Open(runtime_state_.get()));
@@ -232,6 +317,13 @@ Status PlanFragmentExecutor::OpenInternal() {
       }
     }
     RETURN_IF_ERROR(sink_->Send(runtime_state(), batch));
+    if (!sink_->NeedsMoreRows()) {
+      // our receivers have what they need; neither do we need more rows
+      VLOG_QUERY << "sink is done: instance_id="
+                 << runtime_state_->fragment_instance_id();
+      runtime_state_->stream_mgr()->CloseRecvrs(runtime_state_->fragment_instance_id());
+      break;
+    }
   }
 
   // Close the sink *before* stopping the report thread. Close may
@@ -329,7 +421,11 @@ void PlanFragmentExecutor::StopReportThread() {
 
 Status PlanFragmentExecutor::GetNext(RowBatch** batch) {
   VLOG_FILE << "GetNext(): instance_id=" << runtime_state_->fragment_instance_id();
-  Status status = GetNextInternal(batch);
+  Status status;
+  {
+    SCOPED_THREAD_COUNTER_MEASUREMENT(fragment_thread_counters_);
+    status = GetNextInternal(batch);
+  }
   UpdateStatus(status);
   if (done_) {
     VLOG_QUERY << "Finished executing fragment query_id=" << PrintId(query_id_)
@@ -349,7 +445,16 @@ Status PlanFragmentExecutor::GetNextInternal(RowBatch** batch) {
   while (!done_) {
     row_batch_->Reset();
     SCOPED_TIMER(profile()->total_time_counter());
+    StopWatch batch_watch;
+    batch_watch.Start();
     RETURN_IF_ERROR(plan_->GetNext(runtime_state_.get(), row_batch_.get(), &done_));
+    row_batch_time_->Add(batch_watch.ElapsedTime());
+    // The plan may be done before its exchanges' senders are (e.g., because of a
+    // limit): let them stop.
+    if (done_) {
+      runtime_state_->stream_mgr()->CloseRecvrs(runtime_state_->fragment_instance_id());
+    }
+    RETURN_IF_ERROR(runtime_state_->CheckQueryState());
     if (row_batch_->num_rows() > 0) {
       COUNTER_UPDATE(rows_produced_counter_, row_batch_->num_rows());
       *batch = row_batch_.get();
@@ -376,6 +481,8 @@ void PlanFragmentExecutor::Cancel() {
   DCHECK(prepared_);
   runtime_state_->set_is_cancelled(true);
   runtime_state_->stream_mgr()->Cancel(runtime_state_->fragment_instance_id());
+  // wake up threads that are blocked on I/O or on each other
+  plan_->Cancel(runtime_state_.get());
 }
 
 const RowDescriptor& PlanFragmentExecutor::row_desc() {
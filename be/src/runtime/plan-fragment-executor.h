@@ -75,6 +75,10 @@ class PlanFragmentExecutor {
   // information periodically during execution (Open() or GetNext()).
   PlanFragmentExecutor(ExecEnv* exec_env, const ReportStatusCallback& report_status_cb);
 
+  // Name of the counter of the fragment's current memory consumption, which the
+  // coordinator adds up into the memory usage of the query.
+  static const std::string MEMORY_USAGE_COUNTER;
+
   // Closes the underlying plan fragment and frees up all resources allocated
   // in Open()/GetNext().
   // It is an error to delete a PlanFragmentExecutor with a report callback
@@ -160,6 +164,14 @@ class PlanFragmentExecutor {
 
   RuntimeProfile::Counter* rows_produced_counter_;
 
+  // distribution of the times of the plan root's GetNext() calls
+  Histogram* row_batch_time_;
+
+  // cpu time and context switches of the threads executing the fragment in Open()
+  // and GetNext(); the threads of the scan nodes and the sender are measured
+  // separately, in their own profiles
+  RuntimeProfile::ThreadCounters* fragment_thread_counters_;
+
   ObjectPool* obj_pool() { return runtime_state_->obj_pool(); }
 
   // typedef for TPlanFragmentExecParams.per_node_scan_ranges
@@ -197,6 +209,13 @@ class PlanFragmentExecutor {
   // Idempotent.
   void StopReportThread();
 
+  // Decides whether the fragment should run with codegen, and sets 'reason' to the
+  // explanation for the profile.  Codegen is skipped when the fragment processes so
+  // little data that compiling would take longer than it saves.  The only size
+  // estimate available is the length of the hdfs scan ranges, so fragments with other
+  // inputs (exchanges, hbase scans) always use codegen.
+  bool UseCodegen(const TExecPlanFragmentParams& request, std::string* reason);
+
   // Print stats about scan ranges for each volumeId in params to info log.
   void PrintVolumeIds(const TPlanExecParams& params);
   void PrintVolumeIds(const PerNodeScanRanges& per_node_scan_ranges);
@@ -18,6 +18,7 @@
 #include "runtime/raw-value.h"
 #include "runtime/string-value.inline.h"
 #include "runtime/tuple.h"
+#include "util/string-formatter.h"
 
 using namespace boost;
 using namespace std;
@@ -113,32 +114,65 @@ void RawValue::PrintValue(const void* value, PrimitiveType type, stringstream* s
 }
 
 void RawValue::PrintValue(const void* value, PrimitiveType type, string* str) {
+  str->clear();
+  AppendValue(value, type, ASCII_PRECISION, str);
+}
+
+void RawValue::AppendValue(const void* value, PrimitiveType type, int precision,
+    string* str) {
   if (value == NULL) {
-    *str = "NULL";
+    str->append("NULL");
     return;
   }
 
-  stringstream out;
-  out.precision(ASCII_PRECISION);
+  // Big enough for any number and for a timestamp.
+  char buf[StringFormatter::MAX_DOUBLE_LEN > TimestampValue::MAX_STRING_LEN ?
+      StringFormatter::MAX_DOUBLE_LEN : TimestampValue::MAX_STRING_LEN];
+  int len = 0;
   const StringValue* string_val = NULL;
-  string tmp;
-  bool val;
-
-  // Special case types that we can print more efficiently without using a stringstream
   switch (type) {
-    case TYPE_BOOLEAN:
-      val = *reinterpret_cast<const bool*>(value);
-      *str = (val ? "true" : "false");
+    case TYPE_BOOLEAN: {
+      bool val = *reinterpret_cast<const bool*>(value);
+      str->append(val ? "true" : "false");
       return;
+    }
+    case TYPE_TINYINT:
+      len = StringFormatter::FormatInt(*reinterpret_cast<const int8_t*>(value), buf);
+      break;
+    case TYPE_SMALLINT:
+      len = StringFormatter::FormatInt(*reinterpret_cast<const int16_t*>(value), buf);
+      break;
+    case TYPE_INT:
+      len = StringFormatter::FormatInt(*reinterpret_cast<const int32_t*>(value), buf);
+      break;
+    case TYPE_BIGINT:
+      len = StringFormatter::FormatInt(*reinterpret_cast<const int64_t*>(value), buf);
+      break;
+    case TYPE_FLOAT:
+      len = StringFormatter::FormatDouble(
+          *reinterpret_cast<const float*>(value), precision, buf);
+      break;
+    case TYPE_DOUBLE:
+      len = StringFormatter::FormatDouble(
+          *reinterpret_cast<const double*>(value), precision, buf);
+      break;
     case TYPE_STRING:
       string_val = reinterpret_cast<const StringValue*>(value);
-      tmp.assign(static_cast<char*>(string_val->ptr), string_val->len);
-      str->swap(tmp);
+      str->append(static_cast<char*>(string_val->ptr), string_val->len);
       return;
+    case TYPE_TIMESTAMP: {
+      const TimestampValue* ts = reinterpret_cast<const TimestampValue*>(value);
+      len = ts->ToString(buf);
+      if (len < 0) {
+        str->append(ts->DebugString());
+        return;
+      }
+      break;
+    }
     default:
-      PrintValue(value, type, &out);
+      DCHECK(false) << "bad RawValue::AppendValue() type: " << TypeToString(type);
   }
-  *str = out.str();
+  str->append(buf, len);
 }
 
 int RawValue::Compare(const void* v1, const void* v2, PrimitiveType type) {
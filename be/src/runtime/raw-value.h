@@ -47,6 +47,13 @@ class RawValue {
   // NULL turns into "NULL".
   static void PrintValue(const void* value, PrimitiveType type, std::string* str);
 
+  // Appends the ascii representation of value, the same as that of PrintValue() with
+  // 'precision' for double/float, to 'str'.  Doesn't use a stringstream, so this is
+  // the one to use when converting many values, e.g. to return results or to write
+  // text files.  NULL turns into "NULL".
+  static void AppendValue(const void* value, PrimitiveType type, int precision,
+                          std::string* str);
+
   // Writes the byte representation of a value to a stringstream character-by-character
   static void PrintValueAsBytes(const void* value, PrimitiveType type,
                                 std::stringstream* stream);
@@ -15,11 +15,21 @@
 #include "runtime/row-batch.h"
 
 #include <stdint.h>  // for intptr_t
+#include <boost/scoped_ptr.hpp>
+#include <gflags/gflags.h>
 
 #include "runtime/string-value.h"
 #include "runtime/tuple-row.h"
+#include "util/codec.h"
 #include "gen-cpp/Data_types.h"
+#include "gen-cpp/JavaConstants_constants.h"
 
+DEFINE_bool(compress_row_batches, true,
+    "if true, serialized row batches are compressed with --row_batch_compression_codec");
+DEFINE_string(row_batch_compression_codec, "snappy",
+    "codec for compressing serialized row batches: snappy, lz4 or zstd");
+
+using namespace boost;
 using namespace std;
 
 namespace impala {
@@ -31,7 +41,28 @@ RowBatch::~RowBatch() {
   }
 }
 
-void RowBatch::Serialize(TRowBatch* output_batch) {
+// Copies the data in 'chunks' into 'output', back to back.
+static void ConcatChunks(const vector<pair<uint8_t*, int> >& chunks, int size,
+    string* output) {
+  output->clear();
+  output->reserve(size);
+  for (int i = 0; i < chunks.size(); ++i) {
+    output->append(reinterpret_cast<char*>(chunks[i].first), chunks[i].second);
+  }
+}
+
+Status RowBatch::Serialize(TRowBatch* output_batch) {
+  MemPool output_pool;
+  RETURN_IF_ERROR(Serialize(output_batch, &output_pool));
+  if (output_batch->tuple_data.empty() && output_batch->uncompressed_size > 0) {
+    vector<pair<uint8_t*, int> > chunk_info;
+    output_pool.GetChunkInfo(&chunk_info);
+    ConcatChunks(chunk_info, output_batch->uncompressed_size, &output_batch->tuple_data);
+  }
+  return Status::OK;
+}
+
+Status RowBatch::Serialize(TRowBatch* output_batch, MemPool* output_pool) {
   // why does Thrift not generate a Clear() function?
   output_batch->row_tuples.clear();
   output_batch->tuple_offsets.clear();
@@ -40,71 +71,100 @@ void RowBatch::Serialize(TRowBatch* output_batch) {
   output_batch->num_rows = num_rows_;
   row_desc_.ToThrift(&output_batch->row_tuples);
   output_batch->tuple_offsets.reserve(num_rows_ * num_tuples_per_row_);
-  MemPool output_pool;
 
   // iterate through all tuples;
   // for a self-contained batch, convert Tuple* and string pointers into offsets into
   // our tuple_data_pool_;
   // otherwise, copy the tuple data, including strings, into output_pool (converting
   // string pointers into offset in the process)
+  // Without string slots, self-contained tuples only need their offsets recorded and
+  // the others are copied without looking at their slots.
+  const vector<TupleDescriptor*>& tuple_descs = row_desc_.tuple_descriptors();
+  bool has_string_slots = row_desc_.has_string_slots();
   for (int i = 0; i < num_rows_; ++i) {
     TupleRow* row = GetRow(i);
-    const vector<TupleDescriptor*>& tuple_descs = row_desc_.tuple_descriptors();
-    vector<TupleDescriptor*>::const_iterator desc = tuple_descs.begin();
-    for (int j = 0; desc != tuple_descs.end(); ++desc, ++j) {
-      if (row->GetTuple(j) == NULL) {
+    for (int j = 0; j < num_tuples_per_row_; ++j) {
+      Tuple* t = row->GetTuple(j);
+      if (t == NULL) {
         // NULLs are encoded as -1
         output_batch->tuple_offsets.push_back(-1);
         continue;
       }
 
-      Tuple* t;
       if (is_self_contained_) {
-        t = row->GetTuple(j);
         output_batch->tuple_offsets.push_back(
             tuple_data_pool_->GetOffset(reinterpret_cast<uint8_t*>(t)));
+        if (!has_string_slots) continue;
 
         // convert string pointers to offsets
-        vector<SlotDescriptor*>::const_iterator slot = (*desc)->string_slots().begin();
-        for (; slot != (*desc)->string_slots().end(); ++slot) {
-          DCHECK_EQ((*slot)->type(), TYPE_STRING);
-          StringValue* string_val = t->GetStringSlot((*slot)->tuple_offset());
+        const vector<SlotDescriptor*>& string_slots = tuple_descs[j]->string_slots();
+        for (int k = 0; k < string_slots.size(); ++k) {
+          DCHECK_EQ(string_slots[k]->type(), TYPE_STRING);
+          StringValue* string_val = t->GetStringSlot(string_slots[k]->tuple_offset());
           string_val->ptr = reinterpret_cast<char*>(tuple_data_pool_->GetOffset(
                   reinterpret_cast<uint8_t*>(string_val->ptr)));
         }
-      } else  {
+      } else if (!has_string_slots) {
+        int byte_size = tuple_descs[j]->byte_size();
+        output_batch->tuple_offsets.push_back(output_pool->GetCurrentOffset());
+        memcpy(output_pool->Allocate(byte_size), t, byte_size);
+      } else {
         // record offset before creating copy
-        output_batch->tuple_offsets.push_back(output_pool.GetCurrentOffset());
-        t = row->GetTuple(j)->DeepCopy(**desc, &output_pool, /* convert_ptrs */ true);
+        output_batch->tuple_offsets.push_back(output_pool->GetCurrentOffset());
+        t->DeepCopy(*tuple_descs[j], output_pool, /* convert_ptrs */ true);
       }
     }
   }
 
   if (is_self_contained_) {
-    output_pool.AcquireData(tuple_data_pool_.get(), false);
+    output_pool->AcquireData(tuple_data_pool_.get(), false);
     Reset();  // we passed on all data
   }
 
+  // The offsets recorded above are relative to the start of output_pool's data
+  // with all chunks laid out back to back, which is what we ship.
   vector<pair<uint8_t*, int> > chunk_info;
-  output_pool.GetChunkInfo(&chunk_info);
-  output_batch->tuple_data.reserve(chunk_info.size());
+  output_pool->GetChunkInfo(&chunk_info);
+  int size = 0;
   for (int i = 0; i < chunk_info.size(); ++i) {
-    // TODO: this creates yet another data copy, figure out how to avoid that
-    // (Thrift should introduce something like StringPieces, that can hold
-    // references to data/length pairs)
-    string data(reinterpret_cast<char*>(chunk_info[i].first), chunk_info[i].second);
-    output_batch->tuple_data.push_back(string());
-    output_batch->tuple_data.back().swap(data);
-    DCHECK(data.empty());
+    size += chunk_info[i].second;
+  }
+  output_batch->uncompressed_size = size;
+  output_batch->compression_type = THdfsCompression::NONE;
+  if (!FLAGS_compress_row_batches || size == 0) return Status::OK;
+
+  map<string, THdfsCompression::type>::const_iterator codec_type =
+      g_JavaConstants_constants.COMPRESSION_MAP.find(FLAGS_row_batch_compression_codec);
+  if (codec_type == g_JavaConstants_constants.COMPRESSION_MAP.end()) {
+    return Status("Unknown row batch compression codec: " +
+        FLAGS_row_batch_compression_codec);
+  }
+
+  // the codecs need their input in a single buffer
+  string uncompressed;
+  uint8_t* input = chunk_info[0].first;
+  if (chunk_info.size() > 1 && chunk_info[1].second > 0) {
+    ConcatChunks(chunk_info, size, &uncompressed);
+    input = reinterpret_cast<uint8_t*>(const_cast<char*>(uncompressed.data()));
+  }
+  MemPool compressor_pool;
+  Codec* codec;
+  RETURN_IF_ERROR(Codec::CreateCompressor(
+      NULL, &compressor_pool, false, codec_type->second, &codec));
+  scoped_ptr<Codec> compressor(codec);
+  int compressed_size = 0;
+  uint8_t* compressed = NULL;
+  RETURN_IF_ERROR(compressor->ProcessBlock(size, input, &compressed_size, &compressed));
+  if (compressed_size < size) {
+    output_batch->tuple_data.assign(reinterpret_cast<char*>(compressed), compressed_size);
+    output_batch->compression_type = codec_type->second;
+  } else if (!uncompressed.empty()) {
+    // incompressible data: ship it as is
+    output_batch->tuple_data.swap(uncompressed);
   }
+  return Status::OK;
 }
 
-// TODO: we want our input_batch's tuple_data to come from our (not yet implemented)
-// global runtime memory segment; how do we get thrift to allocate it from there?
-// maybe change line (in Data_types.cc generated from Data.thrift)
-//              xfer += iprot->readString(this->tuple_data[_i9]);
-// to allocated string data in special mempool
-// (change via python script that runs over Data_types.cc)
 RowBatch::RowBatch(const RowDescriptor& row_desc, const TRowBatch& input_batch)
   : has_in_flight_row_(false),
     is_self_contained_(true),
@@ -113,7 +173,32 @@ RowBatch::RowBatch(const RowDescriptor& row_desc, const TRowBatch& input_batch)
     num_tuples_per_row_(input_batch.row_tuples.size()),
     row_desc_(row_desc),
     tuple_ptrs_(new Tuple*[num_rows_ * input_batch.row_tuples.size()]),
-    tuple_data_pool_(new MemPool(input_batch.tuple_data)) {
+    tuple_data_pool_(new MemPool()) {
+  tuple_ptrs_size_ = num_rows_ * num_tuples_per_row_ * sizeof(Tuple*);
+  // The tuple data goes into a single chunk, so offsets translate directly into
+  // pointers into it. Compressed data is decompressed straight into that chunk.
+  int size = input_batch.uncompressed_size;
+  if (size > 0) {
+    uint8_t* data = tuple_data_pool_->Allocate(size);
+    uint8_t* input =
+        reinterpret_cast<uint8_t*>(const_cast<char*>(input_batch.tuple_data.data()));
+    if (input_batch.compression_type == THdfsCompression::NONE) {
+      DCHECK_EQ(input_batch.tuple_data.size(), size);
+      memcpy(data, input, size);
+    } else {
+      Codec* codec;
+      Status status = Codec::CreateDecompressor(
+          NULL, tuple_data_pool_.get(), false, input_batch.compression_type, &codec);
+      if (status.ok()) {
+        scoped_ptr<Codec> decompressor(codec);
+        status = decompressor->ProcessBlock(
+            input_batch.tuple_data.size(), input, &size, &data);
+      }
+      if (!status.ok()) LOG(ERROR) << "Corrupt row batch: " << status.GetErrorMsg();
+      DCHECK(status.ok());
+    }
+  }
+
   // convert input_batch.tuple_offsets into pointers
   int tuple_idx = 0;
   for (vector<int32_t>::const_iterator offset = input_batch.tuple_offsets.begin();
@@ -126,19 +211,10 @@ RowBatch::RowBatch(const RowDescriptor& row_desc, const TRowBatch& input_batch)
     }
   }
 
-  // check whether we have string slots
-  // TODO: do that during setup (part of RowDescriptor c'tor?)
-  bool has_string_slots = false;
-  const vector<TupleDescriptor*>& tuple_descs = row_desc_.tuple_descriptors();
-  for (int i = 0; i < tuple_descs.size(); ++i) {
-    if (!tuple_descs[i]->string_slots().empty()) {
-      has_string_slots = true;
-      break;
-    }
-  }
-  if (!has_string_slots) return;
+  if (!row_desc_.has_string_slots()) return;
 
   // convert string offsets contained in tuple data into pointers
+  const vector<TupleDescriptor*>& tuple_descs = row_desc_.tuple_descriptors();
   for (int i = 0; i < num_rows_; ++i) {
     TupleRow* row = GetRow(i);
     vector<TupleDescriptor*>::const_iterator desc = tuple_descs.begin();
@@ -159,11 +235,7 @@ RowBatch::RowBatch(const RowDescriptor& row_desc, const TRowBatch& input_batch)
 }
 
 int RowBatch::GetBatchSize(const TRowBatch& batch) {
-  int result = 0;
-  for (int i = 0; i < batch.tuple_data.size(); ++i) {
-    result += batch.tuple_data[i].size();
-  }
-  return result;
+  return batch.uncompressed_size;
 }
 
 void RowBatch::Swap(RowBatch* other) {
@@ -175,7 +247,7 @@ void RowBatch::Swap(RowBatch* other) {
   DCHECK(!has_in_flight_row_);
   DCHECK(!is_self_contained_);
   DCHECK(io_buffers_.empty());
-  DCHECK_EQ(tuple_data_pool_->GetTotalChunkSizes(), 0);
+  DCHECK_EQ(tuple_data_pool_->total_allocated_bytes(), 0);
 
   std::swap(has_in_flight_row_, other->has_in_flight_row_);
   std::swap(is_self_contained_, other->is_self_contained_);
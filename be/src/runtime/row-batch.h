@@ -21,6 +21,7 @@
 #include <boost/scoped_ptr.hpp>
 
 #include "common/logging.h"
+#include "common/status.h"
 #include "runtime/descriptors.h"
 #include "runtime/disk-io-mgr.h"
 #include "runtime/mem-pool.h"
@@ -43,7 +44,6 @@ class TupleDescriptor;
 //      the data is in an io buffer that may not be attached to this row batch.  The
 //      creator of that row batch has to make sure that the io buffer is not recycled
 //      until all batches that reference the memory have been consumed.  
-// TODO: stick tuple_ptrs_ into a pool?
 class RowBatch {
  public:
   // Create RowBatch for a maximum of 'capacity' rows of tuples specified
@@ -61,11 +61,10 @@ class RowBatch {
     DCHECK_GT(capacity, 0);
   }
 
-  // Populate a row batch from input_batch by copying input_batch's
-  // tuple_data into the row batch's mempool and converting all offsets
-  // in the data back into pointers. The row batch will be self-contained after the call.
-  // TODO: figure out how to transfer the data from input_batch to this RowBatch
-  // (so that we don't need to make yet another copy)
+  // Populate a row batch from input_batch by decompressing (or, if it isn't
+  // compressed, copying) input_batch's tuple_data into a single chunk of the row
+  // batch's mempool and converting all offsets in the data back into pointers.
+  // The row batch will be self-contained after the call.
   RowBatch(const RowDescriptor& row_desc, const TRowBatch& input_batch);
 
   // Releases all resources accumulated at this row batch.  This includes
@@ -122,10 +121,13 @@ class RowBatch {
     return reinterpret_cast<TupleRow*>(tuple_ptrs_ + row_idx * num_tuples_per_row_);
   }
 
+  // Drops all rows and the resources they reference.  The tuple data pool keeps one
+  // of its chunks for the next rows, so a batch that is refilled after every Reset()
+  // doesn't give back and reallocate its memory each time.
   void Reset() {
     num_rows_ = 0;
     has_in_flight_row_ = false;
-    tuple_data_pool_.reset(new MemPool());
+    tuple_data_pool_->FreeAllButOneChunk();
     for (int i = 0; i < io_buffers_.size(); ++i) {
       io_buffers_[i]->Return();
     }
@@ -178,14 +180,23 @@ class RowBatch {
   void Swap(RowBatch* other);
 
   // Create a serialized version of this row batch in output_batch, attaching
-  // all of the data it references (TRowBatch::tuple_data) to output_batch.tuple_data.
+  // all of the data it references (TRowBatch::tuple_data) to output_batch.tuple_data
+  // as a single buffer, which is compressed with --row_batch_compression_codec if
+  // --compress_row_batches is set and that makes it smaller.
   // If an in-flight row is present in this row batch, it is ignored.
   // If this batch is self-contained, it simply does an in-place conversion of the
   // string pointers contained in the tuple data into offsets and resets the batch
   // after copying the data to TRowBatch.
-  void Serialize(TRowBatch* output_batch);
+  Status Serialize(TRowBatch* output_batch);
 
-  // utility function: return total tuple data size of 'batch'.
+  // Same as Serialize(TRowBatch*), except that the tuple data is serialized into
+  // 'output_pool' and, unless it ends up compressed, might not get copied into
+  // output_batch.tuple_data: if that is left empty, the data is in 'output_pool''s
+  // chunks, back to back in GetChunkInfo() order.  This lets transports send the
+  // data straight from the chunks.
+  Status Serialize(TRowBatch* output_batch, MemPool* output_pool);
+
+  // utility function: return total (uncompressed) tuple data size of 'batch'.
   static int GetBatchSize(const TRowBatch& batch);
 
   int num_rows() const { return num_rows_; }
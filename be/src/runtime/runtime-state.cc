@@ -23,16 +23,21 @@
 #include "common/status.h"
 #include "exprs/expr.h"
 #include "runtime/descriptors.h"
+#include "runtime/mem-tracker.h"
 #include "runtime/runtime-state.h"
+#include "runtime/scratch-mgr.h"
 #include "runtime/timestamp-value.h"
 #include "util/cpu-info.h"
 #include "util/debug-util.h"
 #include "util/jni-util.h"
+#include "util/thread-tokens.h"
 
 #include <jni.h>
 #include <iostream>
 
 DECLARE_int32(max_errors);
+DEFINE_bool(adaptive_batch_size, true, "If true, the row batches of queries that don't "
+    "set batch_size are sized to the width of their rows and the L2 cache size.");
 
 using namespace boost;
 using namespace llvm;
@@ -55,7 +60,10 @@ RuntimeState::RuntimeState(
 RuntimeState::RuntimeState()
   : obj_pool_(new ObjectPool()),
     unreported_error_idx_(0),
-    profile_(obj_pool_.get(), "<unnamed>") {
+    exec_env_(NULL),
+    adaptive_batch_size_(false),
+    profile_(obj_pool_.get(), "<unnamed>"),
+    is_cancelled_(false) {
   query_options_.batch_size = DEFAULT_BATCH_SIZE;
 }
 
@@ -72,19 +80,23 @@ Status RuntimeState::Init(
   if (!query_options.disable_codegen) {
     RETURN_IF_ERROR(CreateCodegen());
   } else {
-    codegen_.reset(NULL);
+    codegen_.reset();
   }
   if (query_options_.max_errors <= 0) {
     // TODO: fix linker error and uncomment this
     //query_options_.max_errors = FLAGS_max_errors;
     query_options_.max_errors = 100;
   }
+  adaptive_batch_size_ = FLAGS_adaptive_batch_size && query_options_.batch_size <= 0;
   if (query_options_.batch_size <= 0) {
     query_options_.batch_size = DEFAULT_BATCH_SIZE;
   }
   if (query_options_.max_io_buffers <= 0) {
     query_options_.max_io_buffers = DEFAULT_MAX_IO_BUFFERS;
   }
+  if (query_options_.io_weight <= 0) {
+    query_options_.io_weight = DEFAULT_IO_WEIGHT;
+  }
   
   DCHECK_GT(query_options_.max_io_buffers, 0);
   DCHECK_GE(query_options_.num_scanner_threads, 0);
@@ -95,9 +107,64 @@ void RuntimeState::set_now(const TimestampValue* now) {
   now_.reset(new TimestampValue(*now));
 }
 
+int RuntimeState::batch_size(const RowDescriptor& row_desc, int64_t limit) const {
+  int batch_size = query_options_.batch_size;
+  if (adaptive_batch_size_) {
+    long cache_size = CpuInfo::CacheSize(CpuInfo::L2_CACHE);
+    int row_bytes =
+        row_desc.GetRowSize() + row_desc.tuple_descriptors().size() * sizeof(void*);
+    if (cache_size > 0 && row_bytes > 0) {
+      batch_size = min<long>(MAX_ADAPTIVE_BATCH_SIZE, cache_size / 2 / row_bytes);
+      batch_size = max<int>(MIN_ADAPTIVE_BATCH_SIZE, batch_size);
+    }
+  }
+  if (limit >= 0 && limit < batch_size) batch_size = max<int64_t>(limit, 1);
+  return batch_size;
+}
+
+void RuntimeState::InitMemTrackers(const TUniqueId& query_id) {
+  DCHECK(exec_env_ != NULL);
+  int64_t query_limit = query_options_.mem_limit > 0 ? query_options_.mem_limit : -1;
+  query_mem_tracker_ = MemTracker::GetQueryMemTracker(
+      query_id, query_limit, exec_env_->process_mem_tracker());
+  instance_mem_tracker_.reset(new MemTracker(
+      -1, "Fragment " + PrintId(fragment_instance_id_), query_mem_tracker_.get()));
+  if (exec_env_->scratch_mgr() != NULL) {
+    query_scratch_tracker_ = exec_env_->scratch_mgr()->GetQueryTracker(query_id);
+  }
+}
+
+void RuntimeState::InitScannerThreadTokens(const TUniqueId& query_id) {
+  DCHECK(exec_env_ != NULL);
+  if (query_options_.max_scanner_thread_tokens <= 0) return;
+  query_scanner_thread_tokens_ = ThreadTokens::GetQueryTokens(query_id,
+      query_options_.max_scanner_thread_tokens, exec_env_->scanner_thread_tokens());
+}
+
+ThreadTokens* RuntimeState::scanner_thread_tokens() {
+  if (query_scanner_thread_tokens_.get() != NULL) {
+    return query_scanner_thread_tokens_.get();
+  }
+  return exec_env_ == NULL ? NULL : exec_env_->scanner_thread_tokens();
+}
+
+Status RuntimeState::CheckQueryState() {
+  if (UNLIKELY(is_cancelled_)) return Status(TStatusCode::CANCELLED);
+  if (instance_mem_tracker_.get() == NULL) return Status::OK;
+  const MemTracker* tracker = instance_mem_tracker_->GetExceededTracker();
+  if (LIKELY(tracker == NULL)) return Status::OK;
+  stringstream ss;
+  ss << "Memory limit exceeded: " << tracker->label() << " is using "
+     << tracker->consumption() << " bytes, limit is " << tracker->limit() << " bytes";
+  return Status(TStatusCode::MEM_LIMIT_EXCEEDED, ss.str());
+}
+
 Status RuntimeState::CreateCodegen() {
-  RETURN_IF_ERROR(LlvmCodeGen::LoadImpalaIR(obj_pool_.get(), &codegen_));
+  scoped_ptr<LlvmCodeGen> codegen;
+  RETURN_IF_ERROR(LlvmCodeGen::LoadImpalaIR(&codegen));
+  codegen_.reset(codegen.release());
   codegen_->EnableOptimizations(true);
+  codegen_->EnableJitCache(codegen_);
   profile_.AddChild(codegen_->runtime_profile());
   return Status::OK;
 }
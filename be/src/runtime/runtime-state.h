@@ -20,6 +20,7 @@
 #include "common/object-pool.h"
 
 #include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 #include <vector>
@@ -35,12 +36,16 @@
 namespace impala {
 
 class DescriptorTbl;
+class RowDescriptor;
 class DiskIoMgr;
 class ObjectPool;
 class Status;
 class ExecEnv;
 class Expr;
 class LlvmCodeGen;
+class MemTracker;
+class ScratchMgr;
+class ThreadTokens;
 class TimestampValue;
 
 // Counts how many rows an INSERT query has added to a particular partition
@@ -54,6 +59,10 @@ typedef std::map<std::string, int64_t> PartitionRowCount;
 // deleted.
 typedef std::map<std::string, std::string> FileMoveMap;
 
+// Statistics of the rows that an INSERT query wrote to each partition, keyed like
+// PartitionRowCount.
+typedef std::map<std::string, TInsertPartitionStats> PartitionStatsMap;
+
 // A collection of items that are part of the global state of a
 // query and shared across all execution nodes of that query.
 class RuntimeState {
@@ -76,10 +85,21 @@ class RuntimeState {
   const DescriptorTbl& desc_tbl() const { return *desc_tbl_; }
   void set_desc_tbl(DescriptorTbl* desc_tbl) { desc_tbl_ = desc_tbl; }
   int batch_size() const { return query_options_.batch_size; }
+
+  // Returns the capacity of the row batches of rows of 'row_desc'.  If the query
+  // doesn't set batch_size and --adaptive_batch_size is true, this is the number of
+  // rows (and their tuple pointers) that fill about half of the L2 cache, otherwise
+  // batch_size().  If 'limit' is >= 0, batches are at most 'limit' rows.
+  int batch_size(const RowDescriptor& row_desc, int64_t limit = -1) const;
   bool abort_on_error() const { return query_options_.abort_on_error; }
   int max_errors() const { return query_options_.max_errors; }
   int max_io_buffers() const { return query_options_.max_io_buffers; }
+  int io_weight() const { return query_options_.io_weight; }
   int num_scanner_threads() const { return query_options_.num_scanner_threads; }
+  const std::string& cpu_cgroup() const { return query_options_.cpu_cgroup; }
+  int64_t max_broadcast_build_bytes() const {
+    return query_options_.max_broadcast_build_bytes;
+  }
   const TimestampValue* now() const { return now_.get(); }
   void set_now(const TimestampValue* now);
   const std::vector<std::string>& error_log() const { return error_log_; }
@@ -92,13 +112,46 @@ class RuntimeState {
   HdfsFsCache* fs_cache() { return exec_env_->fs_cache(); }
   HBaseTableCache* htable_cache() { return exec_env_->htable_cache(); }
   DiskIoMgr* io_mgr() { return exec_env_->disk_io_mgr(); }
+  ScratchMgr* scratch_mgr() { return exec_env_->scratch_mgr(); }
 
   FileMoveMap* hdfs_files_to_move() { return &hdfs_files_to_move_; }
   PartitionRowCount* num_appended_rows() { return &num_appended_rows_; }
+  PartitionStatsMap* insert_partition_stats() { return &insert_partition_stats_; }
 
   // Returns runtime state profile
   RuntimeProfile* runtime_profile() { return &profile_; }
 
+  // Creates the mem trackers for this fragment instance: the query tracker (shared
+  // with the other fragment instances of 'query_id' on this node and limited by the
+  // mem_limit query option) and the instance tracker below it.  The query tracker's
+  // parent is the process tracker.  Until this is called, both trackers are NULL.
+  // Also gets the tracker of the query's scratch files (see ScratchMgr).
+  void InitMemTrackers(const TUniqueId& query_id);
+
+  MemTracker* query_mem_tracker() { return query_mem_tracker_.get(); }
+  MemTracker* instance_mem_tracker() { return instance_mem_tracker_.get(); }
+
+  // Bytes of the query's scratch files on this node, shared with the other fragment
+  // instances of the query.  NULL until InitMemTrackers() is called.
+  MemTracker* query_scratch_tracker() { return query_scratch_tracker_.get(); }
+
+  // Gets the query's quota of the scanner thread tokens of this node, which
+  // the other fragment instances of 'query_id' share, if the max_scanner_thread_tokens
+  // query option is set.
+  void InitScannerThreadTokens(const TUniqueId& query_id);
+
+  // Returns the tokens that the scans of this fragment instance take for their
+  // scanner threads beyond the first: the query's quota if it has one, otherwise
+  // the tokens of all queries (ExecEnv::scanner_thread_tokens()).  NULL if there is no
+  // limit.
+  ThreadTokens* scanner_thread_tokens();
+
+  // Returns CANCELLED if the query was cancelled and MEM_LIMIT_EXCEEDED if this
+  // fragment instance, its query or the process is over its memory limit.
+  // Blocking operators call this while consuming their input, so that a query that
+  // runs out of memory fails cleanly instead of taking down the process.
+  Status CheckQueryState();
+
   // Returns CodeGen object.  Returns NULL if codegen is disabled.
   LlvmCodeGen* llvm_codegen() { return codegen_.get(); }
 
@@ -135,8 +188,21 @@ class RuntimeState {
 
  private:
   static const int DEFAULT_BATCH_SIZE = 1024;
+  // Bounds of the adaptive batch sizes.
+  static const int MIN_ADAPTIVE_BATCH_SIZE = 128;
+  static const int MAX_ADAPTIVE_BATCH_SIZE = 16 * 1024;
   // This is the number of buffers per disk.
   static const int DEFAULT_MAX_IO_BUFFERS = 5;
+  static const int DEFAULT_IO_WEIGHT = 1;
+
+  // Memory trackers; declared before obj_pool_ so that they outlive the exec nodes
+  // (whose trackers are children of instance_mem_tracker_).
+  boost::shared_ptr<MemTracker> query_mem_tracker_;
+  boost::scoped_ptr<MemTracker> instance_mem_tracker_;
+  boost::shared_ptr<MemTracker> query_scratch_tracker_;
+
+  // Set by InitScannerThreadTokens() if the query has a quota.
+  boost::shared_ptr<ThreadTokens> query_scanner_thread_tokens_;
 
   DescriptorTbl* desc_tbl_;
   boost::scoped_ptr<ObjectPool> obj_pool_;
@@ -160,7 +226,11 @@ class RuntimeState {
   TUniqueId fragment_instance_id_;
   TQueryOptions query_options_;
   ExecEnv* exec_env_;
-  boost::scoped_ptr<LlvmCodeGen> codegen_;
+
+  // If true, batch_size(const RowDescriptor&) adapts the batch size to the rows.
+  bool adaptive_batch_size_;
+  // Shared with the JitCache, which can keep the object alive after this state is gone.
+  boost::shared_ptr<LlvmCodeGen> codegen_;
 
   // Temporary Hdfs files created, and where they should be moved to ultimately.
   // Mapping a filename to a blank destination causes it to be deleted. 
@@ -169,6 +239,9 @@ class RuntimeState {
   // Records the total number of appended rows per created Hdfs partition
   PartitionRowCount num_appended_rows_;
 
+  // Statistics of the written partitions, if the table sink gathers them
+  PartitionStatsMap insert_partition_stats_;
+
   RuntimeProfile profile_;
 
   // if true, execution should stop with a CANCELLED status
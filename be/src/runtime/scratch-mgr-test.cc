@@ -0,0 +1,195 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "runtime/disk-io-mgr.h"
+#include "runtime/scratch-mgr.h"
+#include "util/cpu-info.h"
+#include "util/disk-info.h"
+
+using namespace std;
+using boost::scoped_ptr;
+
+DECLARE_string(scratch_dirs);
+DECLARE_string(scratch_compression);
+DECLARE_int64(scratch_limit_per_query);
+
+namespace impala {
+
+class ScratchMgrTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    char dir[] = "/tmp/scratch-mgr-test-XXXXXX";
+    ASSERT_TRUE(mkdtemp(dir) != NULL);
+    dir_ = dir;
+    FLAGS_scratch_dirs = dir_;
+    FLAGS_scratch_compression = "none";
+    FLAGS_scratch_limit_per_query = -1;
+    // Small io buffers (which are also the write buffers), so that blocks span them.
+    io_mgr_.reset(new DiskIoMgr(1, 1, 512));
+    ASSERT_TRUE(io_mgr_->Init().ok());
+  }
+
+  virtual void TearDown() {
+    io_mgr_.reset();
+    rmdir(dir_.c_str());
+  }
+
+  // Returns a block of 'len' bytes; the blocks compress well if 'compressible'.
+  static vector<uint8_t> MakeBlock(int len, int seed, bool compressible) {
+    vector<uint8_t> block(len);
+    for (int i = 0; i < len; ++i) {
+      block[i] = compressible ? (i / 64 + seed) % 4 : (i * 7919 + seed * 31) >> 3;
+    }
+    return block;
+  }
+
+  // Writes blocks of various sizes to a new file, reads them back and checks them.
+  void WriteAndRead(ScratchMgr* mgr, bool compressible) {
+    scoped_ptr<ScratchMgr::File> file;
+    ASSERT_TRUE(mgr->NewFile(fragment_id_, NULL, &file).ok());
+    string path = file->path();
+    EXPECT_EQ(access(path.c_str(), F_OK), 0);
+
+    vector<vector<uint8_t> > blocks;
+    int sizes[] = { 1, 999, 1000, 1001, 0, 5000, 17 };
+    for (int i = 0; i < sizeof(sizes) / sizeof(int); ++i) {
+      blocks.push_back(MakeBlock(sizes[i], i, compressible));
+      vector<uint8_t>& block = blocks.back();
+      ASSERT_TRUE(file->AppendBlock(block.empty() ? NULL : &block[0], block.size()).ok());
+    }
+    EXPECT_EQ(file->num_blocks(), blocks.size());
+    EXPECT_EQ(mgr->bytes_in_use(), file->bytes_written());
+    ASSERT_TRUE(file->PrepareForRead().ok());
+
+    for (int i = 0; i < blocks.size(); ++i) {
+      uint8_t* data;
+      int64_t len;
+      bool eos;
+      ASSERT_TRUE(file->GetNextBlock(&data, &len, &eos).ok());
+      ASSERT_FALSE(eos);
+      ASSERT_EQ(len, blocks[i].size());
+      EXPECT_TRUE(memcmp(data, &blocks[i][0], len) == 0) << i;
+    }
+    uint8_t* data;
+    int64_t len;
+    bool eos;
+    ASSERT_TRUE(file->GetNextBlock(&data, &len, &eos).ok());
+    EXPECT_TRUE(eos);
+
+    file->Close();
+    EXPECT_NE(access(path.c_str(), F_OK), 0);
+    EXPECT_EQ(mgr->bytes_in_use(), 0);
+  }
+
+  string dir_;
+  scoped_ptr<DiskIoMgr> io_mgr_;
+  TUniqueId fragment_id_;
+};
+
+TEST_F(ScratchMgrTest, WriteAndRead) {
+  ScratchMgr mgr(io_mgr_.get());
+  ASSERT_TRUE(mgr.Init().ok());
+  EXPECT_EQ(mgr.num_dirs(), 1);
+  WriteAndRead(&mgr, false);
+  WriteAndRead(&mgr, true);
+}
+
+TEST_F(ScratchMgrTest, Compression) {
+  FLAGS_scratch_compression = "lz4";
+  ScratchMgr mgr(io_mgr_.get());
+  ASSERT_TRUE(mgr.Init().ok());
+  WriteAndRead(&mgr, false);
+  WriteAndRead(&mgr, true);
+
+  // Compressible blocks take less space, incompressible ones are stored as they are.
+  scoped_ptr<ScratchMgr::File> file;
+  ASSERT_TRUE(mgr.NewFile(fragment_id_, NULL, &file).ok());
+  vector<uint8_t> block = MakeBlock(10000, 0, true);
+  ASSERT_TRUE(file->AppendBlock(&block[0], block.size()).ok());
+  EXPECT_LT(file->bytes_written(), block.size() / 4);
+
+  FLAGS_scratch_compression = "zip";
+  ScratchMgr invalid_mgr(io_mgr_.get());
+  EXPECT_FALSE(invalid_mgr.Init().ok());
+}
+
+TEST_F(ScratchMgrTest, QueryLimit) {
+  FLAGS_scratch_limit_per_query = 3000;
+  ScratchMgr mgr(io_mgr_.get());
+  ASSERT_TRUE(mgr.Init().ok());
+  TUniqueId query_id;
+  query_id.hi = 1;
+  boost::shared_ptr<MemTracker> tracker = mgr.GetQueryTracker(query_id);
+  EXPECT_EQ(mgr.GetQueryTracker(query_id).get(), tracker.get());
+
+  // The limit is shared by the files of the query.
+  scoped_ptr<ScratchMgr::File> file1;
+  scoped_ptr<ScratchMgr::File> file2;
+  ASSERT_TRUE(mgr.NewFile(fragment_id_, tracker.get(), &file1).ok());
+  ASSERT_TRUE(mgr.NewFile(fragment_id_, tracker.get(), &file2).ok());
+  vector<uint8_t> block = MakeBlock(1000, 0, false);
+  EXPECT_TRUE(file1->AppendBlock(&block[0], block.size()).ok());
+  EXPECT_TRUE(file2->AppendBlock(&block[0], block.size()).ok());
+  EXPECT_FALSE(file2->AppendBlock(&block[0], block.size()).ok());
+  EXPECT_EQ(tracker->consumption(), file1->bytes_written() + file2->bytes_written());
+  EXPECT_EQ(mgr.bytes_in_use(), tracker->consumption());
+
+  file1->Close();
+  file2->Close();
+  EXPECT_EQ(tracker->consumption(), 0);
+  EXPECT_GT(tracker->peak_consumption(), 2000);
+}
+
+// Files are spread across the scratch dirs.
+TEST_F(ScratchMgrTest, Dirs) {
+  char dir[] = "/tmp/scratch-mgr-test-XXXXXX";
+  ASSERT_TRUE(mkdtemp(dir) != NULL);
+  string dir2 = dir;
+  FLAGS_scratch_dirs = dir_ + ",/nonexistent-scratch-dir," + dir2;
+  ScratchMgr mgr(io_mgr_.get());
+  ASSERT_TRUE(mgr.Init().ok());
+  EXPECT_EQ(mgr.num_dirs(), 2);
+
+  scoped_ptr<ScratchMgr::File> files[4];
+  int files_in_dir2 = 0;
+  for (int i = 0; i < 4; ++i) {
+    ASSERT_TRUE(mgr.NewFile(fragment_id_, NULL, &files[i]).ok());
+    if (files[i]->path().find(dir2) == 0) ++files_in_dir2;
+  }
+  EXPECT_EQ(files_in_dir2, 2);
+  for (int i = 0; i < 4; ++i) files[i]->Close();
+  rmdir(dir2.c_str());
+
+  FLAGS_scratch_dirs = "/nonexistent-scratch-dir";
+  ScratchMgr no_dirs_mgr(io_mgr_.get());
+  EXPECT_FALSE(no_dirs_mgr.Init().ok());
+  scoped_ptr<ScratchMgr::File> file;
+  EXPECT_FALSE(no_dirs_mgr.NewFile(fragment_id_, NULL, &file).ok());
+}
+
+}
+
+int main(int argc, char **argv) {
+  google::InitGoogleLogging(argv[0]);
+  ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
+  impala::DiskInfo::Init();
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,448 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/scratch-mgr.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits>
+#include <map>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <boost/bind.hpp>
+#include <boost/thread/locks.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "runtime/mem-pool.h"
+#include "util/codec.h"
+#include "util/debug-util.h"
+#include "util/disk-info.h"
+
+DEFINE_string(scratch_dirs, "/tmp",
+    "comma-separated list of local directories used by operators to spill "
+    "intermediate data to disk");
+// Spilled data is written once and read once, so a fast codec that cuts the bytes
+// on disk usually pays for itself.
+DEFINE_string(scratch_compression, "none", "Codec for the blocks of scratch files: "
+    "none, lz4 or snappy.");
+DEFINE_int64(scratch_limit_per_query, -1, "Maximum number of bytes of scratch files "
+    "of a query on this node.  Spilling beyond that fails the query.  < 0 means no "
+    "limit.");
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+// Each block is prefixed with its stored and its uncompressed length, as uint32_ts.
+static const int BLOCK_HEADER_SIZE = 2 * sizeof(uint32_t);
+
+// Number of write buffers per file: one can be filled while the other is written.
+static const int NUM_WRITE_BUFFERS = 2;
+
+// Number of io buffers for reading back a file; 2 lets the io mgr read the next
+// buffer while the current one is being consumed.
+static const int IO_BUFFERS_PER_FILE = 2;
+
+ScratchMgr::ScratchMgr(DiskIoMgr* io_mgr)
+  : io_mgr_(io_mgr),
+    num_dirs_(0),
+    compression_(THdfsCompression::NONE),
+    next_file_idx_(0),
+    scratch_tracker_(-1, "Scratch") {
+}
+
+Status ScratchMgr::Init() {
+  string compression = to_lower_copy(FLAGS_scratch_compression);
+  if (compression.empty() || compression == "none") {
+    compression_ = THdfsCompression::NONE;
+  } else if (compression == "lz4") {
+    compression_ = THdfsCompression::LZ4;
+  } else if (compression == "snappy") {
+    compression_ = THdfsCompression::SNAPPY;
+  } else {
+    stringstream ss;
+    ss << "Invalid --scratch_compression: " << FLAGS_scratch_compression;
+    return Status(ss.str());
+  }
+
+  vector<string> dirs;
+  split(dirs, FLAGS_scratch_dirs, is_any_of(","), token_compress_on);
+  map<int, vector<string> > dirs_by_disk;
+  for (int i = 0; i < dirs.size(); ++i) {
+    if (dirs[i].empty()) continue;
+    if (access(dirs[i].c_str(), W_OK | X_OK) != 0) {
+      LOG(WARNING) << "Not using scratch directory " << dirs[i] << ": "
+                   << strerror(errno);
+      continue;
+    }
+    int disk_id = DiskInfo::disk_id(dirs[i].c_str());
+    if (disk_id < 0) disk_id = 0;
+    dirs_by_disk[disk_id % io_mgr_->num_disks()].push_back(dirs[i]);
+    ++num_dirs_;
+  }
+  for (map<int, vector<string> >::iterator it = dirs_by_disk.begin();
+      it != dirs_by_disk.end(); ++it) {
+    disk_ids_.push_back(it->first);
+    dirs_by_disk_.push_back(it->second);
+  }
+  if (num_dirs_ == 0) {
+    return Status("No usable scratch directories specified (--scratch_dirs)");
+  }
+  LOG(INFO) << "Using " << num_dirs_ << " scratch directories on "
+            << disk_ids_.size() << " disks";
+  return Status::OK;
+}
+
+shared_ptr<MemTracker> ScratchMgr::GetQueryTracker(const TUniqueId& query_id) {
+  lock_guard<mutex> l(query_trackers_lock_);
+  QueryTrackerMap::iterator it = query_trackers_.find(query_id);
+  if (it != query_trackers_.end()) {
+    shared_ptr<MemTracker> tracker = it->second.lock();
+    if (tracker.get() != NULL) return tracker;
+  }
+  // Drop the entries of finished queries.
+  for (QueryTrackerMap::iterator entry = query_trackers_.begin();
+      entry != query_trackers_.end();) {
+    if (entry->second.expired()) {
+      entry = query_trackers_.erase(entry);
+    } else {
+      ++entry;
+    }
+  }
+  stringstream label;
+  label << "Query " << PrintId(query_id) << " scratch";
+  shared_ptr<MemTracker> tracker(
+      new MemTracker(FLAGS_scratch_limit_per_query, label.str(), &scratch_tracker_));
+  query_trackers_[query_id] = tracker;
+  return tracker;
+}
+
+Status ScratchMgr::CreateFile(const string& name, string* path, int* disk_id) {
+  if (num_dirs_ == 0) {
+    return Status("No usable scratch directories specified (--scratch_dirs)");
+  }
+  int64_t file_idx = __sync_fetch_and_add(&next_file_idx_, 1);
+  int disk_idx = file_idx % dirs_by_disk_.size();
+  const vector<string>& dirs = dirs_by_disk_[disk_idx];
+  const string& dir = dirs[(file_idx / dirs_by_disk_.size()) % dirs.size()];
+
+  stringstream ss;
+  ss << dir << "/impala-scratch-" << name << "-" << getpid() << "-" << file_idx;
+  *path = ss.str();
+  *disk_id = disk_ids_[disk_idx];
+  int fd = open(path->c_str(), O_CREAT | O_EXCL | O_WRONLY, S_IRUSR | S_IWUSR);
+  if (fd < 0) {
+    stringstream error;
+    error << "Could not create scratch file " << *path << ": " << strerror(errno);
+    return Status(error.str());
+  }
+  close(fd);
+  return Status::OK;
+}
+
+Status ScratchMgr::NewFile(const TUniqueId& fragment_instance_id,
+    MemTracker* query_tracker, scoped_ptr<File>* file) {
+  string path;
+  int disk_id;
+  RETURN_IF_ERROR(CreateFile(PrintId(fragment_instance_id), &path, &disk_id));
+  file->reset(new File(io_mgr_, path, disk_id,
+      query_tracker != NULL ? query_tracker : &scratch_tracker_));
+  if (compression_ == THdfsCompression::NONE) return Status::OK;
+
+  File* f = file->get();
+  f->compression_pool_.reset(new MemPool());
+  Codec* compressor;
+  Status status = Codec::CreateCompressor(NULL, f->compression_pool_.get(), true,
+      compression_, &compressor);
+  if (status.ok()) {
+    f->compressor_.reset(compressor);
+    Codec* decompressor;
+    status = Codec::CreateDecompressor(NULL, f->compression_pool_.get(), true,
+        compression_, &decompressor);
+    if (status.ok()) f->decompressor_.reset(decompressor);
+  }
+  // Removes the file again.
+  if (!status.ok()) file->reset();
+  return status;
+}
+
+ScratchMgr::File::File(DiskIoMgr* io_mgr, const string& path, int disk_id,
+    MemTracker* tracker)
+  : io_mgr_(io_mgr),
+    path_(path),
+    disk_id_(disk_id),
+    tracker_(tracker),
+    current_buffer_(NULL),
+    num_writes_in_flight_(0),
+    reader_(NULL),
+    io_buffer_(NULL),
+    io_buffer_offset_(0),
+    num_blocks_(0),
+    bytes_written_(0),
+    bytes_read_(0),
+    read_mode_(false) {
+}
+
+ScratchMgr::File::~File() {
+  Close();
+}
+
+Status ScratchMgr::File::AppendBlock(const uint8_t* data, int64_t len) {
+  DCHECK(!read_mode_);
+  DCHECK_LE(len, numeric_limits<uint32_t>::max());
+  {
+    lock_guard<mutex> l(lock_);
+    RETURN_IF_ERROR(write_status_);
+  }
+
+  uint32_t header[2];
+  header[0] = len;
+  header[1] = 0;
+  if (compressor_.get() != NULL && len > 0) {
+    int compressed_len = 0;
+    uint8_t* compressed;
+    RETURN_IF_ERROR(compressor_->ProcessBlock(len, const_cast<uint8_t*>(data),
+        &compressed_len, &compressed));
+    // Incompressible blocks are stored as they are.
+    if (compressed_len < len) {
+      header[0] = compressed_len;
+      header[1] = len;
+      data = compressed;
+    }
+  }
+
+  int64_t block_bytes = BLOCK_HEADER_SIZE + header[0];
+  tracker_->Consume(block_bytes);
+  const MemTracker* exceeded = tracker_->GetExceededTracker();
+  if (exceeded != NULL) {
+    stringstream ss;
+    ss << "Scratch space limit exceeded: " << exceeded->label() << " would use "
+       << exceeded->consumption() << " bytes, limit is " << exceeded->limit()
+       << " bytes (--scratch_limit_per_query)";
+    tracker_->Release(block_bytes);
+    return Status(ss.str());
+  }
+  int64_t file_len = bytes_written_;
+  Status status = AppendBytes(reinterpret_cast<uint8_t*>(header), BLOCK_HEADER_SIZE);
+  if (status.ok()) status = AppendBytes(data, header[0]);
+  if (!status.ok()) {
+    // Only the bytes that made it into the file stay charged (see Close()).
+    tracker_->Release(block_bytes - (bytes_written_ - file_len));
+    return status;
+  }
+  ++num_blocks_;
+  return Status::OK;
+}
+
+Status ScratchMgr::File::AppendBytes(const uint8_t* data, int64_t len) {
+  while (len > 0) {
+    if (current_buffer_ == NULL) {
+      unique_lock<mutex> l(lock_);
+      while (free_buffers_.empty() && buffers_.size() == NUM_WRITE_BUFFERS) {
+        writes_done_cv_.wait(l);
+      }
+      RETURN_IF_ERROR(write_status_);
+      if (free_buffers_.empty()) {
+        buffers_.push_back(new WriteBuffer());
+        buffers_.back()->data = io_mgr_->GetWriteBuffer();
+        free_buffers_.push_back(buffers_.back());
+      }
+      current_buffer_ = free_buffers_.back();
+      free_buffers_.pop_back();
+      current_buffer_->len = 0;
+    }
+    int64_t capacity = io_mgr_->read_buffer_size();
+    int64_t bytes = min(len, capacity - current_buffer_->len);
+    memcpy(&current_buffer_->data[current_buffer_->len], data, bytes);
+    current_buffer_->len += bytes;
+    bytes_written_ += bytes;
+    data += bytes;
+    len -= bytes;
+    if (current_buffer_->len == capacity) {
+      RETURN_IF_ERROR(WriteCurrentBuffer());
+    }
+  }
+  return Status::OK;
+}
+
+Status ScratchMgr::File::WriteCurrentBuffer() {
+  DCHECK(current_buffer_ != NULL);
+  WriteBuffer* buffer = current_buffer_;
+  current_buffer_ = NULL;
+  buffer->range.Reset(path_.c_str(), bytes_written_ - buffer->len, disk_id_,
+      buffer->data, buffer->len, bind(&File::WriteDone, this, buffer, _1));
+  {
+    lock_guard<mutex> l(lock_);
+    ++num_writes_in_flight_;
+  }
+  Status status = io_mgr_->AddWriteRange(&buffer->range);
+  if (!status.ok()) WriteDone(buffer, status);
+  return status;
+}
+
+void ScratchMgr::File::WriteDone(WriteBuffer* buffer, const Status& status) {
+  // The file can be destroyed as soon as the lock is released, so it is notified
+  // with the lock held.
+  lock_guard<mutex> l(lock_);
+  DCHECK_GT(num_writes_in_flight_, 0);
+  --num_writes_in_flight_;
+  if (!status.ok() && write_status_.ok()) write_status_ = status;
+  free_buffers_.push_back(buffer);
+  writes_done_cv_.notify_all();
+}
+
+Status ScratchMgr::File::WaitForWrites() {
+  unique_lock<mutex> l(lock_);
+  while (num_writes_in_flight_ > 0) writes_done_cv_.wait(l);
+  return write_status_;
+}
+
+void ScratchMgr::File::FreeWriteBuffers() {
+  DCHECK_EQ(num_writes_in_flight_, 0);
+  for (int i = 0; i < buffers_.size(); ++i) {
+    io_mgr_->ReturnWriteBuffer(buffers_[i]->data);
+    delete buffers_[i];
+  }
+  buffers_.clear();
+  free_buffers_.clear();
+}
+
+Status ScratchMgr::File::PrepareForRead() {
+  DCHECK(!read_mode_);
+  read_mode_ = true;
+  if (current_buffer_ != NULL && current_buffer_->len > 0) {
+    RETURN_IF_ERROR(WriteCurrentBuffer());
+  }
+  current_buffer_ = NULL;
+  RETURN_IF_ERROR(WaitForWrites());
+  FreeWriteBuffers();
+  if (bytes_written_ == 0) return Status::OK;
+
+  RETURN_IF_ERROR(io_mgr_->RegisterReader(NULL, IO_BUFFERS_PER_FILE, &reader_));
+  scan_range_.Reset(path_.c_str(), bytes_written_, 0, disk_id_);
+  vector<DiskIoMgr::ScanRange*> ranges;
+  ranges.push_back(&scan_range_);
+  return io_mgr_->AddScanRanges(reader_, ranges);
+}
+
+Status ScratchMgr::File::NextIoBuffer() {
+  if (io_buffer_ != NULL) {
+    io_buffer_->Return();
+    io_buffer_ = NULL;
+  }
+  io_buffer_offset_ = 0;
+  bool eos;
+  DiskIoMgr::BufferDescriptor* buffer = NULL;
+  Status status = io_mgr_->GetNext(reader_, &buffer, &eos);
+  if (!status.ok()) {
+    if (buffer != NULL) buffer->Return();
+    return status;
+  }
+  if (buffer == NULL) {
+    stringstream ss;
+    ss << "Unexpected end of scratch file " << path_ << " at offset " << bytes_read_;
+    return Status(ss.str());
+  }
+  io_buffer_ = buffer;
+  return Status::OK;
+}
+
+Status ScratchMgr::File::ReadBytes(int64_t len, uint8_t** data) {
+  DCHECK_LE(bytes_read_ + len, bytes_written_);
+  if (io_buffer_ == NULL || io_buffer_offset_ == io_buffer_->len()) {
+    RETURN_IF_ERROR(NextIoBuffer());
+  }
+  bytes_read_ += len;
+
+  // Common case: the bytes are contiguous in the current io buffer.
+  if (io_buffer_->len() - io_buffer_offset_ >= len) {
+    *data = reinterpret_cast<uint8_t*>(io_buffer_->buffer() + io_buffer_offset_);
+    io_buffer_offset_ += len;
+    return Status::OK;
+  }
+
+  staging_.resize(len);
+  int64_t copied = 0;
+  while (copied < len) {
+    if (io_buffer_offset_ == io_buffer_->len()) RETURN_IF_ERROR(NextIoBuffer());
+    int64_t bytes = min(len - copied, io_buffer_->len() - io_buffer_offset_);
+    memcpy(&staging_[copied], io_buffer_->buffer() + io_buffer_offset_, bytes);
+    io_buffer_offset_ += bytes;
+    copied += bytes;
+  }
+  *data = reinterpret_cast<uint8_t*>(&staging_[0]);
+  return Status::OK;
+}
+
+Status ScratchMgr::File::GetNextBlock(uint8_t** data, int64_t* len, bool* eos) {
+  DCHECK(read_mode_);
+  if (bytes_read_ == bytes_written_) {
+    *eos = true;
+    return Status::OK;
+  }
+  *eos = false;
+
+  uint8_t* header_data;
+  RETURN_IF_ERROR(ReadBytes(BLOCK_HEADER_SIZE, &header_data));
+  uint32_t header[2];
+  memcpy(header, header_data, BLOCK_HEADER_SIZE);
+  if (bytes_read_ + header[0] > bytes_written_) {
+    stringstream ss;
+    ss << "Corrupt scratch file " << path_ << ": block of " << header[0]
+       << " bytes at offset " << bytes_read_ << " exceeds file length " << bytes_written_;
+    return Status(ss.str());
+  }
+  RETURN_IF_ERROR(ReadBytes(header[0], data));
+  *len = header[0];
+  if (header[1] == 0) return Status::OK;
+
+  DCHECK(decompressor_.get() != NULL);
+  decompressed_.resize(header[1]);
+  int decompressed_len = header[1];
+  uint8_t* output = &decompressed_[0];
+  RETURN_IF_ERROR(decompressor_->ProcessBlock(header[0], *data, &decompressed_len,
+      &output));
+  *data = output;
+  *len = decompressed_len;
+  return Status::OK;
+}
+
+void ScratchMgr::File::Close() {
+  // The disk threads may still reference the write buffers.
+  WaitForWrites();
+  FreeWriteBuffers();
+  current_buffer_ = NULL;
+  if (io_buffer_ != NULL) {
+    io_buffer_->Return();
+    io_buffer_ = NULL;
+  }
+  if (reader_ != NULL) {
+    io_mgr_->UnregisterReader(reader_);
+    reader_ = NULL;
+  }
+  if (!path_.empty()) {
+    if (unlink(path_.c_str()) != 0) {
+      LOG(WARNING) << "Could not remove scratch file " << path_ << ": "
+                   << strerror(errno);
+    }
+    path_.clear();
+    tracker_->Release(bytes_written_);
+  }
+}
+
+}
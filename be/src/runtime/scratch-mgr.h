@@ -0,0 +1,217 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_SCRATCH_MGR_H
+#define IMPALA_RUNTIME_SCRATCH_MGR_H
+
+#include <string>
+#include <vector>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "common/status.h"
+#include "runtime/disk-io-mgr.h"
+#include "runtime/mem-tracker.h"
+#include "util/uid-util.h"
+#include "gen-cpp/Descriptors_types.h"  // for THdfsCompression
+
+namespace impala {
+
+class Codec;
+class MemPool;
+
+// Manages the local scratch space that operators spill intermediate data to (see
+// SpillStream).
+// Scratch files are created in the directories of --scratch_dirs.  The directories
+// are grouped by the disk they are on (DiskInfo::disk_id()) and new files are
+// striped round-robin across the disks, and then across the directories of each
+// disk, so that the spill streams of concurrent operators go to different disks.
+// A file is a sequence of blocks that is written once and read back in order.
+// Blocks are optionally compressed (--scratch_compression) and are buffered and
+// written asynchronously through the DiskIoMgr's write queue of the disk, so that
+// the operator keeps producing data while its previous blocks are written.
+// The bytes in scratch files are tracked per query with MemTrackers below a process
+// wide scratch tracker, and limited by --scratch_limit_per_query.
+// All functions of the ScratchMgr are thread-safe; files are not.
+class ScratchMgr {
+ public:
+  class File;
+
+  // 'io_mgr' must outlive the scratch mgr and all of its files.
+  ScratchMgr(DiskIoMgr* io_mgr);
+
+  // Sets up the directories of --scratch_dirs.  Directories that are not writable
+  // are skipped with a warning.  Returns an error if no directory is usable or
+  // --scratch_compression is invalid; NewFile() fails in that case.
+  Status Init();
+
+  // Returns the tracker of the scratch bytes of query 'query_id' on this node,
+  // creating it if it doesn't exist yet.  All fragment instances of the query share
+  // the tracker, which is limited by --scratch_limit_per_query.
+  boost::shared_ptr<MemTracker> GetQueryTracker(const TUniqueId& query_id);
+
+  // Creates a new, empty scratch file for fragment instance 'fragment_instance_id'.
+  // The file's bytes are charged to 'query_tracker' (from GetQueryTracker()) if it is
+  // non-NULL.  The caller owns the file.
+  Status NewFile(const TUniqueId& fragment_instance_id, MemTracker* query_tracker,
+      boost::scoped_ptr<File>* file);
+
+  // Creates a new, empty file named after 'name' in the directory that NewFile() would
+  // use next, and returns its path and io mgr disk.  For clients that manage the file
+  // themselves (e.g. BufferPool), which must also remove it.
+  Status CreateFile(const std::string& name, std::string* path, int* disk_id);
+
+  // Bytes in the scratch files of all queries.
+  int64_t bytes_in_use() const { return scratch_tracker_.consumption(); }
+
+  int num_dirs() const { return num_dirs_; }
+
+ private:
+  DiskIoMgr* io_mgr_;
+
+  // The usable scratch directories, by the io mgr disk they are on.  Disks without
+  // scratch directories are left out.
+  std::vector<std::vector<std::string> > dirs_by_disk_;
+  std::vector<int> disk_ids_;
+  int num_dirs_;
+
+  THdfsCompression::type compression_;
+
+  // Picks the directories of new files and makes file names unique.
+  int64_t next_file_idx_;
+
+  // Parent of the query trackers: all scratch bytes of the process.
+  MemTracker scratch_tracker_;
+
+  typedef boost::unordered_map<TUniqueId, boost::weak_ptr<MemTracker> >
+      QueryTrackerMap;
+  boost::mutex query_trackers_lock_;
+  QueryTrackerMap query_trackers_;
+};
+
+// A scratch file, written with AppendBlock() and read back with GetNextBlock() after
+// PrepareForRead().  On disk each block is prefixed with its stored length and its
+// uncompressed length (0 if it is stored uncompressed).  The file is removed in
+// Close(), which is also called by the d'tor.
+class ScratchMgr::File {
+ public:
+  ~File();
+
+  // Appends the block of 'len' bytes at 'data', which is copied.  Blocks if all write
+  // buffers are being written.  Since writes are asynchronous, errors of earlier
+  // writes are returned by later calls.  Returns an error if the file would take the
+  // query over its scratch limit.
+  Status AppendBlock(const uint8_t* data, int64_t len);
+
+  // Writes out the buffered blocks, waits for all writes and registers the file with
+  // the io mgr for reading.  After this call only GetNextBlock() and Close() are
+  // valid.
+  Status PrepareForRead();
+
+  // Returns the next block in *data and *len.  *data is valid until the next call.
+  // Sets *eos to true instead once all blocks have been returned.
+  Status GetNextBlock(uint8_t** data, int64_t* len, bool* eos);
+
+  // Waits for outstanding writes, releases the io mgr reader and deletes the file.
+  // Idempotent.
+  void Close();
+
+  const std::string& path() const { return path_; }
+  int64_t num_blocks() const { return num_blocks_; }
+
+  // Bytes in the file, after compression.
+  int64_t bytes_written() const { return bytes_written_; }
+
+ private:
+  friend class ScratchMgr;
+
+  // The data is an io mgr buffer of DiskIoMgr::read_buffer_size() bytes.
+  struct WriteBuffer {
+    char* data;
+    int64_t len;
+    DiskIoMgr::WriteRange range;
+  };
+
+  File(DiskIoMgr* io_mgr, const std::string& path, int disk_id, MemTracker* tracker);
+
+  // Copies 'len' bytes into the write buffers, queueing the buffers that fill up.
+  Status AppendBytes(const uint8_t* data, int64_t len);
+
+  // Queues the write of current_buffer_.
+  Status WriteCurrentBuffer();
+
+  // Callback of the write of 'buffer'.
+  void WriteDone(WriteBuffer* buffer, const Status& status);
+
+  // Waits until no writes are in flight.  Returns the first write error.
+  Status WaitForWrites();
+
+  // Returns the write buffers to the io mgr.  No writes may be in flight.
+  void FreeWriteBuffers();
+
+  // Returns the next 'len' bytes of the file in *data.  The bytes are either
+  // returned in place from the current io buffer, or assembled in staging_ if they
+  // span io buffers.  *data is valid until the next call.
+  Status ReadBytes(int64_t len, uint8_t** data);
+
+  // Returns the current io buffer (if any) and gets the next one from the io mgr.
+  Status NextIoBuffer();
+
+  DiskIoMgr* io_mgr_;
+  std::string path_;
+  int disk_id_;
+
+  // Charged with the bytes of the file: the query's scratch tracker, or the process
+  // wide one.
+  MemTracker* tracker_;
+
+  // NULL if blocks are not compressed.  The compressor's output comes from
+  // compression_pool_.
+  boost::scoped_ptr<MemPool> compression_pool_;
+  boost::scoped_ptr<Codec> compressor_;
+  boost::scoped_ptr<Codec> decompressor_;
+  std::vector<uint8_t> decompressed_;
+
+  // Write state.  The buffers are allocated as needed, up to NUM_WRITE_BUFFERS.
+  // lock_ protects free_buffers_, num_writes_in_flight_ and write_status_, which are
+  // updated by the disk threads.
+  boost::mutex lock_;
+  boost::condition_variable writes_done_cv_;
+  std::vector<WriteBuffer*> buffers_;
+  std::vector<WriteBuffer*> free_buffers_;
+  WriteBuffer* current_buffer_;
+  int num_writes_in_flight_;
+  Status write_status_;
+
+  // io mgr state used in read mode.
+  DiskIoMgr::ReaderContext* reader_;
+  DiskIoMgr::ScanRange scan_range_;
+  DiskIoMgr::BufferDescriptor* io_buffer_;
+  int64_t io_buffer_offset_;  // bytes of io_buffer_ that have been consumed
+  std::string staging_;       // holds blocks that straddle io buffers
+
+  int64_t num_blocks_;
+  int64_t bytes_written_;
+  int64_t bytes_read_;
+  bool read_mode_;
+};
+
+}
+
+#endif
@@ -0,0 +1,193 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "runtime/sort-key-normalizer.h"
+#include "runtime/string-value.h"
+#include "runtime/timestamp-value.h"
+
+using namespace std;
+
+namespace impala {
+
+// Checks that the normalized keys of 'values' (which must be in ascending order and
+// distinct) are ordered for both sort directions.
+template <typename T>
+void TestOrder(PrimitiveType type, const vector<T>& values) {
+  for (int asc = 0; asc <= 1; ++asc) {
+    SortKeyNormalizer normalizer;
+    normalizer.Init(vector<PrimitiveType>(1, type), vector<bool>(1, asc), false);
+    vector<vector<uint8_t> > keys;
+    for (int i = 0; i < values.size(); ++i) {
+      keys.push_back(vector<uint8_t>(normalizer.key_size()));
+      normalizer.NormalizeValue(0, &values[i], &keys.back()[0]);
+    }
+    for (int i = 1; i < keys.size(); ++i) {
+      int result = normalizer.Compare(&keys[i - 1][0], &keys[i][0]);
+      if (asc) {
+        EXPECT_LT(result, 0) << "type=" << type << " i=" << i;
+      } else {
+        EXPECT_GT(result, 0) << "type=" << type << " i=" << i;
+      }
+    }
+  }
+}
+
+TEST(SortKeyNormalizerTest, Integers) {
+  vector<int8_t> tinyints;
+  tinyints.push_back(numeric_limits<int8_t>::min());
+  tinyints.push_back(-1);
+  tinyints.push_back(0);
+  tinyints.push_back(1);
+  tinyints.push_back(numeric_limits<int8_t>::max());
+  TestOrder(TYPE_TINYINT, tinyints);
+
+  vector<int32_t> ints;
+  ints.push_back(numeric_limits<int32_t>::min());
+  ints.push_back(-65536);
+  ints.push_back(-1);
+  ints.push_back(0);
+  ints.push_back(255);
+  ints.push_back(256);
+  ints.push_back(numeric_limits<int32_t>::max());
+  TestOrder(TYPE_INT, ints);
+
+  vector<int64_t> bigints;
+  bigints.push_back(numeric_limits<int64_t>::min());
+  bigints.push_back(numeric_limits<int32_t>::min());
+  bigints.push_back(-1);
+  bigints.push_back(0);
+  bigints.push_back(1LL << 40);
+  bigints.push_back(numeric_limits<int64_t>::max());
+  TestOrder(TYPE_BIGINT, bigints);
+}
+
+TEST(SortKeyNormalizerTest, FloatingPoint) {
+  vector<double> doubles;
+  doubles.push_back(-numeric_limits<double>::infinity());
+  doubles.push_back(-1e100);
+  doubles.push_back(-1.5);
+  doubles.push_back(-numeric_limits<double>::denorm_min());
+  doubles.push_back(0);
+  doubles.push_back(numeric_limits<double>::denorm_min());
+  doubles.push_back(0.25);
+  doubles.push_back(3);
+  doubles.push_back(numeric_limits<double>::infinity());
+  TestOrder(TYPE_DOUBLE, doubles);
+
+  vector<float> floats;
+  floats.push_back(-numeric_limits<float>::max());
+  floats.push_back(-1);
+  floats.push_back(0);
+  floats.push_back(1e-3);
+  floats.push_back(1);
+  floats.push_back(numeric_limits<float>::max());
+  TestOrder(TYPE_FLOAT, floats);
+
+  // -0 and 0 compare equal
+  SortKeyNormalizer normalizer;
+  normalizer.Init(vector<PrimitiveType>(1, TYPE_DOUBLE), vector<bool>(1, true), false);
+  uint8_t key1[9], key2[9];
+  double d1 = 0.0, d2 = -0.0;
+  normalizer.NormalizeValue(0, &d1, key1);
+  normalizer.NormalizeValue(0, &d2, key2);
+  EXPECT_EQ(normalizer.Compare(key1, key2), 0);
+}
+
+TEST(SortKeyNormalizerTest, Timestamps) {
+  const char* strs[] = {
+    "1400-01-01 00:00:00", "1969-12-31 23:59:59.999999999", "1970-01-01 00:00:00",
+    "1970-01-01 00:00:00.000000001", "2012-01-20 01:10:01", "2012-01-21 00:00:00"
+  };
+  vector<TimestampValue> values;
+  for (int i = 0; i < sizeof(strs) / sizeof(strs[0]); ++i) {
+    values.push_back(TimestampValue(strs[i], strlen(strs[i])));
+  }
+  TestOrder(TYPE_TIMESTAMP, values);
+}
+
+TEST(SortKeyNormalizerTest, Strings) {
+  const char* strs[] = { "", "a", "aa", "ab", "b", "bcdefghijklmnopqrstuvwxyz", "z" };
+  vector<StringValue> values;
+  for (int i = 0; i < sizeof(strs) / sizeof(strs[0]); ++i) {
+    values.push_back(StringValue(const_cast<char*>(strs[i]), strlen(strs[i])));
+  }
+  TestOrder(TYPE_STRING, values);
+
+  // strings that only differ after the prefix have equal keys
+  SortKeyNormalizer normalizer;
+  normalizer.Init(vector<PrimitiveType>(1, TYPE_STRING), vector<bool>(1, true), false, 4);
+  EXPECT_FALSE(normalizer.is_exact());
+  EXPECT_EQ(normalizer.key_size(), 5);
+  char s1[] = "abcdx";
+  char s2[] = "abcdy";
+  StringValue v1(s1, 5), v2(s2, 5);
+  uint8_t key1[5], key2[5];
+  normalizer.NormalizeValue(0, &v1, key1);
+  normalizer.NormalizeValue(0, &v2, key2);
+  EXPECT_EQ(normalizer.Compare(key1, key2), 0);
+}
+
+TEST(SortKeyNormalizerTest, NullsAndMultipleColumns) {
+  // (int asc, bigint desc), nulls last
+  vector<PrimitiveType> types;
+  types.push_back(TYPE_INT);
+  types.push_back(TYPE_BIGINT);
+  vector<bool> is_asc;
+  is_asc.push_back(true);
+  is_asc.push_back(false);
+  SortKeyNormalizer normalizer;
+  normalizer.Init(types, is_asc, false);
+  EXPECT_TRUE(normalizer.is_exact());
+  EXPECT_EQ(normalizer.key_size(), 1 + 4 + 1 + 8);
+
+  int32_t i1 = 1, i2 = 2;
+  int64_t b1 = 10, b2 = 20;
+  vector<uint8_t> k1(normalizer.key_size()), k2(normalizer.key_size()),
+      k3(normalizer.key_size()), k4(normalizer.key_size()), k5(normalizer.key_size());
+  // expected order: (1, 20) < (1, 10) < (1, NULL) < (2, 10) < (NULL, 20)
+  normalizer.NormalizeValue(0, &i1, &k1[0]);
+  normalizer.NormalizeValue(1, &b2, &k1[0]);
+  normalizer.NormalizeValue(0, &i1, &k2[0]);
+  normalizer.NormalizeValue(1, &b1, &k2[0]);
+  normalizer.NormalizeValue(0, &i1, &k3[0]);
+  normalizer.NormalizeValue(1, NULL, &k3[0]);
+  normalizer.NormalizeValue(0, &i2, &k4[0]);
+  normalizer.NormalizeValue(1, &b1, &k4[0]);
+  normalizer.NormalizeValue(0, NULL, &k5[0]);
+  normalizer.NormalizeValue(1, &b2, &k5[0]);
+  EXPECT_LT(normalizer.Compare(&k1[0], &k2[0]), 0);
+  EXPECT_LT(normalizer.Compare(&k2[0], &k3[0]), 0);
+  EXPECT_LT(normalizer.Compare(&k3[0], &k4[0]), 0);
+  EXPECT_LT(normalizer.Compare(&k4[0], &k5[0]), 0);
+
+  // with nulls first, NULLs sort before everything
+  normalizer.Init(types, is_asc, true);
+  normalizer.NormalizeValue(0, &i1, &k1[0]);
+  normalizer.NormalizeValue(1, &b1, &k1[0]);
+  normalizer.NormalizeValue(0, NULL, &k2[0]);
+  normalizer.NormalizeValue(1, &b1, &k2[0]);
+  EXPECT_GT(normalizer.Compare(&k1[0], &k2[0]), 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,152 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/sort-key-normalizer.h"
+
+#include <algorithm>
+#include <cmath>
+
+#include "common/logging.h"
+#include "runtime/string-value.h"
+#include "runtime/timestamp-value.h"
+
+using namespace impala;
+using namespace std;
+
+// Writes the lower 'num_bytes' bytes of 'value' to 'dst', most significant first.
+static inline void WriteBigEndian(uint64_t value, int num_bytes, uint8_t* dst) {
+  for (int i = num_bytes - 1; i >= 0; --i) {
+    dst[i] = static_cast<uint8_t>(value);
+    value >>= 8;
+  }
+}
+
+// Flips the sign bit of a 'num_bytes' wide signed integer, which makes its two's
+// complement representation compare like an unsigned number.
+static inline uint64_t FlipSign(int64_t value, int num_bytes) {
+  return static_cast<uint64_t>(value) ^ (1ULL << (num_bytes * 8 - 1));
+}
+
+// Maps the bits of an IEEE float/double of 'num_bytes' to an unsigned number with the
+// same order.
+static inline uint64_t NormalizeFloatBits(uint64_t bits, int num_bytes) {
+  uint64_t sign_bit = 1ULL << (num_bytes * 8 - 1);
+  if (bits & sign_bit) return ~bits;
+  return bits | sign_bit;
+}
+
+void SortKeyNormalizer::Init(const vector<PrimitiveType>& types,
+    const vector<bool>& is_asc_order, bool nulls_first, int string_prefix_len) {
+  DCHECK_EQ(types.size(), is_asc_order.size());
+  DCHECK_GT(string_prefix_len, 0);
+  columns_.clear();
+  nulls_first_ = nulls_first;
+  is_exact_ = true;
+  int offset = 0;
+  for (int i = 0; i < types.size(); ++i) {
+    Column col;
+    col.type = types[i];
+    col.is_asc = is_asc_order[i];
+    col.offset = offset;
+    switch (col.type) {
+      case TYPE_STRING:
+        col.width = string_prefix_len;
+        is_exact_ = false;
+        break;
+      case TYPE_TIMESTAMP:
+        col.width = sizeof(uint32_t) + sizeof(int64_t);
+        break;
+      default:
+        col.width = GetByteSize(col.type);
+    }
+    columns_.push_back(col);
+    offset += 1 + col.width;
+  }
+  key_size_ = offset;
+}
+
+void SortKeyNormalizer::NormalizeValue(int col_idx, const void* value,
+    uint8_t* key) const {
+  const Column& col = columns_[col_idx];
+  uint8_t* dst = key + col.offset;
+  if (value == NULL) {
+    *dst = nulls_first_ ? 0 : 1;
+    // all NULLs compare equal
+    memset(dst + 1, 0, col.width);
+    return;
+  }
+  *dst++ = nulls_first_ ? 1 : 0;
+
+  switch (col.type) {
+    case TYPE_BOOLEAN:
+      *dst = *reinterpret_cast<const bool*>(value) ? 1 : 0;
+      break;
+    case TYPE_TINYINT:
+      WriteBigEndian(FlipSign(*reinterpret_cast<const int8_t*>(value), 1), 1, dst);
+      break;
+    case TYPE_SMALLINT:
+      WriteBigEndian(FlipSign(*reinterpret_cast<const int16_t*>(value), 2), 2, dst);
+      break;
+    case TYPE_INT:
+      WriteBigEndian(FlipSign(*reinterpret_cast<const int32_t*>(value), 4), 4, dst);
+      break;
+    case TYPE_BIGINT:
+      WriteBigEndian(FlipSign(*reinterpret_cast<const int64_t*>(value), 8), 8, dst);
+      break;
+    case TYPE_FLOAT: {
+      float f = *reinterpret_cast<const float*>(value);
+      uint32_t bits = 0;  // also for -0
+      if (isnan(f)) {
+        bits = 0x7fc00000;
+      } else if (f != 0) {
+        memcpy(&bits, &f, sizeof(bits));
+      }
+      WriteBigEndian(NormalizeFloatBits(bits, 4), 4, dst);
+      break;
+    }
+    case TYPE_DOUBLE: {
+      double d = *reinterpret_cast<const double*>(value);
+      uint64_t bits = 0;  // also for -0
+      if (isnan(d)) {
+        bits = 0x7ff8000000000000ULL;
+      } else if (d != 0) {
+        memcpy(&bits, &d, sizeof(bits));
+      }
+      WriteBigEndian(NormalizeFloatBits(bits, 8), 8, dst);
+      break;
+    }
+    case TYPE_TIMESTAMP: {
+      // the accessors aren't const
+      TimestampValue ts = *reinterpret_cast<const TimestampValue*>(value);
+      WriteBigEndian(ts.date().day_number(), sizeof(uint32_t), dst);
+      WriteBigEndian(FlipSign(ts.time_of_day().ticks(), 8), 8, dst + sizeof(uint32_t));
+      break;
+    }
+    case TYPE_STRING: {
+      const StringValue* sv = reinterpret_cast<const StringValue*>(value);
+      int len = min(sv->len, col.width);
+      memcpy(dst, sv->ptr, len);
+      memset(dst + len, 0, col.width - len);
+      break;
+    }
+    default:
+      DCHECK(false) << "invalid type: " << TypeToString(col.type);
+  }
+
+  if (!col.is_asc) {
+    for (int i = 0; i < col.width; ++i) {
+      dst[i] = ~dst[i];
+    }
+  }
+}
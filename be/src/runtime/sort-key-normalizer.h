@@ -0,0 +1,84 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_SORT_KEY_NORMALIZER_H
+#define IMPALA_RUNTIME_SORT_KEY_NORMALIZER_H
+
+#include <stdint.h>
+#include <cstring>
+#include <vector>
+
+#include "runtime/primitive-type.h"
+
+namespace impala {
+
+// Encodes the values of a list of ordering columns into a fixed-size, byte-comparable
+// key: comparing two normalized keys with memcmp() orders them the way the ORDER BY
+// clause orders the values they were created from.  Each column takes a null
+// indicator byte followed by a fixed number of value bytes:
+// - integers are stored big-endian with the sign bit flipped
+// - floats and doubles are stored big-endian with the sign bit flipped for positive
+//   values and all bits flipped for negative ones (-0 is stored as 0)
+// - timestamps are stored as their (unsigned) day number followed by their
+//   time of day in ticks, encoded like a bigint
+// - strings are stored as their first 'string_prefix_len' bytes, padded with 0
+// The value bytes of descending columns are inverted; NULLs go before or after all
+// non-NULL values, regardless of the sort direction.
+// The encoding of strings loses information: a memcmp() result != 0 is always
+// conclusive, but keys can be equal for different strings (if they share a prefix,
+// or only differ in trailing 0 bytes).  Callers need to compare the original values
+// on ties unless is_exact() is true.
+class SortKeyNormalizer {
+ public:
+  SortKeyNormalizer() : key_size_(0), is_exact_(true) {}
+
+  // Sets up the key layout for columns of the given types and sort directions.
+  void Init(const std::vector<PrimitiveType>& types,
+      const std::vector<bool>& is_asc_order, bool nulls_first,
+      int string_prefix_len = DEFAULT_STRING_PREFIX_LEN);
+
+  // Writes the normalized form of 'value' (NULL for a SQL NULL), the value of the
+  // col-th column, into 'key', which is key_size() bytes.
+  void NormalizeValue(int col, const void* value, uint8_t* key) const;
+
+  // Returns <0, 0 or >0, like memcmp().
+  int Compare(const uint8_t* key1, const uint8_t* key2) const {
+    return memcmp(key1, key2, key_size_);
+  }
+
+  int key_size() const { return key_size_; }
+
+  // True if equal keys imply equal values, ie, if there are no string columns.
+  bool is_exact() const { return is_exact_; }
+
+  static const int DEFAULT_STRING_PREFIX_LEN = 16;
+
+ private:
+  struct Column {
+    PrimitiveType type;
+    bool is_asc;
+    int offset;  // of the null indicator byte; the value follows
+    int width;  // number of value bytes
+  };
+
+  std::vector<Column> columns_;
+  bool nulls_first_;
+  int key_size_;
+  bool is_exact_;
+};
+
+}
+
+#endif
@@ -0,0 +1,118 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/spill-stream.h"
+
+#include <sstream>
+#include <protocol/TBinaryProtocol.h>
+#include <transport/TBufferTransports.h>
+
+#include "runtime/row-batch.h"
+#include "runtime/runtime-state.h"
+#include "gen-cpp/Data_types.h"
+
+using namespace apache::thrift::protocol;
+using namespace apache::thrift::transport;
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+SpillStream::SpillStream(RuntimeState* state, const RowDescriptor& row_desc)
+  : state_(state),
+    row_desc_(row_desc),
+    num_rows_(0),
+    num_batches_(0),
+    read_mode_(false) {
+}
+
+SpillStream::~SpillStream() {
+  Close();
+}
+
+Status SpillStream::Init() {
+  DCHECK(file_.get() == NULL);
+  RETURN_IF_ERROR(state_->scratch_mgr()->NewFile(state_->fragment_instance_id(),
+      state_->query_scratch_tracker(), &file_));
+  write_buffer_.reset(new TMemoryBuffer());
+  return Status::OK;
+}
+
+Status SpillStream::AddBatch(RowBatch* batch) {
+  DCHECK(file_.get() != NULL);
+  DCHECK(!read_mode_);
+  if (batch->num_rows() == 0) return Status::OK;
+  int num_rows = batch->num_rows();
+
+  TRowBatch thrift_batch;
+  RETURN_IF_ERROR(batch->Serialize(&thrift_batch));
+  write_buffer_->resetBuffer();
+  TBinaryProtocolT<TMemoryBuffer> protocol(write_buffer_);
+  try {
+    thrift_batch.write(&protocol);
+  } catch (apache::thrift::TException& e) {
+    stringstream ss;
+    ss << "Couldn't serialize row batch to scratch file " << file_->path() << ": "
+       << e.what();
+    return Status(ss.str());
+  }
+
+  uint8_t* buffer;
+  uint32_t len;
+  write_buffer_->getBuffer(&buffer, &len);
+  RETURN_IF_ERROR(file_->AppendBlock(buffer, len));
+  num_rows_ += num_rows;
+  ++num_batches_;
+  return Status::OK;
+}
+
+Status SpillStream::PrepareForRead() {
+  DCHECK(file_.get() != NULL);
+  DCHECK(!read_mode_);
+  read_mode_ = true;
+  // Release the serialization buffer; it is not needed anymore.
+  write_buffer_.reset();
+  return file_->PrepareForRead();
+}
+
+Status SpillStream::GetNext(scoped_ptr<RowBatch>* batch, bool* eos) {
+  DCHECK(read_mode_);
+  uint8_t* data;
+  int64_t len;
+  RETURN_IF_ERROR(file_->GetNextBlock(&data, &len, eos));
+  if (*eos) {
+    batch->reset();
+    return Status::OK;
+  }
+
+  TRowBatch thrift_batch;
+  shared_ptr<TMemoryBuffer> transport(new TMemoryBuffer(data, len));
+  TBinaryProtocolT<TMemoryBuffer> protocol(transport);
+  try {
+    thrift_batch.read(&protocol);
+  } catch (apache::thrift::TException& e) {
+    stringstream ss;
+    ss << "Couldn't deserialize row batch from scratch file " << file_->path() << ": "
+       << e.what();
+    return Status(ss.str());
+  }
+  batch->reset(new RowBatch(row_desc_, thrift_batch));
+  return Status::OK;
+}
+
+void SpillStream::Close() {
+  if (file_.get() != NULL) file_->Close();
+}
+
+}
@@ -0,0 +1,96 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_SPILL_STREAM_H
+#define IMPALA_RUNTIME_SPILL_STREAM_H
+
+#include <string>
+#include <boost/scoped_ptr.hpp>
+#include <boost/shared_ptr.hpp>
+
+#include "common/status.h"
+#include "runtime/scratch-mgr.h"
+
+namespace apache { namespace thrift { namespace transport {
+class TMemoryBuffer;
+} } }
+
+namespace impala {
+
+class RowBatch;
+class RowDescriptor;
+class RuntimeState;
+
+// A sequence of row batches that is written out to a local scratch file and read
+// back in the order it was written.  Operators that run out of memory (sort,
+// aggregation, join) use this to move intermediate state to disk.
+// Batches are serialized with RowBatch::Serialize() and written as thrift messages,
+// one block of a ScratchMgr::File each.  The scratch mgr places the file, writes it
+// asynchronously and reads it back through the DiskIoMgr, so that the io is
+// scheduled with the rest of the io on the node and overlaps with the caller's cpu
+// work.
+// A stream is written via AddBatch(), then switched to read mode with
+// PrepareForRead() and consumed with GetNext().  It cannot be written to again after
+// that.  The scratch file is removed in Close(), which is also called by the d'tor.
+// This class is not thread-safe.
+class SpillStream {
+ public:
+  SpillStream(RuntimeState* state, const RowDescriptor& row_desc);
+  ~SpillStream();
+
+  // Creates the scratch file.  Must be called before any other function.
+  Status Init();
+
+  // Appends the rows of 'batch' to the stream.  'batch' is serialized, which resets
+  // it if it is self-contained (see RowBatch::Serialize()).
+  Status AddBatch(RowBatch* batch);
+
+  // Finishes writing and registers the stream with the io mgr.  After this call
+  // only GetNext() and Close() are valid.
+  Status PrepareForRead();
+
+  // Returns the next batch in the stream in *batch.  The returned batch is
+  // self-contained and owned by the caller.  *batch is reset to NULL and *eos set
+  // to true once all batches have been returned.
+  Status GetNext(boost::scoped_ptr<RowBatch>* batch, bool* eos);
+
+  // Releases the io mgr reader and deletes the scratch file.  Idempotent.
+  void Close();
+
+  int64_t num_rows() const { return num_rows_; }
+  int64_t num_batches() const { return num_batches_; }
+
+  // Bytes in the scratch file (after compression, see ScratchMgr).
+  int64_t bytes_written() const {
+    return file_.get() == NULL ? 0 : file_->bytes_written();
+  }
+
+ private:
+  RuntimeState* state_;
+  const RowDescriptor& row_desc_;
+
+  boost::scoped_ptr<ScratchMgr::File> file_;
+
+  // Reused serialization buffer for AddBatch().
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> write_buffer_;
+
+  int64_t num_rows_;
+  int64_t num_batches_;
+  bool read_mode_;
+};
+
+}
+
+#endif
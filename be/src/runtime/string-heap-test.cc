@@ -0,0 +1,103 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <sstream>
+#include <gtest/gtest.h>
+
+#include "runtime/mem-pool.h"
+#include "runtime/string-heap.h"
+#include "runtime/string-value.inline.h"
+
+using namespace std;
+
+namespace impala {
+
+TEST(StringHeapTest, Basic) {
+  MemPool pool;
+  StringHeap heap(&pool);
+  string a = "abc";
+  string b = "abcd";
+  string a2 = "abc";
+
+  StringValue interned_a = heap.Intern(StringValue(const_cast<char*>(a.data()), 3));
+  StringValue interned_b = heap.Intern(StringValue(const_cast<char*>(b.data()), 4));
+  StringValue interned_a2 = heap.Intern(StringValue(const_cast<char*>(a2.data()), 3));
+  EXPECT_TRUE(interned_a.ptr != a.data());
+  EXPECT_TRUE(interned_a.ptr == interned_a2.ptr);
+  EXPECT_TRUE(interned_a.ptr != interned_b.ptr);
+  EXPECT_TRUE(interned_a.Eq(StringValue(const_cast<char*>(a.data()), 3)));
+  EXPECT_EQ(interned_b.len, 4);
+  EXPECT_EQ(heap.num_strings(), 2);
+  EXPECT_EQ(heap.num_duplicates(), 1);
+
+  StringHeap::Handle handle = heap.Insert(StringValue(const_cast<char*>(b.data()), 4));
+  EXPECT_TRUE(heap.Get(handle).ptr == interned_b.ptr);
+
+  // Empty strings aren't stored.
+  EXPECT_EQ(heap.Intern(StringValue()).len, 0);
+  EXPECT_EQ(heap.num_strings(), 2);
+
+  MemPool pool2;
+  heap.Reset(&pool2);
+  EXPECT_EQ(heap.num_strings(), 0);
+  StringValue interned_a3 = heap.Intern(StringValue(const_cast<char*>(a.data()), 3));
+  EXPECT_TRUE(interned_a3.ptr != interned_a.ptr);
+  EXPECT_GT(pool2.total_allocated_bytes(), 0);
+}
+
+TEST(StringHeapTest, ManyStrings) {
+  MemPool pool;
+  StringHeap heap(&pool);
+  vector<StringValue> interned;
+  vector<string> strings;
+  for (int i = 0; i < 10000; ++i) {
+    stringstream ss;
+    ss << "value" << i % 1000;
+    strings.push_back(ss.str());
+  }
+  for (int i = 0; i < strings.size(); ++i) {
+    interned.push_back(heap.Intern(
+        StringValue(const_cast<char*>(strings[i].data()), strings[i].size())));
+  }
+  EXPECT_EQ(heap.num_strings(), 1000);
+  EXPECT_EQ(heap.num_duplicates(), 9000);
+  for (int i = 0; i < strings.size(); ++i) {
+    EXPECT_EQ(string(interned[i].ptr, interned[i].len), strings[i]);
+    EXPECT_TRUE(interned[i].ptr == interned[i % 1000].ptr);
+  }
+}
+
+TEST(StringHeapTest, StopsDeduplicating) {
+  MemPool pool;
+  StringHeap heap(&pool);
+  string value;
+  for (int i = 0; i < 100 * 1000; ++i) {
+    stringstream ss;
+    ss << i;
+    value = ss.str();
+    StringValue interned =
+        heap.Intern(StringValue(const_cast<char*>(value.data()), value.size()));
+    EXPECT_EQ(string(interned.ptr, interned.len), value);
+  }
+  EXPECT_FALSE(heap.dedup_enabled());
+  EXPECT_EQ(heap.byte_size(), 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,109 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "runtime/string-heap.h"
+
+#include "runtime/mem-pool.h"
+#include "runtime/string-value.inline.h"
+#include "util/hash-util.h"
+
+using namespace std;
+
+namespace impala {
+
+const StringHeap::Handle StringHeap::EMPTY_BUCKET;
+
+StringHeap::StringHeap(MemPool* pool)
+  : pool_(pool),
+    num_interned_(0),
+    num_duplicates_(0),
+    dedup_enabled_(true) {
+  DCHECK(pool != NULL);
+  buckets_.resize(MIN_BUCKETS, EMPTY_BUCKET);
+}
+
+StringHeap::Handle StringHeap::Insert(const StringValue& str) {
+  DCHECK(dedup_enabled_);
+  uint32_t hash = HashUtil::Hash(str.ptr, str.len, 0);
+  int mask = buckets_.size() - 1;
+  int bucket_idx = hash & mask;
+  while (buckets_[bucket_idx] != EMPTY_BUCKET) {
+    Handle handle = buckets_[bucket_idx];
+    if (hashes_[handle] == hash && strings_[handle].Eq(str)) {
+      ++num_duplicates_;
+      return handle;
+    }
+    bucket_idx = (bucket_idx + 1) & mask;
+  }
+  DCHECK_LT(strings_.size(), EMPTY_BUCKET);
+  Handle handle = strings_.size();
+  strings_.push_back(Copy(str));
+  hashes_.push_back(hash);
+  buckets_[bucket_idx] = handle;
+  // keep the table at most half full
+  if (strings_.size() * 2 > buckets_.size()) ResizeBuckets(buckets_.size() * 2);
+  return handle;
+}
+
+StringValue StringHeap::Intern(const StringValue& str) {
+  if (str.len == 0) return StringValue();
+  if (!dedup_enabled_) return Copy(str);
+  StringValue result = Get(Insert(str));
+  if (++num_interned_ == SAMPLE_SIZE
+      && num_duplicates_ * MIN_DUPLICATE_FRACTION < num_interned_) {
+    VLOG_FILE << "StringHeap found only " << num_duplicates_ << " duplicates in "
+              << num_interned_ << " strings; turning off deduplication";
+    dedup_enabled_ = false;
+    vector<StringValue>().swap(strings_);
+    vector<uint32_t>().swap(hashes_);
+    vector<Handle>().swap(buckets_);
+  }
+  return result;
+}
+
+void StringHeap::Reset(MemPool* pool) {
+  DCHECK(pool != NULL);
+  pool_ = pool;
+  strings_.clear();
+  hashes_.clear();
+  if (dedup_enabled_) {
+    buckets_.assign(MIN_BUCKETS, EMPTY_BUCKET);
+  }
+}
+
+int64_t StringHeap::byte_size() const {
+  return strings_.capacity() * sizeof(StringValue)
+      + hashes_.capacity() * sizeof(uint32_t) + buckets_.capacity() * sizeof(Handle);
+}
+
+StringValue StringHeap::Copy(const StringValue& str) {
+  char* ptr = reinterpret_cast<char*>(pool_->Allocate(str.len));
+  memcpy(ptr, str.ptr, str.len);
+  return StringValue(ptr, str.len);
+}
+
+void StringHeap::ResizeBuckets(int num_buckets) {
+  DCHECK_EQ(num_buckets & (num_buckets - 1), 0);
+  buckets_.assign(num_buckets, EMPTY_BUCKET);
+  int mask = num_buckets - 1;
+  for (Handle handle = 0; handle < strings_.size(); ++handle) {
+    int bucket_idx = hashes_[handle] & mask;
+    while (buckets_[bucket_idx] != EMPTY_BUCKET) {
+      bucket_idx = (bucket_idx + 1) & mask;
+    }
+    buckets_[bucket_idx] = handle;
+  }
+}
+
+}
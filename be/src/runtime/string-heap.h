@@ -0,0 +1,112 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_RUNTIME_STRING_HEAP_H
+#define IMPALA_RUNTIME_STRING_HEAP_H
+
+#include <vector>
+#include <boost/cstdint.hpp>
+
+#include "common/logging.h"
+#include "runtime/string-value.h"
+
+namespace impala {
+
+class MemPool;
+
+// A StringHeap copies strings into a MemPool and keeps a single copy of each distinct
+// string: exec nodes that hold on to many string values with few distinct values
+// (e.g. the build side of a join with a dimension table, or the grouping values of an
+// aggregation) intern them instead of copying every occurrence.  Interned strings
+// that are equal share the same data, so comparing their pointers is enough to find
+// them equal (see StringValue::Eq()).
+// Each distinct string is identified by a 32-bit handle, its index in the heap; the
+// index of the heap is an open addressing hash table of handles.
+// If the first SAMPLE_SIZE strings contain few duplicates, the heap stops
+// deduplicating and Intern() only copies, so that unique strings don't pay for the
+// hashing and the index.
+class StringHeap {
+ public:
+  typedef uint32_t Handle;
+
+  // The string data is allocated from 'pool', which must outlive the uses of the
+  // interned strings.
+  explicit StringHeap(MemPool* pool);
+
+  // Returns the handle of the string in the heap that is equal to 'str', adding a
+  // copy of 'str' if there is none.  Must not be called once dedup_enabled() is
+  // false.
+  Handle Insert(const StringValue& str);
+
+  // Returns the string for 'handle'.
+  const StringValue& Get(Handle handle) const {
+    DCHECK_LT(handle, strings_.size());
+    return strings_[handle];
+  }
+
+  // Returns a copy of 'str' in the pool, which is shared with all equal strings that
+  // were interned before.  Once deduplication is turned off, the copy isn't shared.
+  StringValue Intern(const StringValue& str);
+
+  // Drops all strings and allocates future ones from 'pool'.  This must be called
+  // when the data of the previous pool was freed or transferred.
+  void Reset(MemPool* pool);
+
+  // Returns false once the heap stopped deduplicating.
+  bool dedup_enabled() const { return dedup_enabled_; }
+
+  // Number of distinct strings in the heap.
+  int num_strings() const { return strings_.size(); }
+
+  // Number of Intern() and Insert() calls that found an equal string in the heap.
+  int64_t num_duplicates() const { return num_duplicates_; }
+
+  // Returns the number of bytes allocated for the index, not including the string
+  // data in the pool.
+  int64_t byte_size() const;
+
+ private:
+  static const Handle EMPTY_BUCKET = 0xffffffff;
+  static const int MIN_BUCKETS = 1024;
+
+  // Deduplication is turned off once SAMPLE_SIZE strings were interned if fewer
+  // than 1 in MIN_DUPLICATE_FRACTION of them were duplicates.
+  static const int SAMPLE_SIZE = 64 * 1024;
+  static const int MIN_DUPLICATE_FRACTION = 4;
+
+  // Returns a copy of 'str' in pool_.
+  StringValue Copy(const StringValue& str);
+
+  // Rebuilds buckets_ with 'num_buckets' buckets, which must be a power of two.
+  void ResizeBuckets(int num_buckets);
+
+  MemPool* pool_;
+
+  // Distinct strings, indexed by their handles, and their hashes
+  std::vector<StringValue> strings_;
+  std::vector<uint32_t> hashes_;
+
+  // Handles of strings_, or EMPTY_BUCKET; the bucket of a string is the first empty
+  // one at or after the string's hash modulo the number of buckets.
+  std::vector<Handle> buckets_;
+
+  int64_t num_interned_;
+  int64_t num_duplicates_;
+  bool dedup_enabled_;
+};
+
+}
+
+#endif
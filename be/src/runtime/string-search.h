@@ -22,11 +22,18 @@
 
 #include "common/logging.h"
 #include "runtime/string-value.h"
+#include "util/cpu-dispatch.h"
+#include "util/cpu-info.h"
+#ifdef __SSE4_2__
+#include "util/sse-util.h"
+#endif
 
 namespace impala {
 
-// TODO: This can be sped up with SIDD_CMP_EQUAL_ORDERED or at the very least rewritten
-// from published algorithms.
+// Patterns of 2 to 16 characters are searched with the sse4.2 SIDD_CMP_EQUAL_ORDERED
+// string compare, which checks 16 positions of the string at a time.  Other patterns,
+// the end of the string and cpus without sse4.2 use the search below; SEARCH_KERNEL
+// selects between the two.
 //
 // This is taken from the python search string function doing string search (substring)
 // using an optimized boyer-moore-horspool algorithm.
@@ -83,10 +90,20 @@ namespace impala {
 class StringSearch {
 
  public:
+  // Selects between SearchSSE() and SearchNoSSE().
+  static CpuDispatch::Kernel SEARCH_KERNEL;
+
   StringSearch() : pattern_(NULL), mask_(0) {}
 
   // Initialize/Precompute a StringSearch object from the pattern
   StringSearch(const StringValue* pattern) : pattern_(pattern), mask_(0), skip_(0) {
+#ifdef __SSE4_2__
+    // Copy the pattern so a full register can be loaded from it.
+    if (pattern_->len <= SSEUtil::CHARS_PER_128_BIT_REGISTER) {
+      memset(sse_pattern_, 0, sizeof(sse_pattern_));
+      memcpy(sse_pattern_, pattern_->ptr, pattern_->len);
+    }
+#endif
     // Special cases
     if (pattern_->len <= 1) {
       return;
@@ -112,7 +129,50 @@ class StringSearch {
     if (!str || !pattern_ || pattern_->len == 0) {
       return -1;
     }
-    
+#ifdef __SSE4_2__
+    if (pattern_->len > 1 && pattern_->len <= SSEUtil::CHARS_PER_128_BIT_REGISTER &&
+        SEARCH_KERNEL.level() >= CpuDispatch::SSE4_2) {
+      return SearchSSE(str);
+    }
+#endif
+    return SearchNoSSE(str);
+  }
+
+ private:
+  static const int BLOOM_WIDTH = 64;
+
+#ifdef __SSE4_2__
+  // Search with sse4.2 intrinsics.  This finds the first position in each 16 bytes of
+  // str at which the pattern starts, including patterns cut off by the end of the 16
+  // bytes.  For those, the search continues from that position.
+  // Only 16 bytes within str are loaded; the last bytes are searched by SearchNoSSE().
+  int SearchSSE(const StringValue* str) const {
+    int m = pattern_->len;
+    int n = str->len;
+    const char* s = str->ptr;
+    __m128i pattern = _mm_loadu_si128(reinterpret_cast<const __m128i*>(sse_pattern_));
+    int i = 0;
+    while (i + SSEUtil::CHARS_PER_128_BIT_REGISTER <= n) {
+      __m128i xmm = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s + i));
+      int offset = _mm_cmpestri(pattern, m, xmm, SSEUtil::CHARS_PER_128_BIT_REGISTER,
+          SSEUtil::STRSTR_MODE);
+      if (offset == SSEUtil::CHARS_PER_128_BIT_REGISTER) {
+        i += SSEUtil::CHARS_PER_128_BIT_REGISTER;
+      } else if (offset + m <= SSEUtil::CHARS_PER_128_BIT_REGISTER) {
+        return i + offset;
+      } else {
+        // Partial match at the end.  offset > 0 since m <= 16.
+        i += offset;
+      }
+    }
+    if (n - i < m) return -1;
+    StringValue rest(const_cast<char*>(s + i), n - i);
+    int result = SearchNoSSE(&rest);
+    return result == -1 ? -1 : i + result;
+  }
+#endif
+
+  int SearchNoSSE(const StringValue* str) const {
     int mlast = pattern_->len - 1;
     int w = str->len - pattern_->len;
     int n = str->len;
@@ -153,9 +213,6 @@ class StringSearch {
     return -1;
   }
 
- private:
-  static const int BLOOM_WIDTH = 64;
-
   void BloomAdd(char c) {
     mask_ |= (1UL << (c & (BLOOM_WIDTH - 1)));
   } 
@@ -167,6 +224,11 @@ class StringSearch {
   const StringValue* pattern_;
   int64_t mask_;
   int64_t skip_;
+
+#ifdef __SSE4_2__
+  // Copy of the pattern padded with 0s, if it has at most 16 characters
+  char sse_pattern_[SSEUtil::CHARS_PER_128_BIT_REGISTER];
+#endif
 };
 
 }
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #ifdef IR_COMPILE
+#include "runtime/string-search.h"
 #include "runtime/string-value.inline.h"
 
 using namespace impala;
@@ -46,6 +47,14 @@ extern "C"
 bool StringValueGE(const StringValue* s1, const StringValue* s2) {
   return s1->Ge(*s2);
 }
+
+// Returns the offset of the first occurrence of 'pattern' in 'str', or -1 if there is
+// none (see StringSearch::Search())
+extern "C"
+int StringValueFind(const StringValue* str, const StringValue* pattern) {
+  StringSearch search(pattern);
+  return search.Search(str);
+}
 #else
 #error "This file should only be used for cross compiling to IR."
 #endif
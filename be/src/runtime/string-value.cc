@@ -21,6 +21,14 @@ namespace impala {
 
 const char* StringValue::LLVM_CLASS_NAME = "struct.impala::StringValue";
 
+#ifdef __SSE4_2__
+CpuDispatch::Kernel StringValue::COMPARE_KERNEL("StringValue::Compare",
+    CpuDispatch::SSE4_2);
+#else
+CpuDispatch::Kernel StringValue::COMPARE_KERNEL("StringValue::Compare",
+    CpuDispatch::SCALAR);
+#endif
+
 string StringValue::DebugString() const {
   return string(ptr, len);
 }
@@ -18,6 +18,8 @@
 
 #include <string>
 
+#include "util/cpu-dispatch.h"
+
 namespace impala {
 
 // The format of a string-typed slot.
@@ -67,6 +69,10 @@ struct StringValue {
 
   // For C++/IR interop, we need to be able to look up types by name.
   static const char* LLVM_CLASS_NAME;
+
+  // Selects the sse4.2 or byte-by-byte variant of StringCompare() (see
+  // string-value.inline.h).
+  static CpuDispatch::Kernel COMPARE_KERNEL;
 };
 
 std::ostream& operator<<(std::ostream& os, const StringValue& string_value);
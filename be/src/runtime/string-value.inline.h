@@ -25,8 +25,9 @@
 
 namespace impala {
 
-// Compare two strings using sse4.2 intrinsics if they are available. This code assumes
-// that the trivial cases are already handled (i.e. one string is empty). 
+// Compare two strings using sse4.2 intrinsics if StringValue::COMPARE_KERNEL selects
+// them. This code assumes that the trivial cases are already handled (i.e. one string
+// is empty).
 // Returns:
 //   < 0 if s1 < s2
 //   0 if s1 == s2
@@ -38,7 +39,7 @@ namespace impala {
 static inline int StringCompare(const char* s1, int n1, const char* s2, int n2, int len) {
   DCHECK_EQ(len, std::min(n1, n2));
 #ifdef __SSE4_2__
-  if (CpuInfo::IsSupported(CpuInfo::SSE4_2)) {
+  if (StringValue::COMPARE_KERNEL.level() >= CpuDispatch::SSE4_2) {
     while (len >= SSEUtil::CHARS_PER_128_BIT_REGISTER) {
       __m128i xmm0 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s1));
       __m128i xmm1 = _mm_loadu_si128(reinterpret_cast<const __m128i*>(s2));
@@ -82,6 +83,8 @@ inline int StringValue::Compare(const StringValue& other) const {
 
 inline bool StringValue::Eq(const StringValue& other) const {
   if (this->len != other.len) return false;
+  // interned strings (see StringHeap) that are equal share their data
+  if (this->ptr == other.ptr) return true;
   return StringCompare(this->ptr, this->len, other.ptr, other.len, this->len) == 0;
 }
 
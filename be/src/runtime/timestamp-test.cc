@@ -15,6 +15,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <iostream>
+#include <sstream>
 #include <gtest/gtest.h>
 #include "runtime/raw-value.h"
 #include "runtime/timestamp-value.h"
@@ -129,6 +130,30 @@ TEST(TimestampTest, Basic) {
   EXPECT_EQ(bv7.time_of_day(), not_a_date_time);
 }
 
+// The civil date conversions and the formatting agree with boost.
+TEST(TimestampTest, CivilDate) {
+  for (date d(1400, 1, 1); d <= date(9999, 12, 31); d += date_duration(1)) {
+    int year, month, day;
+    TimestampValue::CivilFromDayNumber(d.day_number(), &year, &month, &day);
+    ASSERT_EQ(year, d.year());
+    ASSERT_EQ(month, d.month());
+    ASSERT_EQ(day, d.day());
+    ASSERT_EQ(TimestampValue::DayNumberFromCivil(year, month, day), d.day_number());
+  }
+
+  const char* values[] = { "1400-01-01 00:00:00", "1969-12-31 23:59:59.999999999",
+      "2000-02-29 12:01:02.000000010", "9999-12-31 23:59:59.100000000" };
+  for (int i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    TimestampValue v(values[i], strlen(values[i]));
+    stringstream ss;
+    ss << to_iso_extended_string(v.date()) << " " << to_simple_string(v.time_of_day());
+    EXPECT_EQ(v.DebugString(), ss.str());
+    EXPECT_EQ(v.DebugString(), values[i]);
+  }
+  TimestampValue date_only(date(2012, 1, 20), time_duration(not_a_date_time));
+  EXPECT_EQ(date_only.DebugString(), "2012-01-20");
+}
+
 }
 
 int main(int argc, char **argv) {
@@ -28,6 +28,15 @@ time_t to_time_t(ptime t) {
   if (t == not_a_date_time) {
     return 0;
   }
+  int64_t ticks = t.time_of_day().ticks();
+  if (!t.is_special() && ticks >= 0) {
+    int64_t ticks_per_second = time_duration::ticks_per_second();
+    int64_t seconds = (static_cast<int64_t>(t.date().day_number()) -
+        TimestampValue::EPOCH_DAY_NUMBER) * 24 * 60 * 60 + ticks / ticks_per_second;
+    // Round towards 0, like time_duration::total_seconds().
+    if (seconds < 0 && ticks % ticks_per_second != 0) ++seconds;
+    return seconds;
+  }
   ptime epoch(date(1970, 1, 1));
   time_duration::sec_type x = (t - epoch).total_seconds();
 
@@ -36,6 +45,67 @@ time_t to_time_t(ptime t) {
 static const time_duration one_day(24, 0, 0);
 
 
+// Returns the number of the 'len' digits at str.  The caller checks they are digits.
+static inline int DigitsToInt(const char* str, int len) {
+  int val = 0;
+  for (int i = 0; i < len; ++i) val = val * 10 + str[i] - '0';
+  return val;
+}
+
+static inline bool IsDigit(char c) {
+  return c >= '0' && c <= '9';
+}
+
+inline bool TimestampValue::ParseDefaultFormat(const char* str, int len) {
+  // Length of "YYYY-MM-DD HH:MM:SS" and the maximum number of fractional digits
+  static const int DATE_TIME_LEN = 19;
+  static const int MAX_FRACTION_LEN = 9;
+  if (len < DATE_TIME_LEN) return false;
+  int fraction_len = 0;
+  if (len > DATE_TIME_LEN) {
+    fraction_len = len - DATE_TIME_LEN - 1;
+    if (str[DATE_TIME_LEN] != '.' || fraction_len == 0 ||
+        fraction_len > MAX_FRACTION_LEN) {
+      return false;
+    }
+  }
+  if (str[4] != '-' || str[7] != '-' || str[10] != ' ' || str[13] != ':' ||
+      str[16] != ':') {
+    return false;
+  }
+  static const int DIGIT_POSITIONS[] = {0, 1, 2, 3, 5, 6, 8, 9, 11, 12, 14, 15, 17, 18};
+  int num_digits = sizeof(DIGIT_POSITIONS) / sizeof(int);
+  for (int i = 0; i < num_digits; ++i) {
+    if (!IsDigit(str[DIGIT_POSITIONS[i]])) return false;
+  }
+  const char* fraction_str = str + DATE_TIME_LEN + 1;
+  for (int i = 0; i < fraction_len; ++i) {
+    if (!IsDigit(fraction_str[i])) return false;
+  }
+
+  int year = DigitsToInt(str, 4);
+  int month = DigitsToInt(str + 5, 2);
+  int day = DigitsToInt(str + 8, 2);
+  int hour = DigitsToInt(str + 11, 2);
+  int minute = DigitsToInt(str + 14, 2);
+  int second = DigitsToInt(str + 17, 2);
+  // Leave dates outside of the boost range to the generic parsing, which treats them
+  // as invalid.
+  if (year < 1400 || month < 1 || month > 12 || day < 1 || hour >= 24 ||
+      minute >= 60 || second >= 60) {
+    return false;
+  }
+  if (day > gregorian_calendar::end_of_month_day(year, month)) return false;
+
+  // Convert the factional part to a number of nano-seconds.
+  int fraction = DigitsToInt(fraction_str, fraction_len);
+  for (int i = fraction_len; i < MAX_FRACTION_LEN; ++i) fraction *= 10;
+
+  date_ = date(year, month, day);
+  time_of_day_ = time_duration(hour, minute, second, fraction);
+  return true;
+}
+
 inline bool TimestampValue::ParseTime(const char** strp, int* lenp) {
   StringParser::ParseResult status;
   int len = *lenp;
@@ -143,6 +213,8 @@ TimestampValue::TimestampValue(const char* str, int len) {
   // In the case of just a time, the date will be set to invalid.
   // Unfortunately there is no snscanf.
 
+  if (ParseDefaultFormat(str, len)) return;
+
   // Remove leading white space.
   while (len > 0 && isspace(*str)){
     ++str;
@@ -186,6 +258,9 @@ TimestampValue::TimestampValue(const char* str, int len) {
 }
     
 ostream& operator<<(ostream& os, const TimestampValue& timestamp_value) {
+  char buf[TimestampValue::MAX_STRING_LEN];
+  int len = timestamp_value.ToString(buf);
+  if (len >= 0) return os.write(buf, len);
   return os << timestamp_value.DebugString();
 }
 
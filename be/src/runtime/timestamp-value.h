@@ -93,6 +93,9 @@ class  TimestampValue {
   void set_time(boost::posix_time::time_duration t) { time_of_day_ = t; }
 
   std::string DebugString() const {
+    char buf[MAX_STRING_LEN];
+    int len = ToString(buf);
+    if (len >= 0) return std::string(buf, len);
     std::stringstream ss;
     if (!this->date_.is_special()) {
       ss << boost::gregorian::to_iso_extended_string(this->date_);
@@ -104,6 +107,55 @@ class  TimestampValue {
     return ss.str();
   }
 
+  // Longest result of ToString().
+  static const int MAX_STRING_LEN = 29;
+
+  // Writes the timestamp in the format of DebugString(), "YYYY-MM-DD HH:MM:SS[.fff]"
+  // or just the date, into 'buf' (of MAX_STRING_LEN bytes) and returns its length.
+  // Returns -1 for the values that only boost formats: an invalid date or a time of
+  // day outside of [00:00:00, 24:00:00).
+  inline int ToString(char* buf) const;
+
+  // Sets the year, month (1-12) and day of month (1-31) of the date and returns true,
+  // or returns false if the date is not valid.  One pass of integer arithmetic, while
+  // boost converts the day number to a date for every date().year(), month() etc.
+  bool GetCivilDate(int* year, int* month, int* day) const {
+    if (this->date_.is_special()) return false;
+    CivilFromDayNumber(this->date_.day_number(), year, month, day);
+    return true;
+  }
+
+  // Conversions between the (Julian) day numbers of boost::gregorian::date and civil
+  // dates, after http://howardhinnant.github.io/date_algorithms.html.  Only valid for
+  // the years 0 to 9999.
+  static void CivilFromDayNumber(int64_t day_number, int* year, int* month, int* day) {
+    // days since 0000-03-01, so that the leap day is the last day of a year
+    int64_t days = day_number - DAY_NUMBER_0000_03_01;
+    int64_t era = days / DAYS_PER_ERA;
+    int64_t day_of_era = days - era * DAYS_PER_ERA;
+    int64_t year_of_era = (day_of_era - day_of_era / 1460 + day_of_era / 36524 -
+        day_of_era / 146096) / 365;
+    int64_t day_of_year = day_of_era - (365 * year_of_era + year_of_era / 4 -
+        year_of_era / 100);
+    int64_t month_index = (5 * day_of_year + 2) / 153;  // 0 is March
+    *day = day_of_year - (153 * month_index + 2) / 5 + 1;
+    *month = month_index < 10 ? month_index + 3 : month_index - 9;
+    *year = year_of_era + era * 400 + (*month <= 2);
+  }
+
+  static int64_t DayNumberFromCivil(int year, int month, int day) {
+    year -= month <= 2;
+    int64_t era = year / 400;
+    int64_t year_of_era = year - era * 400;
+    int64_t day_of_year = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + day - 1;
+    int64_t day_of_era = year_of_era * 365 + year_of_era / 4 - year_of_era / 100 +
+        day_of_year;
+    return era * DAYS_PER_ERA + day_of_era + DAY_NUMBER_0000_03_01;
+  }
+
+  // Day number of 1970-01-01.
+  static const int64_t EPOCH_DAY_NUMBER = 2440588;
+
   bool operator==(const TimestampValue& other) const {
     return this->date_  == other.date_ && this->time_of_day_ == other.time_of_day_;
   }
@@ -182,6 +234,24 @@ class  TimestampValue {
   // Precision of fractional part of the time: nanoseconds.
   static const double FRACTIONAL = 0.000000001;
 
+  static const int64_t DAY_NUMBER_0000_03_01 = 1721120;
+  static const int64_t DAYS_PER_ERA = 146097;  // 400 years
+
+  // Writes the 'num_digits' low decimal digits of 'value' to 'buf'.
+  static void WriteDigits(int64_t value, int num_digits, char* buf) {
+    for (int i = num_digits - 1; i >= 0; --i) {
+      buf[i] = '0' + value % 10;
+      value /= 10;
+    }
+  }
+
+  // Parse a string in the full "YYYY-MM-DD HH:MM:SS[.sssssssss]" format, without
+  // leading or trailing white space, into the object.  This is the common case and is
+  // checked without the generic parsing below.
+  // Returns false, leaving the object unchanged, if str is not a valid timestamp in
+  // that format.
+  inline bool ParseDefaultFormat(const char* str, int len);
+
   // Parse a date string into the object.
   // strp -- pointer to string to parse, points to character after parsing stopped.
   // lenp -- pointer to the length of the string.  The length will
@@ -208,6 +278,34 @@ class  TimestampValue {
 };
 
 std::ostream& operator<<(std::ostream& os, const TimestampValue& timestamp_value);
+
+inline int TimestampValue::ToString(char* buf) const {
+  int year, month, day;
+  if (!GetCivilDate(&year, &month, &day) || year > 9999) return -1;
+  WriteDigits(year, 4, buf);
+  buf[4] = '-';
+  WriteDigits(month, 2, buf + 5);
+  buf[7] = '-';
+  WriteDigits(day, 2, buf + 8);
+  if (this->time_of_day_.is_special()) return 10;
+  int64_t ticks = this->time_of_day_.ticks();
+  int64_t ticks_per_second = boost::posix_time::time_duration::ticks_per_second();
+  if (ticks < 0 || ticks >= 24 * 60 * 60 * ticks_per_second) return -1;
+  int64_t seconds = ticks / ticks_per_second;
+  buf[10] = ' ';
+  WriteDigits(seconds / 3600, 2, buf + 11);
+  buf[13] = ':';
+  WriteDigits(seconds / 60 % 60, 2, buf + 14);
+  buf[16] = ':';
+  WriteDigits(seconds % 60, 2, buf + 17);
+  int64_t fraction = ticks % ticks_per_second;
+  if (fraction == 0) return 19;
+  // like boost, all fractional digits are written
+  int num_digits = boost::posix_time::time_duration::num_fractional_digits();
+  buf[19] = '.';
+  WriteDigits(fraction, num_digits, buf + 20);
+  return 20 + num_digits;
+}
 }
 
 #endif
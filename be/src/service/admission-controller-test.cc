@@ -0,0 +1,150 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <map>
+#include <string>
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "service/admission-controller.h"
+
+using namespace std;
+
+namespace impala {
+
+static AdmissionController::PoolConfig MakeConfig(int max_running, int max_queued,
+    int64_t mem_limit) {
+  AdmissionController::PoolConfig config;
+  config.max_running = max_running;
+  config.max_queued = max_queued;
+  config.mem_limit = mem_limit;
+  return config;
+}
+
+static void AdmitAndRecord(AdmissionController* controller, int64_t timeout_ms,
+    Status* status) {
+  int64_t wait_ms;
+  *status = controller->Admit("default", 0, timeout_ms, &wait_ms);
+}
+
+// Waits until 'pool' has 'num_queued' queued queries.
+static void WaitForQueued(AdmissionController* controller, int num_queued) {
+  int running, queued;
+  for (;;) {
+    controller->GetPoolStats("default", &running, &queued);
+    if (queued == num_queued) return;
+    boost::this_thread::sleep(boost::posix_time::milliseconds(1));
+  }
+}
+
+TEST(AdmissionControllerTest, ParsePoolConfigs) {
+  map<string, AdmissionController::PoolConfig> pools;
+  EXPECT_TRUE(AdmissionController::ParsePoolConfigs("", &pools).ok());
+  EXPECT_TRUE(pools.empty());
+  EXPECT_TRUE(AdmissionController::ParsePoolConfigs(
+      "etl:2:10:8589934592, adhoc:10:50:0", &pools).ok());
+  ASSERT_EQ(pools.size(), 2);
+  EXPECT_EQ(pools["etl"].max_running, 2);
+  EXPECT_EQ(pools["etl"].max_queued, 10);
+  EXPECT_EQ(pools["etl"].mem_limit, 8589934592L);
+  EXPECT_EQ(pools["adhoc"].max_running, 10);
+  EXPECT_EQ(pools["etl"].io_weight, 0);
+  EXPECT_EQ(pools["etl"].max_scanner_thread_tokens, 0);
+  EXPECT_TRUE(pools["etl"].cpu_cgroup.empty());
+
+  // with shares
+  EXPECT_TRUE(AdmissionController::ParsePoolConfigs(
+      "etl:2:10:0:1:8:batch,adhoc:10:50:0:4", &pools).ok());
+  EXPECT_EQ(pools["etl"].io_weight, 1);
+  EXPECT_EQ(pools["etl"].max_scanner_thread_tokens, 8);
+  EXPECT_EQ(pools["etl"].cpu_cgroup, "batch");
+  EXPECT_EQ(pools["adhoc"].io_weight, 4);
+  EXPECT_EQ(pools["adhoc"].max_scanner_thread_tokens, 0);
+  EXPECT_TRUE(pools["adhoc"].cpu_cgroup.empty());
+
+  AdmissionController controller(AdmissionController::PoolConfig(), pools);
+  EXPECT_EQ(controller.GetPoolConfig("etl").cpu_cgroup, "batch");
+  EXPECT_EQ(controller.GetPoolConfig("other").io_weight, 0);
+
+  EXPECT_FALSE(AdmissionController::ParsePoolConfigs("etl:2:10", &pools).ok());
+  EXPECT_FALSE(AdmissionController::ParsePoolConfigs("etl:2:10:0:x", &pools).ok());
+  EXPECT_FALSE(AdmissionController::ParsePoolConfigs("etl:2:10:0:1:2:a:b", &pools).ok());
+  EXPECT_FALSE(AdmissionController::ParsePoolConfigs("etl:2:x:0", &pools).ok());
+  EXPECT_FALSE(AdmissionController::ParsePoolConfigs(":2:10:0", &pools).ok());
+}
+
+TEST(AdmissionControllerTest, Limits) {
+  map<string, AdmissionController::PoolConfig> pools;
+  pools["small"] = MakeConfig(0, 0, 100);
+  AdmissionController controller(MakeConfig(1, 0, 0), pools);
+  int64_t wait_ms;
+
+  // Only one query runs in the default pool, and none are queued.
+  EXPECT_TRUE(controller.Admit("default", 0, 0, &wait_ms).ok());
+  EXPECT_FALSE(controller.Admit("default", 0, 0, &wait_ms).ok());
+  // Pools are independent.
+  EXPECT_TRUE(controller.Admit("other", 0, 0, &wait_ms).ok());
+  controller.Release("default", 0);
+  EXPECT_TRUE(controller.Admit("default", 0, 0, &wait_ms).ok());
+
+  // Memory estimates
+  EXPECT_FALSE(controller.Admit("small", 101, 0, &wait_ms).ok());
+  EXPECT_TRUE(controller.Admit("small", 60, 0, &wait_ms).ok());
+  EXPECT_FALSE(controller.Admit("small", 60, 0, &wait_ms).ok());
+  EXPECT_TRUE(controller.Admit("small", 40, 0, &wait_ms).ok());
+  controller.Release("small", 60);
+  EXPECT_TRUE(controller.Admit("small", 60, 0, &wait_ms).ok());
+}
+
+TEST(AdmissionControllerTest, Queue) {
+  AdmissionController controller(
+      MakeConfig(1, 2, 0), map<string, AdmissionController::PoolConfig>());
+  int64_t wait_ms;
+  EXPECT_TRUE(controller.Admit("default", 0, 0, &wait_ms).ok());
+  EXPECT_EQ(wait_ms, 0);
+
+  // Queued queries are admitted in order as running ones are released.
+  Status status1, status2;
+  boost::thread thread1(AdmitAndRecord, &controller, 0, &status1);
+  WaitForQueued(&controller, 1);
+  boost::thread thread2(AdmitAndRecord, &controller, 0, &status2);
+  WaitForQueued(&controller, 2);
+
+  // The queue is full.
+  EXPECT_FALSE(controller.Admit("default", 0, 0, &wait_ms).ok());
+
+  controller.Release("default", 0);
+  thread1.join();
+  EXPECT_TRUE(status1.ok());
+  WaitForQueued(&controller, 1);
+  controller.Release("default", 0);
+  thread2.join();
+  EXPECT_TRUE(status2.ok());
+
+  // Queued queries time out.
+  EXPECT_FALSE(controller.Admit("default", 0, 10, &wait_ms).ok());
+  EXPECT_GE(wait_ms, 10);
+  int running, queued;
+  controller.GetPoolStats("default", &running, &queued);
+  EXPECT_EQ(running, 1);
+  EXPECT_EQ(queued, 0);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,180 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "service/admission-controller.h"
+
+#include <sstream>
+#include <vector>
+#include <boost/algorithm/string.hpp>
+#include <boost/thread/thread_time.hpp>
+
+#include "util/stopwatch.h"
+#include "util/string-parser.h"
+
+using namespace boost;
+using namespace boost::algorithm;
+using namespace std;
+
+namespace impala {
+
+AdmissionController::AdmissionController(const PoolConfig& default_config,
+    const map<string, PoolConfig>& pools)
+  : default_config_(default_config),
+    pool_configs_(pools),
+    next_ticket_(0) {
+}
+
+Status AdmissionController::ParsePoolConfigs(const string& configs,
+    map<string, PoolConfig>* pools) {
+  vector<string> entries;
+  split(entries, configs, is_any_of(","), token_compress_on);
+  for (int i = 0; i < entries.size(); ++i) {
+    string entry = trim_copy(entries[i]);
+    if (entry.empty()) continue;
+    vector<string> fields;
+    split(fields, entry, is_any_of(":"));
+    bool valid = fields.size() >= 4 && fields.size() <= 7 && !fields[0].empty();
+    PoolConfig config;
+    StringParser::ParseResult results[5];
+    for (int j = 0; j < 5; ++j) results[j] = StringParser::PARSE_SUCCESS;
+    if (valid) {
+      config.max_running = StringParser::StringToInt<int>(
+          fields[1].c_str(), fields[1].size(), &results[0]);
+      config.max_queued = StringParser::StringToInt<int>(
+          fields[2].c_str(), fields[2].size(), &results[1]);
+      config.mem_limit = StringParser::StringToInt<int64_t>(
+          fields[3].c_str(), fields[3].size(), &results[2]);
+      if (fields.size() > 4) {
+        config.io_weight = StringParser::StringToInt<int>(
+            fields[4].c_str(), fields[4].size(), &results[3]);
+      }
+      if (fields.size() > 5) {
+        config.max_scanner_thread_tokens = StringParser::StringToInt<int>(
+            fields[5].c_str(), fields[5].size(), &results[4]);
+      }
+      if (fields.size() > 6) config.cpu_cgroup = fields[6];
+      for (int j = 0; j < 5; ++j) {
+        valid &= results[j] == StringParser::PARSE_SUCCESS;
+      }
+    }
+    if (!valid) {
+      stringstream ss;
+      ss << "Invalid admission pool config '" << entry << "', expected "
+         << "<name>:<max_running>:<max_queued>:<mem_limit>[:<io_weight>"
+         << "[:<max_scanner_thread_tokens>[:<cpu_cgroup>]]]";
+      return Status(ss.str());
+    }
+    (*pools)[fields[0]] = config;
+  }
+  return Status::OK;
+}
+
+AdmissionController::PoolState* AdmissionController::GetPool(const string& pool) {
+  map<string, PoolState>::iterator it = pools_.find(pool);
+  if (it != pools_.end()) return &it->second;
+  PoolState* state = &pools_[pool];
+  map<string, PoolConfig>::const_iterator config = pool_configs_.find(pool);
+  state->config = config == pool_configs_.end() ? default_config_ : config->second;
+  return state;
+}
+
+AdmissionController::PoolConfig AdmissionController::GetPoolConfig(const string& pool) {
+  lock_guard<mutex> l(lock_);
+  return GetPool(pool)->config;
+}
+
+bool AdmissionController::HasCapacity(const PoolState& state, int64_t mem_estimate) {
+  if (state.config.max_running > 0 && state.num_running >= state.config.max_running) {
+    return false;
+  }
+  // An idle pool admits a query even if its estimate is over the limit; it was
+  // rejected up front if it can't ever fit.
+  if (state.config.mem_limit > 0 && state.num_running > 0 &&
+      state.mem_admitted + mem_estimate > state.config.mem_limit) {
+    return false;
+  }
+  return true;
+}
+
+Status AdmissionController::Admit(const string& pool, int64_t mem_estimate,
+    int64_t timeout_ms, int64_t* queue_wait_ms) {
+  *queue_wait_ms = 0;
+  unique_lock<mutex> l(lock_);
+  PoolState* state = GetPool(pool);
+  if (state->config.mem_limit > 0 && mem_estimate > state->config.mem_limit) {
+    stringstream ss;
+    ss << "Rejected query from pool " << pool << ": memory estimate " << mem_estimate
+       << " exceeds the pool's limit of " << state->config.mem_limit;
+    return Status(ss.str());
+  }
+  if (state->queue.empty() && HasCapacity(*state, mem_estimate)) {
+    ++state->num_running;
+    state->mem_admitted += mem_estimate;
+    return Status::OK;
+  }
+  if (static_cast<int>(state->queue.size()) >= state->config.max_queued) {
+    stringstream ss;
+    ss << "Rejected query from pool " << pool << ": queue full, "
+       << state->queue.size() << " queries queued";
+    return Status(ss.str());
+  }
+
+  // Wait until this query is at the head of the queue and fits.
+  int64_t ticket = next_ticket_++;
+  state->queue.push_back(ticket);
+  WallClockStopWatch queue_timer;
+  queue_timer.Start();
+  system_time deadline = get_system_time() + posix_time::milliseconds(timeout_ms);
+  bool timed_out = false;
+  while (state->queue.front() != ticket || !HasCapacity(*state, mem_estimate)) {
+    if (timeout_ms <= 0) {
+      pool_changed_cv_.wait(l);
+    } else if (!pool_changed_cv_.timed_wait(l, deadline)) {
+      timed_out = true;
+      break;
+    }
+  }
+  state->queue.remove(ticket);
+  // The next query in the queue may be able to run now.
+  pool_changed_cv_.notify_all();
+  *queue_wait_ms = queue_timer.ElapsedTime();
+  if (timed_out) {
+    stringstream ss;
+    ss << "Query from pool " << pool << " timed out after waiting " << *queue_wait_ms
+       << "ms in the admission queue";
+    return Status(ss.str());
+  }
+  ++state->num_running;
+  state->mem_admitted += mem_estimate;
+  return Status::OK;
+}
+
+void AdmissionController::Release(const string& pool, int64_t mem_estimate) {
+  lock_guard<mutex> l(lock_);
+  PoolState* state = GetPool(pool);
+  DCHECK_GT(state->num_running, 0);
+  --state->num_running;
+  state->mem_admitted -= mem_estimate;
+  pool_changed_cv_.notify_all();
+}
+
+void AdmissionController::GetPoolStats(const string& pool, int* num_running,
+    int* num_queued) {
+  lock_guard<mutex> l(lock_);
+  PoolState* state = GetPool(pool);
+  *num_running = state->num_running;
+  *num_queued = state->queue.size();
+}
+
+}
@@ -0,0 +1,134 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_SERVICE_ADMISSION_CONTROLLER_H
+#define IMPALA_SERVICE_ADMISSION_CONTROLLER_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "common/status.h"
+
+namespace impala {
+
+// Limits the queries that a coordinator runs at the same time.  Queries are
+// submitted to a named pool; a pool admits a query if it has fewer than max_running
+// queries running and the memory estimates of its running queries plus the query's
+// estimate don't exceed its mem_limit.  Queries that can't be admitted wait in the
+// pool's queue, in FIFO order, until they can be admitted or their timeout expires.
+// A query that arrives when the queue holds max_queued queries is rejected.
+// The limits are local to this process: the state store only tracks membership, so
+// there is no cluster wide view of the load.
+// A pool also has the shares of the backends' resources that its queries get (see
+// PoolConfig); the coordinator passes them on to the backends in the query options.
+// This class is thread safe.
+class AdmissionController {
+ public:
+  struct PoolConfig {
+    // Maximum number of running queries; <= 0 means no limit
+    int max_running;
+
+    // Maximum number of queued queries; <= 0 means queries are never queued
+    int max_queued;
+
+    // Maximum summed memory estimate of the running queries; <= 0 means no limit
+    int64_t mem_limit;
+
+    // Shares of each query of the pool, used unless the query sets the query option
+    // of the same name:
+    // io_weight: the query's share of the disks; <= 0 means the backend default
+    int io_weight;
+
+    // max_scanner_thread_tokens: the most scanner thread tokens that the scans of the
+    // query hold on a backend at a time; <= 0 means no quota
+    int max_scanner_thread_tokens;
+
+    // cpu_cgroup: cpu cgroup of the query's fragment threads (see CgroupUtil); empty
+    // means the threads stay in impalad's cgroup
+    std::string cpu_cgroup;
+
+    PoolConfig()
+      : max_running(0), max_queued(0), mem_limit(0), io_weight(0),
+        max_scanner_thread_tokens(0) {
+    }
+  };
+
+  // Pools that aren't in 'pools' use 'default_config'.
+  AdmissionController(const PoolConfig& default_config,
+      const std::map<std::string, PoolConfig>& pools);
+
+  // Parses pool configs of the form "<name>:<max_running>:<max_queued>:<mem_limit>",
+  // optionally followed by ":<io_weight>", ":<max_scanner_thread_tokens>" and
+  // ":<cpu_cgroup>", separated by commas (e.g.
+  // "etl:2:10:8589934592:1:8:etl,adhoc:10:50:0:4"), into 'pools'.
+  static Status ParsePoolConfigs(const std::string& configs,
+      std::map<std::string, PoolConfig>* pools);
+
+  // Blocks until a query with memory estimate 'mem_estimate' is admitted to pool
+  // 'pool', waiting at most 'timeout_ms' in the queue (<= 0: no limit).  Returns an
+  // error if the query is rejected or times out.  Sets *queue_wait_ms to the time
+  // spent in the queue.  Each admitted query must be released with Release().
+  Status Admit(const std::string& pool, int64_t mem_estimate, int64_t timeout_ms,
+      int64_t* queue_wait_ms);
+
+  // Releases a query admitted to 'pool' with 'mem_estimate'.
+  void Release(const std::string& pool, int64_t mem_estimate);
+
+  // Returns the config of 'pool'.
+  PoolConfig GetPoolConfig(const std::string& pool);
+
+  // Returns the number of running and queued queries of 'pool'.
+  void GetPoolStats(const std::string& pool, int* num_running, int* num_queued);
+
+ private:
+  struct PoolState {
+    PoolConfig config;
+    int num_running;
+    int64_t mem_admitted;
+
+    // Tickets of the queued queries, oldest first
+    std::list<int64_t> queue;
+
+    PoolState() : num_running(0), mem_admitted(0) {}
+  };
+
+  // Returns the state of 'pool', creating it if necessary.  lock_ must be taken.
+  PoolState* GetPool(const std::string& pool);
+
+  // Returns true if 'state' has room for a query with 'mem_estimate'.
+  static bool HasCapacity(const PoolState& state, int64_t mem_estimate);
+
+  PoolConfig default_config_;
+
+  // protects all fields below
+  boost::mutex lock_;
+
+  // signalled whenever a query leaves a queue or is released
+  boost::condition_variable pool_changed_cv_;
+
+  std::map<std::string, PoolConfig> pool_configs_;
+  std::map<std::string, PoolState> pools_;
+
+  // ticket for the next query that is queued
+  int64_t next_ticket_;
+};
+
+}
+
+#endif
@@ -15,6 +15,7 @@
 #include "service/impala-server.h"
 
 #include <algorithm>
+#include <iomanip>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/date_time/posix_time/posix_time_types.hpp>
 #include <boost/unordered_set.hpp>
@@ -31,11 +32,13 @@
 #include <gtest/gtest.h>
 #include <boost/foreach.hpp>
 #include <boost/bind.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/algorithm/string.hpp>
 
 #include "common/logging.h"
 #include "common/service-ids.h"
 #include "exprs/expr.h"
+#include "exprs/shared-expr.h"
 #include "exec/hdfs-table-sink.h"
 #include "codegen/llvm-codegen.h"
 #include "runtime/data-stream-mgr.h"
@@ -46,17 +49,29 @@
 #include "runtime/plan-fragment-executor.h"
 #include "runtime/hdfs-fs-cache.h"
 #include "runtime/exec-env.h"
+#include "runtime/exec-stats-store.h"
 #include "runtime/coordinator.h"
+#include "runtime/disk-io-mgr.h"
+#include "runtime/mem-tracker.h"
 #include "exec/exec-node.h"
 #include "exec/scan-node.h"
 #include "exec/exec-stats.h"
 #include "exec/ddl-executor.h"
+#include "runtime/raw-value.h"
+#include "runtime/timestamp-value.h"
+#include "service/admission-controller.h"
+#include "service/plan-cache.h"
+#include "service/query-result-cache.h"
+#include "service/result-spool.h"
 #include "sparrow/simple-scheduler.h"
+#include "util/cgroup-util.h"
 #include "util/container-util.h"
 #include "util/debug-util.h"
+#include "util/hdfs-util.h"
 #include "util/string-parser.h"
 #include "util/thrift-util.h"
 #include "util/thrift-server.h"
+#include "util/thread-pool.h"
 #include "util/jni-util.h"
 #include "util/webserver.h"
 #include "gen-cpp/Types_types.h"
@@ -83,6 +98,8 @@ using namespace beeswax;
 using sparrow::Scheduler;
 using sparrow::ServiceStateMap;
 using sparrow::Membership;
+using sparrow::TBackendLoad;
+using sparrow::TVersionedObject;
 
 DEFINE_bool(use_planservice, false, "Use external planservice if true");
 DECLARE_string(planservice_host);
@@ -90,12 +107,49 @@ DECLARE_int32(planservice_port);
 DEFINE_int32(fe_port, 21000, "port on which client requests are served");
 DEFINE_int32(fe_service_threads, 64,
     "number of threads available to serve client requests");
+DEFINE_bool(fe_nonblocking_server, false, "(Advanced) if true, client requests are "
+    "served by an event-driven server, so that idle client connections don't hold a "
+    "thread; --fe_service_threads then is the number of worker threads that execute "
+    "the requests. Clients must use a framed transport. Not supported with Kerberos.");
+DECLARE_string(principal);
 DECLARE_int32(be_port);
+DECLARE_int32(data_stream_port_offset);
 DEFINE_int32(be_service_threads, 64,
     "(Advanced) number of threads available to serve backend execution requests");
 DEFINE_bool(load_catalog_at_startup, false, "if true, load all catalog data at startup");
+DEFINE_bool(warm_catalog_at_startup, false, "If true and --load_catalog_at_startup is "
+    "false, all catalog data is loaded in the background after startup while queries "
+    "are served, so that most queries don't wait for their tables to load.");
+DEFINE_string(warm_catalog_tables, "", "Comma separated list of db.table that "
+    "--warm_catalog_at_startup loads first, e.g. the most frequently queried tables.");
 DEFINE_int32(default_num_nodes, 1, "default degree of parallelism for all queries; query "
     "can override it by specifying num_nodes in beeswax.Query.Configuration");
+DEFINE_string(admission_pools, "", "Admission control pools, as a comma separated list "
+    "of <name>:<max_running>:<max_queued>:<mem_limit>, optionally followed by the "
+    "pool's shares :<io_weight>:<max_scanner_thread_tokens>:<cpu_cgroup> (defaults for "
+    "the query options of the same name). Queries choose a pool with the "
+    "request_pool query option; pools that aren't listed use the default_pool_* limits.");
+DEFINE_int32(default_pool_max_running, 0, "Maximum number of queries of an admission "
+    "pool that run at the same time. <= 0 means no limit.");
+DEFINE_int32(default_pool_max_queued, 50, "Maximum number of queries of an admission "
+    "pool that wait for others to finish. <= 0 means queries are rejected instead.");
+DEFINE_int64(default_pool_mem_limit, 0, "Maximum sum of the mem_limit query options of "
+    "the running queries of an admission pool. <= 0 means no limit.");
+DEFINE_int64(admission_queue_timeout_ms, 60000, "Time a query waits in the admission "
+    "queue before it fails. <= 0 means no limit.");
+DEFINE_int64(result_spool_max_mem_bytes, 8 * 1024 * 1024, "Maximum size of the result "
+    "rows of a query that are buffered in memory until the client fetches them, so the "
+    "query can finish before the client has fetched all rows. 0 disables spooling.");
+DEFINE_int64(result_spool_max_disk_bytes, 1024L * 1024L * 1024L, "Maximum size of the "
+    "result rows of a query that are buffered in a file in --scratch_dirs once the "
+    "memory buffer is full. 0 disables spooling to disk.");
+DEFINE_int64(result_cache_max_bytes, 0, "Maximum size of the cache of query results, "
+    "which answers repeated queries without planning or executing them. Cached results "
+    "are dropped by ResetCatalog and INSERTs through this server, and when one of the "
+    "hdfs directories that the query read from is modified. 0 disables the cache.");
+DEFINE_int32(plan_cache_max_entries, 0, "Maximum number of plans of recent queries that "
+    "are kept so that repeated queries skip planning. Cached plans are dropped like "
+    "cached results. 0 disables the cache.");
 
 namespace impala {
 
@@ -106,6 +160,8 @@ ThreadManager* be_tm;
 const string NO_QUERY_HANDLE = "no_query_handle";
 
 const string NUM_QUERIES_METRIC = "impala-server.num.queries";
+const string NUM_RESULT_CACHE_HITS_METRIC = "impala-server.result-cache.hits";
+const string NUM_PLAN_CACHE_HITS_METRIC = "impala-server.plan-cache.hits";
 
 // Execution state of a query. This captures everything necessary
 // to convert row batches received by the coordinator into results
@@ -127,11 +183,31 @@ class ImpalaServer::QueryExecState {
       current_batch_(NULL),
       current_batch_row_(0),
       num_rows_fetched_(0),
-      impala_server_(server) {
+      impala_server_(server),
+      admitted_(false),
+      mem_estimate_(0),
+      spool_spilled_rows_counter_(NULL),
+      replanned_(false),
+      cancelled_(false),
+      result_cache_generation_(0),
+      result_cache_entry_bytes_(0) {
     planner_timer_ = ADD_COUNTER(&profile_, "PlanningTime", TCounterType::CPU_TICKS);
+    query_events_ = profile_.AddEventSequence("Query Timeline");
+    query_events_->Start();
   }
 
   ~QueryExecState() {
+    if (spool_thread_.get() != NULL) {
+      // The client may close the query before it fetched all rows.
+      if (!result_spool_->is_closed()) {
+        result_spool_->Cancel();
+        coord_->Cancel();
+      }
+      spool_thread_->join();
+    }
+    if (admitted_) {
+      impala_server_->admission_controller_->Release(request_pool_, mem_estimate_);
+    }
   }
 
   // Initiates execution of plan fragments, if there are any, and sets
@@ -140,11 +216,21 @@ class ImpalaServer::QueryExecState {
   // Non-blocking.
   Status Exec(TExecRequest* exec_request);
 
+  // Sets up this query to return the rows of 'cached_result' instead of executing.
+  void ExecCachedResult(const TUniqueId& query_id,
+      const shared_ptr<const QueryResultCache::Entry>& cached_result);
+
+  // Collects the fetched rows in 'entry' and adds it to the result cache under 'key'
+  // once the client has fetched all rows, unless the rows don't fit into the cache.
+  // 'generation' is the cache's generation from before the query was planned.
+  void EnableResultCaching(const string& key, int64_t generation,
+      const shared_ptr<QueryResultCache::Entry>& entry);
+
   // Call this to ensure that rows are ready when calling FetchRowsAsAscii().
   // Must be preceded by call to Exec().
   Status Wait() {
     if (coord_.get() != NULL) { 
-      RETURN_IF_ERROR(coord_->Wait());
+      RETURN_IF_ERROR(WaitForCoordinator());
       RETURN_IF_ERROR(UpdateMetastore());
     }
         
@@ -177,6 +263,18 @@ class ImpalaServer::QueryExecState {
 
   bool eos() { return eos_; }
   Coordinator* coord() const { return coord_.get(); }
+
+  // Returns the coordinator that executes this query under 'query_id', which differs
+  // from query_id() after a re-planning, or NULL if there is none.  Thread-safe.
+  Coordinator* GetCoordinator(const TUniqueId& query_id);
+
+  // The statement of the query, for re-planning it; set before Exec().
+  void set_client_request(const TClientRequest& request) { client_request_ = request; }
+
+  // True if the query was re-planned; it is then also registered under
+  // replanned_query_id().
+  bool replanned() const { return replanned_; }
+  const TUniqueId& replanned_query_id() const { return replanned_query_id_; }
   int num_rows_fetched() const { return num_rows_fetched_; }
   const TResultSetMetadata* result_metadata() { return &result_metadata_; }
   const TUniqueId& query_id() const { return query_id_; }
@@ -187,6 +285,8 @@ class ImpalaServer::QueryExecState {
   void set_query_state(QueryState::type state) { query_state_ = state; }
   const Status& query_status() const { return query_status_; }
   RuntimeProfile::Counter* planner_timer() { return planner_timer_; }
+  RuntimeProfile::EventSequence* query_events() { return query_events_; }
+  RuntimeProfile* profile() { return &profile_; }
   void set_result_metadata(const TResultSetMetadata& md) { result_metadata_ = md; }
 
  private:
@@ -201,6 +301,8 @@ class ImpalaServer::QueryExecState {
   ObjectPool profile_pool_;
   RuntimeProfile profile_;
   RuntimeProfile::Counter* planner_timer_;
+  // Milestones of the query, from its registration to the last fetch
+  RuntimeProfile::EventSequence* query_events_;
   vector<Expr*> output_exprs_;
   bool eos_;  // if true, there are no more rows to return
   QueryState::type query_state_;
@@ -215,6 +317,78 @@ class ImpalaServer::QueryExecState {
   // To get access to UpdateMetastore
   ImpalaServer* impala_server_;
 
+  // Admission control pool and memory estimate of the query.  If admitted_ is true,
+  // the query is released from the pool when this object is destroyed.
+  bool admitted_;
+  string request_pool_;
+  int64_t mem_estimate_;
+
+  // Waits until the admission controller lets the query run and records the result
+  // in profile_.  Also sets the resource shares of the query's pool in
+  // 'query_options' (see ApplyPoolShares()).
+  Status Admit(TQueryOptions* query_options);
+
+  // Sets the io_weight, max_scanner_thread_tokens and cpu_cgroup of 'query_options'
+  // that the query doesn't set to those of request_pool_.
+  void ApplyPoolShares(TQueryOptions* query_options);
+
+  // If set, spool_thread_ runs SpoolResults(), which moves all result rows from coord_
+  // into result_spool_, and the client fetches from result_spool_.  Otherwise the
+  // fetches pull the rows from coord_ and convert them.
+  scoped_ptr<ResultSpool> result_spool_;
+  scoped_ptr<thread> spool_thread_;
+  RuntimeProfile::Counter* spool_spilled_rows_counter_;
+
+  // Scratch column for ConvertBatchToAscii(); only used by spool_thread_.
+  ExprColumn output_column_;
+
+  // Producer loop of result_spool_.
+  void SpoolResults();
+
+  // If a join's broadcast build exceeded max_broadcast_build_bytes (see
+  // HashJoinNode), the rows of the query haven't been returned yet, and it is simply
+  // re-planned with partitioned joins and restarted under a new query id: coord_ is
+  // replaced and failed_coord_ keeps the cancelled one until this object goes away,
+  // since the profile refers to it and its backends may still report to it.
+  TClientRequest client_request_;
+  TExecRequest replanned_exec_request_;
+  TUniqueId replanned_query_id_;
+  bool replanned_;
+  scoped_ptr<Coordinator> failed_coord_;
+
+  // Protects coord_ and failed_coord_ while they are swapped, and cancelled_, which is
+  // set by Cancel() so that a coordinator started afterwards is cancelled as well.
+  // Not held while calling into the coordinators, but Cancel() holds lock_ for it.
+  mutex coord_lock_;
+  bool cancelled_;
+
+  // Serializes the callers of WaitForCoordinator(), so that only the first one
+  // re-plans and the others wait for the new coordinator.
+  mutex wait_lock_;
+
+  // Calls coord_->Wait(), re-planning the query with partitioned joins and waiting
+  // for the new coordinator if the broadcast build limit was exceeded.
+  Status WaitForCoordinator();
+
+  // Re-plans the query with partition_join and starts the new coordinator.
+  Status ReplanWithPartitionedJoins(const Status& status);
+
+  // Converts the rows of 'batch' into 'rows', evaluating output_exprs_ over the whole
+  // batch one expr at a time.
+  Status ConvertBatchToAscii(RowBatch* batch, vector<string>* rows);
+
+  // Set if the rows are served from the result cache.
+  shared_ptr<const QueryResultCache::Entry> cached_result_;
+
+  // Set while the fetched rows are collected for the result cache.
+  shared_ptr<QueryResultCache::Entry> result_cache_entry_;
+  string result_cache_key_;
+  int64_t result_cache_generation_;
+  int64_t result_cache_entry_bytes_;
+
+  // Adds 'rows' to result_cache_entry_, and adds that to the cache after the last row.
+  void AddToResultCacheEntry(const vector<string>& rows);
+
   // Core logic of FetchRowsAsAscii(). Does not update query_state_/status_.
   Status FetchRowsAsAsciiInternal(const int32_t max_rows, vector<string>* fetched_rows);
 
@@ -279,13 +453,23 @@ Status ImpalaServer::QueryExecState::Exec(TExecRequest* exec_request) {
       RETURN_IF_ERROR(PrepareSelectListExprs(&local_runtime_state_,
           query_exec_request.fragments[0].output_exprs, RowDescriptor()));
     } else {
+      RETURN_IF_ERROR(Admit(&exec_request->query_options));
+      exec_request_.query_options = exec_request->query_options;
       coord_.reset(new Coordinator(exec_env_, &exec_stats_));
-      RETURN_IF_ERROR(coord_->Exec(
-          exec_request->request_id, &query_exec_request, exec_request->query_options));
+      RETURN_IF_ERROR(coord_->Exec(exec_request->request_id, &query_exec_request,
+          exec_request->query_options, query_events_));
 
       if (has_coordinator_fragment) {
         RETURN_IF_ERROR(PrepareSelectListExprs(coord_->runtime_state(),
             query_exec_request.fragments[0].output_exprs, coord_->row_desc()));
+        if (FLAGS_result_spool_max_mem_bytes > 0 &&
+            exec_request->stmt_type == TStmtType::QUERY) {
+          result_spool_.reset(new ResultSpool(FLAGS_result_spool_max_mem_bytes,
+              FLAGS_result_spool_max_disk_bytes, PrintId(exec_request->request_id)));
+          spool_spilled_rows_counter_ =
+              ADD_COUNTER(&profile_, "ResultSpoolSpilledRows", TCounterType::UNIT);
+          spool_thread_.reset(new thread(&QueryExecState::SpoolResults, this));
+        }
       }
       profile_.AddChild(coord_->query_profile());
     }
@@ -299,6 +483,76 @@ Status ImpalaServer::QueryExecState::Exec(TExecRequest* exec_request) {
   return Status::OK;
 }
 
+void ImpalaServer::QueryExecState::ExecCachedResult(const TUniqueId& query_id,
+    const shared_ptr<const QueryResultCache::Entry>& cached_result) {
+  query_id_ = query_id;
+  exec_request_.stmt_type = TStmtType::QUERY;
+  cached_result_ = cached_result;
+  profile_.set_name("Query (id=" + PrintId(query_id) + ")");
+  profile_.AddInfoString("Result cache", "Hit");
+  query_events_->MarkEvent("Result cache hit");
+}
+
+void ImpalaServer::QueryExecState::EnableResultCaching(const string& key,
+    int64_t generation, const shared_ptr<QueryResultCache::Entry>& entry) {
+  result_cache_key_ = key;
+  result_cache_generation_ = generation;
+  result_cache_entry_ = entry;
+  result_cache_entry_bytes_ = QueryResultCache::GetEntryBytes(key, *entry);
+  profile_.AddInfoString("Result cache", "Miss");
+}
+
+void ImpalaServer::QueryExecState::AddToResultCacheEntry(const vector<string>& rows) {
+  QueryResultCache* cache = impala_server_->result_cache_.get();
+  for (int i = 0; i < rows.size(); ++i) {
+    result_cache_entry_bytes_ += sizeof(string) + rows[i].size();
+  }
+  if (result_cache_entry_bytes_ > cache->max_bytes()) {
+    // Too large to cache; stop collecting.
+    result_cache_entry_.reset();
+    return;
+  }
+  result_cache_entry_->rows.insert(result_cache_entry_->rows.end(),
+      rows.begin(), rows.end());
+  if (eos_) {
+    cache->Insert(result_cache_key_, result_cache_generation_, result_cache_entry_);
+    result_cache_entry_.reset();
+  }
+}
+
+Status ImpalaServer::QueryExecState::Admit(TQueryOptions* query_options) {
+  request_pool_ =
+      query_options->request_pool.empty() ? "default" : query_options->request_pool;
+  // The per node mem_limit is the only estimate of the query's memory we have.
+  mem_estimate_ = max<int64_t>(query_options->mem_limit, 0);
+  ApplyPoolShares(query_options);
+  int64_t queue_wait_ms;
+  Status status = impala_server_->admission_controller_->Admit(request_pool_,
+      mem_estimate_, FLAGS_admission_queue_timeout_ms, &queue_wait_ms);
+  profile_.AddInfoString("Request pool", request_pool_);
+  ADD_COUNTER(&profile_, "AdmissionQueueWaitTime", TCounterType::TIME_MS)->Set(
+      queue_wait_ms);
+  if (!status.ok()) {
+    profile_.AddInfoString("Admission result", status.GetErrorMsg());
+    return status;
+  }
+  profile_.AddInfoString("Admission result",
+      queue_wait_ms > 0 ? "Admitted after queuing" : "Admitted immediately");
+  query_events_->MarkEvent("Admitted");
+  admitted_ = true;
+  return Status::OK;
+}
+
+void ImpalaServer::QueryExecState::ApplyPoolShares(TQueryOptions* query_options) {
+  AdmissionController::PoolConfig config =
+      impala_server_->admission_controller_->GetPoolConfig(request_pool_);
+  if (query_options->io_weight <= 0) query_options->io_weight = config.io_weight;
+  if (query_options->max_scanner_thread_tokens <= 0) {
+    query_options->max_scanner_thread_tokens = config.max_scanner_thread_tokens;
+  }
+  if (query_options->cpu_cgroup.empty()) query_options->cpu_cgroup = config.cpu_cgroup;
+}
+
 Status ImpalaServer::QueryExecState::FetchRowsAsAscii(const int32_t max_rows,
     vector<string>* fetched_rows) {
   DCHECK(!eos_);
@@ -306,22 +560,39 @@ Status ImpalaServer::QueryExecState::FetchRowsAsAscii(const int32_t max_rows,
   query_status_ = FetchRowsAsAsciiInternal(max_rows, fetched_rows);
   if (!query_status_.ok()) {
     query_state_ = QueryState::EXCEPTION;
+    return query_status_;
   }
+  if (result_cache_entry_ != NULL) AddToResultCacheEntry(*fetched_rows);
+  if (eos_) query_events_->MarkEvent("Last row fetched");
   return query_status_;
 }
 
 Status ImpalaServer::QueryExecState::FetchRowsAsAsciiInternal(const int32_t max_rows,
     vector<string>* fetched_rows) {
-  if (coord_ == NULL && ddl_executor_ == NULL) {
+  if (cached_result_ != NULL) {
+    query_state_ = QueryState::FINISHED;
+    const vector<string>& all_rows = cached_result_->rows;
+    int num_rows = all_rows.size() - num_rows_fetched_;
+    if (max_rows >= 0 && max_rows < num_rows) num_rows = max_rows;
+    fetched_rows->insert(fetched_rows->end(), all_rows.begin() + num_rows_fetched_,
+        all_rows.begin() + num_rows_fetched_ + num_rows);
+    num_rows_fetched_ += num_rows;
+    eos_ = num_rows_fetched_ == all_rows.size();
+    return Status::OK;
+  } else if (coord_ == NULL && ddl_executor_ == NULL) {
     query_state_ = QueryState::FINISHED;  // results will be ready after this call
     // query without FROM clause: we return exactly one row
     return CreateConstantRowAsAscii(fetched_rows);
   } else {
     if (coord_ != NULL) {
-      RETURN_IF_ERROR(coord_->Wait());
+      RETURN_IF_ERROR(WaitForCoordinator());
     }
     query_state_ = QueryState::FINISHED;  // results will be ready after this call
-    if (coord_ != NULL) {
+    if (result_spool_ != NULL) {
+      RETURN_IF_ERROR(result_spool_->GetRows(max_rows, fetched_rows, &eos_));
+      num_rows_fetched_ += fetched_rows->size();
+      return Status::OK;
+    } else if (coord_ != NULL) {
       // Fetch the next batch if we've returned the current batch entirely
       if (current_batch_ == NULL || current_batch_row_ >= current_batch_->num_rows()) {
         RETURN_IF_ERROR(FetchNextBatch());
@@ -351,7 +622,110 @@ void ImpalaServer::QueryExecState::Cancel() {
   // Coordinator::Cancel() multiple times
   if (query_state_ == QueryState::EXCEPTION) return;
   query_state_ = QueryState::EXCEPTION;
-  coord_->Cancel();
+  if (result_spool_ != NULL) result_spool_->Cancel();
+  // Queries without FROM clause and cached results have nothing to cancel.
+  lock_guard<mutex> l(coord_lock_);
+  cancelled_ = true;
+  if (coord_ != NULL) coord_->Cancel();
+}
+
+Coordinator* ImpalaServer::QueryExecState::GetCoordinator(
+    const TUniqueId& query_id) {
+  lock_guard<mutex> l(coord_lock_);
+  if (coord_ != NULL && coord_->query_id() == query_id) return coord_.get();
+  if (failed_coord_ != NULL && failed_coord_->query_id() == query_id) {
+    return failed_coord_.get();
+  }
+  return NULL;
+}
+
+Status ImpalaServer::QueryExecState::WaitForCoordinator() {
+  lock_guard<mutex> l(wait_lock_);
+  Status status = coord_->Wait();
+  // Only queries are restarted: an INSERT may have written files already.
+  if (!status.IsBroadcastBuildLimitExceeded() || replanned_
+      || exec_request_.stmt_type != TStmtType::QUERY
+      || exec_request_.query_options.partition_join) {
+    return status;
+  }
+  RETURN_IF_ERROR(ReplanWithPartitionedJoins(status));
+  return coord_->Wait();
+}
+
+Status ImpalaServer::QueryExecState::ReplanWithPartitionedJoins(const Status& status) {
+  VLOG_QUERY << "Re-planning query " << PrintId(query_id_)
+             << " with partitioned joins: " << status.GetErrorMsg();
+  shared_ptr<QueryExecState> self = impala_server_->GetQueryExecState(query_id_, false);
+  // the query was closed meanwhile
+  if (self == NULL) return status;
+  TClientRequest request = client_request_;
+  request.queryOptions.partition_join = true;
+  RETURN_IF_ERROR(impala_server_->GetExecRequest(request, &replanned_exec_request_));
+  ApplyPoolShares(&replanned_exec_request_.query_options);
+  query_events_->MarkEvent("Re-planned with partitioned joins");
+  profile_.AddInfoString("Re-planned", status.GetErrorMsg());
+
+  // The new request id gives the new fragment instances ids that don't collide with
+  // those of the cancelled ones; the backends report to it.
+  replanned_query_id_ = replanned_exec_request_.request_id;
+  RETURN_IF_ERROR(impala_server_->RegisterQuery(replanned_query_id_, self));
+  replanned_ = true;
+  {
+    lock_guard<mutex> l(coord_lock_);
+    if (cancelled_) return Status::CANCELLED;
+    failed_coord_.swap(coord_);
+    coord_.reset(new Coordinator(exec_env_, &exec_stats_));
+  }
+  TQueryExecRequest& query_exec_request = replanned_exec_request_.query_exec_request;
+  RETURN_IF_ERROR(coord_->Exec(replanned_query_id_, &query_exec_request,
+      replanned_exec_request_.query_options, query_events_));
+  {
+    lock_guard<mutex> l(coord_lock_);
+    if (cancelled_) coord_->Cancel();
+  }
+  if (query_exec_request.fragments[0].partition.type == TPartitionType::UNPARTITIONED) {
+    RETURN_IF_ERROR(PrepareSelectListExprs(coord_->runtime_state(),
+        query_exec_request.fragments[0].output_exprs, coord_->row_desc()));
+  }
+  profile_.AddChild(coord_->query_profile());
+
+  const unordered_set<THostPort>& unique_hosts = coord_->unique_hosts();
+  lock_guard<mutex> l(impala_server_->query_locations_lock_);
+  BOOST_FOREACH(const THostPort& port, unique_hosts) {
+    impala_server_->query_locations_[port].insert(query_id_);
+  }
+  return Status::OK;
+}
+
+void ImpalaServer::QueryExecState::SpoolResults() {
+  Status status = WaitForCoordinator();
+  vector<string> rows;
+  while (status.ok()) {
+    RowBatch* batch;
+    status = coord_->GetNext(&batch, coord_->runtime_state());
+    if (!status.ok() || batch == NULL) break;
+    status = ConvertBatchToAscii(batch, &rows);
+    if (status.ok()) status = result_spool_->AddRows(&rows);
+  }
+  spool_spilled_rows_counter_->Set(result_spool_->num_spilled_rows());
+  result_spool_->Close(status);
+}
+
+Status ImpalaServer::QueryExecState::ConvertBatchToAscii(RowBatch* batch,
+    vector<string>* rows) {
+  int num_rows = batch->num_rows();
+  rows->resize(num_rows);
+  for (int i = 0; i < output_exprs_.size(); ++i) {
+    output_exprs_[i]->GetValues(batch, NULL, num_rows, &output_column_);
+    PrimitiveType type = output_exprs_[i]->type();
+    for (int j = 0; j < num_rows; ++j) {
+      // ODBC-187 - ODBC can only take "\t" as the delimiter
+      if (i > 0) (*rows)[j].push_back('\t');
+      RawValue::AppendValue(output_column_.GetValue(j), type, ASCII_PRECISION,
+          &(*rows)[j]);
+    }
+  }
+  return Status::OK;
 }
 
 Status ImpalaServer::QueryExecState::PrepareSelectListExprs(
@@ -448,14 +822,14 @@ Status ImpalaServer::QueryExecState::CreateConstantRowAsAscii(
 
 Status ImpalaServer::QueryExecState::ConvertSingleRowToAscii(TupleRow* row,
     vector<string>* converted_rows) {
-  stringstream out_stream;
-  out_stream.precision(ASCII_PRECISION);
+  string out_str;
   for (int i = 0; i < output_exprs_.size(); ++i) {
     // ODBC-187 - ODBC can only take "\t" as the delimiter
-    out_stream << (i > 0 ? "\t" : "");
-    output_exprs_[i]->PrintValue(row, &out_stream);
+    if (i > 0) out_str.push_back('\t');
+    RawValue::AppendValue(output_exprs_[i]->GetValue(row), output_exprs_[i]->type(),
+        ASCII_PRECISION, &out_str);
   }
-  converted_rows->push_back(out_stream.str());
+  converted_rows->push_back(out_str);
   return Status::OK;
 }
 
@@ -492,6 +866,7 @@ class ImpalaServer::FragmentExecState {
 
   const TUniqueId& query_id() const { return query_id_; }
   const TUniqueId& fragment_instance_id() const { return fragment_instance_id_; }
+  const string& cpu_cgroup() const { return exec_params_.query_options.cpu_cgroup; }
 
   void set_exec_thread(thread* exec_thread) { exec_thread_.reset(exec_thread); }
 
@@ -577,7 +952,14 @@ void ImpalaServer::FragmentExecState::ReportStatusCb(
   params.__set_fragment_instance_id(fragment_instance_id_);
   exec_status.SetTStatus(&params);
   params.__set_done(done);
-  profile->ToThrift(&params.profile);
+  // Intermediate reports only carry what changed since the previous report, which
+  // the coordinator applies to its copy of the profile; the final report is complete
+  // in case an earlier one was lost.
+  if (done) {
+    profile->ToThrift(&params.profile);
+  } else {
+    profile->ToThriftDelta(&params.profile);
+  }
   params.__isset.profile = true;
 
   RuntimeState* runtime_state = executor_.runtime_state();
@@ -592,6 +974,9 @@ void ImpalaServer::FragmentExecState::ReportStatusCb(
       insert_status.__set_num_appended_rows(
           *executor_.runtime_state()->num_appended_rows());
     }
+    if (!runtime_state->insert_partition_stats()->empty()) {
+      insert_status.__set_partition_stats(*runtime_state->insert_partition_stats());
+    }
 
     params.__set_insert_exec_status(insert_status);
   }
@@ -627,7 +1012,8 @@ const char* ImpalaServer::SQLSTATE_OPTIONAL_FEATURE_NOT_IMPLEMENTED = "HYC00";
 const int ImpalaServer::ASCII_PRECISION = 16; // print 16 digits for double/float
 
 ImpalaServer::ImpalaServer(ExecEnv* exec_env)
-    : exec_env_(exec_env) {
+    : exec_env_(exec_env),
+      load_version_(0) {
   // Initialize default config
   InitializeConfigVariables();
 
@@ -656,11 +1042,17 @@ ImpalaServer::ImpalaServer(ExecEnv* exec_env)
     EXIT_IF_EXC(jni_env);
     get_db_names_id_ = jni_env->GetMethodID(fe_class, "getDbNames", "([B)[B");
     EXIT_IF_EXC(jni_env);
+    warm_catalog_id_ =
+        jni_env->GetMethodID(fe_class, "warmCatalog", "(Ljava/lang/String;)V");
+    EXIT_IF_EXC(jni_env);
 
     jboolean lazy = (FLAGS_load_catalog_at_startup ? false : true);
     jobject fe = jni_env->NewObject(fe_class, fe_ctor, lazy);
     EXIT_IF_EXC(jni_env);
     EXIT_IF_ERROR(JniUtil::LocalToGlobalRef(jni_env, fe, &fe_));
+    if (lazy && FLAGS_warm_catalog_at_startup) {
+      catalog_warmup_thread_.reset(new thread(&ImpalaServer::WarmCatalog, this));
+    }
   } else {
     planservice_socket_.reset(new TSocket(FLAGS_planservice_host,
         FLAGS_planservice_port));
@@ -678,6 +1070,14 @@ ImpalaServer::ImpalaServer(ExecEnv* exec_env)
       bind<void>(mem_fn(&ImpalaServer::QueryStatePathHandler), this, _1);
   exec_env->webserver()->RegisterPathHandler("/queries", query_callback);
 
+  Webserver::PathHandlerCallback query_json_callback =
+      bind<void>(mem_fn(&ImpalaServer::QueryStateJsonPathHandler), this, _1);
+  exec_env->webserver()->RegisterPathHandler("/jsonqueries", query_json_callback);
+
+  Webserver::PathHandlerCallback profiles_callback =
+      bind<void>(mem_fn(&ImpalaServer::QueryProfilesPathHandler), this, _1);
+  exec_env->webserver()->RegisterPathHandler("/query_profiles", profiles_callback);
+
   Webserver::PathHandlerCallback sessions_callback =
       bind<void>(mem_fn(&ImpalaServer::SessionPathHandler), this, _1);
   exec_env->webserver()->RegisterPathHandler("/sessions", sessions_callback);
@@ -692,6 +1092,24 @@ ImpalaServer::ImpalaServer(ExecEnv* exec_env)
 
   num_queries_metric_ = 
       exec_env->metrics()->CreateAndRegisterPrimitiveMetric(NUM_QUERIES_METRIC, 0L);
+  num_result_cache_hits_metric_ = exec_env->metrics()->CreateAndRegisterPrimitiveMetric(
+      NUM_RESULT_CACHE_HITS_METRIC, 0L);
+  if (FLAGS_result_cache_max_bytes > 0) {
+    result_cache_.reset(new QueryResultCache(FLAGS_result_cache_max_bytes));
+  }
+  num_plan_cache_hits_metric_ = exec_env->metrics()->CreateAndRegisterPrimitiveMetric(
+      NUM_PLAN_CACHE_HITS_METRIC, 0L);
+  if (FLAGS_plan_cache_max_entries > 0) {
+    plan_cache_.reset(new PlanCache(FLAGS_plan_cache_max_entries));
+  }
+
+  AdmissionController::PoolConfig default_pool;
+  default_pool.max_running = FLAGS_default_pool_max_running;
+  default_pool.max_queued = FLAGS_default_pool_max_queued;
+  default_pool.mem_limit = FLAGS_default_pool_mem_limit;
+  map<string, AdmissionController::PoolConfig> pools;
+  EXIT_IF_ERROR(AdmissionController::ParsePoolConfigs(FLAGS_admission_pools, &pools));
+  admission_controller_.reset(new AdmissionController(default_pool, pools));
 }
 
 void ImpalaServer::RenderHadoopConfigs(stringstream* output) {
@@ -714,22 +1132,63 @@ void ImpalaServer::RenderHadoopConfigs(stringstream* output) {
   RETURN_IF_EXC(jni_env);
 }
 
+// Rows per second of 'rows' over 'elapsed_ms'.
+static int64_t RowsPerSecond(int64_t rows, int64_t elapsed_ms) {
+  return elapsed_ms <= 0 ? 0 : rows * 1000 / elapsed_ms;
+}
+
+// Escapes the characters of 's' that can't appear in a json string.
+static string EscapeJson(const string& s) {
+  stringstream result;
+  for (int i = 0; i < s.size(); ++i) {
+    switch (s[i]) {
+      case '"': result << "\\\""; break;
+      case '\\': result << "\\\\"; break;
+      case '\n': result << "\\n"; break;
+      case '\t': result << "\\t"; break;
+      default:
+        if (static_cast<unsigned char>(s[i]) < 0x20) {
+          result << "\\u" << setw(4) << setfill('0') << hex << static_cast<int>(s[i])
+                 << dec;
+        } else {
+          result << s[i];
+        }
+    }
+  }
+  return result.str();
+}
+
 void ImpalaServer::QueryStatePathHandler(stringstream* output) {
   (*output) << "<h2>Queries</h2>";
-  lock_guard<mutex> l(query_exec_state_map_lock_);
+  // Computing the progress may wait for a query's Exec(), so it's done without
+  // holding query_exec_state_map_lock_.
+  vector<shared_ptr<QueryExecState> > exec_states;
+  {
+    lock_guard<mutex> l(query_exec_state_map_lock_);
+    BOOST_FOREACH(const QueryExecStateMap::value_type& exec_state,
+        query_exec_state_map_) {
+      exec_states.push_back(exec_state.second);
+    }
+  }
   (*output) << "This page lists all registered queries, i.e., those that are not closed "
-    " nor cancelled.<br/>" << endl;
-  (*output) << query_exec_state_map_.size() << " queries in flight" << endl;
+    " nor cancelled.  The progress of a query is as of the last status reports of its "
+    "fragments; it is also available as json at /jsonqueries.<br/>" << endl;
+  (*output) << exec_states.size() << " queries in flight" << endl;
   (*output) << "<table border=1><tr><th>Query Id</th>" << endl;
   (*output) << "<th>Statement</th>" << endl;
   (*output) << "<th>Query Type</th>" << endl;
   (*output) << "<th>State</th>" << endl;
   (*output) << "<th># rows fetched</th>" << endl;
+  (*output) << "<th>Scan Ranges</th>" << endl;
+  (*output) << "<th>Elapsed</th>" << endl;
+  (*output) << "<th>Est. Remaining</th>" << endl;
+  (*output) << "<th>Memory</th>" << endl;
+  (*output) << "<th>Operators (rows returned, rows/sec)</th>" << endl;
   (*output) << "</tr>";
-  BOOST_FOREACH(const QueryExecStateMap::value_type& exec_state, query_exec_state_map_) {
+  BOOST_FOREACH(const shared_ptr<QueryExecState>& exec_state, exec_states) {
     QueryHandle handle;
-    TUniqueIdToQueryHandle(exec_state.first, &handle);
-    const TExecRequest& request = exec_state.second->exec_request();
+    TUniqueIdToQueryHandle(exec_state->query_id(), &handle);
+    const TExecRequest& request = exec_state->exec_request();
     const string& query_stmt = 
         (request.stmt_type != TStmtType::DDL && request.__isset.sql_stmt) ?
         request.sql_stmt : "N/A";
@@ -739,9 +1198,34 @@ void ImpalaServer::QueryStatePathHandler(stringstream* output) {
               << _TStmtType_VALUES_TO_NAMES.find(request.stmt_type)->second
               << "</td>"
               << "<td>" << _QueryState_VALUES_TO_NAMES.find(
-                  exec_state.second->query_state())->second << "</td>"
-              << "<td>" << exec_state.second->num_rows_fetched() << "</td>"
-              << "</tr>" << endl;
+                  exec_state->query_state())->second << "</td>"
+              << "<td>" << exec_state->num_rows_fetched() << "</td>";
+    Coordinator::Progress progress;
+    if (exec_state->coord() == NULL || !exec_state->coord()->GetProgress(&progress)) {
+      (*output) << "<td colspan=5>N/A</td></tr>" << endl;
+      continue;
+    }
+    (*output) << "<td>" << progress.num_scan_ranges_complete << " / "
+              << progress.num_scan_ranges << "</td>"
+              << "<td>"
+              << PrettyPrinter::Print(progress.elapsed_ms, TCounterType::TIME_MS)
+              << "</td>"
+              << "<td>" << (progress.remaining_ms < 0 ? "N/A" :
+                  PrettyPrinter::Print(progress.remaining_ms, TCounterType::TIME_MS))
+              << "</td>"
+              << "<td>" << PrettyPrinter::Print(progress.mem_usage, TCounterType::BYTES)
+              << "</td><td>";
+    map<PlanNodeId, Coordinator::Progress::NodeProgress>::const_iterator it;
+    for (it = progress.nodes.begin(); it != progress.nodes.end(); ++it) {
+      const Coordinator::Progress::NodeProgress& node = it->second;
+      (*output) << node.name << ": "
+                << PrettyPrinter::Print(node.rows_returned, TCounterType::UNIT) << ", "
+                << PrettyPrinter::Print(
+                    RowsPerSecond(node.rows_returned, progress.elapsed_ms),
+                    TCounterType::UNIT_PER_SECOND)
+                << "<br/>";
+    }
+    (*output) << "</td></tr>" << endl;
   }
 
   (*output) << "</table>";
@@ -759,6 +1243,84 @@ void ImpalaServer::QueryStatePathHandler(stringstream* output) {
   (*output) << "</table>";
 }
 
+void ImpalaServer::QueryStateJsonPathHandler(stringstream* output) {
+  vector<shared_ptr<QueryExecState> > exec_states;
+  {
+    lock_guard<mutex> l(query_exec_state_map_lock_);
+    BOOST_FOREACH(const QueryExecStateMap::value_type& exec_state,
+        query_exec_state_map_) {
+      exec_states.push_back(exec_state.second);
+    }
+  }
+  (*output) << "{\n  \"queries\" : [";
+  for (int i = 0; i < exec_states.size(); ++i) {
+    QueryExecState* exec_state = exec_states[i].get();
+    const TExecRequest& request = exec_state->exec_request();
+    (*output) << (i == 0 ? "" : ",") << "\n    {\n"
+              << "      \"id\" : \"" << PrintId(exec_state->query_id()) << "\",\n"
+              << "      \"statement\" : \"" << EscapeJson(
+                  (request.stmt_type != TStmtType::DDL && request.__isset.sql_stmt) ?
+                  request.sql_stmt : "") << "\",\n"
+              << "      \"type\" : \""
+              << _TStmtType_VALUES_TO_NAMES.find(request.stmt_type)->second << "\",\n"
+              << "      \"state\" : \"" << _QueryState_VALUES_TO_NAMES.find(
+                  exec_state->query_state())->second << "\",\n"
+              << "      \"rows_fetched\" : " << exec_state->num_rows_fetched();
+    Coordinator::Progress progress;
+    if (exec_state->coord() != NULL && exec_state->coord()->GetProgress(&progress)) {
+      (*output) << ",\n"
+                << "      \"scan_ranges\" : " << progress.num_scan_ranges << ",\n"
+                << "      \"scan_ranges_complete\" : "
+                << progress.num_scan_ranges_complete << ",\n"
+                << "      \"elapsed_ms\" : " << progress.elapsed_ms << ",\n"
+                << "      \"remaining_ms\" : " << progress.remaining_ms << ",\n"
+                << "      \"mem_usage_bytes\" : " << progress.mem_usage << ",\n"
+                << "      \"operators\" : [";
+      map<PlanNodeId, Coordinator::Progress::NodeProgress>::const_iterator it;
+      for (it = progress.nodes.begin(); it != progress.nodes.end(); ++it) {
+        const Coordinator::Progress::NodeProgress& node = it->second;
+        (*output) << (it == progress.nodes.begin() ? "" : ",")
+                  << "\n        { \"name\" : \""
+                  << EscapeJson(node.name) << "\", \"rows_returned\" : "
+                  << node.rows_returned << ", \"rows_per_sec\" : "
+                  << RowsPerSecond(node.rows_returned, progress.elapsed_ms) << " }";
+      }
+      (*output) << " ]";
+    }
+    (*output) << "\n    }";
+  }
+  (*output) << " ]\n}\n";
+}
+
+// Escapes the characters of 's' that have a meaning in html.
+static string EscapeHtml(const string& s) {
+  string result;
+  result.reserve(s.size());
+  for (int i = 0; i < s.size(); ++i) {
+    switch (s[i]) {
+      case '<': result += "&lt;"; break;
+      case '>': result += "&gt;"; break;
+      case '&': result += "&amp;"; break;
+      default: result += s[i];
+    }
+  }
+  return result;
+}
+
+void ImpalaServer::QueryProfilesPathHandler(stringstream* output) {
+  (*output) << "<h2>Query Profiles</h2>";
+  (*output) << "Runtime profiles of the registered queries; start impalad with "
+    "--exec_node_hw_counters to include the hardware counters of the plan nodes."
+    "<br/>" << endl;
+  lock_guard<mutex> l(query_exec_state_map_lock_);
+  BOOST_FOREACH(const QueryExecStateMap::value_type& exec_state, query_exec_state_map_) {
+    stringstream profile;
+    exec_state.second->profile()->PrettyPrint(&profile);
+    (*output) << "<h3>" << PrintId(exec_state.first) << "</h3>" << endl
+              << "<pre>" << EscapeHtml(profile.str()) << "</pre>" << endl;
+  }
+}
+
 void ImpalaServer::SessionPathHandler(stringstream* output) {
   (*output) << "<h2>Sessions</h2>" << endl;
   lock_guard<mutex> l_(session_state_map_lock_);
@@ -909,17 +1471,221 @@ Status ImpalaServer::Execute(const TClientRequest& request,
   return status;
 }
 
+// Returns true if 'expr' calls a function whose result differs between executions.
+static bool IsNonDeterministic(const TExpr& expr) {
+  BOOST_FOREACH(const TExprNode& node, expr.nodes) {
+    if (!node.__isset.opcode) continue;
+    if (node.opcode == TExprOpcode::MATH_RAND || node.opcode == TExprOpcode::MATH_RAND_INT
+        || node.opcode == TExprOpcode::TIMESTAMP_NOW
+        || node.opcode == TExprOpcode::UNIX_TIMESTAMP) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool IsNonDeterministic(const vector<TExpr>& exprs) {
+  BOOST_FOREACH(const TExpr& expr, exprs) {
+    if (IsNonDeterministic(expr)) return true;
+  }
+  return false;
+}
+
+// Returns true if 'request' scans an hbase table.  Changes to hbase tables aren't
+// detected, so neither its plan nor its results can be cached.
+static bool ScansHBase(const TQueryExecRequest& request) {
+  BOOST_FOREACH(const TPlanFragment& fragment, request.fragments) {
+    if (!fragment.__isset.plan) continue;
+    BOOST_FOREACH(const TPlanNode& node, fragment.plan.nodes) {
+      if (node.__isset.hbase_scan_node) return true;
+    }
+  }
+  return false;
+}
+
+// Returns true if the results of 'request' can be cached: it only reads hdfs tables,
+// whose changes we can detect, and it is deterministic.
+static bool IsResultCacheable(const TQueryExecRequest& request) {
+  if (ScansHBase(request)) return false;
+  BOOST_FOREACH(const TPlanFragment& fragment, request.fragments) {
+    if (IsNonDeterministic(fragment.output_exprs)) return false;
+    if (!fragment.__isset.plan) continue;
+    BOOST_FOREACH(const TPlanNode& node, fragment.plan.nodes) {
+      if (IsNonDeterministic(node.conjuncts)) return false;
+      if (node.__isset.hash_join_node) {
+        BOOST_FOREACH(const TEqJoinCondition& cond,
+            node.hash_join_node.eq_join_conjuncts) {
+          if (IsNonDeterministic(cond.left) || IsNonDeterministic(cond.right)) {
+            return false;
+          }
+        }
+        if (IsNonDeterministic(node.hash_join_node.other_join_conjuncts)) return false;
+      }
+      if (node.__isset.agg_node && (IsNonDeterministic(node.agg_node.grouping_exprs)
+          || IsNonDeterministic(node.agg_node.aggregate_exprs))) {
+        return false;
+      }
+      if (node.__isset.sort_node && IsNonDeterministic(node.sort_node.ordering_exprs)) {
+        return false;
+      }
+      if (node.__isset.merge_node) {
+        BOOST_FOREACH(const vector<TExpr>& exprs, node.merge_node.result_expr_lists) {
+          if (IsNonDeterministic(exprs)) return false;
+        }
+        BOOST_FOREACH(const vector<TExpr>& exprs, node.merge_node.const_expr_lists) {
+          if (IsNonDeterministic(exprs)) return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+// Adds the base directories of the hdfs tables that 'request' reads, and the
+// directories of the files it scans, to 'dir_mtimes'.
+static void GetScannedDirs(const TQueryExecRequest& request,
+    map<string, int64_t>* dir_mtimes) {
+  if (request.__isset.desc_tbl) {
+    BOOST_FOREACH(const TTableDescriptor& table, request.desc_tbl.tableDescriptors) {
+      if (table.__isset.hdfsTable) (*dir_mtimes)[table.hdfsTable.hdfsBaseDir] = 0;
+    }
+  }
+  typedef map<TPlanNodeId, vector<TScanRangeLocations> > ScanRangeMap;
+  BOOST_FOREACH(const ScanRangeMap::value_type& entry, request.per_node_scan_ranges) {
+    BOOST_FOREACH(const TScanRangeLocations& locations, entry.second) {
+      if (!locations.scan_range.__isset.hdfs_file_split) continue;
+      const string& path = locations.scan_range.hdfs_file_split.path;
+      (*dir_mtimes)[path.substr(0, path.rfind('/'))] = 0;
+    }
+  }
+}
+
+Status ImpalaServer::GetHdfsDirMtimes(map<string, int64_t>* dir_mtimes) {
+  hdfsFS hdfs_connection = exec_env_->fs_cache()->GetDefaultConnection();
+  for (map<string, int64_t>::iterator it = dir_mtimes->begin();
+       it != dir_mtimes->end(); ++it) {
+    hdfsFileInfo* info = hdfsGetPathInfo(hdfs_connection, it->first.c_str());
+    if (info == NULL) {
+      return Status(AppendHdfsErrorMessage("Failed to get info on ", it->first));
+    }
+    it->second = info->mLastMod;
+    hdfsFreeFileInfo(info, 1);
+  }
+  return Status::OK;
+}
+
+bool ImpalaServer::GetCachedExecRequest(const string& key, TExecRequest* result) {
+  shared_ptr<const PlanCache::Entry> entry = plan_cache_->Lookup(key);
+  if (entry == NULL) return false;
+  map<string, int64_t> dir_mtimes = entry->dir_mtimes;
+  Status status = GetHdfsDirMtimes(&dir_mtimes);
+  if (!status.ok() || dir_mtimes != entry->dir_mtimes) {
+    // The scan ranges may be out of date.
+    plan_cache_->Erase(key);
+    return false;
+  }
+  *result = entry->exec_request;
+  // The plan is reused by a new query, which needs its own id and time.
+  result->request_id = GenerateQueryId();
+  result->query_exec_request.query_globals.now_string =
+      TimestampValue(posix_time::microsec_clock::local_time()).DebugString();
+  num_plan_cache_hits_metric_->Increment(1L);
+  return true;
+}
+
+void ImpalaServer::AddToPlanCache(const string& key, int64_t generation,
+    const TExecRequest& exec_request) {
+  // DDL and DML statements are cheap to plan or change the catalog.
+  if (exec_request.stmt_type != TStmtType::QUERY) return;
+  if (ScansHBase(exec_request.query_exec_request)) return;
+  shared_ptr<PlanCache::Entry> entry(new PlanCache::Entry());
+  GetScannedDirs(exec_request.query_exec_request, &entry->dir_mtimes);
+  Status status = GetHdfsDirMtimes(&entry->dir_mtimes);
+  if (!status.ok()) {
+    VLOG_QUERY << "Not caching plan: " << status.GetErrorMsg();
+    return;
+  }
+  entry->exec_request = exec_request;
+  plan_cache_->Insert(key, generation, entry);
+}
+
+TUniqueId ImpalaServer::GenerateQueryId() {
+  uuids::uuid uuid;
+  {
+    lock_guard<mutex> l(uuid_lock_);
+    uuid = uuid_generator_();
+  }
+  TUniqueId query_id;
+  memcpy(&query_id.hi, &uuid.data[0], 8);
+  memcpy(&query_id.lo, &uuid.data[8], 8);
+  return query_id;
+}
+
+Status ImpalaServer::RegisterQuery(const TUniqueId& query_id,
+    const shared_ptr<QueryExecState>& exec_state) {
+  lock_guard<mutex> l(query_exec_state_map_lock_);
+
+  // there shouldn't be an active query with that same id
+  // (query_id is globally unique)
+  QueryExecStateMap::iterator entry = query_exec_state_map_.find(query_id);
+  if (entry != query_exec_state_map_.end()) {
+    stringstream ss;
+    ss << "query id " << PrintId(query_id) << " already exists";
+    return Status(TStatusCode::INTERNAL_ERROR, ss.str());
+  }
+
+  query_exec_state_map_.insert(make_pair(query_id, exec_state));
+  return Status::OK;
+}
+
 Status ImpalaServer::ExecuteInternal(
     const TClientRequest& request, bool* registered_exec_state,
     shared_ptr<QueryExecState>* exec_state) {
   exec_state->reset(new QueryExecState(exec_env_, this));
   *registered_exec_state = false;
 
+  // The key includes everything besides the catalog that the plan and result depend
+  // on.
+  string cache_key;
+  if (result_cache_ != NULL || plan_cache_ != NULL) {
+    cache_key = QueryResultCache::NormalizeStmt(request.stmt) + "\n" +
+        request.sessionState.database + "\n" + ThriftDebugString(request.queryOptions);
+  }
+  int64_t cache_generation = 0;
+  if (result_cache_ != NULL) {
+    cache_generation = result_cache_->generation();
+    shared_ptr<const QueryResultCache::Entry> cached_result =
+        result_cache_->Lookup(cache_key);
+    if (cached_result != NULL) {
+      map<string, int64_t> dir_mtimes = cached_result->dir_mtimes;
+      Status status = GetHdfsDirMtimes(&dir_mtimes);
+      if (status.ok() && dir_mtimes == cached_result->dir_mtimes) {
+        TUniqueId query_id = GenerateQueryId();
+        (*exec_state)->ExecCachedResult(query_id, cached_result);
+        (*exec_state)->set_result_metadata(cached_result->result_metadata);
+        RETURN_IF_ERROR(RegisterQuery(query_id, *exec_state));
+        *registered_exec_state = true;
+        num_result_cache_hits_metric_->Increment(1L);
+        return Status::OK;
+      }
+      result_cache_->Erase(cache_key);
+    }
+  }
+
   TExecRequest result;
   {
     SCOPED_TIMER((*exec_state)->planner_timer());
-    RETURN_IF_ERROR(GetExecRequest(request, &result));
+    if (plan_cache_ == NULL) {
+      RETURN_IF_ERROR(GetExecRequest(request, &result));
+    } else if (GetCachedExecRequest(cache_key, &result)) {
+      (*exec_state)->profile()->AddInfoString("Plan cache", "Hit");
+    } else {
+      int64_t plan_generation = plan_cache_->generation();
+      RETURN_IF_ERROR(GetExecRequest(request, &result));
+      AddToPlanCache(cache_key, plan_generation, result);
+    }
   }
+  (*exec_state)->query_events()->MarkEvent("Planning finished");
 
   if (result.stmt_type == TStmtType::DDL && 
       result.ddl_exec_request.ddl_type == TDdlType::USE) {
@@ -940,25 +1706,25 @@ Status ImpalaServer::ExecuteInternal(
 
   // register exec state before starting execution in order to handle incoming
   // status reports
-  {
-    lock_guard<mutex> l(query_exec_state_map_lock_);
-
-    // there shouldn't be an active query with that same id
-    // (query_id is globally unique)
-    QueryExecStateMap::iterator entry =
-        query_exec_state_map_.find(result.request_id);
-    if (entry != query_exec_state_map_.end()) {
-      stringstream ss;
-      ss << "query id " << PrintId(result.request_id)
-         << " already exists";
-      return Status(TStatusCode::INTERNAL_ERROR, ss.str());
+  RETURN_IF_ERROR(RegisterQuery(result.request_id, *exec_state));
+  *registered_exec_state = true;
+
+  if (result_cache_ != NULL && result.stmt_type == TStmtType::QUERY &&
+      IsResultCacheable(result.query_exec_request)) {
+    // Record the directory mtimes before the query reads them.
+    shared_ptr<QueryResultCache::Entry> entry(new QueryResultCache::Entry());
+    entry->result_metadata = result.result_set_metadata;
+    GetScannedDirs(result.query_exec_request, &entry->dir_mtimes);
+    Status status = GetHdfsDirMtimes(&entry->dir_mtimes);
+    if (status.ok()) {
+      (*exec_state)->EnableResultCaching(cache_key, cache_generation, entry);
+    } else {
+      VLOG_QUERY << "Not caching results: " << status.GetErrorMsg();
     }
-
-    query_exec_state_map_.insert(make_pair(result.request_id, *exec_state));
-    *registered_exec_state = true;
   }
 
   // start execution of query; also starts fragment status reports
+  (*exec_state)->set_client_request(request);
   RETURN_IF_ERROR((*exec_state)->Exec(&result));
 
   if ((*exec_state)->coord() != NULL) {
@@ -987,6 +1753,9 @@ bool ImpalaServer::UnregisterQuery(const TUniqueId& query_id) {
       exec_state = entry->second;
     }      
     query_exec_state_map_.erase(entry);
+    if (exec_state->replanned()) {
+      query_exec_state_map_.erase(exec_state->replanned_query_id());
+    }
   }
   
 
@@ -1029,6 +1798,10 @@ void ImpalaServer::Wait(boost::shared_ptr<QueryExecState> exec_state) {
 
 Status ImpalaServer::UpdateMetastore(const TCatalogUpdate& catalog_update) {
   VLOG_QUERY << "UpdateMetastore()";
+  if (result_cache_ != NULL) result_cache_->Invalidate();
+  if (plan_cache_ != NULL) plan_cache_->Invalidate();
+  ExecStatsStore* exec_stats_store = exec_env_->exec_stats_store();
+  if (exec_stats_store != NULL) exec_stats_store->Invalidate();
   if (!FLAGS_use_planservice) {
     JNIEnv* jni_env = getJNIEnv();
     jbyteArray request_bytes;
@@ -1179,6 +1952,10 @@ Status ImpalaServer::GetExplainPlan(
 
 Status ImpalaServer::ResetCatalogInternal() {
   LOG(INFO) << "Refreshing catalog";
+  if (result_cache_ != NULL) result_cache_->Invalidate();
+  if (plan_cache_ != NULL) plan_cache_->Invalidate();
+  ExecStatsStore* exec_stats_store = exec_env_->exec_stats_store();
+  if (exec_stats_store != NULL) exec_stats_store->Invalidate();
   if (!FLAGS_use_planservice) {
     JNIEnv* jni_env = getJNIEnv();
     jni_env->CallObjectMethod(fe_, reset_catalog_id_);
@@ -1198,6 +1975,22 @@ Status ImpalaServer::ResetCatalogInternal() {
   return Status::OK;
 }
 
+void ImpalaServer::WarmCatalog() {
+  LOG(INFO) << "Warming catalog";
+  Status status = WarmCatalogInternal();
+  if (!status.ok()) LOG(WARNING) << "Error warming catalog: " << status.GetErrorMsg();
+}
+
+Status ImpalaServer::WarmCatalogInternal() {
+  JNIEnv* jni_env = getJNIEnv();
+  jstring tables = jni_env->NewStringUTF(FLAGS_warm_catalog_tables.c_str());
+  RETURN_ERROR_IF_EXC(jni_env, JniUtil::throwable_to_string_id());
+  jni_env->CallVoidMethod(fe_, warm_catalog_id_, tables);
+  jni_env->DeleteLocalRef(tables);
+  RETURN_ERROR_IF_EXC(jni_env, JniUtil::throwable_to_string_id());
+  return Status::OK;
+}
+
 void ImpalaServer::ResetCatalog(impala::TStatus& status) {
   ResetCatalogInternal().ToThrift(&status);
 }
@@ -1524,6 +2317,37 @@ void ImpalaServer::QueryToTClientRequest(const Query& query,
             request->queryOptions.allow_unsupported_formats =
                 iequals(key_value[1], "true") || iequals(key_value[1], "1");
             break;
+          case TImpalaQueryOptions::PARTITION_JOIN:
+            request->queryOptions.partition_join =
+                iequals(key_value[1], "true") || iequals(key_value[1], "1");
+            break;
+          case TImpalaQueryOptions::MEM_LIMIT:
+            request->queryOptions.mem_limit = atol(key_value[1].c_str());
+            break;
+          case TImpalaQueryOptions::IO_WEIGHT:
+            request->queryOptions.io_weight = atoi(key_value[1].c_str());
+            break;
+          case TImpalaQueryOptions::REQUEST_POOL:
+            request->queryOptions.request_pool = key_value[1];
+            break;
+          case TImpalaQueryOptions::CLUSTERED_INSERT:
+            request->queryOptions.clustered_insert =
+                iequals(key_value[1], "true") || iequals(key_value[1], "1");
+            break;
+          case TImpalaQueryOptions::NUM_INSTANCES_PER_HOST:
+            request->queryOptions.num_instances_per_host = atoi(key_value[1].c_str());
+            break;
+          case TImpalaQueryOptions::MAX_BROADCAST_BUILD_BYTES:
+            request->queryOptions.max_broadcast_build_bytes =
+                atol(key_value[1].c_str());
+            break;
+          case TImpalaQueryOptions::MAX_SCANNER_THREAD_TOKENS:
+            request->queryOptions.max_scanner_thread_tokens =
+                atoi(key_value[1].c_str());
+            break;
+          case TImpalaQueryOptions::CPU_CGROUP:
+            request->queryOptions.cpu_cgroup = key_value[1];
+            break;
           default:
             // We hit this DCHECK(false) if we forgot to add the corresponding entry here
             // when we add a new query option.
@@ -1622,7 +2446,13 @@ void ImpalaServer::ReportExecStatus(
     LOG(ERROR) << str.str();
     return;
   }
-  exec_state->coord()->UpdateFragmentExecStatus(params).SetTStatus(&return_val);
+  Coordinator* coord = exec_state->GetCoordinator(params.query_id);
+  if (coord == NULL) {
+    // a report for the coordinator that a re-planned query replaced
+    return_val.status.__set_status_code(TStatusCode::OK);
+    return;
+  }
+  coord->UpdateFragmentExecStatus(params).SetTStatus(&return_val);
 }
 
 void ImpalaServer::CancelPlanFragment(
@@ -1651,9 +2481,12 @@ void ImpalaServer::TransmitData(
   // TODO: fix Thrift so we can simply take ownership of thrift_batch instead
   // of having to copy its data
   if (params.row_batch.num_rows > 0) {
+    bool recvr_closed;
     Status status = exec_env_->stream_mgr()->AddData(
-        params.dest_fragment_instance_id, params.dest_node_id, params.row_batch);
+        params.dest_fragment_instance_id, params.dest_node_id,
+        params.src_fragment_instance_id, params.row_batch, &recvr_closed);
     status.SetTStatus(&return_val);
+    if (recvr_closed) return_val.__set_recvr_closed(true);
     if (!status.ok()) {
       // should we close the channel here as well?
       return;
@@ -1662,7 +2495,8 @@ void ImpalaServer::TransmitData(
 
   if (params.eos) {
     exec_env_->stream_mgr()->CloseSender(
-        params.dest_fragment_instance_id, params.dest_node_id).SetTStatus(&return_val);
+        params.dest_fragment_instance_id, params.dest_node_id,
+        params.src_fragment_instance_id).SetTStatus(&return_val);
   }
 }
 
@@ -1689,15 +2523,25 @@ Status ImpalaServer::StartPlanFragmentExecution(
     fragment_exec_state_map_.insert(make_pair(params.fragment_instance_id, exec_state));
   }
 
-  // execute plan fragment in new thread
-  // TODO: manage threads via global thread pool
-  exec_state->set_exec_thread(
-      new thread(&ImpalaServer::RunExecPlanFragment, this, exec_state.get()));
+  // execute plan fragment on a thread of the pool, or in a new thread
+  ThreadPool* pool = exec_env_->fragment_exec_pool();
+  if (pool != NULL) {
+    // the exec state stays in fragment_exec_state_map_ until the work item is done
+    pool->Offer(bind(&ImpalaServer::RunExecPlanFragment, this, exec_state.get()));
+  } else {
+    exec_state->set_exec_thread(
+        new thread(&ImpalaServer::RunExecPlanFragment, this, exec_state.get()));
+  }
   return Status::OK;
 }
 
 void ImpalaServer::RunExecPlanFragment(FragmentExecState* exec_state) {
-  exec_state->Exec();
+  // the pool's thread may have evaluated the exprs of another fragment before
+  SharedExpr::StartThreadScopes();
+  {
+    ScopedCgroupAssignment cgroup(exec_state->cpu_cgroup());
+    exec_state->Exec();
+  }
 
   // we're done with this plan fragment
   {
@@ -1763,6 +2607,33 @@ void ImpalaServer::InitializeConfigVariables() {
       case TImpalaQueryOptions::ALLOW_UNSUPPORTED_FORMATS:
         value << default_options.allow_unsupported_formats;
         break;
+      case TImpalaQueryOptions::PARTITION_JOIN:
+        value << default_options.partition_join;
+        break;
+      case TImpalaQueryOptions::MEM_LIMIT:
+        value << default_options.mem_limit;
+        break;
+      case TImpalaQueryOptions::IO_WEIGHT:
+        value << default_options.io_weight;
+        break;
+      case TImpalaQueryOptions::REQUEST_POOL:
+        value << default_options.request_pool;
+        break;
+      case TImpalaQueryOptions::CLUSTERED_INSERT:
+        value << default_options.clustered_insert;
+        break;
+      case TImpalaQueryOptions::NUM_INSTANCES_PER_HOST:
+        value << default_options.num_instances_per_host;
+        break;
+      case TImpalaQueryOptions::MAX_BROADCAST_BUILD_BYTES:
+        value << default_options.max_broadcast_build_bytes;
+        break;
+      case TImpalaQueryOptions::MAX_SCANNER_THREAD_TOKENS:
+        value << default_options.max_scanner_thread_tokens;
+        break;
+      case TImpalaQueryOptions::CPU_CGROUP:
+        value << default_options.cpu_cgroup;
+        break;
       default:
         // We hit this DCHECK(false) if we forgot to add the corresponding entry here
         // when we add a new query option.
@@ -1844,6 +2715,31 @@ void ImpalaServer::MembershipCallback(const ServiceStateMap& service_state) {
   }
 }
 
+void ImpalaServer::PublishLoad(const THostPort& address,
+                               vector<TVersionedObject>* objects) {
+  TBackendLoad load;
+  {
+    lock_guard<mutex> l(fragment_exec_state_map_lock_);
+    load.num_fragments = fragment_exec_state_map_.size();
+  }
+  load.mem_used = exec_env_->process_mem_tracker()->consumption();
+  load.disk_queue_length = exec_env_->disk_io_mgr()->GetQueueLength();
+
+  TVersionedObject object;
+  object.service_id = IMPALA_SERVICE_ID;
+  stringstream key;
+  key << address.ipaddress << ":" << address.port;
+  object.key = key.str();
+  object.type = "load";
+  object.version = ++load_version_;
+  Status status = SerializeThriftMsg(&load, &object.value);
+  if (!status.ok()) {
+    LOG(WARNING) << "Could not publish the backend load: " << status.GetErrorMsg();
+    return;
+  }
+  objects->push_back(object);
+}
+
 ImpalaServer* CreateImpalaServer(ExecEnv* exec_env, int fe_port, int be_port,
     ThriftServer** fe_server, ThriftServer** be_server) {
   DCHECK((fe_port == 0) == (fe_server == NULL));
@@ -1856,10 +2752,21 @@ ImpalaServer* CreateImpalaServer(ExecEnv* exec_env, int fe_port, int be_port,
   shared_ptr<ThreadFactory> thread_factory(new PosixThreadFactory());
 
   if (fe_port != 0 && fe_server != NULL) {
-    // FE must be a TThreadPoolServer because ODBC and Hue only support TThreadPoolServer.
+    // FE is a TThreadPoolServer by default because ODBC and Hue only support
+    // TThreadPoolServer. The nonblocking server holds any number of connections, but
+    // requires a framed transport.
+    ThriftServer::ServerType server_type = ThriftServer::ThreadPool;
+    if (FLAGS_fe_nonblocking_server) {
+      if (FLAGS_principal.empty()) {
+        server_type = ThriftServer::Nonblocking;
+      } else {
+        LOG(WARNING) << "Ignoring --fe_nonblocking_server, which can't be used with "
+                     << "Kerberos";
+      }
+    }
     shared_ptr<TProcessor> fe_processor(new ImpalaServiceProcessor(handler));
     *fe_server = new ThriftServer("ImpalaServer Frontend", fe_processor, fe_port, 
-        FLAGS_fe_service_threads, ThriftServer::ThreadPool);
+        FLAGS_fe_service_threads, server_type);
 
     (*fe_server)->SetSessionHandler(handler.get());
 
@@ -1872,6 +2779,13 @@ ImpalaServer* CreateImpalaServer(ExecEnv* exec_env, int fe_port, int be_port,
         FLAGS_be_service_threads);
 
     LOG(INFO) << "ImpalaInternalService listening on " << be_port;
+
+    if (FLAGS_data_stream_port_offset > 0) {
+      // senders fall back to TransmitData rpcs if they can't connect
+      Status status = exec_env->StartDataStreamServer(
+          be_port + FLAGS_data_stream_port_offset);
+      if (!status.ok()) LOG(ERROR) << status.GetErrorMsg();
+    }
   }
 
   return handler.get();
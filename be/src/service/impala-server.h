@@ -16,14 +16,17 @@
 #ifndef IMPALA_SERVICE_IMPALA_SERVER_H
 #define IMPALA_SERVICE_IMPALA_SERVER_H
 
+#include <map>
 #include <jni.h>
 
 #include "util/uid-util.h"  // for some reason needed right here for hash<TUniqueId>
 #include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
 #include <boost/unordered_map.hpp>
 #include <boost/unordered_set.hpp>
+#include <boost/uuid/uuid_generators.hpp>
 
 #include "gen-cpp/ImpalaService.h"
 #include "gen-cpp/ImpalaInternalService.h"
@@ -36,6 +39,9 @@
 namespace impala {
 
 class ExecEnv;
+class AdmissionController;
+class PlanCache;
+class QueryResultCache;
 class DataSink;
 class Coordinator;
 class RowDescriptor;
@@ -138,6 +144,12 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   // active nodes that have failed, and cancels any queries running on them.
   void MembershipCallback(const sparrow::ServiceStateMap& service_state);
 
+  // Called with every response to the state-store. Adds this backend's current
+  // TBackendLoad, keyed by 'address', to 'objects' for the schedulers of the other
+  // impalads.
+  void PublishLoad(const THostPort& address,
+                   std::vector<sparrow::TVersionedObject>* objects);
+
  private:
   class QueryExecState;
   class FragmentExecState;
@@ -210,6 +222,27 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   Status ExecuteInternal(const TClientRequest& request, bool* registered_exec_state,
                          boost::shared_ptr<QueryExecState>* exec_state);
 
+  // Adds exec_state to query_exec_state_map_ under query_id.  Returns an error if
+  // there already is a query with that id.
+  Status RegisterQuery(const TUniqueId& query_id,
+      const boost::shared_ptr<QueryExecState>& exec_state);
+
+  // Looks up the plan cached under 'key' and, if it is still valid, copies it into
+  // 'result' with a new request id.  Returns false if there is no valid plan.
+  bool GetCachedExecRequest(const std::string& key, TExecRequest* result);
+
+  // Adds 'exec_request' to plan_cache_ under 'key' if it can be reused.
+  // 'generation' is the cache's generation from before the statement was planned.
+  void AddToPlanCache(const std::string& key, int64_t generation,
+      const TExecRequest& exec_request);
+
+  // Returns a new, random query id, for queries that aren't planned by the frontend.
+  TUniqueId GenerateQueryId();
+
+  // Sets the value of each entry of dir_mtimes to the modification time of the hdfs
+  // directory named by its key.
+  Status GetHdfsDirMtimes(std::map<std::string, int64_t>* dir_mtimes);
+
   // Removes exec_state from query_exec_state_map_ and cancels execution.
   // Returns true if it found a registered exec_state, otherwise false.
   bool UnregisterQuery(const TUniqueId& query_id);
@@ -224,6 +257,12 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   // Non-thrift callable version of ResetCatalog
   Status ResetCatalogInternal();
 
+  // Loads the tables of the lazily loaded catalog that are not loaded yet, starting
+  // with --warm_catalog_tables.  Runs on catalog_warmup_thread_ while queries are
+  // served, until all tables are loaded or the catalog is reset.
+  void WarmCatalog();
+  Status WarmCatalogInternal();
+
   // Initiates query cancellation. Returns OK unless query_id is not found. 
   Status CancelInternal(const TUniqueId& query_id);
 
@@ -231,9 +270,15 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   void RenderHadoopConfigs(std::stringstream* output);
 
   // Webserver callback. Prints a table of current queries, including their
-  // states, types and IDs.
+  // states, types, IDs and progress.
   void QueryStatePathHandler(std::stringstream* output);
 
+  // Webserver callback. Prints the current queries and their progress as json.
+  void QueryStateJsonPathHandler(std::stringstream* output);
+
+  // Webserver callback that prints the runtime profiles of the current queries.
+  void QueryProfilesPathHandler(std::stringstream* output);
+
   // Webserver callback that prints a table of active sessions.
   void SessionPathHandler(std::stringstream* output);
 
@@ -285,8 +330,12 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   jmethodID get_table_names_id_; // JniFrontend.getTableNames
   jmethodID describe_table_id_,; // JniFrontend.describeTable
   jmethodID get_db_names_id_; // JniFrontend.getDbNames
+  jmethodID warm_catalog_id_; // JniFrontend.warmCatalog
   ExecEnv* exec_env_;  // not owned
 
+  // Thread running WarmCatalog(), if --warm_catalog_at_startup.
+  boost::scoped_ptr<boost::thread> catalog_warmup_thread_;
+
   // plan service-related - impalad optionally uses a standalone
   // plan service (see FLAGS_use_planservice etc)
   boost::shared_ptr<apache::thrift::transport::TTransport> planservice_socket_;
@@ -343,11 +392,33 @@ class ImpalaServer : public ImpalaServiceIf, public ImpalaInternalServiceIf,
   // The set of backends last reported by the state-store, used for failure detection.
   std::vector<THostPort> last_membership_;
 
+  // Version of the last load published by PublishLoad().
+  int64_t load_version_;
+
   // Metrics
 
   // Total number of queries executed by this server, including failed and cancelled
   // queries.
   Metrics::IntMetric* num_queries_metric_;
+
+  // Decides when the queries submitted to this server start running.
+  boost::scoped_ptr<AdmissionController> admission_controller_;
+
+  // Results of recent queries; NULL if --result_cache_max_bytes is 0.
+  boost::scoped_ptr<QueryResultCache> result_cache_;
+
+  // Number of queries answered from result_cache_
+  Metrics::IntMetric* num_result_cache_hits_metric_;
+
+  // Plans of recent queries; NULL if --plan_cache_max_entries is 0.
+  boost::scoped_ptr<PlanCache> plan_cache_;
+
+  // Number of queries that reused a plan from plan_cache_
+  Metrics::IntMetric* num_plan_cache_hits_metric_;
+
+  // protects uuid_generator_
+  boost::mutex uuid_lock_;
+  boost::uuids::random_generator uuid_generator_;
 };
 
 // Create an ImpalaServer and Thrift servers.
@@ -19,6 +19,7 @@
 #include <unistd.h>
 #include <jni.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
 #include <boost/unordered_map.hpp>
 
 #include <protocol/TBinaryProtocol.h>
@@ -70,6 +71,13 @@ DECLARE_int32(be_port);
 DECLARE_string(principal);
 DECLARE_string(hostname);
 
+// Loads the HBase classes and configuration; run on a thread of its own while the
+// frontend starts.
+static void InitHBase(Status* status) {
+  *status = HBaseTableScanner::Init();
+  if (status->ok()) *status = HBaseTableCache::Init();
+}
+
 int main(int argc, char** argv) {
   // Set the default hostname.  The user can override this with the hostname flag.
   FLAGS_hostname = GetHostname();
@@ -93,7 +101,8 @@ int main(int argc, char** argv) {
   InitThriftLogging();
   CpuInfo::Init();
   DiskInfo::Init();
-  LlvmCodeGen::InitializeLlvm();
+  // Llvm doesn't need the JVM, so it is initialized while the JVM starts.
+  thread llvm_init_thread(&LlvmCodeGen::InitializeLlvm, false);
   
   // Enable Kerberos security if requested.
   if (!FLAGS_principal.empty()) {
@@ -102,8 +111,10 @@ int main(int argc, char** argv) {
   
   JniUtil::InitLibhdfs();
   EXIT_IF_ERROR(JniUtil::Init());
-  EXIT_IF_ERROR(HBaseTableScanner::Init());
-  EXIT_IF_ERROR(HBaseTableCache::Init());
+  // The HBase classes are only needed by queries, so they are loaded while the
+  // frontend and its catalog start in CreateImpalaServer().
+  Status hbase_status;
+  thread hbase_init_thread(&InitHBase, &hbase_status);
   InitFeSupport();
 
   // start backend service for the coordinator on be_port
@@ -112,6 +123,9 @@ int main(int argc, char** argv) {
   ThriftServer* be_server = NULL;
   ImpalaServer* server = 
       CreateImpalaServer(&exec_env, FLAGS_fe_port, FLAGS_be_port, &fe_server, &be_server);
+  llvm_init_thread.join();
+  hbase_init_thread.join();
+  EXIT_IF_ERROR(hbase_status);
   be_server->Start();
 
   Status status = exec_env.StartServices();
@@ -139,6 +153,8 @@ int main(int argc, char** argv) {
         bind<void>(mem_fn(&ImpalaServer::MembershipCallback), server, _1)));
     exec_env.subscription_mgr()->RegisterSubscription(services, "impala.server", 
         cb.get());
+    exec_env.subscription_mgr()->SetObjectCallback(
+        bind<void>(mem_fn(&ImpalaServer::PublishLoad), server, host_port, _1));
                                                       
     if (!status.ok()) {
       LOG(ERROR) << "Could not register with state store service: "
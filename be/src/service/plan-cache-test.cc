@@ -0,0 +1,74 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "service/plan-cache.h"
+
+using namespace std;
+
+namespace impala {
+
+static boost::shared_ptr<const PlanCache::Entry> MakeEntry() {
+  return boost::shared_ptr<const PlanCache::Entry>(new PlanCache::Entry());
+}
+
+TEST(PlanCacheTest, LookupAndEvict) {
+  PlanCache cache(2);
+  int64_t generation = cache.generation();
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+
+  boost::shared_ptr<const PlanCache::Entry> entry = MakeEntry();
+  cache.Insert("a", generation, entry);
+  cache.Insert("b", generation, MakeEntry());
+  EXPECT_TRUE(cache.Lookup("a") == entry);
+
+  // "b" is the least recently used entry.
+  cache.Insert("c", generation, MakeEntry());
+  EXPECT_EQ(cache.num_entries(), 2);
+  EXPECT_TRUE(cache.Lookup("a") != NULL);
+  EXPECT_TRUE(cache.Lookup("b") == NULL);
+  EXPECT_TRUE(cache.Lookup("c") != NULL);
+
+  // Replacing an entry doesn't evict another one.
+  cache.Insert("c", generation, MakeEntry());
+  EXPECT_EQ(cache.num_entries(), 2);
+  EXPECT_TRUE(cache.Lookup("a") != NULL);
+
+  cache.Erase("a");
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  EXPECT_EQ(cache.num_entries(), 1);
+}
+
+TEST(PlanCacheTest, Invalidate) {
+  PlanCache cache(10);
+  int64_t generation = cache.generation();
+  cache.Insert("a", generation, MakeEntry());
+  cache.Invalidate();
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  EXPECT_EQ(cache.num_entries(), 0);
+
+  // Plans made before the invalidation are dropped.
+  cache.Insert("a", generation, MakeEntry());
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  cache.Insert("a", cache.generation(), MakeEntry());
+  EXPECT_TRUE(cache.Lookup("a") != NULL);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
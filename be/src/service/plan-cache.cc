@@ -0,0 +1,82 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "service/plan-cache.h"
+
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+PlanCache::PlanCache(int max_entries)
+  : max_entries_(max_entries),
+    generation_(0) {
+  DCHECK_GT(max_entries, 0);
+}
+
+shared_ptr<const PlanCache::Entry> PlanCache::Lookup(const string& key) {
+  lock_guard<mutex> l(lock_);
+  map<string, EntryList::iterator>::iterator it = entries_.find(key);
+  if (it == entries_.end()) return shared_ptr<const Entry>();
+  lru_.splice(lru_.begin(), lru_, it->second);
+  return it->second->second;
+}
+
+int64_t PlanCache::generation() {
+  lock_guard<mutex> l(lock_);
+  return generation_;
+}
+
+void PlanCache::Insert(const string& key, int64_t generation,
+    const shared_ptr<const Entry>& entry) {
+  lock_guard<mutex> l(lock_);
+  if (generation != generation_) return;
+  map<string, EntryList::iterator>::iterator it = entries_.find(key);
+  if (it != entries_.end()) {
+    lru_.erase(it->second);
+    entries_.erase(it);
+  }
+  if (static_cast<int>(entries_.size()) >= max_entries_) {
+    entries_.erase(lru_.back().first);
+    lru_.pop_back();
+  }
+  lru_.push_front(make_pair(key, entry));
+  entries_[key] = lru_.begin();
+}
+
+void PlanCache::Erase(const string& key) {
+  lock_guard<mutex> l(lock_);
+  map<string, EntryList::iterator>::iterator it = entries_.find(key);
+  if (it == entries_.end()) return;
+  lru_.erase(it->second);
+  entries_.erase(it);
+}
+
+void PlanCache::Invalidate() {
+  lock_guard<mutex> l(lock_);
+  entries_.clear();
+  lru_.clear();
+  ++generation_;
+}
+
+int PlanCache::num_entries() {
+  lock_guard<mutex> l(lock_);
+  return entries_.size();
+}
+
+}
@@ -0,0 +1,89 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_SERVICE_PLAN_CACHE_H
+#define IMPALA_SERVICE_PLAN_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "gen-cpp/Frontend_types.h"
+
+namespace impala {
+
+// Caches the TExecRequests that the frontend produced for recent statements, so that
+// repeated statements skip analysis and planning.  Entries are keyed like the
+// QueryResultCache; at most max_entries are kept, and the least recently used ones
+// are evicted first.  Invalidate() drops all entries, and each entry records the
+// modification times of the directories its scan ranges came from, which the caller
+// checks before it uses an entry.
+// This class is thread safe.
+class PlanCache {
+ public:
+  struct Entry {
+    TExecRequest exec_request;
+
+    // Hdfs directories that the plan reads from, and their modification times when
+    // it was planned.
+    std::map<std::string, int64_t> dir_mtimes;
+  };
+
+  // max_entries must be > 0.
+  explicit PlanCache(int max_entries);
+
+  // Returns the entry for 'key' and marks it as most recently used, or NULL if there
+  // is none.
+  boost::shared_ptr<const Entry> Lookup(const std::string& key);
+
+  // Returns the current generation, which Invalidate() increments.  It is read before
+  // a statement is planned and passed to Insert().
+  int64_t generation();
+
+  // Adds 'entry' under 'key', replacing any existing entry and evicting the least
+  // recently used entry if the cache is full.  Does nothing if Invalidate() was called
+  // after 'generation' was read.
+  void Insert(const std::string& key, int64_t generation,
+      const boost::shared_ptr<const Entry>& entry);
+
+  // Removes the entry for 'key', if any.
+  void Erase(const std::string& key);
+
+  // Removes all entries, e.g. because the catalog changed.
+  void Invalidate();
+
+  int num_entries();
+
+ private:
+  typedef std::list<std::pair<std::string, boost::shared_ptr<const Entry> > > EntryList;
+
+  const int max_entries_;
+
+  // protects all fields below
+  boost::mutex lock_;
+
+  // All entries, most recently used first, and an index into it by key
+  EntryList lru_;
+  std::map<std::string, EntryList::iterator> entries_;
+
+  int64_t generation_;
+};
+
+}
+
+#endif
@@ -0,0 +1,94 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "service/query-result-cache.h"
+
+using namespace std;
+
+namespace impala {
+
+static boost::shared_ptr<const QueryResultCache::Entry> MakeEntry(int num_rows,
+    const string& row) {
+  boost::shared_ptr<QueryResultCache::Entry> entry(new QueryResultCache::Entry());
+  entry->rows.resize(num_rows, row);
+  return entry;
+}
+
+TEST(QueryResultCacheTest, NormalizeStmt) {
+  EXPECT_EQ(QueryResultCache::NormalizeStmt("  select   *\n\tfrom t  "),
+      "select * from t");
+  EXPECT_EQ(QueryResultCache::NormalizeStmt("select 1 -- one\nfrom t"),
+      "select 1 from t");
+  EXPECT_EQ(QueryResultCache::NormalizeStmt("select/* a */1"), "select 1");
+  // Quoted strings are preserved.
+  EXPECT_EQ(QueryResultCache::NormalizeStmt("select 'a  b',  \"c -- d\""),
+      "select 'a  b', \"c -- d\"");
+  EXPECT_EQ(QueryResultCache::NormalizeStmt("select 'it\\'s  x'  from t"),
+      "select 'it\\'s  x' from t");
+}
+
+TEST(QueryResultCacheTest, LookupAndEvict) {
+  boost::shared_ptr<const QueryResultCache::Entry> entry = MakeEntry(10, "0123456789");
+  int64_t entry_bytes = QueryResultCache::GetEntryBytes("a", *entry);
+  QueryResultCache cache(entry_bytes * 2);
+  int64_t generation = cache.generation();
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+
+  cache.Insert("a", generation, entry);
+  cache.Insert("b", generation, MakeEntry(10, "0123456789"));
+  EXPECT_EQ(cache.num_entries(), 2);
+  EXPECT_EQ(cache.num_bytes(), entry_bytes * 2);
+  EXPECT_TRUE(cache.Lookup("a") == entry);
+
+  // "b" is the least recently used entry.
+  cache.Insert("c", generation, MakeEntry(10, "0123456789"));
+  EXPECT_EQ(cache.num_entries(), 2);
+  EXPECT_TRUE(cache.Lookup("a") != NULL);
+  EXPECT_TRUE(cache.Lookup("b") == NULL);
+  EXPECT_TRUE(cache.Lookup("c") != NULL);
+
+  // Too large for the cache
+  cache.Insert("d", generation, MakeEntry(30, "0123456789"));
+  EXPECT_TRUE(cache.Lookup("d") == NULL);
+  EXPECT_EQ(cache.num_entries(), 2);
+
+  cache.Erase("a");
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  EXPECT_EQ(cache.num_bytes(), entry_bytes);
+}
+
+TEST(QueryResultCacheTest, Invalidate) {
+  QueryResultCache cache(1024 * 1024);
+  int64_t generation = cache.generation();
+  cache.Insert("a", generation, MakeEntry(1, "x"));
+  cache.Invalidate();
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  EXPECT_EQ(cache.num_bytes(), 0);
+
+  // Results of queries that started before the invalidation are dropped.
+  cache.Insert("a", generation, MakeEntry(1, "x"));
+  EXPECT_TRUE(cache.Lookup("a") == NULL);
+  cache.Insert("a", cache.generation(), MakeEntry(1, "x"));
+  EXPECT_TRUE(cache.Lookup("a") != NULL);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
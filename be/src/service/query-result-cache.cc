@@ -0,0 +1,150 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "service/query-result-cache.h"
+
+#include <ctype.h>
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+QueryResultCache::QueryResultCache(int64_t max_bytes)
+  : max_bytes_(max_bytes),
+    num_bytes_(0),
+    generation_(0) {
+  DCHECK_GT(max_bytes, 0);
+}
+
+string QueryResultCache::NormalizeStmt(const string& stmt) {
+  string result;
+  result.reserve(stmt.size());
+  bool pending_space = false;
+  int i = 0;
+  while (i < stmt.size()) {
+    char c = stmt[i];
+    if (isspace(c)) {
+      pending_space = true;
+      ++i;
+      continue;
+    }
+    // Comments count as whitespace.
+    if (c == '-' && i + 1 < stmt.size() && stmt[i + 1] == '-') {
+      while (i < stmt.size() && stmt[i] != '\n') ++i;
+      pending_space = true;
+      continue;
+    }
+    if (c == '/' && i + 1 < stmt.size() && stmt[i + 1] == '*') {
+      size_t end = stmt.find("*/", i + 2);
+      i = end == string::npos ? stmt.size() : end + 2;
+      pending_space = true;
+      continue;
+    }
+    if (pending_space && !result.empty()) result.push_back(' ');
+    pending_space = false;
+    if (c == '\'' || c == '"' || c == '`') {
+      // Copy quoted strings and identifiers verbatim, including escaped quotes.
+      result.push_back(c);
+      ++i;
+      while (i < stmt.size() && stmt[i] != c) {
+        if (stmt[i] == '\\' && c != '`' && i + 1 < stmt.size()) {
+          result.push_back(stmt[i++]);
+        }
+        result.push_back(stmt[i++]);
+      }
+      if (i < stmt.size()) result.push_back(stmt[i++]);
+      continue;
+    }
+    result.push_back(c);
+    ++i;
+  }
+  return result;
+}
+
+shared_ptr<const QueryResultCache::Entry> QueryResultCache::Lookup(const string& key) {
+  lock_guard<mutex> l(lock_);
+  EntryMap::iterator it = entries_.find(key);
+  if (it == entries_.end()) return shared_ptr<const Entry>();
+  lru_.splice(lru_.begin(), lru_, it->second.lru_it);
+  return it->second.entry;
+}
+
+int64_t QueryResultCache::generation() {
+  lock_guard<mutex> l(lock_);
+  return generation_;
+}
+
+void QueryResultCache::Insert(const string& key, int64_t generation,
+    const shared_ptr<const Entry>& entry) {
+  int64_t bytes = GetEntryBytes(key, *entry);
+  if (bytes > max_bytes_) return;
+  lock_guard<mutex> l(lock_);
+  if (generation != generation_) return;
+  EntryMap::iterator it = entries_.find(key);
+  if (it != entries_.end()) EraseInternal(it);
+  while (num_bytes_ + bytes > max_bytes_) {
+    DCHECK(!lru_.empty());
+    EraseInternal(entries_.find(lru_.back()));
+  }
+  lru_.push_front(key);
+  CacheEntry& cache_entry = entries_[key];
+  cache_entry.entry = entry;
+  cache_entry.bytes = bytes;
+  cache_entry.lru_it = lru_.begin();
+  num_bytes_ += bytes;
+}
+
+void QueryResultCache::Erase(const string& key) {
+  lock_guard<mutex> l(lock_);
+  EntryMap::iterator it = entries_.find(key);
+  if (it != entries_.end()) EraseInternal(it);
+}
+
+void QueryResultCache::Invalidate() {
+  lock_guard<mutex> l(lock_);
+  entries_.clear();
+  lru_.clear();
+  num_bytes_ = 0;
+  ++generation_;
+}
+
+int64_t QueryResultCache::GetEntryBytes(const string& key, const Entry& entry) {
+  int64_t bytes = sizeof(Entry) + key.size();
+  for (int i = 0; i < entry.rows.size(); ++i) {
+    bytes += sizeof(string) + entry.rows[i].size();
+  }
+  return bytes;
+}
+
+int64_t QueryResultCache::num_bytes() {
+  lock_guard<mutex> l(lock_);
+  return num_bytes_;
+}
+
+int QueryResultCache::num_entries() {
+  lock_guard<mutex> l(lock_);
+  return entries_.size();
+}
+
+void QueryResultCache::EraseInternal(EntryMap::iterator it) {
+  num_bytes_ -= it->second.bytes;
+  lru_.erase(it->second.lru_it);
+  entries_.erase(it);
+}
+
+}
@@ -0,0 +1,114 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_SERVICE_QUERY_RESULT_CACHE_H
+#define IMPALA_SERVICE_QUERY_RESULT_CACHE_H
+
+#include <list>
+#include <map>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "gen-cpp/Frontend_types.h"
+
+namespace impala {
+
+// Caches the complete, ascii converted result sets of queries, so that repeated
+// queries are answered without planning or executing them.
+// Entries are keyed by a string that identifies the query (see NormalizeStmt()); the
+// total size of the cached rows is bounded by max_bytes, and the least recently used
+// entries are evicted first.  Invalidate() drops all entries, and each entry records
+// the modification times of the directories it read, which the caller checks before
+// it uses an entry.
+// This class is thread safe.
+class QueryResultCache {
+ public:
+  struct Entry {
+    TResultSetMetadata result_metadata;
+    std::vector<std::string> rows;
+
+    // Hdfs directories that the query read from, and their modification times when
+    // the query started.
+    std::map<std::string, int64_t> dir_mtimes;
+  };
+
+  // max_bytes must be > 0.
+  explicit QueryResultCache(int64_t max_bytes);
+
+  // Returns 'stmt' with comments removed and whitespace sequences outside of quoted
+  // strings and identifiers collapsed into a single space, so that statements that
+  // only differ in formatting share an entry.
+  static std::string NormalizeStmt(const std::string& stmt);
+
+  // Returns the entry for 'key' and marks it as most recently used, or NULL if there
+  // is none.
+  boost::shared_ptr<const Entry> Lookup(const std::string& key);
+
+  // Returns the current generation, which Invalidate() increments.  A query reads
+  // it before it starts and passes it to Insert().
+  int64_t generation();
+
+  // Adds 'entry' under 'key', replacing any existing entry, and evicts entries until
+  // the cache fits into max_bytes.  Does nothing if Invalidate() was called after
+  // 'generation' was read or if the entry alone is larger than max_bytes.
+  void Insert(const std::string& key, int64_t generation,
+      const boost::shared_ptr<const Entry>& entry);
+
+  // Removes the entry for 'key', if any.
+  void Erase(const std::string& key);
+
+  // Removes all entries, e.g. because the catalog changed.
+  void Invalidate();
+
+  // Approximate memory used by the entry under 'key'.
+  static int64_t GetEntryBytes(const std::string& key, const Entry& entry);
+
+  int64_t max_bytes() const { return max_bytes_; }
+  int64_t num_bytes();
+  int num_entries();
+
+ private:
+  struct CacheEntry {
+    boost::shared_ptr<const Entry> entry;
+    int64_t bytes;
+
+    // position in lru_
+    std::list<std::string>::iterator lru_it;
+  };
+  typedef std::map<std::string, CacheEntry> EntryMap;
+
+  // Removes 'it' from the cache.  lock_ must be taken.
+  void EraseInternal(EntryMap::iterator it);
+
+  const int64_t max_bytes_;
+
+  // protects all fields below
+  boost::mutex lock_;
+
+  EntryMap entries_;
+
+  // Keys of entries_, most recently used first
+  std::list<std::string> lru_;
+
+  int64_t num_bytes_;
+  int64_t generation_;
+};
+
+}
+
+#endif
@@ -0,0 +1,116 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <sstream>
+#include <string>
+#include <vector>
+#include <gtest/gtest.h>
+#include <boost/thread/thread.hpp>
+
+#include "service/result-spool.h"
+
+using namespace std;
+
+namespace impala {
+
+static string MakeRow(int i) {
+  stringstream ss;
+  ss << "row " << i;
+  return ss.str();
+}
+
+// Adds 'num_rows' rows in batches of 'batch_size' and closes the spool.
+static void Produce(ResultSpool* spool, int num_rows, int batch_size, Status* status) {
+  vector<string> rows;
+  for (int i = 0; i < num_rows; ++i) {
+    rows.push_back(MakeRow(i));
+    if (rows.size() == batch_size || i == num_rows - 1) {
+      *status = spool->AddRows(&rows);
+      if (!status->ok()) return;
+    }
+  }
+  spool->Close(Status::OK);
+}
+
+// Fetches all rows, 'fetch_size' at a time, and checks their order.
+static void ConsumeAndCheck(ResultSpool* spool, int num_rows, int fetch_size) {
+  int num_fetched = 0;
+  bool eos = false;
+  while (!eos) {
+    vector<string> rows;
+    ASSERT_TRUE(spool->GetRows(fetch_size, &rows, &eos).ok());
+    if (fetch_size > 0) EXPECT_LE(rows.size(), fetch_size);
+    for (int i = 0; i < rows.size(); ++i) {
+      EXPECT_EQ(rows[i], MakeRow(num_fetched++));
+    }
+  }
+  EXPECT_EQ(num_fetched, num_rows);
+}
+
+TEST(ResultSpoolTest, Memory) {
+  ResultSpool spool(1024 * 1024, 0, "test");
+  Status status;
+  Produce(&spool, 1000, 100, &status);
+  EXPECT_TRUE(status.ok());
+  ConsumeAndCheck(&spool, 1000, 64);
+  EXPECT_EQ(spool.num_spilled_rows(), 0);
+}
+
+TEST(ResultSpoolTest, Spill) {
+  // Only a few rows fit into memory; the producer runs ahead of the consumer on
+  // disk and has to wait once the disk limit is reached.
+  ResultSpool spool(64, 1024, "test");
+  Status status;
+  boost::thread producer(Produce, &spool, 10000, 37, &status);
+  ConsumeAndCheck(&spool, 10000, 100);
+  producer.join();
+  EXPECT_TRUE(status.ok());
+  EXPECT_GT(spool.num_spilled_rows(), 0);
+}
+
+TEST(ResultSpoolTest, NoDisk) {
+  // The producer waits for the consumer once memory is full.
+  ResultSpool spool(64, 0, "test");
+  Status status;
+  boost::thread producer(Produce, &spool, 1000, 10, &status);
+  ConsumeAndCheck(&spool, 1000, 0);
+  producer.join();
+  EXPECT_TRUE(status.ok());
+  EXPECT_EQ(spool.num_spilled_rows(), 0);
+}
+
+TEST(ResultSpoolTest, ErrorAndCancel) {
+  ResultSpool spool(1024, 0, "test");
+  vector<string> rows(1, "a");
+  EXPECT_TRUE(spool.AddRows(&rows).ok());
+  spool.Close(Status("query failed"));
+  bool eos;
+  EXPECT_FALSE(spool.GetRows(0, &rows, &eos).ok());
+
+  // Cancel() unblocks a waiting producer.
+  ResultSpool full_spool(1, 0, "test");
+  Status status;
+  boost::thread producer(Produce, &full_spool, 10, 10, &status);
+  full_spool.Cancel();
+  producer.join();
+  EXPECT_TRUE(status.IsCancelled());
+  EXPECT_TRUE(full_spool.is_closed());
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,228 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "service/result-spool.h"
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <algorithm>
+#include <sstream>
+#include <boost/algorithm/string.hpp>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+
+DECLARE_string(scratch_dirs);
+
+using namespace boost;
+using namespace boost::algorithm;
+using namespace std;
+
+namespace impala {
+
+// Used to pick the scratch dir and to generate unique file names.
+static int64_t spool_file_counter = 0;
+
+// Minimum number of bytes read from the scratch file at a time.
+static const int READ_BUFFER_SIZE = 64 * 1024;
+
+ResultSpool::ResultSpool(int64_t max_mem_bytes, int64_t max_disk_bytes,
+    const string& name)
+  : max_mem_bytes_(max_mem_bytes),
+    max_disk_bytes_(max_disk_bytes),
+    name_(name),
+    mem_bytes_(0),
+    write_file_(NULL),
+    read_offset_(0),
+    read_buffer_pos_(0),
+    num_unread_spilled_rows_(0),
+    unread_spilled_bytes_(0),
+    num_spilled_rows_(0),
+    closed_(false),
+    cancelled_(false) {
+}
+
+ResultSpool::~ResultSpool() {
+  if (write_file_ != NULL) fclose(write_file_);
+  if (!path_.empty()) unlink(path_.c_str());
+}
+
+Status ResultSpool::AddRows(vector<string>* rows) {
+  unique_lock<mutex> l(lock_);
+  for (int i = 0; i < rows->size(); ++i) {
+    const string& row = (*rows)[i];
+    int64_t len = row.size();
+    while (true) {
+      if (cancelled_) return Status::CANCELLED;
+      // Rows only go to memory while there are no unread rows on disk, so that they
+      // are returned in order.  A single row always fits into an empty buffer.
+      bool fits_mem = num_unread_spilled_rows_ == 0 &&
+          (mem_rows_.empty() || mem_bytes_ + len <= max_mem_bytes_);
+      if (fits_mem) {
+        mem_rows_.push_back(row);
+        mem_bytes_ += len;
+        break;
+      }
+      bool fits_disk = max_disk_bytes_ > 0 &&
+          (num_unread_spilled_rows_ == 0 ||
+           unread_spilled_bytes_ + len <= max_disk_bytes_);
+      if (fits_disk) {
+        RETURN_IF_ERROR(SpillRow(row));
+        break;
+      }
+      rows_removed_cv_.wait(l);
+    }
+    rows_added_cv_.notify_one();
+  }
+  rows->clear();
+  return Status::OK;
+}
+
+void ResultSpool::Close(const Status& status) {
+  lock_guard<mutex> l(lock_);
+  closed_ = true;
+  status_ = status;
+  rows_added_cv_.notify_all();
+}
+
+Status ResultSpool::GetRows(int max_rows, vector<string>* rows, bool* eos) {
+  rows->clear();
+  *eos = false;
+  unique_lock<mutex> l(lock_);
+  while (!cancelled_ && !closed_ && mem_rows_.empty() &&
+      num_unread_spilled_rows_ == 0) {
+    rows_added_cv_.wait(l);
+  }
+  if (cancelled_) return Status::CANCELLED;
+  RETURN_IF_ERROR(status_);
+
+  int num_rows = mem_rows_.size() + num_unread_spilled_rows_;
+  if (max_rows > 0 && max_rows < num_rows) num_rows = max_rows;
+  rows->resize(num_rows);
+  for (int i = 0; i < num_rows; ++i) {
+    if (!mem_rows_.empty()) {
+      (*rows)[i].swap(mem_rows_.front());
+      mem_bytes_ -= (*rows)[i].size();
+      mem_rows_.pop_front();
+    } else {
+      RETURN_IF_ERROR(ReadSpilledRow(&(*rows)[i]));
+    }
+  }
+  *eos = closed_ && mem_rows_.empty() && num_unread_spilled_rows_ == 0;
+  rows_removed_cv_.notify_one();
+  return Status::OK;
+}
+
+void ResultSpool::Cancel() {
+  lock_guard<mutex> l(lock_);
+  cancelled_ = true;
+  rows_added_cv_.notify_all();
+  rows_removed_cv_.notify_all();
+}
+
+bool ResultSpool::is_closed() {
+  lock_guard<mutex> l(lock_);
+  return closed_ || cancelled_;
+}
+
+int64_t ResultSpool::num_spilled_rows() {
+  lock_guard<mutex> l(lock_);
+  return num_spilled_rows_;
+}
+
+Status ResultSpool::SpillRow(const string& row) {
+  if (write_file_ == NULL) {
+    vector<string> dirs;
+    split(dirs, FLAGS_scratch_dirs, is_any_of(","), token_compress_on);
+    if (dirs.empty()) return Status("No scratch directories specified (--scratch_dirs)");
+    int64_t file_idx = __sync_fetch_and_add(&spool_file_counter, 1);
+    stringstream ss;
+    ss << dirs[file_idx % dirs.size()] << "/impala-result-spool-" << name_ << "-"
+       << getpid() << "-" << file_idx;
+    path_ = ss.str();
+    write_file_ = fopen(path_.c_str(), "w+");
+    if (write_file_ == NULL) {
+      stringstream error;
+      error << "Could not create result spool file " << path_ << ": "
+            << strerror(errno);
+      return Status(error.str());
+    }
+  }
+  uint32_t len = row.size();
+  if (fwrite(&len, sizeof(len), 1, write_file_) != 1 ||
+      fwrite(row.data(), 1, len, write_file_) != len) {
+    stringstream ss;
+    ss << "Error writing to result spool file " << path_ << ": " << strerror(errno);
+    return Status(ss.str());
+  }
+  ++num_unread_spilled_rows_;
+  unread_spilled_bytes_ += sizeof(len) + len;
+  ++num_spilled_rows_;
+  return Status::OK;
+}
+
+Status ResultSpool::ReadBytes(int64_t len, void* data) {
+  if (read_buffer_.size() - read_buffer_pos_ < len) {
+    // The writer doesn't flush its rows itself.
+    if (fflush(write_file_) != 0) {
+      stringstream ss;
+      ss << "Error writing to result spool file " << path_ << ": " << strerror(errno);
+      return Status(ss.str());
+    }
+    read_buffer_.erase(0, read_buffer_pos_);
+    read_buffer_pos_ = 0;
+    int64_t num_buffered = read_buffer_.size();
+    read_buffer_.resize(num_buffered + max<int64_t>(len, READ_BUFFER_SIZE));
+    ssize_t bytes_read = pread(fileno(write_file_), &read_buffer_[num_buffered],
+        read_buffer_.size() - num_buffered, read_offset_);
+    read_buffer_.resize(num_buffered + max<ssize_t>(bytes_read, 0));
+    if (bytes_read < 0 || read_buffer_.size() < len) {
+      stringstream ss;
+      ss << "Error reading result spool file " << path_ << ": "
+         << (bytes_read < 0 ? strerror(errno) : "unexpected end of file");
+      return Status(ss.str());
+    }
+    read_offset_ += bytes_read;
+  }
+  memcpy(data, &read_buffer_[read_buffer_pos_], len);
+  read_buffer_pos_ += len;
+  return Status::OK;
+}
+
+Status ResultSpool::ReadSpilledRow(string* row) {
+  DCHECK_GT(num_unread_spilled_rows_, 0);
+  uint32_t len;
+  RETURN_IF_ERROR(ReadBytes(sizeof(len), &len));
+  row->resize(len);
+  if (len > 0) RETURN_IF_ERROR(ReadBytes(len, &(*row)[0]));
+  --num_unread_spilled_rows_;
+  unread_spilled_bytes_ -= sizeof(len) + len;
+  if (num_unread_spilled_rows_ == 0) {
+    // Start over at the beginning of the file.
+    DCHECK_EQ(unread_spilled_bytes_, 0);
+    if (ftruncate(fileno(write_file_), 0) != 0) {
+      stringstream ss;
+      ss << "Error truncating result spool file " << path_ << ": " << strerror(errno);
+      return Status(ss.str());
+    }
+    rewind(write_file_);
+    read_offset_ = 0;
+    read_buffer_.clear();
+    read_buffer_pos_ = 0;
+  }
+  return Status::OK;
+}
+
+}
@@ -0,0 +1,119 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_SERVICE_RESULT_SPOOL_H
+#define IMPALA_SERVICE_RESULT_SPOOL_H
+
+#include <cstdio>
+#include <deque>
+#include <string>
+#include <vector>
+#include <boost/cstdint.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include "common/status.h"
+
+namespace impala {
+
+// Buffers the result rows of a query, converted to their wire format, between the
+// thread that pulls them from the coordinator and the client fetches.  This lets the
+// query's fragments run to completion and release their resources while a slow
+// client is still fetching.
+// Rows are kept in memory up to max_mem_bytes; further rows are appended to a
+// scratch file in one of the --scratch_dirs, up to max_disk_bytes of unread rows.
+// Once both are full, AddRows() blocks until the client has fetched more rows.
+// Rows are returned in the order they were added.
+// This class is thread safe, but is meant for one producer and one consumer.
+class ResultSpool {
+ public:
+  // max_disk_bytes <= 0 disables the scratch file.  'name' identifies the query in
+  // the name of the scratch file.
+  ResultSpool(int64_t max_mem_bytes, int64_t max_disk_bytes, const std::string& name);
+
+  // Deletes the scratch file.
+  ~ResultSpool();
+
+  // Appends 'rows'.  'rows' is cleared.  Blocks while the spool is full.  Returns
+  // CANCELLED if Cancel() is called before all rows were added.
+  Status AddRows(std::vector<std::string>* rows);
+
+  // Called by the producer after its last AddRows().  If 'status' is an error, the
+  // next GetRows() returns it.
+  void Close(const Status& status);
+
+  // Returns at most 'max_rows' rows (max_rows <= 0: all the rows that are currently
+  // buffered) in 'rows', replacing its contents.  Blocks until at least one row is
+  // buffered or the producer closed the spool.  Sets *eos once all rows were
+  // returned.
+  Status GetRows(int max_rows, std::vector<std::string>* rows, bool* eos);
+
+  // Unblocks the producer and makes all subsequent calls fail with CANCELLED.
+  void Cancel();
+
+  // Returns true if Close() or Cancel() was called.
+  bool is_closed();
+
+  // Number of rows that were written to the scratch file.
+  int64_t num_spilled_rows();
+
+ private:
+  // Writes 'row' to the end of the scratch file, creating it if needed.
+  // lock_ must be taken.
+  Status SpillRow(const std::string& row);
+
+  // Reads the next row from the scratch file.  lock_ must be taken.
+  Status ReadSpilledRow(std::string* row);
+
+  // Copies the next 'len' bytes of the scratch file into 'data'.
+  Status ReadBytes(int64_t len, void* data);
+
+  const int64_t max_mem_bytes_;
+  const int64_t max_disk_bytes_;
+  const std::string name_;
+
+  // protects all fields below
+  boost::mutex lock_;
+
+  // signalled when rows are added, or the spool is closed or cancelled
+  boost::condition_variable rows_added_cv_;
+
+  // signalled when rows are removed, or the spool is cancelled
+  boost::condition_variable rows_removed_cv_;
+
+  // Rows in memory; these come before the rows in the scratch file.
+  std::deque<std::string> mem_rows_;
+  int64_t mem_bytes_;
+
+  // Scratch file.  Rows are appended through write_file_ and read back with pread()
+  // into read_buffer_; read_offset_ is the file offset of the end of read_buffer_.
+  // The file is truncated once all rows were read.
+  std::string path_;
+  FILE* write_file_;
+  int64_t read_offset_;
+  std::string read_buffer_;
+  int read_buffer_pos_;
+  int64_t num_unread_spilled_rows_;
+  int64_t unread_spilled_bytes_;
+  int64_t num_spilled_rows_;
+
+  bool closed_;
+  bool cancelled_;
+  Status status_;
+};
+
+}
+
+#endif
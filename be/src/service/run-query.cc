@@ -12,6 +12,7 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <fstream>
 #include <iostream>
 #include <iomanip>
 #include <jni.h>
@@ -60,6 +61,19 @@ DEFINE_string(profile_output_file, "pprof.out", "google pprof output file");
 DEFINE_int32(iterations, 1, "Number of times to run the query (for perf testing)");
 DEFINE_bool(enable_counters, true, "if false, disable using counters (so a profiler can use them");
 DEFINE_bool(explain_plan, false, "if true, print the explain plan only");
+DEFINE_int32(warmup_iterations, 1, "Number of unmeasured runs of each query before the "
+    "measured ones, if --iterations > 1");
+DEFINE_string(profile_dir, "", "If set, the counters of the profile of each run and of "
+    "the profile averaged over the runs of each query are written to files in this "
+    "directory, for --compare_profiles");
+DEFINE_string(compare_profiles, "", "Comma separated baseline and new --profile_dir "
+    "directories. If set, the averaged profiles in them are compared instead of "
+    "running queries.");
+DEFINE_double(regression_threshold, 10, "With --compare_profiles, counters that changed "
+    "by more than this percentage are printed, and increases of the time counters of "
+    "plan nodes are flagged as regressions");
+DEFINE_int32(regression_min_ms, 10, "With --compare_profiles, time increases of less "
+    "than this many ms are not flagged as regressions");
 DECLARE_int32(num_nodes);
 DECLARE_int32(fe_port);
 DECLARE_int32(be_port);
@@ -88,12 +102,140 @@ static void ConstructSummaryString(ExecStats::QueryType query_type, int num_rows
                    << " in " << setiosflags(ios::fixed) << setprecision(3)
                    << mean/1000.0 << " s with stddev "
                    << setiosflags(ios::fixed) << setprecision(3) << stddev/1000.0
-                   << " s" << endl << endl;
+                   << " s (p50 " << StatUtil::ComputePercentile<double>(
+                       &elapsed_times[0], elapsed_times.size(), 50) / 1000.0
+                   << " s, p95 " << StatUtil::ComputePercentile<double>(
+                       &elapsed_times[0], elapsed_times.size(), 95) / 1000.0
+                   << " s, p99 " << StatUtil::ComputePercentile<double>(
+                       &elapsed_times[0], elapsed_times.size(), 99) / 1000.0
+                   << " s)" << endl << endl;
   }
 
   summary->append(summary_stream.str());
 }
 
+// Returns the file in 'dir' for the profile of run 'run' of the query with index
+// 'query_idx', or for its averaged profile if 'run' is -1.
+static string ProfileFile(const string& dir, int query_idx, int run) {
+  stringstream ss;
+  ss << dir << "/q" << query_idx;
+  if (run != -1) ss << ".run" << run;
+  ss << ".txt";
+  return ss.str();
+}
+
+// Writes the counters of nodes[*idx] and its descendants, then advances *idx past them.
+// 'path' identifies nodes[*idx]; the paths of its children are 'path' + "/" + their
+// name, with "#<n>" appended for the n-th sibling with the same name.
+static void WriteNodeCounters(const vector<TRuntimeProfileNode>& nodes,
+    const string& path, int* idx, ofstream* out) {
+  const TRuntimeProfileNode& node = nodes[(*idx)++];
+  for (int i = 0; i < node.counters.size(); ++i) {
+    const TCounter& counter = node.counters[i];
+    *out << path << '\t' << counter.name << '\t' << counter.type << '\t'
+         << counter.value << '\n';
+  }
+  map<string, int> name_counts;
+  for (int i = 0; i < node.num_children; ++i) {
+    const string& name = nodes[*idx].name;
+    int n = name_counts[name]++;
+    stringstream child_path;
+    child_path << path << '/' << name;
+    if (n > 0) child_path << '#' << n;
+    WriteNodeCounters(nodes, child_path.str(), idx, out);
+  }
+}
+
+// Writes the counters of 'profile' to 'file', one per line as
+// "<profile path>\t<counter name>\t<counter type>\t<value>".
+static void WriteProfileCounters(RuntimeProfile* profile, const string& file) {
+  ofstream out(file.c_str());
+  if (!out) {
+    cerr << "Unable to write file: " << file << endl;
+    return;
+  }
+  vector<TRuntimeProfileNode> nodes;
+  profile->ToThrift(&nodes);
+  int idx = 0;
+  WriteNodeCounters(nodes, nodes[0].name, &idx, &out);
+}
+
+struct ProfileCounter {
+  TCounterType::type type;
+  int64_t value;
+};
+
+// Counters of a profile written by WriteProfileCounters(), by
+// "<profile path>\t<counter name>".
+typedef map<string, ProfileCounter> ProfileCounters;
+
+// Reads the counters written by WriteProfileCounters(); returns false if there is no
+// such file.
+static bool ReadProfileCounters(const string& file, ProfileCounters* counters) {
+  ifstream in(file.c_str());
+  if (!in) return false;
+  string line;
+  while (getline(in, line)) {
+    vector<string> fields;
+    split(fields, line, is_any_of("\t"));
+    if (fields.size() != 4) continue;
+    ProfileCounter& counter = (*counters)[fields[0] + '\t' + fields[1]];
+    counter.type = static_cast<TCounterType::type>(atoi(fields[2].c_str()));
+    counter.value = atoll(fields[3].c_str());
+  }
+  return true;
+}
+
+// Compares the averaged profiles of the queries in the two --compare_profiles
+// directories and prints the counters that changed by more than
+// --regression_threshold percent.  Increases of the time counters of plan nodes (whose
+// profiles are named "... (id=<n>)") by at least --regression_min_ms are flagged as
+// regressions.  Returns the number of regressions.
+static int CompareProfiles() {
+  vector<string> dirs;
+  split(dirs, FLAGS_compare_profiles, is_any_of(","), token_compress_on);
+  if (dirs.size() != 2) {
+    cout << "--compare_profiles must be two comma separated directories" << endl;
+    exit(1);
+  }
+  int num_regressions = 0;
+  for (int query_idx = 0; ; ++query_idx) {
+    ProfileCounters baseline, counters;
+    if (!ReadProfileCounters(ProfileFile(dirs[0], query_idx, -1), &baseline) ||
+        !ReadProfileCounters(ProfileFile(dirs[1], query_idx, -1), &counters)) {
+      break;
+    }
+    cout << "Query " << query_idx << ":" << endl;
+    for (ProfileCounters::const_iterator it = baseline.begin(); it != baseline.end();
+         ++it) {
+      ProfileCounters::const_iterator new_it = counters.find(it->first);
+      if (new_it == counters.end()) continue;
+      int64_t old_value = it->second.value;
+      int64_t new_value = new_it->second.value;
+      if (old_value == new_value) continue;
+      double change = old_value == 0 ? 100 : (new_value - old_value) * 100.0 / old_value;
+      if (fabs(change) <= FLAGS_regression_threshold) continue;
+
+      TCounterType::type type = it->second.type;
+      int64_t increase_ms = new_value - old_value;
+      if (type == TCounterType::CPU_TICKS) increase_ms /= CpuInfo::cycles_per_ms();
+      bool is_regression =
+          (type == TCounterType::TIME_MS || type == TCounterType::CPU_TICKS) &&
+          it->first.find("(id=") != string::npos &&
+          increase_ms >= FLAGS_regression_min_ms;
+      if (is_regression) ++num_regressions;
+      string name = it->first;
+      replace_all(name, "\t", " ");
+      cout << "  " << name << ": " << PrettyPrinter::Print(old_value, type) << " -> "
+           << PrettyPrinter::Print(new_value, type) << " (" << showpos
+           << setiosflags(ios::fixed) << setprecision(1) << change << noshowpos << "%)"
+           << (is_regression ? " REGRESSION" : "") << endl;
+    }
+  }
+  cout << num_regressions << " regression(s)" << endl;
+  return num_regressions;
+}
+
 static QueryExecutorIf* CreateExecutor() {
   CHECK(!FLAGS_impalad.empty());
   ImpaladQueryExecutor* executor = new ImpaladQueryExecutor();
@@ -175,18 +317,6 @@ static void Exec(const vector<string>& queries) {
   vector<double> elapsed_times;
   elapsed_times.resize(FLAGS_iterations);
 
-  // If the number of iterations is greater than 1, run once to Ignore JVM startup time.
-  if (FLAGS_iterations > 1) {
-    scoped_ptr<QueryExecutorIf> executor(CreateExecutor());
-    EXIT_IF_ERROR(executor->Setup());
-    EXIT_IF_ERROR(executor->Exec(queries[0], NULL));
-    while (true) {
-      string row;
-      EXIT_IF_ERROR(executor->FetchResult(&row));
-      if (row.empty() || executor->eos()) break;
-    }
-  }
-
   PerfCounters hw_counters;
   if (FLAGS_enable_counters) {
     hw_counters.AddDefaultCounters();
@@ -194,6 +324,7 @@ static void Exec(const vector<string>& queries) {
   }
 
   ObjectPool profile_pool;
+  int query_idx = 0;
   for (vector<string>::const_iterator iter = queries.begin();
       iter != queries.end(); ++iter) {
     if (iter->size() == 0) continue;
@@ -202,6 +333,22 @@ static void Exec(const vector<string>& queries) {
       cout << "Running query: " << *iter << endl;
     }
 
+    // If the number of iterations is greater than 1, run the query without measuring
+    // it first, to exclude JVM startup time and to warm up the caches.
+    if (FLAGS_iterations > 1 && FLAGS_warmup_iterations > 0) {
+      for (int i = 0; i < FLAGS_warmup_iterations; ++i) {
+        scoped_ptr<QueryExecutorIf> executor(CreateExecutor());
+        EXIT_IF_ERROR(executor->Setup());
+        EXIT_IF_ERROR(executor->Exec(*iter, NULL));
+        while (true) {
+          string row;
+          EXIT_IF_ERROR(executor->FetchResult(&row));
+          if (row.empty() || executor->eos()) break;
+        }
+      }
+      if (FLAGS_enable_counters) hw_counters.Snapshot("Warmup");
+    }
+
     RuntimeProfile aggregate_profile(&profile_pool, "RunQuery");
     int num_rows = 0;
 
@@ -260,6 +407,9 @@ static void Exec(const vector<string>& queries) {
             children[i]->set_name("Fragment");
           }
         }
+        if (!FLAGS_profile_dir.empty()) {
+          WriteProfileCounters(profile, ProfileFile(FLAGS_profile_dir, query_idx, i));
+        }
         aggregate_profile.Merge(profile);
       }
     }
@@ -271,6 +421,11 @@ static void Exec(const vector<string>& queries) {
     cout << summary;
 
     if (FLAGS_iterations > 1) aggregate_profile.Divide(FLAGS_iterations);
+    if (!FLAGS_profile_dir.empty()) {
+      WriteProfileCounters(&aggregate_profile,
+          ProfileFile(FLAGS_profile_dir, query_idx, -1));
+    }
+    ++query_idx;
 
     aggregate_profile.PrettyPrint(&cout);
     PRETTY_PRINT_DEBUG_COUNTERS(&cout);
@@ -301,6 +456,7 @@ int main(int argc, char** argv) {
   }
 
   CpuInfo::Init();
+  if (!FLAGS_compare_profiles.empty()) return CompareProfiles() > 0 ? 1 : 0;
   DiskInfo::Init();
   InitThriftLogging();
   LlvmCodeGen::InitializeLlvm();
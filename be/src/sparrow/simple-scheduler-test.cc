@@ -14,11 +14,13 @@
 
 #include <gtest/gtest.h>
 
+#include <boost/lexical_cast.hpp>
 #include <boost/scoped_ptr.hpp>
 
 #include "common/logging.h"
 #include "simple-scheduler.h"
 #include "subscription-manager.h"
+#include "util/thrift-util.h"
 
 using namespace std;
 using namespace boost;
@@ -64,6 +66,35 @@ class SimpleSchedulerTest : public testing::Test {
     local_remote_scheduler_.reset(new SimpleScheduler(backends, NULL));
   }
 
+  // Sends local_remote_scheduler_ an update with its backends and a published load of
+  // 'num_fragments' for each of them.
+  void UpdateLoads(const int num_fragments[2][2]) {
+    ServiceStateMap state;
+    ServiceState& service_state = state[""];
+    for (int i = 0; i < 2; ++i) {
+      for (int j = 0; j < 2; ++j) {
+        stringstream host;
+        host << "host_" << i;
+        THostPort& hostport = service_state.membership[i * 2 + j];
+        hostport.ipaddress = host.str();
+        hostport.port = base_port_ + j;
+
+        TBackendLoad load;
+        load.num_fragments = num_fragments[i][j];
+        load.mem_used = 0;
+        load.disk_queue_length = 0;
+        TVersionedObject object;
+        object.service_id = "";
+        object.key = host.str() + ":" + lexical_cast<string>(base_port_ + j);
+        object.type = "load";
+        object.version = 1;
+        EXPECT_TRUE(SerializeThriftMsg(&load, &object.value).ok());
+        service_state.object_updates.push_back(object);
+      }
+    }
+    local_remote_scheduler_->UpdateMembership(state);
+  }
+
   virtual void TearDown() {
     localhost_scheduler_->Close();
     remote_scheduler_->Close();
@@ -137,6 +168,42 @@ TEST_F(SimpleSchedulerTest, NonLocalHost) {
   EXPECT_EQ(hostports.at(4).port, 1000);
 }
 
+TEST_F(SimpleSchedulerTest, LoadedLocalMatches) {
+  // host_1:1000 is busier than host_1:1001, so the data goes to host_1:1001 until the
+  // assignments to it have evened out the load.
+  int num_fragments[2][2] = { { 0, 0 }, { 3, 0 } };
+  UpdateLoads(num_fragments);
+  vector<THostPort> data_locations(3);
+  for (int i = 0; i < 3; ++i) data_locations.at(i).ipaddress = "host_1";
+  SimpleScheduler::HostList hostports;
+  EXPECT_TRUE(local_remote_scheduler_->GetHosts(data_locations, &hostports).ok());
+
+  EXPECT_EQ(3, hostports.size());
+  for (int i = 0; i < 3; ++i) {
+    EXPECT_EQ(hostports.at(i).ipaddress, "host_1");
+    EXPECT_EQ(hostports.at(i).port, 1001);
+  }
+}
+
+TEST_F(SimpleSchedulerTest, LoadedNonLocalHost) {
+  // All of host_0 is busy, so non-local data goes to the idle backend on host_1 until
+  // it is as loaded as the others.
+  int num_fragments[2][2] = { { 2, 2 }, { 2, 0 } };
+  UpdateLoads(num_fragments);
+  vector<THostPort> data_locations(3);
+  for (int i = 0; i < 3; ++i) data_locations.at(i).ipaddress = "non exists ipaddress";
+  SimpleScheduler::HostList hostports;
+  EXPECT_TRUE(local_remote_scheduler_->GetHosts(data_locations, &hostports).ok());
+
+  EXPECT_EQ(3, hostports.size());
+  EXPECT_EQ(hostports.at(0).ipaddress, "host_1");
+  EXPECT_EQ(hostports.at(0).port, 1001);
+  EXPECT_EQ(hostports.at(1).ipaddress, "host_1");
+  EXPECT_EQ(hostports.at(1).port, 1001);
+  // All backends now have a load of 2.
+  EXPECT_EQ(hostports.at(2).ipaddress, "host_0");
+}
+
  TEST_F(SimpleSchedulerTest, CleanShutdownWithoutInit) {
    SubscriptionManager subscription_manager;
    SimpleScheduler simple_scheduler(&subscription_manager, "dummy_service_id", NULL);
@@ -21,6 +21,7 @@
 #include <boost/foreach.hpp>
 
 #include "util/metrics.h"
+#include "util/thrift-util.h"
 #include "runtime/coordinator.h"
 #include "runtime/exec-env.h"
 
@@ -42,6 +43,17 @@ static const string SCHEDULER_INIT_KEY("simple-scheduler.initialized");
 
 static const string SUBSCRIPTION_ID("simple.scheduler");
 
+// Type of the TVersionedObjects that hold a serialized TBackendLoad.
+static const string LOAD_OBJECT_TYPE("load");
+
+static const int64_t BYTES_PER_LOAD_UNIT = 1024L * 1024L * 1024L;
+
+static string BackendKey(const string& ipaddress, int port) {
+  stringstream ss;
+  ss << ipaddress << ":" << port;
+  return ss.str();
+}
+
 SimpleScheduler::SimpleScheduler(SubscriptionManager* subscription_manager,
     const ServiceId& backend_service_id, Metrics* metrics)
   : metrics_(metrics),
@@ -104,6 +116,7 @@ void SimpleScheduler::UpdateMembership(const ServiceStateMap& service_state) {
   lock_guard<mutex> lock(host_map_lock_);
   VLOG(4) << "Received update from subscription manager" << endl;
   host_map_.clear();
+  backend_loads_.clear();
   ServiceStateMap::const_iterator it = service_state.find(backend_service_id_);
   if (it != service_state.end()) {
     VLOG(4) << "Found membership information for " << backend_service_id_;
@@ -116,6 +129,18 @@ void SimpleScheduler::UpdateMembership(const ServiceStateMap& service_state) {
       }
       host_it->second.push_back(member.second.port);
     }
+    BOOST_FOREACH(const TVersionedObject& object, service_state.object_updates) {
+      if (object.type != LOAD_OBJECT_TYPE) continue;
+      TBackendLoad load;
+      Status status = impala::DeserializeThriftMsg(object.value, &load);
+      if (!status.ok()) {
+        LOG(WARNING) << "Could not read the load of " << object.key << ": "
+                     << status.GetErrorMsg();
+        continue;
+      }
+      backend_loads_[object.key] = load.num_fragments + load.disk_queue_length +
+          load.mem_used / BYTES_PER_LOAD_UNIT;
+    }
   } else {
     VLOG(4) << "No membership information found.";
   }
@@ -134,25 +159,18 @@ Status SimpleScheduler::GetHosts(
   for (int i = 0; i < data_locations.size(); ++i) {
     HostMap::iterator entry = host_map_.find(data_locations[i].ipaddress);
     if (entry == host_map_.end()) {
-      // round robin the ipaddress
-      entry = next_nonlocal_host_entry_;
-      ++next_nonlocal_host_entry_;
-      if (next_nonlocal_host_entry_ == host_map_.end()) {
-        next_nonlocal_host_entry_ = host_map_.begin();
-      }
+      entry = PickNonLocalHost();
     } else {
       ++num_local_assignments;
     }
-    DCHECK(!entry->second.empty());
-    // Round-robin between impalads on the same ipaddress.
-    // Pick the first one, then move it to the back of the queue
-    int port = entry->second.front();
+    int64_t load;
     THostPort hostport;
     hostport.ipaddress = entry->first;
-    hostport.port = port;
+    hostport.port = PickPort(entry, &load);
     hostports->push_back(hostport);
-    entry->second.pop_front();
-    entry->second.push_back(port);
+    if (!backend_loads_.empty()) {
+      backend_loads_[BackendKey(hostport.ipaddress, hostport.port)] = load + 1;
+    }
   }
 
   if (metrics_ != NULL) {
@@ -181,6 +199,59 @@ Status SimpleScheduler::GetHosts(
   return Status::OK;
 }
 
+int64_t SimpleScheduler::GetLoad(const string& ipaddress, int port) const {
+  BackendLoads::const_iterator load = backend_loads_.find(BackendKey(ipaddress, port));
+  return load == backend_loads_.end() ? 0 : load->second;
+}
+
+int SimpleScheduler::PickPort(HostMap::iterator entry, int64_t* load) {
+  list<int>& ports = entry->second;
+  DCHECK(!ports.empty());
+  // Round-robin between impalads of the same load on the same ipaddress: pick the
+  // first one, then move it to the back of the queue.
+  list<int>::iterator best = ports.begin();
+  *load = GetLoad(entry->first, *best);
+  if (!backend_loads_.empty()) {
+    for (list<int>::iterator it = ports.begin(); it != ports.end(); ++it) {
+      int64_t port_load = GetLoad(entry->first, *it);
+      if (port_load < *load) {
+        best = it;
+        *load = port_load;
+      }
+    }
+  }
+  int port = *best;
+  ports.erase(best);
+  ports.push_back(port);
+  return port;
+}
+
+SimpleScheduler::HostMap::iterator SimpleScheduler::PickNonLocalHost() {
+  // Round robin the ipaddress, skipping hosts that are more loaded than others.
+  HostMap::iterator best = next_nonlocal_host_entry_;
+  if (!backend_loads_.empty()) {
+    int64_t best_load = -1;
+    HostMap::iterator entry = next_nonlocal_host_entry_;
+    for (int i = 0; i < host_map_.size(); ++i) {
+      int64_t host_load = -1;
+      BOOST_FOREACH(int port, entry->second) {
+        int64_t port_load = GetLoad(entry->first, port);
+        if (host_load == -1 || port_load < host_load) host_load = port_load;
+      }
+      if (best_load == -1 || host_load < best_load) {
+        best = entry;
+        best_load = host_load;
+      }
+      if (++entry == host_map_.end()) entry = host_map_.begin();
+    }
+  }
+  next_nonlocal_host_entry_ = best;
+  if (++next_nonlocal_host_entry_ == host_map_.end()) {
+    next_nonlocal_host_entry_ = host_map_.begin();
+  }
+  return best;
+}
+
 void SimpleScheduler::GetAllKnownHosts(HostList* hostports) {
   lock_guard<mutex> lock(host_map_lock_);
   hostports->clear();
@@ -207,6 +278,7 @@ void SimpleScheduler::Close() {
   subscription_id_ = INVALID_SUBSCRIPTION_ID;
   subscription_manager_ = NULL;
   host_map_.clear();
+  backend_loads_.clear();
 }
 
 }
@@ -55,6 +55,9 @@ class SimpleScheduler : public Scheduler {
   // a round robin fashion and insert it into hostports.
   // If no match is found for a data location, assign the data location in round-robin
   // order to any of the backends.
+  // If the backends publish their load (see BackendLoads), the least loaded matching
+  // backend, or for non-local data the least loaded backend, is chosen instead, with
+  // round robin among backends of equal load.
   // If the set of available hosts is updated between calls, round-robin state is reset.
   virtual impala::Status GetHosts(const HostList& data_locations, HostList* hostports);
 
@@ -82,6 +85,14 @@ class SimpleScheduler : public Scheduler {
   // round robin entry in HostMap for non-local host assignment
   HostMap::iterator next_nonlocal_host_entry_;
 
+  // Load of each backend, keyed by "ipaddress:port", from the TBackendLoad that it last
+  // published: each running fragment, queued disk request and GB of memory in use
+  // counts as one.  Every assignment adds one until the next update, so that the
+  // ranges of a query don't all go to the same backend.  Empty if no backend published
+  // its load.  Protected by host_map_lock_.
+  typedef boost::unordered_map<std::string, int64_t> BackendLoads;
+  BackendLoads backend_loads_;
+
   // Pointer to a subscription manager (which we do not own) which is used to register
   // for dynamic updates to the set of available backends. May be NULL if the set of
   // backends is fixed.
@@ -105,6 +116,18 @@ class SimpleScheduler : public Scheduler {
 
   // Called asynchronously when an update is received from the subscription manager
   void UpdateMembership(const ServiceStateMap& service_state);
+
+  // Returns the load of the backend at ipaddress:port; 0 if it is unknown.
+  int64_t GetLoad(const std::string& ipaddress, int port) const;
+
+  // Returns the port of the least loaded backend on 'entry''s host, the first port if
+  // there is no load information, and moves it to the back of the host's ports.
+  int PickPort(HostMap::iterator entry, int64_t* load);
+
+  // Returns the host for data that is not local to any backend.
+  HostMap::iterator PickNonLocalHost();
+
+  friend class SimpleSchedulerTest;
 };
 
 }
@@ -197,35 +197,78 @@ Status StateStoreSubscriber::UnregisterSubscription(const SubscriptionId& id) {
 void StateStoreSubscriber::UpdateState(TUpdateStateResponse& response,
                                        const TUpdateStateRequest& request) {
   RETURN_IF_UNSET(request, service_memberships, response);
-
-  ServiceStateMap state;
-  StateFromThrift(request, &state);
   failure_detector_->UpdateHeartbeat(state_store_host_port_.ipaddress, true);
 
+  lock_guard<mutex> l(lock_);
+
+  // A delta update only contains the services that changed.
+  if (!request.__isset.is_delta || !request.is_delta) {
+    state_.clear();
+    membership_versions_.clear();
+  }
+  bool needs_full_update = false;
+  BOOST_FOREACH(const TServiceMembership& membership, request.service_memberships) {
+    ServiceState& service_state = state_[membership.service_id];
+    if (!ApplyMembershipUpdate(membership, &service_state.membership,
+                               &membership_versions_[membership.service_id])) {
+      needs_full_update = true;
+    }
+    // Services without instances are left out, as in a full update.
+    if (service_state.membership.empty()) state_.erase(membership.service_id);
+  }
+  if (needs_full_update) {
+    // Don't pass on a state that is missing changes.
+    LOG(INFO) << "Received a delta for a different version; requesting the full state";
+    response.__set_needs_full_update(true);
+    RETURN_AND_SET_STATUS_OK(response);
+  }
+
+  // The objects are always sent in full, and replace the previous ones.
+  if (request.__isset.updated_objects) {
+    BOOST_FOREACH(ServiceStateMap::value_type& service_state, state_) {
+      service_state.second.object_updates.clear();
+    }
+    BOOST_FOREACH(const TVersionedObject& object, request.updated_objects) {
+      ServiceStateMap::iterator it = state_.find(object.service_id);
+      if (it != state_.end()) it->second.object_updates.push_back(object);
+    }
+  }
+
   // Log all of the new state we just got.
   stringstream new_state;
-  BOOST_FOREACH(const ServiceStateMap::value_type& service_state, state) {
+  BOOST_FOREACH(const ServiceStateMap::value_type& service_state, state_) {
     new_state << "State for service " << service_state.first << ":\n" << "Membership: ";
     BOOST_FOREACH(const Membership::value_type& instance,
                   service_state.second.membership) {
       new_state << instance.second.ipaddress << ":" << instance.second.port
                 << " (at subscriber " << instance.first << "),";
     }
+    new_state << "\nObjects: ";
+    BOOST_FOREACH(const TVersionedObject& object, service_state.second.object_updates) {
+      new_state << object.key << " (" << object.type << " v" << object.version << "),";
+    }
     new_state << "\n";
-    // TODO: Log object updates here too, once we include them.
   }
   VLOG(4) << "Received new state:\n" << new_state.str();
 
-  lock_guard<mutex> l(lock_);
-
   BOOST_FOREACH(UpdateCallbacks::value_type& update, update_callbacks_) {
     DCHECK(update.second->currently_registered_);
-    update.second->callback_function_(state);
+    update.second->callback_function_(state_);
   }
 
+  if (!object_callback_.empty()) {
+    object_callback_(&response.updated_objects);
+    response.__isset.updated_objects = true;
+  }
   RETURN_AND_SET_STATUS_OK(response);
 }
 
+void StateStoreSubscriber::SetObjectCallback(
+    const SubscriptionManager::ObjectCallbackFunction& object_callback) {
+  lock_guard<mutex> l(lock_);
+  object_callback_ = object_callback;
+}
+
 Status StateStoreSubscriber::Start() {
   shared_ptr<TProcessor> processor(
       new StateStoreSubscriberServiceProcessor(shared_from_this()));
@@ -101,6 +101,11 @@ class StateStoreSubscriber
   // Unregisters an instance of the given service type with the state store.
   virtual impala::Status UnregisterService(const ServiceId& service_id);
 
+  // Sets the function that collects the objects to publish with every response to
+  // the state store.
+  void SetObjectCallback(
+      const SubscriptionManager::ObjectCallbackFunction& object_callback);
+
   // StateStoreSubscriberServiceIf implementation
 
   // Implements the UpdateState() method of the thrift StateStateSubscriberServiceIf.
@@ -152,6 +157,14 @@ class StateStoreSubscriber
   typedef boost::unordered_map<ServiceId, impala::THostPort> ServiceRegistrations;
   ServiceRegistrations services_;
 
+  // State of the subscribed services as of the last update from the state store, and
+  // the version of each service's membership.  Delta updates are applied to these.
+  ServiceStateMap state_;
+  boost::unordered_map<ServiceId, int64_t> membership_versions_;
+
+  // Collects the objects published by the local services; may be empty.
+  SubscriptionManager::ObjectCallbackFunction object_callback_;
+
   // Thread in which RecoveryModeChecker runs. 
   boost::scoped_ptr<boost::thread> recovery_mode_thread_;
 
@@ -709,6 +709,53 @@ TEST_F(StateStoreTest, SubscriberFailure) {
   }
 };
 
+static TServiceInstance MakeInstance(SubscriberId id, int port) {
+  TServiceInstance instance;
+  instance.subscriber_id = id;
+  instance.host_port.ipaddress = "127.0.0.1";
+  instance.host_port.port = port;
+  return instance;
+}
+
+TEST(MembershipUpdateTest, ApplyDelta) {
+  Membership membership;
+  int64_t version = 0;
+
+  TServiceMembership full;
+  full.service_id = "test_service";
+  full.service_instances.push_back(MakeInstance(0, 1000));
+  full.service_instances.push_back(MakeInstance(1, 1001));
+  full.__set_version(2);
+  EXPECT_TRUE(ApplyMembershipUpdate(full, &membership, &version));
+  EXPECT_EQ(membership.size(), 2);
+  EXPECT_EQ(version, 2);
+
+  TServiceMembership delta;
+  delta.service_id = "test_service";
+  delta.service_instances.push_back(MakeInstance(2, 1002));
+  delta.removed_subscriber_ids.push_back(0);
+  delta.__set_version(4);
+  delta.__set_is_delta(true);
+  delta.__set_base_version(2);
+  EXPECT_TRUE(ApplyMembershipUpdate(delta, &membership, &version));
+  EXPECT_EQ(version, 4);
+  EXPECT_EQ(membership.size(), 2);
+  EXPECT_TRUE(membership.find(0) == membership.end());
+  EXPECT_EQ(membership[2].port, 1002);
+
+  // A delta from a version the subscriber doesn't have is rejected.
+  delta.__set_base_version(3);
+  delta.__set_version(5);
+  EXPECT_FALSE(ApplyMembershipUpdate(delta, &membership, &version));
+  EXPECT_EQ(version, 4);
+  EXPECT_EQ(membership.size(), 2);
+
+  // A full update replaces the membership.
+  EXPECT_TRUE(ApplyMembershipUpdate(full, &membership, &version));
+  EXPECT_EQ(membership.size(), 2);
+  EXPECT_TRUE(membership.find(2) == membership.end());
+}
+
 } // namespace sparrow
 
 int main(int argc, char **argv) {
@@ -15,6 +15,7 @@
 #include "sparrow/state-store.h"
 
 #include <exception>
+#include <map>
 #include <utility>
 #include <sstream>
 #include <vector>
@@ -33,6 +34,7 @@
 #include "util/thrift-server.h"
 #include "util/thrift-client.h"
 #include "util/thrift-util.h"
+#include "util/thread-pool.h"
 #include "util/container-util.h"
 #include "util/webserver.h"
 #include "sparrow/failure-detector.h"
@@ -63,6 +65,11 @@ DEFINE_int32(statestore_num_server_worker_threads, 4,
 DEFINE_int32(statestore_max_missed_heartbeats, 5, "Maximum number of consecutive "
              "heartbeats an impalad can miss before being declared failed by the "
              "state-store.");
+DEFINE_int32(statestore_num_update_threads, 10, "Number of threads that send updates "
+             "to subscribers.  Each thread blocks on one subscriber's update at a time.");
+DEFINE_int32(statestore_update_timeout_ms, 10000, "Timeout for connecting to, and "
+             "sending an update to, a subscriber.  A subscriber that does not respond in "
+             "time misses a heartbeat.  0 means no timeout.");
 DEFINE_int32(statestore_suspect_heartbeats, 2, "(Advanced) Number of consecutive "
              "heartbeats an impalad can miss before being suspected of failure by the "
              "state-store");
@@ -130,6 +137,8 @@ void StateStore::RegisterService(TRegisterServiceResponse& response,
   if (membership.find(subscriber.id()) == membership.end()) {
     membership.insert(make_pair(subscriber.id(), request.service_address));
     subscriber.AddService(request.service_id);
+    AddMembershipChange(request.service_id, subscriber.id(), true,
+                        request.service_address);
     LOG(INFO) << "Registered service instance (id: "
               << request.service_id << ", for: "
               << request.service_address.hostname << "("
@@ -174,6 +183,8 @@ Status StateStore::UnregisterServiceInternal(const THostPort& address,
       stringstream ss;
       ss << instance->second.ipaddress << ":" << instance->second.port;
       backend_set_metric_->Remove(ss.str());
+      AddMembershipChange(service_id, subscriber.id(), false, instance->second);
+      RemoveObjects(service_id, subscriber.id());
 
       membership.erase(instance);
       if (membership.empty()) {
@@ -318,6 +329,7 @@ void StateStore::Start(int port) {
       metrics_->RegisterMetric(new MapMetric<string, string>(
             STATESTORE_SUBSCRIBER_STATE_MAP, map<string, string>()));
 
+  update_pool_.reset(new ThreadPool(FLAGS_statestore_num_update_threads));
   set_is_updating(true);
   update_thread_.reset(new thread(&StateStore::UpdateLoop, this));
 
@@ -338,6 +350,8 @@ void StateStore::Stop() {
   if (update_thread_.get() != NULL) {
     update_thread_->join();
   }
+  // Waits for the updates that are still in flight.
+  update_pool_.reset();
 }
 
 void StateStore::WaitForServerToStop() {
@@ -346,6 +360,9 @@ void StateStore::WaitForServerToStop() {
 
 void StateStore::Subscriber::Init(const THostPort& address) {
   client_.reset(new SubscriberClient(address.hostname, address.port));
+  if (FLAGS_statestore_update_timeout_ms > 0) {
+    client_->SetTimeouts(FLAGS_statestore_update_timeout_ms);
+  }
 }
 
 void StateStore::Subscriber::AddService(const ServiceId& service_id) {
@@ -388,6 +405,7 @@ bool StateStore::Subscriber::RemoveSubscription(SubscriptionId id) {
       --service_subscription_count->second;
       if (service_subscription_count->second == 0) {
         service_subscription_counts_.erase(service_subscription_count);
+        acked_versions_.erase(service_id);
       }
     }
     subscriptions_.erase(subscription);
@@ -430,66 +448,29 @@ void StateStore::UpdateLoop() {
   while (is_updating()) {
     GenerateUpdates(&subscriber_updates);
 
-    // Update each subscriber with the latest state.
-    // TODO: Make this multithreaded.
-    BOOST_FOREACH(SubscriberUpdate& update, subscriber_updates) {
-      string address;
-      THostPortToString(update.subscriber_address, &address);
-      // Will be set in the following if-else block
-      FailureDetector::PeerState peer_state = FailureDetector::FAILED;
-
-      // Open the transport here so that we keep retrying if we don't succeed on the
-      // first attempt to open a connection.
-      Status status = update.client->Open();
-      if (!status.ok()) {
-        // Log failure messages only when peer state is OK; once it is FAILED or
-        // SUSPECTED suppress messages to avoid log spam.
-        if (failure_detector_->GetPeerState(address) == FailureDetector::OK) {
-          LOG(INFO) << "Unable to update client at " << update.client->ipaddress()
-                    << ":" << update.client->port() << "; received error "
-                    << status.GetErrorMsg();
-        }
-
-        peer_state = failure_detector_->UpdateHeartbeat(address, false);
-      } else {      
-        TUpdateStateResponse response;
-        try {
-          update.client->iface()->UpdateState(response, update.request);
-          if (response.status.status_code != TStatusCode::OK) {
-            Status status(response.status);
-            LOG(WARNING) << status.GetErrorMsg();
-            peer_state = failure_detector_->UpdateHeartbeat(address, false);
-          } else {
-            peer_state = failure_detector_->UpdateHeartbeat(address, true);
-          }
-          
-        } catch (TTransportException& e) {
-          LOG(INFO) << "Unable to update client at " << update.client 
-                    << "; received error " << e.what();
-          peer_state = failure_detector_->UpdateHeartbeat(address, false);
-        } catch (std::exception& e) {
-          // Make sure Thrift isn't throwing any other exceptions.
-          DCHECK(false) << e.what();
-        }
+    // Hand each update to the update pool.  A subscriber whose previous update is
+    // still in flight is skipped this round and counts as having missed a heartbeat;
+    // its next update is regenerated from the versions it has acknowledged, so no
+    // changes are lost.
+    BOOST_FOREACH(const SubscriberUpdate& update, subscriber_updates) {
+      bool in_flight;
+      {
+        lock_guard<mutex> l(in_flight_lock_);
+        in_flight = !in_flight_updates_.insert(update.subscriber_address).second;
       }
-
-      subscriber_state_metric_->Add(address, 
-                                    FailureDetector::PeerStateToString(peer_state));
-
-      if (peer_state == FailureDetector::FAILED) {
-        LOG(INFO) << "Subscriber at " << address << " has failed, and will be removed.";
-        Status status = UnregisterSubscriberCompletely(update.subscriber_address);
-        if (!status.ok()) {
-          // Should never happen; if the subscriber was removed concurrently
-          // status will be OK and otherwise lock_ is held during
-          // UnregisterSusbcriberCompletely, so this signifies a concurrency bug.
-          // We can recover from it but it might leave zombie subscriptions around. 
-          LOG(ERROR) << "Could not unregister subscriber on failure: " 
-                     << status.GetErrorMsg();
-        }
+      if (!in_flight) {
+        update_pool_->Offer(bind<void>(mem_fn(&StateStore::SendUpdate), this, update));
+        continue;
       }
+      string address;
+      THostPortToString(update.subscriber_address, &address);
+      VLOG(1) << "Skipping update of subscriber at " << address
+              << ": previous update still in flight";
+      FailureDetector::PeerState peer_state =
+          failure_detector_->UpdateHeartbeat(address, false);
+      UpdatePeerState(update.subscriber_address, address, peer_state);
     }
-    
+
     if (get_system_time() < next_update_time && is_updating()) {
       posix_time::time_duration duration = next_update_time - get_system_time();
       usleep(duration.total_microseconds());
@@ -499,35 +480,263 @@ void StateStore::UpdateLoop() {
   }
 }
 
+void StateStore::SendUpdate(const SubscriberUpdate& update) {
+  string address;
+  THostPortToString(update.subscriber_address, &address);
+  // Will be set in the following if-else block
+  FailureDetector::PeerState peer_state = FailureDetector::FAILED;
+
+  // Open the transport here so that we keep retrying if we don't succeed on the
+  // first attempt to open a connection.
+  Status status = update.client->Open();
+  if (!status.ok()) {
+    // Log failure messages only when peer state is OK; once it is FAILED or
+    // SUSPECTED suppress messages to avoid log spam.
+    if (failure_detector_->GetPeerState(address) == FailureDetector::OK) {
+      LOG(INFO) << "Unable to update client at " << update.client->ipaddress()
+                << ":" << update.client->port() << "; received error "
+                << status.GetErrorMsg();
+    }
+
+    peer_state = failure_detector_->UpdateHeartbeat(address, false);
+  } else {
+    TUpdateStateResponse response;
+    try {
+      update.client->iface()->UpdateState(response, update.request);
+      if (response.status.status_code != TStatusCode::OK) {
+        Status status(response.status);
+        LOG(WARNING) << status.GetErrorMsg();
+        peer_state = failure_detector_->UpdateHeartbeat(address, false);
+      } else {
+        AcknowledgeUpdate(update, response.__isset.needs_full_update &&
+                          response.needs_full_update);
+        if (response.__isset.updated_objects) {
+          StoreObjects(update, response.updated_objects);
+        }
+        peer_state = failure_detector_->UpdateHeartbeat(address, true);
+      }
+    } catch (TTransportException& e) {
+      LOG(INFO) << "Unable to update client at " << address
+                << "; received error " << e.what();
+      // The connection may be in an unknown state, e.g. after a timeout, so reopen
+      // it for the next update.
+      update.client->Close();
+      peer_state = failure_detector_->UpdateHeartbeat(address, false);
+    } catch (std::exception& e) {
+      // Make sure Thrift isn't throwing any other exceptions.
+      DCHECK(false) << e.what();
+    }
+  }
+
+  UpdatePeerState(update.subscriber_address, address, peer_state);
+
+  lock_guard<mutex> l(in_flight_lock_);
+  in_flight_updates_.erase(update.subscriber_address);
+}
+
+void StateStore::UpdatePeerState(const THostPort& subscriber_address,
+                                 const string& address,
+                                 FailureDetector::PeerState peer_state) {
+  subscriber_state_metric_->Add(address, FailureDetector::PeerStateToString(peer_state));
+
+  if (peer_state == FailureDetector::FAILED) {
+    LOG(INFO) << "Subscriber at " << address << " has failed, and will be removed.";
+    Status status = UnregisterSubscriberCompletely(subscriber_address);
+    if (!status.ok()) {
+      // Should never happen; if the subscriber was removed concurrently
+      // status will be OK and otherwise lock_ is held during
+      // UnregisterSusbcriberCompletely, so this signifies a concurrency bug.
+      // We can recover from it but it might leave zombie subscriptions around. 
+      LOG(ERROR) << "Could not unregister subscriber on failure: " 
+                 << status.GetErrorMsg();
+    }
+  }
+}
+
 void StateStore::GenerateUpdates(vector<StateStore::SubscriberUpdate>* updates) {
   lock_guard<recursive_mutex> lock(lock_);
   updates->clear();
 
+  // Oldest version that a subscriber of each service has acknowledged
+  unordered_map<ServiceId, int64_t> min_acked_versions;
+
   // For each subscriber, generate the corresponding SubscriberUpdate (and fill in the
   // TUpdateRequest).
   BOOST_FOREACH(Subscribers::value_type& subscriber, subscribers_) {
     updates->push_back(SubscriberUpdate(subscriber.first, &subscriber.second));
     SubscriberUpdate& subscriber_update = updates->back();
+    const Subscriber::MembershipVersions& acked_versions =
+        *subscriber.second.acked_versions();
     BOOST_FOREACH(
         const Subscriber::ServiceSubscriptionCounts::value_type& service_subscription,
         subscriber.second.service_subscription_counts()) {
       const ServiceId& service_id = service_subscription.first;
-      // Check if any instances exist for the service described by service_subscription,
-      // and if they do, add them to the request.
-      ServiceMemberships::iterator service_membership =
-          service_instances_.find(service_id);
-      if (service_membership != service_instances_.end()) {
-        // Add the membership information for the given service. Add an empty membership
-        // and then modify it, to avoid copying all membership information twice.
-        subscriber_update.request.service_memberships.push_back(TServiceMembership());
-        TServiceMembership& new_membership =
-            subscriber_update.request.service_memberships.back();
-        MembershipToThrift(service_membership->second,
-                           &new_membership.service_instances);
-        new_membership.service_id = service_id;
+      // Services that never had an instance have no membership to send.
+      MembershipLogs::iterator log = membership_logs_.find(service_id);
+      if (log == membership_logs_.end()) continue;
+      Subscriber::MembershipVersions::const_iterator acked =
+          acked_versions.find(service_id);
+      int64_t acked_version = acked == acked_versions.end() ? 0 : acked->second;
+      unordered_map<ServiceId, int64_t>::iterator min_acked =
+          min_acked_versions.find(service_id);
+      if (min_acked == min_acked_versions.end()) {
+        min_acked_versions[service_id] = acked_version;
+      } else if (acked_version < min_acked->second) {
+        min_acked->second = acked_version;
       }
+      // Nothing to send if the subscriber is up to date.
+      if (acked_version == log->second.version) continue;
+
+      // Add an empty membership and then modify it, to avoid copying all membership
+      // information twice.
+      subscriber_update.request.service_memberships.push_back(TServiceMembership());
+      TServiceMembership& new_membership =
+          subscriber_update.request.service_memberships.back();
+      new_membership.service_id = service_id;
+      new_membership.__set_version(log->second.version);
+      if (!GetMembershipDelta(log->second, acked_version, &new_membership)) {
+        ServiceMemberships::iterator service_membership =
+            service_instances_.find(service_id);
+        if (service_membership != service_instances_.end()) {
+          MembershipToThrift(service_membership->second,
+                             &new_membership.service_instances);
+        }
+      }
+      subscriber_update.versions[service_id] = log->second.version;
     }
+    BOOST_FOREACH(
+        const Subscriber::ServiceSubscriptionCounts::value_type& service_subscription,
+        subscriber.second.service_subscription_counts()) {
+      ServiceObjects::const_iterator objects =
+          service_objects_.find(service_subscription.first);
+      if (objects == service_objects_.end()) continue;
+      typedef map<string, PublishedObject> ObjectMap;
+      BOOST_FOREACH(const ObjectMap::value_type& object, objects->second) {
+        subscriber_update.request.updated_objects.push_back(object.second.object);
+      }
+    }
+    subscriber_update.request.__isset.updated_objects = true;
     subscriber_update.request.__isset.service_memberships = true;
+    subscriber_update.request.__set_is_delta(true);
+  }
+
+  // Drop the changes that every subscriber has acknowledged.
+  BOOST_FOREACH(MembershipLogs::value_type& log, membership_logs_) {
+    unordered_map<ServiceId, int64_t>::iterator min_acked =
+        min_acked_versions.find(log.first);
+    int64_t min_acked_version =
+        min_acked == min_acked_versions.end() ? log.second.version : min_acked->second;
+    deque<MembershipChange>& changes = log.second.changes;
+    while (!changes.empty() && changes.front().version <= min_acked_version) {
+      changes.pop_front();
+    }
+  }
+}
+
+void StateStore::AddMembershipChange(const ServiceId& service_id,
+                                     SubscriberId subscriber_id, bool added,
+                                     const THostPort& address) {
+  MembershipLog& log = membership_logs_[service_id];
+  MembershipChange change;
+  change.version = ++log.version;
+  change.subscriber_id = subscriber_id;
+  change.added = added;
+  change.address = address;
+  log.changes.push_back(change);
+}
+
+bool StateStore::GetMembershipDelta(const MembershipLog& log, int64_t base_version,
+                                    TServiceMembership* membership) {
+  // A subscriber without a version needs the full membership.
+  if (base_version == 0 || log.changes.empty() ||
+      log.changes.front().version > base_version + 1) {
+    return false;
+  }
+  // Only the last change to each instance matters.
+  map<SubscriberId, const MembershipChange*> last_changes;
+  BOOST_FOREACH(const MembershipChange& change, log.changes) {
+    if (change.version > base_version) last_changes[change.subscriber_id] = &change;
+  }
+  typedef map<SubscriberId, const MembershipChange*> ChangeMap;
+  BOOST_FOREACH(const ChangeMap::value_type& change, last_changes) {
+    if (change.second->added) {
+      TServiceInstance instance;
+      instance.subscriber_id = change.first;
+      instance.host_port = change.second->address;
+      membership->service_instances.push_back(instance);
+    } else {
+      membership->removed_subscriber_ids.push_back(change.first);
+    }
+  }
+  membership->__isset.removed_subscriber_ids = true;
+  membership->__set_is_delta(true);
+  membership->__set_base_version(base_version);
+  return true;
+}
+
+void StateStore::AcknowledgeUpdate(const SubscriberUpdate& update,
+                                   bool needs_full_update) {
+  lock_guard<recursive_mutex> lock(lock_);
+  // The subscriber may have been removed, or replaced, since the update was generated.
+  Subscribers::iterator subscriber = subscribers_.find(update.subscriber_address);
+  if (subscriber == subscribers_.end() ||
+      subscriber->second.id() != update.subscriber_id) {
+    return;
+  }
+  Subscriber::MembershipVersions* acked_versions = subscriber->second.acked_versions();
+  if (needs_full_update) {
+    acked_versions->clear();
+    return;
+  }
+  const Subscriber::ServiceSubscriptionCounts& subscriptions =
+      subscriber->second.service_subscription_counts();
+  typedef map<ServiceId, int64_t> VersionMap;
+  BOOST_FOREACH(const VersionMap::value_type& version, update.versions) {
+    if (subscriptions.find(version.first) == subscriptions.end()) continue;
+    (*acked_versions)[version.first] = version.second;
+  }
+}
+
+void StateStore::RemoveObjects(const ServiceId& service_id, SubscriberId owner) {
+  ServiceObjects::iterator service_objects = service_objects_.find(service_id);
+  if (service_objects == service_objects_.end()) return;
+  map<string, PublishedObject>& published = service_objects->second;
+  map<string, PublishedObject>::iterator object = published.begin();
+  while (object != published.end()) {
+    if (object->second.owner == owner) {
+      published.erase(object++);
+    } else {
+      ++object;
+    }
+  }
+  if (published.empty()) service_objects_.erase(service_objects);
+}
+
+void StateStore::StoreObjects(const SubscriberUpdate& update,
+                              const vector<TVersionedObject>& objects) {
+  lock_guard<recursive_mutex> lock(lock_);
+  Subscribers::iterator subscriber = subscribers_.find(update.subscriber_address);
+  if (subscriber == subscribers_.end() ||
+      subscriber->second.id() != update.subscriber_id) {
+    return;
+  }
+  const unordered_set<ServiceId>& service_ids = subscriber->second.service_ids();
+  SubscriberId owner = update.subscriber_id;
+  // Drop what the subscriber published before, so that objects it no longer
+  // publishes go away.
+  BOOST_FOREACH(const ServiceId& service_id, service_ids) {
+    RemoveObjects(service_id, owner);
+  }
+  BOOST_FOREACH(const TVersionedObject& object, objects) {
+    if (service_ids.find(object.service_id) == service_ids.end()) {
+      VLOG(1) << "Ignoring object " << object.key << " of service "
+              << object.service_id << " from subscriber " << update.subscriber_address
+              << ", which has no instance of it";
+      continue;
+    }
+    PublishedObject& published = service_objects_[object.service_id][object.key];
+    published.owner = owner;
+    published.object = object;
   }
 }
 
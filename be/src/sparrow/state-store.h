@@ -16,6 +16,8 @@
 #ifndef SPARROW_STATE_STORE_H
 #define SPARROW_STATE_STORE_H
 
+#include <deque>
+#include <map>
 #include <string>
 
 #include <boost/enable_shared_from_this.hpp>
@@ -40,6 +42,7 @@
 namespace impala {
 
 class Status;
+class ThreadPool;
 class THostPort;
 class Webserver;
 }
@@ -53,8 +56,13 @@ class StateStoreTest;
 // both membership information about the instances of each service, and generic
 // versioned key-value pairs. The StateStoreServiceIf interface implementation is thread
 // safe.
-// TODO: Send membership changes as a delta, rather than a full update.
-// TODO: Add versioned objects to the state store.
+// Each service's membership is versioned, and the state store remembers the version
+// that each subscriber last acknowledged.  An update only contains the services that
+// changed since then, and for each of those only the instances that were added or
+// removed, as long as the changes since the acknowledged version are still logged.
+// The instances of a service may also publish versioned objects (e.g. their load) in
+// their responses to updates.  These are kept until the instance is unregistered, and
+// every update has all current objects of the subscribed services.
 class StateStore : public StateStoreServiceIf,
                    public boost::enable_shared_from_this<StateStore> {
  public:
@@ -101,6 +109,10 @@ class StateStore : public StateStoreServiceIf,
     // Count of the number of registered subscriptions for each service id.
     typedef boost::unordered_map<ServiceId, int> ServiceSubscriptionCounts;
 
+    // Version of the membership of each subscribed service that the subscriber has
+    // acknowledged.  Services that are missing are sent in full.
+    typedef boost::unordered_map<ServiceId, int64_t> MembershipVersions;
+
     // Mapping between a subscription id, and a list of service ids for which updates
     // should be pushed.
     typedef boost::unordered_map<SubscriptionId, boost::unordered_set<ServiceId> >
@@ -148,6 +160,8 @@ class StateStore : public StateStoreServiceIf,
       return service_ids_;
     }
 
+    MembershipVersions* acked_versions() { return &acked_versions_; }
+
    private:
 
     // Unique identifier for the subscriber.
@@ -162,6 +176,8 @@ class StateStore : public StateStoreServiceIf,
 
     ServiceSubscriptionCounts service_subscription_counts_;
 
+    MembershipVersions acked_versions_;
+
     // Thrift connection information.
     boost::shared_ptr<SubscriberClient> client_;
   };
@@ -176,14 +192,52 @@ class StateStore : public StateStoreServiceIf,
     boost::shared_ptr<SubscriberClient> client;
     TUpdateStateRequest request;
 
+    // Id of the subscriber, and the membership versions that the request brings it
+    // to, which are acknowledged once the subscriber has applied the request.
+    SubscriberId subscriber_id;
+    std::map<ServiceId, int64_t> versions;
+
     SubscriberUpdate(const impala::THostPort& address, Subscriber* subscriber)
       : subscriber_address(address),
-        client(subscriber->client()) {}
+        client(subscriber->client()),
+        subscriber_id(subscriber->id()) {}
+  };
+
+  // A change to the membership of a service.
+  struct MembershipChange {
+    // Version of the membership after this change
+    int64_t version;
+
+    SubscriberId subscriber_id;
+
+    // True if the instance at 'address' was added, false if the instance was removed.
+    bool added;
+    impala::THostPort address;
+  };
+
+  // The current version of a service's membership, and the changes that led to it that
+  // some subscriber may still need, oldest first.
+  struct MembershipLog {
+    int64_t version;
+    std::deque<MembershipChange> changes;
+
+    MembershipLog() : version(0) {}
   };
+  typedef boost::unordered_map<ServiceId, MembershipLog> MembershipLogs;
 
   // Mapping of service ids to the corresponding membership.
   typedef boost::unordered_map<ServiceId, Membership> ServiceMemberships;
 
+  // An object published by the instance of its service at 'owner'.
+  struct PublishedObject {
+    SubscriberId owner;
+    TVersionedObject object;
+  };
+
+  // The published objects of each service, by key.
+  typedef boost::unordered_map<ServiceId, std::map<std::string, PublishedObject> >
+      ServiceObjects;
+
   // Information about each subscriber, indexed by the address of the subscriber.
   typedef boost::unordered_map<impala::THostPort, Subscriber> Subscribers;
   Subscribers subscribers_;
@@ -199,6 +253,18 @@ class StateStore : public StateStoreServiceIf,
 
   boost::scoped_ptr<boost::thread> update_thread_;
 
+  // Sends the updates generated by update_thread_, so that a slow or unreachable
+  // subscriber only holds up one thread rather than the updates of all other
+  // subscribers.
+  boost::scoped_ptr<impala::ThreadPool> update_pool_;
+
+  // Protects in_flight_updates_.  Never held while taking lock_.
+  boost::mutex in_flight_lock_;
+
+  // Subscribers that have an update queued in, or being sent by, update_pool_.  At
+  // most one update per subscriber is outstanding at a time.
+  boost::unordered_set<impala::THostPort> in_flight_updates_;
+
   boost::scoped_ptr<impala::ThriftServer> server_;
 
   // Protects all following member variables. Recursive because all of the RPC methods
@@ -209,6 +275,12 @@ class StateStore : public StateStoreServiceIf,
   // A set of instances for each service.
   ServiceMemberships service_instances_;
 
+  // The membership log of every service that ever had an instance.
+  MembershipLogs membership_logs_;
+
+  // Objects published by the registered service instances.
+  ServiceObjects service_objects_;
+
   // Next id to use for a StateStoreSubscriber.
   SubscriberId next_subscriber_id_;
 
@@ -238,14 +310,49 @@ class StateStore : public StateStoreServiceIf,
   // not there already, and returns a reference to the Subscriber.
   Subscriber& GetOrCreateSubscriber(const impala::THostPort& host_port);
 
-  // Begins updating all StateStoreSubscriberServices with the new state.  Should be
+  // Begins updating all StateStoreSubscriberServices with the new state, by handing
+  // the updates to update_pool_ every subscriber_update_frequency_ms_.  Should be
   // called in its own thread, because this method blocks until is_updating_ is false.
   void UpdateLoop();
 
+  // Sends 'update' to its subscriber and records the outcome with the failure
+  // detector.  Runs in update_pool_.
+  void SendUpdate(const SubscriberUpdate& update);
+
+  // Records peer_state for the subscriber at subscriber_address (whose string form is
+  // 'address'), and removes the subscriber if it has failed.
+  void UpdatePeerState(const impala::THostPort& subscriber_address,
+                       const std::string& address,
+                       impala::FailureDetector::PeerState peer_state);
+
   // Fills in updates with a SubscriberUpdate (including a filled in TUpdateStateRequest)
-  // for each currently registered subscriber.
+  // for each currently registered subscriber, and trims the membership logs.
   void GenerateUpdates(std::vector<StateStore::SubscriberUpdate>* updates);
 
+  // Records that the instance of service_id at subscriber_id was added or removed.
+  // Must be called with lock_ held.
+  void AddMembershipChange(const ServiceId& service_id, SubscriberId subscriber_id,
+                           bool added, const impala::THostPort& address);
+
+  // Fills in 'membership' with the changes in 'log' since base_version.  Returns false
+  // if these changes are no longer logged.
+  static bool GetMembershipDelta(const MembershipLog& log, int64_t base_version,
+                                 TServiceMembership* membership);
+
+  // Records the versions in 'update' as acknowledged by its subscriber, or forgets all
+  // acknowledged versions if the subscriber needs a full update.
+  void AcknowledgeUpdate(const SubscriberUpdate& update, bool needs_full_update);
+
+  // Stores the objects that the subscriber of 'update' published in its response.
+  // Objects of services that it doesn't have an instance of are ignored, and all
+  // objects it published before for the other services are replaced.
+  void StoreObjects(const SubscriberUpdate& update,
+                    const std::vector<TVersionedObject>& objects);
+
+  // Removes the objects of service_id that were published by 'owner'.  Must be called
+  // with lock_ held.
+  void RemoveObjects(const ServiceId& service_id, SubscriberId owner);
+
   // Removes all subscriptions and registered services for the subscriber with
   // the given address.
   impala::Status UnregisterSubscriberCompletely(const impala::THostPort& address);
@@ -71,6 +71,11 @@ Status SubscriptionManager::UnregisterSubscription(const SubscriptionId& id) {
   return state_store_subscriber_->UnregisterSubscription(id);
 }
 
+void SubscriptionManager::SetObjectCallback(
+    const ObjectCallbackFunction& object_callback) {
+  state_store_subscriber_->SetObjectCallback(object_callback);
+}
+
 Status SubscriptionManager::Start() {
   LOG(INFO) << "Starting subscription manager";
   return state_store_subscriber_->Start();
@@ -17,11 +17,13 @@
 #define SPARROW_SUBSCRIPTION_MANAGER_H
 
 #include <string>
+#include <vector>
 
 #include <boost/function.hpp>
 #include <boost/unordered_set.hpp>
 
 #include "sparrow/util.h"
+#include "gen-cpp/SparrowTypes_types.h"
 
 namespace impala {
 
@@ -41,9 +43,14 @@ class SubscriptionManager {
  public:
   // Function called to update a service with new state. Called in a separate thread to
   // the one in which it is registered.
-  // TODO: Also return object updates using this callback.
   typedef boost::function<void (const ServiceStateMap& state)> UpdateCallbackFunction;
 
+  // Function called at every update from the state store to collect the objects that
+  // the local services publish.  The objects replace those of the previous update, and
+  // are passed on to the subscribers of their service in ServiceState.object_updates.
+  typedef boost::function<void (std::vector<TVersionedObject>* objects)>
+      ObjectCallbackFunction;
+
   // The UpdateCallback class is a lightweight wrappper for UpdateCallbackFunction,
   // which ensures that the callback is not registered with the SubscriptionManager
   // when it is destroyed. If the callback is still registered when it is destroyed, it
@@ -102,6 +109,10 @@ class SubscriptionManager {
   // unregisters the associated callback, so that it will no longer be called.
   impala::Status UnregisterSubscription(const SubscriptionId& id);
 
+  // Sets the function that collects the objects published by this subscriber, replacing
+  // any previous one.  An empty function stops publishing.
+  void SetObjectCallback(const ObjectCallbackFunction& object_callback);
+
   // Starts the underlying server, which receives updates from the StateStore.
   impala::Status Start();
 
@@ -55,6 +55,23 @@ void StateFromThrift(const TUpdateStateRequest& request, ServiceStateMap* state)
   // TODO: Copy object updates and deletions from the request as well.
 }
 
+bool ApplyMembershipUpdate(const TServiceMembership& update, Membership* membership,
+                           int64_t* version) {
+  if (update.__isset.is_delta && update.is_delta) {
+    if (update.base_version != *version) return false;
+    BOOST_FOREACH(SubscriberId id, update.removed_subscriber_ids) {
+      membership->erase(id);
+    }
+  } else {
+    membership->clear();
+  }
+  BOOST_FOREACH(const TServiceInstance& instance, update.service_instances) {
+    (*membership)[instance.subscriber_id] = instance.host_port;
+  }
+  *version = update.version;
+  return true;
+}
+
 void MembershipToThrift(const Membership& from_membership,
                         vector<TServiceInstance>* to_membership) {
   to_membership->clear();
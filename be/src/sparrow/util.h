@@ -67,6 +67,12 @@ typedef boost::unordered_map<std::string, ServiceState> ServiceStateMap;
 // Converts a TUpdateStateRequest to a ServiceStateMap.
 void StateFromThrift(const TUpdateStateRequest& request, ServiceStateMap* state);
 
+// Applies 'update' to 'membership', which has version *version (0 if there is none
+// yet), and sets *version to the update's version.  Returns false and leaves both
+// unchanged if 'update' is a delta from a different version.
+bool ApplyMembershipUpdate(const TServiceMembership& update, Membership* membership,
+                           int64_t* version);
+
 // Converts a Membership to a list of TServiceInstances.
 void MembershipToThrift(const Membership& from_membership,
                         std::vector<TServiceInstance>* to_membership);
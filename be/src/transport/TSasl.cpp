@@ -21,11 +21,53 @@
 #include "config.h"
 #ifdef HAVE_SASL_SASL_H
 
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <transport/TSasl.h>
 
 using namespace std;
 
 namespace sasl {
+
+unsigned TSasl::getNegotiatedSsf() {
+  const sasl_ssf_t* ssf;
+  int result = sasl_getprop(conn, SASL_SSF, (const void**)&ssf);
+  if (result != SASL_OK) {
+    throw SaslException(sasl_errdetail(conn));
+  }
+  return *ssf;
+}
+
+uint32_t TSasl::getMaxWrapSize() {
+  const unsigned* maxOutBuf;
+  int result = sasl_getprop(conn, SASL_MAXOUTBUF, (const void**)&maxOutBuf);
+  if (result != SASL_OK) return 0;
+  return *maxOutBuf;
+}
+
+void TSasl::setSecurityProps(const map<string, string>& props) {
+  if (props.empty()) return;
+  sasl_security_properties_t secprops;
+  memset(&secprops, 0, sizeof(secprops));
+  secprops.min_ssf = 0;
+  secprops.max_ssf = UINT_MAX;
+  secprops.maxbufsize = 64 * 1024;
+  for (map<string, string>::const_iterator it = props.begin(); it != props.end(); ++it) {
+    if (it->first == TSASL_MIN_SSF) {
+      secprops.min_ssf = strtoul(it->second.c_str(), NULL, 10);
+    } else if (it->first == TSASL_MAX_SSF) {
+      secprops.max_ssf = strtoul(it->second.c_str(), NULL, 10);
+    } else {
+      throw SaslException(("Unsupported sasl property: " + it->first).c_str());
+    }
+  }
+  int result = sasl_setprop(conn, SASL_SEC_PROPS, &secprops);
+  if (result != SASL_OK) {
+    throw SaslException(sasl_errdetail(conn));
+  }
+}
+
 uint8_t* TSasl::unwrap(const uint8_t* incoming,
                        const int offset, const uint32_t len, uint32_t* outLen) {
   uint32_t outputlen;
@@ -60,9 +102,6 @@ TSaslClient::TSaslClient(const string& mechanisms, const string& authenticationI
     const string& protocol, const string& serverName, const map<string,string>& props, 
     sasl_callback_t* callbacks) {
   conn = NULL;
-  if (!props.empty()) {
-    throw SaslServerImplException("Properties not yet supported");
-  }
   int result = sasl_client_new(protocol.c_str(), serverName.c_str(),
 			   NULL, NULL, callbacks, 0, &conn);
   if (result != SASL_OK) {
@@ -72,6 +111,7 @@ TSaslClient::TSaslClient(const string& mechanisms, const string& authenticationI
       throw SaslServerImplException(sasl_errstring(result, NULL, NULL));
     }
   }
+  setSecurityProps(props);
   
   if (!authenticationId.empty()) {
     /* TODO: setup security property */
@@ -144,8 +184,8 @@ bool TSaslClient::hasInitialResponse() {
 }
 
 TSaslServer::TSaslServer(const string& service, const string& serverFQDN,
-                         const string& userRealm,
-                         unsigned flags, sasl_callback_t* callbacks) {
+                         const string& userRealm, unsigned flags,
+                         const map<string, string>& props, sasl_callback_t* callbacks) {
   conn = NULL;
   int result = sasl_server_new(service.c_str(),
       serverFQDN.size() == 0 ? NULL : serverFQDN.c_str(),
@@ -158,6 +198,7 @@ TSaslServer::TSaslServer(const string& service, const string& serverFQDN,
       throw SaslServerImplException(sasl_errstring(result, NULL, NULL));
     }
   }
+  setSecurityProps(props);
 
   authComplete = false;
   serverStarted = false;
@@ -41,6 +41,16 @@
 using namespace apache::thrift::transport;
 
 namespace sasl {
+
+/*
+ * Keys of the 'props' maps of TSaslClient and TSaslServer: the bounds of the security
+ * strength factor to negotiate (see sasl_security_properties_t), as decimal strings.
+ * A maximum of "0" only authenticates the connection; no security layer is
+ * negotiated and the data is sent as is afterwards.
+ */
+const char* const TSASL_MIN_SSF = "min_ssf";
+const char* const TSASL_MAX_SSF = "max_ssf";
+
 class SaslException : public TTransportException {
   public:
     SaslException(const char* msg) : TTransportException(msg) {
@@ -102,11 +112,27 @@ class TSasl {
   /* Determines whether this mechanism has an optional initial response. */
   virtual bool hasInitialResponse() { return false; }
 
+  /*
+   * Returns the negotiated security strength factor; 0 if there is no security
+   * layer, in which case the data must not be wrapped.  Only valid once the
+   * authentication exchange has completed.
+   */
+  unsigned getNegotiatedSsf();
+
+  /*
+   * Returns the maximum number of bytes that can be passed to wrap() at once, or 0
+   * if the security layer doesn't say.
+   */
+  uint32_t getMaxWrapSize();
+
   protected:
    /* Authorization is complete. */
    bool authComplete;
    /* Sasl Connection. */
    sasl_conn_t* conn;
+
+   /* Sets the security properties in 'props' (see TSASL_MIN_SSF) on conn. */
+   void setSecurityProps(const std::map<std::string, std::string>& props);
 };
 
 class SaslClientImplException : public SaslException {
@@ -165,7 +191,9 @@ class SaslServerImplException : public SaslException {
 class TSaslServer : public sasl::TSasl {
  public:
   TSaslServer(const std::string& service, const std::string& serverFQDN,
-              const std::string& userRelm, unsigned flags, sasl_callback_t* callbacks);
+              const std::string& userRelm, unsigned flags,
+              const std::map<std::string, std::string>& props,
+              sasl_callback_t* callbacks);
 
   /*
    * This initializes the sasl server library and should be called onece per application
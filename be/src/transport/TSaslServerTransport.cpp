@@ -93,6 +93,7 @@ void TSaslServerTransport::handleSaslStartMessage() {
   sasl_.reset(new TSaslServer(serverDefinition->protocol_,
                               serverDefinition->serverName_, realm,
                               serverDefinition->flags_,
+                              serverDefinition->props_,
                               &serverDefinition->callbacks_[0]));
   sasl_->evaluateChallengeOrResponse(reinterpret_cast<uint8_t*>(message),
                                      resLength, &resLength);
@@ -107,6 +108,7 @@ shared_ptr<TTransport> TSaslServerTransport::Factory::getTransport(
       transportMap_.find(trans);
   if (transMap == transportMap_.end()) {
     retTransport.reset(new TSaslServerTransport(serverDefinitionMap_, trans));
+    retTransport->setMaxFrameSize(maxFrameSize_);
     retTransport.get()->open();
     transportMap_[trans] = retTransport;
   } else {
@@ -122,7 +122,7 @@ class TSaslServerTransport : public TSaslTransport {
    */
   class Factory : public TTransportFactory {
    public:
-    Factory() {
+    Factory() : maxFrameSize_(DEFAULT_MAX_FRAME_SIZE) {
     }
     /**
      * Create a new Factor for a server definition.
@@ -132,10 +132,16 @@ class TSaslServerTransport : public TSaslTransport {
             const std::string& serverName,
             unsigned flags, std::map<std::string, std::string> props,
             std::vector<struct sasl_callback> callbacks)
-        : TTransportFactory() {
+        : TTransportFactory(),
+          maxFrameSize_(DEFAULT_MAX_FRAME_SIZE) {
       addServerDefinition(mechanism, protocol, serverName, flags, props, callbacks);
     }
 
+    /* Sets the maximum frame size of the returned transports (see setMaxFrameSize()). */
+    void setMaxFrameSize(uint32_t maxFrameSize) {
+      maxFrameSize_ = maxFrameSize;
+    }
+
     virtual ~Factory() {}
 
     /**
@@ -166,6 +172,8 @@ class TSaslServerTransport : public TSaslTransport {
     /* Lock to synchronize the transport map. */
     boost::mutex transportMap_mutex_;
 
+    uint32_t maxFrameSize_;
+
   };
 
 };
@@ -21,6 +21,7 @@
 #include "config.h"
 #ifdef HAVE_SASL_SASL_H
 #include <stdint.h>
+#include <algorithm>
 #include <sstream>
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -36,7 +37,9 @@ namespace apache { namespace thrift { namespace transport {
       : transport_(transport),
         memBuf_(new TMemoryBuffer()),
         shouldWrap_(false),
-        isClient_(false) {
+        isClient_(false),
+        maxFrameSize_(DEFAULT_MAX_FRAME_SIZE),
+        maxWrapSize_(0) {
   }
 
   TSaslTransport::TSaslTransport(boost::shared_ptr<sasl::TSasl> saslClient,
@@ -45,7 +48,9 @@ namespace apache { namespace thrift { namespace transport {
         memBuf_(new TMemoryBuffer()),
         sasl_(saslClient),
         shouldWrap_(false),
-        isClient_(true) {
+        isClient_(true),
+        maxFrameSize_(DEFAULT_MAX_FRAME_SIZE),
+        maxWrapSize_(0) {
   }
 
   TSaslTransport::~TSaslTransport() {
@@ -114,12 +119,10 @@ namespace apache { namespace thrift { namespace transport {
       }
     }
 
-    // TODO : need to set the shouldWrap_ based on QOP
-    /*
-    String qop = (String) sasl.getNegotiatedProperty(Sasl.QOP);
-    if (qop != null && !qop.equalsIgnoreCase("auth"))
-      shouldWrap_ = true;
-    */
+    // Only a negotiated security layer (QOP "auth-int" or "auth-conf") needs the
+    // data to be wrapped.
+    shouldWrap_ = sasl_->getNegotiatedSsf() > 0;
+    if (shouldWrap_) maxWrapSize_ = sasl_->getMaxWrapSize();
   }
 
   void TSaslTransport::close() {
@@ -138,34 +141,32 @@ namespace apache { namespace thrift { namespace transport {
   }
 
   uint32_t TSaslTransport::read(uint8_t* buf, uint32_t len) {
-
-    // if there's not enough data in cache, read from underlying transport
-    if (memBuf_->available_read() < len) {
-      uint32_t dataLength = readLength();
-
-      // Fast path
-      if (len == dataLength && !shouldWrap_) {
-        transport_->readAll(buf, len);
-        return len;
-      }
-
-      uint8_t* tmpBuf = new uint8_t[dataLength];
-      transport_->readAll(tmpBuf, dataLength);
-      if (shouldWrap_) {
-        tmpBuf = sasl_->unwrap(tmpBuf, 0, dataLength, &dataLength);
-      }
-
-      // We will consume all the data, no need to put it in the memory buffer.
-      if (len == dataLength) {
-        memcpy(buf, tmpBuf, len);
-        delete tmpBuf;
-        return len;
+    // return the rest of the previous frame first
+    if (memBuf_->available_read() > 0) return memBuf_->read(buf, len);
+
+    uint32_t dataLength = readLength();
+    if (!shouldWrap_) {
+      // Fast path: the caller wants the whole frame
+      if (len >= dataLength) {
+        transport_->readAll(buf, dataLength);
+        return dataLength;
       }
+      memBuf_->resetBuffer();
+      transport_->readAll(memBuf_->getWritePtr(dataLength), dataLength);
+      memBuf_->wroteBytes(dataLength);
+      return memBuf_->read(buf, len);
+    }
 
-      memBuf_->write(tmpBuf, dataLength);
-      memBuf_->flush();
-      delete tmpBuf;
+    if (readBuf_.size() < dataLength) readBuf_.resize(dataLength);
+    transport_->readAll(&readBuf_[0], dataLength);
+    // the unwrapped data is owned by the sasl connection
+    uint8_t* data = sasl_->unwrap(&readBuf_[0], 0, dataLength, &dataLength);
+    if (len >= dataLength) {
+      memcpy(buf, data, dataLength);
+      return dataLength;
     }
+    memBuf_->resetBuffer();
+    memBuf_->write(data, dataLength);
     return memBuf_->read(buf, len);
   }
 
@@ -176,7 +177,7 @@ namespace apache { namespace thrift { namespace transport {
     transport_->write(lenBuf, PAYLOAD_LENGTH_BYTES);
   }
 
-  void TSaslTransport::write(const uint8_t* buf, uint32_t len) {
+  void TSaslTransport::writeFrame(const uint8_t* buf, uint32_t len) {
     const uint8_t* newBuf;
 
     if (shouldWrap_) {
@@ -188,7 +189,34 @@ namespace apache { namespace thrift { namespace transport {
     transport_->write(newBuf, len);
   }
 
+  void TSaslTransport::flushWriteBuffer() {
+    if (writeBuf_.empty()) return;
+    writeFrame(&writeBuf_[0], writeBuf_.size());
+    writeBuf_.clear();
+  }
+
+  void TSaslTransport::write(const uint8_t* buf, uint32_t len) {
+    uint32_t frameSize = maxFrameSize_;
+    if (shouldWrap_ && maxWrapSize_ > 0) frameSize = min(frameSize, maxWrapSize_);
+    // Unwrapped data that fills a frame by itself doesn't need to be copied; frames
+    // may be larger than frameSize.
+    if (!shouldWrap_ && writeBuf_.empty() && len >= frameSize) {
+      writeFrame(buf, len);
+      return;
+    }
+    while (len > 0) {
+      // the frame size might have been lowered since the last write
+      if (writeBuf_.size() >= frameSize) flushWriteBuffer();
+      uint32_t n = min<uint32_t>(len, frameSize - writeBuf_.size());
+      writeBuf_.insert(writeBuf_.end(), buf, buf + n);
+      buf += n;
+      len -= n;
+      if (writeBuf_.size() >= frameSize) flushWriteBuffer();
+    }
+  }
+
   void TSaslTransport::flush() {
+    flushWriteBuffer();
     transport_->flush();
   }
 
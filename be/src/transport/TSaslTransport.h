@@ -22,6 +22,7 @@
 #define _THRIFT_TRANSPORT_TSSLTRANSPORT_H_ 1
 
 #include <string>
+#include <vector>
 
 #include <boost/shared_ptr.hpp>
 #include <boost/scoped_ptr.hpp>
@@ -45,12 +46,19 @@ static const int MECHANISM_NAME_BYTES = 1;
 static const int STATUS_BYTES = 1;
 static const int PAYLOAD_LENGTH_BYTES = 4;
 static const int HEADER_LENGTH = STATUS_BYTES + PAYLOAD_LENGTH_BYTES;
+static const uint32_t DEFAULT_MAX_FRAME_SIZE = 64 * 1024;
 
 /**
  * This transport implements the Simple Authentication and Security Layer (SASL).
  * see: http://www.ietf.org/rfc/rfc2222.txt.  It is based on and depends
  * on the presence of the cyrus-sasl library.
  *
+ * Writes are buffered until flush() or until they fill a frame of maxFrameSize
+ * bytes, and each frame is wrapped as a whole if the negotiated quality of
+ * protection requires it, so that small writes don't each cost a frame, a wrap
+ * call and a syscall.  Data is wrapped iff the handshake negotiated a security
+ * layer (a security strength factor > 0); negotiating "auth" only (see
+ * sasl::TSASL_MAX_SSF) sends it as is.
  */
 class TSaslTransport : public TVirtualTransport<TSaslTransport> {
  public:
@@ -129,6 +137,19 @@ class TSaslTransport : public TVirtualTransport<TSaslTransport> {
    */
   virtual void flush();
 
+  /**
+   * Sets the maximum number of bytes of outgoing data per frame.  Frames that
+   * are wrapped are also limited by the security layer's maximum buffer size.
+   */
+  void setMaxFrameSize(uint32_t maxFrameSize) {
+    maxFrameSize_ = maxFrameSize > 0 ? maxFrameSize : 1;
+  }
+
+  /**
+   * Returns true if the data is wrapped, which is known once the transport is open.
+   */
+  bool isWrapped() const { return shouldWrap_; }
+
   /**
    * Returns the transport underlying this one
    */
@@ -156,6 +177,18 @@ class TSaslTransport : public TVirtualTransport<TSaslTransport> {
   // Buffer to hold protocol info.
   boost::scoped_array<uint8_t> protoBuf_;
 
+  // Outgoing data that hasn't been sent as a frame yet.
+  std::vector<uint8_t> writeBuf_;
+
+  // See setMaxFrameSize().
+  uint32_t maxFrameSize_;
+
+  // Maximum size of the data of a wrapped frame; only valid if shouldWrap_.
+  uint32_t maxWrapSize_;
+
+  // Incoming frames that need to be unwrapped.
+  std::vector<uint8_t> readBuf_;
+
   /* store the big endian format int to given buffer */
   void encodeInt(uint32_t x, uint8_t* buf, uint32_t offset) {
     *(reinterpret_cast<uint32_t*>(buf + offset)) = htonl(x);
@@ -203,6 +236,16 @@ class TSaslTransport : public TVirtualTransport<TSaslTransport> {
    *           Thrown if writing to the underlying transport fails.
    */
   void writeLength(uint32_t length);
+
+  /**
+   * Sends 'buf' as a single frame, wrapping it if necessary.
+   */
+  void writeFrame(const uint8_t* buf, uint32_t len);
+
+  /**
+   * Sends the buffered writes as a frame.
+   */
+  void flushWriteBuffer();
   virtual void handleSaslStartMessage() = 0;
 };
 
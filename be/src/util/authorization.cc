@@ -43,6 +43,13 @@ DEFINE_int32(kerberos_reinit_interval, 60, \
     "Number of minutes between reestablishing our ticket with the kerberos server");
 DEFINE_string(sasl_path, "/usr/lib/sasl2:/usr/lib64/sasl2:/usr/local/lib/sasl2",
     "Colon separated list of paths to look for SASL security library plugins.");
+DEFINE_int32(sasl_max_frame_size, 64 * 1024,
+    "Kerberos connections buffer outgoing data into SASL frames of up to this many "
+    "bytes; a frame is integrity-protected or encrypted as a whole.");
+DEFINE_bool(kerberos_auth_only, false,
+    "If true, Kerberos connections only authenticate the peer (SASL QOP 'auth'): no "
+    "security layer is negotiated, and the data is sent without integrity protection "
+    "or encryption after the handshake.  Only for clusters on a trusted network.");
 
 namespace impala {
 
@@ -272,6 +279,13 @@ Status InitKerberos(const string& appname) {
   return Status::OK;
 }
 
+// Returns the sasl security properties that implement --kerberos_auth_only.
+static map<string, string> GetSaslProperties() {
+  map<string, string> props;
+  if (FLAGS_kerberos_auth_only) props[sasl::TSASL_MAX_SSF] = "0";
+  return props;
+}
+
 Status GetKerberosTransportFactory(const string& principal,
    const string& key_tab_file, shared_ptr<TTransportFactory>* factory) {
 
@@ -295,12 +309,11 @@ Status GetKerberosTransportFactory(const string& principal,
     return Status(ss.str());
   }
 
-  // TODO: What properties do we support? In meantime we pass an empty map.
-  map<string, string> props;
-
   try {
-    factory->reset(new TSaslServerTransport::Factory(
-        KERBEROS_MECHANISM, names[0], names[1], 0, props, callbacks));
+    TSaslServerTransport::Factory* sasl_factory = new TSaslServerTransport::Factory(
+        KERBEROS_MECHANISM, names[0], names[1], 0, GetSaslProperties(), callbacks);
+    sasl_factory->setMaxFrameSize(FLAGS_sasl_max_frame_size);
+    factory->reset(sasl_factory);
   } catch (TTransportException& e) {
     LOG(ERROR) << "Kerberos transport factory failed: " << e.what();
     return Status(e.what());
@@ -310,7 +323,7 @@ Status GetKerberosTransportFactory(const string& principal,
 }
 
 Status GetTSaslClient(const string& hostname, shared_ptr<sasl::TSasl>* saslClient) {
-  map<string, string> props;
+  map<string, string> props = GetSaslProperties();
   // We do not set this.
   string auth_id;
 
@@ -12,10 +12,13 @@
 // See the License for the specific language governing permissions and
 // limitations under the License.
 
+#include <iomanip>
 #include <iostream>
+#include <sstream>
 
 #include "util/benchmark.h"
 #include "util/cpu-info.h"
+#include "util/perf-counters.h"
 #include "util/stopwatch.h"
 
 using namespace std;
@@ -58,4 +61,59 @@ double Benchmark::Measure(BenchmarkFunction function, void* args,
   return iters / ms_elapsed;
 }
 
+void BenchmarkSuite::AddBenchmark(const string& name,
+    Benchmark::BenchmarkFunction function, void* args, int64_t rows_per_iter) {
+  BenchmarkInfo info;
+  info.name = name;
+  info.function = function;
+  info.args = args;
+  info.rows_per_iter = rows_per_iter;
+  benchmarks_.push_back(info);
+}
+
+// Appends the per row value of counter 'idx' between the two snapshots of 'counters'
+// to 'out', or n/a if the counter isn't available.
+static void PrintPerRow(const PerfCounters& counters, bool available, int idx,
+    int64_t rows, stringstream* out) {
+  if (!available || rows == 0) {
+    *out << setw(14) << "n/a";
+    return;
+  }
+  int64_t delta = (*counters.counters(1))[idx] - (*counters.counters(0))[idx];
+  *out << setw(14) << fixed << setprecision(2) << static_cast<double>(delta) / rows;
+}
+
+string BenchmarkSuite::Measure(int max_time) {
+  stringstream out;
+  out << name_ << ":" << endl
+      << left << setw(40) << "Benchmark" << right << setw(16) << "Rows/sec"
+      << setw(14) << "Cycles/row" << setw(14) << "Instrs/row"
+      << setw(14) << "Misses/row" << endl;
+  for (int i = 0; i < benchmarks_.size(); ++i) {
+    const BenchmarkInfo& info = benchmarks_[i];
+    // iterations per ms
+    double rate = Benchmark::Measure(info.function, info.args, max_time, 1);
+    double rows_per_sec = rate * 1000 * info.rows_per_iter;
+
+    // One more run of ~max_time / 5 ms for the hardware counters.
+    int iters = max(static_cast<int>(rate * max_time / 5), 1);
+    PerfCounters counters;
+    bool available = counters.AddCounter(PerfCounters::PERF_COUNTER_HW_CPU_CYCLES) &&
+        counters.AddCounter(PerfCounters::PERF_COUNTER_HW_INSTRUCTIONS) &&
+        counters.AddCounter(PerfCounters::PERF_COUNTER_HW_CACHE_MISSES);
+    counters.Snapshot("before");
+    info.function(iters, info.args);
+    counters.Snapshot("after");
+    int64_t rows = static_cast<int64_t>(iters) * info.rows_per_iter;
+
+    out << left << setw(40) << info.name << right << setw(16) << fixed
+        << setprecision(0) << rows_per_sec;
+    PrintPerRow(counters, available, 0, rows, &out);
+    PrintPerRow(counters, available, 1, rows, &out);
+    PrintPerRow(counters, available, 2, rows, &out);
+    out << endl;
+  }
+  return out.str();
+}
+
 }
@@ -16,6 +16,10 @@
 #ifndef IMPALA_UTIL_BENCHMARK_H
 #define IMPALA_UTIL_BENCHMARK_H
 
+#include <stdint.h>
+#include <string>
+#include <vector>
+
 namespace impala {
 
 // Static utility class for microbenchmarks.
@@ -35,6 +39,38 @@ class Benchmark {
   static double Measure(BenchmarkFunction function, void* args,
       int max_time = 1000, int initial_batch_size = 1000);
 };
+
+// A named list of benchmarks that are measured one after the other and reported as a
+// table.  For each benchmark, the table has the rows processed per second (from
+// Benchmark::Measure()) and the cpu cycles, instructions and cache misses per row.
+// The hardware counters come from PerfCounters over one more run of the benchmark;
+// they are reported as "n/a" if the kernel doesn't provide them (e.g. in some vms).
+// Benchmark functions should only process data that was generated up front from a
+// fixed seed, so that results are comparable between builds.
+class BenchmarkSuite {
+ public:
+  BenchmarkSuite(const std::string& name) : name_(name) {}
+
+  // Adds a benchmark; one invocation of 'function' (one iteration) processes
+  // 'rows_per_iter' rows.
+  void AddBenchmark(const std::string& name, Benchmark::BenchmarkFunction function,
+      void* args, int64_t rows_per_iter);
+
+  // Runs all benchmarks, each for about max_time ms (plus the counter run), and
+  // returns the result table.
+  std::string Measure(int max_time = 1000);
+
+ private:
+  struct BenchmarkInfo {
+    std::string name;
+    Benchmark::BenchmarkFunction function;
+    void* args;
+    int64_t rows_per_iter;
+  };
+
+  std::string name_;
+  std::vector<BenchmarkInfo> benchmarks_;
+};
   
 }
 
@@ -0,0 +1,61 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "util/bloom-filter.h"
+#include "util/hash-util.h"
+
+namespace impala {
+
+static uint32_t HashInt(int32_t i) {
+  return HashUtil::Hash(&i, sizeof(i), 0);
+}
+
+TEST(BloomFilterTest, Basic) {
+  BloomFilter filter(1000);
+  EXPECT_EQ(filter.byte_size(), 2048);
+  for (int i = 0; i < 1000; ++i) {
+    filter.Insert(HashInt(i));
+  }
+  // no false negatives
+  for (int i = 0; i < 1000; ++i) {
+    EXPECT_TRUE(filter.Find(HashInt(i))) << i;
+  }
+  int false_positives = 0;
+  for (int i = 1000; i < 101000; ++i) {
+    if (filter.Find(HashInt(i))) ++false_positives;
+  }
+  EXPECT_LT(false_positives, 3000);
+}
+
+TEST(BloomFilterTest, Small) {
+  BloomFilter filter(0);
+  EXPECT_EQ(filter.byte_size(), 8);
+  EXPECT_FALSE(filter.Find(HashInt(1)));
+  filter.Insert(HashInt(1));
+  EXPECT_TRUE(filter.Find(HashInt(1)));
+}
+
+TEST(BloomFilterTest, MaxSize) {
+  BloomFilter filter(1LL << 40);
+  EXPECT_EQ(filter.byte_size(), BloomFilter::MAX_BYTE_SIZE);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,32 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/bloom-filter.h"
+
+using namespace impala;
+
+const int BloomFilter::BITS_PER_VALUE;
+const int BloomFilter::NUM_HASH_BITS;
+const int64_t BloomFilter::MAX_BYTE_SIZE;
+
+BloomFilter::BloomFilter(int64_t expected_num_values) {
+  // number of words is a power of two so the word index is a mask of the hash
+  int64_t num_words = 1;
+  while (num_words * 64 < expected_num_values * BITS_PER_VALUE &&
+      num_words * sizeof(uint64_t) < MAX_BYTE_SIZE) {
+    num_words *= 2;
+  }
+  words_.resize(num_words, 0);
+  word_mask_ = num_words - 1;
+}
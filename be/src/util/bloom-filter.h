@@ -0,0 +1,67 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_BLOOM_FILTER_H
+#define IMPALA_UTIL_BLOOM_FILTER_H
+
+#include <stdint.h>
+#include <vector>
+
+namespace impala {
+
+// Bloom filter over 32-bit hash values.  Find() never returns false for a hash that
+// was inserted, and returns true for other hashes with a small probability (around 1%
+// when sized for the number of inserted values).
+// All bits of a hash value are set in the same 64-bit word ("register blocked"), so
+// Insert() and Find() touch a single cache line.  The word is picked by the low bits
+// of the hash, the NUM_HASH_BITS bit positions within it by the high bits of a
+// remixed hash.
+class BloomFilter {
+ public:
+  // Creates a filter sized for about 'expected_num_values' distinct values, with
+  // BITS_PER_VALUE bits per value (at most MAX_BYTE_SIZE bytes).
+  BloomFilter(int64_t expected_num_values);
+
+  void Insert(uint32_t hash) {
+    words_[hash & word_mask_] |= BitMask(hash);
+  }
+
+  bool Find(uint32_t hash) const {
+    uint64_t mask = BitMask(hash);
+    return (words_[hash & word_mask_] & mask) == mask;
+  }
+
+  int64_t byte_size() const { return words_.size() * sizeof(uint64_t); }
+
+  static const int BITS_PER_VALUE = 16;
+  static const int NUM_HASH_BITS = 3;
+  static const int64_t MAX_BYTE_SIZE = 16 * 1024 * 1024;
+
+ private:
+  static uint64_t BitMask(uint32_t hash) {
+    // Multiply with the 32-bit golden ratio so that the high bits depend on all bits of
+    // hash (which the word index doesn't, for small filters).
+    uint32_t h = hash * 0x9e3779b1U;
+    return (1ULL << (h >> 26)) | (1ULL << ((h >> 20) & 63)) |
+        (1ULL << ((h >> 14) & 63));
+  }
+
+  std::vector<uint64_t> words_;
+  uint32_t word_mask_;
+};
+
+}
+
+#endif
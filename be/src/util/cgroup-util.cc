@@ -0,0 +1,75 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/cgroup-util.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <sstream>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+
+using namespace std;
+
+DEFINE_string(cgroup_hierarchy_path, "", "Directory of the cpu cgroup that impalad "
+    "runs in, below which the cgroups named by the cpu_cgroup query option and the "
+    "admission pools are.  Empty disables the cgroup placement of fragment threads.");
+
+namespace impala {
+
+Status CgroupUtil::AssignThreadToCgroup(const string& cgroup) {
+  if (FLAGS_cgroup_hierarchy_path.empty()) return Status::OK;
+  // The name comes from a query option; it can't leave the hierarchy.
+  if (cgroup.find("..") != string::npos) {
+    return Status("Invalid cgroup name '" + cgroup + "'");
+  }
+  string path = FLAGS_cgroup_hierarchy_path;
+  if (!cgroup.empty()) path += "/" + cgroup;
+  path += "/tasks";
+  // Writing a thread id to the tasks file moves only that thread.
+  pid_t tid = syscall(SYS_gettid);
+  FILE* tasks = fopen(path.c_str(), "w");
+  bool ok = tasks != NULL && fprintf(tasks, "%d\n", tid) > 0;
+  if (tasks != NULL) ok &= fclose(tasks) == 0;
+  if (!ok) {
+    stringstream ss;
+    ss << "Could not move thread " << tid << " to cgroup " << path << ": "
+       << strerror(errno);
+    return Status(ss.str());
+  }
+  return Status::OK;
+}
+
+ScopedCgroupAssignment::ScopedCgroupAssignment(const string& cgroup)
+  : assigned_(false) {
+  if (cgroup.empty() || FLAGS_cgroup_hierarchy_path.empty()) return;
+  Status status = CgroupUtil::AssignThreadToCgroup(cgroup);
+  if (!status.ok()) {
+    LOG(WARNING) << status.GetErrorMsg();
+    return;
+  }
+  assigned_ = true;
+}
+
+ScopedCgroupAssignment::~ScopedCgroupAssignment() {
+  if (!assigned_) return;
+  Status status = CgroupUtil::AssignThreadToCgroup("");
+  if (!status.ok()) LOG(WARNING) << status.GetErrorMsg();
+}
+
+}
@@ -0,0 +1,53 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_CGROUP_UTIL_H
+#define IMPALA_UTIL_CGROUP_UTIL_H
+
+#include <string>
+
+#include "common/status.h"
+
+namespace impala {
+
+// Places threads in cpu cgroups, so that the kernel divides the cores between the
+// cgroups by their cpu.shares, e.g. to keep batch queries from slowing down
+// interactive ones.  The cgroups are directories below --cgroup_hierarchy_path (a
+// directory of a mounted cpu controller that impalad can write, e.g.
+// /cgroup/cpu/impala) that the administrator creates and sets the shares of.
+class CgroupUtil {
+ public:
+  // Moves the calling thread into cgroup 'cgroup', or into the cgroup at
+  // --cgroup_hierarchy_path itself if 'cgroup' is empty.  Does nothing if
+  // --cgroup_hierarchy_path is empty.
+  static Status AssignThreadToCgroup(const std::string& cgroup);
+};
+
+// Moves the calling thread into a cgroup for the lifetime of this object and back
+// into the cgroup at --cgroup_hierarchy_path afterwards, since pool threads run the
+// work of many queries.  Does nothing for an empty cgroup.  Errors are logged and
+// otherwise ignored: the thread then keeps running in its cgroup.
+class ScopedCgroupAssignment {
+ public:
+  ScopedCgroupAssignment(const std::string& cgroup);
+  ~ScopedCgroupAssignment();
+
+ private:
+  bool assigned_;
+};
+
+}
+
+#endif
@@ -38,13 +38,21 @@ const char* const Codec::BZIP2_COMPRESSION =
 const char* const Codec::SNAPPY_COMPRESSION =
      "org.apache.hadoop.io.compress.SnappyCodec";
 
+const char* const Codec::LZ4_COMPRESSION =
+     "org.apache.hadoop.io.compress.Lz4Codec";
+
+const char* const Codec::ZSTD_COMPRESSION =
+     "org.apache.hadoop.io.compress.ZStandardCodec";
+
 static const map<const string, const THdfsCompression::type>
      compression_map = map_list_of
   ("", THdfsCompression::NONE)
   (Codec::DEFAULT_COMPRESSION, THdfsCompression::DEFAULT)
   (Codec::GZIP_COMPRESSION, THdfsCompression::GZIP)
   (Codec::BZIP2_COMPRESSION, THdfsCompression::BZIP2)
-  (Codec::SNAPPY_COMPRESSION, THdfsCompression::SNAPPY_BLOCKED);
+  (Codec::SNAPPY_COMPRESSION, THdfsCompression::SNAPPY_BLOCKED)
+  (Codec::LZ4_COMPRESSION, THdfsCompression::LZ4_BLOCKED)
+  (Codec::ZSTD_COMPRESSION, THdfsCompression::ZSTD);
 
 string Codec::GetCodecName(THdfsCompression::type type) {
   map<const string, THdfsCompression::type>::const_iterator im;
@@ -96,6 +104,15 @@ Status Codec::CreateCompressor(RuntimeState* runtime_state, MemPool* mem_pool,
     case THdfsCompression::SNAPPY:
       *compressor = new SnappyCompressor(mem_pool, reuse);
       break;
+    case THdfsCompression::LZ4_BLOCKED:
+      *compressor = new Lz4BlockCompressor(mem_pool, reuse);
+      break;
+    case THdfsCompression::LZ4:
+      *compressor = new Lz4Compressor(mem_pool, reuse);
+      break;
+    case THdfsCompression::ZSTD:
+      *compressor = new ZstdCompressor(mem_pool, reuse);
+      break;
   }
 
   return (*compressor)->Init();
@@ -139,11 +156,26 @@ Status Codec::CreateDecompressor(RuntimeState* runtime_state, MemPool* mem_pool,
     case THdfsCompression::SNAPPY:
       *decompressor = new SnappyDecompressor(mem_pool, reuse);
       break;
+    case THdfsCompression::LZ4_BLOCKED:
+      *decompressor = new Lz4BlockDecompressor(mem_pool, reuse);
+      break;
+    case THdfsCompression::LZ4:
+      *decompressor = new Lz4Decompressor(mem_pool, reuse);
+      break;
+    case THdfsCompression::ZSTD:
+      *decompressor = new ZstdDecompressor(mem_pool, reuse);
+      break;
   }
 
   return (*decompressor)->Init();
 }
 
+Status Codec::ProcessBlockStreaming(int input_length, uint8_t* input,
+                                    int* input_bytes_read, int* output_length,
+                                    uint8_t** output, bool* stream_end) {
+  return Status("Codec does not support streaming decompression");
+}
+
 Codec::Codec(MemPool* mem_pool, bool reuse_buffer)
   : memory_pool_(mem_pool),
     reuse_buffer_(reuse_buffer),
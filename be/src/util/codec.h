@@ -41,6 +41,8 @@ class Codec {
   static const char* const GZIP_COMPRESSION;
   static const char* const BZIP2_COMPRESSION;
   static const char* const SNAPPY_COMPRESSION;
+  static const char* const LZ4_COMPRESSION;
+  static const char* const ZSTD_COMPRESSION;
 
   // Map from codec string to compression format
   static const std::map<const std::string, const THdfsCompression> CODEC_MAP;
@@ -96,6 +98,29 @@ class Codec {
   virtual Status ProcessBlock(int input_length, uint8_t* input,
                               int* output_length, uint8_t** output)  = 0;
 
+  // Process the next piece of a compressed stream, for decompressors that can
+  // decompress incrementally.  At most STREAM_OUT_BUF_SIZE bytes are output per
+  // call, so the memory used does not depend on the size of the stream.
+  // Inputs:
+  //   input_length: length of the data to process
+  //   input: data to process
+  // Output:
+  //   input_bytes_read: bytes of input that were consumed.  The rest must be
+  //     passed again to the next call.
+  //   output_length: length of the output, which can be 0.
+  //   output: pointer to the output.  If the buffer is reused, it is only valid
+  //     until the next call.
+  //   stream_end: set to true if the end of the compressed stream was reached.  Any
+  //     remaining input is the start of the next stream (e.g. the next member of a
+  //     gzip file).
+  // Returns an error if the codec cannot decompress incrementally.
+  virtual Status ProcessBlockStreaming(int input_length, uint8_t* input,
+                                       int* input_bytes_read, int* output_length,
+                                       uint8_t** output, bool* stream_end);
+
+  // Size of the output buffers of ProcessBlockStreaming().
+  static const int STREAM_OUT_BUF_SIZE = 1024 * 1024;
+
   // Return the name of a compression algorithm.
   static std::string GetCodecName(THdfsCompression::type);
 
@@ -20,6 +20,8 @@
 #include <zlib.h>
 #include <bzlib.h>
 #include <snappy.h>
+#include <lz4.h>
+#include <zstd.h>
 
 using namespace std;
 using namespace boost;
@@ -208,3 +210,107 @@ Status SnappyCompressor::ProcessBlock(int input_length, uint8_t* input,
   if (*output_length == 0) *output_length = out_len;
   return Status::OK;
 }
+
+Lz4BlockCompressor::Lz4BlockCompressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status Lz4BlockCompressor::ProcessBlock(int input_length, uint8_t* input,
+                                        int *output_length, uint8_t** output) {
+  // Hadoop uses a block compression scheme on top of lz4.  Each block of up to
+  // BLOCK_SIZE bytes is written as its uncompressed size followed by the size of
+  // the compressed block and the compressed block.
+  int num_blocks = (input_length + BLOCK_SIZE - 1) / BLOCK_SIZE;
+  size_t length = static_cast<size_t>(num_blocks) *
+      (LZ4_compressBound(min(input_length, static_cast<int>(BLOCK_SIZE))) +
+       2 * sizeof(int32_t));
+  if (*output_length != 0 && *output_length < length) {
+    return Status("ProcessBlock: output length too small");
+  }
+
+  // If length is non-zero then the output has been allocated.
+  if (*output_length != 0) {
+    buffer_length_ = *output_length;
+    out_buffer_ = *output;
+  } else if (!reuse_buffer_ || out_buffer_ == NULL || buffer_length_ < length) {
+    buffer_length_ = length;
+    out_buffer_ = memory_pool_->Allocate(buffer_length_);
+  }
+
+  uint8_t* outp = out_buffer_;
+  while (input_length > 0) {
+    int block_size = min(input_length, static_cast<int>(BLOCK_SIZE));
+    SerDeUtils::PutInt(outp, block_size);
+    outp += sizeof(int32_t);
+    int size = LZ4_compress_default(reinterpret_cast<const char*>(input),
+        reinterpret_cast<char*>(outp + sizeof(int32_t)), block_size,
+        LZ4_compressBound(block_size));
+    if (size <= 0) return Status("Lz4: LZ4_compress_default failed");
+    SerDeUtils::PutInt(outp, size);
+    outp += sizeof(int32_t) + size;
+    input += block_size;
+    input_length -= block_size;
+  }
+
+  *output = out_buffer_;
+  *output_length = outp - out_buffer_;
+  return Status::OK;
+}
+
+Lz4Compressor::Lz4Compressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status Lz4Compressor::ProcessBlock(int input_length, uint8_t* input,
+                                   int *output_length, uint8_t** output) {
+  int length = LZ4_compressBound(input_length);
+  if (*output_length != 0 && *output_length < length) {
+    return Status("ProcessBlock: output length too small");
+  }
+
+  if (*output_length != 0) {
+    buffer_length_ = *output_length;
+    out_buffer_ = *output;
+  } else if (!reuse_buffer_ || out_buffer_ == NULL || buffer_length_ < length) {
+    buffer_length_ = length;
+    out_buffer_ = memory_pool_->Allocate(buffer_length_);
+  }
+
+  int out_len = LZ4_compress_default(reinterpret_cast<const char*>(input),
+      reinterpret_cast<char*>(out_buffer_), input_length, buffer_length_);
+  if (out_len <= 0) return Status("Lz4: LZ4_compress_default failed");
+
+  *output = out_buffer_;
+  *output_length = out_len;
+  return Status::OK;
+}
+
+ZstdCompressor::ZstdCompressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status ZstdCompressor::ProcessBlock(int input_length, uint8_t* input,
+                                    int *output_length, uint8_t** output) {
+  size_t length = ZSTD_compressBound(input_length);
+  if (*output_length != 0 && *output_length < length) {
+    return Status("ProcessBlock: output length too small");
+  }
+
+  if (*output_length != 0) {
+    buffer_length_ = *output_length;
+    out_buffer_ = *output;
+  } else if (!reuse_buffer_ || out_buffer_ == NULL || buffer_length_ < length) {
+    buffer_length_ = length;
+    out_buffer_ = memory_pool_->Allocate(buffer_length_);
+  }
+
+  size_t out_len = ZSTD_compress(out_buffer_, buffer_length_, input, input_length,
+      COMPRESSION_LEVEL);
+  if (ZSTD_isError(out_len)) {
+    return Status("zstd: ZSTD_compress failed: " + string(ZSTD_getErrorName(out_len)));
+  }
+
+  *output = out_buffer_;
+  *output_length = out_len;
+  return Status::OK;
+}
@@ -97,5 +97,61 @@ class SnappyCompressor : public Codec {
 
 };
 
+// Writes Hadoop's block framing of LZ4 (see Lz4BlockDecompressor).
+class Lz4BlockCompressor : public Codec {
+ public:
+  Lz4BlockCompressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~Lz4BlockCompressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // Lz4 does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+ private:
+  // Uncompressed size of each block.  This is Hadoop's default
+  // io.compression.codec.lz4.buffersize.
+  const static int BLOCK_SIZE = 256 * 1024;
+};
+
+// Raw LZ4.  The uncompressed length is not stored, so the data can only be
+// decompressed into a buffer of known length.
+class Lz4Compressor : public Codec {
+ public:
+  Lz4Compressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~Lz4Compressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // Lz4 does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+};
+
+// Writes a single zstd frame.
+class ZstdCompressor : public Codec {
+ public:
+  ZstdCompressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~ZstdCompressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // The one shot zstd API does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+ private:
+  // zstd's default compression level.
+  const static int COMPRESSION_LEVEL = 3;
+};
+
 }
 #endif
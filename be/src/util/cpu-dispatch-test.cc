@@ -0,0 +1,91 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gflags/gflags.h>
+#include <gtest/gtest.h>
+
+#include "util/cpu-dispatch.h"
+#include "util/cpu-info.h"
+
+DECLARE_string(max_cpu_dispatch_level);
+
+namespace impala {
+
+static CpuDispatch::Kernel scalar_kernel("scalar", CpuDispatch::SCALAR);
+static CpuDispatch::Kernel sse_kernel("sse", CpuDispatch::SSE4_2);
+static CpuDispatch::Kernel avx2_kernel("avx2", CpuDispatch::AVX2);
+
+TEST(CpuDispatchTest, Select) {
+  CpuDispatch::Level cpu_level = CpuDispatch::cpu_level();
+  EXPECT_EQ(scalar_kernel.level(), CpuDispatch::SCALAR);
+  EXPECT_EQ(sse_kernel.level(), std::min(cpu_level, CpuDispatch::SSE4_2));
+  EXPECT_EQ(avx2_kernel.level(), std::min(cpu_level, CpuDispatch::AVX2));
+  EXPECT_EQ(CpuInfo::IsSupported(CpuInfo::SSE4_2),
+      sse_kernel.level() == CpuDispatch::SSE4_2);
+
+  // Kernels created after the selection are selected right away.
+  CpuDispatch::Kernel late_kernel("late", CpuDispatch::AVX512);
+  EXPECT_EQ(late_kernel.level(), cpu_level);
+}
+
+TEST(CpuDispatchTest, MaxLevel) {
+  FLAGS_max_cpu_dispatch_level = "scalar";
+  CpuDispatch::SelectVariants();
+  EXPECT_EQ(CpuDispatch::cpu_level(), CpuDispatch::SCALAR);
+  EXPECT_EQ(sse_kernel.level(), CpuDispatch::SCALAR);
+  EXPECT_EQ(avx2_kernel.level(), CpuDispatch::SCALAR);
+
+  FLAGS_max_cpu_dispatch_level = "sse4.2";
+  CpuDispatch::SelectVariants();
+  EXPECT_LE(avx2_kernel.level(), CpuDispatch::SSE4_2);
+  EXPECT_EQ(avx2_kernel.level(), sse_kernel.level());
+
+  // Unknown levels are ignored.
+  FLAGS_max_cpu_dispatch_level = "sse5";
+  CpuDispatch::SelectVariants();
+  EXPECT_EQ(avx2_kernel.level(), std::min(CpuDispatch::cpu_level(), CpuDispatch::AVX2));
+
+  FLAGS_max_cpu_dispatch_level = "avx512";
+  CpuDispatch::SelectVariants();
+}
+
+TEST(CpuDispatchTest, EnableFeature) {
+  if (!CpuInfo::IsSupported(CpuInfo::SSE4_2)) return;
+  CpuInfo::EnableFeature(CpuInfo::SSE4_2, false);
+  EXPECT_EQ(CpuDispatch::cpu_level(), CpuDispatch::SCALAR);
+  EXPECT_EQ(sse_kernel.level(), CpuDispatch::SCALAR);
+  EXPECT_EQ(avx2_kernel.level(), CpuDispatch::SCALAR);
+  CpuInfo::EnableFeature(CpuInfo::SSE4_2, true);
+  EXPECT_EQ(sse_kernel.level(), CpuDispatch::SSE4_2);
+}
+
+TEST(CpuDispatchTest, Kernels) {
+  const std::vector<CpuDispatch::Kernel*>& kernels = CpuDispatch::kernels();
+  int num_found = 0;
+  for (int i = 0; i < kernels.size(); ++i) {
+    if (kernels[i] == &scalar_kernel || kernels[i] == &sse_kernel ||
+        kernels[i] == &avx2_kernel) {
+      ++num_found;
+    }
+  }
+  EXPECT_EQ(num_found, 3);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
+  return RUN_ALL_TESTS();
+}
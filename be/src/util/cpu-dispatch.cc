@@ -0,0 +1,95 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/cpu-dispatch.h"
+
+#include <sstream>
+#include <gflags/gflags.h>
+
+#include "common/logging.h"
+#include "util/cpu-info.h"
+
+using namespace std;
+
+DEFINE_string(max_cpu_dispatch_level, "avx512", "The most capable instruction set "
+    "that kernels with variants for several instruction sets may use: one of scalar, "
+    "sse4.2, avx2 or avx512.  Lower it to rule out a variant, e.g. while rolling out a "
+    "new one across machines of different generations.");
+
+namespace impala {
+
+static const char* LEVEL_NAMES[] = { "scalar", "sse4.2", "avx2", "avx512" };
+
+bool CpuDispatch::selected_ = false;
+
+CpuDispatch::Kernel::Kernel(const char* name, Level max_level)
+  : name_(name),
+    max_level_(max_level),
+    level_(SCALAR) {
+  GetKernels()->push_back(this);
+  // Kernels of libraries that are loaded later are selected right away.
+  if (selected_) level_ = min(max_level_, cpu_level());
+}
+
+vector<CpuDispatch::Kernel*>* CpuDispatch::GetKernels() {
+  static vector<Kernel*> kernels;
+  return &kernels;
+}
+
+const char* CpuDispatch::LevelName(Level level) {
+  DCHECK_GE(level, SCALAR);
+  DCHECK_LT(level, NUM_LEVELS);
+  return LEVEL_NAMES[level];
+}
+
+CpuDispatch::Level CpuDispatch::cpu_level() {
+  Level level = SCALAR;
+  if (CpuInfo::IsSupported(CpuInfo::SSE4_2)) {
+    level = SSE4_2;
+    if (CpuInfo::IsSupported(CpuInfo::AVX2)) {
+      level = AVX2;
+      const int64_t avx512 = CpuInfo::AVX512F | CpuInfo::AVX512BW;
+      if ((CpuInfo::hardware_flags() & avx512) == avx512) level = AVX512;
+    }
+  }
+  for (int i = 0; i < NUM_LEVELS; ++i) {
+    if (FLAGS_max_cpu_dispatch_level == LEVEL_NAMES[i]) return min(level, Level(i));
+  }
+  LOG(WARNING) << "Ignoring unknown --max_cpu_dispatch_level: "
+               << FLAGS_max_cpu_dispatch_level;
+  return level;
+}
+
+void CpuDispatch::SelectVariants() {
+  selected_ = true;
+  Level level = cpu_level();
+  vector<Kernel*>* kernels = GetKernels();
+  for (int i = 0; i < kernels->size(); ++i) {
+    (*kernels)[i]->level_ = min((*kernels)[i]->max_level_, level);
+  }
+  VLOG(1) << DebugString();
+}
+
+string CpuDispatch::DebugString() {
+  stringstream ss;
+  ss << "Cpu dispatch level: " << LevelName(cpu_level()) << endl;
+  const vector<Kernel*>& all_kernels = kernels();
+  for (int i = 0; i < all_kernels.size(); ++i) {
+    ss << "  " << all_kernels[i]->name() << ": " << LevelName(all_kernels[i]->level())
+       << " (compiled up to " << LevelName(all_kernels[i]->max_level()) << ")" << endl;
+  }
+  return ss.str();
+}
+
+}
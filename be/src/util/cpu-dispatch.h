@@ -0,0 +1,94 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_CPU_DISPATCH_H
+#define IMPALA_UTIL_CPU_DISPATCH_H
+
+#include <string>
+#include <vector>
+
+namespace impala {
+
+// CpuDispatch picks, for each kernel that has variants for several instruction sets,
+// the variant that runs on this machine.  A kernel is a global CpuDispatch::Kernel
+// defined next to its code, which is called as
+//   if (DelimitedTextParser::PARSE_KERNEL.level() >= CpuDispatch::AVX2) {
+//     ParseAvx2(...);
+//   } else ...
+// The variant is selected once by SelectVariants(), which CpuInfo::Init() calls (and
+// CpuInfo::EnableFeature(), for tests and benchmarks): it is the most capable level
+// that both the kernel and the cpu support, capped by --max_cpu_dispatch_level.
+// Checking the level is as cheap as the CpuInfo::IsSupported() it replaces and works
+// for inlined code.  Until the variants are selected, every kernel runs its scalar
+// variant.
+// Variants of a kernel must compute the same results, except for kernels that only
+// run within a single process (e.g. hash functions of hash tables).
+class CpuDispatch {
+ public:
+  // Instruction sets, from least to most capable.  A cpu at a level supports all
+  // lower levels.
+  enum Level {
+    SCALAR = 0,
+    SSE4_2,
+    AVX2,
+    AVX512,
+    NUM_LEVELS,
+  };
+
+  class Kernel {
+   public:
+    // 'max_level' is the most capable level that the kernel was compiled for; it has
+    // variants for that level and lower ones.
+    Kernel(const char* name, Level max_level);
+
+    // Returns the level of the selected variant.
+    Level level() const { return level_; }
+
+    const char* name() const { return name_; }
+    Level max_level() const { return max_level_; }
+
+   private:
+    friend class CpuDispatch;
+
+    const char* name_;
+    Level max_level_;
+    Level level_;
+  };
+
+  // Selects the variant of every kernel for the current CpuInfo::hardware_flags().
+  static void SelectVariants();
+
+  // Returns the most capable level of the cpu, taking --max_cpu_dispatch_level into
+  // account.
+  static Level cpu_level();
+
+  // Returns all kernels, in the order they were created.
+  static const std::vector<Kernel*>& kernels() { return *GetKernels(); }
+
+  // Returns the name of 'level', as used by --max_cpu_dispatch_level.
+  static const char* LevelName(Level level);
+
+  static std::string DebugString();
+
+ private:
+  static bool selected_;
+
+  // With a function local static, kernels can register in any static initializer.
+  static std::vector<Kernel*>* GetKernels();
+};
+
+}
+
+#endif
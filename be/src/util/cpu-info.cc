@@ -13,12 +13,14 @@
 // limitations under the License.
 
 #include "util/cpu-info.h"
+#include "util/cpu-dispatch.h"
 #include "util/debug-util.h"
 
 #include <boost/algorithm/string.hpp>
 #include <iostream>
 #include <fstream>
 #include <sstream>
+#include <sched.h>
 #include <stdlib.h>
 #include <string.h>
 
@@ -35,6 +37,8 @@ int64_t CpuInfo::original_hardware_flags_;
 long CpuInfo::cache_sizes_[L3_CACHE + 1];
 int64_t CpuInfo::cycles_per_ms_;
 int CpuInfo::num_cores_ = 1;
+vector<vector<int> > CpuInfo::numa_node_cores_;
+vector<int> CpuInfo::core_numa_nodes_;
 
 static struct {
   string name;
@@ -44,6 +48,9 @@ static struct {
   { "ssse3",  CpuInfo::SSE3 },
   { "sse4_1", CpuInfo::SSE4_1 },
   { "sse4_2", CpuInfo::SSE4_2 },
+  { "avx2",   CpuInfo::AVX2 },
+  { "avx512f", CpuInfo::AVX512F },
+  { "avx512bw", CpuInfo::AVX512BW },
 };
 static const long num_flags = sizeof(flag_mappings) / sizeof(flag_mappings[0]);
 
@@ -117,8 +124,74 @@ void CpuInfo::Init() {
     num_cores_ = 1;
   }
   
+  InitNumaNodes();
   initialized_ = true;
   LOG(INFO) << DebugString();
+  CpuDispatch::SelectVariants();
+}
+
+// Parses a list of cores like "0-3,8,10-11" into 'cores'.
+static void ParseCoreList(const string& list, vector<int>* cores) {
+  vector<string> ranges;
+  split(ranges, list, is_any_of(","), token_compress_on);
+  for (int i = 0; i < ranges.size(); ++i) {
+    string range = trim_copy(ranges[i]);
+    if (range.empty()) continue;
+    size_t dash = range.find('-');
+    int first = atoi(range.substr(0, dash).c_str());
+    int last = dash == string::npos ? first : atoi(range.substr(dash + 1).c_str());
+    for (int core = first; core <= last; ++core) cores->push_back(core);
+  }
+}
+
+void CpuInfo::InitNumaNodes() {
+  numa_node_cores_.clear();
+  for (int node = 0; ; ++node) {
+    stringstream path;
+    path << "/sys/devices/system/node/node" << node << "/cpulist";
+    ifstream cpulist(path.str().c_str(), ios::in);
+    if (!cpulist.good()) break;
+    string line;
+    getline(cpulist, line);
+    numa_node_cores_.push_back(vector<int>());
+    ParseCoreList(line, &numa_node_cores_.back());
+  }
+  core_numa_nodes_.assign(num_cores_, 0);
+  bool valid = !numa_node_cores_.empty();
+  for (int node = 0; node < numa_node_cores_.size() && valid; ++node) {
+    const vector<int>& cores = numa_node_cores_[node];
+    for (int i = 0; i < cores.size(); ++i) {
+      if (cores[i] >= num_cores_) {
+        valid = false;
+        break;
+      }
+      core_numa_nodes_[cores[i]] = node;
+    }
+  }
+  if (!valid) {
+    // no (usable) topology: a single node with all cores
+    numa_node_cores_.assign(1, vector<int>());
+    for (int core = 0; core < num_cores_; ++core) numa_node_cores_[0].push_back(core);
+    core_numa_nodes_.assign(num_cores_, 0);
+  }
+}
+
+int CpuInfo::GetCurrentNumaNode() {
+  DCHECK(initialized_);
+  if (numa_node_cores_.size() == 1) return 0;
+  int core = sched_getcpu();
+  if (core < 0 || core >= core_numa_nodes_.size()) return 0;
+  return core_numa_nodes_[core];
+}
+
+bool CpuInfo::PinThreadToNumaNode(int node) {
+  DCHECK(initialized_);
+  const vector<int>& cores = numa_node_cores(node);
+  if (cores.empty()) return false;
+  cpu_set_t cpu_set;
+  CPU_ZERO(&cpu_set);
+  for (int i = 0; i < cores.size(); ++i) CPU_SET(cores[i], &cpu_set);
+  return sched_setaffinity(0, sizeof(cpu_set), &cpu_set) == 0;
 }
 
 void CpuInfo::EnableFeature(long flag, bool enable) {
@@ -130,6 +203,7 @@ void CpuInfo::EnableFeature(long flag, bool enable) {
     DCHECK((original_hardware_flags_ & flag) != 0);
     hardware_flags_ |= flag;
   }
+  CpuDispatch::SelectVariants();
 }
 
 string CpuInfo::DebugString() {
@@ -140,6 +214,7 @@ string CpuInfo::DebugString() {
   int64_t L3 = CacheSize(L3_CACHE);
   stream << "Cpu Info:" << endl
          << "  Cores: " << num_cores_ << endl
+         << "  NUMA nodes: " << numa_node_cores_.size() << endl
          << "  L1 Cache: " << PrettyPrinter::Print(L1, TCounterType::BYTES) << endl
          << "  L2 Cache: " << PrettyPrinter::Print(L2, TCounterType::BYTES) << endl
          << "  L3 Cache: " << PrettyPrinter::Print(L3, TCounterType::BYTES) << endl
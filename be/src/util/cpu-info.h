@@ -17,6 +17,7 @@
 #define IMPALA_UTIL_CPU_INFO_H
 
 #include <string>
+#include <vector>
 #include <boost/cstdint.hpp>
 
 #include "common/logging.h"
@@ -27,11 +28,16 @@ namespace impala {
 // ask for the sizes of the caches and what hardware features are supported.
 // On Linux, this information is pulled from a couple of sys files (/proc/cpuinfo and 
 // /sys/devices)
+// The NUMA topology comes from /sys/devices/system/node; a machine without it is
+// treated as a single node with all cores.
 class CpuInfo {
  public:
   static const int64_t SSE3    = (1 << 1);
   static const int64_t SSE4_1  = (1 << 2);
   static const int64_t SSE4_2  = (1 << 3);
+  static const int64_t AVX2    = (1 << 4);
+  static const int64_t AVX512F = (1 << 5);
+  static const int64_t AVX512BW = (1 << 6);
 
   // Cache enums for L1 (data), L2 and L3 
   enum CacheLevel {
@@ -40,7 +46,7 @@ class CpuInfo {
     L3_CACHE = 2,
   };
 
-  // Initialize CpuInfo.
+  // Initialize CpuInfo.  Also selects the variants of the CpuDispatch kernels.
   static void Init();
 
   // Returns all the flags for this cpu
@@ -57,9 +63,10 @@ class CpuInfo {
 
   // Toggle a hardware feature on and off.  It is not valid to turn on a feature
   // that the underlying hardware cannot support. This is useful for testing.
+  // The variants of the CpuDispatch kernels are selected again.
   static void EnableFeature(long flag, bool enable);
 
-  // Returns the size of the cache in KB at this cache level
+  // Returns the size of the cache in bytes at this cache level
   static long CacheSize(CacheLevel level) {
     DCHECK(initialized_);
     return cache_sizes_[level];
@@ -77,6 +84,28 @@ class CpuInfo {
     return num_cores_; 
   }
 
+  // Returns the number of NUMA nodes, at least 1.
+  static int num_numa_nodes() {
+    DCHECK(initialized_);
+    return numa_node_cores_.size();
+  }
+
+  // Returns the cores of NUMA node 'node'.
+  static const std::vector<int>& numa_node_cores(int node) {
+    DCHECK(initialized_);
+    DCHECK_GE(node, 0);
+    DCHECK_LT(node, numa_node_cores_.size());
+    return numa_node_cores_[node];
+  }
+
+  // Returns the NUMA node of the core the calling thread is running on.
+  static int GetCurrentNumaNode();
+
+  // Restricts the calling thread to the cores of NUMA node 'node', so that the memory
+  // it touches first is allocated on that node.  Returns false if the affinity can't
+  // be set.
+  static bool PinThreadToNumaNode(int node);
+
   static std::string DebugString();
 
  private:
@@ -86,6 +115,13 @@ class CpuInfo {
   static long cache_sizes_[L3_CACHE + 1];
   static int64_t cycles_per_ms_;
   static int num_cores_;
+
+  // The cores of each NUMA node, and the node of each core.
+  static std::vector<std::vector<int> > numa_node_cores_;
+  static std::vector<int> core_numa_nodes_;
+
+  // Reads the NUMA topology into numa_node_cores_ and core_numa_nodes_.
+  static void InitNumaNodes();
 };
 
 }
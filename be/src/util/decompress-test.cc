@@ -18,6 +18,7 @@
 #include <gtest/gtest.h>
 #include "util/decompress.h"
 #include "util/compress.h"
+#include "gen-cpp/Descriptors_types.h"
 
 using namespace std;
 using namespace boost;
@@ -89,6 +90,85 @@ TEST_F(DecompressorTest, Snappy) {
   RunTest(Codec::SNAPPY_COMPRESSION);
 }
 
+TEST_F(DecompressorTest, Lz4) {
+  RunTest(Codec::LZ4_COMPRESSION);
+}
+
+TEST_F(DecompressorTest, Zstd) {
+  RunTest(Codec::ZSTD_COMPRESSION);
+}
+
+// Feed a gzip stream of two members to the streaming decompressor a few bytes at
+// a time.
+TEST_F(DecompressorTest, GzipStreaming) {
+  MemPool mem_pool;
+  scoped_ptr<Codec> compressor;
+  scoped_ptr<Codec> decompressor;
+  EXPECT_TRUE(Codec::CreateCompressor(
+      NULL, &mem_pool, false, Codec::GZIP_COMPRESSION, &compressor).ok());
+  EXPECT_TRUE(Codec::CreateDecompressor(
+      NULL, &mem_pool, true, Codec::GZIP_COMPRESSION, &decompressor).ok());
+
+  uint8_t* compressed;
+  int compressed_length = 0;
+  EXPECT_TRUE(compressor->ProcessBlock(sizeof (input_),
+        input_, &compressed_length, &compressed).ok());
+  string stream(reinterpret_cast<char*>(compressed), compressed_length);
+  stream += stream;
+
+  string output;
+  int num_stream_ends = 0;
+  int offset = 0;
+  while (offset < stream.size()) {
+    int input_length = min<int>(100, stream.size() - offset);
+    int bytes_read;
+    int output_length;
+    uint8_t* out;
+    bool stream_end;
+    EXPECT_TRUE(decompressor->ProcessBlockStreaming(input_length,
+        reinterpret_cast<uint8_t*>(&stream[offset]), &bytes_read, &output_length,
+        &out, &stream_end).ok());
+    EXPECT_LE(output_length, Codec::STREAM_OUT_BUF_SIZE);
+    output.append(reinterpret_cast<char*>(out), output_length);
+    if (stream_end) ++num_stream_ends;
+    offset += bytes_read;
+  }
+  EXPECT_EQ(num_stream_ends, 2);
+  ASSERT_EQ(output.size(), 2 * sizeof (input_));
+  EXPECT_TRUE(memcmp(&input_, output.data(), sizeof (input_)) == 0);
+  EXPECT_TRUE(memcmp(&input_, output.data() + sizeof (input_), sizeof (input_)) == 0);
+}
+
+// Raw lz4 does not store the uncompressed length, so it is only decompressed into
+// a buffer of known length.
+TEST_F(DecompressorTest, Lz4Raw) {
+  MemPool mem_pool;
+  Codec* codec;
+  EXPECT_TRUE(Codec::CreateCompressor(
+      NULL, &mem_pool, true, THdfsCompression::LZ4, &codec).ok());
+  scoped_ptr<Codec> compressor(codec);
+  EXPECT_TRUE(Codec::CreateDecompressor(
+      NULL, &mem_pool, true, THdfsCompression::LZ4, &codec).ok());
+  scoped_ptr<Codec> decompressor(codec);
+
+  uint8_t* compressed;
+  int compressed_length = 0;
+  EXPECT_TRUE(compressor->ProcessBlock(sizeof (input_),
+        input_, &compressed_length, &compressed).ok());
+  EXPECT_LT(compressed_length, sizeof (input_));
+
+  uint8_t* output;
+  int out_len = 0;
+  EXPECT_FALSE(decompressor->ProcessBlock(compressed_length,
+        compressed, &out_len, &output).ok());
+
+  out_len = sizeof (input_);
+  output = mem_pool.Allocate(out_len);
+  EXPECT_TRUE(decompressor->ProcessBlock(compressed_length,
+        compressed, &out_len, &output).ok());
+  EXPECT_TRUE(memcmp(&input_, output, sizeof (input_)) == 0);
+}
+
 }
 
 int main(int argc, char **argv) {
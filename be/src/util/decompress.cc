@@ -22,6 +22,9 @@
 #include <zlib.h>
 #include <bzlib.h>
 #include <snappy.h>
+#include <lz4.h>
+#include <zstd.h>
+#include <zstd_errors.h>
 
 using namespace std;
 using namespace boost;
@@ -108,6 +111,37 @@ Status GzipDecompressor::ProcessBlock(int input_length, uint8_t* input,
   return Status::OK;
 }
 
+Status GzipDecompressor::ProcessBlockStreaming(int input_length, uint8_t* input,
+                                               int* input_bytes_read,
+                                               int* output_length,
+                                               uint8_t** output, bool* stream_end) {
+  if (!reuse_buffer_ || out_buffer_ == NULL) {
+    buffer_length_ = STREAM_OUT_BUF_SIZE;
+    out_buffer_ = memory_pool_->Allocate(buffer_length_);
+  }
+
+  stream_.next_in = reinterpret_cast<Bytef*>(input);
+  stream_.avail_in = input_length;
+  stream_.next_out = reinterpret_cast<Bytef*>(out_buffer_);
+  stream_.avail_out = buffer_length_;
+
+  // Z_BUF_ERROR just means that no progress was possible, i.e. there was no input.
+  int ret = inflate(&stream_, Z_NO_FLUSH);
+  if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+    return Status("zlib inflate failed: " +
+        string(stream_.msg != NULL ? stream_.msg : "unknown error"));
+  }
+
+  *input_bytes_read = input_length - stream_.avail_in;
+  *output_length = buffer_length_ - stream_.avail_out;
+  *output = out_buffer_;
+  *stream_end = ret == Z_STREAM_END;
+  if (*stream_end && inflateReset(&stream_) != Z_OK) {
+    return Status("zlib inflateReset failed");
+  }
+  return Status::OK;
+}
+
 BzipDecompressor::BzipDecompressor(MemPool* mem_pool, bool reuse_buffer)
   : Codec(mem_pool, reuse_buffer) {
 }
@@ -258,3 +292,167 @@ Status SnappyBlockDecompressor::ProcessBlock(int input_length, uint8_t* input,
   if (*output_length == 0) *output_length = outp - out_buffer_;
   return Status::OK;
 }
+
+Lz4BlockDecompressor::Lz4BlockDecompressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status Lz4BlockDecompressor::ProcessBlock(int input_length, uint8_t* input,
+                                          int* output_length, uint8_t** output) {
+  bool use_temp = false;
+  // If length is set then the output has been allocated.
+  if (*output_length != 0) {
+    buffer_length_ = *output_length;
+    out_buffer_ = *output;
+  } else if (!reuse_buffer_ || out_buffer_ == NULL) {
+    // Only the uncompressed length of each block is stored, not the total, so
+    // guess that we will need 4x the input length.
+    buffer_length_ = min(static_cast<int64_t>(input_length) * 4,
+        static_cast<int64_t>(MAX_BLOCK_SIZE));
+    out_buffer_ = temp_memory_pool_.Allocate(buffer_length_);
+    use_temp = true;
+  }
+
+  int decompressed_length;
+  bool too_small;
+  while (true) {
+    RETURN_IF_ERROR(
+        DecompressBlocks(input_length, input, &decompressed_length, &too_small));
+    if (!too_small) break;
+    // If the output_length was passed we must have enough room.
+    if (*output_length != 0) {
+      return Status("Too small a buffer passed to Lz4BlockDecompressor");
+    }
+    if (buffer_length_ == MAX_BLOCK_SIZE) {
+      return Status("Decompressor: block size is too big");
+    }
+    temp_memory_pool_.Clear();
+    buffer_length_ = min(static_cast<int64_t>(buffer_length_) * 2,
+        static_cast<int64_t>(MAX_BLOCK_SIZE));
+    out_buffer_ = temp_memory_pool_.Allocate(buffer_length_);
+    use_temp = true;
+  }
+
+  *output = out_buffer_;
+  if (*output_length == 0) *output_length = decompressed_length;
+  if (use_temp) memory_pool_->AcquireData(&temp_memory_pool_, reuse_buffer_);
+  return Status::OK;
+}
+
+Status Lz4BlockDecompressor::DecompressBlocks(int input_length, uint8_t* input,
+                                              int* output_length, bool* too_small) {
+  const int INT_SIZE = sizeof(int32_t);
+  *too_small = false;
+  uint8_t* outp = out_buffer_;
+  uint8_t* out_end = out_buffer_ + buffer_length_;
+  while (input_length > 0) {
+    // Read the uncompressed length of the next block.
+    if (input_length < INT_SIZE) return Status("Lz4: truncated block");
+    int32_t block_length = SerDeUtils::GetInt(input);
+    input += INT_SIZE;
+    input_length -= INT_SIZE;
+    if (block_length < 0) return Status("Lz4: invalid block length");
+    if (block_length > out_end - outp) {
+      *too_small = true;
+      return Status::OK;
+    }
+
+    // A block is compressed in one or more chunks.
+    uint8_t* block_end = outp + block_length;
+    while (outp < block_end) {
+      if (input_length < INT_SIZE) return Status("Lz4: truncated block");
+      int32_t chunk_length = SerDeUtils::GetInt(input);
+      input += INT_SIZE;
+      input_length -= INT_SIZE;
+      if (chunk_length <= 0 || chunk_length > input_length) {
+        return Status("Lz4: truncated block");
+      }
+      int length = LZ4_decompress_safe(reinterpret_cast<const char*>(input),
+          reinterpret_cast<char*>(outp), chunk_length, block_end - outp);
+      if (length <= 0) return Status("Lz4: LZ4_decompress_safe failed");
+      input += chunk_length;
+      input_length -= chunk_length;
+      outp += length;
+    }
+  }
+  *output_length = outp - out_buffer_;
+  return Status::OK;
+}
+
+Lz4Decompressor::Lz4Decompressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status Lz4Decompressor::ProcessBlock(int input_length, uint8_t* input,
+                                     int* output_length, uint8_t** output) {
+  if (*output_length == 0) {
+    return Status("Lz4: the uncompressed length must be passed to Lz4Decompressor");
+  }
+  buffer_length_ = *output_length;
+  out_buffer_ = *output;
+
+  int length = LZ4_decompress_safe(reinterpret_cast<const char*>(input),
+      reinterpret_cast<char*>(out_buffer_), input_length, buffer_length_);
+  if (length < 0) return Status("Lz4: LZ4_decompress_safe failed");
+  if (length != *output_length) {
+    return Status("Lz4: decompressed length does not match the expected length");
+  }
+  return Status::OK;
+}
+
+ZstdDecompressor::ZstdDecompressor(MemPool* mem_pool, bool reuse_buffer)
+  : Codec(mem_pool, reuse_buffer) {
+}
+
+Status ZstdDecompressor::ProcessBlock(int input_length, uint8_t* input,
+                                      int* output_length, uint8_t** output) {
+  bool use_temp = false;
+  // If length is set then the output has been allocated.
+  if (*output_length != 0) {
+    buffer_length_ = *output_length;
+    out_buffer_ = *output;
+  } else if (!reuse_buffer_ || out_buffer_ == NULL) {
+    // The frame header has the uncompressed size if the writer knew it up front.
+    // Hadoop's streaming compressor does not, so otherwise guess that we will need
+    // 2x the input length.
+    unsigned long long content_size = ZSTD_getFrameContentSize(input, input_length);
+    int64_t length = static_cast<int64_t>(input_length) * 2;
+    if (content_size != ZSTD_CONTENTSIZE_UNKNOWN &&
+        content_size != ZSTD_CONTENTSIZE_ERROR) {
+      length = content_size;
+    }
+    if (length > MAX_BLOCK_SIZE) {
+      return Status("Decompressor: block size is too big");
+    }
+    buffer_length_ = length;
+    out_buffer_ = temp_memory_pool_.Allocate(buffer_length_);
+    use_temp = true;
+  }
+
+  size_t ret;
+  while (true) {
+    ret = ZSTD_decompress(out_buffer_, buffer_length_, input, input_length);
+    if (!ZSTD_isError(ret)) break;
+    if (ZSTD_getErrorCode(ret) != ZSTD_error_dstSize_tooSmall) {
+      return Status("zstd: ZSTD_decompress failed: " + string(ZSTD_getErrorName(ret)));
+    }
+    // If the output_length was passed we must have enough room.
+    if (*output_length != 0) {
+      return Status("Too small a buffer passed to ZstdDecompressor");
+    }
+    if (buffer_length_ == MAX_BLOCK_SIZE) {
+      return Status("Decompressor: block size is too big");
+    }
+    temp_memory_pool_.Clear();
+    // The guess may be 0 for an empty (or corrupt) frame.
+    buffer_length_ = min(max(static_cast<int64_t>(buffer_length_) * 2,
+        static_cast<int64_t>(input_length)), static_cast<int64_t>(MAX_BLOCK_SIZE));
+    out_buffer_ = temp_memory_pool_.Allocate(buffer_length_);
+    use_temp = true;
+  }
+
+  *output = out_buffer_;
+  if (*output_length == 0) *output_length = ret;
+  if (use_temp) memory_pool_->AcquireData(&temp_memory_pool_, reuse_buffer_);
+  return Status::OK;
+}
@@ -34,6 +34,12 @@ class GzipDecompressor : public Codec {
   virtual Status ProcessBlock(int input_length, uint8_t* input,
                               int* output_length, uint8_t** output);
 
+  // Inflate the next piece of a gzip or zlib stream.  A decompressor must not be
+  // used for both ProcessBlock() and ProcessBlockStreaming().
+  virtual Status ProcessBlockStreaming(int input_length, uint8_t* input,
+                                       int* input_bytes_read, int* output_length,
+                                       uint8_t** output, bool* stream_end);
+
  protected:
   // Initialize the decompressor.
   virtual Status Init();
@@ -89,5 +95,61 @@ class SnappyBlockDecompressor : public Codec {
 
 };
 
+// Hadoop's Lz4Codec framing (BlockCompressorStream): a sequence of blocks, each
+// the uncompressed length of the block followed by one or more LZ4 compressed
+// chunks, each preceded by its compressed length.
+class Lz4BlockDecompressor : public Codec {
+ public:
+  Lz4BlockDecompressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~Lz4BlockDecompressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // Lz4 does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+ private:
+  // Decompress all blocks of input into out_buffer_.  Sets *too_small instead of
+  // returning an error if the blocks do not fit in buffer_length_ bytes.
+  Status DecompressBlocks(int input_length, uint8_t* input, int* output_length,
+                          bool* too_small);
+};
+
+// Raw LZ4.  The uncompressed length is not stored with the data, so output_length
+// must be passed.
+class Lz4Decompressor : public Codec {
+ public:
+  Lz4Decompressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~Lz4Decompressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // Lz4 does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+};
+
+// One or more zstd frames, as written by Hadoop's ZStandardCodec.
+class ZstdDecompressor : public Codec {
+ public:
+  ZstdDecompressor(MemPool* mem_pool, bool reuse_buffer);
+  virtual ~ZstdDecompressor() { }
+
+  //Process a block of data.
+  virtual Status ProcessBlock(int input_length, uint8_t* input,
+                              int* output_length, uint8_t** output);
+
+ protected:
+  // The one shot zstd API does not need initialization
+  virtual Status Init() { return Status::OK; }
+
+};
+
 }
 #endif
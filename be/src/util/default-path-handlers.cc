@@ -14,19 +14,45 @@
 
 #include <sstream>
 #include <fstream>
+#include <stdlib.h>
+#include <unistd.h>
 #include <sys/stat.h>
+#include <boost/lexical_cast.hpp>
+#include <boost/thread/mutex.hpp>
+#include <google/profiler.h>
 
 #include "common/logging.h"
+#include "util/cpu-dispatch.h"
+#include "util/cpu-info.h"
 #include "util/default-path-handlers.h"
 #include "util/webserver.h"
 #include "util/logging.h"
 
+using namespace boost;
 using namespace std;
 using namespace google;
 using namespace impala;
 
 DEFINE_int64(web_log_bytes, 1024 * 1024, 
     "The maximum number of bytes to display on the debug webserver's log page");
+DEFINE_int32(web_profile_seconds, 30, "The default number of seconds for which the "
+    "debug webserver's /profile and /heap pages collect a profile");
+DECLARE_string(max_cpu_dispatch_level);
+
+// Defined by tcmalloc's heap profiler, which only impalad links in (see
+// service/CMakeLists.txt).  Weak, so the other binaries don't need tcmalloc; the
+// functions are NULL in them.
+extern "C" {
+void HeapProfilerStart(const char* prefix) __attribute__((weak));
+void HeapProfilerStop() __attribute__((weak));
+int IsHeapProfilerRunning() __attribute__((weak));
+char* GetHeapProfile() __attribute__((weak));
+}
+
+static const int MAX_PROFILE_SECONDS = 600;
+
+// Only one profile is collected at a time; the profilers are process-wide.
+static mutex profile_lock;
 
 // Writes the last FLAGS_web_log_bytes of the INFO logfile to a webpage
 // Note to get best performance, set GLOG_logbuflevel=-1 to prevent log buffering
@@ -61,7 +87,102 @@ void FlagsHandler(stringstream* output) {
   (*output) << "<pre>" << CommandlineFlagsIntoString() << "</pre>";
 }
 
+// Registered to handle "/cpu": prints the cpu info and the variant that each
+// CpuDispatch kernel uses on this machine.
+void CpuHandler(stringstream* output) {
+  (*output) << "<h2>Cpu</h2>" << endl;
+  (*output) << "<pre>" << CpuInfo::DebugString() << "</pre>" << endl;
+  (*output) << "<h2>Kernels</h2>" << endl;
+  (*output) << "Dispatch level: " << CpuDispatch::LevelName(CpuDispatch::cpu_level())
+            << " (--max_cpu_dispatch_level=" << FLAGS_max_cpu_dispatch_level << ")"
+            << endl;
+  (*output) << "<table><tr><th>Kernel</th><th>Variant</th><th>Most capable variant"
+            << "</th></tr>" << endl;
+  const vector<CpuDispatch::Kernel*>& kernels = CpuDispatch::kernels();
+  for (int i = 0; i < kernels.size(); ++i) {
+    (*output) << "<tr><td>" << kernels[i]->name() << "</td><td>"
+              << CpuDispatch::LevelName(kernels[i]->level()) << "</td><td>"
+              << CpuDispatch::LevelName(kernels[i]->max_level()) << "</td></tr>" << endl;
+  }
+  (*output) << "</table>" << endl;
+}
+
+// Returns the "seconds" argument of a profile request, or FLAGS_web_profile_seconds if
+// there is none, limited to MAX_PROFILE_SECONDS.
+static int GetProfileSeconds(const Webserver::ArgumentMap& args) {
+  int seconds = FLAGS_web_profile_seconds;
+  Webserver::ArgumentMap::const_iterator it = args.find("seconds");
+  if (it != args.end()) {
+    try {
+      seconds = lexical_cast<int>(it->second);
+    } catch (bad_lexical_cast&) {
+    }
+  }
+  return max(1, min(seconds, MAX_PROFILE_SECONDS));
+}
+
+// Registered to handle "/profile?seconds=N": collects a cpu profile of the process for
+// N seconds and returns it in pprof's format, e.g. for
+//   curl host:25000/profile?seconds=30 > cpu.prof; pprof --svg impalad cpu.prof
+// Functions generated by llvm are not symbolized.
+void CpuProfileHandler(const Webserver::ArgumentMap& args, stringstream* output) {
+  int seconds = GetProfileSeconds(args);
+  mutex::scoped_try_lock l(profile_lock);
+  if (!l.owns_lock()) {
+    (*output) << "Another profile is being collected" << endl;
+    return;
+  }
+  stringstream path;
+  path << "/tmp/impala-cpu-profile." << getpid();
+  // Fails if the profiler is already running, e.g. because of $CPUPROFILE.
+  if (!ProfilerStart(path.str().c_str())) {
+    (*output) << "Couldn't start the cpu profiler" << endl;
+    return;
+  }
+  LOG(INFO) << "Collecting a cpu profile for " << seconds << "s";
+  sleep(seconds);
+  ProfilerStop();
+  ifstream profile(path.str().c_str(), ios::in | ios::binary);
+  (*output) << profile.rdbuf();
+  unlink(path.str().c_str());
+}
+
+// Registered to handle "/heap?seconds=N": records the allocations of the process for N
+// seconds and returns the heap profile, which shows the memory allocated meanwhile
+// that is still in use, in pprof's format.  If the heap profiler is already running
+// (because of $HEAPPROFILE), returns its current profile right away.
+void HeapProfileHandler(const Webserver::ArgumentMap& args, stringstream* output) {
+  if (HeapProfilerStart == NULL) {
+    (*output) << "Heap profiling is not available: this process isn't linked with "
+              << "tcmalloc" << endl;
+    return;
+  }
+  int seconds = GetProfileSeconds(args);
+  mutex::scoped_try_lock l(profile_lock);
+  if (!l.owns_lock()) {
+    (*output) << "Another profile is being collected" << endl;
+    return;
+  }
+  char* profile;
+  if (IsHeapProfilerRunning()) {
+    profile = GetHeapProfile();
+  } else {
+    stringstream prefix;
+    prefix << "/tmp/impala-heap-profile." << getpid();
+    HeapProfilerStart(prefix.str().c_str());
+    LOG(INFO) << "Collecting a heap profile for " << seconds << "s";
+    sleep(seconds);
+    profile = GetHeapProfile();
+    HeapProfilerStop();
+  }
+  (*output) << profile;
+  free(profile);
+}
+
 void impala::AddDefaultPathHandlers(Webserver* webserver) {
   webserver->RegisterPathHandler("/logs", LogsHandler);
   webserver->RegisterPathHandler("/varz", FlagsHandler);
+  webserver->RegisterPathHandler("/cpu", CpuHandler);
+  webserver->RegisterRawPathHandler("/profile", CpuProfileHandler);
+  webserver->RegisterRawPathHandler("/heap", HeapProfileHandler);
 }
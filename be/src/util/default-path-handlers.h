@@ -20,7 +20,7 @@ namespace impala {
 class Webserver;
 
 // Adds a set of default path handlers to the webserver to display
-// logs and configuration flags
+// logs, configuration flags and the cpu dispatch, and to collect cpu and heap profiles
 void AddDefaultPathHandlers(Webserver* webserver);
 }
 
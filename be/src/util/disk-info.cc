@@ -14,6 +14,8 @@
 
 #include "util/disk-info.h"
 
+#include <limits.h>
+#include <stdlib.h>
 #include <sys/vfs.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -89,8 +91,46 @@ void DiskInfo::GetDeviceNames() {
   }
 }
 
+void DiskInfo::GetDeviceTypes() {
+  for (int i = 0; i < disks_.size(); ++i) {
+    // The file contains "1" for rotational disks and "0" for flash.  It is missing
+    // for devices that are not block devices (or on very old kernels), those keep
+    // the default.
+    string path = "/sys/block/" + disks_[i].name + "/queue/rotational";
+    ifstream rotational(path.c_str(), ios::in);
+    if (!rotational.good()) continue;
+    int value;
+    rotational >> value;
+    if (!rotational.fail()) disks_[i].is_rotational = (value != 0);
+    rotational.close();
+  }
+}
+
+void DiskInfo::GetDeviceNumaNodes() {
+  for (int i = 0; i < disks_.size(); ++i) {
+    string link = "/sys/block/" + disks_[i].name + "/device";
+    char resolved[PATH_MAX];
+    if (realpath(link.c_str(), resolved) == NULL) continue;
+    // Block devices themselves have no numa_node file; the pci device of the
+    // controller, somewhere above, does.  It contains -1 if the kernel doesn't know.
+    string dir = resolved;
+    while (dir.size() > string("/sys/devices").size()) {
+      ifstream numa_node((dir + "/numa_node").c_str(), ios::in);
+      if (numa_node.good()) {
+        int value;
+        numa_node >> value;
+        if (!numa_node.fail()) disks_[i].numa_node = value;
+        break;
+      }
+      dir = dir.substr(0, dir.rfind('/'));
+    }
+  }
+}
+
 void DiskInfo::Init() {
   GetDeviceNames();
+  GetDeviceTypes();
+  GetDeviceNumaNodes();
   initialized_ = true;
   LOG(INFO) << DiskInfo::DebugString();
 }
@@ -109,7 +149,8 @@ string DiskInfo::DebugString() {
   stream << "Disk Info: " << endl;
   stream << "  Num disks " << num_disks() << ": ";
   for (int i = 0; i < disks_.size(); ++i) {
-    stream << disks_[i].name;
+    stream << disks_[i].name << (disks_[i].is_rotational ? " (rotational)" : " (flash)");
+    if (disks_[i].numa_node >= 0) stream << " (numa node " << disks_[i].numa_node << ")";
     if (i < num_disks() - 1) stream << ", ";
   }
   stream << endl;
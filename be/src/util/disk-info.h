@@ -66,6 +66,21 @@ class DiskInfo {
     DCHECK_LT(disk_id, disks_.size());
     return disks_[disk_id].name;
   }
+
+  // Returns true if disk_id is a rotational (spinning) disk, false if it is flash.
+  // Disks whose type cannot be determined are treated as rotational.
+  static bool is_rotational(int disk_id) {
+    DCHECK_GE(disk_id, 0);
+    DCHECK_LT(disk_id, disks_.size());
+    return disks_[disk_id].is_rotational;
+  }
+
+  // Returns the NUMA node of the controller of disk_id, or -1 if it is not known.
+  static int numa_node(int disk_id) {
+    DCHECK_GE(disk_id, 0);
+    DCHECK_LT(disk_id, disks_.size());
+    return disks_[disk_id].numa_node;
+  }
   
   static std::string DebugString();
 
@@ -80,7 +95,16 @@ class DiskInfo {
     // our structures
     int id;
 
-    Disk(const std::string& name = "", int id = -1) : name(name), id(id) {}
+    // If true, this is a spinning disk.  Read from
+    // /sys/block/<name>/queue/rotational.
+    bool is_rotational;
+
+    // NUMA node of the disk's controller, -1 if unknown.  Read from the numa_node file
+    // of the closest (pci) device above /sys/block/<name>/device.
+    int numa_node;
+
+    Disk(const std::string& name = "", int id = -1)
+      : name(name), id(id), is_rotational(true), numa_node(-1) {}
   };
 
   // All disks
@@ -95,6 +119,12 @@ class DiskInfo {
   static int num_datanode_dirs_;
 
   static void GetDeviceNames();
+
+  // Sets is_rotational for all disks.
+  static void GetDeviceTypes();
+
+  // Sets numa_node for all disks.
+  static void GetDeviceNumaNodes();
 };
 
 
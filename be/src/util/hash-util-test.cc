@@ -0,0 +1,115 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <set>
+#include <vector>
+#include <gtest/gtest.h>
+
+#include "util/cpu-info.h"
+#include "util/hash-util.h"
+
+using namespace std;
+
+namespace impala {
+
+#ifdef __SSE4_2__
+// Reference implementation, one byte at a time.
+static uint32_t BytewiseCrc(const uint8_t* data, int bytes, uint32_t hash) {
+  for (int i = 0; i < bytes; ++i) hash = _mm_crc32_u8(hash, data[i]);
+  return hash;
+}
+
+class HashUtilTest : public testing::Test {
+ protected:
+  virtual void SetUp() {
+    for (int i = 0; i < 1024; ++i) data_.push_back(i * 7 + (i >> 3));
+  }
+
+  vector<uint8_t> data_;
+};
+
+// The width of the crc steps doesn't change the hash values.
+TEST_F(HashUtilTest, CrcHash) {
+  if (!CpuInfo::IsSupported(CpuInfo::SSE4_2)) return;
+  for (int len = 0; len < 40; ++len) {
+    for (int offset = 0; offset < 8; ++offset) {
+      EXPECT_EQ(HashUtil::CrcHash(&data_[offset], len, 17),
+          BytewiseCrc(&data_[offset], len, 17)) << len << " " << offset;
+    }
+  }
+}
+
+TEST_F(HashUtilTest, CrcHash64) {
+  if (!CpuInfo::IsSupported(CpuInfo::SSE4_2)) return;
+  uint64_t seed = 0x123456789ULL;
+  for (int len = 0; len < 40; ++len) {
+    uint64_t hash = HashUtil::CrcHash64(&data_[0], len, seed);
+    EXPECT_EQ(static_cast<uint32_t>(hash), HashUtil::CrcHash(&data_[0], len, seed));
+  }
+
+  // The high bits aren't a function of the low bits: keys whose 32-bit hashes
+  // collide still get different 64-bit hashes.
+  set<uint32_t> low_hashes;
+  set<uint64_t> hashes;
+  for (int64_t i = 0; i < 100000; ++i) {
+    uint64_t hash = HashUtil::CrcHash64(&i, sizeof(i), 0);
+    low_hashes.insert(static_cast<uint32_t>(hash));
+    hashes.insert(hash);
+  }
+  EXPECT_EQ(hashes.size(), 100000);
+  set<uint32_t> high_hashes;
+  for (set<uint64_t>::iterator it = hashes.begin(); it != hashes.end(); ++it) {
+    high_hashes.insert(*it >> 32);
+  }
+  EXPECT_GT(high_hashes.size(), 99000);
+}
+
+TEST_F(HashUtilTest, CrcHashBatch) {
+  if (!CpuInfo::IsSupported(CpuInfo::SSE4_2)) return;
+  uint32_t hashes[64];
+  for (int key_len = 1; key_len <= 16; ++key_len) {
+    // also covers the keys that don't fill a group of four
+    int num_keys = 1024 / 16 - key_len % 4;
+    HashUtil::CrcHashBatch(&data_[0], key_len, num_keys, 3, hashes);
+    for (int i = 0; i < num_keys; ++i) {
+      EXPECT_EQ(hashes[i], HashUtil::CrcHash(&data_[i * key_len], key_len, 3))
+          << key_len << " " << i;
+    }
+  }
+}
+#endif
+
+TEST(HashUtilFvnTest, HashBatch) {
+  int64_t keys[10];
+  for (int i = 0; i < 10; ++i) keys[i] = i * 1000;
+  uint32_t hashes[10];
+  HashUtil::HashBatch(keys, sizeof(int64_t), 10, 0, hashes);
+  for (int i = 0; i < 10; ++i) {
+    EXPECT_EQ(hashes[i], HashUtil::Hash(&keys[i], sizeof(int64_t), 0));
+  }
+}
+
+TEST(HashUtilFvnTest, FvnHash64) {
+  // Reference values of the 64-bit FNV-1a hash.
+  EXPECT_EQ(HashUtil::FvnHash64("", 0, HashUtil::FVN64_SEED), 0xcbf29ce484222325ULL);
+  EXPECT_EQ(HashUtil::FvnHash64("a", 1, HashUtil::FVN64_SEED), 0xaf63dc4c8601ec8cULL);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  impala::CpuInfo::Init();
+  return RUN_ALL_TESTS();
+}
@@ -16,6 +16,8 @@
 #ifndef IMPALA_UTIL_HASH_UTIL_H
 #define IMPALA_UTIL_HASH_UTIL_H
 
+#include <string.h>
+
 #include "common/logging.h"
 #include "common/compiler-util.h"
 
@@ -26,6 +28,7 @@
 #ifdef __SSE4_2__
 #include <nmmintrin.h>
 #endif
+#include "util/cpu-dispatch.h"
 #include "util/cpu-info.h"
 
 namespace impala {
@@ -33,30 +36,90 @@ namespace impala {
 // Utility class to compute hash values.   
 class HashUtil {
  public:
+  // Selects between the crc (sse4.2) and fvn variants of Hash(), Hash64() and
+  // HashBatch(), and of the codegen'd hash functions.
+  static CpuDispatch::Kernel HASH_KERNEL;
+
 #ifdef __SSE4_2__
   // Compute the Crc32 hash for data using SSE4 instructions.  The input hash parameter is 
   // the current hash/seed value.
   // This should only be called if SSE is supported.
   // This is ~4x faster than Fvn/Boost Hash.
+  // The data is consumed 8 bytes at a time; the crc of a 64-bit word is the same as
+  // the crc of its bytes, so the result doesn't depend on the step width (and matches
+  // the codegen'd hash functions, see LlvmCodeGen::GetHashFunction()).
   static uint32_t CrcHash(const void* data, int32_t bytes, uint32_t hash) {
     DCHECK(CpuInfo::IsSupported(CpuInfo::SSE4_2));
-    uint32_t words = bytes / sizeof(uint32_t);
-    bytes = bytes % sizeof(uint32_t);
-
-    const uint32_t* p = reinterpret_cast<const uint32_t*>(data);
-    while (words--) {
-      hash = _mm_crc32_u32(hash, *p);
-      ++p;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t hash64 = hash;
+    while (bytes >= 8) {
+      hash64 = _mm_crc32_u64(hash64, *reinterpret_cast<const uint64_t*>(p));
+      p += 8;
+      bytes -= 8;
     }
+    return CrcHashTail(p, bytes, hash64);
+  } 
 
-    const uint8_t* s = reinterpret_cast<const uint8_t*>(p);
-    while (bytes--) {
-      hash = _mm_crc32_u8(hash, *s);
-      ++s;
+  // 64-bit variant of CrcHash, for large hash tables and filters that need more than
+  // 32 bits.  The low 32 bits are CrcHash(data, bytes, hash), the high 32 bits are a
+  // second crc stream over the data multiplied by an odd constant.  (A crc of the same
+  // data with another seed would only differ from the first one by a constant.)
+  static uint64_t CrcHash64(const void* data, int32_t bytes, uint64_t hash) {
+    DCHECK(CpuInfo::IsSupported(CpuInfo::SSE4_2));
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(data);
+    uint64_t low = static_cast<uint32_t>(hash);
+    uint64_t high = hash >> 32;
+    while (bytes >= 8) {
+      uint64_t word = *reinterpret_cast<const uint64_t*>(p);
+      low = _mm_crc32_u64(low, word);
+      high = _mm_crc32_u64(high, word * CRC64_MULTIPLIER);
+      p += 8;
+      bytes -= 8;
     }
+    if (bytes > 0) {
+      uint64_t word = 0;
+      memcpy(&word, p, bytes);
+      low = CrcHashTail(p, bytes, low);
+      high = _mm_crc32_u64(high, word * CRC64_MULTIPLIER);
+    }
+    return (high << 32) | low;
+  }
 
-    return hash;
-  } 
+  // Computes hashes[i] = CrcHash(keys + i * key_len, key_len, seed) for 'num_keys'
+  // keys that are stored back to back.  The keys are hashed four at a time, in
+  // interleaved, independent crc streams: a crc32 instruction has a latency of three
+  // cycles but a throughput of one per cycle, which a single stream can't use.
+  static void CrcHashBatch(const void* keys, int32_t key_len, int num_keys,
+      uint32_t seed, uint32_t* hashes) {
+    DCHECK(CpuInfo::IsSupported(CpuInfo::SSE4_2));
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(keys);
+    int i = 0;
+    for (; i + 4 <= num_keys; i += 4, p += 4 * key_len) {
+      const uint8_t* k0 = p;
+      const uint8_t* k1 = k0 + key_len;
+      const uint8_t* k2 = k1 + key_len;
+      const uint8_t* k3 = k2 + key_len;
+      uint64_t h0 = seed;
+      uint64_t h1 = seed;
+      uint64_t h2 = seed;
+      uint64_t h3 = seed;
+      int32_t offset = 0;
+      for (; offset + 8 <= key_len; offset += 8) {
+        h0 = _mm_crc32_u64(h0, *reinterpret_cast<const uint64_t*>(k0 + offset));
+        h1 = _mm_crc32_u64(h1, *reinterpret_cast<const uint64_t*>(k1 + offset));
+        h2 = _mm_crc32_u64(h2, *reinterpret_cast<const uint64_t*>(k2 + offset));
+        h3 = _mm_crc32_u64(h3, *reinterpret_cast<const uint64_t*>(k3 + offset));
+      }
+      int32_t tail = key_len - offset;
+      hashes[i] = CrcHashTail(k0 + offset, tail, h0);
+      hashes[i + 1] = CrcHashTail(k1 + offset, tail, h1);
+      hashes[i + 2] = CrcHashTail(k2 + offset, tail, h2);
+      hashes[i + 3] = CrcHashTail(k3 + offset, tail, h3);
+    }
+    for (; i < num_keys; ++i, p += key_len) {
+      hashes[i] = CrcHash(p, key_len, seed);
+    }
+  }
 #endif
 
   // default values recommended by http://isthe.com/chongo/tech/comp/fnv/
@@ -78,11 +141,24 @@ class HashUtil {
     return hash;
   }
 
+  static const uint64_t FVN64_PRIME = 0x100000001b3ULL;
+  static const uint64_t FVN64_SEED = 0xcbf29ce484222325ULL;
+
+  // 64-bit version of FvnHash.
+  static uint64_t FvnHash64(const void* data, int32_t bytes, uint64_t hash) {
+    const uint8_t* ptr = reinterpret_cast<const uint8_t*>(data);
+    while (bytes--) {
+      hash = (*ptr ^ hash) * FVN64_PRIME;
+      ++ptr;
+    }
+    return hash;
+  }
+
   // Computes the hash value for data.  Will call either CrcHash or FvnHash
-  // depending on hardware capabilities.
+  // depending on the variant of HASH_KERNEL.
   static uint32_t Hash(const void* data, int32_t bytes, uint32_t hash) {
 #ifdef __SSE4_2__
-    if (LIKELY(CpuInfo::IsSupported(CpuInfo::SSE4_2))) {
+    if (LIKELY(HASH_KERNEL.level() >= CpuDispatch::SSE4_2)) {
       return CrcHash(data, bytes, hash);
     } else {
       return FvnHash(data, bytes, hash);
@@ -92,6 +168,56 @@ class HashUtil {
 #endif
   }
 
+  // 64-bit version of Hash(), which calls either CrcHash64 or FvnHash64.
+  static uint64_t Hash64(const void* data, int32_t bytes, uint64_t hash) {
+#ifdef __SSE4_2__
+    if (LIKELY(HASH_KERNEL.level() >= CpuDispatch::SSE4_2)) {
+      return CrcHash64(data, bytes, hash);
+    } else {
+      return FvnHash64(data, bytes, hash);
+    }
+#else
+    return FvnHash64(data, bytes, hash);
+#endif
+  }
+
+  // Hashes 'num_keys' keys of 'key_len' bytes each that are stored back to back into
+  // 'hashes', like calling Hash(key, key_len, seed) for each of them.
+  static void HashBatch(const void* keys, int32_t key_len, int num_keys, uint32_t seed,
+      uint32_t* hashes) {
+#ifdef __SSE4_2__
+    if (LIKELY(HASH_KERNEL.level() >= CpuDispatch::SSE4_2)) {
+      CrcHashBatch(keys, key_len, num_keys, seed, hashes);
+      return;
+    }
+#endif
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(keys);
+    for (int i = 0; i < num_keys; ++i, p += key_len) {
+      hashes[i] = FvnHash(p, key_len, seed);
+    }
+  }
+
+ private:
+#ifdef __SSE4_2__
+  static const uint64_t CRC64_MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+
+  // Hashes the last 'bytes' (< 8) bytes of the data at 'p' into 'hash'.
+  static uint32_t CrcHashTail(const uint8_t* p, int32_t bytes, uint32_t hash) {
+    DCHECK_LT(bytes, 8);
+    if (bytes >= 4) {
+      hash = _mm_crc32_u32(hash, *reinterpret_cast<const uint32_t*>(p));
+      p += 4;
+      bytes -= 4;
+    }
+    if (bytes >= 2) {
+      hash = _mm_crc32_u16(hash, *reinterpret_cast<const uint16_t*>(p));
+      p += 2;
+      bytes -= 2;
+    }
+    if (bytes > 0) hash = _mm_crc32_u8(hash, *p);
+    return hash;
+  }
+#endif
 };
 
 }
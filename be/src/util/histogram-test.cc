@@ -0,0 +1,110 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <limits>
+#include <gtest/gtest.h>
+
+#include "util/histogram.h"
+
+using namespace std;
+
+namespace impala {
+
+TEST(HistogramTest, Buckets) {
+  for (uint64_t i = 0; i < Histogram::SUB_BUCKETS; ++i) {
+    EXPECT_EQ(Histogram::GetBucketIdx(i), i);
+    EXPECT_EQ(Histogram::GetBucketUpperBound(i), i);
+  }
+  // Every value is counted in a bucket whose bounds contain it, and bucket widths are
+  // at most 1/SUB_BUCKETS of their values.
+  uint64_t values[] = { 16, 17, 31, 32, 33, 1000, 1023, 1024, 123456789,
+      numeric_limits<int64_t>::max(), numeric_limits<uint64_t>::max() };
+  for (int i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    int idx = Histogram::GetBucketIdx(values[i]);
+    ASSERT_LT(idx, Histogram::NUM_BUCKETS);
+    uint64_t upper_bound = Histogram::GetBucketUpperBound(idx);
+    uint64_t lower_bound = Histogram::GetBucketUpperBound(idx - 1) + 1;
+    EXPECT_LE(values[i], upper_bound);
+    EXPECT_GE(values[i], lower_bound);
+    EXPECT_LE(upper_bound - lower_bound, values[i] / Histogram::SUB_BUCKETS);
+  }
+  EXPECT_EQ(Histogram::GetBucketIdx(numeric_limits<uint64_t>::max()),
+      Histogram::NUM_BUCKETS - 1);
+}
+
+TEST(HistogramTest, Percentiles) {
+  Histogram histogram(TCounterType::UNIT);
+  EXPECT_EQ(histogram.GetPercentile(50), 0);
+  EXPECT_EQ(histogram.ToString(), "count=0");
+  for (int i = 1; i <= 1000; ++i) {
+    histogram.Add(i);
+  }
+  EXPECT_EQ(histogram.count(), 1000);
+  EXPECT_EQ(histogram.sum(), 500500);
+  EXPECT_EQ(histogram.min_value(), 1);
+  EXPECT_EQ(histogram.max_value(), 1000);
+  EXPECT_EQ(histogram.GetPercentile(0), 1);
+  EXPECT_EQ(histogram.GetPercentile(100), 1000);
+  // Percentiles are exact up to the width of the buckets.
+  int64_t p50 = histogram.GetPercentile(50);
+  EXPECT_GE(p50, 500);
+  EXPECT_LE(p50, 500 + 500 / Histogram::SUB_BUCKETS);
+  int64_t p99 = histogram.GetPercentile(99);
+  EXPECT_GE(p99, 990);
+  EXPECT_LE(p99, 1000);
+
+  histogram.Add(-5);
+  EXPECT_EQ(histogram.min_value(), 0);
+  histogram.Reset();
+  EXPECT_EQ(histogram.count(), 0);
+  EXPECT_EQ(histogram.max_value(), 0);
+}
+
+TEST(HistogramTest, MergeAndThrift) {
+  Histogram a(TCounterType::CPU_TICKS);
+  Histogram b(TCounterType::CPU_TICKS);
+  Histogram all(TCounterType::CPU_TICKS);
+  for (int i = 0; i < 100; ++i) {
+    a.Add(i * 7);
+    b.Add(i * 1000);
+    all.Add(i * 7);
+    all.Add(i * 1000);
+  }
+  a.Merge(b);
+  EXPECT_EQ(a.count(), all.count());
+  EXPECT_EQ(a.sum(), all.sum());
+  EXPECT_EQ(a.max_value(), 99000);
+  for (int p = 0; p <= 100; p += 5) {
+    EXPECT_EQ(a.GetPercentile(p), all.GetPercentile(p));
+  }
+
+  THistogram thistogram;
+  a.ToThrift("Name", &thistogram);
+  EXPECT_EQ(thistogram.name, "Name");
+  Histogram copy(TCounterType::CPU_TICKS);
+  copy.Add(1);
+  copy.SetFromThrift(thistogram);
+  EXPECT_EQ(copy.count(), a.count());
+  EXPECT_EQ(copy.sum(), a.sum());
+  EXPECT_EQ(copy.min_value(), a.min_value());
+  EXPECT_EQ(copy.max_value(), a.max_value());
+  EXPECT_EQ(copy.ToString(), a.ToString());
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
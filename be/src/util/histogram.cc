@@ -0,0 +1,155 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/histogram.h"
+
+#include <math.h>
+#include <cstring>
+#include <limits>
+#include <sstream>
+
+#include "common/logging.h"
+#include "util/debug-util.h"
+
+using namespace std;
+
+namespace impala {
+
+const int Histogram::SUB_BUCKET_BITS;
+const int Histogram::SUB_BUCKETS;
+const int Histogram::NUM_BUCKETS;
+
+Histogram::Histogram(TCounterType::type type) : type_(type) {
+  Reset();
+}
+
+int Histogram::GetBucketIdx(uint64_t value) {
+  if (value < SUB_BUCKETS) return value;
+  // 'value' has its highest bit at position msb >= SUB_BUCKET_BITS; the SUB_BUCKET_BITS
+  // bits below it pick the sub bucket.
+  int msb = 63 - __builtin_clzll(value);
+  int shift = msb - SUB_BUCKET_BITS;
+  int sub_bucket = (value >> shift) - SUB_BUCKETS;
+  return SUB_BUCKETS + shift * SUB_BUCKETS + sub_bucket;
+}
+
+uint64_t Histogram::GetBucketUpperBound(int bucket_idx) {
+  DCHECK_GE(bucket_idx, 0);
+  DCHECK_LT(bucket_idx, NUM_BUCKETS);
+  if (bucket_idx < SUB_BUCKETS) return bucket_idx;
+  int shift = (bucket_idx - SUB_BUCKETS) / SUB_BUCKETS;
+  uint64_t sub_bucket = (bucket_idx - SUB_BUCKETS) % SUB_BUCKETS;
+  uint64_t lower_bound = (SUB_BUCKETS + sub_bucket) << shift;
+  return lower_bound + ((1ULL << shift) - 1);
+}
+
+void Histogram::Add(int64_t value) {
+  if (value < 0) value = 0;
+  __sync_fetch_and_add(&buckets_[GetBucketIdx(value)], 1);
+  __sync_fetch_and_add(&count_, 1);
+  __sync_fetch_and_add(&sum_, value);
+  int64_t old_min = min_;
+  while (value < old_min) {
+    int64_t prev = __sync_val_compare_and_swap(&min_, old_min, value);
+    if (prev == old_min) break;
+    old_min = prev;
+  }
+  int64_t old_max = max_;
+  while (value > old_max) {
+    int64_t prev = __sync_val_compare_and_swap(&max_, old_max, value);
+    if (prev == old_max) break;
+    old_max = prev;
+  }
+}
+
+void Histogram::Merge(const Histogram& other) {
+  DCHECK_EQ(type_, other.type_);
+  if (other.count_ == 0) return;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    buckets_[i] += other.buckets_[i];
+  }
+  count_ += other.count_;
+  sum_ += other.sum_;
+  min_ = std::min(min_, other.min_);
+  max_ = std::max(max_, other.max_);
+}
+
+void Histogram::Reset() {
+  count_ = 0;
+  sum_ = 0;
+  min_ = numeric_limits<int64_t>::max();
+  max_ = 0;
+  memset(buckets_, 0, sizeof(buckets_));
+}
+
+int64_t Histogram::GetPercentile(double percentile) const {
+  if (count_ == 0) return 0;
+  // rank of the value, starting at 1
+  int64_t rank = static_cast<int64_t>(ceil(percentile / 100.0 * count_));
+  rank = std::max<int64_t>(1, std::min(count_, rank));
+  int64_t num_values = 0;
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    num_values += buckets_[i];
+    if (num_values >= rank) {
+      uint64_t upper_bound = GetBucketUpperBound(i);
+      if (upper_bound >= max_) return max_;
+      return std::max<int64_t>(min_, upper_bound);
+    }
+  }
+  DCHECK(false);
+  return max_;
+}
+
+string Histogram::ToString() const {
+  stringstream ss;
+  ss << "count=" << count_;
+  if (count_ > 0) {
+    ss << " min=" << PrettyPrinter::Print(min_value(), type_)
+       << " p50=" << PrettyPrinter::Print(GetPercentile(50), type_)
+       << " p95=" << PrettyPrinter::Print(GetPercentile(95), type_)
+       << " p99=" << PrettyPrinter::Print(GetPercentile(99), type_)
+       << " max=" << PrettyPrinter::Print(max_value(), type_);
+  }
+  return ss.str();
+}
+
+void Histogram::ToThrift(const string& name, THistogram* histogram) const {
+  histogram->name = name;
+  histogram->type = type_;
+  histogram->buckets.clear();
+  for (int i = 0; i < NUM_BUCKETS; ++i) {
+    if (buckets_[i] != 0) histogram->buckets[i] = buckets_[i];
+  }
+  histogram->min_value = min_value();
+  histogram->max_value = max_value();
+  histogram->sum = sum_;
+}
+
+void Histogram::SetFromThrift(const THistogram& histogram) {
+  DCHECK_EQ(type_, histogram.type);
+  Reset();
+  for (map<int32_t, int64_t>::const_iterator it = histogram.buckets.begin();
+       it != histogram.buckets.end(); ++it) {
+    if (it->first < 0 || it->first >= NUM_BUCKETS) continue;
+    buckets_[it->first] = it->second;
+    count_ += it->second;
+  }
+  if (count_ > 0) {
+    min_ = histogram.min_value;
+    max_ = histogram.max_value;
+  }
+  sum_ = histogram.sum;
+}
+
+}
@@ -0,0 +1,87 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_HISTOGRAM_H
+#define IMPALA_UTIL_HISTOGRAM_H
+
+#include <string>
+#include <boost/cstdint.hpp>
+
+#include "gen-cpp/RuntimeProfile_types.h"
+
+namespace impala {
+
+// Histogram of non-negative 64-bit values (negative values count as 0), for the
+// distributions of latencies and sizes in runtime profiles.  Like an HDR histogram,
+// the buckets are log-linear: values below SUB_BUCKETS have a bucket each, and each
+// larger power of two is split into SUB_BUCKETS buckets of equal width, so that
+// percentiles are off by at most 1/SUB_BUCKETS of the value.  Histograms of the same
+// values from different fragment instances merge exactly.
+// Add() is thread safe and lock free; the other functions must not be called
+// concurrently with modifications.
+class Histogram {
+ public:
+  explicit Histogram(TCounterType::type type);
+
+  // Adds 'value' to the histogram.
+  void Add(int64_t value);
+
+  // Adds all the values of 'other'.
+  void Merge(const Histogram& other);
+
+  // Removes all values.
+  void Reset();
+
+  // Returns the smallest value v such that 'percentile' percent of the values are
+  // <= v, up to the precision of the buckets.  Returns 0 if there are no values.
+  int64_t GetPercentile(double percentile) const;
+
+  TCounterType::type type() const { return type_; }
+  int64_t count() const { return count_; }
+  int64_t sum() const { return sum_; }
+  int64_t min_value() const { return count_ == 0 ? 0 : min_; }
+  int64_t max_value() const { return count_ == 0 ? 0 : max_; }
+
+  // Returns e.g. "count=12 min=1ms p50=5ms p95=20ms p99=31ms max=32ms", with the
+  // values printed according to type().
+  std::string ToString() const;
+
+  void ToThrift(const std::string& name, THistogram* histogram) const;
+
+  // Replaces the contents of this histogram with 'histogram'.
+  void SetFromThrift(const THistogram& histogram);
+
+  static const int SUB_BUCKET_BITS = 4;
+  static const int SUB_BUCKETS = 1 << SUB_BUCKET_BITS;
+  static const int NUM_BUCKETS = SUB_BUCKETS * (64 - SUB_BUCKET_BITS + 1);
+
+  // Returns the index of the bucket that 'value' (>= 0) is counted in.
+  static int GetBucketIdx(uint64_t value);
+
+  // Returns the largest value that is counted in bucket 'bucket_idx'.
+  static uint64_t GetBucketUpperBound(int bucket_idx);
+
+ private:
+  TCounterType::type type_;
+  int64_t count_;
+  int64_t sum_;
+  int64_t min_;
+  int64_t max_;
+  int64_t buckets_[NUM_BUCKETS];
+};
+
+}
+
+#endif
@@ -0,0 +1,114 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <string>
+#include <gtest/gtest.h>
+
+#include "util/hash-util.h"
+#include "util/hyper-log-log.h"
+
+using namespace std;
+
+namespace impala {
+
+static uint32_t HashInt(int32_t i) {
+  return HashUtil::Hash(&i, sizeof(i), 0);
+}
+
+// A state with a buffer large enough for any length.
+struct State {
+  char buffer[HyperLogLog::DENSE_LEN];
+  StringValue value;
+
+  State() {
+    value.ptr = buffer;
+    HyperLogLog::Init(&value);
+  }
+
+  void Add(int begin, int end) {
+    for (int i = begin; i < end; ++i) {
+      int len = HyperLogLog::UpdateLen(value, HashInt(i));
+      EXPECT_LE(len, HyperLogLog::DENSE_LEN);
+      HyperLogLog::Update(HashInt(i), &value);
+      EXPECT_EQ(value.len, len);
+    }
+  }
+
+  void Merge(const State& other) {
+    int len = HyperLogLog::MergeLen(value, other.value);
+    HyperLogLog::Merge(other.value, &value);
+    EXPECT_EQ(value.len, len);
+  }
+
+  string ToString() const { return string(value.ptr, value.len); }
+};
+
+TEST(HyperLogLogTest, Empty) {
+  State state;
+  EXPECT_EQ(state.value.len, HyperLogLog::EMPTY_LEN);
+  EXPECT_EQ(HyperLogLog::Estimate(state.value), 0);
+}
+
+TEST(HyperLogLogTest, Sparse) {
+  State state;
+  state.Add(0, 50);
+  // adding the same values again doesn't change the state
+  string before = state.ToString();
+  state.Add(0, 50);
+  EXPECT_EQ(state.ToString(), before);
+  EXPECT_EQ(state.value.ptr[0], HyperLogLog::SPARSE);
+  EXPECT_LE(state.value.len, 1 + 2 * 50);
+  EXPECT_NEAR(HyperLogLog::Estimate(state.value), 50, 3);
+}
+
+TEST(HyperLogLogTest, Dense) {
+  int sizes[] = { 1000, 10000, 1000000 };
+  for (int i = 0; i < sizeof(sizes) / sizeof(int); ++i) {
+    State state;
+    state.Add(0, sizes[i]);
+    EXPECT_EQ(state.value.ptr[0], HyperLogLog::DENSE);
+    EXPECT_NEAR(HyperLogLog::Estimate(state.value), sizes[i], sizes[i] * 0.1);
+  }
+}
+
+TEST(HyperLogLogTest, Merge) {
+  // Merging the states of parts of the values gives the state of all values, for any
+  // combination of formats.
+  int bounds[] = { 0, 10, 30, 200, 5000, 100000 };
+  int num_bounds = sizeof(bounds) / sizeof(int);
+  for (int i = 1; i < num_bounds - 1; ++i) {
+    for (int j = i + 1; j < num_bounds; ++j) {
+      State all;
+      all.Add(0, bounds[j]);
+      State a;
+      a.Add(0, bounds[i]);
+      State b;
+      b.Add(bounds[i], bounds[j]);
+      State merged;
+      merged.Merge(a);
+      merged.Merge(b);
+      EXPECT_EQ(merged.value.ptr[0], all.value.ptr[0]) << bounds[i] << " " << bounds[j];
+      EXPECT_EQ(HyperLogLog::Estimate(merged.value), HyperLogLog::Estimate(all.value));
+      b.Merge(a);
+      EXPECT_EQ(HyperLogLog::Estimate(b.value), HyperLogLog::Estimate(all.value));
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,240 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/hyper-log-log.h"
+
+#include <math.h>
+#include <algorithm>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "common/logging.h"
+
+using namespace std;
+
+namespace impala {
+
+const int HyperLogLog::PRECISION;
+const int HyperLogLog::NUM_REGISTERS;
+const int HyperLogLog::RANK_BITS;
+const int HyperLogLog::MAX_SPARSE_ENTRIES;
+const char HyperLogLog::SPARSE;
+const char HyperLogLog::DENSE;
+const int HyperLogLog::EMPTY_LEN;
+const int HyperLogLog::DENSE_LEN;
+
+static const uint16_t RANK_MASK = (1 << HyperLogLog::RANK_BITS) - 1;
+
+inline uint16_t HyperLogLog::GetEntry(const StringValue& state, int i) {
+  const uint8_t* p = reinterpret_cast<const uint8_t*>(state.ptr) + 1 + 2 * i;
+  return p[0] | (p[1] << 8);
+}
+
+inline void HyperLogLog::SetEntry(StringValue* state, int i, uint16_t entry) {
+  uint8_t* p = reinterpret_cast<uint8_t*>(state->ptr) + 1 + 2 * i;
+  p[0] = entry & 0xff;
+  p[1] = entry >> 8;
+}
+
+int HyperLogLog::FindEntry(const StringValue& state, int idx) {
+  int lo = 0;
+  int hi = NumEntries(state);
+  while (lo < hi) {
+    int mid = (lo + hi) / 2;
+    if ((GetEntry(state, mid) >> RANK_BITS) < idx) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+int HyperLogLog::UpdateLen(const StringValue& state, uint32_t hash) {
+  if (state.ptr[0] == DENSE) return DENSE_LEN;
+  int idx;
+  uint8_t rank;
+  GetRegister(hash, &idx, &rank);
+  int pos = FindEntry(state, idx);
+  if (pos < NumEntries(state) && (GetEntry(state, pos) >> RANK_BITS) == idx) {
+    return state.len;
+  }
+  if (NumEntries(state) == MAX_SPARSE_ENTRIES) return DENSE_LEN;
+  return state.len + 2;
+}
+
+void HyperLogLog::Update(uint32_t hash, StringValue* state) {
+  int idx;
+  uint8_t rank;
+  GetRegister(hash, &idx, &rank);
+  if (state->ptr[0] == DENSE) {
+    uint8_t* registers = reinterpret_cast<uint8_t*>(state->ptr) + 1;
+    registers[idx] = max(registers[idx], rank);
+    return;
+  }
+
+  int num_entries = NumEntries(*state);
+  int pos = FindEntry(*state, idx);
+  if (pos < num_entries && (GetEntry(*state, pos) >> RANK_BITS) == idx) {
+    if ((GetEntry(*state, pos) & RANK_MASK) < rank) {
+      SetEntry(state, pos, (idx << RANK_BITS) | rank);
+    }
+    return;
+  }
+  if (num_entries == MAX_SPARSE_ENTRIES) {
+    ToDense(state);
+    uint8_t* registers = reinterpret_cast<uint8_t*>(state->ptr) + 1;
+    registers[idx] = rank;
+    return;
+  }
+  // Shift the entries after 'pos' to make room.
+  char* entry = state->ptr + 1 + 2 * pos;
+  memmove(entry + 2, entry, 2 * (num_entries - pos));
+  state->len += 2;
+  SetEntry(state, pos, (idx << RANK_BITS) | rank);
+}
+
+// Returns the number of distinct register indexes of the sparse states 'a' and 'b'.
+static int NumUnionEntries(const uint8_t* a, int num_a, const uint8_t* b, int num_b) {
+  int i = 0;
+  int j = 0;
+  int n = 0;
+  while (i < num_a && j < num_b) {
+    int idx_a = (a[2 * i] | (a[2 * i + 1] << 8)) >> HyperLogLog::RANK_BITS;
+    int idx_b = (b[2 * j] | (b[2 * j + 1] << 8)) >> HyperLogLog::RANK_BITS;
+    if (idx_a <= idx_b) ++i;
+    if (idx_b <= idx_a) ++j;
+    ++n;
+  }
+  return n + (num_a - i) + (num_b - j);
+}
+
+int HyperLogLog::MergeLen(const StringValue& dst, const StringValue& src) {
+  if (dst.ptr[0] == DENSE || src.ptr[0] == DENSE) return DENSE_LEN;
+  int n = NumUnionEntries(reinterpret_cast<const uint8_t*>(dst.ptr) + 1,
+      NumEntries(dst), reinterpret_cast<const uint8_t*>(src.ptr) + 1, NumEntries(src));
+  if (n > MAX_SPARSE_ENTRIES) return DENSE_LEN;
+  return 1 + 2 * n;
+}
+
+void HyperLogLog::Merge(const StringValue& src, StringValue* dst) {
+  if (dst->ptr[0] == SPARSE && MergeLen(*dst, src) == DENSE_LEN) ToDense(dst);
+
+  if (dst->ptr[0] == DENSE) {
+    uint8_t* registers = reinterpret_cast<uint8_t*>(dst->ptr) + 1;
+    if (src.ptr[0] == SPARSE) {
+      for (int i = 0; i < NumEntries(src); ++i) {
+        uint16_t entry = GetEntry(src, i);
+        uint8_t rank = entry & RANK_MASK;
+        registers[entry >> RANK_BITS] = max(registers[entry >> RANK_BITS], rank);
+      }
+      return;
+    }
+    DCHECK_EQ(src.len, DENSE_LEN);
+    const uint8_t* src_registers = reinterpret_cast<const uint8_t*>(src.ptr) + 1;
+    int i = 0;
+#ifdef __SSE2__
+    // The registers start after the format byte and are not aligned.
+    for (; i + 16 <= NUM_REGISTERS; i += 16) {
+      __m128i d = _mm_loadu_si128(reinterpret_cast<__m128i*>(registers + i));
+      __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src_registers + i));
+      _mm_storeu_si128(reinterpret_cast<__m128i*>(registers + i), _mm_max_epu8(d, s));
+    }
+#endif
+    for (; i < NUM_REGISTERS; ++i) {
+      registers[i] = max(registers[i], src_registers[i]);
+    }
+    return;
+  }
+
+  // Both are sparse and the union fits: merge the sorted entries.
+  uint16_t merged[MAX_SPARSE_ENTRIES];
+  int num_dst = NumEntries(*dst);
+  int num_src = NumEntries(src);
+  int i = 0;
+  int j = 0;
+  int n = 0;
+  while (i < num_dst || j < num_src) {
+    uint16_t d = i < num_dst ? GetEntry(*dst, i) : 0xffff;
+    uint16_t s = j < num_src ? GetEntry(src, j) : 0xffff;
+    if ((d >> RANK_BITS) == (s >> RANK_BITS)) {
+      merged[n++] = max(d, s);
+      ++i;
+      ++j;
+    } else if (d < s) {
+      merged[n++] = d;
+      ++i;
+    } else {
+      merged[n++] = s;
+      ++j;
+    }
+  }
+  DCHECK_LE(n, MAX_SPARSE_ENTRIES);
+  dst->len = 1 + 2 * n;
+  for (int k = 0; k < n; ++k) {
+    SetEntry(dst, k, merged[k]);
+  }
+}
+
+void HyperLogLog::ToDense(StringValue* state) {
+  DCHECK_EQ(state->ptr[0], SPARSE);
+  uint16_t entries[MAX_SPARSE_ENTRIES];
+  int num_entries = NumEntries(*state);
+  for (int i = 0; i < num_entries; ++i) {
+    entries[i] = GetEntry(*state, i);
+  }
+  state->ptr[0] = DENSE;
+  state->len = DENSE_LEN;
+  uint8_t* registers = reinterpret_cast<uint8_t*>(state->ptr) + 1;
+  memset(registers, 0, NUM_REGISTERS);
+  for (int i = 0; i < num_entries; ++i) {
+    registers[entries[i] >> RANK_BITS] = entries[i] & RANK_MASK;
+  }
+}
+
+int64_t HyperLogLog::Estimate(const StringValue& state) {
+  // sum of 2^-register over all registers
+  double sum = 0;
+  int num_zeros = 0;
+  if (state.ptr[0] == DENSE) {
+    DCHECK_EQ(state.len, DENSE_LEN);
+    const uint8_t* registers = reinterpret_cast<const uint8_t*>(state.ptr) + 1;
+    for (int i = 0; i < NUM_REGISTERS; ++i) {
+      sum += ldexp(1.0, -registers[i]);
+      if (registers[i] == 0) ++num_zeros;
+    }
+  } else {
+    num_zeros = NUM_REGISTERS - NumEntries(state);
+    sum = num_zeros;
+    for (int i = 0; i < NumEntries(state); ++i) {
+      sum += ldexp(1.0, -(GetEntry(state, i) & RANK_MASK));
+    }
+  }
+
+  const double m = NUM_REGISTERS;
+  double alpha = 0.7213 / (1 + 1.079 / m);
+  double estimate = alpha * m * m / sum;
+  // Small and large range corrections from the paper: use linear counting while there
+  // are empty registers, and correct for collisions of the 32-bit hash values.
+  const double two_32 = 4294967296.0;
+  if (estimate <= 2.5 * m) {
+    if (num_zeros != 0) estimate = m * log(m / num_zeros);
+  } else if (estimate > two_32 / 30) {
+    estimate = -two_32 * log(1 - estimate / two_32);
+  }
+  return static_cast<int64_t>(estimate + 0.5);
+}
+
+}
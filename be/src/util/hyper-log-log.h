@@ -0,0 +1,99 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_HYPER_LOG_LOG_H
+#define IMPALA_UTIL_HYPER_LOG_LOG_H
+
+#include <boost/cstdint.hpp>
+
+#include "runtime/string-value.h"
+
+namespace impala {
+
+// HyperLogLog (Flajolet et al.) estimate of the number of distinct 32-bit hash values,
+// with NUM_REGISTERS registers (about 3% standard error).  The state lives in a string
+// so that it can be kept in a string slot of an aggregation tuple and sent between
+// fragments as is.  The first byte of the state is its format:
+//   SPARSE: followed by the non-zero registers as 2-byte little endian entries
+//     (index << RANK_BITS | value), sorted by index.  Groups with few distinct values
+//     only need a couple of bytes.
+//   DENSE: followed by NUM_REGISTERS one-byte registers.
+// A sparse state with more than MAX_SPARSE_ENTRIES entries is converted to dense.
+// The functions don't allocate: callers make sure the buffer of a state has room for
+// the length that UpdateLen() / MergeLen() return before calling Update() / Merge().
+class HyperLogLog {
+ public:
+  static const int PRECISION = 10;
+  static const int NUM_REGISTERS = 1 << PRECISION;
+  static const int RANK_BITS = 5;
+  static const int MAX_SPARSE_ENTRIES = NUM_REGISTERS / 4;
+
+  static const char SPARSE = 0;
+  static const char DENSE = 1;
+  static const int EMPTY_LEN = 1;
+  static const int DENSE_LEN = 1 + NUM_REGISTERS;
+
+  // Sets 'state' (with room for EMPTY_LEN bytes) to the empty sparse state.
+  static void Init(StringValue* state) {
+    state->ptr[0] = SPARSE;
+    state->len = EMPTY_LEN;
+  }
+
+  // Returns the length of 'state' after Update(hash, state).
+  static int UpdateLen(const StringValue& state, uint32_t hash);
+
+  // Adds 'hash' to 'state'.
+  static void Update(uint32_t hash, StringValue* state);
+
+  // Returns the length of 'dst' after Merge(src, dst).
+  static int MergeLen(const StringValue& dst, const StringValue& src);
+
+  // Adds all hash values of 'src' to 'dst'.
+  static void Merge(const StringValue& src, StringValue* dst);
+
+  // Returns the estimated number of distinct hash values of 'state'.
+  static int64_t Estimate(const StringValue& state);
+
+  // Returns the register index of 'hash' in 'idx' and its value (1 + the number of
+  // trailing zeros of the remaining bits) in 'rank'.
+  static void GetRegister(uint32_t hash, int* idx, uint8_t* rank) {
+    // Remix with the MurmurHash3 finalizer: both the index and the rank bits need to
+    // depend on all bits of hash, which e.g. the low bits of Fvn hashes don't.
+    uint32_t h = hash;
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    *idx = h >> (32 - PRECISION);
+    *rank = __builtin_ctz(h | (1U << (32 - PRECISION))) + 1;
+  }
+
+ private:
+  static int NumEntries(const StringValue& state) { return (state.len - 1) / 2; }
+  static uint16_t GetEntry(const StringValue& state, int i);
+  static void SetEntry(StringValue* state, int i, uint16_t entry);
+
+  // Returns the position of the first entry of the sparse 'state' with an index
+  // >= 'idx'.
+  static int FindEntry(const StringValue& state, int idx);
+
+  // Converts the sparse 'state' in place; its buffer must have room for DENSE_LEN bytes.
+  static void ToDense(StringValue* state);
+};
+
+}
+
+#endif
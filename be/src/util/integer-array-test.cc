@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <vector>
 #include <iostream>
 #include <gtest/gtest.h>
 #include "util/integer-array.h"
@@ -45,6 +46,26 @@ TEST(IntegerArrayTest, Basic) {
     }
   }
 }
+
+// Bit packed Trevni blocks use up to 24 bit integers, so values cross word boundaries
+// in every position.
+TEST(IntegerArrayTest, LargeBitSizes) {
+  MemPool mempool;
+  srand(0);
+  for (int size = 13; size <= 24; ++size) {
+    IntegerArrayBuilder build(size, 1000, &mempool);
+    vector<uint32_t> values;
+    for (int i = 0; i < 1000; ++i) {
+      values.push_back(rand() % (1 << size));
+      EXPECT_TRUE(build.Put(values.back()));
+    }
+    EXPECT_FALSE(build.Put(0));
+    IntegerArray int_array(size, 1000, build.array());
+    for (int i = 0; i < 1000; ++i) {
+      EXPECT_EQ(int_array.GetNextValue(), values[i]);
+    }
+  }
+}
 }
 
 int main(int argc, char **argv) {
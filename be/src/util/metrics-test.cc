@@ -16,6 +16,7 @@
 #include "util/non-primitive-metrics.h"
 #include <gtest/gtest.h>
 #include <boost/scoped_ptr.hpp>
+#include <boost/thread/thread.hpp>
 
 using namespace boost;
 using namespace std;
@@ -59,6 +60,22 @@ TEST_F(MetricsTest, IntMetrics) {
   EXPECT_NE(metrics()->DebugString().find("int:3"), string::npos);
 }
 
+static void IncrementMetric(Metrics::IntMetric* metric, int n) {
+  for (int i = 0; i < n; ++i) metric->Increment(1);
+}
+
+TEST_F(MetricsTest, IntMetricsConcurrentUpdates) {
+  thread_group threads;
+  for (int i = 0; i < 4; ++i) {
+    threads.add_thread(new thread(IncrementMetric, int_metric_, 10000));
+  }
+  threads.join_all();
+  EXPECT_EQ(int_metric_->value(), 40000);
+  EXPECT_EQ(int_metric_->TestAndSet(5, 1), 40000);
+  EXPECT_EQ(int_metric_->TestAndSet(5, 40000), 40000);
+  EXPECT_EQ(int_metric_->value(), 5);
+}
+
 TEST_F(MetricsTest, DoubleMetrics) {
   EXPECT_NE(metrics()->DebugString().find("double:1.23"), string::npos);
   double_metric_->Update(2.34);
@@ -108,6 +125,17 @@ TEST_F(MetricsTest, Increment) {
   EXPECT_EQ(int_metric_->Increment(10), 11);
   EXPECT_EQ(int_metric_->value(), 11);
 }
+
+TEST_F(MetricsTest, HistogramMetrics) {
+  HistogramMetric* metric = metrics()->RegisterMetric(
+      new HistogramMetric("histogram", TCounterType::UNIT));
+  EXPECT_NE(metrics()->DebugString().find("histogram:count=0"), string::npos);
+  for (int i = 1; i <= 100; ++i) metric->Add(i);
+  EXPECT_EQ(metric->value().count(), 100);
+  EXPECT_EQ(metric->value().max_value(), 100);
+  EXPECT_NE(metrics()->DebugString().find("histogram:count=100 min=1"), string::npos)
+      << metrics()->DebugString();
+}
 }
 
 int main(int argc, char **argv) {
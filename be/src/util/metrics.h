@@ -132,7 +132,8 @@ class Metrics {
     }    
   };
 
-  // Convenient typedefs for common primitive metric types.
+  // Convenient typedefs for common primitive metric types.  IntMetrics are lock-free
+  // (see the specialization of PrimitiveMetric below).
   typedef struct PrimitiveMetric<int64_t> IntMetric;
   typedef struct PrimitiveMetric<double> DoubleMetric;
   typedef struct PrimitiveMetric<std::string> StringMetric;
@@ -166,6 +167,16 @@ class Metrics {
     return mt;    
   }
 
+  // Returns the metric registered under 'key', or NULL if there is none.  M must be
+  // the type of the registered metric.
+  template <typename M>
+  M* GetMetric(const std::string& key) {
+    boost::lock_guard<boost::mutex> l(lock_);
+    MetricMap::iterator it = metric_map_.find(key);
+    if (it == metric_map_.end()) return NULL;
+    return static_cast<M*>(it->second);
+  }
+
   // Register page callbacks with the webserver
   Status Init(Webserver* webserver);
 
@@ -196,6 +207,46 @@ class Metrics {
   void JsonCallback(std::stringstream* output);
 };
 
+// Integer metrics are updated with atomic instructions instead of under the metric
+// lock, so that they can be updated on hot paths by many threads.  The value is read
+// without the lock, too; Print() and PrintJson() still take the lock, which only
+// serializes them with each other.
+// These functions hide the locking ones of Metric<int64_t>, so they must be called
+// through an IntMetric (not a Metric<int64_t>) pointer.
+template<>
+class Metrics::PrimitiveMetric<int64_t> : public Metrics::Metric<int64_t> {
+ public:
+  PrimitiveMetric(const std::string& key, const int64_t& value)
+      : Metric<int64_t>(key, value) {
+  }
+
+  void Update(const int64_t& value) {
+    __sync_lock_test_and_set(&this->value_, value);
+  }
+
+  int64_t TestAndSet(const int64_t& value, const int64_t& test) {
+    return __sync_val_compare_and_swap(&this->value_, test, value);
+  }
+
+  int64_t value() {
+    return __sync_fetch_and_add(&this->value_, 0);
+  }
+
+  // Returns value of metric after increment
+  int64_t Increment(const int64_t& delta) {
+    return __sync_add_and_fetch(&this->value_, delta);
+  }
+
+ protected:
+  virtual void PrintValue(std::stringstream* out)  {
+    (*out) << value();
+  }
+
+  virtual void PrintValueJson(std::stringstream* out)  {
+    (*out) << "\"" << value() << "\"";
+  }
+};
+
 }
 
 #endif // IMPALA_UTIL_METRICS_H
@@ -21,6 +21,7 @@
 #include <set>
 #include <boost/algorithm/string/join.hpp>
 #include <boost/foreach.hpp>
+#include "util/histogram.h"
 #include "util/metrics.h"
 
 namespace impala {
@@ -140,6 +141,31 @@ class MapMetric : public Metrics::Metric<std::map<K, V> > {
   }
 };
 
+// Metric whose value is a histogram of samples, e.g. of latencies.  Add() does not
+// take the metric's lock, so the percentiles printed while samples are being added
+// may be off by the samples in flight.
+class HistogramMetric : public Metrics::Metric<Histogram> {
+ public:
+  HistogramMetric(const std::string& key, TCounterType::type type)
+      : Metrics::Metric<Histogram>(key, Histogram(type)) { }
+
+  void Add(int64_t value) { this->value_.Add(value); }
+
+ protected:
+  virtual void PrintValueJson(std::stringstream* out) {
+    (*out) << "{ \"count\" : " << this->value_.count()
+           << ", \"min\" : " << this->value_.min_value()
+           << ", \"p50\" : " << this->value_.GetPercentile(50)
+           << ", \"p95\" : " << this->value_.GetPercentile(95)
+           << ", \"p99\" : " << this->value_.GetPercentile(99)
+           << ", \"max\" : " << this->value_.max_value() << " }";
+  }
+
+  virtual void PrintValue(std::stringstream* out) {
+    (*out) << this->value_.ToString();
+  }
+};
+
 };
 
 #endif
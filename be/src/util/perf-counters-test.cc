@@ -47,6 +47,28 @@ TEST(PerfCounterTest, Basic) {
   counters.PrettyPrint(&cout);
 }
 
+TEST(PerfCounterTest, ThreadCounters) {
+  ThreadPerfCounters* counters = ThreadPerfCounters::GetForThread();
+  if (counters == NULL) {
+    cout << "Hardware counters are not available" << endl;
+    return;
+  }
+  EXPECT_EQ(ThreadPerfCounters::GetForThread(), counters);
+  int64_t before[ThreadPerfCounters::NUM_COUNTERS];
+  int64_t after[ThreadPerfCounters::NUM_COUNTERS];
+  ASSERT_TRUE(counters->Read(before));
+  double result = 0;
+  for (int i = 0; i < 1000000; i++) {
+    double d1 = rand() / (double) RAND_MAX;
+    result += d1 * d1;
+  }
+  ASSERT_TRUE(counters->Read(after));
+  EXPECT_GT(after[ThreadPerfCounters::CYCLES], before[ThreadPerfCounters::CYCLES]);
+  EXPECT_GT(after[ThreadPerfCounters::INSTRUCTIONS],
+      before[ThreadPerfCounters::INSTRUCTIONS] + 1000000);
+  cout << "result=" << result << endl;
+}
+
 TEST(CpuInfoTest, Basic) {
   cout << CpuInfo::DebugString();
 }
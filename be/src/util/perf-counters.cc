@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include "util/perf-counters.h"
+#include "common/logging.h"
 #include "util/debug-util.h"
 
 #include <stdio.h>
@@ -26,11 +27,13 @@
 
 #include <sys/syscall.h>
 #include <linux/perf_event.h>
+#include <boost/thread/tss.hpp>
 
 #define COUNTER_SIZE (sizeof(void*))
 #define BUFFER_SIZE 256
 #define PRETTY_PRINT_WIDTH 13
 
+using namespace boost;
 using namespace std;
 
 namespace impala {
@@ -421,5 +424,79 @@ void PerfCounters::PrettyPrint(ostream* s) const {
   stream << endl;
 }
 
+ThreadPerfCounters::ThreadPerfCounters() {
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    fds_[i] = -1;
+  }
+}
+
+ThreadPerfCounters::~ThreadPerfCounters() {
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    if (fds_[i] != -1) close(fds_[i]);
+  }
+}
+
+bool ThreadPerfCounters::Init() {
+  static const PerfCounters::Counter COUNTERS[NUM_COUNTERS] = {
+    PerfCounters::PERF_COUNTER_HW_CPU_CYCLES,
+    PerfCounters::PERF_COUNTER_HW_INSTRUCTIONS,
+    PerfCounters::PERF_COUNTER_HW_CACHE_MISSES,
+    PerfCounters::PERF_COUNTER_HW_BRANCH_MISSES,
+  };
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    perf_event_attr attr;
+    if (!InitEventAttr(&attr, COUNTERS[i])) return false;
+    // Only count user space, which unprivileged processes are usually allowed to.
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_GROUP;
+    // pid 0 and cpu -1: the calling thread, on any cpu
+    fds_[i] = sys_perf_event_open(&attr, 0, -1, fds_[0], 0);
+    if (fds_[i] < 0) {
+      for (int j = 0; j < i; ++j) {
+        close(fds_[j]);
+        fds_[j] = -1;
+      }
+      fds_[i] = -1;
+      return false;
+    }
+  }
+  return true;
 }
 
+ThreadPerfCounters* ThreadPerfCounters::GetForThread() {
+  // Threads that failed to open their counters keep an object with closed fds, so
+  // that they don't retry on every call.
+  static thread_specific_ptr<ThreadPerfCounters> thread_counters;
+  ThreadPerfCounters* counters = thread_counters.get();
+  if (counters == NULL) {
+    counters = new ThreadPerfCounters();
+    thread_counters.reset(counters);
+    if (!counters->Init()) VLOG(1) << "Hardware counters are not available";
+  }
+  return counters->fds_[0] == -1 ? NULL : counters;
+}
+
+const char* ThreadPerfCounters::GetCounterName(Counter counter) {
+  switch (counter) {
+    case CYCLES: return "HwCycles";
+    case INSTRUCTIONS: return "HwInstructions";
+    case CACHE_MISSES: return "HwCacheMisses";
+    case BRANCH_MISSES: return "HwBranchMisses";
+    default: return "";
+  }
+}
+
+bool ThreadPerfCounters::Read(int64_t* values) {
+  // With PERF_FORMAT_GROUP, the leader returns the number of counters followed by
+  // their values.
+  uint64_t buffer[NUM_COUNTERS + 1];
+  int num_bytes = read(fds_[0], buffer, sizeof(buffer));
+  if (num_bytes != sizeof(buffer) || buffer[0] != NUM_COUNTERS) return false;
+  for (int i = 0; i < NUM_COUNTERS; ++i) {
+    values[i] = buffer[i + 1];
+  }
+  return true;
+}
+
+}
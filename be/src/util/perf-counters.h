@@ -134,7 +134,46 @@ class PerfCounters {
   // at the same time.  This is useful to better correlate counter values.
   int group_fd_;
 };
-  
+
+// The hardware counters of the calling thread, opened as one perf_event group so that
+// they are read together with a single read().  Unlike PerfCounters, which counts the
+// process's main thread and keeps its snapshots, this is meant to be read around short
+// windows of work (e.g. ExecNode::GetNext()) on any thread: each thread opens its
+// counters on first use and closes them when it exits.
+class ThreadPerfCounters {
+ public:
+  enum Counter {
+    CYCLES,
+    INSTRUCTIONS,
+    CACHE_MISSES,  // last level cache
+    BRANCH_MISSES,
+    NUM_COUNTERS,
+  };
+
+  // Returns the counters of the calling thread, or NULL if the hardware counters are
+  // not available (e.g. in a VM or if perf_event_paranoid doesn't allow them).
+  static ThreadPerfCounters* GetForThread();
+
+  // Returns the name of 'counter' for profiles, e.g. "HwCycles".
+  static const char* GetCounterName(Counter counter);
+
+  // Reads the current values of all counters into 'values', which must have
+  // NUM_COUNTERS entries.  Returns false if the counters couldn't be read.
+  bool Read(int64_t* values);
+
+  ~ThreadPerfCounters();
+
+ private:
+  ThreadPerfCounters();
+
+  // Opens the counters.  Returns false, with all counters closed, if any of them isn't
+  // available.
+  bool Init();
+
+  // fds of the counters; fds_[0] is the group leader.  -1 if not open.
+  int fds_[NUM_COUNTERS];
+};
+
 }
 
 #endif
@@ -14,6 +14,7 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <unistd.h>
 #include <iostream>
 #include <gtest/gtest.h>
 #include <boost/bind.hpp>
@@ -236,6 +237,39 @@ TEST(CountersTest, DerivedCounters) {
   EXPECT_EQ(throughput_counter->value(), 40);
 }
 
+static void UpdateShardedCounter(RuntimeProfile::ShardedCounter* counter, int n) {
+  for (int i = 0; i < n; ++i) COUNTER_UPDATE(counter, 1);
+}
+
+TEST(CountersTest, ShardedCounters) {
+  ObjectPool pool;
+  RuntimeProfile profile(&pool, "Profile");
+  RuntimeProfile::ShardedCounter* counter =
+      profile.AddShardedCounter("rows", TCounterType::UNIT);
+  EXPECT_EQ(profile.AddShardedCounter("rows", TCounterType::UNIT), counter);
+  thread_group threads;
+  for (int i = 0; i < 20; ++i) {
+    threads.add_thread(new thread(UpdateShardedCounter, counter, 1000));
+  }
+  threads.join_all();
+  EXPECT_EQ(counter->value(), 20000);
+
+  // updates through the base class are included
+  RuntimeProfile::Counter* base = counter;
+  base->Update(5);
+  EXPECT_EQ(profile.GetCounter("rows")->value(), 20005);
+
+  TRuntimeProfileTree tree;
+  profile.ToThrift(&tree);
+  bool found = false;
+  for (int i = 0; i < tree.nodes[0].counters.size(); ++i) {
+    if (tree.nodes[0].counters[i].name != "rows") continue;
+    EXPECT_EQ(tree.nodes[0].counters[i].value, 20005);
+    found = true;
+  }
+  EXPECT_TRUE(found);
+}
+
 TEST(CountersTest, InfoStringTest) {
   ObjectPool pool;
   RuntimeProfile profile(&pool, "Profile");
@@ -277,6 +311,184 @@ TEST(CountersTest, InfoStringTest) {
   EXPECT_EQ(*update_dst_profile.GetInfoString("Foo"), "Bar");
 }
 
+TEST(CountersTest, DeltaUpdate) {
+  ObjectPool pool;
+  RuntimeProfile profile(&pool, "Profile");
+  RuntimeProfile child(&pool, "Child");
+  profile.AddChild(&child);
+  RuntimeProfile::Counter* counter_a = profile.AddCounter("A", TCounterType::UNIT);
+  RuntimeProfile::Counter* counter_b = child.AddCounter("B", TCounterType::UNIT);
+  counter_a->Set(1);
+  counter_b->Set(2);
+  profile.AddInfoString("Key", "Value");
+
+  // The first delta contains everything.
+  TRuntimeProfileTree tprofile;
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes.size(), 2);
+  EXPECT_EQ(tprofile.nodes[0].counters.size(), 2);  // A and TotalTime
+  EXPECT_EQ(tprofile.nodes[1].counters.size(), 2);
+  EXPECT_EQ(tprofile.nodes[0].info_strings.size(), 1);
+  RuntimeProfile dst_profile(&pool, "Dst");
+  dst_profile.Update(tprofile);
+
+  // Nothing changed
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes.size(), 2);
+  EXPECT_EQ(tprofile.nodes[0].counters.size(), 0);
+  EXPECT_EQ(tprofile.nodes[1].counters.size(), 0);
+  EXPECT_EQ(tprofile.nodes[0].info_strings.size(), 0);
+
+  // Only the changed counter and info string, and new counters, are sent.
+  counter_b->Set(3);
+  child.AddCounter("C", TCounterType::BYTES)->Set(4);
+  profile.AddInfoString("Key", "NewValue");
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].counters.size(), 0);
+  EXPECT_EQ(tprofile.nodes[1].counters.size(), 2);
+  EXPECT_EQ(tprofile.nodes[0].info_strings.size(), 1);
+
+  // Applying the deltas results in the same profile as a full update.
+  dst_profile.Update(tprofile);
+  vector<RuntimeProfile*> children;
+  dst_profile.GetChildren(&children);
+  ASSERT_EQ(children.size(), 1);
+  EXPECT_EQ(dst_profile.GetCounter("A")->value(), 1);
+  EXPECT_EQ(children[0]->GetCounter("B")->value(), 3);
+  EXPECT_EQ(children[0]->GetCounter("C")->value(), 4);
+  EXPECT_EQ(*dst_profile.GetInfoString("Key"), "NewValue");
+
+  // A full serialization doesn't affect the next delta.
+  profile.ToThrift(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].counters.size(), 2);
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[1].counters.size(), 0);
+}
+
+TEST(CountersTest, Histograms) {
+  ObjectPool pool;
+  RuntimeProfile profile(&pool, "Profile");
+  Histogram* histogram = profile.AddHistogram("Latency", TCounterType::CPU_TICKS);
+  EXPECT_EQ(profile.AddHistogram("Latency", TCounterType::CPU_TICKS), histogram);
+  EXPECT_EQ(profile.GetHistogram("Latency"), histogram);
+  EXPECT_TRUE(profile.GetHistogram("Other") == NULL);
+  for (int i = 1; i <= 100; ++i) {
+    histogram->Add(i);
+  }
+
+  TRuntimeProfileTree tprofile;
+  profile.ToThrift(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].histograms.size(), 1);
+  RuntimeProfile* from_thrift = RuntimeProfile::CreateFromThrift(&pool, tprofile);
+  Histogram* copy = from_thrift->GetHistogram("Latency");
+  ASSERT_TRUE(copy != NULL);
+  EXPECT_EQ(copy->count(), 100);
+  EXPECT_EQ(copy->GetPercentile(50), histogram->GetPercentile(50));
+
+  // Merging adds up the values; averaging the profile leaves the histogram alone.
+  RuntimeProfile averaged(&pool, "Averaged");
+  averaged.Merge(&profile);
+  averaged.Merge(from_thrift);
+  averaged.Divide(2);
+  EXPECT_EQ(averaged.GetHistogram("Latency")->count(), 200);
+  EXPECT_EQ(averaged.GetHistogram("Latency")->max_value(), 100);
+
+  // Deltas only contain histograms that changed.
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].histograms.size(), 1);
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].histograms.size(), 0);
+  histogram->Add(1000);
+  profile.ToThriftDelta(&tprofile);
+  ASSERT_EQ(tprofile.nodes[0].histograms.size(), 1);
+  from_thrift->Update(tprofile);
+  EXPECT_EQ(copy->count(), 101);
+  EXPECT_EQ(copy->max_value(), 1000);
+}
+
+TEST(CountersTest, EventSequences) {
+  ObjectPool pool;
+  RuntimeProfile profile(&pool, "Profile");
+  RuntimeProfile::EventSequence* events = profile.AddEventSequence("Timeline");
+  EXPECT_EQ(profile.AddEventSequence("Timeline"), events);
+  EXPECT_EQ(profile.GetEventSequence("Timeline"), events);
+  EXPECT_TRUE(profile.GetEventSequence("Other") == NULL);
+  events->Start();
+  events->MarkEvent("First");
+  usleep(20 * 1000);
+  events->MarkEvent("Second");
+  RuntimeProfile::EventSequence::EventList event_list;
+  events->GetEvents(&event_list);
+  ASSERT_EQ(event_list.size(), 2);
+  EXPECT_EQ(event_list[0].first, "First");
+  EXPECT_EQ(event_list[1].first, "Second");
+  EXPECT_GE(event_list[1].second - event_list[0].second, 10);
+
+  stringstream pretty;
+  profile.PrettyPrint(&pretty);
+  EXPECT_NE(pretty.str().find("Timeline: "), string::npos) << pretty.str();
+  EXPECT_NE(pretty.str().find("- Second: "), string::npos) << pretty.str();
+
+  TRuntimeProfileTree tprofile;
+  profile.ToThrift(&tprofile);
+  ASSERT_EQ(tprofile.nodes[0].event_sequences.size(), 1);
+  RuntimeProfile* from_thrift = RuntimeProfile::CreateFromThrift(&pool, tprofile);
+  RuntimeProfile::EventSequence* copy = from_thrift->GetEventSequence("Timeline");
+  ASSERT_TRUE(copy != NULL);
+  RuntimeProfile::EventSequence::EventList copy_list;
+  copy->GetEvents(&copy_list);
+  EXPECT_EQ(copy_list, event_list);
+
+  // Deltas only contain the sequences that changed, in full.
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].event_sequences.size(), 1);
+  profile.ToThriftDelta(&tprofile);
+  EXPECT_EQ(tprofile.nodes[0].event_sequences.size(), 0);
+  events->MarkEvent("Third");
+  profile.ToThriftDelta(&tprofile);
+  ASSERT_EQ(tprofile.nodes[0].event_sequences.size(), 1);
+  from_thrift->Update(tprofile);
+  EXPECT_EQ(copy->num_events(), 3);
+}
+
+TEST(CountersTest, ThreadCounters) {
+  ObjectPool pool;
+  RuntimeProfile profile(&pool, "Profile");
+  RuntimeProfile::ThreadCounters* counters = profile.AddThreadCounters("Test");
+  EXPECT_EQ(profile.GetCounter("TestUserTime"), counters->user_time_);
+  EXPECT_EQ(profile.GetCounter("TestSysTime"), counters->sys_time_);
+  EXPECT_TRUE(profile.GetCounter("TestVoluntaryContextSwitches") != NULL);
+  EXPECT_TRUE(profile.GetCounter("TestInvoluntaryContextSwitches") != NULL);
+
+  // Burn 50ms of cpu, then sleep: the sleep counts as a voluntary context switch but
+  // not as cpu time.
+  int64_t expected = 50 * CpuInfo::cycles_per_ms();
+  volatile int64_t sum = 0;
+  while (counters->user_time_->value() + counters->sys_time_->value() < expected) {
+    SCOPED_THREAD_COUNTER_MEASUREMENT(counters);
+    for (int i = 0; i < 1000000; ++i) sum += i;
+  }
+  {
+    SCOPED_THREAD_COUNTER_MEASUREMENT(counters);
+    usleep(100 * 1000);
+  }
+  int64_t cpu_time = counters->user_time_->value() + counters->sys_time_->value();
+  EXPECT_GE(cpu_time, expected);
+  EXPECT_LT(cpu_time, expected + 50 * CpuInfo::cycles_per_ms());
+  EXPECT_GT(counters->voluntary_context_switches_->value(), 0);
+
+  // Stop() updates the counters only once.
+  int64_t user_time = counters->user_time_->value();
+  ThreadCounterMeasurement measurement(counters);
+  measurement.Stop();
+  for (int i = 0; i < 10000000; ++i) sum += i;
+  measurement.Stop();
+  EXPECT_LT(counters->user_time_->value() - user_time, CpuInfo::cycles_per_ms());
+
+  // A NULL ThreadCounters isn't measured.
+  ThreadCounterMeasurement null_measurement(NULL);
+}
+
 TEST(CountersTest, RateCounters) {
   ObjectPool pool;
   RuntimeProfile profile(&pool, "Profile");
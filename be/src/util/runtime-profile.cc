@@ -31,6 +31,9 @@ namespace impala {
 // Period to update rate counters in ms.  
 static const int RATE_COUNTER_UPDATE_PERIOD = 500;
 
+__thread int RuntimeProfile::ShardedCounter::thread_shard_idx_ = -1;
+int RuntimeProfile::ShardedCounter::next_shard_idx_ = 0;
+
 RuntimeProfile::RateCounterUpdateState RuntimeProfile::rate_counters_state_;
 
 RuntimeProfile::RuntimeProfile(ObjectPool* pool, const string& name) :
@@ -68,6 +71,23 @@ RuntimeProfile* RuntimeProfile::CreateFromThrift(ObjectPool* pool,
     profile->counter_map_[counter.name] =
       pool->Add(new Counter(counter.type, counter.value));
   }
+  if (node.__isset.histograms) {
+    for (int i = 0; i < node.histograms.size(); ++i) {
+      const THistogram& thistogram = node.histograms[i];
+      Histogram* histogram = pool->Add(new Histogram(thistogram.type));
+      histogram->SetFromThrift(thistogram);
+      profile->histogram_map_[thistogram.name] = histogram;
+    }
+  }
+
+  if (node.__isset.event_sequences) {
+    for (int i = 0; i < node.event_sequences.size(); ++i) {
+      const TEventSequence& tevent_sequence = node.event_sequences[i];
+      EventSequence* event_sequence = pool->Add(new EventSequence());
+      event_sequence->SetFromThrift(tevent_sequence);
+      profile->event_sequence_map_[tevent_sequence.name] = event_sequence;
+    }
+  }
 
   profile->info_strings_ = node.info_strings;
   
@@ -98,6 +118,12 @@ void RuntimeProfile::Merge(RuntimeProfile* other) {
         dst_iter->second->Update(src_iter->second->value());
       }
     }
+    for (HistogramMap::const_iterator src = other->histogram_map_.begin();
+         src != other->histogram_map_.end(); ++src) {
+      Histogram*& dst = histogram_map_[src->first];
+      if (dst == NULL) dst = pool_->Add(new Histogram(src->second->type()));
+      dst->Merge(*src->second);
+    }
   }
   
   {
@@ -151,6 +177,28 @@ void RuntimeProfile::Update(const vector<TRuntimeProfileNode>& nodes, int* idx)
         }
       }
     }
+    if (node.__isset.histograms) {
+      for (int i = 0; i < node.histograms.size(); ++i) {
+        const THistogram& thistogram = node.histograms[i];
+        Histogram*& histogram = histogram_map_[thistogram.name];
+        if (histogram == NULL) {
+          histogram = pool_->Add(new Histogram(thistogram.type));
+        } else if (histogram->type() != thistogram.type) {
+          LOG(ERROR) << "Cannot update histograms with the same name ("
+                     << thistogram.name << ") but different types.";
+          continue;
+        }
+        histogram->SetFromThrift(thistogram);
+      }
+    }
+    if (node.__isset.event_sequences) {
+      for (int i = 0; i < node.event_sequences.size(); ++i) {
+        const TEventSequence& tevent_sequence = node.event_sequences[i];
+        EventSequence*& event_sequence = event_sequence_map_[tevent_sequence.name];
+        if (event_sequence == NULL) event_sequence = pool_->Add(new EventSequence());
+        event_sequence->SetFromThrift(tevent_sequence);
+      }
+    }
   }
   
   {
@@ -184,6 +232,7 @@ void RuntimeProfile::Update(const vector<TRuntimeProfileNode>& nodes, int* idx)
 }
 
 void RuntimeProfile::Divide(int n) {
+  // Histograms are left alone: they describe the distribution over all instances.
   DCHECK_GT(n, 0);
   map<string, Counter*>::iterator iter;
   {
@@ -282,6 +331,97 @@ RuntimeProfile::Counter* RuntimeProfile::AddCounter(
   return counter;
 }
 
+Histogram* RuntimeProfile::AddHistogram(const string& name, TCounterType::type type) {
+  lock_guard<mutex> l(counter_map_lock_);
+  Histogram*& histogram = histogram_map_[name];
+  if (histogram == NULL) histogram = pool_->Add(new Histogram(type));
+  DCHECK_EQ(histogram->type(), type) << name;
+  return histogram;
+}
+
+Histogram* RuntimeProfile::GetHistogram(const string& name) {
+  lock_guard<mutex> l(counter_map_lock_);
+  HistogramMap::const_iterator it = histogram_map_.find(name);
+  return it == histogram_map_.end() ? NULL : it->second;
+}
+
+RuntimeProfile::EventSequence* RuntimeProfile::AddEventSequence(const string& name) {
+  lock_guard<mutex> l(counter_map_lock_);
+  EventSequence*& event_sequence = event_sequence_map_[name];
+  if (event_sequence == NULL) event_sequence = pool_->Add(new EventSequence());
+  return event_sequence;
+}
+
+RuntimeProfile::EventSequence* RuntimeProfile::GetEventSequence(const string& name) {
+  lock_guard<mutex> l(counter_map_lock_);
+  EventSequenceMap::const_iterator it = event_sequence_map_.find(name);
+  return it == event_sequence_map_.end() ? NULL : it->second;
+}
+
+RuntimeProfile::ThreadCounters* RuntimeProfile::AddThreadCounters(
+    const string& prefix) {
+  ThreadCounters* counters = pool_->Add(new ThreadCounters());
+  counters->user_time_ = AddCounter(prefix + "UserTime", TCounterType::CPU_TICKS);
+  counters->sys_time_ = AddCounter(prefix + "SysTime", TCounterType::CPU_TICKS);
+  counters->voluntary_context_switches_ =
+      AddCounter(prefix + "VoluntaryContextSwitches", TCounterType::UNIT);
+  counters->involuntary_context_switches_ =
+      AddCounter(prefix + "InvoluntaryContextSwitches", TCounterType::UNIT);
+  return counters;
+}
+
+// getrusage() reports times in us; they are converted to cpu ticks, like the times of
+// the timers, rather than to ms, which would round away the many short measurements.
+static int64_t ElapsedTicks(const timeval& start, const timeval& end) {
+  int64_t us = (end.tv_sec - start.tv_sec) * 1000000L + (end.tv_usec - start.tv_usec);
+  return us * CpuInfo::cycles_per_ms() / 1000;
+}
+
+void ThreadCounterMeasurement::Stop() {
+  if (stopped_) return;
+  stopped_ = true;
+  rusage end;
+  getrusage(RUSAGE_THREAD, &end);
+  counters_->user_time_->Update(ElapsedTicks(start_.ru_utime, end.ru_utime));
+  counters_->sys_time_->Update(ElapsedTicks(start_.ru_stime, end.ru_stime));
+  counters_->voluntary_context_switches_->Update(end.ru_nvcsw - start_.ru_nvcsw);
+  counters_->involuntary_context_switches_->Update(end.ru_nivcsw - start_.ru_nivcsw);
+}
+
+void RuntimeProfile::EventSequence::ToThrift(const string& name,
+    TEventSequence* event_sequence) {
+  lock_guard<mutex> l(lock_);
+  event_sequence->name = name;
+  event_sequence->timestamps.clear();
+  event_sequence->labels.clear();
+  for (int i = 0; i < events_.size(); ++i) {
+    event_sequence->labels.push_back(events_[i].first);
+    event_sequence->timestamps.push_back(events_[i].second);
+  }
+}
+
+void RuntimeProfile::EventSequence::SetFromThrift(const TEventSequence& event_sequence) {
+  DCHECK_EQ(event_sequence.labels.size(), event_sequence.timestamps.size());
+  lock_guard<mutex> l(lock_);
+  events_.clear();
+  for (int i = 0; i < event_sequence.labels.size(); ++i) {
+    events_.push_back(make_pair(event_sequence.labels[i], event_sequence.timestamps[i]));
+  }
+}
+
+RuntimeProfile::ShardedCounter* RuntimeProfile::AddShardedCounter(
+    const string& name, TCounterType::type type) {
+  lock_guard<mutex> l(counter_map_lock_);
+  CounterMap::iterator it = counter_map_.find(name);
+  if (it != counter_map_.end()) {
+    DCHECK(dynamic_cast<ShardedCounter*>(it->second) != NULL) << name;
+    return static_cast<ShardedCounter*>(it->second);
+  }
+  ShardedCounter* counter = pool_->Add(new ShardedCounter(type));
+  counter_map_[name] = counter;
+  return counter;
+}
+
 RuntimeProfile::DerivedCounter* RuntimeProfile::AddDerivedCounter(
     const std::string& name, TCounterType::type type, 
     const DerivedCounterFunction& counter_fn) {
@@ -315,16 +455,22 @@ void RuntimeProfile::GetCounters(
 //  1. Profile Name
 //  2. Info Strings
 //  3. Counters
-//  4. Children
+//  4. Histograms
+//  5. Event sequences
+//  6. Children
 void RuntimeProfile::PrettyPrint(ostream* s, const string& prefix) {
   ostream& stream = *s;
 
   // create copy of counter_map_ so we don't need to hold lock while we call
   // value() on the counters (some of those might be DerivedCounters)
   CounterMap counter_map;
+  HistogramMap histogram_map;
+  EventSequenceMap event_sequence_map;
   {
     lock_guard<mutex> l(counter_map_lock_);
     counter_map = counter_map_;
+    histogram_map = histogram_map_;
+    event_sequence_map = event_sequence_map_;
   }
 
   map<string, Counter*>::const_iterator total_time = counter_map.find("TotalTime");
@@ -355,6 +501,30 @@ void RuntimeProfile::PrettyPrint(ostream* s, const string& prefix) {
            << PrettyPrinter::Print(iter->second->value(), iter->second->type())
            << endl;
   }
+  for (HistogramMap::const_iterator it = histogram_map.begin();
+       it != histogram_map.end(); ++it) {
+    stream << prefix << "   - " << it->first << ": " << it->second->ToString() << endl;
+  }
+  // e.g.
+  //   Query Timeline: 1s203ms
+  //      - Planning finished: 12ms (12ms)
+  //      - First row fetched: 1s203ms (1s191ms)
+  for (EventSequenceMap::const_iterator it = event_sequence_map.begin();
+       it != event_sequence_map.end(); ++it) {
+    EventSequence::EventList events;
+    it->second->GetEvents(&events);
+    int64_t last = events.empty() ? 0 : events.back().second;
+    stream << prefix << "  " << it->first << ": "
+           << PrettyPrinter::Print(last, TCounterType::TIME_MS) << endl;
+    int64_t prev = 0;
+    for (int i = 0; i < events.size(); ++i) {
+      stream << prefix << "     - " << events[i].first << ": "
+             << PrettyPrinter::Print(events[i].second, TCounterType::TIME_MS) << " ("
+             << PrettyPrinter::Print(events[i].second - prev, TCounterType::TIME_MS)
+             << ")" << endl;
+      prev = events[i].second;
+    }
+  }
 
   // create copy of children_ so we don't need to hold lock while we call
   // PrettyPrint() on the children
@@ -376,6 +546,15 @@ void RuntimeProfile::ToThrift(TRuntimeProfileTree* tree) {
 }
 
 void RuntimeProfile::ToThrift(vector<TRuntimeProfileNode>* nodes) {
+  ToThrift(nodes, false);
+}
+
+void RuntimeProfile::ToThriftDelta(TRuntimeProfileTree* tree) {
+  tree->nodes.clear();
+  ToThrift(&tree->nodes, true);
+}
+
+void RuntimeProfile::ToThrift(vector<TRuntimeProfileNode>* nodes, bool delta) {
   nodes->reserve(nodes->size() + children_.size());
 
   int index = nodes->size();
@@ -387,9 +566,13 @@ void RuntimeProfile::ToThrift(vector<TRuntimeProfileNode>* nodes) {
   node.indent = true;
 
   CounterMap counter_map;
+  HistogramMap histogram_map;
+  EventSequenceMap event_sequence_map;
   {
     lock_guard<mutex> l(counter_map_lock_);
     counter_map = counter_map_;
+    histogram_map = histogram_map_;
+    event_sequence_map = event_sequence_map_;
   }
   for (map<string, Counter*>::const_iterator iter = counter_map.begin();
        iter != counter_map.end(); ++iter) {
@@ -397,12 +580,57 @@ void RuntimeProfile::ToThrift(vector<TRuntimeProfileNode>* nodes) {
     counter.name = iter->first;
     counter.value = iter->second->value();
     counter.type = iter->second->type();
+    if (delta) {
+      map<string, int64_t>::iterator reported =
+          reported_counter_values_.find(counter.name);
+      if (reported != reported_counter_values_.end()) {
+        if (reported->second == counter.value) continue;
+        reported->second = counter.value;
+      } else {
+        reported_counter_values_[counter.name] = counter.value;
+      }
+    }
     node.counters.push_back(counter);
   }
+  for (HistogramMap::const_iterator it = histogram_map.begin();
+       it != histogram_map.end(); ++it) {
+    // histograms are sent in full, but only if they changed
+    if (delta) {
+      int64_t& reported_count = reported_histogram_counts_[it->first];
+      if (reported_count == it->second->count() && reported_count != 0) continue;
+      reported_count = it->second->count();
+    }
+    node.histograms.push_back(THistogram());
+    it->second->ToThrift(it->first, &node.histograms.back());
+    node.__isset.histograms = true;
+  }
+  for (EventSequenceMap::const_iterator it = event_sequence_map.begin();
+       it != event_sequence_map.end(); ++it) {
+    // like histograms, event sequences are sent in full if they changed
+    if (delta) {
+      int& reported_count = reported_event_counts_[it->first];
+      int num_events = it->second->num_events();
+      if (reported_count == num_events && reported_count != 0) continue;
+      reported_count = num_events;
+    }
+    node.event_sequences.push_back(TEventSequence());
+    it->second->ToThrift(it->first, &node.event_sequences.back());
+    node.__isset.event_sequences = true;
+  }
 
   {
     lock_guard<mutex> l(info_strings_lock_);
-    node.info_strings = info_strings_;
+    if (!delta) {
+      node.info_strings = info_strings_;
+    } else {
+      for (InfoStrings::const_iterator it = info_strings_.begin();
+          it != info_strings_.end(); ++it) {
+        string& reported = reported_info_strings_[it->first];
+        if (reported == it->second && !reported.empty()) continue;
+        reported = it->second;
+        node.info_strings.insert(*it);
+      }
+    }
   }
 
   ChildVector children;
@@ -412,7 +640,7 @@ void RuntimeProfile::ToThrift(vector<TRuntimeProfileNode>* nodes) {
   }
   for (int i = 0; i < children.size(); ++i) {
     int child_idx = nodes->size();
-    children[i].first->ToThrift(nodes);
+    children[i].first->ToThrift(nodes, delta);
     // fix up indentation flag
     (*nodes)[child_idx].indent = children[i].second;
   }
@@ -20,10 +20,14 @@
 #include <boost/scoped_ptr.hpp>
 #include <boost/thread/mutex.hpp>
 #include <boost/thread/thread.hpp>
+#include <cstring>
+#include <sys/resource.h>
 #include <iostream>
 
+#include "common/compiler-util.h"
 #include "common/logging.h"
 #include "common/object-pool.h"
+#include "util/histogram.h"
 #include "util/stopwatch.h"
 #include "gen-cpp/RuntimeProfile_types.h"
 
@@ -40,15 +44,22 @@ namespace impala {
 
 #if ENABLE_COUNTERS
   #define ADD_COUNTER(profile, name, type) (profile)->AddCounter(name, type)
+  #define ADD_SHARDED_COUNTER(profile, name, type) \
+      (profile)->AddShardedCounter(name, type)
   #define SCOPED_TIMER(c) \
       ScopedTimer<StopWatch> MACRO_CONCAT(SCOPED_TIMER, __COUNTER__)(c)
   #define COUNTER_UPDATE(c, v) (c)->Update(v)
   #define COUNTER_SET(c, v) (c)->Set(v)
+  #define SCOPED_THREAD_COUNTER_MEASUREMENT(c) \
+      ThreadCounterMeasurement \
+        MACRO_CONCAT(SCOPED_THREAD_COUNTER_MEASUREMENT, __COUNTER__)(c)
 #else
   #define ADD_COUNTER(profile, name, type) NULL
+  #define ADD_SHARDED_COUNTER(profile, name, type) NULL
   #define SCOPED_TIMER(c)
   #define COUNTER_UPDATE(c, v)
   #define COUNTER_SET(c, v)
+  #define SCOPED_THREAD_COUNTER_MEASUREMENT(c)
 #endif
 
 class ObjectPool;
@@ -109,6 +120,110 @@ class RuntimeProfile {
     DerivedCounterFunction counter_fn_;
   };
 
+  // A counter for hot paths that is updated by many threads concurrently, e.g. by
+  // all scanner threads of a scan node.  Each thread adds to its own shard, which is
+  // on a separate cache line, so updates don't bounce a shared cache line between
+  // cores; value() adds up the shards.
+  // Updates through a Counter* (e.g. from ScopedTimer or COUNTER_UPDATE on a
+  // Counter*) go to the shared value and are included in value() too, but Set() must
+  // not be used.
+  class ShardedCounter : public Counter {
+   public:
+    ShardedCounter(TCounterType::type type) : Counter(type) {
+      memset(shards_, 0, sizeof(shards_));
+    }
+
+    void Update(int64_t delta) {
+      // Threads only share a shard if there are more than NUM_SHARDS of them.
+      __sync_fetch_and_add(&shards_[GetShardIdx()].value, delta);
+    }
+
+    virtual int64_t value() const {
+      int64_t result = Counter::value();
+      for (int i = 0; i < NUM_SHARDS; ++i) result += shards_[i].value;
+      return result;
+    }
+
+   private:
+    static const int NUM_SHARDS = 16;
+    static const int CACHE_LINE_SIZE = 64;
+
+    struct Shard {
+      int64_t value;
+      char padding[CACHE_LINE_SIZE - sizeof(int64_t)];
+    };
+
+    // Returns the shard of the calling thread, which is assigned round robin on the
+    // thread's first update of any sharded counter.
+    static int GetShardIdx() {
+      if (UNLIKELY(thread_shard_idx_ < 0)) {
+        thread_shard_idx_ = __sync_fetch_and_add(&next_shard_idx_, 1) % NUM_SHARDS;
+      }
+      return thread_shard_idx_;
+    }
+
+    static __thread int thread_shard_idx_;
+    static int next_shard_idx_;
+
+    Shard shards_[NUM_SHARDS];
+  };
+
+  // An ordered list of labelled events with the times they happened, e.g. the
+  // milestones in the execution of a query ("Planning finished", "First row fetched").
+  // Times are wall clock ms since Start().  Unlike counters, this shows where the
+  // elapsed time of something went, not just how much work it did.
+  class EventSequence {
+   public:
+    // An event is a label and its time.
+    typedef std::pair<std::string, int64_t> Event;
+    typedef std::vector<Event> EventList;
+
+    EventSequence() {}
+
+    // Starts the clock that the events are timed with.  Must be called before
+    // MarkEvent().
+    void Start() { sw_.Start(); }
+
+    // Records an event with 'label' at the current time.
+    void MarkEvent(const std::string& label) {
+      boost::lock_guard<boost::mutex> l(lock_);
+      events_.push_back(std::make_pair(label, sw_.ElapsedTime()));
+    }
+
+    // Copies the events, in the order they happened, to 'events'.
+    void GetEvents(EventList* events) {
+      boost::lock_guard<boost::mutex> l(lock_);
+      *events = events_;
+    }
+
+    int num_events() {
+      boost::lock_guard<boost::mutex> l(lock_);
+      return events_.size();
+    }
+
+    void ToThrift(const std::string& name, TEventSequence* event_sequence);
+
+    // Replaces the events with those of 'event_sequence'.
+    void SetFromThrift(const TEventSequence& event_sequence);
+
+   private:
+    boost::mutex lock_;  // protects events_
+    WallClockStopWatch sw_;
+    EventList events_;
+  };
+
+  // The resources used by the threads doing some kind of work, e.g. the scanner
+  // threads of a scan node, as measured by ThreadCounterMeasurement.  Wall clock
+  // timers only show how long something took; these tell apart the time a thread
+  // was on the cpu from the time it was waiting (user + sys time << wall time) or
+  // was descheduled (involuntary context switches).
+  struct ThreadCounters {
+    Counter* user_time_;     // CPU_TICKS
+    Counter* sys_time_;      // CPU_TICKS
+    Counter* voluntary_context_switches_;
+    Counter* involuntary_context_switches_;
+  };
+
   // Create a runtime profile object with 'name'.  Counters and merged profile are
   // allocated from pool.
   RuntimeProfile(ObjectPool* pool, const std::string& name);
@@ -145,6 +260,12 @@ class RuntimeProfile {
   // If the counter already exists, the existing counter object is returned.
   Counter* AddCounter(const std::string& name, TCounterType::type type);
 
+  // Add a ShardedCounter with 'name'/'type', for counters that are updated by many
+  // threads.  The counter is owned by the RuntimeProfile object.
+  // If a counter with 'name' already exists, that counter must be a ShardedCounter
+  // and is returned.
+  ShardedCounter* AddShardedCounter(const std::string& name, TCounterType::type type);
+
   // Add a derived counter with 'name'/'type'. The counter is owned by the
   // RuntimeProfile object.
   // Returns NULL if the counter already exists.
@@ -155,6 +276,30 @@ class RuntimeProfile {
   // that name.
   Counter* GetCounter(const std::string& name);
 
+  // Adds a histogram with 'name' for values of 'type', e.g. the latencies of an
+  // operation that runs many times.  Returns the existing histogram if there is
+  // already one with 'name'.  The histogram is owned by the RuntimeProfile object.
+  // Unlike counters, histograms are not averaged by Divide(): merging the profiles
+  // of several fragment instances results in the distribution over all of them.
+  Histogram* AddHistogram(const std::string& name, TCounterType::type type);
+
+  // Returns the histogram with 'name', or NULL if there is none.
+  Histogram* GetHistogram(const std::string& name);
+
+  // Adds an event sequence with 'name', e.g. the timeline of a query, and returns it.
+  // Returns the existing one if there is already one with 'name'.  The sequence is
+  // owned by the RuntimeProfile object; the caller starts it.  Event sequences are
+  // not merged by Merge(), since their times are only meaningful for one profile.
+  EventSequence* AddEventSequence(const std::string& name);
+
+  // Returns the event sequence with 'name', or NULL if there is none.
+  EventSequence* GetEventSequence(const std::string& name);
+
+  // Adds the counters of a ThreadCounters, named 'prefix' followed by "UserTime",
+  // "SysTime", "VoluntaryContextSwitches" and "InvoluntaryContextSwitches".  The
+  // ThreadCounters is owned by the RuntimeProfile object.
+  ThreadCounters* AddThreadCounters(const std::string& prefix);
+
   // Adds all counters with 'name' that are registered either in this or
   // in any of the child profiles to 'counters'.
   void GetCounters(const std::string& name, std::vector<Counter*>* counters);
@@ -179,6 +324,13 @@ class RuntimeProfile {
   void ToThrift(TRuntimeProfileTree* tree);
   void ToThrift(std::vector<TRuntimeProfileNode>* nodes);
 
+  // Serializes the profile like ToThrift(), but only includes the counters and info
+  // strings that changed since the last call to ToThriftDelta() (all of them on the
+  // first call).  The tree of nodes is always complete, so Update() applies the
+  // result to a profile that received all previous deltas like a full profile.
+  // Must not be called concurrently with itself.
+  void ToThriftDelta(TRuntimeProfileTree* tree);
+
   // Divides all counters by n
   void Divide(int n);
 
@@ -236,7 +388,17 @@ class RuntimeProfile {
   // counters.
   typedef std::map<std::string, Counter*> CounterMap;
   CounterMap counter_map_;
-  boost::mutex counter_map_lock_;  // protects counter_map_
+
+  // Map from histogram names to histograms, which the profile owns.
+  typedef std::map<std::string, Histogram*> HistogramMap;
+  HistogramMap histogram_map_;
+
+  // Map from event sequence names to event sequences, which the profile owns.
+  typedef std::map<std::string, EventSequence*> EventSequenceMap;
+  EventSequenceMap event_sequence_map_;
+
+  // protects counter_map_, histogram_map_ and event_sequence_map_
+  boost::mutex counter_map_lock_;
 
   // Child profiles.  Does not own memory.
   // We record children in both a map (to facilitate updates) and a vector
@@ -252,6 +414,13 @@ class RuntimeProfile {
   InfoStrings info_strings_;
   boost::mutex info_strings_lock_;
 
+  // Counter values and info strings as of the last ToThriftDelta().  Only accessed
+  // by ToThriftDelta().
+  std::map<std::string, int64_t> reported_counter_values_;
+  std::map<std::string, int64_t> reported_histogram_counts_;
+  std::map<std::string, int> reported_event_counts_;
+  InfoStrings reported_info_strings_;
+
   Counter counter_total_time_;
   // Time spent in just in this profile (i.e. not the children) as a fraction
   // of the total time in the entire profile tree.
@@ -295,6 +464,9 @@ class RuntimeProfile {
   // Update a subtree of profiles from nodes, rooted at *idx.
   // On return, *idx points to the node immediately following this subtree.
   void Update(const std::vector<TRuntimeProfileNode>& nodes, int* idx);
+
+  // Implements ToThrift() and, if 'delta' is true, ToThriftDelta().
+  void ToThrift(std::vector<TRuntimeProfileNode>* nodes, bool delta);
   
   // Helper function to compute compute the fraction of the total time spent in 
   // this profile and its children.
@@ -317,7 +489,17 @@ template<class T>
 class ScopedTimer {
  public:
   ScopedTimer(RuntimeProfile::Counter* counter) :
-    counter_(counter) {
+    counter_(counter),
+    sharded_counter_(NULL) {
+    if (counter == NULL) return;
+    DCHECK(counter->type() == TCounterType::CPU_TICKS || 
+           counter->type() == TCounterType::TIME_MS);
+    sw_.Start();
+  }
+
+  ScopedTimer(RuntimeProfile::ShardedCounter* counter) :
+    counter_(NULL),
+    sharded_counter_(counter) {
     if (counter == NULL) return;
     DCHECK(counter->type() == TCounterType::CPU_TICKS || 
            counter->type() == TCounterType::TIME_MS);
@@ -336,6 +518,7 @@ class ScopedTimer {
   ~ScopedTimer() {
     sw_.Stop();
     if (counter_ != NULL) counter_->Update(sw_.ElapsedTime());
+    if (sharded_counter_ != NULL) sharded_counter_->Update(sw_.ElapsedTime());
   }
 
  private:
@@ -345,6 +528,33 @@ class ScopedTimer {
 
   T sw_;
   RuntimeProfile::Counter* counter_;
+  RuntimeProfile::ShardedCounter* sharded_counter_;
+};
+
+// Utility class to add the resources used by the calling thread while the object is
+// in scope to a ThreadCounters.  Only measures the calling thread, so the object
+// must be created and destroyed by the same thread.
+class ThreadCounterMeasurement {
+ public:
+  ThreadCounterMeasurement(RuntimeProfile::ThreadCounters* counters) :
+    counters_(counters),
+    stopped_(counters == NULL) {
+    if (counters != NULL) getrusage(RUSAGE_THREAD, &start_);
+  }
+
+  // Stops the measurement and updates the counters.  Later calls are no-ops.
+  void Stop();
+
+  ~ThreadCounterMeasurement() { Stop(); }
+
+ private:
+  // Disable copy constructor and assignment
+  ThreadCounterMeasurement(const ThreadCounterMeasurement& m);
+  ThreadCounterMeasurement& operator=(const ThreadCounterMeasurement& m);
+
+  RuntimeProfile::ThreadCounters* counters_;
+  bool stopped_;
+  rusage start_;
 };
 
 }
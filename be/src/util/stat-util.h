@@ -17,6 +17,8 @@
 #define IMPALA_UTIL_STAT_UTIL_H
 
 #include <math.h>
+#include <algorithm>
+#include <vector>
 
 namespace impala {
 
@@ -41,6 +43,16 @@ class StatUtil {
     *stddev /= N;
     *stddev = sqrt(*stddev);
   }
+
+  // Returns the 'percentile' (0 to 100) of the N values by the nearest rank method,
+  // i.e. the smallest value that is >= 'percentile' percent of the values.
+  template <typename T>
+  static T ComputePercentile(const T* values, int N, double percentile) {
+    std::vector<T> sorted(values, values + N);
+    std::sort(sorted.begin(), sorted.end());
+    int rank = static_cast<int>(ceil(percentile / 100 * N));
+    return sorted[std::max(rank, 1) - 1];
+  }
 };
 
 }
@@ -15,6 +15,7 @@
 #include <boost/static_assert.hpp>
 
 #include "common/hdfs.h"
+#include "runtime/inlined-string-value.h"
 #include "runtime/string-value.h"
 #include "runtime/timestamp-value.h"
 
@@ -26,6 +27,7 @@ class UnusedClass {
  private:
   BOOST_STATIC_ASSERT(sizeof(StringValue) == 16);
   BOOST_STATIC_ASSERT(offsetof(StringValue, len) == 8);
+  BOOST_STATIC_ASSERT(sizeof(InlinedStringValue) == sizeof(StringValue));
   BOOST_STATIC_ASSERT(sizeof(TimestampValue) == 16);
   BOOST_STATIC_ASSERT(offsetof(TimestampValue, date_) == 8);
   BOOST_STATIC_ASSERT(sizeof(hdfsFS) == sizeof(void*));
@@ -0,0 +1,91 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <stdlib.h>
+#include <limits>
+#include <sstream>
+#include <string>
+#include <gtest/gtest.h>
+
+#include "util/string-formatter.h"
+
+using namespace std;
+
+namespace impala {
+
+// The output must be the same as operator<<'s.
+template <typename T>
+static void TestFormatInt(T value) {
+  stringstream ss;
+  ss << static_cast<int64_t>(value);
+  char buf[StringFormatter::MAX_INT_LEN];
+  int len = StringFormatter::FormatInt(value, buf);
+  EXPECT_EQ(ss.str(), string(buf, len));
+}
+
+static void TestFormatDouble(double value, int precision) {
+  stringstream ss;
+  ss.precision(precision);
+  ss << value;
+  char buf[StringFormatter::MAX_DOUBLE_LEN];
+  int len = StringFormatter::FormatDouble(value, precision, buf);
+  EXPECT_EQ(ss.str(), string(buf, len));
+}
+
+TEST(StringFormatterTest, FormatInt) {
+  for (int i = -1000; i <= 1000; ++i) {
+    TestFormatInt(i);
+  }
+  TestFormatInt(numeric_limits<int8_t>::min());
+  TestFormatInt(numeric_limits<int8_t>::max());
+  TestFormatInt(numeric_limits<int16_t>::min());
+  TestFormatInt(numeric_limits<int16_t>::max());
+  TestFormatInt(numeric_limits<int32_t>::min());
+  TestFormatInt(numeric_limits<int32_t>::max());
+  TestFormatInt(numeric_limits<int64_t>::min());
+  TestFormatInt(numeric_limits<int64_t>::max());
+  int64_t power = 1;
+  for (int i = 0; i < 18; ++i) {
+    power *= 10;
+    TestFormatInt(power - 1);
+    TestFormatInt(power);
+    TestFormatInt(-power);
+  }
+  srand(0);
+  for (int i = 0; i < 10000; ++i) {
+    int64_t value = (static_cast<int64_t>(rand()) << 32 | rand()) >> (rand() % 64);
+    TestFormatInt(value);
+  }
+}
+
+TEST(StringFormatterTest, FormatDouble) {
+  double values[] = { 0, -0.0, 1, -1, 0.1, 1.0 / 3, 123456789.123, 1e-300, 1e300,
+      numeric_limits<double>::max(), numeric_limits<double>::min(),
+      numeric_limits<double>::infinity(), -numeric_limits<double>::infinity() };
+  int precisions[] = { 1, 6, 16, 17 };
+  for (int i = 0; i < sizeof(values) / sizeof(values[0]); ++i) {
+    for (int j = 0; j < sizeof(precisions) / sizeof(precisions[0]); ++j) {
+      TestFormatDouble(values[i], precisions[j]);
+      // floats are printed as doubles
+      TestFormatDouble(static_cast<float>(values[i]), precisions[j]);
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
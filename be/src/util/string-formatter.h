@@ -0,0 +1,79 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_STRING_FORMATTER_H
+#define IMPALA_UTIL_STRING_FORMATTER_H
+
+#include <stdio.h>
+#include <string.h>
+#include <boost/cstdint.hpp>
+
+namespace impala {
+
+// Utility functions for formatting numbers into a caller's buffer, the inverse of
+// StringParser.  Unlike a stringstream, they don't allocate or take the locale's
+// lock, and the output is the same as that of operator<<.
+class StringFormatter {
+ public:
+  // Longest output of FormatInt() for any integer type, e.g. "-9223372036854775808".
+  static const int MAX_INT_LEN = 20;
+
+  // Longest output of FormatDouble(): sign, 17 significant digits, point and an
+  // exponent like "e-308", or "-nan".
+  static const int MAX_DOUBLE_LEN = 32;
+
+  // Writes the decimal representation of 'value' to 'buf' (of at least MAX_INT_LEN
+  // bytes) and returns its length.  Two digits are written at a time from a table.
+  template <typename T>
+  static inline int FormatInt(T value, char* buf) {
+    // Work with the unsigned magnitude, since -min() overflows.
+    uint64_t magnitude = value < 0 ?
+        -static_cast<uint64_t>(static_cast<int64_t>(value)) : value;
+    char digits[MAX_INT_LEN];
+    char* end = digits + MAX_INT_LEN;
+    char* p = end;
+    while (magnitude >= 100) {
+      int pair = magnitude % 100;
+      magnitude /= 100;
+      p -= 2;
+      memcpy(p, &DIGIT_PAIRS[2 * pair], 2);
+    }
+    if (magnitude >= 10) {
+      p -= 2;
+      memcpy(p, &DIGIT_PAIRS[2 * magnitude], 2);
+    } else {
+      *--p = '0' + magnitude;
+    }
+    int len = 0;
+    if (value < 0) buf[len++] = '-';
+    memcpy(buf + len, p, end - p);
+    return len + (end - p);
+  }
+
+  // Writes 'value' with 'precision' significant digits (at most 17), like
+  // operator<< with that precision and the default float field, to 'buf' (of at least
+  // MAX_DOUBLE_LEN bytes) and returns its length.
+  static inline int FormatDouble(double value, int precision, char* buf) {
+    return snprintf(buf, MAX_DOUBLE_LEN, "%.*g", precision, value);
+  }
+
+ private:
+  // "00010203...99"
+  static const char DIGIT_PAIRS[201];
+};
+
+}
+
+#endif
@@ -16,7 +16,9 @@
 #ifndef IMPALA_UTIL_PARSE_UTIL_H
 #define IMPALA_UTIL_PARSE_UTIL_H
 
+#include <cstring>
 #include <limits>
+#include <boost/cstdint.hpp>
 #include "common/compiler-util.h"
 
 namespace impala {
@@ -32,7 +34,6 @@ namespace impala {
 //  - lookup table for converting character to digit
 // Improvements (TODO):
 //  - Validate input using _sidd_compare_ranges
-//  - Since we know the length, we can parallelize this: i.e. result = 100*s[0] + 10*s[1] + s[2]
 class StringParser {
  public:
   enum ParseResult {
@@ -44,6 +45,7 @@ class StringParser {
   // This is considerably faster than glibc's implementation (25x).  
   // In the case of overflow, the max/min value for the data type will be returned.
   // Assumes s represents a decimal number.
+  // For types of at least 32 bits, runs of 8 digits are converted at a time.
   template <typename T>
   static inline T StringToInt(const char* s, int len, ParseResult* result) {
     T val = 0;
@@ -53,6 +55,19 @@ class StringParser {
       case '-': negative = true;
       case '+': i = 1;
     }
+    if (sizeof(T) >= sizeof(int32_t)) {
+      while (len - i >= 8) {
+        int64_t digits = ParseEightDigits(s + i);
+        // Not all digits, the loop below returns the failure.
+        if (digits < 0) break;
+        if (UNLIKELY(val > (std::numeric_limits<T>::max() - digits) / 100000000)) {
+          *result = PARSE_OVERFLOW;
+          return negative ? std::numeric_limits<T>::min() : std::numeric_limits<T>::max();
+        }
+        val = val * 100000000 + digits;
+        i += 8;
+      }
+    }
     for (; i < len; ++i) {
       if (LIKELY(s[i] >= '0' && s[i] <= '9')) {
         T digit = s[i] - '0';
@@ -183,6 +198,26 @@ class StringParser {
     *result = PARSE_FAILURE;
     return false;
   }
+
+ private:
+  // Returns the value of the 8 decimal digits at s, or -1 if they are not all digits.
+  // All 8 characters are processed at once in a 64 bit register (this assumes a little
+  // endian cpu, as all x86 ones are).
+  static inline int64_t ParseEightDigits(const char* s) {
+    uint64_t val;
+    memcpy(&val, s, sizeof(val));
+    // A character is a digit if its high nibble is 3 and adding 6 to it does not
+    // change the high nibble.
+    uint64_t high_nibbles = (val & 0xF0F0F0F0F0F0F0F0ULL) |
+        (((val + 0x0606060606060606ULL) & 0xF0F0F0F0F0F0F0F0ULL) >> 4);
+    if (high_nibbles != 0x3333333333333333ULL) return -1;
+    val -= 0x3030303030303030ULL;
+    // Combine the digits into 2 digit, then 4 digit and then the 8 digit number.
+    val = val * 10 + (val >> 8);
+    val = (((val & 0x000000FF000000FFULL) * (100 + (1000000ULL << 32))) +
+        (((val >> 16) & 0x000000FF000000FFULL) * (1 + (10000ULL << 32)))) >> 32;
+    return val;
+  }
 };
 
 }
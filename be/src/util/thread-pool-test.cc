@@ -0,0 +1,116 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include <vector>
+#include <gtest/gtest.h>
+#include <boost/bind.hpp>
+#include <boost/thread/condition_variable.hpp>
+
+#include "util/metrics.h"
+#include "util/thread-pool.h"
+
+using namespace boost;
+
+namespace impala {
+
+struct Counts {
+  mutex lock;
+  std::vector<int> counts;
+};
+
+static void Increment(Counts* counts, int idx) {
+  lock_guard<mutex> l(counts->lock);
+  ++counts->counts[idx];
+}
+
+TEST(ThreadPoolTest, RunsAllItems) {
+  const int NUM_ITEMS = 1000;
+  for (int num_threads = 1; num_threads <= 8; num_threads *= 2) {
+    Counts counts;
+    counts.counts.resize(NUM_ITEMS);
+    {
+      ThreadPool pool(num_threads);
+      EXPECT_EQ(pool.num_threads(), num_threads);
+      for (int i = 0; i < NUM_ITEMS; ++i) {
+        pool.Offer(bind(&Increment, &counts, i));
+      }
+      // The destructor runs the items still queued.
+    }
+    for (int i = 0; i < NUM_ITEMS; ++i) {
+      EXPECT_EQ(counts.counts[i], 1) << "item " << i;
+    }
+  }
+}
+
+// Items that only finish once 'num_items' of them are running at the same time.
+struct Barrier {
+  mutex lock;
+  condition_variable arrived_cv;
+  int num_arrived;
+  int num_items;
+};
+
+static void Arrive(Barrier* barrier) {
+  unique_lock<mutex> l(barrier->lock);
+  ++barrier->num_arrived;
+  barrier->arrived_cv.notify_all();
+  while (barrier->num_arrived < barrier->num_items) barrier->arrived_cv.wait(l);
+}
+
+TEST(ThreadPoolTest, Grows) {
+  const int NUM_ITEMS = 8;
+  Metrics metrics;
+  Barrier barrier;
+  barrier.num_arrived = 0;
+  barrier.num_items = NUM_ITEMS;
+  {
+    // A fixed pool of one thread would never finish these items.
+    ThreadPool pool(1, -1);
+    pool.RegisterMetrics(&metrics, "test-pool");
+    for (int i = 0; i < NUM_ITEMS; ++i) pool.Offer(bind(&Arrive, &barrier));
+  }
+  EXPECT_EQ(barrier.num_arrived, NUM_ITEMS);
+  // The additional threads are gone.
+  std::string metric_values = metrics.DebugString();
+  EXPECT_NE(metric_values.find("test-pool.threads:1\n"), std::string::npos)
+      << metric_values;
+  EXPECT_NE(metric_values.find("test-pool.queue-size:0\n"), std::string::npos)
+      << metric_values;
+}
+
+TEST(ThreadPoolTest, WorkItemGroup) {
+  const int NUM_ITEMS = 100;
+  ThreadPool pool(4);
+  ThreadPool* pools[] = { &pool, NULL };
+  for (int i = 0; i < 2; ++i) {
+    Counts counts;
+    counts.counts.resize(NUM_ITEMS);
+    WorkItemGroup group;
+    for (int j = 0; j < NUM_ITEMS; ++j) {
+      group.Offer(pools[i], bind(&Increment, &counts, j));
+    }
+    group.Wait();
+    for (int j = 0; j < NUM_ITEMS; ++j) {
+      EXPECT_EQ(counts.counts[j], 1) << "item " << j;
+    }
+  }
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
@@ -0,0 +1,155 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#include "util/thread-pool.h"
+
+#include <boost/bind.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace impala;
+using namespace std;
+
+ThreadPool::ThreadPool(int num_threads, int max_threads)
+  : num_threads_(num_threads),
+    max_threads_(max_threads == 0 ? num_threads : max_threads),
+    shutdown_(false),
+    num_idle_(0),
+    num_active_(0),
+    num_additional_threads_(0),
+    queue_size_metric_(NULL),
+    active_threads_metric_(NULL),
+    threads_metric_(NULL),
+    threads_created_metric_(NULL) {
+  DCHECK_GT(num_threads, 0);
+  DCHECK(max_threads_ < 0 || max_threads_ >= num_threads);
+  for (int i = 0; i < num_threads; ++i) {
+    threads_.add_thread(new thread(&ThreadPool::WorkerThread, this, false));
+  }
+}
+
+ThreadPool::~ThreadPool() {
+  {
+    lock_guard<mutex> l(lock_);
+    shutdown_ = true;
+  }
+  work_available_.notify_all();
+  threads_.join_all();
+  unique_lock<mutex> l(lock_);
+  while (num_additional_threads_ > 0) additional_threads_done_.wait(l);
+  DCHECK(queue_.empty());
+}
+
+void ThreadPool::Offer(const WorkItem& item) {
+  {
+    lock_guard<mutex> l(lock_);
+    DCHECK(!shutdown_);
+    queue_.push_back(item);
+    int num_running = num_threads_ + num_additional_threads_;
+    if (static_cast<int>(queue_.size()) > num_idle_
+        && (max_threads_ < 0 || num_running < max_threads_)) {
+      // all threads are busy; the thread detaches when 't' goes out of scope
+      ++num_additional_threads_;
+      if (threads_created_metric_ != NULL) threads_created_metric_->Increment(1);
+      thread t(&ThreadPool::WorkerThread, this, true);
+    }
+    UpdateMetrics();
+  }
+  work_available_.notify_one();
+}
+
+void ThreadPool::RegisterMetrics(Metrics* metrics, const string& prefix) {
+  lock_guard<mutex> l(lock_);
+  queue_size_metric_ =
+      metrics->CreateAndRegisterPrimitiveMetric(prefix + ".queue-size", 0L);
+  active_threads_metric_ =
+      metrics->CreateAndRegisterPrimitiveMetric(prefix + ".active-threads", 0L);
+  threads_metric_ = metrics->CreateAndRegisterPrimitiveMetric(prefix + ".threads", 0L);
+  threads_created_metric_ =
+      metrics->CreateAndRegisterPrimitiveMetric(prefix + ".threads-created", 0L);
+  UpdateMetrics();
+}
+
+void ThreadPool::UpdateMetrics() {
+  if (queue_size_metric_ == NULL) return;
+  queue_size_metric_->Update(queue_.size());
+  active_threads_metric_->Update(num_active_);
+  threads_metric_->Update(num_threads_ + num_additional_threads_);
+}
+
+void ThreadPool::WorkerThread(bool additional) {
+  while (true) {
+    WorkItem item;
+    {
+      unique_lock<mutex> l(lock_);
+      if (!additional) {
+        ++num_idle_;
+        while (queue_.empty() && !shutdown_) {
+          work_available_.wait(l);
+        }
+        --num_idle_;
+      }
+      if (queue_.empty()) break;
+      item = queue_.front();
+      queue_.pop_front();
+      ++num_active_;
+      UpdateMetrics();
+    }
+    item();
+    lock_guard<mutex> l(lock_);
+    --num_active_;
+    UpdateMetrics();
+  }
+  if (!additional) return;
+  // Signal with the lock held, since the pool may be destroyed once it's released.
+  lock_guard<mutex> l(lock_);
+  --num_additional_threads_;
+  UpdateMetrics();
+  if (num_additional_threads_ == 0) additional_threads_done_.notify_all();
+}
+
+WorkItemGroup::~WorkItemGroup() {
+  DCHECK_EQ(num_running_, 0);
+  threads_.join_all();
+}
+
+void WorkItemGroup::Offer(ThreadPool* pool, const ThreadPool::WorkItem& item) {
+  {
+    lock_guard<mutex> l(lock_);
+    ++num_running_;
+  }
+  if (pool != NULL) {
+    pool->Offer(bind(&WorkItemGroup::Run, this, item));
+  } else {
+    threads_.add_thread(new thread(&WorkItemGroup::Run, this, item));
+  }
+}
+
+void WorkItemGroup::Wait() {
+  {
+    unique_lock<mutex> l(lock_);
+    while (num_running_ > 0) done_.wait(l);
+  }
+  threads_.join_all();
+}
+
+void WorkItemGroup::Run(const ThreadPool::WorkItem& item) {
+  item();
+  // Signal with the lock held, since the group may be destroyed once it's released.
+  lock_guard<mutex> l(lock_);
+  --num_running_;
+  if (num_running_ == 0) done_.notify_all();
+}
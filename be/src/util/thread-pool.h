@@ -0,0 +1,128 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_THREAD_POOL_H
+#define IMPALA_UTIL_THREAD_POOL_H
+
+#include <list>
+#include <string>
+#include <boost/function.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/thread/thread.hpp>
+
+#include "util/metrics.h"
+
+namespace impala {
+
+// Pool of worker threads that run work items in the order they were offered.  This
+// class is thread safe.
+// The pool keeps num_threads() threads.  If it may grow (max_threads is not
+// num_threads), an item that is offered while all threads are busy starts another
+// thread instead of waiting, up to max_threads threads; these additional threads
+// exit once the queue is empty.  A pool without a bound on its threads therefore
+// never queues items, which is required when items wait for each other, while still
+// reusing its threads for the items of a steady load.
+// Example usage:
+//   ThreadPool pool(4);
+//   pool.Offer(bind(&Decompress, block));  // runs on one of the 4 threads
+class ThreadPool {
+ public:
+  typedef boost::function<void ()> WorkItem;
+
+  // Starts num_threads worker threads.  'max_threads' is the number of threads the
+  // pool may grow to, -1 for no limit; 0 (or num_threads) means a fixed pool.
+  ThreadPool(int num_threads, int max_threads = 0);
+
+  // Runs the work items that are still queued and joins the threads.
+  ~ThreadPool();
+
+  // Queues 'item' to be run by the next free thread.  This does not block.
+  void Offer(const WorkItem& item);
+
+  int num_threads() const { return num_threads_; }
+
+  // Registers and maintains the metrics "<prefix>.queue-size", "<prefix>.active-threads"
+  // and "<prefix>.threads", the current number of queued items, of threads running an
+  // item and of threads, and "<prefix>.threads-created", the number of threads the
+  // pool started beyond num_threads().
+  void RegisterMetrics(Metrics* metrics, const std::string& prefix);
+
+ private:
+  // Worker thread loop: runs queued items until the pool is shut down and the queue
+  // is empty.  An 'additional' thread returns as soon as the queue is empty.
+  void WorkerThread(bool additional);
+
+  // Updates the metrics, if registered.  lock_ must be held.
+  void UpdateMetrics();
+
+  const int num_threads_;
+  const int max_threads_;
+
+  // Protects all members below.
+  boost::mutex lock_;
+  boost::condition_variable work_available_;
+  std::list<WorkItem> queue_;
+  bool shutdown_;
+
+  // Number of threads waiting for work and of threads running an item.
+  int num_idle_;
+  int num_active_;
+
+  // Number of additional threads that are running; signalled when it drops to 0.
+  // These threads are detached.
+  int num_additional_threads_;
+  boost::condition_variable additional_threads_done_;
+
+  // NULL until RegisterMetrics() is called.
+  Metrics::IntMetric* queue_size_metric_;
+  Metrics::IntMetric* active_threads_metric_;
+  Metrics::IntMetric* threads_metric_;
+  Metrics::IntMetric* threads_created_metric_;
+
+  boost::thread_group threads_;
+};
+
+// The work items that a client offered to a ThreadPool (e.g. one that other clients
+// share), so that the client can wait for them.  Without a pool each item runs on a
+// thread of its own.  This class is thread safe.
+class WorkItemGroup {
+ public:
+  WorkItemGroup() : num_running_(0) {}
+
+  // The items must have finished.
+  ~WorkItemGroup();
+
+  // Runs 'item' on 'pool', or on a new thread if 'pool' is NULL.
+  void Offer(ThreadPool* pool, const ThreadPool::WorkItem& item);
+
+  // Waits until all items offered so far have finished.
+  void Wait();
+
+ private:
+  // Runs 'item' and signals done_ if it is the last one.
+  void Run(const ThreadPool::WorkItem& item);
+
+  boost::mutex lock_;
+  boost::condition_variable done_;
+  int num_running_;
+
+  // Threads of the items offered without a pool; Wait() joins them.
+  boost::thread_group threads_;
+};
+
+}
+
+#endif
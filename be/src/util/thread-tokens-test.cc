@@ -0,0 +1,82 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include <gtest/gtest.h>
+
+#include "util/thread-tokens.h"
+
+namespace impala {
+
+TEST(ThreadTokensTest, AcquireRelease) {
+  ThreadTokens tokens(4);
+  EXPECT_EQ(tokens.num_tokens(), 4);
+  EXPECT_EQ(tokens.TryAcquire(3), 3);
+  // only what is left
+  EXPECT_EQ(tokens.TryAcquire(3), 1);
+  EXPECT_EQ(tokens.TryAcquire(1), 0);
+  EXPECT_EQ(tokens.num_available(), 0);
+  tokens.Release(2);
+  EXPECT_EQ(tokens.num_available(), 2);
+  EXPECT_EQ(tokens.TryAcquire(0), 0);
+  EXPECT_EQ(tokens.TryAcquire(5), 2);
+  tokens.Release(4);
+  EXPECT_EQ(tokens.num_available(), 4);
+}
+
+TEST(ThreadTokensTest, Quota) {
+  ThreadTokens tokens(4);
+  ThreadTokens quota(3, &tokens);
+  // limited by the quota
+  EXPECT_EQ(quota.TryAcquire(4), 3);
+  EXPECT_EQ(tokens.num_available(), 1);
+  EXPECT_EQ(tokens.TryAcquire(2), 1);
+  quota.Release(2);
+  EXPECT_EQ(quota.num_available(), 2);
+  EXPECT_EQ(tokens.num_available(), 2);
+  // limited by the parent
+  EXPECT_EQ(tokens.TryAcquire(1), 1);
+  EXPECT_EQ(quota.TryAcquire(2), 1);
+  EXPECT_EQ(quota.num_available(), 1);
+  quota.Release(2);
+  tokens.Release(2);
+  EXPECT_EQ(quota.num_available(), 3);
+  EXPECT_EQ(tokens.num_available(), 4);
+}
+
+TEST(ThreadTokensTest, QueryTokens) {
+  ThreadTokens tokens(4);
+  TUniqueId id;
+  id.hi = 1;
+  id.lo = 2;
+  boost::shared_ptr<ThreadTokens> query_tokens =
+      ThreadTokens::GetQueryTokens(id, 2, &tokens);
+  EXPECT_EQ(query_tokens->num_tokens(), 2);
+  // shared by the fragment instances of the query
+  EXPECT_EQ(ThreadTokens::GetQueryTokens(id, 3, &tokens).get(), query_tokens.get());
+  EXPECT_EQ(query_tokens->TryAcquire(4), 2);
+  EXPECT_EQ(tokens.num_available(), 2);
+  query_tokens->Release(2);
+
+  // new tokens once the last reference is gone
+  query_tokens.reset();
+  query_tokens = ThreadTokens::GetQueryTokens(id, 3, &tokens);
+  EXPECT_EQ(query_tokens->num_tokens(), 3);
+}
+
+}
+
+int main(int argc, char **argv) {
+  ::testing::InitGoogleTest(&argc, argv);
+  return RUN_ALL_TESTS();
+}
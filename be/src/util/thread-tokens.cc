@@ -0,0 +1,81 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+#include "util/thread-tokens.h"
+
+#include <algorithm>
+#include <boost/thread/locks.hpp>
+
+#include "common/logging.h"
+
+using namespace boost;
+using namespace std;
+
+namespace impala {
+
+mutex ThreadTokens::query_tokens_lock_;
+ThreadTokens::QueryTokensMap ThreadTokens::query_tokens_;
+
+ThreadTokens::ThreadTokens(int num_tokens, ThreadTokens* parent)
+  : num_tokens_(num_tokens),
+    parent_(parent),
+    num_available_(num_tokens) {
+  DCHECK_GE(num_tokens, 0);
+}
+
+shared_ptr<ThreadTokens> ThreadTokens::GetQueryTokens(const TUniqueId& id,
+    int num_tokens, ThreadTokens* parent) {
+  lock_guard<mutex> l(query_tokens_lock_);
+  QueryTokensMap::iterator it = query_tokens_.find(id);
+  if (it != query_tokens_.end()) {
+    shared_ptr<ThreadTokens> tokens = it->second.lock();
+    if (tokens.get() != NULL) return tokens;
+  }
+  // Drop the entries of finished queries.
+  for (QueryTokensMap::iterator entry = query_tokens_.begin();
+      entry != query_tokens_.end();) {
+    if (entry->second.expired()) {
+      entry = query_tokens_.erase(entry);
+    } else {
+      ++entry;
+    }
+  }
+  shared_ptr<ThreadTokens> tokens(new ThreadTokens(num_tokens, parent));
+  query_tokens_[id] = tokens;
+  return tokens;
+}
+
+int ThreadTokens::TryAcquire(int num_tokens) {
+  if (num_tokens <= 0) return 0;
+  lock_guard<mutex> l(lock_);
+  int acquired = min(num_tokens, num_available_);
+  if (parent_ != NULL) acquired = parent_->TryAcquire(acquired);
+  num_available_ -= acquired;
+  return acquired;
+}
+
+void ThreadTokens::Release(int num_tokens) {
+  if (num_tokens <= 0) return;
+  lock_guard<mutex> l(lock_);
+  num_available_ += num_tokens;
+  DCHECK_LE(num_available_, num_tokens_);
+  if (parent_ != NULL) parent_->Release(num_tokens);
+}
+
+int ThreadTokens::num_available() {
+  lock_guard<mutex> l(lock_);
+  return num_available_;
+}
+
+}
@@ -0,0 +1,80 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+
+#ifndef IMPALA_UTIL_THREAD_TOKENS_H
+#define IMPALA_UTIL_THREAD_TOKENS_H
+
+#include <boost/shared_ptr.hpp>
+#include <boost/thread/mutex.hpp>
+#include <boost/unordered_map.hpp>
+#include <boost/weak_ptr.hpp>
+
+#include "util/uid-util.h"
+#include "gen-cpp/Types_types.h"  // for TUniqueId
+
+namespace impala {
+
+// A fixed number of tokens that components which start threads on demand share, so
+// that the threads of concurrent queries together don't oversubscribe the cores.
+// A component acquires a token for each thread it would like to run and returns it
+// when the thread is done; once the tokens are used up, it makes do with the
+// threads it has.  This class is thread safe.
+// Tokens with a parent are a quota of the parent's tokens: acquiring a token also
+// acquires one of the parent, so that e.g. the scans of a query don't hold more than
+// its quota of the tokens of all queries.
+class ThreadTokens {
+ public:
+  // 'parent', if non-NULL, must outlive these tokens.
+  ThreadTokens(int num_tokens, ThreadTokens* parent = NULL);
+
+  // Returns the tokens of query 'id', creating 'num_tokens' of them with 'parent' if
+  // they don't exist yet.  All fragment instances of a query on this node share the
+  // same tokens; they are dropped once the last reference to them is released.
+  static boost::shared_ptr<ThreadTokens> GetQueryTokens(const TUniqueId& id,
+      int num_tokens, ThreadTokens* parent);
+
+  // Acquires up to 'num_tokens' tokens (and as many of the parent's) and returns the
+  // number acquired.
+  int TryAcquire(int num_tokens);
+
+  // Returns 'num_tokens' acquired tokens (to the parent too).
+  void Release(int num_tokens);
+
+  int num_tokens() const { return num_tokens_; }
+
+  // Returns the number of tokens that are not acquired.
+  int num_available();
+
+ private:
+  typedef boost::unordered_map<TUniqueId, boost::weak_ptr<ThreadTokens> >
+      QueryTokensMap;
+
+  const int num_tokens_;
+  ThreadTokens* parent_;
+
+  // Protects num_available_.
+  boost::mutex lock_;
+  int num_available_;
+
+  // Protects query_tokens_.
+  static boost::mutex query_tokens_lock_;
+
+  // The tokens of the running queries, by query id.
+  static QueryTokensMap query_tokens_;
+};
+
+}
+
+#endif
@@ -13,6 +13,7 @@
 // limitations under the License.
 
 #include <util/thrift-client.h>
+#include <poll.h>
 #include <boost/assign.hpp>
 #include <ostream>
 
@@ -52,6 +53,24 @@ Status ThriftClientImpl::OpenWithRetry(
   return status;
 }
 
+bool ThriftClientImpl::IsHealthy() {
+  if (!transport_->isOpen()) return false;
+  // An idle connection has nothing to read; if it's readable, the remote end
+  // closed it or it is out of sync.
+  pollfd poll_fd;
+  poll_fd.fd = socket_->getSocketFD();
+  poll_fd.events = POLLIN;
+  poll_fd.revents = 0;
+  return poll(&poll_fd, 1, 0) == 0;
+}
+
+void ThriftClientImpl::SetTimeouts(int timeout_ms) {
+  DCHECK_GE(timeout_ms, 0);
+  socket_->setConnTimeout(timeout_ms);
+  socket_->setSendTimeout(timeout_ms);
+  socket_->setRecvTimeout(timeout_ms);
+}
+
 Status ThriftClientImpl::Close() {
   if (transport_->isOpen()) {
     transport_->close();
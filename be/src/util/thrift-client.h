@@ -35,6 +35,7 @@
 
 DECLARE_string(principal);
 DECLARE_string(hostname);
+DECLARE_int32(sasl_max_frame_size);
 
 namespace impala {
 // Super class for templatized thrift clients.
@@ -56,6 +57,14 @@ class ThriftClientImpl {
   // Close the connection with the remote server. May be called
   // repeatedly.
   Status Close();
+
+  // Returns true if the connection is open and the remote end hasn't closed it (or
+  // sent data that no rpc asked for).  Doesn't block.  Only meaningful between rpcs.
+  bool IsHealthy();
+
+  // Sets the connect, send and receive timeouts of the underlying socket.  An rpc
+  // that times out throws a TTransportException.  0 means no timeout (the default).
+  void SetTimeouts(int timeout_ms);
  protected:
   ThriftClientImpl(const std::string& ipaddress, int port)
     : ipaddress_(ipaddress),
@@ -123,8 +132,10 @@ ThriftClient<InterfaceType>::ThriftClient(
   // Check to enable kerberos
   if (!FLAGS_principal.empty()) {
     GetTSaslClient(ipaddress_, &sasl_client_);
-    transport_.reset(new apache::thrift::transport::TSaslClientTransport(
-        sasl_client_, transport_));
+    apache::thrift::transport::TSaslClientTransport* sasl_transport =
+        new apache::thrift::transport::TSaslClientTransport(sasl_client_, transport_);
+    sasl_transport->setMaxFrameSize(FLAGS_sasl_max_frame_size);
+    transport_.reset(sasl_transport);
   }
 
   protocol_.reset(new apache::thrift::protocol::TBinaryProtocol(transport_));
@@ -193,8 +193,8 @@ void* ThriftServer::ThriftServerEventProcessor::createContext(shared_ptr<TProtoc
   if (!thrift_server_->kerberos_enabled_) {
     switch (thrift_server_->server_type_) {
       case Nonblocking:
-        socket = static_cast<TSocket*>(
-            static_cast<TFramedTransport*>(transport)->getUnderlyingTransport().get());
+        // The TNonblockingServer hands us the connection's memory buffers, not its
+        // socket, so the peer address isn't available.
         break;
       case ThreadPool:
       case Threaded:
@@ -209,11 +209,14 @@ void* ThriftServer::ThriftServerEventProcessor::createContext(shared_ptr<TProtoc
         static_cast<TSaslServerTransport*>(transport)->getUnderlyingTransport().get());
   }    
     
-  ss << socket->getPeerAddress() << ":" << socket->getPeerPort();
-
   {
     lock_guard<mutex> l_(thrift_server_->session_keys_lock_);
-      
+
+    if (socket != NULL) {
+      ss << socket->getPeerAddress() << ":" << socket->getPeerPort();
+    } else {
+      ss << "connection-" << ++thrift_server_->num_connections_;
+    }
     shared_ptr<SessionKey> key_ptr(new string(ss.str()));
 
     __session_key__ = key_ptr.get();
@@ -262,6 +265,7 @@ ThriftServer::ThriftServer(const string& name, const shared_ptr<TProcessor>& pro
       server_(NULL),
       processor_(processor),
       session_handler_(NULL),
+      num_connections_(0),
       kerberos_enabled_(false){
 }
 
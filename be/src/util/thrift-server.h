@@ -29,10 +29,12 @@ namespace boost { class thread; }
 
 namespace impala {
 
-// Utility class for all Thrift servers. Runs a TNonblockingServer(default) or a
-// TThreadPoolServer with, by default, 2 worker threads, that exposes the interface
-// described by a user-supplied TProcessor object.
-// If TNonblockingServer is used, client must use TFramedTransport.
+// Utility class for all Thrift servers. Runs a TThreadedServer(default),
+// TThreadPoolServer or TNonblockingServer with, by default, 2 worker threads, that
+// exposes the interface described by a user-supplied TProcessor object.
+// If TNonblockingServer is used, client must use TFramedTransport. It serves all
+// connections from a single event loop and only takes a worker thread while it
+// executes a request, so it can hold many mostly idle connections.
 // If TThreadPoolServer is used, client must use TSocket as transport.
 class ThriftServer {
  public:
@@ -122,7 +124,7 @@ class ThriftServer {
   // If not NULL, called when session events happen. Not owned by us.
   SessionHandlerIf* session_handler_;
 
-  // Protects session_keys_
+  // Protects session_keys_ and num_connections_
   boost::mutex session_keys_lock_;
 
   // Map of active session keys to shared_ptr containing that key; when a key is
@@ -130,6 +132,10 @@ class ThriftServer {
   typedef boost::unordered_map<SessionKey*, boost::shared_ptr<SessionKey> > SessionKeySet;
   SessionKeySet session_keys_;
 
+  // Number of connections accepted by a Nonblocking server, whose session keys can't be
+  // the peer addresses
+  int64_t num_connections_;
+
   // True if using a secure transport
   bool kerberos_enabled_;
 
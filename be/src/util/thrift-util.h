@@ -87,6 +87,43 @@ Status DeserializeThriftMsg(JNIEnv* env, jbyteArray serialized_msg, T* deseriali
   return Status::OK;
 }
 
+// Serializes 'msg' with the binary protocol into 'serialized_msg'.
+template <class T>
+Status SerializeThriftMsg(T* msg, std::string* serialized_msg) {
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> tmem_transport(
+      new apache::thrift::transport::TMemoryBuffer());
+  apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer>
+      tproto(tmem_transport);
+  try {
+    msg->write(&tproto);
+  } catch (apache::thrift::TException& e) {
+    std::stringstream msg;
+    msg << "couldn't serialize thrift msg:\n" << e.what();
+    return Status(msg.str());
+  }
+  *serialized_msg = tmem_transport->getBufferAsString();
+  return Status::OK;
+}
+
+// Deserializes a msg serialized by SerializeThriftMsg(T*, std::string*).
+template <class T>
+Status DeserializeThriftMsg(const std::string& serialized_msg, T* deserialized_msg) {
+  boost::shared_ptr<apache::thrift::transport::TMemoryBuffer> tmem_transport(
+      new apache::thrift::transport::TMemoryBuffer(
+          reinterpret_cast<uint8_t*>(const_cast<char*>(serialized_msg.data())),
+          serialized_msg.size()));
+  apache::thrift::protocol::TBinaryProtocolT<apache::thrift::transport::TMemoryBuffer>
+      tproto(tmem_transport);
+  try {
+    deserialized_msg->read(&tproto);
+  } catch (apache::thrift::TException& e) {
+    std::stringstream msg;
+    msg << "couldn't deserialize thrift msg:\n" << e.what();
+    return Status(msg.str());
+  }
+  return Status::OK;
+}
+
 // Redirects all Thrift logging to VLOG(1)
 void InitThriftLogging();
 
@@ -57,6 +57,9 @@ void Webserver::RootHandler(stringstream* output) {
   BOOST_FOREACH(const PathHandlerMap::value_type& handler, path_handlers_) {
     (*output) << "<a href=\"" << handler.first << "\">" << handler.first << "</a><br/>";
   }
+  BOOST_FOREACH(const RawPathHandlerMap::value_type& handler, raw_path_handlers_) {
+    (*output) << "<a href=\"" << handler.first << "\">" << handler.first << "</a><br/>";
+  }
 }
 
 Status Webserver::Start() {
@@ -118,6 +121,23 @@ void* Webserver::MongooseCallback(enum mg_event event, struct mg_connection* con
     const struct mg_request_info* request_info) {
   if (event == MG_NEW_REQUEST) {
     mutex::scoped_lock lock(path_handlers_lock_);
+    RawPathHandlerMap::const_iterator raw_it = raw_path_handlers_.find(request_info->uri);
+    if (raw_it != raw_path_handlers_.end()) {
+      RawPathHandlerCallback callback = raw_it->second;
+      lock.unlock();
+      ArgumentMap args;
+      ParseArguments(request_info->query_string, &args);
+      stringstream output;
+      callback(args, &output);
+      string str = output.str();
+      mg_printf(connection, "HTTP/1.1 200 OK\r\n"
+          "Content-Type: text/plain\r\n"
+          "Content-Length: %d\r\n"
+          "\r\n", (int)str.length());
+      mg_write(connection, str.c_str(), str.length());
+      return PROCESSING_COMPLETE;
+    }
+
     PathHandlerMap::const_iterator it = path_handlers_.find(request_info->uri);
     if (it == path_handlers_.end()) {
       mg_printf(connection, "HTTP/1.1 404 Not Found\r\n"
@@ -150,7 +170,36 @@ void Webserver::RegisterPathHandler(const std::string& path,
    const PathHandlerCallback& callback) {
   mutex::scoped_lock lock(path_handlers_lock_);
   // operator [] constructs an entry if one does not exist
+  DCHECK(raw_path_handlers_.find(path) == raw_path_handlers_.end()) << path;
   path_handlers_[path].push_back(callback);
 }
 
+void Webserver::RegisterRawPathHandler(const std::string& path,
+    const RawPathHandlerCallback& callback) {
+  mutex::scoped_lock lock(path_handlers_lock_);
+  DCHECK(path_handlers_.find(path) == path_handlers_.end()) << path;
+  DCHECK(raw_path_handlers_.find(path) == raw_path_handlers_.end()) << path;
+  raw_path_handlers_[path] = callback;
+}
+
+void Webserver::ParseArguments(const char* query_string, ArgumentMap* args) {
+  if (query_string == NULL) return;
+  string query(query_string);
+  size_t start = 0;
+  while (start < query.size()) {
+    size_t end = query.find('&', start);
+    if (end == string::npos) end = query.size();
+    string arg = query.substr(start, end - start);
+    size_t eq = arg.find('=');
+    if (!arg.empty()) {
+      if (eq == string::npos) {
+        (*args)[arg] = "";
+      } else {
+        (*args)[arg.substr(0, eq)] = arg.substr(eq + 1);
+      }
+    }
+    start = end + 1;
+  }
+}
+
 }
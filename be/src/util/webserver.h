@@ -32,6 +32,15 @@ class Webserver {
  public:
   typedef boost::function<void (std::stringstream* output)> PathHandlerCallback;
 
+  // The arguments of a request's query string, e.g. {"seconds": "30"} for
+  // "/profile?seconds=30".
+  typedef std::map<std::string, std::string> ArgumentMap;
+
+  // Handlers that produce the whole body of the response, which is sent as plain
+  // text without any html around it, e.g. for binary profiles fetched by tools.
+  typedef boost::function<void (const ArgumentMap& args, std::stringstream* output)>
+      RawPathHandlerCallback;
+
   // If interface is set to the empty string the socket will bind to all available
   // interfaces.
   Webserver(const std::string& interface, const int port);
@@ -52,6 +61,12 @@ class Webserver {
   // http://hostname/ prefix.
   void RegisterPathHandler(const std::string& path, const PathHandlerCallback& callback);
 
+  // Register a raw handler with a particular URL path, which must not have other
+  // handlers.  Unlike the other handlers, raw handlers are called without holding the
+  // webserver's lock, so they may take long, e.g. to collect a profile.
+  void RegisterRawPathHandler(const std::string& path,
+      const RawPathHandlerCallback& callback);
+
  private:
   // Static so that it can act as a function pointer, and then call the next method
   static void* MongooseCallbackStatic(enum mg_event event, 
@@ -64,6 +79,10 @@ class Webserver {
   // Registered to handle "/", and prints a list of available URIs
   void RootHandler(std::stringstream* output);
 
+  // Parses a query string ("a=1&b=2") into 'args'.  Arguments without a value map to
+  // the empty string.
+  static void ParseArguments(const char* query_string, ArgumentMap* args);
+
   // Lock guarding the path_handlers_ map
   boost::mutex path_handlers_lock_;
 
@@ -72,6 +91,9 @@ class Webserver {
   typedef std::map<std::string, std::vector<PathHandlerCallback> > PathHandlerMap;
   PathHandlerMap path_handlers_;
 
+  typedef std::map<std::string, RawPathHandlerCallback> RawPathHandlerMap;
+  RawPathHandlerMap raw_path_handlers_;
+
   const int port_;
   // If empty, webserver will bind to all interfaces.
   const std::string& interface_;
@@ -73,6 +73,14 @@ cd $IMPALA_HOME/thirdparty/snappy-${IMPALA_SNAPPY_VERSION}
 ./configure --with-pic --prefix=$IMPALA_HOME/thirdparty/snappy-${IMPALA_SNAPPY_VERSION}/build
 make install
 
+# Build Lz4
+cd $IMPALA_HOME/thirdparty/lz4-${IMPALA_LZ4_VERSION}/lib
+CFLAGS="-O3 -fPIC" make install PREFIX=$IMPALA_HOME/thirdparty/lz4-${IMPALA_LZ4_VERSION}/build
+
+# Build zstd
+cd $IMPALA_HOME/thirdparty/zstd-${IMPALA_ZSTD_VERSION}/lib
+CFLAGS="-O3 -fPIC" make install PREFIX=$IMPALA_HOME/thirdparty/zstd-${IMPALA_ZSTD_VERSION}/build
+
 # Build Sasl
 # Disable everything except those protocols needed -- currently just Kerberos.
 # Sasl does not have a --with-pic configuration.
@@ -52,6 +52,8 @@ export IMPALA_GPERFTOOLS_VERSION=2.0
 export IMPALA_GLOG_VERSION=0.3.2
 export IMPALA_GTEST_VERSION=1.6.0
 export IMPALA_SNAPPY_VERSION=1.0.5
+export IMPALA_LZ4_VERSION=1.7.5
+export IMPALA_ZSTD_VERSION=1.3.3
 export IMPALA_CYRUS_SASL_VERSION=2.1.23
 export IMPALA_MONGOOSE_VERSION=3.3
 
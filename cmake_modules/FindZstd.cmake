@@ -0,0 +1,48 @@
+# - Find ZSTD (zstd.h, libzstd.a, libzstd.so, and libzstd.so.1)
+# This module defines
+#  ZSTD_INCLUDE_DIR, directory containing headers
+#  ZSTD_LIBS, directory containing zstd libraries
+#  ZSTD_STATIC_LIB, path to libzstd.a
+#  ZSTD_FOUND, whether zstd has been found
+
+set(ZSTD_SEARCH_HEADER_PATHS
+  ${CMAKE_SOURCE_DIR}/thirdparty/zstd-$ENV{IMPALA_ZSTD_VERSION}/build/include
+)
+
+set(ZSTD_SEARCH_LIB_PATH
+  ${CMAKE_SOURCE_DIR}/thirdparty/zstd-$ENV{IMPALA_ZSTD_VERSION}/build/lib
+)
+
+set(ZSTD_INCLUDE_DIR
+  ${CMAKE_SOURCE_DIR}/thirdparty/zstd-$ENV{IMPALA_ZSTD_VERSION}/build/include
+)
+
+find_library(ZSTD_LIB_PATH NAMES zstd
+  PATHS ${ZSTD_SEARCH_LIB_PATH}
+        NO_DEFAULT_PATH
+  DOC   "Zstandard compression library"
+)
+
+if (ZSTD_LIB_PATH)
+  set(ZSTD_FOUND TRUE)
+  set(ZSTD_LIBS ${ZSTD_SEARCH_LIB_PATH})
+  set(ZSTD_STATIC_LIB ${ZSTD_SEARCH_LIB_PATH}/libzstd.a)
+else ()
+  set(ZSTD_FOUND FALSE)
+endif ()
+
+if (ZSTD_FOUND)
+  if (NOT ZSTD_FIND_QUIETLY)
+    message(STATUS "Zstd Found in ${ZSTD_SEARCH_LIB_PATH}")
+  endif ()
+else ()
+  message(STATUS "Zstd includes and libraries NOT found. "
+    "Looked for headers in ${ZSTD_SEARCH_HEADER_PATHS}, "
+    "and for libs in ${ZSTD_SEARCH_LIB_PATH}")
+endif ()
+
+mark_as_advanced(
+  ZSTD_INCLUDE_DIR
+  ZSTD_LIBS
+  ZSTD_STATIC_LIB
+)
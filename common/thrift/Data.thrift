@@ -16,6 +16,7 @@ namespace cpp impala
 namespace java com.cloudera.impala.thrift
 
 include "Types.thrift"
+include "Descriptors.thrift"
 
 // Serialized, self-contained version of a RowBatch (in be/src/runtime/row-batch.h).
 struct TRowBatch {
@@ -26,13 +27,21 @@ struct TRowBatch {
   2: required list<Types.TTupleId> row_tuples
 
   // There are a total of num_rows * num_tuples_per_row offsets
-  // pointing into tuple_data.
+  // pointing into the (uncompressed) tuple_data.
   // An offset of -1 records a NULL.
   3: list<i32> tuple_offsets
 
-  // binary tuple data, broken up into chunks
-  // TODO: figure out how we can avoid copying the data during TRowBatch construction
-  4: list<string> tuple_data
+  // Field 4 (tuple data as a list of chunks) is retired.
+
+  // binary tuple data, as a single contiguous buffer; compressed with
+  // compression_type unless that is NONE
+  5: string tuple_data
+
+  // size of tuple_data after decompression
+  6: i32 uncompressed_size
+
+  // NONE or SNAPPY
+  7: Descriptors.THdfsCompression compression_type
 }
 
 // this is a union over all possible return types
@@ -36,6 +36,12 @@ struct TDataStreamSink {
   // If the partitioning type is UNPARTITIONED, the output is broadcast
   // to each destination host.
   2: required Partitions.TDataPartition output_partition
+
+  // For HASH_PARTITIONED output only: if true, rows with a NULL partitioning value
+  // are spread round-robin across the destinations instead of all being sent to the
+  // same one.  Only valid if the receiver never needs to see such rows together,
+  // e.g. the inputs of a partitioned equi-join.
+  3: optional bool spread_null_keys
 }
 
 // Creates a new Hdfs files according to the evaluation of the partitionKeyExprs,
@@ -43,6 +49,10 @@ struct TDataStreamSink {
 struct THdfsTableSink {
   1: required list<Exprs.TExpr> partition_key_exprs
   2: required bool overwrite
+
+  // If true, the rows of each partition arrive consecutively (the input is sorted by
+  // the partition keys), and the sink closes a partition's file once its rows end.
+  3: optional bool input_is_clustered
 }
 
 // Union type of all table sinks.
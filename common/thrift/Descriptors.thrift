@@ -48,7 +48,10 @@ enum THdfsCompression {
   GZIP,
   BZIP2,
   SNAPPY,
-  SNAPPY_BLOCKED // Used by sequence and rc files but not stored in the metadata.
+  SNAPPY_BLOCKED, // Used by sequence and rc files but not stored in the metadata.
+  LZ4,
+  LZ4_BLOCKED, // Hadoop's block framing of LZ4, like SNAPPY_BLOCKED.
+  ZSTD
 }
 
 struct THdfsPartition {
@@ -49,6 +49,8 @@ enum TAggregationOp {
   MERGE_PCSA,
   MIN,
   SUM,
+  DISTINCT_HLL,
+  MERGE_HLL,
 }
 
 struct TAggregateExpr {
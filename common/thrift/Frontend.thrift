@@ -100,6 +100,10 @@ struct TCatalogUpdate {
   // List of partitions that are new and need to be created. May
   // include the root partition (represented by the empty string).
   3: required set<string> created_partitions;
+
+  // Statistics of the rows that were written to each partition, keyed like
+  // created_partitions, if the INSERT gathered them.
+  4: optional map<string, ImpalaInternalService.TInsertPartitionStats> partition_stats;
 }
 
 // Metadata required to finalize a query - that is, to clean up after the query is done. 
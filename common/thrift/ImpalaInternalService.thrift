@@ -50,6 +50,15 @@ struct TQueryOptions {
   9: required i32 max_io_buffers = 0
   10: required bool allow_unsupported_formats = 0
   11: required bool partition_agg = 0
+  12: required bool partition_join = 0
+  13: required i64 mem_limit = 0
+  14: required i32 io_weight = 0
+  15: required string request_pool = ""
+  16: required bool clustered_insert = 0
+  17: required i32 num_instances_per_host = 0
+  18: required i64 max_broadcast_build_bytes = 0
+  19: required i32 max_scanner_thread_tokens = 0
+  20: required string cpu_cgroup = ""
 }
 
 // A scan range plus the parameters needed to execute that scan.
@@ -89,6 +98,19 @@ struct TPlanFragmentExecParams {
   // TPlanFragment.output_sink.output_partition.
   // The number of output partitions is destinations.size().
   5: list<TPlanFragmentDestination> destinations
+
+  // Broadcast exchange nodes whose stream this instance shares with the instances of
+  // its fragment on the same backend: the senders only send the stream to the
+  // instance broadcast_stream_id, and the backend hands each batch to all of the
+  // instances' receivers.  broadcast_stream_id is set iff
+  // shared_broadcast_exch_ids is non-empty.
+  6: optional set<Types.TPlanNodeId> shared_broadcast_exch_ids
+  7: optional Types.TUniqueId broadcast_stream_id
+
+  // Broadcast streams that this instance forwards to further instances while it
+  // receives them, as an inner node of a relay tree: map from the exchange node
+  // that receives the stream to the destinations it is forwarded to.
+  8: optional map<Types.TPlanNodeId, list<TPlanFragmentDestination>> relay_destinations
 }
 
 // Global query parameters assigned by the coordinator.
@@ -147,6 +169,31 @@ struct TExecPlanFragmentResult {
 
 // The results of an INSERT query, sent to the coordinator as part of 
 // TReportExecStatusParams
+// Statistics of a column of the rows that an INSERT wrote to a partition.
+struct TInsertColumnStats {
+  1: required i64 num_nulls
+
+  // Smallest and largest non-NULL value; not set if all values were NULL.  Timestamps
+  // are strings.
+  2: optional Data.TColumnValue min_value
+  3: optional Data.TColumnValue max_value
+
+  // HyperLogLog state of the hashes of the non-NULL values (see
+  // be/src/util/hyper-log-log.h), which the states of other writers can be merged into
+  4: required string ndv_state
+
+  // Estimated number of distinct non-NULL values; only set in TCatalogUpdate.
+  5: optional i64 num_distinct_values
+}
+
+// Statistics of the rows that an INSERT wrote to a partition.
+struct TInsertPartitionStats {
+  1: required i64 num_rows
+
+  // One per non-partition column of the table, in table order.
+  2: required list<TInsertColumnStats> column_stats
+}
+
 struct TInsertExecStatus {
   // Number of rows appended by an INSERT, per-partition.
   // The keys represent partitions to create, coded as k1=v1/k2=v2/k3=v3..., with the 
@@ -157,6 +204,10 @@ struct TInsertExecStatus {
   // A map from temporary absolute file path to final absolute destination. The 
   // coordinator performs these updates after the query completes. 
   2: required map<string, string> files_to_move;
+
+  // Statistics of the rows written to each partition, keyed like num_appended_rows.
+  // Only gathered with --insert_column_stats.
+  3: optional map<string, TInsertPartitionStats> partition_stats
 }
 
 struct TReportExecStatusParams {
@@ -222,8 +273,9 @@ struct TTransmitDataParams {
   // required in V1
   2: optional Types.TUniqueId dest_fragment_instance_id
 
-  // for debugging purposes; currently ignored
-  //3: optional Types.TUniqueId src_fragment_instance_id
+  // identifies the sending fragment instance; required in V1 for streams that are
+  // received by a merging exchange, which keeps the batches of each sender apart
+  3: optional Types.TUniqueId src_fragment_instance_id
 
   // required in V1
   4: optional Types.TPlanNodeId dest_node_id
@@ -239,6 +291,10 @@ struct TTransmitDataParams {
 struct TTransmitDataResult {
   // required in V1
   1: optional Status.TStatus status
+
+  // if set to true, the receiver doesn't need any more rows (e.g., because it reached
+  // its limit); the batch was dropped and the sender can stop sending
+  2: optional bool recvr_closed
 }
 
 
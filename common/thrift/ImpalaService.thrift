@@ -68,7 +68,52 @@ enum TImpalaQueryOptions {
   PARTITION_AGG,
   
   // If true, Impala will try to execute on file formats that are not fully supported yet
-  ALLOW_UNSUPPORTED_FORMATS
+  ALLOW_UNSUPPORTED_FORMATS,
+
+  // boolean; if true, execute equi-joins as partitioned joins: both inputs are
+  // hash-partitioned on their join exprs, so that each node only builds a hash table
+  // for its share of the right input, instead of for all of it
+  PARTITION_JOIN,
+
+  // Limit on the memory (in bytes) used by the query on each node; a query that
+  // exceeds it fails.  Unspecified or 0 indicates no limit.
+  MEM_LIMIT,
+
+  // Share of the disks given to the query's scans relative to other queries; a query
+  // with weight 4 gets roughly 4 times the io of a query with weight 1 when they read
+  // from the same disks.  Unspecified or 0 indicates backend default (1).
+  IO_WEIGHT,
+
+  // Admission control pool the query is submitted to (see --admission_pools).
+  // Unspecified or empty indicates the "default" pool.
+  REQUEST_POOL,
+
+  // boolean; if true, the rows of an INSERT into a partitioned table are sorted by
+  // their partition keys before they are written, so that each table sink only has
+  // one partition's file open at a time
+  CLUSTERED_INSERT,
+
+  // Number of instances of each partitioned plan fragment that run on a backend, so
+  // that a query uses more than one core per backend.  Unspecified or 0 indicates
+  // backend default (--fragment_instances_per_host).
+  NUM_INSTANCES_PER_HOST,
+
+  // Limit on the size (in bytes) of the hash table of a join whose right input is
+  // broadcast.  A query whose broadcast build exceeds it is re-planned and restarted
+  // with partitioned joins (see PARTITION_JOIN) before it returns any rows.
+  // Unspecified or 0 indicates no limit.
+  MAX_BROADCAST_BUILD_BYTES,
+
+  // Limit on the scanner thread tokens (see --num_scanner_thread_tokens) that the
+  // scans of the query hold on each node at a time, so that a wide scan leaves tokens
+  // for the scans of other queries.  Unspecified or 0 indicates the limit of the
+  // query's admission pool, if any.
+  MAX_SCANNER_THREAD_TOKENS,
+
+  // Cpu cgroup (below --cgroup_hierarchy_path) that the query's fragment threads run
+  // in, to give the query a cpu share relative to other cgroups.  Unspecified or empty
+  // indicates the cgroup of the query's admission pool, if any.
+  CPU_CGROUP
 }
 
 // The summary of an insert.
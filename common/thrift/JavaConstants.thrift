@@ -41,7 +41,9 @@ const map<string, Descriptors.THdfsCompression> COMPRESSION_MAP = {
   "deflate": Descriptors.THdfsCompression.DEFAULT,
   "gzip": Descriptors.THdfsCompression.GZIP,
   "bzip2": Descriptors.THdfsCompression.BZIP2,
-  "snappy": Descriptors.THdfsCompression.SNAPPY
+  "snappy": Descriptors.THdfsCompression.SNAPPY,
+  "lz4": Descriptors.THdfsCompression.LZ4,
+  "zstd": Descriptors.THdfsCompression.ZSTD
 }
 
 // Default values for each query option in ImpalaService.TImpalaQueryOptions
@@ -56,4 +58,13 @@ const map<ImpalaService.TImpalaQueryOptions, string> DEFAULT_QUERY_OPTIONS = {
   ImpalaService.TImpalaQueryOptions.NUM_SCANNER_THREADS : "0"
   ImpalaService.TImpalaQueryOptions.PARTITION_AGG : "false"
   ImpalaService.TImpalaQueryOptions.ALLOW_UNSUPPORTED_FORMATS : "false"
+  ImpalaService.TImpalaQueryOptions.PARTITION_JOIN : "false"
+  ImpalaService.TImpalaQueryOptions.MEM_LIMIT : "0"
+  ImpalaService.TImpalaQueryOptions.IO_WEIGHT : "0"
+  ImpalaService.TImpalaQueryOptions.REQUEST_POOL : ""
+  ImpalaService.TImpalaQueryOptions.CLUSTERED_INSERT : "false"
+  ImpalaService.TImpalaQueryOptions.NUM_INSTANCES_PER_HOST : "0",
+  ImpalaService.TImpalaQueryOptions.MAX_BROADCAST_BUILD_BYTES : "0",
+  ImpalaService.TImpalaQueryOptions.MAX_SCANNER_THREAD_TOKENS : "0",
+  ImpalaService.TImpalaQueryOptions.CPU_CGROUP : ""
 }
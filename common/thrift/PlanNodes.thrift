@@ -31,7 +31,8 @@ enum TPlanNodeType {
   AGGREGATION_NODE,
   SORT_NODE,
   EXCHANGE_NODE,
-  MERGE_NODE
+  MERGE_NODE,
+  NESTED_LOOP_JOIN_NODE
 }
 
 // The information contained in subclasses of ScanNode captured in two separate
@@ -55,6 +56,9 @@ struct THdfsFileSplit {
   // ID of partition in parent THdfsScanNode. Meaningful only
   // in the context of a single THdfsScanNode, may not be unique elsewhere.
   4: required i64 partition_id
+
+  // last modification time of the file (ms since epoch), as of planning
+  5: optional i64 mtime
 }
 
 // key range for single THBaseScanNode
@@ -66,6 +70,14 @@ struct THBaseKeyRange {
 
   // exclusive
   2: optional string stopKey
+
+  // host:port of the region server serving the range.  Used to bound the number of
+  // concurrent scans to one region server.
+  3: optional string regionServer
+
+  // If set, the range is just the rows with these keys (sorted, and within
+  // [startKey, stopKey)), which are read with a batch of gets instead of a scan.
+  4: optional list<string> rowKeys
 }
 
 // Specification of an individual data range which is held in its entirety
@@ -78,6 +90,12 @@ struct TScanRange {
 
 struct THdfsScanNode {
   1: required Types.TTupleId tuple_id
+
+  // If set, the scan only reads the scan ranges that a hash of their file and offset,
+  // seeded with sample_seed, selects with a probability of sample_percent / 100
+  // (TABLESAMPLE clause)
+  2: optional i32 sample_percent
+  3: optional i64 sample_seed
 }
 
 struct THBaseFilter {
@@ -123,6 +141,29 @@ struct THashJoinNode {
   // anything from the ON or USING clauses (but *not* the WHERE clause) that's not an
   // equi-join predicate
   3: optional list<Exprs.TExpr> other_join_conjuncts
+
+  // Set if the build input is the broadcast output of a table scan: identifies the
+  // rows (and their layout) that the scan returns, for reusing them across queries.
+  4: optional string build_cache_key
+
+  // Set if the build input is broadcast although the join could also be executed as
+  // a partitioned join.  The build then fails with BROADCAST_BUILD_LIMIT_EXCEEDED as
+  // soon as it exceeds TQueryOptions.max_broadcast_build_bytes.
+  5: optional bool limit_broadcast_build
+
+  // Slots of the build tuples that neither the join nor anything above it references,
+  // e.g. slots that are only materialized for the predicates of the build input.  The
+  // build rows don't keep the string data of these slots.
+  6: optional list<Types.TSlotId> unused_build_slots
+}
+
+// Join without equi-join predicates (cross joins, inequality and band joins): every
+// probe row is compared with every build row.
+struct TNestedLoopJoinNode {
+  1: required TJoinOp join_op
+
+  // the predicates from the ON clause (but *not* the WHERE clause)
+  2: optional list<Exprs.TExpr> join_conjuncts
 }
 
 struct TAggregationNode {
@@ -133,6 +174,19 @@ struct TAggregationNode {
   // Set to true if this aggregation function requires finalization to complete after all
   // rows have been aggregated, and this node is not an intermediate node.
   4: required bool need_finalize
+
+  // Set to true if the output of this node is merged by an aggregation node in another
+  // fragment; the node may then pass input rows through without aggregating them.
+  5: optional bool is_preaggregation
+
+  // Set to true if the input is sorted on the grouping exprs, so that the rows of each
+  // group are adjacent; the node then aggregates one group at a time.
+  6: optional bool input_is_sorted
+
+  // Set for a grouping pre-aggregation whose input is a table scan: identifies the
+  // groups of each scanned partition (by partition id), for reusing them across
+  // queries as long as the partition's files don't change.
+  7: optional map<i64, string> partition_cache_keys
 }
 
 struct TSortNode {
@@ -142,6 +196,13 @@ struct TSortNode {
   3: required bool use_top_n;
 }
 
+struct TExchangeNode {
+  // If set, each sender's stream is sorted on these exprs and the exchange node
+  // merges the streams into a single sorted stream of rows.
+  1: optional list<Exprs.TExpr> ordering_exprs
+  2: optional list<bool> is_asc_order
+}
+
 struct TMergeNode {
   // List or expr lists materialized by this node.
   // There is one list of exprs per query stmt feeding into this merge node.
@@ -150,6 +211,20 @@ struct TMergeNode {
   2: required list<list<Exprs.TExpr>> const_expr_lists
 }
 
+// What a plan node did in an earlier run of the same plan fragment, the maximum over
+// the fragment's instances.  Recorded by the coordinator (see ExecStatsStore).
+struct TPlanNodeExecStats {
+  // rows returned by the node
+  1: required i64 num_rows
+
+  // number of buckets of the node's hash table when it was done; 0 if the node
+  // doesn't have one
+  2: required i64 num_hash_table_buckets
+
+  // peak memory used by the node, in bytes
+  3: required i64 peak_mem_usage
+}
+
 // This is essentially a union of all messages corresponding to subclasses
 // of PlanNode.
 struct TPlanNode {
@@ -174,6 +249,11 @@ struct TPlanNode {
   12: optional TAggregationNode agg_node
   13: optional TSortNode sort_node
   14: optional TMergeNode merge_node
+  15: optional TExchangeNode exchange_node
+  16: optional TNestedLoopJoinNode nested_loop_join_node
+
+  // Set by the coordinator if the plan fragment ran before; not part of the plan.
+  17: optional TPlanNodeExecStats exec_stats
 }
 
 // A flattened representation of a tree of PlanNodes, obtained by depth-first
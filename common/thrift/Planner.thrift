@@ -68,4 +68,9 @@ struct TScanRangeLocations {
   1: required PlanNodes.TScanRange scan_range
   // non-empty list
   2: list<TScanRangeLocation> locations
+
+  // Set for the ranges of scans whose join with another scan of the same fragment is
+  // executed per bucket: the bucket of the range's file.  All ranges of a fragment with
+  // the same bucket are assigned to the same instance.
+  3: optional i32 bucket
 }
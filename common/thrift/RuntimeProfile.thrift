@@ -32,6 +32,27 @@ struct TCounter {
   3: required i64 value 
 }
 
+// A histogram of values with the same type, e.g. of latencies.  'buckets' maps the
+// indexes of the non-empty buckets to their counts; see be/src/util/histogram.h for
+// the bucket boundaries.
+struct THistogram {
+  1: required string name
+  2: required TCounterType type
+  3: required map<i32, i64> buckets
+  4: required i64 min_value
+  5: required i64 max_value
+  6: required i64 sum
+}
+
+// A sequence of labelled events, e.g. the milestones in the execution of a query.
+// timestamps[i] is the time of labels[i] in ms since the sequence was started; the
+// events are in the order they happened.
+struct TEventSequence {
+  1: required string name
+  2: required list<i64> timestamps
+  3: required list<string> labels
+}
+
 // A single runtime profile
 struct TRuntimeProfileNode {
   1: required string name
@@ -48,6 +69,12 @@ struct TRuntimeProfileNode {
   // map of key,value info strings that capture any kind of additional information 
   // about the profiled object
   6: required map<string, string> info_strings
+
+  // distributions of values over the lifetime of the profiled object
+  7: optional list<THistogram> histograms
+
+  // timelines of events, e.g. of the execution of the query
+  8: optional list<TEventSequence> event_sequences
 }
 
 // A flattened tree of runtime profiles, obtained by an
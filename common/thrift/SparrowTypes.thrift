@@ -33,6 +33,19 @@ struct TVersionedObject {
   5: binary value
 }
 
+// Load of an impalad, which it publishes through the state store in a
+// TVersionedObject of type "load" for the schedulers of the other impalads.
+struct TBackendLoad {
+  // Number of plan fragments executing.
+  1: i32 num_fragments
+
+  // Bytes of memory consumed by the process.
+  2: i64 mem_used
+
+  // Number of readers and writes waiting for the disks.
+  3: i32 disk_queue_length
+}
+
 // Information about a running instance of a particular service.
 struct TServiceInstance {
   // Unique identifier for the corresponding StateStoreSubscriber.
@@ -45,5 +58,16 @@ struct TServiceInstance {
 struct TServiceMembership {
   1: required string service_id
 
+  // If is_delta is set, only the instances that were added or changed since
+  // base_version.
   2: required list<TServiceInstance> service_instances
+
+  // Version of the membership, which increases with every change to it.
+  3: optional i64 version
+
+  // If true, this is the change from base_version to version: service_instances are
+  // the added instances and removed_subscriber_ids the removed ones.
+  4: optional bool is_delta
+  5: optional i64 base_version
+  6: optional list<i32> removed_subscriber_ids
 }
@@ -37,19 +37,28 @@ struct TUpdateStateRequest {
   // Objects that have been deleted, for each service that the subscriber has subscribed
   // to. Required in V1.
   4: optional list<string> deleted_object_keys
+
+  // If true, service_memberships only contains the services whose membership changed
+  // since the last update that the subscriber acknowledged; the other services are
+  // unchanged.
+  5: optional bool is_delta
 }
 
 struct TUpdateStateResponse {
   // Required in V1.
   1: optional Status.TStatus status
 
-  // For each service running on the subscriber, the object updates.  Required in V1,
-  // but not yet implemented.
+  // For each service running on the subscriber, the objects that it publishes.  These
+  // replace all objects that the subscriber published before for those services.
   2: optional list<SparrowTypes.TVersionedObject> updated_objects
 
   // Objects that have been deleted, for each service that the subscriber has subscribed
   // to. Required in V1, but not yet implemented.
   3: optional list<string> deleted_object_keys
+
+  // Set if the subscriber couldn't apply a delta because it doesn't have its base
+  // version, e.g. because it restarted; the next update must contain the full state.
+  4: optional bool needs_full_update
 }
 
 // The StateStoreSubscriber runs on all servers that need to connect to the StateStore,
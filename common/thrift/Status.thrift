@@ -21,7 +21,9 @@ enum TStatusCode {
   ANALYSIS_ERROR,
   NOT_IMPLEMENTED_ERROR,
   RUNTIME_ERROR,
-  INTERNAL_ERROR
+  INTERNAL_ERROR,
+  MEM_LIMIT_EXCEEDED,
+  BROADCAST_BUILD_LIMIT_EXCEEDED
 }
 
 struct TStatus {
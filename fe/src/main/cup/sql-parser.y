@@ -146,14 +146,14 @@ parser code {:
 
 terminal KW_AND, KW_ALL, KW_AS, KW_ASC, KW_AVG, KW_BETWEEN, KW_BIGINT, KW_BOOLEAN, KW_BY,
   KW_CASE, KW_CAST, KW_COUNT, KW_DATABASES, KW_DATE, KW_DATETIME, KW_DESC, KW_DESCRIBE, 
-  KW_DISTINCT, KW_DISTINCTPC, KW_DISTINCTPCSA,
+  KW_DISTINCT, KW_DISTINCTPC, KW_DISTINCTPCSA, KW_DISTINCTHLL,
   KW_DIV, KW_DOUBLE, KW_ELSE, KW_END, KW_FALSE, KW_FLOAT, KW_FROM, KW_FULL, KW_GROUP,
   KW_HAVING, KW_IS, KW_IN, KW_INNER, KW_JOIN, KW_INT, KW_LEFT, KW_LIKE, KW_LIMIT, KW_MIN,
   KW_MAX, KW_NOT, KW_NULL, KW_ON, KW_OR, KW_ORDER, KW_OUTER, KW_REGEXP,
   KW_RLIKE, KW_RIGHT, KW_SCHEMAS, KW_SELECT, KW_SHOW, KW_SEMI, KW_SMALLINT, KW_STRING, 
   KW_SUM, KW_TABLES, KW_TINYINT, KW_TRUE, KW_UNION, KW_USE, KW_USING, KW_WHEN, KW_WHERE, 
   KW_THEN, KW_TIMESTAMP, KW_INSERT, KW_INTO, KW_OVERWRITE, KW_TABLE, KW_PARTITION, 
-  KW_INTERVAL;
+  KW_INTERVAL, KW_TABLESAMPLE, KW_PERCENT, KW_REPEATABLE;
 terminal COMMA, DOT, STAR, LPAREN, RPAREN, DIVIDE, MOD, ADD, SUBTRACT;
 terminal BITAND, BITOR, BITXOR, BITNOT;
 terminal EQUAL, NOT, LESSTHAN, GREATERTHAN;
@@ -208,6 +208,8 @@ nonterminal SlotRef column_ref;
 nonterminal ArrayList<TableRef> from_clause, table_ref_list;
 nonterminal TableRef table_ref;
 nonterminal BaseTableRef base_table_ref;
+nonterminal TableSampleClause opt_tablesample;
+nonterminal Long opt_repeatable;
 nonterminal InlineViewRef inline_view_ref;
 nonterminal JoinOperator join_operator;
 nonterminal opt_inner, opt_outer;
@@ -569,10 +571,25 @@ inline_view_ref ::=
   ;
   
 base_table_ref ::=
-  table_name:name IDENT:alias
-  {: RESULT = new BaseTableRef(name, alias); :}
-  | table_name:name
-  {: RESULT = new BaseTableRef(name, null); :}
+  table_name:name IDENT:alias opt_tablesample:sample
+  {: RESULT = new BaseTableRef(name, alias, sample); :}
+  | table_name:name opt_tablesample:sample
+  {: RESULT = new BaseTableRef(name, null, sample); :}
+  ;
+
+opt_tablesample ::=
+  KW_TABLESAMPLE LPAREN INTEGER_LITERAL:percent KW_PERCENT RPAREN
+  opt_repeatable:seed
+  {: RESULT = new TableSampleClause(percent.longValue(), seed); :}
+  | /* empty */
+  {: RESULT = null; :}
+  ;
+
+opt_repeatable ::=
+  KW_REPEATABLE LPAREN INTEGER_LITERAL:seed RPAREN
+  {: RESULT = seed; :}
+  | /* empty */
+  {: RESULT = null; :}
   ;
 
 join_operator ::=
@@ -912,6 +929,8 @@ aggregate_operator ::=
   {: RESULT = AggregateExpr.Operator.DISTINCT_PC; :}
   | KW_DISTINCTPCSA
   {: RESULT = AggregateExpr.Operator.DISTINCT_PCSA; :}
+  | KW_DISTINCTHLL
+  {: RESULT = AggregateExpr.Operator.DISTINCT_HLL; :}
   | KW_SUM
   {: RESULT = AggregateExpr.Operator.SUM; :}
   | KW_AVG
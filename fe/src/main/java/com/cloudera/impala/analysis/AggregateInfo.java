@@ -51,6 +51,11 @@ import com.google.common.collect.Lists;
  *     computation (grouping exprs are identical)
  *   - aggInfo.2ndPhaseDistinctAggInfo.mergeAggInfo: contains the merging aggregate
  *     functions for the phase 2 computation (grouping exprs are identical)
+ * - for DISTINCT aggregate functions with different parameters (single-phase distinct
+ *   aggregation, see createSinglePhaseDistinctAggInfo()):
+ *   - aggInfo: contains the original aggregation functions and grouping exprs
+ *   - there is no mergeAggInfo: the aggregation can't be split into a pre-aggregation
+ *     and a merge step
  *
  * In general, merging aggregate computations are idempotent; in other words,
  * aggInfo.mergeAggInfo == aggInfo.mergeAggInfo.mergeAggInfo.
@@ -84,6 +89,10 @@ public class AggregateInfo {
   // if true, this AggregateInfo is the first phase of a 2-phase DISTINCT computation
   private boolean isDistinctAgg = false;
 
+  // if true, this AggregateInfo computes its DISTINCT aggregate functions directly,
+  // from sets of distinct values per group
+  private boolean isSinglePhaseDistinctAgg = false;
+
   // C'tor creates copies of groupingExprs and aggExprs.
   // Does *not* set aggTupleDesc, aggTupleSMap, mergeAggInfo, secondPhaseDistinctAggInfo.
   private AggregateInfo(
@@ -140,7 +149,11 @@ public class AggregateInfo {
       // we don't allow you to pass in a descriptor for distinct aggregation
       // (we need two descriptors)
       Preconditions.checkState(tupleDesc == null);
-      result.createDistinctAggInfo(groupingExprs, distinctAggExprs, analyzer);
+      if (haveSameParams(distinctAggExprs)) {
+        result.createDistinctAggInfo(groupingExprs, distinctAggExprs, analyzer);
+      } else {
+        result.createSinglePhaseDistinctAggInfo(analyzer);
+      }
     }
     LOG.info("agg info:\n" + result.debugString());
     return result;
@@ -154,9 +167,9 @@ public class AggregateInfo {
    * - a complete secondPhaseDistinctAggInfo
    * - mergeAggInfo
    *
-   * At the moment, we require that all distinct aggregate
-   * functions be applied to the same set of exprs (ie, we can't do something
-   * like SELECT COUNT(DISTINCT id), COUNT(DISTINCT address)).
+   * This requires that all distinct aggregate functions be applied to the same set of
+   * exprs; SELECT COUNT(DISTINCT id), COUNT(DISTINCT address) is computed by
+   * createSinglePhaseDistinctAggInfo() instead.
    * Aggregation happens in two successive phases:
    * - the first phase aggregates by all grouping exprs plus all parameter exprs
    *   of DISTINCT aggregate functions
@@ -171,34 +184,13 @@ public class AggregateInfo {
    * - 2nd phase grouping exprs: a
    * - 2nd phase agg exprs: COUNT(*), MIN(<MIN(d) from 1st phase>),
    *     SUM(<COUNT(*) from 1st phase>)
-   *
-   * TODO: expand implementation to cover the general case; this will require
-   * a different execution strategy
    */
   private void createDistinctAggInfo(
       ArrayList<Expr> origGroupingExprs,
       ArrayList<AggregateExpr> distinctAggExprs, Analyzer analyzer)
       throws AnalysisException, InternalException {
     Preconditions.checkState(!distinctAggExprs.isEmpty());
-    // make sure that all DISTINCT params are the same;
-    // ignore top-level implicit casts in the comparison, we might have inserted
-    // those during analysis
-    ArrayList<Expr> expr0Children = Lists.newArrayList();
-    for (Expr expr: distinctAggExprs.get(0).getChildren()) {
-      expr0Children.add(expr.ignoreImplicitCast());
-    }
-    for (int i = 1; i < distinctAggExprs.size(); ++i) {
-      ArrayList<Expr> exprIChildren = Lists.newArrayList();
-      for (Expr expr: distinctAggExprs.get(i).getChildren()) {
-        exprIChildren.add(expr.ignoreImplicitCast());
-      }
-      if (!Expr.equalLists(expr0Children, exprIChildren)) {
-        throw new AnalysisException(
-            "all DISTINCT aggregate functions need to have the same set of "
-            + "parameters as " + distinctAggExprs.get(0).toSql()
-            + "; deviating function: " + distinctAggExprs.get(i).toSql());
-      }
-    }
+    Preconditions.checkState(haveSameParams(distinctAggExprs));
     isDistinctAgg = true;
 
     // add DISTINCT parameters to grouping exprs
@@ -212,6 +204,39 @@ public class AggregateInfo {
     createSecondPhaseDistinctAggInfo(origGroupingExprs, distinctAggExprs, analyzer);
   }
 
+  /**
+   * Create aggregate info for a select block whose DISTINCT aggregate functions have
+   * different parameters, eg, SELECT a, COUNT(DISTINCT b), COUNT(DISTINCT c) ...
+   * GROUP BY a. The aggregation node keeps a set of the distinct parameter values per
+   * group for each DISTINCT function and only aggregates values that are new to their
+   * group. Such an aggregation can't be pre-aggregated; in a distributed plan, its
+   * input is partitioned on the grouping exprs instead (see
+   * Planner.createAggregationFragment()).
+   * This creates aggTupleDesc, but no mergeAggInfo.
+   */
+  private void createSinglePhaseDistinctAggInfo(Analyzer analyzer) {
+    isSinglePhaseDistinctAgg = true;
+    aggTupleDesc = createAggTupleDesc(analyzer.getDescTbl());
+  }
+
+  /**
+   * Returns true if all 'distinctAggExprs' have the same parameters, ignoring top-level
+   * implicit casts (we might have inserted those during analysis).
+   */
+  private static boolean haveSameParams(ArrayList<AggregateExpr> distinctAggExprs) {
+    ArrayList<Expr> expr0Children = Lists.newArrayList();
+    for (Expr expr: distinctAggExprs.get(0).getChildren()) {
+      expr0Children.add(expr.ignoreImplicitCast());
+    }
+    for (int i = 1; i < distinctAggExprs.size(); ++i) {
+      ArrayList<Expr> exprIChildren = Lists.newArrayList();
+      for (Expr expr: distinctAggExprs.get(i).getChildren()) {
+        exprIChildren.add(expr.ignoreImplicitCast());
+      }
+      if (!Expr.equalLists(expr0Children, exprIChildren)) return false;
+    }
+    return true;
+  }
 
   public ArrayList<Expr> getGroupingExprs() {
     return groupingExprs;
@@ -249,6 +274,10 @@ public class AggregateInfo {
     return isDistinctAgg;
   }
 
+  public boolean isSinglePhaseDistinctAgg() {
+    return isSinglePhaseDistinctAgg;
+  }
+
   /**
    * Append ids of all slots that are being referenced in the process
    * of performing the aggregate computation described by this AggregateInfo.
@@ -335,6 +364,11 @@ public class AggregateInfo {
         aggExpr =
             new AggregateExpr(AggregateExpr.Operator.MERGE_PCSA, false, false,
                 aggExprParamList);
+      } else if (inputExpr.getOp() == AggregateExpr.Operator.DISTINCT_HLL) {
+        // Merge the local HyperLogLog states
+        aggExpr =
+            new AggregateExpr(AggregateExpr.Operator.MERGE_HLL, false, false,
+                aggExprParamList);
       } else {
         aggExpr = new AggregateExpr(inputExpr.getOp(), false, false, aggExprParamList);
       }
@@ -528,7 +562,7 @@ public class AggregateInfo {
         .add("agg_tuple", (aggTupleDesc == null ? "null" : aggTupleDesc.debugString()))
         .add("smap", aggTupleSMap.debugString())
         .toString());
-    if (mergeAggInfo != this) {
+    if (mergeAggInfo != null && mergeAggInfo != this) {
       out.append("\nmergeAggInfo:\n" + mergeAggInfo.debugString());
     }
     if (secondPhaseDistinctAggInfo != null) {
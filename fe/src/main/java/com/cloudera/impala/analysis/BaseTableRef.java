@@ -16,6 +16,7 @@ package com.cloudera.impala.analysis;
 
 import java.util.List;
 
+import com.cloudera.impala.catalog.HdfsTable;
 import com.cloudera.impala.common.AnalysisException;
 import com.google.common.base.Preconditions;
 
@@ -26,11 +27,19 @@ import com.google.common.base.Preconditions;
 public class BaseTableRef extends TableRef {
   private TableName name;
 
+  // TABLESAMPLE clause; null if the whole table is scanned
+  private final TableSampleClause sampleClause;
+
   public BaseTableRef(TableName name, String alias) {
+    this(name, alias, null);
+  }
+
+  public BaseTableRef(TableName name, String alias, TableSampleClause sampleClause) {
     super(alias);
     Preconditions.checkArgument(!name.toString().isEmpty());
     Preconditions.checkArgument(alias == null || !alias.isEmpty());
     this.name = name;
+    this.sampleClause = sampleClause;
   }
 
 
@@ -43,12 +52,23 @@ public class BaseTableRef extends TableRef {
     return name;
   }
 
+  public TableSampleClause getSampleClause() {
+    return sampleClause;
+  }
+
   /**
    * Register this table ref and then analyze the Join clause.
    */
   @Override
   public void analyze(Analyzer analyzer) throws AnalysisException {
     desc = analyzer.registerBaseTableRef(this);
+    if (sampleClause != null) {
+      if (!(desc.getTable() instanceof HdfsTable)) {
+        throw new AnalysisException(
+            "TABLESAMPLE is only supported for HDFS tables: " + name);
+      }
+      sampleClause.analyze(analyzer);
+    }
     analyzeJoin(analyzer);
     isAnalyzed = true;
   }
@@ -84,6 +104,7 @@ public class BaseTableRef extends TableRef {
 
   @Override
   protected String tableRefToSql() {
-    return name.toString() + (alias != null ? " " + alias : "");
+    return name.toString() + (alias != null ? " " + alias : "")
+        + (sampleClause != null ? " " + sampleClause.toSql() : "");
   }
 }
@@ -19,6 +19,7 @@ import java.util.Collection;
 import java.util.HashMap;
 import java.util.HashSet;
 import java.util.List;
+import java.util.Set;
 
 import com.cloudera.impala.catalog.Table;
 import com.cloudera.impala.thrift.TDescriptorTable;
@@ -73,11 +74,12 @@ public class DescriptorTable {
     referencedTables.add(table);
   }
 
-  // Computes physical layout parameters of all descriptors.
+  // Computes physical layout parameters of all descriptors.  The slots in
+  // 'hotSlotIds' are laid out first (see TupleDescriptor.computeMemLayout()).
   // Call this only after the last descriptor was added.
-  public void computeMemLayout() {
+  public void computeMemLayout(Set<SlotId> hotSlotIds) {
     for (TupleDescriptor d: tupleDescs.values()) {
-      d.computeMemLayout();
+      d.computeMemLayout(hotSlotIds);
     }
   }
 
@@ -33,6 +33,10 @@ public class InPredicate extends Predicate {
     this.isNotIn = isNotIn;
   }
 
+  public boolean isNotIn() {
+    return isNotIn;
+  }
+
   @Override
   public void analyze(Analyzer analyzer) throws AnalysisException {
     super.analyze(analyzer);
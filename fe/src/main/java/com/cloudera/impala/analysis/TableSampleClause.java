@@ -0,0 +1,53 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.cloudera.impala.analysis;
+
+import com.cloudera.impala.common.AnalysisException;
+
+/**
+ * TABLESAMPLE(<percent> PERCENT) [REPEATABLE(<seed>)] clause of a table ref: the scan
+ * only reads a pseudo-random subset of about <percent>% of the table's blocks.  The
+ * same seed selects the same blocks as long as the table's files don't change;
+ * without REPEATABLE, each query picks its own seed.
+ */
+public class TableSampleClause {
+  private final long percent;
+  private final Long seed;  // null if there is no REPEATABLE clause
+
+  public TableSampleClause(long percent, Long seed) {
+    this.percent = percent;
+    this.seed = seed;
+  }
+
+  public long getPercent() {
+    return percent;
+  }
+
+  public Long getSeed() {
+    return seed;
+  }
+
+  public void analyze(Analyzer analyzer) throws AnalysisException {
+    if (percent < 0 || percent > 100) {
+      throw new AnalysisException(
+          "TABLESAMPLE percentage must be between 0 and 100: " + percent);
+    }
+  }
+
+  public String toSql() {
+    return "TABLESAMPLE(" + percent + " PERCENT)"
+        + (seed != null ? " REPEATABLE(" + seed + ")" : "");
+  }
+}
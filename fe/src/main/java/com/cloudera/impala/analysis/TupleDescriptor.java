@@ -16,6 +16,7 @@ package com.cloudera.impala.analysis;
 
 import java.util.ArrayList;
 import java.util.List;
+import java.util.Set;
 
 import com.cloudera.impala.catalog.PrimitiveType;
 import com.cloudera.impala.catalog.Table;
@@ -97,7 +98,15 @@ public class TupleDescriptor {
     return ttupleDesc;
   }
 
-  protected void computeMemLayout() {
+  /**
+   * Assigns offsets and null indicator bits to the materialized slots.  Slots are laid
+   * out in order of ascending size, which only needs padding between slots of
+   * different sizes, and the null indicators are packed as bits at the start of the
+   * tuple.  Within each size, the slots in 'hotSlotIds' (those that exprs are
+   * evaluated over, e.g. join keys and predicate columns) come first, so that they
+   * share cache lines.
+   */
+  protected void computeMemLayout(Set<SlotId> hotSlotIds) {
     // sort slots by size
     List<List<SlotDescriptor>> slotsBySize =
         Lists.newArrayListWithCapacity(PrimitiveType.getMaxSlotSize());
@@ -106,7 +115,14 @@ public class TupleDescriptor {
     }
 
     int numNullableSlots = 0;
+    List<SlotDescriptor> orderedSlots = Lists.newArrayList();
     for (SlotDescriptor d: slots) {
+      if (hotSlotIds.contains(d.getId())) orderedSlots.add(d);
+    }
+    for (SlotDescriptor d: slots) {
+      if (!hotSlotIds.contains(d.getId())) orderedSlots.add(d);
+    }
+    for (SlotDescriptor d: orderedSlots) {
       if (d.getIsMaterialized()) {
         slotsBySize.get(d.getType().getSlotSize()).add(d);
         if (d.getIsNullable()) {
@@ -44,7 +44,7 @@ public class Catalog {
   private static final Logger LOG = Logger.getLogger(Catalog.class);
   private static final int MAX_METASTORE_CLIENT_INIT_RETRIES = 5;
   private static final int MAX_METASTORE_RETRY_INTERVAL_IN_SECONDS = 5;
-  private boolean closed = false;
+  private volatile boolean closed = false;
   private int nextTableId;
 
   // map from db name to DB
@@ -123,11 +123,53 @@ public class Catalog {
     }
   }
 
+  public boolean isClosed() {
+    return closed;
+  }
+
+  /**
+   * Loads the tables that are not loaded yet, for a lazily loaded catalog to warm up
+   * in the background while queries are served.  The tables in priorityTables, as
+   * "db.table", are loaded first, then all others, db by db.  Stops when the catalog
+   * is closed (e.g. by a reset).  Since HiveMetaStoreClient is not thread safe, this
+   * uses a client of its own.
+   */
+  public void warm(List<String> priorityTables) {
+    HiveMetaStoreClient warmupClient;
+    try {
+      warmupClient = createHiveMetaStoreClient(new HiveConf(Catalog.class));
+    } catch (MetaException e) {
+      LOG.warn("Could not create a metastore client to warm the catalog", e);
+      return;
+    }
+    try {
+      long startMs = System.currentTimeMillis();
+      for (String tableName: priorityTables) {
+        String[] parts = tableName.toLowerCase().split("\\.", 2);
+        Db db = parts.length == 2 ? dbs.get(parts[0]) : null;
+        if (db == null) {
+          LOG.warn("Not warming unknown table " + tableName);
+          continue;
+        }
+        if (closed) return;
+        db.warmTable(parts[1], warmupClient);
+      }
+      for (Db db: dbs.values()) {
+        if (closed) return;
+        db.warmAllTables(warmupClient);
+      }
+      LOG.info("Warmed the catalog in " + (System.currentTimeMillis() - startMs) +
+          "ms");
+    } finally {
+      warmupClient.close();
+    }
+  }
+
   public Collection<Db> getDbs() {
     return dbs.values();
   }
 
-  public TableId getNextTableId() {
+  public synchronized TableId getNextTableId() {
     return new TableId(nextTableId++);
   }
 
@@ -29,7 +29,7 @@ import com.google.common.collect.Lists;
 
 /**
  * Internal representation of db-related metadata. Owned by Catalog instance.
- * Not thread safe.
+ * Not thread safe, except for loading tables lazily (see LazyTableMap).
  */
 public class Db {
   private static final Logger LOG = Logger.getLogger(Db.class);
@@ -45,9 +45,9 @@ public class Db {
   // If true, table map values are populated lazily on read.
   final boolean lazy;
 
-  private Table loadTable(String tableName) {
+  private Table loadTable(String tableName, HiveMetaStoreClient msClient) {
     try {
-      return Table.load(parentCatalog.getNextTableId(), client, this, tableName);
+      return Table.load(parentCatalog.getNextTableId(), msClient, this, tableName);
     } catch (UnsupportedOperationException ex) {
       LOG.warn(ex);
     }
@@ -62,12 +62,34 @@ public class Db {
   private void forceLoadAllTables() {
     // Need to copy the keyset to avoid concurrent modification exceptions
     // if we try to remove a table in error
-    Set<String> keys = Sets.newHashSet(tables.keySet());
+    Set<String> keys;
+    synchronized (tables) {
+      keys = Sets.newHashSet(tables.keySet());
+    }
     for (String s: keys) {
       tables.get(s);
     }
   }
 
+  /**
+   * Loads the table 'tableName', if it exists and is not loaded yet, with msClient.
+   * Used to warm the catalog in the background (see Catalog.warm()).
+   */
+  void warmTable(String tableName, HiveMetaStoreClient msClient) {
+    ((LazyTableMap) tables).getOrLoad(tableName, msClient);
+  }
+
+  /**
+   * Loads all tables that are not loaded yet with msClient, stopping early if
+   * the catalog is closed.
+   */
+  void warmAllTables(HiveMetaStoreClient msClient) {
+    for (String s: getAllTableNames()) {
+      if (parentCatalog.isClosed()) return;
+      warmTable(s, msClient);
+    }
+  }
+
   /**
    * Extends the usual HashMap to lazily load tables on read (through 'get').
    *
@@ -76,7 +98,11 @@ public class Db {
    * map is exposed outside of the catalog, make sure to call forceLoadAllTables to
    * make this behave exactly like a usual Map.
    *
-   * This class is not thread safe.
+   * Lookups, puts and removes are synchronized so that tables can be loaded in the
+   * background (see Catalog.warm()) while queries read them.  Tables are loaded
+   * without holding the lock, so a lookup doesn't wait for the loading of other
+   * tables; if two threads load the same table, the first one to finish wins.
+   * Other methods are not thread safe.
    */
   private class LazyTableMap extends HashMap<String, Table> {
     // Required because HashMap implements Serializable
@@ -91,24 +117,53 @@ public class Db {
      */
     @Override
     public Table get(Object key) {
-      if (!super.containsKey(key)) {
-        return null;
-      }
+      return getOrLoad((String)key, client);
+    }
 
-      Table ret = super.get(key);
-      if (ret != null) {
-        // Already loaded
-        return ret;
+    /**
+     * Same as get(), loading the table with msClient.
+     */
+    public Table getOrLoad(String key, HiveMetaStoreClient msClient) {
+      synchronized (this) {
+        if (!super.containsKey(key)) {
+          return null;
+        }
+
+        Table ret = super.get(key);
+        if (ret != null) {
+          // Already loaded
+          return ret;
+        }
       }
 
-      ret = loadTable((String)key);
-      if (ret == null) {
-        remove(key);
-      } else {
-        put((String)key, ret);
+      Table ret = loadTable(key, msClient);
+      synchronized (this) {
+        // The table may have been loaded or removed by another thread meanwhile.
+        if (!super.containsKey(key)) {
+          return null;
+        }
+        Table loaded = super.get(key);
+        if (loaded != null) {
+          return loaded;
+        }
+        if (ret == null) {
+          super.remove(key);
+        } else {
+          super.put(key, ret);
+        }
       }
       return ret;
     }
+
+    @Override
+    public synchronized Table put(String key, Table value) {
+      return super.put(key, value);
+    }
+
+    @Override
+    public synchronized Table remove(Object key) {
+      return super.remove(key);
+    }
   }
 
   private Db(String name, Catalog catalog, HiveMetaStoreClient hiveClient,
@@ -169,7 +224,9 @@ public class Db {
   }
 
   public List<String> getAllTableNames() {
-    return Lists.newArrayList(tables.keySet());
+    synchronized (tables) {
+      return Lists.newArrayList(tables.keySet());
+    }
   }
 
   /**
@@ -184,7 +241,11 @@ public class Db {
    */
   public void invalidateTable(String table) throws TableNotFoundException {
     if (tables.containsKey(table)) {
-      tables.put(table, null);
+      // put() returns the loaded table, if any, without loading it like get() would
+      Table loadedTable = tables.put(table, null);
+      if (loadedTable instanceof HdfsTable) {
+        ((HdfsTable) loadedTable).invalidateBlockMetadata();
+      }
     } else {
       throw new TableNotFoundException("Could not invalidate non-existent table: "
           + table);
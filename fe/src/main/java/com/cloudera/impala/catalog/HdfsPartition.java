@@ -38,21 +38,25 @@ public class HdfsPartition {
   static public class FileDescriptor {
     private final String filePath;
     private final long fileLength;
+    private final long modificationTime;
 
     public String getFilePath() { return filePath; }
     public long getFileLength() { return fileLength; }
+    public long getModificationTime() { return modificationTime; }
 
-    public FileDescriptor(String filePath, long fileLength) {
+    public FileDescriptor(String filePath, long fileLength, long modificationTime) {
       Preconditions.checkNotNull(filePath);
       Preconditions.checkArgument(fileLength >= 0);
       this.filePath = filePath;
       this.fileLength = fileLength;
+      this.modificationTime = modificationTime;
     }
 
     @Override
     public String toString() {
       return Objects.toStringHelper(this).add("Path", filePath)
-          .add("Length", fileLength).toString();
+          .add("Length", fileLength).add("ModificationTime", modificationTime)
+          .toString();
     }
   }
 
@@ -16,7 +16,7 @@ package com.cloudera.impala.catalog;
 
 import java.io.IOException;
 import java.util.ArrayList;
-import java.util.Arrays;
+import java.util.LinkedHashMap;
 import java.util.List;
 import java.util.Map;
 
@@ -69,12 +69,19 @@ public class HdfsTable extends Table {
   // Hive uses this string for NULL partition keys. Set in load().
   private String nullPartitionKeyValue;
 
+  // Columns that the table is bucketed on (CLUSTERED BY ... INTO numBuckets BUCKETS)
+  // and the number of buckets; numBuckets is 0 if the table isn't bucketed or its
+  // files don't have the bucket layout (see loadBuckets()). Set in load().
+  private final List<Column> bucketCols = Lists.newArrayList();
+  private int numBuckets = 0;
+
   /**
    * Captures three important pieces of information for a block: its location, the path
    * of the file to which it belongs, and the partition to which that file belongs.
    */
   public static class BlockMetadata {
     private String fileName;
+    private long fileModificationTime;
     private HdfsPartition parentPartition;
     private final BlockLocation blockLocation;
     // For each replica, this is the 0-based disk index for this block.  The BE uses
@@ -88,6 +95,7 @@ public class HdfsTable extends Table {
     }
 
     public String getFileName() { return fileName; }
+    public long getFileModificationTime() { return fileModificationTime; }
     public BlockLocation getLocation() { return blockLocation; }
     public HdfsPartition getPartition() { return parentPartition; }
 
@@ -95,6 +103,10 @@ public class HdfsTable extends Table {
       this.fileName = fileName;
     }
 
+    public void setFileModificationTime(long fileModificationTime) {
+      this.fileModificationTime = fileModificationTime;
+    }
+
     public void setPartition(HdfsPartition partition) {
       this.parentPartition = partition;
     }
@@ -149,6 +161,14 @@ public class HdfsTable extends Table {
     return col.getPosition() < getNumClusteringCols();
   }
 
+  public List<Column> getBucketCols() {
+    return bucketCols;
+  }
+
+  public int getNumBuckets() {
+    return numBuckets;
+  }
+
   /**
    * Create columns corresponding to fieldSchemas.
    * @param fieldSchemas
@@ -241,7 +261,7 @@ public class HdfsTable extends Table {
     if (fs.exists(path)) {
       for (FileStatus fileStatus: fs.listStatus(path)) {
         FileDescriptor fd = new FileDescriptor(fileStatus.getPath().toString(),
-            fileStatus.getLen());
+            fileStatus.getLen(), fileStatus.getModificationTime());
         fileDescriptors.add(fd);
       }
 
@@ -253,6 +273,34 @@ public class HdfsTable extends Table {
     }
   }
 
+  /**
+   * Sets bucketCols and numBuckets from the table's storage descriptor.  Hive writes
+   * one file per bucket, so that the i-th file of a partition in name order holds
+   * bucket i; the table is only treated as bucketed if each of its non-empty
+   * partitions has exactly that many files.
+   */
+  private void loadBuckets(StorageDescriptor storageDescriptor) {
+    bucketCols.clear();
+    numBuckets = 0;
+    if (storageDescriptor.getNumBuckets() <= 0
+        || storageDescriptor.getBucketColsSize() == 0) {
+      return;
+    }
+    for (HdfsPartition partition: partitions) {
+      int numFiles = partition.getFileDescriptors().size();
+      if (numFiles != 0 && numFiles != storageDescriptor.getNumBuckets()) return;
+    }
+    for (String colName: storageDescriptor.getBucketCols()) {
+      Column col = getColumn(colName);
+      if (col == null) {
+        bucketCols.clear();
+        return;
+      }
+      bucketCols.add(col);
+    }
+    numBuckets = storageDescriptor.getNumBuckets();
+  }
+
   private void addDefaultPartition(StorageDescriptor storageDescriptor)
       throws InvalidStorageDescriptorException {
     // Default partition has no files and is not referred to by scan nodes. Data sinks
@@ -288,6 +336,7 @@ public class HdfsTable extends Table {
       numClusteringCols = partKeys.size();
       try {
         loadPartitions(client.listPartitions(db.getName(), name, Short.MAX_VALUE), msTbl);
+        loadBuckets(msTbl.getSd());
       } catch (Exception ex) {
         // TODO: Do we want this behaviour for all possible exceptions?
         LOG.warn("Ignoring HDFS table '" + msTbl.getTableName() +
@@ -338,25 +387,70 @@ public class HdfsTable extends Table {
   }
 
   /**
-   * Return locations for all blocks in all files in the given partitions.
-   * @return list of HdfsTable.BlockMetadata objects.
+   * Block locations and per-replica disk ids of a file, as of the length and
+   * modification time it had when they were looked up.
    */
-  public static List<BlockMetadata> getBlockMetadata(List<HdfsPartition> partitions) {
-    List<BlockMetadata> result = Lists.newArrayList();
+  private static class FileBlocks {
+    private final long fileLength;
+    private final long modificationTime;
+    // empty for directories
+    private final BlockLocation[] locations;
+    // For each block, the 0-based disk index of each of its replicas, or null if not
+    // known (see BlockMetadata.getVolumeId()). Null until looked up.
+    private int[][] diskIds;
+
+    public FileBlocks(FileDescriptor fd, BlockLocation[] locations) {
+      this.fileLength = fd.getFileLength();
+      this.modificationTime = fd.getModificationTime();
+      this.locations = locations;
+    }
 
-    // Block locations for all the files in all the partitions.
-    List<BlockLocation> blocks = Lists.newArrayList();
+    public boolean isCurrent(FileDescriptor fd) {
+      return fileLength == fd.getFileLength()
+          && modificationTime == fd.getModificationTime();
+    }
+  }
+
+  // Maximum number of files whose blocks are kept in blockCache.
+  private static final int MAX_CACHED_FILES = 100000;
+
+  // Process-wide cache of the blocks of the files of all tables, keyed by path, in
+  // least recently used order. An entry is used as long as its file has the length
+  // and modification time of the table's FileDescriptor, i.e., until the file changes
+  // and the table is reloaded; invalidateBlockMetadata() drops a table's entries.
+  // This saves a getFileStatus() and a getFileBlockLocations() NameNode rpc per file
+  // and query, and the DataNode rpcs of getFileBlockStorageLocations().
+  // Guarded by its own lock.
+  private static final Map<String, FileBlocks> blockCache =
+      new LinkedHashMap<String, FileBlocks>(16, 0.75f, true) {
+        @Override
+        protected boolean removeEldestEntry(Map.Entry<String, FileBlocks> eldest) {
+          return size() > MAX_CACHED_FILES;
+        }
+      };
 
-    // List of ending index in blocks per file. The file index to this list is obtained
-    // traversing the file list in each partitions sequentially. For file i, its block
-    // locations are from blocks[endingBlockIndexes[i-1]] to blocks[endingBlockIndexes[i]]
-    List<Integer> endingBlockIndexes = Lists.newArrayList();
+  // For each host, the 0-based index of each of its VolumeIds. This is process-wide,
+  // so that the disk ids of cached blocks stay consistent with new ones.
+  // Guarded by blockCache's lock.
+  private static final Map<String, Map<VolumeId, Integer>> hostDiskIds =
+      Maps.newHashMap();
 
-    boolean supportsVolumeId =
-        CONF.getBoolean(DFSConfigKeys.DFS_HDFS_BLOCKS_METADATA_ENABLED, false);
+  /**
+   * Drops the cached blocks of this table's files, so that the next query looks them
+   * up again.
+   */
+  public void invalidateBlockMetadata() {
+    synchronized (blockCache) {
+      for (HdfsPartition partition: partitions) {
+        for (FileDescriptor fileDescriptor: partition.getFileDescriptors()) {
+          blockCache.remove(fileDescriptor.getFilePath());
+        }
+      }
+    }
+  }
 
+  private static DistributedFileSystem getDistributedFileSystem() {
     // TODO: Is DistributedFileSystem thread safe? If so, make it a static final object.
-    DistributedFileSystem dfs;
     try {
       FileSystem fs;
       fs = FileSystem.get(CONF);
@@ -365,117 +459,170 @@ public class HdfsTable extends Table {
             CommonConfigurationKeysPublic.FS_DEFAULT_NAME_KEY +
             "(" + CONF.get(CommonConfigurationKeysPublic.FS_DEFAULT_NAME_KEY) + ")" +
             " might be set incorrectly";
-        throw new RuntimeException(error);      }
-      dfs = (DistributedFileSystem)fs;
+        throw new RuntimeException(error);
+      }
+      return (DistributedFileSystem)fs;
     } catch (IOException e) {
       throw new RuntimeException("couldn't retrieve FileSystem:\n" + e.getMessage(), e);
     }
+  }
 
-    for (HdfsPartition partition: partitions) {
-      for (FileDescriptor fileDescriptor: partition.getFileDescriptors()) {
-        Path p = new Path(fileDescriptor.getFilePath());
-        BlockLocation[] locations = null;
-        try {
-          FileStatus fileStatus = dfs.getFileStatus(p);
-          // Ignore directories (and files in them) - if a directory is erroneously
-          // created as a subdirectory of a partition dir we should ignore it and move on
-          // (getFileBlockLocations will throw when
-          // called on a directory). Hive will not recurse into directories.
-          if (!fileStatus.isDirectory()) {
-            locations = dfs.getFileBlockLocations(fileStatus, 0, fileStatus.getLen());
-            blocks.addAll(Arrays.asList(locations));
-          }
-          endingBlockIndexes.add(blocks.size());
-        } catch (IOException e) {
-          throw new RuntimeException("couldn't determine block locations for path '"
-              + fileDescriptor.getFilePath() + "':\n" + e.getMessage(), e);
-        }
+  /**
+   * Returns the blocks of the file of 'fileDescriptor', from blockCache if it has them.
+   */
+  private static FileBlocks getFileBlocks(DistributedFileSystem dfs,
+      FileDescriptor fileDescriptor) {
+    String filePath = fileDescriptor.getFilePath();
+    synchronized (blockCache) {
+      FileBlocks fileBlocks = blockCache.get(filePath);
+      if (fileBlocks != null && fileBlocks.isCurrent(fileDescriptor)) return fileBlocks;
+    }
+    FileBlocks fileBlocks;
+    try {
+      FileStatus fileStatus = dfs.getFileStatus(new Path(filePath));
+      // Ignore directories (and files in them) - if a directory is erroneously
+      // created as a subdirectory of a partition dir we should ignore it and move on
+      // (getFileBlockLocations will throw when
+      // called on a directory). Hive will not recurse into directories.
+      BlockLocation[] locations = new BlockLocation[0];
+      if (!fileStatus.isDirectory()) {
+        locations = dfs.getFileBlockLocations(fileStatus, 0, fileStatus.getLen());
       }
+      fileBlocks = new FileBlocks(fileDescriptor, locations);
+    } catch (IOException e) {
+      throw new RuntimeException("couldn't determine block locations for path '"
+          + filePath + "':\n" + e.getMessage(), e);
     }
+    synchronized (blockCache) {
+      blockCache.put(filePath, fileBlocks);
+    }
+    return fileBlocks;
+  }
 
-    if (supportsVolumeId) {
-      try {
-        // Get the BlockStorageLocations for all the blocks
-        BlockStorageLocation[] locations = dfs.getFileBlockStorageLocations(blocks);
-
-        // Convert block locations to 0 based ids.  The block location ids returned
-        // from HDFS are unique but opaque (only defining comparison operators).  We need
-        // to turn them indices.  
-        // TODO: the diskId should be eventually retrievable from Hdfs when 
-        // the community agrees this API is useful.
-        
-        // For each host, this is a mapping of the VolumeId object to a 0 based index.
-        Map<String, Map<VolumeId, Integer>> hostDiskIds = Maps.newHashMap();
-
-        for (int i = 0; i < locations.length; ++i) {
-          String[] hosts = locations[i].getHosts();
-          VolumeId[] volumeIds = locations[i].getVolumeIds();
-          Preconditions.checkState(hosts.length == volumeIds.length);
-
-          // For each block replica, the disk id for the block on that host
-          int[] diskIds = new int[volumeIds.length];
-
-          boolean found_null = false;
-          for (int j = 0; j < volumeIds.length; ++j) {
-            if (volumeIds[j] == null) {
-              found_null = true;
-              break;
-            }
-
-            Map<VolumeId, Integer> hostDisks;
-            if (!hostDiskIds.containsKey(hosts[j])) {
-              hostDisks = Maps.newHashMap();
-              hostDiskIds.put(hosts[j], hostDisks);
-            } else {
-              hostDisks = hostDiskIds.get(hosts[j]);
-            }
-
-            if (!volumeIds[j].isValid()) {
-              // The data node with this block did not respond to the block location 
-              // rpc.  Mark it as -1 for the BE which will assign it a random disk.
-              diskIds[j] = -1;
-            } else if (hostDisks.containsKey(volumeIds[j])) {
-              // This is a VolumeId we've seen on this host, assign it the id we already
-              // assigned to this VolumeId
-              diskIds[j] = hostDisks.get(volumeIds[j]);
-            } else {
-              // This is a VolumeId we haven't seen.  Give it the next index.
-              int index = hostDisks.size();
-              hostDisks.put(volumeIds[j], index);
-              diskIds[j] = index;
-            }
-          }
-          if (found_null) break;
-          result.add(new BlockMetadata(locations[i], diskIds));
+  /**
+   * Looks up the disk ids of the blocks of 'files'.
+   */
+  private static void getDiskIds(DistributedFileSystem dfs, List<FileBlocks> files) {
+    List<BlockLocation> blocks = Lists.newArrayList();
+    for (FileBlocks fileBlocks: files) {
+      for (BlockLocation location: fileBlocks.locations) blocks.add(location);
+    }
+    BlockStorageLocation[] locations;
+    try {
+      // Get the BlockStorageLocations for all the blocks
+      locations = dfs.getFileBlockStorageLocations(blocks);
+    } catch (IOException e) {
+      throw new RuntimeException("couldn't determine block storage locations:\n"
+          + e.getMessage(), e);
+    }
+    Preconditions.checkState(locations.length == blocks.size());
+
+    // Convert block locations to 0 based ids.  The block location ids returned
+    // from HDFS are unique but opaque (only defining comparison operators).  We need
+    // to turn them indices.
+    // TODO: the diskId should be eventually retrievable from Hdfs when
+    // the community agrees this API is useful.
+    int blockIdx = 0;
+    boolean foundNull = false;
+    synchronized (blockCache) {
+      for (FileBlocks fileBlocks: files) {
+        int[][] fileDiskIds = new int[fileBlocks.locations.length][];
+        for (int i = 0; i < fileDiskIds.length; ++i) {
+          fileDiskIds[i] = getDiskIds(locations[blockIdx++]);
+          if (fileDiskIds[i] == null) foundNull = true;
         }
-      } catch (IOException e) {
-        throw new RuntimeException("couldn't determine block storage locations:\n"
-            + e.getMessage(), e);
+        fileBlocks.diskIds = fileDiskIds;
+      }
+    }
+    if (foundNull) {
+      LOG.warn("Attempted to get block locations but the call returned nulls");
+    }
+  }
+
+  /**
+   * Returns the disk id of each replica of 'location', or null if one is missing.
+   * Must be called with blockCache's lock held.
+   */
+  private static int[] getDiskIds(BlockStorageLocation location) {
+    String[] hosts = location.getHosts();
+    VolumeId[] volumeIds = location.getVolumeIds();
+    Preconditions.checkState(hosts.length == volumeIds.length);
+
+    // For each block replica, the disk id for the block on that host
+    int[] diskIds = new int[volumeIds.length];
+    for (int j = 0; j < volumeIds.length; ++j) {
+      if (volumeIds[j] == null) return null;
+
+      Map<VolumeId, Integer> hostDisks = hostDiskIds.get(hosts[j]);
+      if (hostDisks == null) {
+        hostDisks = Maps.newHashMap();
+        hostDiskIds.put(hosts[j], hostDisks);
       }
-    } 
 
-    if (result.size() == 0) {
-      if (supportsVolumeId) {
-        LOG.warn("Attempted to get block locations but the call returned nulls");
+      if (!volumeIds[j].isValid()) {
+        // The data node with this block did not respond to the block location
+        // rpc.  Mark it as -1 for the BE which will assign it a random disk.
+        diskIds[j] = -1;
+      } else if (hostDisks.containsKey(volumeIds[j])) {
+        // This is a VolumeId we've seen on this host, assign it the id we already
+        // assigned to this VolumeId
+        diskIds[j] = hostDisks.get(volumeIds[j]);
+      } else {
+        // This is a VolumeId we haven't seen.  Give it the next index.
+        int index = hostDisks.size();
+        hostDisks.put(volumeIds[j], index);
+        diskIds[j] = index;
       }
-      // No disk locations.
-      for (int i = 0; i < blocks.size(); ++i) {
-        result.add(new BlockMetadata(blocks.get(i), null));
+    }
+    return diskIds;
+  }
+
+  /**
+   * Return locations for all blocks in all files in the given partitions.
+   * The blocks of files that haven't changed since a previous call come from
+   * blockCache.
+   * @return list of HdfsTable.BlockMetadata objects.
+   */
+  public static List<BlockMetadata> getBlockMetadata(List<HdfsPartition> partitions) {
+    boolean supportsVolumeId =
+        CONF.getBoolean(DFSConfigKeys.DFS_HDFS_BLOCKS_METADATA_ENABLED, false);
+    DistributedFileSystem dfs = getDistributedFileSystem();
+
+    // The blocks of each file, in partition and file order, and the files among them
+    // whose disk ids still need to be looked up.
+    List<FileBlocks> files = Lists.newArrayList();
+    List<FileBlocks> filesWithoutDiskIds = Lists.newArrayList();
+    for (HdfsPartition partition: partitions) {
+      for (FileDescriptor fileDescriptor: partition.getFileDescriptors()) {
+        FileBlocks fileBlocks = getFileBlocks(dfs, fileDescriptor);
+        files.add(fileBlocks);
+        synchronized (blockCache) {
+          if (supportsVolumeId && fileBlocks.diskIds == null) {
+            filesWithoutDiskIds.add(fileBlocks);
+          }
+        }
       }
     }
+    if (!filesWithoutDiskIds.isEmpty()) getDiskIds(dfs, filesWithoutDiskIds);
 
     // Construct block metadata to also include file names and partition information
-    int firstBlockIndex = 0;
-    int fileIndex = 0;
+    List<BlockMetadata> result = Lists.newArrayList();
+    int fileIdx = 0;
     for (HdfsPartition partition: partitions) {
       for (FileDescriptor fileDescriptor: partition.getFileDescriptors()) {
-        int lastBlockIndex = endingBlockIndexes.get(fileIndex);
-        for (int i = firstBlockIndex; i < lastBlockIndex; ++i) {
-          result.get(i).setFileName(fileDescriptor.getFilePath());
-          result.get(i).setPartition(partition);
+        FileBlocks fileBlocks = files.get(fileIdx++);
+        int[][] diskIds;
+        synchronized (blockCache) {
+          diskIds = supportsVolumeId ? fileBlocks.diskIds : null;
+        }
+        for (int i = 0; i < fileBlocks.locations.length; ++i) {
+          BlockMetadata block = new BlockMetadata(fileBlocks.locations[i],
+              diskIds != null ? diskIds[i] : null);
+          block.setFileName(fileDescriptor.getFilePath());
+          block.setFileModificationTime(fileDescriptor.getModificationTime());
+          block.setPartition(partition);
+          result.add(block);
         }
-        ++fileIndex;
-        firstBlockIndex = lastBlockIndex;
       }
     }
     return result;
@@ -15,10 +15,12 @@
 package com.cloudera.impala.planner;
 
 import java.util.List;
+import java.util.Map;
 
 import com.cloudera.impala.analysis.AggregateExpr;
 import com.cloudera.impala.analysis.AggregateInfo;
 import com.cloudera.impala.analysis.Expr;
+import com.cloudera.impala.analysis.SlotDescriptor;
 import com.cloudera.impala.analysis.SlotId;
 import com.cloudera.impala.thrift.TAggregationNode;
 import com.cloudera.impala.thrift.TPlanNode;
@@ -37,6 +39,13 @@ public class AggregationNode extends PlanNode {
   // finalization after all rows have been aggregated.
   private boolean needsFinalize;
 
+  // Set to true if the output of this node is merged by an aggregation node in another
+  // fragment.
+  private boolean isPreAggregation;
+
+  // Set to true if the input is sorted on the grouping exprs.
+  private boolean inputIsSorted;
+
   /**
    * Create an agg node that is not an intermediate node.
    * isIntermediate is true if it is a slave node in a 2-part agg plan.
@@ -70,6 +79,24 @@ public class AggregationNode extends PlanNode {
     return aggInfo;
   }
 
+  /**
+   * Turns this into an intermediate agg node, ie, one that doesn't finalize its
+   * aggregate values because they are merged by a subsequent agg node (in another
+   * fragment).
+   */
+  public void unsetNeedsFinalize() {
+    needsFinalize = false;
+    isPreAggregation = true;
+  }
+
+  /**
+   * Marks the input as sorted on the grouping exprs, which lets the backend aggregate
+   * one group at a time instead of building a hash table.
+   */
+  public void setInputIsSorted(boolean inputIsSorted) {
+    this.inputIsSorted = inputIsSorted;
+  }
+
   @Override
   public void setCompactData(boolean on) {
     this.compactData = on;
@@ -89,10 +116,42 @@ public class AggregationNode extends PlanNode {
     msg.agg_node = new TAggregationNode(
         Expr.treesToThrift(aggInfo.getAggregateExprs()),
         aggInfo.getAggTupleId().asInt(), needsFinalize);
+    msg.agg_node.setIs_preaggregation(isPreAggregation);
+    msg.agg_node.setInput_is_sorted(inputIsSorted);
     List<Expr> groupingExprs = aggInfo.getGroupingExprs();
     if (groupingExprs != null) {
       msg.agg_node.setGrouping_exprs(Expr.treesToThrift(groupingExprs));
     }
+    // The groups of a pre-aggregation over a scan can be cached per partition: its
+    // output is merged by another aggregation, which can as well merge groups that
+    // were computed by an earlier query.
+    if (isPreAggregation && groupingExprs != null && !groupingExprs.isEmpty()
+        && conjuncts.isEmpty() && getChild(0) instanceof HdfsScanNode
+        && getChild(0).getLimit() == -1) {
+      String aggKey = getCacheKey();
+      HdfsScanNode scan = (HdfsScanNode) getChild(0);
+      for (Map.Entry<Long, String> entry: scan.getPartitionCacheKeys().entrySet()) {
+        msg.agg_node.putToPartition_cache_keys(
+            entry.getKey(), entry.getValue() + " agg=" + aggKey);
+      }
+    }
+  }
+
+  /**
+   * Returns a fingerprint of the grouping and aggregate exprs and of the layout of the
+   * aggregation tuple, to identify the groups of this node in the cache keys.
+   */
+  private String getCacheKey() {
+    StringBuilder key = new StringBuilder();
+    key.append("group=" + getExplainString(aggInfo.getGroupingExprs()))
+        .append(" output=" + getExplainString(aggInfo.getAggregateExprs()))
+        .append(" size=" + aggInfo.getAggTupleDesc().getByteSize());
+    for (SlotDescriptor slot: aggInfo.getAggTupleDesc().getSlots()) {
+      key.append(" slot=" + slot.getType() + ":" + slot.getIsMaterialized() + ":"
+          + slot.getByteOffset() + ":" + slot.getNullIndicatorByte() + ":"
+          + slot.getNullIndicatorBit());
+    }
+    return key.toString();
   }
 
   @Override
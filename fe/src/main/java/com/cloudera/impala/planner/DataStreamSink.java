@@ -26,6 +26,7 @@ import com.cloudera.impala.thrift.TExplainLevel;
 public class DataStreamSink extends DataSink {
   private final PlanNodeId exchNodeId;
   private DataPartition outputPartition;
+  private boolean spreadNullKeys = false;
 
   public DataStreamSink(PlanNodeId exchNodeId) {
     this.exchNodeId = exchNodeId;
@@ -35,6 +36,10 @@ public class DataStreamSink extends DataSink {
     outputPartition = partition;
   }
 
+  public void setSpreadNullKeys(boolean spreadNullKeys) {
+    this.spreadNullKeys = spreadNullKeys;
+  }
+
   @Override
   public String getExplainString(String prefix, TExplainLevel explainLevel) {
     StringBuilder strBuilder = new StringBuilder();
@@ -52,6 +57,7 @@ public class DataStreamSink extends DataSink {
     TDataSink result = new TDataSink(TDataSinkType.DATA_STREAM_SINK);
     TDataStreamSink tStreamSink =
         new TDataStreamSink(exchNodeId.asInt(), outputPartition.toThrift());
+    if (spreadNullKeys) tStreamSink.setSpread_null_keys(true);
     result.setStream_sink(tStreamSink);
     return result;
   }
@@ -14,9 +14,16 @@
 
 package com.cloudera.impala.planner;
 
+import java.util.Iterator;
+import java.util.List;
+
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
 
+import com.cloudera.impala.analysis.Expr;
+import com.cloudera.impala.analysis.SlotId;
+import com.cloudera.impala.analysis.SortInfo;
+import com.cloudera.impala.thrift.TExchangeNode;
 import com.cloudera.impala.thrift.TExplainLevel;
 import com.cloudera.impala.thrift.TPlanNode;
 import com.cloudera.impala.thrift.TPlanNodeType;
@@ -25,8 +32,9 @@ import com.google.common.collect.Lists;
 
 /**
  * Receiver side of a 1:n data stream.
- *
- * TODO: merging of sorted inputs.
+ * If a SortInfo is set, each sender's stream is sorted accordingly and the node
+ * merges them into a single sorted stream (a merging exchange); together with a
+ * limit, this is the final step of a distributed top-n.
  */
 public class ExchangeNode extends PlanNode {
   private final static Logger LOG = LoggerFactory.getLogger(ExchangeNode.class);
@@ -34,10 +42,23 @@ public class ExchangeNode extends PlanNode {
   // TODO: remove after transitioning to new planner
   private int numSenders;
 
+  // if set, the input streams are sorted on these exprs and get merged
+  private SortInfo mergeInfo;
+
   public void setNumSenders(int numSenders) {
     this.numSenders = numSenders;
   }
 
+  public void setMergeInfo(SortInfo info) {
+    this.mergeInfo = info;
+  }
+
+  @Override
+  public void getMaterializedIds(List<SlotId> ids) {
+    super.getMaterializedIds(ids);
+    if (mergeInfo != null) Expr.getIds(mergeInfo.getOrderingExprs(), null, ids);
+  }
+
   /**
    * Create ExchangeNode that consumes output of inputNode.
    */
@@ -51,6 +72,12 @@ public class ExchangeNode extends PlanNode {
   @Override
   protected void toThrift(TPlanNode msg) {
     msg.node_type = TPlanNodeType.EXCHANGE_NODE;
+    if (mergeInfo != null) {
+      msg.exchange_node = new TExchangeNode();
+      msg.exchange_node.setOrdering_exprs(
+          Expr.treesToThrift(mergeInfo.getOrderingExprs()));
+      msg.exchange_node.setIs_asc_order(mergeInfo.getIsAscOrder());
+    }
   }
 
   @Override
@@ -58,6 +85,22 @@ public class ExchangeNode extends PlanNode {
     StringBuilder output = new StringBuilder();
     output.append(prefix + "EXCHANGE (" + id.toString() + ")");
     output.append("\n");
+    if (mergeInfo != null) {
+      output.append(prefix + "  MERGE ORDER BY: ");
+      Iterator<Expr> expr = mergeInfo.getOrderingExprs().iterator();
+      Iterator<Boolean> isAsc = mergeInfo.getIsAscOrder().iterator();
+      boolean start = true;
+      while (expr.hasNext()) {
+        if (start) {
+          start = false;
+        } else {
+          output.append(", ");
+        }
+        output.append(expr.next().toSql() + " ");
+        output.append(isAsc.next() ? "ASC" : "DESC");
+      }
+      output.append("\n");
+    }
     output.append(super.getExplainString(prefix + "  ", detailLevel));
     return output.toString();
   }
@@ -66,6 +109,7 @@ public class ExchangeNode extends PlanNode {
   protected String debugString() {
     return Objects.toStringHelper(this)
         .add("numSenders", numSenders)
+        .add("isMerging", mergeInfo != null)
         .addValue(super.debugString())
         .toString();
   }
@@ -20,6 +20,7 @@ import java.util.ArrayList;
 import java.util.Arrays;
 import java.util.List;
 import java.util.Map;
+import java.util.TreeSet;
 
 import org.apache.hadoop.conf.Configuration;
 import org.apache.hadoop.hbase.HBaseConfiguration;
@@ -32,8 +33,10 @@ import org.apache.hadoop.hbase.util.Bytes;
 import com.cloudera.impala.analysis.Analyzer;
 import com.cloudera.impala.analysis.BinaryPredicate;
 import com.cloudera.impala.analysis.Expr;
+import com.cloudera.impala.analysis.InPredicate;
 import com.cloudera.impala.analysis.Predicate;
 import com.cloudera.impala.analysis.SlotDescriptor;
+import com.cloudera.impala.analysis.SlotRef;
 import com.cloudera.impala.analysis.StringLiteral;
 import com.cloudera.impala.analysis.TupleDescriptor;
 import com.cloudera.impala.catalog.HBaseColumn;
@@ -68,6 +71,11 @@ public class HBaseScanNode extends ScanNode {
   private byte[] startKey = HConstants.EMPTY_START_ROW;
   private byte[] stopKey = HConstants.EMPTY_END_ROW;
 
+  // Sorted, distinct keys of the rows to look up if the row key is compared with '=' or
+  // IN to constants; null otherwise.  The rows are read with gets instead of scans.
+  // Set in finalize().
+  private List<byte[]> rowKeys = null;
+
   // List of HBase Filters for generating thrift message. Filled in finalize().
   private final List<THBaseFilter> filters = new ArrayList<THBaseFilter>();
 
@@ -100,10 +108,70 @@ public class HBaseScanNode extends ScanNode {
                                   rowRange.upperBoundInclusive);
       }
     }
+    createRowKeys();
     // Convert predicates to HBase filters.
     createHBaseFilters(analyzer);
   }
 
+  /**
+   * Sets rowKeys if the row key is bound to a single value by an '=' predicate, which
+   * finalize() turned into the key range, or to a list of values by an IN predicate
+   * in conjuncts. The IN predicate is removed from the conjuncts, since the gets
+   * return exactly the rows it selects, and start-/stopKey are narrowed to the keys.
+   */
+  private void createRowKeys() {
+    if (keyRanges != null) {
+      ValueRange rowRange = keyRanges.get(0);
+      if (rowRange.lowerBound != null && rowRange.lowerBound == rowRange.upperBound
+          && rowRange.lowerBoundInclusive && rowRange.upperBoundInclusive) {
+        rowKeys = Lists.newArrayList(startKey);
+        return;
+      }
+    }
+    SlotDescriptor keySlot = null;
+    for (SlotDescriptor slot: desc.getSlots()) {
+      if (slot.getColumn() != null && slot.getColumn().getPosition() == 0) {
+        keySlot = slot;
+        break;
+      }
+    }
+    // Like for the key range, only string-mapped keys are stored in their ascii form.
+    if (keySlot == null || keySlot.getType() != PrimitiveType.STRING) return;
+
+    for (Predicate p: conjuncts) {
+      if (!(p instanceof InPredicate)) continue;
+      InPredicate inPred = (InPredicate) p;
+      if (inPred.isNotIn() || !(inPred.getChild(0) instanceof SlotRef)
+          || !((SlotRef) inPred.getChild(0)).getId().equals(keySlot.getId())) {
+        continue;
+      }
+      TreeSet<byte[]> keys = new TreeSet<byte[]>(Bytes.BYTES_COMPARATOR);
+      boolean allLiterals = true;
+      for (int i = 1; i < inPred.getChildren().size(); ++i) {
+        if (!(inPred.getChild(i) instanceof StringLiteral)) {
+          allLiterals = false;
+          break;
+        }
+        byte[] key = Bytes.toBytes(((StringLiteral) inPred.getChild(i)).getValue());
+        // Drop the keys outside of the key range of the other key predicates.
+        if (Bytes.compareTo(key, startKey) < 0) continue;
+        if (!Bytes.equals(stopKey, HConstants.EMPTY_END_ROW)
+            && Bytes.compareTo(key, stopKey) >= 0) {
+          continue;
+        }
+        keys.add(key);
+      }
+      // Without keys, leave the predicate to the scan of the key range, so that there
+      // still is a scan range.
+      if (!allLiterals || keys.isEmpty()) continue;
+      rowKeys = Lists.newArrayList(keys);
+      startKey = keys.first();
+      stopKey = convertToBytes(Bytes.toString(keys.last()), true);
+      conjuncts.remove(p);
+      return;
+    }
+  }
+
   @Override
   protected String debugString() {
     HBaseTable tbl = (HBaseTable) desc.getTable();
@@ -190,6 +258,7 @@ public class HBaseScanNode extends ScanNode {
     // Convert list of HRegionLocation to Map<hostport, List<HRegionLocation>>.
     // The List<HRegionLocations>'s end up being sorted by start key/end key, because
     // regionsLoc is sorted that way.
+    if (rowKeys != null) return getRowKeyScanRangeLocations(regionsLoc);
     Map<String, List<HRegionLocation>> locationMap = Maps.newHashMap();
     for (HRegionLocation regionLoc: regionsLoc) {
       String locHostPort = regionLoc.getHostnamePort();
@@ -202,41 +271,63 @@ public class HBaseScanNode extends ScanNode {
 
     List<TScanRangeLocations> result = Lists.newArrayList();
     for (Map.Entry<String, List<HRegionLocation>> locEntry: locationMap.entrySet()) {
-      // HBaseTableScanner(backend) initializes a result scanner for each key range.
-      // To minimize # of result scanner re-init, create only a single HBaseKeyRange
-      // for all adjacent regions on this server.
-      THBaseKeyRange keyRange = null;
-      byte[] prevEndKey = null;
+      // Create one HBaseKeyRange (and TScanRange2/TScanRangeLocations to go with it)
+      // per region, so that HBaseScanNode(backend) can scan the regions of a server
+      // concurrently.
       for (HRegionLocation regionLoc: locEntry.getValue()) {
-        byte[] curRegStartKey = regionLoc.getRegionInfo().getStartKey();
-        byte[] curRegEndKey   = regionLoc.getRegionInfo().getEndKey();
-        if (prevEndKey != null &&
-            Bytes.compareTo(prevEndKey, curRegStartKey) == 0) {
-          // the current region starts where the previous one left off;
-          // extend the key range
-          setKeyRangeEnd(keyRange, curRegEndKey);
-        } else {
-          // create a new HBaseKeyRange (and TScanRange2/TScanRangeLocations to go
-          // with it).
-          keyRange = new THBaseKeyRange();
-          setKeyRangeStart(keyRange, curRegStartKey);
-          setKeyRangeEnd(keyRange, curRegEndKey);
-
-          TScanRangeLocations scanRangeLocation = new TScanRangeLocations();
-          scanRangeLocation.addToLocations(
-              new TScanRangeLocation(addressToTHostPort(locEntry.getKey())));
-          result.add(scanRangeLocation);
-
-          TScanRange scanRange = new TScanRange();
-          scanRange.setHbase_key_range(keyRange);
-          scanRangeLocation.setScan_range(scanRange);
-        }
-        prevEndKey = curRegEndKey;
+        THBaseKeyRange keyRange = new THBaseKeyRange();
+        setKeyRangeStart(keyRange, regionLoc.getRegionInfo().getStartKey());
+        setKeyRangeEnd(keyRange, regionLoc.getRegionInfo().getEndKey());
+        keyRange.setRegionServer(locEntry.getKey());
+
+        TScanRangeLocations scanRangeLocation = new TScanRangeLocations();
+        scanRangeLocation.addToLocations(
+            new TScanRangeLocation(addressToTHostPort(locEntry.getKey())));
+        result.add(scanRangeLocation);
+
+        TScanRange scanRange = new TScanRange();
+        scanRange.setHbase_key_range(keyRange);
+        scanRangeLocation.setScan_range(scanRange);
       }
     }
     return result;
   }
 
+  /**
+   * Creates a TScanRange for each region in 'regionsLoc' that contains at least one of
+   * rowKeys, with the keys of that region.  regionsLoc and rowKeys are both sorted.
+   */
+  private List<TScanRangeLocations> getRowKeyScanRangeLocations(
+      List<HRegionLocation> regionsLoc) {
+    List<TScanRangeLocations> result = Lists.newArrayList();
+    int keyIdx = 0;
+    for (HRegionLocation regionLoc: regionsLoc) {
+      byte[] regionEndKey = regionLoc.getRegionInfo().getEndKey();
+      boolean lastRegion = Bytes.equals(regionEndKey, HConstants.EMPTY_END_ROW);
+      THBaseKeyRange keyRange = new THBaseKeyRange();
+      while (keyIdx < rowKeys.size() &&
+          (lastRegion || Bytes.compareTo(rowKeys.get(keyIdx), regionEndKey) < 0)) {
+        keyRange.addToRowKeys(Bytes.toString(rowKeys.get(keyIdx)));
+        ++keyIdx;
+      }
+      if (!keyRange.isSetRowKeys()) continue;
+      List<String> keys = keyRange.getRowKeys();
+      keyRange.setStartKey(keys.get(0));
+      keyRange.setStopKey(
+          Bytes.toString(convertToBytes(keys.get(keys.size() - 1), true)));
+      keyRange.setRegionServer(regionLoc.getHostnamePort());
+
+      TScanRangeLocations scanRangeLocation = new TScanRangeLocations();
+      scanRangeLocation.addToLocations(
+          new TScanRangeLocation(addressToTHostPort(regionLoc.getHostnamePort())));
+      TScanRange scanRange = new TScanRange();
+      scanRange.setHbase_key_range(keyRange);
+      scanRangeLocation.setScan_range(scanRange);
+      result.add(scanRangeLocation);
+    }
+    return result;
+  }
+
   /**
    * Get the corresponding regions for an arbitrary range of keys.
    * TODO: this function will be implemented inside HTable in Dave's patch.
@@ -317,6 +408,13 @@ public class HBaseScanNode extends ScanNode {
     if (!Bytes.equals(stopKey, HConstants.EMPTY_END_ROW)) {
       output.append(prefix + "  STOP KEY: " + printKey(stopKey) + "\n");
     }
+    if (rowKeys != null) {
+      output.append(prefix + "  ROW KEYS (GET):");
+      for (byte[] key: rowKeys) {
+        output.append(" " + printKey(key));
+      }
+      output.append("\n");
+    }
     if (!filters.isEmpty()) {
       output.append(prefix + "  HBASE FILTERS: ");
       if (filters.size() == 1) {
@@ -28,11 +28,15 @@ import com.cloudera.impala.thrift.TPlanNodeType;
 import com.cloudera.impala.thrift.TExplainLevel;
 import com.google.common.base.Objects;
 import com.google.common.base.Preconditions;
+import com.google.common.collect.Lists;
 
 /**
  * Hash join between left child and right child.
  * The right child must be a leaf node, ie, can only materialize
  * a single input tuple.
+ * In a distributed plan, the right input is either broadcast to every instance
+ * of the join, or both inputs are hash-partitioned on their equi-join exprs
+ * (see Planner.createHashJoinFragment()).
  *
  */
 public class HashJoinNode extends PlanNode {
@@ -43,6 +47,19 @@ public class HashJoinNode extends PlanNode {
   // join conjuncts from the JOIN clause that aren't equi-join predicates
   private final List<Predicate> otherJoinConjuncts;
 
+  // If set, the right input is this scan's output, broadcast to every instance
+  // of the join; the backends can then reuse the build rows across queries
+  private HdfsScanNode broadcastBuildScan;
+
+  // If true, the right input is broadcast although the join could also be executed
+  // as a partitioned join; the backends then limit the size of the broadcast build
+  // (see TQueryOptions.max_broadcast_build_bytes)
+  private boolean limitBroadcastBuild = false;
+
+  // Slots of the right input's tuples that aren't referenced by this node or anything
+  // above it (see Planner.setUnusedBuildSlots())
+  private List<SlotId> unusedBuildSlots = Lists.newArrayList();
+
   public HashJoinNode(
       PlanNodeId id, PlanNode outer, PlanNode inner, JoinOperator joinOp,
       List<Pair<Expr, Expr> > eqJoinConjuncts,
@@ -72,6 +89,26 @@ public class HashJoinNode extends PlanNode {
     }
   }
 
+  public JoinOperator getJoinOp() {
+    return joinOp;
+  }
+
+  public List<Pair<Expr, Expr> > getEqJoinConjuncts() {
+    return eqJoinConjuncts;
+  }
+
+  public void setBroadcastBuildScan(HdfsScanNode scan) {
+    broadcastBuildScan = scan;
+  }
+
+  public void setLimitBroadcastBuild(boolean limitBroadcastBuild) {
+    this.limitBroadcastBuild = limitBroadcastBuild;
+  }
+
+  public void setUnusedBuildSlots(List<SlotId> unusedBuildSlots) {
+    this.unusedBuildSlots = unusedBuildSlots;
+  }
+
   @Override
   protected String debugString() {
     return Objects.toStringHelper(this)
@@ -115,6 +152,15 @@ public class HashJoinNode extends PlanNode {
     for (Predicate p: otherJoinConjuncts) {
       msg.hash_join_node.addToOther_join_conjuncts(p.treeToThrift());
     }
+    for (SlotId slotId: unusedBuildSlots) {
+      msg.hash_join_node.addToUnused_build_slots(slotId.asInt());
+    }
+    if (broadcastBuildScan != null) {
+      // the cached rows lack the string data of the unused slots
+      msg.hash_join_node.setBuild_cache_key(
+          broadcastBuildScan.getCacheKey() + " unused=" + unusedBuildSlots);
+    }
+    if (limitBroadcastBuild) msg.hash_join_node.setLimit_broadcast_build(true);
   }
 
   @Override
@@ -16,6 +16,7 @@ package com.cloudera.impala.planner;
 
 import java.io.IOException;
 import java.util.ArrayList;
+import java.util.Collections;
 import java.util.Comparator;
 import java.util.List;
 import java.util.Map;
@@ -27,6 +28,7 @@ import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
 
 import com.cloudera.impala.analysis.Analyzer;
+import com.cloudera.impala.analysis.SlotDescriptor;
 import com.cloudera.impala.analysis.TupleDescriptor;
 import com.cloudera.impala.catalog.HdfsFileFormat;
 import com.cloudera.impala.catalog.HdfsPartition;
@@ -48,6 +50,7 @@ import com.google.common.base.Objects.ToStringHelper;
 import com.google.common.base.Preconditions;
 import com.google.common.collect.Lists;
 import com.google.common.collect.Maps;
+import com.google.common.hash.Hashing;
 
 /**
  * Scan of a single single table. Currently limited to full-table scans.
@@ -61,6 +64,16 @@ public class HdfsScanNode extends ScanNode {
   // Partitions that are filtered in for scanning by the key ranges
   private final ArrayList<HdfsPartition> partitions = Lists.newArrayList();
 
+  // If true, the scan ranges record the bucket of their file, so that this scan is
+  // co-scheduled with the scan it is joined with per bucket
+  // (see Planner.isCoBucketedJoin())
+  private boolean bucketed = false;
+
+  // If samplePercent < 100, only that percentage of the scan ranges is read, selected
+  // by a hash seeded with sampleSeed (see THdfsScanNode.sample_percent)
+  private int samplePercent = 100;
+  private long sampleSeed = 0;
+
   /**
    * Constructs node to scan given data files of table 'tbl'.
    */
@@ -69,6 +82,21 @@ public class HdfsScanNode extends ScanNode {
     this.tbl = tbl;
   }
 
+  public HdfsTable getTable() {
+    return tbl;
+  }
+
+  public void setSample(int samplePercent, long sampleSeed) {
+    Preconditions.checkArgument(samplePercent >= 0 && samplePercent <= 100);
+    this.samplePercent = samplePercent;
+    this.sampleSeed = sampleSeed;
+  }
+
+  public void setBucketed(boolean bucketed) {
+    Preconditions.checkState(!bucketed || tbl.getNumBuckets() > 0);
+    this.bucketed = bucketed;
+  }
+
   @Override
   protected String debugString() {
     ToStringHelper helper = Objects.toStringHelper(this);
@@ -117,9 +145,74 @@ public class HdfsScanNode extends ScanNode {
   protected void toThrift(TPlanNode msg) {
     // TODO: retire this once the migration to the new plan is complete
     msg.hdfs_scan_node = new THdfsScanNode(desc.getId().asInt());
+    if (samplePercent < 100) {
+      msg.hdfs_scan_node.setSample_percent(samplePercent);
+      msg.hdfs_scan_node.setSample_seed(sampleSeed);
+    }
     msg.node_type = TPlanNodeType.HDFS_SCAN_NODE;
   }
 
+  /**
+   * Returns a fingerprint of the rows that this scan returns and of their tuple layout:
+   * two scans with the same key return the same rows in the same layout, though not
+   * necessarily in the same order.  The key covers the materialized slots, the
+   * predicates and limit, and the format and files of each scanned partition with
+   * their lengths and modification times, so that it changes whenever the data does.
+   * Can only be called after finalize() and after the tuple layout was computed.
+   */
+  public String getCacheKey() {
+    StringBuilder key = getRowLayoutKey();
+    for (HdfsPartition partition: partitions) appendPartitionKey(partition, key);
+    return Hashing.sha1().hashString(key).toString();
+  }
+
+  /**
+   * Returns the cache key of the rows of each scanned partition, by partition id: like
+   * getCacheKey(), but covering the files of a single partition, so that a partition's
+   * key only changes with its own files.
+   */
+  public Map<Long, String> getPartitionCacheKeys() {
+    String rowLayoutKey = getRowLayoutKey().toString();
+    Map<Long, String> keys = Maps.newHashMap();
+    for (HdfsPartition partition: partitions) {
+      StringBuilder key = new StringBuilder(rowLayoutKey);
+      appendPartitionKey(partition, key);
+      keys.put(partition.getId(), Hashing.sha1().hashString(key).toString());
+    }
+    return keys;
+  }
+
+  /**
+   * Returns the part of the cache keys that identifies the table, the tuple layout,
+   * the predicates, limit and sampling, but not the files.
+   */
+  private StringBuilder getRowLayoutKey() {
+    StringBuilder key = new StringBuilder();
+    key.append(desc.getTable().getFullName())
+        .append(" size=" + desc.getByteSize())
+        .append(" compact=" + compactData)
+        .append(" limit=" + limit)
+        .append(" sample=" + samplePercent + ":" + sampleSeed)
+        .append(" predicates=" + getExplainString(conjuncts));
+    for (SlotDescriptor slot: desc.getSlots()) {
+      if (!slot.getIsMaterialized()) continue;
+      key.append(" slot=" + slot.getColumn().getName() + ":"
+          + slot.getColumn().getPosition() + ":" + slot.getType() + ":"
+          + slot.getByteOffset() + ":" + slot.getNullIndicatorByte() + ":"
+          + slot.getNullIndicatorBit());
+    }
+    return key;
+  }
+
+  /** Appends the format and the files of 'partition' to 'key'. */
+  private static void appendPartitionKey(HdfsPartition partition, StringBuilder key) {
+    key.append(" partition=" + partition.toThrift());
+    for (HdfsPartition.FileDescriptor fileDesc: partition.getFileDescriptors()) {
+      key.append(" " + fileDesc.getFilePath() + ":" + fileDesc.getFileLength() + ":"
+          + fileDesc.getModificationTime());
+    }
+  }
+
   /**
    * Return scan ranges (hdfs splits) plus their storage locations, including volume
    * ids.
@@ -127,6 +220,20 @@ public class HdfsScanNode extends ScanNode {
   @Override
   public List<TScanRangeLocations> getScanRangeLocations(long maxScanRangeLength) {
     List<TScanRangeLocations> result = Lists.newArrayList();
+    // the bucket of each file is its position among its partition's files in name order
+    Map<String, Integer> fileBuckets = Maps.newHashMap();
+    if (bucketed) {
+      for (HdfsPartition partition: partitions) {
+        List<String> paths = Lists.newArrayList();
+        for (HdfsPartition.FileDescriptor fileDesc: partition.getFileDescriptors()) {
+          paths.add(fileDesc.getFilePath());
+        }
+        Collections.sort(paths);
+        for (int i = 0; i < paths.size(); ++i) {
+          fileBuckets.put(paths.get(i), i);
+        }
+      }
+    }
     List<HdfsTable.BlockMetadata> blockMetadata = HdfsTable.getBlockMetadata(partitions);
     for (HdfsTable.BlockMetadata block: blockMetadata) {
       // collect all locations for block
@@ -170,12 +277,14 @@ public class HdfsScanNode extends ScanNode {
           currentLength = maxScanRangeLength;
         }
         TScanRange scanRange = new TScanRange();
-        scanRange.setHdfs_file_split(
-            new THdfsFileSplit(block.getFileName(), currentOffset,
-              currentLength, block.getPartition().getId()));
+        THdfsFileSplit fileSplit = new THdfsFileSplit(block.getFileName(),
+            currentOffset, currentLength, block.getPartition().getId());
+        fileSplit.setMtime(block.getFileModificationTime());
+        scanRange.setHdfs_file_split(fileSplit);
         TScanRangeLocations scanRangeLocations = new TScanRangeLocations();
         scanRangeLocations.scan_range = scanRange;
         scanRangeLocations.locations = locations;
+        if (bucketed) scanRangeLocations.setBucket(fileBuckets.get(block.getFileName()));
         result.add(scanRangeLocations);
         remainingLength -= currentLength;
         currentOffset += currentLength;
@@ -385,14 +494,16 @@ public class HdfsScanNode extends ScanNode {
     StringBuilder output = new StringBuilder();
     output.append(prefix + "SCAN HDFS table=" + desc.getTable().getFullName());
     output.append(" (" + id + ")");
-    if (compactData) {
-      output.append(" compact\n");
-    } else {
-      output.append("\n");
-    }
+    if (compactData) output.append(" compact");
+    if (bucketed) output.append(" bucketed");
+    output.append("\n");
     if (!conjuncts.isEmpty()) {
       output.append(prefix + "  PREDICATES: " + getExplainString(conjuncts) + "\n");
     }
+    if (samplePercent < 100) {
+      output.append(prefix + "  SAMPLE: " + samplePercent + "% SEED: " + sampleSeed
+          + "\n");
+    }
     output.append(super.getExplainString(prefix + "  ", detailLevel));
     return output.toString();
   }
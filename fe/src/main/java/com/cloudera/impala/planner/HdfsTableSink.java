@@ -35,6 +35,8 @@ public class HdfsTableSink extends TableSink {
   // Whether to overwrite the existing partition(s).
   protected final boolean overwrite;
   protected THdfsFileFormat format;
+  // Whether the rows of each partition arrive consecutively.
+  protected boolean inputIsClustered = false;
 
   public HdfsTableSink(Table targetTable,
       List<Expr> partitionKeyExprs, boolean overwrite) {
@@ -43,11 +45,20 @@ public class HdfsTableSink extends TableSink {
     this.overwrite = overwrite;
   }
 
+  public List<Expr> getPartitionKeyExprs() {
+    return partitionKeyExprs;
+  }
+
+  public void setInputIsClustered(boolean inputIsClustered) {
+    this.inputIsClustered = inputIsClustered;
+  }
+
   @Override
   public String getExplainString(String prefix, TExplainLevel explainLevel) {
     StringBuilder output = new StringBuilder();
     output.append(prefix + "WRITE TO HDFS table=" + targetTable.getFullName() + "\n");
     output.append(prefix + "  OVERWRITE=" + (overwrite ? "true" : "false") + "\n");
+    if (inputIsClustered) output.append(prefix + "  CLUSTERED=true\n");
     if (!partitionKeyExprs.isEmpty()) {
       output.append(prefix + "  PARTITIONS: ");
       for (Expr expr : partitionKeyExprs) {
@@ -64,6 +75,7 @@ public class HdfsTableSink extends TableSink {
     TDataSink result = new TDataSink(TDataSinkType.TABLE_SINK);
     THdfsTableSink hdfsTableSink =
         new THdfsTableSink(Expr.treesToThrift(partitionKeyExprs), overwrite);
+    if (inputIsClustered) hdfsTableSink.setInput_is_clustered(true);
     result.table_sink = new TTableSink(targetTable.getId().asInt(),
         hdfsTableSink);
     return result;
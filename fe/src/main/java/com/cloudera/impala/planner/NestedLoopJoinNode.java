@@ -0,0 +1,113 @@
+// Copyright 2012 Cloudera Inc.
+//
+// Licensed under the Apache License, Version 2.0 (the "License");
+// you may not use this file except in compliance with the License.
+// You may obtain a copy of the License at
+//
+// http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS,
+// WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+// See the License for the specific language governing permissions and
+// limitations under the License.
+
+package com.cloudera.impala.planner;
+
+import java.util.List;
+
+import com.cloudera.impala.analysis.JoinOperator;
+import com.cloudera.impala.analysis.Predicate;
+import com.cloudera.impala.analysis.SlotId;
+import com.cloudera.impala.thrift.TExplainLevel;
+import com.cloudera.impala.thrift.TNestedLoopJoinNode;
+import com.cloudera.impala.thrift.TPlanNode;
+import com.cloudera.impala.thrift.TPlanNodeType;
+import com.google.common.base.Objects;
+import com.google.common.base.Preconditions;
+
+/**
+ * Join between left child and right child that has no equi-join predicates (a cross
+ * join, or e.g. a range or band join): every row of the left input is compared with
+ * every row of the right input, which is kept in memory.
+ * Only joins that produce unmatched rows of the left input at most are supported; in
+ * a distributed plan, the right input is broadcast to every instance of the join
+ * (see Planner.createNestedLoopJoinFragment()).
+ */
+public class NestedLoopJoinNode extends PlanNode {
+  private final JoinOperator joinOp;
+
+  // conjuncts from the JOIN clause
+  private final List<Predicate> joinConjuncts;
+
+  public NestedLoopJoinNode(
+      PlanNodeId id, PlanNode outer, PlanNode inner, JoinOperator joinOp,
+      List<Predicate> joinConjuncts) {
+    super(id);
+    Preconditions.checkArgument(joinConjuncts != null);
+    Preconditions.checkArgument(
+        joinOp == JoinOperator.INNER_JOIN || joinOp == JoinOperator.LEFT_OUTER_JOIN
+        || joinOp == JoinOperator.LEFT_SEMI_JOIN);
+    tupleIds.addAll(outer.getTupleIds());
+    tupleIds.addAll(inner.getTupleIds());
+    this.joinOp = joinOp;
+    this.joinConjuncts = joinConjuncts;
+    children.add(outer);
+    children.add(inner);
+
+    nullableTupleIds.addAll(inner.getNullableTupleIds());
+    nullableTupleIds.addAll(outer.getNullableTupleIds());
+    if (joinOp.equals(JoinOperator.LEFT_OUTER_JOIN)) {
+      nullableTupleIds.addAll(inner.getTupleIds());
+    }
+  }
+
+  public JoinOperator getJoinOp() {
+    return joinOp;
+  }
+
+  @Override
+  protected String debugString() {
+    return Objects.toStringHelper(this)
+        .add("joinOp", joinOp)
+        .addValue(super.debugString())
+        .toString();
+  }
+
+  @Override
+  public void getMaterializedIds(List<SlotId> ids) {
+    super.getMaterializedIds(ids);
+    for (Predicate p: joinConjuncts) {
+      p.getIds(null, ids);
+    }
+  }
+
+  @Override
+  protected void toThrift(TPlanNode msg) {
+    msg.node_type = TPlanNodeType.NESTED_LOOP_JOIN_NODE;
+    msg.nested_loop_join_node = new TNestedLoopJoinNode();
+    msg.nested_loop_join_node.join_op = joinOp.toThrift();
+    for (Predicate p: joinConjuncts) {
+      msg.nested_loop_join_node.addToJoin_conjuncts(p.treeToThrift());
+    }
+  }
+
+  @Override
+  protected String getExplainString(String prefix, TExplainLevel detailLevel) {
+    StringBuilder output = new StringBuilder()
+        .append(prefix + "NESTED LOOP JOIN\n")
+        .append(prefix + "  JOIN OP: " + joinOp.toString() + "\n");
+    if (!joinConjuncts.isEmpty()) {
+      output.append(prefix + "  JOIN PREDICATES: ")
+          .append(getExplainString(joinConjuncts) + "\n");
+    }
+    if (!conjuncts.isEmpty()) {
+      output.append(prefix + "  OTHER PREDICATES: ")
+          .append(getExplainString(conjuncts) + "\n");
+    }
+    output.append(super.getExplainString(prefix + "  ", detailLevel))
+        .append(getChild(0).getExplainString(prefix + "    ", detailLevel))
+        .append(getChild(1).getExplainString(prefix + "    ", detailLevel));
+    return output.toString();
+  }
+}
@@ -82,6 +82,10 @@ public class PlanFragment {
   // if the output is UNPARTITIONED, it is being broadcast
   private DataPartition outputPartition;
 
+  // if true, output rows with NULL partitioning values are spread across the
+  // destinations (see TDataStreamSink.spread_null_keys)
+  private boolean spreadNullKeys = false;
+
   // TODO: SubstitutionMap outputSmap;
   // substitution map to remap exprs onto the output of this fragment, to be applied
   // at destination fragment
@@ -123,6 +127,7 @@ public class PlanFragment {
       // we're streaming to an exchange node
       DataStreamSink streamSink = new DataStreamSink(destNodeId);
       streamSink.setPartition(outputPartition);
+      streamSink.setSpreadNullKeys(spreadNullKeys);
       sink = streamSink;
     }
 
@@ -201,6 +206,10 @@ public class PlanFragment {
     this.outputPartition = outputPartition;
   }
 
+  public void setSpreadNullKeys(boolean spreadNullKeys) {
+    this.spreadNullKeys = spreadNullKeys;
+  }
+
   public PlanNode getPlanRoot() {
     return planRoot;
   }
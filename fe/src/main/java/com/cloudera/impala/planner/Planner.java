@@ -19,6 +19,7 @@ import java.util.ArrayList;
 import java.util.Collections;
 import java.util.List;
 import java.util.ListIterator;
+import java.util.Random;
 
 import org.slf4j.Logger;
 import org.slf4j.LoggerFactory;
@@ -30,17 +31,22 @@ import com.cloudera.impala.analysis.BaseTableRef;
 import com.cloudera.impala.analysis.BinaryPredicate;
 import com.cloudera.impala.analysis.Expr;
 import com.cloudera.impala.analysis.InlineViewRef;
+import com.cloudera.impala.analysis.JoinOperator;
 import com.cloudera.impala.analysis.Predicate;
 import com.cloudera.impala.analysis.QueryStmt;
 import com.cloudera.impala.analysis.SelectStmt;
 import com.cloudera.impala.analysis.SlotDescriptor;
+import com.cloudera.impala.analysis.SlotId;
+import com.cloudera.impala.analysis.SlotRef;
 import com.cloudera.impala.analysis.SortInfo;
 import com.cloudera.impala.analysis.TableRef;
+import com.cloudera.impala.analysis.TableSampleClause;
 import com.cloudera.impala.analysis.TupleDescriptor;
 import com.cloudera.impala.analysis.TupleId;
 import com.cloudera.impala.analysis.UnionStmt;
 import com.cloudera.impala.analysis.UnionStmt.Qualifier;
 import com.cloudera.impala.analysis.UnionStmt.UnionOperand;
+import com.cloudera.impala.catalog.Column;
 import com.cloudera.impala.catalog.HdfsTable;
 import com.cloudera.impala.catalog.PrimitiveType;
 import com.cloudera.impala.common.AnalysisException;
@@ -52,7 +58,10 @@ import com.cloudera.impala.thrift.TExplainLevel;
 import com.cloudera.impala.thrift.TPartitionType;
 import com.cloudera.impala.thrift.TQueryOptions;
 import com.google.common.base.Preconditions;
+import com.google.common.collect.HashMultiset;
 import com.google.common.collect.Lists;
+import com.google.common.collect.Multiset;
+import com.google.common.collect.Sets;
 
 
 /**
@@ -89,6 +98,17 @@ public class Planner {
     Analyzer analyzer = analysisResult.getAnalyzer();
 
     PlanNode singleNodePlan = createSingleNodePlan(queryStmt, analyzer);
+    if (singleNodePlan != null) {
+      Multiset<SlotId> refdIds = HashMultiset.create();
+      List<SlotId> ids = Lists.newArrayList();
+      singleNodePlan.getMaterializedIds(ids);
+      Expr.getIds(queryStmt.getResultExprs(), null, ids);
+      if (analysisResult.isInsertStmt()) {
+        Expr.getIds(analysisResult.getInsertStmt().getPartitionKeyExprs(), null, ids);
+      }
+      refdIds.addAll(ids);
+      setUnusedBuildSlots(singleNodePlan, refdIds, analyzer);
+    }
     //LOG.info("single-node plan:"
         //+ singleNodePlan.getExplainString("", TExplainLevel.VERBOSE));
     ArrayList<PlanFragment> fragments = Lists.newArrayList();
@@ -100,14 +120,17 @@ public class Planner {
       // otherwise merge everything into a single coordinator fragment, so we can
       // pass it back to the client
       createPlanFragments(
-          singleNodePlan, analysisResult.isInsertStmt(), queryOptions.partition_agg,
-          fragments);
+          singleNodePlan, analysisResult.isInsertStmt(), queryOptions, fragments);
     }
 
     PlanFragment rootFragment = fragments.get(fragments.size() - 1);
     if (analysisResult.isInsertStmt()) {
       // set up table sink for root fragment
-      rootFragment.setSink(analysisResult.getInsertStmt().createDataSink());
+      DataSink sink = analysisResult.getInsertStmt().createDataSink();
+      if (queryOptions.clustered_insert && sink instanceof HdfsTableSink) {
+        addClusteringSort(rootFragment, (HdfsTableSink) sink);
+      }
+      rootFragment.setSink(sink);
     }
     // set output exprs before calling finalize()
     rootFragment.setOutputExprs(queryStmt.getResultExprs());
@@ -115,13 +138,38 @@ public class Planner {
     for (PlanFragment fragment: fragments) {
       fragment.finalize(analyzer, !queryOptions.allow_unsupported_formats);
     }
-    // compute mem layout after finalize()
-    analyzer.getDescTbl().computeMemLayout();
+    // compute mem layout after finalize(), with the slots that the plan evaluates
+    // exprs over first
+    List<SlotId> hotSlotIds = Lists.newArrayList();
+    for (PlanFragment fragment: fragments) {
+      fragment.getPlanRoot().getMaterializedIds(hotSlotIds);
+    }
+    analyzer.getDescTbl().computeMemLayout(Sets.newHashSet(hotSlotIds));
 
     Collections.reverse(fragments);
     return fragments;
   }
 
+  /**
+   * Sorts the rows that 'fragment' sends to 'sink' by their non-constant partition
+   * keys, so that the sink only needs one open partition file at a time. Each instance
+   * of the fragment sorts its own rows. Does nothing if the partition keys are all
+   * constant.
+   */
+  private void addClusteringSort(PlanFragment fragment, HdfsTableSink sink) {
+    if (fragment.getPlanRoot() == null) return;
+    List<Expr> orderingExprs = Lists.newArrayList();
+    for (Expr expr: sink.getPartitionKeyExprs()) {
+      if (!expr.isConstant()) orderingExprs.add(expr.clone(null));
+    }
+    if (orderingExprs.isEmpty()) return;
+    List<Boolean> isAscOrder = Collections.nCopies(orderingExprs.size(), true);
+    SortNode sortNode = new SortNode(new PlanNodeId(nodeIdGenerator),
+        fragment.getPlanRoot(), new SortInfo(orderingExprs, isAscOrder), false);
+    fragment.addPlanRoot(sortNode);
+    sink.setInputIsClustered(true);
+  }
+
   /**
    * Return combined explain string for all plan fragments.
    */
@@ -148,17 +196,19 @@ public class Planner {
    * If 'isPartitioned' is false, the returned fragment is unpartitioned;
    * otherwise it may be partitioned, depending on whether its inputs are
    * partitioned; the partitioning function is derived from the inputs.
-   * If partitionAgg is true, AggregationNodes that do grouping are partitioned
-   * on their grouping exprs and placed in a separate fragment.
+   * If queryOptions.partition_agg is true, AggregationNodes that do grouping are
+   * partitioned on their grouping exprs and placed in a separate fragment.
+   * If queryOptions.partition_join is true, HashJoinNodes are partitioned on their
+   * equi-join exprs and placed in a separate fragment.
    */
   private PlanFragment createPlanFragments(
-      PlanNode root, boolean isPartitioned, boolean partitionAgg,
+      PlanNode root, boolean isPartitioned, TQueryOptions queryOptions,
       ArrayList<PlanFragment> fragments)
       throws InternalException, NotImplementedException {
     ArrayList<PlanFragment> childFragments = Lists.newArrayList();
     for (PlanNode child: root.getChildren()) {
       // allow child fragments to be partitioned; merge later if needed
-      childFragments.add(createPlanFragments(child, true, partitionAgg, fragments));
+      childFragments.add(createPlanFragments(child, true, queryOptions, fragments));
     }
 
     PlanFragment result = null;
@@ -168,12 +218,19 @@ public class Planner {
     } else if (root instanceof HashJoinNode) {
       Preconditions.checkState(childFragments.size() == 2);
       result = createHashJoinFragment(
-          (HashJoinNode) root, childFragments.get(1), childFragments.get(0), fragments);
+          (HashJoinNode) root, childFragments.get(1), childFragments.get(0),
+          queryOptions.partition_join, fragments);
+    } else if (root instanceof NestedLoopJoinNode) {
+      Preconditions.checkState(childFragments.size() == 2);
+      result = createNestedLoopJoinFragment(
+          (NestedLoopJoinNode) root, childFragments.get(1), childFragments.get(0),
+          fragments);
     } else if (root instanceof MergeNode) {
       result = createMergeNodeFragment((MergeNode) root, childFragments);
     } else if (root instanceof AggregationNode) {
       result = createAggregationFragment(
-          (AggregationNode) root, childFragments.get(0), partitionAgg, fragments);
+          (AggregationNode) root, childFragments.get(0), queryOptions.partition_agg,
+          fragments);
     } else if (root instanceof SortNode) {
       result = createTopnFragment((SortNode) root, childFragments.get(0), fragments);
     } else {
@@ -192,6 +249,39 @@ public class Planner {
     return result;
   }
 
+  /**
+   * Sets the unused build slots of the HashJoinNodes in the tree rooted at 'node': the
+   * slots of a join's right input tuples that are only referenced within the right
+   * input (e.g. by its scan predicates).  'refdIds' holds the slots referenced by the
+   * exprs of the whole plan and its result exprs, a slot once per referencing node.
+   * Must be called on the single-node plan; the distributed plan keeps its nodes and
+   * their exprs.
+   */
+  private void setUnusedBuildSlots(
+      PlanNode node, Multiset<SlotId> refdIds, Analyzer analyzer) {
+    if (node instanceof HashJoinNode) {
+      PlanNode buildNode = node.getChild(1);
+      Multiset<SlotId> buildRefdIds = HashMultiset.create();
+      List<SlotId> ids = Lists.newArrayList();
+      buildNode.getMaterializedIds(ids);
+      buildRefdIds.addAll(ids);
+      List<SlotId> unusedSlots = Lists.newArrayList();
+      for (TupleId tupleId: buildNode.getTupleIds()) {
+        TupleDescriptor tupleDesc = analyzer.getDescTbl().getTupleDesc(tupleId);
+        for (SlotDescriptor slotDesc: tupleDesc.getSlots()) {
+          SlotId slotId = slotDesc.getId();
+          if (refdIds.count(slotId) == buildRefdIds.count(slotId)) {
+            unusedSlots.add(slotId);
+          }
+        }
+      }
+      ((HashJoinNode) node).setUnusedBuildSlots(unusedSlots);
+    }
+    for (PlanNode child: node.getChildren()) {
+      setUnusedBuildSlots(child, refdIds, analyzer);
+    }
+  }
+
   /**
    * Return unpartitioned fragment that merges the input fragment's output.
    * Requires that input fragment be partitioned.
@@ -204,9 +294,14 @@ public class Planner {
     PlanNode mergePlan = new ExchangeNode(
         new PlanNodeId(nodeIdGenerator), inputFragment.getPlanRoot(), false);
     PlanNodeId exchId = mergePlan.getId();
-    if (inputFragment.getPlanRoot() instanceof AggregationNode) {
+    // the instances of an aggregation fragment that is partitioned on its grouping
+    // exprs produce final results for disjoint sets of groups; we only need to
+    // merge their output streams (the exchange node inherits the limit)
+    if (inputFragment.getPlanRoot() instanceof AggregationNode
+        && !isPartitionedOnGroupingExprs(inputFragment)) {
       // insert merge aggregation
       AggregationNode aggNode = (AggregationNode) inputFragment.getPlanRoot();
+      aggNode.unsetNeedsFinalize();
       mergePlan =
           new AggregationNode(new PlanNodeId(nodeIdGenerator), mergePlan,
                               aggNode.getAggInfo().getMergeAggInfo());
@@ -220,6 +315,18 @@ public class Planner {
     return fragment;
   }
 
+  /**
+   * Returns true if 'fragment' is hash-partitioned on the grouping exprs of the
+   * AggregationNode at its root.
+   */
+  private boolean isPartitionedOnGroupingExprs(PlanFragment fragment) {
+    Preconditions.checkState(fragment.getPlanRoot() instanceof AggregationNode);
+    AggregationNode aggNode = (AggregationNode) fragment.getPlanRoot();
+    DataPartition partition = fragment.getDataPartition();
+    return partition.getType() == TPartitionType.HASH_PARTITIONED
+        && partition.getPartitionExprs().equals(aggNode.getAggInfo().getGroupingExprs());
+  }
+
   /**
    * Create new randomly-partitioned fragment containing a single scan node.
    * TODO: take bucketing into account to produce a naturally hash-partitioned
@@ -231,16 +338,125 @@ public class Planner {
   }
 
   /**
-   * Doesn't create a new fragment, but modifies leftChildFragment to execute
-   * a hash join:
+   * Returns a fragment that executes the hash join 'node'.
+   * If both inputs are scans of tables that are bucketed compatibly with the join (see
+   * isCoBucketedJoin()), the join is executed per bucket in the left child fragment,
+   * with the right scan in that fragment as well; no rows are exchanged.
+   * Otherwise, if the left child fragment is partitioned and either partitionJoin is
+   * true or the join needs to produce unmatched rows of the right input (which can't be
+   * done correctly if the right input is broadcast), creates a new fragment
+   * for a partitioned join (see createPartitionedHashJoinFragment()).
+   * Otherwise doesn't create a new fragment, but modifies leftChildFragment to execute
+   * a broadcast join:
    * - the output of the right child fragment is broadcast to the left child fragment
    * - if the output of the right child fragment is partitioned and an aggregation
    *   result (either from TopN- or AggregationNode), creates a merge fragment
    *   prior to broadcasting; this is to avoid recomputation of the merge step
    *   at every receiving backend
+   * - if the join could also be partitioned, the size of its broadcast build is
+   *   limited at runtime (see TQueryOptions.max_broadcast_build_bytes)
    */
   private PlanFragment createHashJoinFragment(
       HashJoinNode node, PlanFragment rightChildFragment,
+      PlanFragment leftChildFragment, boolean partitionJoin,
+      ArrayList<PlanFragment> fragments) {
+    if (isCoBucketedJoin(node, leftChildFragment, rightChildFragment)) {
+      // each instance of the fragment scans the same buckets of both tables
+      ((HdfsScanNode) leftChildFragment.getPlanRoot()).setBucketed(true);
+      ((HdfsScanNode) rightChildFragment.getPlanRoot()).setBucketed(true);
+      fragments.remove(rightChildFragment);
+      leftChildFragment.setPlanRoot(node);
+      return leftChildFragment;
+    }
+
+    JoinOperator joinOp = node.getJoinOp();
+    boolean outputsUnmatchedRightRows =
+        joinOp == JoinOperator.RIGHT_OUTER_JOIN || joinOp == JoinOperator.FULL_OUTER_JOIN;
+    if (leftChildFragment.isPartitioned() && !node.getEqJoinConjuncts().isEmpty()
+        && (partitionJoin || outputsUnmatchedRightRows)) {
+      return createPartitionedHashJoinFragment(
+          node, leftChildFragment, rightChildFragment);
+    }
+
+    PlanNode rightChildRoot = rightChildFragment.getPlanRoot();
+    if (rightChildFragment.isPartitioned()
+        && (rightChildRoot instanceof AggregationNode
+            || rightChildRoot instanceof SortNode)) {
+      rightChildFragment = createMergeFragment(rightChildFragment);
+      fragments.add(rightChildFragment);
+    }
+    if (rightChildRoot instanceof HdfsScanNode) {
+      // every instance of the join receives the complete scan output
+      node.setBroadcastBuildScan((HdfsScanNode) rightChildRoot);
+    }
+    // if the build turns out to be too large to broadcast, the backends fail the query
+    // and it is re-planned with partitionJoin
+    node.setLimitBroadcastBuild(
+        leftChildFragment.isPartitioned() && !node.getEqJoinConjuncts().isEmpty());
+    connectChildFragment(node, 1, leftChildFragment, rightChildFragment);
+    leftChildFragment.setPlanRoot(node);
+    return leftChildFragment;
+  }
+
+  /**
+   * Returns true if both child fragments of the hash join 'node' consist of a scan of a
+   * table with the same number of buckets, and the equi-join conjuncts equate the
+   * bucket columns of the two tables pairwise.  Rows that can match then lie in the
+   * same bucket of both tables, so that the join can be executed by instances that each
+   * scan some of the buckets of both tables (see
+   * Coordinator::ComputeBucketedScanRangeAssignment()).  This holds for all join
+   * operators, including those that return unmatched right rows.
+   */
+  private boolean isCoBucketedJoin(HashJoinNode node, PlanFragment leftChildFragment,
+      PlanFragment rightChildFragment) {
+    if (!(leftChildFragment.getPlanRoot() instanceof HdfsScanNode)
+        || !(rightChildFragment.getPlanRoot() instanceof HdfsScanNode)) {
+      return false;
+    }
+    HdfsScanNode leftScan = (HdfsScanNode) leftChildFragment.getPlanRoot();
+    HdfsScanNode rightScan = (HdfsScanNode) rightChildFragment.getPlanRoot();
+    HdfsTable leftTbl = leftScan.getTable();
+    HdfsTable rightTbl = rightScan.getTable();
+    if (leftTbl.getNumBuckets() == 0
+        || leftTbl.getNumBuckets() != rightTbl.getNumBuckets()
+        || leftTbl.getBucketCols().size() != rightTbl.getBucketCols().size()) {
+      return false;
+    }
+    for (int i = 0; i < leftTbl.getBucketCols().size(); ++i) {
+      Column leftCol = leftTbl.getBucketCols().get(i);
+      Column rightCol = rightTbl.getBucketCols().get(i);
+      // the bucket of a value depends on its type
+      if (leftCol.getType() != rightCol.getType()) return false;
+      boolean isJoinedOn = false;
+      for (Pair<Expr, Expr> pair: node.getEqJoinConjuncts()) {
+        if (isSlotRefOf(pair.first, leftScan, leftCol)
+            && isSlotRefOf(pair.second, rightScan, rightCol)) {
+          isJoinedOn = true;
+          break;
+        }
+      }
+      if (!isJoinedOn) return false;
+    }
+    return true;
+  }
+
+  /**
+   * Returns true if 'expr' is a reference to column 'col' of the tuple of 'scan'.
+   */
+  private boolean isSlotRefOf(Expr expr, HdfsScanNode scan, Column col) {
+    if (!(expr instanceof SlotRef)) return false;
+    SlotDescriptor slotDesc = ((SlotRef) expr).getDesc();
+    return slotDesc.getColumn() == col
+        && slotDesc.getParent().getId().equals(scan.getTupleIds().get(0));
+  }
+
+  /**
+   * Returns a fragment that executes the nested-loop join 'node'.  Without equi-join
+   * exprs to partition on, the join is always executed as a broadcast join in
+   * leftChildFragment (see createHashJoinFragment()).
+   */
+  private PlanFragment createNestedLoopJoinFragment(
+      NestedLoopJoinNode node, PlanFragment rightChildFragment,
       PlanFragment leftChildFragment, ArrayList<PlanFragment> fragments) {
     PlanNode rightChildRoot = rightChildFragment.getPlanRoot();
     if (rightChildFragment.isPartitioned()
@@ -254,6 +470,41 @@ public class Planner {
     return leftChildFragment;
   }
 
+  /**
+   * Creates a new fragment that executes 'node' as a partitioned join:
+   * both child fragments hash-partition their output on their respective
+   * equi-join exprs, so that each instance of the join fragment only receives
+   * (and builds a hash table for) 1/N of the right input.
+   * The new fragment is hash-partitioned on the left-hand side join exprs.
+   */
+  private PlanFragment createPartitionedHashJoinFragment(
+      HashJoinNode node, PlanFragment leftChildFragment,
+      PlanFragment rightChildFragment) {
+    // the join exprs have been cast to compatible types during analysis, so
+    // matching lhs and rhs values hash to the same partition
+    List<Expr> lhsJoinExprs = Lists.newArrayList();
+    List<Expr> rhsJoinExprs = Lists.newArrayList();
+    for (Pair<Expr, Expr> pair: node.getEqJoinConjuncts()) {
+      lhsJoinExprs.add(pair.first.clone(null));
+      rhsJoinExprs.add(pair.second.clone(null));
+    }
+    DataPartition lhsPartition =
+        new DataPartition(TPartitionType.HASH_PARTITIONED, lhsJoinExprs);
+    DataPartition rhsPartition =
+        new DataPartition(TPartitionType.HASH_PARTITIONED, rhsJoinExprs);
+
+    PlanFragment joinFragment = new PlanFragment(node, lhsPartition);
+    connectChildFragment(node, 0, joinFragment, leftChildFragment);
+    connectChildFragment(node, 1, joinFragment, rightChildFragment);
+    leftChildFragment.setOutputPartition(lhsPartition);
+    rightChildFragment.setOutputPartition(rhsPartition);
+    // rows with a NULL join value never match, so they needn't all go to the
+    // same join instance; spreading them avoids skew on NULL-heavy join columns
+    leftChildFragment.setSpreadNullKeys(true);
+    rightChildFragment.setSpreadNullKeys(true);
+    return joinFragment;
+  }
+
   /**
    * Creates an unpartitioned fragment that merges the outputs of all of its children
    * (with a single ExchangeNode), corresponding to the 'mergeNode' of the
@@ -327,13 +578,19 @@ public class Planner {
 
   /**
    * Returns a fragment that materializes the aggregation result of 'node'.
-   * If partitionAgg is true, the result fragment will be partitioned on the
-   * grouping exprs of 'node'; if partitionAgg is false, the result fragment will be
-   * unpartitioned.
+   * If the child fragment is partitioned, 'node' is placed in the child fragment
+   * as a pre-aggregation, and a new fragment merges the pre-aggregated results.
+   * If partitionAgg is true, the child fragment's output is hash-partitioned
+   * on the grouping exprs and the result fragment is partitioned accordingly, ie,
+   * each of its instances merges a disjoint set of groups; if partitionAgg is false,
+   * the result fragment will be unpartitioned.
    * If 'node' is phase 1 of a 2-phase DISTINCT aggregation, this will simply
    * add 'node' to the child fragment and return the child fragment; the new
    * fragment will be created by the subsequent call of createAggregationFragment()
    * for the phase 2 AggregationNode.
+   * If 'node' computes DISTINCT aggregate functions in a single phase, it can't be
+   * pre-aggregated; it is placed in a new fragment that receives the child fragment's
+   * output, hash-partitioned on the grouping exprs if partitionAgg is true.
    */
   private PlanFragment createAggregationFragment(AggregationNode node,
       PlanFragment childFragment, boolean partitionAgg,
@@ -358,11 +615,15 @@ public class Planner {
       partitionAgg = false;
     }
 
-    DataPartition partition = null;
-    if (partitionAgg) {
-      partition = new DataPartition(TPartitionType.HASH_PARTITIONED, groupingExprs);
-    } else {
-      partition = DataPartition.UNPARTITIONED;
+    if (node.getAggInfo().isSinglePhaseDistinctAgg()) {
+      // all input rows of a group need to reach the same instance
+      DataPartition partition = partitionAgg
+          ? new DataPartition(TPartitionType.HASH_PARTITIONED, groupingExprs)
+          : DataPartition.UNPARTITIONED;
+      childFragment.setOutputPartition(partition);
+      PlanFragment aggFragment = createParentFragment(childFragment, partition);
+      aggFragment.addPlanRoot(node);
+      return aggFragment;
     }
 
     // is 'node' the 2nd phase of a DISTINCT aggregation?
@@ -370,9 +631,25 @@ public class Planner {
         node.getChild(0) instanceof AggregationNode
           && ((AggregationNode)(node.getChild(0))).getAggInfo().isDistinctAgg();
 
+    // The partition exprs are evaluated over the output of the child fragment,
+    // which is the pre-aggregated agg tuple; for the 2nd phase of a DISTINCT
+    // aggregation, the grouping exprs already reference that tuple; otherwise,
+    // the grouping exprs of the merge aggregation do.
+    DataPartition partition = null;
+    if (partitionAgg) {
+      ArrayList<Expr> partitionExprs = is2ndPhaseDistinctAgg
+          ? groupingExprs : node.getAggInfo().getMergeAggInfo().getGroupingExprs();
+      partition = new DataPartition(TPartitionType.HASH_PARTITIONED, partitionExprs);
+    } else {
+      partition = DataPartition.UNPARTITIONED;
+    }
+
     if (is2ndPhaseDistinctAgg) {
       Preconditions.checkState(node.getChild(0) == childFragment.getPlanRoot());
-      // place a merge aggregation step for the 1st phase in a new fragment
+      // the 1st phase is split into a pre-aggregation in the child fragment
+      // and a merge aggregation step in a new fragment
+      ((AggregationNode)(node.getChild(0))).unsetNeedsFinalize();
+      childFragment.setOutputPartition(partition);
       PlanFragment aggFragment = createParentFragment(childFragment, partition);
       AggregateInfo mergeAggInfo =
           ((AggregationNode)(node.getChild(0))).getAggInfo().getMergeAggInfo();
@@ -388,8 +665,11 @@ public class Planner {
       // TODO: transfer having predicates
       return aggFragment;
     } else {
-      // place the original aggregation in the child fragment
+      // place the original aggregation in the child fragment; it only computes
+      // intermediate results, which are finalized by the merge aggregation
       childFragment.addPlanRoot(node);
+      node.unsetNeedsFinalize();
+      childFragment.setOutputPartition(partition);
       // if there is a limit, we need to transfer it from the pre-aggregation
       // node in the child fragment to the merge aggregation node in the parent
       long limit = node.getLimit();
@@ -411,16 +691,15 @@ public class Planner {
   }
 
   /**
-   * Returns a fragment that outputs the result of 'node'.
-   * - if the child fragment is unpartitioned, adds the top-n computation to the child
+   * Returns a fragment that outputs the result of 'node' (a top-n or a full sort).
+   * - if the child fragment is unpartitioned, adds the sort computation to the child
    *   fragment
+   * - for a top-n over a partitioned child fragment whose output is final (ie, not
+   *   a pre-aggregation), adds the top-n to the child fragment, so that each instance
+   *   only sends its first 'limit' rows, and creates a new unpartitioned fragment
+   *   with a merging exchange (with the same limit) that combines them
    * - otherwise it creates a new unpartitioned fragment that merges
-   *   the output of the child and does the top-n computation
-   *
-   * TODO: recognize whether the child fragment's partition is compatible with the
-   * required partition for a distributed top-n computation; doing a distributed
-   * top-n computation doesn't save cycles, but the pre-aggregation step reduces the
-   * output.
+   *   the output of the child and does the sort computation
    */
   private PlanFragment createTopnFragment(SortNode node,
       PlanFragment childFragment, ArrayList<PlanFragment> fragments) {
@@ -429,6 +708,23 @@ public class Planner {
       return childFragment;
     }
 
+    PlanNode childRoot = childFragment.getPlanRoot();
+    boolean needsMergeAgg = childRoot instanceof AggregationNode
+        && !isPartitionedOnGroupingExprs(childFragment);
+    if (node.useTopN() && !needsMergeAgg) {
+      // distributed top-n: per-instance top-n, then merge the sorted streams
+      Preconditions.checkState(node.getLimit() != -1);
+      childFragment.addPlanRoot(node);
+      ExchangeNode mergeExchNode =
+          new ExchangeNode(new PlanNodeId(nodeIdGenerator), node, false);
+      mergeExchNode.setMergeInfo(node.getSortInfo());
+      PlanFragment result =
+          new PlanFragment(mergeExchNode, DataPartition.UNPARTITIONED);
+      childFragment.setDestination(result, mergeExchNode.getId());
+      childFragment.setOutputPartition(DataPartition.UNPARTITIONED);
+      return result;
+    }
+
     // we're doing top-n in a single unpartitioned new fragment
     // that merges the output of childFragment
     PlanFragment result = createMergeFragment(childFragment);
@@ -456,7 +752,6 @@ public class Planner {
   /**
    * Create tree of PlanNodes that implements the Select/Project/Join/Group by/Having
    * of the selectStmt query block.
-   * @throws NotImplementedException if selectStmt contains Order By clause w/o Limit
    */
   private PlanNode createSelectPlan(SelectStmt selectStmt, Analyzer analyzer)
       throws NotImplementedException, InternalException {
@@ -484,17 +779,12 @@ public class Planner {
       root.getChildren().get(1).setCompactData(true);
     }
 
-    if (selectStmt.getSortInfo() != null && selectStmt.getLimit() == -1) {
-      // TODO: only use topN if the memory footprint is expected to be low;
-      // how to account for strings?
-      throw new NotImplementedException(
-          "ORDER BY without LIMIT currently not supported");
-    }
-
     // add aggregation, if required
     AggregateInfo aggInfo = selectStmt.getAggInfo();
     if (aggInfo != null) {
+      boolean inputIsSorted = isSortedOn(root, aggInfo.getGroupingExprs());
       root = new AggregationNode(new PlanNodeId(nodeIdGenerator), root, aggInfo);
+      ((AggregationNode) root).setInputIsSorted(inputIsSorted);
       // if we're computing DISTINCT agg fns, the analyzer already created the
       // 2nd phase agginfo
       if (aggInfo.isDistinctAgg()) {
@@ -513,8 +803,12 @@ public class Planner {
     // add order by and limit
     SortInfo sortInfo = selectStmt.getSortInfo();
     if (sortInfo != null) {
-      Preconditions.checkState(selectStmt.getLimit() != -1);
-      root = new SortNode(new PlanNodeId(nodeIdGenerator), root, sortInfo, true);
+      // without a limit, the input might not fit in memory and we need a full
+      // (external) sort rather than a top-n
+      // TODO: only use topN if the memory footprint is expected to be low;
+      // how to account for strings?
+      boolean useTopN = selectStmt.getLimit() != -1;
+      root = new SortNode(new PlanNodeId(nodeIdGenerator), root, sortInfo, useTopN);
     }
     root.setLimit(selectStmt.getLimit());
 
@@ -632,8 +926,17 @@ public class Planner {
     ScanNode scanNode = null;
 
     if (tblRef.getTable() instanceof HdfsTable) {
-      scanNode = new HdfsScanNode(new PlanNodeId(nodeIdGenerator), tblRef.getDesc(),
-          (HdfsTable)tblRef.getTable());
+      HdfsScanNode hdfsScanNode = new HdfsScanNode(new PlanNodeId(nodeIdGenerator),
+          tblRef.getDesc(), (HdfsTable)tblRef.getTable());
+      TableSampleClause sampleClause = tblRef instanceof BaseTableRef
+          ? ((BaseTableRef) tblRef).getSampleClause() : null;
+      if (sampleClause != null) {
+        // all instances of the scan must select ranges with the same seed
+        long seed = sampleClause.getSeed() != null
+            ? sampleClause.getSeed() : new Random().nextLong();
+        hdfsScanNode.setSample((int) sampleClause.getPercent(), seed);
+      }
+      scanNode = hdfsScanNode;
     } else {
       // HBase table
       scanNode = new HBaseScanNode(new PlanNodeId(nodeIdGenerator), tblRef.getDesc());
@@ -731,7 +1034,8 @@ public class Planner {
   }
 
   /**
-   * Create HashJoinNode to join outer with inner.
+   * Create HashJoinNode to join outer with inner, or a NestedLoopJoinNode if there
+   * are no equi-join predicates between them.
    */
   private PlanNode createHashJoinNode(
       Analyzer analyzer, PlanNode outer, TableRef innerRef)
@@ -745,15 +1049,23 @@ public class Planner {
     List<Predicate> eqJoinPredicates = Lists.newArrayList();
     getHashLookupJoinConjuncts(
         analyzer, outer.getTupleIds(), innerRef, eqJoinConjuncts, eqJoinPredicates);
+    PlanNode result;
     if (eqJoinPredicates.isEmpty()) {
-      throw new NotImplementedException(
-          "Join requires at least one equality predicate between the two tables.");
+      JoinOperator joinOp = innerRef.getJoinOp();
+      if (joinOp == JoinOperator.RIGHT_OUTER_JOIN
+          || joinOp == JoinOperator.FULL_OUTER_JOIN) {
+        throw new NotImplementedException(
+            "Join requires at least one equality predicate between the two tables.");
+      }
+      result = new NestedLoopJoinNode(
+          new PlanNodeId(nodeIdGenerator), outer, inner, joinOp,
+          innerRef.getOtherJoinConjuncts());
+    } else {
+      result = new HashJoinNode(
+          new PlanNodeId(nodeIdGenerator), outer, inner, innerRef.getJoinOp(),
+          eqJoinConjuncts, innerRef.getOtherJoinConjuncts());
+      analyzer.markConjunctsAssigned(eqJoinPredicates);
     }
-    HashJoinNode result =
-        new HashJoinNode(
-            new PlanNodeId(nodeIdGenerator), outer, inner, innerRef.getJoinOp(),
-            eqJoinConjuncts, innerRef.getOtherJoinConjuncts());
-    analyzer.markConjunctsAssigned(eqJoinPredicates);
 
     // The remaining conjuncts that are bound by result.getTupleIds()
     // need to be evaluated explicitly by the hash join.
@@ -764,6 +1076,21 @@ public class Planner {
     return result;
   }
 
+  /**
+   * Returns true if the output of 'node' is sorted on 'exprs', in any order and
+   * direction, so that rows with equal values of 'exprs' are adjacent. This is the
+   * case if 'node' is a sort (e.g. of an inline view with an ORDER BY clause) whose
+   * first ordering exprs are 'exprs'; the distributed plan preserves that order,
+   * since it sorts or merges the output of a SortNode in a single fragment.
+   */
+  private static boolean isSortedOn(PlanNode node, List<Expr> exprs) {
+    if (!(node instanceof SortNode) || exprs == null || exprs.isEmpty()) return false;
+    List<Expr> orderingExprs = ((SortNode) node).getSortInfo().getOrderingExprs();
+    if (orderingExprs.size() < exprs.size()) return false;
+    List<Expr> prefix = orderingExprs.subList(0, exprs.size());
+    return prefix.containsAll(exprs) && exprs.containsAll(prefix);
+  }
+
   /**
    * Create a tree of PlanNodes for the given tblRef, which can be a BaseTableRef or a
    * InlineViewRef
@@ -865,11 +1192,8 @@ public class Planner {
     // Add order by and limit if present.
     SortInfo sortInfo = unionStmt.getSortInfo();
     if (sortInfo != null) {
-      if (unionStmt.getLimit() == -1) {
-        throw new NotImplementedException(
-            "ORDER BY without LIMIT currently not supported");
-      }
-      result = new SortNode(new PlanNodeId(nodeIdGenerator), result, sortInfo, true);
+      boolean useTopN = unionStmt.getLimit() != -1;
+      result = new SortNode(new PlanNodeId(nodeIdGenerator), result, sortInfo, useTopN);
     }
     result.setLimit(unionStmt.getLimit());
 
@@ -48,6 +48,14 @@ public class SortNode extends PlanNode {
     Preconditions.checkArgument(info.getOrderingExprs().size() == info.getIsAscOrder().size());
   }
 
+  public SortInfo getSortInfo() {
+    return info;
+  }
+
+  public boolean useTopN() {
+    return useTopN;
+  }
+
   @Override
   public void getMaterializedIds(List<SlotId> ids) {
     super.getMaterializedIds(ids);
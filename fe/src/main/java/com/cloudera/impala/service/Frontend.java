@@ -99,6 +99,17 @@ public class Frontend {
     this.catalog.close();
   }
 
+  /**
+   * Loads all tables of the catalog that are not loaded yet, starting with
+   * priorityTables (see Catalog.warm()).  Blocks until done; called on a thread of
+   * its own while queries are served.
+   */
+  public void warmCatalog(List<String> priorityTables) {
+    // A reset replaces the catalog and closes this one, which ends the warmup.
+    Catalog currentCatalog = catalog;
+    currentCatalog.warm(priorityTables);
+  }
+
   /**
    * Constructs a TDdlExecRequest and attaches it, plus any metadata, to the
    * result argument.
@@ -18,6 +18,8 @@ import java.util.List;
 import java.util.Map;
 
 import org.apache.hadoop.conf.Configuration;
+import org.apache.hadoop.hdfs.DFSConfigKeys;
+import org.apache.hadoop.hdfs.HdfsConfiguration;
 import org.apache.thrift.TBase;
 import org.apache.thrift.TDeserializer;
 import org.apache.thrift.TException;
@@ -37,6 +39,7 @@ import com.cloudera.impala.thrift.TGetDbsParams;
 import com.cloudera.impala.thrift.TGetDbsResult;
 import com.cloudera.impala.thrift.TGetTablesParams;
 import com.cloudera.impala.thrift.TGetTablesResult;
+import com.google.common.collect.Lists;
 
 /**
  * JNI-callable interface onto a wrapped Frontend instance. The main point is to serialise
@@ -52,10 +55,38 @@ public class JniFrontend {
 
   public JniFrontend() {
     frontend = new Frontend();
+    checkShortCircuitRead();
   }
 
   public JniFrontend(boolean lazy) {
     frontend = new Frontend(lazy);
+    checkShortCircuitRead();
+  }
+
+  /**
+   * The backend reads through libhdfs, which runs the HDFS client in this JVM. If
+   * short-circuit reads are enabled, that client reads node-local block replicas
+   * straight from their files on the local disks, instead of streaming them from the
+   * DataNode over a socket. Logs a warning if they are not enabled, since local scans
+   * are then bounded by the DataNode's copy.
+   */
+  private static void checkShortCircuitRead() {
+    // Unlike Configuration, this also loads hdfs-site.xml.
+    Configuration conf = new HdfsConfiguration();
+    if (!conf.getBoolean(DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_KEY,
+        DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_DEFAULT)) {
+      LOG.warn(DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_KEY + " is not enabled; " +
+          "local HDFS reads will go through the DataNode.");
+      return;
+    }
+    if (!conf.getBoolean(DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_SKIP_CHECKSUM_KEY,
+        DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_SKIP_CHECKSUM_DEFAULT)) {
+      LOG.info("Short-circuit reads are enabled and verify checksums. Set " +
+          DFSConfigKeys.DFS_CLIENT_READ_SHORTCIRCUIT_SKIP_CHECKSUM_KEY +
+          " to skip the checksums.");
+    } else {
+      LOG.info("Short-circuit reads are enabled.");
+    }
   }
 
   /**
@@ -208,4 +239,16 @@ public class JniFrontend {
   public void resetCatalog() {
     frontend.resetCatalog();
   }
+
+  /**
+   * Jni wrapper for Frontend.warmCatalog().  priorityTables is a comma separated list
+   * of "db.table" to load first.
+   */
+  public void warmCatalog(String priorityTables) {
+    List<String> tables = Lists.newArrayList();
+    for (String table: priorityTables.split(",")) {
+      if (!table.trim().isEmpty()) tables.add(table.trim());
+    }
+    frontend.warmCatalog(tables);
+  }
 }
@@ -29,7 +29,8 @@ from ImpalaService import ImpalaService
 from ImpalaService.ImpalaService import TImpalaQueryOptions
 from JavaConstants.constants import DEFAULT_QUERY_OPTIONS
 from thrift.transport.TSocket import TSocket
-from thrift.transport.TTransport import TBufferedTransport, TTransportException
+from thrift.transport.TTransport import TBufferedTransport, TFramedTransport
+from thrift.transport.TTransport import TTransportException
 from thrift.protocol import TBinaryProtocol
 from thrift.Thrift import TApplicationException
 
@@ -69,6 +70,7 @@ class ImpalaShell(cmd.Cmd):
     cmd.Cmd.__init__(self)
     self.is_alive = True
     self.use_kerberos = options.use_kerberos
+    self.use_framed_transport = options.use_framed_transport
     self.verbose = options.verbose
     self.kerberos_service_name = options.kerberos_service_name
     self.impalad = None
@@ -222,11 +224,13 @@ class ImpalaShell(cmd.Cmd):
   def __get_transport(self):
     """Create a Transport.
 
-       A non-kerberized impalad just needs a simple buffered transport. For
-       the kerberized version, a sasl transport is created.
+       A non-kerberized impalad just needs a simple buffered transport, or a framed
+       transport if it runs a nonblocking frontend server. For the kerberized
+       version, a sasl transport is created.
     """
     sock = TSocket(self.impalad[0], int(self.impalad[1]))
     if not self.use_kerberos:
+      if self.use_framed_transport: return TFramedTransport(sock)
       return TBufferedTransport(sock)
     # Initializes a sasl client
     def sasl_factory():
@@ -534,6 +538,9 @@ if __name__ == "__main__":
   parser.add_option("-s", "--kerberos_service_name",
                     dest="kerberos_service_name", default=None,
                     help="Service name of a kerberized impalad, default is 'impala'")
+  parser.add_option("--framed", dest="use_framed_transport", default=False,
+                    action="store_true",
+                    help="Connect to an impalad started with --fe_nonblocking_server")
   parser.add_option("-V", "--verbose", dest="verbose", default=False, action="store_true",
                     help="Enable verbose output")
 
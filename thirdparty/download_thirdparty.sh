@@ -48,6 +48,18 @@ wget http://snappy.googlecode.com/files/snappy-${IMPALA_SNAPPY_VERSION}.tar.gz
 tar xzf snappy-${IMPALA_SNAPPY_VERSION}.tar.gz
 rm snappy-${IMPALA_SNAPPY_VERSION}.tar.gz
 
+echo "Fetching lz4"
+wget -O lz4-${IMPALA_LZ4_VERSION}.tar.gz \
+  https://github.com/lz4/lz4/archive/v${IMPALA_LZ4_VERSION}.tar.gz
+tar xzf lz4-${IMPALA_LZ4_VERSION}.tar.gz
+rm lz4-${IMPALA_LZ4_VERSION}.tar.gz
+
+echo "Fetching zstd"
+wget -O zstd-${IMPALA_ZSTD_VERSION}.tar.gz \
+  https://github.com/facebook/zstd/archive/v${IMPALA_ZSTD_VERSION}.tar.gz
+tar xzf zstd-${IMPALA_ZSTD_VERSION}.tar.gz
+rm zstd-${IMPALA_ZSTD_VERSION}.tar.gz
+
 echo "Fetching cyrus-sasl"
 wget ftp://ftp.andrew.cmu.edu/pub/cyrus-mail/cyrus-sasl-${IMPALA_CYRUS_SASL_VERSION}.tar.gz
 tar xzf cyrus-sasl-${IMPALA_CYRUS_SASL_VERSION}.tar.gz